@@ -0,0 +1,318 @@
+"""Benchmark matrix of picoquicdemo over the kite topology
+
+Sweeps the link parameters of the two client paths (bandwidth, delay, loss, jitter) across plugin variants
+(multipath schedulers, FEC schemes, congestion controls). Each run downloads a file with picoquicdemo -G and
+records its completion time, goodput and the CPU time of the client and of the server in a sqlite database,
+under a label, by default the git revision. The results of a label are then compared to those of a baseline
+label, or of a reference variant, with a permutation test on the medians of the repetitions.
+
+Run from the root of the repository, where picoquicdemo and the plugins are, for instance:
+
+   sudo python benchmarks/benchmark_runner.py --baseline 1a2b3c4
+   python benchmarks/benchmark_runner.py --compare-only --label 5d6e7f8 --baseline 1a2b3c4
+   python benchmarks/benchmark_runner.py --compare-only --reference-variant sp_cubic
+
+The comparisons do not need Mininet, only the database.
+"""
+from __future__ import print_function
+
+import argparse
+import datetime
+import itertools
+import json
+import os
+import random
+import re
+import sqlite3
+import subprocess
+import sys
+import time
+
+DEFAULT_MATRIX = {
+    # The parameters of both paths of the client, all their combinations are run
+    "links": {
+        "bw": [5, 20],  # Mbps
+        "delay_ms": [10, 50],
+        "loss": [0, 1],  # %
+        "jitter_ms": [0, 5],
+    },
+    # The plugins injected at both ends, the congestion control (-g) and whether the client opens a path per address
+    "variants": {
+        "sp_cubic": {"plugins": [], "cc": "cubic"},
+        "sp_bbr": {"plugins": [], "cc": "bbr"},
+        "mp_rr": {"plugins": ["plugins/multipath/multipath_rr.plugin"], "multipath": True},
+        "mp_rtt": {"plugins": ["plugins/multipath/multipath_rtt.plugin"], "multipath": True},
+        "fec_rlc_window": {"plugins": ["plugins/fec/fec_rlc_gf256_window.plugin"]},
+        "fec_rs_block": {"plugins": ["plugins/fec/fec_rs_gf256_block.plugin"]},
+        "mp_rtt_fec_rlc": {"plugins": ["plugins/multipath/multipath_rtt.plugin", "plugins/fec/fec_rlc_gf256_window.plugin"],
+                           "multipath": True},
+    },
+    "file_sizes": [50000, 1000000],
+    "repetitions": 5,
+}
+
+SERVER_ADDR = '10.3.0.2'
+SERVER_PORT = 4443
+
+# For each metric, whether a larger value is better
+METRICS = (
+    ('completion_ms', False),
+    ('goodput_mbps', True),
+    ('client_cpu_s', False),
+    ('server_cpu_s', False),
+)
+
+PERMUTATIONS = 10000
+
+
+def link_key(link):
+    return ','.join('%s=%s' % (k, link[k]) for k in sorted(link.keys()))
+
+
+def link_combinations(links):
+    names = sorted(links.keys())
+    for values in itertools.product(*[links[n] for n in names]):
+        yield dict(zip(names, values))
+
+
+def open_db(filename):
+    conn = sqlite3.connect(filename)
+    conn.execute("""
+        CREATE TABLE IF NOT EXISTS runs (
+          label TEXT NOT NULL,
+          variant TEXT NOT NULL,
+          link TEXT NOT NULL,
+          file_size INTEGER NOT NULL,
+          repetition INTEGER NOT NULL,
+          completion_ms REAL,
+          goodput_mbps REAL,
+          client_cpu_s REAL,
+          server_cpu_s REAL,
+          timestamp TEXT NOT NULL
+        );
+        """)
+    conn.commit()
+    return conn
+
+
+def parse_cpu(text):
+    """ Returns the user + system seconds written by /usr/bin/time -f 'CPU %U %S', or None """
+    m = re.search(r'^CPU ([0-9.]+) ([0-9.]+)$', text or '', re.MULTILINE)
+    return float(m.group(1)) + float(m.group(2)) if m else None
+
+
+def parse_client_output(text):
+    """ Returns the completion time in ms and the goodput in Mbps of a picoquicdemo -G download, or None """
+    received = re.search(r'^(\d+) bytes received$', text, re.MULTILINE)
+    elapsed = re.search(r'^([0-9]+\.[0-9]+) ms$', text, re.MULTILINE)
+    if received is None or elapsed is None or float(elapsed.group(1)) <= 0:
+        return None, None
+    completion_ms = float(elapsed.group(1))
+    return completion_ms, int(received.group(1)) * 8 / (completion_ms * 1000.0)
+
+
+def run_once(net, demo, variant, file_size, timeout):
+    """ Downloads file_size bytes from the web host to the client with the plugins of the variant """
+    client = net['cl']
+    server = net['web']
+    opts = ' '.join('-P %s' % p for p in variant.get('plugins', []))
+    if variant.get('cc'):
+        opts += ' -g %s' % variant['cc']
+
+    server.cmd('rm -f server_time.txt')
+    server.cmd("/usr/bin/time -f 'CPU %%U %%S' -o server_time.txt timeout %d %s -1 -p %d %s > log_server.log 2>&1 &" %
+               (timeout, demo, SERVER_PORT, opts))
+    server_pid = int(server.cmd('echo $!'))
+    time.sleep(1)
+
+    output = client.cmd("/usr/bin/time -f 'CPU %%U %%S' timeout %d %s -G %d %s %s %s %d 2>&1" %
+                        (timeout, demo, file_size, opts, '-M' if variant.get('multipath') else '', SERVER_ADDR, SERVER_PORT))
+    completion_ms, goodput_mbps = parse_client_output(output)
+    client_cpu_s = parse_cpu(output)
+
+    # The server exits after its connection with -1, it is killed if the client gave up
+    for _ in range(10):
+        if server.cmd('kill -0 %d 2>/dev/null; echo $?' % server_pid).strip() != '0':
+            break
+        time.sleep(0.5)
+    else:
+        server.cmd('kill %d' % server_pid)
+        time.sleep(0.5)
+    server_cpu_s = parse_cpu(server.cmd('cat server_time.txt 2>/dev/null'))
+
+    if completion_ms is None:
+        print("The download failed:\n%s" % output)
+    return completion_ms, goodput_mbps, client_cpu_s, server_cpu_s
+
+
+def run_matrix(conn, matrix, label, demo, timeout):
+    from mininet.clean import cleanup as net_cleanup
+    from mininet.link import TCLink
+    from mininet.log import setLogLevel
+    from mininet.net import Mininet
+    from mininet.node import OVSBridge
+
+    from topo_3h_5s_2r_kite import KiteTopo, setup_ips, setup_routes, setup_client_source_routing
+
+    setLogLevel('info')
+    links = list(link_combinations(matrix['links']))
+    nb_runs = len(links) * len(matrix['variants']) * len(matrix['file_sizes']) * matrix['repetitions']
+    run_index = 0
+
+    for link in links:
+        net_cleanup()
+        net = Mininet(KiteTopo(**link), link=TCLink, autoStaticArp=True, switch=OVSBridge, controller=None)
+        net.start()
+        setup_ips(net)
+        setup_routes(net)
+        setup_client_source_routing(net['cl'])
+
+        for name in sorted(matrix['variants'].keys()):
+            for file_size in matrix['file_sizes']:
+                for repetition in range(matrix['repetitions']):
+                    run_index += 1
+                    print("run %d/%d: %s, %s, %d bytes" % (run_index, nb_runs, name, link_key(link), file_size))
+                    values = run_once(net, demo, matrix['variants'][name], file_size, timeout)
+                    conn.execute("INSERT INTO runs VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+                                 (label, name, link_key(link), file_size, repetition) + tuple(values) +
+                                 (datetime.datetime.now().isoformat(),))
+                    conn.commit()
+
+        net['web'].cmd('pkill picoquicdemo')
+        net.stop()
+        net_cleanup()
+
+
+def load_results(conn, label, variant=None):
+    """ Returns the values of each metric, by (variant, link, file_size), of the successful runs of the label """
+    results = {}
+    query = "SELECT variant, link, file_size, %s FROM runs WHERE label = ? AND completion_ms IS NOT NULL" % \
+            ', '.join(m for m, _ in METRICS)
+    args = (label,)
+    if variant is not None:
+        query += " AND variant = ?"
+        args += (variant,)
+    for row in conn.execute(query, args):
+        values = results.setdefault(tuple(row[0:3]), {m: [] for m, _ in METRICS})
+        for (m, _), v in zip(METRICS, row[3:]):
+            if v is not None:
+                values[m].append(v)
+    return results
+
+
+def median(values):
+    s = sorted(values)
+    n = len(s)
+    return (s[n // 2] + s[(n - 1) // 2]) / 2.0
+
+
+def permutation_p_value(a, b):
+    """ Two-sided p-value of the difference of the medians of a and b, exact when there are few permutations """
+    observed = abs(median(a) - median(b))
+    pooled = a + b
+    n = len(pooled)
+    nb_extreme = 0
+    nb_total = 0
+    exact = 1
+    for i in range(len(a)):
+        exact = exact * (n - i) // (i + 1)
+
+    if exact <= PERMUTATIONS:
+        for indexes in itertools.combinations(range(n), len(a)):
+            chosen = set(indexes)
+            pa = [pooled[i] for i in indexes]
+            pb = [pooled[i] for i in range(n) if i not in chosen]
+            nb_extreme += abs(median(pa) - median(pb)) >= observed - 1e-12
+            nb_total += 1
+    else:
+        rng = random.Random(0)
+        for _ in range(PERMUTATIONS):
+            rng.shuffle(pooled)
+            nb_extreme += abs(median(pooled[:len(a)]) - median(pooled[len(a):])) >= observed - 1e-12
+            nb_total += 1
+    return nb_extreme / float(nb_total)
+
+
+def compare(current, baseline, alpha, threshold, title):
+    """ Prints the change of the median of each metric, and returns the number of significant regressions """
+    nb_regressions = 0
+    print("\n%s" % title)
+    print("%-16s %-44s %10s %-14s %12s %12s %9s %8s  %s" %
+          ('variant', 'link', 'size', 'metric', 'baseline', 'current', 'change', 'p', 'verdict'))
+    for key in sorted(current.keys()):
+        if key not in baseline:
+            continue
+        for metric, higher_is_better in METRICS:
+            cur = current[key][metric]
+            base = baseline[key][metric]
+            if len(cur) < 2 or len(base) < 2:
+                continue
+            med_cur = median(cur)
+            med_base = median(base)
+            change = 100.0 * (med_cur - med_base) / med_base if med_base != 0 else 0.0
+            p = permutation_p_value(cur, base)
+            verdict = ''
+            if p < alpha and abs(change) >= threshold:
+                verdict = 'better' if (change > 0) == higher_is_better else 'WORSE'
+                nb_regressions += verdict == 'WORSE'
+            print("%-16s %-44s %10d %-14s %12.3f %12.3f %8.1f%% %8.4f  %s" %
+                  (key[0], key[1], key[2], metric, med_base, med_cur, change, p, verdict))
+    return nb_regressions
+
+
+def git_revision():
+    try:
+        return subprocess.check_output(['git', 'rev-parse', '--short', 'HEAD']).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return 'unknown'
+
+
+def main():
+    dir_path = os.path.dirname(os.path.abspath(__file__))
+    sys.path.append(dir_path)
+
+    parser = argparse.ArgumentParser(description='Runs the benchmark matrix and compares it to a baseline')
+    parser.add_argument('--matrix', help='JSON file replacing the default matrix, with the same keys')
+    parser.add_argument('--db', default=os.path.join(dir_path, 'benchmark_results.sqlite'), help='results database')
+    parser.add_argument('--label', default=None, help='label of the results of this run (default: git revision)')
+    parser.add_argument('--baseline', help='label of the results to compare to')
+    parser.add_argument('--reference-variant', help='compare each variant to this one, within the label')
+    parser.add_argument('--compare-only', action='store_true', help='only compare the results already in the database')
+    parser.add_argument('--demo', default='./picoquicdemo', help='picoquicdemo binary')
+    parser.add_argument('--repetitions', type=int, help='runs of each combination (overrides the matrix)')
+    parser.add_argument('--timeout', type=int, default=120, help='seconds before a run is given up')
+    parser.add_argument('--alpha', type=float, default=0.05, help='significance level of the comparisons')
+    parser.add_argument('--threshold', type=float, default=5.0, help='smallest change of a median to report, in %%')
+    parser.add_argument('--fail-on-regression', action='store_true', help='exit with 1 if a metric got significantly worse')
+    args = parser.parse_args()
+
+    matrix = dict(DEFAULT_MATRIX)
+    if args.matrix:
+        with open(args.matrix) as f:
+            matrix.update(json.load(f))
+    if args.repetitions:
+        matrix['repetitions'] = args.repetitions
+    label = args.label or git_revision()
+
+    conn = open_db(args.db)
+    if not args.compare_only:
+        run_matrix(conn, matrix, label, args.demo, args.timeout)
+
+    nb_regressions = 0
+    current = load_results(conn, label)
+    if args.baseline:
+        nb_regressions += compare(current, load_results(conn, args.baseline), args.alpha, args.threshold,
+                                  "%s compared to %s" % (label, args.baseline))
+    if args.reference_variant:
+        reference = load_results(conn, label, args.reference_variant)
+        for name in sorted(set(k[0] for k in current.keys()) - {args.reference_variant}):
+            variant = {k: v for k, v in current.items() if k[0] == name}
+            baseline = {(name,) + k[1:]: v for k, v in reference.items()}
+            compare(variant, baseline, args.alpha, args.threshold, "%s compared to %s in %s" % (name, args.reference_variant, label))
+    conn.close()
+
+    return 1 if args.fail_on_regression and nb_regressions > 0 else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
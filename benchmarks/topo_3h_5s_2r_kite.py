@@ -55,6 +55,11 @@ class LinuxRouter(Node):
         super(LinuxRouter, self).terminate()
 
 
+def jitter_opts(opts, path):
+    jitter_ms = opts.get('jitter_ms_%s' % path, 0)
+    return {'jitter': '%dms' % jitter_ms} if jitter_ms > 0 else {}
+
+
 class KiteTopo(Topo):
     def build(self, **opts):
         if 'delay_ms' in opts:
@@ -63,6 +68,10 @@ class KiteTopo(Topo):
         if 'bw' in opts:
             opts['bw_a'] = opts['bw']
             opts['bw_b'] = opts['bw']
+        for k in ('loss', 'jitter_ms'):
+            if k in opts:
+                opts['%s_a' % k] = opts[k]
+                opts['%s_b' % k] = opts[k]
 
         generic_opts = {'delay': '5ms', 'max_queue_size': 3 * 174}
         self.r1 = self.addNode('r1', cls=LinuxRouter)
@@ -74,13 +83,13 @@ class KiteTopo(Topo):
 
         if 'bw_b' in opts and 'delay_ms_b' in opts:
             mqs = int(1.5 * (((opts['bw_b'] * 1000000) / 8) / 1500) * (2 * 70 / 1000.0))  # 1.5 * BDP, TODO: This assumes that packet size is 1500 bytes
-            self.addLink(self.s1, self.r1, bw=opts['bw_b'], delay='%dms' % opts['delay_ms_b'], loss=opts.get('loss_b', 0), max_queue_size=mqs, intfName2='r1-eth0')
+            self.addLink(self.s1, self.r1, bw=opts['bw_b'], delay='%dms' % opts['delay_ms_b'], loss=opts.get('loss_b', 0), max_queue_size=mqs, intfName2='r1-eth0', **jitter_opts(opts, 'b'))
         else:
             self.addLink(self.s1, self.r1, intfName2='r1-eth0')
         self.addLink(self.s3, self.r1, intfName2='r1-eth2', **generic_opts)
         if 'bw_a' in opts and 'delay_ms_a' in opts:
             mqs = int(1.5 * (((opts['bw_a'] * 1000000) / 8) / 1500) * (2 * 70 / 1000.0))  # 1.5 * BDP, TODO: This assumes that packet size is 1500 bytes
-            self.addLink(self.s2, self.r2, bw=opts['bw_a'], delay='%dms' % opts['delay_ms_a'], loss=opts.get('loss_a', 0), max_queue_size=mqs, intfName2='r2-eth0')
+            self.addLink(self.s2, self.r2, bw=opts['bw_a'], delay='%dms' % opts['delay_ms_a'], loss=opts.get('loss_a', 0), max_queue_size=mqs, intfName2='r2-eth0', **jitter_opts(opts, 'a'))
         else:
             self.addLink(self.s2, self.r2, intfName2='r1-eth0')
         self.addLink(self.s4, self.r3, intfName2='r3-eth0', **generic_opts)
@@ -166,6 +175,11 @@ def setup_client_tun(nodes, id):
 
     print node.cmd('ip route add {} via {} dev tun0'.format(web_addr, tun_addr[:-3]))
 
+    setup_client_source_routing(node)
+
+
+def setup_client_source_routing(node):
+    """ Sends the packets of each address of the client through its own interface, for the paths of multipath """
     print node.cmd('ip rule add from 10.1.0.2 table 1')
     print node.cmd('ip route add 10.1.0.0/24 dev cl-eth0 scope link table 1')
     print node.cmd('ip route add default via 10.1.0.1 dev cl-eth0 table 1')
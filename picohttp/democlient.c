@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "picoquic_internal.h"
 #include "h3zero.h"
 #include "democlient.h"
@@ -137,6 +138,40 @@ static picoquic_demo_client_stream_ctx_t* picoquic_demo_client_find_stream(
 }
 
 
+/* The generated data is made of lines of 'Z' ended by CRLF. The lines are copied from a page
+ * prepared once, which covers any packet from any offset in a line. */
+#define DEMO_PATTERN_LINE 74
+#define DEMO_PATTERN_PAGE_SIZE (DEMO_PATTERN_LINE * (PICOQUIC_MAX_PACKET_SIZE / DEMO_PATTERN_LINE + 2))
+
+static uint8_t demo_pattern_page[DEMO_PATTERN_PAGE_SIZE];
+static pthread_once_t demo_pattern_once = PTHREAD_ONCE_INIT;
+
+static void demo_pattern_init(void)
+{
+    memset(demo_pattern_page, 0x5A, DEMO_PATTERN_PAGE_SIZE);
+    for (size_t i = DEMO_PATTERN_LINE - 2; i < DEMO_PATTERN_PAGE_SIZE; i += DEMO_PATTERN_LINE) {
+        demo_pattern_page[i] = '\r';
+        demo_pattern_page[i + 1] = '\n';
+    }
+}
+
+static void demo_pattern_copy(uint8_t* buffer, size_t length, size_t offset)
+{
+    size_t page_offset = offset % DEMO_PATTERN_LINE;
+
+    while (length > 0) {
+        size_t chunk = DEMO_PATTERN_PAGE_SIZE - page_offset;
+
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(buffer, demo_pattern_page + page_offset, chunk);
+        buffer += chunk;
+        length -= chunk;
+        page_offset = 0;
+    }
+}
+
 int demo_client_prepare_to_send(void * context, size_t space, size_t echo_length, size_t * echo_sent, FILE * F)
 {
     int ret = 0;
@@ -165,21 +200,8 @@ int demo_client_prepare_to_send(void * context, size_t space, size_t echo_length
                 }
             }
             else {
-                int r = (74 - (*echo_sent % 74)) - 2;
-
-                /* TODO: fill buffer with some text */
-                memset(buffer, 0x5A, available);
-
-                while (r < (int)available) {
-                    if (r >= 0) {
-                        buffer[r] = '\r';
-                    }
-                    r++;
-                    if (r >= 0 && (unsigned int)r < available) {
-                        buffer[r] = '\n';
-                    }
-                    r += 73;
-                }
+                (void)pthread_once(&demo_pattern_once, demo_pattern_init);
+                demo_pattern_copy(buffer, available, *echo_sent);
                 *echo_sent += (uint32_t)available;
                 ret = 0;
             }
@@ -198,7 +220,8 @@ int demo_client_prepare_to_send(void * context, size_t space, size_t echo_length
  */
 
 int h3zero_client_create_stream_request(
-    uint8_t * buffer, size_t max_bytes, uint8_t const * path, size_t path_len, size_t post_size, const char * host, size_t * consumed)
+    uint8_t * buffer, size_t max_bytes, uint8_t const * path, size_t path_len, size_t post_size, const char * host,
+    h3zero_qpack_encoder_t * encoder, uint64_t stream_id, size_t * consumed)
 {
     int ret = 0;
     uint8_t * o_bytes = buffer;
@@ -213,14 +236,9 @@ int h3zero_client_create_stream_request(
         /* Create the request frame for the specified document */
         *o_bytes++ = h3zero_frame_header;
         o_bytes += 2; /* reserve two bytes for frame length */
-        if (post_size == 0) {
-            o_bytes = h3zero_create_request_header_frame(o_bytes, o_bytes_max,
-                (const uint8_t *)path, path_len, host);
-        }
-        else {
-            o_bytes = h3zero_create_post_header_frame(o_bytes, o_bytes_max,
-                (const uint8_t *)path, path_len, host, h3zero_content_type_text_plain);
-        }
+        o_bytes = h3zero_create_request_header_frame_ex(o_bytes, o_bytes_max,
+            (const uint8_t *)path, path_len, host, (post_size == 0) ? h3zero_method_get : h3zero_method_post,
+            h3zero_content_type_text_plain, encoder, stream_id);
     }
 
     if (o_bytes == NULL) {
@@ -262,11 +280,15 @@ int h3zero_client_create_stream_request(
     return ret;
 }
 
-int h3zero_client_init(picoquic_cnx_t* cnx)
+int h3zero_client_init(picoquic_cnx_t* cnx, h3zero_qpack_t * qpack)
 {
     uint8_t decoder_stream_head = 0x03;
     uint8_t encoder_stream_head = 0x02;
-    int ret = picoquic_add_to_stream(cnx, 2, h3zero_default_setting_frame, h3zero_default_setting_frame_size, 0);
+    uint8_t setting_frame[32];
+    uint8_t * setting_frame_end = h3zero_create_setting_frame(setting_frame, setting_frame + sizeof(setting_frame),
+        &qpack->local_settings);
+    int ret = (setting_frame_end == NULL) ? -1 :
+        picoquic_add_to_stream(cnx, 2, setting_frame, setting_frame_end - setting_frame, 0);
 
     /*if (ret == 0) {
 		// set the stream #2 to be the next stream to write!
@@ -274,12 +296,12 @@ int h3zero_client_init(picoquic_cnx_t* cnx)
     }*/
 
     if (ret == 0) {
-        /* set the stream 6 as the encoder stream, although we do not actually create dynamic codes. */
+        /* set the stream 6 as the encoder stream, its instructions follow the requests. */
         ret = picoquic_add_to_stream(cnx, 6, &encoder_stream_head, 1, 0);
     }
 
     if (ret == 0) {
-        /* set the stream 10 as the decoder stream, although we do not actually create dynamic codes. */
+        /* set the stream 10 as the decoder stream, for the acknowledgements of the responses. */
         ret = picoquic_add_to_stream(cnx, 10, &decoder_stream_head, 1, 0);
     }
 
@@ -287,6 +309,23 @@ int h3zero_client_init(picoquic_cnx_t* cnx)
     return ret;
 }
 
+/* The instructions of the encoder and the decoder go on their streams as soon as produced */
+int h3zero_client_flush_qpack(picoquic_cnx_t* cnx, h3zero_qpack_t * qpack)
+{
+    int ret = 0;
+
+    if (qpack->encoder.instructions.length > 0) {
+        ret = picoquic_add_to_stream(cnx, 6, qpack->encoder.instructions.bytes, qpack->encoder.instructions.length, 0);
+        qpack->encoder.instructions.length = 0;
+    }
+    if (ret == 0 && qpack->decoder.instructions.length > 0) {
+        ret = picoquic_add_to_stream(cnx, 10, qpack->decoder.instructions.bytes, qpack->decoder.instructions.length, 0);
+        qpack->decoder.instructions.length = 0;
+    }
+
+    return ret;
+}
+
 /* HTTP 0.9 client. 
  * This is the client that was used for QUIC interop testing prior
  * to availability of HTTP 3.0. It allows for testing transport
@@ -370,6 +409,10 @@ static int picoquic_demo_client_open_stream(picoquic_cnx_t* cnx,
         ctx->first_stream = stream_ctx;
         stream_ctx->stream_id = stream_id + nb_repeat*4u;
         stream_ctx->post_size = post_size;
+        if (ctx->alpn == picoquic_alpn_http_3) {
+            stream_ctx->stream_state.decoder = &ctx->qpack.decoder;
+            stream_ctx->stream_state.stream_id = stream_ctx->stream_id;
+        }
         gettimeofday(&stream_ctx->tv_start, NULL);
 
         if (ctx->no_disk) {
@@ -437,7 +480,8 @@ static int picoquic_demo_client_open_stream(picoquic_cnx_t* cnx,
         switch (ctx->alpn) {
         case picoquic_alpn_http_3:
             ret = h3zero_client_create_stream_request(
-                buffer, sizeof(buffer), path, path_len, post_size, cnx->sni, &request_length);
+                buffer, sizeof(buffer), path, path_len, post_size, cnx->sni, &ctx->qpack.encoder,
+                stream_ctx->stream_id, &request_length);
             break;
         case picoquic_alpn_http_0_9:
         default:
@@ -454,6 +498,9 @@ static int picoquic_demo_client_open_stream(picoquic_cnx_t* cnx,
             if (post_size > 0) {
                 ret = picoquic_mark_active_stream(cnx, stream_id, 1, stream_ctx);
             }
+            if (ret == 0 && ctx->alpn == picoquic_alpn_http_3) {
+                ret = h3zero_client_flush_qpack(cnx, &ctx->qpack);
+            }
         }
 
         if (cnx->quic->F_log) {
@@ -501,7 +548,10 @@ int picoquic_demo_client_start_streams(picoquic_cnx_t* cnx,
     if (fin_stream_id == PICOQUIC_DEMO_STREAM_ID_INITIAL) {
         switch (ctx->alpn) {
         case picoquic_alpn_http_3:
-            ret = h3zero_client_init(cnx);
+            ret = h3zero_qpack_init(&ctx->qpack, &ctx->qpack_settings);
+            if (ret == 0) {
+                ret = h3zero_client_init(cnx, &ctx->qpack);
+            }
             break;
         default:
             break;
@@ -555,6 +605,123 @@ int picoquic_demo_client_open_stream_file(picoquic_cnx_t* cnx, picoquic_demo_cal
     return ret;
 }
 
+/* Parses the frames received on a request stream, writing the data of the response */
+static int picoquic_demo_client_h3_data(picoquic_cnx_t* cnx, picoquic_demo_callback_ctx_t* ctx,
+    picoquic_demo_client_stream_ctx_t* stream_ctx, uint8_t* bytes, size_t length)
+{
+    int ret = 0;
+    uint64_t stream_id = stream_ctx->stream_id;
+    uint16_t error_found = 0;
+    size_t available_data = 0;
+    uint8_t * bytes_max = bytes + length;
+    while (bytes < bytes_max) {
+        bytes = h3zero_parse_data_stream(bytes, bytes_max, &stream_ctx->stream_state, &available_data, &error_found);
+        if (bytes == NULL) {
+            ret = picoquic_close(cnx, error_found);
+            if (ret != 0 && cnx->quic->F_log) {
+                fprintf(cnx->quic->F_log, "Could not parse incoming data from stream %" PRIu64 ", error 0x%x", stream_id, error_found);
+            }
+            break;
+        }
+        else if (available_data > 0) {
+            if (!stream_ctx->flow_opened){
+                if (stream_ctx->stream_state.current_frame_length < 0x100000) {
+                    stream_ctx->flow_opened = 1;
+                }
+                else if (cnx->cnx_state == picoquic_state_client_ready) {
+                    stream_ctx->flow_opened = 1;
+                    /* ret = picoquic_open_flow_control(cnx, stream_id, stream_ctx->stream_state.current_frame_length); */
+                }
+            }
+            if (ret == 0 && ctx->no_disk == 0) {
+                ret = (fwrite(bytes, 1, available_data, stream_ctx->F) > 0) ? 0 : -1;
+                if (ret != 0 && cnx->quic->F_log) {
+                    fprintf(cnx->quic->F_log, "Could not write data from stream %" PRIu64 ", error 0x%x", stream_id, ret);
+                }
+            }
+            stream_ctx->received_length += available_data;
+            bytes += available_data;
+        }
+    }
+
+    if (ret == 0 && bytes != NULL) {
+        /* Acknowledge the sections that used the dynamic table */
+        ret = h3zero_client_flush_qpack(cnx, &ctx->qpack);
+    }
+
+    return ret;
+}
+
+static int picoquic_demo_client_end_stream(picoquic_cnx_t* cnx, picoquic_demo_callback_ctx_t* ctx,
+    picoquic_demo_client_stream_ctx_t* stream_ctx, int ret)
+{
+    uint64_t stream_id = stream_ctx->stream_id;
+    int is_closed = picoquic_demo_client_close_stream(ctx, stream_ctx);
+
+    if (is_closed) {
+        if (stream_id <= 64 && cnx->quic->F_log) {
+            fprintf(cnx->quic->F_log, "Stream %d ended after %d bytes\n",
+            (int)stream_id, (int)stream_ctx->received_length);
+        }
+        if (stream_ctx->received_length == 0 && cnx->quic->F_log) {
+            fprintf(cnx->quic->F_log, "Stream %d ended after %d bytes, ret=0x%x\n",
+                (int)stream_id, (int)stream_ctx->received_length, ret);
+        }
+    }
+
+    return is_closed;
+}
+
+/* The instructions of the encoder of the server may unblock the responses
+ * that refer to the entries they insert. */
+static int picoquic_demo_client_h3_uni_stream(picoquic_cnx_t* cnx, picoquic_demo_callback_ctx_t* ctx,
+    uint64_t stream_id, uint8_t* bytes, size_t length)
+{
+    int ret = 0;
+    uint16_t error_found = h3zero_qpack_receive_uni_stream(&ctx->qpack, stream_id, bytes, length);
+    picoquic_demo_client_stream_ctx_t* stream_ctx = ctx->first_stream;
+
+    if (error_found != 0) {
+        if (cnx->quic->F_log) {
+            fprintf(cnx->quic->F_log, "Could not parse incoming data from stream %" PRIu64 ", error 0x%x\n", stream_id, error_found);
+        }
+        return picoquic_close(cnx, error_found);
+    }
+
+    while (ret == 0 && stream_ctx != NULL) {
+        picoquic_demo_client_stream_ctx_t* next_stream = stream_ctx->next_stream;
+
+        if (stream_ctx->is_open && stream_ctx->stream_state.header_blocked) {
+            uint8_t* kept_bytes = NULL;
+            size_t kept_length = 0;
+            int unblocked = h3zero_unblock_data_stream(&stream_ctx->stream_state, &kept_bytes, &kept_length, &error_found);
+
+            if (unblocked < 0) {
+                ret = picoquic_close(cnx, error_found);
+            }
+            else if (unblocked > 0) {
+                if (kept_length > 0) {
+                    ret = picoquic_demo_client_h3_data(cnx, ctx, stream_ctx, kept_bytes, kept_length);
+                }
+                if (ret == 0 && stream_ctx->stream_state.blocked_fin && !stream_ctx->stream_state.header_blocked &&
+                    picoquic_demo_client_end_stream(cnx, ctx, stream_ctx, ret)) {
+                    ret = picoquic_demo_client_start_streams(cnx, ctx, stream_ctx->stream_id);
+                }
+            }
+            if (kept_bytes != NULL) {
+                free(kept_bytes);
+            }
+        }
+        stream_ctx = next_stream;
+    }
+
+    if (ret == 0) {
+        ret = h3zero_client_flush_qpack(cnx, &ctx->qpack);
+    }
+
+    return ret;
+}
+
 int picoquic_demo_client_callback(picoquic_cnx_t* cnx,
     uint64_t stream_id, uint8_t* bytes, size_t length,
     picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
@@ -571,53 +738,24 @@ int picoquic_demo_client_callback(picoquic_cnx_t* cnx,
     case picoquic_callback_no_event:
     case picoquic_callback_stream_fin:
         /* Data arrival on stream #x, maybe with fin mark */
-        /* TODO: parse the frames. */
-        /* TODO: check settings frame */
         if (stream_ctx == NULL) {
             stream_ctx = picoquic_demo_client_find_stream(ctx, stream_id);
         }
-        if (stream_ctx != NULL && stream_ctx->is_open) {
+        if (stream_ctx == NULL && ctx->alpn == picoquic_alpn_http_3 &&
+            !IS_BIDIR_STREAM_ID(stream_id) && !IS_CLIENT_STREAM_ID(stream_id)) {
+            /* Control and QPACK streams of the server */
+            ret = picoquic_demo_client_h3_uni_stream(cnx, ctx, stream_id, bytes, length);
+        }
+        else if (stream_ctx != NULL && stream_ctx->is_open) {
             if (!stream_ctx->is_file_open && ctx->no_disk == 0) {
                 ret = picoquic_demo_client_open_stream_file(cnx, ctx, stream_ctx);
                 stream_ctx->is_file_open = 1;
             }
             if (ret == 0 && length > 0) {
                 switch (ctx->alpn) {
-                case picoquic_alpn_http_3: {
-                    uint16_t error_found = 0;
-                    size_t available_data = 0;
-                    uint8_t * bytes_max = bytes + length;
-                    while (bytes < bytes_max) {
-                        bytes = h3zero_parse_data_stream(bytes, bytes_max, &stream_ctx->stream_state, &available_data, &error_found);
-                        if (bytes == NULL) {
-                            ret = picoquic_close(cnx, error_found);
-                            if (ret != 0 && cnx->quic->F_log) {
-                                fprintf(cnx->quic->F_log, "Could not parse incoming data from stream %" PRIu64 ", error 0x%x", stream_id, error_found);
-                            }
-                            break;
-                        }
-                        else if (available_data > 0) {
-                            if (!stream_ctx->flow_opened){
-                                if (stream_ctx->stream_state.current_frame_length < 0x100000) {
-                                    stream_ctx->flow_opened = 1;
-                                }
-                                else if (cnx->cnx_state == picoquic_state_client_ready) {
-                                    stream_ctx->flow_opened = 1;
-                                    /* ret = picoquic_open_flow_control(cnx, stream_id, stream_ctx->stream_state.current_frame_length); */
-                                }
-                            }
-                            if (ret == 0 && ctx->no_disk == 0) {
-                                ret = (fwrite(bytes, 1, available_data, stream_ctx->F) > 0) ? 0 : -1;
-                                if (ret != 0 && cnx->quic->F_log) {
-                                    fprintf(cnx->quic->F_log, "Could not write data from stream %" PRIu64 ", error 0x%x", stream_id, ret);
-                                }
-                            }
-                            stream_ctx->received_length += available_data;
-                            bytes += available_data;
-                        }
-                    }
+                case picoquic_alpn_http_3:
+                    ret = picoquic_demo_client_h3_data(cnx, ctx, stream_ctx, bytes, length);
                     break;
-                }
                 case picoquic_alpn_http_0_9:
                     if (ctx->no_disk == 0) {
                         ret = (fwrite(bytes, 1, length, stream_ctx->F) > 0) ? 0 : -1;
@@ -635,16 +773,12 @@ int picoquic_demo_client_callback(picoquic_cnx_t* cnx,
             }
 
             if (fin_or_event == picoquic_callback_stream_fin) {
-                if (picoquic_demo_client_close_stream(ctx, stream_ctx)) {
+                if (ctx->alpn == picoquic_alpn_http_3 && stream_ctx->stream_state.header_blocked) {
+                    /* The stream ends once its header is decoded */
+                    stream_ctx->stream_state.blocked_fin = 1;
+                }
+                else if (picoquic_demo_client_end_stream(cnx, ctx, stream_ctx, ret)) {
                     fin_stream_id = stream_id;
-                    if (stream_id <= 64 && cnx->quic->F_log) {
-                        fprintf(cnx->quic->F_log, "Stream %d ended after %d bytes\n",
-                        (int)stream_id, (int)stream_ctx->received_length);
-                    }
-                    if (stream_ctx->received_length == 0 && cnx->quic->F_log) {
-                        fprintf(cnx->quic->F_log, "Stream %d ended after %d bytes, ret=0x%x\n",
-                            (int)stream_id, (int)stream_ctx->received_length, ret);
-                    }
                 }
             }
         }
@@ -809,6 +943,8 @@ void picoquic_demo_client_delete_context(picoquic_demo_callback_ctx_t* ctx)
     while ((stream_ctx = ctx->first_stream) != NULL) {
         picoquic_demo_client_delete_stream_context(ctx, stream_ctx);
     }
+
+    h3zero_qpack_release(&ctx->qpack);
 }
 
 char const * demo_client_parse_stream_spaces(char const * text) {
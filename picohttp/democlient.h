@@ -91,6 +91,9 @@ typedef struct st_picoquic_demo_client_callback_ctx_t {
     int no_print;
     int connection_ready;
     int connection_closed;
+
+    h3zero_settings_t qpack_settings; /* Set before the connection starts, zeroes for the static table only */
+    h3zero_qpack_t qpack;
 } picoquic_demo_callback_ctx_t;
 
 picoquic_alpn_enum picoquic_parse_alpn(char const * alpn);
@@ -98,10 +101,12 @@ picoquic_alpn_enum picoquic_parse_alpn_nz(char const* alpn, size_t len);
 
 void picoquic_demo_client_set_alpn_from_tickets(picoquic_cnx_t* cnx, picoquic_demo_callback_ctx_t* ctx, uint64_t current_time);
 
-int h3zero_client_init(picoquic_cnx_t* cnx);
+int h3zero_client_init(picoquic_cnx_t* cnx, h3zero_qpack_t * qpack);
+int h3zero_client_flush_qpack(picoquic_cnx_t* cnx, h3zero_qpack_t * qpack);
 int demo_client_prepare_to_send(void * context, size_t space, size_t echo_length, size_t * echo_sent, FILE * F);
 int h3zero_client_create_stream_request(
-    uint8_t * buffer, size_t max_bytes, uint8_t const * path, size_t path_len, size_t post_size, const char * host, size_t * consumed);
+    uint8_t * buffer, size_t max_bytes, uint8_t const * path, size_t path_len, size_t post_size, const char * host,
+    h3zero_qpack_encoder_t * encoder, uint64_t stream_id, size_t * consumed);
 
 int h09_demo_client_prepare_stream_open_command(
     uint8_t * command, size_t max_size, uint8_t const* path, size_t path_len, size_t post_size, const char * host, size_t * consumed);
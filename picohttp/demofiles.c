@@ -0,0 +1,330 @@
+#include "demofiles.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#ifndef _WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static int64_t picohttp_file_mapping_compare(void* l, void* r)
+{
+    return strcmp(((picohttp_file_mapping_t*)l)->file_name, ((picohttp_file_mapping_t*)r)->file_name);
+}
+
+static picosplay_node_t* picohttp_file_mapping_create(void* value)
+{
+    return &((picohttp_file_mapping_t*)value)->mapping_node;
+}
+
+static void* picohttp_file_mapping_value(picosplay_node_t* node)
+{
+    return (void*)((char*)node - offsetof(struct st_picohttp_file_mapping_t, mapping_node));
+}
+
+static void picohttp_file_mapping_free(picohttp_file_mapping_t* mapping)
+{
+#ifndef _WINDOWS
+    (void)munmap((void*)mapping->bytes, mapping->length);
+#endif
+    free(mapping->file_name);
+    free(mapping);
+}
+
+/* A mapping still used by streams only leaves the tree, and is freed with its last reference */
+static void picohttp_file_mapping_delete(void* tree, picosplay_node_t* node)
+{
+    picohttp_file_mapping_t* mapping = (picohttp_file_mapping_t*)picohttp_file_mapping_value(node);
+
+    (void)tree;
+    if (mapping->nb_refs == 0) {
+        mapping->cache->nb_idle--;
+        picohttp_file_mapping_free(mapping);
+    } else {
+        mapping->is_detached = 1;
+    }
+}
+
+static int64_t picohttp_cached_response_compare(void* l, void* r)
+{
+    picohttp_cached_response_t* left = (picohttp_cached_response_t*)l;
+    picohttp_cached_response_t* right = (picohttp_cached_response_t*)r;
+    int cmp = memcmp(left->path, right->path, (left->path_length < right->path_length) ? left->path_length : right->path_length);
+
+    return (cmp != 0) ? cmp : (int64_t)left->path_length - (int64_t)right->path_length;
+}
+
+static picosplay_node_t* picohttp_cached_response_create(void* value)
+{
+    return &((picohttp_cached_response_t*)value)->response_node;
+}
+
+static void* picohttp_cached_response_value(picosplay_node_t* node)
+{
+    return (void*)((char*)node - offsetof(struct st_picohttp_cached_response_t, response_node));
+}
+
+static void picohttp_cached_response_delete(void* tree, picosplay_node_t* node)
+{
+    picohttp_cached_response_t* response = (picohttp_cached_response_t*)picohttp_cached_response_value(node);
+    picohttp_file_cache_t* cache = (picohttp_file_cache_t*)((char*)tree - offsetof(struct st_picohttp_file_cache_t, response_tree));
+
+    if (response->previous_in_lru == NULL) {
+        cache->first_in_lru = response->next_in_lru;
+    } else {
+        response->previous_in_lru->next_in_lru = response->next_in_lru;
+    }
+    if (response->next_in_lru == NULL) {
+        cache->last_in_lru = response->previous_in_lru;
+    } else {
+        response->next_in_lru->previous_in_lru = response->previous_in_lru;
+    }
+    cache->response_bytes -= response->mapping->length;
+    picohttp_file_cache_release(response->mapping);
+    free(response->path);
+    free(response);
+}
+
+picohttp_file_cache_t* picohttp_file_cache_create(size_t nb_idle_max)
+{
+#ifdef _WINDOWS
+    (void)nb_idle_max;
+    return NULL;
+#else
+    picohttp_file_cache_t* cache = (picohttp_file_cache_t*)malloc(sizeof(picohttp_file_cache_t));
+
+    if (cache != NULL) {
+        memset(cache, 0, sizeof(picohttp_file_cache_t));
+        picosplay_init_tree(&cache->mapping_tree, picohttp_file_mapping_compare, picohttp_file_mapping_create,
+            picohttp_file_mapping_delete, picohttp_file_mapping_value);
+        cache->nb_idle_max = nb_idle_max;
+        picosplay_init_tree(&cache->response_tree, picohttp_cached_response_compare, picohttp_cached_response_create,
+            picohttp_cached_response_delete, picohttp_cached_response_value);
+        cache->nb_responses_max = PICOHTTP_RESPONSE_CACHE_MAX;
+        cache->response_bytes_max = PICOHTTP_RESPONSE_CACHE_BYTES_MAX;
+    }
+
+    return cache;
+#endif
+}
+
+void picohttp_file_cache_delete(picohttp_file_cache_t* cache)
+{
+    if (cache != NULL) {
+        /* The responses release their mappings first */
+        picosplay_empty_tree(&cache->response_tree);
+        picosplay_empty_tree(&cache->mapping_tree);
+        free(cache);
+    }
+}
+
+#ifndef _WINDOWS
+static picohttp_file_mapping_t* picohttp_file_mapping_open(char const* file_name, struct stat* st)
+{
+    picohttp_file_mapping_t* mapping = NULL;
+    int fd = open(file_name, O_RDONLY);
+
+    /* Check the opened file, which may not be the one checked by the caller */
+    if (fd >= 0 && fstat(fd, st) == 0 && S_ISREG(st->st_mode) && st->st_size > 0 &&
+        (mapping = (picohttp_file_mapping_t*)malloc(sizeof(picohttp_file_mapping_t))) != NULL) {
+        void* bytes = mmap(NULL, (size_t)st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        memset(mapping, 0, sizeof(picohttp_file_mapping_t));
+        mapping->file_name = strdup(file_name);
+        if (bytes == MAP_FAILED || mapping->file_name == NULL) {
+            if (bytes != MAP_FAILED) {
+                (void)munmap(bytes, (size_t)st->st_size);
+            }
+            free(mapping->file_name);
+            free(mapping);
+            mapping = NULL;
+        } else {
+            /* The streams read the files from start to end */
+            (void)madvise(bytes, (size_t)st->st_size, MADV_SEQUENTIAL);
+            mapping->bytes = (uint8_t const*)bytes;
+            mapping->length = (size_t)st->st_size;
+            mapping->device = (uint64_t)st->st_dev;
+            mapping->inode = (uint64_t)st->st_ino;
+            mapping->mtime = (int64_t)st->st_mtime;
+        }
+    }
+    /* The mapping stays valid once the file is closed */
+    if (fd >= 0) {
+        (void)close(fd);
+    }
+
+    return mapping;
+}
+#endif
+
+/* Unmaps the idle mapping released the longest ago */
+static void picohttp_file_cache_evict(picohttp_file_cache_t* cache)
+{
+    picohttp_file_mapping_t* oldest = NULL;
+
+    for (picosplay_node_t* node = picosplay_first(&cache->mapping_tree); node != NULL; node = picosplay_next(node)) {
+        picohttp_file_mapping_t* mapping = (picohttp_file_mapping_t*)picohttp_file_mapping_value(node);
+        if (mapping->nb_refs == 0 && (oldest == NULL || mapping->last_use < oldest->last_use)) {
+            oldest = mapping;
+        }
+    }
+    if (oldest != NULL) {
+        picosplay_delete_hint(&cache->mapping_tree, &oldest->mapping_node);
+    }
+}
+
+picohttp_file_mapping_t* picohttp_file_cache_get(picohttp_file_cache_t* cache, char const* file_name)
+{
+#ifdef _WINDOWS
+    (void)cache;
+    (void)file_name;
+    return NULL;
+#else
+    picohttp_file_mapping_t target;
+    picohttp_file_mapping_t* mapping = NULL;
+    picosplay_node_t* node;
+    struct stat st;
+
+    target.file_name = (char*)file_name;
+    node = picosplay_find(&cache->mapping_tree, &target);
+    if (node != NULL) {
+        mapping = (picohttp_file_mapping_t*)picohttp_file_mapping_value(node);
+        /* One stat per request, instead of the open, seek and reads of each stream */
+        if (stat(file_name, &st) != 0 || (uint64_t)st.st_dev != mapping->device || (uint64_t)st.st_ino != mapping->inode ||
+            (int64_t)st.st_mtime != mapping->mtime || (size_t)st.st_size != mapping->length) {
+            picosplay_delete_hint(&cache->mapping_tree, node);
+            mapping = NULL;
+        }
+    }
+
+    if (mapping == NULL && (mapping = picohttp_file_mapping_open(file_name, &st)) != NULL) {
+        mapping->cache = cache;
+        picosplay_insert(&cache->mapping_tree, mapping);
+    } else if (mapping != NULL && mapping->nb_refs == 0) {
+        cache->nb_idle--;
+    }
+
+    if (mapping != NULL) {
+        mapping->nb_refs++;
+    }
+
+    return mapping;
+#endif
+}
+
+void picohttp_file_cache_release(picohttp_file_mapping_t* mapping)
+{
+    picohttp_file_cache_t* cache = mapping->cache;
+
+    if (--mapping->nb_refs == 0) {
+        if (mapping->is_detached) {
+            picohttp_file_mapping_free(mapping);
+        } else {
+            mapping->last_use = ++cache->use_count;
+            cache->nb_idle++;
+            if (cache->nb_idle > cache->nb_idle_max) {
+                picohttp_file_cache_evict(cache);
+            }
+        }
+    }
+}
+
+void picohttp_file_cache_hold(picohttp_file_mapping_t* mapping)
+{
+    mapping->nb_refs++;
+}
+
+picohttp_cached_response_t* picohttp_response_cache_get(picohttp_file_cache_t* cache,
+    uint8_t const* path, size_t path_length, uint64_t current_time)
+{
+    picohttp_cached_response_t target;
+    picohttp_cached_response_t* response = NULL;
+    picosplay_node_t* node;
+
+    target.path = (uint8_t*)path;
+    target.path_length = path_length;
+    if ((node = picosplay_find(&cache->response_tree, &target)) != NULL) {
+        response = (picohttp_cached_response_t*)picohttp_cached_response_value(node);
+
+        if (current_time >= response->check_time + PICOHTTP_RESPONSE_CACHE_CHECK_INTERVAL) {
+            picohttp_file_mapping_t* mapping = picohttp_file_cache_get(cache, response->mapping->file_name);
+
+            if (mapping != NULL) {
+                picohttp_file_cache_release(mapping);
+            }
+            if (mapping != response->mapping) {
+                /* The file changed or disappeared */
+                picosplay_delete_hint(&cache->response_tree, node);
+                response = NULL;
+            } else {
+                response->check_time = current_time;
+            }
+        }
+    }
+
+    if (response != NULL && response->previous_in_lru != NULL) {
+        /* Move to the head of the LRU list */
+        response->previous_in_lru->next_in_lru = response->next_in_lru;
+        if (response->next_in_lru == NULL) {
+            cache->last_in_lru = response->previous_in_lru;
+        } else {
+            response->next_in_lru->previous_in_lru = response->previous_in_lru;
+        }
+        response->previous_in_lru = NULL;
+        response->next_in_lru = cache->first_in_lru;
+        cache->first_in_lru->previous_in_lru = response;
+        cache->first_in_lru = response;
+    }
+
+    return response;
+}
+
+int picohttp_response_cache_add(picohttp_file_cache_t* cache, uint8_t const* path, size_t path_length,
+    picohttp_file_mapping_t* mapping, uint8_t const* prefix, size_t prefix_length, uint64_t current_time)
+{
+    picohttp_cached_response_t* response;
+    picohttp_cached_response_t target;
+    picosplay_node_t* node;
+
+    if (mapping->length > cache->response_bytes_max || prefix_length > PICOHTTP_RESPONSE_PREFIX_MAX ||
+        (response = (picohttp_cached_response_t*)malloc(sizeof(picohttp_cached_response_t))) == NULL) {
+        return -1;
+    }
+    memset(response, 0, sizeof(picohttp_cached_response_t));
+    if ((response->path = (uint8_t*)malloc(path_length)) == NULL) {
+        free(response);
+        return -1;
+    }
+
+    /* Replaces the previous response of the path */
+    target.path = (uint8_t*)path;
+    target.path_length = path_length;
+    if ((node = picosplay_find(&cache->response_tree, &target)) != NULL) {
+        picosplay_delete_hint(&cache->response_tree, node);
+    }
+    while (cache->last_in_lru != NULL && (cache->response_tree.size >= (int)cache->nb_responses_max ||
+        cache->response_bytes + mapping->length > cache->response_bytes_max)) {
+        picosplay_delete_hint(&cache->response_tree, &cache->last_in_lru->response_node);
+    }
+
+    memcpy(response->path, path, path_length);
+    response->path_length = path_length;
+    picohttp_file_cache_hold(mapping);
+    response->mapping = mapping;
+    response->check_time = current_time;
+    memcpy(response->prefix, prefix, prefix_length);
+    response->prefix_length = prefix_length;
+    response->next_in_lru = cache->first_in_lru;
+    if (cache->first_in_lru == NULL) {
+        cache->last_in_lru = response;
+    } else {
+        cache->first_in_lru->previous_in_lru = response;
+    }
+    cache->first_in_lru = response;
+    cache->response_bytes += mapping->length;
+    picosplay_insert(&cache->response_tree, response);
+
+    return 0;
+}
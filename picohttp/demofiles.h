@@ -0,0 +1,91 @@
+/**
+ * \file demofiles.h
+ * \brief Cache of the files served from the web folder of the demo server.
+ *
+ * The files are mapped in memory once, and the mappings are shared by all the streams of all the
+ * connections of the server, which copy the stream data straight from them into the packets. A
+ * mapping is kept after the last stream releases it, up to a number of idle mappings, and replaced
+ * when the file changes on disk. Files should be updated by renaming a new version over them: a file
+ * truncated in place while it is being sent faults the server. The cache needs mmap: on Windows it
+ * cannot be created, and the server reads the files through stdio.
+ *
+ * The cache also keeps the responses of the recent requests for files, by path, with the encoded
+ * start of their h3 response and a reference to the mapping of the file. A request that finds its
+ * response is served without any system call: the mapping is only checked against the file again
+ * once the check interval has elapsed. The responses are evicted in LRU order, beyond a number of
+ * responses or a total size of their files.
+ */
+
+#ifndef DEMO_FILES_H
+#define DEMO_FILES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "picosplay.h"
+
+#define PICOHTTP_FILE_CACHE_IDLE_MAX 64
+#define PICOHTTP_RESPONSE_CACHE_MAX 256
+#define PICOHTTP_RESPONSE_CACHE_BYTES_MAX (64 * 1024 * 1024)
+#define PICOHTTP_RESPONSE_CACHE_CHECK_INTERVAL 1000000 /* microseconds */
+#define PICOHTTP_RESPONSE_PREFIX_MAX 64
+
+struct st_picohttp_file_cache_t;
+
+typedef struct st_picohttp_file_mapping_t {
+    picosplay_node_t mapping_node;
+    struct st_picohttp_file_cache_t* cache;
+    char* file_name;
+    uint8_t const* bytes;
+    size_t length;
+    uint64_t device;
+    uint64_t inode;
+    int64_t mtime;
+    uint64_t last_use;
+    int nb_refs;
+    int is_detached; /* No longer in the cache, unmapped when released */
+} picohttp_file_mapping_t;
+
+typedef struct st_picohttp_cached_response_t {
+    picosplay_node_t response_node;
+    struct st_picohttp_cached_response_t* previous_in_lru;
+    struct st_picohttp_cached_response_t* next_in_lru;
+    uint8_t* path;
+    size_t path_length;
+    picohttp_file_mapping_t* mapping;
+    uint64_t check_time;
+    size_t prefix_length;
+    uint8_t prefix[PICOHTTP_RESPONSE_PREFIX_MAX]; /* h3 HEADERS frame and header of the DATA frame */
+} picohttp_cached_response_t;
+
+typedef struct st_picohttp_file_cache_t {
+    picosplay_tree_t mapping_tree;
+    size_t nb_idle;
+    size_t nb_idle_max;
+    uint64_t use_count;
+    picosplay_tree_t response_tree;
+    picohttp_cached_response_t* first_in_lru; /* Most recently used */
+    picohttp_cached_response_t* last_in_lru;
+    size_t response_bytes;
+    size_t nb_responses_max;
+    size_t response_bytes_max;
+} picohttp_file_cache_t;
+
+picohttp_file_cache_t* picohttp_file_cache_create(size_t nb_idle_max);
+void picohttp_file_cache_delete(picohttp_file_cache_t* cache);
+
+/* Returns a mapping of the whole file with a new reference, or NULL if the
+ * file cannot be mapped or is empty. */
+picohttp_file_mapping_t* picohttp_file_cache_get(picohttp_file_cache_t* cache, char const* file_name);
+void picohttp_file_cache_release(picohttp_file_mapping_t* mapping);
+void picohttp_file_cache_hold(picohttp_file_mapping_t* mapping);
+
+/* Returns the response of the path if it is cached and its file did not change, the mapping
+ * is only checked when more than the check interval elapsed since the last check. */
+picohttp_cached_response_t* picohttp_response_cache_get(picohttp_file_cache_t* cache,
+    uint8_t const* path, size_t path_length, uint64_t current_time);
+/* Adds the response of the path, with a new reference to the mapping. Returns -1 if it is
+ * not cached, because it is too large or memory is lacking. */
+int picohttp_response_cache_add(picohttp_file_cache_t* cache, uint8_t const* path, size_t path_length,
+    picohttp_file_mapping_t* mapping, uint8_t const* prefix, size_t prefix_length, uint64_t current_time);
+
+#endif /* DEMO_FILES_H */
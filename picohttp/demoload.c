@@ -0,0 +1,457 @@
+#include "demoload.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "picoquic_internal.h"
+#include "demoserver.h"
+
+/* Per connection state of the load, the demo client context first so that the
+ * demo client callback finds its context at the same address */
+typedef struct st_picohttp_load_cnx_t {
+    picoquic_demo_callback_ctx_t demo_ctx;
+    picohttp_load_ctx_t* load;
+    uint64_t start_time;
+    uint64_t nb_resets;
+    int handshake_done;
+    int streams_started;
+    int is_closing; /* All the streams are done */
+} picohttp_load_cnx_t;
+
+static size_t picohttp_histogram_index(uint64_t value)
+{
+    size_t index;
+
+    if (value < (2u << PICOHTTP_HISTOGRAM_SUB_BITS)) {
+        index = (size_t)value;
+    } else {
+        int e = 63;
+        uint64_t sub;
+
+        while ((value >> e) == 0) {
+            e--;
+        }
+        sub = (value >> (e - PICOHTTP_HISTOGRAM_SUB_BITS)) & ((1u << PICOHTTP_HISTOGRAM_SUB_BITS) - 1);
+        index = ((size_t)(e - PICOHTTP_HISTOGRAM_SUB_BITS + 1) << PICOHTTP_HISTOGRAM_SUB_BITS) + (size_t)sub;
+    }
+
+    return index;
+}
+
+/* Largest value of the bucket */
+static uint64_t picohttp_histogram_bucket_max(size_t index)
+{
+    uint64_t value;
+
+    if (index < (2u << PICOHTTP_HISTOGRAM_SUB_BITS)) {
+        value = index;
+    } else {
+        int shift = (int)(index >> PICOHTTP_HISTOGRAM_SUB_BITS) - 1;
+        uint64_t mantissa = (1u << PICOHTTP_HISTOGRAM_SUB_BITS) + (index & ((1u << PICOHTTP_HISTOGRAM_SUB_BITS) - 1));
+
+        value = (mantissa << shift) + ((1ull << shift) - 1);
+    }
+
+    return value;
+}
+
+void picohttp_histogram_add(picohttp_histogram_t* histogram, uint64_t value)
+{
+    histogram->buckets[picohttp_histogram_index(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+uint64_t picohttp_histogram_percentile(picohttp_histogram_t const* histogram, double fraction)
+{
+    uint64_t value = 0;
+
+    if (histogram->count > 0) {
+        uint64_t rank = (uint64_t)(fraction * (double)histogram->count);
+        uint64_t cumulated = 0;
+
+        if ((double)rank < fraction * (double)histogram->count) {
+            rank++;
+        }
+        if (rank == 0) {
+            rank = 1;
+        }
+
+        for (size_t i = 0; i < PICOHTTP_HISTOGRAM_NB_BUCKETS; i++) {
+            cumulated += histogram->buckets[i];
+            if (cumulated >= rank) {
+                value = picohttp_histogram_bucket_max(i);
+                break;
+            }
+        }
+
+        if (value > histogram->max) {
+            value = histogram->max;
+        }
+    }
+
+    return value;
+}
+
+int picohttp_load_parse_mix(char const* text, size_t* nb_scenarios, picohttp_load_scenario_t** scenarios)
+{
+    int ret = 0;
+    size_t nb_alloc = 1;
+    size_t text_length = strlen(text);
+    char* copy;
+
+    for (size_t i = 0; i < text_length; i++) {
+        if (text[i] == '|') {
+            nb_alloc++;
+        }
+    }
+
+    *nb_scenarios = 0;
+    *scenarios = (picohttp_load_scenario_t*)calloc(nb_alloc, sizeof(picohttp_load_scenario_t));
+    copy = (char*)malloc(text_length + 1);
+
+    if (copy == NULL || *scenarios == NULL) {
+        ret = -1;
+    } else {
+        char* segment = copy;
+
+        memcpy(copy, text, text_length + 1);
+
+        while (ret == 0 && segment != NULL) {
+            picohttp_load_scenario_t* scenario = &(*scenarios)[*nb_scenarios];
+            char* end = strchr(segment, '|');
+            char* desc_text = segment;
+            unsigned int weight = 0;
+
+            if (end != NULL) {
+                *end = 0;
+            }
+
+            while (desc_text[0] >= '0' && desc_text[0] <= '9') {
+                weight = weight * 10 + (unsigned int)(*desc_text++ - '0');
+            }
+            if (desc_text[0] == '@') {
+                desc_text++;
+            } else {
+                /* No weight, the digits are the number of the first stream */
+                desc_text = segment;
+                weight = 1;
+            }
+
+            if (weight == 0) {
+                ret = -1;
+            } else {
+                scenario->weight = weight;
+                ret = demo_client_parse_scenario_desc(desc_text, &scenario->nb_streams, &scenario->desc);
+                (*nb_scenarios)++;
+                if (ret == 0 && scenario->nb_streams == 0) {
+                    ret = -1;
+                }
+            }
+
+            segment = (end == NULL) ? NULL : end + 1;
+        }
+    }
+
+    if (ret != 0 && *scenarios != NULL) {
+        picohttp_load_delete_mix(*nb_scenarios, *scenarios);
+        *scenarios = NULL;
+        *nb_scenarios = 0;
+    }
+
+    free(copy);
+
+    return ret;
+}
+
+void picohttp_load_delete_mix(size_t nb_scenarios, picohttp_load_scenario_t* scenarios)
+{
+    for (size_t i = 0; i < nb_scenarios; i++) {
+        if (scenarios[i].desc != NULL) {
+            demo_client_delete_scenario_desc(scenarios[i].nb_streams, scenarios[i].desc);
+        }
+    }
+    free(scenarios);
+}
+
+/* Completes the statistics of the connection once its handshake is done, and closes it once its
+ * streams are done. The connection can only be closed once the client is ready: the callback for
+ * the almost ready event comes after that. */
+static int picohttp_load_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
+{
+    int ret = 0;
+    picohttp_load_cnx_t* load_cnx = (picohttp_load_cnx_t*)callback_ctx;
+    picohttp_load_ctx_t* load = load_cnx->load;
+
+    if (fin_or_event == picoquic_callback_almost_ready && !load_cnx->handshake_done) {
+        load_cnx->handshake_done = 1;
+        picohttp_histogram_add(&load->handshake_latency, picoquic_get_quic_time(cnx->quic) - load_cnx->start_time);
+        if (picoquic_tls_is_psk_handshake(cnx)) {
+            load->nb_resumed++;
+        }
+        if (cnx->zero_rtt_data_accepted) {
+            load->nb_zero_rtt_accepted++;
+        }
+    } else if (fin_or_event == picoquic_callback_stream_reset || fin_or_event == picoquic_callback_stop_sending) {
+        picoquic_demo_client_stream_ctx_t* stream_ctx = (picoquic_demo_client_stream_ctx_t*)v_stream_ctx;
+
+        if (stream_ctx != NULL && stream_ctx->is_open) {
+            load_cnx->nb_resets++;
+        }
+    }
+
+    ret = picoquic_demo_client_callback(cnx, stream_id, bytes, length, fin_or_event, callback_ctx, v_stream_ctx);
+
+    if (ret == 0 && load_cnx->handshake_done && !load_cnx->streams_started) {
+        load_cnx->streams_started = 1;
+        ret = picoquic_demo_client_start_streams(cnx, &load_cnx->demo_ctx, PICOQUIC_DEMO_STREAM_ID_INITIAL);
+    }
+
+    if (ret == 0 && load_cnx->streams_started && !load_cnx->is_closing &&
+        load_cnx->demo_ctx.nb_open_streams == 0 && cnx->cnx_state == picoquic_state_client_ready) {
+        load_cnx->is_closing = 1;
+        ret = picoquic_close(cnx, 0);
+    }
+
+    return ret;
+}
+
+picohttp_load_ctx_t* picohttp_load_create(picohttp_load_params_t const* params, picoquic_quic_t* quic,
+    struct sockaddr* server_address, uint64_t current_time)
+{
+    picohttp_load_ctx_t* load = (picohttp_load_ctx_t*)calloc(1, sizeof(picohttp_load_ctx_t));
+
+    if (load != NULL) {
+        load->params = *params;
+        if (load->params.alpn == NULL) {
+            load->params.alpn = PICOHTTP_ALPN_H3_LATEST;
+        }
+        if (load->params.nb_users == 0) {
+            load->params.nb_users = 1;
+        }
+        if (load->params.resume_percent > 100) {
+            load->params.resume_percent = 100;
+        }
+        load->quic = quic;
+        memcpy(&load->server_address, server_address,
+            (server_address->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+        load->user_ready_time = (uint64_t*)malloc(load->params.nb_users * sizeof(uint64_t));
+
+        if (load->user_ready_time == NULL ||
+            picohttp_load_parse_mix(load->params.request_mix, &load->nb_scenarios, &load->scenarios) != 0) {
+            picohttp_load_delete(load);
+            load = NULL;
+        } else {
+            for (size_t i = 0; i < load->nb_scenarios; i++) {
+                load->total_weight += load->scenarios[i].weight;
+            }
+            for (size_t i = 0; i < load->params.nb_users; i++) {
+                load->user_ready_time[i] = current_time;
+            }
+            load->nb_idle_users = load->params.nb_users;
+            load->next_start_time = current_time;
+            load->draw_state = current_time;
+            load->start_time = current_time;
+            load->last_end_time = current_time;
+        }
+    }
+
+    return load;
+}
+
+void picohttp_load_delete(picohttp_load_ctx_t* load)
+{
+    if (load->scenarios != NULL) {
+        picohttp_load_delete_mix(load->nb_scenarios, load->scenarios);
+    }
+    free(load->user_ready_time);
+    free(load);
+}
+
+static picohttp_load_scenario_t const* picohttp_load_draw_scenario(picohttp_load_ctx_t* load)
+{
+    size_t i = 0;
+    unsigned int draw;
+
+    load->draw_state = load->draw_state * 6364136223846793005ull + 1442695040888963407ull;
+    draw = (unsigned int)((load->draw_state >> 33) % load->total_weight);
+
+    while (draw >= load->scenarios[i].weight) {
+        draw -= load->scenarios[i].weight;
+        i++;
+    }
+
+    return &load->scenarios[i];
+}
+
+static int picohttp_load_start_connection(picohttp_load_ctx_t* load, uint64_t current_time)
+{
+    int ret = 0;
+    picohttp_load_scenario_t const* scenario = picohttp_load_draw_scenario(load);
+    picohttp_load_cnx_t* load_cnx = (picohttp_load_cnx_t*)malloc(sizeof(picohttp_load_cnx_t));
+    picoquic_cnx_t* cnx = NULL;
+
+    if (load_cnx == NULL) {
+        ret = -1;
+    } else {
+        int is_resumption;
+
+        ret = picoquic_demo_client_initialize_context(&load_cnx->demo_ctx, scenario->desc, scenario->nb_streams,
+            load->params.alpn, 1, 0);
+        load_cnx->demo_ctx.no_print = 1;
+        load_cnx->demo_ctx.qpack_settings = load->params.qpack_settings;
+        load_cnx->demo_ctx.last_interaction_time = current_time;
+        load_cnx->load = load;
+        load_cnx->start_time = current_time;
+        load_cnx->nb_resets = 0;
+        load_cnx->handshake_done = 0;
+        load_cnx->streams_started = 0;
+        load_cnx->is_closing = 0;
+
+        /* The ticket is looked up when the connection is created, hiding the tickets makes a full handshake */
+        load->resume_credit += load->params.resume_percent;
+        is_resumption = load->resume_credit >= 100;
+        if (is_resumption) {
+            load->resume_credit -= 100;
+            cnx = picoquic_create_cnx(load->quic, picoquic_null_connection_id, picoquic_null_connection_id,
+                (struct sockaddr*)&load->server_address, current_time, load->params.proposed_version,
+                load->params.sni, load->params.alpn, 1);
+        } else {
+            picoquic_stored_ticket_t* first_ticket = load->quic->p_first_ticket;
+
+            load->quic->p_first_ticket = NULL;
+            cnx = picoquic_create_cnx(load->quic, picoquic_null_connection_id, picoquic_null_connection_id,
+                (struct sockaddr*)&load->server_address, current_time, load->params.proposed_version,
+                load->params.sni, load->params.alpn, 1);
+            load->quic->p_first_ticket = first_ticket;
+        }
+
+        if (cnx == NULL) {
+            ret = -1;
+        } else {
+            picoquic_set_callback(cnx, picohttp_load_callback, load_cnx);
+            ret = picoquic_start_client_cnx(cnx);
+
+            if (ret == 0 && picoquic_is_0rtt_available(cnx)) {
+                load_cnx->streams_started = 1;
+                ret = picoquic_demo_client_start_streams(cnx, &load_cnx->demo_ctx, PICOQUIC_DEMO_STREAM_ID_INITIAL);
+            }
+        }
+
+        if (ret != 0) {
+            if (cnx != NULL) {
+                picoquic_delete_cnx(cnx);
+            }
+            picoquic_demo_client_delete_context(&load_cnx->demo_ctx);
+            free(load_cnx);
+        } else {
+            load->nb_open++;
+        }
+    }
+
+    return ret;
+}
+
+int picohttp_load_start_connections(picohttp_load_ctx_t* load, uint64_t current_time)
+{
+    int ret = 0;
+
+    while (ret == 0 && picohttp_load_next_start_time(load) <= current_time) {
+        load->first_user = (load->first_user + 1) % load->params.nb_users;
+        load->nb_idle_users--;
+        load->nb_started++;
+        if (load->params.connection_rate > 0) {
+            load->next_start_time = ((load->next_start_time > current_time) ? load->next_start_time : current_time) +
+                (uint64_t)(1000000.0 / load->params.connection_rate);
+        }
+
+        ret = picohttp_load_start_connection(load, current_time);
+    }
+
+    return ret;
+}
+
+uint64_t picohttp_load_next_start_time(picohttp_load_ctx_t* load)
+{
+    uint64_t next_time = UINT64_MAX;
+
+    if (load->nb_started < load->params.nb_connections && load->nb_idle_users > 0) {
+        next_time = load->user_ready_time[load->first_user];
+        if (next_time < load->next_start_time) {
+            next_time = load->next_start_time;
+        }
+    }
+
+    return next_time;
+}
+
+void picohttp_load_connection_ended(picohttp_load_ctx_t* load, picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    picohttp_load_cnx_t* load_cnx = (picohttp_load_cnx_t*)picoquic_get_callback_context(cnx);
+    picoquic_demo_client_stream_ctx_t* stream_ctx;
+    uint64_t nb_open = 0;
+
+    /* The connection is deleted first, its callback may still be called */
+    picoquic_delete_cnx(cnx);
+
+    for (stream_ctx = load_cnx->demo_ctx.first_stream; stream_ctx != NULL; stream_ctx = stream_ctx->next_stream) {
+        load->nb_requests++;
+        load->bytes_received += stream_ctx->received_length;
+        if (stream_ctx->is_open) {
+            nb_open++;
+        } else {
+            picohttp_histogram_add(&load->request_latency,
+                (uint64_t)(stream_ctx->tv_end.tv_sec - stream_ctx->tv_start.tv_sec) * 1000000ull +
+                (uint64_t)stream_ctx->tv_end.tv_usec - (uint64_t)stream_ctx->tv_start.tv_usec);
+        }
+    }
+    load->nb_requests_failed += nb_open + load_cnx->nb_resets;
+
+    if (load_cnx->is_closing && nb_open + load_cnx->nb_resets == 0) {
+        load->nb_completed++;
+    } else {
+        load->nb_failed++;
+    }
+
+    picoquic_demo_client_delete_context(&load_cnx->demo_ctx);
+    free(load_cnx);
+
+    load->nb_open--;
+    load->last_end_time = current_time;
+    load->user_ready_time[(load->first_user + load->nb_idle_users) % load->params.nb_users] = current_time + load->params.think_time;
+    load->nb_idle_users++;
+}
+
+int picohttp_load_is_done(picohttp_load_ctx_t* load)
+{
+    return load->nb_started >= load->params.nb_connections && load->nb_open == 0;
+}
+
+static void picohttp_load_report_histogram(FILE* F, char const* label, picohttp_histogram_t const* histogram)
+{
+    fprintf(F, "%s (us): p50 %" PRIu64 ", p99 %" PRIu64 ", p999 %" PRIu64 ", max %" PRIu64 ", mean %" PRIu64 ", %" PRIu64 " samples\n",
+        label, picohttp_histogram_percentile(histogram, 0.5), picohttp_histogram_percentile(histogram, 0.99),
+        picohttp_histogram_percentile(histogram, 0.999), histogram->max,
+        (histogram->count > 0) ? histogram->sum / histogram->count : 0, histogram->count);
+}
+
+void picohttp_load_report(picohttp_load_ctx_t* load, FILE* F)
+{
+    double duration = (double)(load->last_end_time - load->start_time) / 1000000.0;
+
+    fprintf(F, "Connections: %zu started, %zu completed, %zu failed, %zu resumed, %zu with 0-RTT accepted\n",
+        load->nb_started, load->nb_completed, load->nb_failed, load->nb_resumed, load->nb_zero_rtt_accepted);
+    fprintf(F, "Requests: %" PRIu64 ", %" PRIu64 " failed, %" PRIu64 " bytes received\n",
+        load->nb_requests, load->nb_requests_failed, load->bytes_received);
+    if (duration > 0) {
+        fprintf(F, "Duration: %.3f s, %.1f connections/s, %.1f requests/s, %.3f Mbps\n", duration,
+            (double)(load->nb_completed + load->nb_failed) / duration, (double)load->nb_requests / duration,
+            (double)load->bytes_received * 8.0 / duration / 1000000.0);
+    }
+    picohttp_load_report_histogram(F, "Handshake latency", &load->handshake_latency);
+    picohttp_load_report_histogram(F, "Request latency", &load->request_latency);
+}
@@ -0,0 +1,107 @@
+/**
+ * \file demoload.h
+ * \brief Load generator of the demo client.
+ *
+ * The load generator runs many client connections of the demo client from one QUIC context, for
+ * load testing a server. Each connection runs a scenario of the demo client, drawn from a weighted
+ * request mix, and is closed once all its streams are done. The connections are opened up to a
+ * rate, and by a fixed number of simulated users: a user opens its next connection a think time
+ * after its previous one ended. A share of the connections resume the session with the stored
+ * ticket, and send their requests as 0-RTT data, the others do a full handshake.
+ *
+ * The load context does not own the socket: the caller submits the received packets to the QUIC
+ * context and sends those it prepares, opens the connections that are due and reports those that
+ * are disconnected, which records their statistics and deletes them.
+ */
+
+#ifndef DEMO_LOAD_H
+#define DEMO_LOAD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "picoquic.h"
+#include "h3zero.h"
+#include "democlient.h"
+
+/* Log-linear histogram of durations in microseconds: values below 32 have their own bucket,
+ * the others 16 buckets per power of 2, a relative error of at most 1/16 */
+#define PICOHTTP_HISTOGRAM_SUB_BITS 4
+#define PICOHTTP_HISTOGRAM_NB_BUCKETS ((65 - PICOHTTP_HISTOGRAM_SUB_BITS) << PICOHTTP_HISTOGRAM_SUB_BITS)
+
+typedef struct st_picohttp_histogram_t {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[PICOHTTP_HISTOGRAM_NB_BUCKETS];
+} picohttp_histogram_t;
+
+void picohttp_histogram_add(picohttp_histogram_t* histogram, uint64_t value);
+/* Smallest value that at least the fraction of the values do not exceed, within the bucket precision */
+uint64_t picohttp_histogram_percentile(picohttp_histogram_t const* histogram, double fraction);
+
+/* Request mix: scenarios of the demo client separated by '|', each prefixed by "<weight>@"
+ * unless its weight is 1, e.g. "9@index.html;4:style.css|video.mp4" */
+typedef struct st_picohttp_load_scenario_t {
+    unsigned int weight;
+    size_t nb_streams;
+    picoquic_demo_stream_desc_t* desc;
+} picohttp_load_scenario_t;
+
+int picohttp_load_parse_mix(char const* text, size_t* nb_scenarios, picohttp_load_scenario_t** scenarios);
+void picohttp_load_delete_mix(size_t nb_scenarios, picohttp_load_scenario_t* scenarios);
+
+typedef struct st_picohttp_load_params_t {
+    size_t nb_connections; /* Total number of connections */
+    size_t nb_users; /* Connections open at the same time, at most */
+    double connection_rate; /* New connections per second, at most, 0 for no limit */
+    uint64_t think_time; /* Microseconds between the end of a connection of a user and its next one */
+    unsigned int resume_percent; /* Share of the connections that resume the session, with 0-RTT */
+    char const* request_mix;
+    char const* sni;
+    char const* alpn;
+    uint32_t proposed_version;
+    h3zero_settings_t qpack_settings;
+} picohttp_load_params_t;
+
+typedef struct st_picohttp_load_ctx_t {
+    picohttp_load_params_t params;
+    picoquic_quic_t* quic;
+    struct sockaddr_storage server_address;
+    size_t nb_scenarios;
+    picohttp_load_scenario_t* scenarios;
+    unsigned int total_weight;
+    uint64_t* user_ready_time; /* Ring of the idle users, in the order they become ready */
+    size_t first_user;
+    size_t nb_idle_users;
+    uint64_t next_start_time; /* Per the connection rate */
+    unsigned int resume_credit;
+    uint64_t draw_state;
+    uint64_t start_time;
+    uint64_t last_end_time;
+    size_t nb_started;
+    size_t nb_open;
+    /* Statistics */
+    size_t nb_completed; /* Connections that completed all their requests */
+    size_t nb_failed;
+    size_t nb_resumed; /* PSK handshakes */
+    size_t nb_zero_rtt_accepted;
+    uint64_t nb_requests;
+    uint64_t nb_requests_failed;
+    uint64_t bytes_received;
+    picohttp_histogram_t handshake_latency;
+    picohttp_histogram_t request_latency;
+} picohttp_load_ctx_t;
+
+picohttp_load_ctx_t* picohttp_load_create(picohttp_load_params_t const* params, picoquic_quic_t* quic,
+    struct sockaddr* server_address, uint64_t current_time);
+void picohttp_load_delete(picohttp_load_ctx_t* load);
+/* Opens the connections that are due. Returns 0, or an error if a connection cannot be created */
+int picohttp_load_start_connections(picohttp_load_ctx_t* load, uint64_t current_time);
+/* Time at which the next connection is due, UINT64_MAX if none is until a connection ends */
+uint64_t picohttp_load_next_start_time(picohttp_load_ctx_t* load);
+/* Records the statistics of a disconnected connection of the load, and deletes it */
+void picohttp_load_connection_ended(picohttp_load_ctx_t* load, picoquic_cnx_t* cnx, uint64_t current_time);
+int picohttp_load_is_done(picohttp_load_ctx_t* load);
+void picohttp_load_report(picohttp_load_ctx_t* load, FILE* F);
+
+#endif /* DEMO_LOAD_H */
@@ -30,7 +30,7 @@
 #include "democlient.h"
 #include "demoserver.h"
 
-/* Stream context splay management */
+/* Stream context table management */
 
 static int64_t picohttp_stream_node_compare(void *l, void *r)
 {
@@ -49,11 +49,57 @@ static void * picohttp_stream_node_value(picosplay_node_t * node)
     return (void*)((char*)node - offsetof(struct st_picohttp_server_stream_ctx_t, http_stream_node));
 }
 
-static void picohttp_clear_stream_ctx(picohttp_server_stream_ctx_t* stream_ctx)
+static void demo_server_close_file(picohttp_server_stream_ctx_t* stream_ctx)
 {
     if (stream_ctx->F != NULL) {
         stream_ctx->F = picoquic_file_close(stream_ctx->F);
     }
+    if (stream_ctx->mapping != NULL) {
+        picohttp_file_cache_release(stream_ctx->mapping);
+        stream_ctx->mapping = NULL;
+    }
+}
+
+/* The data of a mapped file is copied straight from the mapping into the packet */
+static int demo_server_prepare_to_send(void* context, size_t space, picohttp_server_stream_ctx_t* stream_ctx)
+{
+    int ret = 0;
+
+    if (stream_ctx->mapping == NULL) {
+        ret = demo_client_prepare_to_send(context, space, stream_ctx->echo_length, &stream_ctx->echo_sent,
+            stream_ctx->F);
+    }
+    else if (stream_ctx->echo_sent < stream_ctx->echo_length) {
+        uint8_t* buffer;
+        size_t available = stream_ctx->echo_length - stream_ctx->echo_sent;
+        int is_fin = 1;
+
+        if (available > space) {
+            available = space;
+            is_fin = 0;
+        }
+
+        buffer = picoquic_provide_stream_data_buffer(context, available, is_fin, !is_fin);
+        if (buffer != NULL) {
+            memcpy(buffer, stream_ctx->mapping->bytes + stream_ctx->echo_sent, available);
+            stream_ctx->echo_sent += available;
+        }
+        else {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && stream_ctx->echo_sent >= stream_ctx->echo_length) {
+        stream_ctx->response_done = 1;
+        demo_server_close_file(stream_ctx);
+    }
+
+    return ret;
+}
+
+static void picohttp_clear_stream_ctx(picohttp_server_stream_ctx_t* stream_ctx)
+{
+    demo_server_close_file(stream_ctx);
 
     if (stream_ctx->path_callback != NULL) {
         (void)stream_ctx->path_callback(NULL, NULL, 0, picohttp_callback_reset, stream_ctx);
@@ -71,56 +117,168 @@ static void picohttp_clear_stream_ctx(picohttp_server_stream_ctx_t* stream_ctx)
 
 static void picohttp_stream_node_delete(void * tree, picosplay_node_t * node)
 {
-    picohttp_server_stream_ctx_t * stream_ctx = picohttp_stream_node_value(node);
+    /* The contexts are owned by the stream table */
+    (void)tree;
+    (void)node;
+}
 
-    picohttp_clear_stream_ctx(stream_ctx);
+static void picohttp_stream_table_init(picohttp_server_stream_table_t* table)
+{
+    memset(table, 0, sizeof(picohttp_server_stream_table_t));
+    picosplay_init_tree(&table->overflow_tree, picohttp_stream_node_compare, picohttp_stream_node_create, picohttp_stream_node_delete, picohttp_stream_node_value);
+}
 
-    free(stream_ctx);
+static void picohttp_stream_table_release(picohttp_server_stream_table_t* table)
+{
+    picohttp_server_stream_ctx_t* stream_ctx;
+
+    picosplay_empty_tree(&table->overflow_tree);
+    while ((stream_ctx = table->first_stream) != NULL) {
+        table->first_stream = stream_ctx->next_stream;
+        picohttp_clear_stream_ctx(stream_ctx);
+        free(stream_ctx);
+    }
+    while ((stream_ctx = table->first_free) != NULL) {
+        table->first_free = stream_ctx->next_stream;
+        free(stream_ctx);
+    }
+    table->nb_free = 0;
 }
 
-void picohttp_delete_stream(picosplay_tree_t * http_stream_tree, picohttp_server_stream_ctx_t* stream)
+static int picohttp_stream_in_window(picohttp_server_stream_table_t* table, uint64_t stream_id)
 {
-    picosplay_delete(http_stream_tree, &stream->http_stream_node);
+    return (stream_id & 3) == 0 && (stream_id >> 2) >= table->window_start &&
+        (stream_id >> 2) < table->window_start + PICOHTTP_STREAM_WINDOW_SIZE;
 }
 
-static picohttp_server_stream_ctx_t* picohttp_find_stream(picosplay_tree_t * stream_tree, uint64_t stream_id)
+static picohttp_server_stream_ctx_t* picohttp_find_stream(picohttp_server_stream_table_t* table, uint64_t stream_id)
 {
     picohttp_server_stream_ctx_t * ret = NULL;
-    picohttp_server_stream_ctx_t target;
-    target.stream_id = stream_id;
-    picosplay_node_t * node = picosplay_find(stream_tree, (void*)&target);
-    
-    if (node != NULL) {
-        ret = (picohttp_server_stream_ctx_t *)picohttp_stream_node_value(node);
+
+    if (picohttp_stream_in_window(table, stream_id)) {
+        ret = table->window[(stream_id >> 2) % PICOHTTP_STREAM_WINDOW_SIZE];
+        if (ret != NULL && ret->stream_id != stream_id) {
+            ret = NULL;
+        }
+    }
+    else if (table->overflow_tree.size > 0) {
+        picohttp_server_stream_ctx_t target;
+        picosplay_node_t * node;
+
+        target.stream_id = stream_id;
+        node = picosplay_find(&table->overflow_tree, (void*)&target);
+        if (node != NULL) {
+            ret = (picohttp_server_stream_ctx_t *)picohttp_stream_node_value(node);
+        }
     }
 
     return ret;
 }
 
+static void picohttp_stream_table_insert(picohttp_server_stream_table_t* table, picohttp_server_stream_ctx_t* stream_ctx)
+{
+    uint64_t index = stream_ctx->stream_id >> 2;
+
+    if ((stream_ctx->stream_id & 3) == 0 && index >= table->window_start + PICOHTTP_STREAM_WINDOW_SIZE) {
+        /* Slide the window up to the new stream, the older streams still open overflow */
+        uint64_t window_start = index - PICOHTTP_STREAM_WINDOW_SIZE + 1;
+
+        for (uint64_t i = table->window_start; i < window_start && i < table->window_start + PICOHTTP_STREAM_WINDOW_SIZE; i++) {
+            picohttp_server_stream_ctx_t** slot = &table->window[i % PICOHTTP_STREAM_WINDOW_SIZE];
+            if (*slot != NULL) {
+                picosplay_insert(&table->overflow_tree, *slot);
+                *slot = NULL;
+            }
+        }
+        table->window_start = window_start;
+    }
+
+    if (picohttp_stream_in_window(table, stream_ctx->stream_id)) {
+        table->window[index % PICOHTTP_STREAM_WINDOW_SIZE] = stream_ctx;
+    }
+    else {
+        picosplay_insert(&table->overflow_tree, stream_ctx);
+    }
+
+    stream_ctx->previous_stream = NULL;
+    stream_ctx->next_stream = table->first_stream;
+    if (table->first_stream != NULL) {
+        table->first_stream->previous_stream = stream_ctx;
+    }
+    table->first_stream = stream_ctx;
+}
+
+/* Called once the request is received and the response sent or reset. The stream
+ * context is detached from the QUIC stream, which may still get late events. */
+static void picohttp_retire_stream(picoquic_cnx_t* cnx, picohttp_server_stream_table_t* table, picohttp_server_stream_ctx_t* stream_ctx)
+{
+    (void)picoquic_set_app_stream_ctx(cnx, stream_ctx->stream_id, NULL);
+
+    if (picohttp_stream_in_window(table, stream_ctx->stream_id)) {
+        table->window[(stream_ctx->stream_id >> 2) % PICOHTTP_STREAM_WINDOW_SIZE] = NULL;
+    }
+    else {
+        picosplay_delete_hint(&table->overflow_tree, &stream_ctx->http_stream_node);
+    }
+
+    if (stream_ctx->previous_stream == NULL) {
+        table->first_stream = stream_ctx->next_stream;
+    }
+    else {
+        stream_ctx->previous_stream->next_stream = stream_ctx->next_stream;
+    }
+    if (stream_ctx->next_stream != NULL) {
+        stream_ctx->next_stream->previous_stream = stream_ctx->previous_stream;
+    }
+
+    picohttp_clear_stream_ctx(stream_ctx);
+    if (table->nb_free < PICOHTTP_STREAM_POOL_MAX) {
+        stream_ctx->next_stream = table->first_free;
+        table->first_free = stream_ctx;
+        table->nb_free++;
+    }
+    else {
+        free(stream_ctx);
+    }
+}
+
+static void picohttp_check_stream_done(picoquic_cnx_t* cnx, picohttp_server_stream_table_t* table, picohttp_server_stream_ctx_t* stream_ctx)
+{
+    if (stream_ctx != NULL && stream_ctx->fin_received && stream_ctx->response_done) {
+        picohttp_retire_stream(cnx, table, stream_ctx);
+    }
+}
+
 static picohttp_server_stream_ctx_t * picohttp_find_or_create_stream(
     picoquic_cnx_t* cnx,
     uint64_t stream_id,
-    picosplay_tree_t * stream_tree,
-    picohttp_server_stream_ctx_t ** p_first_stream,
+    picohttp_server_stream_table_t * table,
     int should_create,
     int is_h3)
 {
-    picohttp_server_stream_ctx_t * stream_ctx = picohttp_find_stream(stream_tree, stream_id);
+    picohttp_server_stream_ctx_t * stream_ctx = picohttp_find_stream(table, stream_id);
 
     /* if stream is already present, check its state. New bytes? */
 
     if (stream_ctx == NULL && should_create) {
-        stream_ctx = (picohttp_server_stream_ctx_t*)
-            malloc(sizeof(picohttp_server_stream_ctx_t));
+        if ((stream_ctx = table->first_free) != NULL) {
+            table->first_free = stream_ctx->next_stream;
+            table->nb_free--;
+        }
+        else {
+            stream_ctx = (picohttp_server_stream_ctx_t*)malloc(sizeof(picohttp_server_stream_ctx_t));
+        }
         if (stream_ctx == NULL) {
             /* Could not handle this stream */
             picoquic_reset_stream(cnx, stream_id, H3ZERO_INTERNAL_ERROR);
         }
         else {
-            memset(stream_ctx, 0, sizeof(picohttp_server_stream_ctx_t));
+            /* Only the start of the context, the frame buffer is written before it is read */
+            memset(stream_ctx, 0, offsetof(struct st_picohttp_server_stream_ctx_t, frame));
+            memset(&stream_ctx->method, 0, sizeof(picohttp_server_stream_ctx_t) - offsetof(struct st_picohttp_server_stream_ctx_t, method));
             stream_ctx->stream_id = stream_id;
             stream_ctx->is_h3 = is_h3;
-            picosplay_insert(stream_tree, stream_ctx);
+            picohttp_stream_table_insert(table, stream_ctx);
         }
     }
 
@@ -138,9 +296,8 @@ static h3zero_server_callback_ctx_t* h3zero_server_callback_create_context(picoh
     if (ctx != NULL) {
         memset(ctx, 0, sizeof(h3zero_server_callback_ctx_t));
 
-        picosplay_init_tree(&ctx->h3_stream_tree, picohttp_stream_node_compare, picohttp_stream_node_create, picohttp_stream_node_delete, picohttp_stream_node_value);
+        picohttp_stream_table_init(&ctx->stream_table);
 
-        ctx->first_stream = NULL;
         ctx->buffer = (uint8_t*)malloc(PICOHTTP_RESPONSE_MAX);
         if (ctx->buffer == NULL) {
             free(ctx);
@@ -152,6 +309,13 @@ static h3zero_server_callback_ctx_t* h3zero_server_callback_create_context(picoh
                 ctx->path_table = param->path_table;
                 ctx->path_table_nb = param->path_table_nb;
                 ctx->web_folder = param->web_folder;
+                ctx->file_cache = param->file_cache;
+            }
+            if (h3zero_qpack_init(&ctx->qpack, (param == NULL) ? NULL : &param->qpack_settings) != 0) {
+                h3zero_qpack_release(&ctx->qpack);
+                free(ctx->buffer);
+                free(ctx);
+                ctx = NULL;
             }
         }
     }
@@ -161,7 +325,8 @@ static h3zero_server_callback_ctx_t* h3zero_server_callback_create_context(picoh
 
 static void h3zero_server_callback_delete_context(h3zero_server_callback_ctx_t* ctx)
 {
-    picosplay_empty_tree(&ctx->h3_stream_tree);
+    picohttp_stream_table_release(&ctx->stream_table);
+    h3zero_qpack_release(&ctx->qpack);
 
     if (ctx->buffer != NULL) {
         free(ctx->buffer);
@@ -240,7 +405,8 @@ int demo_server_is_path_sane(const uint8_t* path, size_t path_length)
     return ret;
 }
 
-int demo_server_try_file_path(const uint8_t* path, size_t path_length, size_t* echo_size, h3zero_content_type_enum *content_type, FILE** pF, char const* web_folder)
+int demo_server_try_file_path(const uint8_t* path, size_t path_length, size_t* echo_size, h3zero_content_type_enum *content_type, FILE** pF,
+    picohttp_file_cache_t* file_cache, picohttp_file_mapping_t** p_mapping, char const* web_folder)
 {
     int ret = -1;
     char file_name[1024];
@@ -263,9 +429,11 @@ int demo_server_try_file_path(const uint8_t* path, size_t path_length, size_t* e
         len += path_length - 1;
         file_name[len] = 0;
 
-        *pF = picoquic_file_open(file_name, "rb");
-
-        if (*pF != NULL) {
+        if (file_cache != NULL && (*p_mapping = picohttp_file_cache_get(file_cache, file_name)) != NULL) {
+            *echo_size = (*p_mapping)->length;
+            ret = 0;
+        }
+        else if ((*pF = picoquic_file_open(file_name, "rb")) != NULL) {
             long sz;
             fseek(*pF, 0, SEEK_END);
             sz = ftell(*pF);
@@ -312,7 +480,8 @@ int demo_server_try_file_path(const uint8_t* path, size_t path_length, size_t* e
 }
 
 
-static int demo_server_parse_path(const uint8_t * path, size_t path_length, size_t * echo_size, h3zero_content_type_enum *content_type, FILE ** pF, char const * web_folder)
+static int demo_server_parse_path(const uint8_t * path, size_t path_length, size_t * echo_size, h3zero_content_type_enum *content_type, FILE ** pF,
+    picohttp_file_cache_t* file_cache, picohttp_file_mapping_t** p_mapping, char const * web_folder)
 {
     int ret = 0;
 
@@ -327,7 +496,7 @@ static int demo_server_parse_path(const uint8_t * path, size_t path_length, size
     if (path == NULL || path_length == 0 || path[0] != '/') {
         ret = -1;
     }
-    else if (web_folder != NULL && demo_server_try_file_path(path, path_length, echo_size, content_type, pF, web_folder) == 0) {
+    else if (web_folder != NULL && demo_server_try_file_path(path, path_length, echo_size, content_type, pF, file_cache, p_mapping, web_folder) == 0) {
         ret = 0;
     }
     else if (path_length > 1 && (path_length != 11 || memcmp(path, "/index.html", 11) != 0)) {
@@ -355,6 +524,29 @@ static int demo_server_parse_path(const uint8_t * path, size_t path_length, size
  * This function is called after the client's stream is closed,
  * after verifying that a request was received */
 
+/* Encodes the start of the h3 response of a file, as cached for the later requests of its path:
+ * the header frame, then the header of the data frame carrying the file */
+static size_t demo_server_file_response_prefix(uint8_t* prefix, size_t prefix_max, h3zero_content_type_enum content_type, size_t length)
+{
+    uint8_t* bytes = prefix;
+    uint8_t* bytes_max = prefix + prefix_max;
+    size_t ld = 0;
+
+    *bytes++ = h3zero_frame_header;
+    bytes += 2; /* reserve two bytes for frame length */
+    bytes = h3zero_create_response_header_frame(bytes, bytes_max, content_type);
+
+    if (bytes != NULL && bytes + 2 < bytes_max) {
+        size_t header_length = bytes - &prefix[3];
+        prefix[1] = (uint8_t)((header_length >> 8) | 0x40);
+        prefix[2] = (uint8_t)(header_length & 0xFF);
+        *bytes++ = h3zero_frame_data;
+        ld = picoquic_varint_encode(bytes, bytes_max - bytes, length);
+    }
+
+    return (ld == 0) ? 0 : (bytes + ld) - prefix;
+}
+
 static int h3zero_server_process_request_frame(
     picoquic_cnx_t* cnx,
     picohttp_server_stream_ctx_t * stream_ctx,
@@ -367,9 +559,36 @@ static int h3zero_server_process_request_frame(
     uint8_t * o_bytes_max = o_bytes + sizeof(buffer);
     size_t response_length = 0;
     int ret = 0;
+    picohttp_cached_response_t* cached = NULL;
 
     h3zero_content_type_enum content_type = h3zero_content_type_text_plain;
 
+    if (!stream_ctx->is_priority_updated) {
+        /* Without a priority header, the response is not incremental, as in RFC 9218 */
+        h3zero_header_parts_t const * header = &stream_ctx->ps.stream_state.header;
+
+        (void)picoquic_set_stream_priority(cnx, stream_ctx->stream_id,
+            (header->priority_found) ? header->urgency : H3ZERO_PRIORITY_URGENCY_DEFAULT,
+            header->priority_found && header->is_incremental);
+    }
+
+    if (stream_ctx->ps.stream_state.header.method == h3zero_method_get && app_ctx->file_cache != NULL &&
+        (cached = picohttp_response_cache_get(app_ctx->file_cache, stream_ctx->ps.stream_state.header.path,
+            stream_ctx->ps.stream_state.header.path_length, picoquic_get_quic_time(cnx->quic))) != NULL) {
+        /* The path is neither resolved nor the file opened again, and the response header is ready */
+        picohttp_file_cache_hold(cached->mapping);
+        stream_ctx->mapping = cached->mapping;
+        stream_ctx->echo_length = cached->mapping->length;
+        if (picoquic_add_to_stream_with_ctx(cnx, stream_ctx->stream_id, cached->prefix, cached->prefix_length, 0, stream_ctx) != 0) {
+            ret = picoquic_reset_stream(cnx, stream_ctx->stream_id, H3ZERO_INTERNAL_ERROR);
+            stream_ctx->response_done = 1;
+        }
+        else {
+            ret = picoquic_mark_active_stream(cnx, stream_ctx->stream_id, 1, stream_ctx);
+        }
+        return ret;
+    }
+
     *o_bytes++ = h3zero_frame_header;
     o_bytes += 2; /* reserve two bytes for frame length */
 
@@ -379,7 +598,8 @@ static int h3zero_server_process_request_frame(
         o_bytes = h3zero_create_bad_method_header_frame(o_bytes, o_bytes_max);
     }
     else if (stream_ctx->ps.stream_state.header.method == h3zero_method_get &&
-        demo_server_parse_path(stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length, &stream_ctx->echo_length, &content_type, &stream_ctx->F, app_ctx->web_folder) != 0) {
+        demo_server_parse_path(stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length, &stream_ctx->echo_length, &content_type, &stream_ctx->F,
+            app_ctx->file_cache, &stream_ctx->mapping, app_ctx->web_folder) != 0) {
         /* If unknown, 404 */
         o_bytes = h3zero_create_not_found_header_frame(o_bytes, o_bytes_max);
         /* TODO: consider known-url?data construct */
@@ -458,14 +678,163 @@ static int h3zero_server_process_request_frame(
             if (ret != 0) {
                 o_bytes = NULL;
             }
+            else if (stream_ctx->mapping != NULL) {
+                /* Failing to cache the response only costs the next requests */
+                (void)picohttp_response_cache_add(app_ctx->file_cache, stream_ctx->ps.stream_state.header.path,
+                    stream_ctx->ps.stream_state.header.path_length, stream_ctx->mapping, buffer, o_bytes - buffer,
+                    picoquic_get_quic_time(cnx->quic));
+            }
         }
 
         if (o_bytes == NULL) {
             ret = picoquic_reset_stream(cnx, stream_ctx->stream_id, H3ZERO_INTERNAL_ERROR);
+            stream_ctx->response_done = 1;
         }
         else if (stream_ctx->echo_length != 0 || response_length > sizeof(post_response)) {
             ret = picoquic_mark_active_stream(cnx, stream_ctx->stream_id, 1, stream_ctx);
         }
+        else {
+            stream_ctx->response_done = 1;
+        }
+    }
+
+    return ret;
+}
+
+/* The instructions of the encoder and the decoder go on their streams as soon as produced */
+static int h3zero_server_flush_qpack(picoquic_cnx_t* cnx, h3zero_qpack_t * qpack)
+{
+    int ret = 0;
+
+    if (qpack->encoder.instructions.length > 0) {
+        ret = picoquic_add_to_stream(cnx, 7, qpack->encoder.instructions.bytes, qpack->encoder.instructions.length, 0);
+        qpack->encoder.instructions.length = 0;
+    }
+    if (ret == 0 && qpack->decoder.instructions.length > 0) {
+        ret = picoquic_add_to_stream(cnx, 11, qpack->decoder.instructions.bytes, qpack->decoder.instructions.length, 0);
+        qpack->decoder.instructions.length = 0;
+    }
+
+    return ret;
+}
+
+static int h3zero_server_stream_data(
+    picoquic_cnx_t* cnx, picohttp_server_stream_ctx_t * stream_ctx,
+    uint8_t* bytes, size_t length, h3zero_server_callback_ctx_t* ctx)
+{
+    int ret = 0;
+    uint64_t stream_id = stream_ctx->stream_id;
+    uint16_t error_found = 0;
+    size_t available_data = 0;
+    uint8_t * bytes_max = bytes + length;
+
+    while (bytes < bytes_max) {
+        bytes = h3zero_parse_data_stream(bytes, bytes_max, &stream_ctx->ps.stream_state, &available_data, &error_found);
+        if (bytes == NULL) {
+            ret = picoquic_close(cnx, error_found);
+            break;
+        }
+        else if (available_data > 0) {
+            if (stream_ctx->ps.stream_state.header_found && stream_ctx->post_received == 0) {
+                int path_item = picohttp_find_path_item(stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length, ctx->path_table, ctx->path_table_nb);
+                if (path_item >= 0) {
+                    stream_ctx->path_callback = ctx->path_table[path_item].path_callback;
+                    stream_ctx->path_callback(cnx, (uint8_t*)stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length, picohttp_callback_post, stream_ctx);
+                }
+
+                (void)picoquic_set_app_stream_ctx(cnx, stream_id, stream_ctx);
+            }
+
+            /* Received data for a POST command. */
+            if (stream_ctx->path_callback != NULL) {
+                /* if known URL, pass the data to URL specific callback. */
+                ret = stream_ctx->path_callback(cnx, bytes, available_data, picohttp_callback_post_data, stream_ctx);
+            }
+            stream_ctx->post_received += available_data;
+            bytes += available_data;
+        }
+    }
+
+    if (ret == 0 && bytes != NULL) {
+        /* Acknowledge the sections that used the dynamic table */
+        ret = h3zero_server_flush_qpack(cnx, &ctx->qpack);
+    }
+
+    return ret;
+}
+
+static int h3zero_server_stream_fin(
+    picoquic_cnx_t* cnx, picohttp_server_stream_ctx_t * stream_ctx, h3zero_server_callback_ctx_t* ctx)
+{
+    int ret;
+
+    /* Process the request header. */
+    if (stream_ctx->ps.stream_state.header_found) {
+        ret = h3zero_server_process_request_frame(cnx, stream_ctx, ctx);
+    }
+    else {
+        /* Unexpected end of stream before the header is received */
+        ret = picoquic_reset_stream(cnx, stream_ctx->stream_id, H3ZERO_FRAME_ERROR);
+    }
+
+    return ret;
+}
+
+/* The instructions of the encoder of the client may unblock the requests
+ * that refer to the entries they insert. The PRIORITY_UPDATE frames on its
+ * control stream apply to the requests already open, the others are dropped. */
+static int h3zero_server_uni_stream(picoquic_cnx_t* cnx, uint64_t stream_id,
+    uint8_t* bytes, size_t length, h3zero_server_callback_ctx_t* ctx)
+{
+    int ret = 0;
+    uint16_t error_found = h3zero_qpack_receive_uni_stream(&ctx->qpack, stream_id, bytes, length);
+    picohttp_server_stream_ctx_t * next_stream = ctx->stream_table.first_stream;
+    h3zero_priority_update_t update;
+
+    if (error_found != 0) {
+        return picoquic_close(cnx, error_found);
+    }
+
+    while (h3zero_qpack_next_priority_update(&ctx->qpack, &update)) {
+        picohttp_server_stream_ctx_t * stream_ctx = picohttp_find_or_create_stream(cnx, update.stream_id, &ctx->stream_table, 0, 1);
+
+        if (stream_ctx != NULL) {
+            stream_ctx->is_priority_updated = 1;
+            (void)picoquic_set_stream_priority(cnx, update.stream_id, update.urgency, update.is_incremental);
+        }
+    }
+
+    while (ret == 0 && next_stream != NULL) {
+        /* Processing the request may retire the stream */
+        picohttp_server_stream_ctx_t * stream_ctx = next_stream;
+        next_stream = stream_ctx->next_stream;
+
+        if (stream_ctx->is_h3 && stream_ctx->ps.stream_state.header_blocked) {
+            uint8_t* kept_bytes = NULL;
+            size_t kept_length = 0;
+            int unblocked = h3zero_unblock_data_stream(&stream_ctx->ps.stream_state, &kept_bytes, &kept_length, &error_found);
+
+            if (unblocked < 0) {
+                ret = picoquic_close(cnx, error_found);
+            }
+            else if (unblocked > 0) {
+                if (kept_length > 0) {
+                    ret = h3zero_server_stream_data(cnx, stream_ctx, kept_bytes, kept_length, ctx);
+                }
+                if (ret == 0 && stream_ctx->ps.stream_state.blocked_fin && !stream_ctx->ps.stream_state.header_blocked) {
+                    stream_ctx->ps.stream_state.blocked_fin = 0;
+                    ret = h3zero_server_stream_fin(cnx, stream_ctx, ctx);
+                    picohttp_check_stream_done(cnx, &ctx->stream_table, stream_ctx);
+                }
+            }
+            if (kept_bytes != NULL) {
+                free(kept_bytes);
+            }
+        }
+    }
+
+    if (ret == 0) {
+        ret = h3zero_server_flush_qpack(cnx, &ctx->qpack);
     }
 
     return ret;
@@ -507,7 +876,7 @@ static int h3zero_server_callback_data(
         else {
             /* Find or create stream context */
             if (stream_ctx == NULL) {
-                stream_ctx = picohttp_find_or_create_stream(cnx, stream_id, &ctx->h3_stream_tree, &ctx->first_stream, 1, 1);
+                stream_ctx = picohttp_find_or_create_stream(cnx, stream_id, &ctx->stream_table, 1, 1);
             }
 
             if (stream_ctx == NULL) {
@@ -518,58 +887,29 @@ static int h3zero_server_callback_data(
                 }
             }
             else {
-                uint16_t error_found = 0;
-                size_t available_data = 0;
-                uint8_t * bytes_max = bytes + length;
-                while (bytes < bytes_max) {
-                    bytes = h3zero_parse_data_stream(bytes, bytes_max, &stream_ctx->ps.stream_state, &available_data, &error_found);
-                    if (bytes == NULL) {
-                        ret = picoquic_close(cnx, error_found);
-                        break;
-                    }
-                    else if (available_data > 0) {
-                        if (stream_ctx->ps.stream_state.header_found && stream_ctx->post_received == 0) {
-                            int path_item = picohttp_find_path_item(stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length, ctx->path_table, ctx->path_table_nb);
-                            if (path_item >= 0) {
-                                stream_ctx->path_callback = ctx->path_table[path_item].path_callback;
-                                stream_ctx->path_callback(cnx, (uint8_t*)stream_ctx->ps.stream_state.header.path, stream_ctx->ps.stream_state.header.path_length, picohttp_callback_post, stream_ctx);
-                            }
-
-                            (void)picoquic_set_app_stream_ctx(cnx, stream_id, stream_ctx);
-                        }
-
-                        /* Received data for a POST command. */
-                        if (stream_ctx->path_callback != NULL) {
-                            /* if known URL, pass the data to URL specific callback. */
-                            ret = stream_ctx->path_callback(cnx, bytes, available_data, picohttp_callback_post_data, stream_ctx);
-                        }
-                        stream_ctx->post_received += available_data;
-                        bytes += available_data;
-                    }
+                if (stream_ctx->ps.stream_state.decoder == NULL) {
+                    stream_ctx->ps.stream_state.decoder = &ctx->qpack.decoder;
+                    stream_ctx->ps.stream_state.stream_id = stream_id;
                 }
-                
+                ret = h3zero_server_stream_data(cnx, stream_ctx, bytes, length, ctx);
+
                 if (ret == 0 && fin_or_event == picoquic_callback_stream_fin) {
-                    /* Process the request header. */
-                    if (stream_ctx->ps.stream_state.header_found) {
-                        ret = h3zero_server_process_request_frame(cnx, stream_ctx, ctx);
+                    stream_ctx->fin_received = 1;
+                    if (stream_ctx->ps.stream_state.header_blocked) {
+                        /* The request is processed once its header is decoded */
+                        stream_ctx->ps.stream_state.blocked_fin = 1;
                     }
                     else {
-                        /* Unexpected end of stream before the header is received */
-                        ret = picoquic_reset_stream(cnx, stream_id, H3ZERO_FRAME_ERROR);
+                        ret = h3zero_server_stream_fin(cnx, stream_ctx, ctx);
+                        picohttp_check_stream_done(cnx, &ctx->stream_table, stream_ctx);
                     }
                 }
             }
         }
     }
     else {
-        /* TODO: If unidir stream, check what type of stream */
-        /* TODO: If this is a control stream, and setting is not received yet,
-         * wait for the setting frame, then process it and move the
-         * state to absorbing.*/
-         /* TODO: Beside control stream, we also absorb the push streams and
-          * the reserved streams (*1F). In fact, we implement that by
-          * just switching the state to absorbing. */
-          /* For now, do nothing, just ignore the data */
+        /* Control and QPACK streams of the client, the other types are absorbed */
+        ret = h3zero_server_uni_stream(cnx, stream_id, bytes, length, ctx);
     }
 
     return ret;
@@ -583,7 +923,7 @@ int h3zero_server_callback_prepare_to_send(picoquic_cnx_t* cnx,
     int ret = -1;
 
     if (stream_ctx == NULL) {
-        stream_ctx = picohttp_find_or_create_stream(cnx, stream_id, &ctx->h3_stream_tree, &ctx->first_stream, 0, 1);
+        stream_ctx = picohttp_find_or_create_stream(cnx, stream_id, &ctx->stream_table, 0, 1);
     }
 
     if (stream_ctx == NULL) {
@@ -596,22 +936,23 @@ int h3zero_server_callback_prepare_to_send(picoquic_cnx_t* cnx,
         }
         else {
             /* default reply for known URL */
-            ret = demo_client_prepare_to_send(context, space, stream_ctx->echo_length, &stream_ctx->echo_sent,
-                stream_ctx->F);
-            if (stream_ctx->F != NULL && stream_ctx->echo_sent >= stream_ctx->echo_length) {
-                stream_ctx->F = picoquic_file_close(stream_ctx->F);
-            }
+            ret = demo_server_prepare_to_send(context, space, stream_ctx);
+            picohttp_check_stream_done(cnx, &ctx->stream_table, stream_ctx);
         }
     }
 
     return ret;
 }
 
-static int h3zero_server_init(picoquic_cnx_t* cnx)
+static int h3zero_server_init(picoquic_cnx_t* cnx, h3zero_qpack_t * qpack)
 {
     uint8_t decoder_stream_head = 0x03;
     uint8_t encoder_stream_head = 0x02;
-    int ret = picoquic_add_to_stream(cnx, 3, h3zero_default_setting_frame, h3zero_default_setting_frame_size, 0);
+    uint8_t setting_frame[32];
+    uint8_t * setting_frame_end = h3zero_create_setting_frame(setting_frame, setting_frame + sizeof(setting_frame),
+        &qpack->local_settings);
+    int ret = (setting_frame_end == NULL) ? -1 :
+        picoquic_add_to_stream(cnx, 3, setting_frame, setting_frame_end - setting_frame, 0);
 
     /*if (ret == 0) {
         // set the stream #3 to be the next stream to write!
@@ -619,12 +960,12 @@ static int h3zero_server_init(picoquic_cnx_t* cnx)
     }*/
 
     if (ret == 0) {
-        /* set the stream 7 as the encoder stream, although we do not actually create dynamic codes. */
+        /* set the stream 7 as the encoder stream. The responses only use the static table, so it stays empty. */
         ret = picoquic_add_to_stream(cnx, 7, &encoder_stream_head, 1, 0);
     }
 
     if (ret == 0) {
-        /* set the stream 11 as the decoder stream, although we do not actually create dynamic codes. */
+        /* set the stream 11 as the decoder stream, for the acknowledgements of the requests. */
         ret = picoquic_add_to_stream(cnx, 11, &decoder_stream_head, 1, 0);
     }
 
@@ -664,7 +1005,7 @@ int h3zero_server_callback(picoquic_cnx_t* cnx,
         }
         else {
             picoquic_set_callback(cnx, h3zero_server_callback, ctx);
-            ret = h3zero_server_init(cnx);
+            ret = h3zero_server_init(cnx, &ctx->qpack);
         }
     } else{
         ctx = (h3zero_server_callback_ctx_t*)callback_ctx;
@@ -681,19 +1022,23 @@ int h3zero_server_callback(picoquic_cnx_t* cnx,
         case picoquic_callback_stop_sending: /* Client asks server to reset stream #x */
             /* TODO: special case for uni streams. */
             if (stream_ctx == NULL) {
-                stream_ctx = picohttp_find_or_create_stream(cnx, stream_id, &ctx->h3_stream_tree, &ctx->first_stream, 0, 1);
+                stream_ctx = picohttp_find_or_create_stream(cnx, stream_id, &ctx->stream_table, 0, 1);
             }
+            picoquic_reset_stream(cnx, stream_id, 0);
             if (stream_ctx != NULL) {
                 /* reset post callback. */
                 if (stream_ctx->path_callback != NULL) {
                     ret = stream_ctx->path_callback(NULL, NULL, 0, picohttp_callback_reset, stream_ctx);
+                    stream_ctx->path_callback = NULL;
                 }
 
-                if (stream_ctx->F != NULL) {
-                    stream_ctx->F = picoquic_file_close(stream_ctx->F);
+                demo_server_close_file(stream_ctx);
+                stream_ctx->response_done = 1;
+                if (fin_or_event == picoquic_callback_stream_reset) {
+                    stream_ctx->fin_received = 1;
                 }
+                picohttp_check_stream_done(cnx, &ctx->stream_table, stream_ctx);
             }
-            picoquic_reset_stream(cnx, stream_id, 0);
             break;
         case picoquic_callback_stateless_reset:
         case picoquic_callback_close: /* Received connection close */
@@ -706,7 +1051,7 @@ int h3zero_server_callback(picoquic_cnx_t* cnx,
         case picoquic_callback_stream_gap:
             /* Gap indication, when unreliable streams are supported */
             if (stream_ctx == NULL) {
-                stream_ctx = picohttp_find_or_create_stream(cnx, stream_id, &ctx->h3_stream_tree, &ctx->first_stream, 0, 1);
+                stream_ctx = picohttp_find_or_create_stream(cnx, stream_id, &ctx->stream_table, 0, 1);
             }
             if (stream_ctx != NULL) {
                 if (stream_ctx->path_callback != NULL) {
@@ -766,13 +1111,13 @@ static picoquic_h09_server_callback_ctx_t* first_server_callback_create_context(
     if (ctx != NULL) {
         memset(ctx, 0, sizeof(picoquic_h09_server_callback_ctx_t));
 
-        picosplay_init_tree(&ctx->h09_stream_tree, picohttp_stream_node_compare, picohttp_stream_node_create, picohttp_stream_node_delete, picohttp_stream_node_value);
+        picohttp_stream_table_init(&ctx->stream_table);
 
-        ctx->first_stream = NULL;
         if (param != NULL) {
             ctx->path_table = param->path_table;
             ctx->path_table_nb = param->path_table_nb;
             ctx->web_folder = param->web_folder;
+            ctx->file_cache = param->file_cache;
         }
     }
 
@@ -781,8 +1126,7 @@ static picoquic_h09_server_callback_ctx_t* first_server_callback_create_context(
 
 static void picoquic_h09_server_callback_delete_context(picoquic_h09_server_callback_ctx_t* ctx)
 {
-
-    picosplay_empty_tree(&ctx->h09_stream_tree);
+    picohttp_stream_table_release(&ctx->stream_table);
 
     free(ctx);
 }
@@ -1053,10 +1397,29 @@ int picoquic_h09_server_process_data(picoquic_cnx_t* cnx,
                 stream_id, strip_endofline(buf, sizeof(buf), (char*)&stream_ctx->frame));
 
             if (stream_ctx->method == 0) {
-                if (demo_server_parse_path(stream_ctx->ps.hq.path, stream_ctx->ps.hq.path_length, &stream_ctx->echo_length,
-                    NULL, &stream_ctx->F, app_ctx->web_folder)) {
+                picohttp_cached_response_t* cached = NULL;
+                h3zero_content_type_enum content_type = h3zero_content_type_text_plain;
+
+                if (app_ctx->file_cache != NULL && (cached = picohttp_response_cache_get(app_ctx->file_cache,
+                    stream_ctx->ps.hq.path, stream_ctx->ps.hq.path_length, picoquic_get_quic_time(cnx->quic))) != NULL) {
+                    picohttp_file_cache_hold(cached->mapping);
+                    stream_ctx->mapping = cached->mapping;
+                    stream_ctx->echo_length = cached->mapping->length;
+                }
+                else if (demo_server_parse_path(stream_ctx->ps.hq.path, stream_ctx->ps.hq.path_length, &stream_ctx->echo_length,
+                    &content_type, &stream_ctx->F, app_ctx->file_cache, &stream_ctx->mapping, app_ctx->web_folder)) {
                     is_not_found = 1;
                 }
+                else if (stream_ctx->mapping != NULL) {
+                    /* Cached with the start of its h3 response, for the requests of both protocols */
+                    uint8_t prefix[PICOHTTP_RESPONSE_PREFIX_MAX];
+                    size_t prefix_length = demo_server_file_response_prefix(prefix, sizeof(prefix), content_type, stream_ctx->echo_length);
+
+                    if (prefix_length > 0) {
+                        (void)picohttp_response_cache_add(app_ctx->file_cache, stream_ctx->ps.hq.path, stream_ctx->ps.hq.path_length,
+                            stream_ctx->mapping, prefix, prefix_length, picoquic_get_quic_time(cnx->quic));
+                    }
+                }
             }
             else if (stream_ctx->method == 1) {
                 if (stream_ctx->post_received == 0) {
@@ -1101,6 +1464,7 @@ int picoquic_h09_server_process_data(picoquic_cnx_t* cnx,
                 stream_ctx->response_length = strlen(bad_request_message);
                 (void)picoquic_add_to_stream_with_ctx(cnx, stream_ctx->stream_id, (const uint8_t*)bad_request_message,
                     stream_ctx->response_length, 1, (void*)stream_ctx);
+                stream_ctx->response_done = 1;
             }
             else {
                 /* If this is HTTP1, send an HTTP1 OK message, with the appropriate content type */
@@ -1117,6 +1481,7 @@ int picoquic_h09_server_process_data(picoquic_cnx_t* cnx,
                     stream_ctx->response_length = strlen(demo_server_default_page);
                     picoquic_add_to_stream_with_ctx(cnx, stream_id, (uint8_t*)demo_server_default_page,
                         stream_ctx->response_length, 1, (void*)stream_ctx);
+                    stream_ctx->response_done = 1;
                 }
                 else if (stream_ctx->echo_length == 0 && stream_ctx->response_length < sizeof(post_response)) {
                     /* For short responses, post directly.
@@ -1124,6 +1489,7 @@ int picoquic_h09_server_process_data(picoquic_cnx_t* cnx,
                      * will have set a data provision shortcut. Verify that! */
                     picoquic_add_to_stream_with_ctx(cnx, stream_id, post_response,
                         stream_ctx->response_length, 1, (void*)stream_ctx);
+                    stream_ctx->response_done = 1;
                 }
                 else {
                     picoquic_mark_active_stream(cnx, stream_ctx->stream_id, 1, stream_ctx);
@@ -1198,7 +1564,7 @@ int picoquic_h09_server_callback(picoquic_cnx_t* cnx,
     }
 
     if (stream_ctx == NULL) {
-        stream_ctx = picohttp_find_or_create_stream(cnx, stream_id, &ctx->h09_stream_tree, &ctx->first_stream, 1, 0);
+        stream_ctx = picohttp_find_or_create_stream(cnx, stream_id, &ctx->stream_table, 1, 0);
     }
 
     switch (fin_or_event) {
@@ -1208,8 +1574,10 @@ int picoquic_h09_server_callback(picoquic_cnx_t* cnx,
         picoquic_reset_stream(cnx, stream_id, 0);
         if (cnx->quic->F_log)
             fprintf(cnx->quic->F_log, "Server CB, Stop Sending Stream: %" PRIu64 ", resetting the local stream.\n", stream_id);
-        if (stream_ctx != NULL && stream_ctx->F != NULL) {
-            stream_ctx->F = picoquic_file_close(stream_ctx->F);
+        if (stream_ctx != NULL) {
+            demo_server_close_file(stream_ctx);
+            stream_ctx->response_done = 1;
+            picohttp_check_stream_done(cnx, &ctx->stream_table, stream_ctx);
         }
         return 0;
     case picoquic_callback_stream_reset:
@@ -1219,8 +1587,11 @@ int picoquic_h09_server_callback(picoquic_cnx_t* cnx,
         if (cnx->quic->F_log)
             fprintf(cnx->quic->F_log, "Server CB, Reset Stream: %" PRIu64 ", resetting the local stream.\n", stream_id);
 
-        if (stream_ctx != NULL && stream_ctx->F != NULL) {
-            stream_ctx->F = picoquic_file_close(stream_ctx->F);
+        if (stream_ctx != NULL) {
+            demo_server_close_file(stream_ctx);
+            stream_ctx->fin_received = 1;
+            stream_ctx->response_done = 1;
+            picohttp_check_stream_done(cnx, &ctx->stream_table, stream_ctx);
         }
         return 0;
     case picoquic_callback_prepare_to_send:
@@ -1236,11 +1607,8 @@ int picoquic_h09_server_callback(picoquic_cnx_t* cnx,
                 }
                 else {
                     /* TODO-POST: notify callback. */
-                    int ret = demo_client_prepare_to_send((void*)bytes, length, stream_ctx->echo_length, &stream_ctx->echo_sent,
-                        stream_ctx->F);
-                    if (stream_ctx->F != NULL && stream_ctx->echo_sent >= stream_ctx->echo_length) {
-                        stream_ctx->F = picoquic_file_close(stream_ctx->F);
-                    }
+                    int ret = demo_server_prepare_to_send((void*)bytes, length, stream_ctx);
+                    picohttp_check_stream_done(cnx, &ctx->stream_table, stream_ctx);
                     return ret;
                 }
             }
@@ -1261,6 +1629,10 @@ int picoquic_h09_server_callback(picoquic_cnx_t* cnx,
         if (picoquic_h09_server_process_data(cnx, stream_id, bytes, length, fin_or_event, ctx, stream_ctx)) {
             /* something bad happened. */
         }
+        if (fin_or_event == picoquic_callback_stream_fin) {
+            stream_ctx->fin_received = 1;
+        }
+        picohttp_check_stream_done(cnx, &ctx->stream_table, stream_ctx);
     } else {
         /* Unknown event */
         /* TODO-POST: notify callback. */
@@ -22,6 +22,8 @@
 #ifndef DEMO_SERVER_H
 #define DEMO_SERVER_H
 
+#include "demofiles.h"
+
 /* This server code is provided for demonstration purposes.
  * The demo server serves a canned index page, or generate
  * variable length content in response to requests of the
@@ -68,6 +70,8 @@ typedef struct st_picohttp_server_parameters_t {
     char const* web_folder;
     picohttp_server_path_item_t* path_table;
     size_t path_table_nb;
+    h3zero_settings_t qpack_settings; /* Zeroes for the static table only */
+    picohttp_file_cache_t* file_cache; /* NULL to read the files through stdio */
 } picohttp_server_parameters_t;
 
 /* Identify the path item based on the incoming path in GET or POST */
@@ -87,9 +91,13 @@ typedef enum {
 typedef struct st_picohttp_server_stream_ctx_t {
     /* TODO-POST: identification of URL to process POST or GET? */
     /* TODO-POST: provide content-type */
-    picosplay_node_t http_stream_node;
+    picosplay_node_t http_stream_node; /* In the overflow tree only */
     struct st_picohttp_server_stream_ctx_t* next_stream;
+    struct st_picohttp_server_stream_ctx_t* previous_stream;
     int is_h3;
+    int fin_received; /* No more data from the client */
+    int response_done; /* Response sent up to its fin, or stream reset */
+    int is_priority_updated; /* A PRIORITY_UPDATE was received, which overrides the priority header */
     union {
         h3zero_data_stream_state_t stream_state; /* h3 only */
         struct {
@@ -110,18 +118,38 @@ typedef struct st_picohttp_server_stream_ctx_t {
     picohttp_post_data_cb_fn path_callback;
     void* path_callback_ctx;
     FILE* F;
+    picohttp_file_mapping_t* mapping; /* Instead of F when the file cache is used */
 } picohttp_server_stream_ctx_t;
 
+/* Stream contexts of a connection. The clients open their bidir streams in order, so
+ * these are found in a window of slots indexed by stream_id >> 2, which slides forward
+ * with the new streams. The streams it leaves behind, and those of other types, go in
+ * the overflow tree. The contexts are retired once both directions of their stream are
+ * done, and kept in a pool for the next requests.
+ */
+#define PICOHTTP_STREAM_WINDOW_SIZE 64
+#define PICOHTTP_STREAM_POOL_MAX 8
+
+typedef struct st_picohttp_server_stream_table_t {
+    uint64_t window_start; /* stream_id >> 2 of the first stream in the window */
+    picohttp_server_stream_ctx_t* window[PICOHTTP_STREAM_WINDOW_SIZE];
+    picosplay_tree_t overflow_tree;
+    picohttp_server_stream_ctx_t* first_stream; /* All the streams of the table */
+    picohttp_server_stream_ctx_t* first_free;
+    size_t nb_free;
+} picohttp_server_stream_table_t;
+
 /* Define the H3Zero server callback */
 
 typedef struct st_h3zero_server_callback_ctx_t {
-    picosplay_tree_t h3_stream_tree;
-    picohttp_server_stream_ctx_t* first_stream;
+    picohttp_server_stream_table_t stream_table;
     size_t buffer_max;
     uint8_t* buffer;
     picohttp_server_path_item_t * path_table;
     size_t path_table_nb;
     char const* web_folder;
+    picohttp_file_cache_t* file_cache;
+    h3zero_qpack_t qpack;
 } h3zero_server_callback_ctx_t;
 
 int h3zero_server_callback(picoquic_cnx_t* cnx,
@@ -133,11 +161,11 @@ int h3zero_server_callback(picoquic_cnx_t* cnx,
  */
 
 typedef struct st_picoquic_h09_server_callback_ctx_t {
-    picosplay_tree_t h09_stream_tree;
-    picohttp_server_stream_ctx_t* first_stream;
+    picohttp_server_stream_table_t stream_table;
     picohttp_server_path_item_t * path_table;
     size_t path_table_nb;
     char const* web_folder;
+    picohttp_file_cache_t* file_cache;
 } picoquic_h09_server_callback_ctx_t;
 
 int picoquic_h09_server_callback(picoquic_cnx_t* cnx,
@@ -156,7 +184,9 @@ size_t picoquic_demo_server_callback_select_alpn(picoquic_quic_t* quic, ptls_iov
 
 int demo_server_is_path_sane(const uint8_t* path, size_t path_length);
 
-int demo_server_try_file_path(const uint8_t* path, size_t path_length, size_t* echo_size, h3zero_content_type_enum *content, FILE** pF, char const* web_folder);
+/* The file is mapped from the cache when there is one, and opened in *pF otherwise */
+int demo_server_try_file_path(const uint8_t* path, size_t path_length, size_t* echo_size, h3zero_content_type_enum *content, FILE** pF,
+    picohttp_file_cache_t* file_cache, picohttp_file_mapping_t** p_mapping, char const* web_folder);
 
 /* For building a basic HTTP 0.9 test server */
 int http0dot9_get(uint8_t* command, size_t command_length,
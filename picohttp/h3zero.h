@@ -38,6 +38,16 @@
 #define H3ZERO_EARLY_RESPONSE 0x010E /* Remainder of request not needed */
 #define H3ZERO_CONNECT_ERROR 0x010F /* TCP reset or error on CONNECT request */
 #define H3ZERO_VERSION_FALLBACK 0x0110 /* Retry over  H3ZERO/1.1 */
+#define H3ZERO_QPACK_DECOMPRESSION_FAILED 0x0200 /* A field section could not be decoded */
+#define H3ZERO_QPACK_ENCODER_STREAM_ERROR 0x0201 /* Bad instruction on the encoder stream */
+#define H3ZERO_QPACK_DECODER_STREAM_ERROR 0x0202 /* Bad instruction on the decoder stream */
+
+typedef enum {
+    h3zero_stream_type_control = 0,
+    h3zero_stream_type_push = 1,
+    h3zero_stream_type_qpack_encoder = 2,
+    h3zero_stream_type_qpack_decoder = 3
+} h3zero_stream_type_enum;
 
 typedef enum {
 	h3zero_frame_data = 0,
@@ -47,6 +57,8 @@ typedef enum {
     h3zero_frame_push_promise = 5,
     h3zero_frame_goaway = 7,
     h3zero_frame_max_push_id = 0xd,
+    h3zero_frame_priority_update_request = 0xF0700,
+    h3zero_frame_priority_update_push = 0xF0701,
     h3zero_frame_reserved_base = 0xb,
     h3zero_frame_reserved_delta = 0x1f
 } h3zero_frame_type_enum_t;
@@ -114,6 +126,7 @@ typedef enum {
     http_header_user_agent,
     http_header_x_forwarded_for,
     http_header_x_frame_options,
+    http_header_priority,
 	http_header_max
 } http_header_enum_t;
 
@@ -135,10 +148,112 @@ typedef struct st_h3zero_qpack_static_t {
 } h3zero_qpack_static_t;
 
 typedef struct st_h3zero_settings_t {
-    unsigned int header_size;
-    unsigned int blocked_streams;
+    unsigned int header_size; /* Capacity of the QPACK dynamic table, 0 for the static table only */
+    unsigned int blocked_streams; /* Streams that may wait for entries not yet received */
 } h3zero_settings_t;
 
+/* Dynamic table of QPACK, as in RFC 9204.
+ *
+ * The entries are kept in a ring, indexed by their absolute index modulo the
+ * largest number of entries that the maximum capacity allows. Each entry counts
+ * for its name, its value and 32 bytes in the size of the table. The oldest
+ * entries are evicted first, when an insertion or a lower capacity needs room.
+ */
+#define H3ZERO_QPACK_ENTRY_OVERHEAD 32
+#define H3ZERO_QPACK_DEFAULT_CAPACITY 4096
+#define H3ZERO_QPACK_DEFAULT_BLOCKED_STREAMS 16
+#define H3ZERO_MAX_BLOCKED_BYTES 0x10000 /* Kept while the header of a stream is blocked */
+
+typedef struct st_h3zero_qpack_entry_t {
+    uint8_t * name; /* The value follows the name in the same allocation */
+    size_t name_length;
+    uint8_t * value;
+    size_t value_length;
+    http_header_enum_t header;
+} h3zero_qpack_entry_t;
+
+typedef struct st_h3zero_qpack_table_t {
+    h3zero_qpack_entry_t * entries;
+    size_t nb_entries_max;
+    uint64_t max_capacity; /* From the settings of the decoder */
+    uint64_t capacity;
+    uint64_t size;
+    uint64_t insert_count;
+    uint64_t drop_count; /* Absolute index of the oldest entry */
+} h3zero_qpack_table_t;
+
+typedef struct st_h3zero_qpack_buffer_t {
+    uint8_t * bytes;
+    size_t length;
+    size_t size;
+} h3zero_qpack_buffer_t;
+
+/* A field section that refers to the dynamic table, until the decoder acknowledges it */
+typedef struct st_h3zero_qpack_section_t {
+    uint64_t stream_id;
+    uint64_t required_insert_count;
+    uint64_t min_index; /* Oldest entry referenced, which cannot be evicted meanwhile */
+} h3zero_qpack_section_t;
+
+/* The encoder only inserts the fields it encodes, and only references an entry that the
+ * decoder may not have yet while fewer than blocked_streams streams are blocked. The
+ * instructions for the encoder stream accumulate in "instructions" until sent. */
+typedef struct st_h3zero_qpack_encoder_t {
+    h3zero_qpack_table_t table;
+    uint64_t known_received_count;
+    unsigned int max_blocked_streams;
+    h3zero_qpack_section_t * sections;
+    size_t nb_sections;
+    size_t nb_sections_max;
+    h3zero_qpack_buffer_t instructions;
+    h3zero_qpack_buffer_t pending; /* Partial instruction received on the decoder stream */
+} h3zero_qpack_encoder_t;
+
+/* The decoder acknowledges the field sections that refer to the dynamic table, and the
+ * insertions, with the instructions for the decoder stream accumulated in "instructions". */
+typedef struct st_h3zero_qpack_decoder_t {
+    h3zero_qpack_table_t table;
+    uint64_t acknowledged_count; /* Insert count known by the encoder */
+    unsigned int max_blocked_streams;
+    unsigned int nb_blocked_streams;
+    h3zero_qpack_buffer_t instructions;
+    h3zero_qpack_buffer_t pending; /* Partial instruction received on the encoder stream */
+} h3zero_qpack_decoder_t;
+
+int h3zero_qpack_encoder_init(h3zero_qpack_encoder_t * encoder);
+/* Sets the capacity from the settings of the peer, capped by the local capacity, which may
+ * only happen once. A null capacity on either side keeps the encoder on the static table. */
+int h3zero_qpack_encoder_configure(h3zero_qpack_encoder_t * encoder, uint64_t capacity, h3zero_settings_t const * peer_settings);
+void h3zero_qpack_encoder_release(h3zero_qpack_encoder_t * encoder);
+/* Processes the bytes received on the decoder stream. Returns 0 or an error code */
+uint16_t h3zero_qpack_encoder_receive(h3zero_qpack_encoder_t * encoder, uint8_t const * bytes, size_t length);
+
+int h3zero_qpack_decoder_init(h3zero_qpack_decoder_t * decoder, h3zero_settings_t const * local_settings);
+void h3zero_qpack_decoder_release(h3zero_qpack_decoder_t * decoder);
+/* Processes the bytes received on the encoder stream. Returns 0 or an error code */
+uint16_t h3zero_qpack_decoder_receive(h3zero_qpack_decoder_t * decoder, uint8_t const * bytes, size_t length);
+/* Tells the encoder that the field section of a stream will not be decoded */
+int h3zero_qpack_decoder_cancel_stream(h3zero_qpack_decoder_t * decoder, uint64_t stream_id);
+
+/* Encoding of a field section. The prefix is only known at the end, so the fields are
+ * written after some reserved space and moved back by h3zero_qpack_block_finish(). */
+typedef struct st_h3zero_qpack_block_t {
+    h3zero_qpack_encoder_t * encoder; /* NULL for the static table only */
+    uint64_t stream_id;
+    uint8_t * start;
+    uint8_t * fields;
+    uint64_t base;
+    uint64_t required_insert_count;
+    uint64_t min_index;
+} h3zero_qpack_block_t;
+
+uint8_t * h3zero_qpack_block_start(uint8_t * bytes, uint8_t * bytes_max, h3zero_qpack_block_t * block,
+    h3zero_qpack_encoder_t * encoder, uint64_t stream_id);
+/* Encodes a field whose name is that of the static entry name_index */
+uint8_t * h3zero_qpack_block_encode_field(uint8_t * bytes, uint8_t * bytes_max, h3zero_qpack_block_t * block,
+    uint64_t name_index, uint8_t const * value, size_t value_length);
+uint8_t * h3zero_qpack_block_finish(uint8_t * bytes, uint8_t * bytes_max, h3zero_qpack_block_t * block);
+
 typedef enum {
     h3zero_content_type_none = 0,
     h3zero_content_type_not_supported,
@@ -172,9 +287,22 @@ typedef struct st_h3zero_header_parts_t {
     size_t path_length;
     int status;
     h3zero_content_type_enum content_type;
+    uint8_t urgency; /* Only valid if priority_found */
+    unsigned int is_incremental : 1;
+    unsigned int priority_found : 1;
     unsigned int path_is_huffman : 1;
 } h3zero_header_parts_t;
 
+/* Extensible priorities, RFC 9218 */
+#define H3ZERO_PRIORITY_URGENCY_MAX 7
+#define H3ZERO_PRIORITY_URGENCY_DEFAULT 3
+#define H3ZERO_PRIORITY_UPDATE_MAX 32
+
+/* Parses the priority field value, a structured field dictionary, updating the urgency and
+ * incremental flag with the parameters it has. Unknown parameters and out of range urgencies
+ * are ignored. Returns -1 if the value cannot be parsed, without updating anything. */
+int h3zero_parse_priority(uint8_t const * bytes, size_t length, uint8_t * urgency, int * is_incremental);
+
 extern uint8_t const * h3zero_default_setting_frame;
 
 extern const size_t h3zero_default_setting_frame_size;
@@ -186,11 +314,19 @@ uint8_t * h3zero_qpack_int_decode(uint8_t * bytes, uint8_t * bytes_max,
 
 uint8_t * h3zero_parse_qpack_header_frame(uint8_t * bytes, uint8_t * bytes_max,
     h3zero_header_parts_t * parts);
+/* With a decoder, the section may refer to the dynamic table. If it refers to entries
+ * not received yet, returns NULL with is_blocked set, and should be parsed again later. */
+uint8_t * h3zero_parse_qpack_header_frame_ex(uint8_t * bytes, uint8_t * bytes_max,
+    h3zero_qpack_decoder_t * decoder, uint64_t stream_id, h3zero_header_parts_t * parts, int * is_blocked);
 uint8_t * h3zero_create_request_header_frame(uint8_t * bytes, uint8_t * bytes_max,
     uint8_t const * path, size_t path_length, char const * host);
 uint8_t * h3zero_create_post_header_frame(uint8_t * bytes, uint8_t * bytes_max,
     uint8_t const * path, size_t path_length, char const * host,
     h3zero_content_type_enum content_type);
+/* Same as the above, the path and host going in the dynamic table when the encoder allows it */
+uint8_t * h3zero_create_request_header_frame_ex(uint8_t * bytes, uint8_t * bytes_max,
+    uint8_t const * path, size_t path_length, char const * host, h3zero_method_enum method,
+    h3zero_content_type_enum content_type, h3zero_qpack_encoder_t * encoder, uint64_t stream_id);
 uint8_t * h3zero_create_response_header_frame(uint8_t * bytes, uint8_t * bytes_max,
     h3zero_content_type_enum doc_type);
 uint8_t * h3zero_create_not_found_header_frame(uint8_t * bytes, uint8_t * bytes_max);
@@ -219,18 +355,80 @@ typedef struct st_h3zero_data_stream_state_t {
     uint64_t current_frame_read;
     uint8_t frame_header[16];
     size_t frame_header_read;
+    h3zero_qpack_decoder_t * decoder; /* NULL if the peer may only use the static table */
+    uint64_t stream_id;
+    h3zero_qpack_buffer_t blocked_bytes; /* Received while the header is blocked */
     unsigned int frame_header_parsed : 1;
     unsigned int header_found : 1;
     unsigned int data_found : 1;
     unsigned int trailer_found : 1;
+    unsigned int header_blocked : 1;
+    unsigned int blocked_fin : 1;
 } h3zero_data_stream_state_t;
 
 uint8_t * h3zero_parse_data_stream(uint8_t * bytes, uint8_t * bytes_max,
     h3zero_data_stream_state_t * stream_state, size_t * available_data, uint16_t * error_found);
 
+/* While the header is blocked, the bytes of the stream are kept aside. Once the decoder
+ * received the entries, returns 1 and hands the bytes kept to the caller, to be parsed
+ * as if just received, and freed. Returns 0 if still blocked, -1 on error. */
+int h3zero_unblock_data_stream(h3zero_data_stream_state_t * stream_state,
+    uint8_t ** kept_bytes, size_t * kept_length, uint16_t * error_found);
+
 void h3zero_delete_data_stream_state(h3zero_data_stream_state_t * stream_state);
 
+/* Unidirectional streams of the peer. The type is read first, then the SETTINGS of the
+ * control stream, and the instructions of the QPACK streams. Other types are ignored. */
+typedef struct st_h3zero_uni_stream_state_t {
+    struct st_h3zero_uni_stream_state_t * next_stream;
+    uint64_t stream_id;
+    uint64_t stream_type;
+    uint8_t frame_header[16];
+    size_t frame_header_read;
+    uint64_t current_frame_type;
+    uint64_t current_frame_length;
+    h3zero_qpack_buffer_t current_frame;
+    unsigned int type_known : 1;
+    unsigned int frame_header_parsed : 1;
+} h3zero_uni_stream_state_t;
+
+/* QPACK state of a connection */
+/* PRIORITY_UPDATE frame of a request stream, received on the control stream */
+typedef struct st_h3zero_priority_update_t {
+    uint64_t stream_id;
+    uint8_t urgency;
+    unsigned int is_incremental : 1;
+} h3zero_priority_update_t;
+
+typedef struct st_h3zero_qpack_t {
+    h3zero_settings_t local_settings;
+    h3zero_settings_t peer_settings;
+    h3zero_qpack_encoder_t encoder;
+    h3zero_qpack_decoder_t decoder;
+    h3zero_uni_stream_state_t * first_uni_stream;
+    h3zero_priority_update_t priority_updates[H3ZERO_PRIORITY_UPDATE_MAX]; /* Received, until taken */
+    size_t nb_priority_updates;
+    unsigned int settings_received : 1;
+} h3zero_qpack_t;
+
+/* local_settings NULL for the static table only */
+int h3zero_qpack_init(h3zero_qpack_t * qpack, h3zero_settings_t const * local_settings);
+void h3zero_qpack_release(h3zero_qpack_t * qpack);
+/* Processes the bytes received on a unidirectional stream of the peer. Returns 0 or an error code */
+uint16_t h3zero_qpack_receive_uni_stream(h3zero_qpack_t * qpack, uint64_t stream_id, uint8_t const * bytes, size_t length);
+/* Takes the oldest of the priority updates received. Returns 0 if there are none left. */
+int h3zero_qpack_next_priority_update(h3zero_qpack_t * qpack, h3zero_priority_update_t * update);
+
+/* Control stream type and SETTINGS frame */
+uint8_t * h3zero_create_setting_frame(uint8_t * bytes, uint8_t * bytes_max, h3zero_settings_t const * settings);
+uint8_t * h3zero_parse_setting_frame(uint8_t * bytes, uint8_t * bytes_max, h3zero_settings_t * settings);
+
 int hzero_qpack_huffman_decode(uint8_t * bytes, uint8_t * bytes_max,
     uint8_t * decoded, size_t max_decoded, size_t * nb_decoded);
+/* Length of the Huffman encoding of a string, in bytes */
+size_t h3zero_qpack_huffman_length(uint8_t const * val, size_t val_length);
+uint8_t * h3zero_qpack_huffman_encode(uint8_t * bytes, uint8_t * bytes_max, uint8_t const * val, size_t val_length);
+/* String literal with its H bit and length (7+), Huffman encoded when shorter */
+uint8_t * h3zero_qpack_string_encode(uint8_t * bytes, uint8_t * bytes_max, uint8_t const * val, size_t val_length);
 
 #endif /* H3ZERO_H */
\ No newline at end of file
@@ -0,0 +1,244 @@
+#include "alloc_profiler.h"
+#include "fnv1a.h"
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PICOQUIC_ALLOC_PROFILER_SYMBOL_STEP 0x10
+
+typedef struct st_picoquic_alloc_profile_site_t {
+    int in_use;
+    picoquic_alloc_profile_entry_t entry;
+    double count; /* Estimates, rounded in the snapshots */
+    double bytes;
+} picoquic_alloc_profile_site_t;
+
+typedef struct st_picoquic_alloc_profiler_t {
+    pthread_mutex_t lock;
+    uint64_t sample_period;
+    uint64_t generation; /* Tells the threads to draw their countdown again after a restart */
+    uint64_t nb_sites;
+    uint64_t dropped;
+    picoquic_alloc_profile_site_t sites[PICOQUIC_ALLOC_PROFILER_MAX_SITES];
+} picoquic_alloc_profiler_t;
+
+static char const* picoquic_alloc_site_names[picoquic_alloc_site_nb] = {
+    "picoquic_create_packet", "stream_data", "sack_items", "queue_enqueue", "plugin_malloc"
+};
+
+int picoquic_alloc_profiler_enabled = 0;
+
+static picoquic_alloc_profiler_t picoquic_alloc_profiler = { PTHREAD_MUTEX_INITIALIZER };
+
+/* Bytes allocated by the thread before its next sample */
+static __thread int64_t picoquic_alloc_profile_countdown;
+static __thread uint64_t picoquic_alloc_profile_generation;
+static __thread uint64_t picoquic_alloc_profile_random;
+
+char const* picoquic_alloc_site_name(picoquic_alloc_site_enum site)
+{
+    return (site < picoquic_alloc_site_nb) ? picoquic_alloc_site_names[site] : "unknown";
+}
+
+/* Exponential distribution of mean the sample period, so that the samples form a Poisson process over the bytes */
+static int64_t picoquic_alloc_profile_next_countdown(uint64_t sample_period)
+{
+    uint64_t x = picoquic_alloc_profile_random;
+    double u;
+
+    if (sample_period == 0) {
+        return 0;
+    }
+    if (x == 0) {
+        x = (uint64_t)(uintptr_t)&picoquic_alloc_profile_random ^ ((uint64_t)getpid() << 32) ^ FNV1A_OFFSET;
+    }
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    picoquic_alloc_profile_random = x;
+    u = (double)((x * 0x2545F4914F6CDD1Dull) >> 11) / (double)(1ull << 53);
+
+    return (int64_t)(-log(1.0 - u) * (double)sample_period) + 1;
+}
+
+static picoquic_alloc_profile_site_t* picoquic_alloc_profile_find(picoquic_alloc_site_enum site, char const* plugin_name, uintptr_t caller)
+{
+    uint64_t h = fnv1a_hash(FNV1A_OFFSET, (uint8_t*)&caller, sizeof(caller)) ^ (uint64_t)site;
+
+    if (plugin_name != NULL) {
+        h = fnv1a_hash(h, (uint8_t*)plugin_name, strlen(plugin_name));
+    }
+
+    for (size_t i = 0; i < PICOQUIC_ALLOC_PROFILER_MAX_SITES; i++) {
+        picoquic_alloc_profile_site_t* s = &picoquic_alloc_profiler.sites[(h + i) % PICOQUIC_ALLOC_PROFILER_MAX_SITES];
+
+        if (!s->in_use) {
+            s->in_use = 1;
+            s->entry.site = site;
+            s->entry.caller = caller;
+            if (plugin_name != NULL) {
+                strncpy(s->entry.plugin_name, plugin_name, PICOQUIC_ALLOC_PROFILER_NAME_MAX - 1);
+            }
+            picoquic_alloc_profiler.nb_sites++;
+            return s;
+        }
+        if (s->entry.site == site && s->entry.caller == caller &&
+            (plugin_name == NULL || strncmp(s->entry.plugin_name, plugin_name, PICOQUIC_ALLOC_PROFILER_NAME_MAX - 1) == 0)) {
+            return s;
+        }
+    }
+
+    return NULL;
+}
+
+void picoquic_alloc_profiler_start(uint64_t sample_period)
+{
+    pthread_mutex_lock(&picoquic_alloc_profiler.lock);
+    memset(picoquic_alloc_profiler.sites, 0, sizeof(picoquic_alloc_profiler.sites));
+    picoquic_alloc_profiler.nb_sites = 0;
+    picoquic_alloc_profiler.dropped = 0;
+    picoquic_alloc_profiler.sample_period = sample_period;
+    picoquic_alloc_profiler.generation++;
+    picoquic_alloc_profiler_enabled = 1;
+    pthread_mutex_unlock(&picoquic_alloc_profiler.lock);
+}
+
+void picoquic_alloc_profiler_stop(void)
+{
+    picoquic_alloc_profiler_enabled = 0;
+}
+
+void picoquic_alloc_profile_record(picoquic_alloc_site_enum site, char const* plugin_name, void* caller, size_t size)
+{
+    uint64_t sample_period = picoquic_alloc_profiler.sample_period;
+
+    if (picoquic_alloc_profile_generation != picoquic_alloc_profiler.generation) {
+        picoquic_alloc_profile_generation = picoquic_alloc_profiler.generation;
+        picoquic_alloc_profile_countdown = picoquic_alloc_profile_next_countdown(sample_period);
+    }
+
+    picoquic_alloc_profile_countdown -= (int64_t)size;
+    if (picoquic_alloc_profile_countdown > 0) {
+        return;
+    }
+
+    /* Each sample stands for the allocations of its size that the period would have sampled */
+    while (picoquic_alloc_profile_countdown <= 0 && sample_period > 0) {
+        picoquic_alloc_profile_countdown += picoquic_alloc_profile_next_countdown(sample_period);
+    }
+
+    pthread_mutex_lock(&picoquic_alloc_profiler.lock);
+    if (picoquic_alloc_profiler_enabled) {
+        picoquic_alloc_profile_site_t* s = picoquic_alloc_profile_find(site,
+            (site == picoquic_alloc_site_plugin) ? plugin_name : NULL, (site == picoquic_alloc_site_plugin) ? 0 : (uintptr_t)caller);
+
+        if (s == NULL) {
+            picoquic_alloc_profiler.dropped++;
+        } else {
+            double weight = (sample_period == 0 || size == 0) ? 1.0 : 1.0 / (1.0 - exp(-(double)size / (double)sample_period));
+
+            s->entry.nb_samples++;
+            s->entry.sampled_bytes += size;
+            s->count += weight;
+            s->bytes += weight * (double)size;
+        }
+    }
+    pthread_mutex_unlock(&picoquic_alloc_profiler.lock);
+}
+
+size_t picoquic_alloc_profiler_snapshot(picoquic_alloc_profile_entry_t* entries, size_t max_entries)
+{
+    size_t nb_entries = 0;
+
+    pthread_mutex_lock(&picoquic_alloc_profiler.lock);
+    for (size_t i = 0; i < PICOQUIC_ALLOC_PROFILER_MAX_SITES; i++) {
+        picoquic_alloc_profile_site_t* s = &picoquic_alloc_profiler.sites[i];
+
+        if (s->in_use) {
+            if (nb_entries < max_entries) {
+                entries[nb_entries] = s->entry;
+                entries[nb_entries].count = (uint64_t)(s->count + 0.5);
+                entries[nb_entries].bytes = (uint64_t)(s->bytes + 0.5);
+            }
+            nb_entries++;
+        }
+    }
+    pthread_mutex_unlock(&picoquic_alloc_profiler.lock);
+
+    return nb_entries;
+}
+
+uint64_t picoquic_alloc_profiler_dropped(void)
+{
+    return picoquic_alloc_profiler.dropped;
+}
+
+/* The made up address that names the site in the dump. The plugin sites each have their own */
+static uint64_t picoquic_alloc_profile_symbol(picoquic_alloc_profile_entry_t const* entry, size_t index)
+{
+    uint64_t rank = (entry->site == picoquic_alloc_site_plugin) ? picoquic_alloc_site_nb + index : entry->site;
+
+    return (rank + 1) * PICOQUIC_ALLOC_PROFILER_SYMBOL_STEP;
+}
+
+int picoquic_alloc_profiler_dump(FILE* F)
+{
+    picoquic_alloc_profile_entry_t* entries = (picoquic_alloc_profile_entry_t*)malloc(
+        PICOQUIC_ALLOC_PROFILER_MAX_SITES * sizeof(picoquic_alloc_profile_entry_t));
+    uint64_t sample_period = picoquic_alloc_profiler.sample_period;
+    uint64_t total_samples = 0;
+    uint64_t total_bytes = 0;
+    size_t nb_entries;
+    char binary[256];
+    ssize_t binary_length;
+    FILE* maps;
+
+    if (entries == NULL) {
+        return -1;
+    }
+    nb_entries = picoquic_alloc_profiler_snapshot(entries, PICOQUIC_ALLOC_PROFILER_MAX_SITES);
+    binary_length = readlink("/proc/self/exe", binary, sizeof(binary) - 1);
+    binary[(binary_length > 0) ? binary_length : 0] = 0;
+
+    fprintf(F, "--- symbol\nbinary=%s\n", (binary_length > 0) ? binary : "picoquic");
+    for (size_t i = 0; i < picoquic_alloc_site_plugin; i++) {
+        fprintf(F, "0x%016" PRIx64 " %s\n", (uint64_t)(i + 1) * PICOQUIC_ALLOC_PROFILER_SYMBOL_STEP, picoquic_alloc_site_names[i]);
+    }
+    for (size_t i = 0; i < nb_entries; i++) {
+        if (entries[i].site == picoquic_alloc_site_plugin) {
+            fprintf(F, "0x%016" PRIx64 " plugin_malloc:%s\n", picoquic_alloc_profile_symbol(&entries[i], i), entries[i].plugin_name);
+        }
+        total_samples += entries[i].nb_samples;
+        total_bytes += entries[i].sampled_bytes;
+    }
+    fprintf(F, "---\n--- heap\n");
+
+    /* Frees are not tracked, so the in use columns stay at 0: read the profile with -sample_index=alloc_space */
+    fprintf(F, "heap profile: %6d: %8d [%6" PRIu64 ": %8" PRIu64 "] @ heap_v2/%" PRIu64 "\n", 0, 0,
+        total_samples, total_bytes, (sample_period == 0) ? 1 : sample_period);
+    for (size_t i = 0; i < nb_entries; i++) {
+        fprintf(F, "%6d: %8d [%6" PRIu64 ": %8" PRIu64 "] @ 0x%016" PRIx64, 0, 0,
+            entries[i].nb_samples, entries[i].sampled_bytes, picoquic_alloc_profile_symbol(&entries[i], i));
+        if (entries[i].caller != 0) {
+            fprintf(F, " 0x%016" PRIx64, (uint64_t)entries[i].caller);
+        }
+        fprintf(F, "\n");
+    }
+
+    /* The callers are return addresses, which pprof symbolizes with the mappings of the process */
+    fprintf(F, "\nMAPPED_LIBRARIES:\n");
+    if ((maps = fopen("/proc/self/maps", "r")) != NULL) {
+        char line[512];
+
+        while (fgets(line, sizeof(line), maps) != NULL) {
+            fputs(line, F);
+        }
+        fclose(maps);
+    }
+    free(entries);
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+/**
+ * \file alloc_profiler.h
+ * \brief Sampling profiler of the allocations of the core and of the plugins.
+ *
+ * The profiler is process wide and off by default, in which case each allocation site only tests a flag.
+ * Once started, each thread counts down the bytes it allocates and records a sample when the count
+ * crosses zero, the distance between two samples being drawn from an exponential distribution of mean
+ * the sample period. A sample goes to the entry of its call site, given by the kind of allocation and the
+ * return address of the allocating function, or by the name of the plugin for the plugin memory.
+ * The counts of a site are thus estimates, exact when the sample period is 0.
+ *
+ * The dump is a symbolized legacy heap profile, "heap_v2" with the sample period as rate, which pprof reads.
+ * Its first frame is a made up address named after the site, the second one is the caller.
+ */
+
+#ifndef ALLOC_PROFILER_H
+#define ALLOC_PROFILER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define PICOQUIC_ALLOC_PROFILER_MAX_SITES 1024
+#define PICOQUIC_ALLOC_PROFILER_NAME_MAX 64
+#define PICOQUIC_ALLOC_PROFILER_DEFAULT_PERIOD (512 * 1024)
+
+typedef enum {
+    picoquic_alloc_site_packet = 0, /* picoquic_create_packet() */
+    picoquic_alloc_site_stream_data, /* Stream data nodes, sent or received */
+    picoquic_alloc_site_sack_items, /* Growth of the arrays of the sack lists */
+    picoquic_alloc_site_queue, /* Growth of the arrays of queue_enqueue() */
+    picoquic_alloc_site_plugin, /* my_malloc() of a plugin */
+    picoquic_alloc_site_nb
+} picoquic_alloc_site_enum;
+
+typedef struct st_picoquic_alloc_profile_entry_t {
+    picoquic_alloc_site_enum site;
+    char plugin_name[PICOQUIC_ALLOC_PROFILER_NAME_MAX]; /* For the plugin sites only */
+    uintptr_t caller; /* 0 for the plugin sites */
+    uint64_t nb_samples;
+    uint64_t sampled_bytes;
+    uint64_t count; /* Estimated number of allocations */
+    uint64_t bytes; /* Estimated number of bytes */
+} picoquic_alloc_profile_entry_t;
+
+extern int picoquic_alloc_profiler_enabled;
+
+/* A period of 0 records every allocation. Starting again resets the counts */
+void picoquic_alloc_profiler_start(uint64_t sample_period);
+void picoquic_alloc_profiler_stop(void);
+
+void picoquic_alloc_profile_record(picoquic_alloc_site_enum site, char const* plugin_name, void* caller, size_t size);
+
+/* Copies up to max_entries sites, and returns the number of sites */
+size_t picoquic_alloc_profiler_snapshot(picoquic_alloc_profile_entry_t* entries, size_t max_entries);
+/* Number of samples lost because the table of the sites was full */
+uint64_t picoquic_alloc_profiler_dropped(void);
+int picoquic_alloc_profiler_dump(FILE* F);
+
+char const* picoquic_alloc_site_name(picoquic_alloc_site_enum site);
+
+/* Allocation sites call this one, in the function that allocates so that the caller is the one of that function */
+#define PICOQUIC_ALLOC_PROFILE(site, plugin_name, size)                                                      \
+    do {                                                                                                     \
+        if (picoquic_alloc_profiler_enabled) {                                                               \
+            picoquic_alloc_profile_record((site), (plugin_name), __builtin_return_address(0), (size));      \
+        }                                                                                                    \
+    } while (0)
+
+#endif /* ALLOC_PROFILER_H */
@@ -145,7 +145,7 @@ typedef struct st_picoquic_bbr_state_t {
     uint64_t btl_bw;
     uint64_t next_round_delivered;
     uint64_t round_start_time;
-    uint64_t btl_bw_filter[BBR_BTL_BW_FILTER_LENGTH];
+    picoquic_win_filter_t btl_bw_filter; /* Max of the delivery rate over the last rounds */
     uint64_t full_bw;
     uint64_t rt_prop;
     uint64_t rt_prop_stamp;
@@ -235,7 +235,7 @@ static void picoquic_bbr_init(picoquic_cnx_t *cnx, picoquic_path_t* path_x)
         memset(bbr_state, 0, sizeof(picoquic_bbr_state_t));
         path_x->cwin = PICOQUIC_CWIN_INITIAL;
         bbr_state->rt_prop = UINT64_MAX;
-        uint64_t current_time = picoquic_current_time();
+        uint64_t current_time = picoquic_get_loop_time(cnx->quic);
         bbr_state->rt_prop_stamp = current_time;
         bbr_state->cycle_stamp = current_time;
 
@@ -267,7 +267,7 @@ void BBRUpdateBtlBw(picoquic_bbr_state_t* bbr_state, picoquic_path_t* path_x)
         // the estimation is not reliable because the CWIN was not probed entirely
         return;
     }
-    if (path_x->delivered_last_packet >= bbr_state->next_round_delivered)
+    if (path_x->rate_sample.prior_delivered >= bbr_state->next_round_delivered)
     {
         bbr_state->next_round_delivered = path_x->delivered;
         bbr_state->round_count++;
@@ -277,29 +277,8 @@ void BBRUpdateBtlBw(picoquic_bbr_state_t* bbr_state, picoquic_path_t* path_x)
         bbr_state->round_start = 0;
     }
 
-    if (bbr_state->round_start) {
-        /* Forget the oldest BW round, shift by 1, compute the max BTL_BW for
-         * the remaining rounds, set current round max to current value */
-
-        bbr_state->btl_bw = 0;
-
-        for (int i = BBR_BTL_BW_FILTER_LENGTH - 2; i >= 0; i--) {
-            uint64_t b = bbr_state->btl_bw_filter[i];
-            bbr_state->btl_bw_filter[i + 1] = b;
-            if (b > bbr_state->btl_bw) {
-                bbr_state->btl_bw = b;
-            }
-        }
-
-        bbr_state->btl_bw_filter[0] = 0;
-    }
-
-    if (bandwidth_estimate > bbr_state->btl_bw_filter[0]) {
-        bbr_state->btl_bw_filter[0] =bandwidth_estimate;
-        if (bandwidth_estimate > bbr_state->btl_bw) {
-            bbr_state->btl_bw = bandwidth_estimate;
-        }
-    }
+    bbr_state->btl_bw = picoquic_win_filter_max(&bbr_state->btl_bw_filter, BBR_BTL_BW_FILTER_LENGTH,
+        (uint64_t)bbr_state->round_count, bandwidth_estimate);
 }
 
 /* This will use one way samples if available */
@@ -40,6 +40,129 @@ int picoquic_cc_was_cwin_blocked(picoquic_path_t* path, uint64_t last_sequence_b
     return (last_sequence_blocked == 0 || picoquic_cc_get_ack_number(path) <= last_sequence_blocked);
 }
 
+/*
+ * Delivery rate estimation, following draft-cheng-iccrg-delivery-rate-estimation.
+ * Each packet records, when it is sent, the path delivered count, the time at
+ * which it was last updated and the send time of the packet that updated it.
+ * When the packet is acknowledged, the data delivered since is divided by the
+ * longest of the send and ACK intervals, so that ACK compression cannot
+ * overestimate the rate. The samples of packets sent while the application did
+ * not fill the window are flagged, the rate they measure being a lower bound.
+ */
+int picoquic_delivery_rate_sample(picoquic_path_t* path_x, uint64_t send_time, uint64_t delivered_prior,
+    uint64_t delivered_time_prior, uint64_t delivered_sent_prior, int is_app_limited, uint64_t delivery_time,
+    picoquic_rate_sample_t* rs)
+{
+    uint64_t ack_interval = delivery_time - delivered_time_prior;
+    uint64_t send_interval = send_time - delivered_sent_prior;
+
+    if (ack_interval <= PICOQUIC_BANDWIDTH_TIME_INTERVAL_MIN) {
+        /* Too short to be meaningful */
+        return 0;
+    }
+
+    rs->delivered = path_x->delivered - delivered_prior;
+    rs->interval = (send_interval > ack_interval) ? send_interval : ack_interval;
+    rs->prior_delivered = delivered_prior;
+    rs->is_app_limited = (is_app_limited) ? 1 : 0;
+
+    if (rs->interval == 0) {
+        rs->delivery_rate = PICOQUIC_BANDWIDTH_ESTIMATE_MAX;
+    }
+    else {
+        rs->delivery_rate = (rs->delivered * 1000000) / rs->interval;
+    }
+
+    return 1;
+}
+
+void picoquic_delivery_rate_set_app_limited(picoquic_path_t* path_x)
+{
+    path_x->delivered_limited_index = path_x->delivered + path_x->bytes_in_transit;
+    if (path_x->delivered_limited_index == 0) {
+        path_x->delivered_limited_index = 1;
+    }
+}
+
+/*
+ * Windowed filters, after the Kathleen Nichols algorithm also used by BBR: the
+ * best, second best and third best samples of the window are kept, each one
+ * more recent than the previous. When the best one leaves the window, the
+ * next ones take its place, and the sub-windows are refreshed with the new
+ * sample when they cover a quarter and a half of the window.
+ */
+void picoquic_win_filter_reset(picoquic_win_filter_t* filter, uint64_t time, uint64_t value)
+{
+    for (int i = 0; i < 3; i++) {
+        filter->time[i] = time;
+        filter->value[i] = value;
+    }
+}
+
+static uint64_t picoquic_win_filter_update(picoquic_win_filter_t* filter, uint64_t window, uint64_t time, uint64_t value)
+{
+    uint64_t elapsed = time - filter->time[0];
+
+    if (elapsed > window) {
+        for (int j = 0; j < 2 && time - filter->time[0] > window; j++) {
+            filter->time[0] = filter->time[1];
+            filter->value[0] = filter->value[1];
+            filter->time[1] = filter->time[2];
+            filter->value[1] = filter->value[2];
+            filter->time[2] = time;
+            filter->value[2] = value;
+        }
+    }
+    else if (filter->time[1] == filter->time[0] && elapsed > window / 4) {
+        filter->time[1] = filter->time[2] = time;
+        filter->value[1] = filter->value[2] = value;
+    }
+    else if (filter->time[2] == filter->time[1] && elapsed > window / 2) {
+        filter->time[2] = time;
+        filter->value[2] = value;
+    }
+
+    return filter->value[0];
+}
+
+uint64_t picoquic_win_filter_max(picoquic_win_filter_t* filter, uint64_t window, uint64_t time, uint64_t value)
+{
+    if (value >= filter->value[0] || time - filter->time[2] > window) {
+        picoquic_win_filter_reset(filter, time, value);
+        return value;
+    }
+
+    if (value >= filter->value[1]) {
+        filter->time[1] = filter->time[2] = time;
+        filter->value[1] = filter->value[2] = value;
+    }
+    else if (value >= filter->value[2]) {
+        filter->time[2] = time;
+        filter->value[2] = value;
+    }
+
+    return picoquic_win_filter_update(filter, window, time, value);
+}
+
+uint64_t picoquic_win_filter_min(picoquic_win_filter_t* filter, uint64_t window, uint64_t time, uint64_t value)
+{
+    if (value <= filter->value[0] || time - filter->time[2] > window) {
+        picoquic_win_filter_reset(filter, time, value);
+        return value;
+    }
+
+    if (value <= filter->value[1]) {
+        filter->time[1] = filter->time[2] = time;
+        filter->value[1] = filter->value[2] = value;
+    }
+    else if (value <= filter->value[2]) {
+        filter->time[2] = time;
+        filter->value[2] = value;
+    }
+
+    return picoquic_win_filter_update(filter, window, time, value);
+}
+
 void picoquic_filter_rtt_min_max(picoquic_min_max_rtt_t * rtt_track, uint64_t rtt)
 {
     int x = rtt_track->sample_current;
@@ -127,6 +250,88 @@ void picoquic_hystart_increase(picoquic_path_t * path_x, picoquic_min_max_rtt_t*
     }
 }
 
+/*
+ * HyStart++ (RFC 9406). The minimum RTT of each round, a round ending when the
+ * first packet sent in it is acknowledged, is compared to the one of the
+ * previous round. When it increased by more than a threshold scaled to the RTT,
+ * the slow start does not end yet but becomes conservative, growing four times
+ * slower. If the RTT goes back below the baseline of that decision, the increase
+ * was spurious and the slow start resumes, otherwise it ends after a few rounds.
+ */
+void picoquic_hystart_pp_reset(picoquic_hystart_pp_t* hs, picoquic_path_t* path_x)
+{
+    memset(hs, 0, sizeof(picoquic_hystart_pp_t));
+    hs->window_end = picoquic_cc_get_sequence_number(path_x);
+    hs->last_round_min_rtt = UINT64_MAX;
+    hs->current_round_min_rtt = UINT64_MAX;
+    hs->css_baseline_min_rtt = UINT64_MAX;
+}
+
+int picoquic_hystart_pp_test(picoquic_hystart_pp_t* hs, picoquic_path_t* path_x, uint64_t rtt_measurement)
+{
+    uint64_t ack_number = picoquic_cc_get_ack_number(path_x);
+    int ret = 0;
+
+    if (ack_number != UINT64_MAX && ack_number >= hs->window_end) {
+        /* Start of a new round */
+        hs->window_end = picoquic_cc_get_sequence_number(path_x);
+        hs->last_round_min_rtt = hs->current_round_min_rtt;
+        hs->current_round_min_rtt = UINT64_MAX;
+        hs->rtt_sample_count = 0;
+        if (hs->is_in_css && ++hs->css_round_count >= PICOQUIC_HYSTART_PP_CSS_ROUNDS) {
+            hs->is_in_css = 0;
+            ret = 1;
+        }
+    }
+
+    if (ret == 0) {
+        if (rtt_measurement < hs->current_round_min_rtt) {
+            hs->current_round_min_rtt = rtt_measurement;
+        }
+        hs->rtt_sample_count++;
+
+        if (hs->rtt_sample_count >= PICOQUIC_HYSTART_PP_N_RTT_SAMPLE) {
+            if (!hs->is_in_css) {
+                if (hs->last_round_min_rtt != UINT64_MAX) {
+                    uint64_t rtt_thresh = hs->last_round_min_rtt / PICOQUIC_HYSTART_PP_MIN_RTT_DIVISOR;
+
+                    if (rtt_thresh > PICOQUIC_HYSTART_PP_MAX_RTT_THRESH) {
+                        rtt_thresh = PICOQUIC_HYSTART_PP_MAX_RTT_THRESH;
+                    }
+                    else if (rtt_thresh < PICOQUIC_HYSTART_PP_MIN_RTT_THRESH) {
+                        rtt_thresh = PICOQUIC_HYSTART_PP_MIN_RTT_THRESH;
+                    }
+                    if (hs->current_round_min_rtt >= hs->last_round_min_rtt + rtt_thresh) {
+                        hs->css_baseline_min_rtt = hs->current_round_min_rtt;
+                        hs->css_round_count = 0;
+                        hs->is_in_css = 1;
+                    }
+                }
+            }
+            else if (hs->current_round_min_rtt < hs->css_baseline_min_rtt) {
+                /* The RTT increase was spurious, back to slow start */
+                hs->css_baseline_min_rtt = UINT64_MAX;
+                hs->is_in_css = 0;
+            }
+        }
+    }
+
+    return ret;
+}
+
+uint64_t picoquic_hystart_pp_increase(picoquic_hystart_pp_t* hs, uint64_t nb_bytes_acknowledged)
+{
+    uint64_t increase = nb_bytes_acknowledged;
+
+    if (hs->is_in_css) {
+        increase += hs->residual_ack;
+        hs->residual_ack = increase % PICOQUIC_HYSTART_PP_CSS_GROWTH_DIVISOR;
+        increase /= PICOQUIC_HYSTART_PP_CSS_GROWTH_DIVISOR;
+    }
+
+    return increase;
+}
+
 uint64_t picoquic_cc_increased_window(picoquic_path_t* path, uint64_t previous_window)
 {
     uint64_t new_window;
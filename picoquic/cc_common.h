@@ -16,6 +16,34 @@ typedef struct st_picoquic_min_max_rtt_t {
     uint64_t samples[PICOQUIC_MIN_MAX_RTT_SCOPE];
 } picoquic_min_max_rtt_t;
 
+/* HyStart++, RFC 9406 */
+#define PICOQUIC_HYSTART_PP_MIN_RTT_THRESH 4000 /* Microseconds */
+#define PICOQUIC_HYSTART_PP_MAX_RTT_THRESH 16000
+#define PICOQUIC_HYSTART_PP_MIN_RTT_DIVISOR 8
+#define PICOQUIC_HYSTART_PP_N_RTT_SAMPLE 8
+#define PICOQUIC_HYSTART_PP_CSS_GROWTH_DIVISOR 4
+#define PICOQUIC_HYSTART_PP_CSS_ROUNDS 5
+
+typedef struct st_picoquic_hystart_pp_t {
+    uint64_t window_end; /* The round ends when this packet number is acknowledged */
+    uint64_t last_round_min_rtt;
+    uint64_t current_round_min_rtt;
+    uint64_t css_baseline_min_rtt;
+    uint64_t residual_ack; /* Acknowledged bytes left over by the CSS growth divisor */
+    int rtt_sample_count;
+    int css_round_count;
+    int is_in_css; /* In Conservative Slow Start */
+} picoquic_hystart_pp_t;
+
+/*
+ * Windowed max or min filter, keeping the best three samples of the window, the
+ * first one being the filtered value. The time can be in microseconds or in rounds.
+ */
+typedef struct st_picoquic_win_filter_t {
+    uint64_t time[3];
+    uint64_t value[3];
+} picoquic_win_filter_t;
+
 
 uint64_t picoquic_cc_get_sequence_number(picoquic_path_t *path);
 
@@ -29,4 +57,22 @@ void picoquic_hystart_increase(picoquic_path_t* path_x, picoquic_min_max_rtt_t*
 
 int picoquic_cc_was_cwin_blocked(picoquic_path_t *path, uint64_t last_sequence_blocked);
 
+void picoquic_hystart_pp_reset(picoquic_hystart_pp_t* hs, picoquic_path_t* path_x);
+/* Returns 1 when the slow start has to end */
+int picoquic_hystart_pp_test(picoquic_hystart_pp_t* hs, picoquic_path_t* path_x, uint64_t rtt_measurement);
+/* Window increase for the bytes acknowledged in slow start */
+uint64_t picoquic_hystart_pp_increase(picoquic_hystart_pp_t* hs, uint64_t nb_bytes_acknowledged);
+
+void picoquic_win_filter_reset(picoquic_win_filter_t* filter, uint64_t time, uint64_t value);
+uint64_t picoquic_win_filter_max(picoquic_win_filter_t* filter, uint64_t window, uint64_t time, uint64_t value);
+uint64_t picoquic_win_filter_min(picoquic_win_filter_t* filter, uint64_t window, uint64_t time, uint64_t value);
+
+/* Returns 1 and fills the sample if the ACK of a packet sent at send_time measures the delivery rate */
+int picoquic_delivery_rate_sample(picoquic_path_t* path_x, uint64_t send_time, uint64_t delivered_prior,
+    uint64_t delivered_time_prior, uint64_t delivered_sent_prior, int is_app_limited, uint64_t delivery_time,
+    picoquic_rate_sample_t* rs);
+
+/* Marks the samples app limited until the data in transit is delivered */
+void picoquic_delivery_rate_set_app_limited(picoquic_path_t* path_x);
+
 #endif //CC_COMMON_H
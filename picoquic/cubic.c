@@ -63,6 +63,17 @@ typedef struct st_picoquic_cubic_state_t {
     int nb_rtt;
     picoquic_cnx_t *cnx;
     uint64_t last_sequence_blocked;
+    picoquic_hystart_pp_t hystart_pp;
+    /* State before the last loss recovery, restored if the loss was spurious */
+    int is_undo_valid;
+    uint64_t undo_sequence;
+    uint64_t undo_cwin;
+    uint64_t undo_ssthresh;
+    uint64_t undo_start_of_epoch;
+    double undo_K;
+    double undo_W_max;
+    double undo_W_last_max;
+    picoquic_cubic_alg_state_t undo_alg_state;
 } picoquic_cubic_state_t;
 
 static int log_cubic_state(picoquic_cubic_state_t *cubic_state, char *buf, size_t buf_length) {
@@ -93,6 +104,7 @@ void picoquic_cubic_init(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
         cubic_state->beta = 7.0 / 8.0;
         cubic_state->start_of_epoch = 0;
         cubic_state->cnx = cnx;
+        picoquic_hystart_pp_reset(&cubic_state->hystart_pp, path_x);
 
         path_x->cwin = PICOQUIC_CWIN_INITIAL;
     }
@@ -140,6 +152,17 @@ static void picoquic_cubic_enter_recovery(picoquic_path_t* path_x,
     picoquic_cubic_state_t* cubic_state,
     uint64_t current_time)
 {
+    /* A CE mark is never spurious */
+    cubic_state->is_undo_valid = (notification != picoquic_congestion_notification_congestion_experienced);
+    cubic_state->undo_sequence = picoquic_cc_get_sequence_number(path_x);
+    cubic_state->undo_cwin = path_x->cwin;
+    cubic_state->undo_ssthresh = cubic_state->ssthresh;
+    cubic_state->undo_start_of_epoch = cubic_state->start_of_epoch;
+    cubic_state->undo_K = cubic_state->K;
+    cubic_state->undo_W_max = cubic_state->W_max;
+    cubic_state->undo_W_last_max = cubic_state->W_last_max;
+    cubic_state->undo_alg_state = cubic_state->alg_state;
+
     /* Update similar to new reno, but different beta */
     cubic_state->W_max = (double)path_x->cwin / (double)path_x->send_mtu;
     /* Apply fast convergence */
@@ -156,6 +179,9 @@ static void picoquic_cubic_enter_recovery(picoquic_path_t* path_x,
         cubic_state->ssthresh = PICOQUIC_CWIN_MINIMUM;
     }
 
+    /* The conservative growth of HyStart++ only applies to the initial slow start */
+    cubic_state->hystart_pp.is_in_css = 0;
+
     if (notification == picoquic_congestion_notification_timeout) {
         path_x->cwin = PICOQUIC_CWIN_MINIMUM;
         cubic_state->start_of_epoch = current_time;
@@ -167,21 +193,26 @@ static void picoquic_cubic_enter_recovery(picoquic_path_t* path_x,
     }
 }
 
-/* On spurious repeat notification, restore the previous congestion control.
- * Assume that K is still valid -- we only update it after exiting recovery.
- * Set cwin to the value of W_max before the recovery event
- * Set W_max to W_max_last, i.e. the value before the recovery event
- * Set the epoch back to where it was, by computing the inverse of the
- * W_cubic formula */
+/* On spurious repeat notification of the packet whose loss started the recovery,
+ * restore the state saved when entering it: cwin, ssthresh, and the cubic curve
+ * defined by W_max, K and the start of the epoch. The curve then continues as if
+ * the loss had never been detected. */
 static void picoquic_cubic_correct_spurious(picoquic_path_t* path_x,
     picoquic_cubic_state_t* cubic_state,
-    uint64_t current_time)
+    uint64_t lost_packet_number)
 {
-    double w_delta = (double)(cubic_state->W_max - cubic_state->W_last_max);
-    double delta_t_sec = picoquic_cubic_root(w_delta / cubic_state->C);
-    cubic_state->start_of_epoch = current_time - (uint64_t)((cubic_state->K + delta_t_sec)*1000000.0);
-    path_x->cwin = (uint64_t)(cubic_state->W_max*(double)path_x->send_mtu);
-    cubic_state->W_max = cubic_state->W_last_max;
+    if (cubic_state->is_undo_valid && lost_packet_number < cubic_state->undo_sequence) {
+        if (path_x->cwin < cubic_state->undo_cwin) {
+            path_x->cwin = cubic_state->undo_cwin;
+        }
+        cubic_state->ssthresh = cubic_state->undo_ssthresh;
+        cubic_state->start_of_epoch = cubic_state->undo_start_of_epoch;
+        cubic_state->K = cubic_state->undo_K;
+        cubic_state->W_max = cubic_state->undo_W_max;
+        cubic_state->W_last_max = cubic_state->undo_W_last_max;
+        cubic_state->alg_state = cubic_state->undo_alg_state;
+        cubic_state->is_undo_valid = 0;
+    }
 }
 
 /* Compute W_cubic(t) = C * (t - K) ^ 3 + W_max */
@@ -225,7 +256,6 @@ void picoquic_cubic_notify(picoquic_path_t* path_x,
 {
 #ifdef _WINDOWS
     UNREFERENCED_PARAMETER(rtt_measurement);
-    UNREFERENCED_PARAMETER(lost_packet_number);
 #endif
     picoquic_cubic_state_t* cubic_state = (picoquic_cubic_state_t*)path_x->congestion_alg_state;
 
@@ -237,7 +267,7 @@ void picoquic_cubic_notify(picoquic_path_t* path_x,
             case picoquic_congestion_notification_acknowledgement:
                 /* Only increase when the app is CWIN limited */
                 if (picoquic_cc_was_cwin_blocked(path_x, cubic_state->last_sequence_blocked)) {
-                    path_x->cwin += nb_bytes_acknowledged;
+                    path_x->cwin += picoquic_hystart_pp_increase(&cubic_state->hystart_pp, nb_bytes_acknowledged);
                     /* if cnx->cwin exceeds SSTHRESH, exit and go to CA */
                     if (path_x->cwin >= cubic_state->ssthresh) {
                         picoquic_cubic_enter_avoidance(cubic_state, current_time);
@@ -253,10 +283,19 @@ void picoquic_cubic_notify(picoquic_path_t* path_x,
                 }
                 break;
             case picoquic_congestion_notification_spurious_repeat:
+                picoquic_cubic_correct_spurious(path_x, cubic_state, lost_packet_number);
                 break;
             case picoquic_congestion_notification_rtt_measurement:
                 /* Using RTT increases as signal to get out of initial slow start */
-                if (cubic_state->ssthresh == (uint64_t)((int64_t)-1)) {
+                if (cubic_state->ssthresh == (uint64_t)((int64_t)-1) && cubic_state->cnx->is_hystart_pp_enabled) {
+                    if (picoquic_hystart_pp_test(&cubic_state->hystart_pp, path_x, rtt_measurement)) {
+                        cubic_state->ssthresh = path_x->cwin;
+                        cubic_state->W_max = (double)path_x->cwin / (double)path_x->send_mtu;
+                        cubic_state->W_last_max = cubic_state->W_max;
+                        picoquic_cubic_enter_avoidance(cubic_state, current_time);
+                    }
+                }
+                else if (cubic_state->ssthresh == (uint64_t)((int64_t)-1)) {
                     uint64_t rolling_min;
                     uint64_t delta_rtt;
 
@@ -302,41 +341,35 @@ void picoquic_cubic_notify(picoquic_path_t* path_x,
             break;
         case picoquic_cubic_alg_recovery:
             /* If the notification is coming less than 1RTT after start,
-			 * ignore it, unless it is a spurious retransmit detection */
-            if (notification == picoquic_congestion_notification_spurious_repeat) {
-                /* To do: if spurious repeat of initial loss detected,
-                 * exit recovery and reset threshold to pre-entry cwin.
-                 */
-            } else{
-                switch (notification) {
-                case picoquic_congestion_notification_acknowledgement:
-                    /* exit recovery, move to CA or SS, depending on CWIN */
-                    cubic_state->alg_state = picoquic_cubic_alg_slow_start;
-                    path_x->cwin += nb_bytes_acknowledged;
-                    /* if cnx->cwin exceeds SSTHRESH, exit and go to CA */
-                    if (path_x->cwin >= cubic_state->ssthresh) {
-                        cubic_state->alg_state = picoquic_cubic_alg_congestion_avoidance;
-                    }
-                    break;
-                case picoquic_congestion_notification_spurious_repeat:
-                    picoquic_cubic_correct_spurious(path_x, cubic_state, current_time);
-                    break;
-                case picoquic_congestion_notification_congestion_experienced:
-                case picoquic_congestion_notification_repeat:
-                case picoquic_congestion_notification_timeout:
-                    if (current_time - cubic_state->start_of_epoch > path_x->smoothed_rtt) {
-                        /* re-enter recovery if this is a new loss */
-                        picoquic_cubic_enter_recovery(path_x, notification, cubic_state, current_time);
-                    }
-                    break;
-                case picoquic_congestion_notification_cwin_blocked:
-                    cubic_state->last_sequence_blocked = picoquic_cc_get_sequence_number(path_x);
-                    break;
-                case picoquic_congestion_notification_rtt_measurement:
-                default:
-                    /* ignore */
-                    break;
+             * ignore it, unless it is a spurious retransmit detection */
+            switch (notification) {
+            case picoquic_congestion_notification_acknowledgement:
+                /* exit recovery, move to CA or SS, depending on CWIN */
+                cubic_state->alg_state = picoquic_cubic_alg_slow_start;
+                path_x->cwin += nb_bytes_acknowledged;
+                /* if cnx->cwin exceeds SSTHRESH, exit and go to CA */
+                if (path_x->cwin >= cubic_state->ssthresh) {
+                    cubic_state->alg_state = picoquic_cubic_alg_congestion_avoidance;
+                }
+                break;
+            case picoquic_congestion_notification_spurious_repeat:
+                picoquic_cubic_correct_spurious(path_x, cubic_state, lost_packet_number);
+                break;
+            case picoquic_congestion_notification_congestion_experienced:
+            case picoquic_congestion_notification_repeat:
+            case picoquic_congestion_notification_timeout:
+                if (current_time - cubic_state->start_of_epoch > path_x->smoothed_rtt) {
+                    /* re-enter recovery if this is a new loss */
+                    picoquic_cubic_enter_recovery(path_x, notification, cubic_state, current_time);
                 }
+                break;
+            case picoquic_congestion_notification_cwin_blocked:
+                cubic_state->last_sequence_blocked = picoquic_cc_get_sequence_number(path_x);
+                break;
+            case picoquic_congestion_notification_rtt_measurement:
+            default:
+                /* ignore */
+                break;
             }
             break;
         case picoquic_cubic_alg_tcp_friendly:
@@ -369,6 +402,8 @@ void picoquic_cubic_notify(picoquic_path_t* path_x,
                 cubic_state->last_sequence_blocked = picoquic_cc_get_sequence_number(path_x);
                 break;
             case picoquic_congestion_notification_spurious_repeat:
+                picoquic_cubic_correct_spurious(path_x, cubic_state, lost_packet_number);
+                break;
             case picoquic_congestion_notification_rtt_measurement:
             default:
                 /* ignore */
@@ -396,6 +431,8 @@ void picoquic_cubic_notify(picoquic_path_t* path_x,
                 cubic_state->last_sequence_blocked = picoquic_cc_get_sequence_number(path_x);
                 break;
             case picoquic_congestion_notification_spurious_repeat:
+                picoquic_cubic_correct_spurious(path_x, cubic_state, lost_packet_number);
+                break;
             case picoquic_congestion_notification_rtt_measurement:
             default:
                 /* ignore */
@@ -409,7 +446,7 @@ void picoquic_cubic_notify(picoquic_path_t* path_x,
         /* Compute pacing data */
         picoquic_update_pacing_data(path_x);
 
-        LOG {
+        LOG_FOR(cubic_state->cnx) {
             char state_str[1024] = { 0 };
             log_cubic_state(cubic_state, state_str, sizeof(state_str));
 
@@ -25,6 +25,9 @@
 #include <string.h>
 #include "plugin.h"
 #include "memory.h"
+#include "cc_common.h"
+#include "tracepoints.h"
+#include "alloc_profiler.h"
 
 /* ****************************************************
  * Frames private declarations
@@ -135,15 +138,37 @@ static uint8_t* picoquic_frames_length_data_skip(uint8_t* bytes, const uint8_t*
 
 /* ****************************************************** */
 
+/*
+ * The ready tree is sorted by this rank, then by stream ID. The streams of an odd rank are sent in
+ * round robin, those of an even rank one after the other.
+ */
+static uint64_t picoquic_stream_ready_rank(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
+{
+    switch (cnx->stream_scheduler) {
+    case picoquic_stream_scheduler_round_robin:
+        return 1;
+    case picoquic_stream_scheduler_weighted:
+        return stream->wfq_tag << 1;
+    case picoquic_stream_scheduler_strict_priority:
+        return ((uint64_t)stream->urgency) << 1;
+    default:
+        return (((uint64_t)stream->urgency) << 1) | ((stream->is_sequential) ? 0 : 1);
+    }
+}
+
 picoquic_stream_head* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t stream_id)
 {
-    picoquic_stream_head* stream = (picoquic_stream_head*)malloc(sizeof(picoquic_stream_head));
+    picoquic_stream_head* stream = picoquic_create_stream_object(cnx);
     if (stream != NULL) {
         picoquic_stream_head* previous_stream = NULL;
         picoquic_stream_head* next_stream = cnx->first_stream;
 
-        memset(stream, 0, sizeof(picoquic_stream_head));
+        picoquic_memory_charge(cnx, picoquic_memory_streams, sizeof(picoquic_stream_head));
         stream->stream_id = stream_id;
+        stream->urgency = PICOQUIC_STREAM_URGENCY_DEFAULT;
+        stream->weight = PICOQUIC_STREAM_WEIGHT_DEFAULT;
+        stream->wfq_tag = cnx->wfq_virtual_time;
+        stream->ready_rank = picoquic_stream_ready_rank(cnx, stream);
 
         if (IS_LOCAL_STREAM_ID(stream_id, cnx->client_mode)) {
             if (IS_BIDIR_STREAM_ID(stream_id)) {
@@ -165,6 +190,7 @@ picoquic_stream_head* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t strea
                 stream->maxdata_remote = 0;
             }
         }
+        stream->max_data_window = stream->maxdata_local;
 
         /*
          * Make sure that the streams are open in order.
@@ -183,6 +209,8 @@ picoquic_stream_head* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t strea
             previous_stream->next_stream = stream;
         }
 
+        HASH_ADD(hh, cnx->streams_by_id, stream_id, sizeof(uint64_t), stream);
+
         protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_STREAM_OPENED, NULL, stream, stream_id);
     }
 
@@ -202,11 +230,13 @@ void picoquic_update_stream_initial_remote(picoquic_cnx_t* cnx)
             if (IS_BIDIR_STREAM_ID(stream->stream_id)) {
                 if (stream->maxdata_remote < cnx->remote_parameters.initial_max_stream_data_bidi_remote) {
                     stream->maxdata_remote = cnx->remote_parameters.initial_max_stream_data_bidi_remote;
+                    picoquic_mark_stream_ready(cnx, stream);
                 }
             }
             else {
                 if (stream->maxdata_remote < cnx->remote_parameters.initial_max_stream_data_uni) {
                     stream->maxdata_remote = cnx->remote_parameters.initial_max_stream_data_uni;
+                    picoquic_mark_stream_ready(cnx, stream);
                 }
             }
         }
@@ -216,15 +246,9 @@ void picoquic_update_stream_initial_remote(picoquic_cnx_t* cnx)
 
 picoquic_stream_head* picoquic_find_stream(picoquic_cnx_t* cnx, uint64_t stream_id, int create)
 {
-    picoquic_stream_head* stream = cnx->first_stream;
+    picoquic_stream_head* stream = NULL;
 
-    while (stream) {
-        if (stream->stream_id == stream_id) {
-            break;
-        } else {
-            stream = stream->next_stream;
-        }
-    };
+    HASH_FIND(hh, cnx->streams_by_id, &stream_id, sizeof(uint64_t), stream);
 
     if (create != 0 && stream == NULL) {
         stream = picoquic_create_stream(cnx, stream_id);
@@ -260,13 +284,15 @@ picoquic_stream_head* picoquic_find_or_create_stream(picoquic_cnx_t* cnx, uint64
 
 picoquic_stream_head* picoquic_create_plugin_stream(picoquic_cnx_t* cnx, uint64_t pid_id)
 {
-    picoquic_stream_head* stream = (picoquic_stream_head*)malloc(sizeof(picoquic_stream_head));
+    picoquic_stream_head* stream = picoquic_create_stream_object(cnx);
     if (stream != NULL) {
         picoquic_stream_head* previous_stream = NULL;
         picoquic_stream_head* next_stream = cnx->first_plugin_stream;
 
-        memset(stream, 0, sizeof(picoquic_stream_head));
+        picoquic_memory_charge(cnx, picoquic_memory_plugins, sizeof(picoquic_stream_head));
         stream->stream_id = pid_id;
+        /* The plugin streams are visited in round robin, whatever the scheduler of the connection */
+        stream->ready_rank = 1;
 
         /* FIXME currently, only server is allowed to send plugin frames */
         if (cnx->client_mode) {
@@ -406,12 +432,10 @@ int picoquic_prepare_stream_reset_frame(picoquic_cnx_t *cnx, picoquic_stream_hea
             /* Free the queued data */
             while (stream->send_queue != NULL) {
                 picoquic_stream_data* next = stream->send_queue->next_stream_data;
-                if (stream->send_queue->bytes != NULL) {
-                    free(stream->send_queue->bytes);
-                }
-                free(stream->send_queue);
+                picoquic_free_stream_data(cnx, stream->send_queue);
                 stream->send_queue = next;
             }
+            picoquic_release_send_buffered(cnx, stream);
         }
     }
 
@@ -756,32 +780,59 @@ int picoquic_parse_stream_header(const uint8_t* bytes, size_t bytes_max,
     return ret;
 }
 
-void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
+/* Frees the bytes of the stream before its consumed offset, and opens its window when due */
+static void picoquic_stream_release_consumed(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
 {
-    picoquic_stream_data* data = stream->stream_data;
+    picoquic_stream_recv_release(&stream->recv, stream->consumed_offset);
 
-    while (data != NULL && data->offset <= stream->consumed_offset) {
-        size_t start = (size_t)(stream->consumed_offset - data->offset);
-        size_t data_length = data->length - start;
-        picoquic_call_back_event_t fin_now = picoquic_callback_no_event;
+    /* Past half of the window, the stream waits for its MAX_STREAM_DATA */
+    if (!stream->is_max_data_queued && picoquic_is_max_stream_data_needed(stream)) {
+        stream->next_max_data_stream = NULL;
+        if (cnx->last_max_data_stream == NULL) {
+            cnx->first_max_data_stream = stream;
+        } else {
+            cnx->last_max_data_stream->next_max_data_stream = stream;
+        }
+        cnx->last_max_data_stream = stream;
+        stream->is_max_data_queued = 1;
+    }
+}
 
-        stream->consumed_offset += data_length;
+/* Hands the next in order bytes of the stream to the application */
+static void picoquic_stream_deliver(picoquic_cnx_t* cnx, picoquic_stream_head* stream, const uint8_t* bytes, size_t data_length)
+{
+    picoquic_call_back_event_t fin_now = picoquic_callback_no_event;
 
-        if (stream->consumed_offset >= stream->fin_offset && stream->fin_received && !stream->fin_signalled){
-            fin_now = picoquic_callback_stream_fin;
-            stream->fin_signalled = 1;
-        }
+    stream->consumed_offset += data_length;
 
-        LOG_EVENT(cnx, "application", "callback", picoquic_log_fin_or_event_name(fin_now), "{\"stream_id\": %" PRIu64 ", \"data_length\": %" PRIu64 "}", stream->stream_id, data_length);
-        if (cnx->callback_fn(cnx, stream->stream_id, data->bytes + start, data_length, fin_now,
-            cnx->callback_ctx, stream->app_stream_ctx) != 0) {
-            picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_INTERNAL_ERROR, 0);
-        }
+    if (stream->consumed_offset >= stream->fin_offset && stream->fin_received && !stream->fin_signalled){
+        fin_now = picoquic_callback_stream_fin;
+        stream->fin_signalled = 1;
+    }
 
-        free(data->bytes);
-        stream->stream_data = data->next_stream_data;
-        free(data);
-        data = stream->stream_data;
+    LOG_EVENT(cnx, "application", "callback", picoquic_log_fin_or_event_name(fin_now), "{\"stream_id\": %" PRIu64 ", \"data_length\": %" PRIu64 "}", stream->stream_id, data_length);
+    if (cnx->callback_fn(cnx, stream->stream_id, (uint8_t*)bytes, data_length, fin_now,
+        cnx->callback_ctx, stream->app_stream_ctx) != 0) {
+        picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_INTERNAL_ERROR, 0);
+    }
+
+    picoquic_stream_release_consumed(cnx, stream);
+}
+
+int picoquic_is_max_stream_data_needed(picoquic_stream_head* stream)
+{
+    return !stream->fin_received && !stream->reset_received &&
+        stream->maxdata_local - stream->consumed_offset < stream->max_data_window / 2;
+}
+
+void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
+{
+    const uint8_t* bytes = NULL;
+    size_t data_length;
+
+    /* The data wrapping around the end of the ring comes in two spans */
+    while ((data_length = picoquic_stream_recv_peek(&stream->recv, stream->consumed_offset, &bytes)) > 0) {
+        picoquic_stream_deliver(cnx, stream, bytes, data_length);
     }
 
     /* handle the case where the fin frame does not carry any data */
@@ -794,10 +845,202 @@ void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head* st
             picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_INTERNAL_ERROR, 0);
         }
     }
+
+    if (stream->fin_signalled) {
+        picoquic_memory_release(cnx, picoquic_memory_recv_data, picoquic_stream_recv_footprint(&stream->recv));
+        picoquic_stream_recv_free(&stream->recv);
+    }
+}
+
+/* Adds the stream to the next batch callback, see picoquic_set_stream_batch_callbacks() */
+static void picoquic_mark_stream_readable(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
+{
+    picoquic_quic_t* quic = cnx->quic;
+
+    if (stream->is_readable_queued) {
+        return;
+    }
+
+    if (cnx->first_readable_stream == NULL) {
+        cnx->next_readable_cnx = NULL;
+        cnx->previous_readable_cnx = quic->last_readable_cnx;
+        if (quic->last_readable_cnx == NULL) {
+            quic->first_readable_cnx = cnx;
+        } else {
+            quic->last_readable_cnx->next_readable_cnx = cnx;
+        }
+        quic->last_readable_cnx = cnx;
+        cnx->first_readable_stream = stream;
+    } else {
+        cnx->last_readable_stream->next_readable_stream = stream;
+    }
+    stream->next_readable_stream = NULL;
+    cnx->last_readable_stream = stream;
+    cnx->nb_readable_streams++;
+    stream->is_readable_queued = 1;
+}
+
+void picoquic_remove_readable_cnx(picoquic_cnx_t* cnx)
+{
+    picoquic_quic_t* quic = cnx->quic;
+    picoquic_stream_head* stream;
+
+    if (cnx->first_readable_stream == NULL) {
+        return;
+    }
+
+    if (cnx->previous_readable_cnx == NULL) {
+        quic->first_readable_cnx = cnx->next_readable_cnx;
+    } else {
+        cnx->previous_readable_cnx->next_readable_cnx = cnx->next_readable_cnx;
+    }
+    if (cnx->next_readable_cnx == NULL) {
+        quic->last_readable_cnx = cnx->previous_readable_cnx;
+    } else {
+        cnx->next_readable_cnx->previous_readable_cnx = cnx->previous_readable_cnx;
+    }
+    cnx->next_readable_cnx = NULL;
+    cnx->previous_readable_cnx = NULL;
+
+    while ((stream = cnx->first_readable_stream) != NULL) {
+        cnx->first_readable_stream = stream->next_readable_stream;
+        stream->next_readable_stream = NULL;
+        stream->is_readable_queued = 0;
+    }
+    cnx->last_readable_stream = NULL;
+    cnx->nb_readable_streams = 0;
+}
+
+/* The data wrapping around the end of the ring comes in two spans, an empty one signals a fin that came alone */
+static size_t picoquic_stream_spans(picoquic_stream_head* stream, picoquic_stream_span_t* spans, size_t max_spans)
+{
+    uint64_t offset = stream->consumed_offset;
+    const uint8_t* bytes = NULL;
+    size_t length;
+    size_t nb_spans = 0;
+
+    if (stream->reset_received || stream->fin_signalled) {
+        return 0;
+    }
+
+    while (nb_spans < max_spans && (length = picoquic_stream_recv_peek(&stream->recv, offset, &bytes)) > 0) {
+        spans[nb_spans].stream_id = stream->stream_id;
+        spans[nb_spans].app_stream_ctx = stream->app_stream_ctx;
+        spans[nb_spans].offset = offset;
+        spans[nb_spans].bytes = bytes;
+        spans[nb_spans].length = length;
+        spans[nb_spans].is_fin = 0;
+        offset += length;
+        nb_spans++;
+    }
+
+    if (stream->fin_received && offset >= stream->fin_offset) {
+        if (nb_spans > 0) {
+            spans[nb_spans - 1].is_fin = 1;
+        } else if (max_spans > 0) {
+            spans[0].stream_id = stream->stream_id;
+            spans[0].app_stream_ctx = stream->app_stream_ctx;
+            spans[0].offset = offset;
+            spans[0].bytes = NULL;
+            spans[0].length = 0;
+            spans[0].is_fin = 1;
+            nb_spans = 1;
+        }
+    }
+
+    return nb_spans;
+}
+
+void picoquic_set_stream_batch_callbacks(picoquic_quic_t* quic, int enable)
+{
+    quic->stream_batch_callbacks = (enable) ? 1 : 0;
+}
+
+void picoquic_notify_stream_batches(picoquic_quic_t* quic)
+{
+    picoquic_cnx_t* cnx;
+
+    while ((cnx = quic->first_readable_cnx) != NULL) {
+        size_t nb_spans = 0;
+
+        if (2 * cnx->nb_readable_streams > quic->stream_batch_spans_max) {
+            size_t new_max = (quic->stream_batch_spans_max == 0) ? 16 : quic->stream_batch_spans_max;
+            picoquic_stream_span_t* new_spans;
+
+            while (new_max < 2 * cnx->nb_readable_streams) {
+                new_max *= 2;
+            }
+            if ((new_spans = (picoquic_stream_span_t*)realloc(quic->stream_batch_spans,
+                new_max * sizeof(picoquic_stream_span_t))) == NULL) {
+                picoquic_remove_readable_cnx(cnx);
+                picoquic_connection_error(cnx, PICOQUIC_ERROR_MEMORY, 0);
+                continue;
+            }
+            quic->stream_batch_spans = new_spans;
+            quic->stream_batch_spans_max = new_max;
+        }
+
+        for (picoquic_stream_head* stream = cnx->first_readable_stream; stream != NULL; stream = stream->next_readable_stream) {
+            nb_spans += picoquic_stream_spans(stream, quic->stream_batch_spans + nb_spans, 2);
+        }
+        picoquic_remove_readable_cnx(cnx);
+
+        if (nb_spans > 0 && cnx->callback_fn != NULL) {
+            LOG_EVENT(cnx, "application", "callback", picoquic_log_fin_or_event_name(picoquic_callback_stream_batch), "{\"nb_spans\": %" PRIst "}", nb_spans);
+            if (cnx->callback_fn(cnx, 0, (uint8_t*)quic->stream_batch_spans, nb_spans, picoquic_callback_stream_batch,
+                cnx->callback_ctx, NULL) != 0) {
+                picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_INTERNAL_ERROR, 0);
+            }
+        }
+    }
 }
 
-/* Common code to data stream and crypto hs stream */
-static int picoquic_queue_network_input(picoquic_cnx_t* cnx, picoquic_stream_head* stream, size_t offset, uint8_t* bytes, size_t length, int * new_data_available)
+size_t picoquic_get_stream_spans(picoquic_cnx_t* cnx, uint64_t stream_id, picoquic_stream_span_t* spans, size_t max_spans)
+{
+    picoquic_stream_head* stream = picoquic_find_stream(cnx, stream_id, 0);
+
+    return (stream == NULL) ? 0 : picoquic_stream_spans(stream, spans, max_spans);
+}
+
+int picoquic_consume_stream_data(picoquic_cnx_t* cnx, const picoquic_stream_consumed_t* consumed, size_t nb_consumed)
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < nb_consumed; i++) {
+        picoquic_stream_head* stream = picoquic_find_stream(cnx, consumed[i].stream_id, 0);
+        picoquic_stream_span_t spans[2];
+        size_t nb_spans;
+        size_t available = 0;
+
+        if (stream == NULL) {
+            ret = PICOQUIC_ERROR_INVALID_STREAM_ID;
+            break;
+        }
+        nb_spans = picoquic_stream_spans(stream, spans, 2);
+        for (size_t j = 0; j < nb_spans; j++) {
+            available += spans[j].length;
+        }
+        if (nb_spans == 0 || consumed[i].length > available) {
+            ret = PICOQUIC_ERROR_UNEXPECTED_STATE;
+        } else {
+            stream->consumed_offset += consumed[i].length;
+            picoquic_stream_release_consumed(cnx, stream);
+
+            if (stream->fin_received && stream->consumed_offset >= stream->fin_offset) {
+                stream->fin_signalled = 1;
+                picoquic_memory_release(cnx, picoquic_memory_recv_data, picoquic_stream_recv_footprint(&stream->recv));
+                picoquic_stream_recv_free(&stream->recv);
+                picoquic_update_max_stream_ID_local(cnx, stream);
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Queues the received data of the crypto hs and plugin streams */
+static int picoquic_queue_network_input(picoquic_cnx_t* cnx, picoquic_stream_head* stream, picoquic_memory_category_enum category,
+    size_t offset, uint8_t* bytes, size_t length, int * new_data_available)
 {
     int ret = 0;
     picoquic_stream_data** pprevious = &stream->stream_data;
@@ -841,6 +1084,7 @@ static int picoquic_queue_network_input(picoquic_cnx_t* cnx, picoquic_stream_hea
             }
             else {
                 data->length = data_length;
+                data->capacity = 0;
                 data->bytes = (uint8_t*)malloc(data_length);
                 if (data->bytes == NULL) {
                     ret = picoquic_connection_error(cnx, PICOQUIC_ERROR_MEMORY, 0);
@@ -848,6 +1092,11 @@ static int picoquic_queue_network_input(picoquic_cnx_t* cnx, picoquic_stream_hea
                 }
                 else {
                     data->offset = offset + start;
+                    data->archive = NULL;
+                    data->release_fn = NULL;
+                    data->memory_category = category;
+                    picoquic_memory_charge(cnx, category, picoquic_stream_data_footprint(data));
+                    PICOQUIC_ALLOC_PROFILE(picoquic_alloc_site_stream_data, NULL, picoquic_stream_data_footprint(data));
                     memcpy(data->bytes, bytes + start, data_length);
                     data->next_stream_data = next;
                     *pprevious = data;
@@ -861,10 +1110,11 @@ static int picoquic_queue_network_input(picoquic_cnx_t* cnx, picoquic_stream_hea
 }
 
 static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id,
-    uint64_t offset, int fin, uint8_t* bytes, size_t length, uint64_t current_time)
+    uint64_t offset, int fin, uint8_t* bytes, size_t length, uint64_t current_time, picoquic_path_t* path_x)
 {
     int ret = 0;
     uint64_t should_notify = 0;
+    int fills_gap = 0;
     /* Is there such a stream, is it still open? */
     picoquic_stream_head* stream;
     uint64_t new_fin_offset = offset + length;
@@ -894,7 +1144,35 @@ static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id
     if (ret == 0) {
         int new_data_available = 0;
 
-        ret = picoquic_queue_network_input(cnx, stream, (size_t)offset, bytes, length, &new_data_available);
+        if (path_x != NULL) {
+            if (offset > stream->consumed_offset) {
+                path_x->ooo_bytes_received += length;
+            } else if (offset + length > stream->consumed_offset) {
+                fills_gap = picoquic_stream_recv_first_offset(&stream->recv) != UINT64_MAX;
+            }
+        }
+
+        if (cnx->callback_fn != NULL && !cnx->quic->stream_batch_callbacks &&
+            offset <= stream->consumed_offset && offset + length > stream->consumed_offset) {
+            /* The in order bytes before the buffered ones are handed to the application from the packet, without copy */
+            uint64_t direct_end = picoquic_stream_recv_first_offset(&stream->recv);
+
+            if (direct_end > offset + length) {
+                direct_end = offset + length;
+            }
+            if (direct_end > stream->consumed_offset) {
+                picoquic_stream_deliver(cnx, stream, bytes + (stream->consumed_offset - offset), (size_t)(direct_end - stream->consumed_offset));
+                new_data_available = 1;
+            }
+        }
+
+        /* Only keeps what was not delivered */
+        size_t footprint = picoquic_stream_recv_footprint(&stream->recv);
+        if (picoquic_stream_recv_insert(&stream->recv, stream->consumed_offset, offset, bytes, length, &new_data_available) != 0) {
+            ret = picoquic_connection_error(cnx, PICOQUIC_ERROR_MEMORY, 0);
+        }
+        picoquic_memory_release(cnx, picoquic_memory_recv_data, footprint);
+        picoquic_memory_charge(cnx, picoquic_memory_recv_data, picoquic_stream_recv_footprint(&stream->recv));
 
         if (new_data_available) {
             should_notify = 1;
@@ -902,9 +1180,16 @@ static int picoquic_stream_network_input(picoquic_cnx_t* cnx, uint64_t stream_id
         }
     }
 
-    if (ret == 0 && should_notify != 0 && cnx->callback_fn != NULL) {
+    if (ret == 0 && should_notify != 0 && cnx->callback_fn != NULL && cnx->quic->stream_batch_callbacks) {
+        picoquic_mark_stream_readable(cnx, stream);
+    } else if (ret == 0 && should_notify != 0 && cnx->callback_fn != NULL) {
         /* check how much data there is to send */
         picoquic_stream_data_callback(cnx, stream);
+
+        /* The buffered bytes delivered after those of the frame were blocked by it */
+        if (fills_gap && stream->consumed_offset > offset + length) {
+            path_x->hol_blocking_bytes += stream->consumed_offset - (offset + length);
+        }
     }
 
     return ret;
@@ -947,65 +1232,220 @@ protoop_arg_t process_stream_frame(picoquic_cnx_t* cnx)
 {
     stream_frame_t *frame = (stream_frame_t *) cnx->protoop_inputv[0];
     uint64_t current_time = (uint64_t) cnx->protoop_inputv[1];
+    picoquic_path_t* path_x = (picoquic_path_t *) cnx->protoop_inputv[3];
 
-    if (picoquic_stream_network_input(cnx, frame->stream_id, frame->offset, frame->fin, frame->data_ptr, frame->data_length, current_time) != 0) {
+    if (picoquic_stream_network_input(cnx, frame->stream_id, frame->offset, frame->fin, frame->data_ptr, frame->data_length, current_time, path_x) != 0) {
         return 1;
     }
 
     return 0;
 }
 
-/**
- * See PROTOOP_NOPARAM_FIND_READY_STREAM
+/*
+ * The streams that may have something to send are kept in a tree sorted by their ready rank, then
+ * by stream ID, so that finding the next one to send does not visit the idle ones. A stream is added
+ * when data, FIN, reset or stop sending is requested, or when its flow control credit grows. It is
+ * removed by the lookup once it has nothing to send, or is blocked by its own flow control.
  */
-protoop_arg_t find_ready_stream(picoquic_cnx_t *cnx) {
-    picoquic_stream_head *stream = NULL;
-
-    for (int nb_pass = 0; nb_pass < 2; nb_pass++) {
-        stream = cnx->first_stream;
-        if (nb_pass == 0) {
-            /* Skip to the first non visited stream */
-            while (stream && stream->stream_id <= cnx->last_visited_stream_id) {
-                stream = stream->next_stream;
-            }
+static int64_t picoquic_ready_stream_compare(void* l, void* r)
+{
+    picoquic_stream_head* left = (picoquic_stream_head*)l;
+    picoquic_stream_head* right = (picoquic_stream_head*)r;
+
+    if (left->ready_rank != right->ready_rank) {
+        return (left->ready_rank < right->ready_rank) ? -1 : 1;
+    }
+    return (left->stream_id < right->stream_id) ? -1 : (left->stream_id > right->stream_id);
+}
+
+static picosplay_node_t* picoquic_ready_stream_create(void* value)
+{
+    return &((picoquic_stream_head*)value)->ready_node;
+}
+
+static void* picoquic_ready_stream_value(picosplay_node_t* node)
+{
+    return (void*)((char*)node - offsetof(struct _picoquic_stream_head, ready_node));
+}
+
+static void picoquic_ready_stream_delete(void* tree, picosplay_node_t* node)
+{
+    (void)tree;
+    ((picoquic_stream_head*)picoquic_ready_stream_value(node))->is_ready_queued = 0;
+}
+
+void picoquic_init_ready_streams(picoquic_cnx_t* cnx)
+{
+    picosplay_init_tree(&cnx->ready_stream_tree, picoquic_ready_stream_compare, picoquic_ready_stream_create,
+        picoquic_ready_stream_delete, picoquic_ready_stream_value);
+    picosplay_init_tree(&cnx->ready_plugin_stream_tree, picoquic_ready_stream_compare, picoquic_ready_stream_create,
+        picoquic_ready_stream_delete, picoquic_ready_stream_value);
+}
+
+static void picoquic_insert_ready_stream(picosplay_tree_t* ready_tree, picoquic_stream_head* stream)
+{
+    if (!stream->is_ready_queued) {
+        picosplay_insert(ready_tree, stream);
+        stream->is_ready_queued = 1;
+    }
+}
+
+void picoquic_mark_stream_ready(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
+{
+    if (!stream->is_ready_queued) {
+        /* A stream that was idle starts from the current virtual time, it does not get back its unused share */
+        if (cnx->stream_scheduler == picoquic_stream_scheduler_weighted && stream->wfq_tag < cnx->wfq_virtual_time) {
+            stream->wfq_tag = cnx->wfq_virtual_time;
         }
-        while (stream) {
-            if ((cnx->maxdata_remote > cnx->data_sent && stream->sent_offset < stream->maxdata_remote &&
-                (stream->is_active ||
-                (stream->send_queue != NULL && stream->send_queue->length > stream->send_queue->offset) ||
-                (stream->fin_requested && !stream->fin_sent))) ||
-                    (stream->reset_requested && !stream->reset_sent) ||
-                (stream->stop_sending_requested && !stream->stop_sending_sent)) {
-                /* if the stream is not active yet, verify that it fits under
-                 * the max stream id limit */
-                /* Check parity */
-                if (IS_CLIENT_STREAM_ID(stream->stream_id) == cnx->client_mode) {
-                    if (stream->stream_id <= cnx->max_stream_id_bidir_remote) {
-                        break;
-                    }
-                } else {
-                    break;
-                }
-            }
+        stream->ready_rank = picoquic_stream_ready_rank(cnx, stream);
+    }
+    picoquic_insert_ready_stream(&cnx->ready_stream_tree, stream);
+}
 
-            stream = stream->next_stream;
-            
-            if (nb_pass > 0) {
-                /* Dont do the loop twice */
-                if (stream && stream->stream_id > cnx->last_visited_stream_id) {
-                    stream = NULL;
-                    break;
-                }
-            }
-        };
+void picoquic_mark_plugin_stream_ready(picoquic_cnx_t* cnx, picoquic_stream_head* plugin_stream)
+{
+    picoquic_insert_ready_stream(&cnx->ready_plugin_stream_tree, plugin_stream);
+}
 
-        /* Do only one pass if we found a stream */
-        if (stream != NULL) {
+/* The key of a queued stream cannot change in place, it is taken out of the tree while it changes */
+static void picoquic_update_stream_rank(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
+{
+    uint64_t ready_rank = picoquic_stream_ready_rank(cnx, stream);
+
+    if (ready_rank != stream->ready_rank) {
+        int was_queued = stream->is_ready_queued;
+
+        if (was_queued) {
+            picosplay_delete_hint(&cnx->ready_stream_tree, &stream->ready_node);
+        }
+        stream->ready_rank = ready_rank;
+        if (was_queued) {
+            picoquic_insert_ready_stream(&cnx->ready_stream_tree, stream);
+        }
+    }
+}
+
+void picoquic_update_stream_priority(picoquic_cnx_t* cnx, picoquic_stream_head* stream, uint8_t urgency, int is_sequential)
+{
+    stream->urgency = urgency;
+    stream->is_sequential = (is_sequential) ? 1 : 0;
+    picoquic_update_stream_rank(cnx, stream);
+}
+
+/* Charges the bytes sent on the stream to its share, which delays it behind the streams that sent less */
+void picoquic_charge_stream_weight(picoquic_cnx_t* cnx, picoquic_stream_head* stream, size_t length)
+{
+    if (cnx->stream_scheduler == picoquic_stream_scheduler_weighted) {
+        if (stream->wfq_tag > cnx->wfq_virtual_time) {
+            cnx->wfq_virtual_time = stream->wfq_tag;
+        }
+        stream->wfq_tag += ((uint64_t)length * PICOQUIC_STREAM_WEIGHT_MAX) / stream->weight;
+        picoquic_update_stream_rank(cnx, stream);
+    }
+}
+
+/* Whether the stream has a reset or stop sending to send, which is not subject to flow control */
+static int picoquic_stream_has_control_to_send(picoquic_stream_head* stream)
+{
+    return (stream->reset_requested && !stream->reset_sent) ||
+        (stream->stop_sending_requested && !stream->stop_sending_sent);
+}
+
+/* Whether the stream can send something, if the connection flow control allows it */
+static int picoquic_stream_has_frames_to_send(picoquic_stream_head* stream)
+{
+    return (stream->sent_offset < stream->maxdata_remote &&
+        (stream->is_active ||
+        (stream->send_queue != NULL && stream->send_queue->length > stream->send_queue->offset) ||
+        (stream->fin_requested && !stream->fin_sent))) ||
+        picoquic_stream_has_control_to_send(stream);
+}
+
+/* The ranks depend on the scheduler, the tree is rebuilt with the new ones */
+void picoquic_update_stream_scheduler(picoquic_cnx_t* cnx, picoquic_stream_scheduler_enum scheduler)
+{
+    picoquic_stream_head* stream = cnx->first_stream;
+
+    picosplay_empty_tree(&cnx->ready_stream_tree);
+    cnx->stream_scheduler = scheduler;
+    while (stream != NULL) {
+        if (scheduler == picoquic_stream_scheduler_weighted) {
+            stream->wfq_tag = cnx->wfq_virtual_time;
+        }
+        stream->ready_rank = picoquic_stream_ready_rank(cnx, stream);
+        if (picoquic_stream_has_frames_to_send(stream)) {
+            picoquic_insert_ready_stream(&cnx->ready_stream_tree, stream);
+        }
+        stream = stream->next_stream;
+    }
+}
+
+/* Whether the stream can be sent now. For the application streams, check_stream_id verifies that
+ * the stream fits under the max stream id limit. */
+static int picoquic_stream_can_send_now(picoquic_cnx_t* cnx, picoquic_stream_head* stream, int check_stream_id)
+{
+    return (cnx->maxdata_remote > cnx->data_sent || picoquic_stream_has_control_to_send(stream)) &&
+        (!check_stream_id || IS_CLIENT_STREAM_ID(stream->stream_id) != cnx->client_mode ||
+        stream->stream_id <= cnx->max_stream_id_bidir_remote);
+}
+
+/* Returns the stream of the node, or of the first node after it, that can be sent now, removing
+ * the streams that have nothing to send on the way. With a class stream, stops at the end of its
+ * ready rank. */
+static picoquic_stream_head* picoquic_next_sendable_stream(picoquic_cnx_t* cnx, picosplay_tree_t* ready_tree,
+    picosplay_node_t* node, picoquic_stream_head* class_stream, int check_stream_id)
+{
+    while (node != NULL) {
+        picoquic_stream_head* stream = (picoquic_stream_head*)picoquic_ready_stream_value(node);
+        picosplay_node_t* next = picosplay_next(node);
+
+        if (class_stream != NULL && stream->ready_rank != class_stream->ready_rank) {
             break;
         }
+        if (!picoquic_stream_has_frames_to_send(stream)) {
+            picosplay_delete_hint(ready_tree, node);
+        } else if (picoquic_stream_can_send_now(cnx, stream, check_stream_id)) {
+            return stream;
+        }
+        node = next;
     }
 
-    return (protoop_arg_t) stream;
+    return NULL;
+}
+
+/*
+ * Returns the first stream of the ready tree that can be sent now. If its rank is even, it is sent
+ * until it has nothing left or its rank changes. Otherwise, the streams of its rank are visited in
+ * round robin, starting after the last visited stream.
+ */
+static picoquic_stream_head* picoquic_next_ready_stream(picoquic_cnx_t* cnx, picosplay_tree_t* ready_tree,
+    uint64_t last_visited_stream_id, int check_stream_id)
+{
+    picoquic_stream_head* stream = picoquic_next_sendable_stream(cnx, ready_tree, picosplay_first(ready_tree), NULL, check_stream_id);
+
+    if (stream != NULL && (stream->ready_rank & 1) != 0 && stream->stream_id <= last_visited_stream_id) {
+        picoquic_stream_head key;
+        picosplay_node_t* previous;
+        picoquic_stream_head* next_stream;
+
+        key.ready_rank = stream->ready_rank;
+        key.stream_id = last_visited_stream_id;
+        previous = picosplay_find_previous(ready_tree, &key);
+        next_stream = picoquic_next_sendable_stream(cnx, ready_tree,
+            (previous == NULL) ? picosplay_first(ready_tree) : picosplay_next(previous), stream, check_stream_id);
+        if (next_stream != NULL) {
+            stream = next_stream;
+        }
+    }
+
+    return stream;
+}
+
+/**
+ * See PROTOOP_NOPARAM_FIND_READY_STREAM
+ */
+protoop_arg_t find_ready_stream(picoquic_cnx_t *cnx) {
+    return (protoop_arg_t) picoquic_next_ready_stream(cnx, &cnx->ready_stream_tree, cnx->last_visited_stream_id, 1);
 }
 
 typedef struct st_picoquic_stream_data_buffer_argument_t {
@@ -1082,47 +1522,7 @@ picoquic_stream_head* picoquic_schedule_next_stream(picoquic_cnx_t* cnx, size_t
  */
 protoop_arg_t find_ready_plugin_stream(picoquic_cnx_t *cnx)
 {
-    picoquic_stream_head *plugin_stream = NULL;
-
-    for (int nb_pass = 0; nb_pass < 2; nb_pass++) {
-        plugin_stream = cnx->first_plugin_stream;
-        if (nb_pass == 0) {
-            /* Skip to the first non visited stream */
-            while (plugin_stream && plugin_stream->stream_id <= cnx->last_visited_plugin_stream_id) {
-                plugin_stream = plugin_stream->next_stream;
-            }
-        }
-        while (plugin_stream) {
-            if ((cnx->maxdata_remote > cnx->data_sent && plugin_stream->sent_offset < plugin_stream->maxdata_remote &&
-                (plugin_stream->is_active ||
-                (plugin_stream->send_queue != NULL && plugin_stream->send_queue->length > plugin_stream->send_queue->offset) ||
-                (plugin_stream->fin_requested && !plugin_stream->fin_sent))) ||
-                    (plugin_stream->reset_requested && !plugin_stream->reset_sent) ||
-                (plugin_stream->stop_sending_requested && !plugin_stream->stop_sending_sent)) {
-                /* if the stream is not active yet, verify that it fits under
-                 * the max stream id limit */
-                /* Check parity */
-                break;
-            }
-
-            plugin_stream = plugin_stream->next_stream;
-
-            if (nb_pass > 0) {
-                /* Dont do the loop twice */
-                if (plugin_stream && plugin_stream->stream_id > cnx->last_visited_plugin_stream_id) {
-                    plugin_stream = NULL;
-                    break;
-                }
-            }
-        };
-
-        /* Do only one pass if we found a stream */
-        if (plugin_stream != NULL) {
-            break;
-        }
-    }
-
-    return (protoop_arg_t) plugin_stream;
+    return (protoop_arg_t) picoquic_next_ready_stream(cnx, &cnx->ready_plugin_stream_tree, cnx->last_visited_plugin_stream_id, 0);
 }
 
 picoquic_stream_head* picoquic_find_ready_plugin_stream(picoquic_cnx_t* cnx)
@@ -1300,12 +1700,13 @@ protoop_arg_t prepare_stream_frame(picoquic_cnx_t* cnx)
                     stream->send_queue->offset += length;
                     if (stream->send_queue->offset >= stream->send_queue->length) {
                         picoquic_stream_data* next = stream->send_queue->next_stream_data;
-                        free(stream->send_queue->bytes);
-                        free(stream->send_queue);
+                        picoquic_free_stream_data(cnx, stream->send_queue);
                         stream->send_queue = next;
                     }
 
                     stream->sent_offset += length;
+                    stream->send_buffered -= length;
+                    cnx->send_buffered -= length;
                     cnx->data_sent += length;
                 }
                 consumed = byte_index;
@@ -1330,6 +1731,7 @@ protoop_arg_t prepare_stream_frame(picoquic_cnx_t* cnx)
         if (ret == 0) {
             /* remember the last stream on which data is sent so each stream is visited in turn. */
             cnx->last_visited_stream_id = stream->stream_id;
+            picoquic_charge_stream_weight(cnx, stream, consumed);
         }
     }
 
@@ -1441,8 +1843,7 @@ protoop_arg_t prepare_plugin_frame(picoquic_cnx_t* cnx)
                 plugin_stream->send_queue->offset += length;
                 if (plugin_stream->send_queue->offset >= plugin_stream->send_queue->length) {
                     picoquic_stream_data* next = plugin_stream->send_queue->next_stream_data;
-                    free(plugin_stream->send_queue->bytes);
-                    free(plugin_stream->send_queue);
+                    picoquic_free_stream_data(cnx, plugin_stream->send_queue);
                     plugin_stream->send_queue = next;
                 }
 
@@ -1581,7 +1982,7 @@ protoop_arg_t process_crypto_hs_frame(picoquic_cnx_t* cnx)
 
     int new_data_available;  // Unused
 
-    if (picoquic_queue_network_input(cnx, &cnx->tls_stream[epoch], (size_t)frame->offset, frame->crypto_data_ptr, (size_t)frame->length, &new_data_available) != 0) {
+    if (picoquic_queue_network_input(cnx, &cnx->tls_stream[epoch], picoquic_memory_tls, (size_t)frame->offset, frame->crypto_data_ptr, (size_t)frame->length, &new_data_available) != 0) {
         return 1;  // Error signaled
     }
 
@@ -1610,7 +2011,7 @@ protoop_arg_t parse_handshake_done_frame(picoquic_cnx_t* cnx) {
  */
 protoop_arg_t process_handshake_done_frame(picoquic_cnx_t* cnx)
 {
-    uint64_t current_time = picoquic_current_time();
+    uint64_t current_time = picoquic_get_loop_time(cnx->quic);
     if (cnx->client_mode) {
         cnx->handshake_done = 1;
         for (int i = 0; i < cnx->nb_paths; i++) {
@@ -1618,6 +2019,7 @@ protoop_arg_t process_handshake_done_frame(picoquic_cnx_t* cnx)
             picoquic_implicit_handshake_ack(cnx, path, picoquic_packet_context_initial, current_time);
             picoquic_implicit_handshake_ack(cnx, path, picoquic_packet_context_handshake, current_time);
         }
+        picoquic_migrate_to_preferred_address(cnx, current_time);
     }
     return 0;
 }
@@ -1648,7 +2050,7 @@ protoop_arg_t decode_crypto_hs_frame(picoquic_cnx_t *cnx)
         picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, picoquic_frame_type_crypto_hs);
         bytes = NULL;
 
-    } else if (picoquic_queue_network_input(cnx, &cnx->tls_stream[epoch], (size_t)offset, bytes, (size_t)data_length, &new_data_available) != 0) {
+    } else if (picoquic_queue_network_input(cnx, &cnx->tls_stream[epoch], picoquic_memory_tls, (size_t)offset, bytes, (size_t)data_length, &new_data_available) != 0) {
         bytes = NULL;  // Error signaled
 
     } else {
@@ -1726,60 +2128,274 @@ protoop_arg_t prepare_crypto_hs_frame(picoquic_cnx_t *cnx)
                 byte_index += l_len;
             }
 
-            if (ret == 0 && length > 0) {
-                memcpy(&bytes[byte_index], stream->send_queue->bytes + stream->send_queue->offset, length);
-                byte_index += length;
+            if (ret == 0 && length > 0) {
+                memcpy(&bytes[byte_index], stream->send_queue->bytes + stream->send_queue->offset, length);
+                byte_index += length;
+
+                stream->send_queue->offset += length;
+                if (stream->send_queue->offset >= stream->send_queue->length) {
+                    picoquic_stream_data* next = stream->send_queue->next_stream_data;
+                    picoquic_free_stream_data(cnx, stream->send_queue);
+                    stream->send_queue = next;
+                }
+
+                stream->sent_offset += length;
+                consumed = byte_index;
+            } else if (ret == 0 && length == 0) {
+                /* No point in sending a silly packet */
+                consumed = 0;
+                ret = PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL;
+            }
+        }
+    }
+
+    protoop_save_outputs(cnx, consumed);
+
+    return (protoop_arg_t) ret;
+}
+
+int picoquic_prepare_crypto_hs_frame(picoquic_cnx_t* cnx, int epoch,
+    uint8_t* bytes, size_t bytes_max, size_t* consumed)
+{
+    protoop_arg_t outs[PROTOOPARGS_MAX];
+    int ret = (int) protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PREPARE_CRYPTO_HS_FRAME, outs,
+        epoch, bytes, bytes_max);
+    *consumed = (size_t) outs[0];
+    return ret;
+}
+
+protoop_arg_t prepare_handshake_done_frame(picoquic_cnx_t* cnx) {
+    uint8_t *bytes = (uint8_t *) cnx->protoop_inputv[0];
+    size_t bytes_max = (size_t) cnx->protoop_inputv[1];
+    size_t consumed = 0;
+
+    if (bytes_max > 0) {
+        *bytes = picoquic_frame_type_handshake_done;
+        consumed++;
+    }
+
+    protoop_save_outputs(cnx, consumed);
+    return 0;
+}
+
+int picoquic_prepare_handshake_done_frame(picoquic_cnx_t* cnx, uint8_t* bytes, size_t bytes_max, size_t* consumed) {
+    protoop_arg_t outs[PROTOOPARGS_MAX];
+    int ret = (int) protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PREPARE_HANDSHAKE_DONE_FRAME, outs, bytes, bytes_max);
+    *consumed = (size_t) outs[0];
+    return ret;
+}
+
+/*
+ * ACK frequency, draft-ietf-quic-ack-frequency
+ */
+
+/**
+ * See PROTOOP_PARAM_PARSE_FRAME
+ */
+protoop_arg_t parse_ack_frequency_frame(picoquic_cnx_t* cnx)
+{
+    uint8_t* bytes = (uint8_t *) cnx->protoop_inputv[0];
+    const uint8_t* bytes_max = (const uint8_t *) cnx->protoop_inputv[1];
+
+    int ack_needed = 1;
+    int is_retransmittable = 1;
+    ack_frequency_frame_t *frame = malloc(sizeof(ack_frequency_frame_t));
+    if (!frame) {
+        printf("Failed to allocate memory for ack_frequency_frame_t\n");
+        protoop_save_outputs(cnx, frame, ack_needed, is_retransmittable);
+        return (protoop_arg_t) NULL;
+    }
+
+    if ((bytes = picoquic_frames_varint_decode(bytes + picoquic_varint_skip(bytes), bytes_max, &frame->sequence_number)) == NULL ||
+        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &frame->packet_tolerance)) == NULL ||
+        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &frame->update_max_ack_delay)) == NULL ||
+        (bytes = picoquic_frames_uint8_decode(bytes, bytes_max, &frame->ignore_order)) == NULL ||
+        frame->packet_tolerance == 0 || frame->ignore_order > 1)
+    {
+        picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, picoquic_frame_type_ack_frequency);
+        free(frame);
+        frame = NULL;
+        bytes = NULL;
+    }
+
+    protoop_save_outputs(cnx, frame, ack_needed, is_retransmittable);
+    return (protoop_arg_t) bytes;
+}
+
+/**
+ * See PROTOOP_PARAM_PROCESS_FRAME
+ */
+protoop_arg_t process_ack_frequency_frame(picoquic_cnx_t* cnx)
+{
+    ack_frequency_frame_t* frame = (ack_frequency_frame_t *) cnx->protoop_inputv[0];
+
+    if (cnx->local_parameters.min_ack_delay == 0 || frame->update_max_ack_delay < cnx->local_parameters.min_ack_delay) {
+        picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, picoquic_frame_type_ack_frequency);
+        return 1;
+    }
+
+    /* Frames arriving out of order are obsolete */
+    if (frame->sequence_number >= cnx->ack_frequency_sequence_remote) {
+        cnx->ack_frequency_sequence_remote = frame->sequence_number + 1;
+        cnx->ack_gap_remote = frame->packet_tolerance;
+        cnx->ack_delay_remote = frame->update_max_ack_delay;
+        cnx->ack_ignore_order_remote = frame->ignore_order;
+        for (int i = 0; i < cnx->nb_paths; i++) {
+            cnx->path[i]->pkt_ctx[picoquic_packet_context_application].ack_delay_local = frame->update_max_ack_delay;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * See PROTOOP_PARAM_PARSE_FRAME
+ */
+protoop_arg_t parse_immediate_ack_frame(picoquic_cnx_t* cnx)
+{
+    uint8_t* bytes = (uint8_t *) cnx->protoop_inputv[0];
+
+    int ack_needed = 1;
+    int is_retransmittable = 1;
+    immediate_ack_frame_t *frame = malloc(sizeof(immediate_ack_frame_t));
+    if (!frame) {
+        printf("Failed to allocate memory for immediate_ack_frame_t\n");
+        protoop_save_outputs(cnx, frame, ack_needed, is_retransmittable);
+        return (protoop_arg_t) NULL;
+    }
+
+    protoop_save_outputs(cnx, frame, ack_needed, is_retransmittable);
+    return (protoop_arg_t) bytes + picoquic_varint_skip(bytes);
+}
+
+/**
+ * See PROTOOP_PARAM_PROCESS_FRAME
+ */
+protoop_arg_t process_immediate_ack_frame(picoquic_cnx_t* cnx)
+{
+    int epoch = (int) cnx->protoop_inputv[2];
+    picoquic_path_t* path_x = (picoquic_path_t*) cnx->protoop_inputv[3];
+
+    path_x->pkt_ctx[picoquic_context_from_epoch(epoch)].ack_immediate = 1;
+    return 0;
+}
+
+/*
+ * Unless the application set them, four ACKs are requested per congestion window,
+ * and the delay follows the RTT as for the local ACKs.
+ */
+void picoquic_compute_ack_frequency(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t* ack_gap, uint64_t* ack_delay)
+{
+    uint64_t gap = cnx->ack_gap_requested;
+    uint64_t delay = cnx->ack_delay_requested;
+
+    if (gap == 0) {
+        gap = path_x->cwin / (4 * (uint64_t) path_x->send_mtu);
+        if (cnx->quic->overload_level >= picoquic_overload_shed) {
+            /* Fewer ACKs to process while the loop falls behind */
+            gap *= PICOQUIC_ACK_GAP_OVERLOAD_FACTOR;
+        }
+        if (gap < PICOQUIC_ACK_GAP_DEFAULT) {
+            gap = PICOQUIC_ACK_GAP_DEFAULT;
+        } else if (gap > PICOQUIC_ACK_GAP_MAX) {
+            gap = PICOQUIC_ACK_GAP_MAX;
+        }
+    }
+
+    if (delay == 0) {
+        delay = ((path_x->rtt_min > 0) ? path_x->rtt_min : path_x->smoothed_rtt) / 4;
+        if (delay > PICOQUIC_ACK_DELAY_MAX) {
+            delay = PICOQUIC_ACK_DELAY_MAX;
+        }
+    }
+
+    if (delay < cnx->remote_parameters.min_ack_delay) {
+        delay = cnx->remote_parameters.min_ack_delay;
+    }
+
+    *ack_gap = gap;
+    *ack_delay = delay;
+}
+
+/* The values following the congestion window are only updated when they doubled or halved */
+static int picoquic_ack_frequency_changed(uint64_t value, uint64_t sent, int exact)
+{
+    return exact ? value != sent : (value >= 2 * sent || 2 * value <= sent);
+}
 
-                stream->send_queue->offset += length;
-                if (stream->send_queue->offset >= stream->send_queue->length) {
-                    picoquic_stream_data* next = stream->send_queue->next_stream_data;
-                    free(stream->send_queue->bytes);
-                    free(stream->send_queue);
-                    stream->send_queue = next;
-                }
+/**
+ * See PROTOOP_NOPARAM_PREPARE_ACK_FREQUENCY_FRAME
+ */
+protoop_arg_t prepare_ack_frequency_frame(picoquic_cnx_t* cnx)
+{
+    picoquic_path_t* path_x = (picoquic_path_t *) cnx->protoop_inputv[0];
+    uint8_t *bytes = (uint8_t *) cnx->protoop_inputv[1];
+    size_t bytes_max = (size_t) cnx->protoop_inputv[2];
+    size_t consumed = 0;
+    uint64_t ack_gap;
+    uint64_t ack_delay;
 
-                stream->sent_offset += length;
+    if (cnx->remote_parameters.min_ack_delay > 0) {
+        picoquic_compute_ack_frequency(cnx, path_x, &ack_gap, &ack_delay);
+
+        if (cnx->ack_frequency_sequence_local == 0 ||
+            picoquic_ack_frequency_changed(ack_gap, cnx->ack_gap_sent, cnx->ack_gap_requested != 0) ||
+            picoquic_ack_frequency_changed(ack_delay, cnx->ack_delay_sent, cnx->ack_delay_requested != 0)) {
+            size_t byte_index = 0;
+            size_t l_type = picoquic_varint_encode(bytes, bytes_max, picoquic_frame_type_ack_frequency);
+            size_t l_seq = (l_type == 0) ? 0 : picoquic_varint_encode(bytes + l_type, bytes_max - l_type,
+                cnx->ack_frequency_sequence_local);
+            byte_index = l_type + l_seq;
+            size_t l_gap = (l_seq == 0) ? 0 : picoquic_varint_encode(bytes + byte_index, bytes_max - byte_index, ack_gap);
+            byte_index += l_gap;
+            size_t l_delay = (l_gap == 0) ? 0 : picoquic_varint_encode(bytes + byte_index, bytes_max - byte_index, ack_delay);
+            byte_index += l_delay;
+
+            /* If there is no room left, the frame is sent in a later packet */
+            if (l_delay > 0 && byte_index < bytes_max) {
+                bytes[byte_index++] = 0; /* Do not ignore order */
                 consumed = byte_index;
-            } else if (ret == 0 && length == 0) {
-                /* No point in sending a silly packet */
-                consumed = 0;
-                ret = PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL;
+                cnx->ack_frequency_sequence_local++;
+                cnx->ack_gap_sent = ack_gap;
+                cnx->ack_delay_sent = ack_delay;
             }
         }
     }
 
     protoop_save_outputs(cnx, consumed);
-
-    return (protoop_arg_t) ret;
+    return 0;
 }
 
-int picoquic_prepare_crypto_hs_frame(picoquic_cnx_t* cnx, int epoch,
+int picoquic_prepare_ack_frequency_frame(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
     uint8_t* bytes, size_t bytes_max, size_t* consumed)
 {
     protoop_arg_t outs[PROTOOPARGS_MAX];
-    int ret = (int) protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PREPARE_CRYPTO_HS_FRAME, outs,
-        epoch, bytes, bytes_max);
+    int ret = (int) protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PREPARE_ACK_FREQUENCY_FRAME, outs, path_x, bytes, bytes_max);
     *consumed = (size_t) outs[0];
     return ret;
 }
 
-protoop_arg_t prepare_handshake_done_frame(picoquic_cnx_t* cnx) {
+/**
+ * See PROTOOP_NOPARAM_PREPARE_IMMEDIATE_ACK_FRAME
+ */
+protoop_arg_t prepare_immediate_ack_frame(picoquic_cnx_t* cnx)
+{
     uint8_t *bytes = (uint8_t *) cnx->protoop_inputv[0];
     size_t bytes_max = (size_t) cnx->protoop_inputv[1];
-    size_t consumed = 0;
+    size_t consumed = picoquic_varint_encode(bytes, bytes_max, picoquic_frame_type_immediate_ack);
 
-    if (bytes_max > 0) {
-        *bytes = picoquic_frame_type_handshake_done;
-        consumed++;
+    if (consumed > 0) {
+        cnx->immediate_ack_requested = 0;
     }
 
     protoop_save_outputs(cnx, consumed);
     return 0;
 }
 
-int picoquic_prepare_handshake_done_frame(picoquic_cnx_t* cnx, uint8_t* bytes, size_t bytes_max, size_t* consumed) {
+int picoquic_prepare_immediate_ack_frame(picoquic_cnx_t* cnx, uint8_t* bytes, size_t bytes_max, size_t* consumed)
+{
     protoop_arg_t outs[PROTOOPARGS_MAX];
-    int ret = (int) protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PREPARE_HANDSHAKE_DONE_FRAME, outs, bytes, bytes_max);
+    int ret = (int) protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PREPARE_IMMEDIATE_ACK_FRAME, outs, bytes, bytes_max);
     *consumed = (size_t) outs[0];
     return ret;
 }
@@ -1851,13 +2467,9 @@ protoop_arg_t check_spurious_retransmission(picoquic_cnx_t *cnx)
             picoquic_path_t * old_path = p->send_path;
 
             if (old_path != NULL) {
-                if (p->length + p->checksum_overhead > old_path->send_mtu) {
-                    old_path->send_mtu = (uint32_t)(p->length + p->checksum_overhead);
-                    if (old_path->send_mtu > old_path->send_mtu_max_tried) {
-                        old_path->send_mtu_max_tried = old_path->send_mtu;
-                    }
-                    old_path->mtu_probe_sent = 0;
-                }
+                picoquic_mtu_packet_acked(cnx, old_path, p, current_time);
+
+                old_path->counters.packets_spurious++;
 
                 if (max_spurious_rtt > old_path->max_spurious_rtt) {
                     old_path->max_spurious_rtt = max_spurious_rtt;
@@ -1871,6 +2483,11 @@ protoop_arg_t check_spurious_retransmission(picoquic_cnx_t *cnx)
                     old_path->max_reorder_gap = max_reorder_gap;
                 }
 
+                /* The packet was only late, widen the reordering window of the path */
+                if (old_path->reorder_window_mult < PICOQUIC_REORDER_WINDOW_MULT_MAX) {
+                    old_path->reorder_window_mult++;
+                }
+
                 if (cnx->congestion_alg != NULL ) {
                     picoquic_congestion_algorithm_notify_func(cnx, old_path, picoquic_congestion_notification_spurious_repeat,
                         0, 0, p->sequence_number, current_time);
@@ -1907,6 +2524,11 @@ protoop_arg_t update_ack_delay(picoquic_cnx_t* cnx) {
     picoquic_path_t* old_path = (picoquic_path_t *) cnx->protoop_inputv[1];
     /* int64_t rtt_estimate = (int64_t) cnx->protoop_inputv[2]; */ // Unused
     bool first_estimate = (bool) cnx->protoop_inputv[3];
+    if (cnx->ack_delay_remote > 0 && pkt_ctx == &old_path->pkt_ctx[picoquic_packet_context_application]) {
+        /* The peer chose the delay with an ACK_FREQUENCY frame */
+        pkt_ctx->ack_delay_local = cnx->ack_delay_remote;
+        return 0;
+    }
     pkt_ctx->ack_delay_local = old_path->rtt_min / 4;
     if (pkt_ctx->ack_delay_local < 1000) {
         pkt_ctx->ack_delay_local = 1000;
@@ -1930,47 +2552,29 @@ protoop_arg_t estimate_path_bandwidth(picoquic_cnx_t *cnx)
     uint64_t delivery_time = cnx->protoop_inputv[5];
     uint64_t current_time = cnx->protoop_inputv[6];
     int rs_is_path_limited = cnx->protoop_inputv[7];
+    picoquic_rate_sample_t* rs = &path_x->rate_sample;
 
     if (send_time >= path_x->delivered_sent_last) {
         if (path_x->delivered_time_last == 0) {
             /* No estimate yet, need to initialize the variables */
-            path_x->delivered_last = current_time;
-            path_x->delivered_time_last = path_x->delivered;
+            path_x->delivered_last = path_x->delivered;
+            path_x->delivered_time_last = current_time;
             path_x->delivered_sent_last = send_time;
         }
-        else {
-            uint64_t receive_interval = delivery_time - delivered_time_prior;
-
-            if (receive_interval > PICOQUIC_BANDWIDTH_TIME_INTERVAL_MIN) {
-                uint64_t delivered = path_x->delivered - delivered_prior;
-                uint64_t send_interval = send_time - delivered_sent_prior;
-                uint64_t bw_estimate;
-
-                if (send_interval > receive_interval) {
-                    receive_interval = send_interval;
-                }
-
-                if (receive_interval == 0) {
-                    bw_estimate = PICOQUIC_BANDWIDTH_ESTIMATE_MAX;
-                }
-                else {
-                    bw_estimate = delivered * 1000000;
-                    bw_estimate /= receive_interval;
-                }
-
-                if (!rs_is_path_limited || bw_estimate > path_x->bandwidth_estimate) {
-                    path_x->bandwidth_estimate = bw_estimate;
-                }
+        else if (picoquic_delivery_rate_sample(path_x, send_time, delivered_prior, delivered_time_prior,
+            delivered_sent_prior, rs_is_path_limited, delivery_time, rs)) {
+            if (!rs->is_app_limited || rs->delivery_rate > path_x->bandwidth_estimate) {
+                path_x->bandwidth_estimate = rs->delivery_rate;
+            }
 
-                /* Bandwidth was estimated, update the references */
-                path_x->delivered_last = path_x->delivered;
-                path_x->delivered_time_last = delivery_time;
-                path_x->delivered_sent_last = send_time;
-                path_x->delivered_last_packet = delivered_prior;
-                path_x->last_bw_estimate_path_limited = rs_is_path_limited;
-                if (path_x->delivered > path_x->delivered_limited_index) {
-                    path_x->delivered_limited_index = 0;
-                }
+            /* Bandwidth was estimated, update the references */
+            path_x->delivered_last = path_x->delivered;
+            path_x->delivered_time_last = delivery_time;
+            path_x->delivered_sent_last = send_time;
+            path_x->delivered_last_packet = delivered_prior;
+            path_x->last_bw_estimate_path_limited = rs_is_path_limited;
+            if (path_x->delivered > path_x->delivered_limited_index) {
+                path_x->delivered_limited_index = 0;
             }
         }
     }
@@ -2001,7 +2605,7 @@ protoop_arg_t update_rtt(picoquic_cnx_t *cnx)
     picoquic_packet_t* packet = pkt_ctx->retransmit_newest;
 
     /* Check whether this is a new acknowledgement */
-    if (largest > pkt_ctx->highest_acknowledged || pkt_ctx->first_sack_item.start_of_sack_range == (uint64_t)((int64_t)-1) ||
+    if (largest > pkt_ctx->highest_acknowledged || pkt_ctx->sack_list.nb_ranges == 0 ||
         pkt_ctx->highest_acknowledged == (uint64_t)((int64_t)-1)) { /* This last condition is for Multipath ! */
         pkt_ctx->highest_acknowledged = largest;
         is_new_ack = 1;
@@ -2010,9 +2614,7 @@ protoop_arg_t update_rtt(picoquic_cnx_t *cnx)
             /* if the ACK is reasonably recent, use it to update the RTT */
             /* find the stored copy of the largest acknowledged packet */
 
-            while (packet != NULL && packet->sequence_number > largest) {
-                packet = packet->next_packet;
-            }
+            packet = picoquic_retransmit_index_floor(pkt_ctx, packet, largest);
 
             if (packet == NULL || packet->sequence_number < largest) {
                 /* There is no copy of this packet in store. It may have
@@ -2065,6 +2667,7 @@ protoop_arg_t update_rtt(picoquic_cnx_t *cnx)
                         old_path->retransmit_timer = old_path->smoothed_rtt + 4 * old_path->rtt_variant + old_path->max_ack_delay;
                     }
                     old_path->rtt_sample = rtt_estimate;
+                    picoquic_path_record_rtt(old_path, (uint64_t)rtt_estimate);
 
                     if (PICOQUIC_MIN_RETRANSMIT_TIMER > old_path->retransmit_timer) {
                         old_path->retransmit_timer = PICOQUIC_MIN_RETRANSMIT_TIMER;
@@ -2093,6 +2696,8 @@ static picoquic_packet_t* picoquic_update_rtt(picoquic_cnx_t* cnx, uint64_t larg
     if (is_new_ack) {
         *is_new_ack = outs[0];
     }
+    PICOQUIC_TRACE5(update_rtt, picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx)), path_x,
+        path_x->rtt_sample, path_x->smoothed_rtt, path_x->rtt_variant);
     return p;
 }
 
@@ -2101,48 +2706,25 @@ static picoquic_packet_t* picoquic_update_rtt(picoquic_cnx_t* cnx, uint64_t larg
  */
 static protoop_arg_t process_ack_of_ack_range(picoquic_cnx_t * cnx)
 {
-    picoquic_sack_item_t* first_sack = (picoquic_sack_item_t*) cnx->protoop_inputv[0];
+    picoquic_sack_list_t* sacks = (picoquic_sack_list_t*) cnx->protoop_inputv[0];
     uint64_t start_of_range = (uint64_t) cnx->protoop_inputv[1];
     uint64_t end_of_range = (uint64_t) cnx->protoop_inputv[2];
 
-    if (first_sack->start_of_sack_range == start_of_range) {
-        if (end_of_range < first_sack->end_of_sack_range) {
-            first_sack->start_of_sack_range = end_of_range + 1;
-        } else {
-            first_sack->start_of_sack_range = first_sack->end_of_sack_range;
-        }
-    } else {
-        picoquic_sack_item_t* previous = first_sack;
-        picoquic_sack_item_t* next = previous->next_sack;
-
-        while (next != NULL) {
-            if (next->end_of_sack_range == end_of_range && next->start_of_sack_range == start_of_range) {
-                /* Matching range should be removed */
-                previous->next_sack = next->next_sack;
-                free(next);
-                break;
-            } else if (next->end_of_sack_range > end_of_range) {
-                previous = next;
-                next = next->next_sack;
-            } else {
-                break;
-            }
-        }
-    }
+    picoquic_sack_list_ack_of_ack(sacks, start_of_range, end_of_range);
 
     return 0;
 }
 
-static void picoquic_process_ack_of_ack_range(picoquic_cnx_t * cnx, picoquic_sack_item_t* first_sack,
+static void picoquic_process_ack_of_ack_range(picoquic_cnx_t * cnx, picoquic_sack_list_t* sacks,
     uint64_t start_of_range, uint64_t end_of_range)
 {
     protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PROCESS_ACK_OF_ACK_RANGE, NULL,
-        first_sack, start_of_range, end_of_range);
+        sacks, start_of_range, end_of_range);
 }
 
 int picoquic_process_ack_of_ack_frame(
     picoquic_cnx_t* cnx,
-    picoquic_sack_item_t* first_sack,
+    picoquic_sack_list_t* sacks,
     uint8_t* bytes, size_t bytes_max, size_t* consumed, int is_ecn)
 {
     int ret;
@@ -2151,14 +2733,6 @@ int picoquic_process_ack_of_ack_frame(
     uint64_t num_block;
     uint64_t ecnx3[3];
 
-    /* Find the oldest ACK range, in order to calibrate the
-     * extension of the largest number to 64 bits */
-
-    picoquic_sack_item_t* target_sack = first_sack;
-    while (target_sack->next_sack != NULL) {
-        target_sack = target_sack->next_sack;
-    }
-
     ret = picoquic_parse_ack_header(bytes, bytes_max,
         &num_block, &largest, &ack_delay, consumed, 0);
 
@@ -2194,7 +2768,7 @@ int picoquic_process_ack_of_ack_frame(
             }
 
             if (range > 0) {
-                picoquic_process_ack_of_ack_range(cnx, first_sack, largest + 1 - range, largest);
+                picoquic_process_ack_of_ack_range(cnx, sacks, largest + 1 - range, largest);
             }
 
             if (num_block-- == 0)
@@ -2278,7 +2852,7 @@ protoop_arg_t check_stream_frame_already_acked(picoquic_cnx_t *cnx)
                     no_need_to_repeat = 1;
                 } else {
                     /* Check whether the ack was already received */
-                    no_need_to_repeat = picoquic_check_sack_list(&stream->first_sack_item, offset, offset + data_length);
+                    no_need_to_repeat = picoquic_check_sack_list(&stream->sack_list, offset, offset + data_length);
                 }
             }
         }
@@ -2324,7 +2898,7 @@ protoop_arg_t process_ack_of_stream_frame(picoquic_cnx_t* cnx)
         /* record the ack range for the stream */
         stream = picoquic_find_stream(cnx, stream_id, 0);
         if (stream != NULL) {
-            (void)picoquic_update_sack_list(cnx, &stream->first_sack_item,
+            (void)picoquic_update_sack_list(cnx, &stream->sack_list,
                 offset, offset + data_length - 1);
         }
     }
@@ -2360,15 +2934,30 @@ protoop_arg_t process_possible_ack_of_ack_frame(picoquic_cnx_t* cnx)
         cnx->nb_zero_rtt_acked++;
     }
 
+    if (p->has_frame_summary) {
+        /* Only the ACK and STREAM frames matter, the others are not parsed again */
+        for (int i = 0; ret == 0 && i < p->nb_frame_summaries; i++) {
+            picoquic_frame_summary_t* fs = &p->frame_summary[i];
+
+            if (fs->type == picoquic_frame_type_ack || fs->type == picoquic_frame_type_ack_ecn) {
+                ret = picoquic_process_ack_of_ack_frame(cnx, &p->send_path->pkt_ctx[p->pc].sack_list,
+                    &p->bytes[fs->offset], p->length - fs->offset, &frame_length, fs->type == picoquic_frame_type_ack_ecn);
+            } else if (PICOQUIC_IN_RANGE(fs->type, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
+                ret = picoquic_process_ack_of_stream_frame(cnx, &p->bytes[fs->offset], p->length - fs->offset, &frame_length);
+            }
+        }
+        return 0;
+    }
+
     byte_index = p->offset;
 
     while (ret == 0 && byte_index < p->length) {
         if (p->bytes[byte_index] == picoquic_frame_type_ack) {
-            ret = picoquic_process_ack_of_ack_frame(cnx, &p->send_path->pkt_ctx[p->pc].first_sack_item,
+            ret = picoquic_process_ack_of_ack_frame(cnx, &p->send_path->pkt_ctx[p->pc].sack_list,
                 &p->bytes[byte_index], p->length - byte_index, &frame_length, 0);
             byte_index += frame_length;
         } else if (p->bytes[byte_index] == picoquic_frame_type_ack_ecn) {
-            ret = picoquic_process_ack_of_ack_frame(cnx, &p->send_path->pkt_ctx[p->pc].first_sack_item,
+            ret = picoquic_process_ack_of_ack_frame(cnx, &p->send_path->pkt_ctx[p->pc].sack_list,
                 &p->bytes[byte_index], p->length - byte_index, &frame_length, 1);
             byte_index += frame_length;
         } else if (PICOQUIC_IN_RANGE(p->bytes[byte_index], picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
@@ -2406,41 +2995,40 @@ protoop_arg_t process_ack_range(picoquic_cnx_t *cnx)
     /* Compare the range to the retransmit queue */
     while (p != NULL && range > 0) {
         if (p->sequence_number > highest) {
-            p = p->next_packet;
+            p = picoquic_retransmit_index_floor(&p->send_path->pkt_ctx[pc], p, highest);
+        } else if (p->sequence_number < highest) {
+            /* Nothing left to acknowledge until p */
+            uint64_t gap = highest - p->sequence_number;
+            if (gap > range) {
+                gap = range;
+            }
+            range -= gap;
+            highest -= gap;
         } else {
-            if (p->sequence_number == highest) {
-                /* TODO: RTT Estimate */
-                picoquic_packet_t* next = p->next_packet;
-                picoquic_path_t * old_path = p->send_path;
-
-                old_path->delivered += p->length;
-                if (cnx->congestion_alg != NULL) {
-                    picoquic_congestion_algorithm_notify_func(cnx, old_path,
-                        picoquic_congestion_notification_acknowledgement,
-                        0, p->length, 0, current_time);
-                }
+            /* TODO: RTT Estimate */
+            picoquic_packet_t* next = p->next_packet;
+            picoquic_path_t * old_path = p->send_path;
 
-                /* If the packet contained an ACK frame, perform the ACK of ACK pruning logic */
-                picoquic_process_possible_ack_of_ack_frame(cnx, p);
+            /* Delivered and notified once the whole frame is processed, see picoquic_process_path_ack_ranges */
+            old_path->ack_batch_bytes += p->length;
+            old_path->ack_batch_packets++;
 
-                /* If packet is larger than the current MTU, update the MTU */
-                if ((p->length + p->checksum_overhead) > old_path->send_mtu) {
-                    old_path->send_mtu = (uint32_t)(p->length + p->checksum_overhead);
-                    old_path->mtu_probe_sent = 0;
-                }
+            /* If the packet contained an ACK frame, perform the ACK of ACK pruning logic */
+            picoquic_process_possible_ack_of_ack_frame(cnx, p);
 
-                /* Any acknowledgement shows progress */
-                p->send_path->pkt_ctx[pc].nb_retransmit = 0;
-                p->send_path->pkt_ctx[pc].latest_progress_time = current_time;
+            picoquic_mtu_packet_acked(cnx, old_path, p, current_time);
 
-                if (p->has_handshake_done) {
-                    cnx->handshake_done_acked = 1;
-                }
+            /* Any acknowledgement shows progress */
+            p->send_path->pkt_ctx[pc].nb_retransmit = 0;
+            p->send_path->pkt_ctx[pc].latest_progress_time = current_time;
 
-                picoquic_dequeue_retransmit_packet(cnx, p, 1);
-                p = next;
+            if (p->has_handshake_done) {
+                cnx->handshake_done_acked = 1;
             }
 
+            picoquic_dequeue_retransmit_packet(cnx, p, 1);
+            p = next;
+
             range--;
             highest--;
         }
@@ -2464,6 +3052,101 @@ static int picoquic_process_ack_range(
     return ret;
 }
 
+/*
+ * The congestion control learns of the packets acknowledged by a frame at once. The packet count goes
+ * in the lost_packet_number argument of the acknowledgement notification.
+ */
+static void picoquic_notify_ack_batches(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    for (int i = 0; i < cnx->nb_paths; i++) {
+        picoquic_path_t* path_x = cnx->path[i];
+
+        if (path_x->ack_batch_packets > 0) {
+            path_x->delivered += path_x->ack_batch_bytes;
+            if (cnx->congestion_alg != NULL) {
+                picoquic_congestion_algorithm_notify_func(cnx, path_x,
+                    picoquic_congestion_notification_acknowledgement,
+                    0, path_x->ack_batch_bytes, path_x->ack_batch_packets, current_time);
+            }
+            path_x->ack_batch_bytes = 0;
+            path_x->ack_batch_packets = 0;
+        }
+    }
+}
+
+static int picoquic_process_path_ack_blocks(picoquic_cnx_t* cnx, picoquic_path_ack_t* path_ack,
+    ack_frame_t* frame, picoquic_packet_t** ptop_packet)
+{
+    picoquic_path_t* path_x = path_ack->path_x;
+    picoquic_packet_context_enum pc = path_ack->pc;
+    uint64_t current_time = path_ack->current_time;
+    uint8_t first_byte = path_ack->frame_type;
+    uint64_t range = frame->first_ack_block;
+    uint64_t block_to_block;
+
+    range ++;
+
+    if (frame->largest_acknowledged + 1 < range) {
+        DBG_PRINTF("ack range error: largest=%" PRIx64 ", range=%" PRIx64, frame->largest_acknowledged, range);
+        picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, first_byte);
+        return 1;
+    }
+
+    if (picoquic_process_ack_range(cnx, pc, frame->largest_acknowledged, range, ptop_packet, current_time) != 0) {
+        return 1;
+    }
+
+    if (range > 0) {
+        picoquic_check_spurious_retransmission(cnx, frame->largest_acknowledged + 1 - range, frame->largest_acknowledged, current_time, pc, path_x);
+    }
+
+    uint64_t largest = frame->largest_acknowledged;
+
+    for (int i = 0; i < frame->ack_block_count; i++) {
+        /* Skip the gap */
+        block_to_block = frame->ack_blocks[i].gap;
+
+        block_to_block += 1; /* add 1, since zero is ruled out by varint, see spec. */
+        block_to_block += range;
+
+        if (largest < block_to_block) {
+            DBG_PRINTF("ack gap error: largest=%" PRIx64 ", range=%" PRIx64 ", gap=%" PRIu64,
+                largest, range, block_to_block - range);
+            picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, first_byte);
+            return 1;
+        }
+
+        largest -= block_to_block;
+        range = frame->ack_blocks[i].additional_ack_block;
+        range ++;
+        if (largest + 1 < range) {
+            DBG_PRINTF("ack range error: largest=%" PRIx64 ", range=%" PRIx64, largest, range);
+            picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, first_byte);
+            return 1;
+        }
+
+        if (picoquic_process_ack_range(cnx, pc, largest, range, ptop_packet, current_time) != 0) {
+            return 1;
+        }
+
+        if (range > 0) {
+            picoquic_check_spurious_retransmission(cnx, largest + 1 - range, largest, current_time, pc, path_x);
+        }
+    }
+
+    return 0;
+}
+
+int picoquic_process_path_ack_ranges(picoquic_cnx_t* cnx, picoquic_path_ack_t* path_ack,
+    ack_frame_t* frame, picoquic_packet_t** ptop_packet)
+{
+    int ret = picoquic_process_path_ack_blocks(cnx, path_ack, frame, ptop_packet);
+
+    picoquic_notify_ack_batches(cnx, path_ack->current_time);
+
+    return ret;
+}
+
 protoop_arg_t parse_ack_frame_maybe_ecn(picoquic_cnx_t* cnx)
 {
     uint8_t* bytes = (uint8_t *) cnx->protoop_inputv[0];
@@ -2522,10 +3205,13 @@ protoop_arg_t parse_ack_frame_maybe_ecn(picoquic_cnx_t* cnx)
         return (protoop_arg_t) NULL;
     }
 
-    for (int i = 0; i < frame->ack_block_count; i++) {
-        if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &frame->ack_blocks[i].gap)) == NULL ||
-            (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &frame->ack_blocks[i].additional_ack_block)) == NULL)
-        {
+    if (frame->ack_block_count > 0) {
+        /* The gap and range pairs are decoded in one pass */
+        uint64_t blocks[2 * 63];
+        size_t nb_values = 2 * (size_t) frame->ack_block_count;
+        size_t consumed = picoquic_varint_decode_n(bytes, bytes_max - bytes, blocks, nb_values);
+
+        if (consumed == 0) {
             picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR,
                 frame->is_ack_ecn ? picoquic_frame_type_ack_ecn : picoquic_frame_type_ack);
             free(frame);
@@ -2533,10 +3219,25 @@ protoop_arg_t parse_ack_frame_maybe_ecn(picoquic_cnx_t* cnx)
             protoop_save_outputs(cnx, frame, ack_needed, is_retransmittable);
             return (protoop_arg_t) NULL;
         }
+        bytes += consumed;
+
+        for (int i = 0; i < frame->ack_block_count; i++) {
+            frame->ack_blocks[i].gap = blocks[2 * i];
+            frame->ack_blocks[i].additional_ack_block = blocks[2 * i + 1];
+        }
     }
 
     if (frame->is_ack_ecn) {
-        bytes = picoquic_parse_ecn_block(cnx, bytes, bytes_max, &frame->ecn_block);
+        /* The core validates the counts, the plugins replacing the parsing of the block give their own one */
+        frame->ecn_block = NULL;
+        if (picoquic_varint_decode_n(bytes, bytes_max - bytes, frame->ecnx3, 3) == 0) {
+            bytes = NULL;
+        } else {
+            bytes = picoquic_parse_ecn_block(cnx, bytes, bytes_max, &frame->ecn_block);
+            if (frame->ecn_block == NULL) {
+                frame->ecn_block = frame->ecnx3;
+            }
+        }
         if (bytes == NULL) {
             picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR,
                                       frame->is_ack_ecn ? picoquic_frame_type_ack_ecn : picoquic_frame_type_ack);
@@ -2573,13 +3274,15 @@ protoop_arg_t process_ack_frame_maybe_ecn(picoquic_cnx_t* cnx)
         picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION, first_byte);
         return 1;
     } else {
+        path_x->counters.ack_frames_received++;
         if (frame->is_ack_ecn) {
             picoquic_process_ecn_block(cnx, frame->ecn_block, &path_x->pkt_ctx[pc], path_x);
         }
 
-        /* Attempt to update the RTT */
+        /* Attempt to update the RTT, from the arrival of the datagram in the kernel when it is known */
         int is_new_ack = 0;
-        picoquic_packet_t* top_packet = picoquic_update_rtt(cnx, frame->largest_acknowledged, current_time, frame->ack_delay, pc, path_x, &is_new_ack);
+        uint64_t rtt_time = (cnx->quic->rcv_time != 0 && cnx->quic->rcv_time < current_time) ? cnx->quic->rcv_time : current_time;
+        picoquic_packet_t* top_packet = picoquic_update_rtt(cnx, frame->largest_acknowledged, rtt_time, frame->ack_delay, pc, path_x, &is_new_ack);
         uint64_t largest_sent_time = 0;
         uint64_t delivered_prior = 0;
         uint64_t delivered_time_prior = 0;
@@ -2587,6 +3290,11 @@ protoop_arg_t process_ack_frame_maybe_ecn(picoquic_cnx_t* cnx)
         picoquic_path_t* old_path = NULL;
         int rs_is_path_limited = 0;
 
+        if (!frame->is_ack_ecn && is_new_ack && path_x->ecn_state == picoquic_ecn_testing && cnx->quic->ecn_codepoint != 0) {
+            /* The marks or their counts do not get through */
+            path_x->ecn_state = picoquic_ecn_failed;
+        }
+
         if (top_packet != NULL) {
             old_path = top_packet->send_path;
             largest_sent_time = top_packet->send_time;
@@ -2596,59 +3304,16 @@ protoop_arg_t process_ack_frame_maybe_ecn(picoquic_cnx_t* cnx)
             rs_is_path_limited = top_packet->delivered_app_limited;
         }
 
-        uint64_t range = frame->first_ack_block;
-        uint64_t block_to_block;
-
-        range ++;
-
-        if (frame->largest_acknowledged + 1 < range) {
-            DBG_PRINTF("ack range error: largest=%" PRIx64 ", range=%" PRIx64, frame->largest_acknowledged, range);
-            picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, first_byte);
-            return 1;
-        }
+        picoquic_path_ack_t path_ack = { 0 };
+        path_ack.path_x = path_x;
+        path_ack.pc = pc;
+        path_ack.current_time = current_time;
+        path_ack.frame_type = first_byte;
 
-        if (picoquic_process_ack_range(cnx, pc, frame->largest_acknowledged, range, &top_packet, current_time) != 0) {
+        if (picoquic_process_path_ack_ranges(cnx, &path_ack, frame, &top_packet) != 0) {
             return 1;
         }
 
-        if (range > 0) {
-            picoquic_check_spurious_retransmission(cnx, frame->largest_acknowledged + 1 - range, frame->largest_acknowledged, current_time, pc, path_x);
-        }
-
-        uint64_t largest = frame->largest_acknowledged;
-
-        for (int i = 0; i < frame->ack_block_count; i++) {
-            /* Skip the gap */
-            block_to_block = frame->ack_blocks[i].gap;
-
-            block_to_block += 1; /* add 1, since zero is ruled out by varint, see spec. */
-            block_to_block += range;
-
-            if (largest < block_to_block) {
-                DBG_PRINTF("ack gap error: largest=%" PRIx64 ", range=%" PRIx64 ", gap=%" PRIu64,
-                    largest, range, block_to_block - range);
-                picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, first_byte);
-                return 1;
-            }
-
-            largest -= block_to_block;
-            range = frame->ack_blocks[i].additional_ack_block;
-            range ++;
-            if (largest + 1 < range) {
-                DBG_PRINTF("ack range error: largest=%" PRIx64 ", range=%" PRIx64, largest, range);
-                picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, first_byte);
-                return 1;
-            }
-
-            if (picoquic_process_ack_range(cnx, pc, largest, range, &top_packet, current_time) != 0) {
-                return 1;
-            }
-
-            if (range > 0) {
-                picoquic_check_spurious_retransmission(cnx, largest + 1 - range, largest, current_time, pc, path_x);
-            }
-        }
-
         if (old_path != NULL && is_new_ack) {
             picoquic_estimate_path_bandwidth(cnx, old_path, largest_sent_time,
                                              delivered_prior, delivered_time_prior, delivered_sent_prior,
@@ -2661,32 +3326,31 @@ protoop_arg_t process_ack_frame_maybe_ecn(picoquic_cnx_t* cnx)
     return 0;
 }
 
-int picoquic_prepare_ack_frame_maybe_ecn(picoquic_cnx_t* cnx, uint64_t current_time,
-    picoquic_packet_context_enum pc,
-    uint8_t* bytes, size_t bytes_max, size_t* consumed, int is_ecn)
+int picoquic_prepare_path_ack_frame(picoquic_cnx_t* cnx, picoquic_path_ack_t* path_ack,
+    uint8_t* bytes, size_t bytes_max, size_t* consumed)
 {
     int ret = 0;
     size_t byte_index = 0;
     uint64_t num_block = 0;
+    size_t l_uniflow_id = 0;
     size_t l_largest = 0;
     size_t l_delay = 0;
     size_t l_first_range = 0;
-    picoquic_path_t* path_x = cnx->path[0];
-    picoquic_packet_context_t * pkt_ctx = &path_x->pkt_ctx[pc];
-    picoquic_sack_item_t* next_sack = pkt_ctx->first_sack_item.next_sack;
+    uint64_t current_time = path_ack->current_time;
+    picoquic_packet_context_t * pkt_ctx = &path_ack->path_x->pkt_ctx[path_ack->pc];
+    picoquic_sack_item_t* first_sack = picoquic_sack_list_first(&pkt_ctx->sack_list);
+    uint32_t next_rank = 1;
     uint64_t ack_delay = 0;
     uint64_t ack_range = 0;
     uint64_t ack_gap = 0;
     uint64_t lowest_acknowledged = 0;
     size_t num_block_index = 0;
-    uint8_t ack_type_byte = (is_ecn)?picoquic_frame_type_ack_ecn: picoquic_frame_type_ack;
-
-    ack_frame_t frame;
+    size_t min_length = (path_ack->has_uniflow_id) ? 13 + picoquic_varint_len(path_ack->uniflow_id) : 13;
 
     /* Check that there is enough room in the packet, and something to acknowledge */
-    if (pkt_ctx->first_sack_item.start_of_sack_range == (uint64_t)((int64_t)-1)) {
+    if (pkt_ctx->sack_list.nb_ranges == 0) {
         *consumed = 0;
-    } else if (bytes_max < 13) {
+    } else if (bytes_max < min_length) {
         /* A valid ACK, with our encoding, uses at least 13 bytes.
         * If there is not enough space, don't attempt to encode it.
         */
@@ -2695,12 +3359,17 @@ int picoquic_prepare_ack_frame_maybe_ecn(picoquic_cnx_t* cnx, uint64_t current_t
     } else {
         /* Encode the first byte */
         size_t type_byte_index = byte_index;
-        bytes[byte_index++] = ack_type_byte;
+        bytes[byte_index++] = path_ack->frame_type;
+        /* Encode the uniflow ID */
+        if (path_ack->has_uniflow_id) {
+            l_uniflow_id = picoquic_varint_encode(bytes + byte_index, bytes_max - byte_index,
+                path_ack->uniflow_id);
+            byte_index += l_uniflow_id;
+        }
         /* Encode the largest seen */
         if (byte_index < bytes_max) {
-            frame.largest_acknowledged = pkt_ctx->first_sack_item.end_of_sack_range;
             l_largest = picoquic_varint_encode(bytes + byte_index, bytes_max - byte_index,
-                pkt_ctx->first_sack_item.end_of_sack_range);
+                first_sack->end_of_sack_range);
             byte_index += l_largest;
         }
         /* Encode the ack delay */
@@ -2720,36 +3389,34 @@ int picoquic_prepare_ack_frame_maybe_ecn(picoquic_cnx_t* cnx, uint64_t current_t
             byte_index++;
             /* Encode the size of the first ack range */
             if (byte_index < bytes_max) {
-                ack_range = pkt_ctx->first_sack_item.end_of_sack_range - pkt_ctx->first_sack_item.start_of_sack_range;
-                frame.first_ack_block = ack_range;
+                ack_range = first_sack->end_of_sack_range - first_sack->start_of_sack_range;
                 l_first_range = picoquic_varint_encode(bytes + byte_index, bytes_max - byte_index,
                     ack_range);
                 byte_index += l_first_range;
             }
         }
 
-        if (l_delay == 0 || l_largest == 0 || l_first_range == 0 || byte_index > bytes_max) {
+        if ((path_ack->has_uniflow_id && l_uniflow_id == 0) || l_delay == 0 || l_largest == 0 || l_first_range == 0 || byte_index > bytes_max) {
             /* not enough space */
             *consumed = 0;
             ret = PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL;
         } else if (ret == 0) {
             /* Set the lowest acknowledged */
-            lowest_acknowledged = pkt_ctx->first_sack_item.start_of_sack_range;
+            lowest_acknowledged = first_sack->start_of_sack_range;
             /* Encode the ack blocks that fit in the allocated space */
-            while (num_block < 63 && next_sack != NULL) {
+            while (num_block < 63 && next_rank < pkt_ctx->sack_list.nb_ranges) {
+                picoquic_sack_item_t* next_sack = &first_sack[next_rank];
                 size_t l_gap = 0;
                 size_t l_range = 0;
 
                 if (byte_index < bytes_max) {
                     ack_gap = lowest_acknowledged - next_sack->end_of_sack_range - 2; /* per spec */
-                    frame.ack_blocks[num_block].gap = ack_gap;
                     l_gap = picoquic_varint_encode(bytes + byte_index,
                         bytes_max - byte_index, ack_gap);
                 }
 
                 if (byte_index + l_gap < bytes_max) {
                     ack_range = next_sack->end_of_sack_range - next_sack->start_of_sack_range;
-                    frame.ack_blocks[num_block].additional_ack_block = ack_range;
                     l_range = picoquic_varint_encode(bytes + byte_index + l_gap,
                         bytes_max - byte_index - l_gap, ack_range);
                 }
@@ -2760,7 +3427,7 @@ int picoquic_prepare_ack_frame_maybe_ecn(picoquic_cnx_t* cnx, uint64_t current_t
                 } else {
                     byte_index += l_gap + l_range;
                     lowest_acknowledged = next_sack->start_of_sack_range;
-                    next_sack = next_sack->next_sack;
+                    next_rank++;
                     num_block++;
                 }
             }
@@ -2769,17 +3436,15 @@ int picoquic_prepare_ack_frame_maybe_ecn(picoquic_cnx_t* cnx, uint64_t current_t
             if (ret != 0) {
                 ret = PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL;
             } else if (*consumed > 0) {
-                bytes[type_byte_index] = picoquic_frame_type_ack_ecn;
+                bytes[type_byte_index] = path_ack->ecn_frame_type;
                 byte_index += *consumed;
             }
 
-            frame.ack_block_count = num_block;
-
             /* When numbers are lower than 64, varint encoding fits on one byte */
             bytes[num_block_index] = (uint8_t)num_block;
 
             /* Remember the ACK value and time */
-            pkt_ctx->highest_ack_sent = pkt_ctx->first_sack_item.end_of_sack_range;
+            pkt_ctx->highest_ack_sent = first_sack->end_of_sack_range;
             pkt_ctx->highest_ack_time = current_time;
 
             if (num_block > 10 && byte_index < bytes_max) {  /* Request an ACK to prune ACK ranges if more than 10 blocks are used*/
@@ -2787,16 +3452,32 @@ int picoquic_prepare_ack_frame_maybe_ecn(picoquic_cnx_t* cnx, uint64_t current_t
             }
 
             *consumed = byte_index;
+            path_ack->path_x->counters.ack_frames_sent++;
         }
     }
 
     if (ret == 0) {
         pkt_ctx->ack_needed = 0;
+        pkt_ctx->ack_immediate = 0;
     }
 
     return ret;
 }
 
+int picoquic_prepare_ack_frame_maybe_ecn(picoquic_cnx_t* cnx, uint64_t current_time,
+    picoquic_packet_context_enum pc,
+    uint8_t* bytes, size_t bytes_max, size_t* consumed, int is_ecn)
+{
+    picoquic_path_ack_t path_ack = { 0 };
+    path_ack.path_x = cnx->path[0];
+    path_ack.pc = pc;
+    path_ack.current_time = current_time;
+    path_ack.frame_type = (is_ecn) ? picoquic_frame_type_ack_ecn : picoquic_frame_type_ack;
+    path_ack.ecn_frame_type = picoquic_frame_type_ack_ecn;
+
+    return picoquic_prepare_path_ack_frame(cnx, &path_ack, bytes, bytes_max, consumed);
+}
+
 /**
  * See PROTOOP_NOPARAM_PREPARE_ACK_FRAME
  */
@@ -2868,16 +3549,19 @@ protoop_arg_t is_ack_needed(picoquic_cnx_t *cnx)
 
     int ret = 0;
     picoquic_packet_context_t * pkt_ctx = &path_x->pkt_ctx[pc];
+    uint64_t ack_gap = (pc == picoquic_packet_context_application && cnx->ack_gap_remote > 0) ?
+        cnx->ack_gap_remote : PICOQUIC_ACK_GAP_DEFAULT;
 
     if (pkt_ctx->ack_needed) {
-        if (pkt_ctx->highest_ack_sent + 2 <= pkt_ctx->first_sack_item.end_of_sack_range ||
+        if (pkt_ctx->ack_immediate ||
+            pkt_ctx->highest_ack_sent + ack_gap <= picoquic_sack_list_first(&pkt_ctx->sack_list)->end_of_sack_range ||
             pkt_ctx->highest_ack_time + pkt_ctx->ack_delay_local <= current_time) {
             ret = 1;
         }
-    } else if (pkt_ctx->highest_ack_sent + 8 <= pkt_ctx->first_sack_item.end_of_sack_range &&
+    } else if (pkt_ctx->highest_ack_sent + 8 <= picoquic_sack_list_first(&pkt_ctx->sack_list)->end_of_sack_range &&
         pkt_ctx->highest_ack_time + pkt_ctx->ack_delay_local <= current_time) {
         /* Force sending an ack-of-ack from time to time, as a low priority action */
-        if (pkt_ctx->first_sack_item.end_of_sack_range == (uint64_t)((int64_t)-1)) {
+        if (picoquic_sack_list_first(&pkt_ctx->sack_list)->end_of_sack_range == (uint64_t)((int64_t)-1)) {
             ret = 0;
         }
         else {
@@ -3234,6 +3918,7 @@ protoop_arg_t process_max_stream_data_frame(picoquic_cnx_t *cnx)
     } else if (frame->maximum_stream_data > stream->maxdata_remote) {
         /* TODO: call back if the stream was blocked? */
         stream->maxdata_remote = frame->maximum_stream_data;
+        picoquic_mark_stream_ready(cnx, stream);
     }
 
     return 0;
@@ -3251,23 +3936,41 @@ protoop_arg_t prepare_required_max_stream_data_frames(picoquic_cnx_t* cnx)
 
     int ret = 0;
     size_t byte_index = 0;
-    picoquic_stream_head* stream = cnx->first_stream;
+    picoquic_stream_head* stream;
+
+    /* Past the memory cap, the streams stay queued until memory is freed, and the peer runs out of credit */
+    int is_capped = cnx->first_max_data_stream != NULL && picoquic_is_memory_capped(cnx);
+
+    if (is_capped) {
+        cnx->nb_memory_capped++;
+    }
 
-    while (stream != NULL && ret == 0 && byte_index < bytes_max) {
-        if (!stream->fin_received && !stream->reset_received && 2 * stream->consumed_offset > stream->maxdata_local) {
+    /* Only the streams queued by picoquic_stream_deliver() may need an update */
+    while (!is_capped && (stream = cnx->first_max_data_stream) != NULL && ret == 0 && byte_index < bytes_max) {
+        if (picoquic_is_max_stream_data_needed(stream)) {
             size_t bytes_in_frame = 0;
+            uint64_t window = picoquic_autotune_window(cnx, stream->max_data_window,
+                (cnx->quic != NULL) ? cnx->quic->max_stream_data_window_max : 0, stream->max_data_update_time);
 
             ret = picoquic_prepare_max_stream_data_frame(stream,
                 bytes + byte_index, bytes_max - byte_index,
-                stream->maxdata_local + 2 * stream->consumed_offset,
+                stream->consumed_offset + window,
                 &bytes_in_frame);
             if (ret == 0) {
                 byte_index += bytes_in_frame;
+                picoquic_autotune_window_set(cnx, &stream->max_data_window, window,
+                    &stream->max_data_update_time, &stream->max_data_growth);
             } else {
+                /* The stream stays queued for the next packet */
                 break;
             }
         }
-        stream = stream->next_stream;
+        cnx->first_max_data_stream = stream->next_max_data_stream;
+        if (cnx->first_max_data_stream == NULL) {
+            cnx->last_max_data_stream = NULL;
+        }
+        stream->next_max_data_stream = NULL;
+        stream->is_max_data_queued = 0;
     }
 
     if (ret == PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL) {
@@ -3458,6 +4161,10 @@ protoop_arg_t process_path_challenge_frame(picoquic_cnx_t* cnx)
     */
     memcpy(path_x->challenge_response, &frame->data, PICOQUIC_CHALLENGE_LENGTH);
     path_x->challenge_response_to_send = 1;
+    if (cnx->client_mode && path_x == cnx->path[0] && cnx->cnx_state == picoquic_state_client_ready) {
+        /* The server validates a new address of the client, after its NAT forgot the binding */
+        picoquic_keep_alive_rebinding(cnx);
+    }
 
     return 0;
 }
@@ -3795,12 +4502,11 @@ protoop_arg_t process_plugin_validate_frame(picoquic_cnx_t* cnx)
     /* Find the corresponding plugin path */
     for (int i = 0; i < cnx->quic->plugins_to_inject.size; i++) {
         if (strcmp(frame->pid, cnx->quic->plugins_to_inject.elems[i].plugin_name) == 0) {
-            uint8_t plugin_buffer[MAX_PLUGIN_DATA_LEN];
-            size_t size_used = 0;
-            int err = plugin_prepare_plugin_data_exchange(cnx, cnx->quic->plugins_to_inject.elems[i].plugin_path, plugin_buffer,
-                MAX_PLUGIN_DATA_LEN, &size_used);
-            if (err == 0) {
-                picoquic_add_to_plugin_stream(cnx, frame->pid_id, plugin_buffer, size_used, 1);
+            int err = 1;
+            plugin_archive_t *archive = plugin_get_plugin_archive(cnx, frame->pid, cnx->quic->plugins_to_inject.elems[i].plugin_path);
+            if (archive) {
+                /* The stream sends the cached archive directly */
+                err = picoquic_add_archive_to_plugin_stream(cnx, frame->pid_id, archive, 1);
             } else {
                 printf("Failed to prepare plugin data exchanged\n");
             }
@@ -3905,9 +4611,8 @@ void picoquic_plugin_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head* pl
             }
         }
 
-        free(data->bytes);
         plugin_stream->stream_data = data->next_stream_data;
-        free(data);
+        picoquic_free_stream_data(cnx, data);
         data = plugin_stream->stream_data;
     }
 
@@ -3963,7 +4668,7 @@ protoop_arg_t process_plugin_frame(picoquic_cnx_t* cnx)
     if (ret == 0) {
         int new_data_available = 0;
 
-        ret = picoquic_queue_network_input(cnx, plugin_stream, (size_t)frame->offset, frame->data, frame->length, &new_data_available);
+        ret = picoquic_queue_network_input(cnx, plugin_stream, picoquic_memory_plugins, (size_t)frame->offset, frame->data, frame->length, &new_data_available);
 
         if (new_data_available) {
             should_notify = 1;
@@ -4054,14 +4759,14 @@ uint8_t* picoquic_decode_frame(picoquic_cnx_t* cnx, uint64_t frame_type, uint8_t
     uint64_t current_time, int epoch, int* ack_needed, picoquic_path_t* path_x)
 {
     protoop_arg_t outs[PROTOOPARGS_MAX];
-    bytes = (uint8_t*) protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_PARSE_FRAME, (uint16_t) frame_type, outs,
-        bytes, bytes_max);
+    bytes = (uint8_t*) protoop_run_frame_op(cnx, picoquic_frame_op_parse, &PROTOOP_PARAM_PARSE_FRAME, frame_type, outs,
+        2, (protoop_arg_t[2]) {PROTOOP_ARG(bytes), PROTOOP_ARG(bytes_max)});
     void *frame = (void *) outs[0];
     *ack_needed |= (int) outs[1];
     protoop_plugin_t *previous_plugin = cnx->previous_plugin_in_replace;
     if (bytes && frame) {
-        int err = (int) protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_PROCESS_FRAME, (uint16_t) frame_type, outs,
-            frame, current_time, epoch, path_x);
+        int err = (int) protoop_run_frame_op(cnx, picoquic_frame_op_process, &PROTOOP_PARAM_PROCESS_FRAME, frame_type, outs,
+            4, (protoop_arg_t[4]) {PROTOOP_ARG(frame), PROTOOP_ARG(current_time), PROTOOP_ARG(epoch), PROTOOP_ARG(path_x)});
         if (err) {
             bytes = NULL;
         }
@@ -4118,7 +4823,8 @@ int picoquic_decode_frames(picoquic_cnx_t* cnx, uint8_t* bytes,
 
         } else {
             protoop_arg_t outs[PROTOOPARGS_MAX];
-            bytes = (uint8_t*) protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_PARSE_FRAME, (uint16_t) frame_type, outs, bytes, bytes_max);
+            bytes = (uint8_t*) protoop_run_frame_op(cnx, picoquic_frame_op_parse, &PROTOOP_PARAM_PARSE_FRAME, frame_type, outs,
+                2, (protoop_arg_t[2]) {PROTOOP_ARG(bytes), PROTOOP_ARG(bytes_max)});
             void *frame = (void *) outs[0];
             ack_needed |= (int) outs[1];
             protoop_plugin_t *previous_plugin = cnx->previous_plugin_in_replace;
@@ -4149,7 +4855,8 @@ int picoquic_decode_frames(picoquic_cnx_t* cnx, uint8_t* bytes,
         frame_queue_t *fq = frames;
 
         protoop_arg_t outs[PROTOOPARGS_MAX];
-        int err = (int) protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_PROCESS_FRAME, (uint16_t) fq->frame_type, outs, fq->frame, current_time, epoch, path_x);
+        int err = (int) protoop_run_frame_op(cnx, picoquic_frame_op_process, &PROTOOP_PARAM_PROCESS_FRAME, fq->frame_type, outs,
+            4, (protoop_arg_t[4]) {PROTOOP_ARG(fq->frame), PROTOOP_ARG(current_time), PROTOOP_ARG(epoch), PROTOOP_ARG(path_x)});
         if (err) {
             bytes = NULL;
         }
@@ -4177,7 +4884,7 @@ int picoquic_decode_frames_without_current_time(picoquic_cnx_t* cnx, uint8_t* by
                                                 size_t bytes_max_size, int epoch, picoquic_path_t* path_x) {
     const uint8_t *bytes_max = bytes + bytes_max_size;
     int ack_needed = 0;
-    uint64_t current_time = picoquic_current_time();
+    uint64_t current_time = picoquic_get_loop_time(cnx->quic);
 
     while (bytes != NULL && bytes < bytes_max) {
         uint64_t frame_type;
@@ -4235,8 +4942,8 @@ protoop_arg_t skip_frame(picoquic_cnx_t *cnx)
     picoquic_varint_decode(bytes, bytes_max_size, &frame_type);
 
     protoop_arg_t outs[PROTOOPARGS_MAX];
-    bytes = (uint8_t*) protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_PARSE_FRAME, (uint16_t) frame_type, outs,
-        bytes, bytes_max);
+    bytes = (uint8_t*) protoop_run_frame_op(cnx, picoquic_frame_op_parse, &PROTOOP_PARAM_PARSE_FRAME, frame_type, outs,
+        2, (protoop_arg_t[2]) {PROTOOP_ARG(bytes), PROTOOP_ARG(bytes_max)});
     void *frame = (void *) outs[0];
     is_retransmittable = (int) outs[2];
     if (frame) {
@@ -4269,6 +4976,50 @@ int picoquic_skip_frame(picoquic_cnx_t *cnx, uint8_t* bytes, size_t bytes_max_si
     return ret;
 }
 
+/**
+ * See PROTOOP_NOPARAM_PROTECTABLE_PAYLOAD_SPANS
+ */
+protoop_arg_t protectable_payload_spans(picoquic_cnx_t *cnx)
+{
+    uint8_t* bytes = (uint8_t *) cnx->protoop_inputv[0];
+    size_t bytes_max_size = (size_t) cnx->protoop_inputv[1];
+    picoquic_payload_span_t* spans = (picoquic_payload_span_t *) cnx->protoop_inputv[2];
+    int max_spans = (int) cnx->protoop_inputv[3];
+
+    int ret = 0;
+    int nb_spans = 0;
+    size_t length = 0;
+    size_t byte_index = 0;
+
+    while (ret == 0 && byte_index < bytes_max_size) {
+        uint64_t frame_type;
+        size_t consumed = 0;
+        int pure_ack = 0;
+
+        picoquic_varint_decode(bytes + byte_index, bytes_max_size - byte_index, &frame_type);
+        ret = picoquic_skip_frame(cnx, bytes + byte_index, bytes_max_size - byte_index, &consumed, &pure_ack);
+
+        if (ret == 0 && frame_type != picoquic_frame_type_ack && frame_type != picoquic_frame_type_padding &&
+            frame_type != picoquic_frame_type_crypto_hs) {
+            if (nb_spans > 0 && spans[nb_spans - 1].offset + spans[nb_spans - 1].length == byte_index) {
+                spans[nb_spans - 1].length += (uint16_t) consumed;
+            } else if (nb_spans < max_spans) {
+                spans[nb_spans].offset = (uint16_t) byte_index;
+                spans[nb_spans].length = (uint16_t) consumed;
+                nb_spans++;
+            } else {
+                ret = PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL;
+            }
+            length += consumed;
+        }
+        byte_index += consumed;
+    }
+
+    protoop_save_outputs(cnx, nb_spans, length);
+
+    return (protoop_arg_t) ret;
+}
+
 int picoquic_decode_closing_frames(picoquic_cnx_t *cnx, uint8_t* bytes, size_t bytes_max, int* closing_received)
 {
     int ret = 0;
@@ -4295,23 +5046,101 @@ int picoquic_decode_closing_frames(picoquic_cnx_t *cnx, uint8_t* bytes, size_t b
     return ret;
 }
 
+/**
+ * cnx->protoop_inputv[0] = uint8_t* bytes
+ * cnx->protoop_inputv[1] = const uint8_t* bytes_max
+ *
+ * Output: void* ecn_block, NULL for the counts decoded by the core
+ */
 protoop_arg_t skip_ecn_block(picoquic_cnx_t *cnx) {
-    uint8_t* bytes = (uint8_t *) cnx->protoop_inputv[1];
-    const uint8_t *bytes_max = (const uint8_t *) cnx->protoop_inputv[2];
+    uint8_t* bytes = (uint8_t *) cnx->protoop_inputv[0];
+    const uint8_t *bytes_max = (const uint8_t *) cnx->protoop_inputv[1];
 
     uint64_t u;
     for(int i = 0; bytes && i < 3; i++) {
         bytes = picoquic_frames_varint_decode(bytes, bytes_max, &u);
     }
 
+    protoop_save_outputs(cnx, NULL);
     return (protoop_arg_t) bytes;
 }
 
-protoop_arg_t dont_write_ecn_block(picoquic_cnx_t *cnx) {
-    protoop_save_outputs(cnx, 0);
+/**
+ * cnx->protoop_inputv[0] = uint64_t* ecn_block, the ECT(0), ECT(1) and CE counts of the peer
+ * cnx->protoop_inputv[1] = picoquic_packet_context_t* pkt_ctx
+ * cnx->protoop_inputv[2] = picoquic_path_t* path
+ *
+ * Output: None
+ */
+static protoop_arg_t process_ecn_block(picoquic_cnx_t *cnx) {
+    uint64_t* counts = (uint64_t *) cnx->protoop_inputv[0];
+    picoquic_packet_context_t* pkt_ctx = (picoquic_packet_context_t *) cnx->protoop_inputv[1];
+    picoquic_path_t* path_x = (picoquic_path_t *) cnx->protoop_inputv[2];
+    uint64_t ect_acked = 0;
+    uint64_t ce_acked;
+
+    if (counts == NULL || path_x->ecn_state == picoquic_ecn_failed) {
+        return 0;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (counts[i] < pkt_ctx->ecn_remote[i]) {
+            /* The counts only grow, unless the ACK frames are reordered or the marks are rewritten */
+            if (path_x->ecn_state == picoquic_ecn_testing) {
+                path_x->ecn_state = picoquic_ecn_failed;
+            }
+            return 0;
+        }
+        ect_acked += counts[i] - pkt_ctx->ecn_remote[i];
+    }
+    ce_acked = counts[2] - pkt_ctx->ecn_remote[2];
+    memcpy(pkt_ctx->ecn_remote, counts, sizeof(pkt_ctx->ecn_remote));
+
+    /* Keep the path counts up to date before the notification, so that the controller can compute the CE fraction */
+    path_x->ecn_ect_acked += ect_acked;
+    path_x->ecn_ce_acked += ce_acked;
+    if (path_x->ecn_state == picoquic_ecn_testing && ect_acked > 0) {
+        path_x->ecn_state = picoquic_ecn_capable;
+    }
+    if (ce_acked > 0 && path_x->ecn_state == picoquic_ecn_capable) {
+        picoquic_congestion_algorithm_notify_func(cnx, path_x, picoquic_congestion_notification_congestion_experienced,
+            0, 0, 0, picoquic_current_time());
+    }
+
     return 0;
 }
 
+/**
+ * cnx->protoop_inputv[0] = uint8_t* bytes
+ * cnx->protoop_inputv[1] = size_t bytes_max
+ * cnx->protoop_inputv[2] = picoquic_packet_context_t* pkt_ctx
+ *
+ * Output: size_t consumed, 0 if the ACK frame has no ECN block
+ */
+static protoop_arg_t write_ecn_block(picoquic_cnx_t *cnx) {
+    uint8_t* bytes = (uint8_t *) cnx->protoop_inputv[0];
+    size_t bytes_max = (size_t) cnx->protoop_inputv[1];
+    picoquic_packet_context_t* pkt_ctx = (picoquic_packet_context_t *) cnx->protoop_inputv[2];
+    size_t consumed = 0;
+    int ret = 0;
+
+    if ((pkt_ctx->ecn_received[0] | pkt_ctx->ecn_received[1] | pkt_ctx->ecn_received[2]) != 0) {
+        for (int i = 0; ret == 0 && i < 3; i++) {
+            size_t l_count = picoquic_varint_encode(bytes + consumed, bytes_max - consumed, pkt_ctx->ecn_received[i]);
+
+            if (l_count == 0) {
+                consumed = 0;
+                ret = PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL;
+            } else {
+                consumed += l_count;
+            }
+        }
+    }
+
+    protoop_save_outputs(cnx, consumed);
+    return (protoop_arg_t) ret;
+}
+
 void frames_register_noparam_protoops(picoquic_cnx_t *cnx)
 {
     /* Decoding */
@@ -4346,6 +5175,8 @@ void frames_register_noparam_protoops(picoquic_cnx_t *cnx)
     register_param_protoop(cnx, &PROTOOP_PARAM_PARSE_FRAME, picoquic_frame_type_handshake_done, &parse_handshake_done_frame);
     register_param_protoop(cnx, &PROTOOP_PARAM_PARSE_FRAME, picoquic_frame_type_plugin_validate, &parse_plugin_validate_frame);
     register_param_protoop(cnx, &PROTOOP_PARAM_PARSE_FRAME, picoquic_frame_type_plugin, &parse_plugin_frame);
+    register_param_protoop(cnx, &PROTOOP_PARAM_PARSE_FRAME, picoquic_frame_type_ack_frequency, &parse_ack_frequency_frame);
+    register_param_protoop(cnx, &PROTOOP_PARAM_PARSE_FRAME, picoquic_frame_type_immediate_ack, &parse_immediate_ack_frame);
 
     register_param_protoop_default(cnx, &PROTOOP_PARAM_PROCESS_FRAME, &process_unknown_frame);
     register_param_protoop(cnx, &PROTOOP_PARAM_PROCESS_FRAME, picoquic_frame_type_padding, &process_ignore_frame);
@@ -4376,6 +5207,8 @@ void frames_register_noparam_protoops(picoquic_cnx_t *cnx)
     register_param_protoop(cnx, &PROTOOP_PARAM_PROCESS_FRAME, picoquic_frame_type_handshake_done, &process_handshake_done_frame);
     register_param_protoop(cnx, &PROTOOP_PARAM_PROCESS_FRAME, picoquic_frame_type_plugin_validate, &process_plugin_validate_frame);
     register_param_protoop(cnx, &PROTOOP_PARAM_PROCESS_FRAME, picoquic_frame_type_plugin, &process_plugin_frame);
+    register_param_protoop(cnx, &PROTOOP_PARAM_PROCESS_FRAME, picoquic_frame_type_ack_frequency, &process_ack_frequency_frame);
+    register_param_protoop(cnx, &PROTOOP_PARAM_PROCESS_FRAME, picoquic_frame_type_immediate_ack, &process_immediate_ack_frame);
 
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_UPDATE_RTT, &update_rtt);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_UPDATE_ACK_DELAY, &update_ack_delay);
@@ -4393,6 +5226,8 @@ void frames_register_noparam_protoops(picoquic_cnx_t *cnx)
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PREPARE_PATH_CHALLENGE_FRAME, &prepare_path_challenge_frame);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PREPARE_CRYPTO_HS_FRAME, &prepare_crypto_hs_frame);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PREPARE_HANDSHAKE_DONE_FRAME, &prepare_handshake_done_frame);
+    register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PREPARE_ACK_FREQUENCY_FRAME, &prepare_ack_frequency_frame);
+    register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PREPARE_IMMEDIATE_ACK_FRAME, &prepare_immediate_ack_frame);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PREPARE_MAX_DATA_FRAME, &prepare_max_data_frame);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PREPARE_REQUIRED_MAX_STREAM_DATA_FRAME, &prepare_required_max_stream_data_frames);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PREPARE_STREAM_FRAME, &prepare_stream_frame);
@@ -4409,6 +5244,7 @@ void frames_register_noparam_protoops(picoquic_cnx_t *cnx)
     /* Skipping */
     /** \todo Refactor API, decode_frame split into parse and process param operations */
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_SKIP_FRAME, &skip_frame);
+    register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PROTECTABLE_PAYLOAD_SPANS, &protectable_payload_spans);
 
     /* Others */
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_CHECK_STREAM_FRAME_ALREADY_ACKED, &check_stream_frame_already_acked);
@@ -4418,6 +5254,6 @@ void frames_register_noparam_protoops(picoquic_cnx_t *cnx)
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_STREAM_ALWAYS_ENCODE_LENGTH, &stream_always_encode_length);
 
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PARSE_ECN_BLOCK, &skip_ecn_block);
-    register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PROCESS_ECN_BLOCK, &protoop_noop);
-    register_noparam_protoop(cnx, &PROTOOP_NOPARAM_WRITE_ECN_BLOCK, &dont_write_ecn_block);
+    register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PROCESS_ECN_BLOCK, &process_ecn_block);
+    register_noparam_protoop(cnx, &PROTOOP_NOPARAM_WRITE_ECN_BLOCK, &write_ecn_block);
 }
@@ -1,5 +1,158 @@
 #include "getset.h"
 #include "picoquic_internal.h"
+#include <stddef.h>
+
+/*
+ * The fields that are plain struct members are described by a table indexed by their
+ * access key, such that accessing them only costs a lookup and a load or a store.
+ * Keys without an entry (width of 0) need specific code and are handled by the switches.
+ */
+#define GETSET_SIGNED 0x01 /* Sign-extend the field when reading it */
+#define GETSET_READ_ONLY 0x02 /* Setting the field goes through the switch, that rejects it or has specific code */
+
+typedef struct getset_field {
+    uint32_t offset;
+    uint8_t width;
+    uint8_t flags;
+} getset_field_t;
+
+#define GETSET_FIELD(type, field, fl) { offsetof(type, field), sizeof(((type *) NULL)->field), fl }
+#define GETSET_FIELD_DEFINED(table, ak) ((ak) < sizeof(table) / sizeof(getset_field_t) && table[ak].width != 0)
+
+static inline protoop_arg_t getset_load(const void *base, const getset_field_t *f)
+{
+    const uint8_t *addr = (const uint8_t *) base + f->offset;
+    bool is_signed = f->flags & GETSET_SIGNED;
+    switch (f->width) {
+    case 1:
+        return is_signed ? (protoop_arg_t) *(const int8_t *) addr : *(const uint8_t *) addr;
+    case 2:
+        return is_signed ? (protoop_arg_t) *(const int16_t *) addr : *(const uint16_t *) addr;
+    case 4:
+        return is_signed ? (protoop_arg_t) *(const int32_t *) addr : *(const uint32_t *) addr;
+    default:
+        return *(const uint64_t *) addr;
+    }
+}
+
+static inline void getset_store(void *base, const getset_field_t *f, protoop_arg_t val)
+{
+    uint8_t *addr = (uint8_t *) base + f->offset;
+    switch (f->width) {
+    case 1:
+        *(uint8_t *) addr = (uint8_t) val;
+        break;
+    case 2:
+        *(uint16_t *) addr = (uint16_t) val;
+        break;
+    case 4:
+        *(uint32_t *) addr = (uint32_t) val;
+        break;
+    default:
+        *(uint64_t *) addr = (uint64_t) val;
+        break;
+    }
+}
+
+static const getset_field_t cnx_fields[] = {
+    [AK_CNX_PROPOSED_VERSION] = GETSET_FIELD(picoquic_cnx_t, proposed_version, 0),
+    [AK_CNX_SPIN_LAST_TRIGGER] = GETSET_FIELD(picoquic_cnx_t, spin_last_trigger, 0),
+    [AK_CNX_MAX_EARLY_DATA_SIZE] = GETSET_FIELD(picoquic_cnx_t, max_early_data_size, 0),
+    [AK_CNX_STATE] = GETSET_FIELD(picoquic_cnx_t, cnx_state, GETSET_READ_ONLY),
+    [AK_CNX_START_TIME] = GETSET_FIELD(picoquic_cnx_t, start_time, 0),
+    [AK_CNX_APPLICATION_ERROR] = GETSET_FIELD(picoquic_cnx_t, application_error, 0),
+    [AK_CNX_LOCAL_ERROR] = GETSET_FIELD(picoquic_cnx_t, local_error, 0),
+    [AK_CNX_REMOTE_APPLICATION_ERROR] = GETSET_FIELD(picoquic_cnx_t, remote_application_error, 0),
+    [AK_CNX_REMOTE_ERROR] = GETSET_FIELD(picoquic_cnx_t, remote_error, 0),
+    [AK_CNX_OFFENDING_FRAME_TYPE] = GETSET_FIELD(picoquic_cnx_t, offending_frame_type, 0),
+    [AK_CNX_NEXT_WAKE_TIME] = GETSET_FIELD(picoquic_cnx_t, next_wake_time, 0),
+    [AK_CNX_LATEST_PROGRESS_TIME] = GETSET_FIELD(picoquic_cnx_t, latest_progress_time, 0),
+    [AK_CNX_NB_PATH_CHALLENGE_SENT] = GETSET_FIELD(picoquic_cnx_t, nb_path_challenge_sent, 0),
+    [AK_CNX_NB_PATH_RESPONSE_RECEIVED] = GETSET_FIELD(picoquic_cnx_t, nb_path_response_received, 0),
+    [AK_CNX_NB_ZERO_RTT_SENT] = GETSET_FIELD(picoquic_cnx_t, nb_zero_rtt_sent, 0),
+    [AK_CNX_NB_ZERO_RTT_ACKED] = GETSET_FIELD(picoquic_cnx_t, nb_zero_rtt_acked, 0),
+    [AK_CNX_NB_RETRANSMISSION_TOTAL] = GETSET_FIELD(picoquic_cnx_t, nb_retransmission_total, 0),
+    [AK_CNX_NB_SPURIOUS] = GETSET_FIELD(picoquic_cnx_t, nb_spurious, 0),
+    [AK_CNX_DATA_SENT] = GETSET_FIELD(picoquic_cnx_t, data_sent, 0),
+    [AK_CNX_DATA_RECEIVED] = GETSET_FIELD(picoquic_cnx_t, data_received, 0),
+    [AK_CNX_MAXDATA_LOCAL] = GETSET_FIELD(picoquic_cnx_t, maxdata_local, 0),
+    [AK_CNX_MAXDATA_REMOTE] = GETSET_FIELD(picoquic_cnx_t, maxdata_remote, 0),
+    [AK_CNX_MAX_STREAM_ID_BIDIR_LOCAL] = GETSET_FIELD(picoquic_cnx_t, max_stream_id_bidir_local, 0),
+    [AK_CNX_MAX_STREAM_ID_UNIDIR_LOCAL] = GETSET_FIELD(picoquic_cnx_t, max_stream_id_unidir_local, 0),
+    [AK_CNX_MAX_STREAM_ID_BIDIR_REMOTE] = GETSET_FIELD(picoquic_cnx_t, max_stream_id_bidir_remote, 0),
+    [AK_CNX_MAX_STREAM_ID_UNIDIR_REMOTE] = GETSET_FIELD(picoquic_cnx_t, max_stream_id_unidir_remote, 0),
+    [AK_CNX_KEEP_ALIVE_INTERVAL] = GETSET_FIELD(picoquic_cnx_t, keep_alive_interval, 0),
+    [AK_CNX_NB_PATHS] = GETSET_FIELD(picoquic_cnx_t, nb_paths, GETSET_SIGNED),
+    [AK_CNX_CONGESTION_CONTROL_ALGORITHM] = GETSET_FIELD(picoquic_cnx_t, congestion_alg, GETSET_READ_ONLY),
+    [AK_CNX_RETRY_TOKEN_LENGTH] = GETSET_FIELD(picoquic_cnx_t, retry_token_length, 0),
+    [AK_CNX_RETURN_VALUE] = GETSET_FIELD(picoquic_cnx_t, protoop_output, GETSET_READ_ONLY),
+    [AK_CNX_RESERVED_FRAMES] = GETSET_FIELD(picoquic_cnx_t, reserved_frames, GETSET_READ_ONLY),
+    [AK_CNX_RETRY_FRAMES] = GETSET_FIELD(picoquic_cnx_t, retry_frames, GETSET_READ_ONLY),
+    [AK_CNX_FIRST_STREAM] = GETSET_FIELD(picoquic_cnx_t, first_stream, GETSET_READ_ONLY),
+    [AK_CNX_PIDS_TO_REQUEST_SIZE] = GETSET_FIELD(picoquic_cnx_t, pids_to_request.size, 0),
+};
+
+static const getset_field_t path_fields[] = {
+    [AK_PATH_PEER_ADDR_LEN] = GETSET_FIELD(picoquic_path_t, peer_addr_len, GETSET_SIGNED),
+    [AK_PATH_LOCAL_ADDR_LEN] = GETSET_FIELD(picoquic_path_t, local_addr_len, GETSET_SIGNED),
+    [AK_PATH_IF_INDEX_LOCAL] = GETSET_FIELD(picoquic_path_t, if_index_local, 0),
+    [AK_PATH_CHALLENGE] = GETSET_FIELD(picoquic_path_t, challenge, 0),
+    [AK_PATH_CHALLENGE_TIME] = GETSET_FIELD(picoquic_path_t, challenge_time, 0),
+    [AK_PATH_CHALLENGE_REPEAT_COUNT] = GETSET_FIELD(picoquic_path_t, challenge_repeat_count, 0),
+    [AK_PATH_MAX_ACK_DELAY] = GETSET_FIELD(picoquic_path_t, max_ack_delay, 0),
+    [AK_PATH_SMOOTHED_RTT] = GETSET_FIELD(picoquic_path_t, smoothed_rtt, 0),
+    [AK_PATH_RTT_VARIANT] = GETSET_FIELD(picoquic_path_t, rtt_variant, 0),
+    [AK_PATH_RETRANSMIT_TIMER] = GETSET_FIELD(picoquic_path_t, retransmit_timer, 0),
+    [AK_PATH_RTT_MIN] = GETSET_FIELD(picoquic_path_t, rtt_min, 0),
+    [AK_PATH_MAX_SPURIOUS_RTT] = GETSET_FIELD(picoquic_path_t, max_spurious_rtt, 0),
+    [AK_PATH_MAX_REORDER_DELAY] = GETSET_FIELD(picoquic_path_t, max_reorder_delay, 0),
+    [AK_PATH_MAX_REORDER_GAP] = GETSET_FIELD(picoquic_path_t, max_reorder_gap, 0),
+    [AK_PATH_SEND_MTU] = GETSET_FIELD(picoquic_path_t, send_mtu, 0),
+    [AK_PATH_SEND_MTU_MAX_TRIED] = GETSET_FIELD(picoquic_path_t, send_mtu_max_tried, 0),
+    [AK_PATH_CWIN] = GETSET_FIELD(picoquic_path_t, cwin, 0),
+    [AK_PATH_BYTES_IN_TRANSIT] = GETSET_FIELD(picoquic_path_t, bytes_in_transit, 0),
+    [AK_PATH_CONGESTION_ALGORITHM_STATE] = GETSET_FIELD(picoquic_path_t, congestion_alg_state, GETSET_READ_ONLY),
+    [AK_PATH_PACKET_EVALUATION_TIME] = GETSET_FIELD(picoquic_path_t, pacing_evaluation_time, 0),
+    [AK_PATH_PACING_BUCKET_NANO_SEC] = GETSET_FIELD(picoquic_path_t, pacing_bucket_nanosec, 0),
+    [AK_PATH_PACING_BUCKET_MAX] = GETSET_FIELD(picoquic_path_t, pacing_bucket_max, 0),
+    [AK_PATH_PACING_PACKET_TIME_NANOSEC] = GETSET_FIELD(picoquic_path_t, pacing_packet_time_nanosec, 0),
+    [AK_PATH_NB_PKT_SENT] = GETSET_FIELD(picoquic_path_t, nb_pkt_sent, 0),
+    [AK_PATH_DELIVERED] = GETSET_FIELD(picoquic_path_t, delivered, GETSET_READ_ONLY),
+    [AK_PATH_DELIVERED_LIMITED_INDEX] = GETSET_FIELD(picoquic_path_t, delivered_limited_index, 0),
+    [AK_PATH_RTT_SAMPLE] = GETSET_FIELD(picoquic_path_t, rtt_sample, 0),
+    [AK_PATH_BANDWIDTH_ESTIMATE] = GETSET_FIELD(picoquic_path_t, bandwidth_estimate, GETSET_READ_ONLY),
+    [AK_PATH_DELIVERY_RATE] = GETSET_FIELD(picoquic_path_t, rate_sample.delivery_rate, GETSET_READ_ONLY),
+    [AK_PATH_DELIVERY_RATE_INTERVAL] = GETSET_FIELD(picoquic_path_t, rate_sample.interval, GETSET_READ_ONLY),
+    [AK_PATH_DELIVERY_RATE_APP_LIMITED] = GETSET_FIELD(picoquic_path_t, rate_sample.is_app_limited, GETSET_READ_ONLY),
+    [AK_PATH_ECN_ECT_ACKED] = GETSET_FIELD(picoquic_path_t, ecn_ect_acked, 0),
+    [AK_PATH_ECN_CE_ACKED] = GETSET_FIELD(picoquic_path_t, ecn_ce_acked, 0),
+    [AK_PATH_REORDER_WINDOW_MULT] = GETSET_FIELD(picoquic_path_t, reorder_window_mult, 0),
+    [AK_PATH_RECEIVE_RATE_ESTIMATE] = GETSET_FIELD(picoquic_path_t, receive_rate_estimate, GETSET_READ_ONLY),
+    [AK_PATH_OOO_BYTES_RECEIVED] = GETSET_FIELD(picoquic_path_t, ooo_bytes_received, GETSET_READ_ONLY),
+    [AK_PATH_HOL_BLOCKING_BYTES] = GETSET_FIELD(picoquic_path_t, hol_blocking_bytes, GETSET_READ_ONLY),
+};
+
+bool getset_field_layout(const void *helper, access_key_t ak, uint32_t *offset, uint8_t *width, bool *is_signed)
+{
+    const getset_field_t *f = NULL;
+
+    if (helper == (const void *) get_cnx && GETSET_FIELD_DEFINED(cnx_fields, ak)) {
+        f = &cnx_fields[ak];
+    } else if (helper == (const void *) set_cnx && GETSET_FIELD_DEFINED(cnx_fields, ak) && !(cnx_fields[ak].flags & GETSET_READ_ONLY)) {
+        f = &cnx_fields[ak];
+    } else if (helper == (const void *) get_path && GETSET_FIELD_DEFINED(path_fields, ak)) {
+        f = &path_fields[ak];
+    } else if (helper == (const void *) set_path && GETSET_FIELD_DEFINED(path_fields, ak) && !(path_fields[ak].flags & GETSET_READ_ONLY)) {
+        f = &path_fields[ak];
+    }
+    if (f == NULL) {
+        return false;
+    }
+    *offset = f->offset;
+    *width = f->width;
+    *is_signed = (f->flags & GETSET_SIGNED) != 0;
+    return true;
+}
 
 static inline protoop_arg_t get_cnx_transport_parameter(picoquic_tp_t *t, uint16_t value) {
     switch (value) {
@@ -37,9 +190,10 @@ static inline protoop_arg_t get_cnx_transport_parameter(picoquic_tp_t *t, uint16
 
 protoop_arg_t get_cnx(picoquic_cnx_t *cnx, access_key_t ak, uint16_t param)
 {
+    if (GETSET_FIELD_DEFINED(cnx_fields, ak)) {
+        return getset_load(cnx, &cnx_fields[ak]);
+    }
     switch(ak) {
-    case AK_CNX_PROPOSED_VERSION:
-        return cnx->proposed_version;
     case AK_CNX_IS_0RTT_ACCEPTED:
         return cnx->is_0RTT_accepted;
     case AK_CNX_REMOTE_PARMETERS_RECEIVED:
@@ -54,74 +208,20 @@ protoop_arg_t get_cnx(picoquic_cnx_t *cnx, access_key_t ak, uint16_t param)
         return cnx->spin_vec;
     case AK_CNX_SPIN_EDGE:
         return cnx->spin_edge;
-    case AK_CNX_SPIN_LAST_TRIGGER:
-        return cnx->spin_last_trigger;
     case AK_CNX_LOCAL_PARAMETER:
         return get_cnx_transport_parameter(&cnx->local_parameters, param);
     case AK_CNX_REMOTE_PARAMETER:
         return get_cnx_transport_parameter(&cnx->remote_parameters, param);
-    case AK_CNX_MAX_EARLY_DATA_SIZE:
-        return cnx->max_early_data_size;
-    case AK_CNX_STATE:
-        return cnx->cnx_state;
     case AK_CNX_INITIAL_CID:
+        /* The pluglet may write through the pointer */
+        picoquic_reset_cnx_header_templates(cnx);
         return (protoop_arg_t) &cnx->initial_cnxid;
-    case AK_CNX_START_TIME:
-        return cnx->start_time;
-    case AK_CNX_APPLICATION_ERROR:
-        return cnx->application_error;
-    case AK_CNX_LOCAL_ERROR:
-        return cnx->local_error;
-    case AK_CNX_REMOTE_APPLICATION_ERROR:
-        return cnx->remote_application_error;
-    case AK_CNX_REMOTE_ERROR:
-        return cnx->remote_error;
-    case AK_CNX_OFFENDING_FRAME_TYPE:
-        return cnx->offending_frame_type;
-    case AK_CNX_NEXT_WAKE_TIME:
-        return cnx->next_wake_time;
-    case AK_CNX_LATEST_PROGRESS_TIME:
-        return cnx->latest_progress_time;
-    case AK_CNX_NB_PATH_CHALLENGE_SENT:
-        return cnx->nb_path_challenge_sent;
-    case AK_CNX_NB_PATH_RESPONSE_RECEIVED:
-        return cnx->nb_path_response_received;
-    case AK_CNX_NB_ZERO_RTT_SENT:
-        return cnx->nb_zero_rtt_sent;
-    case AK_CNX_NB_ZERO_RTT_ACKED:
-        return cnx->nb_zero_rtt_acked;
-    case AK_CNX_NB_RETRANSMISSION_TOTAL:
-        return cnx->nb_retransmission_total;
-    case AK_CNX_NB_SPURIOUS:
-        return cnx->nb_spurious;
-    case AK_CNX_DATA_SENT:
-        return cnx->data_sent;
-    case AK_CNX_DATA_RECEIVED:
-        return cnx->data_received;
-    case AK_CNX_MAXDATA_LOCAL:
-        return cnx->maxdata_local;
-    case AK_CNX_MAXDATA_REMOTE:
-        return cnx->maxdata_remote;
-    case AK_CNX_MAX_STREAM_ID_BIDIR_LOCAL:
-        return cnx->max_stream_id_bidir_local;
-    case AK_CNX_MAX_STREAM_ID_UNIDIR_LOCAL:
-        return cnx->max_stream_id_unidir_local;
-    case AK_CNX_MAX_STREAM_ID_BIDIR_REMOTE:
-        return cnx->max_stream_id_bidir_remote;
-    case AK_CNX_MAX_STREAM_ID_UNIDIR_REMOTE:
-        return cnx->max_stream_id_unidir_remote;
-    case AK_CNX_KEEP_ALIVE_INTERVAL:
-        return cnx->keep_alive_interval;
-    case AK_CNX_NB_PATHS:
-        return cnx->nb_paths;
     case AK_CNX_PATH:
         if (param >= cnx->nb_paths) {
             printf("ERROR: trying to get path with index %u, but only %d paths available\n", param, cnx->nb_paths);
             return 0;
         }
         return (protoop_arg_t) cnx->path[param];
-    case AK_CNX_CONGESTION_CONTROL_ALGORITHM:
-        return (protoop_arg_t) cnx->congestion_alg;
     case AK_CNX_TLS_STREAM:
         if (param >= PICOQUIC_NUMBER_OF_EPOCHS) {
             printf("ERROR: trying to get TLS stream with epoch %u, but only %d epoch available\n", param, PICOQUIC_NUMBER_OF_EPOCHS);
@@ -146,14 +246,6 @@ protoop_arg_t get_cnx(picoquic_cnx_t *cnx, access_key_t ak, uint16_t param)
             return 0;
         }
         return cnx->protoop_outputv[param];
-    case AK_CNX_RETRY_TOKEN_LENGTH:
-        return cnx->retry_token_length;
-    case AK_CNX_RETURN_VALUE:
-        return cnx->protoop_output;
-    case AK_CNX_RESERVED_FRAMES:
-        return (protoop_arg_t) cnx->reserved_frames;
-    case AK_CNX_RETRY_FRAMES:
-        return (protoop_arg_t) cnx->retry_frames;
     case AK_CNX_RTX_FRAMES:
         if (param >= picoquic_nb_packet_context) {
             printf("ERROR: trying to get rtx_frames queue for unknown pc %d\n", param);
@@ -166,12 +258,8 @@ protoop_arg_t get_cnx(picoquic_cnx_t *cnx, access_key_t ak, uint16_t param)
         return cnx->handshake_done_sent;
     case AK_CNX_HANDSHAKE_DONE_ACKED:
         return cnx->handshake_done_acked;
-    case AK_CNX_FIRST_STREAM:
-        return (protoop_arg_t) cnx->first_stream;
     case AK_CNX_PLUGIN_REQUESTED:
         return cnx->plugin_requested;
-    case AK_CNX_PIDS_TO_REQUEST_SIZE:
-        return cnx->pids_to_request.size;
     case AK_CNX_PIDS_TO_REQUEST:
         if (param >= cnx->pids_to_request.size) {
             printf("ERROR: trying to get pid to request %u but only %d pid to requests...\n", param, cnx->pids_to_request.size);
@@ -180,6 +268,8 @@ protoop_arg_t get_cnx(picoquic_cnx_t *cnx, access_key_t ak, uint16_t param)
         return (protoop_arg_t) &cnx->pids_to_request.elems[param];
     case AK_CNX_QUIC_MTU_MAX:
         return cnx->quic->mtu_max;
+    case AK_CNX_QUIC_MAX_PACKET_SIZE:
+        return cnx->quic->max_packet_size;
     default:
         printf("ERROR: unknown cnx access key %u\n", ak);
         return 0;
@@ -233,10 +323,11 @@ static inline void set_cnx_transport_parameter(picoquic_tp_t *t, uint16_t value,
 
 void set_cnx(picoquic_cnx_t *cnx, access_key_t ak, uint16_t param, protoop_arg_t val)
 {
+    if (GETSET_FIELD_DEFINED(cnx_fields, ak) && !(cnx_fields[ak].flags & GETSET_READ_ONLY)) {
+        getset_store(cnx, &cnx_fields[ak], val);
+        return;
+    }
     switch(ak) {
-    case AK_CNX_PROPOSED_VERSION:
-        cnx->proposed_version = (uint32_t) val;
-        break;
     case AK_CNX_IS_0RTT_ACCEPTED:
         cnx->is_0RTT_accepted = (uint8_t) val;
         break;
@@ -258,96 +349,18 @@ void set_cnx(picoquic_cnx_t *cnx, access_key_t ak, uint16_t param, protoop_arg_t
     case AK_CNX_SPIN_EDGE:
         cnx->spin_edge = (uint8_t) val;
         break;
-    case AK_CNX_SPIN_LAST_TRIGGER:
-        cnx->spin_last_trigger = (uint64_t) val;
-        break;
     case AK_CNX_LOCAL_PARAMETER:
         set_cnx_transport_parameter(&cnx->local_parameters, param, val);
         break;
     case AK_CNX_REMOTE_PARAMETER:
         set_cnx_transport_parameter(&cnx->remote_parameters, param, val);
         break;
-    case AK_CNX_MAX_EARLY_DATA_SIZE:
-        cnx->max_early_data_size = (size_t) val;
-        break;
     case AK_CNX_STATE:
         picoquic_set_cnx_state(cnx, (picoquic_state_enum) val);
         break;
     case AK_CNX_INITIAL_CID:
         printf("ERROR: setting initial CID is not implemented!\n");
         break;
-    case AK_CNX_START_TIME:
-        cnx->start_time = (uint64_t) val;
-        break;
-    case AK_CNX_APPLICATION_ERROR:
-        cnx->application_error = (uint64_t) val;
-        break;
-    case AK_CNX_LOCAL_ERROR:
-        cnx->local_error = val;
-        break;
-    case AK_CNX_REMOTE_APPLICATION_ERROR:
-        cnx->remote_application_error = (uint64_t) val;
-        break;
-    case AK_CNX_REMOTE_ERROR:
-        cnx->remote_error = (uint16_t) val;
-        break;
-    case AK_CNX_OFFENDING_FRAME_TYPE:
-        cnx->offending_frame_type = (uint64_t) val;
-        break;
-    case AK_CNX_NEXT_WAKE_TIME:
-        cnx->next_wake_time = (uint64_t) val;
-        break;
-    case AK_CNX_LATEST_PROGRESS_TIME:
-        cnx->latest_progress_time = (uint64_t) val;
-        break;
-    case AK_CNX_NB_PATH_CHALLENGE_SENT:
-        cnx->nb_path_challenge_sent = (uint32_t) val;
-        break;
-    case AK_CNX_NB_PATH_RESPONSE_RECEIVED:
-        cnx->nb_path_response_received = (uint32_t) val;
-        break;
-    case AK_CNX_NB_ZERO_RTT_SENT:
-        cnx->nb_zero_rtt_sent = (uint32_t) val;
-        break;
-    case AK_CNX_NB_ZERO_RTT_ACKED:
-        cnx->nb_zero_rtt_acked = (uint32_t) val;
-        break;
-    case AK_CNX_NB_RETRANSMISSION_TOTAL:
-        cnx->nb_retransmission_total = (uint64_t) val;
-        break;
-    case AK_CNX_NB_SPURIOUS:
-        cnx->nb_spurious = (uint64_t) val;
-        break;
-    case AK_CNX_DATA_SENT:
-        cnx->data_sent = (uint64_t) val;
-        break;
-    case AK_CNX_DATA_RECEIVED:
-        cnx->data_received = (uint64_t) val;
-        break;
-    case AK_CNX_MAXDATA_LOCAL:
-        cnx->maxdata_local = (uint64_t) val;
-        break;
-    case AK_CNX_MAXDATA_REMOTE:
-        cnx->maxdata_remote = (uint64_t) val;
-        break;
-    case AK_CNX_MAX_STREAM_ID_BIDIR_LOCAL:
-        cnx->max_stream_id_bidir_local = (uint64_t) val;
-        break;
-    case AK_CNX_MAX_STREAM_ID_UNIDIR_LOCAL:
-        cnx->max_stream_id_unidir_local = (uint64_t) val;
-        break;
-    case AK_CNX_MAX_STREAM_ID_BIDIR_REMOTE:
-        cnx->max_stream_id_bidir_remote = (uint64_t) val;
-        break;
-    case AK_CNX_MAX_STREAM_ID_UNIDIR_REMOTE:
-        cnx->max_stream_id_unidir_remote = (uint64_t) val;
-        break;
-    case AK_CNX_KEEP_ALIVE_INTERVAL:
-        cnx->keep_alive_interval = (uint64_t) val;
-        break;
-    case AK_CNX_NB_PATHS:
-        cnx->nb_paths = (int) val;
-        break;
     case AK_CNX_PATH:
         if (param >= cnx->nb_paths) {
             printf("ERROR: trying to set path with index %u, but only %d paths available\n", param, cnx->nb_paths);
@@ -377,9 +390,6 @@ void set_cnx(picoquic_cnx_t *cnx, access_key_t ak, uint16_t param, protoop_arg_t
             cnx->protoop_outputc_callee++;
         }
         break;
-    case AK_CNX_RETRY_TOKEN_LENGTH:
-        cnx->retry_token_length = (uint32_t) val;
-        break;
     case AK_CNX_RETURN_VALUE:
         printf("ERROR: trying to modify return value...\n");
         break;
@@ -404,9 +414,6 @@ void set_cnx(picoquic_cnx_t *cnx, access_key_t ak, uint16_t param, protoop_arg_t
     case AK_CNX_PLUGIN_REQUESTED:
         cnx->plugin_requested = (uint8_t) val;
         break;
-    case AK_CNX_PIDS_TO_REQUEST_SIZE:
-        cnx->pids_to_request.size = (uint16_t) val;
-        break;
     case AK_CNX_PIDS_TO_REQUEST:
         printf("ERROR: trying to modify pids to request...\n");
         break;
@@ -416,6 +423,20 @@ void set_cnx(picoquic_cnx_t *cnx, access_key_t ak, uint16_t param, protoop_arg_t
     }
 }
 
+void get_cnx_fields(picoquic_cnx_t *cnx, const access_key_t *aks, const uint16_t *params, uint8_t n, protoop_arg_t *out)
+{
+    for (uint8_t i = 0; i < n; i++) {
+        out[i] = get_cnx(cnx, aks[i], params ? params[i] : 0);
+    }
+}
+
+void set_cnx_fields(picoquic_cnx_t *cnx, const access_key_t *aks, const uint16_t *params, uint8_t n, const protoop_arg_t *vals)
+{
+    for (uint8_t i = 0; i < n; i++) {
+        set_cnx(cnx, aks[i], params ? params[i] : 0, vals[i]);
+    }
+}
+
 void set_cnx_metadata(picoquic_cnx_t *cnx, int idx, protoop_arg_t val) {
     if (!cnx->current_plugin) {
         printf("ERROR: %s called outside a plugin context\n", __func__);
@@ -440,25 +461,16 @@ protoop_arg_t get_cnx_metadata(picoquic_cnx_t *cnx, int idx) {
 
 protoop_arg_t get_path(picoquic_path_t *path, access_key_t ak, uint16_t param)
 {
+    if (GETSET_FIELD_DEFINED(path_fields, ak)) {
+        return getset_load(path, &path_fields[ak]);
+    }
     switch(ak) {
     case AK_PATH_PEER_ADDR:
         return (protoop_arg_t) &path->peer_addr;
-    case AK_PATH_PEER_ADDR_LEN:
-        return path->peer_addr_len;
     case AK_PATH_LOCAL_ADDR:
         return (protoop_arg_t) &path->local_addr;
-    case AK_PATH_LOCAL_ADDR_LEN:
-        return path->local_addr_len;
-    case AK_PATH_IF_INDEX_LOCAL:
-        return path->if_index_local;
-    case AK_PATH_CHALLENGE:
-        return path->challenge;
-    case AK_PATH_CHALLENGE_TIME:
-        return path->challenge_time;
     case AK_PATH_CHALLENGE_RESPONSE:
         return (protoop_arg_t) path->challenge_response;
-    case AK_PATH_CHALLENGE_REPEAT_COUNT:
-        return path->challenge_repeat_count;
     case AK_PATH_MTU_PROBE_SENT:
         return path->mtu_probe_sent;
     case AK_PATH_CHALLENGE_VERIFIED:
@@ -467,45 +479,14 @@ protoop_arg_t get_path(picoquic_path_t *path, access_key_t ak, uint16_t param)
         return path->challenge_response_to_send;
     case AK_PATH_PING_RECEIVED:
         return path->ping_received;
-    case AK_PATH_MAX_ACK_DELAY:
-        return path->max_ack_delay;
-    case AK_PATH_SMOOTHED_RTT:
-        return path->smoothed_rtt;
-    case AK_PATH_RTT_VARIANT:
-        return path->rtt_variant;
-    case AK_PATH_RETRANSMIT_TIMER:
-        return path->retransmit_timer;
-    case AK_PATH_RTT_MIN:
-        return path->rtt_min;
-    case AK_PATH_MAX_SPURIOUS_RTT:
-        return path->max_spurious_rtt;
-    case AK_PATH_MAX_REORDER_DELAY:
-        return path->max_reorder_delay;
-    case AK_PATH_MAX_REORDER_GAP:
-        return path->max_reorder_gap;
-    case AK_PATH_SEND_MTU:
-        return path->send_mtu;
-    case AK_PATH_SEND_MTU_MAX_TRIED:
-        return path->send_mtu_max_tried;
-    case AK_PATH_CWIN:
-        return path->cwin;
-    case AK_PATH_BYTES_IN_TRANSIT:
-        return path->bytes_in_transit;
-    case AK_PATH_CONGESTION_ALGORITHM_STATE:
-        return (protoop_arg_t) path->congestion_alg_state;
-    case AK_PATH_PACKET_EVALUATION_TIME:
-        return path->pacing_evaluation_time;
-    case AK_PATH_PACING_BUCKET_NANO_SEC:
-        return path->pacing_bucket_nanosec;
-    case AK_PATH_PACING_BUCKET_MAX:
-        return path->pacing_bucket_max;
-    case AK_PATH_PACING_PACKET_TIME_NANOSEC:
-        return path->pacing_packet_time_nanosec;
     case AK_PATH_PACING_PACKET_TIME_MICROSEC:
         return path->pacing_packet_time_nanosec;
     case AK_PATH_LOCAL_CID:
+        /* The pluglet may write through the pointer */
+        picoquic_reset_header_templates(path);
         return (protoop_arg_t) &path->local_cnxid;
     case AK_PATH_REMOTE_CID:
+        picoquic_reset_header_templates(path);
         return (protoop_arg_t) &path->remote_cnxid;
     case AK_PATH_RESET_SECRET:
         return (protoop_arg_t) &path->reset_secret;
@@ -515,18 +496,8 @@ protoop_arg_t get_path(picoquic_path_t *path, access_key_t ak, uint16_t param)
             return 0;
         }
         return (protoop_arg_t) &path->pkt_ctx[param];
-    case AK_PATH_NB_PKT_SENT:
-        return path->nb_pkt_sent;
-    case AK_PATH_DELIVERED:
-        return path->delivered;
     case AK_PATH_DELIVERED_PRIOR:
         return path->delivered;
-    case AK_PATH_DELIVERED_LIMITED_INDEX:
-        return path->delivered_limited_index;
-    case AK_PATH_RTT_SAMPLE:
-        return path->rtt_sample;
-    case AK_PATH_BANDWIDTH_ESTIMATE:
-        return path->bandwidth_estimate;
     default:
         printf("ERROR: unknown path access key %u\n", ak);
         return 0;
@@ -535,34 +506,20 @@ protoop_arg_t get_path(picoquic_path_t *path, access_key_t ak, uint16_t param)
 
 void set_path(picoquic_path_t *path, access_key_t ak, uint16_t param, protoop_arg_t val)
 {
+    if (GETSET_FIELD_DEFINED(path_fields, ak) && !(path_fields[ak].flags & GETSET_READ_ONLY)) {
+        getset_store(path, &path_fields[ak], val);
+        return;
+    }
     switch(ak) {
     case AK_PATH_PEER_ADDR:
         printf("ERROR: setting the peer addr is not implemented!\n");
         break;
-    case AK_PATH_PEER_ADDR_LEN:
-        path->peer_addr_len = (int) val;
-        break;
     case AK_PATH_LOCAL_ADDR:
         printf("ERROR: setting the local addr is not implemented!\n");
         break;
-    case AK_PATH_LOCAL_ADDR_LEN:
-        path->local_addr_len = (int) val;
-        break;
-    case AK_PATH_IF_INDEX_LOCAL:
-        path->if_index_local = (int) val;
-        break;
-    case AK_PATH_CHALLENGE:
-        path->challenge = val;
-        break;
-    case AK_PATH_CHALLENGE_TIME:
-        path->challenge_time =val;
-        break;
     case AK_PATH_CHALLENGE_RESPONSE:
         printf("ERROR: setting the challenge response is not implemented!\n");
         break;
-    case AK_PATH_CHALLENGE_REPEAT_COUNT:
-        path->challenge_repeat_count = (uint8_t) val;
-        break;
     case AK_PATH_MTU_PROBE_SENT:
         path->mtu_probe_sent = val;
         break;
@@ -575,57 +532,9 @@ void set_path(picoquic_path_t *path, access_key_t ak, uint16_t param, protoop_ar
     case AK_PATH_PING_RECEIVED:
         path->ping_received = val;
         break;
-    case AK_PATH_MAX_ACK_DELAY:
-        path->max_ack_delay = val;
-        break;
-    case AK_PATH_SMOOTHED_RTT:
-        path->smoothed_rtt = val;
-        break;
-    case AK_PATH_RTT_VARIANT:
-        path->rtt_variant = val;
-        break;
-    case AK_PATH_RETRANSMIT_TIMER:
-        path->retransmit_timer = val;
-        break;
-    case AK_PATH_RTT_MIN:
-        path->rtt_min = val;
-        break;
-    case AK_PATH_MAX_SPURIOUS_RTT:
-        path->max_spurious_rtt = val;
-        break;
-    case AK_PATH_MAX_REORDER_DELAY:
-        path->max_reorder_delay = val;
-        break;
-    case AK_PATH_MAX_REORDER_GAP:
-        path->max_reorder_gap = val;
-        break;
-    case AK_PATH_SEND_MTU:
-        path->send_mtu = val;
-        break;
-    case AK_PATH_SEND_MTU_MAX_TRIED:
-        path->send_mtu_max_tried = val;
-        break;
-    case AK_PATH_CWIN:
-        path->cwin = val;
-        break;
-    case AK_PATH_BYTES_IN_TRANSIT:
-        path->bytes_in_transit = val;
-        break;
     case AK_PATH_CONGESTION_ALGORITHM_STATE:
         printf("ERROR: setting the congestion algorithm state is not implemented!\n");
         break;
-    case AK_PATH_PACKET_EVALUATION_TIME:
-        path->pacing_evaluation_time = val;
-        break;
-    case AK_PATH_PACING_BUCKET_NANO_SEC:
-        path->pacing_bucket_nanosec = val;
-        break;
-    case AK_PATH_PACING_BUCKET_MAX:
-        path->pacing_bucket_max = val;
-        break;
-    case AK_PATH_PACING_PACKET_TIME_NANOSEC:
-        path->pacing_packet_time_nanosec = val;
-        break;
     case AK_PATH_PACING_PACKET_TIME_MICROSEC:
         path->pacing_packet_time_nanosec = val;
         break;
@@ -641,21 +550,26 @@ void set_path(picoquic_path_t *path, access_key_t ak, uint16_t param, protoop_ar
     case AK_PATH_PKT_CTX:
         printf("ERROR: setting the pkt ctx is not implemented!\n");
         break;
-    case AK_PATH_NB_PKT_SENT:
-        path->nb_pkt_sent = val;
-        break;
-    case AK_PATH_DELIVERED_LIMITED_INDEX:
-        path->delivered_limited_index = val;
-        break;
-    case AK_PATH_RTT_SAMPLE:
-        path->rtt_sample = val;
-        break;
     default:
         printf("ERROR: unknown path access key %u\n", ak);
         break;
     }
 }
 
+void get_path_fields(picoquic_path_t *path, const access_key_t *aks, const uint16_t *params, uint8_t n, protoop_arg_t *out)
+{
+    for (uint8_t i = 0; i < n; i++) {
+        out[i] = get_path(path, aks[i], params ? params[i] : 0);
+    }
+}
+
+void set_path_fields(picoquic_path_t *path, const access_key_t *aks, const uint16_t *params, uint8_t n, const protoop_arg_t *vals)
+{
+    for (uint8_t i = 0; i < n; i++) {
+        set_path(path, aks[i], params ? params[i] : 0, vals[i]);
+    }
+}
+
 void set_path_metadata(picoquic_cnx_t *cnx, picoquic_path_t *path, int idx, protoop_arg_t val) {
     if (!cnx->current_plugin) {
         printf("ERROR: %s called outside a plugin context\n", __func__);
@@ -707,7 +621,9 @@ protoop_arg_t get_pkt_ctx(picoquic_packet_context_t *pkt_ctx, access_key_t ak)
     case AK_PKTCTX_SEND_SEQUENCE:
         return pkt_ctx->send_sequence;
     case AK_PKTCTX_FIRST_SACK_ITEM:
-        return (protoop_arg_t) &pkt_ctx->first_sack_item;
+        return (protoop_arg_t) picoquic_sack_list_first(&pkt_ctx->sack_list);
+    case AK_PKTCTX_SACK_LIST:
+        return (protoop_arg_t) &pkt_ctx->sack_list;
     case AK_PKTCTX_TIME_STAMP_LARGEST_RECEIVED:
         return pkt_ctx->time_stamp_largest_received;
     case AK_PKTCTX_HIGHEST_ACK_SENT:
@@ -738,6 +654,8 @@ protoop_arg_t get_pkt_ctx(picoquic_packet_context_t *pkt_ctx, access_key_t ak)
         return pkt_ctx->ack_needed;
     case AK_PKTCTX_LATEST_PROGRESS_TIME:
         return pkt_ctx->latest_progress_time;
+    case AK_PKTCTX_LATEST_ACK_ELICITING_TIME:
+        return pkt_ctx->latest_ack_eliciting_time;
     default:
         printf("ERROR: unknown pkt ctx access key %u\n", ak);
         return 0;
@@ -753,6 +671,9 @@ void set_pkt_ctx(picoquic_packet_context_t *pkt_ctx, access_key_t ak, protoop_ar
     case AK_PKTCTX_FIRST_SACK_ITEM:
         printf("ERROR: setting the first sack item is not implemented!\n");
         break;
+    case AK_PKTCTX_SACK_LIST:
+        printf("ERROR: setting the sack list is not implemented!\n");
+        break;
     case AK_PKTCTX_TIME_STAMP_LARGEST_RECEIVED:
         pkt_ctx->time_stamp_largest_received = val;
         break;
@@ -795,6 +716,9 @@ void set_pkt_ctx(picoquic_packet_context_t *pkt_ctx, access_key_t ak, protoop_ar
     case AK_PKTCTX_ACK_NEEDED:
         pkt_ctx->ack_needed = val;
         break;
+    case AK_PKTCTX_LATEST_ACK_ELICITING_TIME:
+        pkt_ctx->latest_ack_eliciting_time = val;
+        break;
     default:
         printf("ERROR: unknown pkt ctx access key %u\n", ak);
         break;
@@ -872,6 +796,13 @@ protoop_arg_t get_pkt(picoquic_packet_t *pkt, access_key_t ak)
     }
 }
 
+void get_pkt_fields(picoquic_packet_t *pkt, const access_key_t *aks, uint8_t n, protoop_arg_t *out)
+{
+    for (uint8_t i = 0; i < n; i++) {
+        out[i] = get_pkt(pkt, aks[i]);
+    }
+}
+
 void set_pkt(picoquic_packet_t *pkt, access_key_t ak, protoop_arg_t val)
 {
     switch(ak) {
@@ -942,7 +873,8 @@ protoop_arg_t get_sack_item(picoquic_sack_item_t *sack_item, access_key_t ak)
 {
     switch(ak) {
     case AK_SACKITEM_NEXT_SACK:
-        return (protoop_arg_t) sack_item->next_sack;
+        /* The last range is followed by an unused item */
+        return (protoop_arg_t) ((sack_item[1].start_of_sack_range != (uint64_t)((int64_t)-1)) ? &sack_item[1] : NULL);
     case AK_SACKITEM_START_RANGE:
         return sack_item->start_of_sack_range;
     case AK_SACKITEM_END_RANGE:
@@ -1042,6 +974,8 @@ protoop_arg_t get_stream_head(picoquic_stream_head *stream_head, access_key_t ak
         return stream_head->stop_sending_signalled;
     case AK_STREAMHEAD_FLAGS_MAX_STREAM_UPDATED:
         return stream_head->max_stream_updated;
+    case AK_STREAMHEAD_FLAGS_REDUNDANT:
+        return stream_head->is_redundant;
     default:
         printf("ERROR: unknown stream head access key %u\n", ak);
         return 0;
@@ -1096,6 +1030,9 @@ void set_stream_head(picoquic_stream_head *stream_head, access_key_t ak, protoop
     case AK_STREAMHEAD_FLAGS_MAX_STREAM_UPDATED:
         stream_head->max_stream_updated = val;
         break;
+    case AK_STREAMHEAD_FLAGS_REDUNDANT:
+        stream_head->is_redundant = val;
+        break;
     default:
         printf("ERROR: unknown stream head access key %u\n", ak);
         break;
@@ -37,6 +37,28 @@ protoop_arg_t get_cnx(picoquic_cnx_t *cnx, access_key_t ak, uint16_t param);
  */
 void set_cnx(picoquic_cnx_t *cnx, access_key_t ak, uint16_t param, protoop_arg_t val);
 
+/**
+ * Get \p n fields belonging to the connection context \p cnx in a single call
+ *
+ * \param cnx The connection context
+ * \param aks The keys of the fields to get
+ * \param params The parameters of the keys, or NULL if they are all 0
+ * \param n The number of fields to get
+ * \param out The array receiving the \p n values, in the order of \p aks
+ */
+void get_cnx_fields(picoquic_cnx_t *cnx, const access_key_t *aks, const uint16_t *params, uint8_t n, protoop_arg_t *out);
+
+/**
+ * Set \p n fields belonging to the connection context \p cnx in a single call
+ *
+ * \param cnx The connection context
+ * \param aks The keys of the fields to set
+ * \param params The parameters of the keys, or NULL if they are all 0
+ * \param n The number of fields to set
+ * \param vals The \p n values to set, in the order of \p aks
+ */
+void set_cnx_fields(picoquic_cnx_t *cnx, const access_key_t *aks, const uint16_t *params, uint8_t n, const protoop_arg_t *vals);
+
 /**
  * Set the plugin-specific metadata of this connection context \p cnx at index \p idx` to \p val
  *
@@ -79,6 +101,28 @@ protoop_arg_t get_path(picoquic_path_t *path, access_key_t ak, uint16_t param);
  */
 void set_path(picoquic_path_t *path, access_key_t ak, uint16_t param, protoop_arg_t val);
 
+/**
+ * Get \p n fields belonging to the path \p path in a single call
+ *
+ * \param path The path structure pointer
+ * \param aks The keys of the fields to get
+ * \param params The parameters of the keys, or NULL if they are all 0
+ * \param n The number of fields to get
+ * \param out The array receiving the \p n values, in the order of \p aks
+ */
+void get_path_fields(picoquic_path_t *path, const access_key_t *aks, const uint16_t *params, uint8_t n, protoop_arg_t *out);
+
+/**
+ * Set \p n fields belonging to the path \p path in a single call
+ *
+ * \param path The path structure pointer
+ * \param aks The keys of the fields to set
+ * \param params The parameters of the keys, or NULL if they are all 0
+ * \param n The number of fields to set
+ * \param vals The \p n values to set, in the order of \p aks
+ */
+void set_path_fields(picoquic_path_t *path, const access_key_t *aks, const uint16_t *params, uint8_t n, const protoop_arg_t *vals);
+
 /**
  * Set the plugin-specific metadata of this path at index \p idx to \p val
  * 
@@ -150,6 +194,16 @@ void set_pkt_ctx(picoquic_packet_context_t *pkt_ctx, access_key_t ak, protoop_ar
  */
 protoop_arg_t get_pkt(picoquic_packet_t *pkt, access_key_t ak);
 
+/**
+ * Get \p n fields belonging to the packet \p pkt in a single call
+ *
+ * \param pkt The pointer to the packet
+ * \param aks The keys of the fields to get
+ * \param n The number of fields to get
+ * \param out The array receiving the \p n values, in the order of \p aks
+ */
+void get_pkt_fields(picoquic_packet_t *pkt, const access_key_t *aks, uint8_t n, protoop_arg_t *out);
+
 /**
  * Set a specific field belonging to the packet \p pkt to the value \p val
  * 
@@ -305,6 +359,20 @@ protoop_arg_t get_preq(plugin_req_pid_t *preq, access_key_t ak);
  */
 void set_preq(plugin_req_pid_t *preq, access_key_t ak, protoop_arg_t val);
 
+/**
+ * Tells where the getter or setter \p helper accesses the field of key \p ak, when the field is a
+ * plain member of the structure, so that the pluglet loaders can access it without calling \p helper.
+ *
+ * \param helper One of get_cnx, set_cnx, get_path or set_path
+ * \param ak The key of the field
+ * \param offset Receives the offset of the field in the structure
+ * \param width Receives the size of the field, 1, 2, 4 or 8
+ * \param is_signed Receives whether the getter sign-extends the field
+ *
+ * \return true if the field is found, false if the helper has specific code for the key
+ */
+bool getset_field_layout(const void *helper, access_key_t ak, uint32_t *offset, uint8_t *width, bool *is_signed);
+
 
 /**
  * @}
@@ -453,6 +521,8 @@ void set_preq(plugin_req_pid_t *preq, access_key_t ak, protoop_arg_t val);
 #define AK_CNX_READY_NOTIFIED 0x40
 /**/
 #define AK_CNX_QUIC_MTU_MAX 0x41
+/** The largest packet of the QUIC context, see picoquic_set_max_packet_size() */
+#define AK_CNX_QUIC_MAX_PACKET_SIZE 0x42
 
 /**
  * @}
@@ -540,6 +610,24 @@ void set_preq(plugin_req_pid_t *preq, access_key_t ak, protoop_arg_t val);
 #define AK_PATH_RTT_SAMPLE 0x26
 #define AK_PATH_DELIVERED_PRIOR 0x27
 #define AK_PATH_BANDWIDTH_ESTIMATE 0x28
+/** The delivery rate of the last rate sample, in bytes per second */
+#define AK_PATH_DELIVERY_RATE 0x29
+/** The interval of the last rate sample, in microseconds */
+#define AK_PATH_DELIVERY_RATE_INTERVAL 0x2a
+/** Whether the last rate sample was app limited */
+#define AK_PATH_DELIVERY_RATE_APP_LIMITED 0x2b
+/** The number of packets the peer reported received with ECT(0), ECT(1) or CE, in uint64_t */
+#define AK_PATH_ECN_ECT_ACKED 0x2c
+/** The number of packets the peer reported received with CE, in uint64_t */
+#define AK_PATH_ECN_CE_ACKED 0x2d
+/** The number of 1/8 of RTT added to the 9/8 RTT loss time threshold, in uint64_t */
+#define AK_PATH_REORDER_WINDOW_MULT 0x2e
+/** The receive rate measured on the path, in bytes per second */
+#define AK_PATH_RECEIVE_RATE_ESTIMATE 0x2f
+/** The number of stream bytes received on the path beyond the next expected offset, in uint64_t */
+#define AK_PATH_OOO_BYTES_RECEIVED 0x30
+/** The number of buffered stream bytes that were waiting for bytes received on the path, in uint64_t */
+#define AK_PATH_HOL_BLOCKING_BYTES 0x31
 /**
  * @}
  * 
@@ -584,6 +672,10 @@ void set_preq(plugin_req_pid_t *preq, access_key_t ak, protoop_arg_t val);
 #define AK_PKTCTX_LATEST_RETRANSMIT_CC_NOTIFICATION_TIME 0x0f
 /** The latest time at which progress was observed (e.g. an ack was received) */
 #define AK_PKTCTX_LATEST_PROGRESS_TIME 0x10
+/** Pointer to the sack list, as given to the process_ack_of_ack_range operation */
+#define AK_PKTCTX_SACK_LIST 0x11
+/** The time at which the last ack-eliciting packet was sent, from which the probe timer runs */
+#define AK_PKTCTX_LATEST_ACK_ELICITING_TIME 0x12
 
 /**
  * @}
@@ -703,6 +795,7 @@ void set_preq(plugin_req_pid_t *preq, access_key_t ak, protoop_arg_t val);
 #define AK_STREAMHEAD_FLAGS_STOP_SENDING_RECEIVED 0x13
 #define AK_STREAMHEAD_FLAGS_STOP_SENDING_SIGNALLED 0x14
 #define AK_STREAMHEAD_FLAGS_MAX_STREAM_UPDATED 0x15
+#define AK_STREAMHEAD_FLAGS_REDUNDANT 0x16
 
 /**
  * @}
@@ -0,0 +1,230 @@
+#include <string.h>
+#include <pthread.h>
+#include "gf256_region.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GF256_REGION_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define GF256_REGION_NEON
+#endif
+
+/* For each coefficient, its products with the 16 low nibbles and the 16 high nibbles.
+ * coef * x = lo[coef][x & 0x0f] ^ hi[coef][x >> 4], which the vector kernels do with byte shuffles. */
+static uint8_t gf256_nibble_lo[256][16];
+static uint8_t gf256_nibble_hi[256][16];
+
+/* Processes the longest prefix of the region it can, returns its length */
+typedef size_t (*gf256_region_kernel_t)(uint8_t *dst, const uint8_t *src, const uint8_t *lo, const uint8_t *hi, size_t len, int add);
+
+/* XORs the longest prefix of the region it can, returns its length */
+typedef size_t (*gf256_region_xor_kernel_t)(uint8_t *dst, const uint8_t *src, size_t len);
+
+static gf256_region_kernel_t gf256_region_kernel = NULL;
+static gf256_region_xor_kernel_t gf256_region_xor_kernel = NULL;
+static pthread_once_t gf256_region_once = PTHREAD_ONCE_INIT;
+
+static uint8_t gf256_mul_formula(uint8_t a, uint8_t b)
+{
+    uint8_t p = 0;
+    for (int i = 0; i < 8; i++) {
+        if (b & 1) {
+            p ^= a;
+        }
+        b >>= 1;
+        a = (a & 0x80) ? (uint8_t)((a << 1) ^ 0x1d) : (uint8_t)(a << 1);
+    }
+    return p;
+}
+
+static size_t gf256_region_scalar(uint8_t *dst, const uint8_t *src, const uint8_t *lo, const uint8_t *hi, size_t len, int add)
+{
+    for (size_t i = 0; i < len; i++) {
+        uint8_t p = lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+        dst[i] = add ? dst[i] ^ p : p;
+    }
+    return len;
+}
+
+/* Word by word, with memcpy as the symbols are not aligned */
+static size_t gf256_region_xor_words(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t d;
+        uint64_t s;
+        memcpy(&d, dst + i, 8);
+        memcpy(&s, src + i, 8);
+        d ^= s;
+        memcpy(dst + i, &d, 8);
+    }
+    return i;
+}
+
+#ifdef GF256_REGION_X86
+__attribute__((target("sse2")))
+static size_t gf256_region_xor_sse2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i p = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (src + i)), _mm_loadu_si128((const __m128i *) (dst + i)));
+        _mm_storeu_si128((__m128i *) (dst + i), p);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t gf256_region_xor_avx2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i p = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (src + i)), _mm256_loadu_si256((const __m256i *) (dst + i)));
+        _mm256_storeu_si256((__m256i *) (dst + i), p);
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t gf256_region_ssse3(uint8_t *dst, const uint8_t *src, const uint8_t *lo, const uint8_t *hi, size_t len, int add)
+{
+    __m128i tlo = _mm_loadu_si128((const __m128i *) lo);
+    __m128i thi = _mm_loadu_si128((const __m128i *) hi);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(s, mask)),
+            _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+        if (add) {
+            p = _mm_xor_si128(p, _mm_loadu_si128((const __m128i *) (dst + i)));
+        }
+        _mm_storeu_si128((__m128i *) (dst + i), p);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t gf256_region_avx2(uint8_t *dst, const uint8_t *src, const uint8_t *lo, const uint8_t *hi, size_t len, int add)
+{
+    __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) lo));
+    __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) hi));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(s, mask)),
+            _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+        if (add) {
+            p = _mm256_xor_si256(p, _mm256_loadu_si256((const __m256i *) (dst + i)));
+        }
+        _mm256_storeu_si256((__m256i *) (dst + i), p);
+    }
+    return i;
+}
+#endif
+
+#ifdef GF256_REGION_NEON
+static size_t gf256_region_neon(uint8_t *dst, const uint8_t *src, const uint8_t *lo, const uint8_t *hi, size_t len, int add)
+{
+    uint8x16_t tlo = vld1q_u8(lo);
+    uint8x16_t thi = vld1q_u8(hi);
+    uint8x16_t mask = vdupq_n_u8(0x0f);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t s = vld1q_u8(src + i);
+        uint8x16_t p = veorq_u8(vqtbl1q_u8(tlo, vandq_u8(s, mask)), vqtbl1q_u8(thi, vshrq_n_u8(s, 4)));
+        if (add) {
+            p = veorq_u8(p, vld1q_u8(dst + i));
+        }
+        vst1q_u8(dst + i, p);
+    }
+    return i;
+}
+
+static size_t gf256_region_xor_neon(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(src + i), vld1q_u8(dst + i)));
+    }
+    return i;
+}
+#endif
+
+static void gf256_region_init()
+{
+    for (int c = 0; c < 256; c++) {
+        for (int x = 0; x < 16; x++) {
+            gf256_nibble_lo[c][x] = gf256_mul_formula((uint8_t) c, (uint8_t) x);
+            gf256_nibble_hi[c][x] = gf256_mul_formula((uint8_t) c, (uint8_t) (x << 4));
+        }
+    }
+
+    gf256_region_kernel = gf256_region_scalar;
+    gf256_region_xor_kernel = gf256_region_xor_words;
+#if defined(GF256_REGION_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        gf256_region_kernel = gf256_region_avx2;
+        gf256_region_xor_kernel = gf256_region_xor_avx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        gf256_region_kernel = gf256_region_ssse3;
+        gf256_region_xor_kernel = gf256_region_xor_sse2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        gf256_region_xor_kernel = gf256_region_xor_sse2;
+    }
+#elif defined(GF256_REGION_NEON)
+    gf256_region_kernel = gf256_region_neon;
+    gf256_region_xor_kernel = gf256_region_xor_neon;
+#endif
+}
+
+static void gf256_region_apply(uint8_t *dst, const uint8_t *src, uint8_t coef, size_t len, int add)
+{
+    size_t done;
+
+    pthread_once(&gf256_region_once, gf256_region_init);
+    done = gf256_region_kernel(dst, src, gf256_nibble_lo[coef], gf256_nibble_hi[coef], len, add);
+    if (done < len) {
+        gf256_region_scalar(dst + done, src + done, gf256_nibble_lo[coef], gf256_nibble_hi[coef], len - done, add);
+    }
+}
+
+void gf256_region_xor(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t done;
+
+    pthread_once(&gf256_region_once, gf256_region_init);
+    done = gf256_region_xor_kernel(dst, src, len);
+    for (size_t i = done; i < len; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
+void gf256_region_mul_add(uint8_t *dst, const uint8_t *src, uint8_t coef, size_t len)
+{
+    if (coef == 0) {
+        return;
+    } else if (coef == 1) {
+        gf256_region_xor(dst, src, len);
+    } else {
+        gf256_region_apply(dst, src, coef, len, 1);
+    }
+}
+
+void gf256_region_mul(uint8_t *dst, uint8_t coef, size_t len)
+{
+    if (coef == 0) {
+        memset(dst, 0, len);
+    } else if (coef != 1) {
+        gf256_region_apply(dst, dst, coef, len, 0);
+    }
+}
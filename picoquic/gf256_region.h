@@ -0,0 +1,22 @@
+#ifndef PICOQUIC_GF256_REGION_H
+#define PICOQUIC_GF256_REGION_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Native region operations over GF(2^8), with the 0x11d reduction polynomial of the RLC FEC scheme.
+ * They multiply 16 or 32 bytes per instruction with the split nibble tables when SSSE3, AVX2 or NEON
+ * are available, and one byte at a time otherwise. Registered as helpers for the FEC pluglets.
+ */
+
+/* dst[i] ^= src[i], for i < len. Pluglets reach it through gf256_region_mul_add with coef 1 */
+void gf256_region_xor(uint8_t *dst, const uint8_t *src, size_t len);
+
+/* dst[i] ^= coef * src[i], for i < len */
+void gf256_region_mul_add(uint8_t *dst, const uint8_t *src, uint8_t coef, size_t len);
+
+/* dst[i] = coef * dst[i], for i < len */
+void gf256_region_mul(uint8_t *dst, uint8_t coef, size_t len);
+
+#endif /* PICOQUIC_GF256_REGION_H */
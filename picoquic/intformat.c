@@ -126,6 +126,40 @@ size_t picoquic_varint_decode(const uint8_t* bytes, size_t max_bytes, uint64_t*
     return length;
 }
 
+/*
+ * As long as 8 bytes remain, a varint is read as a big endian 64 bits word,
+ * of which the length bits select the shift and the mask, without looping over its bytes.
+ */
+size_t picoquic_varint_decode_n(const uint8_t* bytes, size_t max_bytes, uint64_t* values, size_t nb_values)
+{
+    size_t byte_index = 0;
+    size_t i = 0;
+
+    while (i < nb_values && byte_index + 8 <= max_bytes) {
+        const uint8_t* x = bytes + byte_index;
+        unsigned int length_bits = x[0] >> 6;
+        size_t length = ((size_t)1) << length_bits;
+        uint64_t v = ((uint64_t)x[0] << 56) | ((uint64_t)x[1] << 48) | ((uint64_t)x[2] << 40) | ((uint64_t)x[3] << 32) |
+            ((uint64_t)x[4] << 24) | ((uint64_t)x[5] << 16) | ((uint64_t)x[6] << 8) | (uint64_t)x[7];
+
+        values[i++] = (v >> (64 - 8 * length)) & (UINT64_MAX >> (66 - 8 * length));
+        byte_index += length;
+    }
+
+    while (i < nb_values) {
+        size_t length = (byte_index < max_bytes) ?
+            picoquic_varint_decode(bytes + byte_index, max_bytes - byte_index, &values[i]) : 0;
+
+        if (length == 0) {
+            return 0;
+        }
+        byte_index += length;
+        i++;
+    }
+
+    return byte_index;
+}
+
 size_t picoquic_varint_skip(uint8_t* bytes)
 {
     size_t length = ((size_t)1) << ((bytes[0] & 0xC0) >> 6);
@@ -0,0 +1,208 @@
+#include "picoquic_internal.h"
+#include "cc_common.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Delay based congestion control, following LEDBAT++ (draft-irtf-iccrg-ledbat-plus-plus).
+ * The queuing delay is the minimum of the recent RTT samples, kept by the min-max filter,
+ * minus the path rtt_min. Below the target the window grows as in New Reno, but slower when
+ * the base delay is short; above it the window shrinks in proportion of the excess, so the
+ * bottleneck queue stays near the target instead of filling up until packets are lost.
+ */
+
+#define PICOQUIC_LEDBAT_TARGET_DELAY 60000 /* Microseconds */
+#define PICOQUIC_LEDBAT_GAIN_DIVISOR_MAX 16
+
+typedef enum {
+    picoquic_ledbat_alg_slow_start = 0,
+    picoquic_ledbat_alg_congestion_avoidance
+} picoquic_ledbat_alg_state_t;
+
+typedef struct st_picoquic_ledbat_state_t {
+    picoquic_ledbat_alg_state_t alg_state;
+    uint64_t residual_ack;
+    uint64_t ssthresh;
+    uint64_t recovery_start;
+    uint64_t last_sequence_blocked;
+    picoquic_min_max_rtt_t rtt_filter;
+} picoquic_ledbat_state_t;
+
+void picoquic_ledbat_init(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
+{
+    /* Initialize the state of the congestion control algorithm */
+    picoquic_ledbat_state_t* ledbat_state = (picoquic_ledbat_state_t*)malloc(sizeof(picoquic_ledbat_state_t));
+
+    if (ledbat_state != NULL) {
+        memset(ledbat_state, 0, sizeof(picoquic_ledbat_state_t));
+        path_x->congestion_alg_state = (void*)ledbat_state;
+        ledbat_state->alg_state = picoquic_ledbat_alg_slow_start;
+        ledbat_state->ssthresh = (uint64_t)((int64_t)-1);
+        path_x->cwin = PICOQUIC_CWIN_INITIAL;
+    }
+}
+
+/* Queuing delay measured by the recent samples, zero until there is one */
+static uint64_t picoquic_ledbat_queuing_delay(picoquic_ledbat_state_t* ledbat_state, picoquic_path_t* path_x)
+{
+    uint64_t queuing_delay = 0;
+
+    if ((ledbat_state->rtt_filter.is_init || ledbat_state->rtt_filter.sample_current > 0) &&
+        ledbat_state->rtt_filter.sample_min > path_x->rtt_min) {
+        queuing_delay = ledbat_state->rtt_filter.sample_min - path_x->rtt_min;
+    }
+
+    return queuing_delay;
+}
+
+/* The window grows by 1/divisor packet per RTT, the divisor being larger when the base delay is short */
+static uint64_t picoquic_ledbat_gain_divisor(picoquic_path_t* path_x)
+{
+    uint64_t divisor = PICOQUIC_LEDBAT_GAIN_DIVISOR_MAX;
+
+    if (path_x->rtt_min > 0) {
+        divisor = (2 * PICOQUIC_LEDBAT_TARGET_DELAY + path_x->rtt_min - 1) / path_x->rtt_min;
+        if (divisor > PICOQUIC_LEDBAT_GAIN_DIVISOR_MAX) {
+            divisor = PICOQUIC_LEDBAT_GAIN_DIVISOR_MAX;
+        } else if (divisor == 0) {
+            divisor = 1;
+        }
+    }
+
+    return divisor;
+}
+
+static void picoquic_ledbat_enter_recovery(picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    picoquic_ledbat_state_t* ledbat_state,
+    uint64_t current_time)
+{
+    ledbat_state->ssthresh = path_x->cwin / 2;
+    if (ledbat_state->ssthresh < PICOQUIC_CWIN_MINIMUM) {
+        ledbat_state->ssthresh = PICOQUIC_CWIN_MINIMUM;
+    }
+
+    if (notification == picoquic_congestion_notification_timeout) {
+        path_x->cwin = PICOQUIC_CWIN_MINIMUM;
+        ledbat_state->alg_state = picoquic_ledbat_alg_slow_start;
+    } else {
+        path_x->cwin = ledbat_state->ssthresh;
+        ledbat_state->alg_state = picoquic_ledbat_alg_congestion_avoidance;
+    }
+
+    ledbat_state->recovery_start = current_time;
+    ledbat_state->residual_ack = 0;
+}
+
+static void picoquic_ledbat_acknowledgement(picoquic_path_t* path_x, picoquic_ledbat_state_t* ledbat_state,
+    uint64_t nb_bytes_acknowledged)
+{
+    uint64_t queuing_delay = picoquic_ledbat_queuing_delay(ledbat_state, path_x);
+    uint64_t divisor = picoquic_ledbat_gain_divisor(path_x);
+
+    if (queuing_delay > PICOQUIC_LEDBAT_TARGET_DELAY) {
+        /* Shrink by the excess over the target, at most by half of the acknowledged bytes */
+        uint64_t decrease = nb_bytes_acknowledged * (queuing_delay - PICOQUIC_LEDBAT_TARGET_DELAY) / PICOQUIC_LEDBAT_TARGET_DELAY;
+
+        if (decrease > nb_bytes_acknowledged / 2) {
+            decrease = nb_bytes_acknowledged / 2;
+        }
+        if (path_x->cwin > PICOQUIC_CWIN_MINIMUM + decrease) {
+            path_x->cwin -= decrease;
+        } else {
+            path_x->cwin = PICOQUIC_CWIN_MINIMUM;
+        }
+        if (ledbat_state->alg_state == picoquic_ledbat_alg_slow_start) {
+            ledbat_state->ssthresh = path_x->cwin;
+            ledbat_state->alg_state = picoquic_ledbat_alg_congestion_avoidance;
+        }
+    } else if (picoquic_cc_was_cwin_blocked(path_x, ledbat_state->last_sequence_blocked)) {
+        /* Only increase when the app is CWIN limited */
+        if (ledbat_state->alg_state == picoquic_ledbat_alg_slow_start) {
+            path_x->cwin += nb_bytes_acknowledged / divisor;
+            /* Leave the slow start before the queue reaches the target */
+            if (path_x->cwin >= ledbat_state->ssthresh ||
+                4 * queuing_delay > 3 * PICOQUIC_LEDBAT_TARGET_DELAY) {
+                ledbat_state->ssthresh = path_x->cwin;
+                ledbat_state->alg_state = picoquic_ledbat_alg_congestion_avoidance;
+            }
+        } else {
+            uint64_t complete_delta = nb_bytes_acknowledged * path_x->send_mtu + ledbat_state->residual_ack;
+            uint64_t scaled_cwin = path_x->cwin * divisor;
+
+            ledbat_state->residual_ack = complete_delta % scaled_cwin;
+            path_x->cwin += complete_delta / scaled_cwin;
+        }
+    }
+}
+
+void picoquic_ledbat_notify(picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    uint64_t rtt_measurement,
+    uint64_t nb_bytes_acknowledged,
+    uint64_t lost_packet_number,
+    uint64_t current_time)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(lost_packet_number);
+#endif
+    picoquic_ledbat_state_t* ledbat_state = (picoquic_ledbat_state_t*)path_x->congestion_alg_state;
+
+    if (ledbat_state != NULL) {
+        switch (notification) {
+        case picoquic_congestion_notification_acknowledgement:
+            picoquic_ledbat_acknowledgement(path_x, ledbat_state, nb_bytes_acknowledged);
+            break;
+        case picoquic_congestion_notification_congestion_experienced:
+        case picoquic_congestion_notification_repeat:
+        case picoquic_congestion_notification_timeout:
+            /* enter recovery */
+            if (current_time - ledbat_state->recovery_start > path_x->smoothed_rtt) {
+                picoquic_ledbat_enter_recovery(path_x, notification, ledbat_state, current_time);
+            }
+            break;
+        case picoquic_congestion_notification_spurious_repeat:
+            if (current_time - ledbat_state->recovery_start < path_x->smoothed_rtt &&
+                path_x->cwin < 2 * ledbat_state->ssthresh) {
+                /* The loss was not real, go back to the window before the recovery */
+                path_x->cwin = 2 * ledbat_state->ssthresh;
+                ledbat_state->alg_state = picoquic_ledbat_alg_congestion_avoidance;
+            }
+            break;
+        case picoquic_congestion_notification_rtt_measurement:
+            picoquic_filter_rtt_min_max(&ledbat_state->rtt_filter, rtt_measurement);
+            break;
+        case picoquic_congestion_notification_cwin_blocked:
+            ledbat_state->last_sequence_blocked = picoquic_cc_get_sequence_number(path_x);
+            break;
+        default:
+            /* ignore */
+            break;
+        }
+    }
+
+    /* Compute pacing data */
+    picoquic_update_pacing_data(path_x);
+}
+
+/* Release the state of the congestion control algorithm */
+void picoquic_ledbat_delete(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
+{
+    if (path_x->congestion_alg_state != NULL) {
+        free(path_x->congestion_alg_state);
+        path_x->congestion_alg_state = NULL;
+    }
+}
+
+/* Definition record for the LEDBAT algorithm */
+
+#define PICOQUIC_LEDBAT_ID 0x4C454442 /* LEDB */
+
+picoquic_congestion_algorithm_t picoquic_ledbat_algorithm_struct = {
+    PICOQUIC_LEDBAT_ID,
+    picoquic_ledbat_init,
+    picoquic_ledbat_notify,
+    picoquic_ledbat_delete
+};
+
+picoquic_congestion_algorithm_t* picoquic_ledbat_algorithm = &picoquic_ledbat_algorithm_struct;
@@ -0,0 +1,203 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* fopencookie */
+#endif
+#include "log_flusher.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* The ring is a bounded multi-producer queue, each chunk having a sequence number telling whether it is
+ * free at a position or filled. The thread is its only consumer. */
+static picoquic_log_chunk_t* picoquic_log_flusher_reserve(picoquic_log_flusher_t* flusher, uint64_t* reserved_pos)
+{
+    uint64_t pos = __atomic_load_n(&flusher->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        picoquic_log_chunk_t* chunk = &flusher->chunks[pos & flusher->mask];
+        int64_t diff = (int64_t)(__atomic_load_n(&chunk->sequence, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&flusher->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *reserved_pos = pos;
+                return chunk;
+            }
+        } else if (diff < 0) {
+            /* The thread did not write this chunk yet */
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&flusher->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void picoquic_log_flusher_commit(picoquic_log_chunk_t* chunk, uint64_t pos)
+{
+    __atomic_store_n(&chunk->sequence, pos + 1, __ATOMIC_RELEASE);
+}
+
+static void picoquic_log_chunk_write(picoquic_log_chunk_t* chunk)
+{
+    size_t written = 0;
+
+    while (written < chunk->length) {
+        ssize_t ret = write(chunk->fd, chunk->bytes + written, chunk->length - written);
+        if (ret <= 0) {
+            break;
+        }
+        written += ret;
+    }
+    if (chunk->close_fd) {
+        close(chunk->fd);
+    }
+}
+
+static void* picoquic_log_flusher_thread(void* arg)
+{
+    picoquic_log_flusher_t* flusher = (picoquic_log_flusher_t*)arg;
+
+    for (;;) {
+        uint64_t pos = flusher->dequeue_pos;
+        picoquic_log_chunk_t* chunk = &flusher->chunks[pos & flusher->mask];
+
+        if (__atomic_load_n(&chunk->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+            if (__atomic_load_n(&flusher->stop, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            usleep(PICOQUIC_LOG_FLUSHER_IDLE_WAIT);
+            continue;
+        }
+
+        picoquic_log_chunk_write(chunk);
+        __atomic_store_n(&chunk->sequence, pos + flusher->mask + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&flusher->dequeue_pos, pos + 1, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+picoquic_log_flusher_t* picoquic_log_flusher_create(uint32_t nb_chunks)
+{
+    picoquic_log_flusher_t* flusher;
+
+    if (nb_chunks == 0 || (nb_chunks & (nb_chunks - 1)) != 0) {
+        return NULL;
+    }
+
+    flusher = (picoquic_log_flusher_t*)malloc(sizeof(picoquic_log_flusher_t));
+    if (flusher != NULL) {
+        memset(flusher, 0, sizeof(picoquic_log_flusher_t));
+        flusher->mask = nb_chunks - 1;
+        flusher->chunks = (picoquic_log_chunk_t*)malloc(nb_chunks * sizeof(picoquic_log_chunk_t));
+        if (flusher->chunks == NULL) {
+            free(flusher);
+            return NULL;
+        }
+        for (uint32_t i = 0; i < nb_chunks; i++) {
+            flusher->chunks[i].sequence = i;
+        }
+        if (pthread_create(&flusher->thread, NULL, picoquic_log_flusher_thread, flusher) != 0) {
+            free(flusher->chunks);
+            free(flusher);
+            flusher = NULL;
+        }
+    }
+
+    return flusher;
+}
+
+void picoquic_log_flusher_delete(picoquic_log_flusher_t* flusher)
+{
+    if (flusher == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&flusher->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(flusher->thread, NULL);
+    free(flusher->chunks);
+    free(flusher);
+}
+
+void picoquic_log_flusher_wait_idle(picoquic_log_flusher_t* flusher)
+{
+    while (__atomic_load_n(&flusher->dequeue_pos, __ATOMIC_ACQUIRE) != __atomic_load_n(&flusher->enqueue_pos, __ATOMIC_ACQUIRE)) {
+        usleep(PICOQUIC_LOG_FLUSHER_IDLE_WAIT);
+    }
+}
+
+int picoquic_log_flusher_write(picoquic_log_flusher_t* flusher, int fd, const uint8_t* bytes, size_t length)
+{
+    while (length > 0) {
+        uint64_t pos;
+        picoquic_log_chunk_t* chunk = picoquic_log_flusher_reserve(flusher, &pos);
+        uint32_t chunk_length = (length < PICOQUIC_LOG_CHUNK_SIZE) ? (uint32_t)length : PICOQUIC_LOG_CHUNK_SIZE;
+
+        if (chunk == NULL) {
+            __atomic_fetch_add(&flusher->nb_dropped, (length + PICOQUIC_LOG_CHUNK_SIZE - 1) / PICOQUIC_LOG_CHUNK_SIZE, __ATOMIC_RELAXED);
+            return -1;
+        }
+        chunk->fd = fd;
+        chunk->close_fd = 0;
+        chunk->length = chunk_length;
+        memcpy(chunk->bytes, bytes, chunk_length);
+        picoquic_log_flusher_commit(chunk, pos);
+        bytes += chunk_length;
+        length -= chunk_length;
+    }
+
+    return 0;
+}
+
+void picoquic_log_flusher_close(picoquic_log_flusher_t* flusher, int fd)
+{
+    uint64_t pos;
+    picoquic_log_chunk_t* chunk;
+
+    while ((chunk = picoquic_log_flusher_reserve(flusher, &pos)) == NULL) {
+        usleep(PICOQUIC_LOG_FLUSHER_IDLE_WAIT);
+    }
+    chunk->fd = fd;
+    chunk->close_fd = 1;
+    chunk->length = 0;
+    picoquic_log_flusher_commit(chunk, pos);
+}
+
+typedef struct st_picoquic_log_stream_t {
+    picoquic_log_flusher_t* flusher;
+    int fd;
+} picoquic_log_stream_t;
+
+static ssize_t picoquic_log_stream_write(void* cookie, const char* buf, size_t size)
+{
+    picoquic_log_stream_t* stream = (picoquic_log_stream_t*)cookie;
+
+    /* The dropped chunks are counted, the stream must not fail */
+    (void)picoquic_log_flusher_write(stream->flusher, stream->fd, (const uint8_t*)buf, size);
+    return (ssize_t)size;
+}
+
+static int picoquic_log_stream_close(void* cookie)
+{
+    free(cookie);
+    return 0;
+}
+
+FILE* picoquic_log_flusher_fopen(picoquic_log_flusher_t* flusher, int fd)
+{
+    cookie_io_functions_t functions = { NULL, picoquic_log_stream_write, NULL, picoquic_log_stream_close };
+    picoquic_log_stream_t* stream = (picoquic_log_stream_t*)malloc(sizeof(picoquic_log_stream_t));
+    FILE* F = NULL;
+
+    if (stream != NULL) {
+        stream->flusher = flusher;
+        stream->fd = fd;
+        F = fopencookie(stream, "w", functions);
+        if (F == NULL) {
+            free(stream);
+        } else {
+            /* Each flush of the stream fills one chunk */
+            setvbuf(F, NULL, _IOFBF, PICOQUIC_LOG_CHUNK_SIZE);
+        }
+    }
+
+    return F;
+}
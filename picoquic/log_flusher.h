@@ -0,0 +1,52 @@
+/**
+ * \file log_flusher.h
+ * \brief Background thread writing the logs of a QUIC context, so that a slow disk does not stall its loop.
+ *
+ * The loop copies the logs in chunks of a bounded lock-free ring, each one tagged with the descriptor it goes
+ * to, without any system call. The thread writes them in order. A chunk that does not fit in the ring is
+ * dropped and counted rather than waiting for the disk.
+ */
+
+#ifndef LOG_FLUSHER_H
+#define LOG_FLUSHER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define PICOQUIC_LOG_CHUNK_SIZE 4096
+#define PICOQUIC_LOG_FLUSHER_IDLE_WAIT 1000 /* Microseconds the thread sleeps when the ring is empty */
+
+typedef struct st_picoquic_log_chunk_t {
+    uint64_t sequence; /* Position it can be filled at, plus one once it is filled */
+    int fd;
+    int close_fd; /* The descriptor is closed once the chunk is written */
+    uint32_t length;
+    uint8_t bytes[PICOQUIC_LOG_CHUNK_SIZE];
+} picoquic_log_chunk_t;
+
+typedef struct st_picoquic_log_flusher_t {
+    picoquic_log_chunk_t* chunks;
+    uint64_t mask;
+    uint64_t enqueue_pos; /* Reserved by the writers with a compare and swap */
+    uint64_t dequeue_pos; /* Moved by the thread once a chunk is written */
+    uint64_t nb_dropped;
+    int stop;
+    pthread_t thread;
+} picoquic_log_flusher_t;
+
+/* Starts the thread, with a ring of nb_chunks chunks, a power of 2. Returns NULL on error */
+picoquic_log_flusher_t* picoquic_log_flusher_create(uint32_t nb_chunks);
+/* Stops the thread once the ring is written */
+void picoquic_log_flusher_delete(picoquic_log_flusher_t* flusher);
+/* Waits until the ring is written */
+void picoquic_log_flusher_wait_idle(picoquic_log_flusher_t* flusher);
+
+/* Can be called from any thread. Returns -1 if some chunks were dropped */
+int picoquic_log_flusher_write(picoquic_log_flusher_t* flusher, int fd, const uint8_t* bytes, size_t length);
+/* Closes fd after the chunks queued before. Waits for room in the ring rather than leaking it */
+void picoquic_log_flusher_close(picoquic_log_flusher_t* flusher, int fd);
+/* Returns a stream writing to fd through the ring, without closing it. It must be closed before the flusher */
+FILE* picoquic_log_flusher_fopen(picoquic_log_flusher_t* flusher, int fd);
+
+#endif
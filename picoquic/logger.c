@@ -23,6 +23,7 @@
 * Packet logging.
 */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "fnv1a.h"
 #include "picoquic_internal.h"
@@ -94,6 +95,12 @@ const char * picoquic_log_fin_or_event_name(picoquic_call_back_event_t ev)
     case picoquic_callback_ready:
         text = "ready";
         break;
+    case picoquic_callback_stream_batch:
+        text = "stream batch";
+        break;
+    case picoquic_callback_send_buffer_low:
+        text = "send buffer low";
+        break;
     default:
         break;
     }
@@ -323,6 +330,12 @@ char const* picoquic_log_frame_names(uint64_t frame_type)
     case picoquic_frame_type_plugin_validate:
         frame_name = "plugin_validate";
         break;
+    case picoquic_frame_type_ack_frequency:
+        frame_name = "ack_frequency";
+        break;
+    case picoquic_frame_type_immediate_ack:
+        frame_name = "immediate_ack";
+        break;
     default:
         if (PICOQUIC_IN_RANGE(frame_type, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
             frame_name = "stream";
@@ -736,6 +749,38 @@ size_t picoquic_log_max_data_frame(FILE* F, uint8_t* bytes, size_t bytes_max)
     return byte_index;
 }
 
+size_t picoquic_log_ack_frequency_frame(FILE* F, uint8_t* bytes, size_t bytes_max)
+{
+    size_t byte_index = picoquic_varint_skip(bytes);
+    uint64_t sequence_number = 0;
+    uint64_t packet_tolerance = 0;
+    uint64_t max_ack_delay = 0;
+    size_t l1 = 0, l2 = 0, l3 = 0;
+
+    if (byte_index < bytes_max) {
+        l1 = picoquic_varint_decode(bytes + byte_index, bytes_max - byte_index, &sequence_number);
+        byte_index += l1;
+    }
+    if (l1 > 0 && byte_index < bytes_max) {
+        l2 = picoquic_varint_decode(bytes + byte_index, bytes_max - byte_index, &packet_tolerance);
+        byte_index += l2;
+    }
+    if (l2 > 0 && byte_index < bytes_max) {
+        l3 = picoquic_varint_decode(bytes + byte_index, bytes_max - byte_index, &max_ack_delay);
+        byte_index += l3;
+    }
+
+    if (l3 == 0 || byte_index >= bytes_max) {
+        fprintf(F, "    Malformed ACK FREQUENCY, %d bytes\n", (int)bytes_max);
+        return bytes_max;
+    }
+
+    fprintf(F, "    ACK FREQUENCY: sequence %" PRIu64 ", tolerance %" PRIu64 ", delay %" PRIu64 "us%s.\n",
+        sequence_number, packet_tolerance, max_ack_delay, (bytes[byte_index] != 0) ? ", ignore order" : "");
+
+    return byte_index + 1;
+}
+
 size_t picoquic_log_max_stream_data_frame(FILE* F, uint8_t* bytes, size_t bytes_max)
 {
     size_t byte_index = 1;
@@ -1532,6 +1577,14 @@ void picoquic_log_frames(FILE* F, uint64_t cnx_id64, uint8_t* bytes, size_t leng
             fprintf(F, "    HANDSHAKE_DONE\n");
             byte_index += 1;
             break;
+        case picoquic_frame_type_ack_frequency:
+            byte_index += picoquic_log_ack_frequency_frame(F, bytes + byte_index,
+                length - byte_index);
+            break;
+        case picoquic_frame_type_immediate_ack:
+            fprintf(F, "    IMMEDIATE_ACK\n");
+            byte_index += picoquic_varint_skip(bytes + byte_index);
+            break;
         case 0x2c: /* DATAGRAM */
         case 0x2d:
         case 0x2e:
@@ -1584,32 +1637,31 @@ void picoquic_log_frames(FILE* F, uint64_t cnx_id64, uint8_t* bytes, size_t leng
     }
 }
 
-void picoquic_log_decrypted_segment(void* F_log, int log_cnxid, picoquic_cnx_t* cnx,
-    int receiving, picoquic_packet_header * ph, uint8_t* bytes, size_t length, int ret)
+static uint64_t picoquic_log_segment_cnxid64(picoquic_cnx_t* cnx, picoquic_packet_header* ph, int ret)
 {
     uint64_t log_cnxid64 = 0;
-    FILE * F = (FILE *)F_log;
-
-    if (F == NULL) {
-        return;
-    }
 
-    if (log_cnxid != 0) {
-        if (cnx == NULL) {
-            ph->pn64 = ph->pn;
-            if (ret == 0) {
-                if (ph->ptype == picoquic_packet_version_negotiation) {
-                    log_cnxid64 = picoquic_val64_connection_id(ph->srce_cnx_id);
-                }
-                else {
-                    log_cnxid64 = picoquic_val64_connection_id(ph->dest_cnx_id);
-                }
+    if (cnx == NULL) {
+        ph->pn64 = ph->pn;
+        if (ret == 0) {
+            if (ph->ptype == picoquic_packet_version_negotiation) {
+                log_cnxid64 = picoquic_val64_connection_id(ph->srce_cnx_id);
+            }
+            else {
+                log_cnxid64 = picoquic_val64_connection_id(ph->dest_cnx_id);
             }
-        }
-        else {
-            log_cnxid64 = picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx));
         }
     }
+    else {
+        log_cnxid64 = picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx));
+    }
+
+    return log_cnxid64;
+}
+
+static void picoquic_log_segment_text(FILE* F, uint64_t log_cnxid64,
+    int receiving, picoquic_packet_header* ph, uint8_t* bytes, size_t length, int ret)
+{
     /* Header */
     picoquic_log_packet_header(F, log_cnxid64, ph, receiving);
 
@@ -1646,6 +1698,144 @@ void picoquic_log_decrypted_segment(void* F_log, int log_cnxid, picoquic_cnx_t*
     fprintf(F, "\n");
 }
 
+void picoquic_log_decrypted_segment(void* F_log, int log_cnxid, picoquic_cnx_t* cnx,
+    int receiving, picoquic_packet_header * ph, uint8_t* bytes, size_t length, int ret)
+{
+    uint64_t log_cnxid64 = 0;
+    FILE * F = (FILE *)F_log;
+
+    if (F == NULL) {
+        return;
+    }
+
+    if (log_cnxid != 0) {
+        log_cnxid64 = picoquic_log_segment_cnxid64(cnx, ph, ret);
+    }
+    picoquic_log_segment_text(F, log_cnxid64, receiving, ph, bytes, length, ret);
+}
+
+/*
+ * Binary packet trace. The record only copies what the packet already holds, the frames are decoded
+ * later by picoquic_log_binary_trace(), with the same functions as the text log.
+ */
+static void picoquic_binlog_write(FILE* F, picoquic_binlog_record_t* record, const uint8_t* payload)
+{
+    record->magic = PICOQUIC_BINLOG_MAGIC;
+    fwrite(record, sizeof(picoquic_binlog_record_t), 1, F);
+    if (record->payload_length > 0) {
+        fwrite(payload, record->payload_length, 1, F);
+    }
+}
+
+void picoquic_binlog_incoming_segment(picoquic_quic_t* quic, picoquic_cnx_t* cnx,
+    picoquic_packet_header* ph, uint8_t* bytes, size_t length, int ret)
+{
+    picoquic_binlog_record_t record;
+    size_t payload_offset = ph->offset;
+    size_t payload_length = 0;
+
+    memset(&record, 0, sizeof(record));
+    record.time = picoquic_get_quic_time(quic);
+    record.log_cnxid64 = picoquic_log_segment_cnxid64(cnx, ph, ret);
+    record.pn64 = ph->pn64;
+    record.ret = ret;
+    record.vn = ph->vn;
+    record.receiving = 1;
+    record.ptype = (uint8_t)ph->ptype;
+    record.spin = (uint8_t)ph->spin;
+    record.dest_id_len = ph->dest_cnx_id.id_len;
+    memcpy(record.dest_id, ph->dest_cnx_id.id, ph->dest_cnx_id.id_len);
+    record.srce_id_len = ph->srce_cnx_id.id_len;
+    memcpy(record.srce_id, ph->srce_cnx_id.id, ph->srce_cnx_id.id_len);
+    if (ret == 0) {
+        if (ph->ptype == picoquic_packet_version_negotiation || ph->ptype == picoquic_packet_retry) {
+            payload_length = (length > payload_offset) ? length - payload_offset : 0;
+        } else if (ph->ptype != picoquic_packet_error) {
+            payload_length = ph->payload_length;
+        }
+    }
+    record.payload_length = (uint32_t)payload_length;
+
+    picoquic_binlog_write((FILE*)quic->F_binlog, &record, bytes + payload_offset);
+}
+
+void picoquic_binlog_outgoing_segment(picoquic_cnx_t* cnx, picoquic_packet_type_enum ptype, uint64_t sequence_number,
+    uint8_t* header, uint32_t header_length, uint8_t* payload, uint32_t payload_length)
+{
+    picoquic_binlog_record_t record;
+
+    memset(&record, 0, sizeof(record));
+    record.time = picoquic_get_quic_time(cnx->quic);
+    record.log_cnxid64 = picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx));
+    record.pn64 = sequence_number;
+    record.ptype = (uint8_t)ptype;
+    record.payload_length = payload_length;
+
+    /* The header was just written by picoquic_create_packet_header(), its layout is known */
+    if ((header[0] & 0x80) == 0) {
+        record.spin = (header[0] >> 5) & 1;
+        record.dest_id_len = (uint8_t)(header_length - 5);
+        memcpy(record.dest_id, header + 1, record.dest_id_len);
+    } else {
+        record.vn = PICOPARSE_32(header + 1);
+        record.dest_id_len = header[5];
+        memcpy(record.dest_id, header + 6, record.dest_id_len);
+        record.srce_id_len = header[6 + record.dest_id_len];
+        memcpy(record.srce_id, header + 7 + record.dest_id_len, record.srce_id_len);
+    }
+
+    picoquic_binlog_write((FILE*)cnx->quic->F_binlog, &record, payload);
+}
+
+int picoquic_log_binary_trace(FILE* F_trace, FILE* F, int log_time)
+{
+    picoquic_binlog_record_t record;
+    uint8_t* payload = (uint8_t*)malloc(PICOQUIC_MAX_JUMBO_PACKET_SIZE);
+    uint64_t start_time = 0;
+    int nb_records = 0;
+    int ret = 0;
+
+    if (payload == NULL) {
+        return -1;
+    }
+
+    while (ret == 0 && fread(&record, sizeof(record), 1, F_trace) == 1) {
+        picoquic_packet_header ph;
+
+        if (record.magic != PICOQUIC_BINLOG_MAGIC || record.payload_length > PICOQUIC_MAX_JUMBO_PACKET_SIZE ||
+            record.dest_id_len > PICOQUIC_CONNECTION_ID_MAX_SIZE || record.srce_id_len > PICOQUIC_CONNECTION_ID_MAX_SIZE ||
+            (record.payload_length > 0 && fread(payload, record.payload_length, 1, F_trace) != 1)) {
+            ret = -1;
+            break;
+        }
+
+        memset(&ph, 0, sizeof(ph));
+        ph.ptype = (picoquic_packet_type_enum)record.ptype;
+        ph.pn64 = record.pn64;
+        ph.pn = (uint32_t)record.pn64;
+        ph.vn = record.vn;
+        ph.spin = record.spin;
+        ph.dest_cnx_id.id_len = record.dest_id_len;
+        memcpy(ph.dest_cnx_id.id, record.dest_id, record.dest_id_len);
+        ph.srce_cnx_id.id_len = record.srce_id_len;
+        memcpy(ph.srce_cnx_id.id, record.srce_id, record.srce_id_len);
+        ph.offset = 0;
+        ph.payload_length = (uint16_t)record.payload_length;
+
+        if (nb_records++ == 0) {
+            start_time = record.time;
+        }
+        if (log_time) {
+            picoquic_log_time(F, NULL, record.time - start_time, "T= ", "\n");
+        }
+        picoquic_log_segment_text(F, record.log_cnxid64, record.receiving, &ph, payload, record.payload_length, record.ret);
+    }
+
+    free(payload);
+
+    return (ret == 0) ? nb_records : -1;
+}
+
 void picoquic_log_outgoing_segment(void* F_log, int log_cnxid, picoquic_cnx_t* cnx,
     uint8_t * bytes,
     uint64_t sequence_number,
@@ -35,82 +35,12 @@
 #include <stdio.h>
 
 /*
- * sizeof(word) MUST BE A POWER OF TWO
- * SO THAT wmask BELOW IS ALL ONES
- */
-typedef	int word;		/* "word" used for optimal copy speed */
-
-#define	wsize	sizeof(word)
-#define	wmask	(wsize - 1)
-
-/*
- * Copy a block of memory, handling overlap.
- * This is the routine that actually implements
- * (the portable versions of) bcopy, memcpy, and memmove.
+ * Copy a block of memory, handling overlap. The memmove of the libc
+ * selects the fastest copy of the CPU (rep movsb, AVX2...) at load time.
  */
 void * my_memcpy(void *dst0, const void *src0, size_t length)
 {
-	char *dst = dst0;
-	const char *src = src0;
-	size_t t;
-	
-	if (length == 0 || dst == src)		/* nothing to do */
-		goto done;
-	
-	/*
-	 * Macros: loop-t-times; and loop-t-times, t>0
-	 */
-#define	TLOOP(s) if (t) TLOOP1(s)
-#define	TLOOP1(s) do { s; } while (--t)
-	
-	if ((unsigned long)dst < (unsigned long)src) {
-		/*
-		 * Copy forward.
-		 */
-		t = (uintptr_t)src;	/* only need low bits */
-		if ((t | (uintptr_t)dst) & wmask) {
-			/*
-			 * Try to align operands.  This cannot be done
-			 * unless the low bits match.
-			 */
-			if ((t ^ (uintptr_t)dst) & wmask || length < wsize)
-				t = length;
-			else
-				t = wsize - (t & wmask);
-			length -= t;
-			TLOOP1(*dst++ = *src++);
-		}
-		/*
-		 * Copy whole words, then mop up any trailing bytes.
-		 */
-		t = length / wsize;
-		TLOOP(*(word *)dst = *(word *)src; src += wsize; dst += wsize);
-		t = length & wmask;
-		TLOOP(*dst++ = *src++);
-	} else {
-		/*
-		 * Copy backwards.  Otherwise essentially the same.
-		 * Alignment works as before, except that it takes
-		 * (t&wmask) bytes to align, not wsize-(t&wmask).
-		 */
-		src += length;
-		dst += length;
-		t = (uintptr_t)src;
-		if ((t | (uintptr_t)dst) & wmask) {
-			if ((t ^ (uintptr_t)dst) & wmask || length <= wsize)
-				t = length;
-			else
-				t &= wmask;
-			length -= t;
-			TLOOP1(*--dst = *--src);
-		}
-		t = length / wsize;
-		TLOOP(src -= wsize; dst -= wsize; *(word *)dst = *(word *)src);
-		t = length & wmask;
-		TLOOP(*--dst = *--src);
-	}
-done:
-	return (dst0);
+	return memmove(dst0, src0, length);
 }
 
 void *
@@ -127,41 +57,7 @@ my_bcopy(const void *s1, void *s2, size_t n)
 
 void * __attribute__((weak)) my_memset(void * dest, int c, size_t n)
 {
-    unsigned char *s = dest;
-    size_t k;
-
-    /* Fill head and tail with minimal branching. Each
-     * conditional ensures that all the subsequently used
-     * offsets are well-defined and in the dest region. */
-
-    if (!n) return dest;
-    s[0] = s[n-1] = c;
-    if (n <= 2) return dest;
-    s[1] = s[n-2] = c;
-    s[2] = s[n-3] = c;
-    if (n <= 6) return dest;
-    s[3] = s[n-4] = c;
-    if (n <= 8) return dest;
-
-    /* Advance pointer to align it at a 4-byte boundary,
-     * and truncate n to a multiple of 4. The previous code
-     * already took care of any head/tail that get cut off
-     * by the alignment. */
-
-    k = -(uintptr_t)s & 3;
-    s += k;
-    n -= k;
-    n &= -4;
-    n /= 4;
-
-    uint32_t *ws = (uint32_t *)s;
-    uint32_t wc = c & 0xFF;
-    wc |= ((wc << 8) | (wc << 16) | (wc << 24));
-
-    /* Pure C fallback with no aliasing violations. */
-    for (; n; n--, ws++) *ws = wc;
-
-    return dest;
+    return memset(dest, c, n);
 }
 
 void *my_memcpy_dbg(void *dest, const void *src, size_t count, char *file, int line) {
@@ -1,9 +1,15 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* memfd_create */
+#endif
 #include "memory.h"
 #include "memcpy.h"
 
 #include <unistd.h>
+#include <stdbool.h>
+#include <sys/mman.h>
 #include <michelfralloc/michelfralloc.h>
 #include "picoquic_internal.h"
+#include "alloc_profiler.h"
 
 /* This implementation is mostly a translation from C++ to C of the
  * implementation proposed by Ben Kenwright in "Fast Efficient
@@ -27,6 +33,7 @@ uint64_t index_from_addr(memory_pool_t *mp, uint8_t *p) {
 * If no adequately large free slot is available, return NULL.
 */
 void *my_malloc(picoquic_cnx_t *cnx, unsigned int size) {
+    PICOQUIC_ALLOC_PROFILE(picoquic_alloc_site_plugin, cnx->current_plugin->name, size);
     return cnx->current_plugin->memory_manager.my_malloc(cnx->current_plugin, size);
 }
 
@@ -64,6 +71,27 @@ void *my_realloc(picoquic_cnx_t *cnx, void *ptr, unsigned int size) {
     return cnx->current_plugin->memory_manager.my_realloc(cnx->current_plugin, ptr, size);
 }
 
+/**
+ * Bump allocation in the scratch arena at the top of the plugin memory.
+ * exec_loaded_code() restores the arena as it was before the pluglet ran,
+ * so there is nothing to free.
+ */
+void *my_scratch_alloc(picoquic_cnx_t *cnx, unsigned int size) {
+    protoop_plugin_t *p = cnx->current_plugin;
+    if (!p) {
+        fprintf(stderr, "FATAL ERROR: calling my_scratch_alloc outside plugin scope!\n");
+        exit(1);
+    }
+    uint64_t aligned_size = ((uint64_t) size + 7) & ~((uint64_t) 7);
+    if (aligned_size > p->scratch_size - p->scratch_used) {
+        printf("Out of scratch memory!\n");
+        return NULL;
+    }
+    void *ret = p->memory + (p->memory_size - p->scratch_size) + p->scratch_used;
+    p->scratch_used += (uint32_t) aligned_size;
+    return ret;
+}
+
 /**
 * Search for big enough free space on heap.
 * Return the pointer to this slot.
@@ -188,7 +216,7 @@ int init_block_memory_management(protoop_plugin_t *p)
     }
     mp->mem_start = (uint8_t *) p->memory;
     mp->size_of_each_block = 2100; /* TEST */
-    mp->num_of_blocks = PLUGIN_MEMORY / 2100;
+    mp->num_of_blocks = (p->memory_size - p->scratch_size) / 2100;
     mp->num_initialized = 0;
     mp->num_free_blocks = mp->num_of_blocks;
     mp->next = mp->mem_start;
@@ -233,7 +261,7 @@ int init_dynamic_memory_management(protoop_plugin_t *p)
     if (!mp) {
         return -1;
     }
-    mp->memory_max_size = PLUGIN_MEMORY;
+    mp->memory_max_size = p->memory_size - p->scratch_size;
     mp->memory_current_end = mp->memory_start =  (uint8_t *) p->memory;
     p->memory_manager.ctx = mp;
     return 0;
@@ -251,12 +279,392 @@ int destroy_dynamic_memory_management(protoop_plugin_t *p)
 
 
 
+/* Slab memory manager. Small objects are served from power-of-two size classes, each having its own
+ * free list, so that both allocation and release are O(1). Each class takes SLAB_CHUNK_SIZE bytes
+ * of the plugin memory at a time, and carves its objects only when they are needed to avoid committing
+ * pages for nothing. Objects larger than the largest class are rounded up to SLAB_LARGE_ALIGN bytes
+ * and kept on a first fit free list once released.
+ */
+#define SLAB_CHUNK_SIZE (64 * 1024)
+#define SLAB_LARGE_ALIGN 4096
+#define SLAB_MAGIC_SMALL 0x51ab5
+#define SLAB_MAGIC_LARGE 0x51ab1
+
+typedef struct slab_header {
+    uint32_t magic;
+    uint32_t info; /* Size class for small objects, total size for large ones */
+} slab_header_t;
+
+static inline uint32_t slab_class_size(int class_index) {
+    return ((uint32_t) 1) << (class_index + SLAB_MIN_CLASS_SHIFT);
+}
+
+static inline int slab_class_index(uint64_t total_size) {
+    int class_index = 0;
+    while (class_index < SLAB_NB_CLASSES && slab_class_size(class_index) < total_size) {
+        class_index++;
+    }
+    return class_index;
+}
+
+static inline slab_memory_pool_t *slab_get_pool(protoop_plugin_t *p) {
+    if (!p) {
+        fprintf(stderr, "FATAL ERROR: calling slab memory manager outside plugin scope!\n");
+        exit(1);
+    }
+    slab_memory_pool_t *mp = (slab_memory_pool_t *) p->memory_manager.ctx;
+    if (!mp) {
+        fprintf(stderr, "FATAL ERROR: calling slab memory manager with a NULL context !\n");
+        exit(1);
+    }
+    return mp;
+}
+
+static void slab_account_alloc(slab_class_stats_t *stats) {
+    stats->in_use++;
+    if (stats->in_use > stats->peak) {
+        stats->peak = stats->in_use;
+    }
+}
+
+static void *slab_malloc_large(slab_memory_pool_t *mp, uint64_t total_size) {
+    total_size = (total_size + SLAB_LARGE_ALIGN - 1) & ~((uint64_t) SLAB_LARGE_ALIGN - 1);
+    slab_class_stats_t *stats = &mp->stats[SLAB_LARGE_CLASS];
+    slab_header_t *header = NULL;
+
+    slab_free_node_t **prev = &mp->large_free_list;
+    while (*prev != NULL) {
+        slab_header_t *candidate = (slab_header_t *) *prev - 1;
+        if (candidate->info >= total_size) {
+            *prev = (*prev)->next;
+            header = candidate;
+            stats->free--;
+            break;
+        }
+        prev = &(*prev)->next;
+    }
+
+    if (!header) {
+        if ((uint64_t) (mp->mem_end - mp->brk) < total_size) {
+            printf("Out of memory!\n");
+            return NULL;
+        }
+        header = (slab_header_t *) mp->brk;
+        mp->brk += total_size;
+        header->magic = SLAB_MAGIC_LARGE;
+        header->info = (uint32_t) total_size;
+        stats->bytes += total_size;
+    }
+    slab_account_alloc(stats);
+    return header + 1;
+}
+
+void *my_malloc_slab(protoop_plugin_t *p, unsigned int size) {
+    slab_memory_pool_t *mp = slab_get_pool(p);
+    uint64_t total_size = (uint64_t) size + sizeof(slab_header_t);
+    int class_index = slab_class_index(total_size);
+    if (class_index == SLAB_NB_CLASSES) {
+        return slab_malloc_large(mp, total_size);
+    }
+
+    slab_header_t *header;
+    slab_class_stats_t *stats = &mp->stats[class_index];
+    if (mp->free_lists[class_index] != NULL) {
+        header = (slab_header_t *) mp->free_lists[class_index] - 1;
+        mp->free_lists[class_index] = mp->free_lists[class_index]->next;
+        stats->free--;
+    } else {
+        uint32_t class_size = slab_class_size(class_index);
+        if (mp->carve[class_index] == NULL || mp->carve_end[class_index] - mp->carve[class_index] < class_size) {
+            if (mp->mem_end - mp->brk < SLAB_CHUNK_SIZE) {
+                printf("Out of memory!\n");
+                return NULL;
+            }
+            mp->carve[class_index] = mp->brk;
+            mp->carve_end[class_index] = mp->brk + SLAB_CHUNK_SIZE;
+            mp->brk += SLAB_CHUNK_SIZE;
+            stats->bytes += SLAB_CHUNK_SIZE;
+        }
+        header = (slab_header_t *) mp->carve[class_index];
+        mp->carve[class_index] += class_size;
+        header->magic = SLAB_MAGIC_SMALL;
+        header->info = class_index;
+    }
+    slab_account_alloc(stats);
+    return header + 1;
+}
+
+void my_free_slab(protoop_plugin_t *p, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    slab_memory_pool_t *mp = slab_get_pool(p);
+    slab_header_t *header = (slab_header_t *) ptr - 1;
+    if (!(mp->mem_start <= (uint8_t *) header && (uint8_t *) ptr < mp->brk)) {
+        printf("MEMORY CORRUPTION: FREEING MEMORY (%p) NOT BELONGING TO THE PLUGIN\n", ptr);
+        return;
+    }
+    slab_free_node_t *node = (slab_free_node_t *) ptr;
+    if (header->magic == SLAB_MAGIC_SMALL && header->info < SLAB_NB_CLASSES) {
+        node->next = mp->free_lists[header->info];
+        mp->free_lists[header->info] = node;
+        mp->stats[header->info].in_use--;
+        mp->stats[header->info].free++;
+    } else if (header->magic == SLAB_MAGIC_LARGE) {
+        node->next = mp->large_free_list;
+        mp->large_free_list = node;
+        mp->stats[SLAB_LARGE_CLASS].in_use--;
+        mp->stats[SLAB_LARGE_CLASS].free++;
+    } else {
+        printf("MEMORY CORRUPTION: BAD METADATA: 0x%" PRIx32 ", ORIGINAL PTR: %p\n", header->magic, ptr);
+    }
+}
+
+void *my_realloc_slab(protoop_plugin_t *p, void *ptr, unsigned int size) {
+    if (ptr == NULL) {
+        return my_malloc_slab(p, size);
+    }
+    slab_header_t *header = (slab_header_t *) ptr - 1;
+    uint64_t usable;
+    if (header->magic == SLAB_MAGIC_SMALL && header->info < SLAB_NB_CLASSES) {
+        usable = slab_class_size(header->info) - sizeof(slab_header_t);
+    } else if (header->magic == SLAB_MAGIC_LARGE) {
+        usable = header->info - sizeof(slab_header_t);
+    } else {
+        printf("MEMORY CORRUPTION: BAD METADATA: 0x%" PRIx32 ", ORIGINAL PTR: %p\n", header->magic, ptr);
+        return NULL;
+    }
+    if (size <= usable) {
+        return ptr;
+    }
+    void *new_ptr = my_malloc_slab(p, size);
+    if (new_ptr) {
+        my_memcpy(new_ptr, ptr, usable);
+        my_free_slab(p, ptr);
+    }
+    return new_ptr;
+}
+
+int init_slab_memory_management(protoop_plugin_t *p)
+{
+    p->memory_manager.my_malloc = my_malloc_slab;
+    p->memory_manager.my_free = my_free_slab;
+    p->memory_manager.my_realloc = my_realloc_slab;
+
+    slab_memory_pool_t *mp = calloc(1, sizeof(slab_memory_pool_t));
+    if (!mp) {
+        return -1;
+    }
+    mp->brk = mp->mem_start = (uint8_t *) p->memory;
+    mp->mem_end = mp->mem_start + (p->memory_size - p->scratch_size);
+    p->memory_manager.ctx = mp;
+    return 0;
+}
+
+int destroy_slab_memory_management(protoop_plugin_t *p)
+{
+    if (!p->memory_manager.ctx) {
+        fprintf(stderr, "cannot free NULL plugin slab memory manager context !\n");
+    }
+    free(p->memory_manager.ctx);
+    p->memory_manager.ctx = NULL;
+    return 0;
+}
+
+int slab_memory_get_stats(protoop_plugin_t *p, int class_index, struct slab_class_stats *stats)
+{
+    if (p->params.plugin_memory_manager_type != plugin_memory_manager_slab || !p->memory_manager.ctx ||
+        class_index < 0 || class_index > SLAB_LARGE_CLASS) {
+        return -1;
+    }
+    *stats = ((slab_memory_pool_t *) p->memory_manager.ctx)->stats[class_index];
+    return 0;
+}
+
+/* The plugin memory is a separate mapping surrounded by guard pages. The kernel only commits
+ * its pages once the plugin touches them, so the reserved size does not cost anything upfront.
+ */
+int plugin_memory_reserve(protoop_plugin_t *p)
+{
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    size_t size = p->params.memory_size > 0 ? p->params.memory_size : PLUGIN_MEMORY;
+    size = (size + page_size - 1) & ~(page_size - 1);
+    if (size > UINT32_MAX) {
+        fprintf(stderr, "plugin memory of %zu bytes is too large !\n", size);
+        return -1;
+    }
+    uint8_t *region = mmap(NULL, size + 2 * page_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+        fprintf(stderr, "cannot reserve %zu bytes of plugin memory !\n", size);
+        return -1;
+    }
+    if (mprotect(region, page_size, PROT_NONE) != 0 || mprotect(region + page_size + size, page_size, PROT_NONE) != 0) {
+        fprintf(stderr, "cannot protect the guard pages of the plugin memory !\n");
+        munmap(region, size + 2 * page_size);
+        return -1;
+    }
+    p->memory = (char *) region + page_size;
+    p->memory_size = (uint32_t) size;
+    return 0;
+}
+
+/* Gives the pages of the plugin memory back to the system, while keeping the reservation */
+void plugin_memory_discard(protoop_plugin_t *p)
+{
+    if (p->memory) {
+        madvise(p->memory, p->memory_size, MADV_DONTNEED);
+    }
+}
+
+void plugin_memory_release(protoop_plugin_t *p)
+{
+    if (p->memory) {
+        size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+        munmap(p->memory - page_size, p->memory_size + 2 * page_size);
+        p->memory = NULL;
+        p->memory_size = 0;
+    }
+}
+
+/* Size of the context of the memory manager of the plugin, 0 if it has none */
+static size_t memory_management_ctx_size(protoop_plugin_t *p)
+{
+    if (!p->memory_manager.ctx) {
+        return 0;
+    }
+    switch (p->params.plugin_memory_manager_type) {
+        case plugin_memory_manager_fixed_blocks:
+            return sizeof(memory_pool_t);
+        case plugin_memory_manager_dynamic:
+            return sizeof(plugin_dynamic_memory_pool_t);
+        case plugin_memory_manager_slab:
+            return sizeof(slab_memory_pool_t);
+        default:
+            return 0;
+    }
+}
+
+/* The template memory holds absolute pointers. Any aligned word whose value falls inside the memory is taken as one,
+ * the other values of plugin memories (lengths, counters, byte tables) do not look like addresses of the process.
+ */
+static int plugin_template_add_relocation(plugin_template_t *t, size_t *max_relocations, uint32_t offset)
+{
+    if (t->nb_relocations == *max_relocations) {
+        size_t new_max = (*max_relocations == 0) ? 1024 : 2 * *max_relocations;
+        uint32_t *relocations = realloc(t->relocations, new_max * sizeof(uint32_t));
+        if (!relocations) {
+            return -1;
+        }
+        t->relocations = relocations;
+        *max_relocations = new_max;
+    }
+    t->relocations[t->nb_relocations++] = offset;
+    return 0;
+}
+
+/* Copies the pages of the memory holding something into a memfd, the untouched ones are left as holes.
+ * The scratch arena is not part of the template, it is reset each time a pluglet returns.
+ */
+plugin_template_t *plugin_template_create(protoop_plugin_t *p)
+{
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    size_t managed_size = ((size_t) (p->memory_size - p->scratch_size) + page_size - 1) & ~(page_size - 1);
+    size_t ctx_size = memory_management_ctx_size(p);
+    size_t max_relocations = 0;
+    plugin_template_t *t = NULL;
+
+    if (!p->memory || ctx_size == 0 || (t = calloc(1, sizeof(plugin_template_t))) == NULL) {
+        return NULL;
+    }
+    strcpy(t->name, p->name);
+    t->base = (uint64_t) (uintptr_t) p->memory;
+    t->memory_size = p->memory_size;
+    t->memory_manager_ctx_size = ctx_size;
+    t->fd = memfd_create(p->name, MFD_CLOEXEC);
+    int ok = t->fd >= 0 && ftruncate(t->fd, p->memory_size) == 0 && (t->memory_manager_ctx = malloc(ctx_size)) != NULL;
+
+    /* Reading the pages never touched maps the zero page, it does not commit them */
+    for (size_t offset = 0; ok && offset < managed_size; offset += page_size) {
+        const uint64_t *words = (const uint64_t *) (p->memory + offset);
+        bool is_zero = true;
+        for (size_t i = 0; ok && i < page_size / sizeof(uint64_t); i++) {
+            is_zero &= words[i] == 0;
+            if (words[i] >= t->base && words[i] <= t->base + t->memory_size) {
+                ok = plugin_template_add_relocation(t, &max_relocations, (uint32_t) (offset + i * sizeof(uint64_t))) == 0;
+            }
+        }
+        if (ok && !is_zero) {
+            ok = pwrite(t->fd, words, page_size, (off_t) offset) == (ssize_t) page_size;
+        }
+    }
+
+    if (!ok) {
+        fprintf(stderr, "cannot create the template of plugin %s !\n", p->name);
+        plugin_template_free(t);
+        return NULL;
+    }
+    memcpy(t->memory_manager_ctx, p->memory_manager.ctx, ctx_size);
+    return t;
+}
+
+uint64_t plugin_template_relocate(plugin_template_t *t, protoop_plugin_t *p, uint64_t val)
+{
+    if (val >= t->base && val <= t->base + t->memory_size) {
+        val += (uint64_t) (uintptr_t) p->memory - t->base;
+    }
+    return val;
+}
+
+/* Only the pages holding relocated pointers are copied, the others stay shared with the template until written */
+int plugin_template_apply(plugin_template_t *t, protoop_plugin_t *p)
+{
+    p->from_template = false;
+    if (!p->memory || p->memory_size != t->memory_size ||
+        mmap(p->memory, p->memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, t->fd, 0) == MAP_FAILED) {
+        return -1;
+    }
+    if ((uint64_t) (uintptr_t) p->memory != t->base) {
+        for (size_t i = 0; i < t->nb_relocations; i++) {
+            uint64_t *word = (uint64_t *) (p->memory + t->relocations[i]);
+            *word = plugin_template_relocate(t, p, *word);
+        }
+    }
+    if (init_memory_management(p) != 0) {
+        return -1;
+    }
+    if (memory_management_ctx_size(p) != t->memory_manager_ctx_size) {
+        destroy_memory_management(p);
+        return -1;
+    }
+    uint64_t *ctx_words = (uint64_t *) p->memory_manager.ctx;
+    memcpy(ctx_words, t->memory_manager_ctx, t->memory_manager_ctx_size);
+    for (size_t i = 0; i < t->memory_manager_ctx_size / sizeof(uint64_t); i++) {
+        ctx_words[i] = plugin_template_relocate(t, p, ctx_words[i]);
+    }
+    p->from_template = true;
+    return 0;
+}
+
+void plugin_template_free(plugin_template_t *t)
+{
+    /* The memories still mapping the memfd keep it alive */
+    if (t->fd >= 0) {
+        close(t->fd);
+    }
+    free(t->relocations);
+    free(t->memory_manager_ctx);
+    free(t);
+}
+
 int init_memory_management(protoop_plugin_t *p) {
     if (!p) {
         fprintf(stderr, "call to init_memory_management with a NULL plugin !\n");
         return -1;
     }
     printf("create memory manager for plugin %s\n", p->name);
+    p->scratch_size = (p->memory_size / 8 < PLUGIN_SCRATCH_SIZE) ? (p->memory_size / 8) & ~((uint32_t) 7) : PLUGIN_SCRATCH_SIZE;
+    p->scratch_used = 0;
     switch (p->params.plugin_memory_manager_type) {
         case plugin_memory_manager_fixed_blocks:
             printf("create fixed block size memory manager\n");
@@ -264,6 +672,9 @@ int init_memory_management(protoop_plugin_t *p) {
         case plugin_memory_manager_dynamic:
             printf("create dynamic memory manager\n");
             return init_dynamic_memory_management(p);
+        case plugin_memory_manager_slab:
+            printf("create slab memory manager\n");
+            return init_slab_memory_management(p);
         default:
             fprintf(stderr, "unknown plugin memory manager %d !\n", p->params.plugin_memory_manager_type);
             return -1;
@@ -281,6 +692,8 @@ int destroy_memory_management(protoop_plugin_t *p) {
             return destroy_block_memory_management(p);
         case plugin_memory_manager_dynamic:
             return destroy_dynamic_memory_management(p);
+        case plugin_memory_manager_slab:
+            return destroy_slab_memory_management(p);
         default:
             fprintf(stderr, "unknown plugin memory manager %d !\n", p->params.plugin_memory_manager_type);
             return -1;
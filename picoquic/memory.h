@@ -8,19 +8,38 @@ void *my_malloc_dbg(picoquic_cnx_t *cnx, unsigned int size, char *file, int line
 void my_free(picoquic_cnx_t *cnx, void *ptr);
 void my_free_dbg(picoquic_cnx_t *cnx, void *ptr, char *file, int line);
 void *my_realloc(picoquic_cnx_t *cnx, void *ptr, unsigned int size);
+/* Allocates from the scratch arena of the plugin. The memory is released when the calling pluglet returns */
+void *my_scratch_alloc(picoquic_cnx_t *cnx, unsigned int size);
 
 void my_free_in_core(protoop_plugin_t *p, void *ptr);
 
 int init_memory_management(protoop_plugin_t *p);
 
+int plugin_memory_reserve(protoop_plugin_t *p);
+void plugin_memory_discard(protoop_plugin_t *p);
+void plugin_memory_release(protoop_plugin_t *p);
+
 int destroy_memory_management(protoop_plugin_t *p);
 
+/* Templates of plugin memories, see plugin_template_capture() */
+struct st_plugin_template_t;
+struct st_plugin_template_t *plugin_template_create(protoop_plugin_t *p);
+/* Maps the template over the memory of p and sets up its memory manager as the template left it. Returns 0 on success */
+int plugin_template_apply(struct st_plugin_template_t *t, protoop_plugin_t *p);
+/* Moves val to the memory of p if it points inside the template memory */
+uint64_t plugin_template_relocate(struct st_plugin_template_t *t, protoop_plugin_t *p, uint64_t val);
+void plugin_template_free(struct st_plugin_template_t *t);
+
+/* Only available with the slab memory manager. class_index is either a size class or SLAB_LARGE_CLASS */
+struct slab_class_stats;
+int slab_memory_get_stats(protoop_plugin_t *p, int class_index, struct slab_class_stats *stats);
+
 #ifndef MAX
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #endif
 
 #ifndef IS_IN_PLUGIN_MEMORY
-#define IS_IN_PLUGIN_MEMORY(plugin, ptr) (((ptr) == NULL) || ((void *) (&(plugin)->memory[0]) < ((void *) ptr) && ((void *) ptr) < (void *) (&(plugin)->memory[PLUGIN_MEMORY])))
+#define IS_IN_PLUGIN_MEMORY(plugin, ptr) (((ptr) == NULL) || ((void *) (plugin)->memory < ((void *) ptr) && ((void *) ptr) < (void *) ((plugin)->memory + (plugin)->memory_size)))
 #endif
 
 #ifdef DEBUG_MEMORY_PRINTF
@@ -40,6 +40,14 @@ typedef struct st_picoquic_newreno_state_t {
     uint64_t last_rtt[NB_RTT_RENO];
     int nb_rtt;
     uint64_t last_sequence_blocked;
+    picoquic_cnx_t* cnx;
+    picoquic_hystart_pp_t hystart_pp;
+    /* State before the last loss recovery, restored if the loss was spurious */
+    int is_undo_valid;
+    uint64_t undo_sequence;
+    uint64_t undo_cwin;
+    uint64_t undo_ssthresh;
+    picoquic_newreno_alg_state_t undo_alg_state;
 } picoquic_newreno_state_t;
 
 void picoquic_newreno_init(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
@@ -52,6 +60,8 @@ void picoquic_newreno_init(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
         path_x->congestion_alg_state = (void*)nr_state;
         nr_state->alg_state = picoquic_newreno_alg_slow_start;
         nr_state->ssthresh = (uint64_t)((int64_t)-1);
+        nr_state->cnx = cnx;
+        picoquic_hystart_pp_reset(&nr_state->hystart_pp, path_x);
         path_x->cwin = PICOQUIC_CWIN_INITIAL;
     }
 }
@@ -63,10 +73,19 @@ static void picoquic_newreno_enter_recovery(picoquic_path_t* path_x,
     picoquic_newreno_state_t* nr_state,
     uint64_t current_time)
 {
+    /* A CE mark is never spurious */
+    nr_state->is_undo_valid = (notification != picoquic_congestion_notification_congestion_experienced);
+    nr_state->undo_sequence = picoquic_cc_get_sequence_number(path_x);
+    nr_state->undo_cwin = path_x->cwin;
+    nr_state->undo_ssthresh = nr_state->ssthresh;
+    nr_state->undo_alg_state = nr_state->alg_state;
+
     nr_state->ssthresh = path_x->cwin / 2;
     if (nr_state->ssthresh < PICOQUIC_CWIN_MINIMUM) {
         nr_state->ssthresh = PICOQUIC_CWIN_MINIMUM;
     }
+    /* The conservative growth of HyStart++ only applies to the initial slow start */
+    nr_state->hystart_pp.is_in_css = 0;
 
     if (notification == picoquic_congestion_notification_timeout) {
         path_x->cwin = PICOQUIC_CWIN_MINIMUM;
@@ -79,8 +98,22 @@ static void picoquic_newreno_enter_recovery(picoquic_path_t* path_x,
     nr_state->recovery_start = current_time;
 
     nr_state->residual_ack = 0;
+}
 
-
+/* The packet whose loss started the recovery was only late: go back to the state before it */
+static void picoquic_newreno_undo_recovery(picoquic_path_t* path_x, picoquic_newreno_state_t* nr_state,
+    uint64_t lost_packet_number)
+{
+    if (nr_state->is_undo_valid && lost_packet_number < nr_state->undo_sequence) {
+        if (path_x->cwin < nr_state->undo_cwin) {
+            path_x->cwin = nr_state->undo_cwin;
+        }
+        nr_state->ssthresh = nr_state->undo_ssthresh;
+        nr_state->alg_state = nr_state->undo_alg_state;
+        nr_state->residual_ack = 0;
+        nr_state->recovery_start = 0;
+        nr_state->is_undo_valid = 0;
+    }
 }
 
 /*
@@ -98,7 +131,6 @@ void picoquic_newreno_notify(picoquic_path_t* path_x,
 {
 #ifdef _WINDOWS
     UNREFERENCED_PARAMETER(rtt_measurement);
-    UNREFERENCED_PARAMETER(lost_packet_number);
 #endif
     picoquic_newreno_state_t* nr_state = (picoquic_newreno_state_t*)path_x->congestion_alg_state;
 
@@ -109,7 +141,7 @@ void picoquic_newreno_notify(picoquic_path_t* path_x,
             case picoquic_newreno_alg_slow_start:
                 /* Only increase when the app is CWIN limited */
                 if (picoquic_cc_was_cwin_blocked(path_x, nr_state->last_sequence_blocked)) {
-                    path_x->cwin += nb_bytes_acknowledged;
+                    path_x->cwin += picoquic_hystart_pp_increase(&nr_state->hystart_pp, nb_bytes_acknowledged);
                     /* if cnx->cwin exceeds SSTHRESH, exit and go to CA */
                     if (path_x->cwin >= nr_state->ssthresh) {
                         nr_state->alg_state = picoquic_newreno_alg_congestion_avoidance;
@@ -135,19 +167,18 @@ void picoquic_newreno_notify(picoquic_path_t* path_x,
             }
             break;
         case picoquic_congestion_notification_spurious_repeat:
-            if (current_time - nr_state->recovery_start < path_x->smoothed_rtt) {
-                /* If spurious repeat of initial loss detected,
-                 * exit recovery and reset threshold to pre-entry cwin.
-                 */
-                if (path_x->cwin < 2 * nr_state->ssthresh) {
-                    path_x->cwin = 2 * nr_state->ssthresh;
-                    nr_state->alg_state = picoquic_newreno_alg_congestion_avoidance;
-                }
-            }
+            picoquic_newreno_undo_recovery(path_x, nr_state, lost_packet_number);
             break;
         case picoquic_congestion_notification_rtt_measurement:
             /* Using RTT increases as signal to get out of initial slow start */
             if (nr_state->alg_state == picoquic_newreno_alg_slow_start &&
+                nr_state->ssthresh == (uint64_t)((int64_t)-1) && nr_state->cnx->is_hystart_pp_enabled) {
+                if (picoquic_hystart_pp_test(&nr_state->hystart_pp, path_x, rtt_measurement)) {
+                    nr_state->ssthresh = path_x->cwin;
+                    nr_state->alg_state = picoquic_newreno_alg_congestion_avoidance;
+                }
+            }
+            else if (nr_state->alg_state == picoquic_newreno_alg_slow_start &&
                 nr_state->ssthresh == (uint64_t)((int64_t)-1)) {
                 uint64_t rolling_min;
                 uint64_t delta_rtt;
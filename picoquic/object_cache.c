@@ -0,0 +1,116 @@
+#include "object_cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+int picoquic_numa_bind(void* addr, size_t length, int numa_node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    if (numa_node >= 0 && numa_node < 8 * (int)sizeof(unsigned long)) {
+        unsigned long node_mask = 1ul << numa_node;
+
+        /* Only a preference, the untouched pages may come from elsewhere if the node is full.
+         * The pages already touched by this process alone are moved. */
+        if (syscall(SYS_mbind, addr, length, MPOL_PREFERRED, &node_mask, 8 * sizeof(unsigned long), MPOL_MF_MOVE) != 0) {
+            fprintf(stderr, "cannot place %zu bytes on NUMA node %d !\n", length, numa_node);
+            return -1;
+        }
+    }
+#endif
+    return 0;
+}
+
+void picoquic_object_cache_init(picoquic_object_cache_t* cache, size_t object_size)
+{
+    memset(cache, 0, sizeof(picoquic_object_cache_t));
+    cache->object_size = object_size;
+    cache->stride = (object_size + PICOQUIC_OBJECT_CACHE_ALIGN - 1) & ~((size_t)PICOQUIC_OBJECT_CACHE_ALIGN - 1);
+    cache->numa_node = -1;
+}
+
+void picoquic_object_cache_set_numa_node(picoquic_object_cache_t* cache, int numa_node)
+{
+    cache->numa_node = numa_node;
+    for (uint8_t* slab = (uint8_t*)cache->slabs; slab != NULL; slab = *(uint8_t**)slab) {
+        (void)picoquic_numa_bind(slab, *(size_t*)(slab + sizeof(void*)), numa_node);
+    }
+}
+
+static int picoquic_object_cache_map_slab(picoquic_object_cache_t* cache)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    /* The first object is preceded by the link to the previous slab and the size of the mapping */
+    size_t size = PICOQUIC_OBJECT_CACHE_ALIGN + cache->stride;
+
+    if (size < PICOQUIC_OBJECT_CACHE_SLAB_SIZE) {
+        size = PICOQUIC_OBJECT_CACHE_SLAB_SIZE;
+    }
+    size = (size + page_size - 1) & ~(page_size - 1);
+
+    uint8_t* slab = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab == MAP_FAILED) {
+        fprintf(stderr, "cannot map %zu bytes for the object cache !\n", size);
+        return -1;
+    }
+    (void)picoquic_numa_bind(slab, size, cache->numa_node);
+    *(void**)slab = cache->slabs;
+    *(size_t*)(slab + sizeof(void*)) = size;
+    cache->slabs = slab;
+    cache->next_object = slab + PICOQUIC_OBJECT_CACHE_ALIGN;
+    cache->slab_end = slab + size;
+    cache->nb_slabs++;
+
+    return 0;
+}
+
+void* picoquic_object_cache_get(picoquic_object_cache_t* cache)
+{
+    void* object = cache->free_objects;
+
+    if (object != NULL) {
+        cache->free_objects = *(void**)object;
+        cache->nb_free--;
+        cache->nb_recycled++;
+        memset(object, 0, cache->object_size);
+    } else if ((size_t)(cache->slab_end - cache->next_object) >= cache->stride || picoquic_object_cache_map_slab(cache) == 0) {
+        /* The kernel gives zeroed pages, the objects never used do not need to be cleared */
+        object = cache->next_object;
+        cache->next_object += cache->stride;
+    }
+
+    return object;
+}
+
+void picoquic_object_cache_put(picoquic_object_cache_t* cache, void* object)
+{
+    if (object != NULL) {
+        *(void**)object = cache->free_objects;
+        cache->free_objects = object;
+        cache->nb_free++;
+    }
+}
+
+void picoquic_object_cache_free(picoquic_object_cache_t* cache)
+{
+    while (cache->slabs != NULL) {
+        uint8_t* slab = (uint8_t*)cache->slabs;
+
+        cache->slabs = *(void**)slab;
+        munmap(slab, *(size_t*)(slab + sizeof(void*)));
+    }
+    cache->free_objects = NULL;
+    cache->next_object = NULL;
+    cache->slab_end = NULL;
+    cache->nb_free = 0;
+}
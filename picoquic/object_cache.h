@@ -0,0 +1,50 @@
+/**
+ * \file object_cache.h
+ * \brief Recycling of the fixed size objects of the connections of a picoquic context.
+ *
+ * Connections, paths and streams are created and deleted at the connection churn rate. Each cache
+ * carves its objects from slabs of a few pages, optionally placed on a given NUMA node, and keeps
+ * the deleted ones in a freelist for the next creation. The slabs are only released with the cache.
+ */
+
+#ifndef OBJECT_CACHE_H
+#define OBJECT_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PICOQUIC_OBJECT_CACHE_SLAB_SIZE (64 * 1024) /* Smallest slab, holds at least one object */
+#define PICOQUIC_OBJECT_CACHE_ALIGN 64
+
+typedef struct st_picoquic_object_cache_t {
+    void* free_objects; /* Chained by their first pointer */
+    void* slabs; /* Chained by their first pointer */
+    uint8_t* next_object; /* Never used objects of the last slab, still zeroed */
+    uint8_t* slab_end;
+    size_t object_size;
+    size_t stride; /* Object size rounded up to PICOQUIC_OBJECT_CACHE_ALIGN */
+    int numa_node; /* -1 if the placement is left to the system */
+    uint32_t nb_free;
+    uint64_t nb_slabs;
+    uint64_t nb_recycled; /* Objects taken from the freelist */
+} picoquic_object_cache_t;
+
+void picoquic_object_cache_init(picoquic_object_cache_t* cache, size_t object_size);
+
+/**
+ * The pages of [addr, addr + length) prefer the memory of numa_node, and those already touched move there.
+ * Does nothing for a numa_node of -1, or where NUMA policies are not supported. Returns 0 on success.
+ */
+int picoquic_numa_bind(void* addr, size_t length, int numa_node);
+
+/* The slabs prefer the memory of numa_node, -1 to leave the placement to the system */
+void picoquic_object_cache_set_numa_node(picoquic_object_cache_t* cache, int numa_node);
+
+/* Returns a zeroed object, or NULL on allocation failure */
+void* picoquic_object_cache_get(picoquic_object_cache_t* cache);
+void picoquic_object_cache_put(picoquic_object_cache_t* cache, void* object);
+
+/* Releases the slabs, the objects taken from the cache must not be used anymore */
+void picoquic_object_cache_free(picoquic_object_cache_t* cache);
+
+#endif
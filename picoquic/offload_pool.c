@@ -0,0 +1,159 @@
+#include "offload_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void* picoquic_offload_worker(void* arg)
+{
+    picoquic_offload_pool_t* pool = (picoquic_offload_pool_t*)arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop) {
+        picoquic_offload_job_t* job = pool->first;
+
+        if (job == NULL) {
+            pthread_cond_wait(&pool->job_queued, &pool->lock);
+            continue;
+        }
+
+        pool->first = job->next;
+        if (pool->first == NULL) {
+            pool->last = NULL;
+        }
+        job->next = NULL;
+        job->state = picoquic_offload_job_running;
+        pool->nb_running++;
+        pthread_mutex_unlock(&pool->lock);
+
+        job->run(job);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->nb_running--;
+        pool->nb_jobs_done++;
+        if (job->state == picoquic_offload_job_abandoned) {
+            job->release(job);
+        } else {
+            __atomic_store_n(&job->state, picoquic_offload_job_done, __ATOMIC_RELEASE);
+        }
+        pthread_cond_broadcast(&pool->job_ended);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+picoquic_offload_pool_t* picoquic_offload_pool_create(int nb_threads)
+{
+    picoquic_offload_pool_t* pool;
+
+    if (nb_threads <= 0 || nb_threads > PICOQUIC_OFFLOAD_POOL_MAX_THREADS) {
+        return NULL;
+    }
+
+    pool = (picoquic_offload_pool_t*)malloc(sizeof(picoquic_offload_pool_t));
+    if (pool != NULL) {
+        memset(pool, 0, sizeof(picoquic_offload_pool_t));
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->job_queued, NULL);
+        pthread_cond_init(&pool->job_ended, NULL);
+
+        for (int i = 0; i < nb_threads; i++) {
+            if (pthread_create(&pool->threads[i], NULL, picoquic_offload_worker, pool) != 0) {
+                picoquic_offload_pool_delete(pool);
+                pool = NULL;
+                break;
+            }
+            pool->nb_threads++;
+        }
+    }
+
+    return pool;
+}
+
+void picoquic_offload_pool_delete(picoquic_offload_pool_t* pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->job_queued);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nb_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    /* The jobs still queued will never run */
+    while (pool->first != NULL) {
+        picoquic_offload_job_t* job = pool->first;
+
+        pool->first = job->next;
+        job->release(job);
+    }
+
+    pthread_cond_destroy(&pool->job_ended);
+    pthread_cond_destroy(&pool->job_queued);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+void picoquic_offload_pool_wait_idle(picoquic_offload_pool_t* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->first != NULL || pool->nb_running > 0) {
+        pthread_cond_wait(&pool->job_ended, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void picoquic_offload_submit(picoquic_offload_pool_t* pool, picoquic_offload_job_t* job)
+{
+    job->next = NULL;
+    job->state = picoquic_offload_job_queued;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->last == NULL) {
+        pool->first = job;
+    } else {
+        pool->last->next = job;
+    }
+    pool->last = job;
+    pthread_cond_signal(&pool->job_queued);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int picoquic_offload_job_is_done(picoquic_offload_job_t* job)
+{
+    return __atomic_load_n(&job->state, __ATOMIC_ACQUIRE) == picoquic_offload_job_done;
+}
+
+void picoquic_offload_job_abandon(picoquic_offload_pool_t* pool, picoquic_offload_job_t* job)
+{
+    int is_released = 1;
+
+    pthread_mutex_lock(&pool->lock);
+    if (job->state == picoquic_offload_job_running) {
+        job->state = picoquic_offload_job_abandoned;
+        is_released = 0;
+    } else if (job->state == picoquic_offload_job_queued) {
+        picoquic_offload_job_t** previous = &pool->first;
+
+        pool->last = NULL;
+        while (*previous != NULL) {
+            if (*previous == job) {
+                *previous = job->next;
+            } else {
+                pool->last = *previous;
+                previous = &(*previous)->next;
+            }
+        }
+        /* Walking the whole queue also found its new last job */
+        pthread_cond_broadcast(&pool->job_ended);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (is_released) {
+        job->release(job);
+    }
+}
@@ -0,0 +1,57 @@
+/**
+ * \file offload_pool.h
+ * \brief Worker threads running the slow operations of a QUIC context out of its loop.
+ *
+ * The loop submits a job and goes on serving the other connections; it then polls the job, which a
+ * worker marks done once it ran. A job given up while queued is released right away, one given up
+ * while running is released by its worker when it returns.
+ */
+
+#ifndef OFFLOAD_POOL_H
+#define OFFLOAD_POOL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define PICOQUIC_OFFLOAD_POOL_MAX_THREADS 64
+
+typedef enum {
+    picoquic_offload_job_queued = 0,
+    picoquic_offload_job_running,
+    picoquic_offload_job_done,
+    picoquic_offload_job_abandoned /* Given up while running */
+} picoquic_offload_job_state_enum;
+
+typedef struct st_picoquic_offload_job_t {
+    void (*run)(struct st_picoquic_offload_job_t* job); /* Called from a worker thread */
+    void (*release)(struct st_picoquic_offload_job_t* job); /* Frees the job once it is abandoned */
+    struct st_picoquic_offload_job_t* next;
+    int state; /* picoquic_offload_job_state_enum, read without the lock by picoquic_offload_job_is_done() */
+} picoquic_offload_job_t;
+
+typedef struct st_picoquic_offload_pool_t {
+    pthread_mutex_t lock;
+    pthread_cond_t job_queued;
+    pthread_cond_t job_ended;
+    picoquic_offload_job_t* first;
+    picoquic_offload_job_t* last;
+    int nb_running;
+    int stop;
+    int nb_threads;
+    pthread_t threads[PICOQUIC_OFFLOAD_POOL_MAX_THREADS];
+    uint64_t nb_jobs_done;
+} picoquic_offload_pool_t;
+
+/* Starts nb_threads workers. Returns NULL on error */
+picoquic_offload_pool_t* picoquic_offload_pool_create(int nb_threads);
+/* Stops the workers once the running jobs returned, and releases the queued ones */
+void picoquic_offload_pool_delete(picoquic_offload_pool_t* pool);
+/* Waits until no job is queued or running */
+void picoquic_offload_pool_wait_idle(picoquic_offload_pool_t* pool);
+
+void picoquic_offload_submit(picoquic_offload_pool_t* pool, picoquic_offload_job_t* job);
+int picoquic_offload_job_is_done(picoquic_offload_job_t* job);
+/* Releases the job, now if it is not running, otherwise when it returns */
+void picoquic_offload_job_abandon(picoquic_offload_pool_t* pool, picoquic_offload_job_t* job);
+
+#endif
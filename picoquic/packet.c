@@ -36,6 +36,7 @@
 #include "plugin.h"
 #include "memory.h"
 #include "logger.h"
+#include "tracepoints.h"
 
 /*
  * The new packet header parsing is version dependent
@@ -324,26 +325,11 @@ uint64_t picoquic_get_packet_number64(uint64_t highest, uint64_t mask, uint32_t
 }
 
 /*
- * Decrypt the incoming packet.
- * Apply packet number decryption. This may require updating the
- * sequence number and the offset
+ * Remove the header protection, in place. This decodes the packet number, which sets the length of
+ * the header, and for short headers the key phase.
  */
-size_t  picoquic_decrypt_packet(picoquic_cnx_t* cnx,
-    uint8_t* bytes, size_t packet_length, picoquic_packet_header* ph,
-    void * hp_enc, void* aead_context, int * already_received, picoquic_path_t* path_from)
+static void picoquic_remove_header_protection(uint8_t* bytes, size_t length, picoquic_packet_header* ph, void* hp_enc)
 {
-    size_t decoded;
-    size_t length = ph->offset + ph->payload_length; /* this may change after decrypting the PN */
-
-    /* Might happen if the CID is not the one expected */
-    if (!path_from) {
-        path_from = cnx->path[0];
-    }
-
-    if (already_received != NULL) {
-        *already_received = 0;
-    }
-
     if (hp_enc != NULL)
     {
         /* The header length is not yet known, will only be known after the sequence number is decrypted */
@@ -398,11 +384,37 @@ size_t  picoquic_decrypt_packet(picoquic_cnx_t* cnx,
         DBG_PRINTF("PN dec not ready, type: %d, epoch: %d, pc: %d, pn: %d\n",
             ph->ptype, ph->epoch, ph->pc, (int)ph->pn);
     }
+}
+
+/*
+ * Decrypt the incoming packet.
+ * Apply packet number decryption. This may require updating the
+ * sequence number and the offset
+ * Both the header protection and the AEAD are removed in place, in the receive buffer, which the
+ * frames are then parsed from.
+ */
+size_t  picoquic_decrypt_packet(picoquic_cnx_t* cnx,
+    uint8_t* bytes, size_t packet_length, picoquic_packet_header* ph,
+    void * hp_enc, void* aead_context, int * already_received, picoquic_path_t* path_from)
+{
+    size_t decoded;
+    size_t length = ph->offset + ph->payload_length; /* this may change after decrypting the PN */
+
+    /* Might happen if the CID is not the one expected */
+    if (!path_from) {
+        path_from = cnx->path[0];
+    }
+
+    if (already_received != NULL) {
+        *already_received = 0;
+    }
+
+    picoquic_remove_header_protection(bytes, length, ph, hp_enc);
 
     /* Build a packet number to 64 bits */
     ph->pn64 = picoquic_get_packet_number64(
         (already_received==NULL)?path_from->pkt_ctx[ph->pc].send_sequence:
-        path_from->pkt_ctx[ph->pc].first_sack_item.end_of_sack_range, ph->pnmask, ph->pn);
+        picoquic_sack_list_first(&path_from->pkt_ctx[ph->pc].sack_list)->end_of_sack_range, ph->pnmask, ph->pn);
 
     /* verify that the packet is new */
     if (already_received != NULL && picoquic_is_pn_already_received(path_from, ph->pc, ph->pn64) != 0) {
@@ -410,6 +422,16 @@ size_t  picoquic_decrypt_packet(picoquic_cnx_t* cnx,
         *already_received = 1;
     }
 
+    /* A key phase other than the expected one is either the previous phase, for the packets sent
+     * before the last update, or the next one, which the caller confirms if the packet decrypts */
+    if (ph->epoch == 3 && hp_enc != NULL &&
+        (ph->ptype == picoquic_packet_1rtt_protected_phi1) != cnx->key_phase_dec) {
+        picoquic_crypto_context_t* ctx = &cnx->crypto_context[3];
+
+        aead_context = (ctx->aead_decrypt_old != NULL && ph->pn64 < ctx->first_pn_current_phase) ?
+            ctx->aead_decrypt_old : ctx->aead_decrypt_next;
+    }
+
     /* by conventions, values larger than input indicate error */
     decoded = picoquic_aead_decrypt_generic(bytes + ph->offset,
                 bytes + ph->offset, ph->payload_length, ph->pn64, bytes, ph->offset, aead_context);
@@ -417,6 +439,26 @@ size_t  picoquic_decrypt_packet(picoquic_cnx_t* cnx,
     return decoded;
 }
 
+/*
+ * Open an Initial packet that does not match a connection, before creating one, so that the packets
+ * which cannot be decrypted are dropped without allocating any state. The packet is decrypted in
+ * place, as picoquic_decrypt_packet() does for the first packets of a new connection.
+ */
+static size_t picoquic_open_initial_without_cnx(picoquic_quic_t* quic, uint8_t* bytes, picoquic_packet_header* ph)
+{
+    size_t decoded = (size_t)(-1ll);
+    picoquic_crypto_context_t* ctx = NULL;
+
+    if (picoquic_get_initial_decrypt_context(quic, ph->version_index, &ph->dest_cnx_id, &ctx) == 0) {
+        picoquic_remove_header_protection(bytes, ph->offset + ph->payload_length, ph, ctx->hp_dec);
+        ph->pn64 = picoquic_get_packet_number64(0, ph->pnmask, ph->pn);
+        decoded = picoquic_aead_decrypt_generic(bytes + ph->offset,
+            bytes + ph->offset, ph->payload_length, ph->pn64, bytes, ph->offset, ctx->aead_decrypt);
+    }
+
+    return decoded;
+}
+
 /**
  * See PROTOOP_NOPARAM_GET_INCOMING_PATH
  */
@@ -426,7 +468,8 @@ protoop_arg_t get_incoming_path(picoquic_cnx_t* cnx)
     picoquic_path_t* path_from = NULL;
 
     if (picoquic_compare_connection_id(&ph->dest_cnx_id, &cnx->initial_cnxid) == 0 ||
-        picoquic_compare_connection_id(&ph->dest_cnx_id, &cnx->path[0]->local_cnxid) == 0) {
+        picoquic_compare_connection_id(&ph->dest_cnx_id, &cnx->path[0]->local_cnxid) == 0 ||
+        (cnx->preferred_cnxid.id_len > 0 && picoquic_compare_connection_id(&ph->dest_cnx_id, &cnx->preferred_cnxid) == 0)) {
         path_from = cnx->path[0];
     }
 
@@ -441,12 +484,284 @@ picoquic_path_t* picoquic_get_incoming_path(
         ph);
 }
 
+/*
+ * Compute the retry token expected from the address of the client.
+ */
+
+static int picoquic_get_retry_token_for_addr(picoquic_quic_t* quic, struct sockaddr* addr_from,
+    uint8_t* token, uint8_t token_length)
+{
+    uint8_t * base;
+    size_t len;
+
+    if (addr_from->sa_family == AF_INET) {
+        struct sockaddr_in * a4 = (struct sockaddr_in *)addr_from;
+        len = 4;
+        base = (uint8_t *)&a4->sin_addr;
+    }
+    else {
+        struct sockaddr_in6 * a6 = (struct sockaddr_in6 *)addr_from;
+        len = 16;
+        base = (uint8_t *)&a6->sin6_addr;
+    }
+
+    return picoquic_get_retry_token(quic, base, len, token, token_length);
+}
+
+/*
+ * Queue a stateless retry packet.
+ *
+ * The retry is built from the parsed header alone, so that no connection
+ * context needs to exist: the destination is the client's source CID, the
+ * source is a fresh CID that the client will use as initial CID for its
+ * next attempt, and the ODCID echoes the CID of the rejected Initial.
+ */
+
+static void picoquic_queue_stateless_retry(picoquic_quic_t* quic,
+    picoquic_packet_header* ph, struct sockaddr* addr_from,
+    struct sockaddr* addr_to,
+    unsigned long if_index_to,
+    uint8_t * token,
+    size_t token_length)
+{
+    picoquic_stateless_packet_t* sp = picoquic_create_stateless_packet(quic);
+
+    if (sp != NULL) {
+        uint8_t* bytes = sp->bytes;
+        uint32_t byte_index = 0;
+        picoquic_connection_id_t srce_cnx_id;
+        uint8_t odcil_random = ((uint8_t)picoquic_public_uniform_random(256))&0xF0;
+
+        picoquic_create_random_cnx_id(quic, &srce_cnx_id, quic->local_ctx_length);
+        if (quic->cnx_id_callback_fn) {
+            quic->cnx_id_callback_fn(srce_cnx_id, ph->dest_cnx_id, quic->cnx_id_callback_ctx, &srce_cnx_id);
+        }
+
+        /* Long header, as picoquic_create_packet_header would produce it for a retry */
+        bytes[byte_index++] = (0xC0 | ((picoquic_long_packet_type_retry & 3) << 4)) | 0x3;
+        picoformat_32(bytes + byte_index, picoquic_supported_versions[ph->version_index].version);
+        byte_index += 4;
+        bytes[byte_index++] = ph->srce_cnx_id.id_len;
+        byte_index += picoquic_format_connection_id(bytes + byte_index, PICOQUIC_MAX_PACKET_SIZE - byte_index, ph->srce_cnx_id);
+        bytes[byte_index++] = srce_cnx_id.id_len;
+        byte_index += picoquic_format_connection_id(bytes + byte_index, PICOQUIC_MAX_PACKET_SIZE - byte_index, srce_cnx_id);
+
+        /* use same encoding as packet header */
+        bytes[byte_index++] = odcil_random|picoquic_create_packet_header_cnxid_lengths(0, ph->dest_cnx_id.id_len);
+
+        byte_index += picoquic_format_connection_id(bytes + byte_index,
+            PICOQUIC_MAX_PACKET_SIZE - byte_index, ph->dest_cnx_id);
+        memcpy(&bytes[byte_index], token, token_length);
+        byte_index += (uint32_t)token_length;
+
+        sp->length = byte_index;
+
+
+        memset(&sp->addr_to, 0, sizeof(sp->addr_to));
+        memcpy(&sp->addr_to, addr_from,
+            (addr_from->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+        memset(&sp->addr_local, 0, sizeof(sp->addr_local));
+        memcpy(&sp->addr_local, addr_to,
+            (addr_to->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+        sp->if_index_local = if_index_to;
+        picoquic_queue_stateless_packet(quic, sp);
+    }
+}
+
+/*
+ * Refuse an Initial packet that does not match any connection, while the context is overloaded, with a
+ * CONNECTION_CLOSE(SERVER_BUSY) in an Initial packet of the server. No connection context is created,
+ * the keys come from the cache of the Initial keys.
+ */
+static void picoquic_queue_stateless_busy_close(picoquic_quic_t* quic,
+    picoquic_packet_header* ph, struct sockaddr* addr_from,
+    struct sockaddr* addr_to,
+    unsigned long if_index_to)
+{
+    picoquic_crypto_context_t* ctx = NULL;
+    picoquic_stateless_packet_t* sp;
+
+    if (picoquic_get_initial_encrypt_context(quic, ph->version_index, &ph->dest_cnx_id, &ctx) == 0 &&
+        (sp = picoquic_create_stateless_packet(quic)) != NULL) {
+        uint8_t* bytes = sp->bytes;
+        uint8_t payload[16];
+        size_t payload_length = 0;
+        uint32_t byte_index = 0;
+        uint32_t pn_offset;
+        picoquic_connection_id_t srce_cnx_id;
+        uint8_t mask[5] = { 0, 0, 0, 0, 0 };
+
+        picoquic_create_random_cnx_id(quic, &srce_cnx_id, quic->local_ctx_length);
+        if (quic->cnx_id_callback_fn) {
+            quic->cnx_id_callback_fn(srce_cnx_id, ph->dest_cnx_id, quic->cnx_id_callback_ctx, &srce_cnx_id);
+        }
+
+        /* The frame is padded, so that the header protection finds its sample */
+        memset(payload, 0, sizeof(payload));
+        payload[payload_length++] = picoquic_frame_type_connection_close;
+        payload_length += picoquic_varint_encode(payload + payload_length, sizeof(payload) - payload_length,
+            PICOQUIC_TRANSPORT_SERVER_BUSY);
+        payload[payload_length++] = 0; /* Frame type */
+        payload[payload_length++] = 0; /* Reason phrase length */
+        payload_length = sizeof(payload);
+
+        /* Long header, as picoquic_create_packet_header would produce it for packet number 0 */
+        bytes[byte_index++] = (0xC0 | ((picoquic_long_packet_type_initial & 3) << 4)) | 0x3;
+        picoformat_32(bytes + byte_index, picoquic_supported_versions[ph->version_index].version);
+        byte_index += 4;
+        bytes[byte_index++] = ph->srce_cnx_id.id_len;
+        byte_index += picoquic_format_connection_id(bytes + byte_index, PICOQUIC_MAX_PACKET_SIZE - byte_index, ph->srce_cnx_id);
+        bytes[byte_index++] = srce_cnx_id.id_len;
+        byte_index += picoquic_format_connection_id(bytes + byte_index, PICOQUIC_MAX_PACKET_SIZE - byte_index, srce_cnx_id);
+        bytes[byte_index++] = 0; /* Token length */
+        picoquic_varint_encode_16(bytes + byte_index,
+            (uint16_t)(4 + payload_length + picoquic_aead_get_checksum_length(ctx->aead_encrypt)));
+        byte_index += 2;
+        pn_offset = byte_index;
+        picoformat_32(bytes + byte_index, 0);
+        byte_index += 4;
+
+        sp->length = byte_index + picoquic_aead_encrypt_generic(bytes + byte_index, payload, payload_length, 0,
+            bytes, byte_index, ctx->aead_encrypt);
+        picoquic_hp_encrypt(ctx->hp_enc, bytes + pn_offset + 4, mask, mask, 5);
+        bytes[0] ^= (mask[0] & 0x0F);
+        for (int i = 0; i < 4; i++) {
+            bytes[pn_offset + i] ^= mask[i + 1];
+        }
+
+        memset(&sp->addr_to, 0, sizeof(sp->addr_to));
+        memcpy(&sp->addr_to, addr_from,
+            (addr_from->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+        memset(&sp->addr_local, 0, sizeof(sp->addr_local));
+        memcpy(&sp->addr_local, addr_to,
+            (addr_to->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+        sp->if_index_local = if_index_to;
+        picoquic_queue_stateless_packet(quic, sp);
+    }
+}
+
+/*
+ * Check the token of an Initial packet that does not match any connection.
+ * This runs on the parsed header, before decryption and before any context
+ * is allocated, so that a flood of spoofed Initials only costs one hash and
+ * one stateless packet each. Returns 0 if the token is valid; otherwise a
+ * retry is queued and PICOQUIC_ERROR_RETRY is returned.
+ */
+
+static int picoquic_check_initial_token(picoquic_quic_t* quic, uint8_t* bytes,
+    picoquic_packet_header* ph, struct sockaddr* addr_from, struct sockaddr* addr_to,
+    unsigned long if_index_to)
+{
+    int ret = 0;
+    uint8_t token[PICOQUIC_RETRY_TOKEN_SIZE];
+
+    if (picoquic_get_retry_token_for_addr(quic, addr_from, token, sizeof(token)) != 0) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+    else {
+        uint8_t diff = 0;
+
+        if (ph->token_length != sizeof(token)) {
+            diff = 1;
+        }
+        else {
+            /* Compare in constant time, so the check does not leak the expected token */
+            for (size_t i = 0; i < sizeof(token); i++) {
+                diff |= token[i] ^ bytes[ph->token_offset + i];
+            }
+        }
+        if (diff != 0) {
+            picoquic_queue_stateless_retry(quic, ph, addr_from, addr_to, if_index_to, token, sizeof(token));
+            ret = PICOQUIC_ERROR_RETRY;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Decrypts a 1-RTT packet in place, and follows the key phase of the peer.
+ */
+static size_t picoquic_decrypt_1rtt_packet(picoquic_cnx_t* cnx, uint8_t* bytes, uint32_t length,
+    picoquic_packet_header* ph, uint64_t current_time, int* already_received, picoquic_path_t* path_from)
+{
+    size_t decoded_length;
+
+    picoquic_check_key_retention(cnx, current_time);
+    /* AEAD Decrypt, in place */
+    decoded_length = picoquic_decrypt_packet(cnx, bytes, length, ph,
+        cnx->crypto_context[3].hp_dec,
+        cnx->crypto_context[3].aead_decrypt, already_received, path_from);
+    if (decoded_length <= (length - ph->offset) &&
+        (ph->ptype == picoquic_packet_1rtt_protected_phi1) != cnx->key_phase_dec &&
+        ph->pn64 >= cnx->crypto_context[3].first_pn_current_phase) {
+        /* The peer moved to the next phase. Ours follows, unless we started the update */
+        int follow_enc = (cnx->key_phase_enc == cnx->key_phase_dec);
+
+        if (picoquic_rotate_key_phase(cnx, 0, current_time) == 0) {
+            cnx->crypto_context[3].first_pn_current_phase = ph->pn64;
+            if (follow_enc) {
+                (void)picoquic_rotate_key_phase(cnx, 1, current_time);
+            }
+        }
+    }
+
+    return decoded_length;
+}
+
+/*
+ * Once the connections are established, almost all packets have a short header. When the connection
+ * is found by its destination CID, the header is parsed and the packet decrypted without going through
+ * the version and long header checks. Returns -1 when the packet has to take the generic path, which
+ * also handles the stateless resets and the packets of unknown connections.
+ */
+static int picoquic_short_header_and_decrypt(picoquic_quic_t* quic, uint8_t* bytes, uint32_t length,
+    uint64_t current_time, picoquic_packet_header* ph, picoquic_cnx_t** pcnx, uint32_t* consumed)
+{
+    int ret = 0;
+    int already_received = 0;
+    size_t decoded_length;
+    picoquic_cnx_t* cnx;
+
+    memset(ph, 0, sizeof(picoquic_packet_header));
+    ph->offset = (uint32_t)(1 + picoquic_parse_connection_id(bytes + 1, quic->local_ctx_length, &ph->dest_cnx_id));
+    cnx = picoquic_cnx_by_id(quic, ph->dest_cnx_id);
+    if (cnx == NULL || picoquic_supported_versions[cnx->version_index].version_header_encoding != picoquic_version_header_29) {
+        return -1;
+    }
+
+    ph->ptype = picoquic_packet_1rtt_protected_phi0;
+    ph->pc = picoquic_packet_context_application;
+    ph->epoch = 3;
+    ph->version_index = cnx->version_index;
+    ph->has_spin_bit = 1;
+    ph->spin = (bytes[0] >> 5) & 1;
+    ph->pn_offset = ph->offset;
+    ph->payload_length = (uint16_t)(length - ph->offset);
+    *pcnx = cnx;
+    *consumed = length;
+
+    decoded_length = picoquic_decrypt_1rtt_packet(cnx, bytes, length, ph, current_time, &already_received,
+        picoquic_get_incoming_path(cnx, ph));
+    if (decoded_length > (length - ph->offset)) {
+        ret = PICOQUIC_ERROR_AEAD_CHECK;
+    } else if (already_received != 0) {
+        ret = PICOQUIC_ERROR_DUPLICATE;
+    } else {
+        ph->payload_length = (uint16_t)decoded_length;
+    }
+
+    return ret;
+}
+
 int picoquic_parse_header_and_decrypt(
     picoquic_quic_t* quic,
     uint8_t* bytes,
     uint32_t length,
     uint32_t packet_length,
     struct sockaddr* addr_from,
+    struct sockaddr* addr_to,
+    unsigned long if_index_to,
     uint64_t current_time,
     picoquic_packet_header* ph,
     picoquic_cnx_t** pcnx,
@@ -455,8 +770,18 @@ int picoquic_parse_header_and_decrypt(
 {
     /* Parse the clear text header. Ret == 0 means an incorrect packet that could not be parsed */
     int already_received = 0;
+    int is_initial_opened = 0;
     size_t decoded_length = 0;
-    int ret = picoquic_parse_packet_header(quic, bytes, length, addr_from, ph, pcnx, 1);
+    int ret;
+
+    if (quic->local_ctx_length > 0 && length > quic->local_ctx_length && (bytes[0] & 0xc0) == 0x40) {
+        ret = picoquic_short_header_and_decrypt(quic, bytes, length, current_time, ph, pcnx, consumed);
+        if (ret != -1) {
+            return ret;
+        }
+    }
+
+    ret = picoquic_parse_packet_header(quic, bytes, length, addr_from, ph, pcnx, 1);
 
     if (ret == 0) {
         /* TODO: clarify length, payload length, packet length -- special case of initial packet */
@@ -465,13 +790,44 @@ int picoquic_parse_header_and_decrypt(
 
 
         if (ph->ptype == picoquic_packet_initial) {
-            if ((*pcnx == NULL || !(*pcnx)->client_mode)) {
+            if (*pcnx == NULL && picoquic_tombstone_incoming(quic, &ph->dest_cnx_id, packet_length,
+                addr_from, addr_to, if_index_to, current_time)) {
+                /* Late Initial of a closed connection, which must not be opened again */
+                ret = PICOQUIC_ERROR_DETECTED;
+                quic->nb_initial_rejected[picoquic_initial_reject_closed]++;
+            }
+            else if ((*pcnx == NULL || !(*pcnx)->client_mode)) {
                 /* Create a connection context if the CI is acceptable */
                 if (packet_length < PICOQUIC_ENFORCED_INITIAL_MTU) {
                     /* Unexpected packet. Reject, drop and log. */
                     ret = PICOQUIC_ERROR_INITIAL_TOO_SHORT;
+                    quic->nb_initial_rejected[picoquic_initial_reject_too_short]++;
+                }
+            }
+            if (ret == 0 && *pcnx == NULL &&
+                ((quic->flags&picoquic_context_check_token) || quic->overload_level >= picoquic_overload_retry)) {
+                /* Validate the token, or send a retry, before committing any state */
+                ret = picoquic_check_initial_token(quic, bytes, ph, addr_from, addr_to, if_index_to);
+                if (ret != 0) {
+                    quic->nb_initial_rejected[picoquic_initial_reject_token]++;
                 }
             }
+            if (ret == 0 && *pcnx == NULL) {
+                /* Then decrypt it, with keys cached by destination CID */
+                decoded_length = picoquic_open_initial_without_cnx(quic, bytes, ph);
+                if (decoded_length > (length - ph->offset)) {
+                    ret = PICOQUIC_ERROR_AEAD_CHECK;
+                    quic->nb_initial_rejected[picoquic_initial_reject_aead]++;
+                } else {
+                    is_initial_opened = 1;
+                }
+            }
+            if (ret == 0 && *pcnx == NULL && quic->overload_level >= picoquic_overload_reject) {
+                /* Only refused once it proved to be a genuine Initial */
+                picoquic_queue_stateless_busy_close(quic, ph, addr_from, addr_to, if_index_to);
+                ret = PICOQUIC_ERROR_DETECTED;
+                quic->nb_initial_rejected[picoquic_initial_reject_busy]++;
+            }
             if (ret == 0 && *pcnx == NULL) {
                 /* if listening is OK, listen */
                 *pcnx = picoquic_create_cnx(quic, ph->dest_cnx_id, ph->srce_cnx_id, addr_from, current_time, ph->vn,
@@ -489,9 +845,11 @@ int picoquic_parse_header_and_decrypt(
                 /* Packet is not encrypted */
                 break;
             case picoquic_packet_initial:
-                decoded_length = picoquic_decrypt_packet(*pcnx, bytes, packet_length, ph,
-                    (*pcnx)->crypto_context[0].hp_dec,
-                    (*pcnx)->crypto_context[0].aead_decrypt, &already_received, path_from);
+                if (!is_initial_opened) {
+                    decoded_length = picoquic_decrypt_packet(*pcnx, bytes, packet_length, ph,
+                        (*pcnx)->crypto_context[0].hp_dec,
+                        (*pcnx)->crypto_context[0].aead_decrypt, &already_received, path_from);
+                }
                 length = ph->offset + ph->payload_length;
                 *consumed = length;
                 break;
@@ -514,11 +872,8 @@ int picoquic_parse_header_and_decrypt(
                 break;
             case picoquic_packet_1rtt_protected_phi0:
             case picoquic_packet_1rtt_protected_phi1:
-                /* TODO : roll key based on PHI */
-                /* AEAD Decrypt, in place */
-                decoded_length = picoquic_decrypt_packet(*pcnx, bytes, length, ph,
-                    (*pcnx)->crypto_context[3].hp_dec,
-                    (*pcnx)->crypto_context[3].aead_decrypt, &already_received, path_from);
+                decoded_length = picoquic_decrypt_1rtt_packet(*pcnx, bytes, length, ph, current_time,
+                    &already_received, path_from);
                 break;
             default:
                 /* Packet type error. Log and ignore */
@@ -703,59 +1058,6 @@ void picoquic_process_unexpected_cnxid(
     }
 }
 
-/*
- * Queue a stateless retry packet
- */
-
-void picoquic_queue_stateless_retry(picoquic_cnx_t* cnx,
-    picoquic_packet_header* ph, struct sockaddr* addr_from,
-    struct sockaddr* addr_to,
-    unsigned long if_index_to,
-    uint8_t * token,
-    size_t token_length)
-{
-    picoquic_stateless_packet_t* sp = picoquic_create_stateless_packet(cnx->quic);
-    size_t checksum_length = picoquic_get_checksum_length(cnx, 1);
-
-    if (sp != NULL) {
-        uint8_t* bytes = sp->bytes;
-        uint32_t byte_index = 0;
-        size_t data_bytes = 0;
-        uint32_t header_length = 0;
-        uint32_t pn_offset;
-        uint32_t pn_length;
-        uint8_t odcil_random = ((uint8_t)picoquic_public_uniform_random(256))&0xF0;
-
-        cnx->path[0]->remote_cnxid = ph->srce_cnx_id;
-
-        byte_index = header_length = picoquic_create_packet_header(cnx, picoquic_packet_retry,
-            cnx->path[0],
-            0, bytes, &pn_offset, &pn_length);
-
-
-        /* use same encoding as packet header */
-        bytes[byte_index++] = odcil_random|picoquic_create_packet_header_cnxid_lengths(0, cnx->initial_cnxid.id_len);
-
-        byte_index += picoquic_format_connection_id(bytes + byte_index,
-            PICOQUIC_MAX_PACKET_SIZE - byte_index - checksum_length, cnx->initial_cnxid);
-        byte_index += (uint32_t)data_bytes;
-        memcpy(&bytes[byte_index], token, token_length);
-        byte_index += (uint32_t)token_length;
-
-        sp->length = byte_index;
-
-
-        memset(&sp->addr_to, 0, sizeof(sp->addr_to));
-        memcpy(&sp->addr_to, addr_from,
-            (addr_from->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
-        memset(&sp->addr_local, 0, sizeof(sp->addr_local));
-        memcpy(&sp->addr_local, addr_to,
-            (addr_to->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
-        sp->if_index_local = if_index_to;
-        picoquic_queue_stateless_packet(cnx->quic, sp);
-    }
-}
-
 /*
  * Processing of an incoming client initial packet,
  * on an unknown connection context.
@@ -774,39 +1076,7 @@ int picoquic_incoming_initial(
     int ret = 0;
     size_t extra_offset = 0;
 
-    /* Logic to test the retry token.
-     * TODO: this should probably be implemented as a callback */
-    if ((*pcnx)->quic->flags&picoquic_context_check_token) {
-        uint8_t * base;
-        size_t len;
-        uint8_t token[16];
-
-        if (addr_from->sa_family == AF_INET) {
-            struct sockaddr_in * a4 = (struct sockaddr_in *)addr_from;
-            len = 4;
-            base = (uint8_t *)&a4->sin_addr;
-        }
-        else {
-            struct sockaddr_in6 * a6 = (struct sockaddr_in6 *)addr_from;
-            len = 16;
-            base = (uint8_t *)&a6->sin6_addr;
-        }
-
-        if (picoquic_get_retry_token((*pcnx)->quic, base, len,
-            token, sizeof(token)) != 0)
-        {
-            ret = PICOQUIC_ERROR_MEMORY;
-        }
-        else {
-            if (ph->token_length != sizeof(token) ||
-                memcmp(token, bytes + ph->token_offset, sizeof(token)) != 0)
-            {
-                picoquic_queue_stateless_retry(*pcnx, ph,
-                    addr_from, addr_to, if_index_to, token, sizeof(token));
-                ret = PICOQUIC_ERROR_RETRY;
-            }
-        }
-    }
+    /* The retry token, if required, was verified before the context was created */
 
     /* decode the incoming frames */
     if (ret == 0) {
@@ -908,6 +1178,7 @@ int picoquic_incoming_retry(
     if (ret == 0) {
         /* reset the initial CNX_ID to the version sent by the server */
         cnx->initial_cnxid = ph->srce_cnx_id;
+        picoquic_reset_cnx_header_templates(cnx);
 
         /* keep a copy of the retry token */
         if (cnx->retry_token != NULL) {
@@ -955,6 +1226,7 @@ int picoquic_incoming_server_cleartext(
     if (picoquic_is_connection_id_null(cnx->path[0]->remote_cnxid) && restricted == 0) {
         /* On first response from the server, copy the cnx ID and the incoming address */
         cnx->path[0]->remote_cnxid = ph->srce_cnx_id;
+        picoquic_reset_header_templates(cnx->path[0]);
         cnx->path[0]->local_addr_len = (addr_to->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
         memcpy(&cnx->path[0]->local_addr, addr_to, cnx->path[0]->local_addr_len);
     }
@@ -1132,7 +1404,7 @@ protoop_arg_t incoming_encrypted(picoquic_cnx_t *cnx)
     }
     else {
         /* Packet is correct */
-        if (ph->pn64 > path_x->pkt_ctx[pc].first_sack_item.end_of_sack_range) {
+        if (ph->pn64 > picoquic_sack_list_first(&path_x->pkt_ctx[pc].sack_list)->end_of_sack_range) {
             cnx->current_spin = ph->spin ^ cnx->client_mode;
             if (ph->has_spin_bit && cnx->current_spin != cnx->prev_spin) {
                 // got an edge
@@ -1172,8 +1444,10 @@ protoop_arg_t incoming_encrypted(picoquic_cnx_t *cnx)
             }
         }
         else {
-            /* Compare the packet address to the current path value */
-            if (picoquic_compare_addr((struct sockaddr *)&path_x->peer_addr,
+            /* Compare the packet address to the current path value. Once the client moved to the preferred address,
+             * the packets still coming from the former one do not move it back */
+            if (!(cnx->client_mode && cnx->preferred_address_used) &&
+                picoquic_compare_addr((struct sockaddr *)&path_x->peer_addr,
                 (struct sockaddr *)addr_from) != 0 &&
                 (((addr_from->sa_family != AF_INET) || ((struct sockaddr_in *) addr_from)->sin_addr.s_addr != 0))) /* This line is a pure hotfix for UDP src address being 0.0.0.0 */
             { // TODO: Handle equivalent IPv4 encoded in IPv6
@@ -1198,6 +1472,10 @@ protoop_arg_t incoming_encrypted(picoquic_cnx_t *cnx)
                 path_x->challenge_verified = 0;
                 path_x->challenge_time = current_time + path_x->retransmit_timer;
                 path_x->challenge_repeat_count = 0;
+                if (!cnx->client_mode && path_x == cnx->path[0]) {
+                    /* Most often the NAT of the client forgot its binding while the connection was idle */
+                    picoquic_keep_alive_rebinding(cnx);
+                }
                 protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PEER_ADDRESS_CHANGED, NULL, path_x);
             }
 
@@ -1270,9 +1548,9 @@ int picoquic_incoming_segment(
 
     /* Parse the header and decrypt the packet */
     ret = picoquic_parse_header_and_decrypt(quic, bytes, length, packet_length, addr_from,
-        current_time, &ph, &cnx, consumed, new_context_created);
+        addr_to, if_index_to, current_time, &ph, &cnx, consumed, new_context_created);
 
-    if (cnx != NULL) LOG {
+    if (cnx != NULL) {
         PUSH_LOG_CTX(cnx, "\"packet_type\": \"%s\", \"pn\": %" PRIu64, picoquic_log_ptype_name(ph.ptype), ph.pn64);
     }
 
@@ -1291,7 +1569,11 @@ int picoquic_incoming_segment(
     }
 
     /* Log the incoming packet */
-    picoquic_log_decrypted_segment(quic->F_log, 1, cnx, 1, &ph, bytes, (uint32_t)*consumed, ret);
+    if (quic->F_binlog != NULL) {
+        picoquic_binlog_incoming_segment(quic, cnx, &ph, bytes, (uint32_t)*consumed, ret);
+    } else {
+        picoquic_log_decrypted_segment(quic->F_log, 1, cnx, 1, &ph, bytes, (uint32_t)*consumed, ret);
+    }
 
     if (ret == 0) {
         if (cnx == NULL) {
@@ -1300,8 +1582,9 @@ int picoquic_incoming_segment(
                 picoquic_prepare_version_negotiation(quic, addr_from, addr_to, if_index_to, &ph);
             }
             else {
-                /* Unexpected packet. Reject, drop and log. */
-                if (!picoquic_is_connection_id_null(ph.dest_cnx_id)) {
+                /* Unexpected packet. Reject, drop and log. The tombstone of a closed connection answers instead of a reset */
+                if (!picoquic_is_connection_id_null(ph.dest_cnx_id) &&
+                    !picoquic_tombstone_incoming(quic, &ph.dest_cnx_id, packet_length, addr_from, addr_to, if_index_to, current_time)) {
                     picoquic_process_unexpected_cnxid(quic, length, addr_from, addr_to, if_index_to, &ph);
                 }
                 ret = PICOQUIC_ERROR_DETECTED;
@@ -1311,10 +1594,15 @@ int picoquic_incoming_segment(
             /* TO DO: Find the incoming path */
             /* TO DO: update each of the incoming functions, since the packet is already decrypted. */
             /* Hook for performing action when connection received new packet */
+            picoquic_wake_cnx(cnx);
             picoquic_received_packet(cnx, quic->rcv_socket, quic->rcv_tos);
             picoquic_path_t *path = (picoquic_path_t *) protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_GET_INCOMING_PATH, NULL, &ph);
+            if (path != NULL && quic->rcv_socket != INVALID_SOCKET) {
+                path->rcv_socket = quic->rcv_socket;
+            }
+            picoquic_ecn_packet_received(path, &ph, quic->rcv_tos);
             picoquic_header_parsed(cnx, &ph, path, *consumed);
-            if (cnx != NULL) LOG {
+            if (cnx != NULL) {
                 PUSH_LOG_CTX(cnx, "\"path\": \"%p\"", path);
             }
 
@@ -1339,6 +1627,7 @@ int picoquic_incoming_segment(
                     /* Verify that the source CID matches expectation */
                     if (picoquic_is_connection_id_null(cnx->path[0]->remote_cnxid)) {
                         cnx->path[0]->remote_cnxid = ph.srce_cnx_id;
+                        picoquic_reset_header_templates(cnx->path[0]);
                         cnx->path[0]->local_addr_len = (addr_to->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
                         memcpy(&cnx->path[0]->local_addr, addr_to, cnx->path[0]->local_addr_len);
                     } else if (picoquic_compare_connection_id(&cnx->path[0]->remote_cnxid, &ph.srce_cnx_id) != 0) {
@@ -1394,7 +1683,7 @@ int picoquic_incoming_segment(
                 ret = PICOQUIC_ERROR_DETECTED;
                 break;
             }
-            if (cnx != NULL) LOG {
+            if (cnx != NULL) {
                 POP_LOG_CTX(cnx);
             }
         }
@@ -1402,13 +1691,26 @@ int picoquic_incoming_segment(
         ret = picoquic_incoming_stateless_reset(cnx);
     }
 
+    PICOQUIC_TRACE5(incoming_segment,
+        picoquic_val64_connection_id((cnx != NULL) ? picoquic_get_logging_cnxid(cnx) : ph.dest_cnx_id),
+        (int)ph.ptype, ph.pn64, (uint64_t)*consumed, ret);
+
     if (ret == 0 || ret == PICOQUIC_ERROR_SPURIOUS_REPEAT) {
         if (cnx != NULL && cnx->cnx_state != picoquic_state_disconnected &&
             ph.ptype != picoquic_packet_version_negotiation) {
             /* Mark the sequence number as received */
             /* FIXME */
             picoquic_path_t* path_x = picoquic_get_incoming_path(cnx, &ph);
+            path_x->counters.packets_received++;
+            path_x->counters.bytes_received += *consumed;
             ret = picoquic_record_pn_received(cnx, path_x, ph.pc, ph.pn64, current_time);
+            /* The client moved to the preferred address, the replies leave from it */
+            if (!cnx->client_mode && addr_to != NULL && cnx->preferred_cnxid.id_len > 0 &&
+                picoquic_compare_connection_id(&ph.dest_cnx_id, &cnx->preferred_cnxid) == 0 &&
+                picoquic_compare_addr((struct sockaddr*)&path_x->local_addr, addr_to) != 0) {
+                path_x->local_addr_len = (addr_to->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+                memcpy(&path_x->local_addr, addr_to, path_x->local_addr_len);
+            }
         }
         if (cnx != NULL) {
             picoquic_cnx_set_next_wake_time(cnx, current_time);
@@ -1444,7 +1746,7 @@ int picoquic_incoming_segment(
         ret = -1;
     }
 
-    if (cnx != NULL) LOG {
+    if (cnx != NULL) {
         POP_LOG_CTX(cnx);
     }
 
@@ -1471,6 +1773,7 @@ int picoquic_incoming_packet(
     uint32_t consumed_index = 0;
     int ret = 0;
     picoquic_connection_id_t previous_destid = picoquic_null_connection_id;
+    uint64_t profile_start = picoquic_profile_start(quic);
 
 
     while (consumed_index < length) {
@@ -1488,6 +1791,10 @@ int picoquic_incoming_packet(
         }
     }
 
+    /* The receive time set by the application only applies to this datagram */
+    quic->rcv_time = 0;
+    picoquic_profile_end(quic, picoquic_profile_incoming, profile_start);
+
     return ret;
 }
 
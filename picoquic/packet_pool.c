@@ -0,0 +1,231 @@
+#include "packet_pool.h"
+#include "object_cache.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+void picoquic_packet_pool_init(picoquic_packet_pool_t* pool)
+{
+    memset(pool, 0, sizeof(picoquic_packet_pool_t));
+    pool->max_free_packets = PICOQUIC_PACKET_POOL_DEFAULT_MAX;
+    pool->numa_node = -1;
+}
+
+void picoquic_packet_pool_set_numa_node(picoquic_packet_pool_t* pool, int numa_node)
+{
+    pool->numa_node = numa_node;
+    if (pool->slab != NULL) {
+        (void)picoquic_numa_bind(pool->slab, pool->slab_size, numa_node);
+    }
+}
+
+static int picoquic_packet_pool_in_slab(picoquic_packet_pool_t* pool, picoquic_packet_t* packet)
+{
+    return pool->slab != NULL && (uint8_t*)packet >= pool->slab &&
+        (uint8_t*)packet < pool->slab + (size_t)pool->nb_slab_packets * sizeof(picoquic_packet_t);
+}
+
+static void picoquic_packet_pool_release(picoquic_packet_t* packet)
+{
+    free(packet->bytes);
+    free(packet);
+}
+
+static int picoquic_packet_pool_map_slab(picoquic_packet_pool_t* pool, uint32_t nb_packets)
+{
+    size_t packet_size = sizeof(picoquic_packet_t) + PICOQUIC_MAX_PACKET_SIZE;
+    size_t size = (size_t)nb_packets * packet_size;
+    size = (size + PICOQUIC_PACKET_POOL_HUGEPAGE_SIZE - 1) & ~((size_t)PICOQUIC_PACKET_POOL_HUGEPAGE_SIZE - 1);
+
+    uint8_t* slab = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    slab = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (slab == MAP_FAILED) {
+        /* No reserved huge pages, let the kernel back the slab with transparent ones if it can */
+        slab = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slab == MAP_FAILED) {
+            fprintf(stderr, "cannot map %zu bytes for the packet pool !\n", size);
+            return -1;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(slab, size, MADV_HUGEPAGE);
+#endif
+    }
+    (void)picoquic_numa_bind(slab, size, pool->numa_node);
+    pool->slab = slab;
+    pool->slab_size = size;
+
+    /* Use the whole mapping, it is rounded up anyway */
+    pool->nb_slab_packets = (uint32_t)(size / packet_size);
+    picoquic_packet_t* packets = (picoquic_packet_t*)slab;
+    uint8_t* payloads = slab + (size_t)pool->nb_slab_packets * sizeof(picoquic_packet_t);
+    for (uint32_t i = 0; i < pool->nb_slab_packets; i++) {
+        packets[i].bytes = payloads + (size_t)i * PICOQUIC_MAX_PACKET_SIZE;
+        packets[i].bytes_max = PICOQUIC_MAX_PACKET_SIZE;
+        packets[i].next_packet = pool->free_packets;
+        pool->free_packets = &packets[i];
+        pool->nb_free_packets++;
+    }
+    return 0;
+}
+
+static void picoquic_packet_pool_trim(picoquic_packet_pool_t* pool, picoquic_packet_t** pnext, uint32_t* nb_free)
+{
+    uint32_t nb_heap_packets = 0;
+
+    while (*pnext != NULL) {
+        picoquic_packet_t* packet = *pnext;
+        if (!picoquic_packet_pool_in_slab(pool, packet) && ++nb_heap_packets > pool->max_free_packets) {
+            *pnext = packet->next_packet;
+            (*nb_free)--;
+            picoquic_packet_pool_release(packet);
+        } else {
+            pnext = &packet->next_packet;
+        }
+    }
+}
+
+int picoquic_packet_pool_configure(picoquic_packet_pool_t* pool, uint32_t max_free_packets, int use_hugepages)
+{
+    if (use_hugepages && (pool->slab != NULL || pool->stats.packet_hits + pool->stats.packet_misses > 0)) {
+        fprintf(stderr, "the packet pool can only be backed by huge pages before its first use !\n");
+        return -1;
+    }
+    pool->max_free_packets = max_free_packets;
+
+    /* Give back the heap packets now exceeding the bound */
+    picoquic_packet_pool_trim(pool, &pool->free_packets, &pool->nb_free_packets);
+    picoquic_packet_pool_trim(pool, &pool->free_jumbo_packets, &pool->nb_free_jumbo_packets);
+
+    return use_hugepages && max_free_packets > 0 ? picoquic_packet_pool_map_slab(pool, max_free_packets) : 0;
+}
+
+picoquic_packet_t* picoquic_packet_pool_get(picoquic_packet_pool_t* pool, size_t bytes_max)
+{
+    int is_jumbo = bytes_max > PICOQUIC_MAX_PACKET_SIZE;
+    picoquic_packet_t** free_packets = (is_jumbo) ? &pool->free_jumbo_packets : &pool->free_packets;
+    picoquic_packet_t* packet = *free_packets;
+
+    if (bytes_max > PICOQUIC_MAX_JUMBO_PACKET_SIZE) {
+        return NULL;
+    }
+    if (packet != NULL) {
+        *free_packets = packet->next_packet;
+        if (is_jumbo) {
+            pool->nb_free_jumbo_packets--;
+        } else {
+            pool->nb_free_packets--;
+        }
+        pool->stats.packet_hits++;
+    } else {
+        uint32_t size = (is_jumbo) ? PICOQUIC_MAX_JUMBO_PACKET_SIZE : PICOQUIC_MAX_PACKET_SIZE;
+        packet = (picoquic_packet_t*)malloc(sizeof(picoquic_packet_t));
+        uint8_t* bytes = (uint8_t*)malloc(size);
+        if (packet == NULL || bytes == NULL) {
+            free(packet);
+            free(bytes);
+            return NULL;
+        }
+        packet->bytes = bytes;
+        packet->bytes_max = size;
+        pool->stats.packet_misses++;
+    }
+    /* The payload is always written before being sent, padding included */
+    uint8_t* bytes = packet->bytes;
+    uint32_t size = packet->bytes_max;
+    memset(packet, 0, sizeof(picoquic_packet_t));
+    packet->bytes = bytes;
+    packet->bytes_max = size;
+    return packet;
+}
+
+void picoquic_packet_pool_put(picoquic_packet_pool_t* pool, picoquic_packet_t* packet)
+{
+    if (packet->bytes == NULL) {
+        free(packet);
+    } else if (packet->bytes_max > PICOQUIC_MAX_PACKET_SIZE) {
+        if (pool->nb_free_jumbo_packets < pool->max_free_packets) {
+            packet->next_packet = pool->free_jumbo_packets;
+            pool->free_jumbo_packets = packet;
+            pool->nb_free_jumbo_packets++;
+        } else {
+            pool->stats.packet_overflows++;
+            picoquic_packet_pool_release(packet);
+        }
+    } else if (picoquic_packet_pool_in_slab(pool, packet) || pool->nb_free_packets < pool->max_free_packets) {
+        packet->next_packet = pool->free_packets;
+        pool->free_packets = packet;
+        pool->nb_free_packets++;
+    } else {
+        pool->stats.packet_overflows++;
+        picoquic_packet_pool_release(packet);
+    }
+}
+
+void picoquic_packet_pool_drop_payload(picoquic_packet_pool_t* pool, picoquic_packet_t* packet)
+{
+    if (!picoquic_packet_pool_in_slab(pool, packet)) {
+        free(packet->bytes);
+        packet->bytes = NULL;
+        packet->bytes_max = 0;
+    }
+}
+
+picoquic_packet_plugin_frame_t* picoquic_packet_pool_get_frame(picoquic_packet_pool_t* pool)
+{
+    picoquic_packet_plugin_frame_t* frame = pool->free_frames;
+    if (frame != NULL) {
+        pool->free_frames = frame->next;
+        pool->nb_free_frames--;
+        pool->stats.frame_hits++;
+    } else {
+        frame = (picoquic_packet_plugin_frame_t*)malloc(sizeof(picoquic_packet_plugin_frame_t));
+        if (frame != NULL) {
+            pool->stats.frame_misses++;
+        }
+    }
+    return frame;
+}
+
+void picoquic_packet_pool_put_frame(picoquic_packet_pool_t* pool, picoquic_packet_plugin_frame_t* frame)
+{
+    if (pool->nb_free_frames < PICOQUIC_PACKET_POOL_FRAMES_MAX) {
+        frame->next = pool->free_frames;
+        pool->free_frames = frame;
+        pool->nb_free_frames++;
+    } else {
+        free(frame);
+    }
+}
+
+void picoquic_packet_pool_free(picoquic_packet_pool_t* pool)
+{
+    while (pool->free_packets != NULL) {
+        picoquic_packet_t* packet = pool->free_packets;
+        pool->free_packets = packet->next_packet;
+        if (!picoquic_packet_pool_in_slab(pool, packet)) {
+            picoquic_packet_pool_release(packet);
+        }
+    }
+    while (pool->free_jumbo_packets != NULL) {
+        picoquic_packet_t* packet = pool->free_jumbo_packets;
+        pool->free_jumbo_packets = packet->next_packet;
+        picoquic_packet_pool_release(packet);
+    }
+    while (pool->free_frames != NULL) {
+        picoquic_packet_plugin_frame_t* frame = pool->free_frames;
+        pool->free_frames = frame->next;
+        free(frame);
+    }
+    if (pool->slab != NULL) {
+        munmap(pool->slab, pool->slab_size);
+        pool->slab = NULL;
+    }
+    pool->nb_slab_packets = 0;
+    pool->nb_free_packets = 0;
+    pool->nb_free_jumbo_packets = 0;
+    pool->nb_free_frames = 0;
+}
@@ -0,0 +1,67 @@
+/**
+ * \file packet_pool.h
+ * \brief Recycling of the packets sent by the connections of a picoquic context.
+ *
+ * Each sent packet stays allocated until it is acknowledged or declared lost, so packets are
+ * allocated and freed at the sending rate. The pool keeps a bounded freelist of packets and of the
+ * plugin frame records attached to them, optionally backed by a slab of huge pages.
+ *
+ * Packets come in two size classes: standard ones of PICOQUIC_MAX_PACKET_SIZE bytes, and jumbo ones of
+ * PICOQUIC_MAX_JUMBO_PACKET_SIZE bytes for the connections that may send larger datagrams, see
+ * picoquic_set_max_packet_size(). Each class has its own freelist, only the standard one uses the slab.
+ */
+
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+#include "picoquic.h"
+
+#define PICOQUIC_PACKET_POOL_DEFAULT_MAX 256 /* Packets kept in the freelist by default */
+#define PICOQUIC_PACKET_POOL_FRAMES_MAX 1024 /* Plugin frame records kept in the freelist */
+#define PICOQUIC_PACKET_POOL_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+typedef struct st_picoquic_packet_pool_t {
+    picoquic_packet_t* free_packets; /* Chained by next_packet */
+    picoquic_packet_t* free_jumbo_packets;
+    picoquic_packet_plugin_frame_t* free_frames; /* Chained by next */
+    uint32_t nb_free_packets;
+    uint32_t nb_free_jumbo_packets;
+    uint32_t max_free_packets; /* Heap packets beyond that bound are freed, in each class */
+    uint32_t nb_free_frames;
+    /* Packets carved from the slab always come back to the freelist, they are released with the pool.
+     * The slab starts with the packets, followed by their payloads. */
+    uint8_t* slab;
+    size_t slab_size;
+    uint32_t nb_slab_packets;
+    int numa_node; /* Of the slab, -1 if the placement is left to the system */
+    picoquic_packet_pool_stats_t stats;
+} picoquic_packet_pool_t;
+
+void picoquic_packet_pool_init(picoquic_packet_pool_t* pool);
+
+/**
+ * Changes the bound of the freelist. With use_hugepages, a slab of huge pages holding max_free_packets
+ * packets is reserved, falling back on transparent huge pages if none is available.
+ * The slab can only be set up once, when no packet was taken yet. Returns 0 on success.
+ */
+int picoquic_packet_pool_configure(picoquic_packet_pool_t* pool, uint32_t max_free_packets, int use_hugepages);
+
+/* The slab prefers the memory of numa_node, whether it is already mapped or not, -1 to leave the placement to the system */
+void picoquic_packet_pool_set_numa_node(picoquic_packet_pool_t* pool, int numa_node);
+
+/* Returns a packet whose fields are zeroed, with a payload buffer that is not, or NULL on allocation failure.
+ * The buffer holds at least bytes_max bytes, its size is in packet->bytes_max. A recycled packet keeps its buffer. */
+picoquic_packet_t* picoquic_packet_pool_get(picoquic_packet_pool_t* pool, size_t bytes_max);
+void picoquic_packet_pool_put(picoquic_packet_pool_t* pool, picoquic_packet_t* packet);
+
+/* Frees the payload buffer of a packet that no longer needs its bytes, unless it comes from the slab.
+ * The packet is released instead of recycled when it is given back. */
+void picoquic_packet_pool_drop_payload(picoquic_packet_pool_t* pool, picoquic_packet_t* packet);
+
+picoquic_packet_plugin_frame_t* picoquic_packet_pool_get_frame(picoquic_packet_pool_t* pool);
+void picoquic_packet_pool_put_frame(picoquic_packet_pool_t* pool, picoquic_packet_plugin_frame_t* frame);
+
+/* All the packets taken from the pool must have been given back */
+void picoquic_packet_pool_free(picoquic_packet_pool_t* pool);
+
+#endif
@@ -20,27 +20,106 @@
 */
 
 /*
- * Basic hash implementation, like we have seen tons off already.
+ * Open addressing hash table, resized incrementally.
  */
 #include "picohash.h"
 #include <stdlib.h>
 #include <string.h>
 
+#define PICOHASH_MIN_SLOTS 16
+/* Slots of the old table moved at each insertion or deletion. Moving 8 slots per insertion empties
+ * the old table well before the new one, twice as large, reaches its maximum load */
+#define PICOHASH_MOVES_PER_OPERATION 8
+
+/* Marks the slots of the old table whose item moved or was deleted, so that probes go past them */
+static char picohash_tombstone;
+
+/* The caller hash is not expected to be spread over all bits, e.g. when it is made of the first
+ * bytes of a connection ID, hence this finalizer */
+static uint64_t picohash_mix(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+static int picohash_is_overloaded(size_t nb_used, size_t nb_slots)
+{
+    return 4 * nb_used > 3 * nb_slots;
+}
+
+static picohash_item* picohash_find(picohash_table* hash_table, picohash_item* slots, size_t nb_slots,
+    uint64_t hash, void* key)
+{
+    size_t mask = nb_slots - 1;
+    size_t index = (size_t)hash & mask;
+
+    while (slots[index].key != NULL) {
+        if (slots[index].hash == hash && slots[index].key != &picohash_tombstone &&
+            hash_table->picohash_compare(key, slots[index].key) == 0) {
+            return &slots[index];
+        }
+        index = (index + 1) & mask;
+    }
+
+    return NULL;
+}
+
+/* The new table has no tombstone and always has free slots */
+static void picohash_place(picohash_table* hash_table, uint64_t hash, void* key)
+{
+    size_t mask = hash_table->nb_slots - 1;
+    size_t index = (size_t)hash & mask;
+
+    while (hash_table->slots[index].key != NULL) {
+        index = (index + 1) & mask;
+    }
+    hash_table->slots[index].hash = hash;
+    hash_table->slots[index].key = key;
+    hash_table->nb_used++;
+}
+
+static void picohash_move_old_slots(picohash_table* hash_table, size_t nb_moves)
+{
+    while (hash_table->old_slots != NULL && nb_moves-- > 0) {
+        picohash_item* old = &hash_table->old_slots[hash_table->old_cursor++];
+
+        if (old->key != NULL && old->key != &picohash_tombstone) {
+            picohash_place(hash_table, old->hash, old->key);
+            old->key = &picohash_tombstone;
+        }
+        if (hash_table->old_cursor >= hash_table->nb_old_slots) {
+            free(hash_table->old_slots);
+            hash_table->old_slots = NULL;
+            hash_table->nb_old_slots = 0;
+            hash_table->old_cursor = 0;
+        }
+    }
+}
+
 picohash_table* picohash_create(size_t nb_bin,
     uint64_t (*picohash_hash)(void*),
     int (*picohash_compare)(void*, void*))
 {
     picohash_table* t = (picohash_table*)malloc(sizeof(picohash_table));
     if (t != NULL) {
-        t->hash_bin = (picohash_item**)malloc(sizeof(picohash_item*) * nb_bin);
+        size_t nb_slots = PICOHASH_MIN_SLOTS;
+
+        while (nb_slots < nb_bin) {
+            nb_slots *= 2;
+        }
+        memset(t, 0, sizeof(picohash_table));
+        t->slots = (picohash_item*)calloc(nb_slots, sizeof(picohash_item));
 
-        if (t->hash_bin == NULL) {
+        if (t->slots == NULL) {
             free(t);
             t = NULL;
         } else {
-            (void)memset(t->hash_bin, 0, sizeof(picohash_item*) * nb_bin);
-            t->nb_bin = nb_bin;
-            t->count = 0;
+            t->nb_slots = nb_slots;
             t->picohash_hash = picohash_hash;
             t->picohash_compare = picohash_compare;
         }
@@ -51,16 +130,11 @@ picohash_table* picohash_create(size_t nb_bin,
 
 picohash_item* picohash_retrieve(picohash_table* hash_table, void* key)
 {
-    uint64_t hash = hash_table->picohash_hash(key);
-    uint32_t bin = (uint32_t)(hash % hash_table->nb_bin);
-    picohash_item* item = hash_table->hash_bin[bin];
+    uint64_t hash = picohash_mix(hash_table->picohash_hash(key));
+    picohash_item* item = picohash_find(hash_table, hash_table->slots, hash_table->nb_slots, hash, key);
 
-    while (item != NULL) {
-        if (hash_table->picohash_compare(key, item->key) == 0) {
-            break;
-        } else {
-            item = item->next_in_bin;
-        }
+    if (item == NULL && hash_table->old_slots != NULL) {
+        item = picohash_find(hash_table, hash_table->old_slots, hash_table->nb_old_slots, hash, key);
     }
 
     return item;
@@ -68,19 +142,31 @@ picohash_item* picohash_retrieve(picohash_table* hash_table, void* key)
 
 int picohash_insert(picohash_table* hash_table, void* key)
 {
-    uint64_t hash = hash_table->picohash_hash(key);
-    uint32_t bin = (uint32_t)(hash % hash_table->nb_bin);
     int ret = 0;
-    picohash_item* item = (picohash_item*)malloc(sizeof(picohash_item));
 
-    if (item == NULL) {
-        ret = -1;
-    } else {
-        item->hash = hash;
-        item->key = key;
-        item->next_in_bin = hash_table->hash_bin[bin];
-        hash_table->hash_bin[bin] = item;
+    if (picohash_is_overloaded(hash_table->nb_used + 1, hash_table->nb_slots)) {
+        picohash_item* slots;
+
+        /* Should not happen given the moves per operation, but the previous resize has to be complete */
+        picohash_move_old_slots(hash_table, hash_table->nb_old_slots);
+
+        slots = (picohash_item*)calloc(2 * hash_table->nb_slots, sizeof(picohash_item));
+        if (slots == NULL) {
+            ret = -1;
+        } else {
+            hash_table->old_slots = hash_table->slots;
+            hash_table->nb_old_slots = hash_table->nb_slots;
+            hash_table->old_cursor = 0;
+            hash_table->slots = slots;
+            hash_table->nb_slots *= 2;
+            hash_table->nb_used = 0;
+        }
+    }
+
+    if (ret == 0) {
+        picohash_place(hash_table, picohash_mix(hash_table->picohash_hash(key)), key);
         hash_table->count++;
+        picohash_move_old_slots(hash_table, PICOHASH_MOVES_PER_OPERATION);
     }
 
     return ret;
@@ -88,38 +174,55 @@ int picohash_insert(picohash_table* hash_table, void* key)
 
 void picohash_item_delete(picohash_table* hash_table, picohash_item* item, int delete_key_too)
 {
-    uint32_t bin = (uint32_t)(item->hash % hash_table->nb_bin);
-    picohash_item* previous = hash_table->hash_bin[bin];
-
-    if (previous == item) {
-        hash_table->hash_bin[bin] = item->next_in_bin;
-    } else
-        while (previous != NULL) {
-            if (previous->next_in_bin == item) {
-                previous->next_in_bin = item->next_in_bin;
+    if (delete_key_too) {
+        free(item->key);
+    }
+
+    if (hash_table->old_slots != NULL && item >= hash_table->old_slots &&
+        item < hash_table->old_slots + hash_table->nb_old_slots) {
+        item->key = &picohash_tombstone;
+    } else {
+        /* Shift back the next items of the cluster that may take the slot, so that no tombstone is needed */
+        size_t mask = hash_table->nb_slots - 1;
+        size_t hole = (size_t)(item - hash_table->slots);
+        size_t index = hole;
+
+        for (;;) {
+            size_t home;
+
+            index = (index + 1) & mask;
+            if (hash_table->slots[index].key == NULL) {
                 break;
-            } else {
-                previous = previous->next_in_bin;
+            }
+            home = (size_t)hash_table->slots[index].hash & mask;
+            if (((index - home) & mask) >= ((index - hole) & mask)) {
+                hash_table->slots[hole] = hash_table->slots[index];
+                hole = index;
             }
         }
-
-    if (delete_key_too) {
-        free(item->key);
+        hash_table->slots[hole].key = NULL;
+        hash_table->nb_used--;
     }
+    hash_table->count--;
 
-    free(item);
+    picohash_move_old_slots(hash_table, PICOHASH_MOVES_PER_OPERATION);
 }
 
 void picohash_delete(picohash_table* hash_table, int delete_key_too)
 {
-    for (uint32_t i = 0; i < hash_table->nb_bin; i++) {
-        while (hash_table->hash_bin[i] != NULL) {
-            /* TODO: could be faster */
-            picohash_item_delete(hash_table, hash_table->hash_bin[i], delete_key_too);
+    if (delete_key_too) {
+        for (size_t i = 0; i < hash_table->nb_slots; i++) {
+            free(hash_table->slots[i].key);
+        }
+        for (size_t i = 0; i < hash_table->nb_old_slots; i++) {
+            if (hash_table->old_slots[i].key != &picohash_tombstone) {
+                free(hash_table->old_slots[i].key);
+            }
         }
     }
 
-    free(hash_table->hash_bin);
+    free(hash_table->old_slots);
+    free(hash_table->slots);
     free(hash_table);
 }
 
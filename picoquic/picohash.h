@@ -33,21 +33,32 @@
 extern "C" {
 #endif
 
+/*
+ * The table uses open addressing with linear probing, the items being stored in the slots
+ * with the full hash of their key. When it gets too loaded, a table twice as large is allocated
+ * and the items of the previous one move there a few at a time, at each insertion or deletion,
+ * so that no operation has to rehash the whole table. The items returned by picohash_retrieve
+ * are only valid until the next insertion or deletion.
+ */
 typedef struct _picohash_item {
     uint64_t hash;
-    struct _picohash_item* next_in_bin;
-    void* key;
+    void* key; /* NULL for an empty slot */
 } picohash_item;
 
 typedef struct picohash_table {
     /* TODO: lock ! */
-    picohash_item** hash_bin;
-    size_t nb_bin;
+    picohash_item* slots;
+    size_t nb_slots; /* Power of 2 */
+    size_t nb_used; /* Items in slots */
+    picohash_item* old_slots; /* Table being emptied into slots after a resize, or NULL */
+    size_t nb_old_slots;
+    size_t old_cursor; /* Old slots below it have been moved */
     size_t count;
     uint64_t (*picohash_hash)(void*);
     int (*picohash_compare)(void*, void*);
 } picohash_table;
 
+/* The table starts with room for about nb_bin items */
 picohash_table* picohash_create(size_t nb_bin,
     uint64_t (*picohash_hash)(void*),
     int (*picohash_compute)(void*, void*));
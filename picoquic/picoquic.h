@@ -86,6 +86,8 @@ extern "C" {
 #define PICOQUIC_ERROR_PROTOCOL_OPERATION_UNEXEPECTED_ARGC (PICOQUIC_ERROR_CLASS + 41)
 #define PICOQUIC_ERROR_INVALID_PLUGIN_STREAM_ID (PICOQUIC_ERROR_CLASS + 42)
 #define PICOQUIC_ERROR_NO_ALPN_PROVIDED (PICOQUIC_ERROR_CLASS + 43)
+#define PICOQUIC_ERROR_KEY_ROTATION_NOT_READY (PICOQUIC_ERROR_CLASS + 44)
+#define PICOQUIC_ERROR_WOULD_BLOCK (PICOQUIC_ERROR_CLASS + 45)
 
 #define PICOQUIC_MISCCODE_CLASS 0x800
 #define PICOQUIC_MISCCODE_RETRY_NXT_PKT (PICOQUIC_MISCCODE_CLASS + 1)
@@ -108,7 +110,8 @@ extern "C" {
 #define PICOQUIC_TLS_FATAL_ALERT_GENERATED (0x202)
 #define PICOQUIC_TLS_FATAL_ALERT_RECEIVED (0x203)
 
-#define PICOQUIC_MAX_PACKET_SIZE 1536
+#define PICOQUIC_MAX_PACKET_SIZE 1536 /* Default largest datagram, see picoquic_set_max_packet_size() */
+#define PICOQUIC_MAX_JUMBO_PACKET_SIZE 9216 /* Largest datagram of a jumbo frame */
 #define PICOQUIC_RESET_SECRET_SIZE 16
 #define PICOQUIC_RESET_PACKET_MIN_SIZE (1 + 20 + 16)
 
@@ -151,7 +154,9 @@ typedef enum {
     picoquic_frame_type_application_close = 0x1d, // TODO merge
     picoquic_frame_type_handshake_done = 0x1e,
     picoquic_frame_type_plugin_validate = 0x30,
-    picoquic_frame_type_plugin = 0x31
+    picoquic_frame_type_plugin = 0x31,
+    picoquic_frame_type_immediate_ack = 0xac, /* draft-ietf-quic-ack-frequency */
+    picoquic_frame_type_ack_frequency = 0xaf
 } picoquic_frame_type_enum_t;
 
 /*
@@ -208,7 +213,7 @@ int picoquic_is_handshake_error(uint64_t error_code);
 */
 
 typedef struct st_picoquic_stateless_packet_t {
-    struct st_picoquic_stateless_packet_t* next_packet;
+    uint64_t ring_sequence; /* Managed by the ring of the QUIC context, see picoquic_create_stateless_packet() */
     struct sockaddr_storage addr_to;
     struct sockaddr_storage addr_local;
     unsigned long if_index_local;
@@ -250,6 +255,18 @@ typedef enum {
 typedef struct protoop_plugin protoop_plugin_t;
 typedef struct st_plugin_struct_metadata plugin_struct_metadata_t;
 
+#define STRUCT_METADATA_MAX 10
+#define PLUGIN_METADATA_SLOTS 4
+
+/* The plugin-specific metadata attached to a structure. Each plugin of a connection gets a slot
+ * when inserted; the plugins with the first slots store their metadata inline, the other ones
+ * in the overflow hash map. The structure must be zeroed before being used.
+ */
+typedef struct st_plugin_metadata_t {
+    uint64_t slots[PLUGIN_METADATA_SLOTS][STRUCT_METADATA_MAX];
+    plugin_struct_metadata_t *overflow;
+} plugin_metadata_t;
+
 /* This structure is used for sending booking purposes */
 typedef struct reserve_frame_slot {
     size_t nb_bytes;
@@ -259,13 +276,23 @@ typedef struct reserve_frame_slot {
     protoop_plugin_t *p; /* Whathever you place here, it will be overwritten */
     /* TODO FIXME position */
     void *frame_ctx;
+    uint64_t expire_time; /* 0 if none, afterwards the frame is dropped instead of being sent */
+    uint8_t drop_priority; /* The reservations with the highest value are cancelled first */
 } reserve_frame_slot_t;
 
+/* Values of the received input of notify_frame */
+#define PICOQUIC_FRAME_LOST 0
+#define PICOQUIC_FRAME_RECEIVED 1
+#define PICOQUIC_FRAME_NOT_SENT 2 /* Erased from the packet when written */
+#define PICOQUIC_FRAME_EXPIRED 3 /* Dropped before being written, see reserve_frame_slot_t.expire_time */
+
 typedef struct reserve_frames_block {
     size_t total_bytes;
     uint8_t nb_frames;
     uint8_t is_congestion_controlled:1;
     bool low_priority:1; // if false, picoquic will wake as soon as it is reserved
+    uint8_t drop_priority; /* The lowest of its frames */
+    uint64_t expire_time; /* The latest of its frames, 0 if one of them does not expire */
     /* The following pointer is an array! */
     reserve_frame_slot_t *frames;
 } reserve_frames_block_t;
@@ -278,6 +305,12 @@ typedef struct st_picoquic_packet_plugin_frame_t {
     reserve_frame_slot_t *rfs; /* Memory held by the plugin, responsible for its my_free */
 } picoquic_packet_plugin_frame_t;
 
+/* A run of contiguous frames in a packet payload */
+typedef struct st_picoquic_payload_span_t {
+    uint16_t offset; /* Offset of the first frame in the packet payload */
+    uint16_t length;
+} picoquic_payload_span_t;
+
 /*
  * The simple packet structure is used to store packets that
  * have been sent but are not yet acknowledged.
@@ -285,6 +318,49 @@ typedef struct st_picoquic_packet_plugin_frame_t {
  * The checksum length is the difference between encrypted and unencrypted.
  */
 
+/* Counters of the packet pool of a context, see picoquic_get_packet_pool_stats() */
+typedef struct st_picoquic_packet_pool_stats_t {
+    uint64_t packet_hits; /* Packets taken from the freelist */
+    uint64_t packet_misses; /* Packets allocated because the freelist was empty */
+    uint64_t packet_overflows; /* Packets freed because the freelist was full */
+    uint64_t frame_hits;
+    uint64_t frame_misses;
+} picoquic_packet_pool_stats_t;
+
+/* Categories of the memory held by a connection, see picoquic_get_memory_stats() */
+typedef enum {
+    picoquic_memory_streams = 0, /* Stream contexts */
+    picoquic_memory_send_data, /* Data queued on the streams, not sent yet */
+    picoquic_memory_recv_data, /* Data received on the streams, not consumed yet */
+    picoquic_memory_retransmit, /* Packets waiting for an acknowledgement */
+    picoquic_memory_sacks, /* Ranges of packet numbers received, beyond the inline ones */
+    picoquic_memory_paths,
+    picoquic_memory_plugins, /* Plugin instances with their memory, and plugin stream data */
+    picoquic_memory_tls, /* Handshake data received or waiting to be sent */
+    picoquic_memory_reserved_frames, /* Frame reservations of the plugins */
+    picoquic_nb_memory_categories
+} picoquic_memory_category_enum;
+
+typedef struct st_picoquic_memory_stats_t {
+    uint64_t bytes[picoquic_nb_memory_categories];
+    uint64_t total;
+    uint64_t peak; /* Highest total since the creation of the connection */
+    uint64_t nb_capped; /* Flow control updates held back because the memory cap was reached */
+    uint64_t nb_charges; /* About one per allocation since the creation of the connection */
+} picoquic_memory_stats_t;
+
+#define PICOQUIC_FRAME_SUMMARY_MAX 16
+#define PICOQUIC_FRAME_SUMMARY_TYPE_OTHER 0xff /* Frame type encoded on more than one byte */
+
+/* A frame of a sent packet, found when the packet is finalized so that its acknowledgement or loss does not parse it again */
+typedef struct st_picoquic_frame_summary_t {
+    uint16_t offset; /* In the bytes of the packet */
+    uint16_t length;
+    uint8_t type;
+    uint8_t is_pure_ack : 1;
+    uint8_t is_plugin_frame : 1; /* Also in plugin_frames */
+} picoquic_frame_summary_t;
+
 typedef struct st_picoquic_packet_t {
     struct st_picoquic_packet_t* previous_packet;
     struct st_picoquic_packet_t* next_packet;
@@ -307,12 +383,20 @@ typedef struct st_picoquic_packet_t {
     unsigned int is_mtu_probe : 1;
     unsigned int delivered_app_limited : 1;
     unsigned int has_handshake_done : 1;
+    unsigned int has_frame_summary : 1; /* Unset when the frames did not fit or the packet was finalized by a plugin */
 
     picoquic_packet_plugin_frame_t *plugin_frames; /* Track plugin bytes */
 
-    plugin_struct_metadata_t *metadata;
+    uint8_t nb_frame_summaries;
+    picoquic_frame_summary_t frame_summary[PICOQUIC_FRAME_SUMMARY_MAX];
 
-    uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE];
+    plugin_metadata_t metadata;
+
+    struct st_picoquic_packet_pool_t* pool; /* Where the packet goes back when destroyed, NULL if it was allocated elsewhere */
+
+    /* bytes_max bytes, allocated apart so that walking the retransmit queues only touches the fields above */
+    uint8_t* bytes;
+    uint32_t bytes_max;
 } picoquic_packet_t;
 
 typedef struct st_picoquic_quic_t picoquic_quic_t;
@@ -320,6 +404,7 @@ typedef struct st_picoquic_cnx_t picoquic_cnx_t;
 typedef struct st_picoquic_path_t picoquic_path_t;
 typedef struct st_picoquic_packet_context_t picoquic_packet_context_t;
 typedef struct st_picoquic_sack_item_t picoquic_sack_item_t;
+typedef struct st_picoquic_sack_list_t picoquic_sack_list_t;
 typedef struct _picoquic_stream_head picoquic_stream_head;
 typedef struct st_picoquic_crypto_context_t picoquic_crypto_context_t;
 typedef struct _picoquic_packet_header picoquic_packet_header;
@@ -469,6 +554,15 @@ typedef struct new_token_frame {
 
 typedef uint8_t hanshake_done_frame_t;
 
+typedef struct ack_frequency_frame {
+    uint64_t sequence_number;
+    uint64_t packet_tolerance; /* Ack-eliciting packets received before an ACK is sent */
+    uint64_t update_max_ack_delay; /* In microseconds */
+    uint8_t ignore_order;
+} ack_frequency_frame_t;
+
+typedef uint8_t immediate_ack_frame_t;
+
 typedef struct plugin_validate_frame {
     uint64_t pid_id;
     uint64_t pid_len;
@@ -506,15 +600,25 @@ typedef enum {
     picoquic_callback_ready, /* Data can be sent and received, connection migration can be initiated */
     picoquic_callback_request_alpn_list, /* Provide the list of supported ALPN */
     picoquic_callback_set_alpn, /* Set ALPN to negotiated value */
+    picoquic_callback_stream_batch, /* Readable streams, see picoquic_set_stream_batch_callbacks(). Stream=0, bytes=picoquic_stream_span_t array, len=number of spans */
+    picoquic_callback_send_buffer_low, /* Writes refused on stream N are accepted again, see picoquic_set_send_buffer_watermarks(). bytes=NULL, len=bytes still buffered on the stream */
 } picoquic_call_back_event_t;
 
+#define PLUGIN_STAT_LATENCY_BUCKETS 32
+
 typedef struct plugin_stat {
     char *protoop_name;
     char *pluglet_name;
     bool pre, replace, post, is_param;
     param_id_t param;
     uint64_t count;
-    uint64_t total_execution_time;
+    uint64_t total_execution_time; /* In microseconds, estimated from the timed calls */
+    /* Only a sample of the calls is timed, see PLUGLET_PROFILE_SAMPLING_SHIFT */
+    uint64_t sampled_count;
+    uint64_t max_execution_time; /* In nanoseconds */
+    uint64_t latency_histogram[PLUGIN_STAT_LATENCY_BUCKETS]; /* Bucket i counts the timed calls lasting [2^i, 2^(i+1)[ ns */
+    uint32_t memory_accesses; /* Load and store instructions of the pluglet */
+    uint32_t elidable_checks; /* Those that are proven to remain in the stack at load time */
 } plugin_stat_t;
 #define PICOQUIC_STREAM_ID_TYPE_MASK 3
 #define PICOQUIC_STREAM_ID_CLIENT_INITIATED 0
@@ -525,6 +629,10 @@ typedef struct plugin_stat {
 #define PICOQUIC_STREAM_ID_SERVER_INITIATED_BIDIR (PICOQUIC_STREAM_ID_SERVER_INITIATED|PICOQUIC_STREAM_ID_BIDIR)
 #define PICOQUIC_STREAM_ID_CLIENT_INITIATED_UNIDIR (PICOQUIC_STREAM_ID_CLIENT_INITIATED|PICOQUIC_STREAM_ID_UNIDIR)
 #define PICOQUIC_STREAM_ID_SERVER_INITIATED_UNIDIR (PICOQUIC_STREAM_ID_SERVER_INITIATED|PICOQUIC_STREAM_ID_UNIDIR)
+#define PICOQUIC_STREAM_URGENCY_MAX 7
+#define PICOQUIC_STREAM_URGENCY_DEFAULT 3
+#define PICOQUIC_STREAM_WEIGHT_DEFAULT 16
+#define PICOQUIC_STREAM_WEIGHT_MAX 256
 
 #define PICOQUIC_STREAM_ID_CLIENT_MAX_INITIAL_BIDIR (PICOQUIC_STREAM_ID_CLIENT_INITIATED_BIDIR + ((65535-1)*4))
 #define PICOQUIC_STREAM_ID_SERVER_MAX_INITIAL_BIDIR (PICOQUIC_STREAM_ID_SERVER_INITIATED_BIDIR + ((65535-1)*4))
@@ -545,22 +653,33 @@ typedef struct plugin_stat {
 * If the argument is set, the default time function of picotls will be overridden by a function that
 * reads the value of *p_simulated_time.
 *
-* The function "picoquic_current_time()" reads the wall time in microseconds, using the same system calls
-* as picotls. The default socket code in "picosock.[ch]" uses that time function, and returns the time
-* at which messages arrived.
+* The function "picoquic_current_time()" reads a monotonic clock in microseconds, which starts at the wall
+* time when it is first read, so that it stays close to the time of picotls but does not jump when the wall
+* clock is stepped. The default socket code in "picosock.[ch]" uses that time function, and returns the time
+* at which messages arrived. The function "picoquic_wall_time()" reads the wall time itself.
+*
+* Reading the clock for each packet is costly, so an event loop calls "picoquic_refresh_time()" once per
+* iteration, as "picoquic_select()" does. The code processing the packets then reads the cached time with
+* "picoquic_get_loop_time()", which reads the clock until the first refresh. The pluglets calling the
+* "picoquic_current_time" helper get the time of the last refresh in their thread, from "picoquic_cached_time()".
 *
 * The function "picoquic_get_quic_time()" returns the "virtual time" used by the specified quic
 * context, which can be either the current wall time or the simulated time, depending on how the
 * quic context was initialized.
 */
 
-uint64_t picoquic_current_time(); /* wall time */
+uint64_t picoquic_current_time(); /* monotonic time */
+uint64_t picoquic_wall_time();
+uint64_t picoquic_refresh_time(picoquic_quic_t* quic); /* Caches and returns the current time */
+uint64_t picoquic_get_loop_time(picoquic_quic_t* quic);
+uint64_t picoquic_cached_time();
 uint64_t picoquic_get_quic_time(picoquic_quic_t* quic); /* connection time, compatible with simulations */
 
 
 /* Callback function for providing stream data to the application.
      * If stream_id is zero, this delivers changes in
      * connection state.
+     * The bytes are only valid during the call: in order data points into the received packet.
      */
 typedef int (*picoquic_stream_data_cb_fn)(picoquic_cnx_t* cnx,
     uint64_t stream_id, uint8_t* bytes, size_t length,
@@ -641,6 +760,219 @@ int picoquic_set_plugins_to_inject(picoquic_quic_t* quic, const char** plugin_fn
 /* Set the local plugins we want to forcefully inject */
 int picoquic_set_local_plugins(picoquic_quic_t* quic, const char** plugin_fnames, int plugins);
 
+/* Set the directory where the images of the injected plugins are kept, to speed up their loading.
+ * If path is NULL, do not use plugin images. */
+int picoquic_set_plugin_image_cache(picoquic_quic_t* quic, const char* path);
+
+/* Set the number of ready instances of the local plugins that picoquic_prewarm_plugins
+ * keeps in the plugin cache. A depth of 0 disables pre-warming. */
+void picoquic_set_plugin_prewarm_depth(picoquic_quic_t* quic, uint8_t depth);
+
+/* Load the native build of a pluglet, the shared object next to its eBPF object with the .so suffix, when there is one.
+ * The plugins keep their names, and thus negotiate as before, but their pluglets run at native speed without any
+ * memory isolation: only enable it with trusted plugins. */
+void picoquic_set_native_pluglets(picoquic_quic_t* quic, int enable);
+
+/* Which connections to capture with a logging plugin, typically the qlog one. It is only inserted in the captured
+ * connections, the others have no pluglet attached to the logging operations and do not pay for them. A connection
+ * is captured when it passes all the filters that are set and is sampled. One that passes the filters without being
+ * sampled is captured from the moment it crosses one of the thresholds. The filters are evaluated when the
+ * connection changes state, once its SNI and ALPN are known if they are filtered on. */
+typedef void (*picoquic_log_capture_cb)(picoquic_cnx_t* cnx, void* capture_ctx);
+
+typedef struct st_picoquic_log_policy_t {
+    char const* plugin_fname; /* Inserted in the captured connections */
+    picoquic_log_capture_cb capture_fn; /* Called once it is inserted, e.g. to give it an output file. Can be NULL */
+    void* capture_ctx;
+    uint32_t sample_one_in; /* Capture one connection in sample_one_in at random, 0 for none */
+    char const* sni; /* Filters, ignored when NULL */
+    char const* alpn;
+    struct sockaddr_storage peer_prefix; /* Ignored when peer_prefix_length is 0 */
+    uint8_t peer_prefix_length; /* In bits */
+    int capture_on_error; /* Thresholds, ignored when 0 */
+    uint64_t loss_threshold; /* Number of retransmissions */
+    uint64_t rtt_threshold; /* Smoothed RTT of the first path, in microseconds */
+} picoquic_log_policy_t;
+
+/* The policy is copied, NULL removes it. Only applies to the connections not evaluated yet */
+int picoquic_set_log_policy(picoquic_quic_t* quic, picoquic_log_policy_t const* policy);
+
+/* Write the logs from a background thread, through a ring of nb_chunks chunks of 4 KB, a power of 2. The log file
+ * set with PICOQUIC_SET_LOG is replaced by a stream appending to the ring, and the plugins write through it with
+ * the write_log operation. The loop no longer waits for the disk: the chunks that do not fit in the ring are
+ * dropped and counted. Returns -1 if the thread cannot be started. */
+int picoquic_set_log_flusher(picoquic_quic_t* quic, uint32_t nb_chunks);
+/* Log the packets in the FILE* F as binary records of their metadata and frames, instead of decoding them as text in the log file.
+ * Logging a packet is then a copy; the picoquic_binlog tool decodes the trace offline. NULL restores the text log. */
+void picoquic_set_binary_log(picoquic_quic_t* quic, void* F);
+uint64_t picoquic_get_log_flusher_drops(picoquic_quic_t* quic);
+/* Waits until the logs queued so far are written, e.g. before closing a log file */
+void picoquic_wait_log_flusher(picoquic_quic_t* quic);
+
+/* Set how many sent packets are kept for reuse once acknowledged. With use_hugepages, they are
+ * carved from a slab of huge pages, which must be done before the first connection is created. */
+int picoquic_set_packet_pool(picoquic_quic_t* quic, uint32_t max_free_packets, int use_hugepages);
+void picoquic_get_packet_pool_stats(picoquic_quic_t* quic, picoquic_packet_pool_stats_t* stats);
+
+/* Set the largest datagram that the connections may send or receive, PICOQUIC_MAX_PACKET_SIZE by default and at
+ * most PICOQUIC_MAX_JUMBO_PACKET_SIZE. Above the default, the path MTU discovery probes up to that size, and the
+ * connections whose peer accepts larger packets take their packets from the jumbo class of the packet pool.
+ * The sockets must then receive in buffers of that size. Returns -1 if the size is out of bounds. */
+int picoquic_set_max_packet_size(picoquic_quic_t* quic, uint32_t max_packet_size);
+uint32_t picoquic_get_max_packet_size(picoquic_quic_t* quic);
+
+/* Place the connections, paths and streams created afterwards on the memory of numa_node, -1 to leave it to the system */
+void picoquic_set_object_cache_numa_node(picoquic_quic_t* quic, int numa_node);
+
+/* Place the memory of the context on numa_node, -1 to leave it to the system: the slabs of the object caches and of the
+ * packet pool, including those already mapped, and the memory of the plugins inserted afterwards. The other allocations
+ * follow the policy of the thread, which should run on the same node, see picoquic_threaded_server_set_worker_cpu(). */
+void picoquic_set_numa_node(picoquic_quic_t* quic, int numa_node);
+int picoquic_get_numa_node(picoquic_quic_t* quic);
+
+/* Leave the pacing to the kernel, e.g. the fq qdisc with SO_TXTIME: packets are prepared up to horizon
+ * microseconds before their departure time, see picoquic_get_departure_time(). A horizon of 0 restores
+ * the pacing in user space. Only applies to the paths created afterwards. */
+void picoquic_set_pacing_offload(picoquic_quic_t* quic, uint64_t horizon);
+
+/* Let trains of nb_packets leave at once, one pacing decision covering all of them, e.g. to fill a
+ * segmentation offload batch of picoquic_prepare_packets(). 0 or 1 paces each packet. Only applies
+ * to the paths created afterwards. */
+void picoquic_set_pacing_burst(picoquic_quic_t* quic, uint64_t nb_packets);
+
+/* Caps a turn of a connection in picoquic_prepare_next_packets() to max_packets datagrams and max_bytes bytes,
+ * 0 for no cap, so that a connection with a large window does not delay the others. A turn has at least one datagram. */
+void picoquic_set_send_budget(picoquic_quic_t* quic, size_t max_packets, size_t max_bytes);
+
+/* Past cap bytes of memory, see picoquic_get_memory_stats(), the connections stop granting flow control credit
+ * to the peer until some of it is freed. A cap of 0 means no cap. Only applies to the connections created afterwards. */
+void picoquic_set_default_memory_cap(picoquic_quic_t* quic, uint64_t cap);
+/* Send buffer watermarks of the new connections, see picoquic_set_send_buffer_watermarks() */
+void picoquic_set_default_send_buffer_watermarks(picoquic_quic_t* quic, uint64_t stream_high, uint64_t stream_low,
+    uint64_t cnx_high, uint64_t cnx_low);
+/* After delay microseconds without progress, a ready connection releases the memory it only needs while
+ * data is in flight, see picoquic_hibernate_cnx(). It wakes up on the next packet or application send.
+ * A delay of 0 disables hibernation. */
+void picoquic_set_hibernation_delay(picoquic_quic_t* quic, uint64_t delay);
+/* Rounds the keep alive deadlines up to a multiple of bucket microseconds, so that the idle connections wake
+ * and send their PINGs together, in one turn of the loop. The default is a second, 0 disables the rounding. */
+void picoquic_set_keep_alive_bucket(picoquic_quic_t* quic, uint64_t bucket);
+/* Keeps up to max_tombstones closed connections as tombstones, 0 disables them, the default. Once a connection has
+ * sent its CONNECTION_CLOSE, or answered the one of its peer, it moves to the disconnected state and can be deleted:
+ * a tombstone holding its CIDs and its close datagram stands for it until 3 RTO have passed. It repeats the datagram
+ * to the packets of the peer, at most once per interval of the closing state and within 3 times the bytes received,
+ * or drops them silently when draining. The oldest tombstone goes when they are all in use. The connections of a
+ * client with zero length CIDs have no tombstone. */
+void picoquic_set_tombstones(picoquic_quic_t* quic, size_t max_tombstones);
+/* Tombstones not expired at current_time */
+size_t picoquic_get_nb_tombstones(picoquic_quic_t* quic, uint64_t current_time);
+/* QUIC-LB routable connection IDs, see draft-ietf-quic-load-balancers. A load balancer sharing the configuration
+ * finds the server ID in the CIDs, without state per flow. The first octet holds the config rotation bits, then
+ * the length of the CID less one when it is self encoded, random bits otherwise. */
+#define PICOQUIC_LB_SERVER_ID_MAX 15
+#define PICOQUIC_LB_KEY_SIZE 16
+#define PICOQUIC_LB_CONFIG_ROTATION_MAX 6 /* 7 marks the CIDs that cannot be routed */
+typedef enum {
+    picoquic_lb_plaintext = 0, /* Server ID in clear, then a nonce of at least 4 bytes */
+    picoquic_lb_stream_cipher, /* Nonce of 8 to 16 bytes, then the server ID, encrypted in three AES-ECB passes */
+    picoquic_lb_block_cipher /* Server ID then nonce, 16 bytes together, encrypted as one AES block */
+} picoquic_lb_mode_enum;
+
+typedef struct st_picoquic_lb_config_t {
+    uint8_t config_rotation;
+    picoquic_lb_mode_enum mode;
+    int self_encode_length;
+    uint8_t server_id_length;
+    uint8_t server_id[PICOQUIC_LB_SERVER_ID_MAX];
+    uint8_t nonce_length;
+    uint8_t key[PICOQUIC_LB_KEY_SIZE]; /* Not used in plaintext */
+} picoquic_lb_config_t;
+
+typedef struct st_picoquic_lb_ctx_t picoquic_lb_ctx_t;
+
+/* Returns NULL if the configuration is not valid or the cipher cannot be created */
+picoquic_lb_ctx_t* picoquic_lb_ctx_create(picoquic_lb_config_t const* config);
+void picoquic_lb_ctx_free(picoquic_lb_ctx_t* lb_ctx);
+/* 1 + server_id_length + nonce_length */
+uint8_t picoquic_lb_cnx_id_length(picoquic_lb_ctx_t* lb_ctx);
+/* Encodes the CID in place. It holds random bytes of the configured length, which become the nonce */
+void picoquic_lb_encode_cnx_id(picoquic_lb_ctx_t* lb_ctx, picoquic_connection_id_t* cnx_id);
+/* What a load balancer runs on the destination CID of a packet. Copies the server ID and returns 0, or returns
+ * -1 if the CID does not follow the configuration, e.g. after a rotation */
+int picoquic_lb_decode_server_id(picoquic_lb_ctx_t* lb_ctx, const uint8_t* bytes, size_t length, uint8_t* server_id);
+/* All the CIDs the server issues afterwards follow config, those of NEW_CONNECTION_ID and MP_NEW_CONNECTION_ID
+ * included, and have its length. A cnx_id callback must leave them as they are. A new config_rotation lets the
+ * load balancers tell the CIDs of the two configurations apart. NULL goes back to random CIDs of the same length.
+ * Returns -1, keeping the previous configuration, if config is not valid. */
+int picoquic_set_lb_config(picoquic_quic_t* quic, picoquic_lb_config_t const* config);
+/* Marks the packets sent with the ECN codepoint, PICOQUIC_ECN_ECT0 or PICOQUIC_ECN_ECT1 for L4S, and asks for the TOS
+ * of the received packets, on the sockets passed to picoquic_before_sending_packet(). The CE marks reported by the
+ * peer are notified to the congestion control once the ECN counts of the path are validated. 0 stops marking. */
+#define PICOQUIC_ECN_ECT1 0x01
+#define PICOQUIC_ECN_ECT0 0x02
+#define PICOQUIC_ECN_CE 0x03
+void picoquic_set_ecn(picoquic_quic_t* quic, uint8_t ecn_codepoint);
+/* Advertises a preferred address in the transport parameters of the server connections, with a CID of its own. The
+ * clients move to it once the handshake is confirmed, e.g. to reach the socket of the thread owning the connection,
+ * validating it with a PATH_CHALLENGE sent along their data. Either address may be NULL. A wildcard IP stands for
+ * the local address of the connection, so that only the port changes. NULL for both stops advertising. Only applies
+ * to the connections created afterwards. */
+void picoquic_set_preferred_address(picoquic_quic_t* quic, struct sockaddr const* addr_ipv4, struct sockaddr const* addr_ipv6);
+/* The receive windows of the connections and of their streams start at the transport parameters, and double
+ * when the peer sends close to a window per RTT, up to max_data_window_max and max_stream_data_window_max.
+ * The growth of the windows of all the connections is capped by budget bytes, 0 for no budget. A window max
+ * not above the transport parameters disables the auto-tuning. Only applies to the next updates. */
+void picoquic_set_flow_control_autotune(picoquic_quic_t* quic, uint64_t max_data_window_max,
+    uint64_t max_stream_data_window_max, uint64_t budget);
+/* Bytes of flow control credit granted by the auto-tuning, past the transport parameters */
+uint64_t picoquic_get_flow_control_growth(picoquic_quic_t* quic);
+/* Take the session ticket keys from a store shared with the other server processes, see resumption_store.h,
+ * and accept the early data of each ticket only once across them. The store is not owned by the context
+ * and must outlive it. Until the store has a key, the tickets use the local key of the context. */
+struct st_picoquic_resumption_store_t;
+void picoquic_set_resumption_store(picoquic_quic_t* quic, struct st_picoquic_resumption_store_t* store);
+/* Aggregate the totals of the connections in metrics, see server_metrics.h, when they close. They are given by
+ * the monitoring plugin, so only the connections running it are counted. The metrics are not owned by the context
+ * and must outlive it. */
+struct st_picoquic_server_metrics_t;
+void picoquic_set_server_metrics(picoquic_quic_t* quic, struct st_picoquic_server_metrics_t* metrics);
+/* CPU time spent in the main stages of the connections, see picoquic_set_profile().
+ * The TLS time is mostly spent while processing incoming packets, so it is also part of that category */
+typedef enum {
+    picoquic_profile_tls = 0, /* Handshake messages, from picoquic_initialize_tls_stream() and picoquic_tls_stream_process() */
+    picoquic_profile_incoming, /* picoquic_incoming_packet() */
+    picoquic_profile_prepare, /* picoquic_prepare_packet() */
+    picoquic_profile_plugins, /* Insertion of the plugins in the connections */
+    picoquic_nb_profile_categories
+} picoquic_profile_category_enum;
+
+typedef struct st_picoquic_profile_t {
+    uint64_t cpu_time[picoquic_nb_profile_categories]; /* Nanoseconds of CPU time of the calling thread */
+    uint64_t nb_calls[picoquic_nb_profile_categories];
+} picoquic_profile_t;
+
+/* Adds the CPU time spent by the context to *profile, or stops doing so if profile is NULL.
+ * Without profile, nothing is measured. */
+void picoquic_set_profile(picoquic_quic_t* quic, picoquic_profile_t* profile);
+
+/* Sum of the memory stats of the connections of the context, the peak being the sum of their peaks */
+void picoquic_quic_get_memory_stats(picoquic_quic_t* quic, picoquic_memory_stats_t* stats);
+
+/* Prepare at most max_instances new instances of the local plugins, such that the next
+ * connections do not have to load them. Meant to be called when the server is idle.
+ * Returns the number of instances prepared. */
+int picoquic_prewarm_plugins(picoquic_quic_t* quic, int max_instances);
+
+/* Keep the memory of the plugin plugin_name, as initialised in cnx, as the template of its next instances on the
+ * same context. They map it copy-on-write instead of building the same state again, see plugin_template_capture.
+ * Returns 0 on success, -1 otherwise. */
+int picoquic_set_plugin_template(picoquic_cnx_t* cnx, const char* plugin_name);
+
+/* Read and verify the pluglets of the supported, injected and local plugins in nb_threads worker
+ * threads, such that the connections and picoquic_prewarm_plugins find them in memory. Call it
+ * once these plugins are set. Returns the number of pluglets read, -1 if the threads cannot be started. */
+int picoquic_preload_plugins(picoquic_quic_t* quic, int nb_threads);
+
 /* Set the filename where the logging will be printed.
  * If log_fname is NULL, print to stdout.
  * If log_fname is "/dev/null", does not print at all. */
@@ -649,11 +981,19 @@ int picoquic_set_log(picoquic_quic_t* quic, const char *log_fname);
 /* If the application required plugin insertion, handle the negotiation */
 int picoquic_handle_plugin_negotiation(picoquic_cnx_t* cnx);
 
+/* Use the cipher suites of the named AEAD provider, e.g. "openssl" or "fusion", for the connections
+ * created afterwards. By default, the preferred provider supported by the CPU is used.
+ * Returns -1 if the provider is unknown or not supported. */
+int picoquic_set_aead_provider(picoquic_quic_t* quic, char const* name);
+char const* picoquic_get_aead_provider(picoquic_quic_t* quic);
+
 /* Set cookie mode on QUIC context when under stress */
 void picoquic_set_cookie_mode(picoquic_quic_t* quic, int cookie_mode);
 
 /* Set the TLS certificate chain(DER format) for the QUIC context. The context will take ownership over the certs pointer. */
 void picoquic_set_tls_certificate_chain(picoquic_quic_t* quic, ptls_iovec_t* certs, size_t count);
+/* Whether the server chain is sent compressed, which requires picotls with brotli */
+int picoquic_is_certificate_compressed(picoquic_quic_t* quic);
 
 /* Set the TLS root certificates (DER format) for the QUIC context. The context will take ownership over the certs pointer.
  * The root certificates will be used to verify the certificate chain of the server and client (with client authentication activated).
@@ -666,6 +1006,10 @@ void picoquic_set_null_verifier(picoquic_quic_t* quic);
 
 /* Set the TLS private key(DER format) for the QUIC context. The caller is responsible for cleaning up the pointer. */
 int picoquic_set_tls_key(picoquic_quic_t* quic, const uint8_t* data, size_t len);
+/* Compute the server signatures of the handshakes in nb_threads worker threads, the handshakes being
+ * parked meanwhile. Call it once the key is set. Returns -1 if picotls does not support asynchronous
+ * signatures or the threads cannot be started. */
+int picoquic_set_sign_offload(picoquic_quic_t* quic, int nb_threads);
 
 /* Set the verify certificate callback and context. */
 int picoquic_set_verify_certificate_callback(picoquic_quic_t* quic, picoquic_verify_certificate_cb_fn cb, void* ctx,
@@ -704,6 +1048,13 @@ int picoquic_start_client_cnx(picoquic_cnx_t* cnx);
  */
 int picoquic_get_plugin_stats(picoquic_cnx_t *cnx, plugin_stat_t **stats, int nmemb);
 
+/* Memory held by the connection, by category. Does not include the connection context itself */
+void picoquic_get_memory_stats(picoquic_cnx_t* cnx, picoquic_memory_stats_t* stats);
+void picoquic_set_memory_cap(picoquic_cnx_t* cnx, uint64_t cap);
+/* Releases the memory not needed by an idle connection now, returns the number of bytes released */
+uint64_t picoquic_hibernate_cnx(picoquic_cnx_t* cnx);
+int picoquic_is_cnx_hibernating(picoquic_cnx_t* cnx);
+
 void picoquic_delete_cnx(picoquic_cnx_t* cnx);
 
 int picoquic_close(picoquic_cnx_t* cnx, uint64_t reason_code);
@@ -718,6 +1069,10 @@ picoquic_cnx_t* picoquic_get_earliest_cnx_to_wake(picoquic_quic_t* quic, uint64_
 picoquic_state_enum picoquic_get_cnx_state(picoquic_cnx_t* cnx);
 void picoquic_set_cnx_state(picoquic_cnx_t* cnx, picoquic_state_enum state);
 
+/* Moves the outgoing 1-RTT packets to the next key phase. The peer follows when it sees them; until
+ * it did, another update returns PICOQUIC_ERROR_KEY_ROTATION_NOT_READY */
+int picoquic_start_key_rotation(picoquic_cnx_t* cnx, uint64_t current_time);
+
 int picoquic_tls_is_psk_handshake(picoquic_cnx_t* cnx);
 
 /* Needed for bridging */
@@ -739,6 +1094,77 @@ uint64_t picoquic_is_0rtt_available(picoquic_cnx_t* cnx);
 
 int picoquic_is_cnx_backlog_empty(picoquic_cnx_t* cnx);
 
+/*
+ * Snapshot of the transport counters of a connection or of one of its paths. Fields are only
+ * appended to these structures, with a new version: a caller compiled against an older version
+ * passes its smaller size and gets the fields it knows. Times are in microseconds, and the
+ * limited times count how long the sender was held back by each cause.
+ */
+#define PICOQUIC_STATS_VERSION 1
+
+typedef struct st_picoquic_path_stats_t {
+    uint32_t version;
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    uint64_t packets_received;
+    uint64_t bytes_received;
+    uint64_t packets_lost;
+    uint64_t bytes_lost;
+    uint64_t packets_spurious;
+    uint64_t ack_frames_sent;
+    uint64_t ack_frames_received;
+    uint64_t cwnd_limited_time;
+    uint64_t pacing_limited_time;
+    uint64_t app_limited_time;
+    uint64_t flow_control_blocked_time;
+    uint64_t cwin;
+    uint64_t bytes_in_transit;
+    uint64_t bandwidth_estimate; /* In bytes per second */
+    uint64_t send_mtu;
+    uint64_t smoothed_rtt;
+    uint64_t rtt_variant;
+    uint64_t rtt_min;
+    uint64_t rtt_samples;
+    uint64_t rtt_p50;
+    uint64_t rtt_p90;
+    uint64_t rtt_p99;
+} picoquic_path_stats_t;
+
+typedef struct st_picoquic_cnx_stats_t {
+    uint32_t version;
+    uint32_t nb_paths;
+    /* Sums over the paths */
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    uint64_t packets_received;
+    uint64_t bytes_received;
+    uint64_t packets_lost;
+    uint64_t bytes_lost;
+    uint64_t packets_retransmitted;
+    uint64_t packets_spurious;
+    uint64_t ack_frames_sent;
+    uint64_t ack_frames_received;
+    uint64_t cwnd_limited_time;
+    uint64_t pacing_limited_time;
+    uint64_t app_limited_time;
+    uint64_t flow_control_blocked_time;
+    uint64_t zero_rtt_sent;
+    uint64_t zero_rtt_acked;
+    uint64_t data_sent; /* Stream bytes */
+    uint64_t data_received;
+    /* RTT of the first path, and percentiles over the samples of all paths */
+    uint64_t smoothed_rtt;
+    uint64_t rtt_min;
+    uint64_t rtt_samples;
+    uint64_t rtt_p50;
+    uint64_t rtt_p90;
+    uint64_t rtt_p99;
+} picoquic_cnx_stats_t;
+
+/* Fill the first stats_size bytes of stats, return -1 if the path does not exist or stats_size is too small for the version */
+int picoquic_get_path_stats(picoquic_cnx_t* cnx, int path_index, picoquic_path_stats_t* stats, size_t stats_size);
+int picoquic_get_cnx_stats(picoquic_cnx_t* cnx, picoquic_cnx_stats_t* stats, size_t stats_size);
+
 void picoquic_set_callback(picoquic_cnx_t* cnx,
     picoquic_stream_data_cb_fn callback_fn, void* callback_ctx);
 
@@ -749,8 +1175,43 @@ int picoquic_process_ecn_block(picoquic_cnx_t* cnx, void *ecn_block, picoquic_pa
 int picoquic_write_ecn_block(picoquic_cnx_t* cnx, uint8_t *bytes, size_t bytes_max, picoquic_packet_context_t *pkt_ctx, size_t *consumed);
 /* Send and receive network packets */
 
+/* The stateless packets are read by a single thread, which must delete each of them, in order, once sent */
 picoquic_stateless_packet_t* picoquic_dequeue_stateless_packet(picoquic_quic_t* quic);
 void picoquic_delete_stateless_packet(picoquic_stateless_packet_t* sp);
+/* Stateless packets not sent because the queue was full */
+uint64_t picoquic_get_stateless_packets_dropped(picoquic_quic_t* quic);
+
+/* Initial packets dropped before a connection context was created, by reason */
+typedef enum {
+    picoquic_initial_reject_too_short = 0, /* Datagram below the minimum size of the Initial packets */
+    picoquic_initial_reject_token, /* No valid token, a retry was sent instead */
+    picoquic_initial_reject_aead, /* Could not be decrypted with the Initial keys of its destination CID */
+    picoquic_initial_reject_closed, /* Destination CID of a closed connection, see picoquic_set_tombstones() */
+    picoquic_initial_reject_busy, /* Refused with a CONNECTION_CLOSE(SERVER_BUSY), see picoquic_update_overload() */
+    picoquic_initial_reject_max
+} picoquic_initial_reject_enum;
+
+uint64_t picoquic_get_initial_reject_count(picoquic_quic_t* quic, picoquic_initial_reject_enum reason);
+
+/* Overload control. Each level adds to the previous ones, so that the established connections keep their latency
+ * when the loop falls behind */
+typedef enum {
+    picoquic_overload_none = 0,
+    picoquic_overload_retry, /* The new connections must prove their address with a Retry */
+    picoquic_overload_shed, /* The log captures and the plugin exchanges wait, the peers are asked for fewer ACKs */
+    picoquic_overload_reject, /* The new connections are refused with CONNECTION_CLOSE(SERVER_BUSY) */
+    picoquic_overload_max
+} picoquic_overload_level_enum;
+
+/* The load is the largest of the smoothed lag of the loop over lag_threshold, in microseconds, and of the smoothed
+ * backlog over backlog_threshold, in datagrams. It engages the retry level at 1, shed at 2 and reject at 4, and goes
+ * back a level below three quarters of these. A threshold of 0 ignores its measure, both leave the controller off */
+void picoquic_set_overload_thresholds(picoquic_quic_t* quic, uint64_t lag_threshold, uint32_t backlog_threshold);
+/* Called by the loop once per round, after the datagrams were received. The lag is how late the first connection to
+ * wake is served. The backlog is the number of datagrams the round found waiting, e.g. a full receive batch and the
+ * packets queued by other threads. Returns the new level */
+picoquic_overload_level_enum picoquic_update_overload(picoquic_quic_t* quic, uint64_t current_time, uint32_t backlog);
+picoquic_overload_level_enum picoquic_get_overload_level(picoquic_quic_t* quic);
 
 int picoquic_incoming_packet(
     picoquic_quic_t* quic,
@@ -766,9 +1227,25 @@ picoquic_packet_t* picoquic_create_packet(picoquic_cnx_t *cnx);
 
 void picoquic_destroy_packet(picoquic_packet_t *p);
 
+/* Returns the bytes [offset, offset + length[ of the packet buffer, or NULL if they do not fit in it */
+uint8_t* picoquic_packet_window(picoquic_packet_t *p, size_t offset, size_t length);
+
 int picoquic_prepare_packet(picoquic_cnx_t* cnx,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length, picoquic_path_t** path);
 
+/* Prepare up to max_segments datagrams to send on the same path, each of them starting where the previous
+ * one ends in send_buffer. nb_segments is set to 0 if there is nothing to send. */
+int picoquic_prepare_packets(picoquic_cnx_t* cnx, uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max,
+    size_t* segment_lengths, size_t max_segments, size_t* nb_segments, picoquic_path_t** path);
+
+/* Serves the connections whose wake time is reached in turns, for a server loop: each call prepares the datagrams
+ * of one turn of the earliest of them, as picoquic_prepare_packets() does, within the budget set by
+ * picoquic_set_send_budget(). A connection that can send more afterwards waits behind the other ready ones.
+ * *p_cnx is set to the connection served, NULL once none is ready at current_time. Returns
+ * PICOQUIC_ERROR_DISCONNECTED when *p_cnx is closed and can be deleted. */
+int picoquic_prepare_next_packets(picoquic_quic_t* quic, uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max,
+    size_t* segment_lengths, size_t max_segments, size_t* nb_segments, picoquic_cnx_t** p_cnx, picoquic_path_t** path);
+
 /* Associate stream with app context */
 int picoquic_set_app_stream_ctx(picoquic_cnx_t* cnx,
                                 uint64_t stream_id, void* app_stream_ctx);
@@ -782,6 +1259,45 @@ int picoquic_set_app_stream_ctx(picoquic_cnx_t* cnx,
 int picoquic_mark_active_stream(picoquic_cnx_t* cnx,
     uint64_t stream_id, int is_active, void *app_stream_ctx);
 
+/* Mark stream as redundant, or not.
+ * The frames of a redundant stream may be sent on several paths at once
+ * by a multipath scheduler, trading bandwidth for a lower delivery delay.
+ * Without such a scheduler, the mark has no effect.
+ */
+int picoquic_set_stream_redundant(picoquic_cnx_t* cnx,
+    uint64_t stream_id, int is_redundant);
+
+/* Set the priority of the stream, as in the HTTP extensible priorities.
+ * The streams of the lowest urgency are sent first, from 0 to PICOQUIC_STREAM_URGENCY_MAX.
+ * Within an urgency, the non incremental streams are sent one after the other
+ * by stream ID, then the incremental ones in round robin. The streams are created
+ * with the default urgency and incremental, so that they share the link by default.
+ */
+int picoquic_set_stream_priority(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t urgency, int is_incremental);
+
+/* The stream schedulers that find_ready_stream implements, a plugin can still replace it.
+ * - priority: the HTTP priorities above, the default.
+ * - round_robin: all the streams in round robin, regardless of their priority.
+ * - weighted: each stream gets a share of the bytes proportional to its weight,
+ *   a stream that was idle does not get back the share it did not use.
+ * - strict_priority: the lowest urgency first, the streams of an urgency one after
+ *   the other by stream ID, whether incremental or not.
+ */
+typedef enum {
+    picoquic_stream_scheduler_priority = 0,
+    picoquic_stream_scheduler_round_robin,
+    picoquic_stream_scheduler_weighted,
+    picoquic_stream_scheduler_strict_priority
+} picoquic_stream_scheduler_enum;
+
+int picoquic_set_stream_scheduler(picoquic_cnx_t* cnx, picoquic_stream_scheduler_enum scheduler);
+
+/* Set the weight of the stream for the weighted scheduler, from 1 to PICOQUIC_STREAM_WEIGHT_MAX.
+ * The streams are created with PICOQUIC_STREAM_WEIGHT_DEFAULT.
+ */
+int picoquic_set_stream_weight(picoquic_cnx_t* cnx, uint64_t stream_id, uint16_t weight);
+
 /* If a stream is marked active, the application will receive a callback with
  * event type "picoquic_callback_prepare_to_send" when the transport is ready to
  * send data on a stream. The "length" argument in the call back indicates the
@@ -812,6 +1328,59 @@ int picoquic_add_to_stream(picoquic_cnx_t* cnx,
  */
 int picoquic_add_to_stream_with_ctx(picoquic_cnx_t * cnx, uint64_t stream_id, const uint8_t * data, size_t length, int set_fin, void * app_stream_ctx);
 
+/* Bound the data queued by "picoquic_add_to_stream" and "picoquic_add_buffer_to_stream" and not sent yet.
+ * Once a stream holds stream_high bytes, or the connection cnx_high bytes, the writes with data return
+ * PICOQUIC_ERROR_WOULD_BLOCK and queue nothing. A write accepted below the high marks is queued entirely.
+ * When the stream is back to stream_low bytes and the connection to cnx_low bytes, the application gets a
+ * picoquic_callback_send_buffer_low event for each stream that had a write refused.
+ * A high mark of 0, the default, does not bound the data.
+ */
+void picoquic_set_send_buffer_watermarks(picoquic_cnx_t* cnx, uint64_t stream_high, uint64_t stream_low,
+    uint64_t cnx_high, uint64_t cnx_low);
+
+/* Called when the transport no longer needs the bytes queued by "picoquic_add_buffer_to_stream" */
+typedef void (*picoquic_stream_data_release_fn)(void* release_ctx, const uint8_t* bytes, size_t length);
+
+/* Same as "picoquic_add_to_stream", but the data is not copied: the frames are built from the
+ * buffer of the application, e.g. a mapped file region, which must stay valid until release_fn
+ * is called. That happens once all its bytes were written in packets, since retransmissions
+ * are made from the packets, or when the stream is abandoned. If the call fails, release_fn is
+ * not called and the buffer remains the application's.
+ */
+int picoquic_add_buffer_to_stream(picoquic_cnx_t* cnx, uint64_t stream_id, const uint8_t* data, size_t length, int set_fin,
+    picoquic_stream_data_release_fn release_fn, void* release_ctx);
+
+/* A contiguous span of the data received on a stream, see picoquic_set_stream_batch_callbacks() */
+typedef struct st_picoquic_stream_span_t {
+    uint64_t stream_id;
+    void* app_stream_ctx;
+    uint64_t offset; /* Stream offset of the first byte */
+    const uint8_t* bytes;
+    size_t length;
+    int is_fin; /* The stream ends with this span, which is empty if the fin came alone */
+} picoquic_stream_span_t;
+
+typedef struct st_picoquic_stream_consumed_t {
+    uint64_t stream_id;
+    size_t length;
+} picoquic_stream_consumed_t;
+
+/* In the batched mode, the received data is not handed out chunk by chunk while the frames are processed, the
+ * streams are only marked readable. picoquic_notify_stream_batches() then makes one picoquic_callback_stream_batch
+ * callback per connection with readable streams, listing the spans of their data. The application calls it after
+ * submitting a batch of datagrams to picoquic_incoming_packet(). The data stays in the stream buffers until it is
+ * consumed with picoquic_consume_stream_data(), in the callback or later. The fin is signalled by the span that
+ * ends the stream, and taken once the stream is consumed up to it. Resets are still signalled as they arrive.
+ * Disabled by default. */
+void picoquic_set_stream_batch_callbacks(picoquic_quic_t* quic, int enable);
+void picoquic_notify_stream_batches(picoquic_quic_t* quic);
+/* Fills up to max_spans spans with the data available from the consumed offset of the stream, there are at most 2.
+ * Returns their number */
+size_t picoquic_get_stream_spans(picoquic_cnx_t* cnx, uint64_t stream_id, picoquic_stream_span_t* spans, size_t max_spans);
+/* Consumes the first bytes available on each of the streams, which frees their buffers and opens their flow control
+ * windows. Consuming 0 bytes of a stream that reached its fin takes the fin */
+int picoquic_consume_stream_data(picoquic_cnx_t* cnx, const picoquic_stream_consumed_t* consumed, size_t nb_consumed);
+
 /* Reset a stream, indicating that no more data will be sent on 
  * that stream and that any data currently queued can be abandoned. */
 int picoquic_reset_stream(picoquic_cnx_t* cnx,
@@ -857,13 +1426,33 @@ typedef struct st_picoquic_congestion_algorithm_t {
 extern picoquic_congestion_algorithm_t* picoquic_newreno_algorithm;
 extern picoquic_congestion_algorithm_t* picoquic_cubic_algorithm;
 extern picoquic_congestion_algorithm_t* picoquic_bbr_algorithm;
+/* Delay based, keeps the queuing delay under a target, see ledbat.c */
+extern picoquic_congestion_algorithm_t* picoquic_ledbat_algorithm;
+/* Scalable response to the CE marks reported in the ACK_ECN frames, for L4S bottlenecks, see prague.c */
+extern picoquic_congestion_algorithm_t* picoquic_prague_algorithm;
 
 #define PICOQUIC_DEFAULT_CONGESTION_ALGORITHM picoquic_cubic_algorithm;
 
 void picoquic_set_default_congestion_algorithm(picoquic_quic_t* quic, picoquic_congestion_algorithm_t const* algo);
+/* Returns the algorithm named newreno, cubic, bbr, ledbat or prague, NULL if the name is unknown */
+picoquic_congestion_algorithm_t const* picoquic_get_congestion_algorithm(char const* alg_name);
 
 void picoquic_set_congestion_algorithm(picoquic_cnx_t* cnx, picoquic_congestion_algorithm_t const* alg);
 
+/* Ends the initial slow start of Cubic and New Reno with HyStart++ (RFC 9406) instead of their
+ * RTT increase test */
+void picoquic_set_hystart_pp(picoquic_cnx_t* cnx, int enable);
+
+/* Asks the peer to acknowledge every packet_tolerance ack-eliciting packets, or after max_ack_delay
+ * microseconds, using ACK_FREQUENCY frames. Zero values are scaled to the congestion window and the RTT,
+ * which is the default. Nothing is sent if the peer did not announce the min_ack_delay parameter. */
+void picoquic_set_ack_frequency(picoquic_cnx_t* cnx, uint64_t packet_tolerance, uint64_t max_ack_delay);
+
+/* Asks the peer to acknowledge the next 1-RTT packet without delay, with an IMMEDIATE_ACK frame */
+void picoquic_request_immediate_ack(picoquic_cnx_t* cnx);
+
+/* The packets acknowledged by an ACK frame are notified at once: with picoquic_congestion_notification_acknowledgement,
+ * lost_packet_number holds their number, or 0 when the notification is for a single packet */
 void picoquic_congestion_algorithm_notify_func(picoquic_cnx_t *cnx, picoquic_path_t* path_x, picoquic_congestion_notification_t notification, uint64_t rtt_measurement,
                                                 uint64_t nb_bytes_acknowledged, uint64_t lost_packet_number, uint64_t current_time);
 
@@ -888,6 +1477,17 @@ size_t reserve_frames(picoquic_cnx_t* cnx, uint8_t nb_frames, reserve_frame_slot
  */
 reserve_frame_slot_t* cancel_head_reservation(picoquic_cnx_t* cnx, uint8_t *nb_frames, int congestion_controlled);
 
+/**
+ * Cancels the reservation of the plugin queue with the highest drop priority,
+ * the oldest one among equals, and returns its slots.
+ *
+ * \param[in] cnx The context of the connection
+ * \param[in] nb_frames A pointer to return the number of slots
+ * \param[in] congestion_controlled \b int Do we consider the congestion controlled queue or the non one?
+ * \return The slots in the reservation
+ */
+reserve_frame_slot_t* cancel_droppable_reservation(picoquic_cnx_t* cnx, uint8_t *nb_frames, int congestion_controlled);
+
 /* For building a basic HTTP 0.9 test server */
 int http0dot9_get(uint8_t* command, size_t command_length,
     uint8_t* response, size_t response_max, size_t* response_length);
@@ -896,6 +1496,13 @@ int http0dot9_get(uint8_t* command, size_t command_length,
  * If `interval` is `0`, it is set to `max_idle_timeout / 2`.
  */
 void picoquic_enable_keep_alive(picoquic_cnx_t* cnx, uint64_t interval);
+/* Enables keep alive for a connection, with an interval that discovers the timeout of the NAT bindings of the path.
+ * It starts at `min_interval` and grows by half after each keep alive not followed by a NAT rebinding, up to
+ * `max_interval`. A rebinding is seen by the server as a new address of the client, and by the client as a path
+ * challenge from the server. The interval then backs off to the longest one that held, and stops growing.
+ * If `min_interval` is `0`, it is 15 seconds. If `max_interval` is `0`, it is `max_idle_timeout / 2`.
+ */
+void picoquic_enable_adaptive_keep_alive(picoquic_cnx_t* cnx, uint64_t min_interval, uint64_t max_interval);
 /* Disables keep alive for a connection. */
 void picoquic_disable_keep_alive(picoquic_cnx_t* cnx);
 
@@ -911,6 +1518,23 @@ uint64_t picoquic_get_remote_error(picoquic_cnx_t* cnx);
 /* Create a path */
 int picoquic_create_path(picoquic_cnx_t* cnx, uint64_t start_time, struct sockaddr* addr);
 
+/* ACK of the packet context of any path, as the multipath plugin sends them in its MP_ACK frames.
+ * With has_uniflow_id, the uniflow ID is encoded right after the frame type. */
+typedef struct st_picoquic_path_ack_t {
+    picoquic_path_t* path_x;
+    picoquic_packet_context_enum pc;
+    uint64_t current_time;
+    uint8_t frame_type; /* Type without ECN block, also reported in frame errors */
+    uint8_t ecn_frame_type; /* Type once an ECN block is written */
+    uint8_t has_uniflow_id;
+    uint64_t uniflow_id;
+} picoquic_path_ack_t;
+int picoquic_prepare_path_ack_frame(picoquic_cnx_t* cnx, picoquic_path_ack_t* path_ack,
+    uint8_t* bytes, size_t bytes_max, size_t* consumed);
+/* Processes the ranges of a parsed ACK frame acknowledging packets of path_ack->path_x */
+int picoquic_process_path_ack_ranges(picoquic_cnx_t* cnx, picoquic_path_ack_t* path_ack,
+    ack_frame_t* frame, picoquic_packet_t** ptop_packet);
+
 /* Check pacing to see whether the next transmission is authorized. If it is not, update the next wait time to reflect pacing. */
 int picoquic_is_sending_authorized_by_pacing(picoquic_path_t * path_x, uint64_t current_time, uint64_t * next_time);
 
@@ -918,11 +1542,26 @@ int picoquic_is_sending_authorized_by_pacing(picoquic_path_t * path_x, uint64_t
 void picoquic_update_pacing_data(picoquic_path_t * path_x);
 void picoquic_update_pacing_rate(picoquic_path_t* path_x, double pacing_rate, uint64_t quantum);
 
+/* Update the pacing data after sending a packet */
+void picoquic_update_pacing_after_send(picoquic_path_t * path_x, uint64_t current_time);
+
+/* Time at which the last packet prepared on the path should leave, when the pacing is offloaded */
+uint64_t picoquic_get_departure_time(picoquic_path_t* path_x);
+
+/* Delay after its sending at which a packet followed by acknowledged ones is deemed lost */
+uint64_t picoquic_loss_time_threshold(picoquic_path_t* path_x);
+
+/* Probe timeout of the packet number space, with its exponential backoff, and the time at which it expires for the packet */
+uint64_t picoquic_pto_duration(picoquic_path_t* path_x, picoquic_packet_context_enum pc);
+uint64_t picoquic_pto_time(picoquic_path_t* path_x, picoquic_packet_context_enum pc, picoquic_packet_t* p);
+
 void picoquic_estimate_path_bandwidth(picoquic_cnx_t *cnx, picoquic_path_t* path_x, uint64_t send_time, uint64_t delivered_prior, uint64_t delivered_time_prior, uint64_t delivered_sent_prior,
                                       uint64_t delivery_time, uint64_t current_time, int rs_is_path_limited);
 
 /* Integer formatting functions */
 size_t picoquic_varint_decode(const uint8_t* bytes, size_t max_bytes, uint64_t* n64);
+/* Decodes nb_values successive varints, returns the number of bytes used, or 0 if they do not all fit */
+size_t picoquic_varint_decode_n(const uint8_t* bytes, size_t max_bytes, uint64_t* values, size_t nb_values);
 size_t picoquic_varint_encode(uint8_t* bytes, size_t max_bytes, uint64_t n64);
 size_t picoquic_varint_skip(const uint8_t* bytes);
 
@@ -32,6 +32,12 @@
 #include "picosocks.h"
 #include "uthash.h"
 #include "plugin.h"
+#include "packet_pool.h"
+#include "object_cache.h"
+#include "picosplay.h"
+#include "stream_recv.h"
+#include "resumption_store.h"
+#include "server_metrics.h"
 
 #ifdef __APPLE__
 #include <machine/endian.h>
@@ -59,13 +65,16 @@
 extern "C" {
 #endif
 
-#define PICOQUIC_MAX_PACKET_SIZE 1536
 #define PICOQUIC_MIN_SEGMENT_SIZE 256
 #define PICOQUIC_INITIAL_MTU_IPV4 1252
 #define PICOQUIC_INITIAL_MTU_IPV6 1232
 #define PICOQUIC_ENFORCED_INITIAL_MTU 1200
 #define PICOQUIC_PRACTICAL_MAX_MTU 1440
 #define PICOQUIC_RETRY_SECRET_SIZE 64
+#define PICOQUIC_RETRY_TOKEN_SIZE 16
+#define PICOQUIC_MAX_SECRET_SIZE 64 /* Largest hash digest of the cipher suites */
+#define PICOQUIC_KEY_RETENTION_PTO 3 /* Previous 1-RTT decryption key kept for that many retransmit timers */
+#define PICOQUIC_SIGN_OFFLOAD_POLL_INTERVAL 1000 /* Microseconds between checks of a parked handshake */
 #define PICOQUIC_DEFAULT_0RTT_WINDOW 4096
 
 #define PICOQUIC_NUMBER_OF_EPOCHS 4
@@ -75,17 +84,35 @@ extern "C" {
 #define PICOQUIC_TARGET_RENO_RTT 100000 /* 100 ms */
 #define PICOQUIC_INITIAL_RETRANSMIT_TIMER 1000000 /* one second */
 #define PICOQUIC_MIN_RETRANSMIT_TIMER 50000 /* 50 ms */
+#define PICOQUIC_PTO_PERSISTENT_CONGESTION 2 /* Probe timeouts in a row, spanning 3 PTO, before collapsing the window */
+#define PICOQUIC_PTO_COUNT_MAX 8 /* Probe timeouts in a row before giving up the connection */
 #define PICOQUIC_ACK_DELAY_MAX 25000 /* 25 ms */
+#define PICOQUIC_ACK_DELAY_MIN 1000 /* 1 ms, announced in the min_ack_delay parameter */
+#define PICOQUIC_ACK_GAP_DEFAULT 2 /* Packets acknowledged at once when the peer sets no tolerance */
+#define PICOQUIC_ACK_GAP_MAX 32
+#define PICOQUIC_ACK_GAP_OVERLOAD_FACTOR 4 /* Gap asked to the peers of an overloaded context, see picoquic_overload_shed */
 #define PICOQUIC_RACK_DELAY 10000 /* 10 ms */
+#define PICOQUIC_REORDER_WINDOW_MULT_MAX 7 /* Loss time threshold up to 2 RTT */
 
 #define PICOQUIC_BANDWIDTH_ESTIMATE_MAX 10000000000ull /* 10 GB per second */
 #define PICOQUIC_BANDWIDTH_TIME_INTERVAL_MIN 1000
 
 #define PICOQUIC_SPURIOUS_RETRANSMIT_DELAY_MAX 1000000 /* one second */
 
+#define PICOQUIC_MTU_MAX_PROBES 3 /* Lost probes of a size before it is deemed too large, MAX_PROBES of RFC 8899 */
+#define PICOQUIC_MTU_SEARCH_PRECISION 10 /* The search stops when the bounds are that close */
+#define PICOQUIC_MTU_RAISE_TIMER 600000000ull /* 600 seconds before searching again, PMTU_RAISE_TIMER of RFC 8899 */
+#define PICOQUIC_MTU_BLACK_HOLE_LOSSES 6 /* Full size packets lost in a row before the MTU falls back to the base */
+#define PICOQUIC_DEFAULT_MAX_DATA_WINDOW_MAX 0x1000000 /* 16 MB, cap of the auto-tuned connection window */
+#define PICOQUIC_DEFAULT_MAX_STREAM_DATA_WINDOW_MAX 0x800000 /* 8 MB, cap of the auto-tuned stream windows */
+#define PICOQUIC_STREAM_SEND_CHUNK_SIZE 0x4000 /* Smallest chunk of copied send data, that the next writes fill up */
+#define PICOQUIC_DRR_QUANTUM PICOQUIC_MAX_PACKET_SIZE /* Bytes of reservations a plugin may send per turn */
+
 #define PICOQUIC_MICROSEC_SILENCE_MAX 120000000 /* 120 seconds for now */
 #define PICOQUIC_MICROSEC_HANDSHAKE_MAX 15000000 /* 15 seconds for now */
 #define PICOQUIC_MICROSEC_WAIT_MAX 10000000 /* 10 seconds for now */
+#define PICOQUIC_KEEP_ALIVE_BUCKET 1000000 /* Keep alive deadlines are rounded up to the second, for idle connections to wake together */
+#define PICOQUIC_KEEP_ALIVE_ADAPTIVE_MIN 15000000 /* 15 seconds, shorter than the UDP binding timeout of the NATs */
 
 #define PICOQUIC_CWIN_INITIAL (10 * PICOQUIC_MAX_PACKET_SIZE)
 #define PICOQUIC_CWIN_MINIMUM (2 * PICOQUIC_MAX_PACKET_SIZE)
@@ -132,29 +159,41 @@ int picoquic_get_version_index(uint32_t proposed_version);
 
 /*
      * Definition of the session ticket store that can be associated with a
-     * client context.
+     * client context. The list head is the head of a hash index by SNI and ALPN,
+     * whose order is that of storage.
      */
 typedef struct st_picoquic_stored_ticket_t {
-    struct st_picoquic_stored_ticket_t* next_ticket;
+    UT_hash_handle hh; /* Index by "sni\0alpn", see picoquic_store_ticket() */
     char* sni;
     char* alpn;
     uint8_t* ticket;
+    char* plugins; /* Those the server injected, comma separated, empty if none */
     uint64_t time_valid_until;
     uint16_t sni_length;
     uint16_t alpn_length;
     uint16_t ticket_length;
+    uint16_t plugins_length;
+    unsigned int is_persisted : 1; /* Written to the ticket file since it was stored or loaded */
 } picoquic_stored_ticket_t;
 
 int picoquic_store_ticket(picoquic_stored_ticket_t** pp_first_ticket,
     uint64_t current_time,
     char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
-    uint8_t* ticket, uint16_t ticket_length);
+    uint8_t* ticket, uint16_t ticket_length, char const* plugins);
 int picoquic_get_ticket(picoquic_stored_ticket_t* p_first_ticket,
     uint64_t current_time,
     char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
     uint8_t** ticket, uint16_t* ticket_length);
+/* The plugins stored with the ticket, NULL if none */
+char const* picoquic_get_ticket_plugins(picoquic_stored_ticket_t* p_first_ticket,
+    uint64_t current_time,
+    char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length);
 
-int picoquic_save_tickets(const picoquic_stored_ticket_t* first_ticket,
+/* Rewrites the file with the valid tickets */
+int picoquic_save_tickets(picoquic_stored_ticket_t* first_ticket,
+    uint64_t current_time, char const* ticket_file_name);
+/* Appends to the file the valid tickets not written yet, those loaded from it included */
+int picoquic_append_tickets(picoquic_stored_ticket_t* first_ticket,
     uint64_t current_time, char const* ticket_file_name);
 int picoquic_load_tickets(picoquic_stored_ticket_t** pp_first_ticket,
     uint64_t current_time, char const* ticket_file_name);
@@ -164,18 +203,62 @@ void picoquic_free_tickets(picoquic_stored_ticket_t** pp_first_ticket);
 #define MAX_PLUGIN 64
 #define PROTOOPPLUGINNAME_MAX 100
 /**
- * XXX: For now, we assume we always request the same plugin.
- * If not, we would require an hash map with linked list, but the current behaviour
- * of the client and the server does not require it now. Currently, a queue does
- * well the job.
+ * The protocol operations and plugins of a closed connection, ready to be reused by a new one.
+ * Negotiated plugins are cached without their postplugins, as if they were freshly inserted.
  */
 typedef struct st_cached_plugins_t {
     protocol_operation_struct_t* ops; /* A hash map to the protocol operations */
     protoop_plugin_t* plugins; /* A hash map to the plugins referenced by ops */
     char plugin_names[MAX_PLUGIN][PROTOOPPLUGINNAME_MAX]; /* The names of the plugins */
     uint8_t nb_plugins;
+    struct st_cached_plugins_t* next; /* Next cached instance of the same set of plugins */
 } cached_plugins_t;
 
+/* All the cached instances of a set of plugins, whatever the order in which they were inserted */
+typedef struct st_cached_plugins_set_t {
+    uint64_t set_hash; /* Key, see plugin_set_hash_add() */
+    cached_plugins_t* first;
+    UT_hash_handle hh;
+} cached_plugins_set_t;
+
+/**
+ * The memory of a plugin instance, captured once it is initialised, that the new instances of the plugin map
+ * copy-on-write instead of building the same state again. See plugin_template_capture().
+ */
+typedef struct st_plugin_template_t {
+    char name[PROTOOPPLUGINNAME_MAX]; /* Key, name of the plugin */
+    int fd; /* memfd holding the resident pages of the memory, at their offsets */
+    uint64_t base; /* Address of the memory when it was captured */
+    uint32_t memory_size;
+    /* Offsets of the words of the memory pointing inside it, moved by the mappings at another address */
+    uint32_t *relocations;
+    size_t nb_relocations;
+    void *memory_manager_ctx; /* Copy of the memory manager context, relative to base as well */
+    size_t memory_manager_ctx_size;
+    uint64_t metadata[STRUCT_METADATA_MAX]; /* Connection metadata of the plugin */
+    UT_hash_handle hh;
+} plugin_template_t;
+
+/* File put in a plugin archive, as it was when the archive was prepared */
+typedef struct st_plugin_archive_source_t {
+    char* path;
+    time_t mtime;
+    off_t size;
+} plugin_archive_source_t;
+
+/* Archive of a plugin to inject, prepared once and then sent to all the peers requesting it.
+ * It is prepared again when one of its sources changed on disk.
+ */
+typedef struct st_plugin_archive_t {
+    char* plugin_name; /* Key */
+    uint8_t* data;
+    size_t data_len;
+    plugin_archive_source_t* sources; /* The manifest, then its pluglets */
+    int nb_sources;
+    int refcount; /* The context and the plugin stream data referencing it */
+    UT_hash_handle hh;
+} plugin_archive_t;
+
 typedef struct st_plugin_list_t {
     uint16_t size;
     uint16_t name_num_bytes; // Count the number of bytes in the plugin names
@@ -195,6 +278,56 @@ typedef struct st_plugin_request_t {
     plugin_req_pid_t elems[MAX_PLUGIN];
 } plugin_request_t;
 
+/* Per epoch crypto context. There are four such contexts:
+ * 0: Initial context, with encryption based on a version dependent key,
+ * 1: 0-RTT context
+ * 2: Handshake context
+ * 3: Application data
+ */
+typedef struct st_picoquic_crypto_context_t {
+    void* aead_encrypt;
+    void* aead_decrypt;
+    void* hp_enc; /* Used for PN encryption */
+    void* hp_dec; /* Used for PN decryption */
+    void* hp_ecb; /* Key of hp_enc as a block cipher, to compute several masks at once. NULL if the cipher is not AES */
+    /* 1-RTT only: the contexts of the next key phase are derived as soon as the current one is in
+     * use, so that a key update is a swap of pointers. The previous decryption context is kept for
+     * the packets reordered across the update, until old_decrypt_expiry. */
+    void* aead_encrypt_next;
+    void* aead_decrypt_next;
+    void* aead_decrypt_old;
+    uint64_t old_decrypt_expiry;
+    uint64_t first_pn_current_phase; /* First packet number received in the current decryption phase */
+    uint32_t nb_key_phases_received; /* Key updates of the peer, or confirmations of ours */
+    uint8_t secret_next[2][PICOQUIC_MAX_SECRET_SIZE]; /* Secrets of the next phase, by is_enc */
+} picoquic_crypto_context_t;
+
+/* Cache of the Initial decryption keys of destination CIDs without connection, indexed by CID */
+#define PICOQUIC_INITIAL_KEY_CACHE_SIZE 16
+
+typedef struct st_picoquic_initial_key_cache_entry_t {
+    picoquic_connection_id_t cnx_id;
+    int version_index;
+    picoquic_crypto_context_t ctx; /* The decryption contexts, and the encryption ones once a packet was refused */
+} picoquic_initial_key_cache_entry_t;
+
+typedef struct st_picoquic_tp_preferred_address_t {
+    uint8_t ipv4_address[4];
+    uint16_t ipv4_port;
+    uint8_t ipv6_address[16];
+    uint16_t ipv6_port;
+    picoquic_connection_id_t connection_id;
+    uint8_t stateless_reset_token[16];
+} picoquic_tp_preferred_address_t;
+
+/* See picoquic_set_send_buffer_watermarks(), a high mark of 0 does not bound the data */
+typedef struct st_picoquic_send_watermarks_t {
+    uint64_t stream_high;
+    uint64_t stream_low;
+    uint64_t cnx_high;
+    uint64_t cnx_low;
+} picoquic_send_watermarks_t;
+
 /*
 	 * QUIC context, defining the tables of connections,
 	 * open sockets, etc.
@@ -203,6 +336,12 @@ typedef struct st_picoquic_quic_t {
     void * F_log;
     void * F_tls_secrets;
     void* tls_master_ctx;
+    char const* aead_provider_name; /* See picoquic_set_aead_provider() */
+    void* sign_offload; /* See picoquic_set_sign_offload() */
+    void* log_flusher; /* See picoquic_set_log_flusher() */
+    void* F_binlog; /* See picoquic_set_binary_log() */
+    picoquic_log_policy_t* log_policy; /* See picoquic_set_log_policy() */
+    picoquic_profile_t* profile; /* See picoquic_set_profile() */
     picoquic_stream_data_cb_fn default_callback_fn;
     void* default_callback_ctx;
     char const* default_alpn;
@@ -210,21 +349,41 @@ typedef struct st_picoquic_quic_t {
     uint8_t reset_seed[PICOQUIC_RESET_SECRET_SIZE];
     uint8_t retry_seed[PICOQUIC_RETRY_SECRET_SIZE];
     uint64_t* p_simulated_time;
+    uint64_t loop_time; /* Set by picoquic_refresh_time(), 0 until then */
     char const* ticket_file_name;
     picoquic_stored_ticket_t* p_first_ticket;
     uint32_t mtu_max;
+    uint32_t max_packet_size; /* See picoquic_set_max_packet_size() */
 
     uint32_t flags;
 
-    picoquic_stateless_packet_t* pending_stateless_packet;
+    /* Bounded ring of stateless packets, with several producers and one consumer */
+    picoquic_stateless_packet_t* stateless_ring;
+    uint64_t stateless_ring_head; /* Next position reserved by a producer */
+    uint64_t stateless_ring_tail; /* Next position read by the consumer */
+    uint64_t stateless_packets_dropped;
+
+    /* Initial keys of the destination CIDs that did not match a connection, see picoquic_get_initial_decrypt_context() */
+    picoquic_initial_key_cache_entry_t initial_key_cache[PICOQUIC_INITIAL_KEY_CACHE_SIZE];
+    uint64_t nb_initial_rejected[picoquic_initial_reject_max];
+
+    /* Overload control, see picoquic_update_overload(). The load is counted in eighths of the thresholds */
+    uint64_t overload_lag_threshold;
+    uint32_t overload_backlog_threshold;
+    uint64_t overload_lag_smoothed;
+    uint64_t overload_backlog_smoothed; /* Eight times the smoothed backlog */
+    picoquic_overload_level_enum overload_level;
 
     picoquic_congestion_algorithm_t const* default_congestion_alg;
 
     struct st_picoquic_cnx_t* cnx_list;
     struct st_picoquic_cnx_t* cnx_last;
 
-    struct st_picoquic_cnx_t* cnx_wake_first;
-    struct st_picoquic_cnx_t* cnx_wake_last;
+    /* Connections by wake time, in a 4-ary min heap, see picoquic_insert_cnx_by_wake_time() */
+    struct st_picoquic_cnx_t** cnx_wake_heap;
+    size_t cnx_wake_heap_size;
+    size_t cnx_wake_heap_max;
+    uint64_t cnx_wake_sequence; /* Connections waking at the same time wake in the order they were inserted */
 
     picohash_table* table_cnx_by_id;
     picohash_table* table_cnx_by_net;
@@ -234,24 +393,91 @@ typedef struct st_picoquic_quic_t {
 
     void* aead_encrypt_ticket_ctx;
     void* aead_decrypt_ticket_ctx;
+    /* With a shared store, the ticket keys come from it and are kept here by key slot */
+    picoquic_resumption_store_t* resumption_store;
+    void* resumption_aead[2][PICOQUIC_RESUMPTION_KEY_SLOTS]; /* Decrypt, encrypt */
+    uint32_t resumption_aead_key_id[2][PICOQUIC_RESUMPTION_KEY_SLOTS];
+    picoquic_server_metrics_t* server_metrics;
 
     picoquic_verify_certificate_cb_fn verify_certificate_callback_fn;
     picoquic_free_verify_certificate_ctx free_verify_certificate_callback_fn;
     void* verify_certificate_ctx;
     uint8_t local_ctx_length;
+    /* Encoding of the local CIDs, see picoquic_set_lb_config(). NULL if they are random */
+    picoquic_lb_ctx_t* lb_ctx;
 
     /* Which was the socket used to receive the last packet? */
     SOCKET_TYPE rcv_socket;
     /* Last received TOS */
     int rcv_tos;
+    /* Kernel receive time of the datagram being processed, 0 if unknown, see picoquic_enable_rx_timestamps() */
+    uint64_t rcv_time;
+    /* ECN codepoint of the packets sent, see picoquic_set_ecn(). 0 if they are not marked */
+    uint8_t ecn_codepoint;
+    uint8_t ecn_configured; /* Set by picoquic_set_ecn(), the sockets are left as they are otherwise */
+    /* Sockets below 64 already marked with ecn_codepoint, by picoquic_before_sending_packet() */
+    uint64_t ecn_socket_flags;
 
     picoquic_tp_t * default_tp;
+    /* Advertised to the clients, see picoquic_set_preferred_address(). A port of 0 if there is no address of the family */
+    picoquic_tp_preferred_address_t preferred_address;
 
     picoquic_fuzz_fn fuzz_fn;
     void* fuzz_ctx;
 
-    /* Queue of cached plugins */
-    queue_t* cached_plugins_queue;
+    /* Hash map of the cached plugin sets */
+    cached_plugins_set_t* cached_plugins;
+    /* Hash map of the archives of the plugins to inject already sent to a peer */
+    plugin_archive_t* plugin_archives;
+    /* Hash map of the pluglet ELF files read by the connections, by path */
+    pluglet_image_t* pluglet_images;
+    /* Hash map of the plugin templates, by plugin name */
+    plugin_template_t* plugin_templates;
+    /* Packets sent by the connections, recycled once acknowledged */
+    picoquic_packet_pool_t packet_pool;
+    /* Connections, paths and streams, recycled once deleted */
+    picoquic_object_cache_t cnx_cache;
+    picoquic_object_cache_t path_cache;
+    picoquic_object_cache_t stream_cache;
+    /* NUMA node of the packet pool, the object caches and the plugin memories, -1 if left to the system */
+    int numa_node;
+    /* Optional directory holding the on-disk images of the injected plugins */
+    char* plugin_image_cache_path;
+    /* Number of ready instances of the local plugins to keep in the plugin cache */
+    uint8_t plugin_prewarm_depth;
+    /* Load the native build of the pluglets instead of their eBPF code when there is one */
+    uint8_t use_native_pluglets;
+    /* How far ahead of their departure time packets may be prepared when the kernel paces them, 0 if it does not */
+    uint64_t pacing_offload_horizon;
+    /* Packets sent per pacing decision, see picoquic_set_pacing_burst() */
+    uint64_t pacing_burst;
+    /* Largest turn of a connection in picoquic_prepare_next_packets(), see picoquic_set_send_budget(). 0 if unlimited */
+    size_t send_budget_packets;
+    size_t send_budget_bytes;
+    /* Memory cap of the new connections, see picoquic_set_default_memory_cap() */
+    uint64_t default_memory_cap;
+    picoquic_send_watermarks_t default_send_watermarks;
+    /* Idle time after which the connections hibernate, see picoquic_set_hibernation_delay(). 0 if they do not */
+    uint64_t hibernation_delay;
+    /* Granularity of the keep alive deadlines, see picoquic_set_keep_alive_bucket() */
+    uint64_t keep_alive_bucket;
+    /* Tombstones of the closed connections, by expiry time, see picoquic_set_tombstones(). No table if they are disabled */
+    picohash_table* table_tombstones;
+    struct st_picoquic_tombstone_t* tombstone_first;
+    struct st_picoquic_tombstone_t* tombstone_last;
+    size_t nb_tombstones;
+    size_t max_tombstones;
+    /* Connections with readable streams in the batched mode, see picoquic_set_stream_batch_callbacks() */
+    unsigned int stream_batch_callbacks : 1;
+    struct st_picoquic_cnx_t* first_readable_cnx;
+    struct st_picoquic_cnx_t* last_readable_cnx;
+    picoquic_stream_span_t* stream_batch_spans;
+    size_t stream_batch_spans_max;
+    /* Receive window auto-tuning, see picoquic_set_flow_control_autotune() */
+    uint64_t max_data_window_max;
+    uint64_t max_stream_data_window_max;
+    uint64_t flow_control_budget; /* 0 if there is none */
+    uint64_t flow_control_growth; /* Growth of the windows of all the connections, past the transport parameters */
     /* Path to the plugin cache store */
     char* plugin_store_path;
     /* List of supported plugins in plugin cache store */
@@ -286,19 +512,11 @@ typedef enum {
     picoquic_tp_active_connection_id_limit = 0x0e, // TODO draft-29
     picoquic_tp_initial_source_connection_id = 0x0f, // TODO draft-29
     picoquic_tp_retry_source_connection_id = 0x10,
+    picoquic_tp_min_ack_delay = 0xde1a, /* draft-ietf-quic-ack-frequency */
     picoquic_tp_supported_plugins = 0x79, // to avoid clash with datagram extension
     picoquic_tp_plugins_to_inject = 0x7a, // to avoid clash with datagram extension
 } picoquic_tp_enum;
 
-typedef struct st_picoquic_tp_preferred_address_t {
-    uint8_t ipv4_address[4];
-    uint16_t ipv4_port;
-    uint8_t ipv6_address[16];
-    uint16_t ipv6_port;
-    picoquic_connection_id_t connection_id;
-    uint8_t stateless_reset_token[16];
-} picoquic_tp_preferred_address_t;
-
 typedef struct st_picoquic_tp_t {
     picoquic_connection_id_t original_destination_connection_id;
     uint64_t max_idle_timeout;  // TODO use TP
@@ -316,20 +534,52 @@ typedef struct st_picoquic_tp_t {
     uint64_t active_connection_id_limit;
     picoquic_connection_id_t initial_source_connection_id;
     picoquic_connection_id_t retry_source_connection_id; // TODO use this TP
+    uint64_t min_ack_delay; /* In microseconds, 0 if the ACK_FREQUENCY frames are not supported */
     char* supported_plugins;
     char* plugins_to_inject;
 } picoquic_tp_t;
 
 /*
- * SACK dashboard item, part of connection context.
+ * SACK dashboard, part of connection context.
  */
 
 typedef struct st_picoquic_sack_item_t {
-    struct st_picoquic_sack_item_t* next_sack;
     uint64_t start_of_sack_range;
     uint64_t end_of_sack_range;
 } picoquic_sack_item_t;
 
+#define PICOQUIC_SACK_INLINE_RANGES 4
+
+/*
+ * Sorted array of ranges, from the highest one. The last range is followed by an unused item
+ * whose start_of_sack_range is (uint64_t)-1, which lets the pluglets walk the ranges. Room is
+ * kept before the highest range, so that a new highest range does not move the others.
+ * A zeroed list is empty.
+ */
+typedef struct st_picoquic_sack_list_t {
+    picoquic_sack_item_t* allocated; /* NULL while the ranges fit in inline_items */
+    uint32_t nb_items_alloc;
+    uint32_t first; /* Index of the highest range */
+    uint32_t nb_ranges;
+    picoquic_sack_item_t inline_items[PICOQUIC_SACK_INLINE_RANGES + 1];
+} picoquic_sack_list_t;
+
+static inline picoquic_sack_item_t* picoquic_sack_list_items(picoquic_sack_list_t* sacks)
+{
+    return (sacks->allocated != NULL) ? sacks->allocated : sacks->inline_items;
+}
+
+/* Highest range, or the unused item with start_of_sack_range (uint64_t)-1 if the list is empty */
+static inline picoquic_sack_item_t* picoquic_sack_list_first(picoquic_sack_list_t* sacks)
+{
+    picoquic_sack_item_t* first = picoquic_sack_list_items(sacks) + sacks->first;
+    if (sacks->nb_ranges == 0) {
+        first->start_of_sack_range = (uint64_t)((int64_t)-1);
+        first->end_of_sack_range = 0;
+    }
+    return first;
+}
+
 /*
  * Stream head.
  * Stream contains bytes of data, which are not always delivered in order.
@@ -341,7 +591,12 @@ typedef struct _picoquic_stream_data {
     struct _picoquic_stream_data* next_stream_data;
     uint64_t offset;  /* Stream offset of the first octet in "bytes" */
     size_t length;    /* Number of octets in "bytes" */
+    size_t capacity;  /* When not 0, "bytes" follows the structure and later writes can fill it up to that size */
     uint8_t* bytes;
+    plugin_archive_t* archive; /* When set, bytes is the data of the archive, shared with other streams */
+    picoquic_stream_data_release_fn release_fn; /* When set, bytes belongs to the application, which gets it back through it */
+    void* release_ctx;
+    picoquic_memory_category_enum memory_category; /* Where the data is counted in the memory stats of the connection */
 } picoquic_stream_data;
 
 typedef struct _picoquic_stream_head {
@@ -351,19 +606,26 @@ typedef struct _picoquic_stream_head {
     uint64_t fin_offset;
     uint64_t maxdata_local;
     uint64_t maxdata_remote;
+    /* Credit granted past the consumed offset, see picoquic_autotune_window() */
+    uint64_t max_data_window;
+    uint64_t max_data_update_time;
+    uint64_t max_data_growth; /* Growth of the window, counted in the flow control budget of the context */
     uint64_t local_error;
     uint64_t remote_error;
     uint64_t local_stop_error;
     uint64_t remote_stop_error;
-    picoquic_stream_data* stream_data;
+    picoquic_stream_data* stream_data; /* Received data of the TLS and plugin streams */
+    picoquic_stream_recv_t recv; /* Received data of the application streams */
     uint64_t sent_offset;
     uint64_t sending_offset;
     picoquic_stream_data* send_queue;
+    uint64_t send_buffered; /* Bytes of send_queue not sent yet */
     void *app_stream_ctx;
-    picoquic_sack_item_t first_sack_item;
+    picoquic_sack_list_t sack_list; /* Acknowledged offsets */
     /* Flags describing the state of the stream */
     unsigned int is_active : 1; /* The application is actively managing data sending through callbacks */
     unsigned int fin_requested : 1; /* Application has requested Fin of sending stream */
+    unsigned int send_blocked : 1; /* A write was refused, see picoquic_set_send_buffer_watermarks() */
     unsigned int fin_sent : 1; /* Fin sent to peer */
     unsigned int fin_received : 1; /* Fin received from peer */
     unsigned int fin_signalled : 1; /* After Fin was received from peer, Fin was signalled to the application */
@@ -376,6 +638,19 @@ typedef struct _picoquic_stream_head {
     unsigned int stop_sending_received : 1; /* Stop sending received from peer */
     unsigned int stop_sending_signalled : 1; /* After stop sending received from peer, application was notified */
     unsigned int max_stream_updated : 1; /* After stream was closed in both directions, the max stream id number was updated */
+    unsigned int is_ready_queued : 1; /* The stream is in the ready list of the connection */
+    unsigned int is_max_data_queued : 1; /* The stream is in the MAX_STREAM_DATA list of the connection */
+    unsigned int is_readable_queued : 1; /* The stream is in the readable list of the connection */
+    unsigned int is_redundant : 1; /* Application asked to send the stream frames on several paths */
+    unsigned int is_sequential : 1; /* Sent alone before the other streams of its urgency, instead of round robin */
+    uint8_t urgency; /* 0 is sent first, see picoquic_set_stream_priority() */
+    uint16_t weight; /* Share of the weighted scheduler, see picoquic_set_stream_weight() */
+    uint64_t wfq_tag; /* Virtual time at which the weighted scheduler serves the stream next */
+    uint64_t ready_rank; /* Key of the ready tree before the stream ID, set by the scheduler of the connection */
+    picosplay_node_t ready_node;
+    struct _picoquic_stream_head* next_max_data_stream;
+    struct _picoquic_stream_head* next_readable_stream;
+    UT_hash_handle hh; /* Index of the application streams by ID */
 } picoquic_stream_head;
 
 #define IS_CLIENT_STREAM_ID(id) (unsigned int)(((id) & 1) == 0)
@@ -383,18 +658,21 @@ typedef struct _picoquic_stream_head {
 #define IS_LOCAL_STREAM_ID(id, client_mode)  (unsigned int)(((id)^(client_mode)) & 1)
 #define STREAM_ID_FROM_RANK(rank, is_server_stream, is_unidir) ((((uint64_t)(rank)-(uint64_t)1)<<2)|(((uint64_t)is_unidir)<<1)|((uint64_t)(is_server_stream)))
 
-/* Per epoch crypto context. There are four such contexts:
- * 0: Initial context, with encryption based on a version dependent key,
- * 1: 0-RTT context
- * 2: Handshake context
- * 3: Application data
- */
-typedef struct st_picoquic_crypto_context_t {
-    void* aead_encrypt;
-    void* aead_decrypt;
-    void* hp_enc; /* Used for PN encryption */
-    void* hp_dec; /* Used for PN decryption */
-} picoquic_crypto_context_t;
+/* Header protection deferred to the end of a burst, so that the masks of its packets are computed together */
+#define PICOQUIC_HP_BATCH_MAX 64
+
+typedef struct st_picoquic_hp_batch_entry_t {
+    uint8_t* header;
+    void* hp_enc;
+    void* hp_ecb;
+    uint32_t pn_offset;
+    uint8_t first_mask;
+} picoquic_hp_batch_entry_t;
+
+typedef struct st_picoquic_hp_batch_t {
+    size_t nb_entries;
+    picoquic_hp_batch_entry_t entries[PICOQUIC_HP_BATCH_MAX];
+} picoquic_hp_batch_t;
 
 /* Per epoch sequence/packet context.
  * There are three such contexts:
@@ -406,15 +684,16 @@ typedef struct st_picoquic_crypto_context_t {
 typedef struct st_picoquic_packet_context_t {
     uint64_t send_sequence;
 
-    picoquic_sack_item_t first_sack_item;
+    picoquic_sack_list_t sack_list; /* Received packet numbers */
     uint64_t time_stamp_largest_received;
     uint64_t highest_ack_sent;
     uint64_t highest_ack_time;
     uint64_t ack_delay_local;
     uint64_t latest_progress_time;
 
-    uint64_t nb_retransmit;
+    uint64_t nb_retransmit; /* Probe timeouts since the last acknowledgement, the backoff exponent */
     uint64_t latest_retransmit_time;
+    uint64_t latest_ack_eliciting_time; /* The probe timer runs from there */
     uint64_t latest_retransmit_cc_notification_time;
     uint64_t highest_acknowledged;
     uint64_t latest_time_acknowledged; /* time at which the highest acknowledged was sent */
@@ -422,30 +701,103 @@ typedef struct st_picoquic_packet_context_t {
     picoquic_packet_t* retransmit_oldest;
     picoquic_packet_t* retransmitted_newest;
     picoquic_packet_t* retransmitted_oldest;
+    /* Packets of the retransmit queue, by sequence_number & retransmit_index_mask */
+    picoquic_packet_t** retransmit_index;
+    uint64_t retransmit_index_mask;
+
+    /* ECT(0), ECT(1) and CE marked packets received, echoed in the ACK_ECN frames */
+    uint64_t ecn_received[3];
+    /* Counts of the last ACK_ECN frame of the peer */
+    uint64_t ecn_remote[3];
 
     unsigned int ack_needed : 1;
+    unsigned int ack_immediate : 1; /* An IMMEDIATE_ACK frame was received */
+    unsigned int retransmit_index_broken : 1; /* Queue not indexable until it is emptied */
 
-    plugin_struct_metadata_t *metadata;
+    plugin_metadata_t metadata;
 } picoquic_packet_context_t;
 
+/*
+ * Delivery rate sample of a path, computed when an ACK acknowledges new data,
+ * see picoquic_delivery_rate_sample() in cc_common.c
+ */
+/* Checks that the ECN marks of a path get through, on its first acknowledgements, see RFC 9000 section 13.4.2 */
+typedef enum {
+    picoquic_ecn_testing = 0,
+    picoquic_ecn_capable, /* The peer reported marked packets, its counts drive the response to CE */
+    picoquic_ecn_failed /* The counts were missing or went backwards, they are ignored */
+} picoquic_ecn_state_enum;
+
+typedef struct st_picoquic_rate_sample_t {
+    uint64_t delivery_rate; /* In bytes per second */
+    uint64_t delivered; /* Bytes delivered during the interval */
+    uint64_t interval; /* Microseconds, the longest of the send and ACK intervals */
+    uint64_t prior_delivered; /* Path delivered count when the acknowledged packet was sent */
+    uint64_t is_app_limited; /* The packet was sent while the application did not fill the window */
+} picoquic_rate_sample_t;
+
+/* What held the sender of a path back, the time spent in each is counted, see picoquic_path_set_send_limit() */
+typedef enum {
+    picoquic_send_limit_none = 0,
+    picoquic_send_limit_cwnd, /* The bytes in transit filled the congestion window */
+    picoquic_send_limit_pacing,
+    picoquic_send_limit_app, /* Nothing to send */
+    picoquic_send_limit_flow_control, /* Data waiting on the MAX_DATA of the peer */
+    picoquic_nb_send_limits
+} picoquic_send_limit_enum;
+
+/*
+ * RTT histogram with 4 buckets per power of two of microseconds, so that a percentile is within 12%
+ * of the samples. Values above 2^33 microseconds go in the last bucket.
+ */
+#define PICOQUIC_RTT_HISTOGRAM_SIZE 128
+
+/* Transport counters of a path, reported by picoquic_get_path_stats() */
+typedef struct st_picoquic_path_counters_t {
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    uint64_t packets_received;
+    uint64_t bytes_received;
+    uint64_t packets_lost; /* Retransmitted or abandoned as lost, including the spurious losses */
+    uint64_t bytes_lost;
+    uint64_t packets_spurious; /* Declared lost, then acknowledged */
+    uint64_t ack_frames_sent;
+    uint64_t ack_frames_received;
+    uint64_t send_limit_time[picoquic_nb_send_limits];
+    uint64_t send_limit_start;
+    picoquic_send_limit_enum send_limit;
+    uint32_t rtt_histogram[PICOQUIC_RTT_HISTOGRAM_SIZE];
+} picoquic_path_counters_t;
+
+/*
+ * Part of the packet header that only changes with the CIDs and the version: the flags, the version and the
+ * CIDs with their lengths. The token, the payload length and the packet number follow it, and the spin and
+ * key phase bits are set on the copy. See picoquic_create_packet_header().
+ */
+#define PICOQUIC_HEADER_TEMPLATE_MAX (1 + 4 + 2 * (1 + PICOQUIC_CONNECTION_ID_MAX_SIZE))
+
+typedef struct st_picoquic_header_template_t {
+    uint8_t bytes[PICOQUIC_HEADER_TEMPLATE_MAX];
+    uint8_t length; /* 0 until built, and after a CID or version change */
+} picoquic_header_template_t;
+
 /*
 * Per path context
+*
+* The fields are ordered by use: those read or written for every packet sent or acknowledged come
+* first, so that they share a few cache lines, then the packet contexts, and last the addresses, the
+* challenge and the statistics. See cnx_layout_test() for the fields expected in the leading lines.
 */
 typedef struct st_picoquic_path_t {
-    /* Peer address. To do: allow for multiple addresses */
-    struct sockaddr_storage peer_addr;
-    int peer_addr_len;
-    struct sockaddr_storage local_addr;
-    int local_addr_len;
-    unsigned long if_index_local;
+    /* Congestion control state */
+    uint64_t cwin;
+    uint64_t bytes_in_transit;
+    void* congestion_alg_state;
+
+    /* MTU, searched as in RFC 8899 between the base of the address family and the smallest size that failed */
+    uint32_t send_mtu;
+    uint32_t send_mtu_max_tried; /* 0 if no size failed */
 
-#define PICOQUIC_CHALLENGE_LENGTH 8
-    /* Challenge used for this path */
-    uint64_t challenge;
-    uint64_t challenge_time;
-    uint8_t challenge_response[PICOQUIC_CHALLENGE_LENGTH];
-    uint8_t challenge_repeat_count;
-#define PICOQUIC_CHALLENGE_REPEAT_MAX 4
     /* flags */
     unsigned int mtu_probe_sent : 1;
     unsigned int challenge_verified : 1;
@@ -463,15 +815,8 @@ typedef struct st_picoquic_path_t {
     uint64_t max_spurious_rtt;
     uint64_t max_reorder_delay;
     uint64_t max_reorder_gap;
-
-    /* MTU */
-    uint32_t send_mtu;
-    uint32_t send_mtu_max_tried;
-
-    /* Congestion control state */
-    uint64_t cwin;
-    uint64_t bytes_in_transit;
-    void* congestion_alg_state;
+    /* Reordering window in 1/8 of RTT above the 1/8 of RFC 9002, grown when a loss was spurious */
+    uint64_t reorder_window_mult;
 
     /*
      * Pacing uses a set of per path variables:
@@ -479,16 +824,26 @@ typedef struct st_picoquic_path_t {
      * - pacing_bucket_nanosec: number of nanoseconds of transmission time that are allowed.
      * - pacing_bucket_max: maximum value (capacity) of the leaky bucket.
      * - pacing_packet_time_nanosec: number of nanoseconds required to send a full size packet.
-     * - pacing_packet_time_microsec: max of (packet_time_nano_sec/1024, 1) microsec.
+     * - pacing_packet_time_microsec: packet_time_nano_sec rounded up to the microsecond.
+     * - pacing_burst: packets sent per pacing decision, copied from the QUIC context, 0 or 1 for one.
+     * - pacing_train_start, pacing_train_remaining: time of the last decision, and packets of its
+     *   train that can still be sent at that time.
+     * When the pacing is offloaded to the kernel, each packet gets a departure time instead:
+     * - pacing_offload_horizon: copied from the QUIC context, 0 if the bucket is used.
+     * - pacing_departure_nanosec: earliest departure time of the next packet.
+     * - pacing_last_departure_time: departure time of the last packet sent on the path, in microseconds.
      */
     uint64_t pacing_evaluation_time;
     uint64_t pacing_bucket_nanosec;
     uint64_t pacing_bucket_max;
     uint64_t pacing_packet_time_nanosec;
     uint64_t pacing_packet_time_microsec;
-
-    /* Statistics */
-    uint64_t nb_pkt_sent;
+    uint64_t pacing_offload_horizon;
+    uint64_t pacing_burst;
+    uint64_t pacing_train_start;
+    uint64_t pacing_train_remaining;
+    uint64_t pacing_departure_nanosec;
+    uint64_t pacing_last_departure_time;
 
     /* Bandwidth measurement */
     uint64_t delivered; /* The total amount of data delivered so far on the path */
@@ -498,33 +853,74 @@ typedef struct st_picoquic_path_t {
     uint64_t delivered_limited_index;
     uint64_t delivered_last_packet;
     uint64_t bandwidth_estimate; /* In bytes per second */
-
-    uint64_t received; /* Total amount of bytes received from the path */
-    uint64_t receive_rate_epoch; /* Time of last receive rate measurement */
-    uint64_t received_prior; /* Total amount received at start of epoch */
-    uint64_t receive_rate_estimate; /* In bytes per second */
-    uint64_t receive_rate_max; /* In bytes per second */
+    /* Packets acknowledged by the ACK frame being processed, given to the congestion control once per frame */
+    uint64_t ack_batch_bytes;
+    uint64_t ack_batch_packets;
+    uint64_t nb_pkt_sent;
 
     /* QDC: Moved from the ctx */
     /* Connection IDs */
     picoquic_connection_id_t local_cnxid;
     picoquic_connection_id_t remote_cnxid;
-    uint8_t reset_secret[PICOQUIC_RESET_SECRET_SIZE];
+    /* By epoch, see picoquic_reset_header_templates() */
+    picoquic_header_template_t header_templates[PICOQUIC_NUMBER_OF_EPOCHS];
     /* Sequence and retransmission state */
     picoquic_packet_context_t pkt_ctx[picoquic_nb_packet_context];
 
-    plugin_struct_metadata_t *metadata;
+    plugin_metadata_t metadata;
+
+    /* Peer address. To do: allow for multiple addresses */
+    struct sockaddr_storage peer_addr;
+    int peer_addr_len;
+    struct sockaddr_storage local_addr;
+    int local_addr_len;
+    unsigned long if_index_local;
+    /* Local socket on which the packets of the path arrive, to send them on the same one, see picoquic_get_path_socket() */
+    SOCKET_TYPE rcv_socket;
+
+    picoquic_rate_sample_t rate_sample; /* The last one */
+    /* Packets that the peer reported received with an ECN mark, and those of them marked CE */
+    uint64_t ecn_ect_acked;
+    uint64_t ecn_ce_acked;
+    picoquic_ecn_state_enum ecn_state;
+
+    uint32_t mtu_probe_losses; /* Lost probes of the next size */
+    uint32_t mtu_black_hole_losses; /* Full size packets lost since one was acknowledged */
+    uint64_t mtu_raise_time; /* When the search starts again once done, 0 while it goes on */
+
+#define PICOQUIC_CHALLENGE_LENGTH 8
+    /* Challenge used for this path */
+    uint64_t challenge;
+    uint64_t challenge_time;
+    uint8_t challenge_response[PICOQUIC_CHALLENGE_LENGTH];
+    uint8_t challenge_repeat_count;
+#define PICOQUIC_CHALLENGE_REPEAT_MAX 4
+    uint8_t reset_secret[PICOQUIC_RESET_SECRET_SIZE];
+
+    uint64_t received; /* Total amount of bytes received from the path */
+    uint64_t receive_rate_epoch; /* Time of last receive rate measurement */
+    uint64_t received_prior; /* Total amount received at start of epoch */
+    uint64_t receive_rate_estimate; /* In bytes per second */
+    uint64_t receive_rate_max; /* In bytes per second */
+    /* Stream reassembly, charged to the path that received the bytes */
+    uint64_t ooo_bytes_received; /* Stream bytes received beyond the next expected offset */
+    uint64_t hol_blocking_bytes; /* Buffered stream bytes that were waiting for bytes received on this path */
+
+    /* Statistics */
+    picoquic_path_counters_t counters;
 } picoquic_path_t;
 
 /* Typedef for plugins */
 
 typedef char* plugin_id_t;
 
-#define PLUGIN_MEMORY (16 * 1024 * 1024) /* In bytes, at least needed by tests */
+#define PLUGIN_MEMORY (16 * 1024 * 1024) /* Default size in bytes, at least needed by tests */
+#define PLUGIN_SCRATCH_SIZE (64 * 1024) /* Top of the plugin memory kept for my_scratch_alloc(), at most an eighth of it */
 
 typedef enum {
     plugin_memory_manager_fixed_blocks,
     plugin_memory_manager_dynamic,
+    plugin_memory_manager_slab,
 } plugin_memory_manager_type_t;
 
 typedef struct plugin_memory_manager {
@@ -544,6 +940,54 @@ typedef struct memory_pool {
     uint8_t *next;
 } memory_pool_t;
 
+/* Size classes of the slab memory manager, from 16 to 4096 bytes (header included) */
+#define SLAB_MIN_CLASS_SHIFT 4
+#define SLAB_NB_CLASSES 9
+#define SLAB_LARGE_CLASS SLAB_NB_CLASSES /* Index of the statistics of the objects above the largest class */
+
+typedef struct slab_class_stats {
+    uint64_t in_use;   /* Number of objects currently allocated */
+    uint64_t free;     /* Number of released objects ready to be reused */
+    uint64_t peak;     /* Maximum value reached by in_use */
+    uint64_t bytes;    /* Bytes taken from the plugin memory by this class */
+} slab_class_stats_t;
+
+typedef struct slab_free_node {
+    struct slab_free_node *next;
+} slab_free_node_t;
+
+typedef struct slab_memory_pool {
+    uint8_t *mem_start;
+    uint8_t *mem_end;
+    uint8_t *brk;   /* Start of the memory not yet given to a class */
+    slab_free_node_t *free_lists[SLAB_NB_CLASSES];
+    uint8_t *carve[SLAB_NB_CLASSES];     /* Next never used object of the current chunk of each class */
+    uint8_t *carve_end[SLAB_NB_CLASSES];
+    slab_free_node_t *large_free_list; /* Released large objects, reused on a first fit basis */
+    slab_class_stats_t stats[SLAB_NB_CLASSES + 1];
+} slab_memory_pool_t;
+
+/* Active lists of the deficit round robin of the plugin reservations, see picoquic_frame_fair_reserve() */
+typedef enum {
+    picoquic_drr_cc = 0, /* Congestion controlled reservations, held to the share left by the core rate */
+    picoquic_drr_cc_unlimited, /* Congestion controlled reservations of the rate unlimited plugins */
+    picoquic_drr_non_cc,
+    picoquic_nb_drr_lists
+} picoquic_drr_list_enum;
+
+typedef struct st_picoquic_drr_entry_t {
+    struct protoop_plugin* next; /* In the active list */
+    uint64_t deficit;
+    uint8_t is_active : 1;
+    uint8_t has_quantum : 1; /* The quantum of the current turn was granted */
+} picoquic_drr_entry_t;
+
+typedef struct st_picoquic_drr_list_t {
+    struct protoop_plugin* first;
+    struct protoop_plugin* last;
+    uint32_t nb_active;
+} picoquic_drr_list_t;
+
 typedef struct plugin_parameters {
     // set to true when the frames generated by the plugin should be considered as "rate-unlimited"
     // the frames will be sent regardless of the fact that STREAM frames must be sent
@@ -551,6 +995,8 @@ typedef struct plugin_parameters {
 
     // determines the memory manager used for this plugin
     plugin_memory_manager_type_t plugin_memory_manager_type;
+    // size of the plugin memory, in bytes; if 0, PLUGIN_MEMORY is used
+    uint32_t memory_size;
     // indicates if the injection of the plugin is negotiated with TPs
     bool require_negotiation;
     // set during the processing of the transport parameter to indicate if the plugin was successfully negotiated or not
@@ -563,9 +1009,12 @@ typedef struct protoop_plugin {
     char* path; /* Path of the plugin manifest */
     queue_t *block_queue_cc; /* Send reservation queue for congestion controlled frames */
     queue_t *block_queue_non_cc; /* Send reservation queue for non-congestion controlled frames */
+    /* Places of the two reservation queues in the active lists, indexed by is_congestion_controlled */
+    picoquic_drr_entry_t drr[2];
     uint64_t bytes_in_flight; /* Number of bytes in flight due to generated frames */
     uint64_t bytes_total; /* Number of total bytes by generated frames, for monitoring */
     uint64_t frames_total; /* Number of total generated frames, for monitoring */
+    uint64_t frames_expired; /* Number of reserved frames dropped past their expire time, for monitoring */
     uint64_t hash;         /* Hash of the plugin name */
     plugin_parameters_t params;
     /* With uBPF, we don't want the VM it corrupts the memory of another context.
@@ -573,11 +1022,19 @@ typedef struct protoop_plugin {
      * needed for the given connection.
      */
     plugin_memory_manager_t memory_manager;
-    char memory[PLUGIN_MEMORY]; /* Memory that can be used for malloc, free,... */
+    pid_node_t *post_pluglets; /* Pluglets inserted after negotiation, most recent first */
+    char *memory; /* Memory that can be used for malloc, free,..., only committed when touched */
+    uint32_t memory_size; /* Usable size of memory, in bytes */
+    /* The last scratch_size bytes of memory are not managed by the memory manager, but given by my_scratch_alloc()
+     * to the running pluglet, and taken back when it returns */
+    uint32_t scratch_size;
+    uint32_t scratch_used;
+    uint8_t metadata_slot; /* Index of its metadata in the plugin_metadata_t of the connection structures */
+    bool from_template; /* Its memory maps the template of the plugin, see plugin_template_apply() */
+    plugin_record_ring_t *record_ring; /* Events of its record anchors, allocated on the first one */
 } protoop_plugin_t;
 
 #define PROTOOPNAME_MAX 100
-#define STRUCT_METADATA_MAX 10
 
 typedef protoop_arg_t (*protocol_operation)(picoquic_cnx_t *);
 
@@ -586,6 +1043,11 @@ typedef struct observer_node {
     struct observer_node *next;
 } observer_node_t;
 
+typedef struct recorder_node {
+    protoop_plugin_t *p; /* A plugin recording the calls in its ring */
+    struct recorder_node *next;
+} recorder_node_t;
+
 typedef struct {
     param_id_t param; /* Key of the parameter. If its value is -1, it has no parameter */
     protocol_operation core; /* The default operation, kept for unplugging feature */
@@ -596,9 +1058,22 @@ typedef struct {
                    * Efficient way to figure out if there are loops in protocol operation calls */
     observer_node_t *pre; /* List of observers, probing just before function invocation */
     observer_node_t *post; /* List of observers, probing just after function returns */
+    recorder_node_t *record; /* List of plugins recording the calls, after the post observers ran */
+    struct st_plugin_async_observer_t *async; /* List of observers run outside of the packet path */
+    bool plain_core; /* Only the core operation is attached, so callers can directly invoke it */
+    bool is_private; /* The replace pluglet was inserted as private, no other pluglet can be attached */
+    bool plain_private; /* Only a private pluglet is attached, so pluglets can directly run it */
     UT_hash_handle hh; /* Make the structure hashable */
 } protocol_operation_param_struct_t;
 
+/* Must be called each time a pluglet is plugged or unplugged from popst */
+static inline void picoquic_update_plain_core(protocol_operation_param_struct_t *popst)
+{
+    bool no_observer = !popst->pre && !popst->post && !popst->record && !popst->async;
+    popst->plain_core = popst->core && !popst->replace && no_observer;
+    popst->plain_private = popst->is_private && popst->replace && popst->intern && no_observer;
+}
+
 protocol_operation_param_struct_t *create_protocol_operation_param(param_id_t param, protocol_operation op);
 
 typedef struct st_protocol_operation_struct_t {
@@ -610,9 +1085,38 @@ typedef struct st_protocol_operation_struct_t {
      * such elements
      */
     protocol_operation_param_struct_t *params; /* This is a hash map */
+    /* For parametrable operations only, direct access to the params lower than
+     * PROTOOP_PARAM_TABLE_SIZE, kept in sync with the params hash map
+     */
+    protocol_operation_param_struct_t **param_table;
     UT_hash_handle hh; /* Make the structure hashable */
 } protocol_operation_struct_t;
 
+#define PROTOOP_PARAM_TABLE_SIZE 256
+
+/* Maximum number of private operations of a connection that the pluglets call without lookup */
+#define PROTOOP_PRIVATE_INDEX_MAX 32
+
+/* A private operation, the protoop_id_t of the pluglets calling it gets PROTOOP_BUILTIN_INDEX_MAX plus its index */
+typedef struct st_picoquic_private_op_t {
+    uint64_t hash;
+    param_id_t param;
+    protocol_operation_struct_t *post;
+    protocol_operation_param_struct_t *popst;
+} picoquic_private_op_t;
+
+/* Frame types whose operations are resolved in the dispatch table of the connection. The other
+ * ones, such as the extension frames, are found through the param table or hash of the operation.
+ */
+#define PICOQUIC_FRAME_DISPATCH_SIZE 64
+
+typedef enum {
+    picoquic_frame_op_parse = 0,
+    picoquic_frame_op_process,
+    picoquic_frame_op_notify,
+    picoquic_frame_op_max
+} picoquic_frame_op_enum;
+
 typedef struct st_plugin_struct_metadata {
     uint64_t plugin_hash;   /* primary key (we will store the plugin hash inside, so we assume it won't collide) */
     uint64_t metadata[STRUCT_METADATA_MAX];
@@ -638,18 +1142,18 @@ void quicctx_register_noparam_protoops(picoquic_cnx_t *cnx);
 /*
  * Per connection context.
  * This is the structure that will be passed to pluglets.
+ *
+ * The fields are ordered by use: the state, the paths, the protocol operation being run, the wake time
+ * and the flow control, read or written for every packet, come first so that they share a few cache
+ * lines. The per epoch keys, streams and frame queues follow, then the operation tables, and last the
+ * state only used during the handshake, the close or by the API. See cnx_layout_test().
  */
 typedef struct st_picoquic_cnx_t {
     picoquic_quic_t* quic;
 
-    /* Management of context retrieval tables */
-    struct st_picoquic_cnx_t* next_in_table;
-    struct st_picoquic_cnx_t* previous_in_table;
-    struct st_picoquic_cnx_id_t* first_cnx_id;
-    struct st_picoquic_net_id_t* first_net_id;
-
-    /* Proposed and negotiated version. Feature flags denote version dependent features */
-    uint32_t proposed_version;
+    /* connection state, ID, etc. Todo: allow for multiple cnxid */
+    picoquic_state_enum cnx_state;
+    /* Negotiated version. Feature flags denote version dependent features */
     int version_index;
 
     /* Series of flags showing the state or choices of the connection */
@@ -660,67 +1164,73 @@ typedef struct st_picoquic_cnx_t {
     unsigned int prev_spin : 1;  /* previous Spin bit */
     unsigned int spin_vec : 2;   /* Valid Edge Counter, makes spin bit RTT measurements more reliable */
     unsigned int spin_edge : 1;  /* internal signalling from incoming to outgoing: we just spinned it */
-    uint64_t spin_last_trigger;  /* timestamp of the incoming packet that triggered the spinning */
     unsigned int key_phase_enc : 1; /* Key phase used in outgoing packets */
     unsigned int key_phase_dec : 1; /* Key phase expected in incoming packets */
     unsigned int zero_rtt_data_accepted : 1; /* Peer confirmed acceptance of zero rtt data */
     unsigned int one_rtt_data_acknowledged : 1; /* 1RTT data acknowledged by peer */
     unsigned int processed_transport_parameter: 1; /* Indicate if transport parameters are processed or not */
-
-
-    /* Local and remote parameters */
-    picoquic_tp_t local_parameters;
-    picoquic_tp_t remote_parameters;
-    /* On clients, document the SNI and ALPN expected from the server */
-    /* TODO: there may be a need to propose multiple ALPN */
-    char const* sni;
-    char const* alpn;
-    /* On clients, receives the maximum 0RTT size accepted by server */
-    size_t max_early_data_size;
-    /* Call back function and context */
-    picoquic_stream_data_cb_fn callback_fn;
-    void* callback_ctx;
-
-    /* connection state, ID, etc. Todo: allow for multiple cnxid */
-    picoquic_state_enum cnx_state;
-    picoquic_connection_id_t initial_cnxid;  // What's that ?
-    uint64_t start_time;
-    uint64_t application_error;
-    uint64_t local_error;
-    uint64_t remote_application_error;
-    uint64_t remote_error;
-    uint64_t offending_frame_type;
-    uint32_t retry_token_length;
-    uint8_t * retry_token;
     unsigned int handshake_done : 1;
     unsigned int handshake_done_sent : 1;
     unsigned int handshake_done_acked : 1;
+    unsigned int immediate_ack_requested : 1; /* An IMMEDIATE_ACK frame has to be sent */
+    unsigned int is_coalescing : 1; /* A handshake datagram is being filled, its wake time is computed once done */
+    unsigned int wake_time_pending : 1; /* A segment of the datagram left the wake time to compute */
+    unsigned int is_hystart_pp_enabled : 1; /* See picoquic_set_hystart_pp() */
+    unsigned int ack_ignore_order_remote : 1;
+    unsigned int registering_builtin_ops : 1; /* Set while register_protocol_operations runs */
+    unsigned int logging_active : 1; /* A pluglet observes the logging operations, see picoquic_update_logging_active() */
+    /* No pluglet on the header operations, which are then run directly, see picoquic_update_frame_dispatch() */
+    unsigned int plain_header_ops : 1;
+    unsigned int plain_checksum_op : 1;
+    /* Set while the idle connection holds the least memory, see picoquic_hibernate_cnx() */
+    unsigned int is_hibernating : 1;
+    /* Set when the close datagram is prepared, which leaves a tombstone once protected, see picoquic_bury_cnx() */
+    unsigned int tombstone_pending : 1;
+    /* The client moved to the preferred address of the server, see picoquic_migrate_to_preferred_address() */
+    unsigned int preferred_address_used : 1;
+    uint8_t plugin_requested:1;
+    uint8_t log_policy_state; /* picoquic_log_policy_state_enum */
+    uint32_t log_ctx_skipped; /* Depth of the log contexts pushed while logging was not active */
+
+    /* Management of paths */
+    picoquic_path_t ** path;
+    int nb_paths;
+    int nb_path_alloc;
 
+    /* Due to uBPF constraints, all needed info must be contained in the context.
+     * Furthermore, the arguments might have different types...
+     * Fortunately, if arguments are either integers or pointers, this is simple.
+     */
+    int protoop_inputc;
+    protoop_arg_t *protoop_inputv;  /*An array that cannot exceed PROTOOPARGS_MAX elements*/
+    protoop_arg_t *protoop_outputv;  /*An array that cannot exceed PROTOOPARGS_MAX elements*/
 
-    /* Next time sending data is expected */
-    uint64_t next_wake_time;
-    struct st_picoquic_cnx_t* next_by_wake_time;
-    struct st_picoquic_cnx_t* previous_by_wake_time;
+    int protoop_outputc_callee; /* Modified by the callee */
+    protoop_arg_t protoop_output; /* Only available for post calls */
 
-    /* TLS context, TLS Send Buffer, streams, epochs */
-    void* tls_ctx;
-    struct st_ptls_buffer_t* tls_sendbuf;
-    uint16_t psk_cipher_suite_id;
+    protocol_operation_struct_t *current_protoop; /* This should not be modified by the plugins... */
+    pluglet_type_enum current_anchor;
+    protoop_plugin_t *current_plugin; /* This should not be modified by the plugins... */
+    protoop_plugin_t *previous_plugin_in_replace; /* To free memory, we might be interested to know if it is in plugin or core memory */;
 
-    picoquic_stream_head tls_stream[PICOQUIC_NUMBER_OF_EPOCHS]; /* Separate input/output from each epoch */
-    picoquic_crypto_context_t crypto_context[PICOQUIC_NUMBER_OF_EPOCHS]; /* Encryption and decryption objects */
+    /* Next time sending data is expected */
+    uint64_t next_wake_time;
+    uint64_t wake_sequence;
+    size_t wake_heap_index; /* Position in the wake heap of the QUIC context */
+    /* Set by picoquic_prepare_packets() while it prepares a burst, see picoquic_hp_batch_flush() */
+    picoquic_hp_batch_t* hp_batch;
 
     /* Liveness detection */
     uint64_t latest_progress_time; /* last local time at which the connection progressed */
-
-    /* Statistics */
-    uint64_t nb_bytes_queued;
-    uint32_t nb_path_challenge_sent;
-    uint32_t nb_path_response_received;
-    uint32_t nb_zero_rtt_sent;
-    uint32_t nb_zero_rtt_acked;
-    uint64_t nb_retransmission_total;
-    uint64_t nb_spurious;
+    /* If not `0`, the connection will send keep alive messages in the given interval. */
+    uint64_t keep_alive_interval;
+    /* Adaptive keep alive, see picoquic_enable_adaptive_keep_alive() */
+    uint64_t keep_alive_min;
+    uint64_t keep_alive_max; /* Lowered to the longest interval that held once a NAT rebinding is seen */
+    uint64_t keep_alive_safe; /* Longest interval after which no rebinding was seen */
+    uint64_t keep_alive_probe; /* Interval before the last keep alive, held if no rebinding follows it */
+    unsigned int keep_alive_adaptive : 1;
+    uint64_t spin_last_trigger;  /* timestamp of the incoming packet that triggered the spinning */
 
     /* Congestion algorithm */
     picoquic_congestion_algorithm_t const* congestion_alg;
@@ -730,6 +1240,10 @@ typedef struct st_picoquic_cnx_t {
     uint64_t data_received;
     uint64_t maxdata_local;
     uint64_t maxdata_remote;
+    /* Credit granted past the received data, see picoquic_autotune_window() */
+    uint64_t max_data_window;
+    uint64_t max_data_update_time;
+    uint64_t max_data_growth; /* Growth of the window, counted in the flow control budget of the context */
     uint64_t max_stream_id_bidir_local;
     uint64_t max_stream_id_bidir_local_computed;
     uint64_t max_stream_id_unidir_local;
@@ -737,18 +1251,45 @@ typedef struct st_picoquic_cnx_t {
     uint64_t max_stream_id_bidir_remote;
     uint64_t max_stream_id_unidir_remote;
 
+    /* ACK frequency negotiation, the remote values are those requested by the peer, 0 when not set */
+    uint64_t ack_frequency_sequence_local; /* Sequence number of the next ACK_FREQUENCY frame sent */
+    uint64_t ack_frequency_sequence_remote; /* Next sequence number accepted from the peer */
+    uint64_t ack_gap_requested; /* Set by picoquic_set_ack_frequency, 0 to follow the congestion window */
+    uint64_t ack_delay_requested;
+    uint64_t ack_gap_sent;
+    uint64_t ack_delay_sent;
+    uint64_t ack_gap_remote;
+    uint64_t ack_delay_remote;
+
+    /* Call back function and context */
+    picoquic_stream_data_cb_fn callback_fn;
+    void* callback_ctx;
+
+    picoquic_crypto_context_t crypto_context[PICOQUIC_NUMBER_OF_EPOCHS]; /* Encryption and decryption objects */
+
     /* Management of streams */
     picoquic_stream_head * first_stream;
+    /* Hash map of the same streams, by stream ID */
+    picoquic_stream_head * streams_by_id;
+    /* Streams that may have something to send, sorted by priority then stream ID, see picoquic_mark_stream_ready() */
+    picosplay_tree_t ready_stream_tree;
+    /* Streams whose consumed offset crossed the MAX_STREAM_DATA threshold, in the order they did */
+    picoquic_stream_head * first_max_data_stream;
+    picoquic_stream_head * last_max_data_stream;
+    /* Streams that received data or their fin since the last batch callback, see picoquic_notify_stream_batches() */
+    picoquic_stream_head * first_readable_stream;
+    picoquic_stream_head * last_readable_stream;
+    size_t nb_readable_streams;
+    struct st_picoquic_cnx_t* next_readable_cnx;
+    struct st_picoquic_cnx_t* previous_readable_cnx;
     uint64_t last_visited_stream_id;
     uint64_t last_visited_plugin_stream_id;
+    uint64_t wfq_virtual_time; /* Tag of the last stream served by the weighted scheduler */
+    picoquic_stream_scheduler_enum stream_scheduler;
 
-    /* If not `0`, the connection will send keep alive messages in the given interval. */
-    uint64_t keep_alive_interval;
-
-    /* Management of paths */
-    picoquic_path_t ** path;
-    int nb_paths;
-    int nb_path_alloc;
+    /* Management of plugin streams */
+    picoquic_stream_head * first_plugin_stream;
+    picosplay_tree_t ready_plugin_stream_tree;
 
     /* Management of pending frames to be sent due to reservations */
     queue_t *reserved_frames;
@@ -756,41 +1297,95 @@ typedef struct st_picoquic_cnx_t {
     queue_t *retry_frames;
     /* Queues of frames to be retransmitted */
     queue_t *rtx_frames[picoquic_nb_packet_context];
-    /* Keep a pointer to the next plugin to look at first */
-    protoop_plugin_t *first_drr;
+    /* Plugins with reservations queued, served in deficit round robin */
+    picoquic_drr_list_t drr[picoquic_nb_drr_lists];
+    uint64_t nb_reserved_cc_blocks;
+    uint64_t plugin_bytes_in_flight; /* Sum of the bytes in flight of the plugins */
     /* Core guaranteed rate (fraction over 1000) */
     uint16_t core_rate;
 
-    uint8_t plugin_requested:1;
+    /* Memory held by the connection, charged by picoquic_memory_charge() where it is allocated */
+    uint64_t memory_used[picoquic_nb_memory_categories];
+    uint64_t memory_total;
+    uint64_t memory_peak;
+    uint64_t nb_memory_charges;
+    /* Past it, no flow control credit is granted, see picoquic_is_memory_capped(). 0 if there is no cap */
+    uint64_t memory_cap;
+    uint64_t nb_memory_capped;
 
-    /* List of plugins that should be requested on this connection */
-    plugin_request_t pids_to_request;
+    /* Bytes queued on the streams and not sent yet, bounded by the watermarks */
+    uint64_t send_buffered;
+    picoquic_send_watermarks_t send_watermarks;
+    uint32_t nb_send_blocked; /* Streams with send_blocked set */
 
-    /* Management of plugin streams */
-    picoquic_stream_head * first_plugin_stream;
+    protoop_plugin_t *plugins;
+
+    plugin_metadata_t metadata;
 
     /* Management of default protocol operations and plugins */
     protocol_operation_struct_t *ops;
+    /* Direct access to the built-in protocol operations, indexed by protoop_id_t.index */
+    protocol_operation_struct_t *builtin_ops[PROTOOP_BUILTIN_INDEX_MAX];
+    uint16_t nb_builtin_ops;
+    /* Param structs of the frame operations, NO_PARAM one included, see picoquic_update_frame_dispatch() */
+    protocol_operation_param_struct_t *frame_dispatch[picoquic_frame_op_max][PICOQUIC_FRAME_DISPATCH_SIZE];
+    /* Param structs of the private operations, see picoquic_update_frame_dispatch() */
+    picoquic_private_op_t private_ops[PROTOOP_PRIVATE_INDEX_MAX];
+    uint8_t nb_private_ops;
 
-    protoop_plugin_t *plugins;
+    /* Management of context retrieval tables */
+    struct st_picoquic_cnx_t* next_in_table;
+    struct st_picoquic_cnx_t* previous_in_table;
+    struct st_picoquic_cnx_id_t* first_cnx_id;
+    struct st_picoquic_net_id_t* first_net_id;
 
-    plugin_struct_metadata_t *metadata;
+    /* Proposed version */
+    uint32_t proposed_version;
 
-    /* Due to uBPF constraints, all needed info must be contained in the context.
-     * Furthermore, the arguments might have different types...
-     * Fortunately, if arguments are either integers or pointers, this is simple.
-     */
-    int protoop_inputc;
-    protoop_arg_t *protoop_inputv;  /*An array that cannot exceed PROTOOPARGS_MAX elements*/
-    protoop_arg_t *protoop_outputv;  /*An array that cannot exceed PROTOOPARGS_MAX elements*/
+    /* Local and remote parameters */
+    picoquic_tp_t local_parameters;
+    picoquic_tp_t remote_parameters;
+    /* On clients, document the SNI and ALPN expected from the server */
+    /* TODO: there may be a need to propose multiple ALPN */
+    char const* sni;
+    char const* alpn;
+    /* On clients, receives the maximum 0RTT size accepted by server */
+    size_t max_early_data_size;
 
-    int protoop_outputc_callee; /* Modified by the callee */
-    protoop_arg_t protoop_output; /* Only available for post calls */
+    picoquic_connection_id_t initial_cnxid;  // What's that ?
+    /* Server CID of the preferred address, of sequence 1, which stands for path 0. Empty if none is advertised */
+    picoquic_connection_id_t preferred_cnxid;
+    uint64_t start_time;
+    uint64_t application_error;
+    uint64_t local_error;
+    uint64_t remote_application_error;
+    uint64_t remote_error;
+    uint64_t offending_frame_type;
+    uint32_t retry_token_length;
+    uint8_t * retry_token;
 
-    protocol_operation_struct_t *current_protoop; /* This should not be modified by the plugins... */
-    pluglet_type_enum current_anchor;
-    protoop_plugin_t *current_plugin; /* This should not be modified by the plugins... */
-    protoop_plugin_t *previous_plugin_in_replace; /* To free memory, we might be interested to know if it is in plugin or core memory */;
+    /* TLS context, TLS Send Buffer, streams, epochs */
+    void* tls_ctx;
+    struct st_ptls_buffer_t* tls_sendbuf;
+    uint16_t psk_cipher_suite_id;
+
+    picoquic_stream_head tls_stream[PICOQUIC_NUMBER_OF_EPOCHS]; /* Separate input/output from each epoch */
+
+    /* Statistics */
+    uint64_t nb_bytes_queued;
+    uint32_t nb_path_challenge_sent;
+    uint32_t nb_path_response_received;
+    uint32_t nb_zero_rtt_sent;
+    uint32_t nb_zero_rtt_acked;
+    uint64_t nb_retransmission_total;
+    uint64_t nb_spurious;
+    uint64_t nb_hibernations;
+
+    uint64_t tombstone_expiry;
+    uint64_t tombstone_interval; /* 0 when draining, nothing is sent */
+
+    /* List of plugins that should be requested on this connection */
+    plugin_request_t pids_to_request;
 } picoquic_cnx_t;
 
 /* Init of transport parameters */
@@ -806,27 +1401,62 @@ void picoquic_init_transport_parameters(picoquic_tp_t* tp, int client_mode);
 # define N_ARGS_HELPER1(...) N_ARGS_HELPER2(__VA_ARGS__)
 # define N_ARGS_HELPER2(x1, x2, x3, x4, x5, x6, x7, x8, x9, n, ...) n
 
-# define protoop_prepare_and_run_noparam(cnx, pid, outputv, ...) protoop_prepare_and_run_helper(cnx, pid, NO_PARAM, true, outputv, N_ARGS(__VA_ARGS__), __VA_ARGS__)
-# define protoop_prepare_and_run_param(cnx, pid, param, outputv, ...) protoop_prepare_and_run_helper(cnx, pid, param, true, outputv, N_ARGS(__VA_ARGS__), __VA_ARGS__)
-# define protoop_prepare_and_run_extern_noparam(cnx, pid, outputv, ...) protoop_prepare_and_run_helper(cnx, pid, NO_PARAM, false, outputv, N_ARGS(__VA_ARGS__), __VA_ARGS__)
-# define protoop_prepare_and_run_extern_param(cnx, pid, param, outputv, ...) protoop_prepare_and_run_helper(cnx, pid, param, false, outputv, N_ARGS(__VA_ARGS__), __VA_ARGS__)
+/* The arguments are put in a fixed size array on the caller stack, with one variant per arity */
+# define PROTOOP_CONCAT(a, b) PROTOOP_CONCAT_HELPER(a, b)
+# define PROTOOP_CONCAT_HELPER(a, b) a##b
+# define PROTOOP_ARG(a) ((protoop_arg_t) (a))
+# define protoop_prepare_and_run_n(cnx, pid, param, caller, outputv, ...) PROTOOP_CONCAT(protoop_prepare_and_run_, N_ARGS(__VA_ARGS__))(cnx, pid, param, caller, outputv, __VA_ARGS__)
+# define protoop_prepare_and_run_1(cnx, pid, param, caller, outputv, a1) \
+    protoop_prepare_and_run_args(cnx, pid, param, caller, outputv, 1, (protoop_arg_t[1]) {PROTOOP_ARG(a1)})
+# define protoop_prepare_and_run_2(cnx, pid, param, caller, outputv, a1, a2) \
+    protoop_prepare_and_run_args(cnx, pid, param, caller, outputv, 2, (protoop_arg_t[2]) {PROTOOP_ARG(a1), PROTOOP_ARG(a2)})
+# define protoop_prepare_and_run_3(cnx, pid, param, caller, outputv, a1, a2, a3) \
+    protoop_prepare_and_run_args(cnx, pid, param, caller, outputv, 3, (protoop_arg_t[3]) {PROTOOP_ARG(a1), PROTOOP_ARG(a2), PROTOOP_ARG(a3)})
+# define protoop_prepare_and_run_4(cnx, pid, param, caller, outputv, a1, a2, a3, a4) \
+    protoop_prepare_and_run_args(cnx, pid, param, caller, outputv, 4, (protoop_arg_t[4]) {PROTOOP_ARG(a1), PROTOOP_ARG(a2), PROTOOP_ARG(a3), PROTOOP_ARG(a4)})
+# define protoop_prepare_and_run_5(cnx, pid, param, caller, outputv, a1, a2, a3, a4, a5) \
+    protoop_prepare_and_run_args(cnx, pid, param, caller, outputv, 5, (protoop_arg_t[5]) {PROTOOP_ARG(a1), PROTOOP_ARG(a2), PROTOOP_ARG(a3), PROTOOP_ARG(a4), \
+        PROTOOP_ARG(a5)})
+# define protoop_prepare_and_run_6(cnx, pid, param, caller, outputv, a1, a2, a3, a4, a5, a6) \
+    protoop_prepare_and_run_args(cnx, pid, param, caller, outputv, 6, (protoop_arg_t[6]) {PROTOOP_ARG(a1), PROTOOP_ARG(a2), PROTOOP_ARG(a3), PROTOOP_ARG(a4), \
+        PROTOOP_ARG(a5), PROTOOP_ARG(a6)})
+# define protoop_prepare_and_run_7(cnx, pid, param, caller, outputv, a1, a2, a3, a4, a5, a6, a7) \
+    protoop_prepare_and_run_args(cnx, pid, param, caller, outputv, 7, (protoop_arg_t[7]) {PROTOOP_ARG(a1), PROTOOP_ARG(a2), PROTOOP_ARG(a3), PROTOOP_ARG(a4), \
+        PROTOOP_ARG(a5), PROTOOP_ARG(a6), PROTOOP_ARG(a7)})
+# define protoop_prepare_and_run_8(cnx, pid, param, caller, outputv, a1, a2, a3, a4, a5, a6, a7, a8) \
+    protoop_prepare_and_run_args(cnx, pid, param, caller, outputv, 8, (protoop_arg_t[8]) {PROTOOP_ARG(a1), PROTOOP_ARG(a2), PROTOOP_ARG(a3), PROTOOP_ARG(a4), \
+        PROTOOP_ARG(a5), PROTOOP_ARG(a6), PROTOOP_ARG(a7), PROTOOP_ARG(a8)})
+# define protoop_prepare_and_run_9(cnx, pid, param, caller, outputv, a1, a2, a3, a4, a5, a6, a7, a8, a9) \
+    protoop_prepare_and_run_args(cnx, pid, param, caller, outputv, 9, (protoop_arg_t[9]) {PROTOOP_ARG(a1), PROTOOP_ARG(a2), PROTOOP_ARG(a3), PROTOOP_ARG(a4), \
+        PROTOOP_ARG(a5), PROTOOP_ARG(a6), PROTOOP_ARG(a7), PROTOOP_ARG(a8), PROTOOP_ARG(a9)})
+
+# define protoop_prepare_and_run_noparam(cnx, pid, outputv, ...) protoop_prepare_and_run_n(cnx, pid, NO_PARAM, true, outputv, __VA_ARGS__)
+# define protoop_prepare_and_run_param(cnx, pid, param, outputv, ...) protoop_prepare_and_run_n(cnx, pid, param, true, outputv, __VA_ARGS__)
+# define protoop_prepare_and_run_extern_noparam(cnx, pid, outputv, ...) protoop_prepare_and_run_n(cnx, pid, NO_PARAM, false, outputv, __VA_ARGS__)
+# define protoop_prepare_and_run_extern_param(cnx, pid, param, outputv, ...) protoop_prepare_and_run_n(cnx, pid, param, false, outputv, __VA_ARGS__)
 # define protoop_save_outputs(cnx, ...) protoop_save_outputs_helper(cnx, N_ARGS(__VA_ARGS__), __VA_ARGS__)
 
+/* The logging macros expect cnx to be in scope. Unless a pluglet observes the logging operations,
+ * they skip both the formatting and the dispatch.
+ */
 #ifndef LOG
 #ifndef DISABLE_QLOG
-#define LOG
+#define LOG_FOR(c) if ((c)->logging_active)
 #else
-#define LOG if (0)
+#define LOG_FOR(c) if (0)
 #endif
+#define LOG LOG_FOR(cnx)
 #endif
 
 #ifndef LOG_EVENT
 #ifndef DISABLE_QLOG
 #define LOG_EVENT(cnx, cat, ev_type, trig, data_fmt, ...)                                                                                                                    \
     do {                                                                                                                                                                     \
-        char ___data[1024];                                                                                                                                                  \
-        snprintf(___data, 1024, data_fmt, __VA_ARGS__);                                                                                                                      \
-        protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_LOG_EVENT, NULL, (protoop_arg_t) cat, (protoop_arg_t) ev_type, (protoop_arg_t) trig, (protoop_arg_t) NULL, (protoop_arg_t) ___data); \
+        if ((cnx)->logging_active) {                                                                                                                                         \
+            char ___data[1024];                                                                                                                                              \
+            snprintf(___data, 1024, data_fmt, __VA_ARGS__);                                                                                                                  \
+            protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_LOG_EVENT, NULL, (protoop_arg_t) cat, (protoop_arg_t) ev_type, (protoop_arg_t) trig, (protoop_arg_t) NULL, (protoop_arg_t) ___data); \
+        }                                                                                                                                                                    \
     } while (0)
 #else
 #define LOG_EVENT(cnx, cat, ev_type, trig, data_fmt, ...)
@@ -835,11 +1465,16 @@ void picoquic_init_transport_parameters(picoquic_tp_t* tp, int client_mode);
 
 #ifndef PUSH_LOG_CTX
 #ifndef DISABLE_QLOG
+/* A skipped context is not popped either, even if a logger was plugged in the meantime */
 #define PUSH_LOG_CTX(cnx, ctx_fmt, ...) \
     do {                                                                                                                                                                     \
-        char ___data[1024];                                                                                                                                                  \
-        snprintf(___data, 1024, ctx_fmt, __VA_ARGS__);                                                                                                                      \
-        protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PUSH_LOG_CONTEXT, NULL, (protoop_arg_t) ___data); \
+        if ((cnx)->logging_active) {                                                                                                                                         \
+            char ___data[1024];                                                                                                                                              \
+            snprintf(___data, 1024, ctx_fmt, __VA_ARGS__);                                                                                                                  \
+            protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PUSH_LOG_CONTEXT, NULL, (protoop_arg_t) ___data); \
+        } else {                                                                                                                                                             \
+            (cnx)->log_ctx_skipped++;                                                                                                                                        \
+        }                                                                                                                                                                    \
     } while (0)
 #else
 #define PUSH_LOG_CTX(cnx, ctx_fmt, ...)
@@ -848,7 +1483,14 @@ void picoquic_init_transport_parameters(picoquic_tp_t* tp, int client_mode);
 
 #ifndef POP_LOG_CTX
 #ifndef DISABLE_QLOG
-#define POP_LOG_CTX(cnx)    protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_POP_LOG_CONTEXT, NULL, NULL)
+#define POP_LOG_CTX(cnx) \
+    do {                                                                                                                                                                     \
+        if ((cnx)->log_ctx_skipped > 0) {                                                                                                                                    \
+            (cnx)->log_ctx_skipped--;                                                                                                                                        \
+        } else {                                                                                                                                                             \
+            protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_POP_LOG_CONTEXT, NULL, NULL);                                                                            \
+        }                                                                                                                                                                    \
+    } while (0)
 #else
 #define POP_LOG_CTX(cnx)
 #endif
@@ -873,23 +1515,140 @@ void picoquic_init_transport_parameters(picoquic_tp_t* tp, int client_mode);
 
 #endif
 
-static inline protoop_arg_t protoop_prepare_and_run_helper(picoquic_cnx_t *cnx, protoop_id_t *pid, param_id_t param, bool caller, protoop_arg_t *outputv, unsigned int n_args, ...)
+/* Finds the protocol operation structure, using the built-in index when the pid has one */
+static inline protocol_operation_struct_t *picoquic_find_protoop(picoquic_cnx_t *cnx, protoop_id_t *pid)
 {
-  int i;
-  va_list ap;
+    protocol_operation_struct_t *post = NULL;
+    if (pid->hash == 0) {
+        pid->hash = hash_value_str(pid->id);
+    }
+    /* The index may come from a pluglet, so only trust it if the hash matches */
+    if (pid->index > 0 && pid->index < PROTOOP_BUILTIN_INDEX_MAX) {
+        post = cnx->builtin_ops[pid->index];
+        if (post && post->pid.hash == pid->hash) {
+            return post;
+        }
+    }
+    HASH_FIND_PID(cnx->ops, &(pid->hash), post);
+    return post;
+}
 
-  va_start(ap, n_args);
-  protoop_arg_t args[n_args];
+/* Finds the param structure of a parametrable protocol operation, without falling back on NO_PARAM */
+static inline protocol_operation_param_struct_t *picoquic_find_protoop_param(protocol_operation_struct_t *post, param_id_t param)
+{
+    protocol_operation_param_struct_t *popst = NULL;
+    if (post->param_table && param < PROTOOP_PARAM_TABLE_SIZE) {
+        return post->param_table[param];
+    }
+    HASH_FIND(hh, post->params, &param, sizeof(param_id_t), popst);
+    return popst;
+}
+
+/* Keep the param table in sync with the params hash map. popst may be NULL when it is removed */
+static inline void picoquic_set_protoop_param_table(protocol_operation_struct_t *post, param_id_t param, protocol_operation_param_struct_t *popst)
+{
+    if (post->param_table && param < PROTOOP_PARAM_TABLE_SIZE) {
+        post->param_table[param] = popst;
+    }
+}
+
+void picoquic_index_builtin_protoops(picoquic_cnx_t *cnx);
+/* To call once pluglets are plugged in or unplugged from the logging operations */
+void picoquic_update_logging_active(picoquic_cnx_t *cnx);
+
+typedef enum {
+    picoquic_log_policy_pending = 0, /* Not evaluated yet */
+    picoquic_log_policy_watching, /* Passed the filters, captured if it crosses a threshold */
+    picoquic_log_policy_captured,
+    picoquic_log_policy_excluded
+} picoquic_log_policy_state_enum;
+
+/* Evaluates the log policy of the context, see picoquic_set_log_policy() */
+void picoquic_log_policy_update(picoquic_cnx_t* cnx);
+/* To call each time the param structs of the operations change, e.g. on plug and unplug. Also updates
+ * plain_header_ops, plain_checksum_op and the private operations */
+void picoquic_update_frame_dispatch(picoquic_cnx_t *cnx);
+
+/* To call when the CIDs or the version used in the headers of the path change */
+static inline void picoquic_reset_header_templates(picoquic_path_t* path_x)
+{
+    for (int epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS; epoch++) {
+        path_x->header_templates[epoch].length = 0;
+    }
+}
+
+static inline void picoquic_reset_cnx_header_templates(picoquic_cnx_t* cnx)
+{
+    for (int i = 0; i < cnx->nb_paths; i++) {
+        picoquic_reset_header_templates(cnx->path[i]);
+    }
+}
+void picoquic_free_protoops(protocol_operation_struct_t * ops);
+/* Frees a plugin that is not in the plugins of a connection anymore */
+void picoquic_free_plugin(protoop_plugin_t *p);
+void picoquic_free_protoops_and_plugins(picoquic_cnx_t* cnx);
+
+/* Runs the core operation of popst with the same context handling as plugin_run_protoop_internal,
+ * minus the bookkeeping that is only needed when pluglets are involved
+ */
+static inline protoop_arg_t picoquic_run_plain_core(picoquic_cnx_t *cnx, protocol_operation_param_struct_t *popst, unsigned int n_args, protoop_arg_t *args, protoop_arg_t *outputv)
+{
+  protoop_plugin_t *old_plugin = cnx->current_plugin;
+  int caller_inputc = cnx->protoop_inputc;
+  int caller_outputc = cnx->protoop_outputc_callee;
+  protoop_arg_t *caller_inputv = cnx->protoop_inputv;
+  protoop_arg_t *caller_outputv = cnx->protoop_outputv;
+  cnx->protoop_inputv = args;
+  cnx->protoop_inputc = n_args;
+  cnx->protoop_outputv = outputv;
+  cnx->protoop_outputc_callee = 0;
+  cnx->current_plugin = NULL;
+
+  protoop_arg_t status = popst->core(cnx);
+
+  cnx->protoop_output = 0;
+  cnx->protoop_inputv = caller_inputv;
+  cnx->protoop_outputv = caller_outputv;
+  cnx->protoop_inputc = caller_inputc;
+  cnx->protoop_outputc_callee = caller_outputc;
+  cnx->previous_plugin_in_replace = NULL;
+  cnx->current_plugin = old_plugin;
+  return status;
+}
+
+/* Called by the protoop_prepare_and_run_<n> variants, args lives in the stack of the caller */
+static inline protoop_arg_t protoop_prepare_and_run_args(picoquic_cnx_t *cnx, protoop_id_t *pid, param_id_t param, bool caller, protoop_arg_t *outputv, unsigned int n_args, protoop_arg_t *args)
+{
   DBG_PLUGIN_PRINTF("%u argument(s):", n_args);
-  for (i = 0; i < n_args; i++) {
-    args[i] = va_arg(ap, protoop_arg_t);
+  for (unsigned int i = 0; i < n_args; i++) {
     DBG_PLUGIN_PRINTF("  %" PRIu64, args[i]);
   }
-  va_end(ap);
+  /* Fast path: when no pluglet is attached, directly call the core operation */
+  protocol_operation_struct_t *post = picoquic_find_protoop(cnx, pid);
+  if (post) {
+    protocol_operation_param_struct_t *popst = post->is_parametrable ? picoquic_find_protoop_param(post, param) : post->params;
+    if (popst && popst->plain_core && popst->intern == caller && !popst->running) {
+      return picoquic_run_plain_core(cnx, popst, n_args, args, outputv);
+    }
+  }
   protoop_params_t pp = { .pid = pid, .param = param, .inputc = n_args, .inputv = args, .outputv = outputv, .caller_is_intern = caller };
   return plugin_run_protoop_internal(cnx, &pp);
 }
 
+/* Same as protoop_prepare_and_run_args for the frame operation op of pid, the param being the frame
+ * type. The frequent frame types only cost a load in the dispatch table when no pluglet is attached.
+ */
+static inline protoop_arg_t protoop_run_frame_op(picoquic_cnx_t *cnx, picoquic_frame_op_enum op, protoop_id_t *pid, uint64_t frame_type, protoop_arg_t *outputv, unsigned int n_args, protoop_arg_t *args)
+{
+  if (frame_type < PICOQUIC_FRAME_DISPATCH_SIZE) {
+    protocol_operation_param_struct_t *popst = cnx->frame_dispatch[op][frame_type];
+    if (popst && popst->plain_core && popst->intern && !popst->running) {
+      return picoquic_run_plain_core(cnx, popst, n_args, args, outputv);
+    }
+  }
+  return protoop_prepare_and_run_args(cnx, pid, (param_id_t) frame_type, true, outputv, n_args, args);
+}
+
 static inline void protoop_save_outputs_helper(picoquic_cnx_t *cnx, unsigned int n_args, ...)
 {
   int i;
@@ -910,17 +1669,50 @@ static inline void protoop_save_outputs_helper(picoquic_cnx_t *cnx, unsigned int
 /* Init of transport parameters */
 void picoquic_init_transport_parameters(picoquic_tp_t* tp, int client_mode);
 
-/* Handling of stateless packets */
+/* Handling of stateless packets. A packet created, i.e. reserved in the ring, must be queued.
+ * Returns NULL if the ring is full, in which case the packet is counted as dropped. */
+#define PICOQUIC_STATELESS_RING_SIZE 64 /* Must be a power of 2 */
 picoquic_stateless_packet_t* picoquic_create_stateless_packet(picoquic_quic_t* quic);
 void picoquic_queue_stateless_packet(picoquic_quic_t* quic, picoquic_stateless_packet_t* sp);
 
+/* Replaces the closing or draining connection by a tombstone holding its CIDs and its close datagram, and moves it
+ * to the disconnected state, see picoquic_set_tombstones() */
+void picoquic_bury_cnx(picoquic_cnx_t* cnx, const uint8_t* close_datagram, size_t close_length, uint64_t current_time);
+/* Returns 1 if the packet to dest_cnx_id is for a tombstone, which answers it with its close datagram when due */
+int picoquic_tombstone_incoming(picoquic_quic_t* quic, picoquic_connection_id_t* dest_cnx_id, uint32_t length,
+    struct sockaddr* addr_from, struct sockaddr* addr_to, unsigned long if_index_to, uint64_t current_time);
+void picoquic_free_tombstones(picoquic_quic_t* quic);
+
+/* Injects or requests in 0-RTT the plugins remembered with the session ticket, see quicctx.c */
+int picoquic_handle_cached_plugin_negotiation(picoquic_cnx_t* cnx, uint64_t current_time);
+
 /* Registration of connection ID in server context */
 int picoquic_register_cnx_id(picoquic_quic_t* quic, picoquic_cnx_t* cnx, const picoquic_connection_id_t* cnx_id);
 int picoquic_register_cnx_id_for_cnx(picoquic_cnx_t* cnx, const picoquic_connection_id_t* cnx_id);
+int picoquic_register_net_id(picoquic_quic_t* quic, picoquic_cnx_t* cnx, struct sockaddr* addr);
+/* Copies up to max_cnx_ids of the CIDs registered for the connection, returns how many there are */
+int picoquic_get_registered_cnx_ids(picoquic_cnx_t* cnx, picoquic_connection_id_t* cnx_ids, int max_cnx_ids);
 
 /* handling of retransmission queue */
 void picoquic_dequeue_retransmit_packet(picoquic_cnx_t* cnx, picoquic_packet_t* p, int should_free);
 void picoquic_dequeue_retransmitted_packet(picoquic_cnx_t* cnx, picoquic_packet_t* p);
+void picoquic_retransmit_index_add(picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* packet);
+void picoquic_retransmit_index_remove(picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* packet);
+void picoquic_retransmit_index_free(picoquic_packet_context_t* pkt_ctx);
+void picoquic_summarize_packet_frames(picoquic_cnx_t* cnx, picoquic_packet_t* p);
+
+/* Path MTU discovery: a packet sent on the path was acknowledged, or declared lost. The latter returns 1 if it was an
+ * MTU probe, which is not retransmitted. */
+size_t picoquic_mtu_probe_length(picoquic_cnx_t* cnx, picoquic_path_t* path_x);
+int picoquic_is_mtu_probe_needed(picoquic_cnx_t* cnx, picoquic_path_t* path_x);
+void picoquic_mtu_packet_acked(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_t* p, uint64_t current_time);
+int picoquic_mtu_packet_lost(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_t* p, uint64_t current_time);
+/* Adds the reservation queue of the plugin to its active list, unless it is there already */
+void picoquic_drr_activate(picoquic_cnx_t* cnx, protoop_plugin_t* p, int is_congestion_controlled);
+picoquic_packet_t* picoquic_retransmit_index_floor(picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* p, uint64_t sequence_number);
+/* Transport counters: the time until the next change is counted for the limit, and the RTT samples go in the histogram */
+void picoquic_path_set_send_limit(picoquic_path_t* path_x, picoquic_send_limit_enum limit, uint64_t current_time);
+void picoquic_path_record_rtt(picoquic_path_t* path_x, uint64_t rtt);
 void picoquic_implicit_handshake_ack(picoquic_cnx_t* cnx, picoquic_path_t *path, picoquic_packet_context_enum pc, uint64_t current_time);
 
 /* Reset connection after receiving version negotiation */
@@ -947,8 +1739,51 @@ picoquic_cnx_t* picoquic_cnx_by_net(picoquic_quic_t* quic, struct sockaddr* addr
      * so ready connections are polled first */
 void picoquic_reinsert_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t next_time);
 
+/* Deadline of the next keep alive, rounded up to the bucket of the context */
+uint64_t picoquic_keep_alive_time(picoquic_cnx_t* cnx);
+/* Adapts the interval of the adaptive keep alive as one is sent, or once a NAT rebinding is seen */
+void picoquic_keep_alive_sent(picoquic_cnx_t* cnx);
+void picoquic_keep_alive_rebinding(picoquic_cnx_t* cnx);
+int picoquic_insert_cnx_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx);
+void picoquic_remove_cnx_from_wake_list(picoquic_cnx_t* cnx);
+
 void picoquic_cnx_set_next_wake_time(picoquic_cnx_t* cnx, uint64_t current_time);
 
+/* Zeroed stream and path objects, taken from the caches of the context when the connection has one */
+picoquic_stream_head* picoquic_create_stream_object(picoquic_cnx_t* cnx);
+void picoquic_free_stream_object(picoquic_cnx_t* cnx, picoquic_stream_head* stream);
+void picoquic_free_path_object(picoquic_cnx_t* cnx, picoquic_path_t* path_x);
+
+/* Memory accounting of the connection, cnx may be NULL for the structures built outside of one */
+void picoquic_memory_charge(picoquic_cnx_t* cnx, picoquic_memory_category_enum category, size_t length);
+void picoquic_memory_release(picoquic_cnx_t* cnx, picoquic_memory_category_enum category, size_t length);
+/* Returns 1 if the memory cap is reached, in which case the flow control credit should be held back */
+int picoquic_is_memory_capped(picoquic_cnx_t* cnx);
+/* Forgets the data of the stream not sent yet, when its send queue is dropped */
+void picoquic_release_send_buffered(picoquic_cnx_t* cnx, picoquic_stream_head* stream);
+/* Window to grant at the next flow control update. The window doubles, up to window_max and the budget of the
+ * context, when the previous update was less than 2 RTT ago: the peer then sends faster than the window allows. */
+uint64_t picoquic_autotune_window(picoquic_cnx_t* cnx, uint64_t window, uint64_t window_max, uint64_t update_time);
+/* Records the window granted by an update, and its growth in the budget of the context */
+void picoquic_autotune_window_set(picoquic_cnx_t* cnx, uint64_t* window, uint64_t new_window,
+    uint64_t* update_time, uint64_t* growth);
+/* Returns 1 when less than half of the window of the stream is left, and it should get a MAX_STREAM_DATA */
+int picoquic_is_max_stream_data_needed(picoquic_stream_head* stream);
+/* Takes the connection out of the batch of picoquic_notify_stream_batches(), before it is deleted */
+void picoquic_remove_readable_cnx(picoquic_cnx_t* cnx);
+/* With a profile set, returns the CPU time at the start of the measured call, to pass to picoquic_profile_end() */
+uint64_t picoquic_profile_start(picoquic_quic_t* quic);
+void picoquic_profile_end(picoquic_quic_t* quic, picoquic_profile_category_enum category, uint64_t start_time);
+/* Hibernates the connection if it made no progress for the hibernation delay of the context */
+void picoquic_check_hibernation(picoquic_cnx_t* cnx, uint64_t current_time);
+/* Leaves hibernation, the released structures grow again as needed */
+void picoquic_wake_cnx(picoquic_cnx_t* cnx);
+/* The client moves path 0 to the preferred address of the server, once the handshake is confirmed */
+void picoquic_migrate_to_preferred_address(picoquic_cnx_t* cnx, uint64_t current_time);
+/* Copies the preferred address of the server connection, the wildcard addresses replaced by the local address of
+ * path 0. Returns 0 if it has no address to advertise */
+int picoquic_get_local_preferred_address(picoquic_cnx_t* cnx, picoquic_tp_preferred_address_t* preferred_address);
+
 void picoquic_create_random_cnx_id(picoquic_quic_t* quic, picoquic_connection_id_t * cnx_id, uint8_t id_length);
 void picoquic_create_random_cnx_id_for_cnx(picoquic_cnx_t* cnx, picoquic_connection_id_t *cnx_id, uint8_t id_length);
 
@@ -1057,6 +1892,8 @@ uint32_t picoquic_protect_packet(picoquic_cnx_t* cnx,
     uint8_t* send_buffer, uint32_t send_buffer_max,
     picoquic_packet_header *ph,
     void * aead_context, void* pn_enc);
+/* Applies the header protection of the packets queued in the batch, then empties it */
+void picoquic_hp_batch_flush(picoquic_hp_batch_t* batch);
 
 void picoquic_finalize_and_protect_packet(picoquic_cnx_t *cnx, picoquic_packet_t * packet, int ret,
     uint32_t length, uint32_t header_length, uint32_t checksum_overhead,
@@ -1069,6 +1906,8 @@ int picoquic_parse_header_and_decrypt(
     uint32_t length,
     uint32_t packet_length,
     struct sockaddr* addr_from,
+    struct sockaddr* addr_to,
+    unsigned long if_index_to,
     uint64_t current_time,
     picoquic_packet_header* ph,
     picoquic_cnx_t** pcnx,
@@ -1084,6 +1923,37 @@ void picoquic_log_outgoing_segment(void* F_log, int log_cnxid, picoquic_cnx_t* c
     uint64_t sequence_number,
     uint32_t length,
     uint8_t* send_buffer, uint32_t send_length);
+void picoquic_log_frames(FILE* F, uint64_t cnx_id64, uint8_t* bytes, size_t length);
+
+/* Binary packet trace, see picoquic_set_binary_log(). Each record is followed by payload_length bytes:
+ * the decrypted frames, or what follows the header for version negotiation and retry packets */
+#define PICOQUIC_BINLOG_MAGIC 0x424c5150 /* "PQLB" */
+
+typedef struct st_picoquic_binlog_record_t {
+    uint32_t magic;
+    uint32_t payload_length;
+    uint64_t time;
+    uint64_t log_cnxid64;
+    uint64_t pn64;
+    int32_t ret; /* Error of the parsing or decryption of a received packet */
+    uint32_t vn;
+    uint8_t receiving;
+    uint8_t ptype;
+    uint8_t spin;
+    uint8_t dest_id_len;
+    uint8_t srce_id_len;
+    uint8_t dest_id[PICOQUIC_CONNECTION_ID_MAX_SIZE];
+    uint8_t srce_id[PICOQUIC_CONNECTION_ID_MAX_SIZE];
+} picoquic_binlog_record_t;
+
+void picoquic_binlog_incoming_segment(picoquic_quic_t* quic, picoquic_cnx_t* cnx,
+    picoquic_packet_header* ph, uint8_t* bytes, size_t length, int ret);
+/* The header must be the one created by picoquic_create_packet_header(), before its protection */
+void picoquic_binlog_outgoing_segment(picoquic_cnx_t* cnx, picoquic_packet_type_enum ptype, uint64_t sequence_number,
+    uint8_t* header, uint32_t header_length, uint8_t* payload, uint32_t payload_length);
+/* Writes a binary trace as the text packet log, with the time of each packet if log_time is set.
+ * Returns the number of packets, or -1 if the trace is truncated or corrupted */
+int picoquic_log_binary_trace(FILE* F_trace, FILE* F, int log_time);
 
 void picoquic_log_packet_address(FILE* F, uint64_t log_cnxid64, picoquic_cnx_t* cnx,
     struct sockaddr* addr_peer, int receiving, size_t length, uint64_t current_time);
@@ -1116,26 +1986,41 @@ int picoquic_record_pn_received(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
 uint16_t picoquic_deltat_to_float16(uint64_t delta_t);
 uint64_t picoquic_float16_to_deltat(uint16_t float16);
 
-int picoquic_update_sack_list(picoquic_cnx_t* cnx, picoquic_sack_item_t* sack,
+void picoquic_sack_list_init(picoquic_sack_list_t* sacks);
+/* Frees the allocated ranges, the list is empty after that */
+void picoquic_sack_list_free(picoquic_sack_list_t* sacks);
+/* Moves the ranges back in place when they fit there, freeing the allocated ones */
+void picoquic_sack_list_compact(picoquic_sack_list_t* sacks);
+/* Memory allocated for the ranges, 0 while they fit inline */
+size_t picoquic_sack_list_footprint(picoquic_sack_list_t* sacks);
+int picoquic_update_sack_list(picoquic_cnx_t* cnx, picoquic_sack_list_t* sacks,
     uint64_t pn64_min, uint64_t pn64_max);
 /*
      * Check whether the data fills a hole. returns 0 if it does, -1 otherwise.
      */
-int picoquic_check_sack_list(picoquic_sack_item_t* sack,
+int picoquic_check_sack_list(picoquic_sack_list_t* sacks,
     uint64_t pn64_min, uint64_t pn64_max);
+/* Removes the range start_of_range..end_of_range once the peer knows it was acknowledged */
+void picoquic_sack_list_ack_of_ack(picoquic_sack_list_t* sacks, uint64_t start_of_range, uint64_t end_of_range);
 
 /*
      * Process ack of ack
      */
 int picoquic_process_ack_of_ack_frame(
     picoquic_cnx_t* cnx,
-    picoquic_sack_item_t* first_sack,
+    picoquic_sack_list_t* sacks,
     uint8_t* bytes, size_t bytes_max, size_t* consumed, int is_ecn);
 
 /* stream management */
 picoquic_stream_head* picoquic_create_stream(picoquic_cnx_t* cnx, uint64_t stream_id);
 void picoquic_update_stream_initial_remote(picoquic_cnx_t* cnx);
 picoquic_stream_head* picoquic_find_ready_stream(picoquic_cnx_t* cnx);
+/* Lets find_ready_stream visit the stream, to be called when it may have become ready */
+void picoquic_mark_stream_ready(picoquic_cnx_t* cnx, picoquic_stream_head* stream);
+void picoquic_init_ready_streams(picoquic_cnx_t* cnx);
+void picoquic_update_stream_priority(picoquic_cnx_t* cnx, picoquic_stream_head* stream, uint8_t urgency, int is_sequential);
+void picoquic_update_stream_scheduler(picoquic_cnx_t* cnx, picoquic_stream_scheduler_enum scheduler);
+void picoquic_charge_stream_weight(picoquic_cnx_t* cnx, picoquic_stream_head* stream, size_t length);
 picoquic_stream_head* picoquic_schedule_next_stream(picoquic_cnx_t* cnx, size_t max_size, picoquic_path_t *path);
 int picoquic_is_tls_stream_ready(picoquic_cnx_t* cnx);
 uint8_t* picoquic_decode_stream_frame(picoquic_cnx_t* cnx, uint8_t* bytes, const uint8_t* bytes_max, uint64_t current_time, picoquic_path_t* path_x);
@@ -1148,6 +2033,10 @@ uint8_t* picoquic_decode_crypto_hs_frame(picoquic_cnx_t* cnx, uint8_t* bytes,
 int picoquic_prepare_crypto_hs_frame(picoquic_cnx_t* cnx, int epoch,
     uint8_t* bytes, size_t bytes_max, size_t* consumed);
 int picoquic_prepare_handshake_done_frame(picoquic_cnx_t *cnx, uint8_t* bytes, size_t bytes_max, size_t* consumed);
+void picoquic_compute_ack_frequency(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t* ack_gap, uint64_t* ack_delay);
+int picoquic_prepare_ack_frequency_frame(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    uint8_t* bytes, size_t bytes_max, size_t* consumed);
+int picoquic_prepare_immediate_ack_frame(picoquic_cnx_t* cnx, uint8_t* bytes, size_t bytes_max, size_t* consumed);
 int picoquic_prepare_ack_frame(picoquic_cnx_t* cnx, uint64_t current_time,
     picoquic_packet_context_enum pc,
     uint8_t* bytes, size_t bytes_max, size_t* consumed);
@@ -1162,7 +2051,16 @@ int picoquic_prepare_max_data_frame(picoquic_cnx_t* cnx, uint64_t maxdata_increa
 void picoquic_update_max_stream_ID_local(picoquic_cnx_t* cnx, picoquic_stream_head* stream);
 int picoquic_prepare_max_stream_ID_frame_if_needed(picoquic_cnx_t* cnx,
     uint8_t* bytes, size_t bytes_max, size_t* consumed);
-void picoquic_clear_stream(picoquic_stream_head* stream);
+void picoquic_clear_stream(picoquic_cnx_t* cnx, picoquic_stream_head* stream);
+void picoquic_free_stream_data(picoquic_cnx_t* cnx, picoquic_stream_data* data);
+/* Memory held by the stream data, as charged to the connection */
+size_t picoquic_stream_data_footprint(picoquic_stream_data* data);
+/* Appends data to a send queue, copied in the room left in its last chunk or in a new one of at least
+ * PICOQUIC_STREAM_SEND_CHUNK_SIZE bytes, unless release_fn is set. Returns 0, or -1 if out of memory. */
+int picoquic_append_stream_data(picoquic_cnx_t* cnx, picoquic_stream_data** pqueue, const uint8_t* data, size_t length,
+    picoquic_stream_data_release_fn release_fn, void* release_ctx);
+/* Queues the archive on the plugin stream without copying it, the stream data keeps a reference to it */
+int picoquic_add_archive_to_plugin_stream(picoquic_cnx_t* cnx, uint64_t pid_id, plugin_archive_t* archive, int set_fin);
 int picoquic_prepare_path_challenge_frame(picoquic_cnx_t* cnx, uint8_t* bytes,
     size_t bytes_max, size_t* consumed, picoquic_path_t * path);
 
@@ -1172,6 +2070,7 @@ int picoquic_write_plugin_validate_frame(picoquic_cnx_t* cnx, uint8_t* bytes, co
 /* plugin stream management */
 picoquic_stream_head* picoquic_create_plugin_stream(picoquic_cnx_t* cnx, uint64_t pid_id);
 picoquic_stream_head* picoquic_find_ready_plugin_stream(picoquic_cnx_t* cnx);
+void picoquic_mark_plugin_stream_ready(picoquic_cnx_t* cnx, picoquic_stream_head* plugin_stream);
 int picoquic_prepare_plugin_frame(picoquic_cnx_t* cnx, picoquic_stream_head* plugin_stream,
     uint8_t* bytes, size_t bytes_max, size_t* consumed);
 
@@ -1203,6 +2102,8 @@ void picoquic_segment_prepared(picoquic_cnx_t *cnx, picoquic_packet_t *pkt);
 void picoquic_segment_aborted(picoquic_cnx_t *cnx);
 /* Hooks for reception and sending of QUIC packets before encryption */  // TODO: Maybe the two above and below should be merged
 void picoquic_header_parsed(picoquic_cnx_t *cnx, picoquic_packet_header *ph, picoquic_path_t *path, size_t length);
+/* Counts the ECN mark of a packet received on the path, in the packet context of ph */
+void picoquic_ecn_packet_received(picoquic_path_t* path, picoquic_packet_header* ph, int recv_tos);
 void picoquic_header_prepared(picoquic_cnx_t *cnx, picoquic_packet_header *ph, picoquic_path_t *path, picoquic_packet_t *packet, size_t length);
 
 /* Queue stateless reset */
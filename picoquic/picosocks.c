@@ -19,9 +19,36 @@
 * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* recvmmsg */
+#endif
 #include <sys/stat.h>
 #include "picosocks.h"
 #include "util.h"
+#if defined(PICOQUIC_EVENT_LOOP_EPOLL)
+#include <sys/epoll.h>
+#elif defined(PICOQUIC_EVENT_LOOP_KQUEUE)
+#include <sys/event.h>
+#endif
+#if defined(__linux__)
+#include <linux/net_tstamp.h>
+#include <time.h>
+#endif
+#if defined(PICOQUIC_WITH_IO_URING)
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifndef IORING_RECV_MULTISHOT
+#undef PICOQUIC_WITH_IO_URING /* Headers older than Linux 6.0 */
+#endif
+#endif
+#if defined(_WINDOWS)
+#if defined(SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER) && defined(WSA_FLAG_REGISTERED_IO)
+#define PICOQUIC_WITH_RIO /* Registered I/O, from Windows 8 */
+#endif
+#define PICOQUIC_URO_MAX_COALESCED_SIZE 65527 /* 64KB less the UDP header, as GRO */
+#endif
 
 static int bind_to_port(SOCKET_TYPE fd, int af, int port)
 {
@@ -51,6 +78,11 @@ static int bind_to_port(SOCKET_TYPE fd, int af, int port)
 }
 
 int picoquic_open_server_sockets(picoquic_server_sockets_t* sockets, int port)
+{
+    return picoquic_open_server_sockets_ex(sockets, port, 0);
+}
+
+int picoquic_open_server_sockets_ex(picoquic_server_sockets_t* sockets, int port, int reuse_port)
 {
     int ret = 0;
 #ifndef NS3
@@ -60,8 +92,16 @@ int picoquic_open_server_sockets(picoquic_server_sockets_t* sockets, int port)
 #endif
 
     for (int i = 0; i < PICOQUIC_NB_SERVER_SOCKETS; i++) {
+        sockets->gso_disabled[i] = 0;
+        sockets->txtime_enabled[i] = 0;
         if (ret == 0) {
+#ifdef PICOQUIC_WITH_RIO
+            /* Registered I/O is only possible on the sockets created for it */
+            sockets->s_socket[i] = WSASocket(sock_af[i], SOCK_DGRAM, IPPROTO_UDP, NULL, 0,
+                WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+#else
             sockets->s_socket[i] = socket(sock_af[i], SOCK_DGRAM, IPPROTO_UDP);
+#endif
         } else {
             sockets->s_socket[i] = INVALID_SOCKET;
         }
@@ -102,6 +142,14 @@ int picoquic_open_server_sockets(picoquic_server_sockets_t* sockets, int port)
 #endif
             }
 #endif
+            if (ret == 0 && reuse_port) {
+#ifdef SO_REUSEPORT
+                int val = 1;
+                ret = setsockopt(sockets->s_socket[i], SOL_SOCKET, SO_REUSEPORT, (char*)&val, sizeof(int));
+#else
+                ret = -1;
+#endif
+            }
             if (ret == 0) {
                 ret = bind_to_port(sockets->s_socket[i], sock_af[i], port);
             }
@@ -121,106 +169,424 @@ void picoquic_close_server_sockets(picoquic_server_sockets_t* sockets)
     }
 }
 
-int picoquic_recvmsg(SOCKET_TYPE fd,
-    struct sockaddr_storage* addr_from,
-    socklen_t* from_length,
-    struct sockaddr_storage* addr_dest,
-    socklen_t* dest_length,
-    unsigned long* dest_if,
-    uint8_t* buffer, int buffer_max,
-    int *tos)
-#ifdef _WINDOWS
+int picoquic_open_local_sockets(picoquic_local_sockets_t* sockets, int port)
 {
-    GUID WSARecvMsg_GUID = WSAID_WSARECVMSG;
-    LPFN_WSARECVMSG WSARecvMsg;
-    char cmsg_buffer[1024];
-    DWORD NumberOfBytes;
-    int nResult;
-    WSAMSG msg;
-    WSABUF dataBuf;
-    int recv_ret = 0;
-    int bytes_recv;
-    int last_error;
+    struct sockaddr_storage sas[PICOQUIC_MAX_LOCAL_SOCKETS];
+    uint32_t if_indexes[PICOQUIC_MAX_LOCAL_SOCKETS];
+    int nb_addrs = picoquic_getaddrs(sas, if_indexes, PICOQUIC_MAX_LOCAL_SOCKETS);
+
+    sockets->nb_sockets = 0;
+
+    for (int i = 0; i < nb_addrs; i++) {
+        int af = sas[i].ss_family;
+        int addr_length = (af == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+        struct sockaddr_storage bound_addr;
+        SOCKET_TYPE fd = socket(af, SOCK_DGRAM, IPPROTO_UDP);
+        int ret = 0;
+        int val = 1;
+
+        if (fd == INVALID_SOCKET) {
+            continue;
+        }
 
-    if (dest_length != NULL) {
-        *dest_length = 0;
+        /* The destination address of the incoming packets sets the local address of their path */
+        if (af == AF_INET6) {
+            ret = setsockopt(fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, (char*)&val, sizeof(int));
+            if (ret == 0) {
+                ret = setsockopt(fd, IPPROTO_IPV6, IPV6_DONTFRAG, &val, sizeof(val));
+            }
+        } else {
+#ifdef IP_PKTINFO
+            ret = setsockopt(fd, IPPROTO_IP, IP_PKTINFO, (char*)&val, sizeof(int));
+#else
+            /* The IP_PKTINFO structure is not defined on BSD */
+            ret = setsockopt(fd, IPPROTO_IP, IP_RECVDSTADDR, (char*)&val, sizeof(int));
+#endif
+        }
+
+        if (ret == 0) {
+            memcpy(&bound_addr, &sas[i], addr_length);
+            if (af == AF_INET) {
+                ((struct sockaddr_in*)&bound_addr)->sin_port = htons((unsigned short)port);
+            } else {
+                ((struct sockaddr_in6*)&bound_addr)->sin6_port = htons((unsigned short)port);
+            }
+            ret = bind(fd, (struct sockaddr*)&bound_addr, addr_length);
+        }
+
+        if (ret != 0) {
+            DBG_PRINTF("Cannot open a local socket for address %d, error: %s\n", i, strerror(errno));
+            SOCKET_CLOSE(fd);
+            continue;
+        }
+
+        sockets->s_socket[sockets->nb_sockets] = fd;
+        memcpy(&sockets->local_addr[sockets->nb_sockets], &sas[i], addr_length);
+        sockets->if_index[sockets->nb_sockets] = if_indexes[i];
+        sockets->nb_sockets++;
     }
 
-    if (dest_if != NULL) {
-        *dest_if = 0;
+    return sockets->nb_sockets;
+}
+
+void picoquic_close_local_sockets(picoquic_local_sockets_t* sockets)
+{
+    for (int i = 0; i < sockets->nb_sockets; i++) {
+        if (sockets->s_socket[i] != INVALID_SOCKET) {
+            SOCKET_CLOSE(sockets->s_socket[i]);
+            sockets->s_socket[i] = INVALID_SOCKET;
+        }
+    }
+    sockets->nb_sockets = 0;
+}
+
+SOCKET_TYPE picoquic_get_path_socket(picoquic_local_sockets_t* sockets, picoquic_path_t* path_x, SOCKET_TYPE default_socket)
+{
+    /* Keep the socket that received the packets of the path, so that its 4-tuple does not change */
+    if (path_x->rcv_socket != INVALID_SOCKET) {
+        return path_x->rcv_socket;
     }
 
-    nResult = WSAIoctl(fd, SIO_GET_EXTENSION_FUNCTION_POINTER,
-        &WSARecvMsg_GUID, sizeof WSARecvMsg_GUID,
-        &WSARecvMsg, sizeof WSARecvMsg,
-        &NumberOfBytes, NULL, NULL);
+    if (sockets != NULL && path_x->local_addr_len > 0) {
+        for (int i = 0; i < sockets->nb_sockets; i++) {
+            if (picoquic_compare_addr((struct sockaddr*)&sockets->local_addr[i], (struct sockaddr*)&path_x->local_addr) == 0) {
+                path_x->rcv_socket = sockets->s_socket[i];
+                return path_x->rcv_socket;
+            }
+        }
+    }
 
-    if (nResult == SOCKET_ERROR) {
-        last_error = WSAGetLastError();
-        DBG_PRINTF("Could not initialize WSARecvMsg) on UDP socket %d= %d!\n",
-            (int)fd, last_error);
-        bytes_recv = -1;
-        *from_length = 0;
+    return default_socket;
+}
+
+void picoquic_init_connected_sockets(picoquic_connected_sockets_t* sockets, SOCKET_TYPE initial_socket)
+{
+    memset(sockets, 0, sizeof(picoquic_connected_sockets_t));
+    sockets->initial_socket = initial_socket;
+}
+
+static void picoquic_release_connected_socket(picoquic_connected_sockets_t* sockets, int i)
+{
+    if (sockets->s[i].is_initial_socket) {
+        sockets->initial_socket_used = 0;
+#ifndef _WINDOWS
+        /* Dissolves the association, so that the next path can connect it again */
+        {
+            struct sockaddr unspec;
+
+            memset(&unspec, 0, sizeof(unspec));
+            unspec.sa_family = AF_UNSPEC;
+            (void)connect(sockets->s[i].fd, &unspec, sizeof(unspec));
+        }
+#endif
+    } else if (sockets->s[i].fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(sockets->s[i].fd);
+    }
+    sockets->s[i] = sockets->s[--sockets->nb_sockets];
+}
+
+/* An IPv4 peer seen from an IPv6 socket is connected as a mapped address */
+static int picoquic_connect_to_peer(SOCKET_TYPE fd, struct sockaddr* peer_addr)
+{
+    struct sockaddr_storage fd_addr;
+    socklen_t fd_addr_length = sizeof(fd_addr);
+    struct sockaddr_in6 mapped;
+
+    if (peer_addr->sa_family == AF_INET && getsockname(fd, (struct sockaddr*)&fd_addr, &fd_addr_length) == 0 &&
+        fd_addr.ss_family == AF_INET6) {
+        memset(&mapped, 0, sizeof(mapped));
+        mapped.sin6_family = AF_INET6;
+        mapped.sin6_port = ((struct sockaddr_in*)peer_addr)->sin_port;
+        mapped.sin6_addr.s6_addr[10] = 0xff;
+        mapped.sin6_addr.s6_addr[11] = 0xff;
+        memcpy(&mapped.sin6_addr.s6_addr[12], &((struct sockaddr_in*)peer_addr)->sin_addr, 4);
+        return connect(fd, (struct sockaddr*)&mapped, sizeof(mapped));
+    }
+
+    return connect(fd, peer_addr, (peer_addr->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+}
+
+/* A socket of the family of the peer, bound to the local address of the path if known, on an ephemeral port */
+static SOCKET_TYPE picoquic_open_path_socket(picoquic_path_t* path_x)
+{
+    int af = path_x->peer_addr.ss_family;
+    SOCKET_TYPE fd = socket(af, SOCK_DGRAM, IPPROTO_UDP);
+    int val = 1;
+    int ret = 0;
+
+    if (fd == INVALID_SOCKET) {
+        return fd;
+    }
+
+    if (af == AF_INET6) {
+        ret = setsockopt(fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, (char*)&val, sizeof(int));
+        if (ret == 0) {
+            ret = setsockopt(fd, IPPROTO_IPV6, IPV6_DONTFRAG, &val, sizeof(val));
+        }
     } else {
-        dataBuf.buf = (char*)buffer;
-        dataBuf.len = buffer_max;
+#ifdef IP_PKTINFO
+        ret = setsockopt(fd, IPPROTO_IP, IP_PKTINFO, (char*)&val, sizeof(int));
+#else
+        ret = setsockopt(fd, IPPROTO_IP, IP_RECVDSTADDR, (char*)&val, sizeof(int));
+#endif
+    }
 
-        msg.name = (struct sockaddr*)addr_from;
-        msg.namelen = *from_length;
-        msg.lpBuffers = &dataBuf;
-        msg.dwBufferCount = 1;
-        msg.dwFlags = 0;
-        msg.Control.buf = cmsg_buffer;
-        msg.Control.len = sizeof(cmsg_buffer);
+    if (ret == 0 && path_x->local_addr_len > 0 && path_x->local_addr.ss_family == af) {
+        struct sockaddr_storage bound_addr;
 
-        recv_ret = WSARecvMsg(fd, &msg, &NumberOfBytes, NULL, NULL);
+        memcpy(&bound_addr, &path_x->local_addr, sizeof(bound_addr));
+        if (af == AF_INET) {
+            ((struct sockaddr_in*)&bound_addr)->sin_port = 0;
+        } else {
+            ((struct sockaddr_in6*)&bound_addr)->sin6_port = 0;
+        }
+        ret = bind(fd, (struct sockaddr*)&bound_addr, (af == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+    }
 
-        if (recv_ret != 0) {
-            last_error = WSAGetLastError();
-            DBG_PRINTF("Could not receive message (WSARecvMsg) on UDP socket %d = %d!\n",
-                (int)fd, last_error);
-            bytes_recv = -1;
-            *from_length = 0;
+    if (ret != 0) {
+        SOCKET_CLOSE(fd);
+        fd = INVALID_SOCKET;
+    }
+
+    return fd;
+}
+
+SOCKET_TYPE picoquic_get_connected_socket(picoquic_connected_sockets_t* sockets, picoquic_cnx_t* cnx, picoquic_path_t* path_x)
+{
+    picoquic_connected_socket_t* cs = NULL;
+
+    for (int i = 0; i < sockets->nb_sockets;) {
+        int is_live = 0;
+
+        for (int j = 0; !is_live && j < cnx->nb_paths; j++) {
+            is_live = (cnx->path[j] == sockets->s[i].path);
+        }
+        if (!is_live) {
+            picoquic_release_connected_socket(sockets, i);
         } else {
-            struct cmsghdr* cmsg;
+            if (sockets->s[i].path == path_x) {
+                cs = &sockets->s[i];
+            }
+            i++;
+        }
+    }
 
-            bytes_recv = NumberOfBytes;
-            *from_length = msg.namelen;
+    /* A new local address needs a new socket, a new peer address only a new association */
+    if (cs != NULL && picoquic_compare_addr((struct sockaddr*)&cs->local_addr, (struct sockaddr*)&path_x->local_addr) != 0 &&
+        cs->local_addr.ss_family != 0) {
+        picoquic_release_connected_socket(sockets, (int)(cs - sockets->s));
+        cs = NULL;
+    }
 
-            /* Get the control information */
-            for (cmsg = WSA_CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = WSA_CMSG_NXTHDR(&msg, cmsg)) {
-                if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_PKTINFO)) {
-                    if (addr_dest != NULL && dest_length != NULL) {
-                        IN_PKTINFO* pPktInfo = (IN_PKTINFO*)WSA_CMSG_DATA(cmsg);
-                        ((struct sockaddr_in*)addr_dest)->sin_family = AF_INET;
-                        ((struct sockaddr_in*)addr_dest)->sin_port = 0;
-                        ((struct sockaddr_in*)addr_dest)->sin_addr.s_addr = pPktInfo->ipi_addr.s_addr;
-                        *dest_length = sizeof(struct sockaddr_in);
-
-                        if (dest_if != NULL) {
-                            *dest_if = pPktInfo->ipi_ifindex;
-                        }
-                    }
-                } else if ((cmsg->cmsg_level == IPPROTO_IPV6) && (cmsg->cmsg_type == IPV6_PKTINFO)) {
-                    if (addr_dest != NULL && dest_length != NULL) {
-                        IN6_PKTINFO* pPktInfo6 = (IN6_PKTINFO*)WSA_CMSG_DATA(cmsg);
-                        ((struct sockaddr_in6*)addr_dest)->sin6_family = AF_INET6;
-                        ((struct sockaddr_in6*)addr_dest)->sin6_port = 0;
-                        memcpy(&((struct sockaddr_in6*)addr_dest)->sin6_addr, &pPktInfo6->ipi6_addr, sizeof(IN6_ADDR));
-                        *dest_length = sizeof(struct sockaddr_in6);
-
-                        if (dest_if != NULL) {
-                            *dest_if = pPktInfo6->ipi6_ifindex;
-                        }
-                    }
-                }
+    if (cs == NULL) {
+        if (sockets->nb_sockets >= PICOQUIC_MAX_CONNECTED_SOCKETS) {
+            return INVALID_SOCKET;
+        }
+        cs = &sockets->s[sockets->nb_sockets];
+        memset(cs, 0, sizeof(picoquic_connected_socket_t));
+        cs->path = path_x;
+        if (!sockets->initial_socket_used && sockets->initial_socket != INVALID_SOCKET) {
+            cs->fd = sockets->initial_socket;
+            cs->is_initial_socket = 1;
+        } else if ((cs->fd = picoquic_open_path_socket(path_x)) == INVALID_SOCKET) {
+            return INVALID_SOCKET;
+        }
+        if (picoquic_connect_to_peer(cs->fd, (struct sockaddr*)&path_x->peer_addr) != 0) {
+            DBG_PRINTF("Could not connect the socket of a path, error %d\n", errno);
+            if (!cs->is_initial_socket) {
+                SOCKET_CLOSE(cs->fd);
             }
+            return INVALID_SOCKET;
         }
+        sockets->initial_socket_used |= cs->is_initial_socket;
+        memcpy(&cs->peer_addr, &path_x->peer_addr, sizeof(cs->peer_addr));
+        memcpy(&cs->local_addr, &path_x->local_addr, sizeof(cs->local_addr));
+        sockets->nb_sockets++;
+    } else if (picoquic_compare_addr((struct sockaddr*)&cs->peer_addr, (struct sockaddr*)&path_x->peer_addr) != 0) {
+        if (picoquic_connect_to_peer(cs->fd, (struct sockaddr*)&path_x->peer_addr) != 0) {
+            DBG_PRINTF("Could not connect the socket of a path again, error %d\n", errno);
+            return INVALID_SOCKET;
+        }
+        memcpy(&cs->peer_addr, &path_x->peer_addr, sizeof(cs->peer_addr));
+    } else if (cs->local_addr.ss_family == 0) {
+        /* The local address is learnt from the first packets of the path */
+        memcpy(&cs->local_addr, &path_x->local_addr, sizeof(cs->local_addr));
     }
 
-    return bytes_recv;
+    return cs->fd;
+}
+
+int picoquic_list_connected_sockets(picoquic_connected_sockets_t* sockets, SOCKET_TYPE* fds, int max_fds)
+{
+    int nb_fds = 0;
+
+    for (int i = 0; i < sockets->nb_sockets && nb_fds < max_fds; i++) {
+        if (!sockets->s[i].is_initial_socket) {
+            fds[nb_fds++] = sockets->s[i].fd;
+        }
+    }
+
+    return nb_fds;
+}
+
+void picoquic_close_connected_sockets(picoquic_connected_sockets_t* sockets)
+{
+    while (sockets->nb_sockets > 0) {
+        picoquic_release_connected_socket(sockets, sockets->nb_sockets - 1);
+    }
+}
+
+int picoquic_send_connected(SOCKET_TYPE fd, uint8_t* const* bytes, const size_t* lengths, int nb_packets)
+{
+    int nb_sent = 0;
+#if defined(__linux__)
+    struct mmsghdr msgs[PICOQUIC_MAX_SEND_BATCH];
+    struct iovec iovs[PICOQUIC_MAX_SEND_BATCH];
+
+    if (nb_packets > PICOQUIC_MAX_SEND_BATCH) {
+        nb_packets = PICOQUIC_MAX_SEND_BATCH;
+    }
+    memset(msgs, 0, nb_packets * sizeof(struct mmsghdr));
+    for (int j = 0; j < nb_packets; j++) {
+        iovs[j].iov_base = bytes[j];
+        iovs[j].iov_len = lengths[j];
+        msgs[j].msg_hdr.msg_iov = &iovs[j];
+        msgs[j].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (nb_sent < nb_packets) {
+        int nb = sendmmsg(fd, msgs + nb_sent, nb_packets - nb_sent, 0);
+
+        if (nb <= 0) {
+            DBG_PRINTF("Could not send %d packets on a connected socket, error %d\n", nb_packets - nb_sent, errno);
+            break;
+        }
+        nb_sent += nb;
+    }
+#else
+    while (nb_sent < nb_packets && send(fd, (const char*)bytes[nb_sent], (int)lengths[nb_sent], 0) > 0) {
+        nb_sent++;
+    }
+#endif
+
+    return nb_sent;
+}
+
+#ifndef _WINDOWS
+/* Converts a receive timestamp of the kernel, on CLOCK_REALTIME, to the clock of picoquic_current_time() */
+static uint64_t picoquic_kernel_to_current_time(const struct timespec* ts)
+{
+    struct timespec now_ts;
+    uint64_t now = picoquic_current_time();
+    uint64_t kernel_time = ((uint64_t)ts->tv_sec) * 1000000ull + (uint64_t)ts->tv_nsec / 1000;
+    uint64_t kernel_now;
+
+    if (clock_gettime(CLOCK_REALTIME, &now_ts) != 0) {
+        return 0;
+    }
+    kernel_now = ((uint64_t)now_ts.tv_sec) * 1000000ull + (uint64_t)now_ts.tv_nsec / 1000;
+
+    /* After a step back of the wall clock, the datagram would seem to come from the future */
+    return (kernel_time > kernel_now || kernel_now - kernel_time > now) ? 0 : now - (kernel_now - kernel_time);
 }
+
+/* Get the control information of a received message */
+static void picoquic_parse_recv_control(struct msghdr* msg,
+    struct sockaddr_storage* addr_dest,
+    socklen_t* dest_length,
+    unsigned long* dest_if,
+    int* tos, int* segment_size, uint64_t* rcv_time)
+{
+    struct cmsghdr* cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET) {
+#ifdef SCM_TIMESTAMPING
+            if (cmsg->cmsg_type == SCM_TIMESTAMPING && rcv_time != NULL) {
+                /* The software timestamp comes first, then two that are only set by the hardware */
+                struct timespec ts[3];
+
+                memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+                if (ts[0].tv_sec != 0 || ts[0].tv_nsec != 0) {
+                    *rcv_time = picoquic_kernel_to_current_time(&ts[0]);
+                }
+            }
+#endif
+#ifdef SCM_TIMESTAMPNS
+            if (cmsg->cmsg_type == SCM_TIMESTAMPNS && rcv_time != NULL) {
+                struct timespec ts;
+
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                *rcv_time = picoquic_kernel_to_current_time(&ts);
+            }
+#endif
+        } else if (cmsg->cmsg_level == IPPROTO_IP) {
+#ifdef IP_PKTINFO
+            if (cmsg->cmsg_type == IP_PKTINFO && addr_dest != NULL && dest_length != NULL) {
+                struct in_pktinfo* pPktInfo = (struct in_pktinfo*)CMSG_DATA(cmsg);
+                ((struct sockaddr_in*)addr_dest)->sin_family = AF_INET;
+                ((struct sockaddr_in*)addr_dest)->sin_port = 0;
+                ((struct sockaddr_in*)addr_dest)->sin_addr.s_addr = pPktInfo->ipi_addr.s_addr;
+                *dest_length = sizeof(struct sockaddr_in);
+
+                if (dest_if != NULL) {
+                    *dest_if = pPktInfo->ipi_ifindex;
+                }
+            }
 #else
+        /* The IP_PKTINFO structure is not defined on BSD */
+        if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_RECVDSTADDR)) {
+            if (addr_dest != NULL && dest_length != NULL) {
+                struct in_addr* pPktInfo = (struct in_addr*)CMSG_DATA(cmsg);
+                ((struct sockaddr_in*)addr_dest)->sin_family = AF_INET;
+                ((struct sockaddr_in*)addr_dest)->sin_port = 0;
+                ((struct sockaddr_in*)addr_dest)->sin_addr.s_addr = pPktInfo->s_addr;
+                *dest_length = sizeof(struct sockaddr_in);
+
+                if (dest_if != NULL) {
+                    *dest_if = 0;
+                }
+            }
+#endif
+            if (cmsg->cmsg_type == IP_TOS && tos) {
+                *tos = *(int *) CMSG_DATA(cmsg);
+            }
+        } else if (cmsg->cmsg_level == IPPROTO_IPV6) {
+            if (cmsg->cmsg_type == IPV6_PKTINFO && addr_dest != NULL && dest_length != NULL) {
+                struct in6_pktinfo* pPktInfo6 = (struct in6_pktinfo*)CMSG_DATA(cmsg);
+
+                ((struct sockaddr_in6*)addr_dest)->sin6_family = AF_INET6;
+                ((struct sockaddr_in6*)addr_dest)->sin6_port = 0;
+                memcpy(&((struct sockaddr_in6*)addr_dest)->sin6_addr, &pPktInfo6->ipi6_addr, sizeof(struct in6_addr));
+                *dest_length = sizeof(struct sockaddr_in6);
+
+                if (dest_if != NULL) {
+                    *dest_if = pPktInfo6->ipi6_ifindex;
+                }
+            } else if (cmsg->cmsg_type == IPV6_TCLASS && tos) {
+                    *tos = *(int *) CMSG_DATA(cmsg);
+            }
+        }
+#ifdef UDP_GRO
+        else if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO && segment_size != NULL) {
+            /* Datagrams coalesced by the kernel, all of this size but the last one */
+            *segment_size = *(int *) CMSG_DATA(cmsg);
+        }
+#endif
+    }
+}
+#endif
+
+#ifndef _WINDOWS
+/* Same as picoquic_recvmsg(), also giving the kernel receive time, see picoquic_enable_rx_timestamps() */
+static int picoquic_recvmsg_timed(SOCKET_TYPE fd,
+    struct sockaddr_storage* addr_from,
+    socklen_t* from_length,
+    struct sockaddr_storage* addr_dest,
+    socklen_t* dest_length,
+    unsigned long* dest_if,
+    uint8_t* buffer, int buffer_max,
+    int *tos, uint64_t* rcv_time)
 {
     int bytes_recv = 0;
     struct msghdr msg;
@@ -254,195 +620,178 @@ int picoquic_recvmsg(SOCKET_TYPE fd,
             printf("bytes_recv: %d, err: %s\n", bytes_recv, strerror(errno));
         }
     } else {
-        /* Get the control information */
-        struct cmsghdr* cmsg;
         *from_length = msg.msg_namelen;
-
-        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-            if (cmsg->cmsg_level == IPPROTO_IP) {
-#ifdef IP_PKTINFO
-                if (cmsg->cmsg_type == IP_PKTINFO && addr_dest != NULL && dest_length != NULL) {
-                    struct in_pktinfo* pPktInfo = (struct in_pktinfo*)CMSG_DATA(cmsg);
-                    ((struct sockaddr_in*)addr_dest)->sin_family = AF_INET;
-                    ((struct sockaddr_in*)addr_dest)->sin_port = 0;
-                    ((struct sockaddr_in*)addr_dest)->sin_addr.s_addr = pPktInfo->ipi_addr.s_addr;
-                    *dest_length = sizeof(struct sockaddr_in);
-
-                    if (dest_if != NULL) {
-                        *dest_if = pPktInfo->ipi_ifindex;
-                    }
-                }
-#else
-            /* The IP_PKTINFO structure is not defined on BSD */
-            if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_RECVDSTADDR)) {
-                if (addr_dest != NULL && dest_length != NULL) {
-                    struct in_addr* pPktInfo = (struct in_addr*)CMSG_DATA(cmsg);
-                    ((struct sockaddr_in*)addr_dest)->sin_family = AF_INET;
-                    ((struct sockaddr_in*)addr_dest)->sin_port = 0;
-                    ((struct sockaddr_in*)addr_dest)->sin_addr.s_addr = pPktInfo->s_addr;
-                    *dest_length = sizeof(struct sockaddr_in);
-
-                    if (dest_if != NULL) {
-                        *dest_if = 0;
-                    }
-                }
-#endif
-                if (cmsg->cmsg_type == IP_TOS && tos) {
-                    *tos = *(int *) CMSG_DATA(cmsg);
-                }
-            } else if (cmsg->cmsg_level == IPPROTO_IPV6) {
-                if (cmsg->cmsg_type == IPV6_PKTINFO && addr_dest != NULL && dest_length != NULL) {
-                    struct in6_pktinfo* pPktInfo6 = (struct in6_pktinfo*)CMSG_DATA(cmsg);
-
-                    ((struct sockaddr_in6*)addr_dest)->sin6_family = AF_INET6;
-                    ((struct sockaddr_in6*)addr_dest)->sin6_port = 0;
-                    memcpy(&((struct sockaddr_in6*)addr_dest)->sin6_addr, &pPktInfo6->ipi6_addr, sizeof(struct in6_addr));
-                    *dest_length = sizeof(struct sockaddr_in6);
-
-                    if (dest_if != NULL) {
-                        *dest_if = pPktInfo6->ipi6_ifindex;
-                    }
-                } else if (cmsg->cmsg_type == IPV6_TCLASS && tos) {
-                        *tos = *(int *) CMSG_DATA(cmsg);
-                }
-            }
-        }
+        picoquic_parse_recv_control(&msg, addr_dest, dest_length, dest_if, tos, NULL, rcv_time);
     }
 
     return bytes_recv;
 }
 #endif
 
-int picoquic_sendmsg(SOCKET_TYPE fd,
-    struct sockaddr* addr_dest,
-    socklen_t dest_length,
-    struct sockaddr* addr_from,
-    socklen_t from_length,
-    unsigned long dest_if,
-    const char* bytes, int length)
 #ifdef _WINDOWS
-{
-    GUID WSASendMsg_GUID = WSAID_WSASENDMSG;
-    LPFN_WSASENDMSG WSASendMsg;
-    char cmsg_buffer[1024];
-    int control_length = 0;
-    DWORD NumberOfBytes;
-    int ret = 0;
-    DWORD dwBytesSent = 0;
-    WSAMSG msg;
-    WSABUF dataBuf;
-    int bytes_sent;
-    int last_error;
-    WSACMSGHDR* cmsg;
-
-    ret = WSAIoctl(fd, SIO_GET_EXTENSION_FUNCTION_POINTER,
-        &WSASendMsg_GUID, sizeof WSASendMsg_GUID,
-        &WSASendMsg, sizeof WSASendMsg,
-        &NumberOfBytes, NULL, NULL);
-
-    if (ret == SOCKET_ERROR) {
-        last_error = WSAGetLastError();
-        DBG_PRINTF("Could not initialize WSARecvMsg) on UDP socket %d= %d!\n",
-            (int)fd, last_error);
-        bytes_sent = -1;
-    } else {
-        /* Format the message header */
+/* The Winsock extension functions, loaded once for all the sockets */
+static LPFN_WSARECVMSG picoquic_wsa_recvmsg_fn = NULL;
+static LPFN_WSASENDMSG picoquic_wsa_sendmsg_fn = NULL;
 
-        memset(&msg, 0, sizeof(msg));
-        msg.name = addr_dest;
-        msg.namelen = dest_length;
-        dataBuf.buf = (char*)bytes;
-        dataBuf.len = length;
-        msg.lpBuffers = &dataBuf;
-        msg.dwBufferCount = 1;
-        msg.Control.buf = (char*)cmsg_buffer;
-        msg.Control.len = sizeof(cmsg_buffer);
+static int picoquic_wsa_load_extension(SOCKET_TYPE fd, GUID* guid, void* fn, DWORD fn_size)
+{
+    DWORD NumberOfBytes = 0;
 
-        /* Format the control message */
-        cmsg = WSA_CMSG_FIRSTHDR(&msg);
+    if (WSAIoctl(fd, SIO_GET_EXTENSION_FUNCTION_POINTER, guid, sizeof(GUID), fn, fn_size,
+        &NumberOfBytes, NULL, NULL) == SOCKET_ERROR) {
+        DBG_PRINTF("Could not load a Winsock extension on UDP socket %d = %d!\n", (int)fd, WSAGetLastError());
+        return -1;
+    }
 
-        if (addr_from != NULL && from_length != 0) {
-            if (addr_from->sa_family == AF_INET) {
-                memset(cmsg, 0, WSA_CMSG_SPACE(sizeof(struct in_pktinfo)));
-                cmsg->cmsg_level = IPPROTO_IP;
-                cmsg->cmsg_type = IP_PKTINFO;
-                cmsg->cmsg_len = WSA_CMSG_LEN(sizeof(struct in_pktinfo));
-                struct in_pktinfo* pktinfo = (struct in_pktinfo*)WSA_CMSG_DATA(cmsg);
-                pktinfo->ipi_addr.s_addr = ((struct sockaddr_in*)addr_from)->sin_addr.s_addr;
-                pktinfo->ipi_ifindex = dest_if;
+    return 0;
+}
 
-                control_length += WSA_CMSG_SPACE(sizeof(struct in_pktinfo));
+/* Reads one control message of a received datagram, the destination address or the segment size of the
+ * datagrams coalesced by URO, which are all of that size but the last one */
+static void picoquic_parse_wsa_cmsg(WSACMSGHDR* cmsg, struct sockaddr_storage* addr_dest, socklen_t* dest_length,
+    unsigned long* dest_if, int* segment_size)
+{
+    if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_PKTINFO)) {
+        if (addr_dest != NULL && dest_length != NULL) {
+            IN_PKTINFO* pPktInfo = (IN_PKTINFO*)WSA_CMSG_DATA(cmsg);
+            ((struct sockaddr_in*)addr_dest)->sin_family = AF_INET;
+            ((struct sockaddr_in*)addr_dest)->sin_port = 0;
+            ((struct sockaddr_in*)addr_dest)->sin_addr.s_addr = pPktInfo->ipi_addr.s_addr;
+            *dest_length = sizeof(struct sockaddr_in);
+
+            if (dest_if != NULL) {
+                *dest_if = pPktInfo->ipi_ifindex;
             }
-            else {
-                memset(cmsg, 0, WSA_CMSG_SPACE(sizeof(struct in6_pktinfo)));
-                cmsg->cmsg_level = IPPROTO_IPV6;
-                cmsg->cmsg_type = IPV6_PKTINFO;
-                cmsg->cmsg_len = WSA_CMSG_LEN(sizeof(struct in6_pktinfo));
-                struct in6_pktinfo* pktinfo6 = (struct in6_pktinfo*)WSA_CMSG_DATA(cmsg);
-                memcpy(&pktinfo6->ipi6_addr.u, &((struct sockaddr_in6*)addr_from)->sin6_addr.u, sizeof(IN6_ADDR));
-                pktinfo6->ipi6_ifindex = dest_if;
-
-                control_length += WSA_CMSG_SPACE(sizeof(struct in6_pktinfo));
-            }
-
-            else if (length > PICOQUIC_INITIAL_MTU_IPV4) {
-                struct cmsghdr * cmsg_2 = WSA_CMSG_NXTHDR(&msg, cmsg);
-                if (cmsg_2 == NULL) {
-                    DBG_PRINTF("Cannot obtain second CMSG (control_length: %d)\n", control_length);
-                }
-                else {
-                    int val = 1;
-                    cmsg_2->cmsg_level = IPPROTO_IP;
-                    cmsg_2->cmsg_type = IP_DONTFRAGMENT;
-                    cmsg_2->cmsg_len = WSA_CMSG_LEN(sizeof(int));
-                    *((int *)WSA_CMSG_DATA(cmsg_2)) = val;
-                    control_length += WSA_CMSG_SPACE(sizeof(int));
-                }
+        }
+    } else if ((cmsg->cmsg_level == IPPROTO_IPV6) && (cmsg->cmsg_type == IPV6_PKTINFO)) {
+        if (addr_dest != NULL && dest_length != NULL) {
+            IN6_PKTINFO* pPktInfo6 = (IN6_PKTINFO*)WSA_CMSG_DATA(cmsg);
+            ((struct sockaddr_in6*)addr_dest)->sin6_family = AF_INET6;
+            ((struct sockaddr_in6*)addr_dest)->sin6_port = 0;
+            memcpy(&((struct sockaddr_in6*)addr_dest)->sin6_addr, &pPktInfo6->ipi6_addr, sizeof(IN6_ADDR));
+            *dest_length = sizeof(struct sockaddr_in6);
+
+            if (dest_if != NULL) {
+                *dest_if = pPktInfo6->ipi6_ifindex;
             }
         }
-
-        msg.Control.len = control_length;
-        if (control_length == 0) {
-            msg.Control.buf = NULL;
+    }
+#ifdef UDP_COALESCED_INFO
+    else if ((cmsg->cmsg_level == IPPROTO_UDP) && (cmsg->cmsg_type == UDP_COALESCED_INFO)) {
+        if (segment_size != NULL) {
+            *segment_size = (int)*(PDWORD)WSA_CMSG_DATA(cmsg);
         }
+    }
+#endif
+}
 
-        /* Send the message */
+static int picoquic_wsa_recvmsg(SOCKET_TYPE fd,
+    struct sockaddr_storage* addr_from,
+    socklen_t* from_length,
+    struct sockaddr_storage* addr_dest,
+    socklen_t* dest_length,
+    unsigned long* dest_if,
+    uint8_t* buffer, int buffer_max,
+    int* segment_size)
+{
+    GUID WSARecvMsg_GUID = WSAID_WSARECVMSG;
+    char cmsg_buffer[1024];
+    DWORD NumberOfBytes;
+    WSAMSG msg;
+    WSABUF dataBuf;
+    int recv_ret = 0;
+    int bytes_recv;
+    int last_error;
 
-        ret = WSASendMsg(fd, &msg, 0, &dwBytesSent, NULL, NULL);
+    if (dest_length != NULL) {
+        *dest_length = 0;
+    }
 
-        if (ret != 0) {
-            bytes_sent = -1;
+    if (dest_if != NULL) {
+        *dest_if = 0;
+    }
+
+    if (segment_size != NULL) {
+        *segment_size = 0;
+    }
+
+    if (picoquic_wsa_recvmsg_fn == NULL &&
+        picoquic_wsa_load_extension(fd, &WSARecvMsg_GUID, &picoquic_wsa_recvmsg_fn, sizeof(picoquic_wsa_recvmsg_fn)) != 0) {
+        bytes_recv = -1;
+        *from_length = 0;
+    } else {
+        dataBuf.buf = (char*)buffer;
+        dataBuf.len = buffer_max;
+
+        msg.name = (struct sockaddr*)addr_from;
+        msg.namelen = *from_length;
+        msg.lpBuffers = &dataBuf;
+        msg.dwBufferCount = 1;
+        msg.dwFlags = 0;
+        msg.Control.buf = cmsg_buffer;
+        msg.Control.len = sizeof(cmsg_buffer);
+
+        recv_ret = picoquic_wsa_recvmsg_fn(fd, &msg, &NumberOfBytes, NULL, NULL);
+
+        if (recv_ret != 0) {
+            last_error = WSAGetLastError();
+            DBG_PRINTF("Could not receive message (WSARecvMsg) on UDP socket %d = %d!\n",
+                (int)fd, last_error);
+            bytes_recv = -1;
+            *from_length = 0;
         } else {
-            bytes_sent = (int)dwBytesSent;
+            WSACMSGHDR* cmsg;
+
+            bytes_recv = NumberOfBytes;
+            *from_length = msg.namelen;
+
+            /* Get the control information */
+            for (cmsg = WSA_CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = WSA_CMSG_NXTHDR(&msg, cmsg)) {
+                picoquic_parse_wsa_cmsg(cmsg, addr_dest, dest_length, dest_if, segment_size);
+            }
         }
     }
 
-    return bytes_sent;
+    return bytes_recv;
+}
+#endif
+
+int picoquic_recvmsg(SOCKET_TYPE fd,
+    struct sockaddr_storage* addr_from,
+    socklen_t* from_length,
+    struct sockaddr_storage* addr_dest,
+    socklen_t* dest_length,
+    unsigned long* dest_if,
+    uint8_t* buffer, int buffer_max,
+    int *tos)
+#ifdef _WINDOWS
+{
+    (void)tos;
+    return picoquic_wsa_recvmsg(fd, addr_from, from_length, addr_dest, dest_length, dest_if, buffer, buffer_max, NULL);
 }
 #else
 {
-    struct msghdr msg;
-    struct iovec dataBuf;
-    char cmsg_buffer[1024];
-    int control_length = 0;
-    int bytes_sent;
-    struct cmsghdr* cmsg;
-
-    /* Format the message header */
+    return picoquic_recvmsg_timed(fd, addr_from, from_length, addr_dest, dest_length, dest_if, buffer, buffer_max, tos, NULL);
+}
+#endif
 
-    dataBuf.iov_base = (char*)bytes;
-    dataBuf.iov_len = length;
+#ifndef _WINDOWS
+#define PICOQUIC_SEND_CONTROL_SIZE 1024
 
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = addr_dest;
-    msg.msg_namelen = dest_length;
-    msg.msg_iov = &dataBuf;
-    msg.msg_iovlen = 1;
-    msg.msg_control = (void*)cmsg_buffer;
-    msg.msg_controllen = sizeof(cmsg_buffer);
+/* Formats the control data of a message to send, in msg_control which holds PICOQUIC_SEND_CONTROL_SIZE bytes.
+ * A non zero segment_size asks the kernel to split the datagram in segments of that size.
+ * A non zero txtime, in nanoseconds of CLOCK_MONOTONIC, holds it until then, if SO_TXTIME is set on the socket. */
+static void picoquic_format_send_control(struct msghdr* msg,
+    struct sockaddr* addr_from,
+    socklen_t from_length,
+    unsigned long dest_if,
+    int length, int segment_size, uint64_t txtime)
+{
+    int control_length = 0;
+    struct cmsghdr* cmsg;
 
-    /* Format the control message */
-    cmsg = CMSG_FIRSTHDR(&msg);
+    msg->msg_controllen = PICOQUIC_SEND_CONTROL_SIZE;
+    cmsg = CMSG_FIRSTHDR(msg);
 
     if (addr_from != NULL && from_length != 0) {
         if (addr_from->sa_family == AF_INET) {
@@ -486,7 +835,7 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
             struct cmsghdr * cmsg_2 = (struct cmsghdr *)((unsigned char *)cmsg + CMSG_ALIGN(cmsg->cmsg_len));
             {
 #else
-            struct cmsghdr * cmsg_2 = CMSG_NXTHDR((&msg), cmsg);
+            struct cmsghdr * cmsg_2 = CMSG_NXTHDR(msg, cmsg);
             if (cmsg_2 == NULL) {
                 DBG_PRINTF("Cannot obtain second CMSG (control_length: %d)\n", control_length);
             }
@@ -516,7 +865,7 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
             struct cmsghdr * cmsg_2 = (struct cmsghdr *)((unsigned char *)cmsg $
             {
 #else
-            struct cmsghdr * cmsg_2 = CMSG_NXTHDR((&msg), cmsg);
+            struct cmsghdr * cmsg_2 = CMSG_NXTHDR(msg, cmsg);
             if (cmsg_2 == NULL) {
                 DBG_PRINTF("Cannot obtain second CMSG (control_length: %d)\n", $
             }
@@ -538,214 +887,2182 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
 
     }
 
-    msg.msg_controllen = control_length;
+#ifdef UDP_SEGMENT
+    if (segment_size > 0 && segment_size < length) {
+        uint16_t val = (uint16_t)segment_size;
+        if (control_length > 0) {
+            cmsg = CMSG_NXTHDR(msg, cmsg);
+        }
+        memset(cmsg, 0, CMSG_SPACE(sizeof(uint16_t)));
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(cmsg), &val, sizeof(uint16_t));
+        control_length += CMSG_SPACE(sizeof(uint16_t));
+    }
+#endif
+#ifdef SCM_TXTIME
+    if (txtime != 0) {
+        if (control_length > 0) {
+            cmsg = CMSG_NXTHDR(msg, cmsg);
+        }
+        memset(cmsg, 0, CMSG_SPACE(sizeof(uint64_t)));
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_TXTIME;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+        memcpy(CMSG_DATA(cmsg), &txtime, sizeof(uint64_t));
+        control_length += CMSG_SPACE(sizeof(uint64_t));
+    }
+#else
+    (void)txtime;
+#endif
+
+    msg->msg_controllen = control_length;
     if (control_length == 0) {
-        msg.msg_control = NULL;
+        msg->msg_control = NULL;
     }
+}
 
-    bytes_sent = sendmsg(fd, &msg, 0);
+static int picoquic_sendmsg_segments(SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    socklen_t dest_length,
+    struct sockaddr* addr_from,
+    socklen_t from_length,
+    unsigned long dest_if,
+    const char* bytes, int length, int segment_size, uint64_t txtime)
+{
+    struct msghdr msg;
+    struct iovec dataBuf;
+    char cmsg_buffer[PICOQUIC_SEND_CONTROL_SIZE];
 
-    return bytes_sent;
+    dataBuf.iov_base = (char*)bytes;
+    dataBuf.iov_len = length;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = addr_dest;
+    msg.msg_namelen = dest_length;
+    msg.msg_iov = &dataBuf;
+    msg.msg_iovlen = 1;
+    msg.msg_control = (void*)cmsg_buffer;
+    picoquic_format_send_control(&msg, addr_from, from_length, dest_if, length, segment_size, txtime);
+
+    return (int)sendmsg(fd, &msg, 0);
 }
-#endif
+#else
+#define PICOQUIC_SEND_CONTROL_SIZE 256
 
-int picoquic_select(SOCKET_TYPE* sockets,
-    int nb_sockets,
-    struct sockaddr_storage* addr_from,
-    socklen_t* from_length,
-    struct sockaddr_storage* addr_dest,
-    socklen_t* dest_length,
-    unsigned long* dest_if,
-    uint8_t* buffer, int buffer_max,
-    int64_t delta_t,
-    uint64_t* current_time,
-    picoquic_quic_t* quic)
+/* Formats the control data of a message to send on Windows, in control which holds PICOQUIC_SEND_CONTROL_SIZE
+ * bytes, and returns its length. A segment_size asks for UDP segmentation offload (USO), as UDP_SEGMENT does. */
+static ULONG picoquic_format_wsa_send_control(char* control, struct sockaddr* addr_from, socklen_t from_length,
+    unsigned long dest_if, int length, int segment_size)
 {
-    fd_set readfds;
-    struct timeval tv;
-    int ret_select = 0;
-    int bytes_recv = 0;
-    int sockmax = 0;
+    WSACMSGHDR* cmsg = (WSACMSGHDR*)control;
+    ULONG control_length = 0;
 
-    FD_ZERO(&readfds);
+    memset(control, 0, PICOQUIC_SEND_CONTROL_SIZE);
 
-    for (int i = 0; i < nb_sockets; i++) {
-        if (sockmax < (int)sockets[i]) {
-            sockmax = (int)sockets[i];
-        }
-        FD_SET(sockets[i], &readfds);
-    }
+    if (addr_from != NULL && from_length != 0) {
+        if (addr_from->sa_family == AF_INET) {
+            struct in_pktinfo* pktinfo = (struct in_pktinfo*)WSA_CMSG_DATA(cmsg);
 
-    if (delta_t <= 0) {
-        tv.tv_sec = 0;
-        tv.tv_usec = 0;
-    } else {
-        if (delta_t > 10000000) {
-            tv.tv_sec = (long)10;
-            tv.tv_usec = 0;
+            cmsg->cmsg_level = IPPROTO_IP;
+            cmsg->cmsg_type = IP_PKTINFO;
+            cmsg->cmsg_len = WSA_CMSG_LEN(sizeof(struct in_pktinfo));
+            pktinfo->ipi_addr.s_addr = ((struct sockaddr_in*)addr_from)->sin_addr.s_addr;
+            pktinfo->ipi_ifindex = dest_if;
+            control_length += (ULONG)WSA_CMSG_SPACE(sizeof(struct in_pktinfo));
+
+            if (length > PICOQUIC_INITIAL_MTU_IPV4) {
+                cmsg = (WSACMSGHDR*)(control + control_length);
+                cmsg->cmsg_level = IPPROTO_IP;
+                cmsg->cmsg_type = IP_DONTFRAGMENT;
+                cmsg->cmsg_len = WSA_CMSG_LEN(sizeof(int));
+                *((int*)WSA_CMSG_DATA(cmsg)) = 1;
+                control_length += (ULONG)WSA_CMSG_SPACE(sizeof(int));
+            }
         } else {
-            tv.tv_sec = (long)(delta_t / 1000000);
-            tv.tv_usec = (long)(delta_t % 1000000);
+            struct in6_pktinfo* pktinfo6 = (struct in6_pktinfo*)WSA_CMSG_DATA(cmsg);
+
+            cmsg->cmsg_level = IPPROTO_IPV6;
+            cmsg->cmsg_type = IPV6_PKTINFO;
+            cmsg->cmsg_len = WSA_CMSG_LEN(sizeof(struct in6_pktinfo));
+            memcpy(&pktinfo6->ipi6_addr.u, &((struct sockaddr_in6*)addr_from)->sin6_addr.u, sizeof(IN6_ADDR));
+            pktinfo6->ipi6_ifindex = dest_if;
+            control_length += (ULONG)WSA_CMSG_SPACE(sizeof(struct in6_pktinfo));
         }
     }
+#ifdef UDP_SEND_MSG_SIZE
+    if (segment_size > 0) {
+        cmsg = (WSACMSGHDR*)(control + control_length);
+        cmsg->cmsg_level = IPPROTO_UDP;
+        cmsg->cmsg_type = UDP_SEND_MSG_SIZE;
+        cmsg->cmsg_len = WSA_CMSG_LEN(sizeof(DWORD));
+        *((PDWORD)WSA_CMSG_DATA(cmsg)) = (DWORD)segment_size;
+        control_length += (ULONG)WSA_CMSG_SPACE(sizeof(DWORD));
+    }
+#else
+    (void)segment_size;
+#endif
 
-select_retry:
-    ret_select = select(sockmax + 1, &readfds, NULL, NULL, &tv);
+    return control_length;
+}
 
-    if (ret_select < 0) {
-        bytes_recv = -1;
-        if (bytes_recv <= 0) {
-            DBG_PRINTF("Error: select returns %d, error: %s\n", ret_select, strerror(errno));
-            if (errno == EINTR) {
-                bytes_recv = 0;
-                goto select_retry;
-            }
-        }
-    } else if (ret_select > 0) {
-        for (int i = 0; i < nb_sockets; i++) {
-            if (FD_ISSET(sockets[i], &readfds)) {
-                struct stat statbuf;
-                fstat(sockets[i], &statbuf);
-                if (S_ISSOCK(statbuf.st_mode)) {
-                    bytes_recv = picoquic_recvmsg(sockets[i], addr_from, from_length,
-                                                  addr_dest, dest_length, dest_if,
-                                                  buffer, buffer_max, &quic->rcv_tos);
-                } else {
-                    bytes_recv = (int) read(sockets[i], buffer, (size_t) buffer_max);
-                }
-                // bytes_recv = recvfrom(socket[i], buffer, buffer_max, 0, addr_from, from_length);
+static int picoquic_sendmsg_segments(SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    socklen_t dest_length,
+    struct sockaddr* addr_from,
+    socklen_t from_length,
+    unsigned long dest_if,
+    const char* bytes, int length, int segment_size, uint64_t txtime)
+{
+    GUID WSASendMsg_GUID = WSAID_WSASENDMSG;
+    char cmsg_buffer[PICOQUIC_SEND_CONTROL_SIZE];
+    DWORD dwBytesSent = 0;
+    WSAMSG msg;
+    WSABUF dataBuf;
 
-                if (bytes_recv <= 0) {
-#ifdef _WINDOWS
-                    int last_error = WSAGetLastError();
+    (void)txtime; /* No SO_TXTIME on Windows */
 
-                    if (last_error == WSAECONNRESET || last_error == WSAEMSGSIZE) {
-                        bytes_recv = 0;
-                        continue;
-                    }
-#endif
-                    DBG_PRINTF("Could not receive packet on UDP socket[%d]= %d!\n",
-                        i, (int)sockets[i]);
-                    break;
-                } else {
-                    if (quic) {
-                        quic->rcv_socket = sockets[i];
-                    }
-                    break;
-                }
-            }
-        }
+    if (picoquic_wsa_sendmsg_fn == NULL &&
+        picoquic_wsa_load_extension(fd, &WSASendMsg_GUID, &picoquic_wsa_sendmsg_fn, sizeof(picoquic_wsa_sendmsg_fn)) != 0) {
+        return -1;
     }
 
-exit:
-    *current_time = picoquic_current_time();
+    memset(&msg, 0, sizeof(msg));
+    msg.name = addr_dest;
+    msg.namelen = dest_length;
+    dataBuf.buf = (char*)bytes;
+    dataBuf.len = length;
+    msg.lpBuffers = &dataBuf;
+    msg.dwBufferCount = 1;
+    msg.Control.buf = cmsg_buffer;
+    msg.Control.len = picoquic_format_wsa_send_control(cmsg_buffer, addr_from, from_length, dest_if, length, segment_size);
+    if (msg.Control.len == 0) {
+        msg.Control.buf = NULL;
+    }
 
-    return bytes_recv;
+    return (picoquic_wsa_sendmsg_fn(fd, &msg, 0, &dwBytesSent, NULL, NULL) != 0) ? -1 : (int)dwBytesSent;
 }
+#endif
 
-int picoquic_send_through_server_sockets(
-    picoquic_server_sockets_t* sockets,
-    struct sockaddr* addr_dest, socklen_t dest_length,
-    struct sockaddr* addr_from, socklen_t from_length, unsigned long from_if,
+int picoquic_sendmsg(SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    socklen_t dest_length,
+    struct sockaddr* addr_from,
+    socklen_t from_length,
+    unsigned long dest_if,
     const char* bytes, int length)
 {
-    /* Both Linux and Windows use separate sockets for V4 and V6 */
-#ifndef NS3
-    int socket_index = (addr_dest->sa_family == AF_INET) ? 1 : 0;
+    return picoquic_sendmsg_segments(fd, addr_dest, dest_length, addr_from, from_length, dest_if, bytes, length, 0, 0);
+}
+
+/* Converts a departure time, on the clock of picoquic_current_time(), to the clock of SO_TXTIME.
+ * Returns 0 if the datagram can leave now. */
+static uint64_t picoquic_departure_to_txtime(uint64_t departure_time)
+{
+    uint64_t txtime = 0;
+#if defined(SCM_TXTIME) && defined(CLOCK_MONOTONIC)
+    uint64_t now = picoquic_current_time();
+
+    if (departure_time > now) {
+        struct timespec ts;
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+            txtime = ((uint64_t)ts.tv_sec) * 1000000000ull + (uint64_t)ts.tv_nsec + (departure_time - now) * 1000ull;
+        }
+    }
 #else
-    int socket_index = 0;
+    (void)departure_time;
 #endif
+    return txtime;
+}
 
-    int sent = picoquic_sendmsg(sockets->s_socket[socket_index], addr_dest, dest_length,
-        addr_from, from_length, from_if, bytes, length);
-
-#ifndef DISABLE_DEBUG_PRINTF
-    if (sent <= 0) {
+#if defined(UDP_SEGMENT) || defined(UDP_SEND_MSG_SIZE)
+/* Whether the last send failed because UDP segmentation is not supported, by the system or by the NIC */
+static int picoquic_gso_refused(void)
+{
 #ifdef _WINDOWS
-        int last_error = WSAGetLastError();
+    int last_error = WSAGetLastError();
+
+    return last_error == WSAEINVAL || last_error == WSAEOPNOTSUPP || last_error == WSAENOPROTOOPT;
 #else
-        int last_error = errno;
+    /* EIO is returned when the NIC cannot checksum the segments, the others by kernels without GSO */
+    return errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP;
 #endif
-        DBG_PRINTF("Could not send packet on UDP socket[%d]= %d!\n",
-            socket_index, last_error);
-        DBG_PRINTF("Dest address length: %d, family: %d.\n",
-            dest_length, addr_dest->sa_family);
+}
+#endif
+
+int picoquic_sendmsg_gso(SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    socklen_t dest_length,
+    struct sockaddr* addr_from,
+    socklen_t from_length,
+    unsigned long dest_if,
+    const char* bytes, int length, int segment_size, uint64_t departure_time, int* gso_disabled)
+{
+    int bytes_sent = 0;
+    uint64_t txtime = (departure_time == 0) ? 0 : picoquic_departure_to_txtime(departure_time);
+
+    if (segment_size <= 0) {
+        segment_size = length;
+    }
+#if defined(UDP_SEGMENT) || defined(UDP_SEND_MSG_SIZE)
+    if (segment_size < length && (gso_disabled == NULL || !*gso_disabled)) {
+        bytes_sent = picoquic_sendmsg_segments(fd, addr_dest, dest_length, addr_from, from_length, dest_if,
+            bytes, length, segment_size, txtime);
+        if (bytes_sent >= 0 || !picoquic_gso_refused()) {
+            return bytes_sent;
+        }
+        DBG_PRINTF("%s", "UDP segmentation refused, sending the segments one by one\n");
+        if (gso_disabled != NULL) {
+            *gso_disabled = 1;
+        }
+        bytes_sent = 0;
     }
 #endif
 
-    return sent;
+    for (int offset = 0; offset < length; offset += segment_size) {
+        int sent = picoquic_sendmsg_segments(fd, addr_dest, dest_length, addr_from, from_length, dest_if,
+            bytes + offset, (length - offset < segment_size) ? length - offset : segment_size, 0, txtime);
+        if (sent < 0) {
+            return (bytes_sent > 0) ? bytes_sent : sent;
+        }
+        bytes_sent += sent;
+    }
+
+    return bytes_sent;
 }
 
-int picoquic_get_server_address(const char* ip_address_text, int server_port,
-    struct sockaddr_storage* server_address,
-    int* server_addr_length,
-    int* is_name)
+/* Waits for up to delta_t microseconds until one of the sockets is readable */
+static int picoquic_select_wait(SOCKET_TYPE* sockets, int nb_sockets, int64_t delta_t, fd_set* readfds)
 {
-    int ret = 0;
-    struct sockaddr_in* ipv4_dest = (struct sockaddr_in*)server_address;
-    struct sockaddr_in6* ipv6_dest = (struct sockaddr_in6*)server_address;
-
-    /* get the IP address of the server */
-    memset(server_address, 0, sizeof(struct sockaddr_storage));
-    *is_name = 0;
-    *server_addr_length = 0;
+    struct timeval tv;
+    int ret_select = 0;
+    int sockmax = 0;
 
-    if (inet_pton(AF_INET, ip_address_text, &ipv4_dest->sin_addr) == 1) {
-        /* Valid IPv4 address */
-        ipv4_dest->sin_family = AF_INET;
-        ipv4_dest->sin_port = htons((unsigned short)server_port);
-        *server_addr_length = sizeof(struct sockaddr_in);
-    } else if (inet_pton(AF_INET6, ip_address_text, &ipv6_dest->sin6_addr) == 1) {
-        /* Valid IPv6 address */
-        ipv6_dest->sin6_family = AF_INET6;
-        ipv6_dest->sin6_port = htons((unsigned short)server_port);
-        *server_addr_length = sizeof(struct sockaddr_in6);
-    } else {
-        /* Server is described by name. Do a lookup for the IP address,
-        * and then use the name as SNI parameter */
-        struct addrinfo* result = NULL;
-        struct addrinfo hints;
+    do {
+        FD_ZERO(readfds);
 
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_DGRAM;
-        hints.ai_protocol = IPPROTO_UDP;
+        for (int i = 0; i < nb_sockets; i++) {
+            if (sockmax < (int)sockets[i]) {
+                sockmax = (int)sockets[i];
+            }
+            FD_SET(sockets[i], readfds);
+        }
 
-        if (getaddrinfo(ip_address_text, NULL, &hints, &result) != 0) {
-            fprintf(stderr, "Cannot get IP address for %s\n", ip_address_text);
-            ret = -1;
+        if (delta_t <= 0) {
+            tv.tv_sec = 0;
+            tv.tv_usec = 0;
         } else {
-            *is_name = 1;
+            if (delta_t > 10000000) {
+                tv.tv_sec = (long)10;
+                tv.tv_usec = 0;
+            } else {
+                tv.tv_sec = (long)(delta_t / 1000000);
+                tv.tv_usec = (long)(delta_t % 1000000);
+            }
+        }
 
-            switch (result->ai_family) {
-            case AF_INET:
-                ipv4_dest->sin_family = AF_INET;
-                ipv4_dest->sin_port = htons((unsigned short)server_port);
+        ret_select = select(sockmax + 1, readfds, NULL, NULL, &tv);
+
+        if (ret_select < 0) {
+            DBG_PRINTF("Error: select returns %d, error: %s\n", ret_select, strerror(errno));
+        }
+    } while (ret_select < 0 && errno == EINTR);
+
+    return ret_select;
+}
+
+int picoquic_select(SOCKET_TYPE* sockets,
+    int nb_sockets,
+    struct sockaddr_storage* addr_from,
+    socklen_t* from_length,
+    struct sockaddr_storage* addr_dest,
+    socklen_t* dest_length,
+    unsigned long* dest_if,
+    uint8_t* buffer, int buffer_max,
+    int64_t delta_t,
+    uint64_t* current_time,
+    picoquic_quic_t* quic)
+{
+    fd_set readfds;
+    int ret_select = 0;
+    int bytes_recv = 0;
+
+    ret_select = picoquic_select_wait(sockets, nb_sockets, delta_t, &readfds);
+
+    if (ret_select < 0) {
+        bytes_recv = -1;
+    } else if (ret_select > 0) {
+        for (int i = 0; i < nb_sockets; i++) {
+            if (FD_ISSET(sockets[i], &readfds)) {
+                struct stat statbuf;
+                fstat(sockets[i], &statbuf);
+                if (S_ISSOCK(statbuf.st_mode)) {
 #ifdef _WINDOWS
-                ipv4_dest->sin_addr.S_un.S_addr = ((struct sockaddr_in*)result->ai_addr)->sin_addr.S_un.S_addr;
+                    bytes_recv = picoquic_recvmsg(sockets[i], addr_from, from_length,
+                                                  addr_dest, dest_length, dest_if,
+                                                  buffer, buffer_max, &quic->rcv_tos);
 #else
-                ipv4_dest->sin_addr.s_addr = ((struct sockaddr_in*)result->ai_addr)->sin_addr.s_addr;
+                    quic->rcv_time = 0;
+                    bytes_recv = picoquic_recvmsg_timed(sockets[i], addr_from, from_length,
+                                                  addr_dest, dest_length, dest_if,
+                                                  buffer, buffer_max, &quic->rcv_tos, &quic->rcv_time);
 #endif
-                *server_addr_length = sizeof(struct sockaddr_in);
-                break;
-            case AF_INET6:
-                ipv6_dest->sin6_family = AF_INET6;
-                ipv6_dest->sin6_port = htons((unsigned short)server_port);
-                memcpy(&ipv6_dest->sin6_addr,
-                    &((struct sockaddr_in6*)result->ai_addr)->sin6_addr,
-                    sizeof(ipv6_dest->sin6_addr));
-                *server_addr_length = sizeof(struct sockaddr_in6);
-                break;
-            default:
-                fprintf(stderr, "Error getting IPv6 address for %s, family = %d\n",
-                    ip_address_text, result->ai_family);
-                ret = -1;
-                break;
+                } else {
+                    bytes_recv = (int) read(sockets[i], buffer, (size_t) buffer_max);
+                }
+                // bytes_recv = recvfrom(socket[i], buffer, buffer_max, 0, addr_from, from_length);
+
+                if (bytes_recv <= 0) {
+#ifdef _WINDOWS
+                    int last_error = WSAGetLastError();
+
+                    if (last_error == WSAECONNRESET || last_error == WSAEMSGSIZE) {
+                        bytes_recv = 0;
+                        continue;
+                    }
+#endif
+                    DBG_PRINTF("Could not receive packet on UDP socket[%d]= %d!\n",
+                        i, (int)sockets[i]);
+                    break;
+                } else {
+                    if (quic) {
+                        quic->rcv_socket = sockets[i];
+                    }
+                    break;
+                }
             }
+        }
+    }
 
-            freeaddrinfo(result);
+exit:
+    *current_time = (quic != NULL) ? picoquic_refresh_time(quic) : picoquic_current_time();
+
+    return bytes_recv;
+}
+
+/* Receives the datagrams waiting on fd, without blocking. Returns their number, or -1 on error */
+static int picoquic_recv_batch(SOCKET_TYPE fd, picoquic_recv_datagram_t* datagrams, int max_datagrams,
+    uint8_t* buffer, size_t datagram_buffer_size)
+{
+    int nb_received = 0;
+    struct stat statbuf;
+
+    for (int j = 0; j < max_datagrams; j++) {
+        memset(&datagrams[j], 0, sizeof(picoquic_recv_datagram_t));
+        datagrams[j].socket = fd;
+        datagrams[j].bytes = buffer + j * datagram_buffer_size;
+    }
+
+    fstat(fd, &statbuf);
+    if (!S_ISSOCK(statbuf.st_mode)) {
+        nb_received = (int)read(fd, datagrams[0].bytes, datagram_buffer_size);
+        if (nb_received > 0) {
+            datagrams[0].length = nb_received;
+            nb_received = 1;
+        }
+    } else {
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+        struct mmsghdr msgs[PICOQUIC_MAX_RECV_BATCH];
+        struct iovec iovs[PICOQUIC_MAX_RECV_BATCH];
+        char cmsg_buffers[PICOQUIC_MAX_RECV_BATCH][256];
+
+        if (max_datagrams > PICOQUIC_MAX_RECV_BATCH) {
+            max_datagrams = PICOQUIC_MAX_RECV_BATCH;
+        }
+        memset(msgs, 0, max_datagrams * sizeof(struct mmsghdr));
+        for (int j = 0; j < max_datagrams; j++) {
+            iovs[j].iov_base = datagrams[j].bytes;
+            iovs[j].iov_len = datagram_buffer_size;
+            msgs[j].msg_hdr.msg_name = &datagrams[j].addr_from;
+            msgs[j].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+            msgs[j].msg_hdr.msg_iov = &iovs[j];
+            msgs[j].msg_hdr.msg_iovlen = 1;
+            msgs[j].msg_hdr.msg_control = cmsg_buffers[j];
+            msgs[j].msg_hdr.msg_controllen = sizeof(cmsg_buffers[j]);
+        }
+
+        nb_received = recvmmsg(fd, msgs, max_datagrams, MSG_DONTWAIT, NULL);
+        for (int j = 0; j < nb_received; j++) {
+            datagrams[j].from_length = msgs[j].msg_hdr.msg_namelen;
+            datagrams[j].length = (int)msgs[j].msg_len;
+            picoquic_parse_recv_control(&msgs[j].msg_hdr, &datagrams[j].addr_dest, &datagrams[j].dest_length,
+                &datagrams[j].dest_if, &datagrams[j].tos, &datagrams[j].segment_size, &datagrams[j].rcv_time);
+            if (datagrams[j].segment_size >= datagrams[j].length) {
+                datagrams[j].segment_size = 0;
+            }
+        }
+#else
+        datagrams[0].from_length = sizeof(struct sockaddr_storage);
+#ifdef _WINDOWS
+        nb_received = picoquic_wsa_recvmsg(fd, &datagrams[0].addr_from, &datagrams[0].from_length,
+            &datagrams[0].addr_dest, &datagrams[0].dest_length, &datagrams[0].dest_if,
+            datagrams[0].bytes, (int)datagram_buffer_size, &datagrams[0].segment_size);
+        if (datagrams[0].segment_size >= nb_received) {
+            datagrams[0].segment_size = 0;
+        }
+#else
+        nb_received = picoquic_recvmsg_timed(fd, &datagrams[0].addr_from, &datagrams[0].from_length,
+            &datagrams[0].addr_dest, &datagrams[0].dest_length, &datagrams[0].dest_if,
+            datagrams[0].bytes, (int)datagram_buffer_size, &datagrams[0].tos, &datagrams[0].rcv_time);
+#endif
+        if (nb_received > 0) {
+            datagrams[0].length = nb_received;
+            nb_received = 1;
+        }
+#endif
+    }
+
+    return nb_received;
+}
+
+/* Adds the datagrams waiting on a ready socket to the batch. Returns -1 if the batch should stop there */
+static int picoquic_recv_ready_socket(SOCKET_TYPE fd, picoquic_recv_datagram_t* datagrams, int max_datagrams,
+    uint8_t* buffer, size_t datagram_buffer_size, int* nb_received)
+{
+    int nb = picoquic_recv_batch(fd, datagrams + *nb_received, max_datagrams - *nb_received,
+        buffer + *nb_received * datagram_buffer_size, datagram_buffer_size);
+
+    if (nb <= 0) {
+#ifdef _WINDOWS
+        int last_error = WSAGetLastError();
+
+        if (last_error == WSAECONNRESET || last_error == WSAEMSGSIZE) {
+            return 0;
+        }
+#endif
+        DBG_PRINTF("Could not receive packet on UDP socket %d!\n", (int)fd);
+        if (*nb_received == 0) {
+            *nb_received = -1;
+        }
+        return -1;
+    }
+    *nb_received += nb;
+
+    return 0;
+}
+
+int picoquic_select_batch(SOCKET_TYPE* sockets,
+    int nb_sockets,
+    picoquic_recv_datagram_t* datagrams, int max_datagrams,
+    uint8_t* buffer, size_t datagram_buffer_size,
+    int64_t delta_t,
+    uint64_t* current_time)
+{
+    fd_set readfds;
+    int ret_select = picoquic_select_wait(sockets, nb_sockets, delta_t, &readfds);
+    int nb_received = (ret_select < 0) ? -1 : 0;
+
+    for (int i = 0; ret_select > 0 && i < nb_sockets && nb_received < max_datagrams; i++) {
+        if (FD_ISSET(sockets[i], &readfds) &&
+            picoquic_recv_ready_socket(sockets[i], datagrams, max_datagrams, buffer, datagram_buffer_size, &nb_received) != 0) {
+            break;
+        }
+    }
+
+    *current_time = picoquic_current_time();
+
+    return nb_received;
+}
+
+/*
+ * Persistent event loop. The sockets are registered once, so that a wake up only costs
+ * the number of ready sockets with epoll or kqueue. Elsewhere, the registered sockets
+ * are passed to select() at each wake up.
+ */
+struct st_picoquic_event_loop_t {
+    int event_fd; /* epoll or kqueue descriptor */
+    SOCKET_TYPE* sockets;
+    int nb_sockets;
+    int max_sockets;
+    uint64_t spin_budget; /* Microseconds of polling before blocking, 0 to block at once */
+    int busy_poll_usec;
+    picoquic_quic_t* quic; /* Which cached time to refresh, if any */
+};
+
+static int picoquic_set_busy_poll(SOCKET_TYPE fd, int busy_poll_usec)
+{
+#if defined(SO_BUSY_POLL) && defined(__linux__)
+    int ret = setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, (char*)&busy_poll_usec, sizeof(int));
+#ifdef SO_PREFER_BUSY_POLL
+    if (ret == 0) {
+        int val = 1;
+        ret = setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, (char*)&val, sizeof(int));
+    }
+#endif
+    if (ret != 0) {
+        DBG_PRINTF("Cannot set socket %d to busy poll, error: %s\n", (int)fd, strerror(errno));
+    }
+    return ret;
+#else
+    (void)fd;
+    (void)busy_poll_usec;
+    return -1;
+#endif
+}
+
+picoquic_event_loop_t* picoquic_event_loop_create()
+{
+    picoquic_event_loop_t* loop = (picoquic_event_loop_t*)calloc(1, sizeof(picoquic_event_loop_t));
+
+    if (loop != NULL) {
+#if defined(PICOQUIC_EVENT_LOOP_EPOLL)
+        loop->event_fd = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(PICOQUIC_EVENT_LOOP_KQUEUE)
+        loop->event_fd = kqueue();
+#else
+        loop->event_fd = 0;
+#endif
+        if (loop->event_fd < 0) {
+            DBG_PRINTF("Cannot create the event loop, error: %s\n", strerror(errno));
+            free(loop);
+            loop = NULL;
+        }
+    }
+
+    return loop;
+}
+
+void picoquic_event_loop_free(picoquic_event_loop_t* loop)
+{
+#if defined(PICOQUIC_EVENT_LOOP_EPOLL) || defined(PICOQUIC_EVENT_LOOP_KQUEUE)
+    close(loop->event_fd);
+#endif
+    free(loop->sockets);
+    free(loop);
+}
+
+int picoquic_event_loop_add(picoquic_event_loop_t* loop, SOCKET_TYPE fd)
+{
+    int ret = 0;
+
+    if (loop->nb_sockets == loop->max_sockets) {
+        int max_sockets = (loop->max_sockets == 0) ? 4 : 2 * loop->max_sockets;
+        SOCKET_TYPE* sockets = (SOCKET_TYPE*)realloc(loop->sockets, max_sockets * sizeof(SOCKET_TYPE));
+        if (sockets == NULL) {
+            return -1;
+        }
+        loop->sockets = sockets;
+        loop->max_sockets = max_sockets;
+    }
+
+#if defined(PICOQUIC_EVENT_LOOP_EPOLL)
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    ret = epoll_ctl(loop->event_fd, EPOLL_CTL_ADD, fd, &ev);
+#elif defined(PICOQUIC_EVENT_LOOP_KQUEUE)
+    struct kevent ev;
+    EV_SET(&ev, fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+    ret = kevent(loop->event_fd, &ev, 1, NULL, 0, NULL);
+#elif defined(_WINDOWS)
+    if (loop->nb_sockets >= FD_SETSIZE) {
+        ret = -1;
+    }
+#else
+    if (fd >= FD_SETSIZE) {
+        ret = -1;
+    }
+#endif
+
+    if (ret == 0) {
+        loop->sockets[loop->nb_sockets++] = fd;
+        if (loop->busy_poll_usec > 0) {
+            (void)picoquic_set_busy_poll(fd, loop->busy_poll_usec);
         }
+    } else {
+        DBG_PRINTF("Cannot add socket %d to the event loop\n", (int)fd);
     }
 
     return ret;
 }
+
+void picoquic_event_loop_remove(picoquic_event_loop_t* loop, SOCKET_TYPE fd)
+{
+    for (int i = 0; i < loop->nb_sockets; i++) {
+        if (loop->sockets[i] == fd) {
+            loop->sockets[i] = loop->sockets[--loop->nb_sockets];
+#if defined(PICOQUIC_EVENT_LOOP_EPOLL)
+            (void)epoll_ctl(loop->event_fd, EPOLL_CTL_DEL, fd, NULL);
+#elif defined(PICOQUIC_EVENT_LOOP_KQUEUE)
+            struct kevent ev;
+            EV_SET(&ev, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+            (void)kevent(loop->event_fd, &ev, 1, NULL, 0, NULL);
+#endif
+            break;
+        }
+    }
+}
+
+int picoquic_event_loop_wait(picoquic_event_loop_t* loop, int64_t delta_t, SOCKET_TYPE* ready, int max_ready)
+{
+    int nb_ready = 0;
+
+    /* Same bounds as picoquic_select() */
+    if (delta_t < 0) {
+        delta_t = 0;
+    } else if (delta_t > 10000000) {
+        delta_t = 10000000;
+    }
+
+#if defined(PICOQUIC_EVENT_LOOP_EPOLL)
+    struct epoll_event events[PICOQUIC_MAX_RECV_BATCH];
+    /* Round up, not to wake up before the timer is due */
+    int timeout_ms = (int)((delta_t + 999) / 1000);
+
+    if (max_ready > PICOQUIC_MAX_RECV_BATCH) {
+        max_ready = PICOQUIC_MAX_RECV_BATCH;
+    }
+    do {
+        nb_ready = epoll_wait(loop->event_fd, events, max_ready, timeout_ms);
+    } while (nb_ready < 0 && errno == EINTR);
+    for (int i = 0; i < nb_ready; i++) {
+        ready[i] = events[i].data.fd;
+    }
+#elif defined(PICOQUIC_EVENT_LOOP_KQUEUE)
+    struct kevent events[PICOQUIC_MAX_RECV_BATCH];
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(delta_t / 1000000);
+    ts.tv_nsec = (long)((delta_t % 1000000) * 1000);
+    if (max_ready > PICOQUIC_MAX_RECV_BATCH) {
+        max_ready = PICOQUIC_MAX_RECV_BATCH;
+    }
+    do {
+        nb_ready = kevent(loop->event_fd, NULL, 0, events, max_ready, &ts);
+    } while (nb_ready < 0 && errno == EINTR);
+    for (int i = 0; i < nb_ready; i++) {
+        ready[i] = (SOCKET_TYPE)events[i].ident;
+    }
+#else
+    fd_set readfds;
+
+    if (picoquic_select_wait(loop->sockets, loop->nb_sockets, delta_t, &readfds) < 0) {
+        nb_ready = -1;
+    }
+    for (int i = 0; nb_ready >= 0 && i < loop->nb_sockets && nb_ready < max_ready; i++) {
+        if (FD_ISSET(loop->sockets[i], &readfds)) {
+            ready[nb_ready++] = loop->sockets[i];
+        }
+    }
+#endif
+
+    if (nb_ready < 0) {
+        DBG_PRINTF("Error when waiting for the event loop: %s\n", strerror(errno));
+    }
+
+    return nb_ready;
+}
+
+int picoquic_event_loop_set_busy_poll(picoquic_event_loop_t* loop, uint64_t spin_budget, int busy_poll_usec)
+{
+    int ret = 0;
+
+    loop->spin_budget = spin_budget;
+    loop->busy_poll_usec = busy_poll_usec;
+    for (int i = 0; busy_poll_usec > 0 && i < loop->nb_sockets; i++) {
+        if (picoquic_set_busy_poll(loop->sockets[i], busy_poll_usec) != 0) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+void picoquic_event_loop_set_quic(picoquic_event_loop_t* loop, picoquic_quic_t* quic)
+{
+    loop->quic = quic;
+}
+
+/* Polls for up to the spin budget, and only then waits for what is left of delta_t */
+static int picoquic_event_loop_spin_wait(picoquic_event_loop_t* loop, int64_t delta_t, SOCKET_TYPE* ready, int max_ready)
+{
+    if (loop->spin_budget > 0 && delta_t > 0) {
+        uint64_t start = picoquic_current_time();
+        uint64_t spin_end = start + (((uint64_t)delta_t < loop->spin_budget) ? (uint64_t)delta_t : loop->spin_budget);
+        uint64_t now;
+
+        do {
+            int nb_ready = picoquic_event_loop_wait(loop, 0, ready, max_ready);
+            if (nb_ready != 0) {
+                return nb_ready;
+            }
+            now = picoquic_current_time();
+        } while (now < spin_end);
+
+        delta_t -= (int64_t)(now - start);
+    }
+
+    return picoquic_event_loop_wait(loop, delta_t, ready, max_ready);
+}
+
+int picoquic_event_loop_recv_batch(picoquic_event_loop_t* loop,
+    picoquic_recv_datagram_t* datagrams, int max_datagrams,
+    uint8_t* buffer, size_t datagram_buffer_size,
+    int64_t delta_t,
+    uint64_t* current_time)
+{
+    SOCKET_TYPE ready[PICOQUIC_MAX_RECV_BATCH];
+    int nb_ready = picoquic_event_loop_spin_wait(loop, delta_t, ready, PICOQUIC_MAX_RECV_BATCH);
+    int nb_received = (nb_ready < 0) ? -1 : 0;
+
+    for (int i = 0; i < nb_ready && nb_received < max_datagrams; i++) {
+        if (picoquic_recv_ready_socket(ready[i], datagrams, max_datagrams, buffer, datagram_buffer_size, &nb_received) != 0) {
+            break;
+        }
+    }
+
+    *current_time = (loop->quic != NULL) ? picoquic_refresh_time(loop->quic) : picoquic_current_time();
+
+    return nb_received;
+}
+
+int picoquic_enable_udp_gro(SOCKET_TYPE fd)
+{
+#if defined(UDP_GRO)
+    int val = 1;
+    return setsockopt(fd, SOL_UDP, UDP_GRO, (char*)&val, sizeof(int));
+#elif defined(_WINDOWS) && defined(UDP_RECV_MAX_COALESCED_SIZE)
+    /* Receive segment coalescing (URO), up to the largest UDP payload */
+    DWORD val = PICOQUIC_URO_MAX_COALESCED_SIZE;
+    return setsockopt(fd, IPPROTO_UDP, UDP_RECV_MAX_COALESCED_SIZE, (char*)&val, sizeof(val));
+#else
+    return -1;
+#endif
+}
+
+int picoquic_enable_txtime(SOCKET_TYPE fd)
+{
+#if defined(SO_TXTIME) && defined(__linux__)
+    struct sock_txtime txtime;
+
+    txtime.clockid = CLOCK_MONOTONIC;
+    txtime.flags = 0;
+    return setsockopt(fd, SOL_SOCKET, SO_TXTIME, (char*)&txtime, sizeof(txtime));
+#else
+    (void)fd;
+    return -1;
+#endif
+}
+
+int picoquic_enable_rx_timestamps(SOCKET_TYPE fd)
+{
+#if defined(SO_TIMESTAMPING) && defined(__linux__)
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+    return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, (char*)&flags, sizeof(flags));
+#elif defined(SO_TIMESTAMPNS)
+    int val = 1;
+
+    return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, (char*)&val, sizeof(val));
+#else
+    (void)fd;
+    return -1;
+#endif
+}
+
+int picoquic_enable_server_sockets_rx_timestamps(picoquic_server_sockets_t* sockets)
+{
+    int ret = 0;
+
+    for (int i = 0; i < PICOQUIC_NB_SERVER_SOCKETS; i++) {
+        if (picoquic_enable_rx_timestamps(sockets->s_socket[i]) != 0) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_enable_ecn(SOCKET_TYPE fd, uint8_t ecn_codepoint)
+{
+    int ret = -1;
+    int val = 1;
+    int tos = ecn_codepoint;
+
+    /* A dual stack socket takes both, the others refuse the options of the other family */
+#ifdef IP_RECVTOS
+    if (setsockopt(fd, IPPROTO_IP, IP_RECVTOS, (char*)&val, sizeof(val)) == 0 &&
+        setsockopt(fd, IPPROTO_IP, IP_TOS, (char*)&tos, sizeof(tos)) == 0) {
+        ret = 0;
+    }
+#endif
+#ifdef IPV6_RECVTCLASS
+    if (setsockopt(fd, IPPROTO_IPV6, IPV6_RECVTCLASS, (char*)&val, sizeof(val)) == 0 &&
+        setsockopt(fd, IPPROTO_IPV6, IPV6_TCLASS, (char*)&tos, sizeof(tos)) == 0) {
+        ret = 0;
+    }
+#endif
+    (void)fd;
+    (void)val;
+    (void)tos;
+
+    return ret;
+}
+
+int picoquic_enable_server_sockets_txtime(picoquic_server_sockets_t* sockets)
+{
+    int ret = 0;
+
+    for (int i = 0; i < PICOQUIC_NB_SERVER_SOCKETS; i++) {
+        sockets->txtime_enabled[i] = (picoquic_enable_txtime(sockets->s_socket[i]) == 0);
+        if (!sockets->txtime_enabled[i]) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_send_through_server_sockets(
+    picoquic_server_sockets_t* sockets,
+    struct sockaddr* addr_dest, socklen_t dest_length,
+    struct sockaddr* addr_from, socklen_t from_length, unsigned long from_if,
+    const char* bytes, int length)
+{
+    /* Both Linux and Windows use separate sockets for V4 and V6 */
+#ifndef NS3
+    int socket_index = (addr_dest->sa_family == AF_INET) ? 1 : 0;
+#else
+    int socket_index = 0;
+#endif
+
+    int sent = picoquic_sendmsg(sockets->s_socket[socket_index], addr_dest, dest_length,
+        addr_from, from_length, from_if, bytes, length);
+
+#ifndef DISABLE_DEBUG_PRINTF
+    if (sent <= 0) {
+#ifdef _WINDOWS
+        int last_error = WSAGetLastError();
+#else
+        int last_error = errno;
+#endif
+        DBG_PRINTF("Could not send packet on UDP socket[%d]= %d!\n",
+            socket_index, last_error);
+        DBG_PRINTF("Dest address length: %d, family: %d.\n",
+            dest_length, addr_dest->sa_family);
+    }
+#endif
+
+    return sent;
+}
+
+#if defined(__linux__)
+/* Sends the packets of one address family in as few system calls as possible */
+static int picoquic_sendmmsg_stateless(SOCKET_TYPE fd, picoquic_stateless_packet_t** packets, int nb_packets)
+{
+    struct mmsghdr msgs[PICOQUIC_MAX_SEND_BATCH];
+    struct iovec iovs[PICOQUIC_MAX_SEND_BATCH];
+    char cmsg_buffers[PICOQUIC_MAX_SEND_BATCH][CMSG_SPACE(sizeof(struct in6_pktinfo))];
+    int nb_sent = 0;
+
+    memset(msgs, 0, nb_packets * sizeof(struct mmsghdr));
+    for (int j = 0; j < nb_packets; j++) {
+        picoquic_stateless_packet_t* sp = packets[j];
+        struct msghdr* msg = &msgs[j].msg_hdr;
+
+        iovs[j].iov_base = sp->bytes;
+        iovs[j].iov_len = sp->length;
+        msg->msg_name = &sp->addr_to;
+        msg->msg_namelen = (sp->addr_to.ss_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+        msg->msg_iov = &iovs[j];
+        msg->msg_iovlen = 1;
+
+        /* Answer from the address the packet was sent to */
+        if (sp->addr_local.ss_family == AF_INET || sp->addr_local.ss_family == AF_INET6) {
+            struct cmsghdr* cmsg;
+
+            msg->msg_control = cmsg_buffers[j];
+            msg->msg_controllen = sizeof(cmsg_buffers[j]);
+            cmsg = CMSG_FIRSTHDR(msg);
+            if (sp->addr_local.ss_family == AF_INET) {
+                struct in_pktinfo* pktinfo = (struct in_pktinfo*)CMSG_DATA(cmsg);
+
+                memset(cmsg, 0, CMSG_SPACE(sizeof(struct in_pktinfo)));
+                cmsg->cmsg_level = IPPROTO_IP;
+                cmsg->cmsg_type = IP_PKTINFO;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+                pktinfo->ipi_spec_dst.s_addr = ((struct sockaddr_in*)&sp->addr_local)->sin_addr.s_addr;
+                pktinfo->ipi_ifindex = sp->if_index_local;
+                msg->msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
+            } else {
+                struct in6_pktinfo* pktinfo6 = (struct in6_pktinfo*)CMSG_DATA(cmsg);
+
+                memset(cmsg, 0, CMSG_SPACE(sizeof(struct in6_pktinfo)));
+                cmsg->cmsg_level = IPPROTO_IPV6;
+                cmsg->cmsg_type = IPV6_PKTINFO;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+                memcpy(&pktinfo6->ipi6_addr, &((struct sockaddr_in6*)&sp->addr_local)->sin6_addr, sizeof(struct in6_addr));
+                pktinfo6->ipi6_ifindex = sp->if_index_local;
+                msg->msg_controllen = CMSG_SPACE(sizeof(struct in6_pktinfo));
+            }
+        }
+    }
+
+    /* A short count leaves the rest for another call, an error drops them */
+    while (nb_sent < nb_packets) {
+        int nb = sendmmsg(fd, msgs + nb_sent, nb_packets - nb_sent, 0);
+
+        if (nb <= 0) {
+            DBG_PRINTF("Could not send %d stateless packets, error %d\n", nb_packets - nb_sent, errno);
+            break;
+        }
+        nb_sent += nb;
+    }
+
+    return nb_sent;
+}
+#endif
+
+int picoquic_send_stateless_packets(picoquic_quic_t* quic, picoquic_server_sockets_t* sockets)
+{
+    picoquic_stateless_packet_t* batch[PICOQUIC_MAX_SEND_BATCH];
+    int nb_sent = 0;
+    int nb_batch;
+
+    do {
+        nb_batch = 0;
+        while (nb_batch < PICOQUIC_MAX_SEND_BATCH &&
+            (batch[nb_batch] = picoquic_dequeue_stateless_packet(quic)) != NULL) {
+            nb_batch++;
+        }
+
+#if defined(__linux__)
+        /* One batch per socket, as for picoquic_send_through_server_sockets() */
+        for (int socket_index = 0; socket_index < PICOQUIC_NB_SERVER_SOCKETS; socket_index++) {
+            picoquic_stateless_packet_t* same_socket[PICOQUIC_MAX_SEND_BATCH];
+            int nb_same_socket = 0;
+
+            for (int j = 0; j < nb_batch; j++) {
+                if (((batch[j]->addr_to.ss_family == AF_INET) ? 1 : 0) == socket_index) {
+                    same_socket[nb_same_socket++] = batch[j];
+                }
+            }
+            if (nb_same_socket > 0) {
+                nb_sent += picoquic_sendmmsg_stateless(sockets->s_socket[socket_index], same_socket, nb_same_socket);
+            }
+        }
+#else
+        for (int j = 0; j < nb_batch; j++) {
+            picoquic_stateless_packet_t* sp = batch[j];
+
+            if (picoquic_send_through_server_sockets(sockets,
+                (struct sockaddr*)&sp->addr_to,
+                (sp->addr_to.ss_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6),
+                (struct sockaddr*)&sp->addr_local,
+                (sp->addr_local.ss_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6),
+                sp->if_index_local,
+                (const char*)sp->bytes, (int)sp->length) > 0) {
+                nb_sent++;
+            }
+        }
+#endif
+
+        /* The ring expects the packets back in the order they were read */
+        for (int j = 0; j < nb_batch; j++) {
+            picoquic_delete_stateless_packet(batch[j]);
+        }
+    } while (nb_batch == PICOQUIC_MAX_SEND_BATCH);
+
+    return nb_sent;
+}
+
+int picoquic_send_segments_through_server_sockets(
+    picoquic_server_sockets_t* sockets,
+    struct sockaddr* addr_dest, socklen_t dest_length,
+    struct sockaddr* addr_from, socklen_t from_length, unsigned long from_if,
+    const char* bytes, int length, int segment_size, uint64_t departure_time)
+{
+#ifndef NS3
+    int socket_index = (addr_dest->sa_family == AF_INET) ? 1 : 0;
+#else
+    int socket_index = 0;
+#endif
+
+    int sent = picoquic_sendmsg_gso(sockets->s_socket[socket_index], addr_dest, dest_length,
+        addr_from, from_length, from_if, bytes, length, segment_size,
+        sockets->txtime_enabled[socket_index] ? departure_time : 0, &sockets->gso_disabled[socket_index]);
+
+    if (sent <= 0) {
+        DBG_PRINTF("Could not send segments on UDP socket[%d]= %d!\n",
+            socket_index, WSA_LAST_ERROR(errno));
+    }
+
+    return sent;
+}
+
+int picoquic_get_server_address(const char* ip_address_text, int server_port,
+    struct sockaddr_storage* server_address,
+    int* server_addr_length,
+    int* is_name)
+{
+    int ret = 0;
+    struct sockaddr_in* ipv4_dest = (struct sockaddr_in*)server_address;
+    struct sockaddr_in6* ipv6_dest = (struct sockaddr_in6*)server_address;
+
+    /* get the IP address of the server */
+    memset(server_address, 0, sizeof(struct sockaddr_storage));
+    *is_name = 0;
+    *server_addr_length = 0;
+
+    if (inet_pton(AF_INET, ip_address_text, &ipv4_dest->sin_addr) == 1) {
+        /* Valid IPv4 address */
+        ipv4_dest->sin_family = AF_INET;
+        ipv4_dest->sin_port = htons((unsigned short)server_port);
+        *server_addr_length = sizeof(struct sockaddr_in);
+    } else if (inet_pton(AF_INET6, ip_address_text, &ipv6_dest->sin6_addr) == 1) {
+        /* Valid IPv6 address */
+        ipv6_dest->sin6_family = AF_INET6;
+        ipv6_dest->sin6_port = htons((unsigned short)server_port);
+        *server_addr_length = sizeof(struct sockaddr_in6);
+    } else {
+        /* Server is described by name. Do a lookup for the IP address,
+        * and then use the name as SNI parameter */
+        struct addrinfo* result = NULL;
+        struct addrinfo hints;
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_protocol = IPPROTO_UDP;
+
+        if (getaddrinfo(ip_address_text, NULL, &hints, &result) != 0) {
+            fprintf(stderr, "Cannot get IP address for %s\n", ip_address_text);
+            ret = -1;
+        } else {
+            *is_name = 1;
+
+            switch (result->ai_family) {
+            case AF_INET:
+                ipv4_dest->sin_family = AF_INET;
+                ipv4_dest->sin_port = htons((unsigned short)server_port);
+#ifdef _WINDOWS
+                ipv4_dest->sin_addr.S_un.S_addr = ((struct sockaddr_in*)result->ai_addr)->sin_addr.S_un.S_addr;
+#else
+                ipv4_dest->sin_addr.s_addr = ((struct sockaddr_in*)result->ai_addr)->sin_addr.s_addr;
+#endif
+                *server_addr_length = sizeof(struct sockaddr_in);
+                break;
+            case AF_INET6:
+                ipv6_dest->sin6_family = AF_INET6;
+                ipv6_dest->sin6_port = htons((unsigned short)server_port);
+                memcpy(&ipv6_dest->sin6_addr,
+                    &((struct sockaddr_in6*)result->ai_addr)->sin6_addr,
+                    sizeof(ipv6_dest->sin6_addr));
+                *server_addr_length = sizeof(struct sockaddr_in6);
+                break;
+            default:
+                fprintf(stderr, "Error getting IPv6 address for %s, family = %d\n",
+                    ip_address_text, result->ai_family);
+                ret = -1;
+                break;
+            }
+
+            freeaddrinfo(result);
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * io_uring backend. Each socket has a multishot recvmsg armed, which takes its buffers from a ring shared
+ * with the kernel, and the sends are sendmsg entries queued for the next io_uring_enter(). That call also
+ * waits for the completions, with the timeout of the loop in its extended argument.
+ */
+#ifdef PICOQUIC_WITH_IO_URING
+#define PICOQUIC_URING_ENTRIES 256
+#define PICOQUIC_URING_RECV_BUFFERS 256 /* Power of 2, as the kernel wants for a buffer ring */
+#define PICOQUIC_URING_SEND_SLOTS 64
+#define PICOQUIC_URING_MAX_SOCKETS 8
+#define PICOQUIC_URING_NAME_SIZE sizeof(struct sockaddr_storage)
+#define PICOQUIC_URING_CONTROL_SIZE 256
+#define PICOQUIC_URING_RECV_OFFSET (sizeof(struct io_uring_recvmsg_out) + PICOQUIC_URING_NAME_SIZE + PICOQUIC_URING_CONTROL_SIZE)
+#define PICOQUIC_URING_BUFFER_GROUP 0
+
+/* The kind of operation goes in the high byte of the user data, the socket or the slot in the low bits */
+#define PICOQUIC_URING_OP_RECV 1ull
+#define PICOQUIC_URING_OP_SEND 2ull
+#define PICOQUIC_URING_USER_DATA(op, index) (((op) << 56) | (uint64_t)(index))
+
+typedef struct st_picoquic_uring_send_slot_t {
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_storage addr_dest;
+    struct sockaddr_storage addr_from;
+    socklen_t from_length;
+    unsigned long from_if;
+    SOCKET_TYPE fd;
+    int segment_size;
+    int next_free;
+    char control[PICOQUIC_SEND_CONTROL_SIZE];
+} picoquic_uring_send_slot_t;
+
+typedef struct st_picoquic_uring_ready_t {
+    int socket_index;
+    int32_t res;
+    uint16_t bid;
+} picoquic_uring_ready_t;
+
+struct st_picoquic_uring_t {
+    int ring_fd;
+    /* Submission queue, mapped from the kernel */
+    void* sq_ptr;
+    size_t sq_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned sq_local_tail;
+    unsigned sq_submitted;
+    /* Completion queue, mapped from the kernel */
+    void* cq_ptr;
+    size_t cq_size;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+    /* Receive buffers, lent to the kernel through the buffer ring */
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    uint8_t* recv_buffers;
+    size_t recv_buffer_size;
+    uint16_t buf_tail;
+    uint16_t lent[PICOQUIC_URING_RECV_BUFFERS]; /* Held by the datagrams of the last batch */
+    int nb_lent;
+    picoquic_uring_ready_t ready[PICOQUIC_URING_RECV_BUFFERS];
+    int first_ready;
+    int nb_ready;
+    /* The multishot receive of each socket, rearmed when the kernel stops it */
+    SOCKET_TYPE sockets[PICOQUIC_URING_MAX_SOCKETS];
+    struct msghdr recv_msg[PICOQUIC_URING_MAX_SOCKETS];
+    int armed[PICOQUIC_URING_MAX_SOCKETS];
+    int nb_sockets;
+    /* Sends in flight */
+    picoquic_uring_send_slot_t slots[PICOQUIC_URING_SEND_SLOTS];
+    uint8_t* send_buffers;
+    size_t send_buffer_size;
+    int first_free_slot;
+    int reserved_slot;
+    int gso_disabled;
+    uint64_t send_errors;
+    picoquic_quic_t* quic;
+};
+
+static int picoquic_uring_setup(unsigned entries, struct io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int picoquic_uring_register(int ring_fd, unsigned opcode, void* arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+static int picoquic_uring_map(picoquic_uring_t* uring, struct io_uring_params* params)
+{
+    uring->sq_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    uring->cq_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    if (uring->cq_size > uring->sq_size) {
+        uring->sq_size = uring->cq_size;
+    }
+    uring->cq_size = uring->sq_size; /* Both queues in one mapping */
+    uring->sq_ptr = mmap(NULL, uring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        uring->ring_fd, IORING_OFF_SQ_RING);
+    if (uring->sq_ptr == MAP_FAILED) {
+        uring->sq_ptr = NULL;
+        return -1;
+    }
+    uring->cq_ptr = uring->sq_ptr;
+    uring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = (struct io_uring_sqe*)mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        uring->ring_fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        uring->sqes = NULL;
+        return -1;
+    }
+
+    uring->sq_head = (unsigned*)((uint8_t*)uring->sq_ptr + params->sq_off.head);
+    uring->sq_tail = (unsigned*)((uint8_t*)uring->sq_ptr + params->sq_off.tail);
+    uring->sq_mask = *(unsigned*)((uint8_t*)uring->sq_ptr + params->sq_off.ring_mask);
+    uring->sq_entries = params->sq_entries;
+    uring->sq_array = (unsigned*)((uint8_t*)uring->sq_ptr + params->sq_off.array);
+    uring->sq_local_tail = *uring->sq_tail;
+    uring->sq_submitted = uring->sq_local_tail;
+    uring->cq_head = (unsigned*)((uint8_t*)uring->cq_ptr + params->cq_off.head);
+    uring->cq_tail = (unsigned*)((uint8_t*)uring->cq_ptr + params->cq_off.tail);
+    uring->cq_mask = *(unsigned*)((uint8_t*)uring->cq_ptr + params->cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe*)((uint8_t*)uring->cq_ptr + params->cq_off.cqes);
+
+    return 0;
+}
+
+/* Submits the queued entries and, if wait is set, waits for a completion or for delta_t */
+static int picoquic_uring_enter(picoquic_uring_t* uring, int wait, int64_t delta_t)
+{
+    unsigned to_submit;
+    int ret;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+
+    __atomic_store_n(uring->sq_tail, uring->sq_local_tail, __ATOMIC_RELEASE);
+    to_submit = uring->sq_local_tail - uring->sq_submitted;
+    if (to_submit == 0 && !wait) {
+        return 0;
+    }
+
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    ts.tv_sec = delta_t / 1000000;
+    ts.tv_nsec = (delta_t % 1000000) * 1000;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    do {
+        ret = (int)syscall(__NR_io_uring_enter, uring->ring_fd, to_submit, wait ? 1 : 0,
+            wait ? (IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG) : 0, wait ? &arg : NULL, wait ? sizeof(arg) : 0);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret >= 0) {
+        uring->sq_submitted += (unsigned)ret;
+        ret = 0;
+    } else if (errno == ETIME) {
+        /* The entries were submitted before the wait timed out */
+        uring->sq_submitted = uring->sq_local_tail;
+        ret = 0;
+    } else {
+        DBG_PRINTF("io_uring_enter failed, error: %s\n", strerror(errno));
+    }
+
+    return ret;
+}
+
+/* Returns a zeroed entry, submitting the queue first if it is full */
+static struct io_uring_sqe* picoquic_uring_get_sqe(picoquic_uring_t* uring)
+{
+    struct io_uring_sqe* sqe;
+    unsigned index;
+
+    if (uring->sq_local_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries &&
+        (picoquic_uring_enter(uring, 0, 0) != 0 ||
+            uring->sq_local_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries)) {
+        return NULL;
+    }
+    index = uring->sq_local_tail & uring->sq_mask;
+    sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    uring->sq_array[index] = index;
+    uring->sq_local_tail++;
+
+    return sqe;
+}
+
+static void picoquic_uring_lend_buffer(picoquic_uring_t* uring, uint16_t bid)
+{
+    struct io_uring_buf* buf = &uring->buf_ring->bufs[uring->buf_tail & (PICOQUIC_URING_RECV_BUFFERS - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(uring->recv_buffers + bid * uring->recv_buffer_size);
+    buf->len = (uint32_t)uring->recv_buffer_size;
+    buf->bid = bid;
+    uring->buf_tail++;
+}
+
+static void picoquic_uring_publish_buffers(picoquic_uring_t* uring)
+{
+    __atomic_store_n(&uring->buf_ring->tail, uring->buf_tail, __ATOMIC_RELEASE);
+}
+
+static int picoquic_uring_arm_recv(picoquic_uring_t* uring)
+{
+    for (int i = 0; i < uring->nb_sockets; i++) {
+        if (!uring->armed[i]) {
+            struct io_uring_sqe* sqe = picoquic_uring_get_sqe(uring);
+
+            if (sqe == NULL) {
+                return -1;
+            }
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->fd = uring->sockets[i];
+            sqe->addr = (uint64_t)(uintptr_t)&uring->recv_msg[i];
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = PICOQUIC_URING_BUFFER_GROUP;
+            sqe->user_data = PICOQUIC_URING_USER_DATA(PICOQUIC_URING_OP_RECV, i);
+            uring->armed[i] = 1;
+        }
+    }
+
+    return 0;
+}
+
+static void picoquic_uring_release_slot(picoquic_uring_t* uring, int index)
+{
+    uring->slots[index].next_free = uring->first_free_slot;
+    uring->first_free_slot = index;
+}
+
+static void picoquic_uring_send_done(picoquic_uring_t* uring, int index, int32_t res)
+{
+    picoquic_uring_send_slot_t* slot = &uring->slots[index];
+
+    if (res < 0 && slot->segment_size > 0 && (res == -EIO || res == -EINVAL || res == -ENOPROTOOPT || res == -EOPNOTSUPP)) {
+        /* As in picoquic_sendmsg_gso(), the segments go one by one once the kernel or the NIC refused them */
+        uring->gso_disabled = 1;
+        res = picoquic_sendmsg_gso(slot->fd, (struct sockaddr*)&slot->addr_dest, slot->msg.msg_namelen,
+            (struct sockaddr*)&slot->addr_from, slot->from_length, slot->from_if,
+            (const char*)slot->iov.iov_base, (int)slot->iov.iov_len, slot->segment_size, 0, &uring->gso_disabled);
+    }
+    if (res < 0) {
+        uring->send_errors++;
+    }
+    picoquic_uring_release_slot(uring, index);
+}
+
+/* Moves the received datagrams to the ready list, and frees the slots of the completed sends */
+static void picoquic_uring_reap(picoquic_uring_t* uring)
+{
+    unsigned head = *uring->cq_head;
+    unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &uring->cqes[head & uring->cq_mask];
+        int index = (int)(cqe->user_data & 0xFFFF);
+
+        if ((cqe->user_data >> 56) == PICOQUIC_URING_OP_RECV) {
+            if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+                /* Stopped, most often because the buffers ran out */
+                uring->armed[index] = 0;
+            }
+            if ((cqe->flags & IORING_CQE_F_BUFFER) != 0) {
+                picoquic_uring_ready_t* ready = &uring->ready[(uring->first_ready + uring->nb_ready) % PICOQUIC_URING_RECV_BUFFERS];
+
+                ready->socket_index = index;
+                ready->res = cqe->res;
+                ready->bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                uring->nb_ready++;
+            } else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+                DBG_PRINTF("Receive on socket %d failed, error: %s\n", (int)uring->sockets[index], strerror(-cqe->res));
+            }
+        } else if ((cqe->user_data >> 56) == PICOQUIC_URING_OP_SEND) {
+            picoquic_uring_send_done(uring, index, cqe->res);
+        }
+        head++;
+    }
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Fills the datagram from its buffer. Returns -1 if there is none to process in it */
+static int picoquic_uring_fill_datagram(picoquic_uring_t* uring, picoquic_uring_ready_t* ready, picoquic_recv_datagram_t* d)
+{
+    uint8_t* buffer = uring->recv_buffers + ready->bid * uring->recv_buffer_size;
+    struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)buffer;
+    struct msghdr msg;
+
+    if (ready->res < (int32_t)PICOQUIC_URING_RECV_OFFSET || (out->flags & MSG_TRUNC) != 0 ||
+        out->namelen > PICOQUIC_URING_NAME_SIZE || out->controllen > PICOQUIC_URING_CONTROL_SIZE) {
+        return -1;
+    }
+
+    memset(d, 0, sizeof(picoquic_recv_datagram_t));
+    d->socket = uring->sockets[ready->socket_index];
+    memcpy(&d->addr_from, buffer + sizeof(struct io_uring_recvmsg_out), out->namelen);
+    d->from_length = out->namelen;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = buffer + sizeof(struct io_uring_recvmsg_out) + PICOQUIC_URING_NAME_SIZE;
+    msg.msg_controllen = out->controllen;
+    picoquic_parse_recv_control(&msg, &d->addr_dest, &d->dest_length, &d->dest_if, &d->tos, &d->segment_size, &d->rcv_time);
+    d->bytes = buffer + PICOQUIC_URING_RECV_OFFSET;
+    d->length = ready->res - (int32_t)PICOQUIC_URING_RECV_OFFSET;
+    if (d->segment_size >= d->length) {
+        d->segment_size = 0;
+    }
+
+    return (d->length > 0) ? 0 : -1;
+}
+
+void picoquic_uring_free(picoquic_uring_t* uring)
+{
+    /* Closing the ring cancels the receives */
+    if (uring->ring_fd >= 0) {
+        close(uring->ring_fd);
+    }
+    if (uring->sqes != NULL) {
+        munmap(uring->sqes, uring->sqes_size);
+    }
+    if (uring->sq_ptr != NULL) {
+        munmap(uring->sq_ptr, uring->sq_size);
+    }
+    if (uring->buf_ring != NULL) {
+        munmap(uring->buf_ring, uring->buf_ring_size);
+    }
+    free(uring->recv_buffers);
+    free(uring->send_buffers);
+    free(uring);
+}
+
+picoquic_uring_t* picoquic_uring_create(SOCKET_TYPE* sockets, int nb_sockets, size_t recv_buffer_size, size_t send_buffer_size)
+{
+    picoquic_uring_t* uring = NULL;
+    struct io_uring_params params;
+    struct io_uring_buf_reg reg;
+    int ret = 0;
+
+    if (nb_sockets > PICOQUIC_URING_MAX_SOCKETS ||
+        (uring = (picoquic_uring_t*)calloc(1, sizeof(picoquic_uring_t))) == NULL) {
+        return NULL;
+    }
+    uring->reserved_slot = -1;
+    uring->recv_buffer_size = PICOQUIC_URING_RECV_OFFSET + recv_buffer_size;
+    uring->send_buffer_size = send_buffer_size;
+
+    memset(&params, 0, sizeof(params));
+    if ((uring->ring_fd = picoquic_uring_setup(PICOQUIC_URING_ENTRIES, &params)) < 0) {
+        DBG_PRINTF("Cannot create the io_uring, error: %s\n", strerror(errno));
+        ret = -1;
+    } else if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0 || (params.features & IORING_FEAT_EXT_ARG) == 0 ||
+        picoquic_uring_map(uring, &params) != 0) {
+        DBG_PRINTF("%s", "The kernel lacks the io_uring features\n");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        uring->buf_ring_size = PICOQUIC_URING_RECV_BUFFERS * sizeof(struct io_uring_buf);
+        uring->buf_ring = (struct io_uring_buf_ring*)mmap(NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        uring->recv_buffers = (uint8_t*)malloc(PICOQUIC_URING_RECV_BUFFERS * uring->recv_buffer_size);
+        uring->send_buffers = (uint8_t*)malloc(PICOQUIC_URING_SEND_SLOTS * send_buffer_size);
+        if (uring->buf_ring == MAP_FAILED) {
+            uring->buf_ring = NULL;
+            ret = -1;
+        } else if (uring->recv_buffers == NULL || uring->send_buffers == NULL) {
+            ret = -1;
+        } else {
+            memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = (uint64_t)(uintptr_t)uring->buf_ring;
+            reg.ring_entries = PICOQUIC_URING_RECV_BUFFERS;
+            reg.bgid = PICOQUIC_URING_BUFFER_GROUP;
+            if (picoquic_uring_register(uring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+                DBG_PRINTF("Cannot register the buffer ring, error: %s\n", strerror(errno));
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        for (uint16_t bid = 0; bid < PICOQUIC_URING_RECV_BUFFERS; bid++) {
+            picoquic_uring_lend_buffer(uring, bid);
+        }
+        picoquic_uring_publish_buffers(uring);
+
+        uring->first_free_slot = -1;
+        for (int i = PICOQUIC_URING_SEND_SLOTS - 1; i >= 0; i--) {
+            picoquic_uring_release_slot(uring, i);
+        }
+
+        /* The kernel reads the sizes of the name and of the control data to reserve in each buffer */
+        for (int i = 0; i < nb_sockets; i++) {
+            uring->sockets[i] = sockets[i];
+            uring->recv_msg[i].msg_namelen = PICOQUIC_URING_NAME_SIZE;
+            uring->recv_msg[i].msg_controllen = PICOQUIC_URING_CONTROL_SIZE;
+        }
+        uring->nb_sockets = nb_sockets;
+
+        /* Kernels without multishot recvmsg reject it at once */
+        if (picoquic_uring_arm_recv(uring) != 0 || picoquic_uring_enter(uring, 0, 0) != 0) {
+            ret = -1;
+        } else {
+            picoquic_uring_reap(uring);
+            for (int i = 0; i < nb_sockets; i++) {
+                if (!uring->armed[i]) {
+                    DBG_PRINTF("%s", "The kernel lacks multishot recvmsg\n");
+                    ret = -1;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (ret != 0) {
+        picoquic_uring_free(uring);
+        uring = NULL;
+    }
+
+    return uring;
+}
+
+void picoquic_uring_set_quic(picoquic_uring_t* uring, picoquic_quic_t* quic)
+{
+    uring->quic = quic;
+}
+
+int picoquic_uring_recv_batch(picoquic_uring_t* uring, picoquic_recv_datagram_t* datagrams, int max_datagrams,
+    int64_t delta_t, uint64_t* current_time)
+{
+    int nb_received = 0;
+
+    /* The datagrams of the previous batch have been processed, their buffers go back to the kernel */
+    for (int i = 0; i < uring->nb_lent; i++) {
+        picoquic_uring_lend_buffer(uring, uring->lent[i]);
+    }
+    uring->nb_lent = 0;
+    picoquic_uring_publish_buffers(uring);
+
+    picoquic_uring_reap(uring);
+    if (picoquic_uring_arm_recv(uring) != 0) {
+        nb_received = -1;
+    } else {
+        /* Same bounds as picoquic_select() */
+        if (delta_t < 0) {
+            delta_t = 0;
+        } else if (delta_t > 10000000) {
+            delta_t = 10000000;
+        }
+        if (picoquic_uring_enter(uring, uring->nb_ready == 0 && delta_t > 0, delta_t) != 0) {
+            nb_received = -1;
+        } else {
+            picoquic_uring_reap(uring);
+        }
+    }
+
+    while (nb_received >= 0 && nb_received < max_datagrams && uring->nb_ready > 0) {
+        picoquic_uring_ready_t* ready = &uring->ready[uring->first_ready];
+
+        uring->first_ready = (uring->first_ready + 1) % PICOQUIC_URING_RECV_BUFFERS;
+        uring->nb_ready--;
+        uring->lent[uring->nb_lent++] = ready->bid;
+        if (picoquic_uring_fill_datagram(uring, ready, &datagrams[nb_received]) == 0) {
+            nb_received++;
+        }
+    }
+
+    *current_time = (uring->quic != NULL) ? picoquic_refresh_time(uring->quic) : picoquic_current_time();
+
+    return nb_received;
+}
+
+uint8_t* picoquic_uring_get_send_buffer(picoquic_uring_t* uring)
+{
+    if (uring->reserved_slot < 0) {
+        if (uring->first_free_slot < 0) {
+            picoquic_uring_reap(uring);
+        }
+        if (uring->first_free_slot < 0) {
+            return NULL;
+        }
+        uring->reserved_slot = uring->first_free_slot;
+        uring->first_free_slot = uring->slots[uring->reserved_slot].next_free;
+    }
+
+    return uring->send_buffers + uring->reserved_slot * uring->send_buffer_size;
+}
+
+int picoquic_uring_queue_send(picoquic_uring_t* uring, SOCKET_TYPE fd,
+    struct sockaddr* addr_dest, socklen_t dest_length,
+    struct sockaddr* addr_from, socklen_t from_length, unsigned long from_if,
+    int length, int segment_size, uint64_t departure_time)
+{
+    int index = uring->reserved_slot;
+    picoquic_uring_send_slot_t* slot;
+    struct io_uring_sqe* sqe;
+
+    if (index < 0 || length <= 0 || (size_t)length > uring->send_buffer_size) {
+        return -1;
+    }
+    slot = &uring->slots[index];
+    uring->reserved_slot = -1;
+
+    slot->fd = fd;
+    slot->segment_size = (segment_size > 0 && segment_size < length) ? segment_size : 0;
+    memcpy(&slot->addr_dest, addr_dest, dest_length);
+    slot->from_length = (addr_from != NULL) ? from_length : 0;
+    if (slot->from_length > 0) {
+        memcpy(&slot->addr_from, addr_from, from_length);
+    }
+    slot->from_if = from_if;
+    slot->iov.iov_base = uring->send_buffers + index * uring->send_buffer_size;
+    slot->iov.iov_len = length;
+
+    if (slot->segment_size > 0 && uring->gso_disabled) {
+        int sent = picoquic_sendmsg_gso(fd, addr_dest, dest_length, addr_from, from_length, from_if,
+            (const char*)slot->iov.iov_base, length, segment_size, departure_time, &uring->gso_disabled);
+        picoquic_uring_release_slot(uring, index);
+        return (sent > 0) ? 0 : -1;
+    }
+
+    memset(&slot->msg, 0, sizeof(slot->msg));
+    slot->msg.msg_name = &slot->addr_dest;
+    slot->msg.msg_namelen = dest_length;
+    slot->msg.msg_iov = &slot->iov;
+    slot->msg.msg_iovlen = 1;
+    slot->msg.msg_control = slot->control;
+    picoquic_format_send_control(&slot->msg, (slot->from_length > 0) ? (struct sockaddr*)&slot->addr_from : NULL,
+        slot->from_length, from_if, length, slot->segment_size,
+        (departure_time == 0) ? 0 : picoquic_departure_to_txtime(departure_time));
+
+    if ((sqe = picoquic_uring_get_sqe(uring)) == NULL) {
+        picoquic_uring_release_slot(uring, index);
+        return -1;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&slot->msg;
+    sqe->user_data = PICOQUIC_URING_USER_DATA(PICOQUIC_URING_OP_SEND, index);
+
+    return 0;
+}
+
+int picoquic_uring_submit(picoquic_uring_t* uring)
+{
+    return picoquic_uring_enter(uring, 0, 0);
+}
+
+uint64_t picoquic_uring_send_errors(picoquic_uring_t* uring)
+{
+    return uring->send_errors;
+}
+#elif defined(PICOQUIC_WITH_RIO)
+#define PICOQUIC_RIO_RECV_BUFFERS 256
+#define PICOQUIC_RIO_SEND_SLOTS 64
+#define PICOQUIC_RIO_MAX_SOCKETS 8
+#define PICOQUIC_RIO_CONTROL_SIZE (16 + PICOQUIC_SEND_CONTROL_SIZE) /* RIO_CMSG_BASE_SIZE, then the messages */
+#define PICOQUIC_RIO_MAX_RESULTS (PICOQUIC_RIO_RECV_BUFFERS + PICOQUIC_RIO_SEND_SLOTS)
+
+/* The kind of operation goes in the high bits of the request context, the buffer or the slot in the low bits */
+#define PICOQUIC_RIO_OP_RECV 1
+#define PICOQUIC_RIO_OP_SEND 2
+#define PICOQUIC_RIO_REQUEST_CONTEXT(op, index) ((PVOID)(ULONG_PTR)(((op) << 16) | (index)))
+
+/* Heads each buffer of the pools, which are registered as a whole. The control data comes first, for its
+ * alignment, as the buffers are on 16 bytes boundaries. */
+typedef struct st_picoquic_rio_header_t {
+    char control[PICOQUIC_RIO_CONTROL_SIZE]; /* RIO_CMSG_BUFFER */
+    SOCKADDR_INET remote_addr;
+} picoquic_rio_header_t;
+
+typedef struct st_picoquic_uring_send_slot_t {
+    struct sockaddr_storage addr_dest;
+    socklen_t dest_length;
+    struct sockaddr_storage addr_from;
+    socklen_t from_length;
+    unsigned long from_if;
+    SOCKET_TYPE fd;
+    int length;
+    int segment_size;
+    int next_free;
+} picoquic_uring_send_slot_t;
+
+typedef struct st_picoquic_uring_ready_t {
+    LONG status;
+    ULONG bytes;
+    uint16_t bid;
+} picoquic_uring_ready_t;
+
+struct st_picoquic_uring_t {
+    RIO_EXTENSION_FUNCTION_TABLE rio;
+    RIO_CQ cq;
+    HANDLE cq_event;
+    /* Receive buffers, each posted on one of the sockets */
+    uint8_t* recv_pool;
+    size_t recv_stride;
+    size_t recv_buffer_size;
+    RIO_BUFFERID recv_pool_id;
+    int recv_socket[PICOQUIC_RIO_RECV_BUFFERS];
+    uint16_t lent[PICOQUIC_RIO_RECV_BUFFERS]; /* Held by the datagrams of the last batch */
+    int nb_lent;
+    picoquic_uring_ready_t ready[PICOQUIC_RIO_RECV_BUFFERS];
+    int first_ready;
+    int nb_ready;
+    /* The request queue of each socket, and whether requests wait for a commit on it */
+    SOCKET_TYPE sockets[PICOQUIC_RIO_MAX_SOCKETS];
+    RIO_RQ rq[PICOQUIC_RIO_MAX_SOCKETS];
+    int recv_deferred[PICOQUIC_RIO_MAX_SOCKETS];
+    int send_deferred[PICOQUIC_RIO_MAX_SOCKETS];
+    int nb_sockets;
+    /* Sends in flight */
+    picoquic_uring_send_slot_t slots[PICOQUIC_RIO_SEND_SLOTS];
+    uint8_t* send_pool;
+    size_t send_stride;
+    size_t send_buffer_size;
+    RIO_BUFFERID send_pool_id;
+    int first_free_slot;
+    int reserved_slot;
+    int gso_disabled;
+    uint64_t send_errors;
+    picoquic_quic_t* quic;
+};
+
+static RIO_BUF picoquic_rio_buf(RIO_BUFFERID id, uint8_t* pool, void* p, size_t length)
+{
+    RIO_BUF buf;
+
+    buf.BufferId = id;
+    buf.Offset = (ULONG)((uint8_t*)p - pool);
+    buf.Length = (ULONG)length;
+
+    return buf;
+}
+
+/* Allocates a pool of nb_buffers buffers and registers it with RIO */
+static uint8_t* picoquic_rio_create_pool(picoquic_uring_t* uring, size_t stride, int nb_buffers, RIO_BUFFERID* id)
+{
+    uint8_t* pool = (uint8_t*)VirtualAlloc(NULL, stride * nb_buffers, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if (pool != NULL && (*id = uring->rio.RIORegisterBuffer((PCHAR)pool, (DWORD)(stride * nb_buffers))) == RIO_INVALID_BUFFERID) {
+        DBG_PRINTF("Cannot register the buffers, error: %d\n", WSAGetLastError());
+        VirtualFree(pool, 0, MEM_RELEASE);
+        pool = NULL;
+    }
+
+    return pool;
+}
+
+static void picoquic_rio_post_recv(picoquic_uring_t* uring, uint16_t bid)
+{
+    int index = uring->recv_socket[bid];
+    uint8_t* buffer = uring->recv_pool + bid * uring->recv_stride;
+    picoquic_rio_header_t* header = (picoquic_rio_header_t*)buffer;
+    RIO_BUF data = picoquic_rio_buf(uring->recv_pool_id, uring->recv_pool, buffer + sizeof(picoquic_rio_header_t), uring->recv_buffer_size);
+    RIO_BUF remote = picoquic_rio_buf(uring->recv_pool_id, uring->recv_pool, &header->remote_addr, sizeof(SOCKADDR_INET));
+    RIO_BUF control = picoquic_rio_buf(uring->recv_pool_id, uring->recv_pool, header->control, PICOQUIC_RIO_CONTROL_SIZE);
+
+    if (!uring->rio.RIOReceiveEx(uring->rq[index], &data, 1, NULL, &remote, &control, NULL, RIO_MSG_DEFER,
+        PICOQUIC_RIO_REQUEST_CONTEXT(PICOQUIC_RIO_OP_RECV, bid))) {
+        DBG_PRINTF("Cannot post a receive on socket %d, error: %d\n", (int)uring->sockets[index], WSAGetLastError());
+    } else {
+        uring->recv_deferred[index] = 1;
+    }
+}
+
+/* Starts the deferred receives and sends, with one call per socket and direction */
+static void picoquic_rio_commit(picoquic_uring_t* uring)
+{
+    for (int i = 0; i < uring->nb_sockets; i++) {
+        if (uring->recv_deferred[i]) {
+            uring->rio.RIOReceive(uring->rq[i], NULL, 0, RIO_MSG_COMMIT_ONLY, NULL);
+            uring->recv_deferred[i] = 0;
+        }
+        if (uring->send_deferred[i]) {
+            uring->rio.RIOSend(uring->rq[i], NULL, 0, RIO_MSG_COMMIT_ONLY, NULL);
+            uring->send_deferred[i] = 0;
+        }
+    }
+}
+
+static void picoquic_rio_release_slot(picoquic_uring_t* uring, int index)
+{
+    uring->slots[index].next_free = uring->first_free_slot;
+    uring->first_free_slot = index;
+}
+
+static void picoquic_rio_send_done(picoquic_uring_t* uring, int index, LONG status)
+{
+    picoquic_uring_send_slot_t* slot = &uring->slots[index];
+
+    if (status != 0 && slot->segment_size > 0 && (status == WSAEINVAL || status == WSAEOPNOTSUPP || status == WSAENOPROTOOPT)) {
+        /* As in picoquic_sendmsg_gso(), the segments go one by one once the system or the NIC refused them */
+        uring->gso_disabled = 1;
+        status = (picoquic_sendmsg_gso(slot->fd, (struct sockaddr*)&slot->addr_dest, slot->dest_length,
+            (slot->from_length > 0) ? (struct sockaddr*)&slot->addr_from : NULL, slot->from_length, slot->from_if,
+            (const char*)(uring->send_pool + index * uring->send_stride + sizeof(picoquic_rio_header_t)),
+            slot->length, slot->segment_size, 0, &uring->gso_disabled) < 0) ? -1 : 0;
+    }
+    if (status != 0) {
+        uring->send_errors++;
+    }
+    picoquic_rio_release_slot(uring, index);
+}
+
+/* Moves the received datagrams to the ready list, and frees the slots of the completed sends */
+static void picoquic_rio_reap(picoquic_uring_t* uring)
+{
+    RIORESULT results[PICOQUIC_RIO_MAX_RESULTS];
+    ULONG nb_results = uring->rio.RIODequeueCompletion(uring->cq, results, PICOQUIC_RIO_MAX_RESULTS);
+
+    if (nb_results == RIO_CORRUPT_CQ) {
+        DBG_PRINTF("%s", "The RIO completion queue is corrupt\n");
+        return;
+    }
+
+    for (ULONG i = 0; i < nb_results; i++) {
+        ULONG_PTR context = (ULONG_PTR)results[i].RequestContext;
+        int index = (int)(context & 0xFFFF);
+
+        if ((context >> 16) == PICOQUIC_RIO_OP_RECV) {
+            picoquic_uring_ready_t* ready = &uring->ready[(uring->first_ready + uring->nb_ready) % PICOQUIC_RIO_RECV_BUFFERS];
+
+            ready->status = results[i].Status;
+            ready->bytes = results[i].BytesTransferred;
+            ready->bid = (uint16_t)index;
+            uring->nb_ready++;
+        } else if ((context >> 16) == PICOQUIC_RIO_OP_SEND) {
+            picoquic_rio_send_done(uring, index, results[i].Status);
+        }
+    }
+}
+
+/* Waits for a completion, or until delta_t microseconds have passed */
+static int picoquic_rio_wait(picoquic_uring_t* uring, int64_t delta_t)
+{
+    INT notify_ret = uring->rio.RIONotify(uring->cq);
+
+    /* A notification still armed by a previous wait, which timed out, signals the same event */
+    if (notify_ret != ERROR_SUCCESS && notify_ret != WSAEALREADY) {
+        DBG_PRINTF("Cannot wait for the RIO completions, error: %d\n", notify_ret);
+        return -1;
+    }
+    if (WaitForSingleObject(uring->cq_event, (DWORD)((delta_t + 999) / 1000)) == WAIT_FAILED) {
+        DBG_PRINTF("Error when waiting for the RIO completions: %d\n", (int)GetLastError());
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Fills the datagram from its buffer. Returns -1 if there is none to process in it */
+static int picoquic_rio_fill_datagram(picoquic_uring_t* uring, picoquic_uring_ready_t* ready, picoquic_recv_datagram_t* d)
+{
+    uint8_t* buffer = uring->recv_pool + ready->bid * uring->recv_stride;
+    picoquic_rio_header_t* header = (picoquic_rio_header_t*)buffer;
+    PRIO_CMSG_BUFFER control = (PRIO_CMSG_BUFFER)header->control;
+
+    /* The receives that fail, as on ICMP port unreachable, only give their buffer back */
+    if (ready->status != 0 || ready->bytes == 0) {
+        return -1;
+    }
+
+    memset(d, 0, sizeof(picoquic_recv_datagram_t));
+    d->socket = uring->sockets[uring->recv_socket[ready->bid]];
+    if (header->remote_addr.si_family == AF_INET) {
+        memcpy(&d->addr_from, &header->remote_addr.Ipv4, sizeof(struct sockaddr_in));
+        d->from_length = sizeof(struct sockaddr_in);
+    } else {
+        memcpy(&d->addr_from, &header->remote_addr.Ipv6, sizeof(struct sockaddr_in6));
+        d->from_length = sizeof(struct sockaddr_in6);
+    }
+    for (WSACMSGHDR* cmsg = RIO_CMSG_FIRSTHDR(control); cmsg != NULL; cmsg = RIO_CMSG_NEXTHDR(control, cmsg)) {
+        picoquic_parse_wsa_cmsg(cmsg, &d->addr_dest, &d->dest_length, &d->dest_if, &d->segment_size);
+    }
+    d->bytes = buffer + sizeof(picoquic_rio_header_t);
+    d->length = (int)ready->bytes;
+    if (d->segment_size >= d->length) {
+        d->segment_size = 0;
+    }
+
+    return 0;
+}
+
+void picoquic_uring_free(picoquic_uring_t* uring)
+{
+    /* The request queues go with their sockets, which are closed first */
+    if (uring->cq != RIO_INVALID_CQ) {
+        uring->rio.RIOCloseCompletionQueue(uring->cq);
+    }
+    if (uring->cq_event != NULL) {
+        CloseHandle(uring->cq_event);
+    }
+    if (uring->recv_pool != NULL) {
+        uring->rio.RIODeregisterBuffer(uring->recv_pool_id);
+        VirtualFree(uring->recv_pool, 0, MEM_RELEASE);
+    }
+    if (uring->send_pool != NULL) {
+        uring->rio.RIODeregisterBuffer(uring->send_pool_id);
+        VirtualFree(uring->send_pool, 0, MEM_RELEASE);
+    }
+    free(uring);
+}
+
+picoquic_uring_t* picoquic_uring_create(SOCKET_TYPE* sockets, int nb_sockets, size_t recv_buffer_size, size_t send_buffer_size)
+{
+    picoquic_uring_t* uring = NULL;
+    GUID rio_guid = WSAID_MULTIPLE_RIO;
+    DWORD NumberOfBytes = 0;
+    RIO_NOTIFICATION_COMPLETION completion;
+    ULONG recv_per_socket;
+    DWORD cq_size;
+    int ret = 0;
+
+    if (nb_sockets <= 0 || nb_sockets > PICOQUIC_RIO_MAX_SOCKETS ||
+        (uring = (picoquic_uring_t*)calloc(1, sizeof(picoquic_uring_t))) == NULL) {
+        return NULL;
+    }
+    uring->cq = RIO_INVALID_CQ;
+    uring->reserved_slot = -1;
+    uring->recv_buffer_size = recv_buffer_size;
+    uring->recv_stride = (sizeof(picoquic_rio_header_t) + recv_buffer_size + 15) & ~(size_t)15;
+    uring->send_buffer_size = send_buffer_size;
+    uring->send_stride = (sizeof(picoquic_rio_header_t) + send_buffer_size + 15) & ~(size_t)15;
+    recv_per_socket = (PICOQUIC_RIO_RECV_BUFFERS + nb_sockets - 1) / nb_sockets;
+    /* Room for all the requests that the queues of the sockets may hold */
+    cq_size = nb_sockets * (recv_per_socket + PICOQUIC_RIO_SEND_SLOTS);
+
+    uring->rio.cbSize = sizeof(RIO_EXTENSION_FUNCTION_TABLE);
+    if (WSAIoctl(sockets[0], SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &rio_guid, sizeof(rio_guid),
+        &uring->rio, sizeof(uring->rio), &NumberOfBytes, NULL, NULL) == SOCKET_ERROR) {
+        DBG_PRINTF("Registered I/O is not available, error: %d\n", WSAGetLastError());
+        free(uring);
+        return NULL;
+    }
+
+    if ((uring->cq_event = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL) {
+        ret = -1;
+    } else {
+        memset(&completion, 0, sizeof(completion));
+        completion.Type = RIO_EVENT_COMPLETION;
+        completion.Event.EventHandle = uring->cq_event;
+        completion.Event.NotifyReset = TRUE;
+        if ((uring->cq = uring->rio.RIOCreateCompletionQueue(cq_size, &completion)) == RIO_INVALID_CQ) {
+            DBG_PRINTF("Cannot create the RIO completion queue, error: %d\n", WSAGetLastError());
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 &&
+        ((uring->recv_pool = picoquic_rio_create_pool(uring, uring->recv_stride, PICOQUIC_RIO_RECV_BUFFERS, &uring->recv_pool_id)) == NULL ||
+        (uring->send_pool = picoquic_rio_create_pool(uring, uring->send_stride, PICOQUIC_RIO_SEND_SLOTS, &uring->send_pool_id)) == NULL)) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < nb_sockets; i++) {
+        uring->sockets[i] = sockets[i];
+        uring->rq[i] = uring->rio.RIOCreateRequestQueue(sockets[i], recv_per_socket, 1, PICOQUIC_RIO_SEND_SLOTS, 1,
+            uring->cq, uring->cq, NULL);
+        if (uring->rq[i] == RIO_INVALID_RQ) {
+            /* Also the case of the sockets opened without WSA_FLAG_REGISTERED_IO */
+            DBG_PRINTF("Cannot create the RIO request queue of socket %d, error: %d\n", (int)sockets[i], WSAGetLastError());
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        uring->nb_sockets = nb_sockets;
+        for (uint16_t bid = 0; bid < PICOQUIC_RIO_RECV_BUFFERS; bid++) {
+            uring->recv_socket[bid] = bid % nb_sockets;
+            picoquic_rio_post_recv(uring, bid);
+        }
+        picoquic_rio_commit(uring);
+
+        uring->first_free_slot = -1;
+        for (int i = PICOQUIC_RIO_SEND_SLOTS - 1; i >= 0; i--) {
+            picoquic_rio_release_slot(uring, i);
+        }
+    }
+
+    if (ret != 0) {
+        picoquic_uring_free(uring);
+        uring = NULL;
+    }
+
+    return uring;
+}
+
+void picoquic_uring_set_quic(picoquic_uring_t* uring, picoquic_quic_t* quic)
+{
+    uring->quic = quic;
+}
+
+int picoquic_uring_recv_batch(picoquic_uring_t* uring, picoquic_recv_datagram_t* datagrams, int max_datagrams,
+    int64_t delta_t, uint64_t* current_time)
+{
+    int nb_received = 0;
+
+    /* The datagrams of the previous batch have been processed, their buffers are posted again */
+    for (int i = 0; i < uring->nb_lent; i++) {
+        picoquic_rio_post_recv(uring, uring->lent[i]);
+    }
+    uring->nb_lent = 0;
+    picoquic_rio_commit(uring);
+
+    picoquic_rio_reap(uring);
+    if (uring->nb_ready == 0) {
+        /* Same bounds as picoquic_select() */
+        if (delta_t > 10000000) {
+            delta_t = 10000000;
+        }
+        if (delta_t > 0) {
+            if (picoquic_rio_wait(uring, delta_t) != 0) {
+                nb_received = -1;
+            } else {
+                picoquic_rio_reap(uring);
+            }
+        }
+    }
+
+    while (nb_received >= 0 && nb_received < max_datagrams && uring->nb_ready > 0) {
+        picoquic_uring_ready_t* ready = &uring->ready[uring->first_ready];
+
+        uring->first_ready = (uring->first_ready + 1) % PICOQUIC_RIO_RECV_BUFFERS;
+        uring->nb_ready--;
+        uring->lent[uring->nb_lent++] = ready->bid;
+        if (picoquic_rio_fill_datagram(uring, ready, &datagrams[nb_received]) == 0) {
+            nb_received++;
+        }
+    }
+
+    *current_time = (uring->quic != NULL) ? picoquic_refresh_time(uring->quic) : picoquic_current_time();
+
+    return nb_received;
+}
+
+uint8_t* picoquic_uring_get_send_buffer(picoquic_uring_t* uring)
+{
+    if (uring->reserved_slot < 0) {
+        if (uring->first_free_slot < 0) {
+            picoquic_rio_reap(uring);
+        }
+        if (uring->first_free_slot < 0) {
+            return NULL;
+        }
+        uring->reserved_slot = uring->first_free_slot;
+        uring->first_free_slot = uring->slots[uring->reserved_slot].next_free;
+    }
+
+    return uring->send_pool + uring->reserved_slot * uring->send_stride + sizeof(picoquic_rio_header_t);
+}
+
+int picoquic_uring_queue_send(picoquic_uring_t* uring, SOCKET_TYPE fd,
+    struct sockaddr* addr_dest, socklen_t dest_length,
+    struct sockaddr* addr_from, socklen_t from_length, unsigned long from_if,
+    int length, int segment_size, uint64_t departure_time)
+{
+    int index = uring->reserved_slot;
+    int socket_index = 0;
+    picoquic_uring_send_slot_t* slot;
+    uint8_t* buffer;
+    picoquic_rio_header_t* header;
+    PRIO_CMSG_BUFFER control;
+    RIO_BUF data;
+    RIO_BUF remote;
+    RIO_BUF control_buf;
+
+    (void)departure_time; /* No SO_TXTIME on Windows */
+
+    if (index < 0 || length <= 0 || (size_t)length > uring->send_buffer_size || (size_t)dest_length > sizeof(SOCKADDR_INET)) {
+        return -1;
+    }
+    slot = &uring->slots[index];
+    uring->reserved_slot = -1;
+    buffer = uring->send_pool + index * uring->send_stride;
+    header = (picoquic_rio_header_t*)buffer;
+
+    slot->fd = fd;
+    slot->length = length;
+    slot->segment_size = (segment_size > 0 && segment_size < length) ? segment_size : 0;
+    memcpy(&slot->addr_dest, addr_dest, dest_length);
+    slot->dest_length = dest_length;
+    slot->from_length = (addr_from != NULL) ? from_length : 0;
+    if (slot->from_length > 0) {
+        memcpy(&slot->addr_from, addr_from, from_length);
+    }
+    slot->from_if = from_if;
+
+    while (socket_index < uring->nb_sockets && uring->sockets[socket_index] != fd) {
+        socket_index++;
+    }
+    if (socket_index >= uring->nb_sockets || (slot->segment_size > 0 && uring->gso_disabled)) {
+        /* Not one of the registered sockets, or without USO: sent at once */
+        int sent = picoquic_sendmsg_gso(fd, addr_dest, dest_length, addr_from, from_length, from_if,
+            (const char*)buffer + sizeof(picoquic_rio_header_t), length, segment_size, 0, &uring->gso_disabled);
+        picoquic_rio_release_slot(uring, index);
+        return (sent > 0) ? 0 : -1;
+    }
+
+    memset(&header->remote_addr, 0, sizeof(SOCKADDR_INET));
+    memcpy(&header->remote_addr, addr_dest, dest_length);
+    control = (PRIO_CMSG_BUFFER)header->control;
+    control->TotalLength = RIO_CMSG_BASE_SIZE + picoquic_format_wsa_send_control(header->control + RIO_CMSG_BASE_SIZE,
+        (slot->from_length > 0) ? (struct sockaddr*)&slot->addr_from : NULL, slot->from_length, from_if, length, slot->segment_size);
+
+    data = picoquic_rio_buf(uring->send_pool_id, uring->send_pool, buffer + sizeof(picoquic_rio_header_t), length);
+    remote = picoquic_rio_buf(uring->send_pool_id, uring->send_pool, &header->remote_addr, sizeof(SOCKADDR_INET));
+    control_buf = picoquic_rio_buf(uring->send_pool_id, uring->send_pool, header->control, control->TotalLength);
+    if (!uring->rio.RIOSendEx(uring->rq[socket_index], &data, 1, NULL, &remote, &control_buf, NULL, RIO_MSG_DEFER,
+        PICOQUIC_RIO_REQUEST_CONTEXT(PICOQUIC_RIO_OP_SEND, index))) {
+        DBG_PRINTF("Cannot queue a send on socket %d, error: %d\n", (int)fd, WSAGetLastError());
+        picoquic_rio_release_slot(uring, index);
+        return -1;
+    }
+    uring->send_deferred[socket_index] = 1;
+
+    return 0;
+}
+
+int picoquic_uring_submit(picoquic_uring_t* uring)
+{
+    picoquic_rio_commit(uring);
+    return 0;
+}
+
+uint64_t picoquic_uring_send_errors(picoquic_uring_t* uring)
+{
+    return uring->send_errors;
+}
+#else
+picoquic_uring_t* picoquic_uring_create(SOCKET_TYPE* sockets, int nb_sockets, size_t recv_buffer_size, size_t send_buffer_size)
+{
+    (void)sockets;
+    (void)nb_sockets;
+    (void)recv_buffer_size;
+    (void)send_buffer_size;
+    return NULL;
+}
+
+void picoquic_uring_free(picoquic_uring_t* uring)
+{
+    (void)uring;
+}
+
+void picoquic_uring_set_quic(picoquic_uring_t* uring, picoquic_quic_t* quic)
+{
+    (void)uring;
+    (void)quic;
+}
+
+int picoquic_uring_recv_batch(picoquic_uring_t* uring, picoquic_recv_datagram_t* datagrams, int max_datagrams,
+    int64_t delta_t, uint64_t* current_time)
+{
+    (void)uring;
+    (void)datagrams;
+    (void)max_datagrams;
+    (void)delta_t;
+    *current_time = picoquic_current_time();
+    return -1;
+}
+
+uint8_t* picoquic_uring_get_send_buffer(picoquic_uring_t* uring)
+{
+    (void)uring;
+    return NULL;
+}
+
+int picoquic_uring_queue_send(picoquic_uring_t* uring, SOCKET_TYPE fd,
+    struct sockaddr* addr_dest, socklen_t dest_length,
+    struct sockaddr* addr_from, socklen_t from_length, unsigned long from_if,
+    int length, int segment_size, uint64_t departure_time)
+{
+    (void)uring;
+    (void)fd;
+    (void)addr_dest;
+    (void)dest_length;
+    (void)addr_from;
+    (void)from_length;
+    (void)from_if;
+    (void)length;
+    (void)segment_size;
+    (void)departure_time;
+    return -1;
+}
+
+int picoquic_uring_submit(picoquic_uring_t* uring)
+{
+    (void)uring;
+    return -1;
+}
+
+uint64_t picoquic_uring_send_errors(picoquic_uring_t* uring)
+{
+    (void)uring;
+    return 0;
+}
+#endif
@@ -84,6 +84,7 @@
 #include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <sys/select.h>
 
 #ifndef SOCKET_TYPE
@@ -122,12 +123,76 @@
 
 typedef struct st_picoquic_server_sockets_t {
     SOCKET_TYPE s_socket[PICOQUIC_NB_SERVER_SOCKETS];
+    int gso_disabled[PICOQUIC_NB_SERVER_SOCKETS]; /* Set once the kernel or the NIC refused UDP segmentation */
+    int txtime_enabled[PICOQUIC_NB_SERVER_SOCKETS]; /* Set by picoquic_enable_server_sockets_txtime() */
 } picoquic_server_sockets_t;
 
 int picoquic_open_server_sockets(picoquic_server_sockets_t* sockets, int port);
 
+/* With reuse_port, several sets of server sockets can be bound to the same port, the kernel
+ * spreading the incoming flows between them. Fails if SO_REUSEPORT is not supported. */
+int picoquic_open_server_sockets_ex(picoquic_server_sockets_t* sockets, int port, int reuse_port);
+
 void picoquic_close_server_sockets(picoquic_server_sockets_t* sockets);
 
+/* Sockets bound to each of the local addresses returned by picoquic_getaddrs(), so that the paths of
+ * a connection leaving from different addresses use their own socket, and their own kernel queues */
+#define PICOQUIC_MAX_LOCAL_SOCKETS 8
+
+typedef struct st_picoquic_local_sockets_t {
+    int nb_sockets;
+    SOCKET_TYPE s_socket[PICOQUIC_MAX_LOCAL_SOCKETS];
+    struct sockaddr_storage local_addr[PICOQUIC_MAX_LOCAL_SOCKETS]; /* Without the port, as in picoquic_path_t */
+    unsigned long if_index[PICOQUIC_MAX_LOCAL_SOCKETS];
+} picoquic_local_sockets_t;
+
+/* Opens one socket per local address, bound to port, 0 for an ephemeral one. The addresses that cannot
+ * be bound are skipped. Returns the number of sockets opened. */
+int picoquic_open_local_sockets(picoquic_local_sockets_t* sockets, int port);
+
+void picoquic_close_local_sockets(picoquic_local_sockets_t* sockets);
+
+/* Socket on which to send the packets of path_x: the one its packets arrive on, else the local socket
+ * bound to its local address, else default_socket. */
+SOCKET_TYPE picoquic_get_path_socket(picoquic_local_sockets_t* sockets, picoquic_path_t* path_x, SOCKET_TYPE default_socket);
+
+/* Sockets connect()ed to the peer of each path of a client connection. The kernel then resolves the route
+ * once instead of for every packet, the packets are sent without address nor control data, and the
+ * incoming ones can be steered to the socket of their flow. The first path takes over the initial socket,
+ * given at init, so that its 4-tuple does not change; the others get a socket bound to their local address.
+ * The socket follows the path when its peer address changes, and is replaced when its local address does. */
+#define PICOQUIC_MAX_CONNECTED_SOCKETS 8
+
+typedef struct st_picoquic_connected_socket_t {
+    picoquic_path_t* path;
+    SOCKET_TYPE fd;
+    int is_initial_socket; /* Not closed with the path */
+    struct sockaddr_storage peer_addr;
+    struct sockaddr_storage local_addr;
+} picoquic_connected_socket_t;
+
+typedef struct st_picoquic_connected_sockets_t {
+    SOCKET_TYPE initial_socket;
+    int initial_socket_used;
+    int nb_sockets;
+    picoquic_connected_socket_t s[PICOQUIC_MAX_CONNECTED_SOCKETS];
+} picoquic_connected_sockets_t;
+
+void picoquic_init_connected_sockets(picoquic_connected_sockets_t* sockets, SOCKET_TYPE initial_socket);
+
+/* Returns the socket connected for path_x, opening or reconnecting it if needed, after closing those of the
+ * paths that cnx no longer has. Returns INVALID_SOCKET if none can be connected. */
+SOCKET_TYPE picoquic_get_connected_socket(picoquic_connected_sockets_t* sockets, picoquic_cnx_t* cnx, picoquic_path_t* path_x);
+
+/* Lists the sockets to wait on besides the initial one. Returns their number */
+int picoquic_list_connected_sockets(picoquic_connected_sockets_t* sockets, SOCKET_TYPE* fds, int max_fds);
+
+/* Closes the sockets opened for the paths. The initial socket stays open */
+void picoquic_close_connected_sockets(picoquic_connected_sockets_t* sockets);
+
+/* Sends nb_packets datagrams on a connected socket, with sendmmsg when available. Returns the number sent */
+int picoquic_send_connected(SOCKET_TYPE fd, uint8_t* const* bytes, const size_t* lengths, int nb_packets);
+
 int picoquic_select(SOCKET_TYPE* sockets, int nb_sockets,
     struct sockaddr_storage* addr_from,
     socklen_t* from_length,
@@ -139,12 +204,133 @@ int picoquic_select(SOCKET_TYPE* sockets, int nb_sockets,
     uint64_t* current_time,
     picoquic_quic_t* quic);
 
+#define PICOQUIC_MAX_RECV_BATCH 32
+
+typedef struct st_picoquic_recv_datagram_t {
+    struct sockaddr_storage addr_from;
+    socklen_t from_length;
+    struct sockaddr_storage addr_dest;
+    socklen_t dest_length;
+    unsigned long dest_if;
+    int tos;
+    SOCKET_TYPE socket;
+    uint8_t* bytes;
+    int length;
+    int segment_size; /* Non zero if coalesced by UDP GRO or URO: the datagrams have this length, except the last one */
+    uint64_t rcv_time; /* Arrival in the kernel, on the clock of picoquic_current_time(), 0 if not known */
+} picoquic_recv_datagram_t;
+
+/* Waits like picoquic_select(), then receives up to max_datagrams datagrams, with recvmmsg when available.
+ * buffer holds max_datagrams slices of datagram_buffer_size bytes, which should be 64KB if UDP GRO is enabled.
+ * Returns the number of datagrams received, 0 on timeout or -1 on error. */
+int picoquic_select_batch(SOCKET_TYPE* sockets,
+    int nb_sockets,
+    picoquic_recv_datagram_t* datagrams, int max_datagrams,
+    uint8_t* buffer, size_t datagram_buffer_size,
+    int64_t delta_t,
+    uint64_t* current_time);
+
+#if defined(__linux__)
+#define PICOQUIC_EVENT_LOOP_EPOLL
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+#define PICOQUIC_EVENT_LOOP_KQUEUE
+#endif
+
+/* Sockets waited for together, backed by epoll or kqueue when available, by select() otherwise */
+typedef struct st_picoquic_event_loop_t picoquic_event_loop_t;
+
+picoquic_event_loop_t* picoquic_event_loop_create();
+void picoquic_event_loop_free(picoquic_event_loop_t* loop);
+int picoquic_event_loop_add(picoquic_event_loop_t* loop, SOCKET_TYPE fd);
+void picoquic_event_loop_remove(picoquic_event_loop_t* loop, SOCKET_TYPE fd);
+
+/* Waits for up to delta_t microseconds, e.g. from picoquic_get_next_wake_delay(), and fills ready
+ * with the readable sockets. Returns their number, 0 on timeout or -1 on error. */
+int picoquic_event_loop_wait(picoquic_event_loop_t* loop, int64_t delta_t, SOCKET_TYPE* ready, int max_ready);
+
+/* Same as picoquic_select_batch(), for the sockets of the loop */
+int picoquic_event_loop_recv_batch(picoquic_event_loop_t* loop,
+    picoquic_recv_datagram_t* datagrams, int max_datagrams,
+    uint8_t* buffer, size_t datagram_buffer_size,
+    int64_t delta_t,
+    uint64_t* current_time);
+
+/* Busy polling: the receive functions poll the sockets without blocking for up to spin_budget microseconds,
+ * or until the timer is due, before they block for the rest of the delay. The clock is read through the vDSO
+ * between two polls, so the spin makes no other system call than the polls. A busy_poll_usec above 0 also
+ * asks the kernel to poll the device queue of the sockets, with SO_BUSY_POLL and SO_PREFER_BUSY_POLL, which
+ * needs CAP_NET_ADMIN to go above the net.core.busy_read sysctl. A spin budget of 0 turns the spin off.
+ * Returns -1 if the sockets could not be set to busy poll, in which case the loop still spins. */
+int picoquic_event_loop_set_busy_poll(picoquic_event_loop_t* loop, uint64_t spin_budget, int busy_poll_usec);
+
+/* The receive functions refresh the cached time of quic instead of reading the clock once more */
+void picoquic_event_loop_set_quic(picoquic_event_loop_t* loop, picoquic_quic_t* quic);
+
+/* io_uring backend, on Linux when built with PICOQUIC_WITH_IO_URING. Each socket is read by a multishot
+ * recvmsg into buffers lent to the kernel, and the datagrams point into those buffers, which stay valid until
+ * the next call to picoquic_uring_recv_batch(). The packets to send are prepared in place, in the buffer
+ * returned by picoquic_uring_get_send_buffer(), and their sends go to the kernel with the next wait, so that
+ * an iteration of the loop costs a single io_uring_enter(). The failed sends are only known at completion.
+ * picoquic_uring_create() returns NULL if the kernel lacks multishot recvmsg, from Linux 6.0, in which case
+ * the loop should use picoquic_event_loop_t.
+ * On Windows, the same API is implemented with Registered I/O, on sockets opened with WSA_FLAG_REGISTERED_IO
+ * as picoquic_open_server_sockets() does. The receive and send buffers are registered once, in two pools,
+ * and the sends are committed with the next wait or picoquic_uring_submit(). A socket only accepts the RIO
+ * queues of one backend, which last as long as the socket: free the backend after closing the sockets. */
+typedef struct st_picoquic_uring_t picoquic_uring_t;
+
+picoquic_uring_t* picoquic_uring_create(SOCKET_TYPE* sockets, int nb_sockets, size_t recv_buffer_size, size_t send_buffer_size);
+void picoquic_uring_free(picoquic_uring_t* uring);
+void picoquic_uring_set_quic(picoquic_uring_t* uring, picoquic_quic_t* quic);
+
+/* Same as picoquic_event_loop_recv_batch(), without copying the datagrams */
+int picoquic_uring_recv_batch(picoquic_uring_t* uring, picoquic_recv_datagram_t* datagrams, int max_datagrams,
+    int64_t delta_t, uint64_t* current_time);
+
+/* Buffer of send_buffer_size bytes for the next send, or NULL if all are in flight */
+uint8_t* picoquic_uring_get_send_buffer(picoquic_uring_t* uring);
+
+/* Queues the send of the first length bytes of the buffer, split in segments of segment_size by the kernel.
+ * departure_time is the one of picoquic_sendmsg_gso(), 0 unless SO_TXTIME is enabled on fd. */
+int picoquic_uring_queue_send(picoquic_uring_t* uring, SOCKET_TYPE fd,
+    struct sockaddr* addr_dest, socklen_t dest_length,
+    struct sockaddr* addr_from, socklen_t from_length, unsigned long from_if,
+    int length, int segment_size, uint64_t departure_time);
+
+/* Submits the queued sends without waiting */
+int picoquic_uring_submit(picoquic_uring_t* uring);
+uint64_t picoquic_uring_send_errors(picoquic_uring_t* uring);
+
+/* Lets the kernel coalesce the datagrams received on fd, with UDP_GRO or on Windows UDP_RECV_MAX_COALESCED_SIZE,
+ * up to 64KB; returns -1 if not supported */
+int picoquic_enable_udp_gro(SOCKET_TYPE fd);
+
+/* Lets the datagrams sent on fd carry their departure time, for the fq qdisc to pace them; returns -1 if not supported */
+int picoquic_enable_txtime(SOCKET_TYPE fd);
+int picoquic_enable_server_sockets_txtime(picoquic_server_sockets_t* sockets);
+
+/* Asks the kernel to timestamp the datagrams received on fd, with SO_TIMESTAMPING in software, so that the
+ * RTT samples do not include the time they waited in the socket and in the loop. The receive functions give
+ * the time in picoquic_recv_datagram_t, or in quic->rcv_time for picoquic_select(). Returns -1 if not supported */
+int picoquic_enable_rx_timestamps(SOCKET_TYPE fd);
+int picoquic_enable_server_sockets_rx_timestamps(picoquic_server_sockets_t* sockets);
+
+/* Marks the datagrams sent on fd with the ECN codepoint, 0 for none, and asks for the TOS of those received,
+ * over IPv4 and IPv6; returns -1 if neither is supported */
+int picoquic_enable_ecn(SOCKET_TYPE fd, uint8_t ecn_codepoint);
+
 int picoquic_send_through_server_sockets(
     picoquic_server_sockets_t* sockets,
     struct sockaddr* addr_dest, socklen_t addr_length,
     struct sockaddr* addr_from, socklen_t from_length, unsigned long from_if,
     const char* bytes, int length);
 
+int picoquic_send_segments_through_server_sockets(
+    picoquic_server_sockets_t* sockets,
+    struct sockaddr* addr_dest, socklen_t addr_length,
+    struct sockaddr* addr_from, socklen_t from_length, unsigned long from_if,
+    const char* bytes, int length, int segment_size, uint64_t departure_time);
+
 int picoquic_sendmsg(SOCKET_TYPE fd,
     struct sockaddr* addr_dest,
     socklen_t dest_length,
@@ -153,6 +339,28 @@ int picoquic_sendmsg(SOCKET_TYPE fd,
     unsigned long dest_if,
     const char* bytes, int length);
 
+#define PICOQUIC_MAX_SEND_BATCH 32
+
+/* Sends the stateless packets queued by the QUIC context, by batches of up to PICOQUIC_MAX_SEND_BATCH
+ * with sendmmsg when available. Can run in another thread than the one processing the incoming packets.
+ * Returns the number of packets sent. */
+int picoquic_send_stateless_packets(picoquic_quic_t* quic, picoquic_server_sockets_t* sockets);
+
+/* Sends length bytes as datagrams of segment_size bytes, the last one possibly shorter, as prepared
+ * by picoquic_prepare_packets(). UDP_SEGMENT, or UDP_SEND_MSG_SIZE on Windows, is used when available,
+ * in a single system call.
+ * If it is refused, the segments are sent one by one and *gso_disabled is set, if not NULL,
+ * so that the next calls do not try again.
+ * A non zero departure_time, on the clock of picoquic_current_time(), is passed to the kernel with
+ * SCM_TXTIME, which fd must accept, see picoquic_enable_txtime(). */
+int picoquic_sendmsg_gso(SOCKET_TYPE fd,
+    struct sockaddr* addr_dest,
+    socklen_t dest_length,
+    struct sockaddr* addr_from,
+    socklen_t from_length,
+    unsigned long dest_if,
+    const char* bytes, int length, int segment_size, uint64_t departure_time, int* gso_disabled);
+
 int picoquic_get_server_address(const char* ip_address_text, int server_port,
     struct sockaddr_storage* server_address,
     int* server_addr_length,
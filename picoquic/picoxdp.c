@@ -0,0 +1,758 @@
+#include "picoxdp.h"
+#include "fnv1a.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef PICOQUIC_WITH_AF_XDP
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#define PICOQUIC_XDP_ETH_HEADER 14
+#define PICOQUIC_XDP_ETH_P_IP 0x0800
+#define PICOQUIC_XDP_ETH_P_IPV6 0x86DD
+#define PICOQUIC_XDP_IPPROTO_UDP 17
+#define PICOQUIC_XDP_TTL 64
+
+/* One's complement sum of the bytes, taken as 16 bits words in network order */
+static uint32_t picoquic_xdp_sum(const uint8_t* bytes, size_t length, uint32_t sum)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < length; i += 2) {
+        sum += ((uint32_t)bytes[i] << 8) | bytes[i + 1];
+    }
+    if (i < length) {
+        sum += (uint32_t)bytes[i] << 8;
+    }
+
+    return sum;
+}
+
+static uint16_t picoquic_xdp_checksum(uint32_t sum)
+{
+    while ((sum >> 16) != 0) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return (uint16_t)~sum;
+}
+
+int picoquic_xdp_encap(uint8_t* payload, size_t payload_length, const uint8_t* mac_src, const uint8_t* mac_dst,
+    struct sockaddr* addr_from, struct sockaddr* addr_dest)
+{
+    uint8_t* udp = payload - 8;
+    uint8_t* ip;
+    uint8_t* eth;
+    size_t udp_length = payload_length + 8;
+    uint16_t eth_type;
+    uint16_t checksum;
+    uint32_t sum;
+
+    if (addr_from->sa_family != addr_dest->sa_family || udp_length > 0xFFFF - 40) {
+        return -1;
+    }
+
+    if (addr_dest->sa_family == AF_INET) {
+        size_t ip_length = 20 + udp_length;
+
+        ip = udp - 20;
+        ip[0] = 0x45;
+        ip[1] = 0;
+        ip[2] = (uint8_t)(ip_length >> 8);
+        ip[3] = (uint8_t)ip_length;
+        ip[4] = 0;
+        ip[5] = 0;
+        ip[6] = 0x40; /* Don't fragment */
+        ip[7] = 0;
+        ip[8] = PICOQUIC_XDP_TTL;
+        ip[9] = PICOQUIC_XDP_IPPROTO_UDP;
+        ip[10] = 0;
+        ip[11] = 0;
+        memcpy(ip + 12, &((struct sockaddr_in*)addr_from)->sin_addr, 4);
+        memcpy(ip + 16, &((struct sockaddr_in*)addr_dest)->sin_addr, 4);
+        checksum = picoquic_xdp_checksum(picoquic_xdp_sum(ip, 20, 0));
+        ip[10] = (uint8_t)(checksum >> 8);
+        ip[11] = (uint8_t)checksum;
+        memcpy(udp, &((struct sockaddr_in*)addr_from)->sin_port, 2);
+        memcpy(udp + 2, &((struct sockaddr_in*)addr_dest)->sin_port, 2);
+        sum = picoquic_xdp_sum(ip + 12, 8, 0);
+        eth_type = PICOQUIC_XDP_ETH_P_IP;
+    } else if (addr_dest->sa_family == AF_INET6) {
+        ip = udp - 40;
+        ip[0] = 0x60;
+        ip[1] = 0;
+        ip[2] = 0;
+        ip[3] = 0;
+        ip[4] = (uint8_t)(udp_length >> 8);
+        ip[5] = (uint8_t)udp_length;
+        ip[6] = PICOQUIC_XDP_IPPROTO_UDP;
+        ip[7] = PICOQUIC_XDP_TTL;
+        memcpy(ip + 8, &((struct sockaddr_in6*)addr_from)->sin6_addr, 16);
+        memcpy(ip + 24, &((struct sockaddr_in6*)addr_dest)->sin6_addr, 16);
+        memcpy(udp, &((struct sockaddr_in6*)addr_from)->sin6_port, 2);
+        memcpy(udp + 2, &((struct sockaddr_in6*)addr_dest)->sin6_port, 2);
+        sum = picoquic_xdp_sum(ip + 8, 32, 0);
+        eth_type = PICOQUIC_XDP_ETH_P_IPV6;
+    } else {
+        return -1;
+    }
+
+    eth = ip - PICOQUIC_XDP_ETH_HEADER;
+    memcpy(eth, mac_dst, 6);
+    memcpy(eth + 6, mac_src, 6);
+    eth[12] = (uint8_t)(eth_type >> 8);
+    eth[13] = (uint8_t)eth_type;
+
+    /* The pseudo header adds the addresses, the protocol and the length of the UDP header and payload */
+    udp[4] = (uint8_t)(udp_length >> 8);
+    udp[5] = (uint8_t)udp_length;
+    udp[6] = 0;
+    udp[7] = 0;
+    checksum = picoquic_xdp_checksum(picoquic_xdp_sum(udp, udp_length, sum + PICOQUIC_XDP_IPPROTO_UDP + (uint32_t)udp_length));
+    if (checksum == 0) {
+        checksum = 0xFFFF;
+    }
+    udp[6] = (uint8_t)(checksum >> 8);
+    udp[7] = (uint8_t)checksum;
+
+    return (int)(payload - eth);
+}
+
+int picoquic_xdp_decap(uint8_t* frame, size_t length, int port, picoquic_recv_datagram_t* d, uint8_t* mac_src)
+{
+    uint8_t* ip = frame + PICOQUIC_XDP_ETH_HEADER;
+    uint8_t* udp;
+    size_t udp_room;
+    size_t udp_length;
+    uint32_t sum;
+    uint16_t eth_type;
+
+    if (length < PICOQUIC_XDP_ETH_HEADER) {
+        return -1;
+    }
+    eth_type = (uint16_t)((frame[12] << 8) | frame[13]);
+    memset(d, 0, sizeof(picoquic_recv_datagram_t));
+    d->socket = INVALID_SOCKET;
+
+    if (eth_type == PICOQUIC_XDP_ETH_P_IP) {
+        struct sockaddr_in* from4 = (struct sockaddr_in*)&d->addr_from;
+        struct sockaddr_in* dest4 = (struct sockaddr_in*)&d->addr_dest;
+        size_t header_length;
+        size_t ip_length;
+
+        if (length < PICOQUIC_XDP_ETH_HEADER + 20 || (ip[0] >> 4) != 4 || ip[9] != PICOQUIC_XDP_IPPROTO_UDP) {
+            return -1;
+        }
+        header_length = (size_t)(ip[0] & 0x0F) * 4;
+        ip_length = ((size_t)ip[2] << 8) | ip[3];
+        /* The fragments are left to the kernel by the program, they cannot be there */
+        if (header_length < 20 || ip_length < header_length + 8 || PICOQUIC_XDP_ETH_HEADER + ip_length > length ||
+            (ip[6] & 0x3F) != 0 || ip[7] != 0 || picoquic_xdp_checksum(picoquic_xdp_sum(ip, header_length, 0)) != 0) {
+            return -1;
+        }
+        udp = ip + header_length;
+        udp_room = ip_length - header_length;
+        from4->sin_family = AF_INET;
+        memcpy(&from4->sin_addr, ip + 12, 4);
+        memcpy(&from4->sin_port, udp, 2);
+        d->from_length = sizeof(struct sockaddr_in);
+        dest4->sin_family = AF_INET;
+        memcpy(&dest4->sin_addr, ip + 16, 4);
+        memcpy(&dest4->sin_port, udp + 2, 2);
+        d->dest_length = sizeof(struct sockaddr_in);
+        d->tos = ip[1];
+        sum = picoquic_xdp_sum(ip + 12, 8, 0);
+    } else if (eth_type == PICOQUIC_XDP_ETH_P_IPV6) {
+        struct sockaddr_in6* from6 = (struct sockaddr_in6*)&d->addr_from;
+        struct sockaddr_in6* dest6 = (struct sockaddr_in6*)&d->addr_dest;
+
+        if (length < PICOQUIC_XDP_ETH_HEADER + 40 + 8 || (ip[0] >> 4) != 6 || ip[6] != PICOQUIC_XDP_IPPROTO_UDP) {
+            return -1;
+        }
+        udp = ip + 40;
+        udp_room = ((size_t)ip[4] << 8) | ip[5];
+        if (PICOQUIC_XDP_ETH_HEADER + 40 + udp_room > length || udp_room < 8) {
+            return -1;
+        }
+        from6->sin6_family = AF_INET6;
+        memcpy(&from6->sin6_addr, ip + 8, 16);
+        memcpy(&from6->sin6_port, udp, 2);
+        d->from_length = sizeof(struct sockaddr_in6);
+        dest6->sin6_family = AF_INET6;
+        memcpy(&dest6->sin6_addr, ip + 24, 16);
+        memcpy(&dest6->sin6_port, udp + 2, 2);
+        d->dest_length = sizeof(struct sockaddr_in6);
+        d->tos = ((ip[0] & 0x0F) << 4) | (ip[1] >> 4);
+        sum = picoquic_xdp_sum(ip + 8, 32, 0);
+    } else {
+        return -1;
+    }
+
+    udp_length = ((size_t)udp[4] << 8) | udp[5];
+    if (udp_length < 8 || udp_length > udp_room || (((int)udp[2] << 8) | udp[3]) != port) {
+        return -1;
+    }
+    /* A zero checksum means none over IPv4, and is invalid over IPv6 */
+    if ((udp[6] != 0 || udp[7] != 0 || eth_type == PICOQUIC_XDP_ETH_P_IPV6) &&
+        picoquic_xdp_checksum(picoquic_xdp_sum(udp, udp_length, sum + PICOQUIC_XDP_IPPROTO_UDP + (uint32_t)udp_length)) != 0) {
+        return -1;
+    }
+
+    d->bytes = udp + 8;
+    d->length = (int)udp_length - 8;
+    memcpy(mac_src, frame + 6, 6);
+
+    return 0;
+}
+
+#ifdef PICOQUIC_WITH_AF_XDP
+#define PICOQUIC_XDP_RING_SIZE (PICOQUIC_XDP_NB_FRAMES / 2)
+#define PICOQUIC_XDP_MAX_QUEUES 64
+#define PICOQUIC_XDP_NEIGHBORS 256
+
+typedef struct st_picoquic_xdp_ring_t {
+    uint32_t* producer;
+    uint32_t* consumer;
+    uint32_t* flags;
+    void* descs;
+    uint32_t mask;
+    void* map;
+    size_t map_size;
+} picoquic_xdp_ring_t;
+
+typedef struct st_picoquic_xdp_neighbor_t {
+    struct sockaddr_storage addr;
+    uint8_t mac[6];
+} picoquic_xdp_neighbor_t;
+
+struct st_picoquic_xdp_t {
+    int fd;
+    int ifindex;
+    int port;
+    int map_fd;
+    int prog_fd;
+    int link_fd;
+    uint8_t* umem;
+    size_t umem_size;
+    picoquic_xdp_ring_t rx;
+    picoquic_xdp_ring_t tx;
+    picoquic_xdp_ring_t fill;
+    picoquic_xdp_ring_t comp;
+    uint64_t free_frames[PICOQUIC_XDP_RING_SIZE]; /* Frames to send in */
+    int nb_free_frames;
+    uint64_t lent[PICOQUIC_XDP_RING_SIZE]; /* Received frames held by the datagrams of the last batch */
+    int nb_lent;
+    int has_reserved_frame;
+    uint64_t reserved_frame;
+    int nb_queued;
+    uint8_t mac[6];
+    uint8_t last_mac[6];
+    picoquic_xdp_neighbor_t neighbors[PICOQUIC_XDP_NEIGHBORS];
+    picoquic_quic_t* quic;
+};
+
+/*
+ * The XDP program, in eBPF. It redirects the UDP datagrams to the port to the socket of their receive
+ * queue in the XSKMAP, and passes the rest, as well as the IPv4 fragments past the first one, which have
+ * no UDP header, and the IPv6 packets with extension headers.
+ */
+#define XDP_INSN(c, d, s, o, i) { (uint8_t)(c), (d), (s), (int16_t)(o), (int32_t)(i) }
+#define XDP_MOV64_REG(d, s) XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define XDP_MOV64_IMM(d, i) XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define XDP_ALU64_IMM(op, d, i) XDP_INSN(BPF_ALU64 | (op) | BPF_K, d, 0, 0, i)
+#define XDP_ALU64_REG(op, d, s) XDP_INSN(BPF_ALU64 | (op) | BPF_X, d, s, 0, 0)
+#define XDP_LDX_MEM(size, d, s, o) XDP_INSN(BPF_LDX | (size) | BPF_MEM, d, s, o, 0)
+#define XDP_JMP_REG(op, d, s, o) XDP_INSN(BPF_JMP | (op) | BPF_X, d, s, o, 0)
+#define XDP_JMP_IMM(op, d, i, o) XDP_INSN(BPF_JMP | (op) | BPF_K, d, 0, o, i)
+#define XDP_JA(o) XDP_INSN(BPF_JMP | BPF_JA, 0, 0, o, 0)
+#define XDP_CALL(f) XDP_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define XDP_EXIT() XDP_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+static int picoquic_xdp_load_program(int map_fd, int port)
+{
+    /* The jumps count the instructions after them, the targets are in the comments */
+    struct bpf_insn insns[] = {
+        XDP_MOV64_REG(BPF_REG_6, BPF_REG_1),                       /* 0: r6 = ctx */
+        XDP_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_1, 0),               /* 1: r2 = data */
+        XDP_LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_1, 4),               /* 2: r3 = data_end */
+        XDP_MOV64_REG(BPF_REG_4, BPF_REG_2),                       /* 3 */
+        XDP_ALU64_IMM(BPF_ADD, BPF_REG_4, 42),                     /* 4: Ethernet, IPv4 and UDP */
+        XDP_JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, 27),            /* 5: to 33 */
+        XDP_LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, 12),              /* 6: r5 = Ethernet type */
+        XDP_JMP_IMM(BPF_JEQ, BPF_REG_5, htons(PICOQUIC_XDP_ETH_P_IP), 8),    /* 7: to 16 */
+        XDP_JMP_IMM(BPF_JNE, BPF_REG_5, htons(PICOQUIC_XDP_ETH_P_IPV6), 24), /* 8: to 33 */
+        XDP_MOV64_REG(BPF_REG_4, BPF_REG_2),                       /* 9 */
+        XDP_ALU64_IMM(BPF_ADD, BPF_REG_4, 62),                     /* 10: Ethernet, IPv6 and UDP */
+        XDP_JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, 21),            /* 11: to 33 */
+        XDP_LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_2, 20),              /* 12: r5 = next header */
+        XDP_JMP_IMM(BPF_JNE, BPF_REG_5, PICOQUIC_XDP_IPPROTO_UDP, 19),       /* 13: to 33 */
+        XDP_LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, 56),              /* 14: r5 = destination port */
+        XDP_JA(10),                                                /* 15: to 26 */
+        XDP_LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_2, 23),              /* 16: r5 = protocol */
+        XDP_JMP_IMM(BPF_JNE, BPF_REG_5, PICOQUIC_XDP_IPPROTO_UDP, 15),       /* 17: to 33 */
+        XDP_LDX_MEM(BPF_B, BPF_REG_5, BPF_REG_2, 14),              /* 18: r5 = version and header length */
+        XDP_ALU64_IMM(BPF_AND, BPF_REG_5, 0x0F),                   /* 19 */
+        XDP_ALU64_IMM(BPF_LSH, BPF_REG_5, 2),                      /* 20 */
+        XDP_ALU64_REG(BPF_ADD, BPF_REG_2, BPF_REG_5),              /* 21: r2 = data + IPv4 header */
+        XDP_MOV64_REG(BPF_REG_4, BPF_REG_2),                       /* 22 */
+        XDP_ALU64_IMM(BPF_ADD, BPF_REG_4, 22),                     /* 23: Ethernet and UDP */
+        XDP_JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, 8),             /* 24: to 33 */
+        XDP_LDX_MEM(BPF_H, BPF_REG_5, BPF_REG_2, 16),              /* 25: r5 = destination port */
+        XDP_JMP_IMM(BPF_JNE, BPF_REG_5, htons((uint16_t)port), 6), /* 26: to 33 */
+        XDP_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_6, 16),              /* 27: r2 = rx_queue_index */
+        XDP_INSN(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd), /* 28: r1 = map */
+        XDP_INSN(0, 0, 0, 0, 0),                                   /* 29 */
+        XDP_MOV64_IMM(BPF_REG_3, XDP_PASS),                        /* 30: without a socket in the map */
+        XDP_CALL(BPF_FUNC_redirect_map),                           /* 31 */
+        XDP_EXIT(),                                                /* 32 */
+        XDP_MOV64_IMM(BPF_REG_0, XDP_PASS),                        /* 33 */
+        XDP_EXIT()                                                 /* 34 */
+    };
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t)(uintptr_t)insns;
+    attr.insn_cnt = sizeof(insns) / sizeof(struct bpf_insn);
+    attr.license = (uint64_t)(uintptr_t)"Dual BSD/GPL";
+
+    return (int)syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+}
+
+static int picoquic_xdp_attach(picoquic_xdp_t* xdp, int queue_id, int port, uint32_t flags)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(int);
+    attr.value_size = sizeof(int);
+    attr.max_entries = PICOQUIC_XDP_MAX_QUEUES;
+    if ((xdp->map_fd = (int)syscall(__NR_bpf, BPF_MAP_CREATE, &attr, sizeof(attr))) < 0) {
+        DBG_PRINTF("Cannot create the XSKMAP, error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = xdp->map_fd;
+    attr.key = (uint64_t)(uintptr_t)&queue_id;
+    attr.value = (uint64_t)(uintptr_t)&xdp->fd;
+    if (syscall(__NR_bpf, BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr)) != 0) {
+        DBG_PRINTF("Cannot add the socket to the XSKMAP, error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if ((xdp->prog_fd = picoquic_xdp_load_program(xdp->map_fd, port)) < 0) {
+        DBG_PRINTF("Cannot load the XDP program, error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* The program stays attached as long as the link is open */
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = xdp->prog_fd;
+    attr.link_create.target_ifindex = xdp->ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = (flags & PICOQUIC_XDP_FLAG_SKB_MODE) ? XDP_FLAGS_SKB_MODE : 0;
+    if ((xdp->link_fd = (int)syscall(__NR_bpf, BPF_LINK_CREATE, &attr, sizeof(attr))) < 0) {
+        DBG_PRINTF("Cannot attach the XDP program, error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int picoquic_xdp_map_ring(picoquic_xdp_t* xdp, picoquic_xdp_ring_t* ring, struct xdp_ring_offset* off,
+    size_t desc_size, off_t pgoff)
+{
+    ring->map_size = off->desc + PICOQUIC_XDP_RING_SIZE * desc_size;
+    ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, xdp->fd, pgoff);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        return -1;
+    }
+    ring->producer = (uint32_t*)((uint8_t*)ring->map + off->producer);
+    ring->consumer = (uint32_t*)((uint8_t*)ring->map + off->consumer);
+    ring->flags = (uint32_t*)((uint8_t*)ring->map + off->flags);
+    ring->descs = (uint8_t*)ring->map + off->desc;
+    ring->mask = PICOQUIC_XDP_RING_SIZE - 1;
+
+    return 0;
+}
+
+static int picoquic_xdp_open_socket(picoquic_xdp_t* xdp, int queue_id, uint32_t flags)
+{
+    struct xdp_umem_reg reg;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    socklen_t optlen = sizeof(off);
+    int ring_size = PICOQUIC_XDP_RING_SIZE;
+
+    xdp->umem_size = (size_t)PICOQUIC_XDP_NB_FRAMES * PICOQUIC_XDP_FRAME_SIZE;
+    xdp->umem = (uint8_t*)mmap(NULL, xdp->umem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (xdp->umem == MAP_FAILED) {
+        xdp->umem = NULL;
+        return -1;
+    }
+    if ((xdp->fd = socket(AF_XDP, SOCK_RAW, 0)) < 0) {
+        DBG_PRINTF("Cannot open the AF_XDP socket, error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uint64_t)(uintptr_t)xdp->umem;
+    reg.len = xdp->umem_size;
+    reg.chunk_size = PICOQUIC_XDP_FRAME_SIZE;
+    if (setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0 ||
+        setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(int)) != 0 ||
+        setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(int)) != 0 ||
+        setsockopt(xdp->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(int)) != 0 ||
+        setsockopt(xdp->fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(int)) != 0 ||
+        getsockopt(xdp->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0) {
+        DBG_PRINTF("Cannot set up the UMEM, error: %s\n", strerror(errno));
+        return -1;
+    }
+    if (picoquic_xdp_map_ring(xdp, &xdp->rx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) != 0 ||
+        picoquic_xdp_map_ring(xdp, &xdp->tx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) != 0 ||
+        picoquic_xdp_map_ring(xdp, &xdp->fill, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) != 0 ||
+        picoquic_xdp_map_ring(xdp, &xdp->comp, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) != 0) {
+        DBG_PRINTF("%s", "Cannot map the rings\n");
+        return -1;
+    }
+
+    /* The first half of the frames receives, the second half sends */
+    for (uint32_t i = 0; i < PICOQUIC_XDP_RING_SIZE; i++) {
+        ((uint64_t*)xdp->fill.descs)[i] = (uint64_t)i * PICOQUIC_XDP_FRAME_SIZE;
+        xdp->free_frames[i] = (uint64_t)(PICOQUIC_XDP_RING_SIZE + i) * PICOQUIC_XDP_FRAME_SIZE;
+    }
+    xdp->nb_free_frames = PICOQUIC_XDP_RING_SIZE;
+    __atomic_store_n(xdp->fill.producer, PICOQUIC_XDP_RING_SIZE, __ATOMIC_RELEASE);
+
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = (uint32_t)xdp->ifindex;
+    sxdp.sxdp_queue_id = (uint32_t)queue_id;
+    sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+    if (flags & PICOQUIC_XDP_FLAG_ZEROCOPY) {
+        sxdp.sxdp_flags |= XDP_ZEROCOPY;
+    } else if (flags & PICOQUIC_XDP_FLAG_SKB_MODE) {
+        sxdp.sxdp_flags |= XDP_COPY;
+    }
+    if (bind(xdp->fd, (struct sockaddr*)&sxdp, sizeof(sxdp)) != 0) {
+        DBG_PRINTF("Cannot bind the AF_XDP socket, error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int picoquic_xdp_get_mac(const char* ifname, uint8_t* mac)
+{
+    struct ifreq ifr;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int ret = -1;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (fd >= 0 && ioctl(fd, SIOCGIFHWADDR, &ifr) == 0) {
+        memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+        ret = 0;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    return ret;
+}
+
+static picoquic_xdp_neighbor_t* picoquic_xdp_neighbor(picoquic_xdp_t* xdp, struct sockaddr* addr)
+{
+    uint64_t h;
+
+    if (addr->sa_family == AF_INET) {
+        h = fnv1a_hash(FNV1A_OFFSET, (uint8_t*)&((struct sockaddr_in*)addr)->sin_addr, 4);
+    } else {
+        h = fnv1a_hash(FNV1A_OFFSET, (uint8_t*)&((struct sockaddr_in6*)addr)->sin6_addr, 16);
+    }
+
+    return &xdp->neighbors[h % PICOQUIC_XDP_NEIGHBORS];
+}
+
+static int picoquic_xdp_same_host(struct sockaddr* a, struct sockaddr* b)
+{
+    if (a->sa_family != b->sa_family) {
+        return 0;
+    } else if (a->sa_family == AF_INET) {
+        return memcmp(&((struct sockaddr_in*)a)->sin_addr, &((struct sockaddr_in*)b)->sin_addr, 4) == 0;
+    } else {
+        return memcmp(&((struct sockaddr_in6*)a)->sin6_addr, &((struct sockaddr_in6*)b)->sin6_addr, 16) == 0;
+    }
+}
+
+static void picoquic_xdp_learn(picoquic_xdp_t* xdp, struct sockaddr* addr, const uint8_t* mac)
+{
+    picoquic_xdp_neighbor_t* neighbor = picoquic_xdp_neighbor(xdp, addr);
+
+    memcpy(&neighbor->addr, addr, (addr->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+    memcpy(neighbor->mac, mac, 6);
+    memcpy(xdp->last_mac, mac, 6);
+}
+
+void picoquic_xdp_free(picoquic_xdp_t* xdp)
+{
+    /* Closing the link detaches the program */
+    if (xdp->link_fd >= 0) {
+        close(xdp->link_fd);
+    }
+    if (xdp->prog_fd >= 0) {
+        close(xdp->prog_fd);
+    }
+    if (xdp->map_fd >= 0) {
+        close(xdp->map_fd);
+    }
+    if (xdp->fd >= 0) {
+        close(xdp->fd);
+    }
+    if (xdp->rx.map != NULL) {
+        munmap(xdp->rx.map, xdp->rx.map_size);
+    }
+    if (xdp->tx.map != NULL) {
+        munmap(xdp->tx.map, xdp->tx.map_size);
+    }
+    if (xdp->fill.map != NULL) {
+        munmap(xdp->fill.map, xdp->fill.map_size);
+    }
+    if (xdp->comp.map != NULL) {
+        munmap(xdp->comp.map, xdp->comp.map_size);
+    }
+    if (xdp->umem != NULL) {
+        munmap(xdp->umem, xdp->umem_size);
+    }
+    free(xdp);
+}
+
+picoquic_xdp_t* picoquic_xdp_create(const char* ifname, int queue_id, int port, uint32_t flags)
+{
+    picoquic_xdp_t* xdp = (picoquic_xdp_t*)calloc(1, sizeof(picoquic_xdp_t));
+
+    if (xdp == NULL) {
+        return NULL;
+    }
+    xdp->fd = xdp->map_fd = xdp->prog_fd = xdp->link_fd = -1;
+    xdp->port = port;
+
+    if (queue_id < 0 || queue_id >= PICOQUIC_XDP_MAX_QUEUES || (xdp->ifindex = (int)if_nametoindex(ifname)) == 0 ||
+        picoquic_xdp_get_mac(ifname, xdp->mac) != 0 || picoquic_xdp_open_socket(xdp, queue_id, flags) != 0 ||
+        picoquic_xdp_attach(xdp, queue_id, port, flags) != 0) {
+        DBG_PRINTF("Cannot use AF_XDP on %s, queue %d\n", ifname, queue_id);
+        picoquic_xdp_free(xdp);
+        xdp = NULL;
+    }
+
+    return xdp;
+}
+
+void picoquic_xdp_set_quic(picoquic_xdp_t* xdp, picoquic_quic_t* quic)
+{
+    xdp->quic = quic;
+}
+
+/* The sent frames come back through the completion ring */
+static void picoquic_xdp_reap_completions(picoquic_xdp_t* xdp)
+{
+    uint32_t consumer = *xdp->comp.consumer;
+    uint32_t producer = __atomic_load_n(xdp->comp.producer, __ATOMIC_ACQUIRE);
+
+    while (consumer != producer) {
+        uint64_t addr = ((uint64_t*)xdp->comp.descs)[consumer & xdp->comp.mask];
+
+        xdp->free_frames[xdp->nb_free_frames++] = addr - (addr % PICOQUIC_XDP_FRAME_SIZE);
+        consumer++;
+    }
+    __atomic_store_n(xdp->comp.consumer, consumer, __ATOMIC_RELEASE);
+}
+
+int picoquic_xdp_submit(picoquic_xdp_t* xdp)
+{
+    int ret = 0;
+
+    if (xdp->nb_queued > 0 && (__atomic_load_n(xdp->tx.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP) != 0 &&
+        sendto(xdp->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 && errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+        DBG_PRINTF("Cannot wake up the transmission, error: %s\n", strerror(errno));
+        ret = -1;
+    }
+    xdp->nb_queued = 0;
+
+    return ret;
+}
+
+int picoquic_xdp_recv_batch(picoquic_xdp_t* xdp, picoquic_recv_datagram_t* datagrams, int max_datagrams,
+    int64_t delta_t, uint64_t* current_time)
+{
+    int nb_received = 0;
+    uint32_t producer;
+    uint32_t consumer = *xdp->rx.consumer;
+    uint32_t fill_producer = *xdp->fill.producer;
+
+    /* The frames of the previous batch have been processed, they go back to the fill ring */
+    for (int i = 0; i < xdp->nb_lent; i++) {
+        ((uint64_t*)xdp->fill.descs)[fill_producer++ & xdp->fill.mask] = xdp->lent[i];
+    }
+    xdp->nb_lent = 0;
+    __atomic_store_n(xdp->fill.producer, fill_producer, __ATOMIC_RELEASE);
+
+    picoquic_xdp_reap_completions(xdp);
+    if (picoquic_xdp_submit(xdp) != 0) {
+        nb_received = -1;
+    }
+
+    producer = __atomic_load_n(xdp->rx.producer, __ATOMIC_ACQUIRE);
+    if (nb_received == 0 && producer == consumer && delta_t > 0) {
+        struct pollfd pfd;
+        int timeout_ms;
+
+        /* Same bounds as picoquic_select(), rounded up not to wake up before the timer is due */
+        if (delta_t > 10000000) {
+            delta_t = 10000000;
+        }
+        timeout_ms = (int)((delta_t + 999) / 1000);
+        pfd.fd = xdp->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR) {
+            nb_received = -1;
+        }
+        producer = __atomic_load_n(xdp->rx.producer, __ATOMIC_ACQUIRE);
+    }
+
+    while (nb_received >= 0 && nb_received < max_datagrams && consumer != producer) {
+        struct xdp_desc* desc = &((struct xdp_desc*)xdp->rx.descs)[consumer & xdp->rx.mask];
+        picoquic_recv_datagram_t* d = &datagrams[nb_received];
+        uint8_t mac[6];
+
+        xdp->lent[xdp->nb_lent++] = desc->addr - (desc->addr % PICOQUIC_XDP_FRAME_SIZE);
+        if (picoquic_xdp_decap(xdp->umem + desc->addr, desc->len, xdp->port, d, mac) == 0) {
+            d->dest_if = (unsigned long)xdp->ifindex;
+            picoquic_xdp_learn(xdp, (struct sockaddr*)&d->addr_from, mac);
+            nb_received++;
+        }
+        consumer++;
+    }
+    __atomic_store_n(xdp->rx.consumer, consumer, __ATOMIC_RELEASE);
+
+    *current_time = (xdp->quic != NULL) ? picoquic_refresh_time(xdp->quic) : picoquic_current_time();
+
+    return nb_received;
+}
+
+uint8_t* picoquic_xdp_get_send_buffer(picoquic_xdp_t* xdp)
+{
+    if (!xdp->has_reserved_frame) {
+        if (xdp->nb_free_frames == 0) {
+            picoquic_xdp_reap_completions(xdp);
+        }
+        if (xdp->nb_free_frames == 0) {
+            return NULL;
+        }
+        xdp->reserved_frame = xdp->free_frames[--xdp->nb_free_frames];
+        xdp->has_reserved_frame = 1;
+    }
+
+    return xdp->umem + xdp->reserved_frame + PICOQUIC_XDP_HEADROOM;
+}
+
+int picoquic_xdp_queue_send(picoquic_xdp_t* xdp, struct sockaddr* addr_dest, struct sockaddr* addr_from, int length)
+{
+    picoquic_xdp_neighbor_t* neighbor = picoquic_xdp_neighbor(xdp, addr_dest);
+    struct sockaddr_storage from;
+    uint32_t producer = *xdp->tx.producer;
+    struct xdp_desc* desc;
+    int header_length;
+
+    if (!xdp->has_reserved_frame || length <= 0 || length > PICOQUIC_XDP_MAX_PAYLOAD ||
+        producer - __atomic_load_n(xdp->tx.consumer, __ATOMIC_ACQUIRE) >= PICOQUIC_XDP_RING_SIZE) {
+        return -1;
+    }
+
+    memcpy(&from, addr_from, (addr_from->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+    if (from.ss_family == AF_INET) {
+        ((struct sockaddr_in*)&from)->sin_port = htons((uint16_t)xdp->port);
+    } else {
+        ((struct sockaddr_in6*)&from)->sin6_port = htons((uint16_t)xdp->port);
+    }
+    header_length = picoquic_xdp_encap(xdp->umem + xdp->reserved_frame + PICOQUIC_XDP_HEADROOM, (size_t)length, xdp->mac,
+        picoquic_xdp_same_host((struct sockaddr*)&neighbor->addr, addr_dest) ? neighbor->mac : xdp->last_mac,
+        (struct sockaddr*)&from, addr_dest);
+    if (header_length < 0) {
+        return -1;
+    }
+
+    desc = &((struct xdp_desc*)xdp->tx.descs)[producer & xdp->tx.mask];
+    desc->addr = xdp->reserved_frame + PICOQUIC_XDP_HEADROOM - header_length;
+    desc->len = (uint32_t)(header_length + length);
+    desc->options = 0;
+    __atomic_store_n(xdp->tx.producer, producer + 1, __ATOMIC_RELEASE);
+    xdp->has_reserved_frame = 0;
+    xdp->nb_queued++;
+
+    return 0;
+}
+#else
+picoquic_xdp_t* picoquic_xdp_create(const char* ifname, int queue_id, int port, uint32_t flags)
+{
+    (void)ifname;
+    (void)queue_id;
+    (void)port;
+    (void)flags;
+    return NULL;
+}
+
+void picoquic_xdp_free(picoquic_xdp_t* xdp)
+{
+    (void)xdp;
+}
+
+void picoquic_xdp_set_quic(picoquic_xdp_t* xdp, picoquic_quic_t* quic)
+{
+    (void)xdp;
+    (void)quic;
+}
+
+int picoquic_xdp_recv_batch(picoquic_xdp_t* xdp, picoquic_recv_datagram_t* datagrams, int max_datagrams,
+    int64_t delta_t, uint64_t* current_time)
+{
+    (void)xdp;
+    (void)datagrams;
+    (void)max_datagrams;
+    (void)delta_t;
+    *current_time = picoquic_current_time();
+    return -1;
+}
+
+uint8_t* picoquic_xdp_get_send_buffer(picoquic_xdp_t* xdp)
+{
+    (void)xdp;
+    return NULL;
+}
+
+int picoquic_xdp_queue_send(picoquic_xdp_t* xdp, struct sockaddr* addr_dest, struct sockaddr* addr_from, int length)
+{
+    (void)xdp;
+    (void)addr_dest;
+    (void)addr_from;
+    (void)length;
+    return -1;
+}
+
+int picoquic_xdp_submit(picoquic_xdp_t* xdp)
+{
+    (void)xdp;
+    return -1;
+}
+#endif
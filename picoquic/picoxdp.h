@@ -0,0 +1,58 @@
+/**
+ * \file picoxdp.h
+ * \brief AF_XDP backend, which receives and sends the datagrams of one UDP port without the kernel stack.
+ *
+ * An XDP program attached to the interface redirects the UDP datagrams to the port, over IPv4 or IPv6,
+ * to the AF_XDP socket of their receive queue, and passes the other packets to the kernel. The frames
+ * live in a memory area, the UMEM, shared with the kernel, or with the NIC in zero copy mode: the
+ * datagrams returned by picoquic_xdp_recv_batch() point into their frames, which stay valid until the
+ * next call, and the packets to send are prepared in place, after room for the headers, in the frame
+ * returned by picoquic_xdp_get_send_buffer(). There is no segmentation offload, a frame holds a datagram.
+ *
+ * The Ethernet address of a peer is learned from the frames it sends, which is that of the gateway for
+ * the peers that are not on the link. The packets to the other destinations go to the last address
+ * learned. Creating the backend needs CAP_NET_ADMIN and CAP_BPF, or root, and Linux 5.9 or later.
+ */
+
+#ifndef PICOXDP_H
+#define PICOXDP_H
+
+#include "picosocks.h"
+
+#define PICOQUIC_XDP_FRAME_SIZE 2048
+#define PICOQUIC_XDP_NB_FRAMES 4096 /* Half to receive, half to send */
+#define PICOQUIC_XDP_HEADROOM 64 /* Room for the Ethernet, IPv6 and UDP headers before a payload */
+#define PICOQUIC_XDP_MAX_PAYLOAD (PICOQUIC_XDP_FRAME_SIZE - PICOQUIC_XDP_HEADROOM)
+
+#define PICOQUIC_XDP_FLAG_SKB_MODE 1 /* Generic XDP, for the drivers without native support */
+#define PICOQUIC_XDP_FLAG_ZEROCOPY 2 /* Fails if the driver cannot share the UMEM with the NIC */
+
+typedef struct st_picoquic_xdp_t picoquic_xdp_t;
+
+/* Returns NULL if the socket, the UMEM or the program cannot be set up on ifname */
+picoquic_xdp_t* picoquic_xdp_create(const char* ifname, int queue_id, int port, uint32_t flags);
+void picoquic_xdp_free(picoquic_xdp_t* xdp);
+void picoquic_xdp_set_quic(picoquic_xdp_t* xdp, picoquic_quic_t* quic);
+
+/* Same as picoquic_event_loop_recv_batch(), without copying the datagrams. Their socket is INVALID_SOCKET */
+int picoquic_xdp_recv_batch(picoquic_xdp_t* xdp, picoquic_recv_datagram_t* datagrams, int max_datagrams,
+    int64_t delta_t, uint64_t* current_time);
+
+/* Buffer of PICOQUIC_XDP_MAX_PAYLOAD bytes for the next datagram, or NULL if all the frames are in flight */
+uint8_t* picoquic_xdp_get_send_buffer(picoquic_xdp_t* xdp);
+
+/* Queues the first length bytes of the buffer, sent with the next receive or submit. addr_from must have
+ * the family of addr_dest, its port is replaced by the one of the backend. */
+int picoquic_xdp_queue_send(picoquic_xdp_t* xdp, struct sockaddr* addr_dest, struct sockaddr* addr_from, int length);
+int picoquic_xdp_submit(picoquic_xdp_t* xdp);
+
+/* Writes the Ethernet, IP and UDP headers just before the payload, which needs PICOQUIC_XDP_HEADROOM bytes in
+ * front of it. Returns the length of the headers, or -1 if the addresses are not of the same family. */
+int picoquic_xdp_encap(uint8_t* payload, size_t payload_length, const uint8_t* mac_src, const uint8_t* mac_dst,
+    struct sockaddr* addr_from, struct sockaddr* addr_dest);
+
+/* Sets the addresses and the payload of a datagram from its frame, and copies the Ethernet source of the
+ * frame in mac_src. Returns -1 if the frame is not a valid UDP datagram to port, 0 otherwise. */
+int picoquic_xdp_decap(uint8_t* frame, size_t length, int port, picoquic_recv_datagram_t* d, uint8_t* mac_src);
+
+#endif /* PICOXDP_H */
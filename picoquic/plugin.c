@@ -1,9 +1,11 @@
 #include "plugin.h"
 #include <libgen.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include "memory.h"
+#include "plugin_async.h"
 #include "picoquic_internal.h"
 
 #include <archive.h>
@@ -11,7 +13,13 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "fnv1a.h"
+#include "tracepoints.h"
+#include "offload_pool.h"
 
 typedef enum {
     plugin_inject_all = 0,
@@ -34,32 +42,81 @@ const char *pluglet_type_name(pluglet_type_enum te) {
         case pluglet_extern:
             text = "extern";
             break;
+        case pluglet_record:
+            text = "record";
+            break;
+        case pluglet_async:
+            text = "async";
+            break;
+        case pluglet_private:
+            text = "private";
+            break;
         default:
             break;
     }
     return text;
 }
 
-int plugin_plug_elf_param_struct(protocol_operation_param_struct_t *popst, protoop_plugin_t *p, pluglet_type_enum pte, char *elf_fname) {
+int plugin_plug_elf_param_struct(protocol_operation_param_struct_t *popst, protoop_plugin_t *p, pluglet_type_enum pte, char *elf_fname, const char *pluglet_args, pluglet_image_t *image) {
     /* Fast track: if we want to insert a replace plugin while there is already one, it will never work! */
-    if ((pte == pluglet_replace || pte == pluglet_extern) && popst->replace) {
+    if ((pte == pluglet_replace || pte == pluglet_extern || pte == pluglet_private) && popst->replace) {
         printf("Replace pluglet already inserted!\n");
         return 1;
     }
 
-    if (!popst->intern && (pte == pluglet_pre || pte == pluglet_post)) {
+    /* A private operation is one of the plugin, that its pluglets call without any observer in between */
+    if (pte == pluglet_private && (!popst->intern || popst->core || popst->pre || popst->post || popst->record || popst->async)) {
+        printf("A private pluglet can only be inserted on a new internal operation without observers!\n");
+        return 1;
+    }
+    if (popst->is_private && popst->replace && pte != pluglet_private) {
+        printf("Cannot insert a pluglet on a private protocol operation!\n");
+        return 1;
+    }
+
+    if (!popst->intern && (pte == pluglet_pre || pte == pluglet_post || pte == pluglet_record || pte == pluglet_async)) {
         printf("External pluglet cannot have observers!\n");
         return 1;
     }
 
-    if (popst->intern && pte == pluglet_extern && (popst->core || popst->pre || popst->post)) {
+    if (popst->intern && pte == pluglet_extern && (popst->core || popst->pre || popst->post || popst->record || popst->async)) {
         printf("An internal pluglet already exists!\n");
         return 1;
     }
 
+    /* A record anchor does not run any code, the core just keeps the calls in the ring of the plugin */
+    if (pte == pluglet_record) {
+        recorder_node_t *new_recorder = malloc(sizeof(recorder_node_t));
+        if (!new_recorder) {
+            printf("Cannot allocate memory to insert record node for plugin %s\n", p->name);
+            return 1;
+        }
+        new_recorder->p = p;
+        new_recorder->next = popst->record;
+        popst->record = new_recorder;
+        picoquic_update_plain_core(popst);
+        return 0;
+    }
+
+    /* An async observer has its own VM and memory, as it runs in the worker thread */
+    if (pte == pluglet_async) {
+        plugin_async_observer_t *new_observer = plugin_async_observer_create(elf_fname, image, pluglet_args);
+        if (!new_observer) {
+            printf("Failed to insert %s\n", elf_fname);
+            return 1;
+        }
+        new_observer->p = p;
+        new_observer->next = popst->async;
+        popst->async = new_observer;
+        picoquic_update_plain_core(popst);
+        return 0;
+    }
+
     /* Then check if we can load the plugin! */
     /* FIXME make adjustable memory size */
-    pluglet_t *new_pluglet = load_elf_file(elf_fname, (uint64_t) p->memory, PLUGIN_MEMORY);
+    pluglet_t *new_pluglet = image ? load_elf_image(image, (uint64_t) p->memory, p->memory_size) :
+        pluglet_file_is_native(elf_fname) ? load_native_file(elf_fname) :
+        load_elf_file(elf_fname, (uint64_t) p->memory, p->memory_size);
     if (!new_pluglet) {
         printf("Failed to insert %s\n", elf_fname);
         return 1;
@@ -74,7 +131,9 @@ int plugin_plug_elf_param_struct(protocol_operation_param_struct_t *popst, proto
         popst->intern = false;
         /* this falls through intentionally */
     case pluglet_replace:
+    case pluglet_private:
         popst->replace = new_pluglet;
+        popst->is_private = (pte == pluglet_private);
         break;
     case pluglet_pre:
         new_node = malloc(sizeof(observer_node_t));
@@ -99,11 +158,12 @@ int plugin_plug_elf_param_struct(protocol_operation_param_struct_t *popst, proto
         popst->post = new_node;
         break;
     }
+    picoquic_update_plain_core(popst);
 
     return 0;
 }
 
-int plugin_plug_elf_noparam(protocol_operation_struct_t *post, protoop_plugin_t *p, protoop_str_id_t pid, pluglet_type_enum pte, char *elf_fname) {
+int plugin_plug_elf_noparam(protocol_operation_struct_t *post, protoop_plugin_t *p, protoop_str_id_t pid, pluglet_type_enum pte, char *elf_fname, const char *pluglet_args, pluglet_image_t *image) {
     protocol_operation_param_struct_t *popst = post->params;
     /* Sanity check */
     if (post->is_parametrable) {
@@ -111,10 +171,10 @@ int plugin_plug_elf_noparam(protocol_operation_struct_t *post, protoop_plugin_t
         return 1;
     }
 
-    return plugin_plug_elf_param_struct(popst, p, pte, elf_fname);
+    return plugin_plug_elf_param_struct(popst, p, pte, elf_fname, pluglet_args, image);
 }
 
-int plugin_plug_elf_param(protocol_operation_struct_t *post, protoop_plugin_t *p, protoop_str_id_t pid, param_id_t param, pluglet_type_enum pte, char *elf_fname) {
+int plugin_plug_elf_param(protocol_operation_struct_t *post, protoop_plugin_t *p, protoop_str_id_t pid, param_id_t param, pluglet_type_enum pte, char *elf_fname, const char *pluglet_args, pluglet_image_t *image) {
     protocol_operation_param_struct_t *popst;
     bool created_popst = false;
     /* Sanity check */
@@ -122,7 +182,7 @@ int plugin_plug_elf_param(protocol_operation_struct_t *post, protoop_plugin_t *p
         printf("Trying to insert parameter %u in non-parametrable protocol operation %s\n", param, pid);
         return 1;
     }
-    HASH_FIND(hh, post->params, &param, sizeof(param_id_t), popst);
+    popst = picoquic_find_protoop_param(post, param);
     /* It is possible to have a new parameter with the pluglet */
     if (!popst) {
         popst = create_protocol_operation_param(param, NULL);
@@ -133,7 +193,7 @@ int plugin_plug_elf_param(protocol_operation_struct_t *post, protoop_plugin_t *p
         }
     }
 
-    int err = plugin_plug_elf_param_struct(popst, p, pte, elf_fname);
+    int err = plugin_plug_elf_param_struct(popst, p, pte, elf_fname, pluglet_args, image);
 
     if (err) {
         if (created_popst) {
@@ -147,18 +207,31 @@ int plugin_plug_elf_param(protocol_operation_struct_t *post, protoop_plugin_t *p
     if (created_popst) {
         /* Insert in hash */
         HASH_ADD(hh, post->params, param, sizeof(param_id_t), popst);
+        picoquic_set_protoop_param_table(post, param, popst);
     }
 
     return 0;
 }
 
-int plugin_plug_elf(picoquic_cnx_t *cnx, protoop_plugin_t *p, protoop_str_id_t pid_str, param_id_t param, pluglet_type_enum pte, char *elf_fname) {
+/* Writes in native_fname the path of the native build of the pluglet, i.e., its .o suffix replaced by .so */
+static bool plugin_native_fname(const char *elf_fname, char *native_fname, size_t native_fname_max) {
+    size_t len = strlen(elf_fname);
+    if (len < 2 || strcmp(elf_fname + len - 2, ".o") != 0 || len + 2 > native_fname_max) {
+        return false;
+    }
+    memcpy(native_fname, elf_fname, len - 2);
+    strcpy(native_fname + len - 2, ".so");
+    return access(native_fname, R_OK) == 0;
+}
+
+static int plugin_plug_elf_args(picoquic_cnx_t *cnx, protoop_plugin_t *p, protoop_str_id_t pid_str, param_id_t param, pluglet_type_enum pte, char *elf_fname, const char *pluglet_args) {
     protocol_operation_struct_t *post;
     protoop_id_t pid;
     pid.id = pid_str;
     /* And compute its hash */
     pid.hash = hash_value_str(pid.id);
-    HASH_FIND_PID(cnx->ops, &(pid.hash), post);
+    pid.index = 0;
+    post = picoquic_find_protoop(cnx, &pid);
 
     /* Two cases: either it exists, or not */
     if (!post) {
@@ -173,17 +246,61 @@ int plugin_plug_elf(picoquic_cnx_t *cnx, protoop_plugin_t *p, protoop_str_id_t p
             return 1;
         }
         /* This is not optimal, but this should not be frequent */
-        HASH_FIND_PID(cnx->ops, &(pid.hash), post);
+        post = picoquic_find_protoop(cnx, &pid);
+    }
+
+    /* Prefer the native build of the pluglet if there is one, it is then loaded directly from its file */
+    char native_fname[PATH_MAX];
+    if (cnx->quic && cnx->quic->use_native_pluglets && (pte == pluglet_replace || pte == pluglet_extern || pte == pluglet_private ||
+        pte == pluglet_pre || pte == pluglet_post) &&
+        plugin_native_fname(elf_fname, native_fname, sizeof(native_fname))) {
+        elf_fname = native_fname;
     }
 
+    /* Avoid reading the same ELF file again for each connection */
+    pluglet_image_t *image = cnx->quic && pte != pluglet_record && elf_fname != native_fname ? pluglet_image_get(&cnx->quic->pluglet_images, elf_fname) : NULL;
+
     /* Again, two cases: either it is parametric or not */
-    return param != NO_PARAM ? plugin_plug_elf_param(post, p, pid_str, param, pte, elf_fname) :
-        plugin_plug_elf_noparam(post, p, pid_str, pte, elf_fname);
+    int ret = param != NO_PARAM ? plugin_plug_elf_param(post, p, pid_str, param, pte, elf_fname, pluglet_args, image) :
+        plugin_plug_elf_noparam(post, p, pid_str, pte, elf_fname, pluglet_args, image);
+    if (ret == 0) {
+        picoquic_update_logging_active(cnx);
+        picoquic_update_frame_dispatch(cnx);
+    }
+    return ret;
+}
+
+int plugin_plug_elf(picoquic_cnx_t *cnx, protoop_plugin_t *p, protoop_str_id_t pid_str, param_id_t param, pluglet_type_enum pte, char *elf_fname) {
+    return plugin_plug_elf_args(cnx, p, pid_str, param, pte, elf_fname, NULL);
+}
+
+/* Cope with a special case of a protoop without core op and with no more plugins */
+static void plugin_release_empty_param_struct(picoquic_cnx_t *cnx, protocol_operation_struct_t *post, protocol_operation_param_struct_t *popst)
+{
+    if (!popst->core && !popst->replace && !popst->pre && !popst->post && !popst->record && !popst->async) {
+        /* If it is parametrable, we just remove popst from post->params */
+        if (post->is_parametrable) {
+            HASH_DEL(post->params, popst);
+            picoquic_set_protoop_param_table(post, popst->param, NULL);
+        }
+        else {
+            HASH_DEL(cnx->ops, post);
+            if (post->pid.index > 0 && post->pid.index < PROTOOP_BUILTIN_INDEX_MAX) {
+                cnx->builtin_ops[post->pid.index] = NULL;
+            }
+            free(post->pid.id);
+            free(post);
+            post = NULL;
+        }
+        /* And free popst */
+        free(popst);
+    }
 }
 
 int plugin_unplug(picoquic_cnx_t *cnx, protoop_str_id_t pid, param_id_t param, pluglet_type_enum pte) {
     protocol_operation_struct_t *post;
-    HASH_FIND_STR(cnx->ops, pid, post);
+    protoop_id_t pid_key = { .id = pid, .hash = hash_value_str(pid), .index = 0 };
+    post = picoquic_find_protoop(cnx, &pid_key);
 
     if (!post) {
         printf("Trying to unplug pluglet for non-existing proto op id %s...\n", pid);
@@ -202,7 +319,7 @@ int plugin_unplug(picoquic_cnx_t *cnx, protoop_str_id_t pid, param_id_t param, p
             printf("Trying to remove param %u from non-parametrable protocol operation %s\n", param, pid);
             return 1;
         }
-        HASH_FIND(hh, post->params, &param, sizeof(param_id_t), popst);
+        popst = picoquic_find_protoop_param(post, param);
         if (!popst) {
             printf("Trying to remove non-existing param %u for protocol operation %s\n", param, pid);
             return 1;
@@ -215,6 +332,8 @@ int plugin_unplug(picoquic_cnx_t *cnx, protoop_str_id_t pid, param_id_t param, p
      * is implemented as a stack, we can simply remove the first one.
      */
     observer_node_t *to_remove;
+    recorder_node_t *recorder_to_remove;
+    plugin_async_observer_t *async_to_remove;
     switch (pte) {
     case pluglet_extern:
         if (popst->intern) {
@@ -223,12 +342,14 @@ int plugin_unplug(picoquic_cnx_t *cnx, protoop_str_id_t pid, param_id_t param, p
         }
         /* this falls through intentionally */
     case pluglet_replace:
+    case pluglet_private:
         if (!popst->replace) {
             printf("Trying to unplug non-existing replace pluglet for proto op id %s...\n", pid);
             return 1;
         }
         release_elf(popst->replace);
         popst->replace = NULL;
+        popst->is_private = false;
         break;
     case pluglet_pre:
         if (!popst->pre) {
@@ -252,29 +373,38 @@ int plugin_unplug(picoquic_cnx_t *cnx, protoop_str_id_t pid, param_id_t param, p
         free(to_remove);
         to_remove = NULL;
         break;
-    }
-
-    /* Cope with a special case of a protoop without core op and with no more plugins */
-    if (!popst->core && !popst->replace && !popst->pre && !popst->post) {
-        /* If it is parametrable, we just remove popst from post->params */
-        if (post->is_parametrable) {
-            HASH_DEL(post->params, popst);
+    case pluglet_record:
+        if (!popst->record) {
+            printf("Trying to unplug non-existing record anchor for proto op id %s...\n", pid);
+            return 1;
         }
-        else {
-            HASH_DEL(cnx->ops, post);
-            free(post);
-            post = NULL;
+        recorder_to_remove = popst->record;
+        popst->record = recorder_to_remove->next;
+        free(recorder_to_remove);
+        recorder_to_remove = NULL;
+        break;
+    case pluglet_async:
+        if (!popst->async) {
+            printf("Trying to unplug non-existing async pluglet for proto op id %s...\n", pid);
+            return 1;
         }
-        /* And free popst */
-        free(popst);
+        async_to_remove = popst->async;
+        popst->async = async_to_remove->next;
+        plugin_async_observer_free(async_to_remove);
+        async_to_remove = NULL;
+        break;
     }
+    picoquic_update_plain_core(popst);
+    plugin_release_empty_param_struct(cnx, post, popst);
+    picoquic_update_logging_active(cnx);
+    picoquic_update_frame_dispatch(cnx);
 
     return 0;
 }
 
 bool parse_plugin_line(char* line, protoop_str_id_t inserted_pid,
     param_id_t *param, pluglet_type_enum *pte, char **pluglet_fname,
-    bool *end_preplugin)
+    char **pluglet_args, bool *end_preplugin)
 {
     if (end_preplugin) {
         *end_preplugin = false;
@@ -330,6 +460,15 @@ bool parse_plugin_line(char* line, protoop_str_id_t inserted_pid,
         *pte = pluglet_post;
     } else if (strncmp(token, "extern", 6) == 0) {
         *pte = pluglet_extern;
+    } else if (strncmp(token, "async", 5) == 0) {
+        *pte = pluglet_async;
+    } else if (strncmp(token, "private", 7) == 0) {
+        *pte = pluglet_private;
+    } else if (strncmp(token, "record", 6) == 0) {
+        /* No ELF file is attached to a record anchor */
+        *pte = pluglet_record;
+        *pluglet_fname = NULL;
+        return true;
     } else {
         printf("Cannot extract the type of the pluglet: %s\n", token);
         return false;
@@ -347,6 +486,11 @@ bool parse_plugin_line(char* line, protoop_str_id_t inserted_pid,
 
     *pluglet_fname = token;
 
+    /* The remainder of the line, if any, configures the pluglet */
+    if (pluglet_args) {
+        *pluglet_args = line;
+    }
+
     return true;
 }
 
@@ -355,8 +499,9 @@ bool insert_pluglet_from_plugin_line(picoquic_cnx_t *cnx, char *line, protoop_pl
     plugin_inject_mode_t pim, bool *seen_preplugin_marker)
 {
     char *pluglet_fname;
+    char *pluglet_args;
     bool end_preplugin;
-    bool ok = parse_plugin_line(line, inserted_pid, param, pte, &pluglet_fname, &end_preplugin);
+    bool ok = parse_plugin_line(line, inserted_pid, param, pte, &pluglet_fname, &pluglet_args, &end_preplugin);
 
     switch (pim)
     {
@@ -392,6 +537,10 @@ bool insert_pluglet_from_plugin_line(picoquic_cnx_t *cnx, char *line, protoop_pl
         exit(-1);
     }
 
+    if (*pte == pluglet_record) {
+        return plugin_plug_elf(cnx, p, inserted_pid, *param, *pte, NULL) == 0;
+    }
+
     size_t max_dirname_size = 250;
     char abs_path[max_dirname_size];
     if (strlen(plugin_dirname) >= max_dirname_size){
@@ -403,7 +552,7 @@ bool insert_pluglet_from_plugin_line(picoquic_cnx_t *cnx, char *line, protoop_pl
     strcpy(abs_path, plugin_dirname);
     strcat(abs_path, "/");
     strcat(abs_path, pluglet_fname);
-    return plugin_plug_elf(cnx, p, inserted_pid, *param, *pte, abs_path) == 0;
+    return plugin_plug_elf_args(cnx, p, inserted_pid, *param, *pte, abs_path, pluglet_args) == 0;
 }
 
 int plugin_parse_parameter(char *param_token, plugin_parameters_t *params) {
@@ -413,9 +562,21 @@ int plugin_parse_parameter(char *param_token, plugin_parameters_t *params) {
     } else if (strcmp(param_token, "dynamic_memory") == 0) {
         params->plugin_memory_manager_type = plugin_memory_manager_dynamic;
         return 0;
+    } else if (strcmp(param_token, "slab_memory") == 0) {
+        params->plugin_memory_manager_type = plugin_memory_manager_slab;
+        return 0;
     } else if (strcmp(param_token, "negotiate") == 0) {
         params->require_negotiation = true;
         return 0;
+    } else if (strncmp(param_token, "memory_size=", 12) == 0) {
+        char *end = NULL;
+        unsigned long long memory_size = strtoull(param_token + 12, &end, 0);
+        if (end == param_token + 12 || *end != '\0' || memory_size == 0 || memory_size > UINT32_MAX) {
+            printf("Invalid plugin memory size: \"%s\"\n", param_token + 12);
+            return 1;
+        }
+        params->memory_size = (uint32_t) memory_size;
+        return 0;
     }
     printf("Unrecognized plugin option: \"%s\"\n", param_token);
     return 1;
@@ -486,20 +647,21 @@ protoop_plugin_t* plugin_initialize(char *first_line) {
         free(p);
         return NULL;
     }
+    if (plugin_memory_reserve(p)) {
+        printf("Cannot reserve memory for plugin %s!\n", p->name);
+        queue_free(p->block_queue_cc);
+        queue_free(p->block_queue_non_cc);
+        free(p);
+        return NULL;
+    }
     /* TODO make this value configurable */
     p->bytes_in_flight = 0;
     p->bytes_total = 0;
     p->frames_total = 0;
+    p->frames_expired = 0;
     return p;
 }
 
-typedef struct pid_node {
-    char pid[100];
-    param_id_t param;
-    pluglet_type_enum pte;
-    struct pid_node *next;
-} pid_node_t;
-
 // FIXME: we do not handle cyclic includes
 int plugin_preprocess_file(picoquic_cnx_t *cnx, char *plugin_dirname, const char *plugin_fname, char **out) {
     FILE *file = fopen(plugin_fname, "r");
@@ -619,6 +781,301 @@ int plugin_preprocess_file(picoquic_cnx_t *cnx, char *plugin_dirname, const char
     return 0;
 }
 
+/* A plugin image holds a preprocessed plugin manifest, identified by its FNV-1a hash, and the content
+ * of all the pluglets it references. The pluglets are revalidated against the mtime and size of their
+ * ELF files, so the image is only a faster way to fill the pluglet images of the context.
+ */
+#define PLUGIN_IMAGE_MAGIC "PQUICIMG"
+#define PLUGIN_IMAGE_VERSION 1
+
+typedef struct st_plugin_image_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_pluglets;
+    uint64_t manifest_hash; /* FNV-1a hash of the preprocessed manifest */
+    uint64_t payload_hash; /* FNV-1a hash of all the bytes following the header */
+} plugin_image_header_t;
+
+/* Followed by the path, including its trailing \0, and the code of the pluglet */
+typedef struct st_plugin_image_entry_t {
+    int64_t mtime;
+    int64_t size;
+    uint32_t path_len;
+    uint32_t code_len;
+} plugin_image_entry_t;
+
+static int plugin_image_parse(picoquic_quic_t *quic, uint8_t *map, size_t map_len, uint64_t manifest_hash)
+{
+    plugin_image_header_t header;
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, PLUGIN_IMAGE_MAGIC, sizeof(header.magic)) != 0 || header.version != PLUGIN_IMAGE_VERSION ||
+        header.manifest_hash != manifest_hash ||
+        header.payload_hash != fnv1a_hash(FNV1A_OFFSET, map + sizeof(header), map_len - sizeof(header))) {
+        return 1;
+    }
+
+    size_t offset = sizeof(header);
+    for (uint32_t i = 0; i < header.nb_pluglets; i++) {
+        plugin_image_entry_t entry;
+        if (map_len - offset < sizeof(entry)) {
+            return 1;
+        }
+        memcpy(&entry, map + offset, sizeof(entry));
+        offset += sizeof(entry);
+        if (entry.path_len == 0 || map_len - offset < (size_t) entry.path_len + entry.code_len) {
+            return 1;
+        }
+        char *path = (char *) map + offset;
+        if (path[entry.path_len - 1] != '\0') {
+            return 1;
+        }
+        offset += entry.path_len;
+
+        struct stat st;
+        if (stat(path, &st) != 0 || st.st_mtime != entry.mtime || st.st_size != entry.size) {
+            /* The source changed, the image has to be rebuilt */
+            return 1;
+        }
+        pluglet_image_t *image = NULL;
+        HASH_FIND_STR(quic->pluglet_images, path, image);
+        if (!image || image->mtime != entry.mtime || image->size != entry.size) {
+            void *code = malloc(entry.code_len);
+            if (!code) {
+                return 1;
+            }
+            memcpy(code, map + offset, entry.code_len);
+            if (!pluglet_image_set(&quic->pluglet_images, path, entry.mtime, entry.size, code, entry.code_len)) {
+                return 1;
+            }
+        }
+        offset += entry.code_len;
+    }
+
+    return offset == map_len ? 0 : 1;
+}
+
+static int plugin_image_load(picoquic_quic_t *quic, const char *image_fname, uint64_t manifest_hash)
+{
+    int fd = open(image_fname, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(plugin_image_header_t)) {
+        close(fd);
+        return 1;
+    }
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 1;
+    }
+    int ret = plugin_image_parse(quic, map, st.st_size, manifest_hash);
+    munmap(map, st.st_size);
+    return ret;
+}
+
+static int plugin_image_write_entry(FILE *file, pluglet_image_t *image, uint64_t *payload_hash)
+{
+    plugin_image_entry_t entry = { .mtime = image->mtime, .size = image->size,
+        .path_len = strlen(image->path) + 1, .code_len = image->code_len };
+    if (fwrite(&entry, sizeof(entry), 1, file) != 1 || fwrite(image->path, entry.path_len, 1, file) != 1 ||
+        (entry.code_len > 0 && fwrite(image->code, entry.code_len, 1, file) != 1)) {
+        return 1;
+    }
+    *payload_hash = fnv1a_hash(*payload_hash, (uint8_t *) &entry, sizeof(entry));
+    *payload_hash = fnv1a_hash(*payload_hash, (uint8_t *) image->path, entry.path_len);
+    *payload_hash = fnv1a_hash(*payload_hash, (uint8_t *) image->code, entry.code_len);
+    return 0;
+}
+
+static int plugin_image_store(picoquic_quic_t *quic, const char *image_fname, uint64_t manifest_hash,
+    char *plugin_dirname, const char *preprocessed)
+{
+    char *manifest = strdup(preprocessed);
+    if (!manifest) {
+        return 1;
+    }
+    size_t tmp_fname_len = strlen(image_fname) + 5;
+    char tmp_fname[tmp_fname_len];
+    snprintf(tmp_fname, tmp_fname_len, "%s.tmp", image_fname);
+    FILE *file = fopen(tmp_fname, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to create plugin image %s: %s\n", tmp_fname, strerror(errno));
+        free(manifest);
+        return 1;
+    }
+
+    plugin_image_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PLUGIN_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = PLUGIN_IMAGE_VERSION;
+    header.manifest_hash = manifest_hash;
+    header.payload_hash = FNV1A_OFFSET;
+    int err = fwrite(&header, sizeof(header), 1, file) != 1;
+
+    /* Skip the first line, which only contains the plugin name and its parameters */
+    char *lines = manifest;
+    char *line = strsep(&lines, "\n");
+    char pid[100];
+    param_id_t param;
+    pluglet_type_enum pte;
+    char *pluglet_fname;
+    char abs_path[250];
+    while (!err && (line = strsep(&lines, "\n")) != NULL) {
+        if (strlen(line) == 0 || !parse_plugin_line(line, pid, &param, &pte, &pluglet_fname, NULL, NULL) || pte == pluglet_record) {
+            continue;
+        }
+        if (snprintf(abs_path, sizeof(abs_path), "%s/%s", plugin_dirname, pluglet_fname) >= sizeof(abs_path)) {
+            err = 1;
+            break;
+        }
+        pluglet_image_t *image = pluglet_image_get(&quic->pluglet_images, abs_path);
+        err = !image || plugin_image_write_entry(file, image, &header.payload_hash);
+        header.nb_pluglets++;
+    }
+    free(manifest);
+
+    if (!err) {
+        err = fseek(file, 0L, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1;
+    }
+    err |= fclose(file) != 0;
+    if (!err && rename(tmp_fname, image_fname) != 0) {
+        fprintf(stderr, "Failed to store plugin image %s: %s\n", image_fname, strerror(errno));
+        err = 1;
+    }
+    if (err) {
+        unlink(tmp_fname);
+    }
+    return err;
+}
+
+/* Loads the pluglets of the preprocessed plugin from its image, or (re)builds the image if needed */
+static void plugin_image_sync(picoquic_quic_t *quic, char *plugin_dirname, const char *plugin_fname, const char *preprocessed)
+{
+    const char *plugin_basename = strrchr(plugin_fname, '/');
+    plugin_basename = plugin_basename ? plugin_basename + 1 : plugin_fname;
+    size_t image_fname_len = strlen(quic->plugin_image_cache_path) + strlen(plugin_basename) + 6;
+    char image_fname[image_fname_len];
+    snprintf(image_fname, image_fname_len, "%s/%s.img", quic->plugin_image_cache_path, plugin_basename);
+
+    uint64_t manifest_hash = fnv1a_hash(FNV1A_OFFSET, (uint8_t *) preprocessed, strlen(preprocessed));
+    if (plugin_image_load(quic, image_fname, manifest_hash) != 0 &&
+        plugin_image_store(quic, image_fname, manifest_hash, plugin_dirname, preprocessed) != 0) {
+        fprintf(stderr, "Cannot use the plugin image cache for %s; continue without it.\n", plugin_fname);
+    }
+}
+
+/* A pluglet read and verified by a worker of plugin_preload_images(), the offload job being first */
+typedef struct st_plugin_preload_job_t {
+    picoquic_offload_job_t offload;
+    char path[250];
+    time_t mtime;
+    off_t size;
+    void *code;
+    size_t code_len;
+    struct st_plugin_preload_job_t *next_job;
+} plugin_preload_job_t;
+
+static void plugin_preload_run(picoquic_offload_job_t *offload)
+{
+    plugin_preload_job_t *job = (plugin_preload_job_t *) offload;
+    job->code = pluglet_image_read(job->path, &job->mtime, &job->size, &job->code_len);
+}
+
+static void plugin_preload_release(picoquic_offload_job_t *offload)
+{
+    plugin_preload_job_t *job = (plugin_preload_job_t *) offload;
+    free(job->code);
+    job->code = NULL;
+}
+
+/* Queues a job for each pluglet of the plugin that is neither in the images of quic nor already queued */
+static int plugin_preload_queue(picoquic_quic_t *quic, picoquic_offload_pool_t *pool, const char *plugin_fname,
+    plugin_preload_job_t **jobs)
+{
+    char buf[250];
+    char *preprocessed = NULL;
+    if (strlen(plugin_fname) >= sizeof(buf)) {
+        return 1;
+    }
+    strcpy(buf, plugin_fname);
+    char *plugin_dirname = dirname(buf);
+    if (plugin_preprocess_file(NULL, plugin_dirname, plugin_fname, &preprocessed) != 0) {
+        free(preprocessed);
+        return 1;
+    }
+
+    /* Skip the first line, which only contains the plugin name and its parameters */
+    char *lines = preprocessed;
+    char *line = strsep(&lines, "\n");
+    char pid[100];
+    param_id_t param;
+    pluglet_type_enum pte;
+    char *pluglet_fname;
+    char abs_path[250];
+    int err = 0;
+    while (!err && (line = strsep(&lines, "\n")) != NULL) {
+        if (strlen(line) == 0 || !parse_plugin_line(line, pid, &param, &pte, &pluglet_fname, NULL, NULL) || pte == pluglet_record) {
+            continue;
+        }
+        if (snprintf(abs_path, sizeof(abs_path), "%s/%s", plugin_dirname, pluglet_fname) >= sizeof(abs_path)) {
+            err = 1;
+            break;
+        }
+        struct stat st;
+        pluglet_image_t *image = NULL;
+        HASH_FIND_STR(quic->pluglet_images, abs_path, image);
+        if (image && stat(abs_path, &st) == 0 && image->mtime == st.st_mtime && image->size == st.st_size) {
+            continue;
+        }
+        plugin_preload_job_t *job = *jobs;
+        while (job && strcmp(job->path, abs_path) != 0) {
+            job = job->next_job;
+        }
+        if (job) {
+            continue;
+        }
+        if ((job = calloc(1, sizeof(plugin_preload_job_t))) == NULL) {
+            err = 1;
+            break;
+        }
+        strcpy(job->path, abs_path);
+        job->offload.run = plugin_preload_run;
+        job->offload.release = plugin_preload_release;
+        job->next_job = *jobs;
+        *jobs = job;
+        picoquic_offload_submit(pool, &job->offload);
+    }
+    free(preprocessed);
+    return err;
+}
+
+int plugin_preload_images(picoquic_quic_t *quic, picoquic_offload_pool_t *pool, uint16_t nb_plugins, plugin_fname_t *plugins)
+{
+    plugin_preload_job_t *jobs = NULL;
+    int nb_loaded = 0;
+
+    for (uint16_t i = 0; i < nb_plugins; i++) {
+        if (plugin_preload_queue(quic, pool, plugins[i].plugin_path, &jobs) != 0) {
+            fprintf(stderr, "Failed to preload the pluglets of %s\n", plugins[i].plugin_path);
+        }
+    }
+    picoquic_offload_pool_wait_idle(pool);
+
+    /* The images are only touched by the thread of the context */
+    while (jobs) {
+        plugin_preload_job_t *job = jobs;
+        jobs = job->next_job;
+        if (job->code && pluglet_image_set(&quic->pluglet_images, job->path, job->mtime, job->size, job->code, job->code_len)) {
+            nb_loaded++;
+        }
+        free(job);
+    }
+
+    return nb_loaded;
+}
+
 static FILE *get_file_from_fname(picoquic_cnx_t *cnx, const char *plugin_fname, char **preprocessed) {
     size_t max_filename_size = 250;
     char buf[max_filename_size];
@@ -633,6 +1090,9 @@ static FILE *get_file_from_fname(picoquic_cnx_t *cnx, const char *plugin_fname,
         if (*preprocessed) free(*preprocessed);
         return NULL;
     }
+    if (cnx->quic && cnx->quic->plugin_image_cache_path) {
+        plugin_image_sync(cnx->quic, plugin_dirname, plugin_fname, *preprocessed);
+    }
 #ifndef NS3
     FILE *file = fmemopen(*preprocessed, strlen(*preprocessed)+1, "r");
 
@@ -725,19 +1185,27 @@ int plugin_insert_post_plugin(picoquic_cnx_t *cnx, protoop_plugin_t *p) {
         }
     }
 
+    pid_node_t *inserted = pid_stack_top;
     while (pid_stack_top != NULL) {
+        tmp = pid_stack_top->next;
         if (!ok) {
             /* Unplug previously plugged code */
             plugin_unplug(cnx, pid_stack_top->pid, pid_stack_top->param, pid_stack_top->pte);
+            free(pid_stack_top);
+        } else {
+            LOG_EVENT(cnx, "plugins", "pluglet_inserted", p->name, "{\"pid\": \"%s\", \"param\": %d, \"anchor\": \"%s\"}", pid_stack_top->pid, pid_stack_top->param, pluglet_type_name(pid_stack_top->pte));
+            if (tmp == NULL) {
+                /* Remember them, to be able to get back to the non negotiated state when caching the plugin */
+                pid_stack_top->next = p->post_pluglets;
+                p->post_pluglets = inserted;
+            }
         }
-        LOG_EVENT(cnx, "plugins", "pluglet_inserted", p->name, "{\"pid\": \"%s\", \"param\": %d, \"anchor\": \"%s\"}", pid_stack_top->pid, pid_stack_top->param, pluglet_type_name(pid_stack_top->pte));
-        tmp = pid_stack_top->next;
-        free(pid_stack_top);
         pid_stack_top = tmp;
     }
 
     if (!ok) {
         LOG_EVENT(cnx, "plugins", "plugin_insertion_failed", "", "{\"filename\": \"%s\"}", p->path);
+        plugin_memory_release(p);
         free(p);
     } else {
         LOG_EVENT(cnx, "plugins", "inserted_plugin", "", "{\"filename\": \"%s\", \"plugin_name\": \"%s\"}", p->path, p->name);
@@ -756,6 +1224,38 @@ int plugin_insert_post_plugin(picoquic_cnx_t *cnx, protoop_plugin_t *p) {
     return ok ? 0 : 1;
 }
 
+int plugin_remove_post_plugin(picoquic_cnx_t *cnx, protoop_plugin_t *p) {
+    int err = 0;
+    /* Most recent first, as plugin_unplug removes the last inserted observer */
+    while (p->post_pluglets != NULL) {
+        pid_node_t *tmp = p->post_pluglets->next;
+        if (plugin_unplug(cnx, p->post_pluglets->pid, p->post_pluglets->param, p->post_pluglets->pte)) {
+            err = 1;
+        }
+        free(p->post_pluglets);
+        p->post_pluglets = tmp;
+    }
+    p->params.negotiated = false;
+    return err;
+}
+
+/* Lowest metadata slot not used by the plugins of cnx, such that the inline slots go to the first plugins */
+static uint8_t plugin_next_metadata_slot(picoquic_cnx_t *cnx)
+{
+    uint64_t used = 0;
+    protoop_plugin_t *current_p, *tmp_p;
+    HASH_ITER(hh, cnx->plugins, current_p, tmp_p) {
+        if (current_p->metadata_slot < 64) {
+            used |= 1ull << current_p->metadata_slot;
+        }
+    }
+    uint8_t slot = 0;
+    while (slot < 64 && (used & (1ull << slot))) {
+        slot++;
+    }
+    return slot;
+}
+
 int plugin_insert_plugin(picoquic_cnx_t *cnx, const char *plugin_fname) {
     size_t max_filename_size = 250;
     char buf[max_filename_size];
@@ -832,8 +1332,25 @@ int plugin_insert_plugin(picoquic_cnx_t *cnx, const char *plugin_fname) {
     }
 
     if (ok) {
-        init_memory_management(p);
+        plugin_template_t *template = NULL;
+        if (cnx->quic != NULL) {
+            HASH_FIND_STR(cnx->quic->plugin_templates, p->name, template);
+        }
+        /* The mapping of the template replaces the memory, so it is bound afterwards */
+        if (template != NULL && plugin_template_apply(template, p) != 0) {
+            printf("Cannot map the template of plugin %s, initialise it again\n", p->name);
+            template = NULL;
+        }
+        if (cnx->quic != NULL) {
+            (void)picoquic_numa_bind(p->memory, p->memory_size, cnx->quic->numa_node);
+        }
+        if (template == NULL) {
+            init_memory_management(p);
+        }
+        p->metadata_slot = plugin_next_metadata_slot(cnx);
         HASH_ADD_STR(cnx->plugins, name, p);
+        plugin_template_set_metadata(cnx, p);
+        picoquic_memory_charge(cnx, picoquic_memory_plugins, sizeof(protoop_plugin_t) + p->memory_size);
     }
 
     while (pid_stack_top != NULL) {
@@ -849,6 +1366,7 @@ int plugin_insert_plugin(picoquic_cnx_t *cnx, const char *plugin_fname) {
 
     if (!ok) {
         LOG_EVENT(cnx, "plugins", "plugin_insertion_failed", "", "{\"filename\": \"%s\"}", plugin_fname);
+        plugin_memory_release(p);
         free(p);
     } else {
         LOG_EVENT(cnx, "plugins", "inserted_plugin", "", "{\"filename\": \"%s\", \"plugin_name\": \"%s\"}", plugin_fname, p->name);
@@ -869,109 +1387,503 @@ int plugin_insert_plugin(picoquic_cnx_t *cnx, const char *plugin_fname) {
     return ok ? 0 : 1;
 }
 
-int plugin_parse_plugin_id(const char *plugin_fname, char *plugin_id, bool *require_negotiation) {
-    FILE *file = fopen(plugin_fname, "r");
+int plugin_template_capture(picoquic_cnx_t *cnx, const char *plugin_name)
+{
+    protoop_plugin_t *p = NULL;
+    plugin_template_t *template = NULL;
+    plugin_template_t *previous = NULL;
 
-    if (file == NULL) {
-        fprintf(stderr, "Failed to open %s: %s\n", plugin_fname, strerror(errno));
-        return 1;
+    if (cnx->quic == NULL) {
+        return -1;
     }
-
-    char *first_line = NULL;    // will be allocated by getline
-    size_t len = 0;
-    ssize_t read = getline(&first_line, &len, file);
-    if (read == -1) {
-        printf("Error in the file %s\n", plugin_fname);
-        fclose(file);
-        return 1;
+    HASH_FIND_STR(cnx->plugins, plugin_name, p);
+    if (p == NULL || (template = plugin_template_create(p)) == NULL) {
+        return -1;
     }
-    char *line_to_parse = first_line;
-
-    plugin_parameters_t params = {0};
-    char* pid_tmp = plugin_parse_first_plugin_line(line_to_parse, &params);
-    if (pid_tmp == NULL) {
-        printf("Cannot extract plugin id\n");
-        fclose(file);
-        return 1;
+    for (int i = 0; i < STRUCT_METADATA_MAX; i++) {
+        if (get_plugin_metadata(p, &cnx->metadata, i, &template->metadata[i]) != 0) {
+            plugin_template_free(template);
+            return -1;
+        }
     }
-    fclose(file);
 
-    if (require_negotiation) {
-        *require_negotiation = params.require_negotiation;
+    HASH_FIND_STR(cnx->quic->plugin_templates, p->name, previous);
+    if (previous != NULL) {
+        HASH_DEL(cnx->quic->plugin_templates, previous);
+        plugin_template_free(previous);
     }
-
-    /* FIXME It's bad, I know... */
-    strcpy(plugin_id, pid_tmp);
-#ifndef NS3
-    if (first_line)
-        free(first_line);
-#endif
-
+    HASH_ADD_STR(cnx->quic->plugin_templates, name, template);
+    LOG_EVENT(cnx, "plugins", "template_captured", p->name, "{\"relocations\": %" PRIu64 "}", (uint64_t) template->nb_relocations);
     return 0;
 }
 
-bool plugin_insert_plugins_from_cache(picoquic_cnx_t *cnx, uint8_t nb_plugins, plugin_fname_t* plugins)
+void plugin_template_set_metadata(picoquic_cnx_t *cnx, protoop_plugin_t *p)
 {
-    /* Fast track: do we have cached plugins? */
+    plugin_template_t *template = NULL;
 
-    /* FIXME: currently, it is NOT possible to use cached plugins if one of them requires negotiation. We need to rework the cache storage first. */
-    for (int i = 0; i < nb_plugins; i++) {
-        if (plugins[i].require_negotiation) {
-            return false;
-        }
+    if (cnx->quic != NULL && p->from_template) {
+        HASH_FIND_STR(cnx->quic->plugin_templates, p->name, template);
+    }
+    for (int i = 0; template != NULL && i < STRUCT_METADATA_MAX; i++) {
+        set_plugin_metadata(p, &cnx->metadata, i, plugin_template_relocate(template, p, template->metadata[i]));
     }
+}
 
-    /* First condition is required for tests */
-    if (cnx->quic && cnx->quic->cached_plugins_queue && queue_peek(cnx->quic->cached_plugins_queue) != NULL) {
-        cached_plugins_t* first = queue_dequeue(cnx->quic->cached_plugins_queue);
-        cached_plugins_t* curr = first;
-        int err = 0;
-        do {
-            /* Check that the cache exactly contains what we want */
-            /* This is not optimised, but it should be ok for the current usage we have */
-            if (curr->nb_plugins == nb_plugins) {
-                bool ok = true;
-                for (int i = 0; ok && i < nb_plugins; i++) {
-                    bool found = false;
-                    for (int j = 0; !found && j < nb_plugins; j++) {
-                        if (strcmp(plugins[i].plugin_name, curr->plugin_names[j]) == 0) {
-                            found = true;
-                        }
-                    }
-                    if (!found) {
-                        ok = false;
-                    }
-                }
-
-                if (ok) {
-                    /* curr is the one we were looking for! Insert it! */
-                    cnx->ops = curr->ops;
-                    cnx->plugins = curr->plugins;
-                    free(curr);
-                    DBG_PRINTF("%s", "Plugin found in cache: inserted!\n");
-                    return true;
-                }
+void plugin_templates_free(picoquic_quic_t *quic)
+{
+    plugin_template_t *current, *tmp;
+    HASH_ITER(hh, quic->plugin_templates, current, tmp) {
+        HASH_DEL(quic->plugin_templates, current);
+        plugin_template_free(current);
+    }
+}
+
+/* A pluglet taken from its anchor by a swap, kept to be put back at the same place if the swap fails */
+typedef struct st_plugin_detached_t {
+    protocol_operation_param_struct_t *popst;
+    pluglet_type_enum pte;
+    void *node; /* The pluglet of a replace anchor, the list node of the other ones */
+    void *prev; /* The list node it followed, NULL if it was the first one */
+    struct st_plugin_detached_t *next;
+} plugin_detached_t;
+
+static int plugin_detach(plugin_detached_t ***tail, protocol_operation_param_struct_t *popst, pluglet_type_enum pte, void *node, void *prev)
+{
+    plugin_detached_t *detached = malloc(sizeof(plugin_detached_t));
+    if (!detached) {
+        return 1;
+    }
+    detached->popst = popst;
+    detached->pte = pte;
+    detached->node = node;
+    detached->prev = prev;
+    detached->next = NULL;
+    /* In the order of the lists, such that a node is put back after the one it followed */
+    **tail = detached;
+    *tail = &detached->next;
+    return 0;
+}
+
+/* Takes the pluglets of p out of popst. They are kept in tail if it is not NULL, released otherwise. */
+static int plugin_detach_param_struct(protocol_operation_param_struct_t *popst, protoop_plugin_t *p, plugin_detached_t ***tail)
+{
+    int err = 0;
+    if (popst->replace && popst->replace->p == p) {
+        if (!tail) {
+            release_elf(popst->replace);
+            popst->replace = NULL;
+        } else if (plugin_detach(tail, popst, pluglet_replace, popst->replace, NULL) == 0) {
+            popst->replace = NULL;
+        } else {
+            err = 1;
+        }
+    }
+    for (int post = 0; post < 2; post++) {
+        observer_node_t **node = post ? &popst->post : &popst->pre;
+        observer_node_t *prev = NULL;
+        while (*node) {
+            observer_node_t *cur = *node;
+            /* A node that cannot be kept stays in place */
+            if (cur->observer->p != p || (tail && plugin_detach(tail, popst, post ? pluglet_post : pluglet_pre, cur, prev) != 0 && (err = 1))) {
+                prev = cur;
+                node = &cur->next;
+                continue;
+            }
+            *node = cur->next;
+            if (!tail) {
+                release_elf(cur->observer);
+                free(cur);
             }
+        }
+    }
+    recorder_node_t **recorder = &popst->record;
+    recorder_node_t *prev_recorder = NULL;
+    while (*recorder) {
+        recorder_node_t *cur = *recorder;
+        if (cur->p != p || (tail && plugin_detach(tail, popst, pluglet_record, cur, prev_recorder) != 0 && (err = 1))) {
+            prev_recorder = cur;
+            recorder = &cur->next;
+            continue;
+        }
+        *recorder = cur->next;
+        if (!tail) {
+            free(cur);
+        }
+    }
+    plugin_async_observer_t **async = &popst->async;
+    plugin_async_observer_t *prev_async = NULL;
+    while (*async) {
+        plugin_async_observer_t *cur = *async;
+        if (cur->p != p || (tail && plugin_detach(tail, popst, pluglet_async, cur, prev_async) != 0 && (err = 1))) {
+            prev_async = cur;
+            async = &cur->next;
+            continue;
+        }
+        *async = cur->next;
+        if (!tail) {
+            plugin_async_observer_free(cur);
+        }
+    }
+    picoquic_update_plain_core(popst);
+    return err;
+}
 
-            /* Otherwise, reinsert in the queue and continue */
-            err = queue_enqueue(cnx->quic->cached_plugins_queue, curr);
-            if (err) {
-                DBG_PRINTF("%s", "Cannot re-insert cached plugins!\n");
+/* Takes all the pluglets of p out of the operations of cnx, leaving the emptied operations in place */
+static int plugin_detach_plugin(picoquic_cnx_t *cnx, protoop_plugin_t *p, plugin_detached_t ***tail)
+{
+    int err = 0;
+    protocol_operation_struct_t *post, *tmp_post;
+    protocol_operation_param_struct_t *popst, *tmp_popst;
+    HASH_ITER(hh, cnx->ops, post, tmp_post) {
+        if (post->is_parametrable) {
+            HASH_ITER(hh, post->params, popst, tmp_popst) {
+                err |= plugin_detach_param_struct(popst, p, tail);
             }
-        } while ((curr = queue_dequeue(cnx->quic->cached_plugins_queue)) != first && curr != NULL);
+        } else {
+            err |= plugin_detach_param_struct(post->params, p, tail);
+        }
     }
+    return err;
+}
 
-    return false;
+/* Puts the detached pluglets back where they were, and frees the list */
+static void plugin_reattach(plugin_detached_t *detached)
+{
+    while (detached) {
+        plugin_detached_t *next = detached->next;
+        protocol_operation_param_struct_t *popst = detached->popst;
+        switch (detached->pte) {
+        case pluglet_extern:
+        case pluglet_replace:
+        case pluglet_private:
+            popst->replace = (pluglet_t *) detached->node;
+            break;
+        case pluglet_pre:
+        case pluglet_post: {
+            observer_node_t *node = (observer_node_t *) detached->node;
+            observer_node_t **head = (detached->pte == pluglet_pre) ? &popst->pre : &popst->post;
+            observer_node_t **link = detached->prev ? &((observer_node_t *) detached->prev)->next : head;
+            node->next = *link;
+            *link = node;
+            break;
+        }
+        case pluglet_record: {
+            recorder_node_t *node = (recorder_node_t *) detached->node;
+            recorder_node_t **link = detached->prev ? &((recorder_node_t *) detached->prev)->next : &popst->record;
+            node->next = *link;
+            *link = node;
+            break;
+        }
+        case pluglet_async: {
+            plugin_async_observer_t *node = (plugin_async_observer_t *) detached->node;
+            plugin_async_observer_t **link = detached->prev ? &((plugin_async_observer_t *) detached->prev)->next : &popst->async;
+            node->next = *link;
+            *link = node;
+            break;
+        }
+        }
+        picoquic_update_plain_core(popst);
+        free(detached);
+        detached = next;
+    }
+}
+
+/* Releases the detached pluglets, and frees the list */
+static void plugin_release_detached(plugin_detached_t *detached)
+{
+    while (detached) {
+        plugin_detached_t *next = detached->next;
+        switch (detached->pte) {
+        case pluglet_extern:
+        case pluglet_replace:
+        case pluglet_private:
+            release_elf((pluglet_t *) detached->node);
+            break;
+        case pluglet_pre:
+        case pluglet_post:
+            release_elf(((observer_node_t *) detached->node)->observer);
+            free(detached->node);
+            break;
+        case pluglet_record:
+            free(detached->node);
+            break;
+        case pluglet_async:
+            plugin_async_observer_free((plugin_async_observer_t *) detached->node);
+            break;
+        }
+        free(detached);
+        detached = next;
+    }
+}
+
+static void plugin_release_empty_ops(picoquic_cnx_t *cnx)
+{
+    protocol_operation_struct_t *post, *tmp_post;
+    protocol_operation_param_struct_t *popst, *tmp_popst;
+    HASH_ITER(hh, cnx->ops, post, tmp_post) {
+        if (post->is_parametrable) {
+            HASH_ITER(hh, post->params, popst, tmp_popst) {
+                plugin_release_empty_param_struct(cnx, post, popst);
+            }
+        } else {
+            plugin_release_empty_param_struct(cnx, post, post->params);
+        }
+    }
+    picoquic_update_logging_active(cnx);
+    picoquic_update_frame_dispatch(cnx);
+}
+
+/* Nothing of the connection refers to p outside of its pluglets, nor runs them */
+static bool plugin_swap_safe_point(picoquic_cnx_t *cnx, protoop_plugin_t *p)
+{
+    queue_t *slot_queues[2] = { cnx->reserved_frames, cnx->retry_frames };
+
+    /* Booked frames and packets in flight call back the plugin with its own frame contexts */
+    if (cnx->current_plugin != NULL || p->bytes_in_flight > 0 ||
+        queue_size(p->block_queue_cc) > 0 || queue_size(p->block_queue_non_cc) > 0) {
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        for (size_t j = 0; j < queue_size(slot_queues[i]); j++) {
+            if (((reserve_frame_slot_t *) queue_get(slot_queues[i], j))->p == p) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int plugin_swap_plugin(picoquic_cnx_t *cnx, const char *plugin_fname, plugin_migrate_fn migrate, void *migrate_ctx)
+{
+    char plugin_name[250];
+    bool require_negotiation;
+    protoop_plugin_t *old_p = NULL;
+    protoop_plugin_t *new_p = NULL;
+    plugin_detached_t *detached = NULL;
+    plugin_detached_t **tail = &detached;
+
+    if (plugin_parse_plugin_id(plugin_fname, plugin_name, &require_negotiation) != 0) {
+        return 1;
+    }
+    HASH_FIND_STR(cnx->plugins, plugin_name, old_p);
+    if (!old_p) {
+        printf("Trying to swap non-inserted plugin %s\n", plugin_name);
+        return 1;
+    }
+    if (!plugin_swap_safe_point(cnx, old_p)) {
+        return PLUGIN_SWAP_NOT_SAFE;
+    }
+
+    /* The old pluglets stay loaded until the new ones are all in */
+    bool ok = plugin_detach_plugin(cnx, old_p, &tail) == 0;
+    if (ok) {
+        HASH_DEL(cnx->plugins, old_p);
+        ok = plugin_insert_plugin(cnx, plugin_fname) == 0;
+        if (ok) {
+            HASH_FIND_STR(cnx->plugins, plugin_name, new_p);
+            new_p->metadata_slot = old_p->metadata_slot;
+            new_p->bytes_total = old_p->bytes_total;
+            new_p->frames_total = old_p->frames_total;
+            new_p->frames_expired = old_p->frames_expired;
+        }
+        if (ok && old_p->params.negotiated && new_p->params.require_negotiation) {
+            ok = plugin_insert_post_plugin(cnx, new_p) == 0;
+        }
+        if (ok && migrate) {
+            ok = migrate(cnx, old_p, new_p, migrate_ctx) == 0;
+        }
+        if (!ok && new_p) {
+            HASH_DEL(cnx->plugins, new_p);
+            plugin_detach_plugin(cnx, new_p, NULL);
+            picoquic_memory_release(cnx, picoquic_memory_plugins, sizeof(protoop_plugin_t) + new_p->memory_size);
+            picoquic_free_plugin(new_p);
+            new_p = NULL;
+        }
+        if (!ok) {
+            HASH_ADD_STR(cnx->plugins, name, old_p);
+        }
+    }
+
+    if (ok) {
+        plugin_release_detached(detached);
+        picoquic_memory_release(cnx, picoquic_memory_plugins, sizeof(protoop_plugin_t) + old_p->memory_size);
+        picoquic_free_plugin(old_p);
+        LOG_EVENT(cnx, "plugins", "swapped_plugin", "", "{\"filename\": \"%s\", \"plugin_name\": \"%s\"}", plugin_fname, plugin_name);
+    } else {
+        plugin_reattach(detached);
+        LOG_EVENT(cnx, "plugins", "plugin_swap_failed", "", "{\"filename\": \"%s\"}", plugin_fname);
+    }
+    plugin_release_empty_ops(cnx);
+
+    return ok ? 0 : 1;
+}
+
+int plugin_parse_plugin_id(const char *plugin_fname, char *plugin_id, bool *require_negotiation) {
+    FILE *file = fopen(plugin_fname, "r");
+
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", plugin_fname, strerror(errno));
+        return 1;
+    }
+
+    char *first_line = NULL;    // will be allocated by getline
+    size_t len = 0;
+    ssize_t read = getline(&first_line, &len, file);
+    if (read == -1) {
+        printf("Error in the file %s\n", plugin_fname);
+        fclose(file);
+        return 1;
+    }
+    char *line_to_parse = first_line;
+
+    plugin_parameters_t params = {0};
+    char* pid_tmp = plugin_parse_first_plugin_line(line_to_parse, &params);
+    if (pid_tmp == NULL) {
+        printf("Cannot extract plugin id\n");
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+
+    if (require_negotiation) {
+        *require_negotiation = params.require_negotiation;
+    }
+
+    /* FIXME It's bad, I know... */
+    strcpy(plugin_id, pid_tmp);
+#ifndef NS3
+    if (first_line)
+        free(first_line);
+#endif
+
+    return 0;
+}
+
+uint64_t plugin_set_hash_add(uint64_t set_hash, const char *plugin_name)
+{
+    /* Addition is commutative, so the insertion order does not matter */
+    return set_hash + hash_value_str((char *) plugin_name);
+}
+
+int plugin_cache_insert(picoquic_quic_t *quic, cached_plugins_t *cached)
+{
+    uint64_t set_hash = 0;
+    for (int i = 0; i < cached->nb_plugins; i++) {
+        set_hash = plugin_set_hash_add(set_hash, cached->plugin_names[i]);
+    }
+
+    cached_plugins_set_t *set = NULL;
+    HASH_FIND(hh, quic->cached_plugins, &set_hash, sizeof(uint64_t), set);
+    if (!set) {
+        set = calloc(1, sizeof(cached_plugins_set_t));
+        if (!set) {
+            return 1;
+        }
+        set->set_hash = set_hash;
+        HASH_ADD(hh, quic->cached_plugins, set_hash, sizeof(uint64_t), set);
+    }
+    cached->next = set->first;
+    set->first = cached;
+    return 0;
+}
+
+static bool plugin_cache_matches(cached_plugins_t *cached, uint8_t nb_plugins, plugin_fname_t* plugins)
+{
+    if (cached->nb_plugins != nb_plugins) {
+        return false;
+    }
+    /* Protects against hash collisions; the sets are small */
+    for (int i = 0; i < nb_plugins; i++) {
+        bool found = false;
+        for (int j = 0; !found && j < nb_plugins; j++) {
+            found = strcmp(plugins[i].plugin_name, cached->plugin_names[j]) == 0;
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static cached_plugins_set_t *plugin_cache_find_set(picoquic_quic_t *quic, uint8_t nb_plugins, plugin_fname_t* plugins)
+{
+    uint64_t set_hash = 0;
+    for (int i = 0; i < nb_plugins; i++) {
+        set_hash = plugin_set_hash_add(set_hash, plugins[i].plugin_name);
+    }
+    cached_plugins_set_t *set = NULL;
+    HASH_FIND(hh, quic->cached_plugins, &set_hash, sizeof(uint64_t), set);
+    return set;
+}
+
+int plugin_cache_count(picoquic_quic_t *quic, uint8_t nb_plugins, plugin_fname_t* plugins)
+{
+    int count = 0;
+    cached_plugins_set_t *set = plugin_cache_find_set(quic, nb_plugins, plugins);
+    for (cached_plugins_t *curr = set ? set->first : NULL; curr != NULL; curr = curr->next) {
+        if (plugin_cache_matches(curr, nb_plugins, plugins)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+bool plugin_insert_plugins_from_cache(picoquic_cnx_t *cnx, uint8_t nb_plugins, plugin_fname_t* plugins)
+{
+    /* First condition is required for tests */
+    if (!cnx->quic || !cnx->quic->cached_plugins) {
+        return false;
+    }
+    /* A cached instance replaces all the protocol operations, so it cannot be merged with already inserted plugins */
+    if (cnx->plugins) {
+        return false;
+    }
+
+    cached_plugins_set_t *set = plugin_cache_find_set(cnx->quic, nb_plugins, plugins);
+    if (!set) {
+        return false;
+    }
+
+    cached_plugins_t **prev = &set->first;
+    while (*prev != NULL && !plugin_cache_matches(*prev, nb_plugins, plugins)) {
+        prev = &(*prev)->next;
+    }
+    cached_plugins_t *curr = *prev;
+    if (!curr) {
+        return false;
+    }
+    *prev = curr->next;
+    if (!set->first) {
+        HASH_DEL(cnx->quic->cached_plugins, set);
+        free(set);
+    }
+
+    /* The built-in operations registered at connection creation are superseded by the cached ones */
+    picoquic_free_protoops(cnx->ops);
+    cnx->ops = curr->ops;
+    cnx->plugins = curr->plugins;
+    protoop_plugin_t *current_p, *tmp_p;
+    HASH_ITER(hh, cnx->plugins, current_p, tmp_p) {
+        picoquic_memory_charge(cnx, picoquic_memory_plugins, sizeof(protoop_plugin_t) + current_p->memory_size);
+        plugin_template_set_metadata(cnx, current_p);
+    }
+    picoquic_index_builtin_protoops(cnx);
+    picoquic_update_logging_active(cnx);
+    picoquic_update_frame_dispatch(cnx);
+    free(curr);
+    DBG_PRINTF("%s", "Plugin found in cache: inserted!\n");
+    return true;
 }
 
 int plugin_insert_plugins(picoquic_cnx_t *cnx, uint8_t nb_plugins, plugin_fname_t* plugins)
 {
     int ret = 0;
     int err = 0;
+    uint64_t profile_start = picoquic_profile_start(cnx->quic);
 
     /* First, look at the cache */
     if (plugin_insert_plugins_from_cache(cnx, nb_plugins, plugins)) {
-        return 0;
+        nb_plugins = 0;
     }
 
     /* If the combination was not previously cached, insert them now */
@@ -986,6 +1898,8 @@ int plugin_insert_plugins(picoquic_cnx_t *cnx, uint8_t nb_plugins, plugin_fname_
             ret++;
         }
     }
+    picoquic_profile_end(cnx->quic, picoquic_profile_plugins, profile_start);
+
     return ret;
 }
 
@@ -1020,8 +1934,50 @@ int plugin_insert_plugins_from_fnames(picoquic_cnx_t *cnx, uint8_t nb_plugins, c
     return nb_plugins_failed;
 }
 
-int plugin_prepare_plugin_data_exchange(picoquic_cnx_t *cnx, const char *plugin_fname,
-    uint8_t* plugin_data, size_t max_plugin_data, size_t* plugin_data_len)
+static int plugin_archive_add_source(plugin_archive_t *archive, const char *path, const struct stat *st)
+{
+    plugin_archive_source_t *sources = realloc(archive->sources, (archive->nb_sources + 1) * sizeof(plugin_archive_source_t));
+    if (!sources) {
+        return 1;
+    }
+    archive->sources = sources;
+    sources[archive->nb_sources].path = strdup(path);
+    if (!sources[archive->nb_sources].path) {
+        return 1;
+    }
+    sources[archive->nb_sources].mtime = st->st_mtime;
+    sources[archive->nb_sources].size = st->st_size;
+    archive->nb_sources++;
+    return 0;
+}
+
+static void plugin_archive_free(plugin_archive_t *archive)
+{
+    for (int i = 0; i < archive->nb_sources; i++) {
+        free(archive->sources[i].path);
+    }
+    free(archive->sources);
+    free(archive->data);
+    free(archive->plugin_name);
+    free(archive);
+}
+
+/* Returns true if one of the files put in the archive was modified or removed since */
+static bool plugin_archive_changed(plugin_archive_t *archive)
+{
+    struct stat st;
+    for (int i = 0; i < archive->nb_sources; i++) {
+        if (stat(archive->sources[i].path, &st) != 0 ||
+            st.st_mtime != archive->sources[i].mtime || st.st_size != archive->sources[i].size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* When archive is not NULL, the files put in the archive are recorded in its sources */
+static int plugin_prepare_archive(picoquic_cnx_t *cnx, const char *plugin_fname,
+    uint8_t* plugin_data, size_t max_plugin_data, size_t* plugin_data_len, plugin_archive_t *archive)
 {
     size_t max_filename_size = 250;
     char buf[max_filename_size];
@@ -1036,6 +1992,12 @@ int plugin_prepare_plugin_data_exchange(picoquic_cnx_t *cnx, const char *plugin_
     size_t read_len = 0;
     char *plugin_dirname = dirname(buf);
     int err = 0;
+    struct stat st;
+
+    if (archive && (stat(plugin_fname, &st) != 0 || plugin_archive_add_source(archive, plugin_fname, &st) != 0)) {
+        printf("Cannot record the manifest %s\n", plugin_fname);
+        return 1;
+    }
 
     char *preprocessed = NULL;
     if (plugin_preprocess_file(cnx, plugin_dirname, plugin_fname, &preprocessed) != 0 || !preprocessed) {
@@ -1093,7 +2055,7 @@ int plugin_prepare_plugin_data_exchange(picoquic_cnx_t *cnx, const char *plugin_
     archive_entry_set_size(entry, preprocessed_len);
     archive_entry_set_filetype(entry, AE_IFREG);
     archive_entry_set_perm(entry, 0644);
-    archive_entry_set_mtime(entry, picoquic_current_time() / 1000000, (picoquic_current_time() % 1000000) * 1000);
+    archive_entry_set_mtime(entry, picoquic_wall_time() / 1000000, (picoquic_wall_time() % 1000000) * 1000);
     err = archive_write_header(a, entry);
     if (err != ARCHIVE_OK) {
         printf("Error when writing entry header %d: %s\n", err, archive_error_string(a));
@@ -1119,7 +2081,6 @@ int plugin_prepare_plugin_data_exchange(picoquic_cnx_t *cnx, const char *plugin_
     char *pluglet_fname;
     size_t max_dirname_size = 250;
     char abs_path[max_dirname_size];
-    struct stat st;
     int fd;
     bool pre_plugin;
     char buff[8192];
@@ -1132,20 +2093,25 @@ int plugin_prepare_plugin_data_exchange(picoquic_cnx_t *cnx, const char *plugin_
         if (read_len <= 1) {
             continue;
         }
-        ok = parse_plugin_line(line, (protoop_str_id_t) inserted_pid, &param, &pte, &pluglet_fname, &pre_plugin);
-        if (ok) {
+        ok = parse_plugin_line(line, (protoop_str_id_t) inserted_pid, &param, &pte, &pluglet_fname, NULL, &pre_plugin);
+        if (ok && pte != pluglet_record) {
             // here, we know that plugin_dirname will have a \0 at an index before max_dirname_size
             // abs_path is thus large enough
             strcpy(abs_path, plugin_dirname);
             strcat(abs_path, "/");
             strcat(abs_path, pluglet_fname);
-            stat(abs_path, &st);
+            if (stat(abs_path, &st) != 0 || (archive && plugin_archive_add_source(archive, abs_path, &st) != 0)) {
+                printf("Cannot record the pluglet %s\n", abs_path);
+                archive_write_close(a);
+                archive_write_free(a);
+                return 1;
+            }
             entry = archive_entry_new();
             archive_entry_set_pathname(entry, pluglet_fname);
             archive_entry_set_size(entry, st.st_size);
             archive_entry_set_filetype(entry, AE_IFREG);
             archive_entry_set_perm(entry, 0644);
-            archive_entry_set_mtime(entry, picoquic_current_time() / 1000000, (picoquic_current_time() % 1000000) * 1000);
+            archive_entry_set_mtime(entry, picoquic_wall_time() / 1000000, (picoquic_wall_time() % 1000000) * 1000);
             err = archive_write_header(a, entry);
             if (err != ARCHIVE_OK) {
                 printf("Error when writing entry header %d: %s\n", err, archive_error_string(a));
@@ -1181,6 +2147,52 @@ int plugin_prepare_plugin_data_exchange(picoquic_cnx_t *cnx, const char *plugin_
     return 0;
 }
 
+int plugin_prepare_plugin_data_exchange(picoquic_cnx_t *cnx, const char *plugin_fname,
+    uint8_t* plugin_data, size_t max_plugin_data, size_t* plugin_data_len)
+{
+    return plugin_prepare_archive(cnx, plugin_fname, plugin_data, max_plugin_data, plugin_data_len, NULL);
+}
+
+plugin_archive_t *plugin_get_plugin_archive(picoquic_cnx_t *cnx, const char *plugin_name, const char *plugin_fname)
+{
+    plugin_archive_t *archive = NULL;
+    HASH_FIND_STR(cnx->quic->plugin_archives, plugin_name, archive);
+    if (archive && plugin_archive_changed(archive)) {
+        /* Prepare it again from the current files, the streams still sending the old one keep it */
+        HASH_DEL(cnx->quic->plugin_archives, archive);
+        plugin_archive_release(archive);
+        archive = NULL;
+    }
+    if (!archive) {
+        archive = calloc(1, sizeof(plugin_archive_t));
+        if (!archive) {
+            return NULL;
+        }
+        archive->refcount = 1;
+        archive->data = malloc(MAX_PLUGIN_DATA_LEN);
+        archive->plugin_name = strdup(plugin_name);
+        if (!archive->data || !archive->plugin_name ||
+            plugin_prepare_archive(cnx, plugin_fname, archive->data, MAX_PLUGIN_DATA_LEN, &archive->data_len, archive) != 0) {
+            plugin_archive_free(archive);
+            return NULL;
+        }
+        /* Only keep what is actually used */
+        uint8_t *shrunk = realloc(archive->data, archive->data_len > 0 ? archive->data_len : 1);
+        if (shrunk) {
+            archive->data = shrunk;
+        }
+        HASH_ADD_KEYPTR(hh, cnx->quic->plugin_archives, archive->plugin_name, strlen(archive->plugin_name), archive);
+    }
+    return archive;
+}
+
+void plugin_archive_release(plugin_archive_t *archive)
+{
+    if (--archive->refcount == 0) {
+        plugin_archive_free(archive);
+    }
+}
+
 /* From the example in https://github.com/libarchive/libarchive/wiki/Examples#A_Universal_Decompressor */
 static int
 copy_data(struct archive *ar, struct archive *aw)
@@ -1239,6 +2251,9 @@ int plugin_process_plugin_data_exchange(picoquic_cnx_t *cnx, const char* plugin_
     if ((r = archive_read_open_memory(a, data, data_length)))
         return 1;
 
+    /* The manifest comes first, the other entries are pluglets */
+    bool is_manifest = true;
+    struct stat st;
     for (;;) {
         r = archive_read_next_header(a, &entry);
         if (r == ARCHIVE_EOF)
@@ -1253,10 +2268,19 @@ int plugin_process_plugin_data_exchange(picoquic_cnx_t *cnx, const char* plugin_
         strcat(destination_path, archive_entry_pathname(entry));
         archive_entry_set_pathname(entry, destination_path);
 
+        uint8_t *code = NULL;
+        la_int64_t code_len = archive_entry_size_is_set(entry) ? archive_entry_size(entry) : 0;
         r = archive_write_header(ext, entry);
         if (r < ARCHIVE_OK)
             fprintf(stderr, "%s\n", archive_error_string(ext));
-        else if (archive_entry_size(entry) > 0) {
+        else if (!is_manifest && code_len > 0 && code_len <= MAX_PLUGIN_DATA_LEN && (code = malloc(code_len)) != NULL) {
+            /* Keep the pluglet in memory while writing it in the cache */
+            if (archive_read_data(a, code, code_len) != code_len || archive_write_data(ext, code, code_len) != code_len) {
+                fprintf(stderr, "Failed to extract %s\n", destination_path);
+                free(code);
+                return 1;
+            }
+        } else if (archive_entry_size(entry) > 0) {
             r = copy_data(a, ext);
             if (r < ARCHIVE_OK)
                 fprintf(stderr, "%s\n", archive_error_string(ext));
@@ -1266,8 +2290,17 @@ int plugin_process_plugin_data_exchange(picoquic_cnx_t *cnx, const char* plugin_
         r = archive_write_finish_entry(ext);
         if (r < ARCHIVE_OK)
             fprintf(stderr, "%s\n", archive_error_string(ext));
-        if (r < ARCHIVE_WARN)
+        if (r < ARCHIVE_WARN) {
+            free(code);
             return 1;
+        }
+        /* Stat the extracted file, so that loading the pluglet finds the image up to date */
+        if (code && stat(destination_path, &st) == 0) {
+            pluglet_image_set(&cnx->quic->pluglet_images, destination_path, st.st_mtime, st.st_size, code, code_len);
+        } else {
+            free(code);
+        }
+        is_manifest = false;
     }
     archive_read_close(a);
     archive_read_free(a);
@@ -1276,6 +2309,13 @@ int plugin_process_plugin_data_exchange(picoquic_cnx_t *cnx, const char* plugin_
     return 0;
 }
 
+static inline uint64_t plugin_trace_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
 protoop_arg_t plugin_run_protoop_internal(picoquic_cnx_t *cnx, const protoop_params_t *pp) {
     if (pp->inputc > PROTOOPARGS_MAX) {
         printf("Too many arguments for protocol operation with id %s : %d > %d\n",
@@ -1284,6 +2324,7 @@ protoop_arg_t plugin_run_protoop_internal(picoquic_cnx_t *cnx, const protoop_par
     }
 
     char *error_msg = NULL;
+    uint64_t trace_start = PICOQUIC_TRACE_ENABLED(protoop) ? plugin_trace_clock() : 0;
 
     /* First save previous args, and update context with new ones
      * Notice that we store ALL array of protoop_inputv and protoop_outputv.
@@ -1318,11 +2359,7 @@ protoop_arg_t plugin_run_protoop_internal(picoquic_cnx_t *cnx, const protoop_par
 
     /* Either we have a pluglet, and we run it, or we stick to the default ops behaviour */
     protoop_arg_t status;
-    protocol_operation_struct_t *post;
-    if (pp->pid->hash == 0) {
-        pp->pid->hash = hash_value_str(pp->pid->id);
-    }
-    HASH_FIND_PID(cnx->ops, &(pp->pid->hash), post);
+    protocol_operation_struct_t *post = picoquic_find_protoop(cnx, pp->pid);
     if (!post) {
         printf("FATAL ERROR: no protocol operation with id %s and hash %" PRIu64 "\n", pp->pid->id, pp->pid->hash);
         exit(-1);
@@ -1330,7 +2367,7 @@ protoop_arg_t plugin_run_protoop_internal(picoquic_cnx_t *cnx, const protoop_par
 
     protocol_operation_param_struct_t *popst;
     if (post->is_parametrable) {
-        HASH_FIND(hh, post->params, &pp->param, sizeof(param_id_t), popst);
+        popst = picoquic_find_protoop_param(post, pp->param);
         if (!popst) {
             param_id_t default_behaviour = NO_PARAM;
             HASH_FIND(hh, post->params, &default_behaviour, sizeof(param_id_t), popst);
@@ -1369,7 +2406,7 @@ protoop_arg_t plugin_run_protoop_internal(picoquic_cnx_t *cnx, const protoop_par
         /* TODO: restrict the memory accesible by the observers */
         cnx->current_plugin = tmp->observer->p;
         cnx->current_anchor = pluglet_pre;
-        exec_loaded_code(tmp->observer, (void *)cnx, (void *)cnx->current_plugin->memory, sizeof(cnx->current_plugin->memory), &error_msg);
+        exec_loaded_code(tmp->observer, (void *)cnx, (void *)cnx->current_plugin->memory, cnx->current_plugin->memory_size, &error_msg);
         tmp = tmp->next;
     }
 
@@ -1378,7 +2415,7 @@ protoop_arg_t plugin_run_protoop_internal(picoquic_cnx_t *cnx, const protoop_par
         DBG_PLUGIN_PRINTF("Running pluglet at proto op id %s", pp->pid->id);
         cnx->current_plugin = popst->replace->p;
         cnx->current_anchor = pluglet_replace;
-        status = (protoop_arg_t) exec_loaded_code(popst->replace, (void *)cnx, (void *)cnx->current_plugin->memory, sizeof(cnx->current_plugin->memory), &error_msg);
+        status = (protoop_arg_t) exec_loaded_code(popst->replace, (void *)cnx, (void *)cnx->current_plugin->memory, cnx->current_plugin->memory_size, &error_msg);
         if (error_msg) {
             /* TODO fixme str_pid */
             fprintf(stderr, "Error when running %s: %s\n", pp->pid->id, error_msg);
@@ -1403,13 +2440,21 @@ protoop_arg_t plugin_run_protoop_internal(picoquic_cnx_t *cnx, const protoop_par
         /* TODO: restrict the memory accesible by the observers */
         cnx->current_plugin = tmp->observer->p;
         cnx->current_anchor = pluglet_post;
-        exec_loaded_code(tmp->observer, (void *)cnx, (void *)cnx->current_plugin->memory, sizeof(cnx->current_plugin->memory), &error_msg);
+        exec_loaded_code(tmp->observer, (void *)cnx, (void *)cnx->current_plugin->memory, cnx->current_plugin->memory_size, &error_msg);
         tmp = tmp->next;
     }
     cnx->protoop_output = 0;
 
     int outputc = cnx->protoop_outputc_callee;
 
+    /* And the passive observers only get the call in their ring, to be processed later */
+    for (recorder_node_t *recorder = popst->record; recorder; recorder = recorder->next) {
+        plugin_record_event(recorder->p, pp, outputc, status);
+    }
+    for (plugin_async_observer_t *observer = popst->async; observer; observer = observer->next) {
+        plugin_async_push(cnx, observer, pp, outputc, status);
+    }
+
     DBG_PLUGIN_PRINTF("Protocol operation with id 0x%x returns 0x%" PRIx64 " with %d additional outputs", pp->pid, status, outputc);
 
     /* Copy the output of the caller to the provided output pointer (if any)... */
@@ -1446,6 +2491,69 @@ cleanup:
     cnx->current_protoop = old_protoop;
     cnx->current_anchor = old_anchor;
 
+    /* A probe attached during the operation has no start time */
+    PICOQUIC_TRACE5(protoop, picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx)), pp->pid->id, pp->param, status,
+        (trace_start != 0) ? plugin_trace_clock() - trace_start : 0);
+
+    return status;
+}
+
+/* The index may come from a pluglet, so only trust it if the hash matches. Once found, the private
+ * operation is directly indexed by the protoop_id_t of the pluglet */
+static picoquic_private_op_t *plugin_find_private_protoop(picoquic_cnx_t *cnx, protoop_id_t *pid, param_id_t param)
+{
+    if (pid->index >= PROTOOP_BUILTIN_INDEX_MAX && pid->index - PROTOOP_BUILTIN_INDEX_MAX < cnx->nb_private_ops) {
+        picoquic_private_op_t *op = &cnx->private_ops[pid->index - PROTOOP_BUILTIN_INDEX_MAX];
+        if (op->hash == pid->hash && op->param == param) {
+            return op;
+        }
+    }
+    for (int i = 0; i < cnx->nb_private_ops; i++) {
+        if (cnx->private_ops[i].hash == pid->hash && cnx->private_ops[i].param == param) {
+            pid->index = (uint16_t) (PROTOOP_BUILTIN_INDEX_MAX + i);
+            return &cnx->private_ops[i];
+        }
+    }
+    return NULL;
+}
+
+/* Same as plugin_run_protoop_internal for a private operation, which has neither observers nor core
+ * operation. Only the context that its pluglet can see is saved and restored */
+static protoop_arg_t plugin_run_private_protoop(picoquic_cnx_t *cnx, picoquic_private_op_t *op, const protoop_params_t *pp)
+{
+    char *error_msg = NULL;
+    protocol_operation_param_struct_t *popst = op->popst;
+    protoop_plugin_t *old_plugin = cnx->current_plugin;
+    protocol_operation_struct_t *old_protoop = cnx->current_protoop;
+    pluglet_type_enum old_anchor = cnx->current_anchor;
+    int caller_inputc = cnx->protoop_inputc;
+    int caller_outputc = cnx->protoop_outputc_callee;
+    protoop_arg_t *caller_inputv = cnx->protoop_inputv;
+    protoop_arg_t *caller_outputv = cnx->protoop_outputv;
+    cnx->protoop_inputv = pp->inputv;
+    cnx->protoop_inputc = pp->inputc;
+    cnx->protoop_outputv = pp->outputv;
+    cnx->protoop_outputc_callee = 0;
+
+    popst->running = true;
+    cnx->current_protoop = op->post;
+    cnx->current_plugin = popst->replace->p;
+    cnx->current_anchor = pluglet_replace;
+    protoop_arg_t status = (protoop_arg_t) exec_loaded_code(popst->replace, (void *)cnx, (void *)cnx->current_plugin->memory, cnx->current_plugin->memory_size, &error_msg);
+    if (error_msg) {
+        fprintf(stderr, "Error when running %s: %s\n", pp->pid->id, error_msg);
+    }
+    popst->running = false;
+
+    cnx->protoop_inputv = caller_inputv;
+    cnx->protoop_outputv = caller_outputv;
+    cnx->protoop_inputc = caller_inputc;
+    cnx->protoop_outputc_callee = caller_outputc;
+    cnx->previous_plugin_in_replace = cnx->current_plugin;
+    cnx->current_plugin = old_plugin;
+    cnx->current_protoop = old_protoop;
+    cnx->current_anchor = old_anchor;
+
     return status;
 }
 
@@ -1461,23 +2569,27 @@ protoop_arg_t plugin_run_protoop(picoquic_cnx_t *cnx, protoop_params_t *pp, char
     } else {
         tmp_pid.id = pid_str;
         tmp_pid.hash = hash_value_str(tmp_pid.id);
+        tmp_pid.index = 0;
         pp->pid = &tmp_pid;
     }
+    /* Pluglets calling the private operations of their plugin skip the dispatch */
+    if (cnx->nb_private_ops > 0 && pp->caller_is_intern && pp->inputc <= PROTOOPARGS_MAX) {
+        picoquic_private_op_t *op = plugin_find_private_protoop(cnx, pp->pid, pp->param);
+        if (op && op->popst->plain_private && !op->popst->running) {
+            return plugin_run_private_protoop(cnx, op, pp);
+        }
+    }
     return plugin_run_protoop_internal(cnx, pp);
 }
 
 bool plugin_pluglet_exists(picoquic_cnx_t *cnx, protoop_id_t *pid, param_id_t param, pluglet_type_enum anchor) {
-    protocol_operation_struct_t *post;
-    if (pid->hash == 0) {
-        pid->hash = hash_value_str(pid->id);
-    }
-    HASH_FIND_PID(cnx->ops, &pid->hash, post);
+    protocol_operation_struct_t *post = picoquic_find_protoop(cnx, pid);
     if (!post)
         return false;
 
     protocol_operation_param_struct_t *popst;
     if (post->is_parametrable) {
-        HASH_FIND(hh, post->params, &param, sizeof(param_id_t), popst);
+        popst = picoquic_find_protoop_param(post, param);
         if (!popst)
             return false;
     } else {
@@ -1489,38 +2601,115 @@ bool plugin_pluglet_exists(picoquic_cnx_t *cnx, protoop_id_t *pid, param_id_t pa
             return popst->replace && !popst->intern;
         case pluglet_replace:
             return popst->replace && popst->intern;
+        case pluglet_private:
+            return popst->replace && popst->is_private;
         case pluglet_pre:
             return popst->pre;
         case pluglet_post:
             return popst->post;
+        case pluglet_record:
+            return popst->record;
+        case pluglet_async:
+            return popst->async;
         default:
             return false;
     }
 }
 
+void plugin_record_fill_event(plugin_record_event_t *event, const protoop_params_t *pp, int outputc, protoop_arg_t status)
+{
+    int inputc = pp->inputc < PLUGIN_RECORD_INPUTS_MAX ? pp->inputc : PLUGIN_RECORD_INPUTS_MAX;
+    int kept_outputc = pp->outputv == NULL ? 0 : (outputc < PLUGIN_RECORD_OUTPUTS_MAX ? outputc : PLUGIN_RECORD_OUTPUTS_MAX);
+    event->time = picoquic_current_time();
+    event->pid_hash = pp->pid->hash;
+    event->param = pp->param;
+    event->inputc = (uint8_t) pp->inputc;
+    event->outputc = (uint8_t) outputc;
+    event->status = status;
+    memcpy(event->inputv, pp->inputv, inputc * sizeof(protoop_arg_t));
+    memset(event->inputv + inputc, 0, (PLUGIN_RECORD_INPUTS_MAX - inputc) * sizeof(protoop_arg_t));
+    if (kept_outputc > 0) {
+        memcpy(event->outputv, pp->outputv, kept_outputc * sizeof(protoop_arg_t));
+    }
+    memset(event->outputv + kept_outputc, 0, (PLUGIN_RECORD_OUTPUTS_MAX - kept_outputc) * sizeof(protoop_arg_t));
+}
 
-int set_plugin_metadata(protoop_plugin_t *plugin, plugin_struct_metadata_t **metadata, int idx, uint64_t val) {
-    if (!plugin) {
-        printf("ERROR: set_plugin_metadata called with an undefined plugin\n");
-        return -1;
+void plugin_record_event(protoop_plugin_t *p, const protoop_params_t *pp, int outputc, protoop_arg_t status)
+{
+    plugin_record_ring_t *ring = p->record_ring;
+    if (!ring) {
+        ring = p->record_ring = calloc(1, sizeof(plugin_record_ring_t));
+        if (!ring) {
+            printf("Cannot allocate memory for the record ring of plugin %s\n", p->name);
+            return;
+        }
     }
-    if (idx >= STRUCT_METADATA_MAX) {
-        printf("ERROR: set_plugin_metadata called with an index out of bound\n");
-        return -1;
+    if (ring->head - ring->tail == PLUGIN_RECORD_RING_SIZE) {
+        /* Full, drop the oldest one */
+        ring->tail++;
+        ring->dropped++;
     }
+    plugin_record_fill_event(&ring->events[ring->head++ & (PLUGIN_RECORD_RING_SIZE - 1)], pp, outputc, status);
+}
+
+int plugin_record_drain(picoquic_cnx_t *cnx, plugin_record_event_t *events, int max)
+{
+    protoop_plugin_t *p = cnx->current_plugin;
+    if (!p || !p->record_ring) {
+        return 0;
+    }
+    plugin_record_ring_t *ring = p->record_ring;
+    int n = 0;
+    while (n < max && ring->tail != ring->head) {
+        events[n++] = ring->events[ring->tail++ & (PLUGIN_RECORD_RING_SIZE - 1)];
+    }
+    return n;
+}
+
+uint64_t plugin_record_dropped(picoquic_cnx_t *cnx)
+{
+    protoop_plugin_t *p = cnx->current_plugin;
+    return p && p->record_ring ? p->record_ring->dropped : 0;
+}
+
+
+static plugin_struct_metadata_t *plugin_metadata_overflow(protoop_plugin_t *plugin, plugin_metadata_t *metadata)
+{
     if (plugin->hash == 0) {
         plugin->hash = hash_value_str(plugin->name);
     }
     plugin_struct_metadata_t *md = NULL;
-    HASH_FIND_PLUGIN(*metadata, &(plugin->hash), md);
+    // try to find the metadata
+    HASH_FIND_PLUGIN(metadata->overflow, &(plugin->hash), md);
     if (md == NULL) {
+        // the metadata were not already allocated, so create it
         md = (plugin_struct_metadata_t *) calloc(1, sizeof(plugin_struct_metadata_t));
         if (!md) {
             printf("ERROR: out of memory !\n");
-            return -1;
+            return NULL;
         }
         md->plugin_hash = plugin->hash;
-        HASH_ADD_PLUGIN(*metadata, plugin_hash, md);
+        HASH_ADD_PLUGIN(metadata->overflow, plugin_hash, md);
+    }
+    return md;
+}
+
+int set_plugin_metadata(protoop_plugin_t *plugin, plugin_metadata_t *metadata, int idx, uint64_t val) {
+    if (!plugin) {
+        printf("ERROR: set_plugin_metadata called with an undefined plugin\n");
+        return -1;
+    }
+    if (idx >= STRUCT_METADATA_MAX) {
+        printf("ERROR: set_plugin_metadata called with an index out of bound\n");
+        return -1;
+    }
+    if (plugin->metadata_slot < PLUGIN_METADATA_SLOTS) {
+        metadata->slots[plugin->metadata_slot][idx] = val;
+        return 0;
+    }
+    plugin_struct_metadata_t *md = plugin_metadata_overflow(plugin, metadata);
+    if (md == NULL) {
+        return -1;
     }
     md->metadata[idx] = val;
     return 0;
@@ -1528,7 +2717,7 @@ int set_plugin_metadata(protoop_plugin_t *plugin, plugin_struct_metadata_t **met
 
 // gets the metadata attached to a plugin
 // (creates the metadata structure if it is not already there)
-int get_plugin_metadata(protoop_plugin_t *plugin, plugin_struct_metadata_t **metadata, int idx, uint64_t *out) {
+int get_plugin_metadata(protoop_plugin_t *plugin, plugin_metadata_t *metadata, int idx, uint64_t *out) {
     if (!plugin) {
         printf("ERROR: set_plugin_metadata called with an undefined plugin\n");
         return -1;
@@ -1537,26 +2726,27 @@ int get_plugin_metadata(protoop_plugin_t *plugin, plugin_struct_metadata_t **met
         printf("ERROR: set_plugin_metadata called with an index out of bound\n");
         return -1;
     }
-    if (plugin->hash == 0) {
-        plugin->hash = hash_value_str(plugin->name);
+    if (plugin->metadata_slot < PLUGIN_METADATA_SLOTS) {
+        *out = metadata->slots[plugin->metadata_slot][idx];
+        return 0;
     }
-    plugin_struct_metadata_t *md = NULL;
-    // try to find the metadata
-    HASH_FIND_PLUGIN(*metadata, &(plugin->hash), md);
+    plugin_struct_metadata_t *md = plugin_metadata_overflow(plugin, metadata);
     if (md == NULL) {
-        // the metadata were not already allocated, so create it
-        md = (plugin_struct_metadata_t *) calloc(1, sizeof(plugin_struct_metadata_t));
-        if (!md) {
-            printf("ERROR: out of memory !\n");
-            return -1;
-        }
-        md->plugin_hash = plugin->hash;
-        HASH_ADD_PLUGIN((*metadata), plugin_hash, md);
+        return -1;
     }
     *out = md->metadata[idx];
     return 0;
 }
 
+void plugin_metadata_free(plugin_metadata_t *metadata) {
+    plugin_struct_metadata_t *current_md, *tmp;
+    HASH_ITER(hh, metadata->overflow, current_md, tmp) {
+        HASH_DEL(metadata->overflow, current_md);
+        free(current_md);
+    }
+    memset(metadata, 0, sizeof(plugin_metadata_t));
+}
+
 int get_errno() {
     return errno;
 }
@@ -15,11 +15,22 @@ typedef enum {
     pluglet_extern,
     pluglet_replace,
     pluglet_pre,
-    pluglet_post
+    pluglet_post,
+    pluglet_record, /* No pluglet attached, the core records the call in the ring of the plugin */
+    pluglet_async, /* Post observer run by a worker thread on a copy of the call, see plugin_async.h */
+    pluglet_private /* Replace pluglet of an operation of the plugin that no one observes, directly called by pluglets */
 } pluglet_type_enum;
 
 const char *pluglet_type_name(pluglet_type_enum te);
 
+/* Records where a pluglet was inserted, to be able to unplug it */
+typedef struct pid_node {
+    char pid[100];
+    param_id_t param;
+    pluglet_type_enum pte;
+    struct pid_node *next;
+} pid_node_t;
+
 /* Function to insert plugins */
 int plugin_plug_elf(picoquic_cnx_t *cnx, protoop_plugin_t *p, protoop_str_id_t pid, param_id_t param, pluglet_type_enum pte, char *elf_fname);
 /* Function that reset the protocol operation to its default behaviour */
@@ -34,6 +45,46 @@ int plugin_unplug(picoquic_cnx_t *cnx, protoop_str_id_t pid, param_id_t param, p
  */
 int plugin_insert_plugin(picoquic_cnx_t *cnx, const char *plugin_fname);
 
+/**
+ * Function that captures the memory and the connection metadata of the plugin plugin_name of cnx as the template
+ * of the plugin in cnx->quic, replacing the previous one. The next instances of the plugin map this memory
+ * copy-on-write when inserted, so the state built by its initialisation is found in place and shared until written.
+ * The pointers inside the memory are moved to the memory of each instance, but the template must not refer to
+ * anything outside of it, such as the connection it was built in.
+ * Returns 0 on success, -1 otherwise.
+ */
+int plugin_template_capture(picoquic_cnx_t *cnx, const char *plugin_name);
+
+/**
+ * Function that sets the connection metadata of the plugin p, inserted in cnx from its template, as the template
+ * left them. Does nothing when the memory of p does not map a template.
+ */
+void plugin_template_set_metadata(picoquic_cnx_t *cnx, protoop_plugin_t *p);
+
+/* Frees the plugin templates of quic. The plugin memories mapping them keep their pages */
+void plugin_templates_free(picoquic_quic_t *quic);
+
+/* Returned by plugin_swap_plugin when the connection is not at a point where the plugin can be swapped */
+#define PLUGIN_SWAP_NOT_SAFE 2
+
+/**
+ * Hook copying the state of a plugin from the memory of its old version to the one of the new version.
+ * It runs before the swap is committed, so it must not call protocol operations.
+ * Returns 0 on success, the swap is undone otherwise.
+ */
+typedef int (*plugin_migrate_fn)(picoquic_cnx_t *cnx, protoop_plugin_t *old_p, protoop_plugin_t *new_p, void *migrate_ctx);
+
+/**
+ * Function that replaces the pluglets of an inserted plugin by the ones of the manifest
+ * plugin_fname, which has the same plugin name, without closing the connection. The new
+ * version gets a fresh memory, unless migrate copies the state of the old one in it.
+ * The swap must be done between packets, when no pluglet runs and the plugin has neither
+ * booked frames nor frames in flight; PLUGIN_SWAP_NOT_SAFE is returned otherwise, and the
+ * caller should try again later. If the new version cannot be inserted, the old one is kept.
+ * Returns 0 if the plugin was swapped, 1 or PLUGIN_SWAP_NOT_SAFE otherwise.
+ */
+int plugin_swap_plugin(picoquic_cnx_t *cnx, const char *plugin_fname, plugin_migrate_fn migrate, void *migrate_ctx);
+
 /**
  * Function that reads a plugin file and insert post-plugins described in it
  * in an atomic, transaction style. This means, if one of the plugins
@@ -43,6 +94,41 @@ int plugin_insert_plugin(picoquic_cnx_t *cnx, const char *plugin_fname);
  */
 int plugin_insert_post_plugin(picoquic_cnx_t *cnx, protoop_plugin_t *p);
 
+/**
+ * Function that unplugs the post-plugins previously inserted by
+ * plugin_insert_post_plugin, such that the plugin is back to the state
+ * it had before negotiation.
+ * Returns 0 on success.
+ */
+int plugin_remove_post_plugin(picoquic_cnx_t *cnx, protoop_plugin_t *p);
+
+/**
+ * Order-independent hash of a set of plugins, computed by adding their names
+ * one by one to an initial value of 0.
+ */
+uint64_t plugin_set_hash_add(uint64_t set_hash, const char *plugin_name);
+
+/**
+ * Function that stores the protocol operations of a closed connection in the
+ * plugin cache of quic. Returns 0 on success.
+ */
+struct st_cached_plugins_t;
+int plugin_cache_insert(picoquic_quic_t *quic, struct st_cached_plugins_t *cached);
+
+/**
+ * Function that returns the number of instances of the given set of plugins
+ * ready to be reused in the plugin cache of quic.
+ */
+int plugin_cache_count(picoquic_quic_t *quic, uint8_t nb_plugins, plugin_fname_t* plugins);
+
+/**
+ * Function that reads and verifies the pluglets of the given plugins in the workers of pool, and
+ * keeps them in the pluglet images of quic. The pluglets already there are not read again.
+ * Returns the number of pluglets read.
+ */
+struct st_picoquic_offload_pool_t;
+int plugin_preload_images(picoquic_quic_t *quic, struct st_picoquic_offload_pool_t *pool, uint16_t nb_plugins, plugin_fname_t *plugins);
+
 /**
  * Function taking a list of plugin file names with their associated plugin
  * IDs and insert them in the provided order.
@@ -77,9 +163,21 @@ int plugin_parse_plugin_id(const char *plugin_fname, char *plugin_id, bool *requ
 int plugin_prepare_plugin_data_exchange(picoquic_cnx_t *cnx, const char *plugin_fname,
     uint8_t* plugin_data, size_t max_plugin_data, size_t* plugin_data_len);
 
+/**
+ * Same as plugin_prepare_plugin_data_exchange, but the archive is only prepared once
+ * and then kept by the context, until the manifest or one of its pluglets changes on disk.
+ * The archive is owned by the context; take a reference to use it beyond the next call.
+ * Returns NULL on error.
+ */
+struct st_plugin_archive_t *plugin_get_plugin_archive(picoquic_cnx_t *cnx, const char *plugin_name, const char *plugin_fname);
+
+/* Drops a reference to the archive, freeing it when it was the last one */
+void plugin_archive_release(struct st_plugin_archive_t *archive);
+
 /**
  * This function extracts the archive contained in memory in preq in the cache of
- * the host of the connection.
+ * the host of the connection. The pluglets are also kept in the pluglet images of
+ * the context, so that inserting the plugin does not read them back from the disk.
  * Returns 0 on success.
  */
 int plugin_process_plugin_data_exchange(picoquic_cnx_t *cnx, const char* plugin_name, uint8_t *data, size_t data_length);
@@ -108,21 +206,70 @@ protoop_arg_t plugin_run_protoop(picoquic_cnx_t *cnx, protoop_params_t *pp, char
 
 bool plugin_pluglet_exists(picoquic_cnx_t *cnx, protoop_id_t *pid, param_id_t param, pluglet_type_enum anchor);
 
+#define PLUGIN_RECORD_RING_SIZE 256 /* Must be a power of 2 */
+#define PLUGIN_RECORD_INPUTS_MAX 8
+#define PLUGIN_RECORD_OUTPUTS_MAX 4
+
+/* Fixed-layout event appended by the core each time a protocol operation with a record anchor returns */
+typedef struct st_plugin_record_event_t {
+    uint64_t time; /* picoquic_current_time() when the operation returned */
+    uint64_t pid_hash; /* hash_value_str() of the protocol operation id */
+    param_id_t param;
+    uint8_t inputc; /* Number of inputs, only the first PLUGIN_RECORD_INPUTS_MAX are kept */
+    uint8_t outputc; /* Number of outputs, only the first PLUGIN_RECORD_OUTPUTS_MAX are kept */
+    protoop_arg_t status; /* Return value of the operation */
+    protoop_arg_t inputv[PLUGIN_RECORD_INPUTS_MAX];
+    protoop_arg_t outputv[PLUGIN_RECORD_OUTPUTS_MAX];
+} plugin_record_event_t;
+
+typedef struct st_plugin_record_ring_t {
+    uint64_t head; /* Total number of events recorded */
+    uint64_t tail; /* Total number of events drained or dropped */
+    uint64_t dropped; /* Events overwritten before being drained */
+    plugin_record_event_t events[PLUGIN_RECORD_RING_SIZE];
+} plugin_record_ring_t;
+
+/* Fills \p event with the call described by \p pp, that returned \p status and \p outputc outputs */
+void plugin_record_fill_event(plugin_record_event_t *event, const protoop_params_t *pp, int outputc, protoop_arg_t status);
+
 /**
- * This function sets metadata at `idx` to `val` from a plugin structure metadata hashmap stored at `metadata`
- * If the metadata are not present in the hashmap, it will be allocated and the values at indexes different thant `idx`
- * are set to zero by default
+ * Appends an event for the operation described by \p pp to the ring of \p p, allocating it on first use.
+ * When the ring is full, the oldest event is overwritten.
+ */
+void plugin_record_event(protoop_plugin_t *p, const protoop_params_t *pp, int outputc, protoop_arg_t status);
+
+/**
+ * Copies, in FIFO order, at most \p max events recorded for the plugin currently running into \p events.
+ * Returns the number of events copied.
+ */
+int plugin_record_drain(picoquic_cnx_t *cnx, plugin_record_event_t *events, int max);
+
+/**
+ * Returns the number of events of the plugin currently running that were overwritten before being drained.
+ */
+uint64_t plugin_record_dropped(picoquic_cnx_t *cnx);
+
+/**
+ * This function sets metadata at `idx` to `val` in the plugin structure metadata stored at `metadata`
+ * The metadata of a plugin are inline when its slot allows it. Otherwise, if they are not present in the overflow
+ * hashmap, they will be allocated and the values at indexes different thant `idx` are set to zero by default
  * Returns 0 if no error, -1 if an error occurred
  */
-int set_plugin_metadata(protoop_plugin_t *plugin, plugin_struct_metadata_t **metadata, int idx, uint64_t val);
+int set_plugin_metadata(protoop_plugin_t *plugin, plugin_metadata_t *metadata, int idx, uint64_t val);
 
 /**
- * This function sets out to the values of the plugin metadata at `idx` from a plugin structure metadata hashmap stored
- * in `metadata`. If the metadata are not present in the hashmap, it will be allocated and the values are set to zero
- * by default (*out will thus be set to 0)
+ * This function sets out to the values of the plugin metadata at `idx` from a plugin structure metadata stored
+ * in `metadata`. If the metadata are neither inline nor present in the overflow hashmap, they will be allocated and
+ * the values are set to zero by default (*out will thus be set to 0)
  * Returns 0 if no error, -1 if an error occurred
  */
-int get_plugin_metadata(protoop_plugin_t *plugin, plugin_struct_metadata_t **metadata, int idx, uint64_t *out);
+int get_plugin_metadata(protoop_plugin_t *plugin, plugin_metadata_t *metadata, int idx, uint64_t *out);
+
+/**
+ * Frees the metadata of the plugins that do not fit in the inline slots of \p metadata,
+ * and resets all of them to zero.
+ */
+void plugin_metadata_free(plugin_metadata_t *metadata);
 
 int get_errno();
 
@@ -0,0 +1,177 @@
+#include "plugin_async.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+typedef struct st_plugin_async_entry_t {
+    plugin_async_observer_t *observer;
+    plugin_async_event_t event;
+} plugin_async_entry_t;
+
+/* The protocol operations all run in the same thread, which is thus the only producer.
+ * head is only written by it, tail only by the worker.
+ */
+typedef struct st_plugin_async_worker_t {
+    pthread_t thread;
+    int refcount; /* Number of attached observers, only used by the producer */
+    int stop;
+    uint64_t head;
+    uint64_t tail;
+    plugin_async_entry_t *entries;
+} plugin_async_worker_t;
+
+static plugin_async_worker_t async_worker;
+
+static void plugin_async_sleep()
+{
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = PLUGIN_ASYNC_IDLE_SLEEP };
+    nanosleep(&ts, NULL);
+}
+
+static void *plugin_async_worker_run(void *arg)
+{
+    plugin_async_worker_t *worker = arg;
+    char *error_msg = NULL;
+    for (;;) {
+        uint64_t tail = worker->tail;
+        if (tail == __atomic_load_n(&worker->head, __ATOMIC_ACQUIRE)) {
+            if (__atomic_load_n(&worker->stop, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            plugin_async_sleep();
+            continue;
+        }
+        plugin_async_entry_t *entry = &worker->entries[tail & (PLUGIN_ASYNC_QUEUE_SIZE - 1)];
+        plugin_async_observer_t *observer = entry->observer;
+        memcpy(observer->memory, &entry->event, sizeof(plugin_async_event_t));
+        exec_loaded_code(observer->pluglet, observer->memory, observer->memory, PLUGIN_ASYNC_MEMORY, &error_msg);
+        if (error_msg) {
+            fprintf(stderr, "Error when running async observer: %s\n", error_msg);
+            error_msg = NULL;
+        }
+        observer->executed++;
+        /* Only release the entry once done, so that a flush guarantees the observer is not running anymore */
+        __atomic_store_n(&worker->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+plugin_async_observer_t *plugin_async_observer_create(const char *elf_fname, pluglet_image_t *image, const char *args)
+{
+    pluglet_image_t *images = NULL;
+    if (!image) {
+        image = pluglet_image_get(&images, elf_fname);
+        if (!image) {
+            return NULL;
+        }
+    }
+
+    plugin_async_observer_t *observer = NULL;
+    if (pluglet_image_imports(image, "set_")) {
+        printf("Pluglet %s modifies the connection, it cannot be an async observer!\n", elf_fname);
+    } else if ((observer = calloc(1, sizeof(plugin_async_observer_t))) == NULL ||
+               (observer->memory = calloc(1, PLUGIN_ASYNC_MEMORY)) == NULL) {
+        printf("Cannot allocate memory for async observer %s\n", elf_fname);
+        free(observer);
+        observer = NULL;
+    }
+
+    /* Parse the declared fields */
+    char *end = NULL;
+    while (observer && args && *args != '\0') {
+        unsigned long ak = strtoul(args, &end, 0);
+        if (end == args || observer->nb_fields == PLUGIN_ASYNC_FIELDS_MAX) {
+            printf("Invalid fields declared for async observer %s: %s\n", elf_fname, args);
+            free(observer->memory);
+            free(observer);
+            observer = NULL;
+            break;
+        }
+        observer->fields[observer->nb_fields++] = (access_key_t) ak;
+        args = end + strspn(end, " \r\n");
+    }
+
+    if (observer) {
+        observer->pluglet = load_elf_image(image, (uint64_t) observer->memory, PLUGIN_ASYNC_MEMORY);
+        if (!observer->pluglet || plugin_async_attach(observer) != 0) {
+            printf("Failed to load async observer %s\n", elf_fname);
+            if (observer->pluglet) {
+                release_elf(observer->pluglet);
+            }
+            free(observer->memory);
+            free(observer);
+            observer = NULL;
+        }
+    }
+    pluglet_images_free(&images);
+    return observer;
+}
+
+void plugin_async_observer_free(plugin_async_observer_t *observer)
+{
+    plugin_async_detach(observer);
+    release_elf(observer->pluglet);
+    free(observer->memory);
+    free(observer);
+}
+
+int plugin_async_attach(plugin_async_observer_t *observer)
+{
+    if (async_worker.refcount == 0) {
+        async_worker.entries = calloc(PLUGIN_ASYNC_QUEUE_SIZE, sizeof(plugin_async_entry_t));
+        if (!async_worker.entries) {
+            printf("Cannot allocate memory for the async observers queue\n");
+            return 1;
+        }
+        async_worker.head = 0;
+        async_worker.tail = 0;
+        async_worker.stop = 0;
+        if (pthread_create(&async_worker.thread, NULL, plugin_async_worker_run, &async_worker) != 0) {
+            printf("Cannot start the async observers worker\n");
+            free(async_worker.entries);
+            async_worker.entries = NULL;
+            return 1;
+        }
+    }
+    async_worker.refcount++;
+    return 0;
+}
+
+void plugin_async_flush()
+{
+    uint64_t head = async_worker.head;
+    while (async_worker.entries && __atomic_load_n(&async_worker.tail, __ATOMIC_ACQUIRE) < head) {
+        plugin_async_sleep();
+    }
+}
+
+void plugin_async_detach(plugin_async_observer_t *observer)
+{
+    /* The worker might still have some of its events to process */
+    plugin_async_flush();
+    if (--async_worker.refcount == 0) {
+        __atomic_store_n(&async_worker.stop, 1, __ATOMIC_RELEASE);
+        pthread_join(async_worker.thread, NULL);
+        free(async_worker.entries);
+        async_worker.entries = NULL;
+    }
+}
+
+void plugin_async_push(picoquic_cnx_t *cnx, plugin_async_observer_t *observer, const protoop_params_t *pp, int outputc, protoop_arg_t status)
+{
+    uint64_t head = async_worker.head;
+    if (head - __atomic_load_n(&async_worker.tail, __ATOMIC_ACQUIRE) == PLUGIN_ASYNC_QUEUE_SIZE) {
+        observer->dropped++;
+        return;
+    }
+    plugin_async_entry_t *entry = &async_worker.entries[head & (PLUGIN_ASYNC_QUEUE_SIZE - 1)];
+    entry->observer = observer;
+    plugin_record_fill_event(&entry->event.record, pp, outputc, status);
+    for (int i = 0; i < observer->nb_fields; i++) {
+        entry->event.fields[i] = get_cnx(cnx, observer->fields[i], 0);
+    }
+    memset(entry->event.fields + observer->nb_fields, 0, (PLUGIN_ASYNC_FIELDS_MAX - observer->nb_fields) * sizeof(protoop_arg_t));
+    __atomic_store_n(&async_worker.head, head + 1, __ATOMIC_RELEASE);
+}
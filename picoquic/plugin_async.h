@@ -0,0 +1,64 @@
+/**
+ * \file plugin_async.h
+ * \brief Observers running outside of the packet path.
+ *
+ * An async observer is a pluglet that does not modify the connection. When the protocol operation
+ * it observes returns, the core copies the call and the connection fields declared in the manifest
+ * into a lock-free single producer, single consumer queue. A worker thread then runs the pluglet,
+ * in its own VM and memory, with the copy as argument.
+ */
+
+#ifndef PLUGIN_ASYNC_H
+#define PLUGIN_ASYNC_H
+
+#include "picoquic.h"
+#include "plugin.h"
+#include "getset.h"
+#include "ubpf.h"
+
+#define PLUGIN_ASYNC_QUEUE_SIZE 1024 /* Must be a power of 2 */
+#define PLUGIN_ASYNC_FIELDS_MAX 8
+#define PLUGIN_ASYNC_MEMORY (64 * 1024) /* Private memory of an async pluglet, starting with the event it processes */
+#define PLUGIN_ASYNC_IDLE_SLEEP 200000 /* ns the worker sleeps when there is no event */
+
+/* Argument of an async pluglet, it must not access anything else of the connection */
+typedef struct st_plugin_async_event_t {
+    plugin_record_event_t record;
+    protoop_arg_t fields[PLUGIN_ASYNC_FIELDS_MAX]; /* Declared connection fields when the operation returned */
+} plugin_async_event_t;
+
+typedef struct st_plugin_async_observer_t {
+    pluglet_t *pluglet; /* Only run by the worker */
+    protoop_plugin_t *p; /* The plugin that inserted it, only used by the main thread */
+    uint8_t *memory;
+    uint8_t nb_fields;
+    access_key_t fields[PLUGIN_ASYNC_FIELDS_MAX];
+    uint64_t executed; /* Updated by the worker */
+    uint64_t dropped; /* Events not queued because the queue was full */
+    struct st_plugin_async_observer_t *next;
+} plugin_async_observer_t;
+
+/**
+ * Loads the pluglet as an async observer and attaches it to the worker. \p args contains the access keys
+ * of the connection fields to snapshot, separated by spaces. The pluglet is refused if it calls a set_* helper.
+ * Returns NULL on error.
+ */
+plugin_async_observer_t *plugin_async_observer_create(const char *elf_fname, pluglet_image_t *image, const char *args);
+
+/* Detaches \p observer, once its queued events are processed, and frees it */
+void plugin_async_observer_free(plugin_async_observer_t *observer);
+
+/**
+ * Registers an observer to the worker, starting it if needed.
+ * Every attached observer must be detached, which stops the worker once none remains.
+ */
+int plugin_async_attach(plugin_async_observer_t *observer);
+void plugin_async_detach(plugin_async_observer_t *observer);
+
+/* Queues the call described by \p pp for \p observer; never blocks, the event is dropped if the queue is full */
+void plugin_async_push(picoquic_cnx_t *cnx, plugin_async_observer_t *observer, const protoop_params_t *pp, int outputc, protoop_arg_t status);
+
+/* Waits until all the events queued so far are processed */
+void plugin_async_flush();
+
+#endif
@@ -0,0 +1,212 @@
+#include "picoquic_internal.h"
+#include "cc_common.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Scalable congestion control for L4S, after TCP Prague (draft-briscoe-iccrg-prague-congestion-control).
+ * The ECN plugin counts in the path the packets that the peer acknowledged with an ECN mark, and those
+ * of them marked CE. Once per round trip, the fraction of CE marks updates the moving average alpha,
+ * and a CE notification shrinks the window by alpha/2 instead of the classic half. With the shallow
+ * marking threshold of an L4S bottleneck, the window then oscillates by a few packets around the
+ * bandwidth delay product. Losses are handled as in New Reno.
+ */
+
+#define PICOQUIC_PRAGUE_ALPHA_SHIFT 20 /* alpha is in 1/2^20, small fractions surviving the g shift */
+#define PICOQUIC_PRAGUE_ALPHA_MAX (1ull << PICOQUIC_PRAGUE_ALPHA_SHIFT)
+#define PICOQUIC_PRAGUE_G_SHIFT 4 /* g = 1/16 */
+
+typedef enum {
+    picoquic_prague_alg_slow_start = 0,
+    picoquic_prague_alg_congestion_avoidance
+} picoquic_prague_alg_state_t;
+
+typedef struct st_picoquic_prague_state_t {
+    picoquic_prague_alg_state_t alg_state;
+    uint64_t residual_ack;
+    uint64_t ssthresh;
+    uint64_t recovery_start;
+    uint64_t last_sequence_blocked;
+    uint64_t alpha;
+    uint64_t round_end;
+    uint64_t round_ect_acked;
+    uint64_t round_ce_acked;
+} picoquic_prague_state_t;
+
+void picoquic_prague_init(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
+{
+    /* Initialize the state of the congestion control algorithm */
+    picoquic_prague_state_t* prague_state = (picoquic_prague_state_t*)malloc(sizeof(picoquic_prague_state_t));
+
+    if (prague_state != NULL) {
+        memset(prague_state, 0, sizeof(picoquic_prague_state_t));
+        path_x->congestion_alg_state = (void*)prague_state;
+        prague_state->alg_state = picoquic_prague_alg_slow_start;
+        prague_state->ssthresh = (uint64_t)((int64_t)-1);
+        prague_state->alpha = PICOQUIC_PRAGUE_ALPHA_MAX;
+        prague_state->round_ect_acked = path_x->ecn_ect_acked;
+        prague_state->round_ce_acked = path_x->ecn_ce_acked;
+        path_x->cwin = PICOQUIC_CWIN_INITIAL;
+    }
+}
+
+/* At the end of each round trip, alpha moves by g towards the fraction of packets marked CE during the round */
+static void picoquic_prague_update_alpha(picoquic_path_t* path_x, picoquic_prague_state_t* prague_state)
+{
+    uint64_t ack_number = picoquic_cc_get_ack_number(path_x);
+
+    if (ack_number == UINT64_MAX || ack_number < prague_state->round_end) {
+        return;
+    }
+
+    uint64_t ect_acked = path_x->ecn_ect_acked - prague_state->round_ect_acked;
+
+    if (ect_acked > 0) {
+        uint64_t ce_acked = path_x->ecn_ce_acked - prague_state->round_ce_acked;
+        uint64_t frac = (ce_acked << PICOQUIC_PRAGUE_ALPHA_SHIFT) / ect_acked;
+
+        if (frac > PICOQUIC_PRAGUE_ALPHA_MAX) {
+            frac = PICOQUIC_PRAGUE_ALPHA_MAX;
+        }
+        prague_state->alpha -= prague_state->alpha >> PICOQUIC_PRAGUE_G_SHIFT;
+        prague_state->alpha += frac >> PICOQUIC_PRAGUE_G_SHIFT;
+    }
+
+    prague_state->round_ect_acked = path_x->ecn_ect_acked;
+    prague_state->round_ce_acked = path_x->ecn_ce_acked;
+    prague_state->round_end = picoquic_cc_get_sequence_number(path_x);
+}
+
+/* Shrink the window in proportion of the marks, at most once per RTT */
+static void picoquic_prague_congestion_experienced(picoquic_path_t* path_x, picoquic_prague_state_t* prague_state,
+    uint64_t current_time)
+{
+    uint64_t decrease = (path_x->cwin * prague_state->alpha) >> (PICOQUIC_PRAGUE_ALPHA_SHIFT + 1);
+
+    if (path_x->cwin > PICOQUIC_CWIN_MINIMUM + decrease) {
+        path_x->cwin -= decrease;
+    } else {
+        path_x->cwin = PICOQUIC_CWIN_MINIMUM;
+    }
+
+    prague_state->ssthresh = path_x->cwin;
+    prague_state->alg_state = picoquic_prague_alg_congestion_avoidance;
+    prague_state->recovery_start = current_time;
+    prague_state->residual_ack = 0;
+}
+
+static void picoquic_prague_enter_recovery(picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    picoquic_prague_state_t* prague_state,
+    uint64_t current_time)
+{
+    prague_state->ssthresh = path_x->cwin / 2;
+    if (prague_state->ssthresh < PICOQUIC_CWIN_MINIMUM) {
+        prague_state->ssthresh = PICOQUIC_CWIN_MINIMUM;
+    }
+
+    if (notification == picoquic_congestion_notification_timeout) {
+        path_x->cwin = PICOQUIC_CWIN_MINIMUM;
+        prague_state->alg_state = picoquic_prague_alg_slow_start;
+    } else {
+        path_x->cwin = prague_state->ssthresh;
+        prague_state->alg_state = picoquic_prague_alg_congestion_avoidance;
+    }
+
+    prague_state->recovery_start = current_time;
+    prague_state->residual_ack = 0;
+}
+
+static void picoquic_prague_acknowledgement(picoquic_path_t* path_x, picoquic_prague_state_t* prague_state,
+    uint64_t nb_bytes_acknowledged)
+{
+    picoquic_prague_update_alpha(path_x, prague_state);
+
+    /* Only increase when the app is CWIN limited */
+    if (picoquic_cc_was_cwin_blocked(path_x, prague_state->last_sequence_blocked)) {
+        if (prague_state->alg_state == picoquic_prague_alg_slow_start) {
+            path_x->cwin += nb_bytes_acknowledged;
+            if (path_x->cwin >= prague_state->ssthresh) {
+                prague_state->alg_state = picoquic_prague_alg_congestion_avoidance;
+            }
+        } else {
+            uint64_t complete_delta = nb_bytes_acknowledged * path_x->send_mtu + prague_state->residual_ack;
+
+            prague_state->residual_ack = complete_delta % path_x->cwin;
+            path_x->cwin += complete_delta / path_x->cwin;
+        }
+    }
+}
+
+void picoquic_prague_notify(picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    uint64_t rtt_measurement,
+    uint64_t nb_bytes_acknowledged,
+    uint64_t lost_packet_number,
+    uint64_t current_time)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(rtt_measurement);
+    UNREFERENCED_PARAMETER(lost_packet_number);
+#endif
+    picoquic_prague_state_t* prague_state = (picoquic_prague_state_t*)path_x->congestion_alg_state;
+
+    if (prague_state != NULL) {
+        switch (notification) {
+        case picoquic_congestion_notification_acknowledgement:
+            picoquic_prague_acknowledgement(path_x, prague_state, nb_bytes_acknowledged);
+            break;
+        case picoquic_congestion_notification_congestion_experienced:
+            if (current_time - prague_state->recovery_start > path_x->smoothed_rtt) {
+                picoquic_prague_congestion_experienced(path_x, prague_state, current_time);
+            }
+            break;
+        case picoquic_congestion_notification_repeat:
+        case picoquic_congestion_notification_timeout:
+            /* enter recovery */
+            if (current_time - prague_state->recovery_start > path_x->smoothed_rtt) {
+                picoquic_prague_enter_recovery(path_x, notification, prague_state, current_time);
+            }
+            break;
+        case picoquic_congestion_notification_spurious_repeat:
+            if (current_time - prague_state->recovery_start < path_x->smoothed_rtt &&
+                path_x->cwin < 2 * prague_state->ssthresh) {
+                /* The loss was not real, go back to the window before the recovery */
+                path_x->cwin = 2 * prague_state->ssthresh;
+                prague_state->alg_state = picoquic_prague_alg_congestion_avoidance;
+            }
+            break;
+        case picoquic_congestion_notification_cwin_blocked:
+            prague_state->last_sequence_blocked = picoquic_cc_get_sequence_number(path_x);
+            break;
+        default:
+            /* ignore */
+            break;
+        }
+    }
+
+    /* Compute pacing data */
+    picoquic_update_pacing_data(path_x);
+}
+
+/* Release the state of the congestion control algorithm */
+void picoquic_prague_delete(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
+{
+    if (path_x->congestion_alg_state != NULL) {
+        free(path_x->congestion_alg_state);
+        path_x->congestion_alg_state = NULL;
+    }
+}
+
+/* Definition record for the Prague algorithm */
+
+#define PICOQUIC_PRAGUE_ID 0x50524147 /* PRAG */
+
+picoquic_congestion_algorithm_t picoquic_prague_algorithm_struct = {
+    PICOQUIC_PRAGUE_ID,
+    picoquic_prague_init,
+    picoquic_prague_notify,
+    picoquic_prague_delete
+};
+
+picoquic_congestion_algorithm_t* picoquic_prague_algorithm = &picoquic_prague_algorithm_struct;
@@ -31,6 +31,7 @@ protoop_id_t PROTOOP_NOPARAM_CONNECTION_ERROR = { .id = PROTOOPID_NOPARAM_CONNEC
 protoop_id_t PROTOOP_NOPARAM_GET_DESTINATION_CONNECTION_ID = { .id = PROTOOPID_NOPARAM_GET_DESTINATION_CONNECTION_ID };
 protoop_id_t PROTOOP_NOPARAM_SET_NEXT_WAKE_TIME = { .id = PROTOOPID_NOPARAM_SET_NEXT_WAKE_TIME };
 protoop_id_t PROTOOP_NOPARAM_HAS_CONGESTION_CONTROLLED_PLUGIN_FRAMEMS_TO_SEND = { .id = PROTOOPID_NOPARAM_HAS_CONGESTION_CONTROLLED_PLUGIN_FRAMEMS_TO_SEND };
+protoop_id_t PROTOOP_NOPARAM_PACKET_WINDOW = { .id = PROTOOPID_NOPARAM_PACKET_WINDOW };
 protoop_id_t PROTOOP_NOPARAM_RETRANSMIT_NEEDED = { .id = PROTOOPID_NOPARAM_RETRANSMIT_NEEDED };
 protoop_id_t PROTOOP_NOPARAM_RETRANSMIT_NEEDED_BY_PACKET = { .id = PROTOOPID_NOPARAM_RETRANSMIT_NEEDED_BY_PACKET };
 protoop_id_t PROTOOP_NOPARAM_PREDICT_PACKET_HEADER_LENGTH = { .id = PROTOOPID_NOPARAM_PREDICT_PACKET_HEADER_LENGTH };
@@ -45,6 +46,8 @@ protoop_id_t PROTOOP_NOPARAM_STREAM_BYTES_MAX = { .id = PROTOOPID_NOPARAM_STREAM
 protoop_id_t PROTOOP_NOPARAM_STREAM_ALWAYS_ENCODE_LENGTH = { .id = PROTOOPID_NOPARAM_STREAM_ALWAYS_ENCODE_LENGTH };
 protoop_id_t PROTOOP_NOPARAM_PREPARE_CRYPTO_HS_FRAME = { .id = PROTOOPID_NOPARAM_PREPARE_CRYPTO_HS_FRAME };
 protoop_id_t PROTOOP_NOPARAM_PREPARE_HANDSHAKE_DONE_FRAME = { .id = PROTOOPID_NOPARAM_PREPARE_HANDSHAKE_DONE_FRAME };
+protoop_id_t PROTOOP_NOPARAM_PREPARE_ACK_FREQUENCY_FRAME = { .id = PROTOOPID_NOPARAM_PREPARE_ACK_FREQUENCY_FRAME };
+protoop_id_t PROTOOP_NOPARAM_PREPARE_IMMEDIATE_ACK_FRAME = { .id = PROTOOPID_NOPARAM_PREPARE_IMMEDIATE_ACK_FRAME };
 protoop_id_t PROTOOP_NOPARAM_PREPARE_ACK_FRAME = { .id = PROTOOPID_NOPARAM_PREPARE_ACK_FRAME };
 protoop_id_t PROTOOP_NOPARAM_PREPARE_ACK_ECN_FRAME = { .id = PROTOOPID_NOPARAM_PREPARE_ACK_ECN_FRAME };
 protoop_id_t PROTOOP_NOPARAM_PARSE_ECN_BLOCK = { .id = PROTOOPID_NOPARAM_PARSE_ECN_BLOCK };
@@ -54,6 +57,7 @@ protoop_id_t PROTOOP_NOPARAM_PREPARE_MAX_DATA_FRAME = { .id = PROTOOPID_NOPARAM_
 protoop_id_t PROTOOP_NOPARAM_PREPARE_REQUIRED_MAX_STREAM_DATA_FRAME = { .id = PROTOOPID_NOPARAM_PREPARE_REQUIRED_MAX_STREAM_DATA_FRAME };
 protoop_id_t PROTOOP_NOPARAM_PREPARE_PATH_CHALLENGE_FRAME = { .id = PROTOOPID_NOPARAM_PREPARE_PATH_CHALLENGE_FRAME };
 protoop_id_t PROTOOP_NOPARAM_SKIP_FRAME = { .id = PROTOOPID_NOPARAM_SKIP_FRAME };
+protoop_id_t PROTOOP_NOPARAM_PROTECTABLE_PAYLOAD_SPANS = { .id = PROTOOPID_NOPARAM_PROTECTABLE_PAYLOAD_SPANS };
 protoop_id_t PROTOOP_NOPARAM_PREPARE_PACKET_READY = { .id = PROTOOPID_NOPARAM_PREPARE_PACKET_READY };
 protoop_id_t PROTOOP_NOPARAM_RECEIVED_PACKET = { .id = PROTOOPID_NOPARAM_RECEIVED_PACKET };
 protoop_id_t PROTOOP_NOPARAM_BEFORE_SENDING_PACKET = { .id = PROTOOPID_NOPARAM_BEFORE_SENDING_PACKET };
@@ -79,4 +83,6 @@ protoop_id_t PROTOOP_NOPARAM_LOG_EVENT = { .id = PROTOOPID_NOPARAM_LOG_EVENT };
 protoop_id_t PROTOOP_NOPARAM_LOG_FRAME = { .id = PROTOOPID_NOPARAM_LOG_FRAME };
 protoop_id_t PROTOOP_NOPARAM_PUSH_LOG_CONTEXT = { .id = PROTOOPID_NOPARAM_PUSH_LOG_CONTEXT };
 protoop_id_t PROTOOP_NOPARAM_POP_LOG_CONTEXT = { .id = PROTOOPID_NOPARAM_POP_LOG_CONTEXT };
+protoop_id_t PROTOOP_NOPARAM_WRITE_LOG = { .id = PROTOOPID_NOPARAM_WRITE_LOG };
+protoop_id_t PROTOOP_NOPARAM_MERGE_SERVER_METRICS = { .id = PROTOOPID_NOPARAM_MERGE_SERVER_METRICS };
 protoop_id_t PROTOOP_NOPARAM_PEER_ADDRESS_CHANGED = { .id = PROTOOPID_NOPARAM_PEER_ADDRESS_CHANGED };
\ No newline at end of file
@@ -31,8 +31,12 @@ typedef char* protoop_str_id_t;
 typedef struct protoop_id {
     uint64_t hash;
     char* id;
+    uint16_t index; /* Dense index of built-in protocol operations, assigned at registration. 0 if none */
 } protoop_id_t;
 
+/* Maximum number of built-in protocol operations that can be directly indexed */
+#define PROTOOP_BUILTIN_INDEX_MAX 128
+
 static inline uint64_t hash_value_str(char *str_pid)
 {
     uint64_t ret;
@@ -90,8 +94,8 @@ extern protoop_id_t PROTOOP_PARAM_WRITE_FRAME;
 /**
  * Notifies the reception (or not) of the frame by the peer and enables reservation frame slot cleaning.
  * \param[in] rfs \b reserve_frame_slot_t* The reserved frame. Should be free'd to avoid memory leak in the plugin.
- * \param[in] received \b int Indicates if the frame was received or not.
- * 
+ * \param[in] received \b int Indicates if the frame was received or not, one of the PICOQUIC_FRAME_* values.
+ * With PICOQUIC_FRAME_NOT_SENT and PICOQUIC_FRAME_EXPIRED, the frame was not sent, and with the latter, not even written.
  */
 #define PROTOOPID_PARAM_NOTIFY_FRAME "notify_frame"
 extern protoop_id_t PROTOOP_PARAM_NOTIFY_FRAME;
@@ -213,7 +217,7 @@ extern protoop_id_t PROTOOP_NOPARAM_PROCESS_POSSIBLE_ACK_OF_ACK_FRAME;
 
 /**
  * Process possible ACK of ACK range, and clean the associated SACK_ITEM
- * \param[in] first_sack \b picoquic_sack_item_t* The pointer to the first SACK item
+ * \param[in] sacks \b picoquic_sack_list_t* The SACK list, see AK_PKTCTX_SACK_LIST
  * \param[in] start_range \b uint64_t The start of the ACKed range
  * \param[in] end_range \b uint64_t The end of the ACKed range
  * 
@@ -398,6 +402,21 @@ extern protoop_id_t PROTOOP_NOPARAM_SET_NEXT_WAKE_TIME;
 #define PROTOOPID_NOPARAM_HAS_CONGESTION_CONTROLLED_PLUGIN_FRAMEMS_TO_SEND "has_congestion_controlled_plugin_frames_to_send"
 extern protoop_id_t PROTOOP_NOPARAM_HAS_CONGESTION_CONTROLLED_PLUGIN_FRAMEMS_TO_SEND;
 
+/**
+ * Copy a window of the bytes of a packet to a buffer, or the buffer to the window, in a single call.
+ * The window is checked once against the size of the packet buffer, so that the bytes can then be
+ * parsed or built in place in the buffer, e.g., in the memory of the plugin.
+ * \param[in] packet \b picoquic_packet_t* The packet
+ * \param[in] offset \b size_t Offset of the window in the bytes of the packet
+ * \param[in] length \b size_t Length of the window
+ * \param[in] buffer \b uint8_t* Buffer of \p length bytes
+ * \param[in] is_write \b int Copies the buffer to the window if set, the window to the buffer otherwise
+ *
+ * \return \b int 0 if the bytes were copied, PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL if the window goes past the packet buffer
+ */
+#define PROTOOPID_NOPARAM_PACKET_WINDOW "packet_window"
+extern protoop_id_t PROTOOP_NOPARAM_PACKET_WINDOW;
+
 /**
  * Detect if a retransmission is needed.
  * \param[in] pc \b picoquic_packet_context_enum The packet context to retransmit
@@ -549,6 +568,30 @@ extern protoop_id_t PROTOOP_NOPARAM_PREPARE_CRYPTO_HS_FRAME;
  */
 #define PROTOOPID_NOPARAM_PREPARE_HANDSHAKE_DONE_FRAME "prepare_handshake_done"
 extern protoop_id_t PROTOOP_NOPARAM_PREPARE_HANDSHAKE_DONE_FRAME;
+
+/**
+ * Prepare an ACK_FREQUENCY frame, if the ACK frequency to request from the peer changed enough
+ * since the last one sent.
+ * \param[in] path_x \b picoquic_path_t* The path whose congestion window and RTT scale the request
+ * \param[in] bytes \b uint8_t* Pointer to the buffer to write the frame
+ * \param[in] bytes_max \b size_t Max size that can be written
+ *
+ * \return \b int Error code, 0 means it's ok
+ * \param[out] consumed \b size_t Number of bytes written, 0 if no frame is needed
+ */
+#define PROTOOPID_NOPARAM_PREPARE_ACK_FREQUENCY_FRAME "prepare_ack_frequency_frame"
+extern protoop_id_t PROTOOP_NOPARAM_PREPARE_ACK_FREQUENCY_FRAME;
+
+/**
+ * Prepare an IMMEDIATE_ACK frame.
+ * \param[in] bytes \b uint8_t* Pointer to the buffer to write the frame
+ * \param[in] bytes_max \b size_t Max size that can be written
+ *
+ * \return \b int Error code, 0 means it's ok
+ * \param[out] consumed \b size_t Number of bytes written
+ */
+#define PROTOOPID_NOPARAM_PREPARE_IMMEDIATE_ACK_FRAME "prepare_immediate_ack_frame"
+extern protoop_id_t PROTOOP_NOPARAM_PREPARE_IMMEDIATE_ACK_FRAME;
 /**
  * Prepare a ACK frame.
  * \param[in] current_time \b uint64_t The current time
@@ -580,13 +623,15 @@ extern protoop_id_t PROTOOP_NOPARAM_PREPARE_ACK_ECN_FRAME;
  * \param[in] bytes_max <b> const uint8_t* </b> Pointer to the end of the packet to parse
  *
  * \return \b uint8_t* Pointer to the first byte after the block in the packet, or NULL if an error occurred
- * \param[out] ecn_block \b void* Pointer to the structure malloc'ed in the context memory containing the block information
+ * \param[out] ecn_block \b void* Pointer to the structure malloc'ed in the context memory containing the block information,
+ * or NULL to process the ECT(0), ECT(1) and CE counts decoded by the core, as an \b uint64_t[3]
  */
 #define PROTOOPID_NOPARAM_PARSE_ECN_BLOCK "parse_ecn_block"
 extern protoop_id_t PROTOOP_NOPARAM_PARSE_ECN_BLOCK;
 
 /**
- * Process an ECN block, and free it
+ * Process an ECN block, and free it. By default, validates the ECN counts of the path and notifies the CE marks
+ * to the congestion control.
  * \param[in] ecn_block \b void* The block to process
  * \param[in] pkt_ctx \b picoquic_packet_context_t* The packet context of the block
  * \param[in] path \b picoquic_path_t* The path on which the block was received
@@ -597,7 +642,7 @@ extern protoop_id_t PROTOOP_NOPARAM_PARSE_ECN_BLOCK;
 extern protoop_id_t PROTOOP_NOPARAM_PROCESS_ECN_BLOCK;
 
 /**
- * Write an ECN block
+ * Write an ECN block. By default, the counts of the marked packets received in pkt_ctx, if there are any.
  * \param[in] bytes \b uint8_t* The buffer to write the block to
  * \param[in] bytes_max \b size_t The number of bytes that can be written in the buffer
  * \param[in] pkt_ctx \b picoquic_packet_context_t* The packet context for which a block should be written
@@ -653,6 +698,20 @@ extern protoop_id_t PROTOOP_NOPARAM_PREPARE_PATH_CHALLENGE_FRAME;
  */
 #define PROTOOPID_NOPARAM_SKIP_FRAME "skip_frame"
 extern protoop_id_t PROTOOP_NOPARAM_SKIP_FRAME;
+/**
+ * Walk the frames of the packet payload pointed by \p bytes and list the runs of contiguous frames that are
+ * worth protecting, i.e., all of them except the ACK, PADDING and CRYPTO ones.
+ * \param[in] bytes \b uint8_t* Pointer to the start of the packet payload
+ * \param[in] bytes_max_size \b size_t Length of the packet payload
+ * \param[in] spans \b picoquic_payload_span_t* Array receiving the runs of frames, in payload order
+ * \param[in] max_spans \b int Number of entries of \p spans
+ *
+ * \return \b int Error code, PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL if the runs do not fit in \p spans
+ * \param[out] nb_spans \b int Number of entries written in \p spans
+ * \param[out] length \b size_t Total length of the runs
+ */
+#define PROTOOPID_NOPARAM_PROTECTABLE_PAYLOAD_SPANS "protectable_payload_spans"
+extern protoop_id_t PROTOOP_NOPARAM_PROTECTABLE_PAYLOAD_SPANS;
 /**
  * Prepare a packet when the connection is in ready state.
  * \todo Write doc
@@ -854,6 +913,27 @@ extern protoop_id_t PROTOOP_NOPARAM_PUSH_LOG_CONTEXT;
 #define PROTOOPID_NOPARAM_POP_LOG_CONTEXT "pop_log_context"
 extern protoop_id_t PROTOOP_NOPARAM_POP_LOG_CONTEXT;
 
+/**
+ * Write logs to a file, through the log flusher of the context when there is one, see picoquic_set_log_flusher()
+ * \param[in] fd  int The file descriptor
+ * \param[in] bytes <b> const uint8_t* </b> The bytes to write
+ * \param[in] length  size_t The number of bytes
+ * \param[in] close_fd  int Close the file descriptor once the bytes are written
+ *
+ * \return  int 0 if the bytes were written or queued, -1 if some were dropped
+ */
+#define PROTOOPID_NOPARAM_WRITE_LOG "write_log"
+extern protoop_id_t PROTOOP_NOPARAM_WRITE_LOG;
+
+/**
+ * Merge the totals of a closing connection in the server metrics of the context, if it has some, see picoquic_set_server_metrics()
+ * \param[in] sample <b> picoquic_server_metrics_sample_t* </b> The totals of the connection
+ *
+ * \return None
+ */
+#define PROTOOPID_NOPARAM_MERGE_SERVER_METRICS "merge_server_metrics"
+extern protoop_id_t PROTOOP_NOPARAM_MERGE_SERVER_METRICS;
+
 
 /**
  * The peer address of a particular path has changed
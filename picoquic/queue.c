@@ -1,5 +1,7 @@
 #include <stdlib.h>
+#include <string.h>
 #include "queue.h"
+#include "alloc_profiler.h"
 
 queue_t *queue_init()
 {
@@ -7,71 +9,55 @@ queue_t *queue_init()
     if (!q) {
         return NULL;
     }
-    q->head = NULL;
-    q->tail = NULL;
+    q->items = (void **) malloc(QUEUE_INITIAL_CAPACITY * sizeof(void *));
+    if (!q->items) {
+        free(q);
+        return NULL;
+    }
+    q->capacity = QUEUE_INITIAL_CAPACITY;
+    q->head = 0;
     q->size = 0;
     return q;
 }
 
 void queue_free(queue_t *q)
 {
-    /* First remove all elements */
-    while (q->head) {
-        queue_dequeue(q);
-    }
+    free(q->items);
     free(q);
 }
 
 int queue_enqueue(queue_t *q, void *d)
 {
-    queue_node_t *n = (queue_node_t *) malloc(sizeof(queue_node_t));
-    if (!n) {
-        return 1;
-    }
-    n->data = d;
-    /* This element is the last one to be removed, so the next one is NULL */
-    n->next = NULL;
-
-    /* Is it the first element to be inserted? */
-    if (!q->head) {
-        q->head = n;
-        q->tail = n;
-    } else {
-        /* Then n is the next of the previously last one */
-        q->tail->next = n;
-        /* And n is the new tail */
-        q->tail = n;
+    if (q->size == q->capacity) {
+        /* Double the array, the elements wrapping around its end move after the others */
+        void **items = (void **) realloc(q->items, 2 * q->capacity * sizeof(void *));
+        if (!items) {
+            return 1;
+        }
+        PICOQUIC_ALLOC_PROFILE(picoquic_alloc_site_queue, NULL, 2 * q->capacity * sizeof(void *));
+        memcpy(items + q->capacity, items, q->head * sizeof(void *));
+        q->items = items;
+        q->capacity *= 2;
     }
+    q->items[(q->head + q->size) & (q->capacity - 1)] = d;
     q->size++;
     return 0;
 }
 
 void *queue_dequeue(queue_t *q)
 {
-    /* Case 1: the list is empty */
-    if (!q->head) {
+    if (q->size == 0) {
         return NULL;
     }
-    queue_node_t *to_remove = q->head;
-    void *to_return = to_remove->data;
-    /* Case 2: only one element is left */
-    if (q->head == q->tail) {
-        q->head = NULL;
-        q->tail = NULL;
-    } else {
-        /* Case 3: at least two elements left */
-        q->head = q->head->next;
-    }
-
+    void *to_return = q->items[q->head];
+    q->head = (q->head + 1) & (q->capacity - 1);
     q->size--;
-    /* Don't forget to free the node memory */
-    free(to_remove);
     return to_return;
 }
 
 void *queue_peek(const queue_t *q)
 {
-    return q->head ? q->head->data : NULL;
+    return (q->size > 0) ? q->items[q->head] : NULL;
 }
 
 void *queue_peek_any(const queue_t **q, int nq) {
@@ -85,4 +71,23 @@ void *queue_peek_any(const queue_t **q, int nq) {
 size_t queue_size(const queue_t *q)
 {
     return q->size;
-}
\ No newline at end of file
+}
+
+void *queue_get(const queue_t *q, size_t index)
+{
+    return (index < q->size) ? q->items[(q->head + index) & (q->capacity - 1)] : NULL;
+}
+
+void *queue_remove(queue_t *q, size_t index)
+{
+    if (index >= q->size) {
+        return NULL;
+    }
+    void *to_return = q->items[(q->head + index) & (q->capacity - 1)];
+    /* Move the elements after it one position forward */
+    for (size_t i = index + 1; i < q->size; i++) {
+        q->items[(q->head + i - 1) & (q->capacity - 1)] = q->items[(q->head + i) & (q->capacity - 1)];
+    }
+    q->size--;
+    return to_return;
+}
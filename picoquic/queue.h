@@ -1,31 +1,28 @@
 /**
  * \file queue.h
  * \author Quentin De Coninck
- * \brief A simple implementation of a queue using linked-list.
+ * \brief A simple implementation of a queue using a circular array.
  * 
- * Queue using two pointers, head and tail, and a simple linked list
- * to the next element being removed. Node memory is managed by this
- * simple library.
+ * The elements are kept in a circular array, which doubles when it is full and is
+ * never shrunk: once the queue has reached its usual size, enqueueing and dequeueing
+ * do not allocate memory. The array memory is managed by this simple library.
  * 
  * \warning Insertion of NULL element is discouraged, as it would not be possible to distinguish at peeking and dequeueing
  * if the element is NULL or if the queue is empty.
  */
 
-/**
- * A node of the queue.
- */
-typedef struct queue_node {
-    void *data;
-    struct queue_node *next;
-} queue_node_t;
+#include <stddef.h>
+
+#define QUEUE_INITIAL_CAPACITY 8
 
 /**
- * The queue containing references to the first (for removal) and the
- * last (fast insertion) elements.
+ * The queue, holding its elements from the head (for removal) to the
+ * tail (fast insertion) in a circular array.
  */
 typedef struct queue {
-    queue_node_t *head;
-    queue_node_t *tail;
+    void **items;
+    size_t capacity; /* Size of the array, a power of 2 */
+    size_t head; /* Index of the first element */
     size_t size;
 } queue_t;
 
@@ -52,7 +49,7 @@ void queue_free(queue_t *q);
 int queue_enqueue(queue_t *q, void *d);
 
 /**
- * Dequeue the first element in the queue \p q and free internal structure used to maintain this element in \p q.
+ * Dequeue the first element in the queue \p q.
  * \param[in] q The queue to dequeue the first element.
  * 
  * \return The data contained in the first element of the queue, or NULL if there is no such element.
@@ -82,4 +79,22 @@ void *queue_peek_any(const queue_t **q, int nq);
  *
  * \return The number of elements in the queue.
  */
-size_t queue_size(const queue_t *q);
\ No newline at end of file
+size_t queue_size(const queue_t *q);
+
+/**
+ * Get an element of the queue without removing it.
+ * \param[in] q The queue to get the element.
+ * \param[in] index The position of the element, 0 being the first one to be removed.
+ *
+ * \return The data of the element, or NULL if there is no such element.
+ */
+void *queue_get(const queue_t *q, size_t index);
+
+/**
+ * Remove an element from the queue, the elements after it keep their order.
+ * \param[in] q The queue to remove the element from.
+ * \param[in] index The position of the element, 0 being the first one to be removed.
+ *
+ * \return The data of the element, or NULL if there is no such element.
+ */
+void *queue_remove(queue_t *q, size_t index);
\ No newline at end of file
@@ -0,0 +1,177 @@
+/*
+ * QUIC-LB routable connection IDs, see draft-ietf-quic-load-balancers.
+ *
+ * The first octet carries the config rotation bits in its 3 high bits. In plaintext, the server ID follows in
+ * clear, then the nonce. The stream cipher puts the nonce first and hides both in three passes, each XORing one
+ * of them with the AES-ECB encryption of the other, padded with zeros. The block cipher encrypts the server ID
+ * and the nonce as a single AES block. The nonces are the random bytes of the CIDs, so they do not repeat.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "tls_api.h"
+
+#define PICOQUIC_LB_BLOCK_SIZE 16
+#define PICOQUIC_LB_PLAINTEXT_NONCE_MIN 4
+#define PICOQUIC_LB_STREAM_NONCE_MIN 8
+#define PICOQUIC_LB_STREAM_NONCE_MAX 16
+
+struct st_picoquic_lb_ctx_t {
+    picoquic_lb_config_t config;
+    uint8_t cnx_id_length;
+    void* ecb_enc;
+    void* ecb_dec; /* Block cipher only */
+};
+
+static int picoquic_lb_config_is_valid(picoquic_lb_config_t const* config)
+{
+    size_t cnx_id_length = 1 + (size_t)config->server_id_length + config->nonce_length;
+    int is_valid = config->config_rotation <= PICOQUIC_LB_CONFIG_ROTATION_MAX &&
+        config->server_id_length > 0 && config->server_id_length <= PICOQUIC_LB_SERVER_ID_MAX &&
+        cnx_id_length <= PICOQUIC_CONNECTION_ID_MAX_SIZE;
+
+    switch (config->mode) {
+    case picoquic_lb_plaintext:
+        is_valid &= config->nonce_length >= PICOQUIC_LB_PLAINTEXT_NONCE_MIN;
+        break;
+    case picoquic_lb_stream_cipher:
+        is_valid &= config->nonce_length >= PICOQUIC_LB_STREAM_NONCE_MIN && config->nonce_length <= PICOQUIC_LB_STREAM_NONCE_MAX;
+        break;
+    case picoquic_lb_block_cipher:
+        is_valid &= config->server_id_length + config->nonce_length == PICOQUIC_LB_BLOCK_SIZE;
+        break;
+    default:
+        is_valid = 0;
+        break;
+    }
+
+    return is_valid;
+}
+
+picoquic_lb_ctx_t* picoquic_lb_ctx_create(picoquic_lb_config_t const* config)
+{
+    picoquic_lb_ctx_t* lb_ctx = NULL;
+
+    if (picoquic_lb_config_is_valid(config) && (lb_ctx = (picoquic_lb_ctx_t*)calloc(1, sizeof(picoquic_lb_ctx_t))) != NULL) {
+        lb_ctx->config = *config;
+        lb_ctx->cnx_id_length = (uint8_t)(1 + config->server_id_length + config->nonce_length);
+        if (config->mode != picoquic_lb_plaintext &&
+            ((lb_ctx->ecb_enc = picoquic_aes128_ecb_create(1, config->key)) == NULL ||
+            (config->mode == picoquic_lb_block_cipher && (lb_ctx->ecb_dec = picoquic_aes128_ecb_create(0, config->key)) == NULL))) {
+            picoquic_lb_ctx_free(lb_ctx);
+            lb_ctx = NULL;
+        }
+    }
+
+    return lb_ctx;
+}
+
+void picoquic_lb_ctx_free(picoquic_lb_ctx_t* lb_ctx)
+{
+    if (lb_ctx != NULL) {
+        picoquic_aes128_ecb_free(lb_ctx->ecb_enc);
+        picoquic_aes128_ecb_free(lb_ctx->ecb_dec);
+        memset(lb_ctx->config.key, 0, sizeof(lb_ctx->config.key));
+        free(lb_ctx);
+    }
+}
+
+uint8_t picoquic_lb_cnx_id_length(picoquic_lb_ctx_t* lb_ctx)
+{
+    return lb_ctx->cnx_id_length;
+}
+
+/* XORs target with the encryption of source, padded with zeros */
+static void picoquic_lb_stream_pass(void* ecb_enc, uint8_t* target, size_t target_length, const uint8_t* source, size_t source_length)
+{
+    uint8_t block[PICOQUIC_LB_BLOCK_SIZE];
+
+    memset(block, 0, sizeof(block));
+    memcpy(block, source, source_length);
+    picoquic_aes128_ecb_apply(ecb_enc, block, block, sizeof(block));
+    for (size_t i = 0; i < target_length; i++) {
+        target[i] ^= block[i];
+    }
+}
+
+void picoquic_lb_encode_cnx_id(picoquic_lb_ctx_t* lb_ctx, picoquic_connection_id_t* cnx_id)
+{
+    picoquic_lb_config_t* config = &lb_ctx->config;
+    uint8_t* nonce;
+    uint8_t* server_id;
+
+    cnx_id->id[0] = (uint8_t)(config->config_rotation << 5) |
+        (config->self_encode_length ? (uint8_t)(lb_ctx->cnx_id_length - 1) : (cnx_id->id[0] & 0x1F));
+    cnx_id->id_len = lb_ctx->cnx_id_length;
+
+    switch (config->mode) {
+    case picoquic_lb_plaintext:
+        memcpy(cnx_id->id + 1, config->server_id, config->server_id_length);
+        break;
+    case picoquic_lb_stream_cipher:
+        nonce = cnx_id->id + 1;
+        server_id = nonce + config->nonce_length;
+        memcpy(server_id, config->server_id, config->server_id_length);
+        picoquic_lb_stream_pass(lb_ctx->ecb_enc, server_id, config->server_id_length, nonce, config->nonce_length);
+        picoquic_lb_stream_pass(lb_ctx->ecb_enc, nonce, config->nonce_length, server_id, config->server_id_length);
+        picoquic_lb_stream_pass(lb_ctx->ecb_enc, server_id, config->server_id_length, nonce, config->nonce_length);
+        break;
+    case picoquic_lb_block_cipher:
+        memcpy(cnx_id->id + 1, config->server_id, config->server_id_length);
+        picoquic_aes128_ecb_apply(lb_ctx->ecb_enc, cnx_id->id + 1, cnx_id->id + 1, PICOQUIC_LB_BLOCK_SIZE);
+        break;
+    default:
+        break;
+    }
+}
+
+int picoquic_lb_decode_server_id(picoquic_lb_ctx_t* lb_ctx, const uint8_t* bytes, size_t length, uint8_t* server_id)
+{
+    picoquic_lb_config_t* config = &lb_ctx->config;
+    uint8_t nonce[PICOQUIC_LB_STREAM_NONCE_MAX];
+    uint8_t block[PICOQUIC_LB_BLOCK_SIZE];
+
+    if (length < lb_ctx->cnx_id_length || (bytes[0] >> 5) != config->config_rotation ||
+        (config->self_encode_length && (bytes[0] & 0x1F) != lb_ctx->cnx_id_length - 1)) {
+        return -1;
+    }
+
+    switch (config->mode) {
+    case picoquic_lb_plaintext:
+        memcpy(server_id, bytes + 1, config->server_id_length);
+        break;
+    case picoquic_lb_stream_cipher:
+        memcpy(nonce, bytes + 1, config->nonce_length);
+        memcpy(server_id, bytes + 1 + config->nonce_length, config->server_id_length);
+        picoquic_lb_stream_pass(lb_ctx->ecb_enc, server_id, config->server_id_length, nonce, config->nonce_length);
+        picoquic_lb_stream_pass(lb_ctx->ecb_enc, nonce, config->nonce_length, server_id, config->server_id_length);
+        picoquic_lb_stream_pass(lb_ctx->ecb_enc, server_id, config->server_id_length, nonce, config->nonce_length);
+        break;
+    case picoquic_lb_block_cipher:
+        picoquic_aes128_ecb_apply(lb_ctx->ecb_dec, block, bytes + 1, PICOQUIC_LB_BLOCK_SIZE);
+        memcpy(server_id, block, config->server_id_length);
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+int picoquic_set_lb_config(picoquic_quic_t* quic, picoquic_lb_config_t const* config)
+{
+    picoquic_lb_ctx_t* lb_ctx = NULL;
+
+    if (config != NULL && (lb_ctx = picoquic_lb_ctx_create(config)) == NULL) {
+        return -1;
+    }
+
+    picoquic_lb_ctx_free(quic->lb_ctx);
+    quic->lb_ctx = lb_ctx;
+    if (lb_ctx != NULL) {
+        quic->local_ctx_length = lb_ctx->cnx_id_length;
+    }
+
+    return 0;
+}
@@ -25,11 +25,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include "plugin.h"
+#include "plugin_async.h"
 #include "memory.h"
+#include "log_flusher.h"
+#include "offload_pool.h"
+#include "tracepoints.h"
 #include <ifaddrs.h>
 #include <net/if.h>
 #ifndef _WINDOWS
 #include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
 #include <netinet/in.h>
 
 #include <dirent.h>
@@ -157,6 +163,21 @@ const picoquic_version_parameters_t picoquic_supported_versions[] = {
 const size_t picoquic_nb_supported_versions = sizeof(picoquic_supported_versions) / sizeof(picoquic_version_parameters_t);
 
 
+static void picoquic_fill_pluglet_stat(plugin_stat_t *stat, pluglet_t *pluglet)
+{
+    stat->count = pluglet->count;
+    stat->sampled_count = pluglet->sampled_count;
+    /* Extrapolate the time spent in the calls that were not timed */
+    stat->total_execution_time = pluglet->sampled_count == 0 ? 0 :
+        (uint64_t) (((double) pluglet->total_execution_time / pluglet->sampled_count) * pluglet->count / 1000);
+    stat->max_execution_time = pluglet->max_execution_time;
+    stat->memory_accesses = pluglet->memory_accesses;
+    stat->elidable_checks = pluglet->elidable_checks;
+    for (int i = 0; i < PLUGIN_STAT_LATENCY_BUCKETS; i++) {
+        stat->latency_histogram[i] = i < PLUGLET_LATENCY_BUCKETS ? pluglet->latency_histogram[i] : 0;
+    }
+}
+
 int picoquic_get_plugin_stats(picoquic_cnx_t *cnx, plugin_stat_t **statsptr, int nmemb) {
 
     protocol_operation_struct_t *ops = (cnx->ops);
@@ -191,8 +212,7 @@ int picoquic_get_plugin_stats(picoquic_cnx_t *cnx, plugin_stat_t **statsptr, int
                     stats[current_position].post = false;
                     stats[current_position].is_param = true;
                     stats[current_position].param = current_popst->param;
-                    stats[current_position].count = current_popst->replace->count;
-                    stats[current_position].total_execution_time = current_popst->replace->total_execution_time;
+                    picoquic_fill_pluglet_stat(&stats[current_position], current_popst->replace);
                     current_position++;
                 }
 
@@ -211,8 +231,7 @@ int picoquic_get_plugin_stats(picoquic_cnx_t *cnx, plugin_stat_t **statsptr, int
                         stats[current_position].post = false;
                         stats[current_position].is_param = true;
                         stats[current_position].param = current_popst->param;
-                        stats[current_position].count = cur->observer->count;
-                        stats[current_position].total_execution_time = cur->observer->total_execution_time;
+                        picoquic_fill_pluglet_stat(&stats[current_position], cur->observer);
                         cur = cur->next;
                         current_position++;
                     }
@@ -232,8 +251,7 @@ int picoquic_get_plugin_stats(picoquic_cnx_t *cnx, plugin_stat_t **statsptr, int
                         stats[current_position].post = true;
                         stats[current_position].is_param = true;
                         stats[current_position].param = current_popst->param;
-                        stats[current_position].count = cur->observer->count;
-                        stats[current_position].total_execution_time = cur->observer->total_execution_time;
+                        picoquic_fill_pluglet_stat(&stats[current_position], cur->observer);
                         cur = cur->next;
                         current_position++;
                     }
@@ -253,8 +271,7 @@ int picoquic_get_plugin_stats(picoquic_cnx_t *cnx, plugin_stat_t **statsptr, int
                 stats[current_position].pre = false;
                 stats[current_position].post = false;
                 stats[current_position].is_param = false;
-                stats[current_position].count = current_popst->replace->count;
-                stats[current_position].total_execution_time = current_popst->replace->total_execution_time;
+                picoquic_fill_pluglet_stat(&stats[current_position], current_popst->replace);
                 current_position++;
             }
 
@@ -272,8 +289,7 @@ int picoquic_get_plugin_stats(picoquic_cnx_t *cnx, plugin_stat_t **statsptr, int
                     stats[current_position].pre = true;
                     stats[current_position].post = false;
                     stats[current_position].is_param = false;
-                    stats[current_position].count = cur->observer->count;
-                    stats[current_position].total_execution_time = cur->observer->total_execution_time;
+                    picoquic_fill_pluglet_stat(&stats[current_position], cur->observer);
                     cur = cur->next;
                     current_position++;
                 }
@@ -292,8 +308,7 @@ int picoquic_get_plugin_stats(picoquic_cnx_t *cnx, plugin_stat_t **statsptr, int
                     stats[current_position].pre = false;
                     stats[current_position].post = true;
                     stats[current_position].is_param = false;
-                    stats[current_position].count = cur->observer->count;
-                    stats[current_position].total_execution_time = cur->observer->total_execution_time;
+                    picoquic_fill_pluglet_stat(&stats[current_position], cur->observer);
                     cur = cur->next;
                     current_position++;
                 }
@@ -309,6 +324,8 @@ void picoquic_free_protoops(protocol_operation_struct_t * ops)
     protocol_operation_struct_t *current_post, *tmp_protoop;
     protocol_operation_param_struct_t *current_popst, *tmp_popst;
     observer_node_t *cur_del, *tmp;
+    recorder_node_t *rec_del;
+    plugin_async_observer_t *async_del;
 
     HASH_ITER(hh, ops, current_post, tmp_protoop) {
         HASH_DEL(ops, current_post);
@@ -338,6 +355,16 @@ void picoquic_free_protoops(protocol_operation_struct_t * ops)
                         cur_del = tmp;
                     }
                 }
+                while (current_popst->record) {
+                    rec_del = current_popst->record;
+                    current_popst->record = rec_del->next;
+                    free(rec_del);
+                }
+                while (current_popst->async) {
+                    async_del = current_popst->async;
+                    current_popst->async = async_del->next;
+                    plugin_async_observer_free(async_del);
+                }
                 free(current_popst);
             }
         } else {
@@ -364,25 +391,48 @@ void picoquic_free_protoops(protocol_operation_struct_t * ops)
                     cur_del = tmp;
                 }
             }
+            while (current_popst->record) {
+                rec_del = current_popst->record;
+                current_popst->record = rec_del->next;
+                free(rec_del);
+            }
+            while (current_popst->async) {
+                async_del = current_popst->async;
+                current_popst->async = async_del->next;
+                plugin_async_observer_free(async_del);
+            }
             free(current_popst);
         }
 
+        free(current_post->param_table);
         free(current_post->pid.id);
         free(current_post);
     }
 }
 
+void picoquic_free_plugin(protoop_plugin_t *p)
+{
+    /* This remains safe to do this, as the memory of the frame context will be freed when cnx will */
+    queue_free(p->block_queue_cc);
+    queue_free(p->block_queue_non_cc);
+    destroy_memory_management(p);
+    plugin_memory_release(p);
+    while (p->post_pluglets != NULL) {
+        pid_node_t *tmp_node = p->post_pluglets->next;
+        free(p->post_pluglets);
+        p->post_pluglets = tmp_node;
+    }
+    free(p->record_ring);
+    free(p->path);
+    free(p);
+}
+
 void picoquic_free_plugins(protoop_plugin_t *plugins)
 {
     protoop_plugin_t *current_p, *tmp_p;
     HASH_ITER(hh, plugins, current_p, tmp_p) {
         HASH_DEL(plugins, current_p);
-        /* This remains safe to do this, as the memory of the frame context will be freed when cnx will */
-        queue_free(current_p->block_queue_cc);
-        queue_free(current_p->block_queue_non_cc);
-        destroy_memory_management(current_p);
-        free(current_p->path);
-        free(current_p);
+        picoquic_free_plugin(current_p);
     }
 }
 
@@ -530,6 +580,318 @@ int picoquic_set_local_plugins(picoquic_quic_t* quic, const char** plugin_fnames
     return inject_plugin(&quic->local_plugins, plugin_fnames, plugins);
 }
 
+int picoquic_set_plugin_image_cache(picoquic_quic_t* quic, const char* path)
+{
+    if (quic->plugin_image_cache_path != NULL) {
+        free(quic->plugin_image_cache_path);
+        quic->plugin_image_cache_path = NULL;
+    }
+    if (path == NULL) {
+        return 0;
+    }
+    if (picoquic_check_or_create_directory(path)) {
+        fprintf(stderr, "Cannot use plugin image cache %s; continue without it.\n", path);
+        return 1;
+    }
+    quic->plugin_image_cache_path = malloc(sizeof(char) * (strlen(path) + 1));
+    if (quic->plugin_image_cache_path == NULL) {
+        return 1;
+    }
+    strcpy(quic->plugin_image_cache_path, path);
+    return 0;
+}
+
+void picoquic_set_plugin_prewarm_depth(picoquic_quic_t* quic, uint8_t depth)
+{
+    quic->plugin_prewarm_depth = depth;
+}
+
+void picoquic_set_native_pluglets(picoquic_quic_t* quic, int enable)
+{
+    quic->use_native_pluglets = (enable) ? 1 : 0;
+}
+
+static void picoquic_log_policy_free(picoquic_quic_t* quic)
+{
+    if (quic->log_policy != NULL) {
+        free((void*)quic->log_policy->plugin_fname);
+        free((void*)quic->log_policy->sni);
+        free((void*)quic->log_policy->alpn);
+        free(quic->log_policy);
+        quic->log_policy = NULL;
+    }
+}
+
+int picoquic_set_log_policy(picoquic_quic_t* quic, picoquic_log_policy_t const* policy)
+{
+    picoquic_log_policy_t* copy;
+
+    picoquic_log_policy_free(quic);
+    if (policy == NULL) {
+        return 0;
+    }
+    if (policy->plugin_fname == NULL || (copy = (picoquic_log_policy_t*)malloc(sizeof(picoquic_log_policy_t))) == NULL) {
+        return -1;
+    }
+    *copy = *policy;
+    copy->plugin_fname = strdup(policy->plugin_fname);
+    copy->sni = (policy->sni == NULL) ? NULL : strdup(policy->sni);
+    copy->alpn = (policy->alpn == NULL) ? NULL : strdup(policy->alpn);
+    quic->log_policy = copy;
+    if (copy->plugin_fname == NULL || (policy->sni != NULL && copy->sni == NULL) || (policy->alpn != NULL && copy->alpn == NULL)) {
+        picoquic_log_policy_free(quic);
+        return -1;
+    }
+    return 0;
+}
+
+static int picoquic_addr_in_prefix(struct sockaddr* addr, struct sockaddr* prefix, uint8_t prefix_length)
+{
+    uint8_t const* a;
+    uint8_t const* p;
+    uint8_t max_length;
+
+    if (addr->sa_family != prefix->sa_family) {
+        return 0;
+    }
+    if (addr->sa_family == AF_INET) {
+        a = (uint8_t const*)&((struct sockaddr_in*)addr)->sin_addr;
+        p = (uint8_t const*)&((struct sockaddr_in*)prefix)->sin_addr;
+        max_length = 32;
+    } else if (addr->sa_family == AF_INET6) {
+        a = (uint8_t const*)&((struct sockaddr_in6*)addr)->sin6_addr;
+        p = (uint8_t const*)&((struct sockaddr_in6*)prefix)->sin6_addr;
+        max_length = 128;
+    } else {
+        return 0;
+    }
+    if (prefix_length > max_length) {
+        prefix_length = max_length;
+    }
+    if (memcmp(a, p, prefix_length / 8) != 0) {
+        return 0;
+    }
+    if (prefix_length % 8 != 0 && ((a[prefix_length / 8] ^ p[prefix_length / 8]) & (0xff << (8 - prefix_length % 8))) != 0) {
+        return 0;
+    }
+    return 1;
+}
+
+static int picoquic_log_policy_filter(picoquic_cnx_t* cnx, picoquic_log_policy_t* policy)
+{
+    return (policy->sni == NULL || (cnx->sni != NULL && strcmp(cnx->sni, policy->sni) == 0)) &&
+        (policy->alpn == NULL || (cnx->alpn != NULL && strcmp(cnx->alpn, policy->alpn) == 0)) &&
+        (policy->peer_prefix_length == 0 ||
+            picoquic_addr_in_prefix((struct sockaddr*)&cnx->path[0]->peer_addr, (struct sockaddr*)&policy->peer_prefix, policy->peer_prefix_length));
+}
+
+static void picoquic_log_policy_capture(picoquic_cnx_t* cnx, picoquic_log_policy_t* policy)
+{
+    cnx->log_policy_state = picoquic_log_policy_captured;
+    if (plugin_insert_plugin(cnx, policy->plugin_fname) != 0) {
+        fprintf(stderr, "Failed to insert log plugin %s\n", policy->plugin_fname);
+    } else if (policy->capture_fn != NULL) {
+        policy->capture_fn(cnx, policy->capture_ctx);
+    }
+}
+
+void picoquic_log_policy_update(picoquic_cnx_t* cnx)
+{
+    picoquic_log_policy_t* policy = cnx->quic->log_policy;
+
+    if (cnx->quic->overload_level >= picoquic_overload_shed && policy != NULL) {
+        /* Evaluated at a later change of state, once the load went down */
+        return;
+    }
+    if (policy == NULL) {
+        if (cnx->log_policy_state == picoquic_log_policy_watching) {
+            cnx->log_policy_state = picoquic_log_policy_excluded;
+        }
+        return;
+    }
+
+    if (cnx->log_policy_state == picoquic_log_policy_pending) {
+        if ((policy->sni != NULL || policy->alpn != NULL) && cnx->cnx_state < picoquic_state_client_almost_ready) {
+            /* Not known yet */
+            return;
+        }
+        if (!picoquic_log_policy_filter(cnx, policy)) {
+            cnx->log_policy_state = picoquic_log_policy_excluded;
+        } else if (policy->sample_one_in > 0 && picoquic_public_uniform_random(policy->sample_one_in) == 0) {
+            picoquic_log_policy_capture(cnx, policy);
+        } else if (policy->capture_on_error || policy->loss_threshold > 0 || policy->rtt_threshold > 0) {
+            cnx->log_policy_state = picoquic_log_policy_watching;
+        } else {
+            cnx->log_policy_state = picoquic_log_policy_excluded;
+        }
+    } else if (cnx->log_policy_state == picoquic_log_policy_watching) {
+        if ((policy->capture_on_error && (cnx->local_error != 0 || cnx->remote_error != 0)) ||
+            (policy->loss_threshold > 0 && cnx->nb_retransmission_total >= policy->loss_threshold) ||
+            (policy->rtt_threshold > 0 && cnx->path[0]->smoothed_rtt >= policy->rtt_threshold)) {
+            picoquic_log_policy_capture(cnx, policy);
+        }
+    }
+}
+
+int picoquic_set_log_flusher(picoquic_quic_t* quic, uint32_t nb_chunks)
+{
+    picoquic_log_flusher_t* flusher;
+
+    if (quic->log_flusher != NULL || (flusher = picoquic_log_flusher_create(nb_chunks)) == NULL) {
+        return -1;
+    }
+    if (quic->F_log != NULL) {
+        FILE* F = picoquic_log_flusher_fopen(flusher, fileno((FILE*)quic->F_log));
+        if (F == NULL) {
+            picoquic_log_flusher_delete(flusher);
+            return -1;
+        }
+        fflush((FILE*)quic->F_log);
+        PICOQUIC_SET_LOG(quic, F);
+    }
+    quic->log_flusher = flusher;
+    return 0;
+}
+
+uint64_t picoquic_get_log_flusher_drops(picoquic_quic_t* quic)
+{
+    return (quic->log_flusher == NULL) ? 0 :
+        __atomic_load_n(&((picoquic_log_flusher_t*)quic->log_flusher)->nb_dropped, __ATOMIC_RELAXED);
+}
+
+void picoquic_wait_log_flusher(picoquic_quic_t* quic)
+{
+    if (quic->log_flusher != NULL) {
+        if (quic->F_log != NULL) {
+            fflush((FILE*)quic->F_log);
+        }
+        picoquic_log_flusher_wait_idle((picoquic_log_flusher_t*)quic->log_flusher);
+    }
+}
+
+int picoquic_set_packet_pool(picoquic_quic_t* quic, uint32_t max_free_packets, int use_hugepages)
+{
+    return picoquic_packet_pool_configure(&quic->packet_pool, max_free_packets, use_hugepages);
+}
+
+void picoquic_get_packet_pool_stats(picoquic_quic_t* quic, picoquic_packet_pool_stats_t* stats)
+{
+    *stats = quic->packet_pool.stats;
+}
+
+int picoquic_set_max_packet_size(picoquic_quic_t* quic, uint32_t max_packet_size)
+{
+    if (max_packet_size < PICOQUIC_ENFORCED_INITIAL_MTU || max_packet_size > PICOQUIC_MAX_JUMBO_PACKET_SIZE) {
+        return -1;
+    }
+    quic->max_packet_size = max_packet_size;
+    return 0;
+}
+
+uint32_t picoquic_get_max_packet_size(picoquic_quic_t* quic)
+{
+    return quic->max_packet_size;
+}
+
+void picoquic_set_object_cache_numa_node(picoquic_quic_t* quic, int numa_node)
+{
+    picoquic_object_cache_set_numa_node(&quic->cnx_cache, numa_node);
+    picoquic_object_cache_set_numa_node(&quic->path_cache, numa_node);
+    picoquic_object_cache_set_numa_node(&quic->stream_cache, numa_node);
+}
+
+void picoquic_set_numa_node(picoquic_quic_t* quic, int numa_node)
+{
+    quic->numa_node = numa_node;
+    picoquic_set_object_cache_numa_node(quic, numa_node);
+    picoquic_packet_pool_set_numa_node(&quic->packet_pool, numa_node);
+}
+
+int picoquic_get_numa_node(picoquic_quic_t* quic)
+{
+    return quic->numa_node;
+}
+
+/* Loads the local plugins in a connection-less set of protocol operations and stores it in the plugin cache */
+static int picoquic_prewarm_local_plugins(picoquic_quic_t* quic)
+{
+    /* Only used as a container for the protocol operations to build, it never sends anything */
+    picoquic_cnx_t* cnx = calloc(1, sizeof(picoquic_cnx_t));
+    cached_plugins_t* cached = calloc(1, sizeof(cached_plugins_t));
+    int ret = (cnx == NULL || cached == NULL) ? 1 : 0;
+
+    if (ret == 0) {
+        cnx->quic = quic;
+        register_protocol_operations(cnx);
+        for (int i = 0; ret == 0 && i < quic->local_plugins.size; i++) {
+            ret = plugin_insert_plugin(cnx, quic->local_plugins.elems[i].plugin_path);
+        }
+    }
+
+    if (ret == 0) {
+        protoop_plugin_t *current_p, *tmp_p;
+        HASH_ITER(hh, cnx->plugins, current_p, tmp_p) {
+            strcpy(cached->plugin_names[cached->nb_plugins], current_p->name);
+            cached->nb_plugins++;
+        }
+        cached->ops = cnx->ops;
+        cached->plugins = cnx->plugins;
+        ret = plugin_cache_insert(quic, cached);
+    }
+
+    if (ret != 0) {
+        if (cnx != NULL) {
+            picoquic_free_protoops_and_plugins(cnx);
+        }
+        free(cached);
+    }
+    free(cnx);
+
+    return ret;
+}
+
+int picoquic_preload_plugins(picoquic_quic_t* quic, int nb_threads)
+{
+    plugin_list_t* lists[3] = { &quic->supported_plugins, &quic->plugins_to_inject, &quic->local_plugins };
+    picoquic_offload_pool_t* pool = picoquic_offload_pool_create(nb_threads);
+    int nb_loaded = 0;
+
+    if (pool == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < 3; i++) {
+        nb_loaded += plugin_preload_images(quic, pool, lists[i]->size, lists[i]->elems);
+    }
+    picoquic_offload_pool_delete(pool);
+
+    return nb_loaded;
+}
+
+int picoquic_prewarm_plugins(picoquic_quic_t* quic, int max_instances)
+{
+    int nb_prepared = 0;
+
+    if (quic->local_plugins.size == 0) {
+        return 0;
+    }
+
+    int nb_ready = plugin_cache_count(quic, quic->local_plugins.size, quic->local_plugins.elems);
+    while (nb_prepared < max_instances && nb_ready + nb_prepared < quic->plugin_prewarm_depth) {
+        if (picoquic_prewarm_local_plugins(quic) != 0) {
+            fprintf(stderr, "Failed to pre-warm the local plugins\n");
+            break;
+        }
+        nb_prepared++;
+    }
+
+    return nb_prepared;
+}
+
+int picoquic_set_plugin_template(picoquic_cnx_t* cnx, const char* plugin_name)
+{
+    return plugin_template_capture(cnx, plugin_name);
+}
+
 int picoquic_set_log(picoquic_quic_t* quic, const char *log_fname)
 {
     FILE* F_log = NULL;
@@ -593,6 +955,7 @@ picoquic_quic_t* picoquic_create(uint32_t nb_connections,
         quic->cnx_id_callback_ctx = cnx_id_callback_ctx;
         quic->p_simulated_time = p_simulated_time;
         quic->local_ctx_length = 8; /* TODO: should be lower on clients-only implementation */
+        quic->rcv_socket = INVALID_SOCKET;
 
         if (cnx_id_callback != NULL) {
             quic->flags |= picoquic_context_unconditional_cnx_id;
@@ -618,10 +981,20 @@ picoquic_quic_t* picoquic_create(uint32_t nb_connections,
         quic->table_cnx_by_net = picohash_create(nb_connections * 4,
             picoquic_net_id_hash, picoquic_net_id_compare);
 
+        quic->stateless_ring = (picoquic_stateless_packet_t*)malloc(
+            PICOQUIC_STATELESS_RING_SIZE * sizeof(picoquic_stateless_packet_t));
+        for (uint64_t i = 0; quic->stateless_ring != NULL && i < PICOQUIC_STATELESS_RING_SIZE; i++) {
+            quic->stateless_ring[i].ring_sequence = i;
+        }
+
         if (quic->table_cnx_by_id == NULL || quic->table_cnx_by_net == NULL) {
             ret = -1;
             DBG_PRINTF("%s", "Cannot initialize hash tables\n");
         }
+        else if (quic->stateless_ring == NULL) {
+            ret = -1;
+            DBG_PRINTF("%s", "Cannot allocate the stateless packets\n");
+        }
         else if (picoquic_master_tlscontext(quic, cert_file_name, key_file_name, cert_root_file_name, ticket_encryption_key, ticket_encryption_key_length) != 0) {
                 ret = -1;
                 DBG_PRINTF("%s", "Cannot create TLS context \n");
@@ -635,11 +1008,16 @@ picoquic_quic_t* picoquic_create(uint32_t nb_connections,
             else
                 memcpy(quic->reset_seed, reset_seed, sizeof(quic->reset_seed));
 
-            quic->cached_plugins_queue = queue_init();
-            if (!quic->cached_plugins_queue) {
-                ret = -1;
-                DBG_PRINTF("%s", "Cannot create cached plugins queue \n");
-            }
+            quic->cached_plugins = NULL;
+            picoquic_packet_pool_init(&quic->packet_pool);
+            quic->max_packet_size = PICOQUIC_MAX_PACKET_SIZE;
+            quic->max_data_window_max = PICOQUIC_DEFAULT_MAX_DATA_WINDOW_MAX;
+            quic->max_stream_data_window_max = PICOQUIC_DEFAULT_MAX_STREAM_DATA_WINDOW_MAX;
+            quic->keep_alive_bucket = PICOQUIC_KEEP_ALIVE_BUCKET;
+            picoquic_object_cache_init(&quic->cnx_cache, sizeof(picoquic_cnx_t));
+            picoquic_object_cache_init(&quic->path_cache, sizeof(picoquic_path_t));
+            picoquic_object_cache_init(&quic->stream_cache, sizeof(picoquic_stream_head));
+            quic->numa_node = -1;
             quic->plugin_store_path = NULL;
             if (plugin_store_path != NULL) {
                 if (picoquic_check_or_create_directory(plugin_store_path)) {
@@ -697,6 +1075,17 @@ void picoquic_free(picoquic_quic_t* quic)
             quic->aead_decrypt_ticket_ctx = NULL;
         }
 
+        picoquic_initial_key_cache_free(quic);
+
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < PICOQUIC_RESUMPTION_KEY_SLOTS; j++) {
+                if (quic->resumption_aead[i][j] != NULL) {
+                    picoquic_aead_free(quic->resumption_aead[i][j]);
+                    quic->resumption_aead[i][j] = NULL;
+                }
+            }
+        }
+
         if (quic->default_alpn != NULL) {
             free((void*)quic->default_alpn);
             quic->default_alpn = NULL;
@@ -706,17 +1095,21 @@ void picoquic_free(picoquic_quic_t* quic)
         picoquic_free_tickets(&quic->p_first_ticket);
 
         /* delete all pending packets */
-        while (quic->pending_stateless_packet != NULL) {
-            picoquic_stateless_packet_t* to_delete = quic->pending_stateless_packet;
-            quic->pending_stateless_packet = to_delete->next_packet;
-            free(to_delete);
-        }
+        free(quic->stateless_ring);
+        quic->stateless_ring = NULL;
 
         /* delete all the connection contexts */
         while (quic->cnx_list != NULL) {
             picoquic_delete_cnx(quic->cnx_list);
         }
 
+        free(quic->cnx_wake_heap);
+        quic->cnx_wake_heap = NULL;
+        free(quic->stream_batch_spans);
+        quic->stream_batch_spans = NULL;
+        picoquic_lb_ctx_free(quic->lb_ctx);
+        quic->lb_ctx = NULL;
+
         if (quic->table_cnx_by_id != NULL) {
             picohash_delete(quic->table_cnx_by_id, 1);
         }
@@ -725,6 +1118,8 @@ void picoquic_free(picoquic_quic_t* quic)
             picohash_delete(quic->table_cnx_by_net, 1);
         }
 
+        picoquic_free_tombstones(quic);
+
         if (quic->verify_certificate_ctx != NULL &&
             quic->free_verify_certificate_callback_fn != NULL) {
             (quic->free_verify_certificate_callback_fn)(quic->verify_certificate_ctx);
@@ -748,15 +1143,33 @@ void picoquic_free(picoquic_quic_t* quic)
             quic->tls_master_ctx = NULL;
         }
 
-        if (quic->cached_plugins_queue != NULL) {
-            cached_plugins_t* tmp;
-            while(queue_peek(quic->cached_plugins_queue) != NULL) {
-                tmp = queue_dequeue(quic->cached_plugins_queue);
-                picoquic_free_cached_plugins(tmp);
+        cached_plugins_set_t *current_set, *tmp_set;
+        HASH_ITER(hh, quic->cached_plugins, current_set, tmp_set) {
+            HASH_DEL(quic->cached_plugins, current_set);
+            while (current_set->first != NULL) {
+                cached_plugins_t* tmp = current_set->first->next;
+                picoquic_free_cached_plugins(current_set->first);
+                current_set->first = tmp;
             }
-            queue_free(quic->cached_plugins_queue);
+            free(current_set);
+        }
+
+        plugin_archive_t *current_archive, *tmp_archive;
+        HASH_ITER(hh, quic->plugin_archives, current_archive, tmp_archive) {
+            HASH_DEL(quic->plugin_archives, current_archive);
+            /* Connections still sending it keep it alive */
+            plugin_archive_release(current_archive);
         }
 
+        pluglet_images_free(&quic->pluglet_images);
+        plugin_templates_free(quic);
+
+        /* The connections, and thus their packets, are all gone */
+        picoquic_packet_pool_free(&quic->packet_pool);
+        picoquic_object_cache_free(&quic->cnx_cache);
+        picoquic_object_cache_free(&quic->path_cache);
+        picoquic_object_cache_free(&quic->stream_cache);
+
         if (quic->supported_plugins.size > 0) {
             for (int i = 0; i < quic->supported_plugins.size; i++) {
                 free(quic->supported_plugins.elems[i].plugin_name);
@@ -775,6 +1188,22 @@ void picoquic_free(picoquic_quic_t* quic)
             free(quic->plugin_store_path);
         }
 
+        if (quic->plugin_image_cache_path != NULL) {
+            free(quic->plugin_image_cache_path);
+        }
+
+        picoquic_log_policy_free(quic);
+
+        /* After the connections, whose plugins may have logged when closing */
+        if (quic->log_flusher != NULL) {
+            if (quic->F_log != NULL) {
+                fclose((FILE*)quic->F_log);
+                quic->F_log = NULL;
+            }
+            picoquic_log_flusher_delete((picoquic_log_flusher_t*)quic->log_flusher);
+            quic->log_flusher = NULL;
+        }
+
         free(quic);
     }
 }
@@ -783,6 +1212,206 @@ void picoquic_set_null_verifier(picoquic_quic_t* quic) {
     picoquic_dispose_verify_certificate_callback(quic, 1);
 }
 
+void picoquic_set_pacing_offload(picoquic_quic_t* quic, uint64_t horizon)
+{
+    quic->pacing_offload_horizon = horizon;
+}
+
+void picoquic_set_pacing_burst(picoquic_quic_t* quic, uint64_t nb_packets)
+{
+    quic->pacing_burst = nb_packets;
+}
+
+void picoquic_set_send_budget(picoquic_quic_t* quic, size_t max_packets, size_t max_bytes)
+{
+    quic->send_budget_packets = max_packets;
+    quic->send_budget_bytes = max_bytes;
+}
+
+void picoquic_set_default_memory_cap(picoquic_quic_t* quic, uint64_t cap)
+{
+    quic->default_memory_cap = cap;
+}
+
+void picoquic_set_default_send_buffer_watermarks(picoquic_quic_t* quic, uint64_t stream_high, uint64_t stream_low,
+    uint64_t cnx_high, uint64_t cnx_low)
+{
+    quic->default_send_watermarks.stream_high = stream_high;
+    quic->default_send_watermarks.stream_low = (stream_low < stream_high) ? stream_low : stream_high;
+    quic->default_send_watermarks.cnx_high = cnx_high;
+    quic->default_send_watermarks.cnx_low = (cnx_low < cnx_high) ? cnx_low : cnx_high;
+}
+
+void picoquic_set_hibernation_delay(picoquic_quic_t* quic, uint64_t delay)
+{
+    quic->hibernation_delay = delay;
+}
+
+void picoquic_set_keep_alive_bucket(picoquic_quic_t* quic, uint64_t bucket)
+{
+    quic->keep_alive_bucket = bucket;
+}
+
+void picoquic_set_ecn(picoquic_quic_t* quic, uint8_t ecn_codepoint)
+{
+    quic->ecn_codepoint = ecn_codepoint & PICOQUIC_ECN_CE;
+    quic->ecn_configured = 1;
+    /* The sockets get the new codepoint before their next packet */
+    quic->ecn_socket_flags = 0;
+}
+
+void picoquic_set_preferred_address(picoquic_quic_t* quic, struct sockaddr const* addr_ipv4, struct sockaddr const* addr_ipv6)
+{
+    memset(&quic->preferred_address, 0, sizeof(quic->preferred_address));
+    if (addr_ipv4 != NULL && addr_ipv4->sa_family == AF_INET) {
+        memcpy(quic->preferred_address.ipv4_address, &((struct sockaddr_in*)addr_ipv4)->sin_addr, 4);
+        quic->preferred_address.ipv4_port = ntohs(((struct sockaddr_in*)addr_ipv4)->sin_port);
+    }
+    if (addr_ipv6 != NULL && addr_ipv6->sa_family == AF_INET6) {
+        memcpy(quic->preferred_address.ipv6_address, &((struct sockaddr_in6*)addr_ipv6)->sin6_addr, 16);
+        quic->preferred_address.ipv6_port = ntohs(((struct sockaddr_in6*)addr_ipv6)->sin6_port);
+    }
+}
+
+int picoquic_get_local_preferred_address(picoquic_cnx_t* cnx, picoquic_tp_preferred_address_t* preferred_address)
+{
+    static const uint8_t wildcard[16] = { 0 };
+    struct sockaddr* local_addr = (struct sockaddr*)&cnx->path[0]->local_addr;
+
+    if (cnx->preferred_cnxid.id_len == 0) {
+        return 0;
+    }
+    *preferred_address = cnx->local_parameters.preferred_address;
+    if (preferred_address->ipv4_port != 0 && memcmp(preferred_address->ipv4_address, wildcard, 4) == 0) {
+        if (local_addr->sa_family == AF_INET) {
+            memcpy(preferred_address->ipv4_address, &((struct sockaddr_in*)local_addr)->sin_addr, 4);
+        } else {
+            preferred_address->ipv4_port = 0;
+        }
+    }
+    if (preferred_address->ipv6_port != 0 && memcmp(preferred_address->ipv6_address, wildcard, 16) == 0) {
+        if (local_addr->sa_family == AF_INET6) {
+            memcpy(preferred_address->ipv6_address, &((struct sockaddr_in6*)local_addr)->sin6_addr, 16);
+        } else {
+            preferred_address->ipv6_port = 0;
+        }
+    }
+
+    return preferred_address->ipv4_port != 0 || preferred_address->ipv6_port != 0;
+}
+
+void picoquic_migrate_to_preferred_address(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    picoquic_path_t* path_x = cnx->path[0];
+    picoquic_tp_preferred_address_t* preferred_address = &cnx->remote_parameters.preferred_address;
+    struct sockaddr_storage addr;
+
+    if (!cnx->client_mode || cnx->preferred_address_used || preferred_address->connection_id.id_len == 0) {
+        return;
+    }
+
+    memcpy(&addr, &path_x->peer_addr, sizeof(addr));
+    if (addr.ss_family == AF_INET && preferred_address->ipv4_port != 0) {
+        memcpy(&((struct sockaddr_in*)&addr)->sin_addr, preferred_address->ipv4_address, 4);
+        ((struct sockaddr_in*)&addr)->sin_port = htons(preferred_address->ipv4_port);
+    } else if (addr.ss_family == AF_INET6 && preferred_address->ipv6_port != 0) {
+        memcpy(&((struct sockaddr_in6*)&addr)->sin6_addr, preferred_address->ipv6_address, 16);
+        ((struct sockaddr_in6*)&addr)->sin6_port = htons(preferred_address->ipv6_port);
+    } else {
+        return;
+    }
+    cnx->preferred_address_used = 1;
+
+    /* Packets still coming from the former address do not move the path back, see picoquic_incoming_encrypted() */
+    memcpy(&path_x->peer_addr, &addr, path_x->peer_addr_len);
+    (void)picoquic_register_net_id(cnx->quic, cnx, (struct sockaddr*)&addr);
+    path_x->remote_cnxid = preferred_address->connection_id;
+    memcpy(path_x->reset_secret, preferred_address->stateless_reset_token, PICOQUIC_RESET_SECRET_SIZE);
+    picoquic_reset_header_templates(path_x);
+
+    /* The challenge leaves with the next packet, the data does not wait for the response. In the common case only the
+     * port changes, so the congestion state is kept */
+    path_x->challenge = picoquic_public_random_64();
+    path_x->challenge_verified = 0;
+    path_x->challenge_time = (current_time > path_x->retransmit_timer) ? current_time - path_x->retransmit_timer : 0;
+    path_x->challenge_repeat_count = 0;
+}
+
+void picoquic_set_flow_control_autotune(picoquic_quic_t* quic, uint64_t max_data_window_max,
+    uint64_t max_stream_data_window_max, uint64_t budget)
+{
+    quic->max_data_window_max = max_data_window_max;
+    quic->max_stream_data_window_max = max_stream_data_window_max;
+    quic->flow_control_budget = budget;
+}
+
+uint64_t picoquic_get_flow_control_growth(picoquic_quic_t* quic)
+{
+    return quic->flow_control_growth;
+}
+
+void picoquic_set_profile(picoquic_quic_t* quic, picoquic_profile_t* profile)
+{
+    quic->profile = profile;
+}
+
+static uint64_t picoquic_thread_cpu_time()
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    }
+#endif
+    return picoquic_current_time() * 1000;
+}
+
+uint64_t picoquic_profile_start(picoquic_quic_t* quic)
+{
+    return (quic == NULL || quic->profile == NULL) ? 0 : picoquic_thread_cpu_time();
+}
+
+void picoquic_profile_end(picoquic_quic_t* quic, picoquic_profile_category_enum category, uint64_t start_time)
+{
+    if (quic != NULL && quic->profile != NULL) {
+        quic->profile->cpu_time[category] += picoquic_thread_cpu_time() - start_time;
+        quic->profile->nb_calls[category]++;
+    }
+}
+
+void picoquic_set_resumption_store(picoquic_quic_t* quic, picoquic_resumption_store_t* store)
+{
+    quic->resumption_store = store;
+}
+
+void picoquic_set_binary_log(picoquic_quic_t* quic, void* F)
+{
+    quic->F_binlog = F;
+}
+
+void picoquic_set_server_metrics(picoquic_quic_t* quic, picoquic_server_metrics_t* metrics)
+{
+    quic->server_metrics = metrics;
+}
+
+void picoquic_quic_get_memory_stats(picoquic_quic_t* quic, picoquic_memory_stats_t* stats)
+{
+    picoquic_memory_stats_t cnx_stats;
+
+    memset(stats, 0, sizeof(picoquic_memory_stats_t));
+    for (picoquic_cnx_t* cnx = quic->cnx_list; cnx != NULL; cnx = cnx->next_in_table) {
+        picoquic_get_memory_stats(cnx, &cnx_stats);
+        for (int i = 0; i < picoquic_nb_memory_categories; i++) {
+            stats->bytes[i] += cnx_stats.bytes[i];
+        }
+        stats->total += cnx_stats.total;
+        stats->peak += cnx_stats.peak;
+        stats->nb_capped += cnx_stats.nb_capped;
+        stats->nb_charges += cnx_stats.nb_charges;
+    }
+}
+
 void picoquic_set_cookie_mode(picoquic_quic_t* quic, int cookie_mode)
 {
     if (cookie_mode) {
@@ -793,41 +1422,125 @@ void picoquic_set_cookie_mode(picoquic_quic_t* quic, int cookie_mode)
     }
 }
 
+/*
+ * The stateless packets live in a preallocated ring. The sequence number of each packet tells who
+ * owns it: equal to its position when free, position + 1 once queued, and set to the position it
+ * takes the next round when the consumer deletes it.
+ */
 picoquic_stateless_packet_t* picoquic_create_stateless_packet(picoquic_quic_t* quic)
 {
-#ifdef _WINDOWS
-    UNREFERENCED_PARAMETER(quic);
-#endif
-    return (picoquic_stateless_packet_t*)malloc(sizeof(picoquic_stateless_packet_t));
+    picoquic_stateless_packet_t* sp = NULL;
+    uint64_t pos = __atomic_load_n(&quic->stateless_ring_head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        picoquic_stateless_packet_t* slot = &quic->stateless_ring[pos & (PICOQUIC_STATELESS_RING_SIZE - 1)];
+        int64_t delta = (int64_t)(__atomic_load_n(&slot->ring_sequence, __ATOMIC_ACQUIRE) - pos);
+
+        if (delta == 0) {
+            if (__atomic_compare_exchange_n(&quic->stateless_ring_head, &pos, pos + 1, 0,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                sp = slot;
+                break;
+            }
+        } else if (delta < 0) {
+            /* Not deleted yet by the consumer, the ring is full */
+            __atomic_fetch_add(&quic->stateless_packets_dropped, 1, __ATOMIC_RELAXED);
+            break;
+        } else {
+            pos = __atomic_load_n(&quic->stateless_ring_head, __ATOMIC_RELAXED);
+        }
+    }
+
+    return sp;
 }
 
 void picoquic_delete_stateless_packet(picoquic_stateless_packet_t* sp)
 {
-    free(sp);
+    __atomic_store_n(&sp->ring_sequence, sp->ring_sequence + PICOQUIC_STATELESS_RING_SIZE - 1, __ATOMIC_RELEASE);
 }
 
 void picoquic_queue_stateless_packet(picoquic_quic_t* quic, picoquic_stateless_packet_t* sp)
 {
-    picoquic_stateless_packet_t** pnext = &quic->pending_stateless_packet;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(quic);
+#endif
+    __atomic_store_n(&sp->ring_sequence, sp->ring_sequence + 1, __ATOMIC_RELEASE);
+}
+
+picoquic_stateless_packet_t* picoquic_dequeue_stateless_packet(picoquic_quic_t* quic)
+{
+    uint64_t pos = quic->stateless_ring_tail;
+    picoquic_stateless_packet_t* sp = &quic->stateless_ring[pos & (PICOQUIC_STATELESS_RING_SIZE - 1)];
 
-    while ((*pnext) != NULL) {
-        pnext = &(*pnext)->next_packet;
+    if (__atomic_load_n(&sp->ring_sequence, __ATOMIC_ACQUIRE) == pos + 1) {
+        quic->stateless_ring_tail = pos + 1;
+    } else {
+        sp = NULL;
     }
 
-    *pnext = sp;
-    sp->next_packet = NULL;
+    return sp;
 }
 
-picoquic_stateless_packet_t* picoquic_dequeue_stateless_packet(picoquic_quic_t* quic)
+uint64_t picoquic_get_stateless_packets_dropped(picoquic_quic_t* quic)
 {
-    picoquic_stateless_packet_t* sp = quic->pending_stateless_packet;
+    return __atomic_load_n(&quic->stateless_packets_dropped, __ATOMIC_RELAXED);
+}
+
+uint64_t picoquic_get_initial_reject_count(picoquic_quic_t* quic, picoquic_initial_reject_enum reason)
+{
+    return (reason < picoquic_initial_reject_max) ? quic->nb_initial_rejected[reason] : 0;
+}
 
-    if (sp != NULL) {
-        quic->pending_stateless_packet = sp->next_packet;
-        sp->next_packet = NULL;
+void picoquic_set_overload_thresholds(picoquic_quic_t* quic, uint64_t lag_threshold, uint32_t backlog_threshold)
+{
+    quic->overload_lag_threshold = lag_threshold;
+    quic->overload_backlog_threshold = backlog_threshold;
+    if (lag_threshold == 0 && backlog_threshold == 0) {
+        quic->overload_lag_smoothed = 0;
+        quic->overload_backlog_smoothed = 0;
+        quic->overload_level = picoquic_overload_none;
     }
+}
 
-    return sp;
+picoquic_overload_level_enum picoquic_update_overload(picoquic_quic_t* quic, uint64_t current_time, uint32_t backlog)
+{
+    /* Load at which each level is engaged, in eighths of the thresholds */
+    static const uint64_t level_load[picoquic_overload_max] = { 0, 8, 16, 32 };
+    uint64_t lag = 0;
+    uint64_t load = 0;
+    int level = (int)quic->overload_level;
+
+    if (quic->overload_lag_threshold == 0 && quic->overload_backlog_threshold == 0) {
+        return quic->overload_level;
+    }
+
+    if (quic->cnx_wake_heap_size > 0 && quic->cnx_wake_heap[0]->next_wake_time < current_time) {
+        lag = current_time - quic->cnx_wake_heap[0]->next_wake_time;
+    }
+    quic->overload_lag_smoothed = (7 * quic->overload_lag_smoothed + lag) / 8;
+    quic->overload_backlog_smoothed = (7 * quic->overload_backlog_smoothed) / 8 + backlog;
+
+    if (quic->overload_lag_threshold > 0) {
+        load = 8 * quic->overload_lag_smoothed / quic->overload_lag_threshold;
+    }
+    if (quic->overload_backlog_threshold > 0 && quic->overload_backlog_smoothed / quic->overload_backlog_threshold > load) {
+        load = quic->overload_backlog_smoothed / quic->overload_backlog_threshold;
+    }
+
+    while (level + 1 < picoquic_overload_max && load >= level_load[level + 1]) {
+        level++;
+    }
+    while (level > picoquic_overload_none && 4 * load < 3 * level_load[level]) {
+        level--;
+    }
+    quic->overload_level = (picoquic_overload_level_enum)level;
+
+    return quic->overload_level;
+}
+
+picoquic_overload_level_enum picoquic_get_overload_level(picoquic_quic_t* quic)
+{
+    return quic->overload_level;
 }
 
 /* Connection context creation and registration */
@@ -866,6 +1579,20 @@ int picoquic_register_cnx_id_for_cnx(picoquic_cnx_t* cnx, const picoquic_connect
     return picoquic_register_cnx_id(cnx->quic, cnx, cnx_id);
 }
 
+int picoquic_get_registered_cnx_ids(picoquic_cnx_t* cnx, picoquic_connection_id_t* cnx_ids, int max_cnx_ids)
+{
+    int nb_cnx_ids = 0;
+
+    for (picoquic_cnx_id* cid = cnx->first_cnx_id; cid != NULL; cid = cid->next_cnx_id) {
+        if (nb_cnx_ids < max_cnx_ids) {
+            cnx_ids[nb_cnx_ids] = cid->cnx_id;
+        }
+        nb_cnx_ids++;
+    }
+
+    return nb_cnx_ids;
+}
+
 static void picoquic_set_hash_key_by_address(picoquic_net_id * key, struct sockaddr* addr)
 {
     memset(&key->saddr, 0, sizeof(struct sockaddr_storage));
@@ -939,6 +1666,7 @@ void picoquic_init_transport_parameters(picoquic_tp_t* tp, int client_mode)
     tp->ack_delay_exponent = 3;
     tp->max_ack_delay = 25;
     tp->active_connection_id_limit = 2;
+    tp->min_ack_delay = PICOQUIC_ACK_DELAY_MIN;
     tp->supported_plugins = NULL;
     tp->plugins_to_inject = NULL;
 }
@@ -985,54 +1713,125 @@ static void picoquic_remove_cnx_from_list(picoquic_cnx_t* cnx)
     }
 }
 
-/* Management of the list of connections, sorted by wake time */
+/*
+ * Management of the connections by wake time, in a 4-ary min heap. Ties are broken by the order
+ * of insertion, a reinsertion counting as a new one, so that connections waking at the same time
+ * are polled in turn.
+ */
+
+#define PICOQUIC_WAKE_HEAP_ARITY 4
+#define PICOQUIC_WAKE_HEAP_MIN_SIZE 16
 
-static void picoquic_remove_cnx_from_wake_list(picoquic_cnx_t* cnx)
+static int picoquic_wake_heap_is_before(picoquic_cnx_t* a, picoquic_cnx_t* b)
 {
-    if (cnx->next_by_wake_time == NULL) {
-        cnx->quic->cnx_wake_last = cnx->previous_by_wake_time;
-    } else {
-        cnx->next_by_wake_time->previous_by_wake_time = cnx->previous_by_wake_time;
+    return a->next_wake_time < b->next_wake_time ||
+        (a->next_wake_time == b->next_wake_time && a->wake_sequence < b->wake_sequence);
+}
+
+static void picoquic_wake_heap_set(picoquic_quic_t* quic, size_t index, picoquic_cnx_t* cnx)
+{
+    quic->cnx_wake_heap[index] = cnx;
+    cnx->wake_heap_index = index;
+}
+
+static void picoquic_wake_heap_sift_up(picoquic_quic_t* quic, size_t index)
+{
+    picoquic_cnx_t* cnx = quic->cnx_wake_heap[index];
+
+    while (index > 0) {
+        size_t parent = (index - 1) / PICOQUIC_WAKE_HEAP_ARITY;
+        if (!picoquic_wake_heap_is_before(cnx, quic->cnx_wake_heap[parent])) {
+            break;
+        }
+        picoquic_wake_heap_set(quic, index, quic->cnx_wake_heap[parent]);
+        index = parent;
     }
+    picoquic_wake_heap_set(quic, index, cnx);
+}
 
-    if (cnx->previous_by_wake_time == NULL) {
-        cnx->quic->cnx_wake_first = cnx->next_by_wake_time;
-    } else {
-        cnx->previous_by_wake_time->next_by_wake_time = cnx->next_by_wake_time;
+static void picoquic_wake_heap_sift_down(picoquic_quic_t* quic, size_t index)
+{
+    picoquic_cnx_t* cnx = quic->cnx_wake_heap[index];
+
+    for (;;) {
+        size_t first_child = index * PICOQUIC_WAKE_HEAP_ARITY + 1;
+        size_t last_child = first_child + PICOQUIC_WAKE_HEAP_ARITY;
+        size_t best = index;
+        picoquic_cnx_t* best_cnx = cnx;
+
+        if (last_child > quic->cnx_wake_heap_size) {
+            last_child = quic->cnx_wake_heap_size;
+        }
+        for (size_t child = first_child; child < last_child; child++) {
+            if (picoquic_wake_heap_is_before(quic->cnx_wake_heap[child], best_cnx)) {
+                best = child;
+                best_cnx = quic->cnx_wake_heap[child];
+            }
+        }
+        if (best == index) {
+            break;
+        }
+        picoquic_wake_heap_set(quic, index, best_cnx);
+        index = best;
     }
+    picoquic_wake_heap_set(quic, index, cnx);
 }
 
-static void picoquic_insert_cnx_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx)
+void picoquic_remove_cnx_from_wake_list(picoquic_cnx_t* cnx)
 {
-    picoquic_cnx_t * cnx_next = quic->cnx_wake_first;
-    picoquic_cnx_t * previous = NULL;
-    while (cnx_next != NULL && cnx_next->next_wake_time <= cnx->next_wake_time) {
-        previous = cnx_next;
-        cnx_next = cnx_next->next_by_wake_time;
+    picoquic_quic_t* quic = cnx->quic;
+    size_t index = cnx->wake_heap_index;
+
+    /* The connection is not there if its insertion failed */
+    if (index >= quic->cnx_wake_heap_size || quic->cnx_wake_heap[index] != cnx) {
+        return;
     }
 
-    cnx->previous_by_wake_time = previous;
-    if (previous == NULL) {
-        quic->cnx_wake_first = cnx;
+    quic->cnx_wake_heap_size--;
+    if (index < quic->cnx_wake_heap_size) {
+        picoquic_cnx_t* moved = quic->cnx_wake_heap[quic->cnx_wake_heap_size];
 
-    } else {
-        previous->next_by_wake_time = cnx;
+        picoquic_wake_heap_set(quic, index, moved);
+        picoquic_wake_heap_sift_up(quic, index);
+        picoquic_wake_heap_sift_down(quic, moved->wake_heap_index);
     }
+}
 
-    cnx->next_by_wake_time = cnx_next;
+int picoquic_insert_cnx_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx)
+{
+    if (quic->cnx_wake_heap_size >= quic->cnx_wake_heap_max) {
+        size_t new_max = (quic->cnx_wake_heap_max == 0) ? PICOQUIC_WAKE_HEAP_MIN_SIZE : 2 * quic->cnx_wake_heap_max;
+        picoquic_cnx_t** new_heap = (picoquic_cnx_t**)realloc(quic->cnx_wake_heap, new_max * sizeof(picoquic_cnx_t*));
 
-    if (cnx_next == NULL) {
-        quic->cnx_wake_last = cnx;
-    } else {
-        cnx_next->previous_by_wake_time = cnx;
+        if (new_heap == NULL) {
+            DBG_PRINTF("Cannot grow the wake heap to %" PRIst " connections\n", new_max);
+            return PICOQUIC_ERROR_MEMORY;
+        }
+        quic->cnx_wake_heap = new_heap;
+        quic->cnx_wake_heap_max = new_max;
     }
+
+    cnx->wake_sequence = quic->cnx_wake_sequence++;
+    picoquic_wake_heap_set(quic, quic->cnx_wake_heap_size++, cnx);
+    picoquic_wake_heap_sift_up(quic, cnx->wake_heap_index);
+
+    return 0;
 }
 
 void picoquic_reinsert_by_wake_time(picoquic_quic_t* quic, picoquic_cnx_t* cnx, uint64_t next_time)
 {
-    picoquic_remove_cnx_from_wake_list(cnx);
+    size_t index = cnx->wake_heap_index;
+
+    if (index >= quic->cnx_wake_heap_size || quic->cnx_wake_heap[index] != cnx) {
+        cnx->next_wake_time = next_time;
+        return;
+    }
+
+    /* Updated in place, which cannot fail */
     cnx->next_wake_time = next_time;
-    picoquic_insert_cnx_by_wake_time(quic, cnx);
+    cnx->wake_sequence = quic->cnx_wake_sequence++;
+    picoquic_wake_heap_sift_up(quic, index);
+    picoquic_wake_heap_sift_down(quic, cnx->wake_heap_index);
 }
 
 void picoquic_reinsert_cnx_by_wake_time(picoquic_cnx_t* cnx, uint64_t next_time)
@@ -1042,7 +1841,7 @@ void picoquic_reinsert_cnx_by_wake_time(picoquic_cnx_t* cnx, uint64_t next_time)
 
 picoquic_cnx_t* picoquic_get_earliest_cnx_to_wake(picoquic_quic_t* quic, uint64_t max_wake_time)
 {
-    picoquic_cnx_t * cnx = quic->cnx_wake_first;
+    picoquic_cnx_t * cnx = (quic->cnx_wake_heap_size > 0) ? quic->cnx_wake_heap[0] : NULL;
     if (cnx != NULL && max_wake_time != 0 && cnx->next_wake_time > max_wake_time)
     {
         cnx = NULL;
@@ -1057,9 +1856,11 @@ int64_t picoquic_get_next_wake_delay(picoquic_quic_t* quic,
 {
     int64_t wake_delay = delay_max;
 
-    if (quic->cnx_wake_first != NULL) {
-        if (quic->cnx_wake_first->next_wake_time > current_time) {
-            wake_delay = quic->cnx_wake_first->next_wake_time - current_time;
+    if (quic->cnx_wake_heap_size > 0) {
+        picoquic_cnx_t* cnx_first = quic->cnx_wake_heap[0];
+
+        if (cnx_first->next_wake_time > current_time) {
+            wake_delay = cnx_first->next_wake_time - current_time;
 
             if (wake_delay > delay_max) {
                 wake_delay = delay_max;
@@ -1108,6 +1909,32 @@ uint32_t picoquic_transport_param_to_stream_id(uint16_t rank, int client_mode, i
     return stream_id;
 }
 
+/* The objects of the connections of a context come from its caches, see picoquic_create_stream() */
+picoquic_stream_head* picoquic_create_stream_object(picoquic_cnx_t* cnx)
+{
+    return (cnx->quic != NULL) ? (picoquic_stream_head*)picoquic_object_cache_get(&cnx->quic->stream_cache) :
+        (picoquic_stream_head*)calloc(1, sizeof(picoquic_stream_head));
+}
+
+void picoquic_free_stream_object(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
+{
+    if (cnx->quic != NULL) {
+        cnx->quic->flow_control_growth -= stream->max_data_growth;
+        picoquic_object_cache_put(&cnx->quic->stream_cache, stream);
+    } else {
+        free(stream);
+    }
+}
+
+void picoquic_free_path_object(picoquic_cnx_t* cnx, picoquic_path_t* path_x)
+{
+    if (cnx->quic != NULL) {
+        picoquic_object_cache_put(&cnx->quic->path_cache, path_x);
+    } else {
+        free(path_x);
+    }
+}
+
 int picoquic_create_path(picoquic_cnx_t* cnx, uint64_t start_time, struct sockaddr* addr)
 {
     int ret = -1;
@@ -1127,6 +1954,7 @@ int picoquic_create_path(picoquic_cnx_t* cnx, uint64_t start_time, struct sockad
                 }
                 free(cnx->path);
             }
+            picoquic_memory_charge(cnx, picoquic_memory_paths, (new_alloc - cnx->nb_path_alloc) * sizeof(picoquic_path_t *));
             cnx->path = new_path;
             cnx->nb_path_alloc = new_alloc;
         }
@@ -1134,15 +1962,17 @@ int picoquic_create_path(picoquic_cnx_t* cnx, uint64_t start_time, struct sockad
 
     if (cnx->nb_paths < cnx->nb_path_alloc)
     {
-        picoquic_path_t * path_x = (picoquic_path_t *)malloc(sizeof(picoquic_path_t));
+        picoquic_path_t * path_x = (cnx->quic != NULL) ? (picoquic_path_t *)picoquic_object_cache_get(&cnx->quic->path_cache) :
+            (picoquic_path_t *)calloc(1, sizeof(picoquic_path_t));
 
         if (path_x != NULL)
         {
-            memset(path_x, 0, sizeof(picoquic_path_t));
+            picoquic_memory_charge(cnx, picoquic_memory_paths, sizeof(picoquic_path_t));
 
             /* Set the peer address */
             path_x->peer_addr_len = (int)((addr->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
             memcpy(&path_x->peer_addr, addr, path_x->peer_addr_len);
+            path_x->rcv_socket = INVALID_SOCKET;
 
             /* Set the challenge used for this path */
             path_x->challenge = picoquic_public_random_64();
@@ -1164,6 +1994,12 @@ int picoquic_create_path(picoquic_cnx_t* cnx, uint64_t start_time, struct sockad
             path_x->pacing_bucket_max = 16;
             path_x->pacing_packet_time_nanosec = 1;
             path_x->pacing_packet_time_microsec = 1;
+            if (cnx->quic) {
+                path_x->pacing_offload_horizon = cnx->quic->pacing_offload_horizon;
+                path_x->pacing_burst = cnx->quic->pacing_burst;
+            }
+            path_x->pacing_departure_nanosec = start_time * 1000;
+            path_x->pacing_last_departure_time = start_time;
 
             /* Initialize the MTU */
             path_x->send_mtu = addr->sa_family == AF_INET ? PICOQUIC_INITIAL_MTU_IPV4 : PICOQUIC_INITIAL_MTU_IPV6;
@@ -1185,22 +2021,25 @@ int picoquic_create_path(picoquic_cnx_t* cnx, uint64_t start_time, struct sockad
             /* Initialize packet contexts */
             for (picoquic_packet_context_enum pc = 0;
                 pc < picoquic_nb_packet_context; pc++) {
-                path_x->pkt_ctx[pc].first_sack_item.start_of_sack_range = (uint64_t)((int64_t)-1);
-                path_x->pkt_ctx[pc].first_sack_item.end_of_sack_range = 0;
-                path_x->pkt_ctx[pc].first_sack_item.next_sack = NULL;
+                picoquic_sack_list_init(&path_x->pkt_ctx[pc].sack_list);
                 path_x->pkt_ctx[pc].highest_ack_sent = 0;
                 path_x->pkt_ctx[pc].highest_ack_time = start_time;
                 path_x->pkt_ctx[pc].time_stamp_largest_received = (uint64_t)((int64_t)-1);
                 path_x->pkt_ctx[pc].send_sequence = 0;
                 path_x->pkt_ctx[pc].nb_retransmit = 0;
                 path_x->pkt_ctx[pc].latest_retransmit_time = 0;
+                path_x->pkt_ctx[pc].latest_ack_eliciting_time = 0;
                 path_x->pkt_ctx[pc].latest_retransmit_cc_notification_time = 0;
                 path_x->pkt_ctx[pc].retransmit_newest = NULL;
                 path_x->pkt_ctx[pc].retransmit_oldest = NULL;
+                path_x->pkt_ctx[pc].retransmit_index = NULL;
+                path_x->pkt_ctx[pc].retransmit_index_mask = 0;
+                path_x->pkt_ctx[pc].retransmit_index_broken = 0;
                 path_x->pkt_ctx[pc].highest_acknowledged = path_x->pkt_ctx[pc].send_sequence - 1;
                 path_x->pkt_ctx[pc].latest_time_acknowledged = start_time;
                 path_x->pkt_ctx[pc].latest_progress_time = start_time;
                 path_x->pkt_ctx[pc].ack_needed = 0;
+                path_x->pkt_ctx[pc].ack_immediate = 0;
                 path_x->pkt_ctx[pc].ack_delay_local = 10000;
             }
 
@@ -1233,13 +2072,20 @@ void picoquic_create_random_cnx_id(picoquic_quic_t* quic, picoquic_connection_id
         picoquic_crypto_random(quic, cnx_id->id, id_length);
     }
     if (id_length < sizeof(cnx_id->id)) {
-        memset(cnx_id->id + 8, 0, sizeof(cnx_id->id) - id_length);
+        memset(cnx_id->id + id_length, 0, sizeof(cnx_id->id) - id_length);
     }
     cnx_id->id_len = id_length;
+    if (quic->lb_ctx != NULL && id_length == quic->local_ctx_length) {
+        picoquic_lb_encode_cnx_id(quic->lb_ctx, cnx_id);
+    }
 }
 
 void picoquic_create_random_cnx_id_for_cnx(picoquic_cnx_t* cnx, picoquic_connection_id_t *cnx_id, uint8_t id_length)
 {
+    /* The plugins issue CIDs of their own length, which the load balancers would not route */
+    if (cnx->quic->lb_ctx != NULL) {
+        id_length = cnx->quic->local_ctx_length;
+    }
     picoquic_create_random_cnx_id(cnx->quic, cnx_id, id_length);
 }
 
@@ -1249,29 +2095,34 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
     struct sockaddr* addr, uint64_t start_time, uint32_t preferred_version,
     char const* sni, char const* alpn, char client_mode)
 {
-    picoquic_cnx_t* cnx = (picoquic_cnx_t*)malloc(sizeof(picoquic_cnx_t));
+    picoquic_cnx_t* cnx = (picoquic_cnx_t*)picoquic_object_cache_get(&quic->cnx_cache);
 
     if (cnx != NULL) {
         int ret;
 
-        memset(cnx, 0, sizeof(picoquic_cnx_t));
-
         cnx->quic = quic;
         cnx->client_mode = client_mode;
+        cnx->memory_cap = quic->default_memory_cap;
+        cnx->send_watermarks = quic->default_send_watermarks;
+        picoquic_init_ready_streams(cnx);
         /* Should return 0, since this is the first path */
         ret = picoquic_create_path(cnx, start_time, addr);
 
         if (ret != 0) {
-            free(cnx);
+            free(cnx->path);
+            picoquic_object_cache_put(&quic->cnx_cache, cnx);
             cnx = NULL;
         } else {
             cnx->next_wake_time = start_time;
             cnx->start_time = start_time;
 
             picoquic_insert_cnx_in_list(quic, cnx);
-            picoquic_insert_cnx_by_wake_time(quic, cnx);
             /* Do not require verification for default path */
             cnx->path[0]->challenge_verified = 1;
+            if (picoquic_insert_cnx_by_wake_time(quic, cnx) != 0) {
+                picoquic_delete_cnx(cnx);
+                cnx = NULL;
+            }
         }
     }
 
@@ -1285,10 +2136,15 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
         {
             cnx->local_parameters.max_packet_size = cnx->quic->mtu_max;
         }
+        else if (cnx->quic->max_packet_size > PICOQUIC_MAX_PACKET_SIZE)
+        {
+            cnx->local_parameters.max_packet_size = cnx->quic->max_packet_size;
+        }
 
 
         /* Initialize local flow control variables to advertised values */
         cnx->maxdata_local = ((uint64_t)cnx->local_parameters.initial_max_data);
+        cnx->max_data_window = cnx->maxdata_local;
         cnx->max_stream_id_bidir_local = picoquic_transport_param_to_stream_id(cnx->local_parameters.initial_max_streams_bidi, cnx->client_mode, PICOQUIC_STREAM_ID_BIDIR);
         cnx->max_stream_id_bidir_local_computed = cnx->max_stream_id_bidir_local;
         cnx->max_stream_id_unidir_local = picoquic_transport_param_to_stream_id(cnx->local_parameters.initial_max_streams_uni, cnx->client_mode, PICOQUIC_STREAM_ID_UNIDIR);
@@ -1360,6 +2216,21 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
             (void)picoquic_create_cnxid_reset_secret(quic, &cnx->path[0]->local_cnxid,
                 cnx->path[0]->reset_secret);
 
+            if ((quic->preferred_address.ipv4_port != 0 || quic->preferred_address.ipv6_port != 0) &&
+                cnx->path[0]->local_cnxid.id_len > 0) {
+                picoquic_tp_preferred_address_t* preferred_address = &cnx->local_parameters.preferred_address;
+
+                *preferred_address = quic->preferred_address;
+                picoquic_create_random_cnx_id(quic, &cnx->preferred_cnxid, quic->local_ctx_length);
+                if (quic->cnx_id_callback_fn) {
+                    quic->cnx_id_callback_fn(cnx->preferred_cnxid, cnx->initial_cnxid,
+                        quic->cnx_id_callback_ctx, &cnx->preferred_cnxid);
+                }
+                preferred_address->connection_id = cnx->preferred_cnxid;
+                (void)picoquic_create_cnxid_reset_secret(quic, &cnx->preferred_cnxid,
+                    preferred_address->stateless_reset_token);
+            }
+
             cnx->version_index = picoquic_get_version_index(preferred_version);
             if (cnx->version_index < 0) {
                 /* TODO: this is an internal error condition, should not happen */
@@ -1430,6 +2301,9 @@ picoquic_cnx_t* picoquic_create_cnx(picoquic_quic_t* quic,
         if (!picoquic_is_connection_id_null(cnx->path[0]->local_cnxid)) {
             (void)picoquic_register_cnx_id(quic, cnx, &cnx->path[0]->local_cnxid);
         }
+        if (cnx->preferred_cnxid.id_len > 0) {
+            (void)picoquic_register_cnx_id(quic, cnx, &cnx->preferred_cnxid);
+        }
 
         if (addr != NULL) {
             (void)picoquic_register_net_id(quic, cnx, addr);
@@ -1482,16 +2356,26 @@ void register_protocol_operations(picoquic_cnx_t *cnx)
     cnx->plugins = NULL;
     cnx->current_plugin = NULL;
     cnx->previous_plugin_in_replace = NULL;
+    memset(cnx->builtin_ops, 0, sizeof(cnx->builtin_ops));
+    cnx->nb_builtin_ops = 0;
+    cnx->registering_builtin_ops = 1;
     packet_register_noparam_protoops(cnx);
     frames_register_noparam_protoops(cnx);
     sender_register_noparam_protoops(cnx);
     quicctx_register_noparam_protoops(cnx);
+    cnx->registering_builtin_ops = 0;
+    picoquic_update_frame_dispatch(cnx);
 }
 
 int picoquic_start_client_cnx(picoquic_cnx_t * cnx)
 {
     int ret = picoquic_initialize_tls_stream(cnx);
 
+    if (ret == 0) {
+        /* The 0-RTT keys are there if a ticket was found */
+        ret = picoquic_handle_cached_plugin_negotiation(cnx, picoquic_get_quic_time(cnx->quic));
+    }
+
     picoquic_cnx_set_next_wake_time(cnx, picoquic_get_quic_time(cnx->quic));
 
     return ret;
@@ -1505,10 +2389,15 @@ void picoquic_set_transport_parameters(picoquic_cnx_t * cnx, picoquic_tp_t * tp)
     {
         cnx->local_parameters.max_packet_size = cnx->quic->mtu_max;
     }
+    else if (cnx->quic->max_packet_size > PICOQUIC_MAX_PACKET_SIZE)
+    {
+        cnx->local_parameters.max_packet_size = cnx->quic->max_packet_size;
+    }
 
     /* Initialize local flow control variables to advertised values */
 
     cnx->maxdata_local = ((uint64_t)cnx->local_parameters.initial_max_data);
+    cnx->max_data_window = cnx->maxdata_local;
     cnx->max_stream_id_bidir_local = picoquic_transport_param_to_stream_id(cnx->local_parameters.initial_max_streams_bidi, cnx->client_mode, PICOQUIC_STREAM_ID_BIDIR);
     cnx->max_stream_id_unidir_local = picoquic_transport_param_to_stream_id(cnx->local_parameters.initial_max_streams_uni, cnx->client_mode, PICOQUIC_STREAM_ID_UNIDIR);
 }
@@ -1581,12 +2470,27 @@ void picoquic_set_cnx_state(picoquic_cnx_t* cnx, picoquic_state_enum state)
     picoquic_state_enum previous_state = cnx->cnx_state;
     cnx->cnx_state = state;
     if(previous_state != cnx->cnx_state) {
+        if (cnx->log_policy_state < picoquic_log_policy_captured) {
+            /* Before the state is logged, so that a newly captured connection logs it */
+            picoquic_log_policy_update(cnx);
+        }
         LOG_EVENT(cnx, "connection", "new_state", "", "{\"state\": \"%s\"}", picoquic_log_state_name(cnx->cnx_state));
         protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_CONNECTION_STATE_CHANGED, NULL,
             previous_state, state);
     }
 }
 
+int picoquic_start_key_rotation(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    /* One update at a time: the peer must have moved to the current phase already */
+    if (cnx->cnx_state < picoquic_state_client_ready || cnx->cnx_state > picoquic_state_server_ready ||
+        cnx->key_phase_enc != cnx->key_phase_dec) {
+        return PICOQUIC_ERROR_KEY_ROTATION_NOT_READY;
+    }
+
+    return picoquic_rotate_key_phase(cnx, 1, current_time);
+}
+
 uint64_t picoquic_is_0rtt_available(picoquic_cnx_t* cnx)
 {
     return (cnx->crypto_context[1].aead_encrypt == NULL) ? 0 : 1;
@@ -1622,65 +2526,131 @@ void handle_plugin_to_negotiate(picoquic_cnx_t* cnx)
     }
 }
 
-int picoquic_handle_plugin_negotiation_client(picoquic_cnx_t* cnx)
+/* Queues the request of a plugin, once, to be sent in the next validate frames */
+static void picoquic_request_plugin(picoquic_cnx_t* cnx, const char* pid)
 {
-    /* First handle plugins to negotiate */
-    handle_plugin_to_negotiate(cnx);
+    plugin_req_pid_t* preq;
+    size_t pid_len = strlen(pid) + 1;
 
-    /* If there is no plugins_to_inject remote parameter, stop now */
-    if (!cnx->remote_parameters.plugins_to_inject) {
-        return 0;
+    for (int i = 0; i < cnx->pids_to_request.size; i++) {
+        if (cnx->pids_to_request.elems[i].plugin_name != NULL && strcmp(cnx->pids_to_request.elems[i].plugin_name, pid) == 0) {
+            return;
+        }
     }
-    /* If we don't have any plugin store, don't request any plugin! */
-    if (cnx->quic->plugin_store_path == NULL) {
-        return 0;
+    if (cnx->pids_to_request.size >= MAX_PLUGIN) {
+        fprintf(stderr, "Client cannot request more plugins, %s is not requested!\n", pid);
+        return;
     }
-    /* The client can inject all plugins required that it already supports. */
-    char **pids_to_inject = picoquic_string_split(cnx->remote_parameters.plugins_to_inject, ',');
+
+    fprintf(stderr, "Client does not support plugin %s, request it.\n", pid);
+    preq = &cnx->pids_to_request.elems[cnx->pids_to_request.size];
+    preq->plugin_name = malloc(sizeof(char) * (pid_len));
+    if (preq->plugin_name == NULL) {
+        fprintf(stderr, "Client cannot allocate memory to request %s!\n", pid);
+    } else {
+        preq->data = malloc(sizeof(uint8_t) * MAX_PLUGIN_DATA_LEN);
+        if (preq->data == NULL) {
+            fprintf(stderr, "Client cannot allocate memory to request %s!\n", pid);
+            free(preq->plugin_name);
+            preq->plugin_name = NULL;
+        } else {
+            memcpy(preq->plugin_name, pid, pid_len);
+            preq->pid_id = cnx->pids_to_request.size;
+            preq->requested = 0;
+            preq->received_length = 0;
+            cnx->pids_to_request.size++;
+            /* The validate frames are written again, for the new requests only */
+            cnx->plugin_requested = 0;
+        }
+    }
+}
+
+/* Injects the plugins of the comma separated list that the client supports and did not inject yet,
+ * and requests the others */
+static void picoquic_inject_server_plugins(picoquic_cnx_t* cnx, const char* plugins_to_inject)
+{
+    /* The split tokenizes its input in place */
+    char* pids_copy = strdup(plugins_to_inject);
+    char **pids_to_inject = (pids_copy == NULL) ? NULL : picoquic_string_split(pids_copy, ',');
     char *pid_to_inject;
     int index;
     plugin_list_t* supported_plugins = &cnx->quic->supported_plugins;
     if (pids_to_inject) {
-        plugin_fname_t plugins[supported_plugins->size];
+        plugin_fname_t plugins[supported_plugins->size + 1];
         uint8_t nb_plugins = 0;
 
         for (int i = 0; (pid_to_inject = pids_to_inject[i]) != NULL; i++) {
+            protoop_plugin_t* injected = NULL;
+
+            HASH_FIND_STR(cnx->plugins, pid_to_inject, injected);
             /* Search in the supported plugins */
             index = picoquic_pid_index(supported_plugins, pid_to_inject);
 
-            if (index < supported_plugins->size) {
-                plugins[nb_plugins] = supported_plugins->elems[index];
-                nb_plugins++;
-            } else {
-                fprintf(stderr, "Client does not support plugin %s, request it.\n", pid_to_inject);
-                size_t pid_len = strlen(pid_to_inject) + 1;
-                cnx->pids_to_request.elems[cnx->pids_to_request.size].plugin_name = malloc(sizeof(char) * (pid_len));
-                if (cnx->pids_to_request.elems[cnx->pids_to_request.size].plugin_name == NULL) {
-                    fprintf(stderr, "Client cannot allocate memory to request %s!\n", pid_to_inject);
-                } else {
-                    cnx->pids_to_request.elems[cnx->pids_to_request.size].data = malloc(sizeof(uint8_t) * MAX_PLUGIN_DATA_LEN);
-                    if (cnx->pids_to_request.elems[cnx->pids_to_request.size].data == NULL) {
-                        fprintf(stderr, "Client cannot allocate memory to request %s!\n", pid_to_inject);
-                        free(cnx->pids_to_request.elems[cnx->pids_to_request.size].plugin_name);
-                        cnx->pids_to_request.elems[cnx->pids_to_request.size].plugin_name = NULL;
-                    } else {
-                        memcpy(cnx->pids_to_request.elems[cnx->pids_to_request.size].plugin_name, pid_to_inject, pid_len);
-                        cnx->pids_to_request.elems[cnx->pids_to_request.size].pid_id = cnx->pids_to_request.size;
-                        cnx->pids_to_request.size++;
-                    }
+            if (injected != NULL) {
+                /* Already injected from the plugins remembered with the ticket */
+            } else if (index < supported_plugins->size) {
+                if (nb_plugins < supported_plugins->size) {
+                    plugins[nb_plugins] = supported_plugins->elems[index];
+                    nb_plugins++;
                 }
+            } else {
+                picoquic_request_plugin(cnx, pid_to_inject);
             }
+            free(pid_to_inject);
         }
 
-        /* TODO plugin loading optimisation */
-        int nb_plugins_failed = plugin_insert_plugins(cnx, nb_plugins, plugins);
-        if (nb_plugins_failed == 0) {
-            fprintf(stderr, "Client successfully inserted %u plugins\n", nb_plugins);
-        } else {
-            fprintf(stderr, "Client failed to insert %d plugins\n", nb_plugins_failed);
+        if (nb_plugins > 0) {
+            /* TODO plugin loading optimisation */
+            int nb_plugins_failed = plugin_insert_plugins(cnx, nb_plugins, plugins);
+            if (nb_plugins_failed == 0) {
+                fprintf(stderr, "Client successfully inserted %u plugins\n", nb_plugins);
+            } else {
+                fprintf(stderr, "Client failed to insert %d plugins\n", nb_plugins_failed);
+            }
         }
         free(pids_to_inject);
     }
+    free(pids_copy);
+}
+
+int picoquic_handle_plugin_negotiation_client(picoquic_cnx_t* cnx)
+{
+    /* First handle plugins to negotiate */
+    handle_plugin_to_negotiate(cnx);
+
+    /* If there is no plugins_to_inject remote parameter, stop now */
+    if (!cnx->remote_parameters.plugins_to_inject) {
+        return 0;
+    }
+    /* If we don't have any plugin store, don't request any plugin! */
+    if (cnx->quic->plugin_store_path == NULL) {
+        return 0;
+    }
+    /* The client can inject all plugins required that it already supports. */
+    picoquic_inject_server_plugins(cnx, cnx->remote_parameters.plugins_to_inject);
+
+    return 0;
+}
+
+/*
+ * When resuming with 0-RTT, the client does not wait for the transport parameters of the server: the plugins
+ * it injected on the connection that got the ticket are injected at once if supported, and requested in the
+ * 0-RTT packets otherwise, so that the server streams their archives in its first 1-RTT packets. The list of
+ * the transport parameters then only adds what changed since.
+ */
+int picoquic_handle_cached_plugin_negotiation(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    char const* plugins_to_inject;
+
+    if (!cnx->client_mode || cnx->crypto_context[1].aead_encrypt == NULL ||
+        cnx->sni == NULL || cnx->alpn == NULL || cnx->quic->plugin_store_path == NULL) {
+        return 0;
+    }
+    plugins_to_inject = picoquic_get_ticket_plugins(cnx->quic->p_first_ticket, current_time,
+        cnx->sni, (uint16_t)strlen(cnx->sni), cnx->alpn, (uint16_t)strlen(cnx->alpn));
+    if (plugins_to_inject != NULL) {
+        picoquic_inject_server_plugins(cnx, plugins_to_inject);
+    }
 
     return 0;
 }
@@ -1745,10 +2715,65 @@ int picoquic_handle_plugin_negotiation(picoquic_cnx_t* cnx)
     return err;
 }
 
-/*
- * Provide clock time
- */
-uint64_t picoquic_current_time()
+/*
+ * Provide clock time
+ */
+#ifdef _WINDOWS
+#define PICOQUIC_THREAD_LOCAL __declspec(thread)
+#else
+#define PICOQUIC_THREAD_LOCAL __thread
+
+static pthread_once_t picoquic_clock_once = PTHREAD_ONCE_INIT;
+static uint64_t picoquic_clock_offset; /* Wall time minus monotonic time, when the clock is first read */
+
+static uint64_t picoquic_monotonic_time()
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec) * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void picoquic_clock_init()
+{
+    picoquic_clock_offset = picoquic_wall_time() - picoquic_monotonic_time();
+}
+#endif
+
+/* Time of the last refresh by an event loop of the thread, for the pluglets */
+static PICOQUIC_THREAD_LOCAL uint64_t picoquic_thread_loop_time;
+
+uint64_t picoquic_current_time()
+{
+#ifdef _WINDOWS
+    return picoquic_wall_time();
+#else
+    (void)pthread_once(&picoquic_clock_once, picoquic_clock_init);
+    return picoquic_clock_offset + picoquic_monotonic_time();
+#endif
+}
+
+uint64_t picoquic_refresh_time(picoquic_quic_t* quic)
+{
+    uint64_t now = picoquic_current_time();
+
+    quic->loop_time = now;
+    picoquic_thread_loop_time = now;
+
+    return now;
+}
+
+uint64_t picoquic_get_loop_time(picoquic_quic_t* quic)
+{
+    return (quic->loop_time != 0) ? quic->loop_time : picoquic_current_time();
+}
+
+uint64_t picoquic_cached_time()
+{
+    return (picoquic_thread_loop_time != 0) ? picoquic_thread_loop_time : picoquic_current_time();
+}
+
+uint64_t picoquic_wall_time()
 {
     uint64_t now;
 #ifdef _WINDOWS
@@ -1839,24 +2864,224 @@ int picoquic_write_ecn_block(picoquic_cnx_t* cnx, uint8_t *bytes, size_t bytes_m
     return ret;
 }
 
-void picoquic_clear_stream(picoquic_stream_head* stream)
+void picoquic_memory_charge(picoquic_cnx_t* cnx, picoquic_memory_category_enum category, size_t length)
+{
+    if (cnx != NULL) {
+        cnx->memory_used[category] += length;
+        cnx->memory_total += length;
+        cnx->nb_memory_charges++;
+        if (cnx->memory_total > cnx->memory_peak) {
+            cnx->memory_peak = cnx->memory_total;
+        }
+    }
+}
+
+void picoquic_memory_release(picoquic_cnx_t* cnx, picoquic_memory_category_enum category, size_t length)
+{
+    if (cnx != NULL) {
+        cnx->memory_used[category] -= length;
+        cnx->memory_total -= length;
+    }
+}
+
+int picoquic_is_memory_capped(picoquic_cnx_t* cnx)
+{
+    return cnx->memory_cap > 0 && cnx->memory_total >= cnx->memory_cap;
+}
+
+uint64_t picoquic_autotune_window(picoquic_cnx_t* cnx, uint64_t window, uint64_t window_max, uint64_t update_time)
+{
+    picoquic_quic_t* quic = cnx->quic;
+    uint64_t growth = 0;
+
+    if (quic != NULL && window < window_max) {
+        uint64_t srtt = (cnx->nb_paths > 0) ? cnx->path[0]->smoothed_rtt : PICOQUIC_INITIAL_RTT;
+
+        /* The updates come every half window: one less than 2 RTT after the previous shows a rate times
+         * RTT above a quarter of the window, close enough to the window for the peer to stall soon */
+        if (picoquic_get_quic_time(quic) < update_time + 2 * srtt) {
+            growth = (window < window_max - window) ? window : window_max - window;
+            if (quic->flow_control_budget > 0) {
+                uint64_t left = (quic->flow_control_growth < quic->flow_control_budget) ?
+                    quic->flow_control_budget - quic->flow_control_growth : 0;
+
+                if (growth > left) {
+                    growth = left;
+                }
+            }
+        }
+    }
+
+    return window + growth;
+}
+
+void picoquic_autotune_window_set(picoquic_cnx_t* cnx, uint64_t* window, uint64_t new_window,
+    uint64_t* update_time, uint64_t* growth)
+{
+    if (cnx->quic != NULL) {
+        *update_time = picoquic_get_quic_time(cnx->quic);
+        cnx->quic->flow_control_growth += new_window - *window;
+    }
+    *growth += new_window - *window;
+    *window = new_window;
+}
+
+void picoquic_get_memory_stats(picoquic_cnx_t* cnx, picoquic_memory_stats_t* stats)
+{
+    memcpy(stats->bytes, cnx->memory_used, sizeof(stats->bytes));
+    stats->total = cnx->memory_total;
+    stats->peak = cnx->memory_peak;
+    stats->nb_capped = cnx->nb_memory_capped;
+    stats->nb_charges = cnx->nb_memory_charges;
+}
+
+void picoquic_set_memory_cap(picoquic_cnx_t* cnx, uint64_t cap)
+{
+    cnx->memory_cap = cap;
+}
+
+void picoquic_set_send_buffer_watermarks(picoquic_cnx_t* cnx, uint64_t stream_high, uint64_t stream_low,
+    uint64_t cnx_high, uint64_t cnx_low)
+{
+    cnx->send_watermarks.stream_high = stream_high;
+    cnx->send_watermarks.stream_low = (stream_low < stream_high) ? stream_low : stream_high;
+    cnx->send_watermarks.cnx_high = cnx_high;
+    cnx->send_watermarks.cnx_low = (cnx_low < cnx_high) ? cnx_low : cnx_high;
+}
+
+void picoquic_release_send_buffered(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
+{
+    cnx->send_buffered -= stream->send_buffered;
+    stream->send_buffered = 0;
+    if (stream->send_blocked) {
+        /* No write will succeed on this stream again */
+        stream->send_blocked = 0;
+        cnx->nb_send_blocked--;
+    }
+}
+
+/*
+ * Hibernation of the idle connections. Once a connection made no progress for
+ * the hibernation delay, the memory it only needs while data is in flight goes
+ * back: the retransmit indexes, the packets kept to detect spurious
+ * retransmissions, the empty reassembly buffers and the sack ranges that fit in
+ * place again. The crypto contexts, connection IDs, flow control state and plugin
+ * state stay as they are. As these structures grow again on demand, waking up
+ * only clears the flag.
+ */
+
+static void picoquic_hibernate_stream(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
+{
+    if (stream->recv.nb_ranges == 0) {
+        picoquic_memory_release(cnx, picoquic_memory_recv_data, picoquic_stream_recv_footprint(&stream->recv));
+        picoquic_stream_recv_free(&stream->recv);
+    }
+    picoquic_memory_release(cnx, picoquic_memory_sacks, picoquic_sack_list_footprint(&stream->sack_list));
+    picoquic_sack_list_compact(&stream->sack_list);
+    picoquic_memory_charge(cnx, picoquic_memory_sacks, picoquic_sack_list_footprint(&stream->sack_list));
+}
+
+uint64_t picoquic_hibernate_cnx(picoquic_cnx_t* cnx)
+{
+    uint64_t memory_before = cnx->memory_total;
+
+    for (int i = 0; i < cnx->nb_paths; i++) {
+        for (picoquic_packet_context_enum pc = 0; pc < picoquic_nb_packet_context; pc++) {
+            picoquic_packet_context_t* pkt_ctx = &cnx->path[i]->pkt_ctx[pc];
+
+            if (pkt_ctx->retransmit_newest == NULL) {
+                picoquic_retransmit_index_free(pkt_ctx);
+            }
+            while (pkt_ctx->retransmitted_newest != NULL) {
+                picoquic_dequeue_retransmitted_packet(cnx, pkt_ctx->retransmitted_newest);
+            }
+            picoquic_memory_release(cnx, picoquic_memory_sacks, picoquic_sack_list_footprint(&pkt_ctx->sack_list));
+            picoquic_sack_list_compact(&pkt_ctx->sack_list);
+            picoquic_memory_charge(cnx, picoquic_memory_sacks, picoquic_sack_list_footprint(&pkt_ctx->sack_list));
+        }
+    }
+
+    for (int epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS; epoch++) {
+        picoquic_hibernate_stream(cnx, &cnx->tls_stream[epoch]);
+    }
+    for (picoquic_stream_head* stream = cnx->first_stream; stream != NULL; stream = stream->next_stream) {
+        picoquic_hibernate_stream(cnx, stream);
+    }
+    for (picoquic_stream_head* stream = cnx->first_plugin_stream; stream != NULL; stream = stream->next_stream) {
+        picoquic_hibernate_stream(cnx, stream);
+    }
+
+    if (!cnx->is_hibernating) {
+        cnx->is_hibernating = 1;
+        cnx->nb_hibernations++;
+    }
+
+    return memory_before - cnx->memory_total;
+}
+
+void picoquic_wake_cnx(picoquic_cnx_t* cnx)
+{
+    cnx->is_hibernating = 0;
+}
+
+int picoquic_is_cnx_hibernating(picoquic_cnx_t* cnx)
+{
+    return cnx->is_hibernating;
+}
+
+void picoquic_check_hibernation(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    uint64_t delay = cnx->quic->hibernation_delay;
+
+    if (delay != 0 && !cnx->is_hibernating &&
+        (cnx->cnx_state == picoquic_state_client_ready || cnx->cnx_state == picoquic_state_server_ready) &&
+        current_time >= cnx->latest_progress_time + delay) {
+        (void)picoquic_hibernate_cnx(cnx);
+    }
+}
+
+size_t picoquic_stream_data_footprint(picoquic_stream_data* data)
+{
+    /* The bytes of the archives and of the application buffers are not copied */
+    if (data->capacity > 0) {
+        return sizeof(picoquic_stream_data) + data->capacity;
+    }
+    return sizeof(picoquic_stream_data) + ((data->archive == NULL && data->release_fn == NULL) ? data->length : 0);
+}
+
+void picoquic_free_stream_data(picoquic_cnx_t* cnx, picoquic_stream_data* data)
+{
+    picoquic_memory_release(cnx, data->memory_category, picoquic_stream_data_footprint(data));
+    if (data->archive != NULL) {
+        plugin_archive_release(data->archive);
+    } else if (data->release_fn != NULL) {
+        data->release_fn(data->release_ctx, data->bytes, data->length);
+    } else if (data->bytes != NULL && data->capacity == 0) {
+        free(data->bytes);
+    }
+    free(data);
+}
+
+void picoquic_clear_stream(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
 {
     picoquic_stream_data** pdata[2];
     pdata[0] = &stream->stream_data;
     pdata[1] = &stream->send_queue;
+    picoquic_release_send_buffered(cnx, stream);
 
     for (int i = 0; i < 2; i++) {
         picoquic_stream_data* next;
 
         while ((next = *pdata[i]) != NULL) {
             *pdata[i] = next->next_stream_data;
-
-            if (next->bytes != NULL) {
-                free(next->bytes);
-            }
-            free(next);
+            picoquic_free_stream_data(cnx, next);
         }
     }
+
+    picoquic_memory_release(cnx, picoquic_memory_recv_data, picoquic_stream_recv_footprint(&stream->recv));
+    picoquic_stream_recv_free(&stream->recv);
+    picoquic_memory_release(cnx, picoquic_memory_sacks, picoquic_sack_list_footprint(&stream->sack_list));
+    picoquic_sack_list_free(&stream->sack_list);
 }
 
 void picoquic_reset_packet_context(picoquic_cnx_t* cnx,
@@ -1868,6 +3093,7 @@ void picoquic_reset_packet_context(picoquic_cnx_t* cnx,
     while (pkt_ctx->retransmit_newest != NULL) {
         picoquic_dequeue_retransmit_packet(cnx, pkt_ctx->retransmit_newest, 1);
     }
+    picoquic_retransmit_index_free(pkt_ctx);
 
     while (pkt_ctx->retransmitted_newest != NULL) {
         picoquic_dequeue_retransmitted_packet(cnx, pkt_ctx->retransmitted_newest);
@@ -1875,23 +3101,11 @@ void picoquic_reset_packet_context(picoquic_cnx_t* cnx,
 
     pkt_ctx->retransmitted_oldest = NULL;
 
-    while (pkt_ctx->first_sack_item.next_sack != NULL) {
-        picoquic_sack_item_t * next = pkt_ctx->first_sack_item.next_sack;
-        pkt_ctx->first_sack_item.next_sack = next->next_sack;
-        free(next);
-    }
-
-    pkt_ctx->first_sack_item.start_of_sack_range = (uint64_t)((int64_t)-1);
-    pkt_ctx->first_sack_item.end_of_sack_range = 0;
+    picoquic_memory_release(cnx, picoquic_memory_sacks, picoquic_sack_list_footprint(&pkt_ctx->sack_list));
+    picoquic_sack_list_free(&pkt_ctx->sack_list);
 
     /* Free the metadata */
-    if (pkt_ctx->metadata) {
-        plugin_struct_metadata_t *current_md, *tmp;
-        HASH_ITER(hh, pkt_ctx->metadata, current_md, tmp) {
-            HASH_DEL(pkt_ctx->metadata, current_md);
-            free(current_md);
-        }
-    }
+    plugin_metadata_free(&pkt_ctx->metadata);
 }
 
 /*
@@ -1926,7 +3140,7 @@ int picoquic_reset_cnx(picoquic_cnx_t* cnx, uint64_t current_time)
 
     /* Reset the crypto stream */
     for (int epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS; epoch++) {
-        picoquic_clear_stream(&cnx->tls_stream[epoch]);
+        picoquic_clear_stream(cnx, &cnx->tls_stream[epoch]);
         cnx->tls_stream[epoch].consumed_offset = 0;
         cnx->tls_stream[epoch].fin_offset = 0;
         cnx->tls_stream[epoch].sent_offset = 0;
@@ -1973,6 +3187,7 @@ int picoquic_reset_cnx_version(picoquic_cnx_t* cnx, uint8_t* bytes, size_t lengt
             for (size_t i = 0; i < picoquic_nb_supported_versions; i++) {
                 if (proposed_version == picoquic_supported_versions[i].version) {
                     cnx->version_index = (int)i;
+                    picoquic_reset_cnx_header_templates(cnx);
                     picoquic_set_cnx_state(cnx, picoquic_state_client_renegotiate);
 
                     break;
@@ -2077,6 +3292,7 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
 
         picoquic_remove_cnx_from_list(cnx);
         picoquic_remove_cnx_from_wake_list(cnx);
+        picoquic_remove_readable_cnx(cnx);
 
         for (int i = 0; i < 4; i++) {
             picoquic_crypto_context_free(&cnx->crypto_context[i]);
@@ -2090,20 +3306,27 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
         }
 
         for (int epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS; epoch++) {
-            picoquic_clear_stream(&cnx->tls_stream[epoch]);
+            picoquic_clear_stream(cnx, &cnx->tls_stream[epoch]);
         }
 
+        HASH_CLEAR(hh, cnx->streams_by_id);
         while ((stream = cnx->first_stream) != NULL) {
             cnx->first_stream = stream->next_stream;
-            picoquic_clear_stream(stream);
-            free(stream);
+            picoquic_clear_stream(cnx, stream);
+            picoquic_memory_release(cnx, picoquic_memory_streams, sizeof(picoquic_stream_head));
+            picoquic_free_stream_object(cnx, stream);
         }
 
         while ((stream = cnx->first_plugin_stream) != NULL) {
             cnx->first_plugin_stream = stream->next_stream;
-            picoquic_clear_stream(stream);
-            free(stream);
+            picoquic_clear_stream(cnx, stream);
+            picoquic_memory_release(cnx, picoquic_memory_plugins, sizeof(picoquic_stream_head));
+            picoquic_free_stream_object(cnx, stream);
         }
+        picoquic_init_ready_streams(cnx);
+        cnx->first_max_data_stream = NULL;
+        cnx->last_max_data_stream = NULL;
+        cnx->quic->flow_control_growth -= cnx->max_data_growth;
 
         if (cnx->tls_ctx != NULL) {
             picoquic_tlscontext_free(cnx, cnx->tls_ctx);
@@ -2119,14 +3342,8 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
                 }
 
                 /* Free the metadata */
-                if (cnx->path[i]->metadata) {
-                    plugin_struct_metadata_t *current_md, *tmp;
-                    HASH_ITER(hh, cnx->path[i]->metadata, current_md, tmp) {
-                        HASH_DEL(cnx->path[i]->metadata, current_md);
-                        free(current_md);
-                    }
-                }
-                free(cnx->path[i]);
+                plugin_metadata_free(&cnx->path[i]->metadata);
+                picoquic_free_path_object(cnx, cnx->path[i]);
                 cnx->path[i] = NULL;
             }
 
@@ -2147,19 +3364,34 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
                 cached->nb_plugins = 0;
                 protoop_plugin_t *current_p, *tmp_p;
                 HASH_ITER(hh, cached->plugins, current_p, tmp_p) {
+                    /* Negotiated plugins go back to their preplugins, the next connection will negotiate again */
+                    if (current_p->post_pluglets && plugin_remove_post_plugin(cnx, current_p)) {
+                        DBG_PRINTF("Cannot remove the postplugins of %s\n", current_p->name);
+                    }
                     /* This remains safe to do this, as the memory of the frame context will be freed when cnx will */
                     while(queue_peek(current_p->block_queue_cc) != NULL) {queue_dequeue(current_p->block_queue_cc);}
                     while(queue_peek(current_p->block_queue_non_cc) != NULL) {queue_dequeue(current_p->block_queue_non_cc);}
-                    /* First destroy the memory */
+                    memset(current_p->drr, 0, sizeof(current_p->drr));
+                    /* The recorded events refer to the structures of this connection, drop them */
+                    free(current_p->record_ring);
+                    current_p->record_ring = NULL;
+                    /* First destroy the memory, and give its pages back until the next connection uses it */
                     destroy_memory_management(current_p);
-                    /* And reinit the memory */
-                    init_memory_management(current_p);
+                    plugin_template_t *template = NULL;
+                    HASH_FIND_STR(cnx->quic->plugin_templates, current_p->name, template);
+                    /* Mapping the template again drops the pages written by this connection */
+                    if (template == NULL || plugin_template_apply(template, current_p) != 0) {
+                        plugin_memory_discard(current_p);
+                        /* And reinit the memory */
+                        init_memory_management(current_p);
+                    }
                     /* And copy the name of the plugin */
                     strcpy(cached->plugin_names[cached->nb_plugins], current_p->name);
                     /* We found one plugin, so count it! */
                     cached->nb_plugins++;
                 }
-                int err = queue_enqueue(cnx->quic->cached_plugins_queue, cached);
+                cached->ops = cnx->ops;
+                int err = plugin_cache_insert(cnx->quic, cached);
                 if (err) {
                     DBG_PRINTF("%s", "Cannot insert cached plugins; free them.\n");
                     picoquic_free_protoops_and_plugins(cnx);
@@ -2172,13 +3404,7 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
         }
 
         /* Free the metadata */
-        if (cnx->metadata) {
-            plugin_struct_metadata_t *current_md, *tmp;
-            HASH_ITER(hh, cnx->metadata, current_md, tmp) {
-                HASH_DEL(cnx->metadata, current_md);
-                free(current_md);
-            }
-        }
+        plugin_metadata_free(&cnx->metadata);
 
         /* Free possibly allocated memory in pids to request */
         for (int i = 0; i < cnx->pids_to_request.size; i++) {
@@ -2215,7 +3441,11 @@ void picoquic_delete_cnx(picoquic_cnx_t* cnx)
             queue_free(cnx->retry_frames);
         }
 
-        free(cnx);
+        if (cnx->quic != NULL) {
+            picoquic_object_cache_put(&cnx->quic->cnx_cache, cnx);
+        } else {
+            free(cnx);
+        }
     }
 }
 
@@ -2268,6 +3498,41 @@ void picoquic_set_default_congestion_algorithm(picoquic_quic_t* quic, picoquic_c
     quic->default_congestion_alg = alg;
 }
 
+picoquic_congestion_algorithm_t const* picoquic_get_congestion_algorithm(char const* alg_name)
+{
+    picoquic_congestion_algorithm_t const* alg = NULL;
+
+    if (alg_name != NULL) {
+        if (strcmp(alg_name, "newreno") == 0 || strcmp(alg_name, "reno") == 0) {
+            alg = picoquic_newreno_algorithm;
+        } else if (strcmp(alg_name, "cubic") == 0) {
+            alg = picoquic_cubic_algorithm;
+        } else if (strcmp(alg_name, "bbr") == 0) {
+            alg = picoquic_bbr_algorithm;
+        } else if (strcmp(alg_name, "ledbat") == 0) {
+            alg = picoquic_ledbat_algorithm;
+        } else if (strcmp(alg_name, "prague") == 0) {
+            alg = picoquic_prague_algorithm;
+        }
+    }
+
+    return alg;
+}
+
+void picoquic_set_ack_frequency(picoquic_cnx_t* cnx, uint64_t packet_tolerance, uint64_t max_ack_delay)
+{
+    cnx->ack_gap_requested = packet_tolerance;
+    cnx->ack_delay_requested = max_ack_delay;
+    /* A new frame is sent with the next packet */
+    cnx->ack_gap_sent = 0;
+    cnx->ack_delay_sent = 0;
+}
+
+void picoquic_request_immediate_ack(picoquic_cnx_t* cnx)
+{
+    cnx->immediate_ack_requested = 1;
+}
+
 void picoquic_set_congestion_algorithm(picoquic_cnx_t* cnx, picoquic_congestion_algorithm_t const* alg)
 {
     if (cnx->congestion_alg != NULL) {
@@ -2289,6 +3554,11 @@ void picoquic_set_congestion_algorithm(picoquic_cnx_t* cnx, picoquic_congestion_
     }
 }
 
+void picoquic_set_hystart_pp(picoquic_cnx_t* cnx, int enable)
+{
+    cnx->is_hystart_pp_enabled = (enable) ? 1 : 0;
+}
+
 /**
  * See PROTOOP_NOPARAM_CONGESTION_ALGORITHM_NOTIFY
  */
@@ -2313,6 +3583,8 @@ void picoquic_congestion_algorithm_notify_func(picoquic_cnx_t *cnx, picoquic_pat
                                  uint64_t nb_bytes_acknowledged, uint64_t lost_packet_number, uint64_t current_time) {
     protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_CONGESTION_ALGORITHM_NOTIFY, NULL, path_x, notification, rtt_measurement, nb_bytes_acknowledged,
             lost_packet_number, current_time);
+    PICOQUIC_TRACE6(congestion_notify, picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx)), path_x, (int)notification,
+        rtt_measurement, nb_bytes_acknowledged, path_x->cwin);
 }
 
 /**
@@ -2341,27 +3613,96 @@ void picoquic_set_alpn_select_fn(picoquic_quic_t* quic, picoquic_alpn_select_fn
     quic->alpn_select_fn = alpn_select_fn;
 }
 
+static uint64_t picoquic_idle_keep_alive_interval(picoquic_cnx_t* cnx)
+{
+    /* Examine the transport parameters */
+    uint64_t idle_timeout = cnx->local_parameters.max_idle_timeout;
+
+    if (cnx->cnx_state >= picoquic_state_client_ready && idle_timeout > cnx->remote_parameters.max_idle_timeout) {
+        idle_timeout = cnx->remote_parameters.max_idle_timeout;
+    }
+    /* convert to microseconds */
+    idle_timeout *= 1000;
+    /* set interval to half that value */
+    return idle_timeout / 2;
+}
+
 void picoquic_enable_keep_alive(picoquic_cnx_t* cnx, uint64_t interval)
 {
-    if (interval == 0) {
-        /* Examine the transport parameters */
-        uint64_t idle_timeout = cnx->local_parameters.max_idle_timeout;
+    cnx->keep_alive_interval = (interval == 0) ? picoquic_idle_keep_alive_interval(cnx) : interval;
+    cnx->keep_alive_adaptive = 0;
+}
 
-        if (cnx->cnx_state >= picoquic_state_client_ready && idle_timeout > cnx->remote_parameters.max_idle_timeout) {
-            idle_timeout = cnx->remote_parameters.max_idle_timeout;
-        }
-        /* convert to microseconds */
-        idle_timeout *= 1000;
-        /* set interval to half that value */
-        cnx->keep_alive_interval = idle_timeout / 2;
-    } else {
-        cnx->keep_alive_interval = interval;
+void picoquic_enable_adaptive_keep_alive(picoquic_cnx_t* cnx, uint64_t min_interval, uint64_t max_interval)
+{
+    cnx->keep_alive_max = (max_interval == 0) ? picoquic_idle_keep_alive_interval(cnx) : max_interval;
+    cnx->keep_alive_min = (min_interval == 0) ? PICOQUIC_KEEP_ALIVE_ADAPTIVE_MIN : min_interval;
+    if (cnx->keep_alive_min > cnx->keep_alive_max) {
+        cnx->keep_alive_min = cnx->keep_alive_max;
     }
+    cnx->keep_alive_interval = cnx->keep_alive_min;
+    cnx->keep_alive_safe = 0;
+    cnx->keep_alive_probe = 0;
+    cnx->keep_alive_adaptive = 1;
 }
 
 void picoquic_disable_keep_alive(picoquic_cnx_t* cnx)
 {
     cnx->keep_alive_interval = 0;
+    cnx->keep_alive_adaptive = 0;
+}
+
+uint64_t picoquic_keep_alive_time(picoquic_cnx_t* cnx)
+{
+    uint64_t keep_alive_time = cnx->latest_progress_time + cnx->keep_alive_interval;
+    uint64_t bucket = cnx->quic->keep_alive_bucket;
+
+    if (bucket > 1) {
+        keep_alive_time = ((keep_alive_time + bucket - 1) / bucket) * bucket;
+    }
+
+    return keep_alive_time;
+}
+
+void picoquic_keep_alive_sent(picoquic_cnx_t* cnx)
+{
+    if (!cnx->keep_alive_adaptive) {
+        return;
+    }
+    if (cnx->keep_alive_probe > cnx->keep_alive_safe) {
+        /* No rebinding since the previous keep alive, the silence before it did not outlive the binding */
+        cnx->keep_alive_safe = cnx->keep_alive_probe;
+    }
+    cnx->keep_alive_probe = cnx->keep_alive_interval;
+    if (cnx->keep_alive_safe >= cnx->keep_alive_interval && cnx->keep_alive_interval < cnx->keep_alive_max) {
+        cnx->keep_alive_interval += cnx->keep_alive_interval / 2;
+        if (cnx->keep_alive_interval > cnx->keep_alive_max) {
+            cnx->keep_alive_interval = cnx->keep_alive_max;
+        }
+    }
+}
+
+void picoquic_keep_alive_rebinding(picoquic_cnx_t* cnx)
+{
+    uint64_t failed;
+
+    if (!cnx->keep_alive_adaptive || cnx->keep_alive_interval == 0) {
+        return;
+    }
+
+    failed = (cnx->keep_alive_probe != 0) ? cnx->keep_alive_probe : cnx->keep_alive_interval;
+    if (cnx->keep_alive_safe >= failed) {
+        /* An interval that held before failed, the NAT forgets sooner than it seemed */
+        cnx->keep_alive_safe = 0;
+    }
+    cnx->keep_alive_max = (cnx->keep_alive_safe != 0) ? cnx->keep_alive_safe : failed / 2;
+    if (cnx->keep_alive_max < cnx->keep_alive_min) {
+        cnx->keep_alive_max = cnx->keep_alive_min;
+    }
+    cnx->keep_alive_interval = cnx->keep_alive_max;
+    cnx->keep_alive_probe = 0;
+    LOG_EVENT(cnx, "connectivity", "keep_alive_backoff", "",
+        "{\"failed_interval\": %" PRIu64 ", \"interval\": %" PRIu64 "}", failed, cnx->keep_alive_interval);
 }
 
 int picoquic_set_verify_certificate_callback(picoquic_quic_t* quic, picoquic_verify_certificate_cb_fn cb, void* ctx,
@@ -2399,6 +3740,17 @@ void picoquic_received_packet(picoquic_cnx_t *cnx, SOCKET_TYPE socket, int recv_
 }
 
 void picoquic_before_sending_packet(picoquic_cnx_t *cnx, SOCKET_TYPE socket) {
+    picoquic_quic_t* quic = cnx->quic;
+
+    if (quic != NULL && quic->ecn_configured && socket != INVALID_SOCKET) {
+        /* Setting the TOS of every packet costs a system call, the socket keeps it */
+        uint64_t flag = ((uint64_t)socket < 64) ? (1ull << socket) : 0;
+
+        if (flag == 0 || (quic->ecn_socket_flags & flag) == 0) {
+            (void)picoquic_enable_ecn(socket, quic->ecn_codepoint);
+            quic->ecn_socket_flags |= flag;
+        }
+    }
     protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_BEFORE_SENDING_PACKET, NULL, socket);
 }
 
@@ -2418,6 +3770,17 @@ void picoquic_header_parsed(picoquic_cnx_t *cnx, picoquic_packet_header *ph, pic
     protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_HEADER_PARSED, NULL, ph, path, length);
 }
 
+void picoquic_ecn_packet_received(picoquic_path_t* path, picoquic_packet_header* ph, int recv_tos)
+{
+    /* ECT(1) is 0x01 and ECT(0) 0x02, the counters are in the order of the ACK_ECN frame */
+    static const int ecn_index[4] = { -1, 1, 0, 2 };
+    int index = ecn_index[recv_tos & PICOQUIC_ECN_CE];
+
+    if (index >= 0 && path != NULL) {
+        path->pkt_ctx[ph->pc].ecn_received[index]++;
+    }
+}
+
 void picoquic_header_prepared(picoquic_cnx_t *cnx, picoquic_packet_header *ph, picoquic_path_t *path, picoquic_packet_t *packet, size_t length) {
     protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_HEADER_PREPARED, NULL, ph, path, packet, length);
 }
@@ -2535,6 +3898,53 @@ protoop_arg_t protoop_snprintf(picoquic_cnx_t *cnx)
 }
 
 /* A simple no-op */
+/**
+ * See PROTOOP_NOPARAM_WRITE_LOG
+ */
+protoop_arg_t protoop_write_log(picoquic_cnx_t *cnx)
+{
+    int fd = (int) cnx->protoop_inputv[0];
+    const uint8_t *bytes = (const uint8_t *) cnx->protoop_inputv[1];
+    size_t length = (size_t) cnx->protoop_inputv[2];
+    int close_fd = (int) cnx->protoop_inputv[3];
+    picoquic_log_flusher_t *flusher = (picoquic_log_flusher_t *) cnx->quic->log_flusher;
+    int ret = 0;
+
+    if (flusher != NULL) {
+        ret = picoquic_log_flusher_write(flusher, fd, bytes, length);
+        if (close_fd) {
+            picoquic_log_flusher_close(flusher, fd);
+        }
+    } else {
+        size_t written = 0;
+        while (written < length) {
+            ssize_t w = write(fd, bytes + written, length - written);
+            if (w <= 0) {
+                ret = -1;
+                break;
+            }
+            written += w;
+        }
+        if (close_fd) {
+            close(fd);
+        }
+    }
+    return (protoop_arg_t) ret;
+}
+
+/**
+ * See PROTOOP_NOPARAM_MERGE_SERVER_METRICS
+ */
+protoop_arg_t protoop_merge_server_metrics(picoquic_cnx_t *cnx)
+{
+    picoquic_server_metrics_sample_t *sample = (picoquic_server_metrics_sample_t *) cnx->protoop_inputv[0];
+
+    if (cnx->quic->server_metrics != NULL) {
+        picoquic_server_metrics_merge(cnx->quic->server_metrics, sample);
+    }
+    return 0;
+}
+
 protoop_arg_t protoop_noop(picoquic_cnx_t *cnx)
 {
     /* Do nothing! */
@@ -2569,9 +3979,115 @@ protocol_operation_param_struct_t *create_protocol_operation_param(param_id_t pa
     popst->replace = NULL;
     popst->pre = NULL;
     popst->post = NULL;
+    popst->record = NULL;
+    popst->async = NULL;
+    popst->is_private = false;
+    picoquic_update_plain_core(popst);
     return popst;
 }
 
+/* Gives a dense index to the built-in protocol operations. As they are always registered in the
+ * same order, all the connections agree on the index stored in the (global) protoop_id_t.
+ */
+static void picoquic_register_builtin_index(picoquic_cnx_t* cnx, protoop_id_t *pid, protocol_operation_struct_t *post)
+{
+    post->pid.index = 0;
+    if (!cnx->registering_builtin_ops || cnx->nb_builtin_ops + 1 >= PROTOOP_BUILTIN_INDEX_MAX) {
+        return;
+    }
+    cnx->nb_builtin_ops++;
+    pid->index = cnx->nb_builtin_ops;
+    post->pid.index = pid->index;
+    cnx->builtin_ops[pid->index] = post;
+}
+
+void picoquic_index_builtin_protoops(picoquic_cnx_t *cnx)
+{
+    protocol_operation_struct_t *current_post, *tmp_protoop;
+    memset(cnx->builtin_ops, 0, sizeof(cnx->builtin_ops));
+    HASH_ITER(hh, cnx->ops, current_post, tmp_protoop) {
+        if (current_post->pid.index > 0 && current_post->pid.index < PROTOOP_BUILTIN_INDEX_MAX) {
+            cnx->builtin_ops[current_post->pid.index] = current_post;
+        }
+    }
+}
+
+void picoquic_update_logging_active(picoquic_cnx_t *cnx)
+{
+    protoop_id_t *log_pids[] = { &PROTOOP_NOPARAM_LOG_EVENT, &PROTOOP_NOPARAM_PUSH_LOG_CONTEXT, &PROTOOP_NOPARAM_POP_LOG_CONTEXT };
+    cnx->logging_active = 0;
+    /* The core logging operations do nothing, so only log if a pluglet is attached to one of them */
+    for (int i = 0; i < sizeof(log_pids) / sizeof(log_pids[0]); i++) {
+        protocol_operation_struct_t *post = picoquic_find_protoop(cnx, log_pids[i]);
+        if (post && post->params && !post->params->plain_core) {
+            cnx->logging_active = 1;
+        }
+    }
+}
+
+static void picoquic_index_private_op(picoquic_cnx_t *cnx, protocol_operation_struct_t *post, protocol_operation_param_struct_t *popst)
+{
+    if (popst->plain_private && cnx->nb_private_ops < PROTOOP_PRIVATE_INDEX_MAX) {
+        picoquic_private_op_t *op = &cnx->private_ops[cnx->nb_private_ops++];
+        op->hash = post->pid.hash;
+        op->param = popst->param;
+        op->post = post;
+        op->popst = popst;
+    }
+}
+
+/* Lists the private operations, the other ones are run through plugin_run_protoop_internal() */
+static void picoquic_index_private_protoops(picoquic_cnx_t *cnx)
+{
+    protocol_operation_struct_t *post, *tmp_post;
+    protocol_operation_param_struct_t *popst, *tmp_popst;
+    cnx->nb_private_ops = 0;
+    HASH_ITER(hh, cnx->ops, post, tmp_post) {
+        if (post->is_parametrable) {
+            HASH_ITER(hh, post->params, popst, tmp_popst) {
+                picoquic_index_private_op(cnx, post, popst);
+            }
+        } else if (post->params) {
+            picoquic_index_private_op(cnx, post, post->params);
+        }
+    }
+}
+
+void picoquic_update_frame_dispatch(picoquic_cnx_t *cnx)
+{
+    protoop_id_t *frame_pids[picoquic_frame_op_max] = { &PROTOOP_PARAM_PARSE_FRAME, &PROTOOP_PARAM_PROCESS_FRAME, &PROTOOP_PARAM_NOTIFY_FRAME };
+    for (int op = 0; op < picoquic_frame_op_max; op++) {
+        protocol_operation_struct_t *post = picoquic_find_protoop(cnx, frame_pids[op]);
+        protocol_operation_param_struct_t *default_popst = NULL;
+        if (post && !post->is_parametrable) {
+            post = NULL;
+        }
+        if (post) {
+            param_id_t default_behaviour = NO_PARAM;
+            HASH_FIND(hh, post->params, &default_behaviour, sizeof(param_id_t), default_popst);
+        }
+        /* As plugin_run_protoop_internal does, fall back on the default behaviour */
+        for (int frame_type = 0; frame_type < PICOQUIC_FRAME_DISPATCH_SIZE; frame_type++) {
+            protocol_operation_param_struct_t *popst = post ? picoquic_find_protoop_param(post, (param_id_t) frame_type) : NULL;
+            cnx->frame_dispatch[op][frame_type] = popst ? popst : default_popst;
+        }
+    }
+    /* The header operations are run for each packet, so they are called directly when no pluglet is attached */
+    protoop_id_t *header_pids[] = { &PROTOOP_NOPARAM_GET_DESTINATION_CONNECTION_ID, &PROTOOP_NOPARAM_PREDICT_PACKET_HEADER_LENGTH };
+    cnx->plain_header_ops = 1;
+    for (int i = 0; i < sizeof(header_pids) / sizeof(header_pids[0]); i++) {
+        protocol_operation_struct_t *post = picoquic_find_protoop(cnx, header_pids[i]);
+        if (!post || !post->params || !post->params->plain_core) {
+            cnx->plain_header_ops = 0;
+        }
+    }
+    protocol_operation_struct_t *checksum_post = picoquic_find_protoop(cnx, &PROTOOP_NOPARAM_GET_CHECKSUM_LENGTH);
+    cnx->plain_checksum_op = (checksum_post && checksum_post->params && checksum_post->params->plain_core) ? 1 : 0;
+    picoquic_index_private_protoops(cnx);
+    /* A pluglet may have changed the CIDs while it was attached */
+    picoquic_reset_cnx_header_templates(cnx);
+}
+
 int register_noparam_protoop(picoquic_cnx_t* cnx, protoop_id_t *pid, protocol_operation op)
 {
     /* This is a safety check */
@@ -2602,6 +4118,7 @@ int register_noparam_protoop(picoquic_cnx_t* cnx, protoop_id_t *pid, protocol_op
     strncpy(post->pid.id, pid->id, p_strlen);
     strncpy(post->name, pid->id, sizeof(post->name) > p_strlen ? p_strlen : sizeof(post->name));
     post->is_parametrable = false;
+    post->param_table = NULL;
     post->params = create_protocol_operation_param(NO_PARAM, op);
     if (!post->params) {
         free(post->pid.id);
@@ -2610,6 +4127,7 @@ int register_noparam_protoop(picoquic_cnx_t* cnx, protoop_id_t *pid, protocol_op
     }
     /* Don't forget to copy the hash of the pid */
     post->pid.hash = pid->hash;
+    picoquic_register_builtin_index(cnx, pid, post);
     HASH_ADD_PID(cnx->ops, pid.hash, post);
     return 0;
 }
@@ -2636,7 +4154,7 @@ int register_param_protoop(picoquic_cnx_t* cnx, protoop_id_t *pid, param_id_t pa
             printf("ERROR: trying to insert parameter in non-parametrable protocol operation %s\n", pid->id);
             return 1;
         }
-        HASH_FIND(hh, post->params, &param, sizeof(param_id_t), popst);
+        popst = picoquic_find_protoop_param(post, param);
         if (popst) {
             printf("ERROR: trying to register twice the parametrable protocol operation %s with param %u\n", pid->id, param);
             return 1;
@@ -2660,6 +4178,13 @@ int register_param_protoop(picoquic_cnx_t* cnx, protoop_id_t *pid, param_id_t pa
         post->is_parametrable = true;
         /* Ensure the value is NULL */
         post->params = NULL;
+        post->param_table = calloc(PROTOOP_PARAM_TABLE_SIZE, sizeof(protocol_operation_param_struct_t *));
+        if (!post->param_table) {
+            free(post->pid.id);
+            free(post);
+            printf("ERROR: failed to allocate memory for the param table of %s\n", pid->id);
+            return 1;
+        }
     }
 
     popst = create_protocol_operation_param(param, op);
@@ -2667,6 +4192,7 @@ int register_param_protoop(picoquic_cnx_t* cnx, protoop_id_t *pid, param_id_t pa
     if (!popst) {
         /* If the post is new, remove it */
         if (!post->params) {
+            free(post->param_table);
             free(post->pid.id);
             free(post);
         }
@@ -2677,10 +4203,12 @@ int register_param_protoop(picoquic_cnx_t* cnx, protoop_id_t *pid, param_id_t pa
     if (!post->params) {
         /* Don't forget to copy the hash of the pid */
         post->pid.hash = pid->hash;
+        picoquic_register_builtin_index(cnx, pid, post);
         HASH_ADD_PID(cnx->ops, pid.hash, post);
     }
     /* Insert the param struct */
     HASH_ADD(hh, post->params, param, sizeof(param_id_t), popst);
+    picoquic_set_protoop_param_table(post, param, popst);
     return 0;
 }
 
@@ -2703,13 +4231,26 @@ size_t reserve_frames(picoquic_cnx_t* cnx, uint8_t nb_frames, reserve_frame_slot
         return 0;
     }
     memset(block, 0, sizeof(reserve_frames_block_t));
+    picoquic_memory_charge(cnx, picoquic_memory_reserved_frames, sizeof(reserve_frames_block_t));
     block->nb_frames = nb_frames;
     block->total_bytes = 0;
     block->low_priority = true;
+    block->drop_priority = UINT8_MAX;
+    bool expires = true;
     for (int i = 0; i < nb_frames; i++) {
         block->total_bytes += slots[i].nb_bytes;
         block->is_congestion_controlled |= slots[i].is_congestion_controlled;
         block->low_priority &= slots[i].low_priority;   // it is higher priority as soon as a higher priority slot is present
+        if (slots[i].drop_priority < block->drop_priority) {
+            block->drop_priority = slots[i].drop_priority;
+        }
+        if (slots[i].expire_time > block->expire_time) {
+            block->expire_time = slots[i].expire_time;
+        }
+        expires &= slots[i].expire_time != 0;
+    }
+    if (!expires) {
+        block->expire_time = 0;
     }
     block->frames = slots;
     int err = 0;
@@ -2719,10 +4260,15 @@ size_t reserve_frames(picoquic_cnx_t* cnx, uint8_t nb_frames, reserve_frame_slot
         err = queue_enqueue(cnx->current_plugin->block_queue_non_cc, block);
     }
     if (err) {
+        picoquic_memory_release(cnx, picoquic_memory_reserved_frames, sizeof(reserve_frames_block_t));
         free(block);
         POP_LOG_CTX(cnx);
         return 0;
     }
+    picoquic_drr_activate(cnx, cnx->current_plugin, block->is_congestion_controlled);
+    if (block->is_congestion_controlled) {
+        cnx->nb_reserved_cc_blocks++;
+    }
     LOG {
         char ftypes_str[250];
         size_t ftypes_ofs = 0;
@@ -2736,20 +4282,17 @@ size_t reserve_frames(picoquic_cnx_t* cnx, uint8_t nb_frames, reserve_frame_slot
     return block->total_bytes;
 }
 
-reserve_frame_slot_t* cancel_head_reservation(picoquic_cnx_t* cnx, uint8_t *nb_frames, int congestion_controlled) {
-    if (!cnx->current_plugin) {
-        printf("ERROR: cancel_head_reservation can only be called by pluglets with plugins!\n");
-        return 0;
-    }
-    PUSH_LOG_CTX(cnx, "\"plugin\": \"%s\", \"protoop\": \"%s\", \"anchor\": \"%s\"",  cnx->current_plugin->name, cnx->current_protoop->name, pluglet_type_name(cnx->current_anchor));
-
+/* Removes the block at index in the reservation queue of the current plugin, and returns its slots */
+static reserve_frame_slot_t* picoquic_cancel_reservation(picoquic_cnx_t* cnx, uint8_t *nb_frames, int congestion_controlled, size_t index) {
     queue_t *block_queue = congestion_controlled ? cnx->current_plugin->block_queue_cc : cnx->current_plugin->block_queue_non_cc;
-    reserve_frames_block_t *block = queue_dequeue(block_queue);
+    reserve_frames_block_t *block = queue_remove(block_queue, index);
     if (block == NULL) {
         *nb_frames = 0;
-        POP_LOG_CTX(cnx);
         return NULL;
     }
+    if (congestion_controlled) {
+        cnx->nb_reserved_cc_blocks--;
+    }
     *nb_frames = block->nb_frames;
     reserve_frame_slot_t *slots = block->frames;
     LOG {
@@ -2760,28 +4303,56 @@ reserve_frame_slot_t* cancel_head_reservation(picoquic_cnx_t* cnx, uint8_t *nb_f
         }
         ftypes_str[ftypes_ofs] = 0;
 
-        LOG_EVENT(cnx, "plugins", "cancel_head_reservation", "", "{\"nb_frames\": %d, \"total_bytes\": %" PRIu64 ", \"is_cc\": %d, \"frames\": [%s]}", block->nb_frames, block->total_bytes, block->is_congestion_controlled, ftypes_str);
+        LOG_EVENT(cnx, "plugins", "cancel_head_reservation", "", "{\"nb_frames\": %d, \"total_bytes\": %" PRIu64 ", \"is_cc\": %d, \"index\": %" PRIu64 ", \"frames\": [%s]}", block->nb_frames, block->total_bytes, block->is_congestion_controlled, (uint64_t) index, ftypes_str);
     }
+    picoquic_memory_release(cnx, picoquic_memory_reserved_frames, sizeof(reserve_frames_block_t));
     free(block);
+    return slots;
+}
+
+reserve_frame_slot_t* cancel_head_reservation(picoquic_cnx_t* cnx, uint8_t *nb_frames, int congestion_controlled) {
+    if (!cnx->current_plugin) {
+        printf("ERROR: cancel_head_reservation can only be called by pluglets with plugins!\n");
+        return 0;
+    }
+    PUSH_LOG_CTX(cnx, "\"plugin\": \"%s\", \"protoop\": \"%s\", \"anchor\": \"%s\"",  cnx->current_plugin->name, cnx->current_protoop->name, pluglet_type_name(cnx->current_anchor));
+    reserve_frame_slot_t *slots = picoquic_cancel_reservation(cnx, nb_frames, congestion_controlled, 0);
+    POP_LOG_CTX(cnx);
+    return slots;
+}
+
+reserve_frame_slot_t* cancel_droppable_reservation(picoquic_cnx_t* cnx, uint8_t *nb_frames, int congestion_controlled) {
+    if (!cnx->current_plugin) {
+        printf("ERROR: cancel_droppable_reservation can only be called by pluglets with plugins!\n");
+        return 0;
+    }
+    PUSH_LOG_CTX(cnx, "\"plugin\": \"%s\", \"protoop\": \"%s\", \"anchor\": \"%s\"",  cnx->current_plugin->name, cnx->current_protoop->name, pluglet_type_name(cnx->current_anchor));
+
+    queue_t *block_queue = congestion_controlled ? cnx->current_plugin->block_queue_cc : cnx->current_plugin->block_queue_non_cc;
+    size_t droppable = 0;
+    reserve_frames_block_t *block;
+    for (size_t i = 1; (block = queue_get(block_queue, i)) != NULL; i++) {
+        if (block->drop_priority > ((reserve_frames_block_t *) queue_get(block_queue, droppable))->drop_priority) {
+            droppable = i;
+        }
+    }
+    reserve_frame_slot_t *slots = picoquic_cancel_reservation(cnx, nb_frames, congestion_controlled, droppable);
     POP_LOG_CTX(cnx);
     return slots;
 }
+
 /* Indicates whether there exist non-low priority frames booked. */
 bool picoquic_has_booked_plugin_frames(picoquic_cnx_t *cnx)
 {
-    queue_node_t *n = cnx->reserved_frames->head;
-    while(n) {
-        reserve_frame_slot_t *s = n->data;
+    for (size_t i = 0; i < queue_size(cnx->reserved_frames); i++) {
+        reserve_frame_slot_t *s = queue_get(cnx->reserved_frames, i);
         if (!s->low_priority)
             return true;
-        n = n->next;
     }
-    n = cnx->retry_frames->head;
-    while(n) {
-        reserve_frame_slot_t *s = n->data;
+    for (size_t i = 0; i < queue_size(cnx->retry_frames); i++) {
+        reserve_frame_slot_t *s = queue_get(cnx->retry_frames, i);
         if (!s->low_priority)
             return true;
-        n = n->next;
     }
     return false;
 }
@@ -2815,6 +4386,8 @@ void quicctx_register_noparam_protoops(picoquic_cnx_t *cnx)
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_LOG_EVENT, &protoop_noop);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PUSH_LOG_CONTEXT, &protoop_noop);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_POP_LOG_CONTEXT, &protoop_noop);
+    register_noparam_protoop(cnx, &PROTOOP_NOPARAM_WRITE_LOG, &protoop_write_log);
+    register_noparam_protoop(cnx, &PROTOOP_NOPARAM_MERGE_SERVER_METRICS, &protoop_merge_server_metrics);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_CONNECTION_ERROR, &connection_error);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_NOPARAM_UNKNOWN_TP_RECEIVED, &protoop_noop);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PEER_ADDRESS_CHANGED, &protoop_noop);
@@ -13,14 +13,48 @@
  * Highly inspired from Algorithms, Fourth edition, https://algs4.cs.princeton.edu/33balanced/RedBlackBST.java
  */
 
-int rbt_init(picoquic_cnx_t *cnx, red_black_tree_t *tree) {
+// allocates a chunk of the node pool, each chunk being twice the size of the previous one
+rbt_chunk_t *rbt_add_chunk(picoquic_cnx_t *cnx, red_black_tree_t *tree) {
+    rbt_chunk_t *chunk = my_malloc(cnx, sizeof(rbt_chunk_t) + tree->chunk_nodes * sizeof(rbt_node_t));
+    if (!chunk) return NULL;
+    chunk->next = tree->chunks;
+    chunk->nb_nodes = tree->chunk_nodes;
+    chunk->nb_used = 0;
+    tree->chunks = chunk;
+    tree->chunk_nodes = (2 * tree->chunk_nodes < RBT_CHUNK_MAX_NODES) ? 2 * tree->chunk_nodes : RBT_CHUNK_MAX_NODES;
+    return chunk;
+}
+
+int rbt_init(picoquic_cnx_t *cnx, red_black_tree_t *tree, uint32_t nb_nodes_hint) {
     memset(tree, 0, sizeof(red_black_tree_t));
+    tree->chunk_nodes = (nb_nodes_hint == 0) ? RBT_CHUNK_DEFAULT_NODES : nb_nodes_hint;
+    if (tree->chunk_nodes > RBT_CHUNK_MAX_NODES) {
+        tree->chunk_nodes = RBT_CHUNK_MAX_NODES;
+    }
+    // with a hint, the first chunk of the pool is reserved right away
+    if (nb_nodes_hint > 0 && rbt_add_chunk(cnx, tree) == NULL) {
+        return -1;
+    }
     return 0;
 }
 
-rbt_node_t *rbt_new_node(picoquic_cnx_t *cnx, rbt_key key, rbt_val val, bool color, int size) {
-    rbt_node_t *newnode = my_malloc(cnx, sizeof(rbt_node_t));
-    if (!newnode) return NULL;
+rbt_node_t *rbt_new_node(picoquic_cnx_t *cnx, red_black_tree_t *tree, rbt_key key, rbt_val val, bool color, int size) {
+    rbt_node_t *newnode;
+    if (tree->free_nodes) {
+        newnode = tree->free_nodes;
+        tree->free_nodes = newnode->right;
+    } else {
+        rbt_chunk_t *chunk = tree->chunks;
+        if (!chunk || chunk->nb_used == chunk->nb_nodes) {
+            if (tree->chunk_nodes == 0) {
+                // the tree was set up without rbt_init
+                tree->chunk_nodes = RBT_CHUNK_DEFAULT_NODES;
+            }
+            chunk = rbt_add_chunk(cnx, tree);
+            if (!chunk) return NULL;
+        }
+        newnode = &chunk->nodes[chunk->nb_used++];
+    }
     memset(newnode, 0, sizeof(rbt_node_t));
     newnode->key = key;
     newnode->val = val;
@@ -31,12 +65,33 @@ rbt_node_t *rbt_new_node(picoquic_cnx_t *cnx, rbt_key key, rbt_val val, bool col
     return newnode;
 }
 
-int rbt_destroy_node(picoquic_cnx_t *cnx, rbt_node_t *node) {
+// the node goes back to the free nodes of the tree, linked through its right child
+int rbt_destroy_node(picoquic_cnx_t *cnx, red_black_tree_t *tree, rbt_node_t *node) {
     if (!node) return 0;
-    my_free(cnx, node);
+    node->left = NULL;
+    node->right = tree->free_nodes;
+    tree->free_nodes = node;
     return 0;
 }
 
+void rbt_clear(picoquic_cnx_t *cnx, red_black_tree_t *tree) {
+    if (!tree)
+        return;
+    if (!IS_IN_PLUGIN_MEMORY(cnx->current_plugin, tree)) {
+        printf("Error: tried to access to node out of plugin memory: %p\n", tree);
+        return;
+    }
+    rbt_chunk_t *chunk = tree->chunks;
+    while (chunk) {
+        rbt_chunk_t *next = chunk->next;
+        my_free(cnx, chunk);
+        chunk = next;
+    }
+    tree->root = NULL;
+    tree->free_nodes = NULL;
+    tree->chunks = NULL;
+}
+
 
 /***************************************************************************
  *  Node helper methods.
@@ -305,9 +360,9 @@ rbt_node_t *rbt_balance(picoquic_cnx_t *cnx, rbt_node_t *h) {
 
 
 // insert the key-value pair in the subtree rooted at h
-rbt_node_t *rbt_node_put(picoquic_cnx_t *cnx, rbt_node_t *node, rbt_key key, rbt_val val) {
+rbt_node_t *rbt_node_put(picoquic_cnx_t *cnx, red_black_tree_t *tree, rbt_node_t *node, rbt_key key, rbt_val val) {
     if (node == NULL) {
-        node = rbt_new_node(cnx, key, val, RED, 1);
+        node = rbt_new_node(cnx, tree, key, val, RED, 1);
         if (!node) {
             printf("Out of memory when creating a new node\n");
             return NULL;
@@ -327,9 +382,9 @@ rbt_node_t *rbt_node_put(picoquic_cnx_t *cnx, rbt_node_t *node, rbt_key key, rbt
 
     int cmp = key_compare(key, node->key);
     if        (cmp < 0) {
-        node->left = rbt_node_put(cnx, node->left, key, val);
+        node->left = rbt_node_put(cnx, tree, node->left, key, val);
     } else if (cmp > 0) {
-        node->right  = rbt_node_put(cnx, node->right,  key, val);
+        node->right  = rbt_node_put(cnx, tree, node->right,  key, val);
     } else {
         node->val   = val;
     }
@@ -352,7 +407,7 @@ void rbt_put(picoquic_cnx_t *cnx, red_black_tree_t *tree, rbt_key key, rbt_val v
         printf("Error: tried to access to node out of plugin memory: %p\n", tree);
         return;
     }
-    tree->root = rbt_node_put(cnx, tree->root, key, val);
+    tree->root = rbt_node_put(cnx, tree, tree->root, key, val);
     tree->root->color = BLACK;
     // assert check();
 }
@@ -489,7 +544,7 @@ rbt_val rbt_max_val(picoquic_cnx_t *cnx, red_black_tree_t *tree) {
 
 
 // delete the key-value pair with the minimum key rooted at h
-rbt_node_t *rbt_node_delete_and_get_min(picoquic_cnx_t *cnx, rbt_node_t *node,
+rbt_node_t *rbt_node_delete_and_get_min(picoquic_cnx_t *cnx, red_black_tree_t *tree, rbt_node_t *node,
                                                                               rbt_key *res, rbt_val *val) {
     if (node == NULL) {
         return NULL;
@@ -507,7 +562,7 @@ rbt_node_t *rbt_node_delete_and_get_min(picoquic_cnx_t *cnx, rbt_node_t *node,
             *val = node->val;
         }
         // destroy the node and release memory
-        rbt_destroy_node(cnx, node);
+        rbt_destroy_node(cnx, tree, node);
         // !!! if the value is something malloc'd, it will be lost !
         return NULL;
     }
@@ -520,7 +575,7 @@ rbt_node_t *rbt_node_delete_and_get_min(picoquic_cnx_t *cnx, rbt_node_t *node,
     if (!is_red(cnx, node->left) && !is_red(cnx, node->left->left)) {
         node = rbt_move_red_left(cnx, node);
     }
-    node->left = rbt_node_delete_and_get_min(cnx, node->left, res, val);
+    node->left = rbt_node_delete_and_get_min(cnx, tree, node->left, res, val);
     return rbt_balance(cnx, node);
 }
 
@@ -547,7 +602,7 @@ uint64_t rbt_delete_and_get_min(picoquic_cnx_t *cnx, red_black_tree_t *tree, rbt
     if (!is_red(cnx, tree->root->left) && !is_red(cnx, tree->root->right))
         tree->root->color = RED;
 
-    tree->root = rbt_node_delete_and_get_min(cnx, tree->root, res, val);
+    tree->root = rbt_node_delete_and_get_min(cnx, tree, tree->root, res, val);
     if (!rbt_is_empty(cnx, tree)) tree->root->color = BLACK;
     return true;
     // assert check();
@@ -563,7 +618,7 @@ inline uint64_t rbt_delete_min(picoquic_cnx_t *cnx, red_black_tree_t *tree) {
 
 
 // delete the key-value pair with the maximum key rooted at h
-rbt_node_t *rbt_node_delete_and_get_max(picoquic_cnx_t *cnx, rbt_node_t *node,
+rbt_node_t *rbt_node_delete_and_get_max(picoquic_cnx_t *cnx, red_black_tree_t *tree, rbt_node_t *node,
                                          rbt_key *res, rbt_val *val) {
     if (node == NULL) {
         return NULL;
@@ -585,7 +640,7 @@ rbt_node_t *rbt_node_delete_and_get_max(picoquic_cnx_t *cnx, rbt_node_t *node,
             *val = node->val;
         }
         // destroy the node and release memory
-        rbt_destroy_node(cnx, node);
+        rbt_destroy_node(cnx, tree, node);
         // !!! if the value is something malloc'd, it will be lost !
         return NULL;
     }
@@ -624,7 +679,7 @@ uint64_t rbt_delete_and_get_max(picoquic_cnx_t *cnx, red_black_tree_t *tree, rbt
     if (!is_red(cnx, tree->root->left) && !is_red(cnx, tree->root->right))
         tree->root->color = RED;
 
-    tree->root = rbt_node_delete_and_get_max(cnx, tree->root, res, val);
+    tree->root = rbt_node_delete_and_get_max(cnx, tree, tree->root, res, val);
     if (!rbt_is_empty(cnx, tree)) tree->root->color = BLACK;
     return true;
     // assert check();
@@ -639,7 +694,7 @@ uint64_t rbt_delete_max(picoquic_cnx_t *cnx, red_black_tree_t *tree) {
 }
 
 // delete the key-value pair with the given key rooted at h
-rbt_node_t *rbt_node_delete(picoquic_cnx_t *cnx, rbt_node_t *node, rbt_key key) {
+rbt_node_t *rbt_node_delete(picoquic_cnx_t *cnx, red_black_tree_t *tree, rbt_node_t *node, rbt_key key) {
 // assert get(h, key) != null;
     if (node == NULL) {
         return NULL;
@@ -660,13 +715,13 @@ rbt_node_t *rbt_node_delete(picoquic_cnx_t *cnx, rbt_node_t *node, rbt_key key)
             node = rbt_move_red_left(cnx, node);
         }
         // search left
-        node->left = rbt_node_delete(cnx, node->left, key);
+        node->left = rbt_node_delete(cnx, tree, node->left, key);
     } else {
         if (is_red(cnx, node->left))
             node = rbt_rotate_right(cnx, node);
         if (key_compare(key, node->key) == 0 && (node->right == NULL)) {  // we found the node and the right child is NULL, let's remove it
             // destroy the node and release memory
-            rbt_destroy_node(cnx, node);
+            rbt_destroy_node(cnx, tree, node);
             // !!! if the value is something malloc'd, it will be lost !
             return NULL;
         }
@@ -676,11 +731,11 @@ rbt_node_t *rbt_node_delete(picoquic_cnx_t *cnx, rbt_node_t *node, rbt_key key)
             rbt_node_t *x = rbt_node_min(cnx, node->right);
             node->key = x->key;
             node->val = x->val;
-            node->right = rbt_node_delete_and_get_min(cnx, node->right, NULL, NULL);
+            node->right = rbt_node_delete_and_get_min(cnx, tree, node->right, NULL, NULL);
         }
         else {
             // search right
-            node->right = rbt_node_delete(cnx, node->right, key);
+            node->right = rbt_node_delete(cnx, tree, node->right, key);
         }
     }
     return rbt_balance(cnx, node);
@@ -796,7 +851,7 @@ void rbt_delete(picoquic_cnx_t *cnx, red_black_tree_t *tree, rbt_key key) {
     if (!is_red(cnx, tree->root->left) && !is_red(cnx, tree->root->right))
         tree->root->color = RED;
 
-    tree->root = rbt_node_delete(cnx, tree->root, key);
+    tree->root = rbt_node_delete(cnx, tree, tree->root, key);
     if (!rbt_is_empty(cnx, tree)) tree->root->color = BLACK;
     // assert check();
 }
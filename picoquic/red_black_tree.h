@@ -15,6 +15,11 @@
 
 #define RBT_MAX_DEPTH 70
 
+// the chunks of the node pool stay below the block size of the plugin memory
+#define RBT_CHUNK_MAX_BYTES 2048
+#define RBT_CHUNK_DEFAULT_NODES 8
+#define RBT_CHUNK_MAX_NODES ((RBT_CHUNK_MAX_BYTES - sizeof(rbt_chunk_t)) / sizeof(rbt_node_t))
+
 #define RED true
 #define BLACK false
 
@@ -33,8 +38,19 @@ typedef struct rbt_node {
     int size;          // subtree count
 } rbt_node_t;
 
+// chunk of the node pool of a tree, allocated in plugin memory
+typedef struct rbt_chunk {
+    struct rbt_chunk *next;
+    uint32_t nb_nodes;
+    uint32_t nb_used;   // nodes handed out from this chunk, it is only filled once
+    rbt_node_t nodes[];
+} rbt_chunk_t;
+
 typedef struct __attribute__((__packed__)) {
     rbt_node_t *root;
+    rbt_node_t *free_nodes;   // deleted nodes, linked through their right child
+    rbt_chunk_t *chunks;      // node pool, the most recent chunk first
+    uint32_t chunk_nodes;     // number of nodes of the next chunk
 } red_black_tree_t;
 
 
@@ -44,7 +60,19 @@ typedef struct __attribute__((__packed__)) {
  * Highly inspired from Algorithms, Fourth edition, https://algs4.cs.princeton.edu/33balanced/RedBlackBST.java
  */
 
-int rbt_init(picoquic_cnx_t *cnx, red_black_tree_t *tree);
+/**
+ * Initializes an empty tree. Its nodes are taken from a pool of chunks allocated in plugin memory,
+ * the first one holding nb_nodes_hint nodes and each following one twice as many, up to
+ * RBT_CHUNK_MAX_NODES. With a hint, the first chunk is allocated right away.
+ * @return 0, or -1 if the first chunk could not be allocated
+ */
+int rbt_init(picoquic_cnx_t *cnx, red_black_tree_t *tree, uint32_t nb_nodes_hint);
+
+/**
+ * Removes all the key-value pairs and releases the node pool of the tree at once.
+ * The values are not freed.
+ */
+void rbt_clear(picoquic_cnx_t *cnx, red_black_tree_t *tree);
 
 /**
  * Returns the number of key-value pairs in this symbol table.
@@ -0,0 +1,284 @@
+#include "resumption_store.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PICOQUIC_RESUMPTION_STORE_MAGIC 0x7071756963727331ull /* "pquicrs1" */
+#define PICOQUIC_RESUMPTION_STORE_OPEN_TRIALS 100 /* Milliseconds waited for the creator to set the store up */
+#define PICOQUIC_RESUMPTION_EXPIRY_MASK 0xFFFFull
+
+static size_t picoquic_resumption_store_size(uint64_t nb_strike_slots)
+{
+    return sizeof(picoquic_resumption_shared_t) + (size_t)nb_strike_slots * sizeof(uint64_t);
+}
+
+static picoquic_resumption_store_t* picoquic_resumption_store_attach(void* mapping, size_t mapping_size)
+{
+    picoquic_resumption_store_t* store = (picoquic_resumption_store_t*)malloc(sizeof(picoquic_resumption_store_t));
+
+    if (store == NULL) {
+        munmap(mapping, mapping_size);
+    } else {
+        store->shared = (picoquic_resumption_shared_t*)mapping;
+        store->strike_slots = (uint64_t*)((uint8_t*)mapping + sizeof(picoquic_resumption_shared_t));
+        store->mapping_size = mapping_size;
+    }
+
+    return store;
+}
+
+/* The pages are zeroed when created, the magic number is set last to tell the other processes they can go */
+static void picoquic_resumption_store_setup(picoquic_resumption_shared_t* shared, uint64_t nb_strike_slots)
+{
+    shared->nb_strike_slots = nb_strike_slots;
+    shared->strike_window = PICOQUIC_RESUMPTION_STRIKE_WINDOW;
+    __atomic_store_n(&shared->magic, PICOQUIC_RESUMPTION_STORE_MAGIC, __ATOMIC_RELEASE);
+}
+
+static picoquic_resumption_store_t* picoquic_resumption_store_open(char const* shm_name, uint64_t nb_strike_slots)
+{
+    picoquic_resumption_store_t* store = NULL;
+    size_t size = picoquic_resumption_store_size(nb_strike_slots);
+    int is_creator = 1;
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0 && errno == EEXIST) {
+        is_creator = 0;
+        fd = shm_open(shm_name, O_RDWR, 0600);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "cannot open the resumption store %s !\n", shm_name);
+        return NULL;
+    }
+
+    if (is_creator) {
+        if (ftruncate(fd, (off_t)size) != 0) {
+            size = 0;
+        }
+    } else {
+        /* The store keeps the size chosen by its creator */
+        struct stat st;
+
+        size = 0;
+        for (int i = 0; i < PICOQUIC_RESUMPTION_STORE_OPEN_TRIALS && size == 0; i++) {
+            if (fstat(fd, &st) != 0) {
+                break;
+            } else if ((size_t)st.st_size >= sizeof(picoquic_resumption_shared_t)) {
+                size = (size_t)st.st_size;
+            } else {
+                usleep(1000);
+            }
+        }
+    }
+
+    if (size > 0) {
+        void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (mapping != MAP_FAILED) {
+            picoquic_resumption_shared_t* shared = (picoquic_resumption_shared_t*)mapping;
+
+            if (is_creator) {
+                picoquic_resumption_store_setup(shared, nb_strike_slots);
+            } else {
+                for (int i = 0; i < PICOQUIC_RESUMPTION_STORE_OPEN_TRIALS &&
+                    __atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != PICOQUIC_RESUMPTION_STORE_MAGIC; i++) {
+                    usleep(1000);
+                }
+            }
+            if (__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != PICOQUIC_RESUMPTION_STORE_MAGIC ||
+                picoquic_resumption_store_size(shared->nb_strike_slots) > size) {
+                munmap(mapping, size);
+            } else {
+                store = picoquic_resumption_store_attach(mapping, size);
+            }
+        }
+    }
+    close(fd);
+
+    if (store == NULL) {
+        fprintf(stderr, "cannot map the resumption store %s !\n", shm_name);
+    }
+
+    return store;
+}
+
+picoquic_resumption_store_t* picoquic_resumption_store_create(char const* shm_name, size_t nb_strike_slots)
+{
+    picoquic_resumption_store_t* store = NULL;
+    uint64_t nb_slots = PICOQUIC_RESUMPTION_STRIKE_PROBES;
+
+    while (nb_slots < nb_strike_slots) {
+        nb_slots *= 2;
+    }
+
+    if (shm_name != NULL) {
+        store = picoquic_resumption_store_open(shm_name, nb_slots);
+    } else {
+        size_t size = picoquic_resumption_store_size(nb_slots);
+        void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+        if (mapping == MAP_FAILED) {
+            fprintf(stderr, "cannot map %zu bytes for the resumption store !\n", size);
+        } else {
+            picoquic_resumption_store_setup((picoquic_resumption_shared_t*)mapping, nb_slots);
+            store = picoquic_resumption_store_attach(mapping, size);
+        }
+    }
+
+    return store;
+}
+
+void picoquic_resumption_store_release(picoquic_resumption_store_t* store)
+{
+    if (store != NULL) {
+        munmap(store->shared, store->mapping_size);
+        free(store);
+    }
+}
+
+int picoquic_resumption_store_unlink(char const* shm_name)
+{
+    return shm_unlink(shm_name);
+}
+
+/*
+ * Each key slot is a sequence lock: the writer makes the sequence odd, writes, then makes it even
+ * again, and the readers retry when they saw it odd or changed. Keys are only written by the
+ * process that rotates them, the others read the current one and those of the tickets.
+ */
+uint32_t picoquic_resumption_store_rotate_key(picoquic_resumption_store_t* store,
+    const uint8_t* secret, size_t secret_length)
+{
+    picoquic_resumption_shared_t* shared = store->shared;
+    uint32_t key_id = __atomic_load_n(&shared->current_key_id, __ATOMIC_ACQUIRE) + 1;
+    picoquic_resumption_key_t* key;
+    uint64_t sequence;
+
+    if (key_id == 0) {
+        key_id = 1;
+    }
+    key = &shared->keys[key_id % PICOQUIC_RESUMPTION_KEY_SLOTS];
+    sequence = __atomic_load_n(&key->sequence, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&key->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memset(key->secret, 0, sizeof(key->secret));
+    memcpy(key->secret, secret, (secret_length < sizeof(key->secret)) ? secret_length : sizeof(key->secret));
+    __atomic_store_n(&key->key_id, key_id, __ATOMIC_RELAXED);
+    __atomic_store_n(&key->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&shared->current_key_id, key_id, __ATOMIC_RELEASE);
+
+    return key_id;
+}
+
+uint32_t picoquic_resumption_store_current_key_id(picoquic_resumption_store_t* store)
+{
+    return __atomic_load_n(&store->shared->current_key_id, __ATOMIC_ACQUIRE);
+}
+
+uint32_t picoquic_resumption_store_get_key(picoquic_resumption_store_t* store, uint32_t key_id,
+    uint8_t secret[PICOQUIC_RESUMPTION_KEY_SIZE])
+{
+    picoquic_resumption_key_t* key;
+    uint32_t slot_key_id;
+    uint64_t sequence;
+
+    if (key_id == 0 && (key_id = picoquic_resumption_store_current_key_id(store)) == 0) {
+        return 0;
+    }
+    key = &store->shared->keys[key_id % PICOQUIC_RESUMPTION_KEY_SLOTS];
+
+    do {
+        while (((sequence = __atomic_load_n(&key->sequence, __ATOMIC_ACQUIRE)) & 1) != 0) {
+            /* The key is being rotated */
+        }
+        slot_key_id = __atomic_load_n(&key->key_id, __ATOMIC_RELAXED);
+        memcpy(secret, key->secret, PICOQUIC_RESUMPTION_KEY_SIZE);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&key->sequence, __ATOMIC_RELAXED) != sequence);
+
+    if (slot_key_id != key_id) {
+        /* Overwritten by a later key */
+        memset(secret, 0, PICOQUIC_RESUMPTION_KEY_SIZE);
+        key_id = 0;
+    }
+
+    return key_id;
+}
+
+void picoquic_resumption_store_set_strike_window(picoquic_resumption_store_t* store, uint32_t window)
+{
+    if (window > 0 && window < 0x8000) {
+        __atomic_store_n(&store->shared->strike_window, window, __ATOMIC_RELAXED);
+    }
+}
+
+/* Expiry seconds are kept modulo 2^16, the window being below half of that */
+static int picoquic_resumption_strike_is_live(uint64_t entry, uint64_t now_s)
+{
+    return entry != 0 && (int16_t)((uint16_t)(entry & PICOQUIC_RESUMPTION_EXPIRY_MASK) - (uint16_t)now_s) > 0;
+}
+
+/*
+ * The strike register is an open addressing table of 64 bit entries, each updated by a single
+ * compare and swap. A ticket is looked for in all of its probes before it takes the first free
+ * one, and once it did, the other probes are checked again: if another process inserted the same
+ * ticket concurrently, both report a replay, which only costs the early data.
+ */
+int picoquic_resumption_store_strike(picoquic_resumption_store_t* store, uint64_t ticket_hash, uint64_t current_time)
+{
+    picoquic_resumption_shared_t* shared = store->shared;
+    uint64_t mask = shared->nb_strike_slots - 1;
+    uint64_t now_s = current_time / 1000000;
+    uint64_t tag = ticket_hash & ~PICOQUIC_RESUMPTION_EXPIRY_MASK;
+    uint64_t entry;
+    uint64_t first = ticket_hash >> 16;
+    int inserted = -1;
+    int is_replay = 0;
+
+    if (tag == 0) {
+        tag = PICOQUIC_RESUMPTION_EXPIRY_MASK + 1;
+    }
+    entry = tag | ((now_s + __atomic_load_n(&shared->strike_window, __ATOMIC_RELAXED)) & PICOQUIC_RESUMPTION_EXPIRY_MASK);
+
+    for (int i = 0; i < PICOQUIC_RESUMPTION_STRIKE_PROBES && !is_replay; i++) {
+        uint64_t current = __atomic_load_n(&store->strike_slots[(first + i) & mask], __ATOMIC_ACQUIRE);
+
+        is_replay = picoquic_resumption_strike_is_live(current, now_s) && (current & ~PICOQUIC_RESUMPTION_EXPIRY_MASK) == tag;
+    }
+
+    for (int i = 0; i < PICOQUIC_RESUMPTION_STRIKE_PROBES && !is_replay && inserted < 0; i++) {
+        uint64_t* slot = &store->strike_slots[(first + i) & mask];
+        uint64_t current = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+        while (!picoquic_resumption_strike_is_live(current, now_s)) {
+            if (__atomic_compare_exchange_n(slot, &current, entry, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                inserted = i;
+                break;
+            }
+        }
+    }
+
+    if (inserted < 0) {
+        /* Seen already, or no room to remember it */
+        is_replay = 1;
+    } else {
+        for (int i = 0; i < PICOQUIC_RESUMPTION_STRIKE_PROBES && !is_replay; i++) {
+            if (i != inserted) {
+                uint64_t current = __atomic_load_n(&store->strike_slots[(first + i) & mask], __ATOMIC_ACQUIRE);
+
+                is_replay = picoquic_resumption_strike_is_live(current, now_s) && (current & ~PICOQUIC_RESUMPTION_EXPIRY_MASK) == tag;
+            }
+        }
+    }
+
+    __atomic_fetch_add((is_replay) ? &shared->nb_replays : &shared->nb_strikes, 1, __ATOMIC_RELAXED);
+
+    return is_replay;
+}
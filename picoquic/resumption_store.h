@@ -0,0 +1,75 @@
+/**
+ * \file resumption_store.h
+ * \brief Resumption state shared by the server contexts of several processes.
+ *
+ * The store lives in shared memory, either anonymous and inherited through fork() or named and
+ * opened by each process. It holds a ring of ticket keys, so that a ticket issued by one process
+ * can be used with another and keys can be rotated without breaking the tickets of the previous
+ * ones, and a strike register of the tickets used for 0-RTT, so that early data is accepted at
+ * most once per ticket whichever process receives it.
+ *
+ * All the accesses go through atomic operations on the shared mapping; no lock is taken.
+ */
+
+#ifndef RESUMPTION_STORE_H
+#define RESUMPTION_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PICOQUIC_RESUMPTION_KEY_SLOTS 4 /* Current key and the previous ones still accepted */
+#define PICOQUIC_RESUMPTION_KEY_SIZE 32
+#define PICOQUIC_RESUMPTION_STRIKE_PROBES 16
+#define PICOQUIC_RESUMPTION_STRIKE_WINDOW 30 /* Seconds, past the freshness window of the ClientHello */
+
+typedef struct st_picoquic_resumption_key_t {
+    uint64_t sequence; /* Odd while the slot is written */
+    uint32_t key_id;
+    uint8_t secret[PICOQUIC_RESUMPTION_KEY_SIZE];
+} picoquic_resumption_key_t;
+
+/* Layout of the shared mapping, followed by the strike register slots */
+typedef struct st_picoquic_resumption_shared_t {
+    uint64_t magic;
+    uint64_t nb_strike_slots; /* A power of 2 */
+    uint32_t current_key_id; /* 0 until a key is set */
+    uint32_t strike_window;
+    picoquic_resumption_key_t keys[PICOQUIC_RESUMPTION_KEY_SLOTS];
+    uint64_t nb_strikes;
+    uint64_t nb_replays;
+} picoquic_resumption_shared_t;
+
+typedef struct st_picoquic_resumption_store_t {
+    picoquic_resumption_shared_t* shared;
+    uint64_t* strike_slots; /* Hash bits above 16, expiry second modulo 2^16 below */
+    size_t mapping_size;
+} picoquic_resumption_store_t;
+
+/* Maps the store with room for nb_strike_slots tickets, rounded up to a power of 2.
+ * With a NULL name the mapping is anonymous and shared with the children forked afterwards,
+ * otherwise it is the POSIX shared memory object of that name, created if needed.
+ * Returns NULL on failure. */
+picoquic_resumption_store_t* picoquic_resumption_store_create(char const* shm_name, size_t nb_strike_slots);
+/* Unmaps the store. The named object stays until picoquic_resumption_store_unlink() */
+void picoquic_resumption_store_release(picoquic_resumption_store_t* store);
+int picoquic_resumption_store_unlink(char const* shm_name);
+
+/* Makes secret the key of the new tickets, the previous keys remaining valid for decryption.
+ * Returns the identifier of the new key, which is never 0 */
+uint32_t picoquic_resumption_store_rotate_key(picoquic_resumption_store_t* store,
+    const uint8_t* secret, size_t secret_length);
+/* Identifier of the key of the new tickets, 0 if no key was set yet */
+uint32_t picoquic_resumption_store_current_key_id(picoquic_resumption_store_t* store);
+/* Copies the secret of key_id, or of the current key if key_id is 0, and returns the key identifier.
+ * Returns 0 if that key is not, or no longer, in the store */
+uint32_t picoquic_resumption_store_get_key(picoquic_resumption_store_t* store, uint32_t key_id,
+    uint8_t secret[PICOQUIC_RESUMPTION_KEY_SIZE]);
+
+/* Seconds during which a ticket stays in the strike register */
+void picoquic_resumption_store_set_strike_window(picoquic_resumption_store_t* store, uint32_t window);
+/* Records the use of a ticket for early data at current_time (microseconds).
+ * Returns 0 the first time within the strike window, 1 if it was seen already or if the register
+ * has no room for it, in which case the early data should be rejected */
+int picoquic_resumption_store_strike(picoquic_resumption_store_t* store, uint64_t ticket_hash, uint64_t current_time);
+
+#endif
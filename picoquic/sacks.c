@@ -21,7 +21,9 @@
 
 #include "picoquic_internal.h"
 #include "memory.h"
+#include "alloc_profiler.h"
 #include <stdlib.h>
+#include <string.h>
 
 /*
 * Packet sequence recording prepares the next ACK:
@@ -32,205 +34,257 @@
 * Maintain the list of ACK
 */
 
+void picoquic_sack_list_init(picoquic_sack_list_t* sacks)
+{
+    memset(sacks, 0, sizeof(picoquic_sack_list_t));
+}
+
+void picoquic_sack_list_free(picoquic_sack_list_t* sacks)
+{
+    if (sacks->allocated != NULL) {
+        free(sacks->allocated);
+    }
+    picoquic_sack_list_init(sacks);
+}
+
+void picoquic_sack_list_compact(picoquic_sack_list_t* sacks)
+{
+    if (sacks->allocated != NULL && sacks->nb_ranges <= PICOQUIC_SACK_INLINE_RANGES) {
+        /* Including the unused last item */
+        memcpy(sacks->inline_items, &sacks->allocated[sacks->first], (sacks->nb_ranges + 1) * sizeof(picoquic_sack_item_t));
+        free(sacks->allocated);
+        sacks->allocated = NULL;
+        sacks->nb_items_alloc = 0;
+        sacks->first = 0;
+    }
+}
+
+size_t picoquic_sack_list_footprint(picoquic_sack_list_t* sacks)
+{
+    return (sacks->allocated != NULL) ? sacks->nb_items_alloc * sizeof(picoquic_sack_item_t) : 0;
+}
+
+static uint32_t picoquic_sack_list_capacity(picoquic_sack_list_t* sacks)
+{
+    return (sacks->allocated != NULL) ? sacks->nb_items_alloc : PICOQUIC_SACK_INLINE_RANGES + 1;
+}
+
+static void picoquic_sack_list_terminate(picoquic_sack_list_t* sacks)
+{
+    picoquic_sack_item_t* last = picoquic_sack_list_items(sacks) + sacks->first + sacks->nb_ranges;
+    last->start_of_sack_range = (uint64_t)((int64_t)-1);
+    last->end_of_sack_range = 0;
+}
+
+/* Number of ranges, from the highest one, whose end is at least n */
+static uint32_t picoquic_sack_nb_ending_from(picoquic_sack_item_t* items, uint32_t nb_ranges, uint64_t n)
+{
+    uint32_t low = 0;
+    uint32_t high = nb_ranges;
+
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (items[middle].end_of_sack_range >= n) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+/* Number of ranges, from the highest one, which start after n */
+static uint32_t picoquic_sack_nb_starting_after(picoquic_sack_item_t* items, uint32_t nb_ranges, uint64_t n)
+{
+    uint32_t low = 0;
+    uint32_t high = nb_ranges;
+
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (items[middle].start_of_sack_range > n) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
 /*
- * Check whether the packet was already received.
+ * Makes room for a new range at rank pos, returns NULL if memory is missing.
+ * Only the ranges on the shortest side move; a new highest range uses the room
+ * left before the first one, which is restored when the array is reorganized.
  */
-int picoquic_is_pn_already_received(picoquic_path_t* path_x, 
-    picoquic_packet_context_enum pc, uint64_t pn64)
+static picoquic_sack_item_t* picoquic_sack_list_insert(picoquic_sack_list_t* sacks, uint32_t pos)
 {
-    int is_received = 0;
-    picoquic_sack_item_t* sack = &path_x->pkt_ctx[pc].first_sack_item;
-
-    if (sack->start_of_sack_range != (uint64_t)((int64_t)-1)) {
-        do {
-            if (pn64 > sack->end_of_sack_range)
-                break;
-            else if (pn64 >= sack->start_of_sack_range) {
-                is_received = 1;
-                break;
+    picoquic_sack_item_t* items = picoquic_sack_list_items(sacks);
+    uint32_t capacity = picoquic_sack_list_capacity(sacks);
+    uint32_t nb_items = sacks->nb_ranges + 1; /* Including the unused last item */
+
+    if (sacks->first > 0 && (pos == 0 || sacks->first + nb_items >= capacity)) {
+        memmove(&items[sacks->first - 1], &items[sacks->first], pos * sizeof(picoquic_sack_item_t));
+        sacks->first--;
+    } else if (pos > 0 && sacks->first + nb_items < capacity) {
+        memmove(&items[sacks->first + pos + 1], &items[sacks->first + pos], (nb_items - pos) * sizeof(picoquic_sack_item_t));
+    } else {
+        /* Re-center the ranges, in a larger array if they use more than half of it */
+        picoquic_sack_item_t* new_items = items;
+        uint32_t new_capacity = capacity;
+        uint32_t head;
+
+        if (2 * (nb_items + 1) > capacity) {
+            new_capacity = 2 * capacity;
+            new_items = (picoquic_sack_item_t*)malloc(new_capacity * sizeof(picoquic_sack_item_t));
+            if (new_items == NULL) {
+                return NULL;
             }
-            else {
-                sack = sack->next_sack;
+        }
+        head = (new_capacity - (nb_items + 1)) / 2;
+        /* The ranges move up, so the lowest ones are moved first */
+        memmove(&new_items[head + pos + 1], &items[sacks->first + pos], (nb_items - pos) * sizeof(picoquic_sack_item_t));
+        memmove(&new_items[head], &items[sacks->first], pos * sizeof(picoquic_sack_item_t));
+        if (new_items != items) {
+            if (sacks->allocated != NULL) {
+                free(sacks->allocated);
             }
-        } while (sack != NULL);
+            sacks->allocated = new_items;
+            sacks->nb_items_alloc = new_capacity;
+            items = new_items;
+        }
+        sacks->first = head;
+    }
+    sacks->nb_ranges++;
+    picoquic_sack_list_terminate(sacks);
+
+    return &items[sacks->first + pos];
+}
+
+/* Removes the ranges from rank pos_min to pos_max excluded */
+static void picoquic_sack_list_remove(picoquic_sack_list_t* sacks, uint32_t pos_min, uint32_t pos_max)
+{
+    picoquic_sack_item_t* items = picoquic_sack_list_items(sacks);
+
+    if (pos_min == 0) {
+        sacks->first += pos_max;
+    } else {
+        memmove(&items[sacks->first + pos_min], &items[sacks->first + pos_max],
+            (sacks->nb_ranges + 1 - pos_max) * sizeof(picoquic_sack_item_t));
     }
+    sacks->nb_ranges -= pos_max - pos_min;
+    picoquic_sack_list_terminate(sacks);
+}
 
-    return is_received;
+/*
+ * Check whether the packet was already received.
+ */
+int picoquic_is_pn_already_received(picoquic_path_t* path_x, 
+    picoquic_packet_context_enum pc, uint64_t pn64)
+{
+    picoquic_sack_list_t* sacks = &path_x->pkt_ctx[pc].sack_list;
+    picoquic_sack_item_t* items = picoquic_sack_list_first(sacks);
+    uint32_t rank = picoquic_sack_nb_ending_from(items, sacks->nb_ranges, pn64);
+
+    return (rank > 0 && items[rank - 1].start_of_sack_range <= pn64) ? 1 : 0;
 }
 
 /*
  * Packet was already received and checksum, etc. was properly verified.
- * Record it in the chain.
+ * Record it in the list. Returns 1 if it is a duplicate, -1 on memory error.
  */
 
-int picoquic_update_sack_list(picoquic_cnx_t* cnx, picoquic_sack_item_t* sack,
+int picoquic_update_sack_list(picoquic_cnx_t* cnx, picoquic_sack_list_t* sacks,
     uint64_t pn64_min, uint64_t pn64_max)
 {
-    int ret = 1; /* duplicate by default, reset to 0 if update found */
-    picoquic_sack_item_t* previous = NULL;
-
-    if (sack->start_of_sack_range == (uint64_t)((int64_t)-1)) {
-        /* This is the first packet ever received.. */
-        sack->start_of_sack_range = pn64_min;
-        sack->end_of_sack_range = pn64_max;
-        ret = 0;
+    picoquic_sack_item_t* items = picoquic_sack_list_first(sacks);
+    /* The ranges from pos_min to pos_max excluded overlap or touch pn64_min..pn64_max */
+    uint32_t pos_min = picoquic_sack_nb_starting_after(items, sacks->nb_ranges, pn64_max + 1);
+    uint32_t pos_max = (pn64_min == 0) ? sacks->nb_ranges : picoquic_sack_nb_ending_from(items, sacks->nb_ranges, pn64_min - 1);
+
+    if (pos_min >= pos_max) {
+        size_t footprint = picoquic_sack_list_footprint(sacks);
+        picoquic_sack_item_t* new_range = picoquic_sack_list_insert(sacks, pos_min);
+        if (new_range == NULL) {
+            /* memory error. That's infortunate */
+            return -1;
+        }
+        if (picoquic_sack_list_footprint(sacks) != footprint) {
+            picoquic_memory_release(cnx, picoquic_memory_sacks, footprint);
+            picoquic_memory_charge(cnx, picoquic_memory_sacks, picoquic_sack_list_footprint(sacks));
+            PICOQUIC_ALLOC_PROFILE(picoquic_alloc_site_sack_items, NULL, picoquic_sack_list_footprint(sacks));
+        }
+        new_range->start_of_sack_range = pn64_min;
+        new_range->end_of_sack_range = pn64_max;
+    } else if (pos_max == pos_min + 1 && items[pos_min].start_of_sack_range <= pn64_min &&
+        items[pos_min].end_of_sack_range >= pn64_max) {
+        /* complete overlap */
+        return 1;
     } else {
-        do {
-            if (pn64_max > sack->end_of_sack_range) {
-                ret = 0;
-
-                if (pn64_min <= sack->end_of_sack_range + 1) {
-                    /* if this actually fills the hole, merge with previous item */
-                    if (previous != NULL && pn64_max + 1 >= previous->start_of_sack_range) {
-                        previous->start_of_sack_range = sack->start_of_sack_range;
-                        previous->next_sack = sack->next_sack;
-                        free(sack);
-                        sack = previous;
-                    } else {
-                        /* add at end of range */
-                        sack->end_of_sack_range = pn64_max;
-                    }
-
-                    /* Check whether there is a need to continue */
-                    if (pn64_min >= sack->start_of_sack_range) {
-                        break;
-                    } else if (sack->next_sack == NULL) {
-                        /* Last in range. Just expand. */
-                        sack->start_of_sack_range = pn64_min;
-                        break;
-                    } else {
-                        /* Continue with reminder of range */
-                        pn64_max = sack->start_of_sack_range - 1;
-                        previous = sack;
-                        sack = sack->next_sack;
-                    }
-                } else if (previous != NULL && pn64_max + 1 >= previous->start_of_sack_range) {
-                    /* Extend the previous range */
-                    previous->start_of_sack_range = pn64_min;
-                    break;
-                } else {
-                    /* Found a new hole */
-                    picoquic_sack_item_t* new_hole = (picoquic_sack_item_t*)malloc(sizeof(picoquic_sack_item_t));
-                    if (new_hole == NULL) {
-                        /* memory error. That's infortunate */
-                        ret = -1;
-                    } else {
-                        /* swap old and new, so it works even if previous == NULL */
-                        new_hole->start_of_sack_range = sack->start_of_sack_range;
-                        new_hole->end_of_sack_range = sack->end_of_sack_range;
-                        new_hole->next_sack = sack->next_sack;
-                        sack->start_of_sack_range = pn64_min;
-                        sack->end_of_sack_range = pn64_max;
-                        sack->next_sack = new_hole;
-                    }
-                    /* No need to continue, everything is consumed. */
-                    break;
-                }
-            } else if (pn64_max >= sack->start_of_sack_range) {
-                if (pn64_min < sack->start_of_sack_range) {
-                    ret = 0;
-
-                    if (sack->next_sack == NULL) {
-                        /* Just extend the last range */
-                        sack->start_of_sack_range = pn64_min;
-                        break;
-                    } else {
-                        /* continue with reminder. */
-                        pn64_max = sack->start_of_sack_range - 1;
-                        previous = sack;
-                        sack = sack->next_sack;
-                    }
-                } else {
-                    /*comple overlap */
-                    break;
-                }
-            } else if (sack->next_sack == NULL) {
-                ret = 0;
-                if (pn64_max + 1 == sack->start_of_sack_range) {
-                    sack->start_of_sack_range = pn64_min;
-                } else {
-                    /* this is an old packet, beyond the current range of SACK */
-                    /* Found a new hole */
-                    picoquic_sack_item_t* new_hole = (picoquic_sack_item_t*)malloc(sizeof(picoquic_sack_item_t));
-                    if (new_hole == NULL) {
-                        /* memory error. That's infortunate */
-                        ret = -1;
-                    } else {
-                        /* Create new hole at the tail. */
-                        new_hole->start_of_sack_range = pn64_min;
-                        new_hole->end_of_sack_range = pn64_max;
-                        new_hole->next_sack = NULL;
-                        sack->next_sack = new_hole;
-                    }
-                }
-                break;
-            } else {
-                previous = sack;
-                sack = sack->next_sack;
-            }
-        } while (sack != NULL);
+        if (items[pos_min].end_of_sack_range < pn64_max) {
+            items[pos_min].end_of_sack_range = pn64_max;
+        }
+        items[pos_min].start_of_sack_range = (items[pos_max - 1].start_of_sack_range < pn64_min) ?
+            items[pos_max - 1].start_of_sack_range : pn64_min;
+        /* The holes were filled, merge the ranges */
+        if (pos_max > pos_min + 1) {
+            picoquic_sack_list_remove(sacks, pos_min + 1, pos_max);
+        }
     }
 
-    return ret;
+    return 0;
 }
 
 int picoquic_record_pn_received(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
     picoquic_packet_context_enum pc, uint64_t pn64,
     uint64_t current_microsec)
 {
-    int ret = 0;
-    picoquic_sack_item_t* sack = &path_x->pkt_ctx[pc].first_sack_item;
+    picoquic_sack_list_t* sacks = &path_x->pkt_ctx[pc].sack_list;
 
-    if (sack->start_of_sack_range == (uint64_t)((int64_t)-1)) {
-        /* This is the first packet ever received.. */
-        sack->start_of_sack_range = pn64;
-        sack->end_of_sack_range = pn64;
+    if (sacks->nb_ranges == 0 || pn64 > picoquic_sack_list_first(sacks)->end_of_sack_range) {
         path_x->pkt_ctx[pc].time_stamp_largest_received = current_microsec;
-    } 
-    else {
-        if (pn64 > sack->end_of_sack_range) {
-            path_x->pkt_ctx[pc].time_stamp_largest_received = current_microsec;
-        }
-
-        ret = picoquic_update_sack_list(cnx, sack, pn64, pn64);
     }
 
-    return ret;
+    return picoquic_update_sack_list(cnx, sacks, pn64, pn64);
 }
 
 /*
  * Check whether the data fills a hole. returns 0 if it does, -1 otherwise.
  */
-int picoquic_check_sack_list(picoquic_sack_item_t* sack,
+int picoquic_check_sack_list(picoquic_sack_list_t* sacks,
     uint64_t pn64_min, uint64_t pn64_max)
 {
-    int ret = -1; /* duplicate by default, reset to 0 if update found */
+    picoquic_sack_item_t* items = picoquic_sack_list_first(sacks);
+    uint32_t rank = picoquic_sack_nb_ending_from(items, sacks->nb_ranges, pn64_max);
 
-    if (sack->start_of_sack_range == (uint64_t)((int64_t)-1)) {
-        ret = 0;
+    /* Only the lowest range ending after pn64_max may contain the data */
+    return (rank > 0 && items[rank - 1].start_of_sack_range <= pn64_min) ? -1 : 0;
+}
+
+/*
+ * The highest range is only trimmed, the others are removed if they match exactly,
+ * so that the pruning does not fragment the list.
+ */
+void picoquic_sack_list_ack_of_ack(picoquic_sack_list_t* sacks, uint64_t start_of_range, uint64_t end_of_range)
+{
+    picoquic_sack_item_t* items = picoquic_sack_list_first(sacks);
+
+    if (sacks->nb_ranges == 0) {
+        return;
+    } else if (items[0].start_of_sack_range == start_of_range) {
+        if (end_of_range < items[0].end_of_sack_range) {
+            items[0].start_of_sack_range = end_of_range + 1;
+        } else {
+            items[0].start_of_sack_range = items[0].end_of_sack_range;
+        }
     } else {
-        do {
-            if (pn64_max > sack->end_of_sack_range) {
-                ret = 0;
-                break;
-            } else if (pn64_max >= sack->start_of_sack_range) {
-                if (pn64_min < sack->start_of_sack_range) {
-                    ret = 0;
-                } else {
-                    /*complete overlap */
-                    ret = -1;
-                }
-                break;
-            } else if (sack->next_sack == NULL) {
-                ret = 0;
-                break;
-            } else {
-                sack = sack->next_sack;
-            }
-        } while (sack != NULL);
-    }
+        uint32_t rank = picoquic_sack_nb_ending_from(items, sacks->nb_ranges, end_of_range);
 
-    return ret;
+        if (rank > 1 && items[rank - 1].end_of_sack_range == end_of_range &&
+            items[rank - 1].start_of_sack_range == start_of_range) {
+            picoquic_sack_list_remove(sacks, rank - 1, rank);
+        }
+    }
 }
 
 /*
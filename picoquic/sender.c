@@ -27,6 +27,9 @@
 #include "plugin.h"
 #include "memory.h"
 #include "logger.h"
+#include "cc_common.h"
+#include "tracepoints.h"
+#include "alloc_profiler.h"
 
 /*
  * Sending logic.
@@ -105,6 +108,7 @@ int picoquic_mark_active_stream(picoquic_cnx_t* cnx,
                 cnx->callback_fn != NULL) {
                 stream->is_active = 1;
                 stream->app_stream_ctx = app_stream_ctx;
+                picoquic_mark_stream_ready(cnx, stream);
                 picoquic_reinsert_by_wake_time(cnx->quic, cnx, picoquic_get_quic_time(cnx->quic));
             }
             else {
@@ -119,8 +123,129 @@ int picoquic_mark_active_stream(picoquic_cnx_t* cnx,
     return ret;
 }
 
-int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
-    const uint8_t* data, size_t length, int set_fin, void *app_stream_ctx)
+int picoquic_set_stream_redundant(picoquic_cnx_t* cnx,
+                                  uint64_t stream_id, int is_redundant)
+{
+    int ret = 0;
+    picoquic_stream_head* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
+
+    if (ret == 0) {
+        stream->is_redundant = (is_redundant) ? 1 : 0;
+    }
+
+    return ret;
+}
+
+int picoquic_set_stream_priority(picoquic_cnx_t* cnx,
+                                uint64_t stream_id, uint8_t urgency, int is_incremental)
+{
+    int ret = 0;
+    picoquic_stream_head* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
+
+    if (ret == 0) {
+        picoquic_update_stream_priority(cnx, stream,
+            (urgency > PICOQUIC_STREAM_URGENCY_MAX) ? PICOQUIC_STREAM_URGENCY_MAX : urgency, !is_incremental);
+    }
+
+    return ret;
+}
+
+int picoquic_set_stream_scheduler(picoquic_cnx_t* cnx, picoquic_stream_scheduler_enum scheduler)
+{
+    int ret = 0;
+
+    if (scheduler < picoquic_stream_scheduler_priority || scheduler > picoquic_stream_scheduler_strict_priority) {
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+    } else if (scheduler != cnx->stream_scheduler) {
+        picoquic_update_stream_scheduler(cnx, scheduler);
+    }
+
+    return ret;
+}
+
+int picoquic_set_stream_weight(picoquic_cnx_t* cnx, uint64_t stream_id, uint16_t weight)
+{
+    int ret = 0;
+    picoquic_stream_head* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
+
+    if (ret == 0) {
+        /* The new weight applies to the bytes sent from now on */
+        stream->weight = (weight == 0) ? 1 : ((weight > PICOQUIC_STREAM_WEIGHT_MAX) ? PICOQUIC_STREAM_WEIGHT_MAX : weight);
+    }
+
+    return ret;
+}
+
+int picoquic_append_stream_data(picoquic_cnx_t* cnx, picoquic_stream_data** pqueue, const uint8_t* data, size_t length,
+    picoquic_stream_data_release_fn release_fn, void* release_ctx)
+{
+    picoquic_stream_data* last = NULL;
+    picoquic_stream_data* stream_data = NULL;
+    size_t copied = 0;
+
+    while (*pqueue != NULL) {
+        last = *pqueue;
+        pqueue = &last->next_stream_data;
+    }
+
+    if (release_fn == NULL && last != NULL && last->capacity > last->length) {
+        /* Small writes go in the room left by the previous ones */
+        copied = last->capacity - last->length;
+        if (copied > length) {
+            copied = length;
+        }
+    }
+
+    if (copied < length) {
+        size_t capacity = 0;
+
+        if (release_fn == NULL) {
+            capacity = (length - copied > PICOQUIC_STREAM_SEND_CHUNK_SIZE) ? length - copied : PICOQUIC_STREAM_SEND_CHUNK_SIZE;
+        }
+        stream_data = (picoquic_stream_data*)malloc(sizeof(picoquic_stream_data) + capacity);
+        if (stream_data == NULL) {
+            return -1;
+        }
+        if (release_fn == NULL) {
+            stream_data->bytes = (uint8_t*)(stream_data + 1);
+            memcpy(stream_data->bytes, data + copied, length - copied);
+        } else {
+            stream_data->bytes = (uint8_t*)data;
+        }
+        stream_data->length = length - copied;
+        stream_data->capacity = capacity;
+        stream_data->offset = 0;
+        stream_data->archive = NULL;
+        stream_data->release_fn = release_fn;
+        stream_data->release_ctx = release_ctx;
+        stream_data->next_stream_data = NULL;
+        stream_data->memory_category = picoquic_memory_send_data;
+        picoquic_memory_charge(cnx, picoquic_memory_send_data, picoquic_stream_data_footprint(stream_data));
+        PICOQUIC_ALLOC_PROFILE(picoquic_alloc_site_stream_data, NULL, picoquic_stream_data_footprint(stream_data));
+        *pqueue = stream_data;
+    }
+
+    if (copied > 0) {
+        memcpy(last->bytes + last->length, data, copied);
+        last->length += copied;
+    }
+
+    return 0;
+}
+
+/* Returns 1 if the stream or the connection holds enough unsent data that new writes must wait */
+static int picoquic_is_send_buffer_full(picoquic_cnx_t* cnx, picoquic_stream_head* stream)
+{
+    picoquic_send_watermarks_t* marks = &cnx->send_watermarks;
+
+    return (marks->stream_high > 0 && stream->send_buffered >= marks->stream_high) ||
+        (marks->cnx_high > 0 && cnx->send_buffered >= marks->cnx_high);
+}
+
+/* Queues the data on the stream, copying it unless release_fn is set */
+static int picoquic_queue_stream_data(picoquic_cnx_t* cnx, uint64_t stream_id,
+    const uint8_t* data, size_t length, int set_fin, void *app_stream_ctx,
+    picoquic_stream_data_release_fn release_fn, void* release_ctx)
 {
     int ret = 0;
     picoquic_stream_head* stream = picoquic_find_stream_for_writing(cnx, stream_id, &ret);
@@ -141,35 +266,24 @@ int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
         ret = -1;
     }
 
-    if (ret == 0 && length > 0) {
-        picoquic_stream_data* stream_data = (picoquic_stream_data*)malloc(sizeof(picoquic_stream_data));
-
-        if (stream_data == 0) {
-            ret = -1;
-        } else {
-            stream_data->bytes = (uint8_t*)malloc(length);
-
-            if (stream_data->bytes == NULL) {
-                free(stream_data);
-                stream_data = NULL;
-                ret = -1;
-            } else {
-                picoquic_stream_data** pprevious = &stream->send_queue;
-                picoquic_stream_data* next = stream->send_queue;
-
-                memcpy(stream_data->bytes, data, length);
-                stream_data->length = length;
-                stream_data->offset = 0;
-                stream_data->next_stream_data = NULL;
-
-                while (next != NULL) {
-                    pprevious = &next->next_stream_data;
-                    next = next->next_stream_data;
-                }
+    if (ret == 0 && length > 0 && picoquic_is_send_buffer_full(cnx, stream)) {
+        /* The fin, if requested, waits with the data */
+        if (set_fin) {
+            stream->fin_requested = 0;
+        }
+        if (!stream->send_blocked) {
+            stream->send_blocked = 1;
+            cnx->nb_send_blocked++;
+        }
+        return PICOQUIC_ERROR_WOULD_BLOCK;
+    }
 
-                *pprevious = stream_data;
-                stream->sending_offset += length;
-            }
+    if (ret == 0 && length > 0) {
+        ret = picoquic_append_stream_data(cnx, &stream->send_queue, data, length, release_fn, release_ctx);
+        if (ret == 0) {
+            stream->sending_offset += length;
+            stream->send_buffered += length;
+            cnx->send_buffered += length;
         }
 
         LOG_EVENT(cnx, "application", "add_to_stream", "", "{\"stream\": \"%p\", \"stream_id\": %" PRIu64 ", \"data_ptr\": \"%p\", \"length\": %" PRIu64 ", \"fin\": %d, \"queued_size\": %" PRIu64 "}", stream, stream->stream_id, data, length, set_fin, stream->sending_offset - stream->sent_offset);
@@ -181,6 +295,28 @@ int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
         cnx->nb_bytes_queued += length;
         stream->is_active = 0;
         stream->app_stream_ctx = app_stream_ctx;
+        picoquic_mark_stream_ready(cnx, stream);
+    }
+
+    return ret;
+}
+
+int picoquic_add_to_stream_with_ctx(picoquic_cnx_t* cnx, uint64_t stream_id,
+    const uint8_t* data, size_t length, int set_fin, void *app_stream_ctx)
+{
+    return picoquic_queue_stream_data(cnx, stream_id, data, length, set_fin, app_stream_ctx, NULL, NULL);
+}
+
+int picoquic_add_buffer_to_stream(picoquic_cnx_t* cnx, uint64_t stream_id, const uint8_t* data, size_t length, int set_fin,
+    picoquic_stream_data_release_fn release_fn, void* release_ctx)
+{
+    picoquic_stream_head* stream = picoquic_find_stream(cnx, stream_id, false);
+    int ret = picoquic_queue_stream_data(cnx, stream_id, data, length, set_fin,
+        (stream != NULL) ? stream->app_stream_ctx : NULL, release_fn, release_ctx);
+
+    if (ret == 0 && length == 0 && release_fn != NULL) {
+        /* Nothing was queued, the buffer is not needed */
+        release_fn(release_ctx, data, length);
     }
 
     return ret;
@@ -191,6 +327,32 @@ int picoquic_add_to_stream(picoquic_cnx_t* cnx, uint64_t stream_id,
     return picoquic_add_to_stream_with_ctx(cnx, stream_id, data, length, set_fin, NULL);
 }
 
+/* Called once packets are prepared, when the application is free to write again.
+ * An error of the application closes the connection with the next packets. */
+static void picoquic_notify_send_buffer_low(picoquic_cnx_t* cnx)
+{
+    int ret = 0;
+    picoquic_send_watermarks_t* marks = &cnx->send_watermarks;
+
+    if (marks->cnx_high > 0 && cnx->send_buffered > marks->cnx_low) {
+        return;
+    }
+
+    for (picoquic_stream_head* stream = cnx->first_stream; ret == 0 && stream != NULL && cnx->nb_send_blocked > 0;
+        stream = stream->next_stream) {
+        if (stream->send_blocked && (marks->stream_high == 0 || stream->send_buffered <= marks->stream_low)) {
+            stream->send_blocked = 0;
+            cnx->nb_send_blocked--;
+            LOG_EVENT(cnx, "application", "callback", picoquic_log_fin_or_event_name(picoquic_callback_send_buffer_low),
+                "{\"stream_id\": %" PRIu64 ", \"buffered\": %" PRIu64 "}", stream->stream_id, stream->send_buffered);
+            if (cnx->callback_fn(cnx, stream->stream_id, NULL, (size_t)stream->send_buffered, picoquic_callback_send_buffer_low,
+                cnx->callback_ctx, stream->app_stream_ctx) != 0) {
+                ret = picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_INTERNAL_ERROR, 0);
+            }
+        }
+    }
+}
+
 int picoquic_reset_stream(picoquic_cnx_t* cnx,
     uint64_t stream_id, uint64_t local_stream_error)
 {
@@ -208,6 +370,7 @@ int picoquic_reset_stream(picoquic_cnx_t* cnx,
     else if (!stream->reset_requested) {
         stream->local_error = local_stream_error;
         stream->reset_requested = 1;
+        picoquic_mark_stream_ready(cnx, stream);
     }
 
     picoquic_cnx_set_next_wake_time(cnx, picoquic_get_quic_time(cnx->quic));
@@ -232,6 +395,7 @@ int picoquic_stop_sending(picoquic_cnx_t* cnx,
     else if (!stream->stop_sending_requested) {
         stream->local_stop_error = local_stream_error;
         stream->stop_sending_requested = 1;
+        picoquic_mark_stream_ready(cnx, stream);
     }
 
     picoquic_cnx_set_next_wake_time(cnx, picoquic_get_quic_time(cnx->quic));
@@ -242,8 +406,9 @@ int picoquic_stop_sending(picoquic_cnx_t* cnx,
 /*
  * Sending plugins
  */
-int picoquic_add_to_plugin_stream(picoquic_cnx_t* cnx, uint64_t pid_id,
-    const uint8_t* data, size_t length, int set_fin)
+/* If archive is set, data is its shared buffer, which is referenced instead of copied */
+static int picoquic_queue_to_plugin_stream(picoquic_cnx_t* cnx, uint64_t pid_id,
+    const uint8_t* data, size_t length, plugin_archive_t* archive, int set_fin)
 {
     int ret = 0;
     int is_unidir = 1;
@@ -294,7 +459,8 @@ int picoquic_add_to_plugin_stream(picoquic_cnx_t* cnx, uint64_t pid_id,
         if (stream_data == 0) {
             ret = -1;
         } else {
-            stream_data->bytes = (uint8_t*)malloc(length);
+            stream_data->bytes = archive != NULL ? archive->data : (uint8_t*)malloc(length);
+            stream_data->capacity = 0;
 
             if (stream_data->bytes == NULL) {
                 free(stream_data);
@@ -304,10 +470,18 @@ int picoquic_add_to_plugin_stream(picoquic_cnx_t* cnx, uint64_t pid_id,
                 picoquic_stream_data** pprevious = &stream->send_queue;
                 picoquic_stream_data* next = stream->send_queue;
 
-                memcpy(stream_data->bytes, data, length);
+                if (archive != NULL) {
+                    archive->refcount++;
+                } else {
+                    memcpy(stream_data->bytes, data, length);
+                }
+                stream_data->archive = archive;
+                stream_data->release_fn = NULL;
                 stream_data->length = length;
                 stream_data->offset = 0;
                 stream_data->next_stream_data = NULL;
+                stream_data->memory_category = picoquic_memory_plugins;
+                picoquic_memory_charge(cnx, picoquic_memory_plugins, picoquic_stream_data_footprint(stream_data));
 
                 while (next != NULL) {
                     pprevious = &next->next_stream_data;
@@ -323,37 +497,117 @@ int picoquic_add_to_plugin_stream(picoquic_cnx_t* cnx, uint64_t pid_id,
         picoquic_cnx_set_next_wake_time(cnx, picoquic_get_quic_time(cnx->quic));
     }
 
+    if (ret == 0) {
+        picoquic_mark_plugin_stream_ready(cnx, stream);
+    }
+
     return ret;
 }
 
+int picoquic_add_to_plugin_stream(picoquic_cnx_t* cnx, uint64_t pid_id,
+    const uint8_t* data, size_t length, int set_fin)
+{
+    return picoquic_queue_to_plugin_stream(cnx, pid_id, data, length, NULL, set_fin);
+}
+
+int picoquic_add_archive_to_plugin_stream(picoquic_cnx_t* cnx, uint64_t pid_id,
+    plugin_archive_t* archive, int set_fin)
+{
+    return picoquic_queue_to_plugin_stream(cnx, pid_id, archive->data, archive->data_len, archive, set_fin);
+}
+
 /*
  * Packet management
  */
 
+/* Largest packet that the connection may send, MTU probes included: it sets the size class of its packets */
+static uint32_t picoquic_cnx_max_packet_size(picoquic_cnx_t* cnx)
+{
+    uint32_t max_packet_size = cnx->quic->max_packet_size;
+
+    if (cnx->quic->mtu_max > 0 && cnx->quic->mtu_max < max_packet_size) {
+        max_packet_size = cnx->quic->mtu_max;
+    }
+    if (cnx->remote_parameters.max_packet_size > 0 && cnx->remote_parameters.max_packet_size < max_packet_size) {
+        max_packet_size = (uint32_t)cnx->remote_parameters.max_packet_size;
+    }
+
+    return max_packet_size;
+}
+
 picoquic_packet_t* picoquic_create_packet(picoquic_cnx_t *cnx)
 {
-    picoquic_packet_t* packet = (picoquic_packet_t*)malloc(sizeof(picoquic_packet_t));
+    picoquic_packet_t* packet;
+
+    if (cnx != NULL && cnx->quic != NULL) {
+        packet = picoquic_packet_pool_get(&cnx->quic->packet_pool, picoquic_cnx_max_packet_size(cnx));
+        if (packet != NULL) {
+            packet->pool = &cnx->quic->packet_pool;
+        }
+    } else {
+        packet = (picoquic_packet_t*)malloc(sizeof(picoquic_packet_t));
+        if (packet != NULL) {
+            memset(packet, 0, sizeof(picoquic_packet_t));
+            packet->bytes = (uint8_t*)malloc(PICOQUIC_MAX_PACKET_SIZE);
+            packet->bytes_max = PICOQUIC_MAX_PACKET_SIZE;
+            if (packet->bytes == NULL) {
+                free(packet);
+                packet = NULL;
+            }
+        }
+    }
 
     if (packet != NULL) {
-        memset(packet, 0, sizeof(picoquic_packet_t));
         packet->is_pure_ack = 1;
+        PICOQUIC_ALLOC_PROFILE(picoquic_alloc_site_packet, NULL, sizeof(picoquic_packet_t) + packet->bytes_max);
     }
 
     return packet;
 }
 
-void picoquic_destroy_packet(picoquic_packet_t *p)
+uint8_t* picoquic_packet_window(picoquic_packet_t *p, size_t offset, size_t length)
 {
-    if (p->metadata) {
+    if (p == NULL || offset > p->bytes_max || length > p->bytes_max - offset) {
+        return NULL;
+    }
+    return p->bytes + offset;
+}
 
-        plugin_struct_metadata_t *current_md, *tmp;
+/**
+ * See PROTOOP_NOPARAM_PACKET_WINDOW
+ */
+protoop_arg_t packet_window(picoquic_cnx_t *cnx)
+{
+    picoquic_packet_t* packet = (picoquic_packet_t *) cnx->protoop_inputv[0];
+    size_t offset = (size_t) cnx->protoop_inputv[1];
+    size_t length = (size_t) cnx->protoop_inputv[2];
+    uint8_t* buffer = (uint8_t *) cnx->protoop_inputv[3];
+    int is_write = (int) cnx->protoop_inputv[4];
+    uint8_t* window = picoquic_packet_window(packet, offset, length);
+
+    if (window == NULL || (buffer == NULL && length > 0)) {
+        return (protoop_arg_t) PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL;
+    }
+    if (is_write) {
+        memmove(window, buffer, length);
+    } else {
+        memmove(buffer, window, length);
+    }
 
-        HASH_ITER(hh, p->metadata, current_md, tmp) {
-            HASH_DEL(p->metadata,current_md);  /* delete; users advances to next */
-            free(current_md);            /* optional- if you want to free  */
-        }
+    return 0;
+}
+
+void picoquic_destroy_packet(picoquic_packet_t *p)
+{
+    if (p->metadata.overflow) {
+        plugin_metadata_free(&p->metadata);
+    }
+    if (p->pool != NULL) {
+        picoquic_packet_pool_put(p->pool, p);
+    } else {
+        free(p->bytes);
+        free(p);
     }
-    free(p);
 }
 
 void picoquic_update_payload_length(
@@ -418,6 +672,106 @@ picoquic_connection_id_t *picoquic_get_destination_connection_id(
         packet_type, path_x);
 }
 
+static uint8_t picoquic_long_packet_type_of(picoquic_packet_type_enum packet_type)
+{
+    uint8_t type = 0;
+
+    switch (packet_type) {
+    case picoquic_packet_initial:
+        type = picoquic_long_packet_type_initial;
+        break;
+    case picoquic_packet_retry:
+        type = picoquic_long_packet_type_retry;
+        break;
+    case picoquic_packet_handshake:
+        type = picoquic_long_packet_type_handshake;
+        break;
+    case picoquic_packet_0rtt_protected:
+        type = picoquic_long_packet_type_0rtt;
+        break;
+    default:
+        type = picoquic_long_packet_type_initial;
+        break;
+    }
+
+    return type;
+}
+
+/*
+ * Returns the header template of the packet type on the path, built if needed, or NULL if the header
+ * has to be created from scratch: a pluglet is attached to the header operations, the path is not the
+ * default one, whose CIDs the core operations use, or the client still proposes its first version.
+ */
+static picoquic_header_template_t* picoquic_get_header_template(picoquic_cnx_t* cnx,
+    picoquic_packet_type_enum packet_type, picoquic_path_t* path_x)
+{
+    picoquic_header_template_t* ht;
+    int epoch;
+
+    if (!cnx->plain_header_ops || path_x != cnx->path[0]) {
+        return NULL;
+    }
+
+    switch (packet_type) {
+    case picoquic_packet_initial:
+        if (cnx->cnx_state == picoquic_state_client_init || cnx->cnx_state == picoquic_state_client_init_sent) {
+            return NULL;
+        }
+        epoch = 0;
+        break;
+    case picoquic_packet_0rtt_protected:
+        epoch = 1;
+        break;
+    case picoquic_packet_handshake:
+        epoch = 2;
+        break;
+    case picoquic_packet_1rtt_protected_phi0:
+    case picoquic_packet_1rtt_protected_phi1:
+        epoch = 3;
+        break;
+    default:
+        return NULL;
+    }
+
+    ht = &path_x->header_templates[epoch];
+    if (ht->length == 0) {
+        picoquic_connection_id_t dest_cnx_id = *(picoquic_get_destination_connection_id(cnx, packet_type, path_x));
+        uint32_t length = 0;
+
+        if (epoch == 3) {
+            ht->bytes[length++] = 0x43;
+            length += picoquic_format_connection_id(&ht->bytes[length], PICOQUIC_HEADER_TEMPLATE_MAX - length, dest_cnx_id);
+        } else {
+            ht->bytes[length++] = (0xC0 | ((picoquic_long_packet_type_of(packet_type) & 3) << 4)) | 0x3;
+            picoformat_32(&ht->bytes[length], picoquic_supported_versions[cnx->version_index].version);
+            length += 4;
+            ht->bytes[length++] = dest_cnx_id.id_len;
+            length += picoquic_format_connection_id(&ht->bytes[length], PICOQUIC_HEADER_TEMPLATE_MAX - length, dest_cnx_id);
+            ht->bytes[length++] = path_x->local_cnxid.id_len;
+            length += picoquic_format_connection_id(&ht->bytes[length], PICOQUIC_HEADER_TEMPLATE_MAX - length, path_x->local_cnxid);
+        }
+        ht->length = (uint8_t)length;
+    }
+
+    return ht;
+}
+
+/* Same as predict_packet_header_length: the template, the token of the Initial packets, the payload length and the packet number */
+static uint32_t picoquic_header_template_predict(picoquic_cnx_t* cnx, picoquic_header_template_t* ht,
+    picoquic_packet_type_enum packet_type)
+{
+    uint32_t length = ht->length + 4;
+
+    if (packet_type != picoquic_packet_1rtt_protected_phi0 && packet_type != picoquic_packet_1rtt_protected_phi1) {
+        length += 2;
+        if (packet_type == picoquic_packet_initial) {
+            length += (uint32_t)picoquic_varint_len(cnx->retry_token_length) + cnx->retry_token_length;
+        }
+    }
+
+    return length;
+}
+
 uint32_t picoquic_create_packet_header(
     picoquic_cnx_t* cnx,
     picoquic_packet_type_enum packet_type,
@@ -428,12 +782,39 @@ uint32_t picoquic_create_packet_header(
     uint32_t * pn_length)
 {
     uint32_t length = 0;
+    picoquic_header_template_t* ht = picoquic_get_header_template(cnx, packet_type, path_x);
+
+    if (ht != NULL) {
+        memcpy(bytes, ht->bytes, ht->length);
+        length = ht->length;
+        if (packet_type == picoquic_packet_1rtt_protected_phi0 || packet_type == picoquic_packet_1rtt_protected_phi1) {
+            bytes[0] |= (cnx->current_spin ? 0x20 : 0) | (cnx->key_phase_enc ? 0x4 : 0);
+        } else {
+            if (packet_type == picoquic_packet_initial) {
+                length += (uint32_t)picoquic_varint_encode(&bytes[length], PICOQUIC_MAX_PACKET_SIZE - length, cnx->retry_token_length);
+                if (cnx->retry_token_length > 0) {
+                    memcpy(&bytes[length], cnx->retry_token, cnx->retry_token_length);
+                    length += cnx->retry_token_length;
+                }
+            }
+            bytes[length++] = 0;
+            bytes[length++] = 0;
+        }
+        *pn_offset = length;
+        *pn_length = 4;
+        picoformat_32(bytes + length, sequence_number);
+        length += 4;
+
+        return length;
+    }
+
     picoquic_connection_id_t dest_cnx_id = * (picoquic_get_destination_connection_id(cnx, packet_type, path_x));
 
     /* Prepare the packet header */
     if (packet_type == picoquic_packet_1rtt_protected_phi0 || packet_type == picoquic_packet_1rtt_protected_phi1) {
         /* Create a short packet -- using 32 bit sequence numbers for now */
-        uint8_t K = (packet_type == picoquic_packet_1rtt_protected_phi0) ? 0 : 0x4;
+        /* The key phase is that of the key protecting the packet, whatever the type the packet was built with */
+        uint8_t K = (cnx->key_phase_enc) ? 0x4 : 0;
         uint8_t spin_bit = cnx->current_spin ? 0x20 : 0;
 
         length = 0;
@@ -447,25 +828,8 @@ uint32_t picoquic_create_packet_header(
     }
     else {
         /* Create a long packet */
-        uint8_t type = 0;
+        uint8_t type = picoquic_long_packet_type_of(packet_type);
 
-        switch (packet_type) {
-        case picoquic_packet_initial:
-            type = picoquic_long_packet_type_initial;
-            break;
-        case picoquic_packet_retry:
-            type = picoquic_long_packet_type_retry;
-            break;
-        case picoquic_packet_handshake:
-            type = picoquic_long_packet_type_handshake;
-            break;
-        case picoquic_packet_0rtt_protected:
-            type = picoquic_long_packet_type_0rtt;
-            break;
-        default:
-            type = picoquic_long_packet_type_initial;
-            break;
-        }
         bytes[0] = (0xC0 | ((type & 3) << 4)) | 0x3;
 
         length = 1;
@@ -563,6 +927,11 @@ uint32_t picoquic_predict_packet_header_length(
     picoquic_packet_type_enum packet_type,
     picoquic_path_t* path_x)
 {
+    picoquic_header_template_t* ht = picoquic_get_header_template(cnx, packet_type, path_x);
+
+    if (ht != NULL) {
+        return picoquic_header_template_predict(cnx, ht, packet_type);
+    }
     return (uint32_t) protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_PREDICT_PACKET_HEADER_LENGTH, NULL,
         packet_type, path_x);
 }
@@ -570,18 +939,20 @@ uint32_t picoquic_predict_packet_header_length(
 /**
  * See PROTOOP_NOPARAM_GET_CHECKSUM_LENGTH
  */
-protoop_arg_t get_checksum_length(picoquic_cnx_t *cnx)
+static uint32_t picoquic_checksum_length_core(picoquic_cnx_t* cnx, int is_cleartext_mode)
 {
-    int is_cleartext_mode = (int) cnx->protoop_inputv[0];
-    uint32_t ret = 16;
-
     if (is_cleartext_mode || cnx->crypto_context[2].aead_encrypt == NULL) {
-        ret = picoquic_aead_get_checksum_length(cnx->crypto_context[0].aead_encrypt);
+        return (uint32_t)picoquic_aead_get_checksum_length(cnx->crypto_context[0].aead_encrypt);
     } else {
-        ret = picoquic_aead_get_checksum_length(cnx->crypto_context[2].aead_encrypt);
+        return (uint32_t)picoquic_aead_get_checksum_length(cnx->crypto_context[2].aead_encrypt);
     }
+}
 
-    return (protoop_arg_t) ret;
+protoop_arg_t get_checksum_length(picoquic_cnx_t *cnx)
+{
+    int is_cleartext_mode = (int) cnx->protoop_inputv[0];
+
+    return (protoop_arg_t) picoquic_checksum_length_core(cnx, is_cleartext_mode);
 }
 
 /*
@@ -589,10 +960,45 @@ protoop_arg_t get_checksum_length(picoquic_cnx_t *cnx)
  */
 uint32_t picoquic_get_checksum_length(picoquic_cnx_t* cnx, int is_cleartext_mode)
 {
+    if (cnx->plain_checksum_op) {
+        return picoquic_checksum_length_core(cnx, is_cleartext_mode);
+    }
     return (uint32_t) protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_GET_CHECKSUM_LENGTH, NULL,
         is_cleartext_mode);
 }
 
+static void picoquic_apply_hp_mask(uint8_t* header, uint32_t pn_offset, uint8_t first_mask, const uint8_t* mask)
+{
+    /* Encode the first byte */
+    uint8_t pn_l = (header[0] & 3) + 1;
+
+    header[0] ^= (mask[0] & first_mask);
+
+    /* Packet encoding is 1 to 4 bytes */
+    for (uint8_t i = 0; i < pn_l; i++) {
+        header[pn_offset + i] ^= mask[i + 1];
+    }
+}
+
+static void* picoquic_get_hp_ecb(picoquic_cnx_t* cnx, void* hp_enc)
+{
+    void* hp_ecb = NULL;
+
+    for (int epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS && hp_ecb == NULL; epoch++) {
+        if (cnx->crypto_context[epoch].hp_enc == hp_enc) {
+            hp_ecb = cnx->crypto_context[epoch].hp_ecb;
+        }
+    }
+
+    return hp_ecb;
+}
+
+/*
+ * The clear text of the packet stays in packet->bytes, where the frames were written, since the
+ * retransmission logic reads the frames from there. The header is created directly in send_buffer
+ * and the AEAD reads the payload from bytes and writes it there, so sealing touches the payload a
+ * single time and send_buffer is what goes to the socket.
+ */
 uint32_t picoquic_protect_packet(picoquic_cnx_t* cnx,
     picoquic_packet_type_enum ptype,
     uint8_t * bytes,
@@ -642,7 +1048,10 @@ uint32_t picoquic_protect_packet(picoquic_cnx_t* cnx,
     send_length += /* header_length */ h_length;
 
     /* if needed, log the segment */
-    if (cnx->quic->F_log != NULL) {
+    if (cnx->quic->F_binlog != NULL) {
+        picoquic_binlog_outgoing_segment(cnx, ptype, sequence_number, send_buffer, h_length,
+            bytes + header_length, length - header_length);
+    } else if (cnx->quic->F_log != NULL) {
         picoquic_log_outgoing_segment(cnx->quic->F_log, 1, cnx,
                                       bytes, sequence_number, length,
                                       send_buffer, send_length);
@@ -655,17 +1064,21 @@ uint32_t picoquic_protect_packet(picoquic_cnx_t* cnx,
     {
         uint8_t first_mask = (ph->ptype == picoquic_packet_1rtt_protected_phi0 || ph->ptype == picoquic_packet_1rtt_protected_phi1) ? 0x1F : 0x0F;
         /* This is always true, as use pn_length = 4 */
-        uint8_t mask[5] = { 0, 0, 0, 0, 0 };
-        uint8_t pn_l;
 
-        picoquic_hp_encrypt(pn_enc, send_buffer + sample_offset, mask, mask, 5);
-        /* Encode the first byte */
-        pn_l = (send_buffer[0] & 3) + 1;
-        send_buffer[0] ^= (mask[0] & first_mask);
+        if (cnx->hp_batch != NULL && cnx->hp_batch->nb_entries < PICOQUIC_HP_BATCH_MAX) {
+            /* Only the header changes, the samples of the packets already in the batch stay as they are */
+            picoquic_hp_batch_entry_t* entry = &cnx->hp_batch->entries[cnx->hp_batch->nb_entries++];
+
+            entry->header = send_buffer;
+            entry->hp_enc = pn_enc;
+            entry->hp_ecb = picoquic_get_hp_ecb(cnx, pn_enc);
+            entry->pn_offset = pn_offset;
+            entry->first_mask = first_mask;
+        } else {
+            uint8_t mask[5] = { 0, 0, 0, 0, 0 };
 
-        /* Packet encoding is 1 to 4 bytes */
-        for (uint8_t i = 0; i < pn_l; i++) {
-            send_buffer[pn_offset+i] ^= mask[i+1];
+            picoquic_hp_encrypt(pn_enc, send_buffer + sample_offset, mask, mask, 5);
+            picoquic_apply_hp_mask(send_buffer, pn_offset, first_mask, mask);
         }
     }
 
@@ -673,13 +1086,38 @@ uint32_t picoquic_protect_packet(picoquic_cnx_t* cnx,
     return send_length;
 }
 
+void picoquic_hp_batch_flush(picoquic_hp_batch_t* batch)
+{
+    size_t first = 0;
+
+    /* The packets of a burst usually share the same key, each run of them is computed at once */
+    while (first < batch->nb_entries) {
+        const uint8_t* samples[PICOQUIC_HP_BATCH_MAX];
+        uint8_t masks[5 * PICOQUIC_HP_BATCH_MAX];
+        size_t nb = 0;
+
+        while (first + nb < batch->nb_entries && batch->entries[first + nb].hp_enc == batch->entries[first].hp_enc) {
+            samples[nb] = batch->entries[first + nb].header + batch->entries[first + nb].pn_offset + 4;
+            nb++;
+        }
+        picoquic_hp_mask_batch(batch->entries[first].hp_enc, batch->entries[first].hp_ecb, samples, masks, nb);
+        for (size_t i = 0; i < nb; i++) {
+            picoquic_hp_batch_entry_t* entry = &batch->entries[first + i];
+
+            picoquic_apply_hp_mask(entry->header, entry->pn_offset, entry->first_mask, masks + 5 * i);
+        }
+        first += nb;
+    }
+    batch->nb_entries = 0;
+}
+
 
 /* Update the leaky bucket used for pacing.
  */
 static void picoquic_update_pacing_bucket(picoquic_path_t * path_x, uint64_t current_time)
 {
     if (current_time > path_x->pacing_evaluation_time) {
-        path_x->pacing_bucket_nanosec += (current_time - path_x->pacing_evaluation_time) << 10;
+        path_x->pacing_bucket_nanosec += (current_time - path_x->pacing_evaluation_time) * 1000;
         path_x->pacing_evaluation_time = current_time;
         if (path_x->pacing_bucket_nanosec > path_x->pacing_bucket_max) {
             path_x->pacing_bucket_nanosec = path_x->pacing_bucket_max;
@@ -687,23 +1125,82 @@ static void picoquic_update_pacing_bucket(picoquic_path_t * path_x, uint64_t cur
     }
 }
 
+/* Departure time of the next packet, when the pacing is offloaded to the kernel.
+ * As with the bucket, a path that was idle may send up to pacing_bucket_max worth of packets at once.
+ */
+static uint64_t picoquic_next_departure_nanosec(picoquic_path_t * path_x, uint64_t current_time)
+{
+    uint64_t now_nanosec = current_time * 1000;
+
+    if (path_x->pacing_departure_nanosec + path_x->pacing_bucket_max < now_nanosec) {
+        path_x->pacing_departure_nanosec = now_nanosec - path_x->pacing_bucket_max;
+    }
+
+    return (path_x->pacing_departure_nanosec > now_nanosec) ? path_x->pacing_departure_nanosec : now_nanosec;
+}
+
+/* Packets per pacing decision, 0 being the same as 1 */
+static uint64_t picoquic_pacing_burst(picoquic_path_t * path_x)
+{
+    return (path_x->pacing_burst > 1) ? path_x->pacing_burst : 1;
+}
+
+/* The packets of a train are authorized together, once the bucket holds the transmission time of all of them */
+static uint64_t picoquic_pacing_train_nanosec(picoquic_path_t * path_x)
+{
+    uint64_t train_nanosec = picoquic_pacing_burst(path_x) * path_x->pacing_packet_time_nanosec;
+
+    return (train_nanosec > path_x->pacing_bucket_max) ? path_x->pacing_bucket_max : train_nanosec;
+}
+
+static int picoquic_is_in_pacing_train(picoquic_path_t * path_x, uint64_t current_time)
+{
+    return path_x->pacing_train_remaining > 0 && path_x->pacing_train_start == current_time;
+}
+
 /*
  * Check pacing to see whether the next transmission is authorized.
  * If it is not, update the next wait time to reflect pacing.
- * -
+ * The decision is made once per train of pacing_burst packets, the following ones prepared at the
+ * same time being authorized without waiting, so that they can leave in one segmentation offload batch.
+ * When the pacing is offloaded, the packet is authorized if it departs within the horizon.
  */
 int picoquic_is_sending_authorized_by_pacing(picoquic_path_t * path_x, uint64_t current_time, uint64_t * next_time)
 {
     int ret = 1;
 
-    picoquic_update_pacing_bucket(path_x, current_time);
+    if (path_x->pacing_offload_horizon > 0) {
+        uint64_t departure_time = picoquic_next_departure_nanosec(path_x, current_time) / 1000;
 
-    if (path_x->pacing_bucket_nanosec <= 0) {
-        uint64_t next_pacing_time = current_time + path_x->pacing_packet_time_microsec;
-        if (next_pacing_time < *next_time) {
-            *next_time = next_pacing_time;
+        if (departure_time > current_time + path_x->pacing_offload_horizon) {
+            uint64_t next_pacing_time = departure_time - path_x->pacing_offload_horizon;
+            if (next_pacing_time < *next_time) {
+                *next_time = next_pacing_time;
+            }
+            ret = 0;
         }
-        ret = 0;
+    } else if (!picoquic_is_in_pacing_train(path_x, current_time)) {
+        uint64_t train_nanosec;
+
+        picoquic_update_pacing_bucket(path_x, current_time);
+        train_nanosec = picoquic_pacing_train_nanosec(path_x);
+
+        if (path_x->pacing_bucket_nanosec >= train_nanosec) {
+            path_x->pacing_train_start = current_time;
+            path_x->pacing_train_remaining = picoquic_pacing_burst(path_x);
+        } else {
+            /* Wait until the bucket refills, rounding up to the microsecond of the clock */
+            uint64_t next_pacing_time = current_time + (train_nanosec - path_x->pacing_bucket_nanosec + 999) / 1000;
+            if (next_pacing_time < *next_time) {
+                *next_time = next_pacing_time;
+            }
+            path_x->pacing_train_remaining = 0;
+            ret = 0;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_path_set_send_limit(path_x, picoquic_send_limit_pacing, current_time);
     }
 
     return ret;
@@ -727,13 +1224,17 @@ void picoquic_update_pacing_rate(picoquic_path_t* path_x, double pacing_rate, ui
         path_x->pacing_packet_time_microsec = 1;
     }
     else {
-        path_x->pacing_packet_time_microsec = (path_x->pacing_packet_time_nanosec + 1023ull) / 1000;
+        path_x->pacing_packet_time_microsec = (path_x->pacing_packet_time_nanosec + 999ull) / 1000;
     }
 
     path_x->pacing_bucket_max = (uint64_t)(quantum_time * 1000000000.0);
     if (path_x->pacing_bucket_max <= 0) {
         path_x->pacing_bucket_max = 16 * path_x->pacing_packet_time_nanosec;
     }
+    /* The bucket has to hold a full train, plus the microsecond to which the wake up time is rounded */
+    if (path_x->pacing_bucket_max < picoquic_pacing_burst(path_x) * path_x->pacing_packet_time_nanosec + 1000) {
+        path_x->pacing_bucket_max = picoquic_pacing_burst(path_x) * path_x->pacing_packet_time_nanosec + 1000;
+    }
 
     if (path_x->pacing_bucket_nanosec > path_x->pacing_bucket_max) {
         path_x->pacing_bucket_nanosec = path_x->pacing_bucket_max;
@@ -761,12 +1262,15 @@ void picoquic_update_pacing_data(picoquic_path_t * path_x)
     else {
         double pacing_rate = ((double)path_x->cwin / (double)rtt_nanosec) * 1000000000.0;
         uint64_t quantum = path_x->cwin / 4;
+        uint64_t nb_burst = picoquic_pacing_burst(path_x);
+        uint64_t quantum_min = ((nb_burst > 2) ? nb_burst : 2) * path_x->send_mtu;
+        uint64_t quantum_max = ((nb_burst > 16) ? nb_burst : 16) * path_x->send_mtu;
 
-        if (quantum < 2ull * path_x->send_mtu) {
-            quantum = 2ull * path_x->send_mtu;
+        if (quantum < quantum_min) {
+            quantum = quantum_min;
         }
-        else if (quantum > 16ull * path_x->send_mtu) {
-            quantum = 16ull * path_x->send_mtu;
+        else if (quantum > quantum_max) {
+            quantum = quantum_max;
         }
 
         picoquic_update_pacing_rate(path_x, pacing_rate, quantum);
@@ -778,15 +1282,145 @@ void picoquic_update_pacing_data(picoquic_path_t * path_x)
  */
 void picoquic_update_pacing_after_send(picoquic_path_t * path_x, uint64_t current_time)
 {
-    picoquic_update_pacing_bucket(path_x, current_time);
+    if (path_x->pacing_offload_horizon > 0) {
+        /* The packets of a train share the departure time of the first one */
+        if (!picoquic_is_in_pacing_train(path_x, current_time)) {
+            path_x->pacing_train_start = current_time;
+            path_x->pacing_train_remaining = picoquic_pacing_burst(path_x);
+            path_x->pacing_last_departure_time = picoquic_next_departure_nanosec(path_x, current_time) / 1000;
+        }
+        path_x->pacing_departure_nanosec += path_x->pacing_packet_time_nanosec;
+    } else {
+        path_x->pacing_last_departure_time = current_time;
+        picoquic_update_pacing_bucket(path_x, current_time);
+
+        if (path_x->pacing_bucket_nanosec < path_x->pacing_packet_time_nanosec) {
+            path_x->pacing_bucket_nanosec = 0;
+        } else {
+            path_x->pacing_bucket_nanosec -= path_x->pacing_packet_time_nanosec;
+        }
+    }
+
+    if (path_x->pacing_train_remaining > 0) {
+        path_x->pacing_train_remaining--;
+    }
+}
+
+uint64_t picoquic_get_departure_time(picoquic_path_t * path_x)
+{
+    return path_x->pacing_last_departure_time;
+}
+
+
+/*
+ * Index of the retransmit queue by packet number.
+ * The queue is sorted by sequence number, so that its packets fit in a ring as long as the ring
+ * is larger than the distance between the oldest and the newest. The ring is doubled when it is not,
+ * and dropped if the queue ever becomes out of order, in which case the lookups walk the queue.
+ */
+
+#define PICOQUIC_RETRANSMIT_INDEX_MIN 64
+
+static int picoquic_retransmit_index_build(picoquic_packet_context_t* pkt_ctx, uint64_t span)
+{
+    uint64_t size = (pkt_ctx->retransmit_index == NULL) ? PICOQUIC_RETRANSMIT_INDEX_MIN : pkt_ctx->retransmit_index_mask + 1;
+    picoquic_packet_t** index;
+
+    while (size <= span) {
+        size *= 2;
+    }
+    index = (picoquic_packet_t**)calloc((size_t)size, sizeof(picoquic_packet_t*));
+    if (index == NULL) {
+        return -1;
+    }
+
+    for (picoquic_packet_t* p = pkt_ctx->retransmit_oldest; p != NULL; p = p->previous_packet) {
+        picoquic_packet_t** slot = &index[p->sequence_number & (size - 1)];
+        if (*slot != NULL) {
+            free(index);
+            return -1;
+        }
+        *slot = p;
+    }
+
+    free(pkt_ctx->retransmit_index);
+    pkt_ctx->retransmit_index = index;
+    pkt_ctx->retransmit_index_mask = size - 1;
+    return 0;
+}
+
+static void picoquic_retransmit_index_break(picoquic_packet_context_t* pkt_ctx)
+{
+    picoquic_retransmit_index_free(pkt_ctx);
+    pkt_ctx->retransmit_index_broken = 1;
+}
+
+/* Must be called once packet is the newest of the queue */
+void picoquic_retransmit_index_add(picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* packet)
+{
+    uint64_t oldest = pkt_ctx->retransmit_oldest->sequence_number;
 
-    if (path_x->pacing_bucket_nanosec < path_x->pacing_packet_time_nanosec) {
-        path_x->pacing_bucket_nanosec = 0;
+    if (pkt_ctx->retransmit_index_broken) {
+        return;
+    }
+    if (packet->next_packet != NULL && packet->next_packet->sequence_number >= packet->sequence_number) {
+        picoquic_retransmit_index_break(pkt_ctx);
+    } else if (pkt_ctx->retransmit_index == NULL || packet->sequence_number - oldest > pkt_ctx->retransmit_index_mask) {
+        if (picoquic_retransmit_index_build(pkt_ctx, packet->sequence_number - oldest) != 0) {
+            picoquic_retransmit_index_break(pkt_ctx);
+        }
     } else {
-        path_x->pacing_bucket_nanosec -= path_x->pacing_packet_time_nanosec;
+        pkt_ctx->retransmit_index[packet->sequence_number & pkt_ctx->retransmit_index_mask] = packet;
     }
 }
 
+/* Must be called once packet is unlinked from the queue */
+void picoquic_retransmit_index_remove(picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* packet)
+{
+    if (pkt_ctx->retransmit_index != NULL) {
+        picoquic_packet_t** slot = &pkt_ctx->retransmit_index[packet->sequence_number & pkt_ctx->retransmit_index_mask];
+        if (*slot == packet) {
+            *slot = NULL;
+        }
+    }
+    if (pkt_ctx->retransmit_newest == NULL) {
+        pkt_ctx->retransmit_index_broken = 0;
+    }
+}
+
+void picoquic_retransmit_index_free(picoquic_packet_context_t* pkt_ctx)
+{
+    free(pkt_ctx->retransmit_index);
+    pkt_ctx->retransmit_index = NULL;
+    pkt_ctx->retransmit_index_mask = 0;
+}
+
+/*
+ * Returns the newest packet of the queue whose sequence number is at most sequence_number,
+ * p being a queued packet not older than it, or NULL if there is none.
+ */
+picoquic_packet_t* picoquic_retransmit_index_floor(picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* p, uint64_t sequence_number)
+{
+    if (p == NULL || p->sequence_number <= sequence_number) {
+        return p;
+    }
+    if (pkt_ctx->retransmit_index == NULL) {
+        while (p != NULL && p->sequence_number > sequence_number) {
+            p = p->next_packet;
+        }
+        return p;
+    }
+    if (pkt_ctx->retransmit_oldest->sequence_number > sequence_number) {
+        return NULL;
+    }
+    /* The oldest packet is in the index, which stops the search */
+    for (uint64_t s = sequence_number;; s--) {
+        picoquic_packet_t* slot = pkt_ctx->retransmit_index[s & pkt_ctx->retransmit_index_mask];
+        if (slot != NULL && slot->sequence_number == s) {
+            return slot;
+        }
+    }
+}
 
 /*
  * Final steps in packet transmission: queue for retransmission, etc
@@ -803,6 +1437,10 @@ void picoquic_queue_for_retransmit(picoquic_cnx_t* cnx, picoquic_path_t * path_x
         LOG_EVENT(cnx, "recovery", "metrics_updated", "queue_for_retransmit", "{\"path\": \"%p\", \"bytes_in_flight\": %" PRIu64 "}", path_x, path_x->bytes_in_transit);
     }
 
+    if (!packet->is_pure_ack) {
+        path_x->pkt_ctx[pc].latest_ack_eliciting_time = current_time;
+    }
+
     /* Manage the double linked packet list for retransmissions */
     packet->previous_packet = NULL;
     if (path_x->pkt_ctx[pc].retransmit_newest == NULL) {
@@ -813,6 +1451,8 @@ void picoquic_queue_for_retransmit(picoquic_cnx_t* cnx, picoquic_path_t * path_x
         packet->next_packet->previous_packet = packet;
     }
     path_x->pkt_ctx[pc].retransmit_newest = packet;
+    picoquic_retransmit_index_add(&path_x->pkt_ctx[pc], packet);
+    picoquic_memory_charge(cnx, picoquic_memory_retransmit, sizeof(picoquic_packet_t) + packet->bytes_max);
 
     /* Update the pacing data */
     picoquic_update_pacing_after_send(path_x, current_time);
@@ -826,14 +1466,35 @@ void remove_registered_plugin_frames(picoquic_cnx_t *cnx, int received, picoquic
     while (pppf) {
         tmp = pppf;
         tmp->plugin->bytes_in_flight -= tmp->bytes;
+        cnx->plugin_bytes_in_flight -= tmp->bytes;
         pppf = tmp->next;
         LOG_EVENT(cnx, "plugins", "metrics_updated", "dequeue_retransmit_packet", "{\"plugin\": \"%s\", \"bytes_in_flight\": %" PRIu64 "}", tmp->plugin->name, tmp->plugin->bytes_in_flight);
-        protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_NOTIFY_FRAME, tmp->rfs->frame_type, NULL, tmp->rfs, received);
-        free(tmp);
+        protoop_run_frame_op(cnx, picoquic_frame_op_notify, &PROTOOP_PARAM_NOTIFY_FRAME, tmp->rfs->frame_type, NULL,
+            2, (protoop_arg_t[2]) {PROTOOP_ARG(tmp->rfs), PROTOOP_ARG(received)});
+        if (p->pool != NULL) {
+            picoquic_packet_pool_put_frame(p->pool, tmp);
+        } else {
+            free(tmp);
+        }
     }
     p->plugin_frames = NULL;
 }
 
+/* Once the frames of a lost packet are sent again, detecting a spurious retransmission only takes its header fields */
+static void picoquic_drop_packet_payload(picoquic_cnx_t* cnx, picoquic_packet_t* p)
+{
+    uint32_t bytes_max = p->bytes_max;
+
+    if (p->pool != NULL) {
+        picoquic_packet_pool_drop_payload(p->pool, p);
+    } else {
+        free(p->bytes);
+        p->bytes = NULL;
+        p->bytes_max = 0;
+    }
+    picoquic_memory_release(cnx, picoquic_memory_retransmit, bytes_max - p->bytes_max);
+}
+
 /**
  * See PROTOOP_NOPARAM_DEQUEUE_RETRANSMIT_PACKET
  */
@@ -868,6 +1529,7 @@ protoop_arg_t dequeue_retransmit_packet(picoquic_cnx_t *cnx)
 #endif
         p->next_packet->previous_packet = p->previous_packet;
     }
+    picoquic_retransmit_index_remove(&send_path->pkt_ctx[pc], p);
 
     /* Account for bytes in transit, for congestion control, only if the packet is marked as contributing to congestion */
     if (p->is_congestion_controlled) {
@@ -881,6 +1543,7 @@ protoop_arg_t dequeue_retransmit_packet(picoquic_cnx_t *cnx)
 
     remove_registered_plugin_frames(cnx, should_free, p);
     if (should_free) {
+        picoquic_memory_release(cnx, picoquic_memory_retransmit, sizeof(picoquic_packet_t) + p->bytes_max);
         picoquic_destroy_packet(p);
     }
     else {
@@ -899,6 +1562,7 @@ protoop_arg_t dequeue_retransmit_packet(picoquic_cnx_t *cnx)
             p->previous_packet = send_path->pkt_ctx[pc].retransmitted_oldest;
             send_path->pkt_ctx[pc].retransmitted_oldest = p;
         }
+        picoquic_drop_packet_payload(cnx, p);
     }
 
     return 0;
@@ -943,6 +1607,7 @@ protoop_arg_t dequeue_retransmitted_packet(picoquic_cnx_t *cnx)
         p->next_packet->previous_packet = p->previous_packet;
     }
 
+    picoquic_memory_release(cnx, picoquic_memory_retransmit, sizeof(picoquic_packet_t) + p->bytes_max);
     picoquic_destroy_packet(p);
 
     return 0;
@@ -977,14 +1642,61 @@ void picoquic_implicit_handshake_ack(picoquic_cnx_t* cnx, picoquic_path_t *path,
                                                 0, p->length, 0, current_time);
             }
         }
-        /* Update the number of bytes in transit and remove old packet from queue */
-        /* The packet will not be placed in the "retransmitted" queue */
-        (void)picoquic_dequeue_retransmit_packet(cnx, p, 1);
+        /* Update the number of bytes in transit and remove old packet from queue */
+        /* The packet will not be placed in the "retransmitted" queue */
+        (void)picoquic_dequeue_retransmit_packet(cnx, p, 1);
+
+        p = p_next;
+    }
+}
+
+
+/*
+ * Records the frames of a packet that is about to be sent. If they do not all fit in the summary, has_frame_summary
+ * stays unset and the packet is parsed again when it is acknowledged or lost.
+ */
+void picoquic_summarize_packet_frames(picoquic_cnx_t* cnx, picoquic_packet_t* p)
+{
+    size_t byte_index = p->offset;
+
+    p->has_frame_summary = 0;
+    p->nb_frame_summaries = 0;
+
+    while (byte_index < p->length) {
+        picoquic_frame_summary_t* fs;
+        picoquic_packet_plugin_frame_t* ppf = p->plugin_frames;
+        size_t frame_length = 0;
+        int frame_is_pure_ack = 0;
+
+        if (p->nb_frame_summaries >= PICOQUIC_FRAME_SUMMARY_MAX) {
+            return;
+        }
+        fs = &p->frame_summary[p->nb_frame_summaries];
+
+        while (ppf != NULL && ppf->frame_offset != byte_index - p->offset) {
+            ppf = ppf->next;
+        }
+        if (ppf != NULL) {
+            frame_length = ppf->bytes;
+        } else if (picoquic_skip_frame(cnx, &p->bytes[byte_index], p->length - byte_index,
+            &frame_length, &frame_is_pure_ack) != 0) {
+            return;
+        }
+        if (frame_length == 0 || frame_length > p->length - byte_index) {
+            return;
+        }
 
-        p = p_next;
+        fs->offset = (uint16_t) byte_index;
+        fs->length = (uint16_t) frame_length;
+        fs->type = (p->bytes[byte_index] < 0x40) ? p->bytes[byte_index] : PICOQUIC_FRAME_SUMMARY_TYPE_OTHER;
+        fs->is_pure_ack = (frame_is_pure_ack != 0);
+        fs->is_plugin_frame = (ppf != NULL);
+        p->nb_frame_summaries++;
+        byte_index += frame_length;
     }
-}
 
+    p->has_frame_summary = 1;
+}
 
 /*
  * Final steps of encoding and protecting the packet before sending
@@ -1060,6 +1772,7 @@ protoop_arg_t finalize_and_protect_packet(picoquic_cnx_t *cnx)
 
         if (length > 0) {
             packet->checksum_overhead = checksum_overhead;
+            picoquic_summarize_packet_frames(cnx, packet);
             picoquic_header_prepared(cnx, &ph, path_x, packet, length);
             picoquic_queue_for_retransmit(cnx, path_x, packet, length, current_time);
         } else {
@@ -1097,6 +1810,59 @@ void picoquic_finalize_and_protect_packet(picoquic_cnx_t *cnx, picoquic_packet_t
 /**
  * See PROTOOP_NOPARAM_RETRANSMIT_NEEDED_BY_PACKET
  */
+/*
+ * Time after which a packet followed by acknowledged ones is deemed lost, as in RFC 9002:
+ * 9/8 of the largest of the smoothed and latest RTT, plus the 1/8 of RTT that the path adds
+ * each time a loss declared that way turned out to be spurious.
+ */
+uint64_t picoquic_loss_time_threshold(picoquic_path_t* path_x)
+{
+    uint64_t rtt = (path_x->rtt_sample > path_x->smoothed_rtt) ? path_x->rtt_sample : path_x->smoothed_rtt;
+    uint64_t threshold = rtt + (rtt >> 3) * (1 + path_x->reorder_window_mult);
+
+    if (threshold < PICOQUIC_ACK_DELAY_MIN) {
+        threshold = PICOQUIC_ACK_DELAY_MIN;
+    }
+
+    return threshold;
+}
+
+/*
+ * Probe timeout of a packet number space, as in RFC 9002. The retransmit timer of the path
+ * is srtt + 4*rttvar + max_ack_delay; the peer does not delay the acknowledgements of the
+ * initial and handshake packets, so the ack delay only counts for the application space.
+ * Each probe timeout in a row since the last acknowledgement doubles the duration.
+ */
+uint64_t picoquic_pto_duration(picoquic_path_t* path_x, picoquic_packet_context_enum pc)
+{
+    uint64_t pto = path_x->retransmit_timer;
+    uint64_t nb_pto = path_x->pkt_ctx[pc].nb_retransmit;
+
+    if (pc != picoquic_packet_context_application && pto > path_x->max_ack_delay) {
+        pto -= path_x->max_ack_delay;
+    }
+    if (pto < PICOQUIC_MIN_RETRANSMIT_TIMER) {
+        pto = PICOQUIC_MIN_RETRANSMIT_TIMER;
+    }
+    if (nb_pto > PICOQUIC_PTO_COUNT_MAX) {
+        nb_pto = PICOQUIC_PTO_COUNT_MAX;
+    }
+
+    return pto << nb_pto;
+}
+
+/* The probe timer runs from the last ack-eliciting packet sent in the space, the oldest one if older */
+uint64_t picoquic_pto_time(picoquic_path_t* path_x, picoquic_packet_context_enum pc, picoquic_packet_t* p)
+{
+    uint64_t pto_start = p->send_time;
+
+    if (path_x->pkt_ctx[pc].latest_ack_eliciting_time > pto_start) {
+        pto_start = path_x->pkt_ctx[pc].latest_ack_eliciting_time;
+    }
+
+    return pto_start + picoquic_pto_duration(path_x, pc);
+}
+
 protoop_arg_t retransmit_needed_by_packet(picoquic_cnx_t *cnx)
 {
     picoquic_packet_t *p = (picoquic_packet_t *) cnx->protoop_inputv[0];
@@ -1113,7 +1879,7 @@ protoop_arg_t retransmit_needed_by_packet(picoquic_cnx_t *cnx)
 
     if (delta_seq > 0) {
         /* By default, we use timer based RACK logic to absorb out of order deliveries */
-        retransmit_time = p->send_time + send_path->smoothed_rtt + (send_path->smoothed_rtt >> 3);
+        retransmit_time = p->send_time + picoquic_loss_time_threshold(send_path);
         is_timer_based = 0;
 
         /* RACK logic fails when the smoothed RTT is too small, in which case we
@@ -1126,10 +1892,8 @@ protoop_arg_t retransmit_needed_by_packet(picoquic_cnx_t *cnx)
             }
         }
     } else {
-        /* There has not been any higher packet acknowledged, thus we fall back on timer logic. */
-        uint64_t rto = (send_path->pkt_ctx[pc].nb_retransmit == 0) ?
-            send_path->retransmit_timer : (1000000ull << (send_path->pkt_ctx[pc].nb_retransmit - 1));
-        retransmit_time = p->send_time + rto;
+        /* There has not been any higher packet acknowledged, thus we fall back on the probe timeout. */
+        retransmit_time = picoquic_pto_time(send_path, pc, p);
         is_timer_based = 1;
     }
     if (p->ptype == picoquic_packet_0rtt_protected) {
@@ -1193,7 +1957,8 @@ static int picoquic_retransmit_needed_by_packet(picoquic_cnx_t* cnx,
 
 void register_plugin_in_pkt(picoquic_packet_t* packet, protoop_plugin_t* p, size_t frame_offset, uint64_t bytes, reserve_frame_slot_t *rfs)
 {
-    picoquic_packet_plugin_frame_t* plugin_frame = malloc(sizeof(picoquic_packet_plugin_frame_t));
+    picoquic_packet_plugin_frame_t* plugin_frame = packet->pool != NULL ?
+        picoquic_packet_pool_get_frame(packet->pool) : malloc(sizeof(picoquic_packet_plugin_frame_t));
     if (!plugin_frame) {
         printf("WARNING: cannot allocate memory for picoquic_packet_plugin_frame_t!\n");
         return;
@@ -1206,12 +1971,23 @@ void register_plugin_in_pkt(picoquic_packet_t* packet, protoop_plugin_t* p, size
     packet->plugin_frames = plugin_frame;
 }
 
+/* Notifies the plugin of a reserved frame dropped past its expire time, instead of being written */
+static void picoquic_drop_expired_frame(picoquic_cnx_t *cnx, protoop_plugin_t *p, reserve_frame_slot_t *rfs)
+{
+    p->frames_expired++;
+    LOG_EVENT(cnx, "plugins", "frame_expired", "", "{\"plugin\": \"%s\", \"frame_type\": %" PRIu64 ", \"nb_bytes\": %" PRIu64 "}", p->name, rfs->frame_type, (uint64_t) rfs->nb_bytes);
+    if (PROTOOP_PARAM_NOTIFY_FRAME.hash == 0) {
+        PROTOOP_PARAM_NOTIFY_FRAME.hash = hash_value_str(PROTOOP_PARAM_NOTIFY_FRAME.id);
+    }
+    protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_NOTIFY_FRAME, rfs->frame_type, NULL, rfs, PICOQUIC_FRAME_EXPIRED);
+}
 
 protoop_arg_t scheduler_write_new_frames(picoquic_cnx_t *cnx) {
     uint8_t *bytes = (uint8_t *) cnx->protoop_inputv[0];
     size_t max_bytes = (size_t) cnx->protoop_inputv[1];
     size_t payload_offset = (size_t) cnx->protoop_inputv[2];
     picoquic_packet_t *packet = (picoquic_packet_t *) cnx->protoop_inputv[3];
+    uint64_t current_time = picoquic_get_quic_time(cnx->quic);
 
     unsigned int is_pure_ack = 1;
 
@@ -1252,6 +2028,10 @@ protoop_arg_t scheduler_write_new_frames(picoquic_cnx_t *cnx) {
         if (PROTOOP_PARAM_NOTIFY_FRAME.hash == 0) {
             PROTOOP_PARAM_NOTIFY_FRAME.hash = hash_value_str(PROTOOP_PARAM_NOTIFY_FRAME.id);
         }
+        if (rfs->expire_time != 0 && rfs->expire_time <= current_time) {
+            picoquic_drop_expired_frame(cnx, rfs->p, rfs);
+            continue;
+        }
         ret = (int) protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_WRITE_FRAME, (param_id_t) rfs->frame_type, outs,
                                                   &bytes[length], &bytes[length + rfs->nb_bytes], rfs->frame_ctx);
         size_t data_bytes = (size_t) outs[0];
@@ -1263,6 +2043,7 @@ protoop_arg_t scheduler_write_new_frames(picoquic_cnx_t *cnx) {
             length += (uint32_t) data_bytes;
             /* Keep track of the bytes sent by the plugin */
             p->bytes_in_flight += (uint64_t) data_bytes;
+            cnx->plugin_bytes_in_flight += (uint64_t) data_bytes;
             p->bytes_total += (uint64_t) data_bytes;
             p->frames_total += 1;
             /* Keep track if the packet should be retransmitted or not */
@@ -1284,7 +2065,7 @@ protoop_arg_t scheduler_write_new_frames(picoquic_cnx_t *cnx) {
                        cnx->current_plugin->name, rfs->frame_type, rfs->nb_bytes, data_bytes);
             }
             memset(&bytes[length], 0, rfs->nb_bytes);
-            protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_NOTIFY_FRAME, rfs->frame_type, NULL, rfs, 2);
+            protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_NOTIFY_FRAME, rfs->frame_type, NULL, rfs, PICOQUIC_FRAME_NOT_SENT);
         }
 
         if (ret == PICOQUIC_MISCCODE_RETRY_NXT_PKT) {
@@ -1303,6 +2084,10 @@ protoop_arg_t scheduler_write_new_frames(picoquic_cnx_t *cnx) {
         if (PROTOOP_PARAM_NOTIFY_FRAME.hash == 0) {
             PROTOOP_PARAM_NOTIFY_FRAME.hash = hash_value_str(PROTOOP_PARAM_NOTIFY_FRAME.id);
         }
+        if (rfs->expire_time != 0 && rfs->expire_time <= current_time) {
+            picoquic_drop_expired_frame(cnx, rfs->p, rfs);
+            continue;
+        }
         ret = (int) protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_WRITE_FRAME, (param_id_t) rfs->frame_type, outs,
                                                   &bytes[length], &bytes[length + rfs->nb_bytes], rfs->frame_ctx);
         size_t data_bytes = (size_t) outs[0];
@@ -1314,6 +2099,7 @@ protoop_arg_t scheduler_write_new_frames(picoquic_cnx_t *cnx) {
             length += (uint32_t) data_bytes;
             /* Keep track of the bytes sent by the plugin */
             p->bytes_in_flight += (uint64_t) data_bytes;
+            cnx->plugin_bytes_in_flight += (uint64_t) data_bytes;
             p->bytes_total += (uint64_t) data_bytes;
             p->frames_total += 1;
             /* Keep track if the packet should be retransmitted or not */
@@ -1336,7 +2122,7 @@ protoop_arg_t scheduler_write_new_frames(picoquic_cnx_t *cnx) {
                            cnx->current_plugin, rfs->frame_type, rfs->nb_bytes, data_bytes);
             }
             memset(&bytes[length], 0, rfs->nb_bytes);
-            protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_NOTIFY_FRAME, rfs->frame_type, NULL, rfs, 2);
+            protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_NOTIFY_FRAME, rfs->frame_type, NULL, rfs, PICOQUIC_FRAME_NOT_SENT);
         }
 
         if (ret == PICOQUIC_MISCCODE_RETRY_NXT_PKT) {
@@ -1460,10 +2246,10 @@ protoop_arg_t retransmit_needed(picoquic_cnx_t *cnx)
                     int written_non_pure_ack_frames = 0;
                     int has_handshake_done = 0;
 
-                    if (p->is_mtu_probe && p->length > old_path->send_mtu) {
-                        /* MTU probe was lost, presumably because of packet too big */
-                        old_path->mtu_probe_sent = 0;
-                        old_path->send_mtu_max_tried = (uint32_t)(p->length);
+                    old_path->counters.packets_lost++;
+                    old_path->counters.bytes_lost += p->length + p->checksum_overhead;
+
+                    if (picoquic_mtu_packet_lost(cnx, old_path, p, current_time)) {
                         /* MTU probes should not be retransmitted */
                         packet_is_pure_ack = 1;
                         do_not_detect_spurious = 0;
@@ -1473,20 +2259,32 @@ protoop_arg_t retransmit_needed(picoquic_cnx_t *cnx)
                         byte_index = p->offset;
 
                         bool has_unlimited_frame = false;
+                        int summary_index = 0;
                         while (ret == 0 && byte_index < p->length) {
                             /* Don't consider frames that were created by a plugin */
-                            picoquic_packet_plugin_frame_t *ppf = p->plugin_frames;
                             bool skip_frame = false;
-                            while (!skip_frame && ppf) {
-                                skip_frame = (byte_index - p->offset) == ppf->frame_offset;
-                                frame_length = ppf->bytes;
-                                ppf = ppf->next;
+                            uint64_t frame_type = 0;
+
+                            if (p->has_frame_summary) {
+                                picoquic_frame_summary_t *fs = &p->frame_summary[summary_index++];
+                                skip_frame = fs->is_plugin_frame;
+                                frame_length = fs->length;
+                                frame_is_pure_ack = fs->is_pure_ack;
+                                frame_type = fs->type;
+                            } else {
+                                picoquic_packet_plugin_frame_t *ppf = p->plugin_frames;
+                                while (!skip_frame && ppf) {
+                                    skip_frame = (byte_index - p->offset) == ppf->frame_offset;
+                                    frame_length = ppf->bytes;
+                                    ppf = ppf->next;
+                                }
+                                if (!skip_frame) {
+                                    picoquic_varint_decode(p->bytes + byte_index, p->length - byte_index, &frame_type);
+                                    ret = picoquic_skip_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length, &frame_is_pure_ack);
+                                }
                             }
 
                             if (!skip_frame) {
-                                uint64_t frame_type;
-                                picoquic_varint_decode(p->bytes + byte_index, p->length - byte_index, &frame_type);
-                                ret = picoquic_skip_frame(cnx, &p->bytes[byte_index], p->length - byte_index, &frame_length, &frame_is_pure_ack);
 
                                 /* Check whether the data was already acked, which may happen in case of spurious retransmissions */
                                 if (ret == 0 && frame_is_pure_ack == 0) {
@@ -1602,7 +2400,7 @@ protoop_arg_t retransmit_needed(picoquic_cnx_t *cnx)
                         uint64_t retrans_cc_notification_timer = orig_path->pkt_ctx[pc].latest_retransmit_cc_notification_time + orig_path->smoothed_rtt;
                         if (timer_based_retransmit != 0 && current_time >= retrans_timer) {
                             is_timer_based = true;
-                            if (orig_path->pkt_ctx[pc].nb_retransmit > 5) {
+                            if (orig_path->pkt_ctx[pc].nb_retransmit > PICOQUIC_PTO_COUNT_MAX) {
                                 /*
                                 * Max retransmission count was exceeded. Disconnect.
                                 */
@@ -1638,10 +2436,13 @@ protoop_arg_t retransmit_needed(picoquic_cnx_t *cnx)
                             packet->length = length;
                             cnx->nb_retransmission_total++;
 
+                            /* A probe timeout alone is handled as a loss, the window only collapses
+                             * on persistent congestion, when the probes themselves are not acknowledged */
                             if (current_time >= retrans_cc_notification_timer && cnx->congestion_alg != NULL) {
                                 orig_path->pkt_ctx[pc].latest_retransmit_cc_notification_time = current_time;
                                 picoquic_congestion_algorithm_notify_func(cnx, old_path,
-                                    (is_timer_based) ? picoquic_congestion_notification_timeout : picoquic_congestion_notification_repeat,
+                                    (is_timer_based && orig_path->pkt_ctx[pc].nb_retransmit >= PICOQUIC_PTO_PERSISTENT_CONGESTION) ?
+                                    picoquic_congestion_notification_timeout : picoquic_congestion_notification_repeat,
                                     0, 0, lost_packet_number, current_time);
                             }
 
@@ -1682,6 +2483,8 @@ int picoquic_retransmit_needed(picoquic_cnx_t* cnx,
     if (reason != NULL) {
         *reason = (char *) outs[2];
     }
+    PICOQUIC_TRACE4(retransmit_needed, picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx)), path_x, (int)pc,
+        (uint64_t)ret);
     return ret;
 }
 
@@ -1720,13 +2523,14 @@ int picoquic_should_send_max_data(picoquic_cnx_t* cnx)
 {
     int ret = 0;
 
-    if (2 * cnx->data_received > cnx->maxdata_local)
+    /* Less than half of the window is left */
+    if (cnx->maxdata_local - cnx->data_received < cnx->max_data_window / 2)
         ret = 1;
 
     return ret;
 }
 
-static size_t picoquic_mtu_probe_length(picoquic_cnx_t *cnx, picoquic_path_t *path_x) {
+size_t picoquic_mtu_probe_length(picoquic_cnx_t *cnx, picoquic_path_t *path_x) {
     size_t probe_length;
     if (path_x->send_mtu_max_tried == 0) {
         if (cnx->remote_parameters.max_packet_size > 0) {
@@ -1734,14 +2538,15 @@ static size_t picoquic_mtu_probe_length(picoquic_cnx_t *cnx, picoquic_path_t *pa
 
             if (cnx->quic->mtu_max > 0 && (int)probe_length > cnx->quic->mtu_max) {
                 probe_length = cnx->quic->mtu_max;
-            } else if (probe_length > PICOQUIC_MAX_PACKET_SIZE) {
-                probe_length = PICOQUIC_MAX_PACKET_SIZE;
+            }
+            if (probe_length > cnx->quic->max_packet_size) {
+                probe_length = cnx->quic->max_packet_size;
             }
             if (probe_length < path_x->send_mtu) {
                 probe_length = path_x->send_mtu;
             }
         } else if (cnx->quic->mtu_max > 0) {
-            probe_length = cnx->quic->mtu_max;
+            probe_length = (cnx->quic->mtu_max < cnx->quic->max_packet_size) ? cnx->quic->mtu_max : cnx->quic->max_packet_size;
         } else {
             probe_length = PICOQUIC_PRACTICAL_MAX_MTU;
         }
@@ -1756,13 +2561,81 @@ int picoquic_is_mtu_probe_needed(picoquic_cnx_t* cnx, picoquic_path_t * path_x)
 {
     int ret = 0;
 
-    if ((cnx->cnx_state == picoquic_state_client_ready || cnx->cnx_state == picoquic_state_server_ready) && path_x->mtu_probe_sent == 0 && (path_x->send_mtu_max_tried == 0 || (path_x->send_mtu + 10) < path_x->send_mtu_max_tried) && picoquic_mtu_probe_length(cnx, path_x) > path_x->send_mtu) {
+    if ((cnx->cnx_state == picoquic_state_client_ready || cnx->cnx_state == picoquic_state_server_ready) && path_x->mtu_probe_sent == 0 && (path_x->send_mtu_max_tried == 0 || (path_x->send_mtu + PICOQUIC_MTU_SEARCH_PRECISION) < path_x->send_mtu_max_tried) && picoquic_mtu_probe_length(cnx, path_x) > path_x->send_mtu) {
         ret = 1;
     }
 
     return ret;
 }
 
+/* Smallest MTU of the path, BASE_PLPMTU of RFC 8899: the one the connection started with */
+static uint32_t picoquic_mtu_base(picoquic_path_t* path_x)
+{
+    return (path_x->peer_addr.ss_family == AF_INET) ? PICOQUIC_INITIAL_MTU_IPV4 : PICOQUIC_INITIAL_MTU_IPV6;
+}
+
+/* Once the search is done, it starts again after the raise timer, in case the path MTU grew */
+static void picoquic_mtu_update_search(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time)
+{
+    if (path_x->mtu_raise_time == 0) {
+        if ((path_x->send_mtu_max_tried != 0 && path_x->send_mtu + PICOQUIC_MTU_SEARCH_PRECISION >= path_x->send_mtu_max_tried) ||
+            picoquic_mtu_probe_length(cnx, path_x) <= path_x->send_mtu) {
+            path_x->mtu_raise_time = current_time + PICOQUIC_MTU_RAISE_TIMER;
+        }
+    } else if (current_time >= path_x->mtu_raise_time) {
+        path_x->send_mtu_max_tried = 0;
+        path_x->mtu_probe_losses = 0;
+        path_x->mtu_raise_time = 0;
+    }
+}
+
+void picoquic_mtu_packet_acked(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_t* p, uint64_t current_time)
+{
+    uint32_t size = p->length + p->checksum_overhead;
+
+    /* If packet is larger than the current MTU, update the MTU */
+    if (size > path_x->send_mtu) {
+        path_x->send_mtu = size;
+        path_x->mtu_probe_sent = 0;
+        path_x->mtu_probe_losses = 0;
+        if (path_x->send_mtu_max_tried != 0 && size >= path_x->send_mtu_max_tried) {
+            /* The size deemed too large was only late, the search goes on above it */
+            path_x->send_mtu_max_tried = 0;
+        }
+    }
+    if (size > picoquic_mtu_base(path_x)) {
+        path_x->mtu_black_hole_losses = 0;
+    }
+    picoquic_mtu_update_search(cnx, path_x, current_time);
+}
+
+int picoquic_mtu_packet_lost(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_t* p, uint64_t current_time)
+{
+    uint32_t size = p->length + p->checksum_overhead;
+    uint32_t base = picoquic_mtu_base(path_x);
+    int is_probe = p->is_mtu_probe;
+
+    if (is_probe) {
+        /* The same size is probed again, until it is lost too many times to be a mere congestion loss */
+        path_x->mtu_probe_sent = 0;
+        if (size > path_x->send_mtu && ++path_x->mtu_probe_losses >= PICOQUIC_MTU_MAX_PROBES) {
+            path_x->send_mtu_max_tried = size;
+            path_x->mtu_probe_losses = 0;
+        }
+    } else if (size > base && ++path_x->mtu_black_hole_losses >= PICOQUIC_MTU_BLACK_HOLE_LOSSES && path_x->send_mtu > base) {
+        /* Black hole: the larger packets no longer get through, fall back to the base and search below the current MTU */
+        path_x->send_mtu_max_tried = path_x->send_mtu;
+        path_x->send_mtu = base;
+        path_x->mtu_black_hole_losses = 0;
+        path_x->mtu_probe_losses = 0;
+        path_x->mtu_probe_sent = 0;
+        path_x->mtu_raise_time = 0;
+    }
+    picoquic_mtu_update_search(cnx, path_x, current_time);
+
+    return is_probe;
+}
+
 /**
  * See PROTOOP_NOPARAM_PREPARE_MTU_PROBE
  */
@@ -1793,15 +2666,6 @@ uint32_t picoquic_prepare_mtu_probe(picoquic_cnx_t* cnx,
         path_x, header_length, checksum_length, bytes);
 }
 
-protoop_plugin_t *get_next_plugin(picoquic_cnx_t *cnx, protoop_plugin_t *t)
-{
-    if (t->hh.next != NULL) {
-        return t->hh.next;
-    }
-    /* Otherwise, it is the first one */
-    return cnx->plugins;
-}
-
 /* Special wake up decision logic in initial state */
 /* TODO: tie with per path scheduling */
 static void picoquic_cnx_set_next_wake_time_init(picoquic_cnx_t* cnx, uint64_t current_time)
@@ -1898,7 +2762,9 @@ static void picoquic_cnx_set_next_wake_time_init(picoquic_cnx_t* cnx, uint64_t c
 
                     /* Consider delayed ACK */
                     if (path_x->pkt_ctx[pc].ack_needed) {
-                        if (path_x->pkt_ctx[pc].highest_ack_time + path_x->pkt_ctx[pc].ack_delay_local < next_time)
+                        if (path_x->pkt_ctx[pc].ack_immediate) {
+                            next_time = current_time;
+                        } else if (path_x->pkt_ctx[pc].highest_ack_time + path_x->pkt_ctx[pc].ack_delay_local < next_time)
                         next_time = path_x->pkt_ctx[pc].highest_ack_time + path_x->pkt_ctx[pc].ack_delay_local;
                     }
 
@@ -1909,15 +2775,10 @@ static void picoquic_cnx_set_next_wake_time_init(picoquic_cnx_t* cnx, uint64_t c
                     }
 
                     if (p != NULL) {
-                        if (path_x->pkt_ctx[pc].nb_retransmit == 0) {
-                            if (p->send_time + path_x->retransmit_timer < next_time) {
-                                next_time = p->send_time + path_x->retransmit_timer;
-                            }
-                        }
-                        else {
-                            if (p->send_time + (1000000ull << (path_x->pkt_ctx[pc].nb_retransmit - 1)) < next_time) {
-                                next_time = p->send_time + (1000000ull << (path_x->pkt_ctx[pc].nb_retransmit - 1));
-                            }
+                        uint64_t pto_time = picoquic_pto_time(path_x, pc, p);
+
+                        if (pto_time < next_time) {
+                            next_time = pto_time;
                         }
                     }
                 }
@@ -1930,18 +2791,7 @@ static void picoquic_cnx_set_next_wake_time_init(picoquic_cnx_t* cnx, uint64_t c
 }
 
 protoop_arg_t has_congestion_controlled_plugin_frames_to_send(picoquic_cnx_t *cnx) {
-    protoop_arg_t ret = 0;
-    protoop_plugin_t *p = cnx->first_drr;
-
-    if(p) {
-        do {
-            if (queue_peek(p->block_queue_cc)) {
-                ret = 1;
-                break;
-            }
-        } while (!ret && (p = get_next_plugin(cnx, p)) != cnx->first_drr);
-    }
-    return ret;
+    return cnx->nb_reserved_cc_blocks > 0;
 }
 
 bool picoquic_has_congestion_controlled_plugin_frames_to_send(picoquic_cnx_t *cnx) {
@@ -2029,7 +2879,8 @@ protoop_arg_t set_next_wake_time(picoquic_cnx_t *cnx)
                 picoquic_packet_t* p = path_x->pkt_ctx[pc].retransmit_oldest;
                 /* Consider delayed ACK */
                 if (path_x->pkt_ctx[pc].ack_needed) {
-                    uint64_t ack_time = path_x->pkt_ctx[pc].highest_ack_time + path_x->pkt_ctx[pc].ack_delay_local;
+                    uint64_t ack_time = (path_x->pkt_ctx[pc].ack_immediate) ? current_time :
+                        path_x->pkt_ctx[pc].highest_ack_time + path_x->pkt_ctx[pc].ack_delay_local;
 
                     if (ack_time < next_time) {
                         next_time = ack_time;
@@ -2063,8 +2914,8 @@ protoop_arg_t set_next_wake_time(picoquic_cnx_t *cnx)
             }
 
             /* Consider keep alive */
-            if (cnx->keep_alive_interval != 0 && next_time > (cnx->latest_progress_time + cnx->keep_alive_interval)) {
-                next_time = cnx->latest_progress_time + cnx->keep_alive_interval;
+            if (cnx->keep_alive_interval != 0 && next_time > picoquic_keep_alive_time(cnx)) {
+                next_time = picoquic_keep_alive_time(cnx);
             }
         }
     }
@@ -2081,6 +2932,16 @@ void picoquic_cnx_set_next_wake_time(picoquic_cnx_t* cnx, uint64_t current_time)
     protoop_prepare_and_run_noparam(cnx, &PROTOOP_NOPARAM_SET_NEXT_WAKE_TIME, NULL, current_time);
 }
 
+/* While a handshake datagram is coalesced, the wake time only depends on its last segment */
+static void picoquic_cnx_set_next_wake_time_segment(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    if (cnx->is_coalescing) {
+        cnx->wake_time_pending = 1;
+    } else {
+        picoquic_cnx_set_next_wake_time(cnx, current_time);
+    }
+}
+
 /* Prepare the next packet to 0-RTT packet to send in the client initial
  * state, when 0-RTT is available
  */
@@ -2115,10 +2976,31 @@ int picoquic_prepare_packet_0rtt(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
         padding_required = 1;
     }
 
-    if ((stream == NULL && padding_required == 0) ||
+    if ((stream == NULL && padding_required == 0 && (cnx->plugin_requested || cnx->pids_to_request.size == 0)) ||
         (PICOQUIC_DEFAULT_0RTT_WINDOW <= path_x->bytes_in_transit + send_buffer_max)) {
         length = 0;
     } else {
+        /* Request the plugins remembered with the ticket first, their archives come back in the first 1-RTT flight */
+        if (!cnx->plugin_requested) {
+            int is_retransmittable = 1;
+            for (int i = 0; ret == 0 && i < cnx->pids_to_request.size; i++) {
+                if (cnx->pids_to_request.elems[i].requested) {
+                    continue;
+                }
+                ret = picoquic_write_plugin_validate_frame(cnx, &bytes[length], &bytes[send_buffer_max - checksum_overhead],
+                    cnx->pids_to_request.elems[i].pid_id, cnx->pids_to_request.elems[i].plugin_name, &data_bytes, &is_retransmittable);
+                if (ret == 0) {
+                    length += (uint32_t)data_bytes;
+                    if (data_bytes > 0) {
+                        packet->is_pure_ack = 0;
+                        cnx->pids_to_request.elems[i].requested = 1;
+                    }
+                } else if (ret == PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL) {
+                    ret = 0;
+                }
+            }
+            cnx->plugin_requested = 1;
+        }
         /* Encode the stream frame */
         while ((stream = picoquic_schedule_next_stream(cnx, send_buffer_max - checksum_overhead - length, path_x)) != NULL) {
             ret = picoquic_prepare_stream_frame(cnx, stream, &bytes[length],
@@ -2145,7 +3027,7 @@ int picoquic_prepare_packet_0rtt(picoquic_cnx_t* cnx, picoquic_path_t * path_x,
         cnx->nb_zero_rtt_sent++;
     }
 
-    picoquic_cnx_set_next_wake_time(cnx, current_time);
+    picoquic_cnx_set_next_wake_time_segment(cnx, current_time);
 
     return ret;
 }
@@ -2504,7 +3386,7 @@ int picoquic_prepare_packet_client_init(picoquic_cnx_t* cnx, picoquic_path_t **
             send_length, send_buffer, (uint32_t)send_buffer_max, path_x, current_time);
 
         if (cnx->cnx_state != picoquic_state_draining) {
-            picoquic_cnx_set_next_wake_time(cnx, current_time);
+            picoquic_cnx_set_next_wake_time_segment(cnx, current_time);
         }
     }
     POP_LOG_CTX(cnx);
@@ -2665,7 +3547,7 @@ int picoquic_prepare_packet_server_init(picoquic_cnx_t* cnx, picoquic_path_t **
         ret, length, header_length, checksum_overhead,
         send_length, send_buffer, (uint32_t)send_buffer_max, path_x, current_time);
 
-    picoquic_cnx_set_next_wake_time(cnx, current_time);
+    picoquic_cnx_set_next_wake_time_segment(cnx, current_time);
 
     POP_LOG_CTX(cnx);
 
@@ -2759,6 +3641,12 @@ int picoquic_prepare_packet_closing(picoquic_cnx_t* cnx, picoquic_path_t ** path
             }
             picoquic_set_cnx_state(cnx, picoquic_state_draining);
             picoquic_reinsert_by_wake_time(cnx->quic, cnx, exit_time);
+            if (cnx->quic->max_tombstones > 0) {
+                /* Nothing is sent while draining, the tombstone only drops the packets */
+                cnx->tombstone_pending = 1;
+                cnx->tombstone_expiry = exit_time;
+                cnx->tombstone_interval = 0;
+            }
         }
         else if (ret == 0 && cnx->cnx_state == picoquic_state_closing) {
             /* if more than 3*RTO is elapsed, move to disconnected */
@@ -2865,6 +3753,11 @@ int picoquic_prepare_packet_closing(picoquic_cnx_t* cnx, picoquic_path_t ** path
             }
             else {
                 picoquic_set_cnx_state(cnx, picoquic_state_closing);
+                if (cnx->quic->max_tombstones > 0) {
+                    cnx->tombstone_pending = 1;
+                    cnx->tombstone_expiry = current_time + 3 * path_x->retransmit_timer;
+                    cnx->tombstone_interval = delta_t;
+                }
             }
             cnx->latest_progress_time = current_time;
             picoquic_reinsert_by_wake_time(cnx->quic, cnx, current_time + delta_t);
@@ -2902,104 +3795,129 @@ picoquic_path_t *picoquic_select_sending_path(picoquic_cnx_t *cnx, picoquic_pack
         retransmit_p, from_path, reason);
 }
 
-/* This implements a deficit round robin with bursts */
-size_t picoquic_frame_fair_reserve(picoquic_cnx_t *cnx, picoquic_path_t *path_x, picoquic_stream_head* stream, uint64_t frame_mss)
+void picoquic_drr_activate(picoquic_cnx_t* cnx, protoop_plugin_t* p, int is_congestion_controlled)
 {
-    /* If there is no plugin, there is no frame to reserve! */
-    if (!cnx->plugins) {
-        return 0;
-    }
-    /* Handle the first call */
-    if (!cnx->first_drr) {
-        cnx->first_drr = cnx->plugins;
+    picoquic_drr_entry_t* entry = &p->drr[is_congestion_controlled ? 1 : 0];
+    picoquic_drr_list_t* list = &cnx->drr[(!is_congestion_controlled) ? picoquic_drr_non_cc :
+        (p->params.rate_unlimited) ? picoquic_drr_cc_unlimited : picoquic_drr_cc];
+
+    if (!entry->is_active) {
+        entry->next = NULL;
+        entry->deficit = 0;
+        entry->has_quantum = 0;
+        entry->is_active = 1;
+        if (list->last == NULL) {
+            list->first = p;
+        } else {
+            list->last->drr[is_congestion_controlled ? 1 : 0].next = p;
+        }
+        list->last = p;
+        list->nb_active++;
     }
-    /* Find if reservations were made */
-    protoop_plugin_t *p, *tmp_p;
-    reserve_frames_block_t *block;
+}
 
-    uint64_t plugin_use = 0;
-    uint64_t num_plugins = 0;
+/* Takes the reservations of the active list in deficit round robin, as long as they fit in the frame_mss bytes
+ * left after queued_bytes. The plugin at the head of the list keeps its turn when the packet is full. */
+static size_t picoquic_drr_reserve(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_drr_list_enum list_id,
+    size_t queued_bytes, uint64_t frame_mss)
+{
+    picoquic_drr_list_t* list = &cnx->drr[list_id];
+    int is_congestion_controlled = list_id != picoquic_drr_non_cc;
+    uint32_t nb_turns = 0;
+    protoop_plugin_t* p;
+
+    /* The plugins go around the list at most once per call, which bounds the work per packet */
+    while ((p = list->first) != NULL && nb_turns <= list->nb_active) {
+        picoquic_drr_entry_t* entry = &p->drr[is_congestion_controlled];
+        queue_t* block_queue = (is_congestion_controlled) ? p->block_queue_cc : p->block_queue_non_cc;
+        reserve_frames_block_t* block = queue_peek(block_queue);
+
+        if (block != NULL && block->expire_time != 0 && block->expire_time <= picoquic_get_quic_time(cnx->quic)) {
+            /* Past its expire time, the block is dropped instead of taking the room of fresher frames */
+            block = (reserve_frames_block_t *) queue_dequeue(block_queue);
+            if (is_congestion_controlled) {
+                cnx->nb_reserved_cc_blocks--;
+            }
+            for (int i = 0; i < block->nb_frames; i++) {
+                picoquic_drop_expired_frame(cnx, p, &block->frames[i]);
+            }
+            picoquic_memory_release(cnx, picoquic_memory_reserved_frames, sizeof(reserve_frames_block_t));
+            free(block);
+            continue;
+        }
+        if (block == NULL || block->total_bytes >= frame_mss || (entry->has_quantum && block->total_bytes > entry->deficit)) {
+            /* Done with its turn, or waiting for a larger packet: the plugin leaves the head of the list */
+            list->first = entry->next;
+            if (list->first == NULL) {
+                list->last = NULL;
+            }
+            entry->next = NULL;
+            entry->has_quantum = 0;
+            if (block == NULL) {
+                entry->is_active = 0;
+                entry->deficit = 0;
+                list->nb_active--;
+            } else {
+                if (list->last == NULL) {
+                    list->first = p;
+                } else {
+                    list->last->drr[is_congestion_controlled].next = p;
+                }
+                list->last = p;
+                nb_turns++;
+            }
+            continue;
+        }
+        if (!entry->has_quantum) {
+            entry->deficit += PICOQUIC_DRR_QUANTUM;
+            entry->has_quantum = 1;
+            continue;
+        }
+        if (queued_bytes + block->total_bytes >= frame_mss ||
+            (block->is_congestion_controlled && path_x->bytes_in_transit >= path_x->cwin)) {
+            break;
+        }
 
-    /* FIXME this is not fair... Introduce DRR */
-    HASH_ITER(hh, cnx->plugins, p, tmp_p) {
-        plugin_use += p->bytes_in_flight;
-        num_plugins += 1;
+        block = (reserve_frames_block_t *) queue_dequeue(block_queue);
+        entry->deficit -= block->total_bytes;
+        if (is_congestion_controlled) {
+            cnx->nb_reserved_cc_blocks--;
+        }
+        for (int i = 0; i < block->nb_frames; i++) {
+            block->frames[i].p = p;
+            queue_enqueue(cnx->reserved_frames, &block->frames[i]);
+        }
+        queued_bytes += block->total_bytes;
+        LOG {
+            char ftypes_str[250];
+            size_t ftypes_ofs = 0;
+            for (int i = 0; i < block->nb_frames; i++) {
+                ftypes_ofs += snprintf(ftypes_str + ftypes_ofs, sizeof(ftypes_str) - ftypes_ofs, "%" PRIu64 "%s", block->frames[i].frame_type, i < block->nb_frames - 1 ? ", " : "");
+            }
+            LOG_EVENT(cnx, "plugins", "enqueue_frame", "frame_fair_reserve", "{\"plugin\": \"%s\", \"nb_frames\": %d, \"total_bytes\": %" PRIu64 ", \"is_cc\": %d, \"frames\": [%s]}", p->name, block->nb_frames, block->total_bytes, block->is_congestion_controlled, ftypes_str);
+        }
+        /* Free the block */
+        picoquic_memory_release(cnx, picoquic_memory_reserved_frames, sizeof(reserve_frames_block_t));
+        free(block);
     }
 
+    return queued_bytes;
+}
+
+/* This implements a deficit round robin over the plugins with reservations queued. Only these plugins are
+ * visited. Unless they are rate unlimited, the plugins only send congestion controlled frames while their
+ * bytes in flight stay below the share of the congestion window left by the core rate, or when no stream
+ * has data to send. */
+size_t picoquic_frame_fair_reserve(picoquic_cnx_t *cnx, picoquic_path_t *path_x, picoquic_stream_head* stream, uint64_t frame_mss)
+{
     uint64_t max_plugin_cwin = path_x->cwin * (1000 - cnx->core_rate) / 1000;
-    uint64_t total_plugin_bytes_in_flight = 0;
+    size_t queued_bytes = 0;
 
-    /*
-    if (stream != NULL && plugin_use >= max_plugin_cwin) {
-        printf("Fair reserve over rate! Stream %p plugin_use %" PRIu64 " max_plugin_cwin %" PRIu64 "\n", stream, plugin_use, max_plugin_cwin);
-        // Don't go over the guaranteed rate!
-        return;
+    if (stream == NULL || cnx->plugin_bytes_in_flight < max_plugin_cwin) {
+        queued_bytes = picoquic_drr_reserve(cnx, path_x, picoquic_drr_cc, queued_bytes, frame_mss);
     }
-    */
-
-    size_t queued_bytes = 0;
-    p = cnx->first_drr;
-
-    /* First pass: consider only under-rated plugins with CC */
-    do {
-        if (p->params.rate_unlimited || total_plugin_bytes_in_flight < max_plugin_cwin){
-            while ((block = queue_peek(p->block_queue_cc)) != NULL &&
-                   queued_bytes + block->total_bytes < frame_mss &&
-                   !(stream != NULL && (!p->params.rate_unlimited && plugin_use >= max_plugin_cwin)) &&
-                   (!block->is_congestion_controlled || path_x->bytes_in_transit < path_x->cwin))
-            {
-                block = (reserve_frames_block_t *) queue_dequeue(p->block_queue_cc);
-                for (int i = 0; i < block->nb_frames; i++) {
-                    /* Not the most efficient way, but will do the trick */
-                    block->frames[i].p = p;
-                    queue_enqueue(cnx->reserved_frames, &block->frames[i]);
-                }
-                /* Update queued bytes counter */
-                queued_bytes += block->total_bytes;
-                LOG {
-                    char ftypes_str[250];
-                    size_t ftypes_ofs = 0;
-                    for (int i = 0; i < block->nb_frames; i++) {
-                        ftypes_ofs += snprintf(ftypes_str + ftypes_ofs, sizeof(ftypes_str) - ftypes_ofs, "%" PRIu64 "%s", block->frames[i].frame_type, i < block->nb_frames - 1 ? ", " : "");
-                    }
-                    LOG_EVENT(cnx, "plugins", "enqueue_frame", "frame_fair_reserve_under_rated", "{\"plugin\": \"%s\", \"nb_frames\": %d, \"total_bytes\": %" PRIu64 ", \"is_cc\": %d, \"frames\": [%s]}", p->name, block->nb_frames, block->total_bytes, block->is_congestion_controlled, ftypes_str);
-                }
-                /* Free the block */
-                free(block);
-            }
-        }
-        total_plugin_bytes_in_flight += p->bytes_in_flight;
-    } while ((p = get_next_plugin(cnx, p)) != cnx->first_drr);
-    p = cnx->first_drr;
-    /* Second pass: consider all plugins with non CC */
-    do {
-        while ((block = queue_peek(p->block_queue_non_cc)) != NULL &&
-                queued_bytes + block->total_bytes < frame_mss &&
-                (!block->is_congestion_controlled || path_x->bytes_in_transit < path_x->cwin))
-        {
-            block = (reserve_frames_block_t *) queue_dequeue(p->block_queue_non_cc);
-            for (int i = 0; i < block->nb_frames; i++) {
-                /* Not the most efficient way, but will do the trick */
-                block->frames[i].p = p;
-                queue_enqueue(cnx->reserved_frames, &block->frames[i]);
-            }
-            /* Update queued bytes counter */
-            queued_bytes += block->total_bytes;
-            LOG {
-                char ftypes_str[250];
-                size_t ftypes_ofs = 0;
-                for (int i = 0; i < block->nb_frames; i++) {
-                    ftypes_ofs += snprintf(ftypes_str + ftypes_ofs, sizeof(ftypes_str) - ftypes_ofs, "%" PRIu64 "%s", block->frames[i].frame_type, i < block->nb_frames - 1 ? ", " : "");
-                }
-                LOG_EVENT(cnx, "plugins", "enqueue_frame", "frame_fair_reserve_under_rated", "{\"plugin\": \"%s\", \"nb_frames\": %d, \"total_bytes\": %" PRIu64 ", \"is_cc\": %d, \"frames\": [%s]}", p->name, block->nb_frames, block->total_bytes, block->is_congestion_controlled, ftypes_str);
-            }
-            /* Free the block */
-            free(block);
-        }
-        total_plugin_bytes_in_flight += p->bytes_in_flight;
-    } while ((p = get_next_plugin(cnx, p)) != cnx->first_drr);
-    /* Now we put all we could */
-    cnx->first_drr = get_next_plugin(cnx, p);
+    queued_bytes = picoquic_drr_reserve(cnx, path_x, picoquic_drr_cc_unlimited, queued_bytes, frame_mss);
+    queued_bytes = picoquic_drr_reserve(cnx, path_x, picoquic_drr_non_cc, queued_bytes, frame_mss);
 
     return queued_bytes;
 }
@@ -3038,7 +3956,9 @@ protoop_arg_t schedule_frames_on_path(picoquic_cnx_t *cnx)
     int tls_ready = picoquic_is_tls_stream_ready(cnx);
     stream = picoquic_find_ready_stream(cnx);
     picoquic_stream_head* plugin_stream = NULL;
-    plugin_stream = picoquic_find_ready_plugin_stream(cnx);
+    if (cnx->quic->overload_level < picoquic_overload_shed) {
+        plugin_stream = picoquic_find_ready_plugin_stream(cnx);
+    }
 
 
     /* First enqueue frames that can be fairly sent, if any */
@@ -3089,11 +4009,13 @@ protoop_arg_t schedule_frames_on_path(picoquic_cnx_t *cnx)
             && picoquic_should_send_max_data(cnx) == 0
             && path_x->challenge_response_to_send == 0
             && (cnx->client_mode || !cnx->handshake_done || cnx->handshake_done_sent)
+            && (!cnx->handshake_done || !cnx->immediate_ack_requested)
             && (path_x->challenge_verified == 1 || current_time < path_x->challenge_time + path_x->retransmit_timer)
             && queue_peek(cnx->reserved_frames) == NULL
             && queue_peek(cnx->retry_frames) == NULL
             && queue_peek(cnx->rtx_frames[pc]) == NULL) {
-            if (ret == 0 && send_buffer_max > path_x->send_mtu && picoquic_is_mtu_probe_needed(cnx, path_x)) {
+            if (ret == 0 && send_buffer_max > path_x->send_mtu && picoquic_is_mtu_probe_needed(cnx, path_x) &&
+                picoquic_mtu_probe_length(cnx, path_x) <= send_buffer_max) {
                 length = picoquic_prepare_mtu_probe(cnx, path_x, header_length, checksum_overhead, bytes);
                 packet->is_mtu_probe = 1;
                 packet->length = length;
@@ -3174,6 +4096,21 @@ protoop_arg_t schedule_frames_on_path(picoquic_cnx_t *cnx)
                             }
                         }
 
+                        if (ret == 0 && cnx->handshake_done) {
+                            ret = picoquic_prepare_ack_frequency_frame(cnx, path_x, bytes + length, send_buffer_min_max - checksum_overhead - length, &data_bytes);
+                            if (ret == 0 && data_bytes > 0) {
+                                length += (uint32_t) data_bytes;
+                                packet->is_pure_ack = 0;
+                            }
+                            if (ret == 0 && cnx->immediate_ack_requested) {
+                                ret = picoquic_prepare_immediate_ack_frame(cnx, bytes + length, send_buffer_min_max - checksum_overhead - length, &data_bytes);
+                                if (ret == 0 && data_bytes > 0) {
+                                    length += (uint32_t) data_bytes;
+                                    packet->is_pure_ack = 0;
+                                }
+                            }
+                        }
+
                         /* if present, send path response. This ensures we send it on the right path */
                         if (path_x->challenge_response_to_send && send_buffer_min_max - checksum_overhead - length >= PICOQUIC_CHALLENGE_LENGTH + 1) {
                             /* This is not really clean, but it will work */
@@ -3183,12 +4120,19 @@ protoop_arg_t schedule_frames_on_path(picoquic_cnx_t *cnx)
                             length += PICOQUIC_CHALLENGE_LENGTH + 1;
                             packet->is_congestion_controlled = 1;
                         }
-                        /* If necessary, encode the max data frame */
-                        if (ret == 0 && 2 * cnx->data_received > cnx->maxdata_local) {
-                            ret = picoquic_prepare_max_data_frame(cnx, 2 * cnx->data_received, &bytes[length],
+                        /* If necessary, encode the max data frame, unless the memory cap holds back the peer */
+                        if (ret == 0 && picoquic_should_send_max_data(cnx) && picoquic_is_memory_capped(cnx)) {
+                            cnx->nb_memory_capped++;
+                        } else if (ret == 0 && picoquic_should_send_max_data(cnx)) {
+                            uint64_t window = picoquic_autotune_window(cnx, cnx->max_data_window,
+                                cnx->quic->max_data_window_max, cnx->max_data_update_time);
+
+                            ret = picoquic_prepare_max_data_frame(cnx, cnx->data_received + window - cnx->maxdata_local, &bytes[length],
                                                                     send_buffer_min_max - checksum_overhead - length, &data_bytes);
 
                             if (ret == 0) {
+                                picoquic_autotune_window_set(cnx, &cnx->max_data_window, window,
+                                    &cnx->max_data_update_time, &cnx->max_data_growth);
                                 length += (uint32_t)data_bytes;
                                 if (data_bytes > 0)
                                 {
@@ -3217,6 +4161,9 @@ protoop_arg_t schedule_frames_on_path(picoquic_cnx_t *cnx)
                         if (ret == 0 && !cnx->plugin_requested) {
                             int is_retransmittable = 1;
                             for (int i = 0; ret == 0 && i < cnx->pids_to_request.size; i++) {
+                                if (cnx->pids_to_request.elems[i].requested) {
+                                    continue;
+                                }
                                 ret = picoquic_write_plugin_validate_frame(cnx, &bytes[length], &bytes[send_buffer_min_max - checksum_overhead],
                                     cnx->pids_to_request.elems[i].pid_id, cnx->pids_to_request.elems[i].plugin_name, &data_bytes, &is_retransmittable);
                                 if (ret == 0) {
@@ -3290,7 +4237,7 @@ protoop_arg_t schedule_frames_on_path(picoquic_cnx_t *cnx)
 
                          if (length <= header_length) {
                              /* Mark the bandwidth estimation as application limited */
-                             path_x->delivered_limited_index = path_x->delivered;
+                             picoquic_delivery_rate_set_app_limited(path_x);
                          }
                     }
                     if (length == 0 || length == header_length) {
@@ -3313,6 +4260,17 @@ protoop_arg_t schedule_frames_on_path(picoquic_cnx_t *cnx)
         }
     }
 
+    if (ret == 0 && length == 0) {
+        /* Nothing to send, count the time against what held the data back */
+        picoquic_send_limit_enum limit = picoquic_send_limit_app;
+        if (path_x->cwin <= path_x->bytes_in_transit) {
+            limit = picoquic_send_limit_cwnd;
+        } else if (cnx->maxdata_remote <= cnx->data_sent && picosplay_first(&cnx->ready_stream_tree) != NULL) {
+            limit = picoquic_send_limit_flow_control;
+        }
+        picoquic_path_set_send_limit(path_x, limit, current_time);
+    }
+
     POP_LOG_CTX(cnx);
     protoop_save_outputs(cnx, path_x, length, header_length);
     return (protoop_arg_t) ret;
@@ -3453,6 +4411,7 @@ protoop_arg_t prepare_packet_ready(picoquic_cnx_t *cnx)
                 bytes[length++] = picoquic_frame_type_ping;
                 bytes[length++] = 0;
                 cnx->latest_progress_time = current_time;
+                picoquic_keep_alive_sent(cnx);
             }
 
             if (cnx->client_mode && coalesced_with_initial) {
@@ -3567,21 +4526,100 @@ int picoquic_prepare_segment(picoquic_cnx_t* cnx, picoquic_path_t ** path, picoq
 
     if (*send_length > 0 && *path) {
         (*path)->nb_pkt_sent++;
+        (*path)->counters.packets_sent++;
+        (*path)->counters.bytes_sent += *send_length;
+        if (packet->is_congestion_controlled) {
+            picoquic_path_set_send_limit(*path, ((*path)->cwin <= (*path)->bytes_in_transit) ?
+                picoquic_send_limit_cwnd : picoquic_send_limit_none, current_time);
+        }
     }
 
+    PICOQUIC_TRACE5(prepare_segment, picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx)), *path,
+        (*send_length > 0) ? packet->sequence_number : 0, (uint64_t)*send_length, (*path != NULL) ? (*path)->cwin : 0);
+
     return ret;
 }
 
 
-/* Prepare next packet to send, or nothing.. */
+/*
+ * Fill the end of a datagram carrying an Initial packet with a packet made only of padding,
+ * protected with the best handshake keys available, so that the datagram reaches the
+ * minimum size whatever the packets coalesced before.
+ */
+static int picoquic_prepare_padding_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length)
+{
+    int ret = 0;
+    int epoch = (cnx->crypto_context[2].aead_encrypt != NULL) ? 2 : 0;
+    picoquic_packet_t* packet;
+    uint32_t header_length;
+    uint32_t checksum_overhead;
+    uint32_t length;
+
+    *send_length = 0;
+
+    if (cnx->crypto_context[epoch].aead_encrypt == NULL) {
+        return 0;
+    }
+
+    checksum_overhead = picoquic_aead_get_checksum_length(cnx->crypto_context[epoch].aead_encrypt);
+    header_length = picoquic_predict_packet_header_length(cnx, picoquic_packet_type_from_epoch(epoch), path_x);
+    if (send_buffer_max <= header_length + checksum_overhead) {
+        return 0;
+    }
+
+    packet = picoquic_create_packet(cnx);
+    if (packet == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    } else {
+        packet->ptype = picoquic_packet_type_from_epoch(epoch);
+        packet->pc = (epoch == 2) ? picoquic_packet_context_handshake : picoquic_packet_context_initial;
+        packet->offset = header_length;
+        packet->sequence_number = path_x->pkt_ctx[packet->pc].send_sequence;
+        packet->send_time = current_time;
+        packet->send_path = path_x;
+        packet->checksum_overhead = checksum_overhead;
+
+        length = (uint32_t)send_buffer_max - checksum_overhead;
+        memset(packet->bytes + header_length, 0, length - header_length);
+
+        picoquic_finalize_and_protect_packet(cnx, packet,
+            ret, length, header_length, checksum_overhead,
+            send_length, send_buffer, (uint32_t)send_buffer_max, path_x, current_time);
+
+        if (*send_length > 0) {
+            picoquic_segment_prepared(cnx, packet);
+        } else {
+            picoquic_destroy_packet(packet);
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Prepare next packet to send, or nothing..
+ * During the handshake, the segments of all the epochs with something to send are coalesced
+ * in the same datagram, the wake time being computed once after the last one.
+ */
 int picoquic_prepare_packet(picoquic_cnx_t* cnx,
     uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max, size_t* send_length, picoquic_path_t **path)
 {
     int ret = 0;
     picoquic_packet_t * packet = NULL;
     int contains_initial = 0;
+    int last_is_short_header = 0;
+    size_t datagram_max = send_buffer_max;
+    uint64_t profile_start = picoquic_profile_start(cnx->quic);
 
     *send_length = 0;
+    cnx->is_coalescing = (cnx->cnx_state < picoquic_state_client_ready);
+    cnx->wake_time_pending = 0;
+
+    if (picoquic_tls_is_sign_pending(cnx)) {
+        /* The server flight can go as soon as its signature is done */
+        ret = picoquic_tls_stream_process(cnx);
+    }
 
     while (ret == 0)
     {
@@ -3625,6 +4663,8 @@ int picoquic_prepare_packet(picoquic_cnx_t* cnx,
                     if (packet->length == 0) {
                         picoquic_destroy_packet(packet);
                         packet = NULL;
+                    } else {
+                        last_is_short_header = 1;
                     }
                     picoquic_segment_aborted(cnx);
                     break;
@@ -3642,10 +4682,154 @@ int picoquic_prepare_packet(picoquic_cnx_t* cnx,
         }
     }
 
-    if (cnx->client_mode && contains_initial
-        && packet->ptype != picoquic_packet_1rtt_protected_phi0
-        && packet->ptype != picoquic_packet_1rtt_protected_phi1) {
-        // TODO: Add another QUIC packet full of padding using the best encryption level available
+    /* A short header packet was padded when built, otherwise the datagram gets a last padding packet */
+    if (ret == 0 && cnx->client_mode && contains_initial && !last_is_short_header &&
+        *send_length < PICOQUIC_ENFORCED_INITIAL_MTU) {
+        size_t segment_length = 0;
+        size_t padded_max = (datagram_max < cnx->path[0]->send_mtu) ? datagram_max : cnx->path[0]->send_mtu;
+
+        if (padded_max > *send_length) {
+            ret = picoquic_prepare_padding_packet(cnx, cnx->path[0], current_time,
+                send_buffer + *send_length, padded_max - *send_length, &segment_length);
+            *send_length += segment_length;
+        }
+    }
+
+    cnx->is_coalescing = 0;
+    if (cnx->wake_time_pending) {
+        cnx->wake_time_pending = 0;
+        if (cnx->cnx_state != picoquic_state_draining) {
+            picoquic_cnx_set_next_wake_time(cnx, current_time);
+        }
+    }
+
+    if (ret == 0 && picoquic_tls_is_sign_pending(cnx) &&
+        cnx->next_wake_time > current_time + PICOQUIC_SIGN_OFFLOAD_POLL_INTERVAL) {
+        picoquic_reinsert_by_wake_time(cnx->quic, cnx, current_time + PICOQUIC_SIGN_OFFLOAD_POLL_INTERVAL);
+    }
+
+    if (ret == 0) {
+        if (*send_length > 0) {
+            picoquic_wake_cnx(cnx);
+        } else {
+            picoquic_check_hibernation(cnx, current_time);
+        }
+    }
+
+    if (ret == 0 && cnx->nb_send_blocked > 0) {
+        picoquic_notify_send_buffer_low(cnx);
+    }
+
+    /* In a burst, the close datagram is only final once its header protection is applied */
+    if (ret == 0 && cnx->tombstone_pending && cnx->hp_batch == NULL) {
+        picoquic_bury_cnx(cnx, send_buffer, *send_length, current_time);
+    }
+
+    picoquic_profile_end(cnx->quic, picoquic_profile_prepare, profile_start);
+
+    return ret;
+}
+
+/*
+ * Prepare a burst of datagrams for the same path, laid out back to back in send_buffer.
+ * All of them but the last have the length of the first one, as expected by segmentation offload,
+ * which is why a burst only continues after full sized datagrams.
+ */
+int picoquic_prepare_packets(picoquic_cnx_t* cnx, uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max,
+    size_t* segment_lengths, size_t max_segments, size_t* nb_segments, picoquic_path_t** path)
+{
+    int ret = 0;
+    size_t offset = 0;
+    size_t segment_max = send_buffer_max;
+    uint64_t first_departure = current_time;
+
+    picoquic_hp_batch_t hp_batch;
+
+    *nb_segments = 0;
+    *path = NULL;
+    hp_batch.nb_entries = 0;
+    cnx->hp_batch = &hp_batch;
+    picoquic_check_key_retention(cnx, current_time);
+    if (cnx->log_policy_state == picoquic_log_policy_watching) {
+        picoquic_log_policy_update(cnx);
+    }
+
+    while (*nb_segments < max_segments && segment_max <= send_buffer_max - offset) {
+        size_t length = 0;
+        picoquic_path_t* path_x = NULL;
+
+        ret = picoquic_prepare_packet(cnx, current_time, send_buffer + offset, segment_max, &length, &path_x);
+        if (ret != 0 || length == 0) {
+            break;
+        }
+        if (*nb_segments == 0) {
+            *path = path_x;
+            segment_max = length;
+        }
+        segment_lengths[(*nb_segments)++] = length;
+        offset += length;
+
+        /* With several paths, the next datagram could be sent on another one */
+        if (length < segment_max || length < path_x->send_mtu || cnx->nb_paths > 1) {
+            break;
+        }
+        /* The segments of a burst leave together, so a datagram that departs later than the first one ends it */
+        if (*nb_segments == 1) {
+            first_departure = picoquic_get_departure_time(path_x);
+        } else if (picoquic_get_departure_time(path_x) != first_departure) {
+            break;
+        }
+    }
+
+    cnx->hp_batch = NULL;
+    picoquic_hp_batch_flush(&hp_batch);
+
+    if (cnx->tombstone_pending) {
+        /* Nothing follows the close datagram in the burst */
+        size_t last_length = (*nb_segments > 0) ? segment_lengths[*nb_segments - 1] : 0;
+
+        picoquic_bury_cnx(cnx, send_buffer + offset - last_length, last_length, current_time);
+    }
+
+    /* The error will be returned again by the next call, once the burst is sent */
+    if (*nb_segments > 0) {
+        ret = 0;
+    }
+
+    return ret;
+}
+
+int picoquic_prepare_next_packets(picoquic_quic_t* quic, uint64_t current_time, uint8_t* send_buffer, size_t send_buffer_max,
+    size_t* segment_lengths, size_t max_segments, size_t* nb_segments, picoquic_cnx_t** p_cnx, picoquic_path_t** path)
+{
+    int ret = 0;
+    picoquic_cnx_t* cnx = picoquic_get_earliest_cnx_to_wake(quic, current_time);
+
+    *p_cnx = cnx;
+    *nb_segments = 0;
+    *path = NULL;
+
+    if (cnx != NULL) {
+        if (quic->send_budget_packets > 0 && quic->send_budget_packets < max_segments) {
+            max_segments = quic->send_budget_packets;
+        }
+        if (quic->send_budget_bytes > 0 && quic->send_budget_bytes < send_buffer_max) {
+            /* The burst ends when the next full datagram does not fit, a first one always does */
+            size_t mtu = cnx->path[0]->send_mtu;
+
+            if (mtu < send_buffer_max) {
+                send_buffer_max = (quic->send_budget_bytes > mtu) ? quic->send_budget_bytes : mtu;
+            }
+        }
+
+        ret = picoquic_prepare_packets(cnx, current_time, send_buffer, send_buffer_max,
+            segment_lengths, max_segments, nb_segments, path);
+
+        if (ret == 0 && cnx->next_wake_time <= current_time) {
+            /* Behind the connections that were ready before the end of the turn. One that did not send
+             * anything is left for the next loop, so that the callers draining the ready ones end. */
+            picoquic_reinsert_by_wake_time(quic, cnx, (*nb_segments > 0) ? current_time : current_time + 1);
+        }
     }
 
     return ret;
@@ -3695,4 +4879,5 @@ void sender_register_noparam_protoops(picoquic_cnx_t *cnx)
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PREPARE_MTU_PROBE, &prepare_mtu_probe);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_FINALIZE_AND_PROTECT_PACKET, &finalize_and_protect_packet);
     register_noparam_protoop(cnx, &PROTOOP_NOPARAM_HAS_CONGESTION_CONTROLLED_PLUGIN_FRAMEMS_TO_SEND, &has_congestion_controlled_plugin_frames_to_send);
+    register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PACKET_WINDOW, &packet_window);
 }
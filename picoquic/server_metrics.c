@@ -0,0 +1,202 @@
+#include "server_metrics.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PICOQUIC_SERVER_METRICS_MAGIC 0x7071756963736d31ull /* "pquicsm1" */
+
+static char const* picoquic_server_metrics_counter_names[picoquic_server_metrics_nb_counters] = {
+    "connections_total", "handshake_failures_total", "bytes_sent_total", "bytes_received_total",
+    "bytes_lost_total", "packets_sent_total", "packets_received_total", "packets_lost_total",
+    "rto_fired_total", "tlp_fired_total", "frt_fired_total", "streams_opened_total"
+};
+
+static char const* picoquic_server_metrics_histogram_names[picoquic_server_metrics_nb_histograms] = {
+    "rtt_microseconds", "loss_rate_per_million", "cwnd_bytes", "goodput_bytes_per_second"
+};
+
+static picoquic_server_metrics_t* picoquic_server_metrics_attach(void* mapping)
+{
+    picoquic_server_metrics_t* metrics = (picoquic_server_metrics_t*)malloc(sizeof(picoquic_server_metrics_t));
+    picoquic_server_metrics_shared_t* shared = (picoquic_server_metrics_shared_t*)mapping;
+    uint64_t expected = 0;
+
+    /* The zeroed pages are already empty metrics, the magic number only tells a mapping of something else apart */
+    __atomic_compare_exchange_n(&shared->magic, &expected, PICOQUIC_SERVER_METRICS_MAGIC, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    if (metrics == NULL || __atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != PICOQUIC_SERVER_METRICS_MAGIC) {
+        munmap(mapping, sizeof(picoquic_server_metrics_shared_t));
+        free(metrics);
+        metrics = NULL;
+    } else {
+        metrics->shared = shared;
+    }
+
+    return metrics;
+}
+
+picoquic_server_metrics_t* picoquic_server_metrics_create(char const* shm_name)
+{
+    size_t size = sizeof(picoquic_server_metrics_shared_t);
+    void* mapping = MAP_FAILED;
+
+    if (shm_name == NULL) {
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    } else {
+        int fd = shm_open(shm_name, O_RDWR | O_CREAT, 0600);
+        struct stat st;
+
+        if (fd >= 0) {
+            /* Growing an object is harmless for the processes that mapped it already */
+            if (fstat(fd, &st) == 0 && ((size_t)st.st_size >= size || ftruncate(fd, (off_t)size) == 0)) {
+                mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            close(fd);
+        }
+    }
+
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "cannot map the server metrics %s !\n", (shm_name == NULL) ? "" : shm_name);
+        return NULL;
+    }
+
+    return picoquic_server_metrics_attach(mapping);
+}
+
+void picoquic_server_metrics_release(picoquic_server_metrics_t* metrics)
+{
+    if (metrics != NULL) {
+        munmap(metrics->shared, sizeof(picoquic_server_metrics_shared_t));
+        free(metrics);
+    }
+}
+
+int picoquic_server_metrics_unlink(char const* shm_name)
+{
+    return shm_unlink(shm_name);
+}
+
+static int picoquic_server_metrics_bucket(uint64_t value)
+{
+    int bucket = (value <= 1) ? 0 : 64 - __builtin_clzll(value - 1);
+
+    return (bucket < PICOQUIC_SERVER_METRICS_BUCKETS) ? bucket : PICOQUIC_SERVER_METRICS_BUCKETS - 1;
+}
+
+static void picoquic_server_metrics_add(uint64_t* value, uint64_t delta)
+{
+    if (delta != 0) {
+        __atomic_fetch_add(value, delta, __ATOMIC_RELAXED);
+    }
+}
+
+static void picoquic_server_metrics_observe(picoquic_server_metrics_shared_t* shared,
+    picoquic_server_metrics_histogram_enum histogram, uint64_t value)
+{
+    picoquic_server_metrics_histogram_t* h = &shared->histograms[histogram];
+
+    __atomic_fetch_add(&h->buckets[picoquic_server_metrics_bucket(value)], 1, __ATOMIC_RELAXED);
+    picoquic_server_metrics_add(&h->sum, value);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+}
+
+void picoquic_server_metrics_merge(picoquic_server_metrics_t* metrics, picoquic_server_metrics_sample_t const* sample)
+{
+    picoquic_server_metrics_shared_t* shared = metrics->shared;
+    uint64_t* counters = shared->counters;
+
+    picoquic_server_metrics_add(&counters[picoquic_server_metrics_connections], 1);
+    picoquic_server_metrics_add(&counters[picoquic_server_metrics_handshake_failures], sample->handshake_failed ? 1 : 0);
+    picoquic_server_metrics_add(&counters[picoquic_server_metrics_bytes_sent], sample->bytes_sent);
+    picoquic_server_metrics_add(&counters[picoquic_server_metrics_bytes_received], sample->bytes_received);
+    picoquic_server_metrics_add(&counters[picoquic_server_metrics_bytes_lost], sample->bytes_lost);
+    picoquic_server_metrics_add(&counters[picoquic_server_metrics_packets_sent], sample->packets_sent);
+    picoquic_server_metrics_add(&counters[picoquic_server_metrics_packets_received], sample->packets_received);
+    picoquic_server_metrics_add(&counters[picoquic_server_metrics_packets_lost], sample->packets_lost);
+    picoquic_server_metrics_add(&counters[picoquic_server_metrics_rto_fired], sample->rto_fired);
+    picoquic_server_metrics_add(&counters[picoquic_server_metrics_tlp_fired], sample->tlp_fired);
+    picoquic_server_metrics_add(&counters[picoquic_server_metrics_frt_fired], sample->frt_fired);
+    picoquic_server_metrics_add(&counters[picoquic_server_metrics_streams_opened], sample->streams_opened);
+
+    /* A failed handshake says nothing of the path, it would only skew the histograms */
+    if (!sample->handshake_failed) {
+        picoquic_server_metrics_observe(shared, picoquic_server_metrics_rtt, sample->smoothed_rtt);
+        picoquic_server_metrics_observe(shared, picoquic_server_metrics_cwnd, sample->cwnd);
+        if (sample->packets_sent > 0) {
+            picoquic_server_metrics_observe(shared, picoquic_server_metrics_loss_rate,
+                (sample->packets_lost * 1000000) / sample->packets_sent);
+        }
+        if (sample->duration > 0) {
+            uint64_t delivered = (sample->bytes_sent > sample->bytes_lost) ? sample->bytes_sent - sample->bytes_lost : 0;
+            picoquic_server_metrics_observe(shared, picoquic_server_metrics_goodput,
+                (uint64_t)(((double)delivered * 1000000.0) / (double)sample->duration));
+        }
+    }
+}
+
+void picoquic_server_metrics_snapshot(picoquic_server_metrics_t* metrics, picoquic_server_metrics_shared_t* snapshot)
+{
+    uint64_t const* values = (uint64_t const*)metrics->shared;
+    uint64_t* copy = (uint64_t*)snapshot;
+
+    for (size_t i = 0; i < sizeof(picoquic_server_metrics_shared_t) / sizeof(uint64_t); i++) {
+        copy[i] = __atomic_load_n(&values[i], __ATOMIC_RELAXED);
+    }
+}
+
+static int picoquic_server_metrics_print(char* buf, size_t buf_len, size_t* length, char const* fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static int picoquic_server_metrics_print(char* buf, size_t buf_len, size_t* length, char const* fmt, ...)
+{
+    va_list args;
+    int ret;
+
+    va_start(args, fmt);
+    ret = vsnprintf(buf + *length, buf_len - *length, fmt, args);
+    va_end(args);
+
+    if (ret < 0 || (size_t)ret >= buf_len - *length) {
+        return -1;
+    }
+    *length += (size_t)ret;
+    return 0;
+}
+
+int picoquic_server_metrics_format(picoquic_server_metrics_shared_t const* snapshot, char const* prefix, char* buf, size_t buf_len)
+{
+    size_t length = 0;
+    int ret = (buf_len > 0) ? 0 : -1;
+
+    for (int i = 0; ret == 0 && i < picoquic_server_metrics_nb_counters; i++) {
+        ret = picoquic_server_metrics_print(buf, buf_len, &length, "# TYPE %s%s counter\n%s%s %llu\n",
+            prefix, picoquic_server_metrics_counter_names[i], prefix, picoquic_server_metrics_counter_names[i],
+            (unsigned long long)snapshot->counters[i]);
+    }
+
+    for (int i = 0; ret == 0 && i < picoquic_server_metrics_nb_histograms; i++) {
+        picoquic_server_metrics_histogram_t const* h = &snapshot->histograms[i];
+        char const* name = picoquic_server_metrics_histogram_names[i];
+        uint64_t cumulated = 0;
+
+        ret = picoquic_server_metrics_print(buf, buf_len, &length, "# TYPE %s%s histogram\n", prefix, name);
+        /* Prometheus wants cumulative buckets */
+        for (int b = 0; ret == 0 && b < PICOQUIC_SERVER_METRICS_BUCKETS - 1; b++) {
+            cumulated += h->buckets[b];
+            ret = picoquic_server_metrics_print(buf, buf_len, &length, "%s%s_bucket{le=\"%llu\"} %llu\n",
+                prefix, name, 1ull << b, (unsigned long long)cumulated);
+        }
+        if (ret == 0) {
+            ret = picoquic_server_metrics_print(buf, buf_len, &length,
+                "%s%s_bucket{le=\"+Inf\"} %llu\n%s%s_sum %llu\n%s%s_count %llu\n",
+                prefix, name, (unsigned long long)h->count, prefix, name, (unsigned long long)h->sum,
+                prefix, name, (unsigned long long)h->count);
+        }
+    }
+
+    return (ret == 0) ? (int)length : -1;
+}
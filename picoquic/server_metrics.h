@@ -0,0 +1,94 @@
+/**
+ * \file server_metrics.h
+ * \brief Metrics aggregated over all the connections of one or several server contexts.
+ *
+ * Each connection is merged once, when it closes, as a sample of its totals. The sample goes in counters
+ * and in histograms of its RTT, loss rate, congestion window and goodput, with power of 2 buckets.
+ * The aggregate lives in shared memory, either anonymous and inherited through fork() or named, so that
+ * an exporter process can map it. Merges and snapshots only use atomic operations on the mapping, and
+ * the packets are never involved.
+ */
+
+#ifndef SERVER_METRICS_H
+#define SERVER_METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PICOQUIC_SERVER_METRICS_BUCKETS 40 /* Bucket i counts the values up to 2^i, the last one all the larger ones */
+
+typedef enum {
+    picoquic_server_metrics_rtt = 0, /* Smoothed RTT, in microseconds */
+    picoquic_server_metrics_loss_rate, /* Lost packets per million sent */
+    picoquic_server_metrics_cwnd, /* Congestion window at the end, in bytes */
+    picoquic_server_metrics_goodput, /* Bytes sent and not lost per second */
+    picoquic_server_metrics_nb_histograms
+} picoquic_server_metrics_histogram_enum;
+
+typedef enum {
+    picoquic_server_metrics_connections = 0,
+    picoquic_server_metrics_handshake_failures,
+    picoquic_server_metrics_bytes_sent,
+    picoquic_server_metrics_bytes_received,
+    picoquic_server_metrics_bytes_lost,
+    picoquic_server_metrics_packets_sent,
+    picoquic_server_metrics_packets_received,
+    picoquic_server_metrics_packets_lost,
+    picoquic_server_metrics_rto_fired,
+    picoquic_server_metrics_tlp_fired,
+    picoquic_server_metrics_frt_fired,
+    picoquic_server_metrics_streams_opened,
+    picoquic_server_metrics_nb_counters
+} picoquic_server_metrics_counter_enum;
+
+/* Totals of a connection, given by the monitoring plugin with the merge_server_metrics operation */
+typedef struct st_picoquic_server_metrics_sample_t {
+    uint64_t duration; /* Microseconds */
+    uint64_t smoothed_rtt; /* Microseconds */
+    uint64_t cwnd;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t bytes_lost;
+    uint64_t packets_sent;
+    uint64_t packets_received;
+    uint64_t packets_lost;
+    uint64_t rto_fired;
+    uint64_t tlp_fired;
+    uint64_t frt_fired;
+    uint64_t streams_opened;
+    int handshake_failed;
+} picoquic_server_metrics_sample_t;
+
+typedef struct st_picoquic_server_metrics_histogram_t {
+    uint64_t buckets[PICOQUIC_SERVER_METRICS_BUCKETS];
+    uint64_t sum;
+    uint64_t count;
+} picoquic_server_metrics_histogram_t;
+
+/* Layout of the shared mapping. A snapshot is a copy of it */
+typedef struct st_picoquic_server_metrics_shared_t {
+    uint64_t magic;
+    uint64_t counters[picoquic_server_metrics_nb_counters];
+    picoquic_server_metrics_histogram_t histograms[picoquic_server_metrics_nb_histograms];
+} picoquic_server_metrics_shared_t;
+
+typedef struct st_picoquic_server_metrics_t {
+    picoquic_server_metrics_shared_t* shared;
+} picoquic_server_metrics_t;
+
+/* With a NULL name the mapping is anonymous and shared with the children forked afterwards,
+ * otherwise it is the POSIX shared memory object of that name, created if needed.
+ * Returns NULL on failure. */
+picoquic_server_metrics_t* picoquic_server_metrics_create(char const* shm_name);
+/* Unmaps the metrics. The named object stays until picoquic_server_metrics_unlink() */
+void picoquic_server_metrics_release(picoquic_server_metrics_t* metrics);
+int picoquic_server_metrics_unlink(char const* shm_name);
+
+void picoquic_server_metrics_merge(picoquic_server_metrics_t* metrics, picoquic_server_metrics_sample_t const* sample);
+/* Each value is read atomically, but the merges made meanwhile may only be partly in the copy */
+void picoquic_server_metrics_snapshot(picoquic_server_metrics_t* metrics, picoquic_server_metrics_shared_t* snapshot);
+/* Writes the snapshot in the Prometheus text format, each metric name starting with prefix.
+ * Returns the length written, or -1 if the buffer is too small */
+int picoquic_server_metrics_format(picoquic_server_metrics_shared_t const* snapshot, char const* prefix, char* buf, size_t buf_len);
+
+#endif
@@ -0,0 +1,180 @@
+#include "stream_recv.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Copies length bytes at the position of offset in the ring, wrapping around its end */
+static void picoquic_stream_recv_write(uint8_t* buffer, size_t size, uint64_t offset, const uint8_t* bytes, size_t length)
+{
+    size_t position = (size_t)(offset & (size - 1));
+    size_t first = (length < size - position) ? length : size - position;
+
+    memcpy(buffer + position, bytes, first);
+    memcpy(buffer, bytes + first, length - first);
+}
+
+/* Makes room for the bytes up to end_offset, moving the kept ones to their position in the new ring */
+static int picoquic_stream_recv_grow(picoquic_stream_recv_t* recv, uint64_t consumed_offset, uint64_t end_offset)
+{
+    size_t new_size = (recv->size == 0) ? PICOQUIC_STREAM_RECV_MIN_SIZE : recv->size;
+    uint8_t* new_buffer;
+
+    if (end_offset - consumed_offset <= recv->size) {
+        return 0;
+    }
+    while (new_size < end_offset - consumed_offset) {
+        new_size *= 2;
+    }
+    if ((new_buffer = (uint8_t*)malloc(new_size)) == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < recv->nb_ranges; i++) {
+        uint64_t offset = recv->ranges[i].start;
+
+        while (offset < recv->ranges[i].end) {
+            size_t position = (size_t)(offset & (recv->size - 1));
+            size_t length = (size_t)(recv->ranges[i].end - offset);
+
+            if (length > recv->size - position) {
+                length = recv->size - position;
+            }
+            picoquic_stream_recv_write(new_buffer, new_size, offset, recv->buffer + position, length);
+            offset += length;
+        }
+    }
+
+    free(recv->buffer);
+    recv->buffer = new_buffer;
+    recv->size = new_size;
+
+    return 0;
+}
+
+int picoquic_stream_recv_insert(picoquic_stream_recv_t* recv, uint64_t consumed_offset,
+    uint64_t offset, const uint8_t* bytes, size_t length, int* new_data)
+{
+    uint64_t start = offset;
+    uint64_t end = offset + length;
+    uint64_t covered = 0;
+    size_t first = 0;
+    size_t last;
+
+    if (start < consumed_offset) {
+        if (end <= consumed_offset) {
+            /* already received */
+            return 0;
+        }
+        bytes += consumed_offset - start;
+        start = consumed_offset;
+    }
+    if (start >= end) {
+        return 0;
+    }
+
+    /* The ranges in [first, last) overlap or touch the new one, and are merged with it */
+    while (first < recv->nb_ranges && recv->ranges[first].end < start) {
+        first++;
+    }
+    for (last = first; last < recv->nb_ranges && recv->ranges[last].start <= end; last++) {
+        uint64_t overlap_start = (recv->ranges[last].start > start) ? recv->ranges[last].start : start;
+        uint64_t overlap_end = (recv->ranges[last].end < end) ? recv->ranges[last].end : end;
+
+        if (overlap_end > overlap_start) {
+            covered += overlap_end - overlap_start;
+        }
+    }
+
+    if (covered == end - start) {
+        return 0;
+    }
+    if (picoquic_stream_recv_grow(recv, consumed_offset, end) != 0) {
+        return -1;
+    }
+
+    if (first == last) {
+        if (recv->nb_ranges >= recv->nb_ranges_alloc) {
+            size_t new_alloc = (recv->nb_ranges_alloc == 0) ? PICOQUIC_STREAM_RECV_MIN_RANGES : 2 * recv->nb_ranges_alloc;
+            picoquic_recv_range_t* new_ranges = (picoquic_recv_range_t*)realloc(recv->ranges, new_alloc * sizeof(picoquic_recv_range_t));
+
+            if (new_ranges == NULL) {
+                return -1;
+            }
+            recv->ranges = new_ranges;
+            recv->nb_ranges_alloc = new_alloc;
+        }
+        memmove(&recv->ranges[first + 1], &recv->ranges[first], (recv->nb_ranges - first) * sizeof(picoquic_recv_range_t));
+        recv->ranges[first].start = start;
+        recv->ranges[first].end = end;
+        recv->nb_ranges++;
+    } else {
+        if (recv->ranges[first].start < start) {
+            start = recv->ranges[first].start;
+        }
+        if (recv->ranges[last - 1].end > end) {
+            end = recv->ranges[last - 1].end;
+        }
+        recv->ranges[first].start = start;
+        recv->ranges[first].end = end;
+        memmove(&recv->ranges[first + 1], &recv->ranges[last], (recv->nb_ranges - last) * sizeof(picoquic_recv_range_t));
+        recv->nb_ranges -= last - first - 1;
+        start = (offset > consumed_offset) ? offset : consumed_offset;
+    }
+
+    /* Rewriting the bytes already received is harmless, they are the same */
+    picoquic_stream_recv_write(recv->buffer, recv->size, start, bytes, (size_t)(offset + length - start));
+    *new_data = 1;
+
+    return 0;
+}
+
+uint64_t picoquic_stream_recv_first_offset(picoquic_stream_recv_t* recv)
+{
+    return (recv->nb_ranges == 0) ? UINT64_MAX : recv->ranges[0].start;
+}
+
+size_t picoquic_stream_recv_peek(picoquic_stream_recv_t* recv, uint64_t consumed_offset, const uint8_t** bytes)
+{
+    size_t position;
+    size_t length;
+
+    if (recv->nb_ranges == 0 || recv->ranges[0].start > consumed_offset) {
+        return 0;
+    }
+
+    position = (size_t)(consumed_offset & (recv->size - 1));
+    length = (size_t)(recv->ranges[0].end - consumed_offset);
+    if (length > recv->size - position) {
+        length = recv->size - position;
+    }
+    *bytes = recv->buffer + position;
+
+    return length;
+}
+
+void picoquic_stream_recv_release(picoquic_stream_recv_t* recv, uint64_t consumed_offset)
+{
+    size_t nb_released = 0;
+
+    while (nb_released < recv->nb_ranges && recv->ranges[nb_released].end <= consumed_offset) {
+        nb_released++;
+    }
+    if (nb_released > 0) {
+        memmove(&recv->ranges[0], &recv->ranges[nb_released], (recv->nb_ranges - nb_released) * sizeof(picoquic_recv_range_t));
+        recv->nb_ranges -= nb_released;
+    }
+    if (recv->nb_ranges > 0 && recv->ranges[0].start < consumed_offset) {
+        recv->ranges[0].start = consumed_offset;
+    }
+}
+
+size_t picoquic_stream_recv_footprint(picoquic_stream_recv_t* recv)
+{
+    return recv->size + recv->nb_ranges_alloc * sizeof(picoquic_recv_range_t);
+}
+
+void picoquic_stream_recv_free(picoquic_stream_recv_t* recv)
+{
+    free(recv->buffer);
+    free(recv->ranges);
+    memset(recv, 0, sizeof(picoquic_stream_recv_t));
+}
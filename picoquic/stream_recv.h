@@ -0,0 +1,54 @@
+/**
+ * \file stream_recv.h
+ * \brief Reassembly of the data received on a stream.
+ *
+ * The bytes received beyond the consumed offset are kept in a ring, at the position given by their
+ * stream offset modulo the size of the ring, which grows as needed up to the receive window.
+ * A sorted array of intervals tells which of them were received. The in-order data is handed out
+ * as contiguous spans of the ring.
+ */
+
+#ifndef STREAM_RECV_H
+#define STREAM_RECV_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PICOQUIC_STREAM_RECV_MIN_SIZE 4096 /* Must be a power of 2 */
+#define PICOQUIC_STREAM_RECV_MIN_RANGES 4
+
+typedef struct st_picoquic_recv_range_t {
+    uint64_t start;
+    uint64_t end; /* First byte after the range */
+} picoquic_recv_range_t;
+
+typedef struct st_picoquic_stream_recv_t {
+    uint8_t* buffer;
+    size_t size; /* 0 until some data is kept, a power of 2 otherwise */
+    picoquic_recv_range_t* ranges; /* Disjoint and not adjacent, sorted by offset */
+    size_t nb_ranges;
+    size_t nb_ranges_alloc;
+} picoquic_stream_recv_t;
+
+/**
+ * Keeps the bytes of [offset, offset + length) that are beyond consumed_offset.
+ * new_data is set if some of them were not received before. Returns -1 on allocation failure.
+ */
+int picoquic_stream_recv_insert(picoquic_stream_recv_t* recv, uint64_t consumed_offset,
+    uint64_t offset, const uint8_t* bytes, size_t length, int* new_data);
+
+/* Returns the offset of the first byte kept, UINT64_MAX if there is none */
+uint64_t picoquic_stream_recv_first_offset(picoquic_stream_recv_t* recv);
+
+/* Returns the length of the contiguous span of data starting at consumed_offset, 0 if there is none */
+size_t picoquic_stream_recv_peek(picoquic_stream_recv_t* recv, uint64_t consumed_offset, const uint8_t** bytes);
+
+/* Forgets the bytes before consumed_offset */
+void picoquic_stream_recv_release(picoquic_stream_recv_t* recv, uint64_t consumed_offset);
+
+void picoquic_stream_recv_free(picoquic_stream_recv_t* recv);
+
+/* Memory allocated for the ring and the ranges */
+size_t picoquic_stream_recv_footprint(picoquic_stream_recv_t* recv);
+
+#endif
@@ -0,0 +1,512 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+#endif
+#include "threaded_server.h"
+#include "picoquic_internal.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#include <sys/syscall.h>
+#endif
+
+void picoquic_worker_cnx_id_callback(picoquic_connection_id_t cnx_id_local, picoquic_connection_id_t cnx_id_remote,
+    void* cnx_id_cb_data, picoquic_connection_id_t* cnx_id_returned)
+{
+    picoquic_server_worker_t* worker = (picoquic_server_worker_t*)cnx_id_cb_data;
+
+    *cnx_id_returned = cnx_id_local;
+    if (cnx_id_returned->id_len > 0) {
+        cnx_id_returned->id[0] = (uint8_t)worker->id;
+    }
+}
+
+int picoquic_threaded_server_route(picoquic_threaded_server_t* server, const uint8_t* bytes, size_t length)
+{
+    int worker_id = -1;
+
+    if (length > 1 && (bytes[0] & 0x80) == 0) {
+        worker_id = bytes[1];
+    } else if (length > 6 && bytes[5] > 0) {
+        /* The connection ID of the first Initial packets is chosen by the client; whichever worker it
+         * designates will create the connection, with connection IDs of its own */
+        worker_id = bytes[6];
+    }
+
+    return (worker_id < server->nb_workers) ? worker_id : -1;
+}
+
+/*
+ * Reuseport program implementing picoquic_threaded_server_route on the UDP payload. An index out of
+ * the group makes the kernel fall back to its flow hash.
+ */
+static int picoquic_threaded_server_attach_steering(picoquic_threaded_server_t* server, SOCKET_TYPE fd)
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x80, 2, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 1),
+        BPF_STMT(BPF_JMP | BPF_JA, 3),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 5),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 3, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 6),
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, (uint32_t)server->nb_workers, 1, 0),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+    };
+    struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+#else
+    return -1;
+#endif
+}
+
+static void picoquic_threaded_server_forward(picoquic_server_worker_t* worker, int to, picoquic_recv_datagram_t* datagram)
+{
+    picoquic_threaded_server_t* server = worker->server;
+    picoquic_forward_queue_t* queue = &server->queues[worker->id * server->nb_workers + to];
+    uint64_t head = queue->head;
+    uint64_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    char c = 0;
+
+    if (head - tail == PICOQUIC_THREADED_SERVER_QUEUE_SIZE || datagram->length > PICOQUIC_MAX_PACKET_SIZE) {
+        queue->dropped++;
+        return;
+    }
+
+    picoquic_forwarded_packet_t* packet = &queue->packets[head & (PICOQUIC_THREADED_SERVER_QUEUE_SIZE - 1)];
+    packet->datagram = *datagram;
+    memcpy(packet->bytes, datagram->bytes, datagram->length);
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    worker->nb_forwarded++;
+
+    /* The other worker might be waiting for its sockets. If the pipe is full, it has yet to wake up anyway */
+    (void)write(server->workers[to].wake_pipe[1], &c, 1);
+}
+
+static void picoquic_worker_incoming(picoquic_server_worker_t* worker, picoquic_recv_datagram_t* datagram, uint64_t current_time)
+{
+    int segment_size = (datagram->segment_size > 0) ? datagram->segment_size : datagram->length;
+    int new_context_created = 0;
+
+    worker->quic->rcv_socket = datagram->socket;
+    worker->quic->rcv_tos = datagram->tos;
+    for (int offset = 0; offset < datagram->length; offset += segment_size) {
+        size_t length = (datagram->length - offset < segment_size) ? datagram->length - offset : segment_size;
+
+        worker->quic->rcv_time = datagram->rcv_time;
+        (void)picoquic_incoming_packet(worker->quic, datagram->bytes + offset, length,
+            (struct sockaddr*)&datagram->addr_from, (struct sockaddr*)&datagram->addr_dest, datagram->dest_if,
+            current_time, &new_context_created);
+    }
+}
+
+static int picoquic_worker_local_port(struct sockaddr* addr)
+{
+    if (addr->sa_family == AF_INET) {
+        return ntohs(((struct sockaddr_in*)addr)->sin_port);
+    } else if (addr->sa_family == AF_INET6) {
+        return ntohs(((struct sockaddr_in6*)addr)->sin6_port);
+    }
+    return 0;
+}
+
+static void picoquic_worker_send(picoquic_server_worker_t* worker, uint8_t* send_buffer, size_t send_buffer_size)
+{
+    picoquic_cnx_t* cnx_next;
+    uint64_t loop_time = picoquic_refresh_time(worker->quic);
+    size_t segment_lengths[PICOQUIC_THREADED_SERVER_BATCH];
+    size_t nb_segments = 0;
+    picoquic_path_t* path = NULL;
+
+    (void)picoquic_send_stateless_packets(worker->quic, &worker->sockets);
+
+    /* The ready connections take turns, within the send budget of the QUIC context */
+    while (1) {
+        int ret = picoquic_prepare_next_packets(worker->quic, loop_time, send_buffer, send_buffer_size,
+            segment_lengths, PICOQUIC_THREADED_SERVER_BATCH, &nb_segments, &cnx_next, &path);
+
+        if (cnx_next == NULL) {
+            break;
+        } else if (ret == PICOQUIC_ERROR_DISCONNECTED) {
+            picoquic_delete_cnx(cnx_next);
+        } else if (ret != 0) {
+            break;
+        } else if (nb_segments > 0) {
+            struct sockaddr* peer_addr;
+            int peer_addr_len = 0;
+            struct sockaddr* local_addr;
+            int local_addr_len = 0;
+            size_t send_length = 0;
+
+            for (size_t i = 0; i < nb_segments; i++) {
+                send_length += segment_lengths[i];
+            }
+            picoquic_get_peer_addr(path, &peer_addr, &peer_addr_len);
+            picoquic_get_local_addr(path, &local_addr, &local_addr_len);
+            (void)picoquic_send_segments_through_server_sockets(
+                (worker->preferred_port != 0 && picoquic_worker_local_port(local_addr) == worker->preferred_port) ?
+                &worker->preferred_sockets : &worker->sockets,
+                peer_addr, peer_addr_len, local_addr, local_addr_len, picoquic_get_local_if_index(path),
+                (const char*)send_buffer, (int)send_length, (int)segment_lengths[0], picoquic_get_departure_time(path));
+        }
+    }
+}
+
+int picoquic_cpu_numa_node(int cpu)
+{
+#ifdef __linux__
+    char path[64];
+    int node = 0;
+
+    /* The node of a cpu is the nodeN entry of its directory */
+    while (snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node) < (int)sizeof(path) && node < 1024) {
+        if (access(path, F_OK) == 0) {
+            return node;
+        }
+        node++;
+    }
+#endif
+    return -1;
+}
+
+int picoquic_netdev_numa_node(const char* ifname)
+{
+    int node = -1;
+#ifdef __linux__
+    char path[128];
+    FILE* f;
+
+    if (snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname) < (int)sizeof(path) &&
+        (f = fopen(path, "r")) != NULL) {
+        if (fscanf(f, "%d", &node) != 1) {
+            node = -1;
+        }
+        fclose(f);
+    }
+#endif
+    return node;
+}
+
+int picoquic_set_irq_affinity(int irq, int cpu)
+{
+    int ret = -1;
+#ifdef __linux__
+    char path[64];
+    FILE* f;
+
+    snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+    if ((f = fopen(path, "w")) != NULL) {
+        ret = (fprintf(f, "%d\n", cpu) > 0) ? 0 : -1;
+        if (fclose(f) != 0) {
+            ret = -1;
+        }
+    }
+#endif
+    return ret;
+}
+
+int picoquic_threaded_server_set_worker_cpu(picoquic_threaded_server_t* server, int worker_id, int cpu)
+{
+    if (worker_id < 0 || worker_id >= server->nb_workers || server->nb_started > 0) {
+        return -1;
+    }
+    server->workers[worker_id].cpu = cpu;
+    return 0;
+}
+
+/* Pins the thread of the worker to its cpu, then moves its memory to the node of that cpu */
+static void picoquic_worker_place(picoquic_server_worker_t* worker)
+{
+#ifdef __linux__
+    picoquic_threaded_server_t* server = worker->server;
+    cpu_set_t cpus;
+    int node;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        fprintf(stderr, "Cannot pin worker %d to cpu %d\n", worker->id, worker->cpu);
+        return;
+    }
+    if ((node = picoquic_cpu_numa_node(worker->cpu)) < 0) {
+        return;
+    }
+    /* The allocations of the thread now come from its node, the memory allocated before is moved there */
+    if (picoquic_get_numa_node(worker->quic) < 0) {
+        picoquic_set_numa_node(worker->quic, node);
+    }
+    for (int from = 0; from < server->nb_workers; from++) {
+        picoquic_forward_queue_t* queue = &server->queues[from * server->nb_workers + worker->id];
+        if (queue->packets != NULL) {
+            (void)picoquic_numa_bind(queue->packets, PICOQUIC_THREADED_SERVER_QUEUE_SIZE * sizeof(picoquic_forwarded_packet_t), node);
+        }
+    }
+#endif
+}
+
+static void* picoquic_worker_run(void* arg)
+{
+    picoquic_server_worker_t* worker = (picoquic_server_worker_t*)arg;
+    picoquic_threaded_server_t* server = worker->server;
+    picoquic_recv_datagram_t datagrams[PICOQUIC_THREADED_SERVER_BATCH];
+    size_t packet_size = picoquic_get_max_packet_size(worker->quic);
+    uint8_t* buffer;
+    uint8_t* send_buffer;
+
+    if (worker->cpu >= 0) {
+        picoquic_worker_place(worker);
+    }
+    buffer = malloc(PICOQUIC_THREADED_SERVER_BATCH * packet_size);
+    send_buffer = malloc(PICOQUIC_THREADED_SERVER_BATCH * packet_size);
+
+    if (buffer == NULL || send_buffer == NULL) {
+        fprintf(stderr, "Cannot allocate the buffers of worker %d\n", worker->id);
+        free(buffer);
+        free(send_buffer);
+        return NULL;
+    }
+
+    while (!__atomic_load_n(&server->stop, __ATOMIC_ACQUIRE)) {
+        uint64_t current_time = picoquic_get_loop_time(worker->quic);
+        int64_t delta_t = picoquic_get_next_wake_delay(worker->quic, current_time, PICOQUIC_THREADED_SERVER_MAX_DELAY);
+        int nb_datagrams = picoquic_event_loop_recv_batch(worker->loop, datagrams, PICOQUIC_THREADED_SERVER_BATCH,
+            buffer, packet_size, delta_t, &current_time);
+        uint32_t backlog = 0;
+
+        current_time = picoquic_refresh_time(worker->quic);
+
+        for (int i = 0; i < nb_datagrams; i++) {
+            int to;
+
+            if (datagrams[i].socket == worker->wake_pipe[0]) {
+                continue;
+            }
+            backlog++;
+            to = picoquic_threaded_server_route(server, datagrams[i].bytes, datagrams[i].length);
+            if (to >= 0 && to != worker->id) {
+                picoquic_threaded_server_forward(worker, to, &datagrams[i]);
+            } else {
+                picoquic_worker_incoming(worker, &datagrams[i], current_time);
+            }
+        }
+
+        /* Then the packets forwarded by the other workers */
+        for (int from = 0; from < server->nb_workers; from++) {
+            picoquic_forward_queue_t* queue = &server->queues[from * server->nb_workers + worker->id];
+            uint64_t tail = queue->tail;
+
+            while (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) {
+                picoquic_forwarded_packet_t* packet = &queue->packets[tail & (PICOQUIC_THREADED_SERVER_QUEUE_SIZE - 1)];
+                packet->datagram.bytes = packet->bytes;
+                picoquic_worker_incoming(worker, &packet->datagram, current_time);
+                tail++;
+                __atomic_store_n(&queue->tail, tail, __ATOMIC_RELEASE);
+                backlog++;
+            }
+        }
+
+        /* The datagrams of the round, as many as a full batch when the sockets are not drained */
+        (void)picoquic_update_overload(worker->quic, current_time, backlog);
+
+        picoquic_notify_stream_batches(worker->quic);
+        picoquic_worker_send(worker, send_buffer, PICOQUIC_THREADED_SERVER_BATCH * packet_size);
+    }
+
+    free(buffer);
+    free(send_buffer);
+    return NULL;
+}
+
+picoquic_threaded_server_t* picoquic_threaded_server_create(int nb_workers, int port,
+    picoquic_worker_create_quic_fn create_quic, void* create_quic_ctx)
+{
+    int ret = 0;
+    picoquic_threaded_server_t* server;
+
+    if (nb_workers <= 0 || nb_workers > PICOQUIC_THREADED_SERVER_MAX_WORKERS) {
+        return NULL;
+    }
+    server = (picoquic_threaded_server_t*)calloc(1, sizeof(picoquic_threaded_server_t));
+    if (server == NULL) {
+        return NULL;
+    }
+    server->nb_workers = nb_workers;
+    server->queues = (picoquic_forward_queue_t*)calloc((size_t)nb_workers * nb_workers, sizeof(picoquic_forward_queue_t));
+    ret = (server->queues == NULL) ? -1 : 0;
+    for (int i = 0; ret == 0 && i < nb_workers * nb_workers; i++) {
+        /* A worker never forwards to itself */
+        if (i / nb_workers != i % nb_workers) {
+            /* Mapped on their own pages, so that they can be moved to the node of the worker reading them */
+            void* packets = mmap(NULL, PICOQUIC_THREADED_SERVER_QUEUE_SIZE * sizeof(picoquic_forwarded_packet_t),
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (packets == MAP_FAILED) {
+                ret = -1;
+            } else {
+                server->queues[i].packets = (picoquic_forwarded_packet_t*)packets;
+            }
+        }
+    }
+
+    for (int i = 0; i < nb_workers; i++) {
+        picoquic_server_worker_t* worker = &server->workers[i];
+        worker->server = server;
+        worker->id = i;
+        worker->cpu = -1;
+        worker->wake_pipe[0] = worker->wake_pipe[1] = -1;
+        for (int j = 0; j < PICOQUIC_NB_SERVER_SOCKETS; j++) {
+            worker->sockets.s_socket[j] = INVALID_SOCKET;
+            worker->preferred_sockets.s_socket[j] = INVALID_SOCKET;
+        }
+    }
+
+    /* The sockets are bound in the order of the workers, which is their index in the reuseport groups */
+    for (int i = 0; ret == 0 && i < nb_workers; i++) {
+        picoquic_server_worker_t* worker = &server->workers[i];
+
+        if (picoquic_open_server_sockets_ex(&worker->sockets, port, 1) != 0) {
+            fprintf(stderr, "Cannot open the sockets of worker %d\n", i);
+            ret = -1;
+        } else if (pipe(worker->wake_pipe) != 0 || fcntl(worker->wake_pipe[0], F_SETFL, O_NONBLOCK) != 0 ||
+            fcntl(worker->wake_pipe[1], F_SETFL, O_NONBLOCK) != 0) {
+            ret = -1;
+        } else if ((worker->loop = picoquic_event_loop_create()) == NULL ||
+            picoquic_event_loop_add(worker->loop, worker->wake_pipe[0]) != 0) {
+            ret = -1;
+        }
+        for (int j = 0; ret == 0 && j < PICOQUIC_NB_SERVER_SOCKETS; j++) {
+            ret = picoquic_event_loop_add(worker->loop, worker->sockets.s_socket[j]);
+        }
+        if (ret == 0 && (worker->quic = create_quic(create_quic_ctx, i)) == NULL) {
+            ret = -1;
+        }
+        if (ret == 0) {
+            worker->quic->cnx_id_callback_fn = picoquic_worker_cnx_id_callback;
+            worker->quic->cnx_id_callback_ctx = worker;
+            worker->quic->flags |= picoquic_context_unconditional_cnx_id;
+            if (worker->quic->pacing_offload_horizon > 0 && picoquic_enable_server_sockets_txtime(&worker->sockets) != 0) {
+                DBG_PRINTF("SO_TXTIME refused, the datagrams of worker %d will not be paced\n", i);
+            }
+            if (picoquic_enable_server_sockets_rx_timestamps(&worker->sockets) != 0) {
+                DBG_PRINTF("SO_TIMESTAMPING refused, the RTT of worker %d is measured in the loop\n", i);
+            }
+        }
+    }
+
+    for (int j = 0; ret == 0 && j < PICOQUIC_NB_SERVER_SOCKETS; j++) {
+        if (picoquic_threaded_server_attach_steering(server, server->workers[0].sockets.s_socket[j]) != 0) {
+            DBG_PRINTF("No reuseport steering, packets will be forwarded between workers\n");
+        }
+    }
+
+    if (ret != 0) {
+        picoquic_threaded_server_free(server);
+        server = NULL;
+    }
+
+    return server;
+}
+
+int picoquic_threaded_server_set_preferred_ports(picoquic_threaded_server_t* server, int first_port)
+{
+    int ret = (server->nb_started > 0 || first_port <= 0 || first_port + server->nb_workers > 0x10000) ? -1 : 0;
+
+    for (int i = 0; ret == 0 && i < server->nb_workers; i++) {
+        picoquic_server_worker_t* worker = &server->workers[i];
+        struct sockaddr_in addr4;
+        struct sockaddr_in6 addr6;
+
+        if (worker->preferred_port != 0) {
+            continue;
+        }
+        if (picoquic_open_server_sockets(&worker->preferred_sockets, first_port + i) != 0) {
+            fprintf(stderr, "Cannot open the preferred sockets of worker %d\n", i);
+            ret = -1;
+            break;
+        }
+        for (int j = 0; ret == 0 && j < PICOQUIC_NB_SERVER_SOCKETS; j++) {
+            ret = picoquic_event_loop_add(worker->loop, worker->preferred_sockets.s_socket[j]);
+        }
+        if (ret != 0) {
+            break;
+        }
+        if (worker->quic->pacing_offload_horizon > 0) {
+            (void)picoquic_enable_server_sockets_txtime(&worker->preferred_sockets);
+        }
+        (void)picoquic_enable_server_sockets_rx_timestamps(&worker->preferred_sockets);
+        worker->preferred_port = first_port + i;
+
+        memset(&addr4, 0, sizeof(addr4));
+        addr4.sin_family = AF_INET;
+        addr4.sin_port = htons((uint16_t)worker->preferred_port);
+        memset(&addr6, 0, sizeof(addr6));
+        addr6.sin6_family = AF_INET6;
+        addr6.sin6_port = htons((uint16_t)worker->preferred_port);
+        picoquic_set_preferred_address(worker->quic, (struct sockaddr*)&addr4, (struct sockaddr*)&addr6);
+    }
+
+    return ret;
+}
+
+int picoquic_threaded_server_start(picoquic_threaded_server_t* server)
+{
+    int ret = 0;
+
+    server->stop = 0;
+    for (int i = 0; i < server->nb_workers; i++) {
+        if (pthread_create(&server->workers[i].thread, NULL, picoquic_worker_run, &server->workers[i]) != 0) {
+            fprintf(stderr, "Cannot start worker %d\n", i);
+            picoquic_threaded_server_stop(server);
+            ret = -1;
+            break;
+        }
+        server->nb_started++;
+    }
+
+    return ret;
+}
+
+void picoquic_threaded_server_stop(picoquic_threaded_server_t* server)
+{
+    __atomic_store_n(&server->stop, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < server->nb_started; i++) {
+        pthread_join(server->workers[i].thread, NULL);
+    }
+    server->nb_started = 0;
+}
+
+void picoquic_threaded_server_free(picoquic_threaded_server_t* server)
+{
+    for (int i = 0; i < server->nb_workers; i++) {
+        picoquic_server_worker_t* worker = &server->workers[i];
+
+        if (worker->quic != NULL) {
+            picoquic_free(worker->quic);
+        }
+        if (worker->loop != NULL) {
+            picoquic_event_loop_free(worker->loop);
+        }
+        for (int j = 0; j < 2; j++) {
+            if (worker->wake_pipe[j] >= 0) {
+                close(worker->wake_pipe[j]);
+            }
+        }
+        picoquic_close_server_sockets(&worker->sockets);
+        picoquic_close_server_sockets(&worker->preferred_sockets);
+    }
+    if (server->queues != NULL) {
+        for (int i = 0; i < server->nb_workers * server->nb_workers; i++) {
+            if (server->queues[i].packets != NULL) {
+                munmap(server->queues[i].packets, PICOQUIC_THREADED_SERVER_QUEUE_SIZE * sizeof(picoquic_forwarded_packet_t));
+            }
+        }
+        free(server->queues);
+    }
+    free(server);
+}
@@ -0,0 +1,117 @@
+/**
+ * \file threaded_server.h
+ * \brief Server spreading its connections over several threads.
+ *
+ * Each worker owns a QUIC context and a set of server sockets bound with SO_REUSEPORT to the
+ * same port. The first byte of the connection IDs chosen by a worker is its index, so that a
+ * short header packet received by another worker, e.g. after a NAT rebinding, can be forwarded
+ * to the right one over a lock-free queue. On Linux, a reuseport BPF program steers most of
+ * these packets to the right socket in the first place. With picoquic_threaded_server_set_preferred_ports(),
+ * each worker also has sockets of its own, which the clients move to after the handshake, so that their
+ * packets need no steering nor forwarding from then on.
+ */
+
+#ifndef THREADED_SERVER_H
+#define THREADED_SERVER_H
+
+#include <pthread.h>
+#include "picosocks.h"
+
+#define PICOQUIC_THREADED_SERVER_MAX_WORKERS 64
+#define PICOQUIC_THREADED_SERVER_QUEUE_SIZE 256 /* Forwarded packets between two workers, must be a power of 2 */
+#define PICOQUIC_THREADED_SERVER_BATCH 8
+#define PICOQUIC_THREADED_SERVER_MAX_DELAY 100000 /* Longest wait of a worker, in us, so that it notices a stop */
+
+typedef struct st_picoquic_forwarded_packet_t {
+    picoquic_recv_datagram_t datagram;
+    uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE];
+} picoquic_forwarded_packet_t;
+
+/* Single producer, single consumer queue: head is only written by the producer, tail by the consumer */
+typedef struct st_picoquic_forward_queue_t {
+    uint64_t head;
+    uint64_t tail;
+    uint64_t dropped;
+    picoquic_forwarded_packet_t* packets;
+} picoquic_forward_queue_t;
+
+typedef struct st_picoquic_threaded_server_t picoquic_threaded_server_t;
+
+typedef struct st_picoquic_server_worker_t {
+    picoquic_threaded_server_t* server;
+    int id;
+    pthread_t thread;
+    int cpu; /* The thread is pinned to it, -1 if it is not pinned */
+    picoquic_quic_t* quic;
+    picoquic_server_sockets_t sockets;
+    picoquic_server_sockets_t preferred_sockets; /* Bound to preferred_port, which only this worker uses */
+    int preferred_port; /* 0 if the worker has no preferred address */
+    picoquic_event_loop_t* loop;
+    int wake_pipe[2]; /* Written to when a packet is forwarded to this worker */
+    uint64_t nb_forwarded; /* Packets this worker received for another one */
+} picoquic_server_worker_t;
+
+/* Creates the QUIC context of a worker, called from the thread creating the server */
+typedef picoquic_quic_t* (*picoquic_worker_create_quic_fn)(void* ctx, int worker_id);
+
+struct st_picoquic_threaded_server_t {
+    int nb_workers;
+    int nb_started; /* Threads running */
+    int stop;
+    picoquic_server_worker_t workers[PICOQUIC_THREADED_SERVER_MAX_WORKERS];
+    picoquic_forward_queue_t* queues; /* queues[from * nb_workers + to] */
+};
+
+/**
+ * Creates nb_workers workers, each one with a QUIC context made by \p create_quic and sockets bound to \p port.
+ * The connection ID callback of the contexts is replaced, to encode the index of the worker.
+ * Returns NULL on error.
+ */
+picoquic_threaded_server_t* picoquic_threaded_server_create(int nb_workers, int port,
+    picoquic_worker_create_quic_fn create_quic, void* create_quic_ctx);
+
+/**
+ * Pins the thread of a worker to cpu, -1 to leave it to the scheduler. Unless picoquic_set_numa_node() was called
+ * for its QUIC context, the memory of the worker then goes to the NUMA node of that cpu, see picoquic_cpu_numa_node().
+ * Must be called before the workers start. Returns 0 on success.
+ */
+int picoquic_threaded_server_set_worker_cpu(picoquic_threaded_server_t* server, int worker_id, int cpu);
+
+/* Returns the NUMA node of cpu, or -1 if it is unknown */
+int picoquic_cpu_numa_node(int cpu);
+
+/* Returns the NUMA node of the network interface ifname, or -1 if it is unknown. The workers serving
+ * the receive queues of the interface should be pinned to the cpus of this node. */
+int picoquic_netdev_numa_node(const char* ifname);
+
+/* Steers the interrupt irq, e.g. the one of a receive queue of the interface, to cpu. Requires root, returns 0 on success */
+int picoquic_set_irq_affinity(int irq, int cpu);
+
+/**
+ * Opens sockets for each worker on port first_port + worker index, and advertises them as the preferred address
+ * of the connections of the worker. The wildcard address is advertised, so that the clients only change port.
+ * Must be called before the workers start. Returns 0 on success.
+ */
+int picoquic_threaded_server_set_preferred_ports(picoquic_threaded_server_t* server, int first_port);
+
+/* Starts one thread per worker */
+int picoquic_threaded_server_start(picoquic_threaded_server_t* server);
+
+/* Stops the workers and waits for their threads */
+void picoquic_threaded_server_stop(picoquic_threaded_server_t* server);
+
+/* Frees the server, including the QUIC contexts of the workers. The server must be stopped */
+void picoquic_threaded_server_free(picoquic_threaded_server_t* server);
+
+/* Connection ID callback of the workers, cnx_id_cb_data being the worker */
+void picoquic_worker_cnx_id_callback(picoquic_connection_id_t cnx_id_local, picoquic_connection_id_t cnx_id_remote,
+    void* cnx_id_cb_data, picoquic_connection_id_t* cnx_id_returned);
+
+/**
+ * Returns the index of the worker owning the connection of the packet, or -1 if the packet can be
+ * processed by any, which is the case of the long header packets whose connection ID was chosen
+ * by the client.
+ */
+int picoquic_threaded_server_route(picoquic_threaded_server_t* server, const uint8_t* bytes, size_t length);
+
+#endif
@@ -24,12 +24,34 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#ifndef _WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*
+ * The tickets are indexed by SNI and ALPN, using as key the "sni\0alpn" bytes laid out
+ * by picoquic_format_ticket. The head of the index is the oldest ticket, so that the
+ * expired ones are found first.
+ *
+ * The file is a sequence of records, each made of a 4 bytes length and a serialized
+ * ticket. New tickets are appended, and when the file is loaded a record replaces the
+ * earlier ones for the same SNI and ALPN, so that saving only writes what changed.
+ * A ticket may end with the plugins the server injected on the connection that got it,
+ * written after the ticket bytes only when there are some, so that the records without
+ * them keep the earlier layout.
+ */
+
+#define PICOQUIC_TICKET_KEY_BUFFER 256
+#define PICOQUIC_TICKET_EXPIRY_SWEEP 2
 
 picoquic_stored_ticket_t* picoquic_format_ticket(uint64_t time_valid_until,
     char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
-    uint8_t* ticket, uint16_t ticket_length)
+    uint8_t* ticket, uint16_t ticket_length, char const* plugins, uint16_t plugins_length)
 {
-    size_t ticket_size = sizeof(picoquic_stored_ticket_t) + sni_length + 1 + alpn_length + 1 + ticket_length;
+    size_t ticket_size = sizeof(picoquic_stored_ticket_t) + sni_length + 1 + alpn_length + 1 + ticket_length + plugins_length + 1;
     picoquic_stored_ticket_t* stored = (picoquic_stored_ticket_t*)malloc(ticket_size);
     char* next_p = ((char*)stored) + sizeof(picoquic_stored_ticket_t);
 
@@ -51,6 +73,14 @@ picoquic_stored_ticket_t* picoquic_format_ticket(uint64_t time_valid_until,
         stored->ticket = (uint8_t*)next_p;
         stored->ticket_length = ticket_length;
         memcpy(next_p, ticket, ticket_length);
+        next_p += ticket_length;
+
+        stored->plugins = next_p;
+        stored->plugins_length = plugins_length;
+        if (plugins_length > 0) {
+            memcpy(next_p, plugins, plugins_length);
+        }
+        next_p[plugins_length] = 0;
     }
 
     return stored;
@@ -64,6 +94,9 @@ int picoquic_serialize_ticket(const picoquic_stored_ticket_t * ticket, uint8_t *
 
     /* Compute serialized length */
     required_length = 8 + 2 + 2 + 2 + ticket->sni_length + ticket->alpn_length + ticket->ticket_length;
+    if (ticket->plugins_length > 0) {
+        required_length += 2 + ticket->plugins_length;
+    }
     /* Serialize */
     if (required_length > bytes_max) {
         ret = PICOQUIC_ERROR_FRAME_BUFFER_TOO_SMALL;
@@ -87,6 +120,13 @@ int picoquic_serialize_ticket(const picoquic_stored_ticket_t * ticket, uint8_t *
         memcpy(bytes + byte_index, ticket->ticket, ticket->ticket_length);
         byte_index += ticket->ticket_length;
 
+        if (ticket->plugins_length > 0) {
+            picoformat_16(bytes + byte_index, ticket->plugins_length);
+            byte_index += 2;
+            memcpy(bytes + byte_index, ticket->plugins, ticket->plugins_length);
+            byte_index += ticket->plugins_length;
+        }
+
         *consumed = byte_index;
     }
 
@@ -102,9 +142,11 @@ int picoquic_deserialize_ticket(picoquic_stored_ticket_t ** ticket, uint8_t * by
     size_t sni_index = 0;
     size_t alpn_index = 0;
     size_t ticket_index = 0;
+    size_t plugins_index = 0;
     uint16_t sni_length = 0;
     uint16_t alpn_length = 0;
     uint16_t ticket_length = 0;
+    uint16_t plugins_length = 0;
 
 
     *consumed = 0;
@@ -133,6 +175,15 @@ int picoquic_deserialize_ticket(picoquic_stored_ticket_t ** ticket, uint8_t * by
         byte_index += 2;
         ticket_index = byte_index;
         required_length += ticket_length;
+        byte_index += ticket_length;
+    }
+
+    /* The plugins are only present when the record goes on */
+    if (required_length + 2 <= bytes_max) {
+        plugins_length = PICOPARSE_16(bytes + byte_index);
+        byte_index += 2;
+        plugins_index = byte_index;
+        required_length += 2 + plugins_length;
     }
 
     if (required_length > bytes_max) {
@@ -140,7 +191,8 @@ int picoquic_deserialize_ticket(picoquic_stored_ticket_t ** ticket, uint8_t * by
         ret = PICOQUIC_ERROR_INVALID_TICKET;
     } else {
         *ticket = picoquic_format_ticket(time_valid_until, (const char *)(bytes + sni_index), sni_length,
-            (const char *)(bytes + alpn_index), alpn_length, bytes + ticket_index, ticket_length);
+            (const char *)(bytes + alpn_index), alpn_length, bytes + ticket_index, ticket_length,
+            (const char *)(bytes + plugins_index), plugins_length);
         if (*ticket == NULL) {
             ret = PICOQUIC_ERROR_MEMORY;
         }
@@ -152,14 +204,58 @@ int picoquic_deserialize_ticket(picoquic_stored_ticket_t ** ticket, uint8_t * by
     return ret;
 }
 
+static void picoquic_delete_ticket(picoquic_stored_ticket_t* stored)
+{
+    memset(stored->ticket, 0, stored->ticket_length);
+    free(stored);
+}
+
+static picoquic_stored_ticket_t* picoquic_find_ticket(picoquic_stored_ticket_t* p_first_ticket,
+    char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length)
+{
+    picoquic_stored_ticket_t* found = NULL;
+    char key_buffer[PICOQUIC_TICKET_KEY_BUFFER];
+    size_t key_length = (size_t)sni_length + 1 + alpn_length;
+    char* key = (key_length <= sizeof(key_buffer)) ? key_buffer : (char*)malloc(key_length);
+
+    if (p_first_ticket != NULL && key != NULL) {
+        memcpy(key, sni, sni_length);
+        key[sni_length] = 0;
+        memcpy(key + sni_length + 1, alpn, alpn_length);
+        HASH_FIND(hh, p_first_ticket, key, key_length, found);
+        if (found != NULL && found->sni_length != sni_length) {
+            found = NULL;
+        }
+    }
+    if (key != key_buffer) {
+        free(key);
+    }
+
+    return found;
+}
+
+/* Adds the ticket to the index, in place of the one stored before for the same SNI and ALPN */
+static void picoquic_insert_ticket(picoquic_stored_ticket_t** pp_first_ticket, picoquic_stored_ticket_t* stored)
+{
+    picoquic_stored_ticket_t* previous = picoquic_find_ticket(*pp_first_ticket,
+        stored->sni, stored->sni_length, stored->alpn, stored->alpn_length);
+
+    if (previous != NULL) {
+        HASH_DEL(*pp_first_ticket, previous);
+        picoquic_delete_ticket(previous);
+    }
+    HASH_ADD_KEYPTR(hh, *pp_first_ticket, stored->sni, (size_t)stored->sni_length + 1 + stored->alpn_length, stored);
+}
+
 int picoquic_store_ticket(picoquic_stored_ticket_t** pp_first_ticket,
     uint64_t current_time,
     char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length,
-    uint8_t* ticket, uint16_t ticket_length)
+    uint8_t* ticket, uint16_t ticket_length, char const* plugins)
 {
     int ret = 0;
+    size_t plugins_length = (plugins == NULL) ? 0 : strlen(plugins);
 
-    if (ticket_length < 17) {
+    if (ticket_length < 17 || plugins_length > UINT16_MAX) {
         ret = PICOQUIC_ERROR_INVALID_TICKET;
     } else {
         uint64_t ticket_issued_time;
@@ -179,31 +275,25 @@ int picoquic_store_ticket(picoquic_stored_ticket_t** pp_first_ticket,
             ret = PICOQUIC_ERROR_INVALID_TICKET;
         } else {
             picoquic_stored_ticket_t* stored = picoquic_format_ticket(time_valid_until, sni, sni_length,
-                    alpn, alpn_length, ticket, ticket_length);
+                    alpn, alpn_length, ticket, ticket_length, plugins, (uint16_t)plugins_length);
             if (stored == NULL) {
                 ret = PICOQUIC_ERROR_MEMORY;
             }
             else {
-                picoquic_stored_ticket_t* next;
-                picoquic_stored_ticket_t** pprevious;
-
-
-                stored->next_ticket = next = *pp_first_ticket;
-                *pp_first_ticket = stored;
-                pprevious = &stored->next_ticket;
-
-                /* Now remove the old tickets for that SNI & ALPN */
-                while (next != NULL) {
-                    if (next->time_valid_until <= stored->time_valid_until && next->sni_length == sni_length && next->alpn_length == alpn_length && memcmp(next->sni, sni, sni_length) == 0 && memcmp(next->alpn, alpn, alpn_length) == 0) {
-                        picoquic_stored_ticket_t* deleted = next;
-                        next = next->next_ticket;
-                        *pprevious = next;
-                        memset(&deleted->ticket, 0, deleted->ticket_length);
-                        free(deleted);
-                    } else {
-                        pprevious = &next->next_ticket;
-                        next = next->next_ticket;
+                /* Without a current time, the ticket was issued now */
+                uint64_t expiry_time = (current_time != 0) ? current_time : ticket_issued_time * 1000;
+
+                picoquic_insert_ticket(pp_first_ticket, stored);
+
+                /* Evict the oldest tickets once expired, a few at a time */
+                for (int i = 0; i < PICOQUIC_TICKET_EXPIRY_SWEEP && *pp_first_ticket != stored; i++) {
+                    picoquic_stored_ticket_t* oldest = *pp_first_ticket;
+
+                    if (oldest->time_valid_until > expiry_time) {
+                        break;
                     }
+                    HASH_DEL(*pp_first_ticket, oldest);
+                    picoquic_delete_ticket(oldest);
                 }
             }
         }
@@ -218,17 +308,9 @@ int picoquic_get_ticket(picoquic_stored_ticket_t* p_first_ticket,
     uint8_t** ticket, uint16_t* ticket_length)
 {
     int ret = 0;
-    picoquic_stored_ticket_t* next = p_first_ticket;
+    picoquic_stored_ticket_t* next = picoquic_find_ticket(p_first_ticket, sni, sni_length, alpn, alpn_length);
 
-    while (next != NULL) {
-        if (next->time_valid_until > current_time && next->sni_length == sni_length && next->alpn_length == alpn_length && memcmp(next->sni, sni, sni_length) == 0 && memcmp(next->alpn, alpn, alpn_length) == 0) {
-            break;
-        } else {
-            next = next->next_ticket;
-        }
-    }
-
-    if (next == NULL) {
+    if (next == NULL || next->time_valid_until <= current_time) {
         *ticket = NULL;
         *ticket_length = 0;
         ret = -1;
@@ -240,28 +322,43 @@ int picoquic_get_ticket(picoquic_stored_ticket_t* p_first_ticket,
     return ret;
 }
 
-int picoquic_save_tickets(const picoquic_stored_ticket_t* first_ticket,
+char const* picoquic_get_ticket_plugins(picoquic_stored_ticket_t* p_first_ticket,
     uint64_t current_time,
-    char const* ticket_file_name)
+    char const* sni, uint16_t sni_length, char const* alpn, uint16_t alpn_length)
+{
+    picoquic_stored_ticket_t* next = picoquic_find_ticket(p_first_ticket, sni, sni_length, alpn, alpn_length);
+
+    return (next == NULL || next->time_valid_until <= current_time || next->plugins_length == 0) ? NULL : next->plugins;
+}
+
+static FILE* picoquic_open_ticket_file(char const* ticket_file_name, char const* mode)
 {
-    int ret = 0;
     FILE* F = NULL;
-    const picoquic_stored_ticket_t* next = first_ticket;
 #ifdef _WINDOWS
-    errno_t err = fopen_s(&F, ticket_file_name, "wb");
-    if (err != 0 || F == NULL) {
-        ret = -1;
+    if (fopen_s(&F, ticket_file_name, mode) != 0) {
+        F = NULL;
     }
 #else
-    F = fopen(ticket_file_name, "wb");
+    F = fopen(ticket_file_name, mode);
+#endif
+    return F;
+}
+
+/* Writes the valid tickets, only those not written yet if all_tickets is not set */
+static int picoquic_write_tickets(picoquic_stored_ticket_t* first_ticket,
+    uint64_t current_time, char const* ticket_file_name, int all_tickets)
+{
+    int ret = 0;
+    FILE* F = picoquic_open_ticket_file(ticket_file_name, (all_tickets) ? "wb" : "ab");
+    picoquic_stored_ticket_t* next = first_ticket;
+
     if (F == NULL) {
         ret = -1;
     }
-#endif
 
     while (ret == 0 && next != NULL) {
         /* Only store the tickets that are valid going forward */
-        if (next->time_valid_until > current_time) {
+        if (next->time_valid_until > current_time && (all_tickets || !next->is_persisted)) {
             /* Compute the serialized size */
             uint8_t buffer[2048];
             size_t record_size;
@@ -269,96 +366,132 @@ int picoquic_save_tickets(const picoquic_stored_ticket_t* first_ticket,
             ret = picoquic_serialize_ticket(next, buffer, sizeof(buffer), &record_size);
 
             if (ret == 0) {
-                if (fwrite(&record_size, 4, 1, F) != 1 || fwrite(buffer, 1, record_size, F) != record_size) {
+                uint32_t storage_size = (uint32_t)record_size;
+
+                if (fwrite(&storage_size, 4, 1, F) != 1 || fwrite(buffer, 1, record_size, F) != record_size) {
                     ret = PICOQUIC_ERROR_INVALID_FILE;
                     break;
                 }
+                next->is_persisted = 1;
             }
         }
-        next = next->next_ticket;
+        next = (picoquic_stored_ticket_t*)next->hh.next;
     }
 
-    if (F != NULL) {
-        fclose(F);
+    if (F != NULL && fclose(F) != 0 && ret == 0) {
+        ret = PICOQUIC_ERROR_INVALID_FILE;
     }
 
     return ret;
 }
 
-int picoquic_load_tickets(picoquic_stored_ticket_t** pp_first_ticket,
-    uint64_t current_time, char const* ticket_file_name)
+int picoquic_save_tickets(picoquic_stored_ticket_t* first_ticket,
+    uint64_t current_time,
+    char const* ticket_file_name)
+{
+    return picoquic_write_tickets(first_ticket, current_time, ticket_file_name, 1);
+}
+
+int picoquic_append_tickets(picoquic_stored_ticket_t* first_ticket,
+    uint64_t current_time,
+    char const* ticket_file_name)
+{
+    return picoquic_write_tickets(first_ticket, current_time, ticket_file_name, 0);
+}
+
+/* Indexes the records of the file, a record cut short by an interrupted append ends it */
+static int picoquic_parse_ticket_records(picoquic_stored_ticket_t** pp_first_ticket,
+    uint64_t current_time, const uint8_t* bytes, size_t length)
 {
     int ret = 0;
-    FILE* F = NULL;
-    picoquic_stored_ticket_t* previous = NULL;
-    picoquic_stored_ticket_t* next;
-    uint32_t record_size;
-    uint32_t storage_size;
+    size_t byte_index = 0;
 
-#ifdef _WINDOWS
-    errno_t err = fopen_s(&F, ticket_file_name, "rb");
-    if (err != 0 || F == NULL) {
-        ret = (err == ENOENT)? PICOQUIC_ERROR_NO_SUCH_FILE:-1;
-    }
-#else
-    F = fopen(ticket_file_name, "rb");
-    if (F == NULL) {
-        ret = (errno == ENOENT) ? PICOQUIC_ERROR_NO_SUCH_FILE : -1;
-    }
-#endif
-    while (ret == 0) {
-        if (fread(&storage_size, 4, 1, F) != 1) {
-            /* end of file */
+    while (ret == 0 && length - byte_index >= 4) {
+        uint32_t storage_size;
+        picoquic_stored_ticket_t* next = NULL;
+        size_t consumed = 0;
+
+        memcpy(&storage_size, bytes + byte_index, 4);
+        byte_index += 4;
+
+        if (storage_size + offsetof(struct st_picoquic_stored_ticket_t, time_valid_until) > 2048) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        } else if (storage_size > length - byte_index) {
             break;
-        }
-        else {
-            record_size = storage_size + offsetof(struct st_picoquic_stored_ticket_t, time_valid_until);
-           
-            if (record_size > 2048) {
+        } else {
+            ret = picoquic_deserialize_ticket(&next, (uint8_t*)bytes + byte_index, storage_size, &consumed);
+
+            if (ret == 0 && (consumed != storage_size || next == NULL)) {
                 ret = PICOQUIC_ERROR_INVALID_FILE;
-                break;
             }
-            else {
-                uint8_t buffer[2048];
-                if (fread(buffer, 1, storage_size, F)
-                    != storage_size) {
-                    ret = PICOQUIC_ERROR_INVALID_FILE;
-                }
-                else {
-                    size_t consumed = 0;
-                    ret = picoquic_deserialize_ticket(&next, buffer, storage_size, &consumed);
-
-                    if (ret == 0 && (consumed != storage_size || next == NULL)) {
-                        ret = PICOQUIC_ERROR_INVALID_FILE;
-                    }
+            byte_index += storage_size;
+        }
 
-                    if (ret == 0) {
-                        if (next->time_valid_until < current_time) {
-                            free(next);
-                        }
-                        else {
-                            next->sni = ((char*)next) + sizeof(picoquic_stored_ticket_t);
-                            next->alpn = next->sni + next->sni_length + 1;
-                            next->ticket = (uint8_t*)(next->alpn + next->alpn_length + 1);
-                            next->next_ticket = NULL;
-                            if (previous == NULL) {
-                                *pp_first_ticket = next;
-                            }
-                            else {
-                                previous->next_ticket = next;
-                            }
-
-                            previous = next;
-                        }
-                    }
-                }
+        if (ret == 0) {
+            if (next->time_valid_until < current_time) {
+                free(next);
+            } else {
+                next->is_persisted = 1;
+                picoquic_insert_ticket(pp_first_ticket, next);
             }
+        } else if (next != NULL) {
+            free(next);
+        }
+    }
+
+    return ret;
+}
+
+int picoquic_load_tickets(picoquic_stored_ticket_t** pp_first_ticket,
+    uint64_t current_time, char const* ticket_file_name)
+{
+    int ret = 0;
+#ifdef _WINDOWS
+    FILE* F = picoquic_open_ticket_file(ticket_file_name, "rb");
+    uint8_t* bytes = NULL;
+    long length = 0;
+
+    if (F == NULL) {
+        ret = (errno == ENOENT) ? PICOQUIC_ERROR_NO_SUCH_FILE : -1;
+    } else if (fseek(F, 0, SEEK_END) != 0 || (length = ftell(F)) < 0 || fseek(F, 0, SEEK_SET) != 0) {
+        ret = PICOQUIC_ERROR_INVALID_FILE;
+    } else if (length > 0) {
+        if ((bytes = (uint8_t*)malloc(length)) == NULL) {
+            ret = PICOQUIC_ERROR_MEMORY;
+        } else if (fread(bytes, 1, length, F) != (size_t)length) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        } else {
+            ret = picoquic_parse_ticket_records(pp_first_ticket, current_time, bytes, (size_t)length);
         }
+        free(bytes);
     }
 
     if (F != NULL) {
         fclose(F);
     }
+#else
+    struct stat st;
+    int fd = open(ticket_file_name, O_RDONLY);
+
+    if (fd < 0) {
+        ret = (errno == ENOENT) ? PICOQUIC_ERROR_NO_SUCH_FILE : -1;
+    } else if (fstat(fd, &st) != 0) {
+        ret = PICOQUIC_ERROR_INVALID_FILE;
+    } else if (st.st_size > 0) {
+        void* bytes = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (bytes == MAP_FAILED) {
+            ret = PICOQUIC_ERROR_INVALID_FILE;
+        } else {
+            ret = picoquic_parse_ticket_records(pp_first_ticket, current_time, (const uint8_t*)bytes, (size_t)st.st_size);
+            munmap(bytes, (size_t)st.st_size);
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
 
     return ret;
 }
@@ -366,10 +499,10 @@ int picoquic_load_tickets(picoquic_stored_ticket_t** pp_first_ticket,
 void picoquic_free_tickets(picoquic_stored_ticket_t** pp_first_ticket)
 {
     picoquic_stored_ticket_t* next;
+    picoquic_stored_ticket_t* tmp;
 
-    while ((next = *pp_first_ticket) != NULL) {
-        *pp_first_ticket = next->next_ticket;
-
-        free(next);
+    HASH_ITER(hh, *pp_first_ticket, next, tmp) {
+        HASH_DEL(*pp_first_ticket, next);
+        picoquic_delete_ticket(next);
     }
 }
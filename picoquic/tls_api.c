@@ -27,7 +27,14 @@
 #include "picoquic_internal.h"
 #include "picotls/openssl.h"
 #include "picotls/minicrypto.h"
+#ifdef PICOQUIC_WITH_FUSION
+#include "picotls/fusion.h"
+#endif
+#ifdef PICOQUIC_WITH_BROTLI
+#include "picotls/certificate_compression.h"
+#endif
 #include "tls_api.h"
+#include "offload_pool.h"
 #include <openssl/pem.h>
 #include <openssl/err.h>
 #include <openssl/engine.h>
@@ -58,6 +65,7 @@ typedef struct st_picoquic_tls_ctx_t {
     uint8_t ext_received[256];
     size_t ext_received_length;
     int ext_received_return;
+    void* sign_job; /* Signature being computed by the offload pool, see picoquic_set_sign_offload() */
 } picoquic_tls_ctx_t;
 
 int picoquic_receive_transport_extensions(picoquic_cnx_t* cnx, int extension_mode,
@@ -161,6 +169,223 @@ static int set_sign_certificate_from_key_file(char const* keypem, ptls_context_t
     return ret;
 }
 
+/*
+ * Signature offload. The server signature of the handshake is the most expensive step of it, so
+ * it can be given to a pool of worker threads, or to a hardware key store behind them, while the
+ * loop goes on with the other connections. The signer of the master context is then wrapped:
+ * picotls is told the operation is asynchronous, the handshake is parked, and it resumes when the
+ * job is done, see picoquic_tls_stream_process(). The inner signer is called without a TLS
+ * context, which may be freed while the job runs. This requires picotls with asynchronous signature
+ * support; without it, the signature is computed inline.
+ */
+#ifdef PTLS_ERROR_ASYNC_OPERATION
+#define PICOQUIC_SIGN_OFFLOAD_MAX_ALGORITHMS 16
+
+typedef struct st_picoquic_sign_offload_t {
+    ptls_sign_certificate_t super;
+    ptls_sign_certificate_t* inner;
+    picoquic_offload_pool_t* pool;
+} picoquic_sign_offload_t;
+
+typedef struct st_picoquic_sign_job_t {
+    ptls_async_job_t super;
+    picoquic_offload_job_t offload;
+    picoquic_sign_offload_t* signer;
+    uint8_t input[PTLS_MAX_CERTIFICATE_VERIFY_SIGNDATA_SIZE];
+    size_t input_length;
+    uint16_t algorithms[PICOQUIC_SIGN_OFFLOAD_MAX_ALGORITHMS];
+    size_t nb_algorithms;
+    uint16_t selected_algorithm;
+    ptls_buffer_t output;
+    int ret;
+} picoquic_sign_job_t;
+
+static void picoquic_sign_job_run(picoquic_offload_job_t* offload)
+{
+    picoquic_sign_job_t* job = container_of(offload, picoquic_sign_job_t, offload);
+    ptls_sign_certificate_t* inner = job->signer->inner;
+
+    job->ret = inner->cb(inner, NULL, NULL, &job->selected_algorithm, &job->output,
+        ptls_iovec_init(job->input, job->input_length), job->algorithms, job->nb_algorithms);
+}
+
+static void picoquic_sign_job_release(picoquic_offload_job_t* offload)
+{
+    picoquic_sign_job_t* job = container_of(offload, picoquic_sign_job_t, offload);
+
+    ptls_buffer_dispose(&job->output);
+    free(job);
+}
+
+/* Called by picotls when the handshake is freed or the signature read */
+static void picoquic_sign_job_destroy(ptls_async_job_t* async)
+{
+    picoquic_sign_job_t* job = container_of(async, picoquic_sign_job_t, super);
+
+    picoquic_offload_job_abandon(job->signer->pool, &job->offload);
+}
+
+static int picoquic_sign_offload_cb(ptls_sign_certificate_t* self, ptls_t* tls, ptls_async_job_t** async,
+    uint16_t* selected_algorithm, ptls_buffer_t* output, ptls_iovec_t input, const uint16_t* algorithms, size_t num_algorithms)
+{
+    picoquic_sign_offload_t* signer = container_of(self, picoquic_sign_offload_t, super);
+    picoquic_cnx_t* cnx = (picoquic_cnx_t*)*ptls_get_data_ptr(tls);
+    picoquic_tls_ctx_t* tls_ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
+    picoquic_sign_job_t* job;
+    int ret;
+
+    if (async == NULL || input.len > PTLS_MAX_CERTIFICATE_VERIFY_SIGNDATA_SIZE ||
+        num_algorithms > PICOQUIC_SIGN_OFFLOAD_MAX_ALGORITHMS) {
+        /* Client certificate, or a request the job cannot hold */
+        ret = signer->inner->cb(signer->inner, tls, NULL, selected_algorithm, output, input, algorithms, num_algorithms);
+    } else if (*async != NULL) {
+        /* Resumed once the job is done */
+        job = container_of(*async, picoquic_sign_job_t, super);
+        ret = job->ret;
+        if (ret == 0) {
+            *selected_algorithm = job->selected_algorithm;
+            ret = ptls_buffer__do_pushv(output, job->output.base, job->output.off);
+        }
+        (*async)->destroy_(*async);
+        *async = NULL;
+        tls_ctx->sign_job = NULL;
+    } else if ((job = (picoquic_sign_job_t*)malloc(sizeof(picoquic_sign_job_t))) == NULL) {
+        ret = PTLS_ERROR_NO_MEMORY;
+    } else {
+        memset(job, 0, sizeof(picoquic_sign_job_t));
+        job->super.destroy_ = picoquic_sign_job_destroy;
+        job->offload.run = picoquic_sign_job_run;
+        job->offload.release = picoquic_sign_job_release;
+        job->signer = signer;
+        memcpy(job->input, input.base, input.len);
+        job->input_length = input.len;
+        memcpy(job->algorithms, algorithms, num_algorithms * sizeof(uint16_t));
+        job->nb_algorithms = num_algorithms;
+        ptls_buffer_init(&job->output, "", 0);
+
+        picoquic_offload_submit(signer->pool, &job->offload);
+        *async = &job->super;
+        tls_ctx->sign_job = job;
+        ret = PTLS_ERROR_ASYNC_OPERATION;
+    }
+
+    return ret;
+}
+#endif
+
+int picoquic_tls_is_sign_pending(picoquic_cnx_t* cnx)
+{
+    picoquic_tls_ctx_t* tls_ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
+
+    return (tls_ctx != NULL && tls_ctx->sign_job != NULL) ? 1 : 0;
+}
+
+static int picoquic_tls_is_async(int ret)
+{
+#ifdef PTLS_ERROR_ASYNC_OPERATION
+    return ret == PTLS_ERROR_ASYNC_OPERATION;
+#else
+    UNREFERENCED_PARAMETER(ret);
+    return 0;
+#endif
+}
+
+static int picoquic_tls_is_sign_done(picoquic_tls_ctx_t* tls_ctx)
+{
+#ifdef PTLS_ERROR_ASYNC_OPERATION
+    return picoquic_offload_job_is_done(&((picoquic_sign_job_t*)tls_ctx->sign_job)->offload);
+#else
+    UNREFERENCED_PARAMETER(tls_ctx);
+    return 1;
+#endif
+}
+
+static void picoquic_dispose_sign_certificate(picoquic_quic_t* quic, ptls_context_t* ctx)
+{
+    ptls_sign_certificate_t* signer = ctx->sign_certificate;
+
+#ifdef PTLS_ERROR_ASYNC_OPERATION
+    if (quic->sign_offload != NULL) {
+        /* The jobs still running use the inner signer */
+        picoquic_offload_pool_wait_idle(((picoquic_sign_offload_t*)quic->sign_offload)->pool);
+        signer = ((picoquic_sign_offload_t*)quic->sign_offload)->inner;
+        ((picoquic_sign_offload_t*)quic->sign_offload)->inner = NULL;
+    }
+#else
+    UNREFERENCED_PARAMETER(quic);
+#endif
+    if (signer != NULL) {
+        ptls_openssl_dispose_sign_certificate((ptls_openssl_sign_certificate_t*)signer);
+        free((ptls_openssl_sign_certificate_t*)signer);
+    }
+    ctx->sign_certificate = NULL;
+}
+
+/* Wraps the signer just set in the master context, when the signatures are offloaded */
+static void picoquic_wrap_sign_certificate(picoquic_quic_t* quic, ptls_context_t* ctx)
+{
+#ifdef PTLS_ERROR_ASYNC_OPERATION
+    picoquic_sign_offload_t* signer = (picoquic_sign_offload_t*)quic->sign_offload;
+
+    if (signer != NULL && ctx->sign_certificate != NULL && ctx->sign_certificate != &signer->super) {
+        signer->inner = ctx->sign_certificate;
+        ctx->sign_certificate = &signer->super;
+    }
+#else
+    UNREFERENCED_PARAMETER(quic);
+    UNREFERENCED_PARAMETER(ctx);
+#endif
+}
+
+int picoquic_set_sign_offload(picoquic_quic_t* quic, int nb_threads)
+{
+    int ret = -1;
+#ifdef PTLS_ERROR_ASYNC_OPERATION
+    ptls_context_t* ctx = (ptls_context_t*)quic->tls_master_ctx;
+
+    if (quic->sign_offload == NULL && ctx != NULL && ctx->sign_certificate != NULL) {
+        picoquic_sign_offload_t* signer = (picoquic_sign_offload_t*)malloc(sizeof(picoquic_sign_offload_t));
+
+        if (signer != NULL) {
+            memset(signer, 0, sizeof(picoquic_sign_offload_t));
+            signer->super.cb = picoquic_sign_offload_cb;
+            signer->pool = picoquic_offload_pool_create(nb_threads);
+            if (signer->pool == NULL) {
+                free(signer);
+            } else {
+                quic->sign_offload = signer;
+                picoquic_wrap_sign_certificate(quic, ctx);
+                ret = 0;
+            }
+        }
+    }
+#else
+    UNREFERENCED_PARAMETER(quic);
+    UNREFERENCED_PARAMETER(nb_threads);
+#endif
+
+    return ret;
+}
+
+static void picoquic_sign_offload_free(picoquic_quic_t* quic)
+{
+#ifdef PTLS_ERROR_ASYNC_OPERATION
+    picoquic_sign_offload_t* signer = (picoquic_sign_offload_t*)quic->sign_offload;
+
+    if (signer != NULL) {
+        picoquic_offload_pool_delete(signer->pool);
+        if (signer->inner != NULL) {
+            ptls_openssl_dispose_sign_certificate((ptls_openssl_sign_certificate_t*)signer->inner);
+            free((ptls_openssl_sign_certificate_t*)signer->inner);
+        }
+        free(signer);
+        quic->sign_offload = NULL;
+    }
+#else
+    UNREFERENCED_PARAMETER(quic);
+#endif
+}
+
 /* Crypto random number generator */
 
 void picoquic_crypto_random(picoquic_quic_t* quic, void* buf, size_t len)
@@ -416,6 +641,100 @@ int picoquic_client_hello_call_back(ptls_on_client_hello_t* on_hello_cb_ctx,
  * Should return 0 if the ticket is good, etc.
  */
 
+/*
+ * With a resumption store, the tickets are prefixed by the identifier of the shared key that
+ * encrypted them, also used as authenticated data, so that any process of the server can decrypt
+ * them. The AEAD contexts of the keys are kept by key slot and rebuilt when the key changes.
+ * Key identifier 0 designates the local key of the context.
+ */
+static ptls_aead_context_t* picoquic_get_resumption_aead(picoquic_quic_t* quic, int is_encrypt, uint32_t* key_id)
+{
+    uint8_t secret[PICOQUIC_RESUMPTION_KEY_SIZE];
+    ptls_cipher_suite_t cipher = { 0, &ptls_openssl_aes128gcm, &ptls_openssl_sha256 };
+    ptls_aead_context_t* aead = NULL;
+    uint32_t slot;
+
+    if (is_encrypt) {
+        *key_id = picoquic_resumption_store_current_key_id(quic->resumption_store);
+    }
+    slot = *key_id % PICOQUIC_RESUMPTION_KEY_SLOTS;
+
+    if (*key_id == 0) {
+        /* Until the store has a key, the local one is used, and only this context can decrypt */
+        aead = (ptls_aead_context_t*)((is_encrypt) ? quic->aead_encrypt_ticket_ctx : quic->aead_decrypt_ticket_ctx);
+    } else if (quic->resumption_aead[is_encrypt][slot] != NULL && quic->resumption_aead_key_id[is_encrypt][slot] == *key_id) {
+        aead = (ptls_aead_context_t*)quic->resumption_aead[is_encrypt][slot];
+    } else if (picoquic_resumption_store_get_key(quic->resumption_store, *key_id, secret) == *key_id) {
+        if (quic->resumption_aead[is_encrypt][slot] != NULL) {
+            picoquic_aead_free(quic->resumption_aead[is_encrypt][slot]);
+            quic->resumption_aead[is_encrypt][slot] = NULL;
+        }
+        if (picoquic_set_aead_from_secret(&quic->resumption_aead[is_encrypt][slot], &cipher, is_encrypt, secret) == 0) {
+            quic->resumption_aead_key_id[is_encrypt][slot] = *key_id;
+            aead = (ptls_aead_context_t*)quic->resumption_aead[is_encrypt][slot];
+        }
+        ptls_clear_memory(secret, sizeof(secret));
+    }
+
+    return aead;
+}
+
+static int picoquic_server_shared_ticket_call_back(picoquic_quic_t* quic,
+    int is_encrypt, ptls_buffer_t* dst, ptls_iovec_t src)
+{
+    int ret = 0;
+    uint32_t key_id = 0;
+    ptls_aead_context_t* aead;
+
+    if (is_encrypt != 0) {
+        if ((aead = picoquic_get_resumption_aead(quic, 1, &key_id)) == NULL) {
+            ret = -1;
+        } else if ((ret = ptls_buffer_reserve(dst, 4 + 8 + src.len + aead->algo->tag_size)) == 0) {
+            uint64_t seq_num = picoquic_public_random_64();
+            uint8_t* aad = dst->base + dst->off;
+
+            picoformat_32(dst->base + dst->off, key_id);
+            dst->off += 4;
+            picoformat_64(dst->base + dst->off, seq_num);
+            dst->off += 8;
+            dst->off += ptls_aead_encrypt(aead, dst->base + dst->off,
+                src.base, src.len, seq_num, aad, 4);
+        }
+    } else if (src.len < 4 + 8) {
+        ret = -1;
+    } else {
+        key_id = PICOPARSE_32(src.base);
+        if ((aead = picoquic_get_resumption_aead(quic, 0, &key_id)) == NULL) {
+            /* Unknown or retired key, a full handshake follows */
+            ret = -1;
+        } else if (src.len < 4 + 8 + aead->algo->tag_size) {
+            ret = -1;
+        } else if ((ret = ptls_buffer_reserve(dst, src.len)) == 0) {
+            uint64_t seq_num = PICOPARSE_64(src.base + 4);
+            size_t decrypted = ptls_aead_decrypt(aead, dst->base + dst->off,
+                src.base + 12, src.len - 12, seq_num, src.base, 4);
+
+            if (decrypted > src.len - 12) {
+                ret = -1;
+            } else {
+                dst->off += decrypted;
+                /* A ticket seen by any of the processes within the window is a replay */
+                if (picoquic_resumption_store_strike(quic->resumption_store, seq_num ^ key_id,
+                    picoquic_get_quic_time(quic)) != 0) {
+#ifdef PTLS_ERROR_REJECT_EARLY_DATA
+                    ret = PTLS_ERROR_REJECT_EARLY_DATA;
+#else
+                    dst->off -= decrypted;
+                    ret = -1;
+#endif
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
 int picoquic_server_encrypt_ticket_call_back(ptls_encrypt_ticket_t* encrypt_ticket_ctx,
     ptls_t* tls, int is_encrypt, ptls_buffer_t* dst, ptls_iovec_t src)
 {
@@ -431,7 +750,9 @@ int picoquic_server_encrypt_ticket_call_back(ptls_encrypt_ticket_t* encrypt_tick
     picoquic_quic_t** ppquic = (picoquic_quic_t**)(((char*)encrypt_ticket_ctx) + sizeof(ptls_encrypt_ticket_t));
     picoquic_quic_t* quic = *ppquic;
 
-    if (is_encrypt != 0) {
+    if (quic->resumption_store != NULL) {
+        ret = picoquic_server_shared_ticket_call_back(quic, is_encrypt, dst, src);
+    } else if (is_encrypt != 0) {
         ptls_aead_context_t* aead_enc = (ptls_aead_context_t*)quic->aead_encrypt_ticket_ctx;
         /* Encoding*/
         if (aead_enc == NULL) {
@@ -483,14 +804,17 @@ int picoquic_client_save_ticket_call_back(ptls_save_ticket_t* save_ticket_ctx,
     picoquic_quic_t* quic = *((picoquic_quic_t**)(((char*)save_ticket_ctx) + sizeof(ptls_save_ticket_t)));
     const char* sni = ptls_get_server_name(tls);
     const char* alpn = ptls_get_negotiated_protocol(tls);
+    picoquic_cnx_t* cnx = (picoquic_cnx_t*)*ptls_get_data_ptr(tls);
 
     if (alpn == NULL && quic != NULL) {
         alpn = quic->default_alpn;
     }
 
     if (sni != NULL && alpn != NULL) {
+        /* The plugins injected by the server are remembered, to ask for them in 0-RTT when resuming */
         ret = picoquic_store_ticket(&quic->p_first_ticket, 0, sni, (uint16_t)strlen(sni),
-            alpn, (uint16_t)strlen(alpn), input.base, (uint16_t)input.len);
+            alpn, (uint16_t)strlen(alpn), input.base, (uint16_t)input.len,
+            (cnx == NULL) ? NULL : cnx->remote_parameters.plugins_to_inject);
     } else {
         DBG_PRINTF("Received incorrect session resume ticket, sni = %s, alpn = %s, length = %d\n",
             (sni == NULL) ? "NULL" : sni, (alpn == NULL) ? "NULL" : alpn, (int)input.len);
@@ -614,7 +938,28 @@ static int picoquic_set_aead_from_secret(void ** v_aead,ptls_cipher_suite_t * ci
     return ret;
 }
 
-static int picoquic_set_hp_enc_from_secret(void ** v_hp_enc, ptls_cipher_suite_t * cipher, int is_enc, const void *secret)
+/* The AES header protection mask is the encryption of the sample, which an ECB context computes for many at once */
+static ptls_cipher_algorithm_t* picoquic_hp_ecb_algorithm(ptls_cipher_algorithm_t* ctr_cipher)
+{
+    ptls_cipher_algorithm_t* ecb_cipher = NULL;
+
+    if (ctr_cipher == &ptls_openssl_aes128ctr) {
+        ecb_cipher = &ptls_openssl_aes128ecb;
+    } else if (ctr_cipher == &ptls_openssl_aes256ctr) {
+        ecb_cipher = &ptls_openssl_aes256ecb;
+    }
+#ifdef PICOQUIC_WITH_FUSION
+    else if (ctr_cipher == &ptls_fusion_aes128ctr) {
+        ecb_cipher = &ptls_openssl_aes128ecb;
+    } else if (ctr_cipher == &ptls_fusion_aes256ctr) {
+        ecb_cipher = &ptls_openssl_aes256ecb;
+    }
+#endif
+
+    return ecb_cipher;
+}
+
+static int picoquic_set_hp_enc_from_secret(void ** v_hp_enc, void ** v_hp_ecb, ptls_cipher_suite_t * cipher, int is_enc, const void *secret)
 {
     uint8_t pnekey[PTLS_MAX_SECRET_SIZE];
     int ret;
@@ -624,6 +969,11 @@ static int picoquic_set_hp_enc_from_secret(void ** v_hp_enc, ptls_cipher_suite_t
         *v_hp_enc = NULL;
     }
 
+    if (v_hp_ecb != NULL && *v_hp_ecb != NULL) {
+        ptls_cipher_free((ptls_cipher_context_t *)*v_hp_ecb);
+        *v_hp_ecb = NULL;
+    }
+
     if ((ret = ptls_hkdf_expand_label(cipher->hash, pnekey, 
         cipher->aead->ctr_cipher->key_size, ptls_iovec_init(secret, cipher->hash->digest_size), 
         PICOQUIC_LABEL_HP, ptls_iovec_init(NULL, 0), PICOQUIC_LABEL_QUIC_BASE)) == 0) {
@@ -633,7 +983,11 @@ static int picoquic_set_hp_enc_from_secret(void ** v_hp_enc, ptls_cipher_suite_t
 #endif
         if ((*v_hp_enc = ptls_cipher_new(cipher->aead->ctr_cipher, is_enc, pnekey)) == NULL) {
             ret = PTLS_ERROR_NO_MEMORY;
+        } else if (v_hp_ecb != NULL && picoquic_hp_ecb_algorithm(cipher->aead->ctr_cipher) != NULL) {
+            /* Without it the masks are computed one by one, so a failure here is not an error */
+            *v_hp_ecb = ptls_cipher_new(picoquic_hp_ecb_algorithm(cipher->aead->ctr_cipher), 1, pnekey);
         }
+        ptls_clear_memory(pnekey, sizeof(pnekey));
     }
     
     return ret;
@@ -649,13 +1003,13 @@ static int picoquic_set_key_from_secret(picoquic_cnx_t* cnx, ptls_cipher_suite_t
         ret = picoquic_set_aead_from_secret(&ctx->aead_encrypt, cipher, is_enc, secret);
         
         if (ret == 0) {
-            ret = picoquic_set_hp_enc_from_secret(&ctx->hp_enc, cipher, is_enc, secret);
+            ret = picoquic_set_hp_enc_from_secret(&ctx->hp_enc, &ctx->hp_ecb, cipher, is_enc, secret);
         }
     } else {
         ret = picoquic_set_aead_from_secret(&ctx->aead_decrypt, cipher, is_enc, secret);
         
         if (ret == 0) {
-            ret = picoquic_set_hp_enc_from_secret(&ctx->hp_dec, cipher, is_enc, secret);
+            ret = picoquic_set_hp_enc_from_secret(&ctx->hp_dec, NULL, cipher, is_enc, secret);
         }
     }
 
@@ -663,6 +1017,78 @@ static int picoquic_set_key_from_secret(picoquic_cnx_t* cnx, ptls_cipher_suite_t
 }
 
 
+/*
+ * Key update. The secret of the next phase is expanded from the current one with the label "ku",
+ * the header protection key staying the same. The AEAD context of the next phase is derived as soon
+ * as a phase is in use, so that the update itself only swaps pointers on the packet path.
+ */
+static int picoquic_set_next_phase_key(picoquic_cnx_t* cnx, ptls_cipher_suite_t * cipher, int is_enc, const void *secret)
+{
+    picoquic_crypto_context_t * ctx = &cnx->crypto_context[3];
+    uint8_t next_secret[PICOQUIC_MAX_SECRET_SIZE];
+    int ret;
+
+    if (cipher->hash->digest_size > sizeof(next_secret)) {
+        ret = PICOQUIC_ERROR_CANNOT_COMPUTE_KEY;
+    } else if ((ret = ptls_hkdf_expand_label(cipher->hash, next_secret, cipher->hash->digest_size,
+        ptls_iovec_init(secret, cipher->hash->digest_size), PICOQUIC_LABEL_KEY_UPDATE,
+        ptls_iovec_init(NULL, 0), PICOQUIC_LABEL_QUIC_BASE)) == 0) {
+        memcpy(ctx->secret_next[is_enc], next_secret, cipher->hash->digest_size);
+        ret = picoquic_set_aead_from_secret((is_enc) ? &ctx->aead_encrypt_next : &ctx->aead_decrypt_next,
+            cipher, is_enc, next_secret);
+        ptls_clear_memory(next_secret, sizeof(next_secret));
+    }
+
+    return ret;
+}
+
+int picoquic_rotate_key_phase(picoquic_cnx_t* cnx, int is_enc, uint64_t current_time)
+{
+    picoquic_crypto_context_t * ctx = &cnx->crypto_context[3];
+    picoquic_tls_ctx_t* tls_ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
+    ptls_cipher_suite_t * cipher = (tls_ctx == NULL) ? NULL : ptls_get_cipher(tls_ctx->tls);
+    uint8_t secret[PICOQUIC_MAX_SECRET_SIZE];
+    int ret = 0;
+
+    if (cipher == NULL || ((is_enc) ? ctx->aead_encrypt_next : ctx->aead_decrypt_next) == NULL) {
+        return PICOQUIC_ERROR_CANNOT_COMPUTE_KEY;
+    }
+
+    if (is_enc) {
+        ptls_aead_free((ptls_aead_context_t*)ctx->aead_encrypt);
+        ctx->aead_encrypt = ctx->aead_encrypt_next;
+        ctx->aead_encrypt_next = NULL;
+        cnx->key_phase_enc ^= 1;
+    } else {
+        if (ctx->aead_decrypt_old != NULL) {
+            ptls_aead_free((ptls_aead_context_t*)ctx->aead_decrypt_old);
+        }
+        ctx->aead_decrypt_old = ctx->aead_decrypt;
+        ctx->aead_decrypt = ctx->aead_decrypt_next;
+        ctx->aead_decrypt_next = NULL;
+        ctx->old_decrypt_expiry = current_time + PICOQUIC_KEY_RETENTION_PTO * cnx->path[0]->retransmit_timer;
+        cnx->key_phase_dec ^= 1;
+        ctx->nb_key_phases_received++;
+    }
+
+    /* The phase after this one, derived now rather than when the peer moves to it */
+    memcpy(secret, ctx->secret_next[is_enc], cipher->hash->digest_size);
+    ret = picoquic_set_next_phase_key(cnx, cipher, is_enc, secret);
+    ptls_clear_memory(secret, sizeof(secret));
+
+    return ret;
+}
+
+void picoquic_check_key_retention(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    picoquic_crypto_context_t * ctx = &cnx->crypto_context[3];
+
+    if (ctx->aead_decrypt_old != NULL && current_time >= ctx->old_decrypt_expiry) {
+        ptls_aead_free((ptls_aead_context_t*)ctx->aead_decrypt_old);
+        ctx->aead_decrypt_old = NULL;
+    }
+}
+
 /* Key update callback: this is called by TLS whenever the session key has changed,
  * from the function "setup_traffic_protection" in picotls.c.
  *
@@ -717,6 +1143,10 @@ static int picoquic_update_traffic_key_callback(ptls_update_traffic_key_t * self
     }
     int ret = picoquic_set_key_from_secret(cnx, cipher, is_enc, epoch, secret);
 
+    if (ret == 0 && epoch == 3) {
+        ret = picoquic_set_next_phase_key(cnx, cipher, is_enc, secret);
+    }
+
     return ret;
 }
 
@@ -820,6 +1250,100 @@ int picoquic_setup_initial_traffic_keys(picoquic_cnx_t* cnx)
     return ret;
 }
 
+/*
+ * Initial decryption keys of the packets that do not match a connection yet, cached by destination
+ * CID: the repeated Initials of a client, or those of a flood reusing a CID, are checked without
+ * deriving the keys again, and without creating a connection context.
+ */
+int picoquic_get_initial_decrypt_context(picoquic_quic_t* quic, int version_index,
+    picoquic_connection_id_t* cnx_id, picoquic_crypto_context_t** p_ctx)
+{
+    int ret = 0;
+    picoquic_initial_key_cache_entry_t* entry =
+        &quic->initial_key_cache[picoquic_val64_connection_id(*cnx_id) % PICOQUIC_INITIAL_KEY_CACHE_SIZE];
+
+    if (entry->ctx.aead_decrypt == NULL || entry->version_index != version_index ||
+        picoquic_compare_connection_id(&entry->cnx_id, cnx_id) != 0) {
+        uint8_t master_secret[256]; /* secret_max */
+        uint8_t client_secret[256];
+        uint8_t server_secret[256];
+        ptls_cipher_suite_t cipher = { 0, &ptls_openssl_aes128gcm, &ptls_openssl_sha256 };
+        ptls_iovec_t salt;
+
+        picoquic_crypto_context_free(&entry->ctx);
+        picoquic_setup_cleartext_aead_salt(version_index, &salt);
+
+        ret = picoquic_setup_initial_master_secret(&cipher, salt, *cnx_id, master_secret);
+        if (ret == 0) {
+            ret = picoquic_setup_initial_secrets(&cipher, master_secret, client_secret, server_secret);
+        }
+        /* The server decrypts what the client protected */
+        if (ret == 0) {
+            ret = picoquic_set_aead_from_secret(&entry->ctx.aead_decrypt, &cipher, 0, client_secret);
+        }
+        if (ret == 0) {
+            ret = picoquic_set_hp_enc_from_secret(&entry->ctx.hp_dec, NULL, &cipher, 0, client_secret);
+        }
+
+        if (ret == 0) {
+            entry->cnx_id = *cnx_id;
+            entry->version_index = version_index;
+        } else {
+            picoquic_crypto_context_free(&entry->ctx);
+        }
+    }
+
+    *p_ctx = (ret == 0) ? &entry->ctx : NULL;
+
+    return ret;
+}
+
+/*
+ * Initial encryption keys of the server for a destination CID of the cache, only derived when a packet
+ * has to be answered without creating a connection context, see picoquic_queue_stateless_busy_close().
+ */
+int picoquic_get_initial_encrypt_context(picoquic_quic_t* quic, int version_index,
+    picoquic_connection_id_t* cnx_id, picoquic_crypto_context_t** p_ctx)
+{
+    picoquic_crypto_context_t* ctx = NULL;
+    int ret = picoquic_get_initial_decrypt_context(quic, version_index, cnx_id, &ctx);
+
+    if (ret == 0 && ctx->aead_encrypt == NULL) {
+        uint8_t master_secret[256]; /* secret_max */
+        uint8_t client_secret[256];
+        uint8_t server_secret[256];
+        ptls_cipher_suite_t cipher = { 0, &ptls_openssl_aes128gcm, &ptls_openssl_sha256 };
+        ptls_iovec_t salt;
+
+        picoquic_setup_cleartext_aead_salt(version_index, &salt);
+        ret = picoquic_setup_initial_master_secret(&cipher, salt, *cnx_id, master_secret);
+        if (ret == 0) {
+            ret = picoquic_setup_initial_secrets(&cipher, master_secret, client_secret, server_secret);
+        }
+        if (ret == 0) {
+            ret = picoquic_set_aead_from_secret(&ctx->aead_encrypt, &cipher, 1, server_secret);
+        }
+        if (ret == 0) {
+            ret = picoquic_set_hp_enc_from_secret(&ctx->hp_enc, NULL, &cipher, 1, server_secret);
+        }
+        if (ret != 0) {
+            /* The entry is derived again on its next use */
+            picoquic_crypto_context_free(ctx);
+        }
+    }
+
+    *p_ctx = (ret == 0) ? ctx : NULL;
+
+    return ret;
+}
+
+void picoquic_initial_key_cache_free(picoquic_quic_t* quic)
+{
+    for (int i = 0; i < PICOQUIC_INITIAL_KEY_CACHE_SIZE; i++) {
+        picoquic_crypto_context_free(&quic->initial_key_cache[i].ctx);
+    }
+}
+
 void picoquic_crypto_context_free(picoquic_crypto_context_t * ctx)
 {
     if (ctx->aead_encrypt != NULL) {
@@ -841,6 +1365,28 @@ void picoquic_crypto_context_free(picoquic_crypto_context_t * ctx)
         ptls_cipher_free((ptls_cipher_context_t *)ctx->hp_dec);
         ctx->hp_dec = NULL;
     }
+
+    if (ctx->hp_ecb != NULL) {
+        ptls_cipher_free((ptls_cipher_context_t *)ctx->hp_ecb);
+        ctx->hp_ecb = NULL;
+    }
+
+    if (ctx->aead_encrypt_next != NULL) {
+        ptls_aead_free((ptls_aead_context_t *)ctx->aead_encrypt_next);
+        ctx->aead_encrypt_next = NULL;
+    }
+
+    if (ctx->aead_decrypt_next != NULL) {
+        ptls_aead_free((ptls_aead_context_t *)ctx->aead_decrypt_next);
+        ctx->aead_decrypt_next = NULL;
+    }
+
+    if (ctx->aead_decrypt_old != NULL) {
+        ptls_aead_free((ptls_aead_context_t *)ctx->aead_decrypt_old);
+        ctx->aead_decrypt_old = NULL;
+    }
+
+    ptls_clear_memory(ctx->secret_next, sizeof(ctx->secret_next));
 }
 
 /* Definition of supported key exchange algorithms */
@@ -850,6 +1396,161 @@ ptls_cipher_suite_t *picoquic_cipher_suites[] = {
     &ptls_openssl_aes256gcmsha384, &ptls_openssl_aes128gcmsha256,
     &ptls_minicrypto_chacha20poly1305sha256, NULL };
 
+/*
+ * AEAD providers, in order of preference. Each one is a list of cipher suites and a check that the
+ * CPU can run them. New contexts take the first supported provider, see picoquic_set_aead_provider().
+ */
+#define PICOQUIC_MAX_AEAD_PROVIDERS 8
+
+typedef struct st_picoquic_aead_provider_t {
+    char const* name;
+    int (*is_supported)(void);
+    ptls_cipher_suite_t** cipher_suites;
+} picoquic_aead_provider_t;
+
+static int picoquic_aead_provider_always_supported(void)
+{
+    return 1;
+}
+
+#ifdef PICOQUIC_WITH_FUSION
+static ptls_cipher_suite_t picoquic_fusion_aes128gcmsha256 = { PTLS_CIPHER_SUITE_AES_128_GCM_SHA256, &ptls_fusion_aes128gcm, &ptls_openssl_sha256 };
+static ptls_cipher_suite_t picoquic_fusion_aes256gcmsha384 = { PTLS_CIPHER_SUITE_AES_256_GCM_SHA384, &ptls_fusion_aes256gcm, &ptls_openssl_sha384 };
+
+ptls_cipher_suite_t *picoquic_fusion_cipher_suites[] = {
+    &picoquic_fusion_aes256gcmsha384, &picoquic_fusion_aes128gcmsha256,
+    &ptls_minicrypto_chacha20poly1305sha256, NULL };
+
+/* Fusion needs AES-NI, PCLMULQDQ and AVX2 */
+static int picoquic_fusion_is_supported(void)
+{
+    return ptls_fusion_is_supported_by_cpu();
+}
+#endif
+
+static picoquic_aead_provider_t picoquic_aead_providers[PICOQUIC_MAX_AEAD_PROVIDERS] = {
+#ifdef PICOQUIC_WITH_FUSION
+    { "fusion", picoquic_fusion_is_supported, picoquic_fusion_cipher_suites },
+#endif
+    { "openssl", picoquic_aead_provider_always_supported, picoquic_cipher_suites }
+};
+
+#ifdef PICOQUIC_WITH_FUSION
+static size_t picoquic_nb_aead_providers = 2;
+#else
+static size_t picoquic_nb_aead_providers = 1;
+#endif
+
+int picoquic_register_aead_provider(char const* name, int (*is_supported)(void), ptls_cipher_suite_t** cipher_suites)
+{
+    int ret = 0;
+
+    if (picoquic_nb_aead_providers >= PICOQUIC_MAX_AEAD_PROVIDERS || name == NULL || cipher_suites == NULL) {
+        ret = -1;
+    } else {
+        /* The last registered is preferred */
+        memmove(&picoquic_aead_providers[1], &picoquic_aead_providers[0], picoquic_nb_aead_providers * sizeof(picoquic_aead_provider_t));
+        picoquic_aead_providers[0].name = name;
+        picoquic_aead_providers[0].is_supported = (is_supported == NULL) ? picoquic_aead_provider_always_supported : is_supported;
+        picoquic_aead_providers[0].cipher_suites = cipher_suites;
+        picoquic_nb_aead_providers++;
+    }
+
+    return ret;
+}
+
+char const* picoquic_get_aead_provider_name(size_t index)
+{
+    return (index < picoquic_nb_aead_providers) ? picoquic_aead_providers[index].name : NULL;
+}
+
+/* The first supported provider if name is NULL */
+static picoquic_aead_provider_t* picoquic_find_aead_provider(char const* name)
+{
+    for (size_t i = 0; i < picoquic_nb_aead_providers; i++) {
+        if ((name == NULL || strcmp(name, picoquic_aead_providers[i].name) == 0) &&
+            picoquic_aead_providers[i].is_supported()) {
+            return &picoquic_aead_providers[i];
+        }
+    }
+
+    return NULL;
+}
+
+ptls_cipher_suite_t** picoquic_get_aead_provider_suites(char const* name)
+{
+    picoquic_aead_provider_t* provider = picoquic_find_aead_provider(name);
+
+    return (provider == NULL) ? NULL : provider->cipher_suites;
+}
+
+int picoquic_set_aead_provider(picoquic_quic_t* quic, char const* name)
+{
+    int ret = 0;
+    picoquic_aead_provider_t* provider = picoquic_find_aead_provider(name);
+
+    if (provider == NULL || quic->tls_master_ctx == NULL) {
+        ret = -1;
+    } else {
+        ((ptls_context_t*)quic->tls_master_ctx)->cipher_suites = provider->cipher_suites;
+        quic->aead_provider_name = provider->name;
+    }
+
+    return ret;
+}
+
+char const* picoquic_get_aead_provider(picoquic_quic_t* quic)
+{
+    return quic->aead_provider_name;
+}
+
+/*
+ * Certificate compression (RFC 8879). The chain is compressed once, when it is set in the master
+ * context, so that the server flight fits more often in the anti-amplification limit without
+ * paying for the compression on each connection. Without it, the chain is sent as is.
+ */
+static void picoquic_dispose_compressed_certificates(ptls_context_t* ctx)
+{
+#ifdef PICOQUIC_WITH_BROTLI
+    if (ctx->emit_certificate != NULL) {
+        ptls_emit_compressed_certificate_t* ecc = (ptls_emit_compressed_certificate_t*)ctx->emit_certificate;
+
+        ptls_dispose_compressed_certificate(ecc);
+        free(ecc);
+        ctx->emit_certificate = NULL;
+    }
+#else
+    UNREFERENCED_PARAMETER(ctx);
+#endif
+}
+
+static void picoquic_set_compressed_certificates(ptls_context_t* ctx)
+{
+    picoquic_dispose_compressed_certificates(ctx);
+#ifdef PICOQUIC_WITH_BROTLI
+    if (ctx->certificates.count > 0) {
+        ptls_emit_compressed_certificate_t* ecc = (ptls_emit_compressed_certificate_t*)malloc(sizeof(ptls_emit_compressed_certificate_t));
+
+        if (ecc == NULL) {
+            DBG_PRINTF("%s", "Cannot allocate the compressed certificates\n");
+        } else if (ptls_init_compressed_certificate(ecc, ctx->certificates.list, ctx->certificates.count,
+            ptls_iovec_init(NULL, 0)) != 0) {
+            DBG_PRINTF("%s", "Cannot compress the certificates\n");
+            free(ecc);
+        } else {
+            ctx->emit_certificate = &ecc->super;
+        }
+    }
+#endif
+}
+
+int picoquic_is_certificate_compressed(picoquic_quic_t* quic)
+{
+    ptls_context_t* ctx = (ptls_context_t*)quic->tls_master_ctx;
+
+    return (ctx != NULL && ctx->emit_certificate != NULL) ? 1 : 0;
+}
+
 /*
  * Setting the master TLS context.
  * On servers, this implies setting the "on hello" call back
@@ -866,6 +1567,7 @@ int picoquic_master_tlscontext(picoquic_quic_t* quic,
     ptls_on_client_hello_t* och = NULL;
     ptls_encrypt_ticket_t* encrypt_ticket = NULL;
     ptls_save_ticket_t* save_ticket = NULL;
+    picoquic_aead_provider_t* aead_provider = picoquic_find_aead_provider(NULL);
 
     picoquic_init_openssl(); /* OpenSSL init, just in case */
 
@@ -877,7 +1579,9 @@ int picoquic_master_tlscontext(picoquic_quic_t* quic,
         memset(ctx, 0, sizeof(ptls_context_t));
         ctx->random_bytes = ptls_openssl_random_bytes;
         ctx->key_exchanges = picoquic_key_exchanges; /* was:  ptls_openssl_key_exchanges; */
-        ctx->cipher_suites = picoquic_cipher_suites; /* was: ptls_openssl_cipher_suites; */
+        /* The openssl provider is always supported */
+        ctx->cipher_suites = aead_provider->cipher_suites; /* was: ptls_openssl_cipher_suites; */
+        quic->aead_provider_name = aead_provider->name;
 
         ctx->send_change_cipher_spec = 0;
 
@@ -904,9 +1608,15 @@ int picoquic_master_tlscontext(picoquic_quic_t* quic,
                 ret = -1;
             } else {
                 ret = set_sign_certificate_from_key_file(key_file_name, ctx);
+                picoquic_set_compressed_certificates(ctx);
             }
         }
 
+#ifdef PICOQUIC_WITH_BROTLI
+        /* Clients announce that the server may compress its chain */
+        ctx->decompress_certificate = &ptls_decompress_certificate;
+#endif
+
         if (ret == 0) {
             och = (ptls_on_client_hello_t*)malloc(sizeof(ptls_on_client_hello_t) + sizeof(picoquic_quic_t*));
             if (och != NULL) {
@@ -1014,13 +1724,16 @@ void picoquic_master_tlscontext_free(picoquic_quic_t* quic)
             ctx->get_time = NULL;
         }
 
+        picoquic_dispose_compressed_certificates(ctx);
         free_certificates_list(ctx->certificates.list, ctx->certificates.count);
 
-        if (ctx->sign_certificate != NULL) {
-            ptls_openssl_dispose_sign_certificate((ptls_openssl_sign_certificate_t*)ctx->sign_certificate);
-            free((ptls_openssl_sign_certificate_t*)ctx->sign_certificate);
+        if (quic->sign_offload != NULL) {
+            picoquic_sign_offload_free(quic);
             ctx->sign_certificate = NULL;
         }
+        else if (ctx->sign_certificate != NULL) {
+            picoquic_dispose_sign_certificate(quic, ctx);
+        }
 
         picoquic_dispose_verify_certificate_callback(quic, 0);
 
@@ -1279,6 +1992,7 @@ static int picoquic_add_to_tls_stream(picoquic_cnx_t* cnx, const uint8_t* data,
         }
         else {
             stream_data->bytes = (uint8_t*)malloc(length);
+            stream_data->capacity = 0;
 
             if (stream_data->bytes == NULL) {
                 free(stream_data);
@@ -1292,7 +2006,11 @@ static int picoquic_add_to_tls_stream(picoquic_cnx_t* cnx, const uint8_t* data,
                 memcpy(stream_data->bytes, data, length);
                 stream_data->length = length;
                 stream_data->offset = 0;
+                stream_data->archive = NULL;
+                stream_data->release_fn = NULL;
                 stream_data->next_stream_data = NULL;
+                stream_data->memory_category = picoquic_memory_tls;
+                picoquic_memory_charge(cnx, picoquic_memory_tls, picoquic_stream_data_footprint(stream_data));
 
                 while (next != NULL) {
                     pprevious = &next->next_stream_data;
@@ -1334,6 +2052,7 @@ int picoquic_add_proposed_alpn(void* tls_context, const char* alpn)
 
 int picoquic_initialize_tls_stream(picoquic_cnx_t* cnx)
 {
+    uint64_t profile_start = picoquic_profile_start(cnx->quic);
     int ret = 0;
     struct st_ptls_buffer_t sendbuf;
     picoquic_tls_ctx_t* ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
@@ -1391,6 +2110,8 @@ int picoquic_initialize_tls_stream(picoquic_cnx_t* cnx)
 
     ptls_buffer_dispose(&sendbuf);
 
+    picoquic_profile_end(cnx->quic, picoquic_profile_tls, profile_start);
+
     return ret;
 }
 
@@ -1403,7 +2124,7 @@ void * picoquic_hp_enc_create_for_test(const uint8_t * secret)
     ptls_cipher_suite_t cipher = { 0, &ptls_openssl_aes128gcm, &ptls_openssl_sha256 };
     void *v_hp_enc = NULL;
     
-    (void)picoquic_set_hp_enc_from_secret(&v_hp_enc, &cipher, 1, secret);
+    (void)picoquic_set_hp_enc_from_secret(&v_hp_enc, NULL, &cipher, 1, secret);
 
     return v_hp_enc;
 }
@@ -1419,6 +2140,49 @@ void picoquic_hp_encrypt(void *hp_enc, const void * iv, void *output, const void
     ptls_cipher_encrypt((ptls_cipher_context_t *) hp_enc, output, input, len);
 }
 
+#define PICOQUIC_HP_BATCH_BLOCKS 16 /* Enough for the AES pipelines to stay busy */
+
+void picoquic_hp_mask_batch(void *hp_enc, void *hp_ecb, const uint8_t **samples, uint8_t *masks, size_t nb_samples)
+{
+    if (hp_ecb == NULL) {
+        for (size_t i = 0; i < nb_samples; i++) {
+            memset(masks + 5 * i, 0, 5);
+            picoquic_hp_encrypt(hp_enc, samples[i], masks + 5 * i, masks + 5 * i, 5);
+        }
+    } else {
+        uint8_t blocks[PICOQUIC_HP_BATCH_BLOCKS * 16];
+
+        for (size_t first = 0; first < nb_samples; first += PICOQUIC_HP_BATCH_BLOCKS) {
+            size_t nb_blocks = (nb_samples - first < PICOQUIC_HP_BATCH_BLOCKS) ? nb_samples - first : PICOQUIC_HP_BATCH_BLOCKS;
+
+            for (size_t i = 0; i < nb_blocks; i++) {
+                memcpy(blocks + 16 * i, samples[first + i], 16);
+            }
+            ptls_cipher_encrypt((ptls_cipher_context_t *)hp_ecb, blocks, blocks, 16 * nb_blocks);
+            for (size_t i = 0; i < nb_blocks; i++) {
+                memcpy(masks + 5 * (first + i), blocks + 16 * i, 5);
+            }
+        }
+    }
+}
+
+void* picoquic_aes128_ecb_create(int is_enc, const uint8_t* key)
+{
+    return ptls_cipher_new(&ptls_openssl_aes128ecb, is_enc, key);
+}
+
+void picoquic_aes128_ecb_apply(void* ecb, void* output, const void* input, size_t len)
+{
+    ptls_cipher_encrypt((ptls_cipher_context_t*)ecb, output, input, len);
+}
+
+void picoquic_aes128_ecb_free(void* ecb)
+{
+    if (ecb != NULL) {
+        ptls_cipher_free((ptls_cipher_context_t*)ecb);
+    }
+}
+
 /* Utility functions, so applications do not have to load picotls.h */
 
 void picoquic_aead_free(void* aead_context)
@@ -1529,12 +2293,65 @@ static void picoquic_setup_cleartext_aead_salt(size_t version_index, ptls_iovec_
  * should be sent at each epoch.
  */
 
+/* Resumes the server handshake parked while its signature was computed by the offload pool */
+static int picoquic_tls_resume_handshake(picoquic_cnx_t* cnx)
+{
+    int ret = 0;
+    int tls_ret;
+    picoquic_tls_ctx_t* ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
+    struct st_ptls_buffer_t sendbuf;
+    size_t send_offset[PICOQUIC_NUMBER_OF_EPOCH_OFFSETS] = { 0, 0, 0, 0, 0 };
+
+    ptls_buffer_init(&sendbuf, "", 0);
+
+    tls_ret = ptls_handle_message(ctx->tls, &sendbuf, send_offset, ptls_get_read_epoch(ctx->tls),
+        NULL, 0, &ctx->handshake_properties);
+
+    if (tls_ret == 0 || tls_ret == PTLS_ERROR_IN_PROGRESS) {
+        for (int i = 0; i < PICOQUIC_NUMBER_OF_EPOCHS && ret == 0; i++) {
+            if (send_offset[i] < send_offset[i + 1]) {
+                ret = picoquic_add_to_tls_stream(cnx,
+                    sendbuf.base + send_offset[i], send_offset[i + 1] - send_offset[i], i);
+            }
+        }
+        if ((cnx->cnx_state == picoquic_state_server_init || cnx->cnx_state == picoquic_state_server_handshake) &&
+            cnx->crypto_context[3].aead_encrypt != NULL) {
+            picoquic_set_cnx_state(cnx, picoquic_state_server_almost_ready);
+        }
+    }
+    else {
+        uint64_t error_code = PICOQUIC_TLS_HANDSHAKE_FAILED;
+
+        if (PTLS_ERROR_GET_CLASS(tls_ret) == PTLS_ERROR_CLASS_SELF_ALERT) {
+            error_code = PICOQUIC_TRANSPORT_CRYPTO_ERROR(tls_ret);
+        }
+#ifdef _DEBUG
+        DBG_PRINTF("Handshake failed after the signature, ret = %x.\n", tls_ret);
+#endif
+        (void)picoquic_connection_error(cnx, error_code, 0);
+    }
+
+    ptls_buffer_dispose(&sendbuf);
+
+    return ret;
+}
+
 int picoquic_tls_stream_process(picoquic_cnx_t* cnx)
 {
+    uint64_t profile_start = picoquic_profile_start(cnx->quic);
     int ret = 0;
     picoquic_tls_ctx_t* ctx = (picoquic_tls_ctx_t*)cnx->tls_ctx;
     size_t next_epoch = 0;
 
+    if (ctx->sign_job != NULL) {
+        if (!picoquic_tls_is_sign_done(ctx)) {
+            /* The handshake stays parked, the data received meanwhile waits in the streams */
+            picoquic_profile_end(cnx->quic, picoquic_profile_tls, profile_start);
+            return 0;
+        }
+        ret = picoquic_tls_resume_handshake(cnx);
+    }
+
     for (size_t epoch = 0; epoch < PICOQUIC_NUMBER_OF_EPOCHS && ret == 0; epoch++) {
         picoquic_stream_head* stream = &cnx->tls_stream[epoch];
         picoquic_stream_data* data = stream->stream_data;
@@ -1579,7 +2396,7 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx)
             }
 #endif
             if ((ret == 0 || ret == PTLS_ERROR_IN_PROGRESS ||
-                ret == PTLS_ERROR_STATELESS_RETRY)) {
+                ret == PTLS_ERROR_STATELESS_RETRY || picoquic_tls_is_async(ret))) {
                 for (int i = 0; i < PICOQUIC_NUMBER_OF_EPOCHS; i++) {
                     if (send_offset[i] < send_offset[i + 1]) {
                         data_pushed = 1;
@@ -1619,9 +2436,8 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx)
             processed += epoch_data;
 
             if (start + epoch_data >= data->length) {
-                free(data->bytes);
                 cnx->tls_stream[epoch].stream_data = data->next_stream_data;
-                free(data);
+                picoquic_free_stream_data(cnx, data);
                 data = cnx->tls_stream[epoch].stream_data;
             }
 
@@ -1702,7 +2518,7 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx)
                 }
             }
 
-            if ((ret == 0 || ret == PTLS_ERROR_IN_PROGRESS || ret == PTLS_ERROR_STATELESS_RETRY)) {
+            if ((ret == 0 || ret == PTLS_ERROR_IN_PROGRESS || ret == PTLS_ERROR_STATELESS_RETRY || picoquic_tls_is_async(ret))) {
                 ret = 0;
             }
             else {
@@ -1720,6 +2536,8 @@ int picoquic_tls_stream_process(picoquic_cnx_t* cnx)
         }
     }
 
+    picoquic_profile_end(cnx->quic, picoquic_profile_tls, profile_start);
+
     return ret;
 }
 
@@ -1768,6 +2586,7 @@ void picoquic_set_tls_certificate_chain(picoquic_quic_t* quic, ptls_iovec_t* cer
 
     ctx->certificates.list = certs;
     ctx->certificates.count = count;
+    picoquic_set_compressed_certificates(ctx);
 }
 
 int picoquic_set_tls_root_certificates(picoquic_quic_t* quic, ptls_iovec_t* certs, size_t count)
@@ -1796,12 +2615,18 @@ int picoquic_set_tls_root_certificates(picoquic_quic_t* quic, ptls_iovec_t* cert
 int picoquic_set_tls_key(picoquic_quic_t* quic, const uint8_t* data, size_t len)
 {
     ptls_context_t* ctx = (ptls_context_t*)quic->tls_master_ctx;
+    int ret;
+
     if (ctx->sign_certificate != NULL) {
-        ptls_openssl_dispose_sign_certificate((ptls_openssl_sign_certificate_t*)ctx->sign_certificate);
-        ctx->sign_certificate = NULL;
+        picoquic_dispose_sign_certificate(quic, ctx);
     }
 
-    return set_sign_certificate_from_key(d2i_AutoPrivateKey(NULL, &data, (long)len), ctx);
+    ret = set_sign_certificate_from_key(d2i_AutoPrivateKey(NULL, &data, (long)len), ctx);
+    if (ret == 0) {
+        picoquic_wrap_sign_certificate(quic, ctx);
+    }
+
+    return ret;
 }
 
 void picoquic_tls_set_client_authentication(picoquic_quic_t* quic, int client_authentication) {
@@ -1813,7 +2638,9 @@ int picoquic_tls_client_authentication_activated(picoquic_quic_t* quic) {
 }
 
 /*
- * Check the incoming retry token, or produce a token (place holder)
+ * Produce the retry token expected from a client address, as an HMAC of the
+ * address keyed with the retry secret. The server can thus check the token
+ * of an incoming Initial without keeping any state.
  */
 
 int picoquic_get_retry_token(picoquic_quic_t* quic, uint8_t * base, size_t len, 
@@ -1821,13 +2648,13 @@ int picoquic_get_retry_token(picoquic_quic_t* quic, uint8_t * base, size_t len,
     /*Using OpenSSL for now: ptls_hash_algorithm_t ptls_openssl_sha256 */
     int ret = 0;
     ptls_hash_algorithm_t* algo = &ptls_openssl_sha256;
-    ptls_hash_context_t* hash_ctx = algo->create();
+    ptls_hash_context_t* hash_ctx = NULL;
     uint8_t final_hash[PTLS_MAX_DIGEST_SIZE];
 
-    if (hash_ctx == NULL || token_length > algo->digest_size ) {
+    if (token_length > algo->digest_size ||
+        (hash_ctx = ptls_hmac_create(algo, quic->retry_seed, sizeof(quic->retry_seed))) == NULL) {
         ret = -1;
     } else {
-        hash_ctx->update(hash_ctx, quic->retry_seed, sizeof(quic->retry_seed));
         if (len > 0) {
             hash_ctx->update(hash_ctx, base, len);
         }
@@ -29,6 +29,7 @@
 #define PICOQUIC_LABEL_KEY "key"
 #define PICOQUIC_LABEL_IV "iv"
 #define PICOQUIC_LABEL_HP "hp"
+#define PICOQUIC_LABEL_KEY_UPDATE "ku"
 
 #define PICOQUIC_LABEL_BASE "tls13 "
 #define PICOQUIC_LABEL_QUIC_BASE PICOQUIC_LABEL_BASE "quic "
@@ -72,8 +73,27 @@ size_t picoquic_hp_iv_size(void *hp_enc);
 
 void picoquic_hp_encrypt(void *hp_enc, const void *iv, void *output, const void *input, size_t len);
 
+/* Computes the 5 byte header protection masks of nb_samples packets, in a single block cipher call
+ * when hp_ecb is set, one packet at a time with hp_enc otherwise */
+void picoquic_hp_mask_batch(void *hp_enc, void *hp_ecb, const uint8_t **samples, uint8_t *masks, size_t nb_samples);
+
+/* AES-128 in ECB mode, e.g. for the QUIC-LB connection IDs. The length applied is a multiple of 16.
+ * Returns NULL if the context cannot be created */
+void* picoquic_aes128_ecb_create(int is_enc, const uint8_t* key);
+void picoquic_aes128_ecb_apply(void* ecb, void* output, const void* input, size_t len);
+void picoquic_aes128_ecb_free(void* ecb);
+
 typedef const struct st_ptls_cipher_suite_t ptls_cipher_suite_t;
 
+/* Adds a provider of cipher suites, preferred to those registered before it, e.g. a stitched AES-GCM
+ * engine. is_supported tells whether the CPU can run it, NULL meaning always. Meant to be called
+ * before the contexts are created. Returns -1 if the table is full. */
+int picoquic_register_aead_provider(char const* name, int (*is_supported)(void), ptls_cipher_suite_t** cipher_suites);
+/* Name of the provider of rank index, in order of preference, NULL past the last one */
+char const* picoquic_get_aead_provider_name(size_t index);
+/* Cipher suites of the named provider, or of the preferred one if name is NULL. NULL if it is not supported */
+ptls_cipher_suite_t** picoquic_get_aead_provider_suites(char const* name);
+
 int picoquic_setup_initial_master_secret(
     ptls_cipher_suite_t * cipher,
     ptls_iovec_t salt,
@@ -90,6 +110,22 @@ int picoquic_setup_initial_traffic_keys(picoquic_cnx_t* cnx);
 
 void picoquic_crypto_context_free(picoquic_crypto_context_t * ctx);
 
+/* Initial decryption keys of a destination CID that does not match a connection, from the cache of the context */
+int picoquic_get_initial_decrypt_context(picoquic_quic_t* quic, int version_index,
+    picoquic_connection_id_t* cnx_id, picoquic_crypto_context_t** p_ctx);
+/* Same entry, with the Initial encryption keys of the server added */
+int picoquic_get_initial_encrypt_context(picoquic_quic_t* quic, int version_index,
+    picoquic_connection_id_t* cnx_id, picoquic_crypto_context_t** p_ctx);
+void picoquic_initial_key_cache_free(picoquic_quic_t* quic);
+
+/* Moves the 1-RTT keys of one direction to the precomputed next phase and derives the one after.
+ * The previous decryption key is kept until picoquic_check_key_retention() sees it expired. */
+int picoquic_rotate_key_phase(picoquic_cnx_t* cnx, int is_enc, uint64_t current_time);
+void picoquic_check_key_retention(picoquic_cnx_t* cnx, uint64_t current_time);
+
+/* Whether the server handshake is parked until the offload pool computed its signature */
+int picoquic_tls_is_sign_pending(picoquic_cnx_t* cnx);
+
 void * picoquic_setup_test_aead_context(int is_encrypt, const uint8_t * secret);
 void * picoquic_hp_enc_create_for_test(const uint8_t * secret);
 
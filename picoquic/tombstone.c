@@ -0,0 +1,237 @@
+/*
+ * Tombstones of the closed connections.
+ *
+ * After sending its CONNECTION_CLOSE, or answering the one of its peer, a connection only has to repeat its
+ * close datagram to the late packets of the peer, or to drop them, until 3 RTO have elapsed. The tombstone
+ * keeps what that takes: the CIDs that route the packets to it, the protected close datagram, and the times.
+ * The connection itself is moved to the disconnected state as soon as the datagram is prepared, and the
+ * application deletes it as for any other disconnection.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+#define PICOQUIC_TOMBSTONE_MAX_CNX_IDS 16 /* Past them, the packets to the other CIDs get stateless resets */
+
+typedef struct st_picoquic_tombstone_id_t {
+    picoquic_connection_id_t cnx_id;
+    struct st_picoquic_tombstone_t* tombstone;
+} picoquic_tombstone_id_t;
+
+typedef struct st_picoquic_tombstone_t {
+    struct st_picoquic_tombstone_t* next; /* By expiry time */
+    struct st_picoquic_tombstone_t* previous;
+    uint64_t expiry_time;
+    uint64_t next_send_time;
+    uint64_t send_interval;
+    int nb_cnx_ids;
+    picoquic_tombstone_id_t* cnx_ids; /* In the same allocation, after the structure */
+    size_t close_length; /* 0 when draining */
+    uint8_t* close_datagram; /* After the CIDs */
+} picoquic_tombstone_t;
+
+static uint64_t picoquic_tombstone_id_hash(void* key)
+{
+    picoquic_tombstone_id_t* tid = (picoquic_tombstone_id_t*)key;
+
+    return picoquic_val64_connection_id(tid->cnx_id);
+}
+
+static int picoquic_tombstone_id_compare(void* key1, void* key2)
+{
+    picoquic_tombstone_id_t* tid1 = (picoquic_tombstone_id_t*)key1;
+    picoquic_tombstone_id_t* tid2 = (picoquic_tombstone_id_t*)key2;
+
+    return picoquic_compare_connection_id(&tid1->cnx_id, &tid2->cnx_id);
+}
+
+static void picoquic_tombstone_delete(picoquic_quic_t* quic, picoquic_tombstone_t* tombstone)
+{
+    for (int i = 0; i < tombstone->nb_cnx_ids; i++) {
+        picohash_item* item = picohash_retrieve(quic->table_tombstones, &tombstone->cnx_ids[i]);
+
+        /* A CID is only registered once, by the first tombstone that holds it */
+        if (item != NULL && item->key == &tombstone->cnx_ids[i]) {
+            picohash_item_delete(quic->table_tombstones, item, 0);
+        }
+    }
+
+    if (tombstone->previous == NULL) {
+        quic->tombstone_first = tombstone->next;
+    } else {
+        tombstone->previous->next = tombstone->next;
+    }
+    if (tombstone->next == NULL) {
+        quic->tombstone_last = tombstone->previous;
+    } else {
+        tombstone->next->previous = tombstone->previous;
+    }
+    quic->nb_tombstones--;
+    free(tombstone);
+}
+
+static void picoquic_tombstones_expire(picoquic_quic_t* quic, uint64_t current_time)
+{
+    while (quic->tombstone_first != NULL && quic->tombstone_first->expiry_time <= current_time) {
+        picoquic_tombstone_delete(quic, quic->tombstone_first);
+    }
+}
+
+void picoquic_free_tombstones(picoquic_quic_t* quic)
+{
+    while (quic->tombstone_first != NULL) {
+        picoquic_tombstone_delete(quic, quic->tombstone_first);
+    }
+    if (quic->table_tombstones != NULL) {
+        picohash_delete(quic->table_tombstones, 0);
+        quic->table_tombstones = NULL;
+    }
+}
+
+void picoquic_set_tombstones(picoquic_quic_t* quic, size_t max_tombstones)
+{
+    if (max_tombstones == 0) {
+        picoquic_free_tombstones(quic);
+    } else if (quic->table_tombstones == NULL) {
+        quic->table_tombstones = picohash_create(max_tombstones * 2, picoquic_tombstone_id_hash, picoquic_tombstone_id_compare);
+    }
+    /* Without a table, there are no tombstones */
+    quic->max_tombstones = (quic->table_tombstones == NULL) ? 0 : max_tombstones;
+    while (quic->nb_tombstones > quic->max_tombstones) {
+        picoquic_tombstone_delete(quic, quic->tombstone_first);
+    }
+}
+
+size_t picoquic_get_nb_tombstones(picoquic_quic_t* quic, uint64_t current_time)
+{
+    picoquic_tombstones_expire(quic, current_time);
+
+    return quic->nb_tombstones;
+}
+
+void picoquic_bury_cnx(picoquic_cnx_t* cnx, const uint8_t* close_datagram, size_t close_length, uint64_t current_time)
+{
+    picoquic_quic_t* quic = cnx->quic;
+    picoquic_tombstone_t* tombstone = NULL;
+    picoquic_connection_id_t cnx_ids[PICOQUIC_TOMBSTONE_MAX_CNX_IDS + 1];
+    int nb_cnx_ids;
+
+    cnx->tombstone_pending = 0;
+    if (quic->max_tombstones == 0) {
+        return;
+    }
+
+    /* The close datagram is repeated as a stateless packet, the larger ones are not kept */
+    if (cnx->tombstone_interval == 0 || close_length > PICOQUIC_MAX_PACKET_SIZE) {
+        close_length = 0;
+    }
+    nb_cnx_ids = picoquic_get_registered_cnx_ids(cnx, cnx_ids, PICOQUIC_TOMBSTONE_MAX_CNX_IDS);
+    if (nb_cnx_ids > PICOQUIC_TOMBSTONE_MAX_CNX_IDS) {
+        nb_cnx_ids = PICOQUIC_TOMBSTONE_MAX_CNX_IDS;
+    }
+    /* The late Initial packets of the client are routed by the CID it chose */
+    if (!cnx->client_mode && !picoquic_is_connection_id_null(cnx->initial_cnxid)) {
+        cnx_ids[nb_cnx_ids++] = cnx->initial_cnxid;
+    }
+
+    picoquic_tombstones_expire(quic, current_time);
+    if (quic->nb_tombstones >= quic->max_tombstones) {
+        picoquic_tombstone_delete(quic, quic->tombstone_first);
+    }
+
+    if (nb_cnx_ids > 0) {
+        tombstone = (picoquic_tombstone_t*)malloc(sizeof(picoquic_tombstone_t) +
+            nb_cnx_ids * sizeof(picoquic_tombstone_id_t) + close_length);
+    }
+
+    if (tombstone != NULL) {
+        picoquic_tombstone_t* previous = quic->tombstone_last;
+        int i;
+
+        memset(tombstone, 0, sizeof(picoquic_tombstone_t));
+        tombstone->expiry_time = cnx->tombstone_expiry;
+        tombstone->send_interval = cnx->tombstone_interval;
+        tombstone->next_send_time = current_time + cnx->tombstone_interval;
+        tombstone->cnx_ids = (picoquic_tombstone_id_t*)(tombstone + 1);
+        tombstone->close_datagram = (uint8_t*)(tombstone->cnx_ids + nb_cnx_ids);
+        tombstone->close_length = close_length;
+        if (close_length > 0) {
+            memcpy(tombstone->close_datagram, close_datagram, close_length);
+        }
+        for (i = 0; i < nb_cnx_ids; i++) {
+            tombstone->cnx_ids[i].cnx_id = cnx_ids[i];
+        }
+        tombstone->nb_cnx_ids = nb_cnx_ids;
+
+        /* The expiry times are close to the insertion times, so the place is found from the end */
+        while (previous != NULL && previous->expiry_time > tombstone->expiry_time) {
+            previous = previous->previous;
+        }
+        tombstone->previous = previous;
+        tombstone->next = (previous == NULL) ? quic->tombstone_first : previous->next;
+        if (previous == NULL) {
+            quic->tombstone_first = tombstone;
+        } else {
+            previous->next = tombstone;
+        }
+        if (tombstone->next == NULL) {
+            quic->tombstone_last = tombstone;
+        } else {
+            tombstone->next->previous = tombstone;
+        }
+        quic->nb_tombstones++;
+
+        for (i = 0; i < nb_cnx_ids; i++) {
+            tombstone->cnx_ids[i].tombstone = tombstone;
+            if (picohash_retrieve(quic->table_tombstones, &tombstone->cnx_ids[i]) == NULL) {
+                (void)picohash_insert(quic->table_tombstones, &tombstone->cnx_ids[i]);
+            }
+        }
+    }
+
+    /* The tombstone answers for the connection from now on, which the application can delete */
+    picoquic_set_cnx_state(cnx, picoquic_state_disconnected);
+    picoquic_reinsert_by_wake_time(quic, cnx, current_time);
+}
+
+int picoquic_tombstone_incoming(picoquic_quic_t* quic, picoquic_connection_id_t* dest_cnx_id, uint32_t length,
+    struct sockaddr* addr_from, struct sockaddr* addr_to, unsigned long if_index_to, uint64_t current_time)
+{
+    picoquic_tombstone_id_t key;
+    picohash_item* item;
+    picoquic_tombstone_t* tombstone;
+
+    if (quic->table_tombstones == NULL || quic->nb_tombstones == 0) {
+        return 0;
+    }
+    picoquic_tombstones_expire(quic, current_time);
+
+    key.cnx_id = *dest_cnx_id;
+    if ((item = picohash_retrieve(quic->table_tombstones, &key)) == NULL) {
+        return 0;
+    }
+    tombstone = ((picoquic_tombstone_id_t*)item->key)->tombstone;
+
+    /* At most one answer per interval, and never more than three times the bytes received */
+    if (tombstone->close_length > 0 && current_time >= tombstone->next_send_time &&
+        tombstone->close_length <= 3 * (size_t)length) {
+        picoquic_stateless_packet_t* sp = picoquic_create_stateless_packet(quic);
+
+        if (sp != NULL) {
+            memcpy(sp->bytes, tombstone->close_datagram, tombstone->close_length);
+            sp->length = tombstone->close_length;
+            memset(&sp->addr_to, 0, sizeof(sp->addr_to));
+            memcpy(&sp->addr_to, addr_from,
+                (addr_from->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+            memset(&sp->addr_local, 0, sizeof(sp->addr_local));
+            memcpy(&sp->addr_local, addr_to,
+                (addr_to->sa_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+            sp->if_index_local = if_index_to;
+            picoquic_queue_stateless_packet(quic, sp);
+            tombstone->next_send_time = current_time + tombstone->send_interval;
+        }
+    }
+
+    return 1;
+}
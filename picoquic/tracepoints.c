@@ -0,0 +1,16 @@
+#include "tracepoints.h"
+
+#ifdef PICOQUIC_WITH_USDT
+/* The tracer finds the semaphores of the probes in this section and increments them while attached */
+#define PICOQUIC_TRACE_SEMAPHORE(name) unsigned short pquic_##name##_semaphore __attribute__((section(".probes"))) = 0
+
+PICOQUIC_TRACE_SEMAPHORE(incoming_segment);
+PICOQUIC_TRACE_SEMAPHORE(prepare_segment);
+PICOQUIC_TRACE_SEMAPHORE(update_rtt);
+PICOQUIC_TRACE_SEMAPHORE(retransmit_needed);
+PICOQUIC_TRACE_SEMAPHORE(congestion_notify);
+PICOQUIC_TRACE_SEMAPHORE(protoop);
+#else
+/* Keeps the unit from being empty */
+typedef int picoquic_tracepoints_disabled_t;
+#endif
@@ -0,0 +1,68 @@
+/**
+ * \file tracepoints.h
+ * \brief USDT probes of the transport, for perf, bpftrace or systemtap.
+ *
+ * The probes are stable attach points on the hot paths, which uprobes on the functions cannot be once
+ * they are inlined. They are compiled in when sys/sdt.h is found, each behind its semaphore: the
+ * arguments are only evaluated while a tracer is attached, otherwise the probe costs a load and a
+ * not taken branch. They sit in the wrappers of the protocol operations rather than in the default
+ * implementations, so that they still fire when a plugin replaces the operation.
+ *
+ * Provider "pquic". The connection is given by its logging connection id, the path by the address of
+ * its context, and the times are in microseconds but the durations in nanoseconds.
+ *
+ *  - incoming_segment(cnxid, ptype, pn, length, ret): a received segment was processed, length is the
+ *    number of bytes of the datagram it used and ret the error of its processing, 0 if accepted.
+ *  - prepare_segment(cnxid, path, pn, length, cwin): a segment was prepared, of length bytes, 0 if
+ *    nothing was to be sent, on the path of congestion window cwin.
+ *  - update_rtt(cnxid, path, rtt_sample, smoothed_rtt, rtt_variant): an acknowledgement was processed
+ *    for the path, the sample is the last one taken, which may be an older one.
+ *  - retransmit_needed(cnxid, path, pc, length): a packet of the context pc was checked for
+ *    retransmission, length is the size of the copy, 0 if none.
+ *  - congestion_notify(cnxid, path, notification, rtt, nb_bytes, cwin): the congestion controller was
+ *    notified, cwin is the window after it.
+ *  - protoop(cnxid, id, param, status, duration): a protocol operation of the given name returned,
+ *    its duration includes the pre and post pluglets.
+ *
+ * For example, the distribution of the durations of each protocol operation:
+ *   bpftrace -e 'usdt:./picoquicdemo:pquic:protoop { @[str(arg1)] = hist(arg4); }'
+ */
+
+#ifndef PICOQUIC_TRACEPOINTS_H
+#define PICOQUIC_TRACEPOINTS_H
+
+#ifdef PICOQUIC_WITH_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+/* Set by the tracer while a probe is attached, see tracepoints.c */
+extern unsigned short pquic_incoming_segment_semaphore;
+extern unsigned short pquic_prepare_segment_semaphore;
+extern unsigned short pquic_update_rtt_semaphore;
+extern unsigned short pquic_retransmit_needed_semaphore;
+extern unsigned short pquic_congestion_notify_semaphore;
+extern unsigned short pquic_protoop_semaphore;
+
+#define PICOQUIC_TRACE_ENABLED(name) __builtin_expect(pquic_##name##_semaphore != 0, 0)
+#define PICOQUIC_TRACE4(name, a1, a2, a3, a4) do { \
+    if (PICOQUIC_TRACE_ENABLED(name)) { DTRACE_PROBE4(pquic, name, a1, a2, a3, a4); } } while (0)
+#define PICOQUIC_TRACE5(name, a1, a2, a3, a4, a5) do { \
+    if (PICOQUIC_TRACE_ENABLED(name)) { DTRACE_PROBE5(pquic, name, a1, a2, a3, a4, a5); } } while (0)
+#define PICOQUIC_TRACE6(name, a1, a2, a3, a4, a5, a6) do { \
+    if (PICOQUIC_TRACE_ENABLED(name)) { DTRACE_PROBE6(pquic, name, a1, a2, a3, a4, a5, a6); } } while (0)
+
+#else
+
+/* The arguments are still checked, but never evaluated */
+#define PICOQUIC_TRACE_ENABLED(name) 0
+#define PICOQUIC_TRACE4(name, a1, a2, a3, a4) do { if (0) { \
+    (void)(a1); (void)(a2); (void)(a3); (void)(a4); } } while (0)
+#define PICOQUIC_TRACE5(name, a1, a2, a3, a4, a5) do { if (0) { \
+    (void)(a1); (void)(a2); (void)(a3); (void)(a4); (void)(a5); } } while (0)
+#define PICOQUIC_TRACE6(name, a1, a2, a3, a4, a5, a6) do { if (0) { \
+    (void)(a1); (void)(a2); (void)(a3); (void)(a4); (void)(a5); (void)(a6); } } while (0)
+
+#endif
+
+#endif
@@ -198,11 +198,7 @@ int prepare_plugin_transport_extensions(picoquic_cnx_t* cnx, uint8_t* bytes, siz
     int byte_index = 0;
 
     /* Insert here a special (parametrizable) protocol operation to add new TPs */
-    protocol_operation_struct_t *post;
-    if (PROTOOP_PARAM_WRITE_TRANSPORT_PARAMETER.hash == 0) {
-        PROTOOP_PARAM_WRITE_TRANSPORT_PARAMETER.hash = hash_value_str(PROTOOP_PARAM_WRITE_TRANSPORT_PARAMETER.id);
-    }
-    HASH_FIND_PID(cnx->ops, &(PROTOOP_PARAM_WRITE_TRANSPORT_PARAMETER.hash), post);
+    protocol_operation_struct_t *post = picoquic_find_protoop(cnx, &PROTOOP_PARAM_WRITE_TRANSPORT_PARAMETER);
     if (!post) {
         printf("No plugin attached on write_transport_parameter\n");
         return 0;
@@ -226,7 +222,7 @@ int prepare_plugin_transport_extensions(picoquic_cnx_t* cnx, uint8_t* bytes, siz
                 cnx->current_plugin = current_popst->replace->p;
                 cnx->current_anchor = pluglet_replace;
                 status = (protoop_arg_t) exec_loaded_code(current_popst->replace, (void *)cnx,
-                    (void *)cnx->current_plugin->memory, sizeof(cnx->current_plugin->memory), &error_msg);
+                    (void *)cnx->current_plugin->memory, cnx->current_plugin->memory_size, &error_msg);
                 if (error_msg) {
                     fprintf(stderr, "Error when running %s: %s\n", PROTOOP_PARAM_WRITE_TRANSPORT_PARAMETER.id, error_msg);
                 }
@@ -252,6 +248,8 @@ int picoquic_prepare_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
     size_t byte_index = 0;
     size_t min_size = 0;
     uint16_t param_size = 0;
+    picoquic_tp_preferred_address_t preferred_address;
+    int has_preferred_address = (extension_mode == 1 && picoquic_get_local_preferred_address(cnx, &preferred_address));
 
     /* All parameters are now optional, but some are sent always */
     param_size =  (1 + 1 + 4) + (1 + 1 + 4) + (1 + 1 + 2) + (1 + 1 + 2) + (1 + 1 + cnx->local_parameters.initial_source_connection_id.id_len);
@@ -285,6 +283,12 @@ int picoquic_prepare_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
     if (cnx->local_parameters.max_packet_size >= 1200) {
         param_size += (1 + 1 + 2);
     }
+    if (cnx->local_parameters.min_ack_delay > 0) {
+        param_size += (4 + 1 + picoquic_varint_len(cnx->local_parameters.min_ack_delay));
+    }
+    if (has_preferred_address) {
+        param_size += (1 + 1 + picoquic_length_transport_param_preferred_address(&preferred_address));
+    }
 
     size_t supported_plugins_len = picoquic_get_supported_plugins_transport_parameter(cnx);
     if (supported_plugins_len > 0) {
@@ -371,6 +375,20 @@ int picoquic_prepare_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
                                            cnx->local_parameters.initial_max_stream_data_uni);
         }
 
+        if (cnx->local_parameters.min_ack_delay > 0) {
+            byte_index += tp_varint_encode(bytes + byte_index, bytes_max - byte_index,
+                                           picoquic_tp_min_ack_delay,
+                                           cnx->local_parameters.min_ack_delay);
+        }
+
+        if (has_preferred_address) {
+            uint8_t coded[64];
+            uint16_t coded_length = picoquic_prepare_transport_param_preferred_address(coded, sizeof(coded), &preferred_address);
+
+            byte_index += tp_data_encode(bytes + byte_index, bytes_max - byte_index,
+                                         picoquic_tp_preferred_address, coded, coded_length);
+        }
+
         if (supported_plugins_len > 0) {
             byte_index += tp_data_encode(bytes + byte_index, bytes_max - byte_index,
                                          picoquic_tp_supported_plugins,
@@ -435,6 +453,7 @@ int picoquic_receive_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
                         case picoquic_tp_max_idle_timeout:
                         case picoquic_tp_max_ack_delay:
                         case picoquic_tp_active_connection_id_limit:
+                        case picoquic_tp_min_ack_delay:
                            if (extension_length != 1 && extension_length != 2 && extension_length != 4 && extension_length != 8) {
                                ret = picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0);
                                break;
@@ -558,6 +577,14 @@ int picoquic_receive_transport_extensions(picoquic_cnx_t* cnx, int extension_mod
                             byte_index += extension_length;
                         }
                         break;
+                    case picoquic_tp_min_ack_delay:
+                        byte_index += picoquic_varint_decode(bytes + byte_index, bytes_max - byte_index, &cnx->remote_parameters.min_ack_delay);
+                        /* Announced in microseconds, while max_ack_delay is in milliseconds */
+                        if (cnx->remote_parameters.min_ack_delay == 0 ||
+                            cnx->remote_parameters.min_ack_delay > cnx->remote_parameters.max_ack_delay * 1000) {
+                            ret = picoquic_connection_error(cnx, PICOQUIC_TRANSPORT_PARAMETER_ERROR, 0);
+                        }
+                        break;
                     case picoquic_tp_supported_plugins:
                         if (extension_length > 0) {
                             cnx->remote_parameters.supported_plugins = malloc(sizeof(char) * extension_length);
@@ -0,0 +1,181 @@
+#include <string.h>
+#include "picoquic_internal.h"
+
+void picoquic_path_set_send_limit(picoquic_path_t* path_x, picoquic_send_limit_enum limit, uint64_t current_time)
+{
+    picoquic_path_counters_t* counters = &path_x->counters;
+
+    if (limit != counters->send_limit) {
+        if (current_time > counters->send_limit_start) {
+            counters->send_limit_time[counters->send_limit] += current_time - counters->send_limit_start;
+        }
+        counters->send_limit = limit;
+        counters->send_limit_start = current_time;
+    }
+}
+
+/* Values under 4 have their own bucket, the others one of the 4 buckets of their power of two */
+static unsigned int picoquic_rtt_bucket(uint64_t rtt)
+{
+    unsigned int bucket = (unsigned int)rtt;
+
+    if (rtt >= 4) {
+        unsigned int e = 63 - __builtin_clzll(rtt);
+        bucket = (e - 1) * 4 + (unsigned int)((rtt >> (e - 2)) & 3);
+        if (bucket >= PICOQUIC_RTT_HISTOGRAM_SIZE) {
+            bucket = PICOQUIC_RTT_HISTOGRAM_SIZE - 1;
+        }
+    }
+
+    return bucket;
+}
+
+/* Middle of the values that go in the bucket */
+static uint64_t picoquic_rtt_bucket_value(unsigned int bucket)
+{
+    uint64_t value = bucket;
+
+    if (bucket >= 4) {
+        unsigned int e = bucket / 4 + 1;
+        uint64_t low = ((uint64_t)(4 + bucket % 4)) << (e - 2);
+        value = low + (((uint64_t)1 << (e - 2)) - 1) / 2;
+    }
+
+    return value;
+}
+
+void picoquic_path_record_rtt(picoquic_path_t* path_x, uint64_t rtt)
+{
+    path_x->counters.rtt_histogram[picoquic_rtt_bucket(rtt)]++;
+}
+
+/* Sets the number of samples and the percentiles from a histogram */
+static void picoquic_rtt_percentiles(const uint64_t* histogram, uint64_t* samples, uint64_t* p50, uint64_t* p90, uint64_t* p99)
+{
+    const unsigned int percents[3] = { 50, 90, 99 };
+    uint64_t* values[3] = { p50, p90, p99 };
+    uint64_t total = 0;
+    uint64_t seen = 0;
+    unsigned int next = 0;
+
+    for (unsigned int i = 0; i < PICOQUIC_RTT_HISTOGRAM_SIZE; i++) {
+        total += histogram[i];
+    }
+    *samples = total;
+    *p50 = *p90 = *p99 = 0;
+
+    for (unsigned int i = 0; total > 0 && i < PICOQUIC_RTT_HISTOGRAM_SIZE && next < 3; i++) {
+        seen += histogram[i];
+        while (next < 3 && seen * 100 >= total * percents[next]) {
+            *values[next++] = picoquic_rtt_bucket_value(i);
+        }
+    }
+}
+
+/* The time spent under the current limit until now is not counted yet */
+static uint64_t picoquic_path_send_limit_time(picoquic_path_t* path_x, picoquic_send_limit_enum limit, uint64_t current_time)
+{
+    uint64_t t = path_x->counters.send_limit_time[limit];
+
+    if (path_x->counters.send_limit == limit && current_time > path_x->counters.send_limit_start) {
+        t += current_time - path_x->counters.send_limit_start;
+    }
+
+    return t;
+}
+
+static void picoquic_fill_path_stats(picoquic_path_t* path_x, picoquic_path_stats_t* stats, uint64_t current_time)
+{
+    picoquic_path_counters_t* counters = &path_x->counters;
+    uint64_t histogram[PICOQUIC_RTT_HISTOGRAM_SIZE];
+
+    memset(stats, 0, sizeof(picoquic_path_stats_t));
+    stats->version = PICOQUIC_STATS_VERSION;
+    stats->packets_sent = counters->packets_sent;
+    stats->bytes_sent = counters->bytes_sent;
+    stats->packets_received = counters->packets_received;
+    stats->bytes_received = counters->bytes_received;
+    stats->packets_lost = counters->packets_lost;
+    stats->bytes_lost = counters->bytes_lost;
+    stats->packets_spurious = counters->packets_spurious;
+    stats->ack_frames_sent = counters->ack_frames_sent;
+    stats->ack_frames_received = counters->ack_frames_received;
+    stats->cwnd_limited_time = picoquic_path_send_limit_time(path_x, picoquic_send_limit_cwnd, current_time);
+    stats->pacing_limited_time = picoquic_path_send_limit_time(path_x, picoquic_send_limit_pacing, current_time);
+    stats->app_limited_time = picoquic_path_send_limit_time(path_x, picoquic_send_limit_app, current_time);
+    stats->flow_control_blocked_time = picoquic_path_send_limit_time(path_x, picoquic_send_limit_flow_control, current_time);
+    stats->cwin = path_x->cwin;
+    stats->bytes_in_transit = path_x->bytes_in_transit;
+    stats->bandwidth_estimate = path_x->bandwidth_estimate;
+    stats->send_mtu = path_x->send_mtu;
+    stats->smoothed_rtt = path_x->smoothed_rtt;
+    stats->rtt_variant = path_x->rtt_variant;
+    stats->rtt_min = path_x->rtt_min;
+    for (unsigned int i = 0; i < PICOQUIC_RTT_HISTOGRAM_SIZE; i++) {
+        histogram[i] = counters->rtt_histogram[i];
+    }
+    picoquic_rtt_percentiles(histogram, &stats->rtt_samples, &stats->rtt_p50, &stats->rtt_p90, &stats->rtt_p99);
+}
+
+int picoquic_get_path_stats(picoquic_cnx_t* cnx, int path_index, picoquic_path_stats_t* stats, size_t stats_size)
+{
+    picoquic_path_stats_t full;
+
+    if (path_index < 0 || path_index >= cnx->nb_paths || stats_size < sizeof(uint32_t)) {
+        return -1;
+    }
+    picoquic_fill_path_stats(cnx->path[path_index], &full, picoquic_get_quic_time(cnx->quic));
+    memcpy(stats, &full, (stats_size < sizeof(full)) ? stats_size : sizeof(full));
+
+    return 0;
+}
+
+int picoquic_get_cnx_stats(picoquic_cnx_t* cnx, picoquic_cnx_stats_t* stats, size_t stats_size)
+{
+    picoquic_cnx_stats_t full;
+    uint64_t histogram[PICOQUIC_RTT_HISTOGRAM_SIZE];
+    uint64_t current_time = picoquic_get_quic_time(cnx->quic);
+
+    if (stats_size < sizeof(uint32_t)) {
+        return -1;
+    }
+
+    memset(&full, 0, sizeof(full));
+    memset(histogram, 0, sizeof(histogram));
+    full.version = PICOQUIC_STATS_VERSION;
+    full.nb_paths = (uint32_t)cnx->nb_paths;
+    for (int i = 0; i < cnx->nb_paths; i++) {
+        picoquic_path_stats_t path_stats;
+
+        picoquic_fill_path_stats(cnx->path[i], &path_stats, current_time);
+        full.packets_sent += path_stats.packets_sent;
+        full.bytes_sent += path_stats.bytes_sent;
+        full.packets_received += path_stats.packets_received;
+        full.bytes_received += path_stats.bytes_received;
+        full.packets_lost += path_stats.packets_lost;
+        full.bytes_lost += path_stats.bytes_lost;
+        full.packets_spurious += path_stats.packets_spurious;
+        full.ack_frames_sent += path_stats.ack_frames_sent;
+        full.ack_frames_received += path_stats.ack_frames_received;
+        full.cwnd_limited_time += path_stats.cwnd_limited_time;
+        full.pacing_limited_time += path_stats.pacing_limited_time;
+        full.app_limited_time += path_stats.app_limited_time;
+        full.flow_control_blocked_time += path_stats.flow_control_blocked_time;
+        for (unsigned int j = 0; j < PICOQUIC_RTT_HISTOGRAM_SIZE; j++) {
+            histogram[j] += cnx->path[i]->counters.rtt_histogram[j];
+        }
+    }
+    full.packets_retransmitted = cnx->nb_retransmission_total;
+    full.zero_rtt_sent = cnx->nb_zero_rtt_sent;
+    full.zero_rtt_acked = cnx->nb_zero_rtt_acked;
+    full.data_sent = cnx->data_sent;
+    full.data_received = cnx->data_received;
+    if (cnx->nb_paths > 0) {
+        full.smoothed_rtt = cnx->path[0]->smoothed_rtt;
+        full.rtt_min = cnx->path[0]->rtt_min;
+    }
+    picoquic_rtt_percentiles(histogram, &full.rtt_samples, &full.rtt_p50, &full.rtt_p90, &full.rtt_p99);
+    memcpy(stats, &full, (stats_size < sizeof(full)) ? stats_size : sizeof(full));
+
+    return 0;
+}
@@ -13,7 +13,9 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <dlfcn.h>
 #include "plugin.h"
 #include "memcpy.h"
 #include "memory.h"
@@ -23,164 +25,199 @@
 #include "picoquic_logger.h"
 #include "red_black_tree.h"
 #include "cc_common.h"
+#include "gf256_region.h"
 
+/* The uBPF JIT only emits x86-64, the other hosts run the threaded interpreter, see ubpf_threaded.c */
 #if defined(NS3)
 #define JIT false
 #elif defined(__APPLE__)
 #define JIT false
-#else
+#elif defined(__x86_64__)
 #define JIT true  /* putting to false show out of memory access */
+#else
+#define JIT false
 #endif
 
 void picoquic_memory_bound_error(uint64_t val, uint64_t mem_ptr, uint64_t stack_ptr) {
     printf("Out of bound access with val 0x%" PRIx64 ", start of mem is 0x%" PRIx64 ", top of stack is 0x%" PRIx64 "\n", val, mem_ptr, stack_ptr);
 }
 
+typedef void (*pluglet_register_fn)(void *ctx, unsigned int idx, const char *name, void *fn);
+
 static void
-register_functions(struct ubpf_vm *vm) {
+register_functions(pluglet_register_fn reg, void *ctx) {
     /* We only have 64 values ... (so far) */
     unsigned int current_idx = 0;
     /* specific API related */
-    ubpf_register(vm, current_idx++, "plugin_run_protoop", plugin_run_protoop);
-    ubpf_register(vm, current_idx++, "reserve_frames", reserve_frames);
-    ubpf_register(vm, current_idx++, "get_cnx", get_cnx);
-    ubpf_register(vm, current_idx++, "set_cnx", set_cnx);
-    ubpf_register(vm, current_idx++, "get_cnx_metadata", get_cnx_metadata);
-    ubpf_register(vm, current_idx++, "set_cnx_metadata", set_cnx_metadata);
-    ubpf_register(vm, current_idx++, "get_path", get_path);
-    ubpf_register(vm, current_idx++, "set_path", set_path);
-    ubpf_register(vm, current_idx++, "get_path_metadata", get_path_metadata);
-    ubpf_register(vm, current_idx++, "set_path_metadata", set_path_metadata);
-    ubpf_register(vm, current_idx++, "get_pkt_ctx", get_pkt_ctx);
-    ubpf_register(vm, current_idx++, "set_pkt_ctx", set_pkt_ctx);
-    ubpf_register(vm, current_idx++, "get_pkt_ctx_metadata", get_pkt_ctx_metadata);
-    ubpf_register(vm, current_idx++, "set_pkt_ctx_metadata", set_pkt_ctx_metadata);
-    ubpf_register(vm, current_idx++, "get_pkt", get_pkt);
-    ubpf_register(vm, current_idx++, "set_pkt", set_pkt);
-    ubpf_register(vm, current_idx++, "get_pkt_metadata", get_pkt_metadata);
-    ubpf_register(vm, current_idx++, "set_pkt_metadata", set_pkt_metadata);
-    ubpf_register(vm, current_idx++, "get_sack_item", get_sack_item);
-    ubpf_register(vm, current_idx++, "set_sack_item", set_sack_item);
-    ubpf_register(vm, current_idx++, "get_cnxid", get_cnxid);
-    ubpf_register(vm, current_idx++, "set_cnxid", set_cnxid);
-    ubpf_register(vm, current_idx++, "get_stream_head", get_stream_head);
-    ubpf_register(vm, current_idx++, "set_stream_head", set_stream_head);
-    ubpf_register(vm, current_idx++, "get_stream_data", get_stream_data);
-    ubpf_register(vm, current_idx++, "get_crypto_context", get_crypto_context);
-    ubpf_register(vm, current_idx++, "set_crypto_context", set_crypto_context);
-    ubpf_register(vm, current_idx++, "get_ph", get_ph);
-    ubpf_register(vm, current_idx++, "set_ph", set_ph);
-    ubpf_register(vm, current_idx++, "cancel_head_reservation", cancel_head_reservation);
+    reg(ctx, current_idx++, "plugin_run_protoop", plugin_run_protoop);
+    reg(ctx, current_idx++, "reserve_frames", reserve_frames);
+    reg(ctx, current_idx++, "get_cnx", get_cnx);
+    reg(ctx, current_idx++, "set_cnx", set_cnx);
+    reg(ctx, current_idx++, "get_cnx_metadata", get_cnx_metadata);
+    reg(ctx, current_idx++, "set_cnx_metadata", set_cnx_metadata);
+    reg(ctx, current_idx++, "get_path", get_path);
+    reg(ctx, current_idx++, "set_path", set_path);
+    reg(ctx, current_idx++, "get_path_metadata", get_path_metadata);
+    reg(ctx, current_idx++, "set_path_metadata", set_path_metadata);
+    reg(ctx, current_idx++, "get_pkt_ctx", get_pkt_ctx);
+    reg(ctx, current_idx++, "set_pkt_ctx", set_pkt_ctx);
+    reg(ctx, current_idx++, "get_pkt_ctx_metadata", get_pkt_ctx_metadata);
+    reg(ctx, current_idx++, "set_pkt_ctx_metadata", set_pkt_ctx_metadata);
+    reg(ctx, current_idx++, "get_pkt", get_pkt);
+    reg(ctx, current_idx++, "set_pkt", set_pkt);
+    reg(ctx, current_idx++, "get_pkt_metadata", get_pkt_metadata);
+    reg(ctx, current_idx++, "set_pkt_metadata", set_pkt_metadata);
+    reg(ctx, current_idx++, "get_sack_item", get_sack_item);
+    reg(ctx, current_idx++, "set_sack_item", set_sack_item);
+    reg(ctx, current_idx++, "get_cnxid", get_cnxid);
+    reg(ctx, current_idx++, "set_cnxid", set_cnxid);
+    reg(ctx, current_idx++, "get_stream_head", get_stream_head);
+    reg(ctx, current_idx++, "set_stream_head", set_stream_head);
+    reg(ctx, current_idx++, "get_stream_data", get_stream_data);
+    reg(ctx, current_idx++, "get_crypto_context", get_crypto_context);
+    reg(ctx, current_idx++, "set_crypto_context", set_crypto_context);
+    reg(ctx, current_idx++, "get_ph", get_ph);
+    reg(ctx, current_idx++, "set_ph", set_ph);
+    reg(ctx, current_idx++, "cancel_head_reservation", cancel_head_reservation);
+    reg(ctx, current_idx++, "cancel_droppable_reservation", cancel_droppable_reservation);
     /* specific to picoquic, how to remove this dependency ? */
-    ubpf_register(vm, current_idx++, "picoquic_reinsert_cnx_by_wake_time", picoquic_reinsert_cnx_by_wake_time);
-    ubpf_register(vm, current_idx++, "picoquic_current_time", picoquic_current_time);
+    reg(ctx, current_idx++, "picoquic_reinsert_cnx_by_wake_time", picoquic_reinsert_cnx_by_wake_time);
+    reg(ctx, current_idx++, "picoquic_current_time", picoquic_cached_time);
     /* for memory */
-    ubpf_register(vm, current_idx++, "my_malloc", my_malloc);
-    ubpf_register(vm, current_idx++, "my_free", my_free);
-    ubpf_register(vm, current_idx++, "my_realloc", my_realloc);
-    ubpf_register(vm, current_idx++, "my_memcpy", my_memcpy);
-    ubpf_register(vm, current_idx++, "my_memset", my_memset);
+    reg(ctx, current_idx++, "my_malloc", my_malloc);
+    reg(ctx, current_idx++, "my_free", my_free);
+    reg(ctx, current_idx++, "my_realloc", my_realloc);
+    reg(ctx, current_idx++, "my_memcpy", my_memcpy);
+    reg(ctx, current_idx++, "my_memset", my_memset);
 
-    ubpf_register(vm, current_idx++, "clock_gettime", clock_gettime);
+    reg(ctx, current_idx++, "clock_gettime", clock_gettime);
 
     /* Network with linux */
-    ubpf_register(vm, current_idx++, "getsockopt", getsockopt);
-    ubpf_register(vm, current_idx++, "setsockopt", setsockopt);
-    ubpf_register(vm, current_idx++, "socket", socket);
-    ubpf_register(vm, current_idx++, "connect", connect);
-    ubpf_register(vm, current_idx++, "send", send);
-    ubpf_register(vm, current_idx++, "inet_aton", inet_aton);
-    ubpf_register(vm, current_idx++, "socketpair", socketpair);
-    ubpf_register(vm, current_idx++, "write", write);
-    ubpf_register(vm, current_idx++, "close", close);
-    ubpf_register(vm, current_idx++, "get_errno", get_errno);
-
-    ubpf_register(vm, current_idx++, "my_htons", my_htons);
-    ubpf_register(vm, current_idx++, "my_ntohs", my_ntohs);
-
-    ubpf_register(vm, current_idx++, "strncmp", strncmp);
-    ubpf_register(vm, current_idx++, "strlen", strlen);
+    reg(ctx, current_idx++, "getsockopt", getsockopt);
+    reg(ctx, current_idx++, "setsockopt", setsockopt);
+    reg(ctx, current_idx++, "socket", socket);
+    reg(ctx, current_idx++, "connect", connect);
+    reg(ctx, current_idx++, "send", send);
+    reg(ctx, current_idx++, "inet_aton", inet_aton);
+    reg(ctx, current_idx++, "socketpair", socketpair);
+    reg(ctx, current_idx++, "write", write);
+    reg(ctx, current_idx++, "close", close);
+    reg(ctx, current_idx++, "get_errno", get_errno);
+
+    reg(ctx, current_idx++, "my_htons", my_htons);
+    reg(ctx, current_idx++, "my_ntohs", my_ntohs);
+
+    reg(ctx, current_idx++, "strncmp", strncmp);
+    reg(ctx, current_idx++, "strlen", strlen);
 
     // logging func
 
-    ubpf_register(vm, current_idx++, "picoquic_has_booked_plugin_frames", picoquic_has_booked_plugin_frames);
+    reg(ctx, current_idx++, "picoquic_has_booked_plugin_frames", picoquic_has_booked_plugin_frames);
 
     /* Specific QUIC functions */
-    ubpf_register(vm, current_idx++, "picoquic_decode_frames_without_current_time", picoquic_decode_frames_without_current_time);
-    ubpf_register(vm, current_idx++, "picoquic_varint_decode", picoquic_varint_decode);
-    ubpf_register(vm, current_idx++, "picoquic_varint_encode", picoquic_varint_encode);
-    ubpf_register(vm, current_idx++, "picoquic_varint_skip", picoquic_varint_skip);
-    ubpf_register(vm, current_idx++, "picoquic_create_random_cnx_id_for_cnx", picoquic_create_random_cnx_id_for_cnx);
-    ubpf_register(vm, current_idx++, "picoquic_create_cnxid_reset_secret_for_cnx", picoquic_create_cnxid_reset_secret_for_cnx);
-    ubpf_register(vm, current_idx++, "picoquic_register_cnx_id_for_cnx", picoquic_register_cnx_id_for_cnx);
-    ubpf_register(vm, current_idx++, "picoquic_create_path", picoquic_create_path);
-    ubpf_register(vm, current_idx++, "picoquic_getaddrs", picoquic_getaddrs);
-    ubpf_register(vm, current_idx++, "picoquic_compare_connection_id", picoquic_compare_connection_id);
-
-    ubpf_register(vm, current_idx++, "picoquic_compare_addr", picoquic_compare_addr);
-    ubpf_register(vm, current_idx++, "picoquic_parse_stream_header", picoquic_parse_stream_header);
-    ubpf_register(vm, current_idx++, "picoquic_find_stream", picoquic_find_stream);
-    ubpf_register(vm, current_idx++, "picoquic_set_cnx_state", picoquic_set_cnx_state);
-    ubpf_register(vm, current_idx++, "picoquic_frames_varint_decode", picoquic_frames_varint_decode);
-    ubpf_register(vm, current_idx++, "picoquic_record_pn_received", picoquic_record_pn_received);
-    ubpf_register(vm, current_idx++, "picoquic_cc_get_sequence_number", picoquic_cc_get_sequence_number);
-    ubpf_register(vm, current_idx++, "picoquic_cc_was_cwin_blocked", picoquic_cc_was_cwin_blocked);
-    ubpf_register(vm, current_idx++, "picoquic_is_sending_authorized_by_pacing", picoquic_is_sending_authorized_by_pacing);
-    ubpf_register(vm, current_idx++, "picoquic_update_pacing_data", picoquic_update_pacing_data);
-
-    ubpf_register(vm, current_idx++, "queue_peek", queue_peek);
+    reg(ctx, current_idx++, "picoquic_decode_frames_without_current_time", picoquic_decode_frames_without_current_time);
+    reg(ctx, current_idx++, "picoquic_varint_decode", picoquic_varint_decode);
+    reg(ctx, current_idx++, "picoquic_varint_encode", picoquic_varint_encode);
+    reg(ctx, current_idx++, "picoquic_varint_skip", picoquic_varint_skip);
+    reg(ctx, current_idx++, "picoquic_create_random_cnx_id_for_cnx", picoquic_create_random_cnx_id_for_cnx);
+    reg(ctx, current_idx++, "picoquic_create_cnxid_reset_secret_for_cnx", picoquic_create_cnxid_reset_secret_for_cnx);
+    reg(ctx, current_idx++, "picoquic_register_cnx_id_for_cnx", picoquic_register_cnx_id_for_cnx);
+    reg(ctx, current_idx++, "picoquic_create_path", picoquic_create_path);
+    reg(ctx, current_idx++, "picoquic_getaddrs", picoquic_getaddrs);
+    reg(ctx, current_idx++, "picoquic_compare_connection_id", picoquic_compare_connection_id);
+
+    reg(ctx, current_idx++, "picoquic_compare_addr", picoquic_compare_addr);
+    reg(ctx, current_idx++, "picoquic_parse_stream_header", picoquic_parse_stream_header);
+    reg(ctx, current_idx++, "picoquic_find_stream", picoquic_find_stream);
+    reg(ctx, current_idx++, "picoquic_set_cnx_state", picoquic_set_cnx_state);
+    reg(ctx, current_idx++, "picoquic_frames_varint_decode", picoquic_frames_varint_decode);
+    reg(ctx, current_idx++, "picoquic_record_pn_received", picoquic_record_pn_received);
+    reg(ctx, current_idx++, "picoquic_prepare_path_ack_frame", picoquic_prepare_path_ack_frame);
+    reg(ctx, current_idx++, "picoquic_process_path_ack_ranges", picoquic_process_path_ack_ranges);
+    reg(ctx, current_idx++, "picoquic_cc_get_sequence_number", picoquic_cc_get_sequence_number);
+    reg(ctx, current_idx++, "picoquic_cc_was_cwin_blocked", picoquic_cc_was_cwin_blocked);
+    reg(ctx, current_idx++, "picoquic_is_sending_authorized_by_pacing", picoquic_is_sending_authorized_by_pacing);
+    reg(ctx, current_idx++, "picoquic_update_pacing_data", picoquic_update_pacing_data);
+
+    reg(ctx, current_idx++, "queue_peek", queue_peek);
     /* FIXME remove this function */
-    ubpf_register(vm, current_idx++, "picoquic_frame_fair_reserve", picoquic_frame_fair_reserve);
-    ubpf_register(vm, current_idx++, "plugin_pluglet_exists", plugin_pluglet_exists);
-
-    ubpf_register(vm, current_idx++, "inet_ntop", inet_ntop);
-    ubpf_register(vm, current_idx++, "strerror", strerror);
-    ubpf_register(vm, current_idx++, "memcmp", memcmp);
-    ubpf_register(vm, current_idx++, "my_malloc_dbg", my_malloc_dbg);
-    ubpf_register(vm, current_idx++, "my_malloc_ex", my_malloc);
-    ubpf_register(vm, current_idx++, "my_free_dbg", my_free_dbg);
-    ubpf_register(vm, current_idx++, "my_memcpy_dbg", my_memcpy_dbg);
-    ubpf_register(vm, current_idx++, "my_memset_dbg", my_memset_dbg);
-
-    ubpf_register(vm, current_idx++, "dprintf", dprintf);
-    ubpf_register(vm, current_idx++, "snprintf", snprintf);
-    ubpf_register(vm, current_idx++, "lseek", lseek);
-    ubpf_register(vm, current_idx++, "ftruncate", ftruncate);
-    ubpf_register(vm, current_idx++, "strlen", strlen);
-    ubpf_register(vm, current_idx++, "snprintf_bytes", snprintf_bytes);
-    ubpf_register(vm, current_idx++, "strncpy", strncpy);
-    ubpf_register(vm, current_idx++, "inet_ntop", inet_ntop);
-    ubpf_register(vm, current_idx++, "get_preq", get_preq);
-    ubpf_register(vm, current_idx++, "set_preq", set_preq);
-
-    ubpf_register(vm, current_idx++, "bind", bind);
-    ubpf_register(vm, current_idx++, "recv", recv);
-
-    ubpf_register(vm, current_idx++, "strcmp", strncmp);
+    reg(ctx, current_idx++, "picoquic_frame_fair_reserve", picoquic_frame_fair_reserve);
+    reg(ctx, current_idx++, "plugin_pluglet_exists", plugin_pluglet_exists);
+
+    reg(ctx, current_idx++, "inet_ntop", inet_ntop);
+    reg(ctx, current_idx++, "strerror", strerror);
+    reg(ctx, current_idx++, "memcmp", memcmp);
+    reg(ctx, current_idx++, "my_malloc_dbg", my_malloc_dbg);
+    reg(ctx, current_idx++, "my_malloc_ex", my_malloc);
+    reg(ctx, current_idx++, "my_scratch_alloc", my_scratch_alloc);
+    reg(ctx, current_idx++, "my_free_dbg", my_free_dbg);
+    reg(ctx, current_idx++, "my_memcpy_dbg", my_memcpy_dbg);
+    reg(ctx, current_idx++, "my_memset_dbg", my_memset_dbg);
+
+    reg(ctx, current_idx++, "dprintf", dprintf);
+    reg(ctx, current_idx++, "snprintf", snprintf);
+    reg(ctx, current_idx++, "lseek", lseek);
+    reg(ctx, current_idx++, "ftruncate", ftruncate);
+    reg(ctx, current_idx++, "snprintf_bytes", snprintf_bytes);
+    reg(ctx, current_idx++, "strncpy", strncpy);
+    reg(ctx, current_idx++, "get_preq", get_preq);
+    reg(ctx, current_idx++, "set_preq", set_preq);
+
+    reg(ctx, current_idx++, "bind", bind);
+    reg(ctx, current_idx++, "recv", recv);
+
+    reg(ctx, current_idx++, "strcmp", strncmp);
 
     /* red black tree */
-    ubpf_register(vm, current_idx++, "rbt_init", rbt_init);
-    ubpf_register(vm, current_idx++, "rbt_is_empty", rbt_is_empty);
-    ubpf_register(vm, current_idx++, "rbt_size", rbt_size);
-    ubpf_register(vm, current_idx++, "rbt_put", rbt_put);
-    ubpf_register(vm, current_idx++, "rbt_get", rbt_get);
-    ubpf_register(vm, current_idx++, "rbt_contains", rbt_contains);
-    ubpf_register(vm, current_idx++, "rbt_min_val", rbt_min_val);
-    ubpf_register(vm, current_idx++, "rbt_min_key", rbt_min_key);
-    ubpf_register(vm, current_idx++, "rbt_min", rbt_min);
-    ubpf_register(vm, current_idx++, "rbt_max_key", rbt_max_key);
-    ubpf_register(vm, current_idx++, "rbt_max_val", rbt_max_val);
-    ubpf_register(vm, current_idx++, "rbt_ceiling_val", rbt_ceiling_val);
-    ubpf_register(vm, current_idx++, "rbt_ceiling_key", rbt_ceiling_key);
-    ubpf_register(vm, current_idx++, "rbt_ceiling", rbt_ceiling);
-    ubpf_register(vm, current_idx++, "rbt_delete", rbt_delete);
-    ubpf_register(vm, current_idx++, "rbt_delete_min", rbt_delete_min);
-    ubpf_register(vm, current_idx++, "rbt_delete_max", rbt_delete_max);
-    ubpf_register(vm, current_idx++, "rbt_delete_and_get_min", rbt_delete_and_get_min);
-    ubpf_register(vm, current_idx++, "rbt_delete_and_get_max", rbt_delete_and_get_max);
+    reg(ctx, current_idx++, "rbt_init", rbt_init);
+    reg(ctx, current_idx++, "rbt_is_empty", rbt_is_empty);
+    reg(ctx, current_idx++, "rbt_size", rbt_size);
+    reg(ctx, current_idx++, "rbt_put", rbt_put);
+    reg(ctx, current_idx++, "rbt_get", rbt_get);
+    reg(ctx, current_idx++, "rbt_contains", rbt_contains);
+    reg(ctx, current_idx++, "rbt_min_val", rbt_min_val);
+    reg(ctx, current_idx++, "rbt_min_key", rbt_min_key);
+    reg(ctx, current_idx++, "rbt_min", rbt_min);
+    reg(ctx, current_idx++, "rbt_max_key", rbt_max_key);
+    reg(ctx, current_idx++, "rbt_max_val", rbt_max_val);
+    reg(ctx, current_idx++, "rbt_ceiling_val", rbt_ceiling_val);
+    reg(ctx, current_idx++, "rbt_ceiling_key", rbt_ceiling_key);
+    reg(ctx, current_idx++, "rbt_ceiling", rbt_ceiling);
+    reg(ctx, current_idx++, "rbt_delete", rbt_delete);
+    reg(ctx, current_idx++, "rbt_delete_min", rbt_delete_min);
+    reg(ctx, current_idx++, "rbt_delete_max", rbt_delete_max);
+    reg(ctx, current_idx++, "rbt_delete_and_get_min", rbt_delete_and_get_min);
+    reg(ctx, current_idx++, "rbt_delete_and_get_max", rbt_delete_and_get_max);
+
+    /* bulk field accesses */
+    reg(ctx, current_idx++, "get_cnx_fields", get_cnx_fields);
+    reg(ctx, current_idx++, "set_cnx_fields", set_cnx_fields);
+    reg(ctx, current_idx++, "get_path_fields", get_path_fields);
+    reg(ctx, current_idx++, "set_path_fields", set_path_fields);
+    reg(ctx, current_idx++, "get_pkt_fields", get_pkt_fields);
+
+    /* record anchors */
+    reg(ctx, current_idx++, "plugin_record_drain", plugin_record_drain);
+    reg(ctx, current_idx++, "plugin_record_dropped", plugin_record_dropped);
+
+    /* GF(256) regions, for the FEC schemes */
+    reg(ctx, current_idx++, "gf256_region_mul_add", gf256_region_mul_add);
+    reg(ctx, current_idx++, "gf256_region_mul", gf256_region_mul);
 
     /* This value is reserved. DO NOT OVERRIDE IT! */
-    ubpf_register(vm, 0x7f, "picoquic_memory_bound_error", picoquic_memory_bound_error);
+    reg(ctx, 0x7f, "picoquic_memory_bound_error", picoquic_memory_bound_error);
+}
+
+static void register_in_vm(void *ctx, unsigned int idx, const char *name, void *fn) {
+    ubpf_register((struct ubpf_vm *) ctx, idx, name, fn);
+}
+
+static void register_in_helpers(void *ctx, unsigned int idx, const char *name, void *fn) {
+    pluglet_helper_t *helpers = (pluglet_helper_t *) ctx;
+    if (idx < PLUGLET_MAX_HELPERS) {
+        helpers[idx].name = name;
+        helpers[idx].fn = fn;
+    }
 }
 
 static void *readfile(const char *path, size_t maxlen, size_t *len)
@@ -226,6 +263,224 @@ static void *readfile(const char *path, size_t maxlen, size_t *len)
     return data;
 }
 
+/* Returns the section headers of the ELF file, or NULL if they cannot be safely read */
+static const Elf64_Shdr *pluglet_elf_sections(const uint8_t *code, size_t code_len, int *nb_sections) {
+    if (code_len < sizeof(Elf64_Ehdr) || memcmp(code, ELFMAG, SELFMAG) != 0) {
+        return NULL;
+    }
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *) code;
+    if (ehdr->e_shentsize != sizeof(Elf64_Shdr) || ehdr->e_shoff > code_len ||
+        (code_len - ehdr->e_shoff) / sizeof(Elf64_Shdr) < ehdr->e_shnum) {
+        return NULL;
+    }
+    *nb_sections = ehdr->e_shnum;
+    return (const Elf64_Shdr *) (code + ehdr->e_shoff);
+}
+
+static bool pluglet_elf_section_valid(const Elf64_Shdr *shdr, size_t code_len) {
+    return shdr->sh_offset <= code_len && shdr->sh_size <= code_len - shdr->sh_offset;
+}
+
+#define PLUGLET_INSN_CLASS(op) ((op) & 0x07)
+#define PLUGLET_INSN_LD 0x00
+#define PLUGLET_INSN_LDX 0x01
+#define PLUGLET_INSN_ST 0x02
+#define PLUGLET_INSN_STX 0x03
+#define PLUGLET_INSN_ALU 0x04
+#define PLUGLET_INSN_JMP 0x05
+#define PLUGLET_INSN_ALU64 0x07
+#define PLUGLET_INSN_MODE_MEM 0x60
+#define PLUGLET_INSN_MODE_XADD 0xc0
+#define PLUGLET_OP_LDDW 0x18
+#define PLUGLET_OP_MOV64_REG 0xbf
+#define PLUGLET_OP_ADD64_IMM 0x07
+#define PLUGLET_OP_SUB64_IMM 0x17
+#define PLUGLET_OP_CALL 0x85
+#define PLUGLET_OP_EXIT 0x95
+#define PLUGLET_FRAME_REG 10
+
+/* Counts the memory accesses and the elidable checks, flagging the elidable accesses in is_elidable if not NULL */
+static void pluglet_analyze_text(const pluglet_insn_t *insns, size_t nb_insns, uint32_t *memory_accesses, uint32_t *elidable_checks,
+    bool *is_elidable) {
+    /* First find the jump targets, where the state of the registers is unknown */
+    bool *is_target = calloc(nb_insns + 1, sizeof(bool));
+    if (!is_target) {
+        return;
+    }
+    for (size_t pc = 0; pc < nb_insns; pc++) {
+        uint8_t op = insns[pc].opcode;
+        if (PLUGLET_INSN_CLASS(op) == PLUGLET_INSN_JMP && op != PLUGLET_OP_CALL && op != PLUGLET_OP_EXIT) {
+            int64_t target = (int64_t) pc + insns[pc].offset + 1;
+            if (target >= 0 && target <= (int64_t) nb_insns) {
+                is_target[target] = true;
+            }
+        }
+    }
+
+    /* Then follow the registers holding the frame pointer plus a constant */
+    bool known[PLUGLET_FRAME_REG + 1];
+    int64_t frame_offset[PLUGLET_FRAME_REG + 1];
+    memset(known, 0, sizeof(known));
+    memset(frame_offset, 0, sizeof(frame_offset));
+    known[PLUGLET_FRAME_REG] = true;
+    for (size_t pc = 0; pc < nb_insns; pc++) {
+        const pluglet_insn_t *insn = &insns[pc];
+        uint8_t op = insn->opcode;
+        uint8_t dst = insn->regs & 0x0f;
+        uint8_t src = insn->regs >> 4;
+        if (dst > PLUGLET_FRAME_REG || src > PLUGLET_FRAME_REG) {
+            continue;
+        }
+        if (is_target[pc]) {
+            memset(known, 0, PLUGLET_FRAME_REG * sizeof(bool));
+        }
+        switch (PLUGLET_INSN_CLASS(op)) {
+        case PLUGLET_INSN_LDX:
+        case PLUGLET_INSN_ST:
+        case PLUGLET_INSN_STX:
+            if ((op & 0xe0) == PLUGLET_INSN_MODE_MEM || (op & 0xe0) == PLUGLET_INSN_MODE_XADD) {
+                static const int sizes[4] = {4, 2, 1, 8};
+                uint8_t base = PLUGLET_INSN_CLASS(op) == PLUGLET_INSN_LDX ? src : dst;
+                int64_t start = frame_offset[base] + insn->offset;
+                (*memory_accesses)++;
+                if (known[base] && start >= -PLUGLET_STACK_SIZE && start + sizes[(op >> 3) & 0x03] <= 0) {
+                    (*elidable_checks)++;
+                    if (is_elidable) {
+                        is_elidable[pc] = true;
+                    }
+                }
+            }
+            if (PLUGLET_INSN_CLASS(op) == PLUGLET_INSN_LDX) {
+                known[dst] = false;
+            }
+            break;
+        case PLUGLET_INSN_LD:
+            known[op == PLUGLET_OP_LDDW ? dst : 0] = false;
+            if (op == PLUGLET_OP_LDDW) {
+                pc++;
+            }
+            break;
+        case PLUGLET_INSN_ALU64:
+            if (op == PLUGLET_OP_MOV64_REG) {
+                known[dst] = known[src];
+                frame_offset[dst] = frame_offset[src];
+            } else if (op == PLUGLET_OP_ADD64_IMM) {
+                frame_offset[dst] += insn->imm;
+            } else if (op == PLUGLET_OP_SUB64_IMM) {
+                frame_offset[dst] -= insn->imm;
+            } else {
+                known[dst] = false;
+            }
+            break;
+        case PLUGLET_INSN_ALU:
+            known[dst] = false;
+            break;
+        case PLUGLET_INSN_JMP:
+            if (op == PLUGLET_OP_CALL) {
+                /* The helpers clobber r0 to r5 */
+                memset(known, 0, 6 * sizeof(bool));
+            }
+            break;
+        }
+        known[PLUGLET_FRAME_REG] = true;
+        frame_offset[PLUGLET_FRAME_REG] = 0;
+    }
+    free(is_target);
+}
+
+void pluglet_count_elidable_checks(const void *code, size_t code_len, uint32_t *memory_accesses, uint32_t *elidable_checks) {
+    int nb_sections;
+    const Elf64_Shdr *shdrs = pluglet_elf_sections(code, code_len, &nb_sections);
+    *memory_accesses = 0;
+    *elidable_checks = 0;
+    for (int i = 0; shdrs && i < nb_sections; i++) {
+        if (shdrs[i].sh_type == SHT_PROGBITS && (shdrs[i].sh_flags & SHF_EXECINSTR) && pluglet_elf_section_valid(&shdrs[i], code_len)) {
+            pluglet_analyze_text((const pluglet_insn_t *) ((const uint8_t *) code + shdrs[i].sh_offset),
+                shdrs[i].sh_size / sizeof(pluglet_insn_t), memory_accesses, elidable_checks, NULL);
+        }
+    }
+}
+
+/* Decodes the text section for the threaded interpreter, the calls relocated as ubpf_load_elf() does */
+static pluglet_threaded_t *pluglet_load_threaded(const uint8_t *code, size_t code_len, char **errmsg) {
+    pluglet_helper_t helpers[PLUGLET_MAX_HELPERS];
+    pluglet_threaded_t *threaded = NULL;
+    int nb_sections;
+    int text = -1;
+    const Elf64_Shdr *shdrs = pluglet_elf_sections(code, code_len, &nb_sections);
+    *errmsg = NULL;
+    for (int i = 0; shdrs && text < 0 && i < nb_sections; i++) {
+        if (shdrs[i].sh_type == SHT_PROGBITS && (shdrs[i].sh_flags & SHF_EXECINSTR) && pluglet_elf_section_valid(&shdrs[i], code_len)) {
+            text = i;
+        }
+    }
+    if (text < 0 || shdrs[text].sh_size < sizeof(pluglet_insn_t)) {
+        *errmsg = strdup("no text section");
+        return NULL;
+    }
+
+    size_t nb_insns = shdrs[text].sh_size / sizeof(pluglet_insn_t);
+    pluglet_insn_t *insns = (pluglet_insn_t *) malloc(nb_insns * sizeof(pluglet_insn_t));
+    bool *is_elidable = (bool *) calloc(nb_insns, sizeof(bool));
+    if (!insns || !is_elidable) {
+        free(insns);
+        free(is_elidable);
+        *errmsg = strdup("out of memory");
+        return NULL;
+    }
+    memcpy(insns, code + shdrs[text].sh_offset, nb_insns * sizeof(pluglet_insn_t));
+    memset(helpers, 0, sizeof(helpers));
+    register_functions(register_in_helpers, helpers);
+
+    /* The calls to the helpers refer to their name */
+    for (int i = 0; *errmsg == NULL && i < nb_sections; i++) {
+        if (shdrs[i].sh_type != SHT_REL || shdrs[i].sh_info != (Elf64_Word) text || shdrs[i].sh_link >= nb_sections ||
+            shdrs[shdrs[i].sh_link].sh_link >= nb_sections) {
+            continue;
+        }
+        const Elf64_Shdr *symtab = &shdrs[shdrs[i].sh_link];
+        const Elf64_Shdr *strtab = &shdrs[symtab->sh_link];
+        if (!pluglet_elf_section_valid(&shdrs[i], code_len) || !pluglet_elf_section_valid(symtab, code_len) ||
+            !pluglet_elf_section_valid(strtab, code_len)) {
+            *errmsg = strdup("invalid relocation section");
+            break;
+        }
+        const Elf64_Rel *rels = (const Elf64_Rel *) (code + shdrs[i].sh_offset);
+        const Elf64_Sym *syms = (const Elf64_Sym *) (code + symtab->sh_offset);
+        const char *names = (const char *) (code + strtab->sh_offset);
+        for (size_t j = 0; *errmsg == NULL && j < shdrs[i].sh_size / sizeof(Elf64_Rel); j++) {
+            size_t pc = rels[j].r_offset / sizeof(pluglet_insn_t);
+            size_t sym = ELF64_R_SYM(rels[j].r_info);
+            const char *name = NULL;
+            if (pc < nb_insns && insns[pc].opcode == PLUGLET_OP_CALL && sym < symtab->sh_size / sizeof(Elf64_Sym) &&
+                syms[sym].st_name < strtab->sh_size &&
+                strnlen(names + syms[sym].st_name, strtab->sh_size - syms[sym].st_name) < strtab->sh_size - syms[sym].st_name) {
+                name = names + syms[sym].st_name;
+            }
+            int helper = -1;
+            for (int idx = 0; name && helper < 0 && idx < PLUGLET_MAX_HELPERS; idx++) {
+                if (helpers[idx].name && strcmp(helpers[idx].name, name) == 0) {
+                    helper = idx;
+                }
+            }
+            if (helper < 0) {
+                *errmsg = strdup("relocation of an unknown helper");
+            } else {
+                insns[pc].imm = helper;
+            }
+        }
+    }
+
+    if (*errmsg == NULL) {
+        uint32_t memory_accesses = 0, elidable_checks = 0;
+        pluglet_analyze_text(insns, nb_insns, &memory_accesses, &elidable_checks, is_elidable);
+        threaded = pluglet_threaded_create(insns, nb_insns, is_elidable, helpers, errmsg);
+    }
+    free(insns);
+    free(is_elidable);
+    return threaded;
+}
+
 pluglet_t *load_elf(void *code, size_t code_len, uint64_t memory_ptr, uint32_t memory_size) {
     pluglet_t *pluglet = (pluglet_t *)calloc(1, sizeof(pluglet_t));
     if (!pluglet) {
@@ -239,11 +494,11 @@ pluglet_t *load_elf(void *code, size_t code_len, uint64_t memory_ptr, uint32_t m
             return NULL;
     }
 
-    register_functions(pluglet->vm);
+    register_functions(register_in_vm, pluglet->vm);
 
     bool elf = code_len >= SELFMAG && !memcmp(code, ELFMAG, SELFMAG);
 
-    char *errmsg;
+    char *errmsg = NULL;
     int rv;
     if (elf) {
         rv = ubpf_load_elf(pluglet->vm, code, code_len, &errmsg, memory_ptr, memory_size);
@@ -259,6 +514,7 @@ pluglet_t *load_elf(void *code, size_t code_len, uint64_t memory_ptr, uint32_t m
         return NULL;
     }
 
+    /* Compiled if the host has a JIT, else decoded for the threaded interpreter. The VM interprets what is left */
     if (JIT) {
         pluglet->fn = ubpf_compile(pluglet->vm, &errmsg);
         if (pluglet->fn == NULL) {
@@ -268,8 +524,17 @@ pluglet_t *load_elf(void *code, size_t code_len, uint64_t memory_ptr, uint32_t m
             free(pluglet);
             return NULL;
         }
-    } else {
-        pluglet->fn = NULL;
+    } else if (elf) {
+        pluglet->threaded = pluglet_load_threaded(code, code_len, &errmsg);
+        if (pluglet->threaded == NULL) {
+            fprintf(stderr, "Failed to decode, interpreting it: %s\n", errmsg);
+            free(errmsg);
+            errmsg = NULL;
+        }
+    }
+
+    if (elf) {
+        pluglet_count_elidable_checks(code, code_len, &pluglet->memory_accesses, &pluglet->elidable_checks);
     }
 
     free(errmsg);
@@ -289,32 +554,262 @@ pluglet_t *load_elf_file(const char *code_filename, uint64_t memory_ptr, uint32_
 	return ret;
 }
 
+pluglet_t *load_elf_image(pluglet_image_t *image, uint64_t memory_ptr, uint32_t memory_size) {
+    return load_elf(image->code, image->code_len, memory_ptr, memory_size);
+}
+
+bool pluglet_file_is_native(const char *code_filename) {
+    Elf64_Ehdr ehdr;
+    FILE *file = fopen(code_filename, "r");
+    if (file == NULL) {
+        return false;
+    }
+    bool native = fread(&ehdr, sizeof(ehdr), 1, file) == 1 && memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0 &&
+        ehdr.e_type == ET_DYN && ehdr.e_machine != EM_BPF;
+    fclose(file);
+    return native;
+}
+
+/* Returns the name of the only function exported by the shared object, or NULL if there is not exactly one */
+static const char *pluglet_native_entry(const uint8_t *code, size_t code_len) {
+    const char *entry = NULL;
+    int nb_sections;
+    const Elf64_Shdr *shdrs = pluglet_elf_sections(code, code_len, &nb_sections);
+    for (int i = 0; shdrs && i < nb_sections; i++) {
+        if (shdrs[i].sh_type != SHT_DYNSYM || shdrs[i].sh_link >= nb_sections) {
+            continue;
+        }
+        const Elf64_Shdr *strtab = &shdrs[shdrs[i].sh_link];
+        if (!pluglet_elf_section_valid(&shdrs[i], code_len) || !pluglet_elf_section_valid(strtab, code_len)) {
+            continue;
+        }
+        const Elf64_Sym *syms = (const Elf64_Sym *) (code + shdrs[i].sh_offset);
+        const char *names = (const char *) (code + strtab->sh_offset);
+        for (size_t j = 0; j < shdrs[i].sh_size / sizeof(Elf64_Sym); j++) {
+            if (syms[j].st_shndx == SHN_UNDEF || ELF64_ST_TYPE(syms[j].st_info) != STT_FUNC ||
+                ELF64_ST_BIND(syms[j].st_info) != STB_GLOBAL || syms[j].st_name == 0 || syms[j].st_name >= strtab->sh_size ||
+                strnlen(names + syms[j].st_name, strtab->sh_size - syms[j].st_name) == strtab->sh_size - syms[j].st_name) {
+                continue;
+            }
+            if (entry) {
+                return NULL;
+            }
+            entry = names + syms[j].st_name;
+        }
+    }
+    return entry;
+}
+
+pluglet_t *load_native_file(const char *code_filename) {
+    size_t code_len;
+    void *code = readfile(code_filename, 1024*1024, &code_len);
+    if (code == NULL) {
+        return NULL;
+    }
+    const char *entry = pluglet_native_entry(code, code_len);
+    if (entry == NULL) {
+        fprintf(stderr, "Failed to find the function of native pluglet %s\n", code_filename);
+        free(code);
+        return NULL;
+    }
+
+    pluglet_t *pluglet = (pluglet_t *)calloc(1, sizeof(pluglet_t));
+    if (!pluglet) {
+        free(code);
+        return NULL;
+    }
+    /* The helpers are resolved against the executable, so each pluglet keeps its own namespace */
+    pluglet->native_handle = dlopen(code_filename, RTLD_NOW | RTLD_LOCAL);
+    if (pluglet->native_handle) {
+        pluglet->native_fn = (pluglet_native_fn) dlsym(pluglet->native_handle, entry);
+    }
+    if (!pluglet->native_fn) {
+        fprintf(stderr, "Failed to load native pluglet %s: %s\n", code_filename, dlerror());
+        if (pluglet->native_handle) {
+            dlclose(pluglet->native_handle);
+        }
+        free(pluglet);
+        pluglet = NULL;
+    }
+    free(code);
+    return pluglet;
+}
+
+pluglet_image_t *pluglet_image_set(pluglet_image_t **images, const char *code_filename, time_t mtime, off_t size, void *code, size_t code_len) {
+    pluglet_image_t *image = NULL;
+    HASH_FIND_STR(*images, code_filename, image);
+    if (!image) {
+        image = (pluglet_image_t *)calloc(1, sizeof(pluglet_image_t));
+        if (!image) {
+            free(code);
+            return NULL;
+        }
+        image->path = strdup(code_filename);
+        if (!image->path) {
+            free(image);
+            free(code);
+            return NULL;
+        }
+        HASH_ADD_KEYPTR(hh, *images, image->path, strlen(image->path), image);
+    } else {
+        /* The file changed on disk, refresh its content */
+        free(image->code);
+    }
+
+    image->mtime = mtime;
+    image->size = size;
+    image->code = code;
+    image->code_len = code_len;
+    return image;
+}
+
+pluglet_image_t *pluglet_image_get(pluglet_image_t **images, const char *code_filename) {
+    struct stat st;
+    if (stat(code_filename, &st) != 0) {
+        fprintf(stderr, "Failed to stat %s: %s\n", code_filename, strerror(errno));
+        return NULL;
+    }
+
+    pluglet_image_t *image = NULL;
+    HASH_FIND_STR(*images, code_filename, image);
+    if (image && image->mtime == st.st_mtime && image->size == st.st_size) {
+        return image;
+    }
+
+    size_t code_len;
+    void *code = readfile(code_filename, 1024*1024, &code_len);
+    if (code == NULL) {
+        return NULL;
+    }
+
+    return pluglet_image_set(images, code_filename, st.st_mtime, st.st_size, code, code_len);
+}
+
+void *pluglet_image_read(const char *code_filename, time_t *mtime, off_t *size, size_t *code_len) {
+    struct stat st;
+    if (stat(code_filename, &st) != 0) {
+        fprintf(stderr, "Failed to stat %s: %s\n", code_filename, strerror(errno));
+        return NULL;
+    }
+
+    void *code = readfile(code_filename, 1024*1024, code_len);
+    if (code == NULL) {
+        return NULL;
+    }
+
+    /* The compiled code is bound to the memory of a plugin, so it is only built to be checked */
+    uint8_t memory[64];
+    pluglet_t *pluglet = load_elf(code, *code_len, (uint64_t) memory, sizeof(memory));
+    if (pluglet == NULL) {
+        fprintf(stderr, "Failed to verify %s\n", code_filename);
+        free(code);
+        return NULL;
+    }
+    release_elf(pluglet);
+
+    *mtime = st.st_mtime;
+    *size = st.st_size;
+    return code;
+}
+
+bool pluglet_image_imports(const pluglet_image_t *image, const char *prefix) {
+    const uint8_t *code = image->code;
+    size_t prefix_len = strlen(prefix);
+    int nb_sections;
+    const Elf64_Shdr *shdrs = pluglet_elf_sections(code, image->code_len, &nb_sections);
+    for (int i = 0; shdrs && i < nb_sections; i++) {
+        if (shdrs[i].sh_type != SHT_SYMTAB || shdrs[i].sh_link >= nb_sections) {
+            continue;
+        }
+        const Elf64_Shdr *strtab = &shdrs[shdrs[i].sh_link];
+        if (!pluglet_elf_section_valid(&shdrs[i], image->code_len) || !pluglet_elf_section_valid(strtab, image->code_len)) {
+            continue;
+        }
+        const Elf64_Sym *syms = (const Elf64_Sym *) (code + shdrs[i].sh_offset);
+        const char *names = (const char *) (code + strtab->sh_offset);
+        for (size_t j = 0; j < shdrs[i].sh_size / sizeof(Elf64_Sym); j++) {
+            /* Helpers are the undefined symbols the relocations refer to */
+            if (syms[j].st_shndx != SHN_UNDEF || syms[j].st_name == 0 || syms[j].st_name >= strtab->sh_size) {
+                continue;
+            }
+            const char *name = names + syms[j].st_name;
+            if (strnlen(name, strtab->sh_size - syms[j].st_name) >= prefix_len && strncmp(name, prefix, prefix_len) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void pluglet_images_free(pluglet_image_t **images) {
+    pluglet_image_t *image, *tmp;
+    HASH_ITER(hh, *images, image, tmp) {
+        HASH_DEL(*images, image);
+        free(image->code);
+        free(image->path);
+        free(image);
+    }
+}
+
 int release_elf(pluglet_t *pluglet) {
-    if (pluglet->vm != NULL) {
+    if (pluglet->native_handle != NULL) {
+        dlclose(pluglet->native_handle);
+        pluglet->native_handle = NULL;
+        pluglet->native_fn = NULL;
+        free(pluglet);
+    } else if (pluglet->vm != NULL) {
         ubpf_destroy(pluglet->vm);
         pluglet->vm = NULL;
         pluglet->fn = 0;
+        pluglet_threaded_free(pluglet->threaded);
         free(pluglet);
     }
     return 0;
 }
 
-uint64_t exec_loaded_code(pluglet_t *pluglet, void *arg, void *mem, size_t mem_len, char **error_msg) {
-    if (pluglet->vm == NULL) {
-        return -1;
+static inline uint64_t pluglet_profile_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static inline void pluglet_profile_record(pluglet_t *pluglet, uint64_t duration)
+{
+    int bucket = (duration == 0) ? 0 : 63 - __builtin_clzll(duration);
+    if (bucket >= PLUGLET_LATENCY_BUCKETS) {
+        bucket = PLUGLET_LATENCY_BUCKETS - 1;
+    }
+    pluglet->sampled_count++;
+    pluglet->total_execution_time += duration;
+    if (duration > pluglet->max_execution_time) {
+        pluglet->max_execution_time = duration;
     }
-    if (JIT && pluglet->fn == NULL) {
+    pluglet->latency_histogram[bucket]++;
+}
+
+bool pluglet_uses_jit(void) {
+    return JIT;
+}
+
+uint64_t exec_loaded_code(pluglet_t *pluglet, void *arg, void *mem, size_t mem_len, char **error_msg) {
+    if (pluglet->native_fn == NULL && (pluglet->vm == NULL || (JIT && pluglet->fn == NULL))) {
         return -1;
     }
 
+    /* What the pluglet takes from the scratch arena is released when it returns */
+    uint32_t scratch_used = (pluglet->p) ? pluglet->p->scratch_used : 0;
+    uint64_t err;
     /* printf("0x%"PRIx64"\n", ret); */
-    pluglet->count++;
-#ifndef DEBUG_PLUGIN_EXECUTION_TIME
-    return _exec_loaded_code(pluglet, arg, mem, mem_len, error_msg, JIT);
-#else
-    uint64_t before = picoquic_current_time();
-    uint64_t err = _exec_loaded_code(pluglet, arg, mem, mem_len, error_msg, JIT);
-    pluglet->total_execution_time += picoquic_current_time() - before;
+    if ((pluglet->count++ & ((1ull << PLUGLET_PROFILE_SAMPLING_SHIFT) - 1)) != 0) {
+        err = _exec_loaded_code(pluglet, arg, mem, mem_len, error_msg, true);
+    } else {
+        uint64_t before = pluglet_profile_clock();
+        err = _exec_loaded_code(pluglet, arg, mem, mem_len, error_msg, true);
+        pluglet_profile_record(pluglet, pluglet_profile_clock() - before);
+    }
+    if (pluglet->p) {
+        pluglet->p->scratch_used = scratch_used;
+    }
     return err;
-#endif
 }
@@ -21,6 +21,8 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
 #include "uthash.h"
 
 struct ubpf_vm;
@@ -91,25 +93,125 @@ ubpf_jit_fn ubpf_compile(struct ubpf_vm *vm, char **errmsg);
 
 typedef struct protoop_plugin protoop_plugin_t;
 
+/* Execution time profiling. One call out of 2^PLUGLET_PROFILE_SAMPLING_SHIFT is timed, starting with the first one */
+#ifdef DEBUG_PLUGIN_EXECUTION_TIME
+#define PLUGLET_PROFILE_SAMPLING_SHIFT 0
+#else
+#define PLUGLET_PROFILE_SAMPLING_SHIFT 6
+#endif
+#define PLUGLET_LATENCY_BUCKETS 32 /* Bucket i counts the timed calls lasting [2^i, 2^(i+1)[ ns, the last one also the longer ones */
+
+#define PLUGLET_STACK_SIZE 512 /* Stack of the VM, r10 points to its top */
+
+/* An eBPF instruction, as laid out in the text section of a pluglet */
+typedef struct {
+    uint8_t opcode;
+    uint8_t regs; /* dst in the low nibble, src in the high one */
+    int16_t offset;
+    int32_t imm;
+} pluglet_insn_t;
+
+#define PLUGLET_MAX_HELPERS 128 /* The immediate of a call is the index of the helper */
+
+typedef struct pluglet_helper {
+    const char *name;
+    void *fn;
+} pluglet_helper_t;
+
+/* Pre-decoded code of a pluglet, run by the threaded interpreter on the hosts without JIT, see ubpf_threaded.c */
+typedef struct pluglet_threaded pluglet_threaded_t;
+
+/**
+ * Decodes the relocated text of a pluglet once for all, the memory accesses flagged in is_elidable being
+ * run without bound check. Returns NULL if the code is invalid, or if the compiler has no computed goto,
+ * in which case errmsg holds the cause, to be freed by the caller.
+ */
+pluglet_threaded_t *pluglet_threaded_create(const pluglet_insn_t *insns, size_t nb_insns, const bool *is_elidable,
+    const pluglet_helper_t *helpers, char **errmsg);
+/* Same contract as ubpf_exec_with_arg(), the error message remains owned by the code */
+uint64_t pluglet_threaded_exec(pluglet_threaded_t *threaded, void *arg, void *mem, size_t mem_len, char **error_msg);
+void pluglet_threaded_free(pluglet_threaded_t *threaded);
+
+/* A native pluglet is the source of a pluglet compiled as a shared object for the host, see load_native_file() */
+typedef uint64_t (*pluglet_native_fn)(void *arg);
+
 /* Now functions that will be actually used in the program */
 typedef struct pluglet {
 	void *vm;
 	ubpf_jit_fn fn;
+	/* Set when there is no compiled code, see load_elf() */
+	pluglet_threaded_t *threaded;
+	/* Only set for native pluglets, which have no VM */
+	void *native_handle;
+	pluglet_native_fn native_fn;
 	protoop_plugin_t *p;
 	uint64_t count;
+	/* The following are only updated by the timed calls, and are in nanoseconds */
+	uint64_t sampled_count;
 	uint64_t total_execution_time;
+	uint64_t max_execution_time;
+	uint32_t latency_histogram[PLUGLET_LATENCY_BUCKETS];
+	/* Computed at load time, the memory accesses whose bound check is useless as they remain in the stack */
+	uint32_t memory_accesses;
+	uint32_t elidable_checks;
 } pluglet_t;
 
+/* Content of a pluglet ELF file, shared by all the connections of a picoquic context.
+ * The compiled code remains per connection, as it is bound to the plugin memory.
+ */
+typedef struct pluglet_image {
+	char *path; /* Key */
+	time_t mtime; /* Used to detect that the file was modified since it was read */
+	off_t size;
+	void *code;
+	size_t code_len;
+	UT_hash_handle hh;
+} pluglet_image_t;
+
+pluglet_image_t *pluglet_image_get(pluglet_image_t **images, const char *code_filename);
+/**
+ * Reads the pluglet file and checks that its code loads, without any context, so that it can run in
+ * any thread. Returns the code, to give to pluglet_image_set(), or NULL if it cannot be read or loaded.
+ */
+void *pluglet_image_read(const char *code_filename, time_t *mtime, off_t *size, size_t *code_len);
+/* Takes the ownership of code */
+pluglet_image_t *pluglet_image_set(pluglet_image_t **images, const char *code_filename, time_t mtime, off_t size, void *code, size_t code_len);
+void pluglet_images_free(pluglet_image_t **images);
+/* Returns true if the pluglet calls a helper whose name starts with prefix */
+bool pluglet_image_imports(const pluglet_image_t *image, const char *prefix);
+/**
+ * Counts the load and store instructions of the pluglet, and those that provably remain in its stack,
+ * i.e., based on the frame pointer plus a constant known on every path.
+ */
+void pluglet_count_elidable_checks(const void *code, size_t code_len, uint32_t *memory_accesses, uint32_t *elidable_checks);
+
 pluglet_t *load_elf(void *code, size_t code_len, uint64_t memory_ptr, uint32_t memory_size);
 pluglet_t *load_elf_file(const char *code_filename, uint64_t memory_ptr, uint32_t memory_size);
+pluglet_t *load_elf_image(pluglet_image_t *image, uint64_t memory_ptr, uint32_t memory_size);
+/**
+ * Loads the shared object built from the source of a pluglet for the host. It calls the helpers directly,
+ * which must thus be exported by the executable, and must only export the pluglet function. Its memory
+ * accesses are not checked, so it must be as trusted as the core.
+ */
+pluglet_t *load_native_file(const char *code_filename);
+/* Returns true if the file at code_filename is a host shared object rather than eBPF code */
+bool pluglet_file_is_native(const char *code_filename);
 int release_elf(pluglet_t *pluglet);
 uint64_t exec_loaded_code(pluglet_t *pluglet, void *arg, void *mem, size_t mem_len, char **error_msg);
+/* Returns true if exec_loaded_code() runs the compiled code rather than the threaded interpreter */
+bool pluglet_uses_jit(void);
 
-/* This should not be used! */
-static inline uint64_t _exec_loaded_code(pluglet_t *pluglet, void *arg, void *mem, size_t mem_len, char **error_msg, bool jit) {
-    if (jit) {
+/* This should not be used! Without fast, the pluglet is run by the interpreter of its VM, for comparison */
+static inline uint64_t _exec_loaded_code(pluglet_t *pluglet, void *arg, void *mem, size_t mem_len, char **error_msg, bool fast) {
+    if (pluglet->native_fn) {
+        return pluglet->native_fn(arg);
+    }
+    if (fast && pluglet->fn) {
         return pluglet->fn(arg, mem_len);
     }
+    if (fast && pluglet->threaded) {
+        return pluglet_threaded_exec(pluglet->threaded, arg, mem, mem_len, error_msg);
+    }
 
     uint64_t ret = ubpf_exec_with_arg(pluglet->vm, arg, mem, mem_len);
     *error_msg = ubpf_get_error_msg(pluglet->vm);
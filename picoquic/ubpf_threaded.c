@@ -0,0 +1,643 @@
+/*
+ * Threaded interpreter of the pluglets, for the hosts on which the uBPF JIT is not available.
+ *
+ * The code is decoded once at load time into an array of instructions holding the address of the code
+ * that runs them, so that running one is a jump to the next, without the decoding and the switch of
+ * the uBPF interpreter. The jumps hold the address of their target, the helpers that of their function,
+ * and the memory accesses that provably remain in the stack skip the bound check. The most frequent
+ * pairs of instructions that clang emits are fused into one, the second one remaining in place for the
+ * jumps that reach it. The calls to the getters and setters of the plain fields of the connection and of
+ * the paths with a constant key, which are most of the calls, are replaced by the load or the store.
+ */
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ubpf.h"
+#include "getset.h"
+
+#define PLUGLET_OP_LDDW 0x18
+#define PLUGLET_OP_ADD64_IMM 0x07
+#define PLUGLET_OP_MOV64_REG 0xbf
+#define PLUGLET_OP_LDXDW 0x79
+#define PLUGLET_OP_JA 0x05
+#define PLUGLET_OP_JEQ_IMM 0x15
+#define PLUGLET_OP_JNE_IMM 0x55
+#define PLUGLET_OP_JNE_REG 0x5d
+#define PLUGLET_OP_CALL 0x85
+#define PLUGLET_OP_EXIT 0x95
+#define PLUGLET_OP_MOV32_IMM 0xb4
+#define PLUGLET_OP_MOV64_IMM 0xb7
+#define PLUGLET_FRAME_REG 10
+
+/* The handlers past the opcodes */
+enum {
+    PLUGLET_TH_INVALID = 256,
+    /* Unchecked memory accesses, in the order of the size bits of the opcodes */
+    PLUGLET_TH_LDXW_NC,
+    PLUGLET_TH_LDXH_NC,
+    PLUGLET_TH_LDXB_NC,
+    PLUGLET_TH_LDXDW_NC,
+    PLUGLET_TH_STW_NC,
+    PLUGLET_TH_STH_NC,
+    PLUGLET_TH_STB_NC,
+    PLUGLET_TH_STDW_NC,
+    PLUGLET_TH_STXW_NC,
+    PLUGLET_TH_STXH_NC,
+    PLUGLET_TH_STXB_NC,
+    PLUGLET_TH_STXDW_NC,
+    /* Pairs */
+    PLUGLET_TH_MOV64_ADD64_IMM, /* r2 = r10; r2 += -16 */
+    PLUGLET_TH_LDXDW_JEQ_IMM, /* r1 = *(u64 *)(r6 + 8); if r1 == 0 goto */
+    PLUGLET_TH_LDXDW_JNE_IMM,
+    PLUGLET_TH_ADD64_JNE_IMM, /* r1 += 1; if r1 != 64 goto */
+    PLUGLET_TH_ADD64_JNE_REG,
+    /* Inlined getters and setters, in the order of the widths */
+    PLUGLET_TH_GET_U8,
+    PLUGLET_TH_GET_U16,
+    PLUGLET_TH_GET_U32,
+    PLUGLET_TH_GET_U64,
+    PLUGLET_TH_GET_S8,
+    PLUGLET_TH_GET_S16,
+    PLUGLET_TH_GET_S32,
+    PLUGLET_TH_SET_8,
+    PLUGLET_TH_SET_16,
+    PLUGLET_TH_SET_32,
+    PLUGLET_TH_SET_64,
+    PLUGLET_TH_FELL_OFF,
+    PLUGLET_TH_NB_HANDLERS
+};
+
+typedef struct pluglet_threaded_insn {
+    const void *handler;
+    uint8_t dst;
+    uint8_t src;
+    int16_t offset;
+    int32_t imm;
+    int32_t imm2; /* Of the jump of a pair */
+    union {
+        uint64_t value; /* Of a lddw */
+        void *fn; /* Of a call */
+        const struct pluglet_threaded_insn *target; /* Of a jump, or of the jump of a pair */
+    } u;
+} pluglet_threaded_insn_t;
+
+struct pluglet_threaded {
+    char error[128];
+    bool has_error;
+    size_t nb_insns;
+    pluglet_threaded_insn_t insns[]; /* nb_insns, then the one that reports falling off the end */
+};
+
+typedef uint64_t (*pluglet_threaded_helper_fn)(uint64_t r1, uint64_t r2, uint64_t r3, uint64_t r4, uint64_t r5);
+
+static char *pluglet_threaded_format(const char *format, ...)
+{
+    char *msg = (char *) malloc(128);
+    va_list ap;
+
+    if (msg != NULL) {
+        va_start(ap, format);
+        vsnprintf(msg, 128, format, ap);
+        va_end(ap);
+    }
+    return msg;
+}
+
+static inline bool pluglet_threaded_in_bounds(uint64_t addr, uint64_t size, uint64_t mem, uint64_t mem_len, uint64_t stack)
+{
+    return (addr >= mem && mem_len >= size && addr - mem <= mem_len - size) ||
+        (addr >= stack && addr - stack <= PLUGLET_STACK_SIZE - size);
+}
+
+#if defined(__GNUC__)
+
+/*
+ * Runs the pluglet. Called without pluglet, returns the handlers in handlers_out instead, the addresses
+ * of labels being only known in the function that holds them.
+ */
+static uint64_t pluglet_threaded_run(pluglet_threaded_t *threaded, void *arg, void *mem, size_t mem_len,
+    const void *const **handlers_out)
+{
+    static const void *const handlers[PLUGLET_TH_NB_HANDLERS] = {
+        [0 ... PLUGLET_TH_NB_HANDLERS - 1] = &&invalid,
+        [0x04] = &&add32_imm, [0x0c] = &&add32_reg, [0x14] = &&sub32_imm, [0x1c] = &&sub32_reg,
+        [0x24] = &&mul32_imm, [0x2c] = &&mul32_reg, [0x34] = &&div32_imm, [0x3c] = &&div32_reg,
+        [0x44] = &&or32_imm, [0x4c] = &&or32_reg, [0x54] = &&and32_imm, [0x5c] = &&and32_reg,
+        [0x64] = &&lsh32_imm, [0x6c] = &&lsh32_reg, [0x74] = &&rsh32_imm, [0x7c] = &&rsh32_reg,
+        [0x84] = &&neg32, [0x94] = &&mod32_imm, [0x9c] = &&mod32_reg, [0xa4] = &&xor32_imm,
+        [0xac] = &&xor32_reg, [0xb4] = &&mov32_imm, [0xbc] = &&mov32_reg, [0xc4] = &&arsh32_imm,
+        [0xcc] = &&arsh32_reg, [0xd4] = &&le, [0xdc] = &&be,
+        [0x07] = &&add64_imm, [0x0f] = &&add64_reg, [0x17] = &&sub64_imm, [0x1f] = &&sub64_reg,
+        [0x27] = &&mul64_imm, [0x2f] = &&mul64_reg, [0x37] = &&div64_imm, [0x3f] = &&div64_reg,
+        [0x47] = &&or64_imm, [0x4f] = &&or64_reg, [0x57] = &&and64_imm, [0x5f] = &&and64_reg,
+        [0x67] = &&lsh64_imm, [0x6f] = &&lsh64_reg, [0x77] = &&rsh64_imm, [0x7f] = &&rsh64_reg,
+        [0x87] = &&neg64, [0x97] = &&mod64_imm, [0x9f] = &&mod64_reg, [0xa7] = &&xor64_imm,
+        [0xaf] = &&xor64_reg, [0xb7] = &&mov64_imm, [0xbf] = &&mov64_reg, [0xc7] = &&arsh64_imm,
+        [0xcf] = &&arsh64_reg,
+        [0x18] = &&lddw,
+        [0x61] = &&ldxw, [0x69] = &&ldxh, [0x71] = &&ldxb, [0x79] = &&ldxdw,
+        [0x62] = &&stw, [0x6a] = &&sth, [0x72] = &&stb, [0x7a] = &&stdw,
+        [0x63] = &&stxw, [0x6b] = &&stxh, [0x73] = &&stxb, [0x7b] = &&stxdw,
+        [0x05] = &&ja, [0x15] = &&jeq_imm, [0x1d] = &&jeq_reg, [0x25] = &&jgt_imm, [0x2d] = &&jgt_reg,
+        [0x35] = &&jge_imm, [0x3d] = &&jge_reg, [0xa5] = &&jlt_imm, [0xad] = &&jlt_reg,
+        [0xb5] = &&jle_imm, [0xbd] = &&jle_reg, [0x45] = &&jset_imm, [0x4d] = &&jset_reg,
+        [0x55] = &&jne_imm, [0x5d] = &&jne_reg, [0x65] = &&jsgt_imm, [0x6d] = &&jsgt_reg,
+        [0x75] = &&jsge_imm, [0x7d] = &&jsge_reg, [0xc5] = &&jslt_imm, [0xcd] = &&jslt_reg,
+        [0xd5] = &&jsle_imm, [0xdd] = &&jsle_reg, [0x85] = &&call, [0x95] = &&exit,
+        [PLUGLET_TH_LDXW_NC] = &&ldxw_nc, [PLUGLET_TH_LDXH_NC] = &&ldxh_nc,
+        [PLUGLET_TH_LDXB_NC] = &&ldxb_nc, [PLUGLET_TH_LDXDW_NC] = &&ldxdw_nc,
+        [PLUGLET_TH_STW_NC] = &&stw_nc, [PLUGLET_TH_STH_NC] = &&sth_nc,
+        [PLUGLET_TH_STB_NC] = &&stb_nc, [PLUGLET_TH_STDW_NC] = &&stdw_nc,
+        [PLUGLET_TH_STXW_NC] = &&stxw_nc, [PLUGLET_TH_STXH_NC] = &&stxh_nc,
+        [PLUGLET_TH_STXB_NC] = &&stxb_nc, [PLUGLET_TH_STXDW_NC] = &&stxdw_nc,
+        [PLUGLET_TH_MOV64_ADD64_IMM] = &&mov64_add64_imm,
+        [PLUGLET_TH_LDXDW_JEQ_IMM] = &&ldxdw_jeq_imm, [PLUGLET_TH_LDXDW_JNE_IMM] = &&ldxdw_jne_imm,
+        [PLUGLET_TH_ADD64_JNE_IMM] = &&add64_jne_imm, [PLUGLET_TH_ADD64_JNE_REG] = &&add64_jne_reg,
+        [PLUGLET_TH_GET_U8] = &&get_u8, [PLUGLET_TH_GET_U16] = &&get_u16, [PLUGLET_TH_GET_U32] = &&get_u32,
+        [PLUGLET_TH_GET_U64] = &&get_u64, [PLUGLET_TH_GET_S8] = &&get_s8, [PLUGLET_TH_GET_S16] = &&get_s16,
+        [PLUGLET_TH_GET_S32] = &&get_s32, [PLUGLET_TH_SET_8] = &&set_8, [PLUGLET_TH_SET_16] = &&set_16,
+        [PLUGLET_TH_SET_32] = &&set_32, [PLUGLET_TH_SET_64] = &&set_64,
+        [PLUGLET_TH_FELL_OFF] = &&fell_off
+    };
+    uint64_t reg[PLUGLET_FRAME_REG + 1];
+    uint64_t stack[PLUGLET_STACK_SIZE / sizeof(uint64_t)];
+    const pluglet_threaded_insn_t *insn;
+    uint64_t addr = 0;
+    uint64_t size = 0;
+
+    if (threaded == NULL) {
+        *handlers_out = handlers;
+        return 0;
+    }
+
+    memset(reg, 0, sizeof(reg));
+    reg[1] = (uint64_t) (uintptr_t) arg;
+    reg[2] = (uint64_t) mem_len;
+    reg[PLUGLET_FRAME_REG] = (uint64_t) (uintptr_t) stack + sizeof(stack);
+    insn = threaded->insns;
+    goto *insn->handler;
+
+#define DST reg[insn->dst]
+#define SRC reg[insn->src]
+#define IMM ((uint64_t) (int64_t) insn->imm)
+#define NEXT() do { insn++; goto *insn->handler; } while (0)
+#define JUMP_IF(cond, length) do { insn = (cond) ? insn->u.target : insn + (length); goto *insn->handler; } while (0)
+#define CHECK(type, base) do { \
+        addr = (base) + (uint64_t) (int64_t) insn->offset; \
+        size = sizeof(type); \
+        if (!pluglet_threaded_in_bounds(addr, size, (uint64_t) (uintptr_t) mem, mem_len, (uint64_t) (uintptr_t) stack)) { \
+            goto out_of_bounds; \
+        } \
+    } while (0)
+
+#define ALU(name, op) \
+    name##32_imm: DST = (uint32_t) ((uint32_t) DST op (uint32_t) insn->imm); NEXT(); \
+    name##32_reg: DST = (uint32_t) ((uint32_t) DST op (uint32_t) SRC); NEXT(); \
+    name##64_imm: DST = DST op IMM; NEXT(); \
+    name##64_reg: DST = DST op SRC; NEXT();
+    ALU(add, +)
+    ALU(sub, -)
+    ALU(mul, *)
+    ALU(or, |)
+    ALU(and, &)
+    ALU(xor, ^)
+#undef ALU
+
+#define SHIFT(name, op32, op64) \
+    name##32_imm: DST = (uint32_t) (op32((uint32_t) DST, insn->imm & 31)); NEXT(); \
+    name##32_reg: DST = (uint32_t) (op32((uint32_t) DST, SRC & 31)); NEXT(); \
+    name##64_imm: DST = op64(DST, insn->imm & 63); NEXT(); \
+    name##64_reg: DST = op64(DST, SRC & 63); NEXT();
+#define LSH(x, n) ((x) << (n))
+#define RSH(x, n) ((x) >> (n))
+#define ARSH32(x, n) ((int32_t) (x) >> (n))
+#define ARSH64(x, n) ((uint64_t) ((int64_t) (x) >> (n)))
+    SHIFT(lsh, LSH, LSH)
+    SHIFT(rsh, RSH, RSH)
+    SHIFT(arsh, ARSH32, ARSH64)
+#undef SHIFT
+
+    /* The immediate divisors are not zero, it is verified at load time */
+div32_imm:
+    DST = (uint32_t) DST / (uint32_t) insn->imm;
+    NEXT();
+div32_reg:
+    if ((uint32_t) SRC == 0) {
+        goto division_by_zero;
+    }
+    DST = (uint32_t) DST / (uint32_t) SRC;
+    NEXT();
+mod32_imm:
+    DST = (uint32_t) DST % (uint32_t) insn->imm;
+    NEXT();
+mod32_reg:
+    if ((uint32_t) SRC == 0) {
+        goto division_by_zero;
+    }
+    DST = (uint32_t) DST % (uint32_t) SRC;
+    NEXT();
+div64_imm:
+    DST = DST / IMM;
+    NEXT();
+div64_reg:
+    if (SRC == 0) {
+        goto division_by_zero;
+    }
+    DST = DST / SRC;
+    NEXT();
+mod64_imm:
+    DST = DST % IMM;
+    NEXT();
+mod64_reg:
+    if (SRC == 0) {
+        goto division_by_zero;
+    }
+    DST = DST % SRC;
+    NEXT();
+neg32:
+    DST = (uint32_t) -(uint32_t) DST;
+    NEXT();
+neg64:
+    DST = -DST;
+    NEXT();
+mov32_imm:
+    DST = (uint32_t) insn->imm;
+    NEXT();
+mov32_reg:
+    DST = (uint32_t) SRC;
+    NEXT();
+mov64_imm:
+    DST = IMM;
+    NEXT();
+mov64_reg:
+    DST = SRC;
+    NEXT();
+    /* The width is verified at load time */
+le:
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    DST = (insn->imm == 16) ? (uint16_t) DST : ((insn->imm == 32) ? (uint32_t) DST : DST);
+#else
+    DST = (insn->imm == 16) ? __builtin_bswap16(DST) : ((insn->imm == 32) ? __builtin_bswap32(DST) : __builtin_bswap64(DST));
+#endif
+    NEXT();
+be:
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    DST = (insn->imm == 16) ? __builtin_bswap16(DST) : ((insn->imm == 32) ? __builtin_bswap32(DST) : __builtin_bswap64(DST));
+#else
+    DST = (insn->imm == 16) ? (uint16_t) DST : ((insn->imm == 32) ? (uint32_t) DST : DST);
+#endif
+    NEXT();
+lddw:
+    DST = insn->u.value;
+    insn += 2;
+    goto *insn->handler;
+
+#define MEMORY(name, type, target, value, base) \
+    name: CHECK(type, base); target = value; NEXT(); \
+    name##_nc: addr = (base) + (uint64_t) (int64_t) insn->offset; target = value; NEXT();
+#define LOADED(type) *(type *) (uintptr_t) addr
+    MEMORY(ldxw, uint32_t, DST, LOADED(uint32_t), SRC)
+    MEMORY(ldxh, uint16_t, DST, LOADED(uint16_t), SRC)
+    MEMORY(ldxb, uint8_t, DST, LOADED(uint8_t), SRC)
+    MEMORY(ldxdw, uint64_t, DST, LOADED(uint64_t), SRC)
+    MEMORY(stw, uint32_t, LOADED(uint32_t), (uint32_t) insn->imm, DST)
+    MEMORY(sth, uint16_t, LOADED(uint16_t), (uint16_t) insn->imm, DST)
+    MEMORY(stb, uint8_t, LOADED(uint8_t), (uint8_t) insn->imm, DST)
+    MEMORY(stdw, uint64_t, LOADED(uint64_t), IMM, DST)
+    MEMORY(stxw, uint32_t, LOADED(uint32_t), (uint32_t) SRC, DST)
+    MEMORY(stxh, uint16_t, LOADED(uint16_t), (uint16_t) SRC, DST)
+    MEMORY(stxb, uint8_t, LOADED(uint8_t), (uint8_t) SRC, DST)
+    MEMORY(stxdw, uint64_t, LOADED(uint64_t), SRC, DST)
+#undef MEMORY
+
+ja:
+    insn = insn->u.target;
+    goto *insn->handler;
+#define JUMP(name, cond_imm, cond_reg) \
+    name##_imm: JUMP_IF(cond_imm, 1); \
+    name##_reg: JUMP_IF(cond_reg, 1);
+    JUMP(jeq, DST == IMM, DST == SRC)
+    JUMP(jne, DST != IMM, DST != SRC)
+    JUMP(jgt, DST > IMM, DST > SRC)
+    JUMP(jge, DST >= IMM, DST >= SRC)
+    JUMP(jlt, DST < IMM, DST < SRC)
+    JUMP(jle, DST <= IMM, DST <= SRC)
+    JUMP(jset, (DST & IMM) != 0, (DST & SRC) != 0)
+    JUMP(jsgt, (int64_t) DST > (int64_t) IMM, (int64_t) DST > (int64_t) SRC)
+    JUMP(jsge, (int64_t) DST >= (int64_t) IMM, (int64_t) DST >= (int64_t) SRC)
+    JUMP(jslt, (int64_t) DST < (int64_t) IMM, (int64_t) DST < (int64_t) SRC)
+    JUMP(jsle, (int64_t) DST <= (int64_t) IMM, (int64_t) DST <= (int64_t) SRC)
+#undef JUMP
+call:
+    reg[0] = ((pluglet_threaded_helper_fn) insn->u.fn)(reg[1], reg[2], reg[3], reg[4], reg[5]);
+    NEXT();
+exit:
+    threaded->has_error = false;
+    return reg[0];
+
+mov64_add64_imm:
+    DST = SRC + IMM;
+    insn += 2;
+    goto *insn->handler;
+ldxdw_jeq_imm:
+    CHECK(uint64_t, SRC);
+    DST = LOADED(uint64_t);
+    JUMP_IF(DST == (uint64_t) (int64_t) insn->imm2, 2);
+ldxdw_jne_imm:
+    CHECK(uint64_t, SRC);
+    DST = LOADED(uint64_t);
+    JUMP_IF(DST != (uint64_t) (int64_t) insn->imm2, 2);
+add64_jne_imm:
+    DST += IMM;
+    JUMP_IF(DST != (uint64_t) (int64_t) insn->imm2, 2);
+add64_jne_reg:
+    DST += IMM;
+    JUMP_IF(DST != SRC, 2);
+#undef LOADED
+
+    /* The field is at the offset in the immediate of the structure in r1, the value to set in r4. Without
+     * structure, the helper is called to report it */
+#define FIELD(type) *(type *) (uintptr_t) (reg[1] + (uint64_t) insn->imm)
+#define GET(name, type) \
+    name: if (reg[1] == 0) { goto call; } reg[0] = (uint64_t) (int64_t) FIELD(type); NEXT();
+#define SET(name, type) \
+    name: if (reg[1] == 0) { goto call; } FIELD(type) = (type) reg[4]; NEXT();
+    GET(get_u8, uint8_t)
+    GET(get_u16, uint16_t)
+    GET(get_u32, uint32_t)
+    GET(get_s8, int8_t)
+    GET(get_s16, int16_t)
+    GET(get_s32, int32_t)
+get_u64:
+    if (reg[1] == 0) {
+        goto call;
+    }
+    reg[0] = FIELD(uint64_t);
+    NEXT();
+    SET(set_8, uint8_t)
+    SET(set_16, uint16_t)
+    SET(set_32, uint32_t)
+    SET(set_64, uint64_t)
+#undef GET
+#undef SET
+#undef FIELD
+
+out_of_bounds:
+    snprintf(threaded->error, sizeof(threaded->error), "out of bound access of %" PRIu64 " bytes at 0x%" PRIx64 ", PC %u",
+        size, addr, (unsigned int) (insn - threaded->insns));
+    threaded->has_error = true;
+    return UINT64_MAX;
+division_by_zero:
+    snprintf(threaded->error, sizeof(threaded->error), "division by zero at PC %u", (unsigned int) (insn - threaded->insns));
+    threaded->has_error = true;
+    return UINT64_MAX;
+fell_off:
+    snprintf(threaded->error, sizeof(threaded->error), "no exit at the end of the code");
+    threaded->has_error = true;
+    return UINT64_MAX;
+invalid:
+    snprintf(threaded->error, sizeof(threaded->error), "invalid instruction at PC %u", (unsigned int) (insn - threaded->insns));
+    threaded->has_error = true;
+    return UINT64_MAX;
+
+#undef DST
+#undef SRC
+#undef IMM
+#undef NEXT
+#undef JUMP_IF
+#undef CHECK
+}
+
+static const void *const *pluglet_threaded_handlers(void)
+{
+    const void *const *handlers = NULL;
+    pluglet_threaded_run(NULL, NULL, NULL, 0, &handlers);
+    return handlers;
+}
+
+#else
+
+static const void *const *pluglet_threaded_handlers(void)
+{
+    return NULL;
+}
+
+static uint64_t pluglet_threaded_run(pluglet_threaded_t *threaded, void *arg, void *mem, size_t mem_len,
+    const void *const **handlers_out)
+{
+    return UINT64_MAX;
+}
+
+#endif
+
+/* Returns the handler of the unchecked access, for the memory access opcodes, or 0 */
+static int pluglet_threaded_unchecked(uint8_t op)
+{
+    int size_index = (op >> 3) & 0x03;
+    switch (op & 0xe7) {
+    case 0x61: /* LDX MEM */
+        return PLUGLET_TH_LDXW_NC + size_index;
+    case 0x62: /* ST MEM */
+        return PLUGLET_TH_STW_NC + size_index;
+    case 0x63: /* STX MEM */
+        return PLUGLET_TH_STXW_NC + size_index;
+    default:
+        return 0;
+    }
+}
+
+static bool pluglet_threaded_is_jump(uint8_t op)
+{
+    return (op & 0x07) == 0x05 && op != PLUGLET_OP_CALL && op != PLUGLET_OP_EXIT;
+}
+
+/* Fuses the instruction with the next one when they form one of the frequent pairs */
+static void pluglet_threaded_fuse(pluglet_threaded_insn_t *insn, const pluglet_insn_t *first, const pluglet_insn_t *second,
+    const void *const *handlers)
+{
+    uint8_t first_dst = first->regs & 0x0f;
+    uint8_t second_dst = second->regs & 0x0f;
+    int pair = 0;
+
+    if (first_dst != second_dst) {
+        return;
+    }
+    if (first->opcode == PLUGLET_OP_MOV64_REG && second->opcode == PLUGLET_OP_ADD64_IMM) {
+        insn->imm = second->imm;
+        pair = PLUGLET_TH_MOV64_ADD64_IMM;
+    } else if (first->opcode == PLUGLET_OP_LDXDW && (second->opcode == PLUGLET_OP_JEQ_IMM || second->opcode == PLUGLET_OP_JNE_IMM)) {
+        pair = (second->opcode == PLUGLET_OP_JEQ_IMM) ? PLUGLET_TH_LDXDW_JEQ_IMM : PLUGLET_TH_LDXDW_JNE_IMM;
+    } else if (first->opcode == PLUGLET_OP_ADD64_IMM && second->opcode == PLUGLET_OP_JNE_IMM) {
+        pair = PLUGLET_TH_ADD64_JNE_IMM;
+    } else if (first->opcode == PLUGLET_OP_ADD64_IMM && second->opcode == PLUGLET_OP_JNE_REG) {
+        insn->src = second->regs >> 4;
+        pair = PLUGLET_TH_ADD64_JNE_REG;
+    }
+    if (pair != 0) {
+        if (pluglet_threaded_is_jump(second->opcode)) {
+            insn->imm2 = second->imm;
+            insn->u.target = insn[1].u.target;
+        }
+        insn->handler = handlers[pair];
+    }
+}
+
+/* The key in r2 of the call at pc, when a mov of a constant sets it on every path that reaches the call */
+static bool pluglet_threaded_constant_key(const pluglet_insn_t *insns, const bool *is_target, size_t pc, access_key_t *ak)
+{
+    while (!is_target[pc] && pc-- > 0) {
+        uint8_t op = insns[pc].opcode;
+        uint8_t cls = op & 0x07;
+        if (op == PLUGLET_OP_CALL) {
+            return false;
+        }
+        if ((insns[pc].regs & 0x0f) == 2 && cls != 0x02 && cls != 0x03 && cls != 0x05) {
+            if (op == PLUGLET_OP_MOV32_IMM || op == PLUGLET_OP_MOV64_IMM) {
+                *ak = (access_key_t) insns[pc].imm;
+                return true;
+            }
+            return false;
+        }
+    }
+    return false;
+}
+
+/* Replaces the call to a getter or a setter of a plain field by the load or the store */
+static void pluglet_threaded_inline_getset(pluglet_threaded_insn_t *insn, const pluglet_insn_t *insns, const bool *is_target,
+    size_t pc, const void *const *handlers)
+{
+    access_key_t ak;
+    uint32_t offset;
+    uint8_t width;
+    bool is_signed;
+    int first;
+
+    if (!pluglet_threaded_constant_key(insns, is_target, pc, &ak) ||
+        !getset_field_layout(insn->u.fn, ak, &offset, &width, &is_signed)) {
+        return;
+    }
+    if (insn->u.fn == (void *) get_cnx || insn->u.fn == (void *) get_path) {
+        first = (is_signed && width < 8) ? PLUGLET_TH_GET_S8 : PLUGLET_TH_GET_U8;
+    } else {
+        first = PLUGLET_TH_SET_8;
+    }
+    /* As getset_load and getset_store, the other widths are read as 64 bits */
+    insn->handler = handlers[first + ((width == 1) ? 0 : ((width == 2) ? 1 : ((width == 4) ? 2 : 3)))];
+    insn->imm = (int32_t) offset;
+}
+
+pluglet_threaded_t *pluglet_threaded_create(const pluglet_insn_t *insns, size_t nb_insns, const bool *is_elidable,
+    const pluglet_helper_t *helpers, char **errmsg)
+{
+    const void *const *handlers = pluglet_threaded_handlers();
+    pluglet_threaded_t *threaded = NULL;
+    bool *is_target = NULL;
+    size_t pc;
+
+    *errmsg = NULL;
+    if (handlers == NULL) {
+        *errmsg = pluglet_threaded_format("no computed goto in this build");
+        return NULL;
+    }
+    if (nb_insns == 0) {
+        *errmsg = pluglet_threaded_format("no instruction");
+        return NULL;
+    }
+    threaded = (pluglet_threaded_t *) calloc(1, sizeof(pluglet_threaded_t) + (nb_insns + 1) * sizeof(pluglet_threaded_insn_t));
+    is_target = (bool *) calloc(nb_insns + 1, sizeof(bool));
+    if (threaded == NULL || is_target == NULL) {
+        *errmsg = pluglet_threaded_format("out of memory");
+    }
+    if (threaded != NULL) {
+        threaded->nb_insns = nb_insns;
+    }
+
+    for (pc = 0; *errmsg == NULL && pc < nb_insns; pc++) {
+        const pluglet_insn_t *in = &insns[pc];
+        pluglet_threaded_insn_t *out = &threaded->insns[pc];
+        uint8_t op = in->opcode;
+        uint8_t cls = op & 0x07;
+        int unchecked = pluglet_threaded_unchecked(op);
+
+        out->dst = in->regs & 0x0f;
+        out->src = in->regs >> 4;
+        out->offset = in->offset;
+        out->imm = in->imm;
+        out->handler = handlers[op];
+        if (out->handler == handlers[PLUGLET_TH_INVALID]) {
+            *errmsg = pluglet_threaded_format("unknown opcode 0x%02x at PC %zu", op, pc);
+        } else if (out->src > PLUGLET_FRAME_REG || out->dst > PLUGLET_FRAME_REG ||
+            (out->dst == PLUGLET_FRAME_REG && cls != 0x02 && cls != 0x03 && cls != 0x05)) {
+            *errmsg = pluglet_threaded_format("invalid register at PC %zu", pc);
+        } else if ((op == 0x34 || op == 0x37 || op == 0x94 || op == 0x97) && in->imm == 0) {
+            *errmsg = pluglet_threaded_format("division by zero at PC %zu", pc);
+        } else if ((op == 0xd4 || op == 0xdc) && in->imm != 16 && in->imm != 32 && in->imm != 64) {
+            *errmsg = pluglet_threaded_format("invalid width at PC %zu", pc);
+        } else if (op == PLUGLET_OP_LDDW) {
+            if (pc + 1 >= nb_insns || insns[pc + 1].opcode != 0) {
+                *errmsg = pluglet_threaded_format("incomplete lddw at PC %zu", pc);
+            } else {
+                out->u.value = (uint64_t) (uint32_t) in->imm | ((uint64_t) (uint32_t) insns[pc + 1].imm << 32);
+                /* The second half is never run, jumping to it is rejected below */
+                threaded->insns[++pc].handler = handlers[PLUGLET_TH_INVALID];
+            }
+        } else if (op == PLUGLET_OP_CALL) {
+            if (in->imm < 0 || in->imm >= PLUGLET_MAX_HELPERS || helpers[in->imm].fn == NULL) {
+                *errmsg = pluglet_threaded_format("call to the unknown helper %d at PC %zu", in->imm, pc);
+            } else {
+                out->u.fn = helpers[in->imm].fn;
+            }
+        } else if (pluglet_threaded_is_jump(op)) {
+            int64_t target = (int64_t) pc + 1 + in->offset;
+            if (target < 0 || target >= (int64_t) nb_insns) {
+                *errmsg = pluglet_threaded_format("jump out of the code at PC %zu", pc);
+            } else {
+                out->u.target = &threaded->insns[target];
+                is_target[target] = true;
+            }
+        } else if (unchecked != 0 && is_elidable != NULL && is_elidable[pc]) {
+            out->handler = handlers[unchecked];
+        }
+    }
+    for (pc = 0; *errmsg == NULL && pc < nb_insns; pc++) {
+        if (is_target[pc] && threaded->insns[pc].handler == handlers[PLUGLET_TH_INVALID]) {
+            *errmsg = pluglet_threaded_format("jump into a lddw at PC %zu", pc);
+        }
+    }
+
+    if (*errmsg == NULL) {
+        for (pc = 0; pc < nb_insns; pc++) {
+            if (insns[pc].opcode == PLUGLET_OP_CALL) {
+                pluglet_threaded_inline_getset(&threaded->insns[pc], insns, is_target, pc, handlers);
+            }
+        }
+        /* The fused instructions run the second one, so it cannot be a jump target */
+        for (pc = 0; pc + 1 < nb_insns; pc++) {
+            if (!is_target[pc + 1] && insns[pc].opcode != PLUGLET_OP_LDDW) {
+                pluglet_threaded_fuse(&threaded->insns[pc], &insns[pc], &insns[pc + 1], handlers);
+            }
+        }
+        threaded->insns[nb_insns].handler = handlers[PLUGLET_TH_FELL_OFF];
+    } else {
+        free(threaded);
+        threaded = NULL;
+    }
+    free(is_target);
+
+    return threaded;
+}
+
+uint64_t pluglet_threaded_exec(pluglet_threaded_t *threaded, void *arg, void *mem, size_t mem_len, char **error_msg)
+{
+    uint64_t ret = pluglet_threaded_run(threaded, arg, mem, mem_len, NULL);
+    *error_msg = (threaded->has_error) ? threaded->error : NULL;
+    return ret;
+}
+
+void pluglet_threaded_free(pluglet_threaded_t *threaded)
+{
+    free(threaded);
+}
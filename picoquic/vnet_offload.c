@@ -0,0 +1,268 @@
+#include "vnet_offload.h"
+#include "picoquic_internal.h"
+#include <string.h>
+
+#define VNET_TCP_FIN 0x01
+#define VNET_TCP_PSH 0x08
+#define VNET_TCP_ACK 0x10
+#define VNET_TCP_ECE 0x40
+#define VNET_TCP_CWR 0x80
+
+void picoquic_vnet_hdr_decode(uint8_t const* bytes, picoquic_vnet_hdr_t* hdr)
+{
+    hdr->flags = bytes[0];
+    hdr->gso_type = bytes[1];
+    memcpy(&hdr->hdr_len, bytes + 2, 2);
+    memcpy(&hdr->gso_size, bytes + 4, 2);
+    memcpy(&hdr->csum_start, bytes + 6, 2);
+    memcpy(&hdr->csum_offset, bytes + 8, 2);
+}
+
+void picoquic_vnet_hdr_encode(picoquic_vnet_hdr_t const* hdr, uint8_t* bytes)
+{
+    bytes[0] = hdr->flags;
+    bytes[1] = hdr->gso_type;
+    memcpy(bytes + 2, &hdr->hdr_len, 2);
+    memcpy(bytes + 4, &hdr->gso_size, 2);
+    memcpy(bytes + 6, &hdr->csum_start, 2);
+    memcpy(bytes + 8, &hdr->csum_offset, 2);
+}
+
+static uint64_t vnet_sum(uint64_t sum, uint8_t const* bytes, size_t length)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < length; i += 2) {
+        sum += PICOPARSE_16(bytes + i);
+    }
+    if (i < length) {
+        sum += ((uint16_t)bytes[i]) << 8;
+    }
+
+    return sum;
+}
+
+static uint16_t vnet_fold(uint64_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)sum;
+}
+
+/* Sum of the pseudo header of the TCP segment of tcp_length bytes in the IP packet */
+static uint64_t vnet_pseudo_sum(uint8_t const* ip, size_t tcp_length)
+{
+    uint64_t sum = ((ip[0] >> 4) == 4) ? vnet_sum(0, ip + 12, 8) : vnet_sum(0, ip + 8, 32);
+
+    return sum + 6 + tcp_length;
+}
+
+/* Returns the length of the IP header of a TCP packet that can be segmented or coalesced, or 0 */
+static size_t vnet_tcp_ip_header_length(uint8_t const* ip, size_t length)
+{
+    if (length >= 20 + 20 && ip[0] == 0x45 && ip[9] == 6 && (PICOPARSE_16(ip + 6) & 0x3FFF) == 0) {
+        return 20;
+    } else if (length >= 40 + 20 && (ip[0] >> 4) == 6 && ip[6] == 6) {
+        return 40;
+    }
+    return 0;
+}
+
+/* Sets the length, the identification and the checksum of the IP header, and the checksum of the TCP
+ * segment: the full checksum, or only the sum of the pseudo header for the kernel to complete. */
+static void vnet_set_lengths(uint8_t* ip, size_t length, size_t ip_hlen, uint16_t ip_id, int partial_checksum)
+{
+    uint8_t* tcp = ip + ip_hlen;
+    uint64_t tcp_sum;
+
+    if (ip_hlen == 20) {
+        picoformat_16(ip + 2, (uint16_t)length);
+        picoformat_16(ip + 4, ip_id);
+        picoformat_16(ip + 10, 0);
+        picoformat_16(ip + 10, (uint16_t)~vnet_fold(vnet_sum(0, ip, 20)));
+    } else {
+        picoformat_16(ip + 4, (uint16_t)(length - 40));
+    }
+
+    picoformat_16(tcp + 16, 0);
+    tcp_sum = vnet_pseudo_sum(ip, length - ip_hlen);
+    if (partial_checksum) {
+        picoformat_16(tcp + 16, vnet_fold(tcp_sum));
+    } else {
+        picoformat_16(tcp + 16, (uint16_t)~vnet_fold(vnet_sum(tcp_sum, tcp, length - ip_hlen)));
+    }
+}
+
+int picoquic_vnet_segment(uint8_t const* frame, size_t frame_length, size_t segment_max,
+    uint8_t* segments, size_t slot_size, size_t* segment_lengths, int max_segments)
+{
+    picoquic_vnet_hdr_t hdr;
+    uint8_t const* ip = frame + PICOQUIC_VNET_HDR_SIZE;
+    size_t length;
+    size_t ip_hlen;
+    size_t headers;
+    size_t mss;
+    size_t nb_segments;
+    uint32_t seq;
+    uint16_t ip_id;
+
+    if (frame_length <= PICOQUIC_VNET_HDR_SIZE || max_segments < 1) {
+        return -1;
+    }
+    picoquic_vnet_hdr_decode(frame, &hdr);
+    length = frame_length - PICOQUIC_VNET_HDR_SIZE;
+    if (segment_max > slot_size) {
+        segment_max = slot_size;
+    }
+
+    if ((hdr.gso_type & ~PICOQUIC_VNET_HDR_GSO_ECN) == PICOQUIC_VNET_HDR_GSO_NONE) {
+        if (length > segment_max) {
+            return -1;
+        }
+        memcpy(segments, ip, length);
+        if (hdr.flags & PICOQUIC_VNET_HDR_F_NEEDS_CSUM) {
+            /* The checksum field holds the sum of the pseudo header */
+            uint16_t checksum;
+
+            if ((size_t)hdr.csum_start + hdr.csum_offset + 2 > length) {
+                return -1;
+            }
+            checksum = (uint16_t)~vnet_fold(vnet_sum(0, segments + hdr.csum_start, length - hdr.csum_start));
+            if (checksum == 0 && hdr.csum_offset == 6) {
+                /* A zero UDP checksum means none */
+                checksum = 0xFFFF;
+            }
+            picoformat_16(segments + hdr.csum_start + hdr.csum_offset, checksum);
+        }
+        segment_lengths[0] = length;
+        return 1;
+    }
+
+    ip_hlen = vnet_tcp_ip_header_length(ip, length);
+    if (hdr.gso_size == 0 || ip_hlen == 0 ||
+        (hdr.gso_type & ~PICOQUIC_VNET_HDR_GSO_ECN) != ((ip_hlen == 20) ? PICOQUIC_VNET_HDR_GSO_TCPV4 : PICOQUIC_VNET_HDR_GSO_TCPV6)) {
+        return -1;
+    }
+    headers = ip_hlen + 4 * (ip[ip_hlen + 12] >> 4);
+    if (headers < ip_hlen + 20 || headers >= length || headers >= segment_max) {
+        return -1;
+    }
+
+    /* The segments may be shorter than those the kernel asked for, to fit in the datagrams */
+    mss = hdr.gso_size;
+    if (headers + mss > segment_max) {
+        mss = segment_max - headers;
+    }
+    nb_segments = (length - headers + mss - 1) / mss;
+    if (nb_segments > (size_t)max_segments) {
+        return -1;
+    }
+
+    seq = PICOPARSE_32(ip + ip_hlen + 4);
+    ip_id = (ip_hlen == 20) ? PICOPARSE_16(ip + 4) : 0;
+    for (size_t i = 0; i < nb_segments; i++) {
+        uint8_t* segment = segments + i * slot_size;
+        uint8_t* tcp = segment + ip_hlen;
+        size_t offset = i * mss;
+        size_t payload_length = (length - headers - offset < mss) ? length - headers - offset : mss;
+
+        memcpy(segment, ip, headers);
+        memcpy(segment + headers, ip + headers + offset, payload_length);
+        picoformat_32(tcp + 4, seq + (uint32_t)offset);
+        if (i > 0) {
+            tcp[13] &= (uint8_t)~VNET_TCP_CWR;
+        }
+        if (i + 1 < nb_segments) {
+            tcp[13] &= (uint8_t)~(VNET_TCP_FIN | VNET_TCP_PSH);
+        }
+        vnet_set_lengths(segment, headers + payload_length, ip_hlen, (uint16_t)(ip_id + i), 0);
+        segment_lengths[i] = headers + payload_length;
+    }
+
+    return (int)nb_segments;
+}
+
+/* Checks that the packet is the next segment of the flow of first: same IP and TCP headers but for the
+ * lengths, identification, sequence number, checksums and PSH flag */
+static int vnet_is_same_flow(uint8_t const* first, uint8_t const* ip, size_t length, size_t ip_hlen, size_t headers)
+{
+    uint8_t const* tcp_first = first + ip_hlen;
+    uint8_t const* tcp = ip + ip_hlen;
+
+    if (vnet_tcp_ip_header_length(ip, length) != ip_hlen || length <= headers ||
+        ip_hlen + 4 * (tcp[12] >> 4) != headers) {
+        return 0;
+    }
+    if (ip_hlen == 20) {
+        if (memcmp(first, ip, 2) != 0 || (first[6] & 0x40) != (ip[6] & 0x40) || memcmp(first + 8, ip + 8, 2) != 0 ||
+            memcmp(first + 12, ip + 12, 8) != 0) {
+            return 0;
+        }
+    } else if (memcmp(first, ip, 4) != 0 || memcmp(first + 6, ip + 6, 34) != 0) {
+        return 0;
+    }
+
+    return memcmp(tcp_first, tcp, 4) == 0 && memcmp(tcp_first + 8, tcp + 8, 5) == 0 &&
+        (tcp[13] & (uint8_t)~VNET_TCP_PSH) == tcp_first[13] && memcmp(tcp_first + 14, tcp + 14, 2) == 0 &&
+        memcmp(tcp_first + 18, tcp + 18, headers - ip_hlen - 18) == 0;
+}
+
+int picoquic_vnet_coalesce(uint8_t const* const* packets, size_t const* lengths, int nb_packets,
+    uint8_t* frame, size_t frame_max, size_t* frame_length)
+{
+    picoquic_vnet_hdr_t hdr;
+    uint8_t const* first = packets[0];
+    uint8_t* ip = frame + PICOQUIC_VNET_HDR_SIZE;
+    size_t length = lengths[0];
+    size_t ip_hlen;
+    int nb_merged = 1;
+
+    if (nb_packets < 1 || PICOQUIC_VNET_HDR_SIZE + length > frame_max) {
+        return 0;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(ip, first, length);
+
+    ip_hlen = vnet_tcp_ip_header_length(first, length);
+    if (ip_hlen > 0 && (first[ip_hlen + 13] & (uint8_t)~(VNET_TCP_ACK | VNET_TCP_ECE)) == 0) {
+        size_t headers = ip_hlen + 4 * (first[ip_hlen + 12] >> 4);
+        size_t mss = (headers < length) ? length - headers : 0;
+        uint32_t next_seq = PICOPARSE_32(first + ip_hlen + 4) + (uint32_t)mss;
+
+        while (headers >= ip_hlen + 20 && mss > 0 && nb_merged < nb_packets) {
+            uint8_t const* packet = packets[nb_merged];
+            size_t payload_length = lengths[nb_merged] - headers;
+
+            if (!vnet_is_same_flow(first, packet, lengths[nb_merged], ip_hlen, headers) || payload_length > mss ||
+                PICOPARSE_32(packet + ip_hlen + 4) != next_seq || length + payload_length > 65535 ||
+                PICOQUIC_VNET_HDR_SIZE + length + payload_length > frame_max) {
+                break;
+            }
+            memcpy(ip + length, packet + headers, payload_length);
+            length += payload_length;
+            next_seq += (uint32_t)payload_length;
+            nb_merged++;
+            if (payload_length < mss || (packet[ip_hlen + 13] & VNET_TCP_PSH) != 0) {
+                /* A short segment or a push ends the super-packet */
+                ip[ip_hlen + 13] |= packet[ip_hlen + 13] & VNET_TCP_PSH;
+                break;
+            }
+        }
+
+        if (nb_merged > 1) {
+            vnet_set_lengths(ip, length, ip_hlen, (ip_hlen == 20) ? PICOPARSE_16(first + 4) : 0, 1);
+            hdr.flags = PICOQUIC_VNET_HDR_F_NEEDS_CSUM;
+            hdr.gso_type = (ip_hlen == 20) ? PICOQUIC_VNET_HDR_GSO_TCPV4 : PICOQUIC_VNET_HDR_GSO_TCPV6;
+            hdr.hdr_len = (uint16_t)headers;
+            hdr.gso_size = (uint16_t)mss;
+            hdr.csum_start = (uint16_t)ip_hlen;
+            hdr.csum_offset = 16;
+        }
+    }
+
+    picoquic_vnet_hdr_encode(&hdr, frame);
+    *frame_length = PICOQUIC_VNET_HDR_SIZE + length;
+
+    return nb_merged;
+}
@@ -0,0 +1,55 @@
+/**
+ * \file vnet_offload.h
+ * \brief Segmentation and coalescing of the TCP packets of a tun device with IFF_VNET_HDR.
+ *
+ * With the TUN_F_TSO4 and TUN_F_TSO6 offloads, the kernel hands TCP super-packets of up to 64 KB to
+ * the application, each behind a virtio-net header. They are split here into packets that fit a QUIC
+ * datagram, which may be smaller than the segments the kernel asked for: the TCP segments are then
+ * just shorter. In the other direction, consecutive segments of a TCP flow are merged back into one
+ * super-packet, which the kernel segments again if it has to forward them.
+ *
+ * The header is the legacy virtio-net header, in the byte order of the host. Only IPv4 without
+ * options and IPv6 without extension headers are segmented or coalesced, the other packets go
+ * through unchanged.
+ */
+
+#ifndef VNET_OFFLOAD_H
+#define VNET_OFFLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PICOQUIC_VNET_HDR_SIZE 10
+#define PICOQUIC_VNET_FRAME_MAX (PICOQUIC_VNET_HDR_SIZE + 65535)
+
+#define PICOQUIC_VNET_HDR_F_NEEDS_CSUM 1
+#define PICOQUIC_VNET_HDR_GSO_NONE 0
+#define PICOQUIC_VNET_HDR_GSO_TCPV4 1
+#define PICOQUIC_VNET_HDR_GSO_TCPV6 4
+#define PICOQUIC_VNET_HDR_GSO_ECN 0x80
+
+typedef struct st_picoquic_vnet_hdr_t {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len; /* Length of the IP and TCP headers */
+    uint16_t gso_size; /* Payload of each segment */
+    uint16_t csum_start;
+    uint16_t csum_offset;
+} picoquic_vnet_hdr_t;
+
+void picoquic_vnet_hdr_decode(uint8_t const* bytes, picoquic_vnet_hdr_t* hdr);
+void picoquic_vnet_hdr_encode(picoquic_vnet_hdr_t const* hdr, uint8_t* bytes);
+
+/* Splits the frame read from the tun device into IP packets of at most segment_max bytes, each written in
+ * a slot of slot_size bytes from segments. Returns the number of packets, or -1 if the frame is malformed
+ * or needs more than max_segments packets. */
+int picoquic_vnet_segment(uint8_t const* frame, size_t frame_length, size_t segment_max,
+    uint8_t* segments, size_t slot_size, size_t* segment_lengths, int max_segments);
+
+/* Writes in frame the virtio-net header and the IP packet made of the first packet and of those that follow
+ * it in the same TCP flow and in sequence. Returns the number of packets merged, at least 1, or 0 if the
+ * first one does not fit in frame_max bytes. */
+int picoquic_vnet_coalesce(uint8_t const* const* packets, size_t const* lengths, int nb_packets,
+    uint8_t* frame, size_t frame_max, size_t* frame_length);
+
+#endif /* VNET_OFFLOAD_H */
@@ -42,14 +42,20 @@ typedef enum {
 
 static const picoquic_test_def_t test_table[] = {
     { "picohash", picohash_test },
+    { "picohash_resize", picohash_resize_test },
+    { "picohash_bench", picohash_bench_test },
     { "splay", splay_test },
     { "cnxcreation", cnxcreation_test },
     { "parseheader", parseheadertest },
+    { "h3zero_huffman", h3zero_huffman_test },
+    { "h3zero_priority", h3zero_priority_test },
+    { "demo_load", demo_load_test },
     { "pn2pn64", pn2pn64test },
     { "intformat", intformattest },
     { "fnv1a", fnv1atest },
     { "float16", float16test },
     { "varint", varint_test },
+    { "varint_decode_n", varint_decode_n_test },
     { "sack", sacktest },
     { "skip_frames", skip_frame_test },
     { "parse_frames", parse_frame_test },
@@ -58,12 +64,33 @@ static const picoquic_test_def_t test_table[] = {
     { "StreamZeroFrame", StreamZeroFrameTest },
     { "sendack", sendacktest },
     { "ackrange", ackrange_test },
+    { "sack_list", sack_list_test },
     { "ack_of_ack", ack_of_ack_test },
     { "sim_link", sim_link_test },
+    { "sim_net", sim_net_test },
+    { "sim_link_bench", sim_link_bench_test },
     { "clear_text_aead", cleartext_aead_test },
     { "pn_ctr", pn_ctr_test },
     { "cleartext_hp_enc", cleartext_hp_enc_test },
+    { "aead_provider_bench", aead_provider_bench_test },
     { "hp_enc_1rtt", hp_enc_1rtt_test },
+    { "hp_mask_batch", hp_mask_batch_test },
+    { "handshake_bench", handshake_bench_test },
+    { "receive_bench", receive_bench_test },
+    { "ecn", ecn_test },
+    { "send_budget", send_budget_test },
+    { "key_rotation", key_rotation_test },
+    { "certificate_compression", certificate_compression_test },
+    { "initial_reject", initial_reject_test },
+    { "hystart_pp", hystart_pp_test },
+    { "ledbat", ledbat_test },
+    { "tombstone", tombstone_test },
+    { "quic_lb", quic_lb_test },
+    { "preferred_address", preferred_address_test },
+    { "overload", overload_test },
+    { "header_template", header_template_test },
+    { "send_buffer", send_buffer_test },
+    { "cc_bench", cc_bench_test },
     { "tls_api", tls_api_test },
     { "silence_test", tls_api_silence_test },
     { "tls_api_version_negotiation", tls_api_version_negotiation_test },
@@ -89,18 +116,46 @@ static const picoquic_test_def_t test_table[] = {
     { "tls_api_very_long_congestion", tls_api_very_long_congestion_test },
     { "http0dot9", http0dot9_test },
     { "retry", tls_api_retry_test },
+    { "retry_stateless", tls_api_retry_stateless_test },
     { "two_connections", tls_api_two_connections_test },
     { "multiple_versions", tls_api_multiple_versions_test },
     { "keep_alive", keep_alive_test },
+    { "keep_alive_adaptive", keep_alive_adaptive_test },
+    { "log_policy", log_policy_test },
+    { "binary_log", binary_log_test },
     { "sockets", socket_test },
+    { "sockets_gso", socket_gso_test },
+    { "sockets_batch", socket_batch_test },
+    { "sockets_event_loop", socket_event_loop_test },
+    { "sockets_connected", socket_connected_test },
+    { "sockets_busy_poll", socket_busy_poll_test },
+    { "sockets_uring", socket_uring_test },
+    { "sockets_rx_timestamp", socket_rx_timestamp_test },
+    { "xdp_frames", xdp_frames_test },
+    { "xdp_loopback", xdp_loopback_test },
+    { "threaded_server", threaded_server_test },
+    { "clock", clock_test },
     { "ticket_store", ticket_store_test },
+    { "ticket_store_append", ticket_store_append_test },
+    { "resumption_store", resumption_store_test },
+    { "server_metrics", server_metrics_test },
+    { "alloc_profiler", alloc_profiler_test },
+    { "offload_pool", offload_pool_test },
+    { "vnet_offload", vnet_offload_test },
+    { "log_flusher", log_flusher_test },
     { "session_resume", session_resume_test },
     { "zero_rtt", zero_rtt_test },
     { "zero_rtt_loss", zero_rtt_loss_test },
     { "stop_sending", stop_sending_test },
     { "unidir", unidir_test },
     { "mtu_discovery", mtu_discovery_test },
+    { "pmtud", pmtud_test },
+    { "plugin_drr", plugin_drr_test },
+    { "plugin_swap", plugin_swap_test },
+    { "queue", queue_test },
+    { "queue_bench", queue_bench_test },
     { "spurious_retransmit", spurious_retransmit_test },
+    { "transport_stats", transport_stats_test },
 #if 0
     { "wrong_keyshare", wrong_keyshare_test },
 #endif
@@ -125,14 +180,158 @@ static const picoquic_test_def_t test_table[] = {
     { "random_tester", random_tester_test},
     { "cubic", cubic_test },
     { "stress", stress_test },
+    { "scale", scale_test },
     { "fuzz", fuzz_test },
     { "datagram_test", datagram_test },
     { "microbench_plugin_run_test", microbench_plugin_run_test },
+    { "slab_memory", slab_memory_test },
+    { "plugin_template", plugin_template_test },
+    { "getset_fields", getset_fields_test },
+    { "delivery_rate", delivery_rate_test },
+    { "hystart_pp_unit", hystart_pp_unit_test },
+    { "ledbat_unit", ledbat_unit_test },
+    { "prague_unit", prague_unit_test },
+    { "cc_undo", cc_undo_test },
+    { "plugin_metadata", plugin_metadata_test },
+    { "plugin_record", plugin_record_test },
+    { "plugin_private", plugin_private_test },
+    { "plugin_async", plugin_async_test },
+    { "logging_active", logging_active_test },
+    { "packet_pool", packet_pool_test },
+    { "retransmit_index", retransmit_index_test },
+    { "loss_threshold", loss_threshold_test },
+    { "pto", pto_test },
+    { "pacing_offload", pacing_offload_test },
+    { "pacing_train", pacing_train_test },
+    { "stream_ready", stream_ready_test },
+    { "stream_scheduler", stream_scheduler_test },
+    { "stream_recv", stream_recv_test },
+    { "stream_buffer", stream_buffer_test },
+    { "max_stream_data", max_stream_data_test },
+    { "stream_batch", stream_batch_test },
+    { "wake_heap", wake_heap_test },
+    { "wake_heap_bench", wake_heap_bench_test },
+    { "cnx_layout", cnx_layout_test },
+    { "cnx_layout_bench", cnx_layout_bench_test },
+    { "stateless_ring", stateless_ring_test },
+    { "memory_stats", memory_stats_test },
+    { "object_cache", object_cache_test },
+    { "hibernation", hibernation_test },
+    { "frame_dispatch", frame_dispatch_test },
+    { "ack_frequency", ack_frequency_test },
+    { "immediate_ack", immediate_ack_test },
+    { "pluglet_image_imports", pluglet_image_imports_test },
+    { "pluglet_bound_checks", pluglet_bound_checks_test },
+    { "pluglet_threaded", pluglet_threaded_test },
+    { "pluglet_threaded_getset", pluglet_threaded_getset_test },
+    { "gf256_region", gf256_region_test },
+    { "fec_bench", fec_bench_test },
     { "split_stream_frame_test", split_stream_frame_test}
 };
 
 static size_t const nb_tests = sizeof(test_table) / sizeof(picoquic_test_def_t);
 
+typedef struct st_picoquic_bench_def_t {
+    char const* bench_name;
+    int (*bench_fn)(picoquic_bench_result_t* result);
+} picoquic_bench_def_t;
+
+static const picoquic_bench_def_t bench_table[] = {
+    { "bulk", bulk_bench },
+    { "small_streams", small_streams_bench },
+    { "handshake_storm", handshake_storm_bench },
+    { "lossy_link", lossy_link_bench },
+    { "multipath", multipath_bench },
+    { "fec", fec_bench }
+};
+
+static size_t const nb_benchs = sizeof(bench_table) / sizeof(picoquic_bench_def_t);
+
+static int get_bench_number(char const* bench_name)
+{
+    int bench_number = -1;
+
+    for (size_t i = 0; i < nb_benchs; i++) {
+        if (strcmp(bench_name, bench_table[i].bench_name) == 0) {
+            bench_number = (int)i;
+        }
+    }
+
+    return bench_number;
+}
+
+/* A value per transferred megabyte, or null when nothing was transferred */
+static void print_bench_per_mb(FILE* F, char const* name, uint64_t value, uint64_t bytes)
+{
+    if (bytes == 0) {
+        fprintf(F, ", \"%s\": null", name);
+    } else {
+        fprintf(F, ", \"%s\": %.3f", name, (double)value * 1000000.0 / (double)bytes);
+    }
+}
+
+static int do_one_bench(size_t i, FILE* F, int is_first)
+{
+    picoquic_bench_result_t result;
+    int ret;
+
+    memset(&result, 0, sizeof(result));
+    ret = bench_table[i].bench_fn(&result);
+
+    fprintf(F, "%s\n    { \"name\": \"%s\", \"status\": \"%s\"", (is_first) ? "" : ",",
+        bench_table[i].bench_name, (ret == 0) ? "success" : "failed");
+    fprintf(F, ", \"bytes\": %" PRIu64 ", \"connections\": %" PRIu64, result.bytes, result.nb_connections);
+    fprintf(F, ", \"simulated_time_us\": %" PRIu64 ", \"wall_time_us\": %" PRIu64 ", \"cpu_time_us\": %" PRIu64,
+        result.simulated_time, result.wall_time, result.cpu_time);
+    fprintf(F, ", \"packets\": %" PRIu64 ", \"allocations\": %" PRIu64, result.nb_packets, result.nb_allocations);
+    if (result.simulated_time == 0) {
+        fprintf(F, ", \"goodput_mbps\": null");
+    } else {
+        fprintf(F, ", \"goodput_mbps\": %.3f", (double)result.bytes * 8.0 / (double)result.simulated_time);
+    }
+    print_bench_per_mb(F, "cpu_us_per_mb", result.cpu_time, result.bytes);
+    print_bench_per_mb(F, "packets_per_mb", result.nb_packets, result.bytes);
+    print_bench_per_mb(F, "allocations_per_mb", result.nb_allocations, result.bytes);
+    fprintf(F, " }");
+    fflush(F);
+
+    return ret;
+}
+
+/* Runs the named benchmarks, or all of them, and prints the results as one JSON object */
+static int do_benchs(int nb_names, char** names, FILE* F)
+{
+    int ret = 0;
+    int is_first = 1;
+
+    for (int i = 0; i < nb_names; i++) {
+        if (get_bench_number(names[i]) < 0) {
+            fprintf(stderr, "Incorrect benchmark name: %s\n", names[i]);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        fprintf(F, "{ \"benchmarks\": [");
+        for (size_t i = 0; i < nb_benchs; i++) {
+            int selected = (nb_names == 0);
+
+            for (int j = 0; !selected && j < nb_names; j++) {
+                selected = (strcmp(names[j], bench_table[i].bench_name) == 0);
+            }
+            if (selected) {
+                if (do_one_bench(i, F, is_first) != 0) {
+                    ret = -1;
+                }
+                is_first = 0;
+            }
+        }
+        fprintf(F, "\n] }\n");
+    }
+
+    return ret;
+}
+
 static int do_one_test(size_t i, FILE* F)
 {
     int ret = 0;
@@ -164,6 +363,7 @@ int usage(char const * argv0)
     fprintf(stderr, "Usage: picoquic_ct [-x <excluded>] [<list of tests]\n");
     fprintf(stderr, "\nUsage: %s [test1 [test2 ..[testN]]]\n\n", argv0);
     fprintf(stderr, "   Or: %s [-x test]*", argv0);
+    fprintf(stderr, "\n   Or: %s -b [bench1 [bench2 ..[benchN]]]\n\n", argv0);
     fprintf(stderr, "Valid test names are: \n");
     for (size_t x = 0; x < nb_tests; x++) {
         fprintf(stderr, "    ");
@@ -173,10 +373,18 @@ int usage(char const * argv0)
         }
         fprintf(stderr, "\n");
     }
+    fprintf(stderr, "Valid benchmark names are: \n    ");
+    for (size_t x = 0; x < nb_benchs; x++) {
+        fprintf(stderr, "%s, ", bench_table[x].bench_name);
+    }
+    fprintf(stderr, "\n");
     fprintf(stderr, "Options: \n");
     fprintf(stderr, "  -x test        Do not run the specified test.\n");
     fprintf(stderr, "  -s nnn         Run stress for nnn minutes.\n");
     fprintf(stderr, "  -f nnn         Run fuzz for nnn minutes.\n");
+    fprintf(stderr, "  -c nnn         Run scale with up to nnn connections.\n");
+    fprintf(stderr, "  -r nnn         Replace nnn connections per second in scale.\n");
+    fprintf(stderr, "  -b             Run the benchmarks and print their results as JSON.\n");
     fprintf(stderr, "  -n             Disable debug prints.\n");
     fprintf(stderr, "  -h             Print this help message\n");
 
@@ -208,6 +416,7 @@ int main(int argc, char** argv)
     int do_fuzz = 0;
     int do_stress = 0;
     int disable_debug = 0;
+    int do_bench = 0;
 
     if (test_status == NULL)
     {
@@ -216,7 +425,7 @@ int main(int argc, char** argv)
     }
     else
     {
-        while (ret == 0 && (opt = getopt(argc, argv, "f:s:x:nh")) != -1) {
+        while (ret == 0 && (opt = getopt(argc, argv, "c:f:r:s:x:bnh")) != -1) {
             switch (opt) {
             case 'x': {
                 int test_number = get_test_number(optarg);
@@ -247,6 +456,25 @@ int main(int argc, char** argv)
                     ret = usage(argv[0]);
                 }
                 break;
+            case 'c':
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "Incorrect number of connections: %s\n", optarg);
+                    ret = usage(argv[0]);
+                } else {
+                    picoquic_scale_nb_connections = (size_t)atoi(optarg);
+                }
+                break;
+            case 'r':
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "Incorrect churn rate: %s\n", optarg);
+                    ret = usage(argv[0]);
+                } else {
+                    picoquic_scale_churn_per_second = (uint64_t)atoi(optarg);
+                }
+                break;
+            case 'b':
+                do_bench = 1;
+                break;
             case 'n':
                 disable_debug = 1;
                 break;
@@ -264,6 +492,13 @@ int main(int argc, char** argv)
             debug_printf_suspend();
         }
 
+        if (ret == 0 && do_bench) {
+            ret = do_benchs(argc - optind, argv + optind, stdout);
+            if (ret != 0) {
+                fprintf(stderr, "Some benchmarks failed.\n");
+            }
+        }
+
         if (ret == 0 && stress_minutes > 0) {
             if (optind >= argc && found_exclusion == 0) {
                 for (size_t i = 0; i < nb_tests; i++) {
@@ -286,7 +521,7 @@ int main(int argc, char** argv)
             }
         }
 
-        if (ret == 0)
+        if (ret == 0 && do_bench == 0)
         {
             if (optind >= argc) {
                 for (size_t i = 0; i < nb_tests; i++) {
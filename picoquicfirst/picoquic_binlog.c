@@ -0,0 +1,70 @@
+/*
+ * Decodes the binary packet trace written with picoquic_set_binary_log() into the text packet log,
+ * using the frame decoders of logger.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WINDOWS
+#include "getopt.h"
+#else
+#include <unistd.h>
+#endif
+#include "picoquic_internal.h"
+
+static void usage(char const* name)
+{
+    fprintf(stderr, "Usage: %s [-t] trace.bin [output.log]\n", name);
+    fprintf(stderr, "  -t                    Print the time of each packet, relative to the first one\n");
+    fprintf(stderr, "The log is written to stdout if no output file is given.\n");
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    int log_time = 0;
+    int opt;
+    int nb_packets;
+    FILE* F_trace;
+    FILE* F = stdout;
+
+    while ((opt = getopt(argc, argv, "th")) != -1) {
+        switch (opt) {
+        case 't':
+            log_time = 1;
+            break;
+        default:
+            usage(argv[0]);
+            break;
+        }
+    }
+
+    if (optind >= argc || argc - optind > 2) {
+        usage(argv[0]);
+    }
+
+    if ((F_trace = fopen(argv[optind], "rb")) == NULL) {
+        fprintf(stderr, "Could not open the trace file <%s>\n", argv[optind]);
+        return 1;
+    }
+    if (argc - optind == 2 && (F = fopen(argv[optind + 1], "w")) == NULL) {
+        fprintf(stderr, "Could not open the log file <%s>\n", argv[optind + 1]);
+        fclose(F_trace);
+        return 1;
+    }
+
+    nb_packets = picoquic_log_binary_trace(F_trace, F, log_time);
+    if (nb_packets < 0) {
+        fprintf(stderr, "The trace <%s> is truncated or corrupted\n", argv[optind]);
+    } else {
+        fprintf(stderr, "%d packets decoded\n", nb_packets);
+    }
+
+    fclose(F_trace);
+    if (F != stdout) {
+        fclose(F);
+    }
+
+    return (nb_packets < 0) ? 1 : 0;
+}
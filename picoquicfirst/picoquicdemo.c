@@ -109,10 +109,12 @@ static char* ticket_store_filename = "demo_ticket_store.bin";
 #include "picosplay.h"
 #include "picoquic_internal.h"
 #include "picosocks.h"
+#include "picoxdp.h"
 #include "util.h"
 #include "h3zero.c"
 #include "democlient.h"
 #include "demoserver.h"
+#include "demoload.h"
 
 void print_address(struct sockaddr* address, char* label, picoquic_connection_id_t cnx_id)
 {
@@ -133,8 +135,52 @@ void print_address(struct sockaddr* address, char* label, picoquic_connection_id
 }
 
 #define PICOQUIC_DEMO_MAX_PLUGIN_FILES 64
+#define PICOQUIC_DEMO_PLUGIN_PREWARM_DEPTH 4
+#define PICOQUIC_DEMO_PLUGIN_PRELOAD_THREADS 4
+#define PICOQUIC_DEMO_SERVER_BURST 8 /* Datagrams received or prepared at once */
+#define PICOQUIC_DEMO_DATAGRAM_SIZE PICOQUIC_MAX_JUMBO_PACKET_SIZE /* Room for the jumbo packets of -m */
+#define PICOQUIC_DEMO_LOG_CHUNKS 256 /* 1 MB of logs waiting for the disk */
+#define PICOQUIC_DEMO_TOMBSTONES 1024 /* Closed connections answered without their context */
+#define PICOQUIC_DEMO_METRICS_INTERVAL 1000000 /* Microseconds between two writes of the server metrics */
+#define PICOQUIC_DEMO_METRICS_SIZE 32768
+#define PICOQUIC_DEMO_BINLOG_BUFFER 0x100000 /* The binary packet trace reaches the disk by 1 MB writes */
+#define PICOQUIC_DEMO_BUSY_POLL_USEC 50 /* Time the kernel polls the device queue for a receive, with -Y */
 
 static protoop_id_t set_qlog_file = { .id = "set_qlog_file" };
+static protoop_id_t set_qlog_binary_file = { .id = "set_qlog_binary_file" };
+
+/* A trace named *.bin is written in the binary format of the qlog plugin, see qlog_convert.py */
+static protoop_id_t *qlog_file_protoop(const char *qlog_filename) {
+    size_t len = strlen(qlog_filename);
+    if (len > 4 && strcmp(qlog_filename + len - 4, ".bin") == 0) {
+        return &set_qlog_binary_file;
+    }
+    return &set_qlog_file;
+}
+
+/* The file is replaced at once, so that a scraper never reads it half written */
+static void write_server_metrics(picoquic_server_metrics_t *metrics, const char *filename) {
+    picoquic_server_metrics_shared_t snapshot;
+    char tmp_filename[512];
+    char *text = malloc(PICOQUIC_DEMO_METRICS_SIZE);
+    int len;
+    FILE *out;
+
+    if (text == NULL) {
+        return;
+    }
+    picoquic_server_metrics_snapshot(metrics, &snapshot);
+    len = picoquic_server_metrics_format(&snapshot, "pquic_server_", text, PICOQUIC_DEMO_METRICS_SIZE);
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+    if (len > 0 && (out = fopen(tmp_filename, "w")) != NULL) {
+        fwrite(text, 1, (size_t)len, out);
+        fclose(out);
+        if (rename(tmp_filename, filename) != 0) {
+            fprintf(stderr, "impossible to write server metrics on file %s\n", filename);
+        }
+    }
+    free(text);
+}
 
 static void write_stats(picoquic_cnx_t *cnx, char *filename) {
     if (!filename) return;
@@ -180,6 +226,18 @@ static void write_stats(picoquic_cnx_t *cnx, char *filename) {
             double average_execution_time = stats[i].count ? (((double) stats[i].total_execution_time)/((double) stats[i].count)) : 0;
             snprintf(buf, size-1, "%s, (avg=%fms, tot=%fms)", str, average_execution_time/1000, ((double) stats[i].total_execution_time)/1000);
             strncpy(str, buf, size-1);
+            /* The p99 is the upper bound of the histogram bucket holding it */
+            uint64_t p99_rank = stats[i].sampled_count - stats[i].sampled_count / 100;
+            uint64_t seen = 0;
+            int p99_bucket = 0;
+            while (p99_bucket < PLUGIN_STAT_LATENCY_BUCKETS - 1 && (seen += stats[i].latency_histogram[p99_bucket]) < p99_rank) {
+                p99_bucket++;
+            }
+            snprintf(buf, size-1, "%s, (max=%" PRIu64 "ns, p99<%" PRIu64 "ns, %" PRIu64 " timed)", str, stats[i].max_execution_time,
+                (uint64_t) 1 << (p99_bucket + 1), stats[i].sampled_count);
+            strncpy(str, buf, size-1);
+            snprintf(buf, size-1, "%s, (%" PRIu32 "/%" PRIu32 " bound checks elidable)", str, stats[i].elidable_checks, stats[i].memory_accesses);
+            strncpy(str, buf, size-1);
             fprintf(out, "%s\n", str);
         }
     }
@@ -191,9 +249,11 @@ int quic_server(const char* server_name, int server_port,
     const char* pem_cert, const char* pem_key,
     int just_once, int do_hrr, cnx_id_cb_fn cnx_id_callback,
     void* cnx_id_callback_ctx, uint8_t reset_seed[PICOQUIC_RESET_SECRET_SIZE],
-    int mtu_max, const char** local_plugin_fnames, int local_plugins,
+    int mtu_max, uint64_t pacing_offload_horizon, uint64_t spin_budget, int use_uring, const char* xdp_interface, picoquic_congestion_algorithm_t const* cc_algorithm,
+    const char** local_plugin_fnames, int local_plugins,
     const char** both_plugin_fnames, int both_plugins, FILE *F_log, FILE *F_tls_secrets, char *qlog_filename,
-    char *stats_filename, bool preload_plugins, const char *web_folder)
+    char *stats_filename, const char *metrics_filename, const char *binlog_filename, bool preload_plugins, const char *web_folder,
+    h3zero_settings_t const* qpack_settings)
 {
     /* Start: start the QUIC process with cert and key files */
     int ret = 0;
@@ -202,16 +262,21 @@ int quic_server(const char* server_name, int server_port,
     picoquic_cnx_t* cnx_next = NULL;
     picoquic_path_t* path = NULL;
     picoquic_server_sockets_t server_sockets;
-    struct sockaddr_storage addr_from;
-    struct sockaddr_storage addr_to;
-    unsigned long if_index_to;
+    picoquic_event_loop_t* event_loop = NULL;
+    picoquic_uring_t* uring = NULL;
+    picoquic_xdp_t* xdp = NULL;
+    uint8_t* prepare_buffer = NULL;
     struct sockaddr_storage client_from;
-    socklen_t from_length;
-    socklen_t to_length;
-    uint8_t buffer[1536];
-    uint8_t send_buffer[1536];
+    picoquic_recv_datagram_t datagrams[PICOQUIC_DEMO_SERVER_BURST];
+    uint8_t buffer[PICOQUIC_DEMO_SERVER_BURST * PICOQUIC_DEMO_DATAGRAM_SIZE];
+    uint8_t send_buffer[PICOQUIC_DEMO_SERVER_BURST * PICOQUIC_DEMO_DATAGRAM_SIZE];
+    size_t segment_lengths[PICOQUIC_DEMO_SERVER_BURST];
+    size_t nb_segments = 0;
     size_t send_length = 0;
     picoquic_stateless_packet_t* sp;
+    picoquic_server_metrics_t* server_metrics = NULL;
+    FILE* F_binlog = NULL;
+    uint64_t next_metrics_time = 0;
     int64_t delay_max = 10000000;
     int new_context_created = 0;
     int qlog_fd = -1;
@@ -219,10 +284,23 @@ int quic_server(const char* server_name, int server_port,
     picohttp_server_parameters_t picoquic_file_param;
     memset(&picoquic_file_param, 0, sizeof(picohttp_server_parameters_t));
     picoquic_file_param.web_folder = web_folder;
+    picoquic_file_param.qpack_settings = *qpack_settings;
+    if (web_folder != NULL) {
+        /* The files are mapped once for all the connections */
+        picoquic_file_param.file_cache = picohttp_file_cache_create(PICOHTTP_FILE_CACHE_IDLE_MAX);
+    }
 
     /* Open a UDP socket */
     ret = picoquic_open_server_sockets(&server_sockets, server_port);
 
+    /* Register them once to the event loop */
+    if (ret == 0 && (event_loop = picoquic_event_loop_create()) == NULL) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < PICOQUIC_NB_SERVER_SOCKETS; i++) {
+        ret = picoquic_event_loop_add(event_loop, server_sockets.s_socket[i]);
+    }
+
     /* Wait for packets and process them */
     if (ret == 0) {
         /* Create QUIC context */
@@ -238,9 +316,82 @@ int quic_server(const char* server_name, int server_port,
                 picoquic_set_cookie_mode(qserver, 1);
             }
             qserver->mtu_max = mtu_max;
+            if (mtu_max > PICOQUIC_MAX_PACKET_SIZE) {
+                (void)picoquic_set_max_packet_size(qserver, (uint32_t)mtu_max);
+            }
+            /* A pacing decision for each batch of datagrams sent at once */
+            picoquic_set_pacing_burst(qserver, PICOQUIC_DEMO_SERVER_BURST);
+            picoquic_set_tombstones(qserver, PICOQUIC_DEMO_TOMBSTONES);
+            if (cc_algorithm != NULL) {
+                picoquic_set_default_congestion_algorithm(qserver, cc_algorithm);
+            }
+            if (pacing_offload_horizon > 0) {
+                /* Without SO_TXTIME, the datagrams would leave unpaced */
+                if (picoquic_enable_server_sockets_txtime(&server_sockets) == 0) {
+                    picoquic_set_pacing_offload(qserver, pacing_offload_horizon);
+                } else {
+                    printf("Cannot set SO_TXTIME, pacing is not offloaded\n");
+                }
+            }
+            /* The RTT is measured from the arrival of the datagrams in the kernel, if it timestamps them */
+            (void)picoquic_enable_server_sockets_rx_timestamps(&server_sockets);
+            /* The loop refreshes the cached time of the context when it returns */
+            picoquic_event_loop_set_quic(event_loop, qserver);
+            if (spin_budget > 0 && picoquic_event_loop_set_busy_poll(event_loop, spin_budget, PICOQUIC_DEMO_BUSY_POLL_USEC) != 0) {
+                printf("Cannot set SO_BUSY_POLL, spinning in user space only\n");
+            }
+            if (use_uring) {
+                /* The packets are then prepared in the send buffers of the ring */
+                uring = picoquic_uring_create(server_sockets.s_socket, PICOQUIC_NB_SERVER_SOCKETS,
+                    PICOQUIC_DEMO_DATAGRAM_SIZE, sizeof(send_buffer));
+                if (uring == NULL) {
+                    printf("Cannot use io_uring, using the event loop\n");
+                } else {
+                    picoquic_uring_set_quic(uring, qserver);
+                }
+            }
+            if (xdp_interface != NULL) {
+                /* The interface name, then the receive queue after a colon */
+                char ifname[64];
+                char const* colon = strchr(xdp_interface, ':');
+                size_t name_length = (colon != NULL) ? (size_t)(colon - xdp_interface) : strlen(xdp_interface);
+
+                if (name_length >= sizeof(ifname)) {
+                    name_length = sizeof(ifname) - 1;
+                }
+                memcpy(ifname, xdp_interface, name_length);
+                ifname[name_length] = 0;
+                xdp = picoquic_xdp_create(ifname, (colon != NULL) ? atoi(colon + 1) : 0, server_port, 0);
+                if (xdp == NULL) {
+                    printf("Cannot use AF_XDP on %s, using the sockets\n", xdp_interface);
+                } else {
+                    picoquic_xdp_set_quic(xdp, qserver);
+                }
+            }
             /* TODO: add log level, to reduce size in "normal" cases */
             PICOQUIC_SET_LOG(qserver, F_log);
+            /* The server loop does not wait for the disk, the logs and binary qlogs are written by another thread */
+            if (F_log != NULL && F_log != stdout && picoquic_set_log_flusher(qserver, PICOQUIC_DEMO_LOG_CHUNKS) == 0) {
+                F_log = (FILE*)qserver->F_log;
+            }
             PICOQUIC_SET_TLS_SECRETS_LOG(qserver, F_tls_secrets);
+            if (binlog_filename != NULL) {
+                if ((F_binlog = fopen(binlog_filename, "wb")) == NULL) {
+                    fprintf(stderr, "Could not open the packet trace file <%s>\n", binlog_filename);
+                    ret = -1;
+                } else {
+                    setvbuf(F_binlog, NULL, _IOFBF, PICOQUIC_DEMO_BINLOG_BUFFER);
+                    picoquic_set_binary_log(qserver, F_binlog);
+                }
+            }
+            /* Filled by the monitoring plugin as the connections close */
+            if (metrics_filename != NULL) {
+                if ((server_metrics = picoquic_server_metrics_create(NULL)) == NULL) {
+                    ret = -1;
+                } else {
+                    picoquic_set_server_metrics(qserver, server_metrics);
+                }
+            }
 
             /* As we currently do not modify plugins to inject yet, we can store it in the quic structure */
             if (ret == 0 && (ret = picoquic_set_plugins_to_inject(qserver, both_plugin_fnames, both_plugins)) != 0) {
@@ -254,19 +405,12 @@ int quic_server(const char* server_name, int server_port,
 
 
     if (ret == 0 && preload_plugins) {
-        // pre-load a mock connection and insert the plugins
-        picoquic_connection_id_t dst;
-        dst.id_len = 4;
-        picoquic_connection_id_t src;
-        src.id_len = 4;
-        struct sockaddr_storage a;
-        picoquic_cnx_t *tmp_cnx = picoquic_create_cnx(qserver, dst, src, (struct sockaddr *) &a, picoquic_current_time(), 0xff00000b, NULL, NULL, 0);
-
-        if (local_plugins > 0) {
-            plugin_insert_plugins_from_fnames(tmp_cnx, local_plugins, (char **) local_plugin_fnames);
+        /* Read all the pluglets in parallel, then prepare instances of the local plugins now, and refill them while idle */
+        if (picoquic_preload_plugins(qserver, PICOQUIC_DEMO_PLUGIN_PRELOAD_THREADS) < 0) {
+            fprintf(stderr, "Cannot preload the plugins, they are read when needed\n");
         }
-
-        picoquic_delete_cnx(tmp_cnx);
+        picoquic_set_plugin_prewarm_depth(qserver, PICOQUIC_DEMO_PLUGIN_PREWARM_DEPTH);
+        picoquic_prewarm_plugins(qserver, PICOQUIC_DEMO_PLUGIN_PREWARM_DEPTH);
     }
 
 
@@ -275,71 +419,93 @@ int quic_server(const char* server_name, int server_port,
         uint64_t time_before = picoquic_current_time();
         uint64_t current_time = picoquic_current_time();
         int64_t delta_t = picoquic_get_next_wake_delay(qserver, picoquic_current_time(), delay_max);
-        int bytes_recv;
-
-        from_length = to_length = sizeof(struct sockaddr_storage);
-        if_index_to = 0;
+        int nb_datagrams;
 
         if (just_once != 0 && delta_t > 10000 && cnx_server != NULL) {
             picoquic_log_congestion_state(F_log, cnx_server, picoquic_current_time());
         }
 
-        bytes_recv = picoquic_select(server_sockets.s_socket, PICOQUIC_NB_SERVER_SOCKETS,
-            &addr_from, &from_length,
-            &addr_to, &to_length, &if_index_to,
-            buffer, sizeof(buffer),
-            delta_t, &current_time,
-            qserver);
+        if (xdp != NULL) {
+            nb_datagrams = picoquic_xdp_recv_batch(xdp, datagrams, PICOQUIC_DEMO_SERVER_BURST, delta_t, &current_time);
+        } else if (uring != NULL) {
+            nb_datagrams = picoquic_uring_recv_batch(uring, datagrams, PICOQUIC_DEMO_SERVER_BURST, delta_t, &current_time);
+        } else {
+            nb_datagrams = picoquic_event_loop_recv_batch(event_loop,
+                datagrams, PICOQUIC_DEMO_SERVER_BURST, buffer, PICOQUIC_DEMO_DATAGRAM_SIZE,
+                delta_t, &current_time);
+        }
 
         if (just_once != 0) {
-            if (bytes_recv > 0) {
-                printf("Select returns %d, from length %u after %d us (wait for %d us)\n",
-                    bytes_recv, from_length, (int)(current_time - time_before), (int)delta_t);
-                print_address((struct sockaddr*)&addr_from, "recv from:", picoquic_null_connection_id);
+            if (nb_datagrams > 0) {
+                printf("Select returns %d datagrams, first %d bytes from length %u after %d us (wait for %d us)\n",
+                    nb_datagrams, datagrams[0].length, datagrams[0].from_length, (int)(current_time - time_before), (int)delta_t);
+                print_address((struct sockaddr*)&datagrams[0].addr_from, "recv from:", picoquic_null_connection_id);
             } else {
-                printf("Select return %d, after %d us (wait for %d us)\n", bytes_recv,
+                printf("Select return %d, after %d us (wait for %d us)\n", nb_datagrams,
                     (int)(current_time - time_before), (int)delta_t);
             }
         }
 
-        if (bytes_recv < 0) {
+        if (server_metrics != NULL && current_time >= next_metrics_time) {
+            write_server_metrics(server_metrics, metrics_filename);
+            next_metrics_time = current_time + PICOQUIC_DEMO_METRICS_INTERVAL;
+        }
+
+        if (nb_datagrams < 0) {
             ret = -1;
         } else {
-            if (bytes_recv > 0) {
-                /* Submit the packet to the server */
-                ret = picoquic_incoming_packet(qserver, buffer,
-                    (size_t)bytes_recv, (struct sockaddr*)&addr_from,
-                    (struct sockaddr*)&addr_to, if_index_to,
-                    current_time, &new_context_created);
-
-                if (ret != 0) {
-                    ret = 0;
-                }
+            /* Submit the whole batch to the server before preparing the packets to send */
+            for (int i = 0; i < nb_datagrams; i++) {
+                picoquic_recv_datagram_t* d = &datagrams[i];
+                int segment_size = (d->segment_size > 0) ? d->segment_size : d->length;
+
+                qserver->rcv_socket = d->socket;
+                qserver->rcv_tos = d->tos;
+                for (int offset = 0; offset < d->length; offset += segment_size) {
+                    size_t length = (d->length - offset < segment_size) ? d->length - offset : segment_size;
+
+                    qserver->rcv_time = d->rcv_time;
+                    ret = picoquic_incoming_packet(qserver, d->bytes + offset,
+                        length, (struct sockaddr*)&d->addr_from,
+                        (struct sockaddr*)&d->addr_dest, d->dest_if,
+                        current_time, &new_context_created);
+
+                    if (ret != 0) {
+                        ret = 0;
+                    }
 
-                if (new_context_created) {
-                    cnx_server = picoquic_get_first_cnx(qserver);
+                    if (new_context_created) {
+                        cnx_server = picoquic_get_first_cnx(qserver);
 
-                    if (qlog_filename) {
-                        qlog_fd = open(qlog_filename, O_WRONLY | O_CREAT | O_TRUNC, 00755);
-                        if (qlog_fd != -1) {
-                            protoop_prepare_and_run_extern_noparam(cnx_server, &set_qlog_file, NULL, qlog_fd);
-                        } else {
-                            perror("qlog_fd");
+                        if (qlog_filename) {
+                            qlog_fd = open(qlog_filename, O_WRONLY | O_CREAT | O_TRUNC, 00755);
+                            if (qlog_fd != -1) {
+                                protoop_prepare_and_run_extern_noparam(cnx_server, qlog_file_protoop(qlog_filename), NULL, qlog_fd);
+                            } else {
+                                perror("qlog_fd");
+                            }
                         }
-                    }
 
-                    printf("%" PRIx64 ": ", picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx_server)));
-                    picoquic_log_time(stdout, cnx_server, picoquic_current_time(), "", " : ");
-                    printf("Connection established, state = %d, from length: %u\n",
-                        picoquic_get_cnx_state(picoquic_get_first_cnx(qserver)), from_length);
-                    memset(&client_from, 0, sizeof(client_from));
-                    memcpy(&client_from, &addr_from, from_length);
+                        printf("%" PRIx64 ": ", picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx_server)));
+                        picoquic_log_time(stdout, cnx_server, picoquic_current_time(), "", " : ");
+                        printf("Connection established, state = %d, from length: %u\n",
+                            picoquic_get_cnx_state(picoquic_get_first_cnx(qserver)), d->from_length);
+                        memset(&client_from, 0, sizeof(client_from));
+                        memcpy(&client_from, &d->addr_from, d->from_length);
 
-                    print_address((struct sockaddr*)&client_from, "Client address:",
-                        picoquic_get_logging_cnxid(cnx_server));
-                    picoquic_log_transport_extension(stdout, cnx_server, 1);
+                        print_address((struct sockaddr*)&client_from, "Client address:",
+                            picoquic_get_logging_cnxid(cnx_server));
+                        picoquic_log_transport_extension(stdout, cnx_server, 1);
+                    }
                 }
             }
+
+            picoquic_notify_stream_batches(qserver);
+
+            if (nb_datagrams == 0 && preload_plugins) {
+                /* Nothing received before the timer, use the time to replace the consumed plugin instances */
+                picoquic_prewarm_plugins(qserver, 1);
+            }
             if (ret == 0) {
                 uint64_t loop_time = picoquic_current_time();
 
@@ -360,8 +526,17 @@ int quic_server(const char* server_name, int server_port,
                 }
 
                 while (ret == 0 && (cnx_next = picoquic_get_earliest_cnx_to_wake(qserver, loop_time)) != NULL) {
-                    ret = picoquic_prepare_packet(cnx_next, picoquic_current_time(),
-                        send_buffer, sizeof(send_buffer), &send_length, &path);
+                    /* Without a free buffer in the ring, this send goes through the socket */
+                    if (xdp != NULL) {
+                        /* A frame holds a single datagram */
+                        prepare_buffer = picoquic_xdp_get_send_buffer(xdp);
+                    } else {
+                        prepare_buffer = (uring != NULL) ? picoquic_uring_get_send_buffer(uring) : NULL;
+                    }
+                    ret = picoquic_prepare_packets(cnx_next, picoquic_current_time(),
+                        (prepare_buffer != NULL) ? prepare_buffer : send_buffer,
+                        (xdp != NULL && prepare_buffer != NULL) ? PICOQUIC_XDP_MAX_PAYLOAD : sizeof(send_buffer),
+                        segment_lengths, (xdp != NULL && prepare_buffer != NULL) ? 1 : PICOQUIC_DEMO_SERVER_BURST, &nb_segments, &path);
 
                     if (ret == PICOQUIC_ERROR_DISCONNECTED) {
                         ret = 0;
@@ -373,6 +548,7 @@ int quic_server(const char* server_name, int server_port,
                             (int)cnx_next->path[0]->max_reorder_gap, (int)cnx_next->path[0]->max_spurious_rtt);
 
                         if (qlog_fd != -1) {
+                            picoquic_wait_log_flusher(qserver);
                             close(qlog_fd);
                         }
 
@@ -390,7 +566,7 @@ int quic_server(const char* server_name, int server_port,
                         int local_addr_len = 0;
                         struct sockaddr* local_addr;
 
-                        if (send_length > 0) {
+                        if (nb_segments > 0) {
                             if (just_once != 0 ||
                                 cnx_next->cnx_state < picoquic_state_client_ready ||
                                 cnx_next->cnx_state >= picoquic_state_disconnecting) {
@@ -411,10 +587,24 @@ int quic_server(const char* server_name, int server_port,
 #endif
                             picoquic_before_sending_packet(cnx_next, server_sockets.s_socket[socket_index]);
 
-                            (void)picoquic_send_through_server_sockets(&server_sockets,
-                                peer_addr, peer_addr_len, local_addr, local_addr_len,
-                                picoquic_get_local_if_index(path),
-                                (const char*)send_buffer, (int)send_length);
+                            send_length = 0;
+                            for (size_t i = 0; i < nb_segments; i++) {
+                                send_length += segment_lengths[i];
+                            }
+                            if (prepare_buffer != NULL && xdp != NULL) {
+                                (void)picoquic_xdp_queue_send(xdp, peer_addr, local_addr, (int)send_length);
+                            } else if (prepare_buffer != NULL) {
+                                (void)picoquic_uring_queue_send(uring, server_sockets.s_socket[socket_index],
+                                    peer_addr, peer_addr_len, local_addr, local_addr_len,
+                                    picoquic_get_local_if_index(path), (int)send_length, (int)segment_lengths[0],
+                                    server_sockets.txtime_enabled[socket_index] ? picoquic_get_departure_time(path) : 0);
+                            } else {
+                                (void)picoquic_send_segments_through_server_sockets(&server_sockets,
+                                    peer_addr, peer_addr_len, local_addr, local_addr_len,
+                                    picoquic_get_local_if_index(path),
+                                    (const char*)send_buffer, (int)send_length, (int)segment_lengths[0],
+                                    picoquic_get_departure_time(path));
+                            }
 
                             /* TODO: log sending packet. */
                         } else {
@@ -432,10 +622,30 @@ int quic_server(const char* server_name, int server_port,
 
     /* Clean up */
     if (qserver != NULL) {
+        if (picoquic_get_log_flusher_drops(qserver) > 0) {
+            printf("%" PRIu64 " chunks of logs were dropped\n", picoquic_get_log_flusher_drops(qserver));
+        }
         picoquic_free(qserver);
     }
+    picohttp_file_cache_delete(picoquic_file_param.file_cache);
+    if (F_binlog != NULL) {
+        fclose(F_binlog);
+    }
+    if (server_metrics != NULL) {
+        write_server_metrics(server_metrics, metrics_filename);
+        picoquic_server_metrics_release(server_metrics);
+    }
 
+    if (xdp != NULL) {
+        picoquic_xdp_free(xdp);
+    }
+    if (event_loop != NULL) {
+        picoquic_event_loop_free(event_loop);
+    }
     picoquic_close_server_sockets(&server_sockets);
+    if (uring != NULL) {
+        picoquic_uring_free(uring);
+    }
 
     return ret;
 }
@@ -443,13 +653,97 @@ int quic_server(const char* server_name, int server_port,
 static const char * test_scenario_default = "0:index.html;4:test.html;8:/1234567;12:main.jpg;16:war-and-peace.txt;20:en/latest/;24:/file-123K";
 
 #define PICOQUIC_DEMO_CLIENT_MAX_RECEIVE_BATCH 4
+#define PICOQUIC_DEMO_CLIENT_SEND_BATCH 8
+
+/* Sends the packets of a batch, all on the same path, through the socket connected for the path */
+static int quic_client_flush_connected(picoquic_cnx_t* cnx_client, picoquic_connected_sockets_t* connected_sockets,
+    picoquic_path_t* path, uint8_t* send_buffer, size_t* send_lengths, int nb_packets, FILE* F_log)
+{
+    SOCKET_TYPE send_fd = picoquic_get_connected_socket(connected_sockets, cnx_client, path);
+    uint8_t* packets[PICOQUIC_DEMO_CLIENT_SEND_BATCH];
+    int nb_sent = 0;
+
+    for (int i = 0; i < nb_packets; i++) {
+        packets[i] = send_buffer + i * PICOQUIC_DEMO_DATAGRAM_SIZE;
+    }
+
+    if (send_fd != INVALID_SOCKET) {
+        for (int i = 0; i < nb_packets; i++) {
+            /* QDC: I hate having this line here... But it is the only place to hook before sending... */
+            picoquic_before_sending_packet(cnx_client, send_fd);
+        }
+        nb_sent = picoquic_send_connected(send_fd, packets, send_lengths, nb_packets);
+    } else {
+        /* Without a connected socket, the packets go through the initial one as usual */
+        int peer_addr_len = 0;
+        struct sockaddr* peer_addr;
+        int local_addr_len = 0;
+        struct sockaddr* local_addr;
+
+        send_fd = connected_sockets->initial_socket;
+        picoquic_get_peer_addr(path, &peer_addr, &peer_addr_len);
+        picoquic_get_local_addr(path, &local_addr, &local_addr_len);
+        for (int i = 0; i < nb_packets; i++) {
+            picoquic_before_sending_packet(cnx_client, send_fd);
+            if (picoquic_sendmsg(send_fd, peer_addr, peer_addr_len, local_addr, local_addr_len,
+                picoquic_get_local_if_index(path), (const char*)packets[i], (int)send_lengths[i]) > 0) {
+                nb_sent++;
+            }
+        }
+    }
+
+    for (int i = 0; i < nb_packets; i++) {
+        picoquic_log_packet_address(F_log,
+            picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx_client)),
+            cnx_client, (struct sockaddr*)&path->peer_addr, 0, (i < nb_sent) ? (int)send_lengths[i] : -1, picoquic_current_time());
+    }
+
+    return 0;
+}
+
+/* Prepares up to PICOQUIC_DEMO_CLIENT_SEND_BATCH packets, sent together when they are on the same path */
+static int quic_client_send_connected(picoquic_cnx_t* cnx_client, picoquic_connected_sockets_t* connected_sockets,
+    uint8_t* send_buffer, FILE* F_log)
+{
+    size_t send_lengths[PICOQUIC_DEMO_CLIENT_SEND_BATCH];
+    picoquic_path_t* batch_path = NULL;
+    int nb_packets = 0;
+    int ret = 0;
+
+    for (int i = 0; ret == 0 && i < PICOQUIC_DEMO_CLIENT_SEND_BATCH; i++) {
+        picoquic_path_t* path = NULL;
+        size_t send_length = 0;
+        uint8_t* bytes = send_buffer + nb_packets * PICOQUIC_DEMO_DATAGRAM_SIZE;
+
+        ret = picoquic_prepare_packet(cnx_client, picoquic_current_time(), bytes, PICOQUIC_DEMO_DATAGRAM_SIZE, &send_length, &path);
+        if (ret != 0 || send_length == 0) {
+            break;
+        }
+        if (nb_packets > 0 && path != batch_path) {
+            /* The new packet goes first in the next batch */
+            ret = quic_client_flush_connected(cnx_client, connected_sockets, batch_path, send_buffer, send_lengths, nb_packets, F_log);
+            memmove(send_buffer, bytes, send_length);
+            nb_packets = 0;
+        }
+        batch_path = path;
+        send_lengths[nb_packets++] = send_length;
+    }
+
+    if (ret == 0 && nb_packets > 0) {
+        ret = quic_client_flush_connected(cnx_client, connected_sockets, batch_path, send_buffer, send_lengths, nb_packets, F_log);
+    }
+
+    return ret;
+}
 
 int quic_client(const char* ip_address_text, int server_port, const char * sni, 
     const char * root_crt,
-    uint32_t proposed_version, int force_zero_share, int mtu_max, FILE* F_log, FILE* F_tls_secrets,
+    uint32_t proposed_version, int force_zero_share, int mtu_max,
+    picoquic_congestion_algorithm_t const* cc_algorithm, FILE* F_log, FILE* F_tls_secrets,
     const char** local_plugin_fnames, int local_plugins,
     char *qlog_filename, char *plugin_store_path, char *stats_filename,
-    char *alpn, char const * client_scenario_text, int no_disk, const char *out_dir)
+    char *alpn, char const * client_scenario_text, int no_disk, const char *out_dir, int use_local_sockets,
+    int use_connected_sockets, h3zero_settings_t const* qpack_settings)
 {
     /* Start: start the QUIC process with cert and key files */
     int ret = 0;
@@ -461,6 +755,11 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
     picoquic_demo_stream_desc_t * client_sc = NULL;
     char const* saved_alpn = NULL;
     SOCKET_TYPE fd = INVALID_SOCKET;
+    picoquic_local_sockets_t local_sockets;
+    picoquic_connected_sockets_t connected_sockets;
+    SOCKET_TYPE client_sockets[1 + PICOQUIC_MAX_LOCAL_SOCKETS + PICOQUIC_MAX_CONNECTED_SOCKETS];
+    int nb_client_sockets = 1;
+    int nb_wait_sockets = 1;
     struct sockaddr_storage server_address;
     struct sockaddr_storage packet_from;
     struct sockaddr_storage packet_to;
@@ -468,8 +767,8 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
     socklen_t from_length;
     socklen_t to_length;
     int server_addr_length = 0;
-    uint8_t buffer[1536];
-    uint8_t send_buffer[1536];
+    uint8_t buffer[PICOQUIC_DEMO_DATAGRAM_SIZE];
+    uint8_t send_buffer[PICOQUIC_DEMO_CLIENT_SEND_BATCH * PICOQUIC_DEMO_DATAGRAM_SIZE];
     size_t send_length = 0;
     int bytes_sent;
     uint64_t current_time = 0;
@@ -485,6 +784,8 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
     int qlog_fd = -1;
 
     memset(&callback_ctx, 0, sizeof(picoquic_demo_callback_ctx_t));
+    local_sockets.nb_sockets = 0;
+    picoquic_init_connected_sockets(&connected_sockets, INVALID_SOCKET);
 
     if (no_disk) {
         fprintf(stdout, "Files not saved to disk (-D, no_disk)\n");
@@ -503,6 +804,7 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
     else {
         ret = picoquic_demo_client_initialize_context(&callback_ctx, client_sc, client_sc_nb, alpn, no_disk, 0);
         callback_ctx.out_dir = out_dir;
+        callback_ctx.qpack_settings = *qpack_settings;
     }
 
     if (ret == 0) {
@@ -546,8 +848,23 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
     /* The IP_PKTINFO structure is not defined on BSD */
     ret = setsockopt(fd, IPPROTO_IP, IP_RECVDSTADDR, (char*)&val, sizeof(int));
 #endif
+    /* Without kernel timestamps, the RTT is measured when the loop reads the datagram */
+    (void)picoquic_enable_rx_timestamps(fd);
 #endif
 
+    /* The paths leaving from the other local addresses get their own socket */
+    client_sockets[0] = fd;
+    if (use_connected_sockets) {
+        picoquic_init_connected_sockets(&connected_sockets, fd);
+        fprintf(stdout, "Sending through a connected socket per path\n");
+    } else if (ret == 0 && use_local_sockets) {
+        int nb_local_sockets = picoquic_open_local_sockets(&local_sockets, 0);
+        for (int i = 0; i < nb_local_sockets; i++) {
+            client_sockets[nb_client_sockets++] = local_sockets.s_socket[i];
+        }
+        fprintf(stdout, "Opened %d local sockets\n", local_sockets.nb_sockets);
+    }
+
     /* Create QUIC context */
     current_time = picoquic_current_time();
     callback_ctx.last_interaction_time = current_time;
@@ -562,6 +879,12 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
                 qclient->flags |= picoquic_context_client_zero_share;
             }
             qclient->mtu_max = mtu_max;
+            if (mtu_max > PICOQUIC_MAX_PACKET_SIZE) {
+                (void)picoquic_set_max_packet_size(qclient, (uint32_t)mtu_max);
+            }
+            if (cc_algorithm != NULL) {
+                picoquic_set_default_congestion_algorithm(qclient, cc_algorithm);
+            }
 
             PICOQUIC_SET_LOG(qclient, F_log);
             PICOQUIC_SET_TLS_SECRETS_LOG(qclient, F_tls_secrets);
@@ -607,7 +930,7 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
             if (qlog_filename) {
                 qlog_fd = open(qlog_filename, O_WRONLY | O_CREAT | O_TRUNC, 00755);
                 if (qlog_fd != -1) {
-                    protoop_prepare_and_run_extern_noparam(cnx_client, &set_qlog_file, NULL, qlog_fd);
+                    protoop_prepare_and_run_extern_noparam(cnx_client, qlog_file_protoop(qlog_filename), NULL, qlog_fd);
                 } else {
                     perror("qlog_fd");
                 }
@@ -666,7 +989,12 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
         from_length = to_length = sizeof(struct sockaddr_storage);
 
         uint64_t select_time = picoquic_current_time();
-        bytes_recv = picoquic_select(&fd, 1, &packet_from, &from_length,
+        nb_wait_sockets = nb_client_sockets;
+        if (use_connected_sockets) {
+            nb_wait_sockets += picoquic_list_connected_sockets(&connected_sockets, client_sockets + nb_client_sockets,
+                PICOQUIC_MAX_CONNECTED_SOCKETS);
+        }
+        bytes_recv = picoquic_select(client_sockets, nb_wait_sockets, &packet_from, &from_length,
             &packet_to, &to_length, &if_index_to,
             buffer, sizeof(buffer),
             delta_t,
@@ -779,7 +1107,9 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
                     }
                 }
 
-                if (ret == 0) {
+                if (ret == 0 && use_connected_sockets) {
+                    ret = quic_client_send_connected(cnx_client, &connected_sockets, send_buffer, F_log);
+                } else if (ret == 0) {
                     send_length = PICOQUIC_MAX_PACKET_SIZE;
 
                     ret = picoquic_prepare_packet(cnx_client, picoquic_current_time(),
@@ -790,14 +1120,15 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
                         struct sockaddr* peer_addr;
                         int local_addr_len = 0;
                         struct sockaddr* local_addr;
+                        SOCKET_TYPE send_fd = picoquic_get_path_socket(&local_sockets, path, fd);
 
                         /* QDC: I hate having this line here... But it is the only place to hook before sending... */
-                        picoquic_before_sending_packet(cnx_client, fd);
+                        picoquic_before_sending_packet(cnx_client, send_fd);
 
                         picoquic_get_peer_addr(path, &peer_addr, &peer_addr_len);
                         picoquic_get_local_addr(path, &local_addr, &local_addr_len);
 
-                        bytes_sent = picoquic_sendmsg(fd, peer_addr, peer_addr_len, local_addr,
+                        bytes_sent = picoquic_sendmsg(send_fd, peer_addr, peer_addr_len, local_addr,
                             local_addr_len, picoquic_get_local_if_index(path),
                             (const char *) send_buffer, (int) send_length);
 
@@ -834,10 +1165,14 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
         picoquic_free(qclient);
     }
 
+    picoquic_close_connected_sockets(&connected_sockets);
+
     if (fd != INVALID_SOCKET) {
         SOCKET_CLOSE(fd);
     }
 
+    picoquic_close_local_sockets(&local_sockets);
+
     if (saved_alpn != NULL) {
         free((void *)saved_alpn);
         saved_alpn = NULL;
@@ -861,6 +1196,159 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
     return ret;
 }
 
+/* Runs the connections of the load from one socket, and prints their statistics once they are all done */
+int quic_load_client(const char* ip_address_text, int server_port, const char* root_crt,
+    int mtu_max, picoquic_congestion_algorithm_t const* cc_algorithm, FILE* F_log,
+    picohttp_load_params_t* load_params)
+{
+    int ret = 0;
+    picoquic_quic_t* qclient = NULL;
+    picohttp_load_ctx_t* load = NULL;
+    picoquic_cnx_t* cnx_next;
+    picoquic_path_t* path = NULL;
+    SOCKET_TYPE fd = INVALID_SOCKET;
+    struct sockaddr_storage server_address;
+    struct sockaddr_storage packet_from;
+    struct sockaddr_storage packet_to;
+    unsigned long if_index_to;
+    socklen_t from_length;
+    socklen_t to_length;
+    int server_addr_length = 0;
+    uint8_t buffer[PICOQUIC_DEMO_DATAGRAM_SIZE];
+    uint8_t send_buffer[PICOQUIC_DEMO_DATAGRAM_SIZE];
+    size_t send_length = 0;
+    uint64_t current_time = 0;
+    int is_name = 0;
+    int64_t delay_max = 10000000;
+    int64_t delta_t = 0;
+    int new_context_created = 0;
+
+    ret = picoquic_get_server_address(ip_address_text, server_port, &server_address, &server_addr_length, &is_name);
+    if (load_params->sni == NULL && is_name != 0) {
+        load_params->sni = ip_address_text;
+    }
+
+    if (ret == 0) {
+        fd = socket(DEFAULT_SOCK_AF, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd == INVALID_SOCKET) {
+            ret = -1;
+        } else if (DEFAULT_SOCK_AF == AF_INET6) {
+            int val = 1;
+            ret = setsockopt(fd, IPPROTO_IPV6, IPV6_DONTFRAG, &val, sizeof(val));
+            if (ret != 0) {
+                perror("setsockopt IPV6_DONTFRAG");
+            }
+        }
+    }
+
+    current_time = picoquic_current_time();
+
+    if (ret == 0) {
+        qclient = picoquic_create((uint32_t)load_params->nb_users, NULL, NULL, root_crt, load_params->alpn, NULL, NULL, NULL, NULL, NULL,
+            current_time, NULL, ticket_store_filename, NULL, 0, NULL);
+
+        if (qclient == NULL) {
+            ret = -1;
+        } else {
+            qclient->mtu_max = mtu_max;
+            if (mtu_max > PICOQUIC_MAX_PACKET_SIZE) {
+                (void)picoquic_set_max_packet_size(qclient, (uint32_t)mtu_max);
+            }
+            if (cc_algorithm != NULL) {
+                picoquic_set_default_congestion_algorithm(qclient, cc_algorithm);
+            }
+            PICOQUIC_SET_LOG(qclient, F_log);
+
+            if (load_params->sni == NULL || root_crt == NULL) {
+                fprintf(stdout, "No server name or root crt list specified, certificates will not be verified.\n");
+                picoquic_set_null_verifier(qclient);
+            }
+
+            load = picohttp_load_create(load_params, qclient, (struct sockaddr*)&server_address, current_time);
+            if (load == NULL) {
+                fprintf(stdout, "Cannot parse the request mix <%s>.\n", load_params->request_mix);
+                ret = -1;
+            }
+        }
+    }
+
+    while (ret == 0 && !picohttp_load_is_done(load)) {
+        uint64_t next_start_time;
+        int bytes_recv;
+
+        ret = picohttp_load_start_connections(load, current_time);
+        if (ret != 0) {
+            fprintf(stdout, "Cannot create a connection, ret = %d\n", ret);
+            break;
+        }
+
+        /* Send what the connections have to send, and delete those that are disconnected */
+        uint64_t loop_time = picoquic_current_time();
+        while ((cnx_next = picoquic_get_earliest_cnx_to_wake(qclient, loop_time)) != NULL) {
+            send_length = 0;
+            ret = picoquic_prepare_packet(cnx_next, picoquic_current_time(),
+                send_buffer, sizeof(send_buffer), &send_length, &path);
+
+            if (ret != 0) {
+                /* A connection in error only fails itself */
+                ret = 0;
+                picohttp_load_connection_ended(load, cnx_next, picoquic_current_time());
+            } else if (send_length > 0) {
+                int peer_addr_len = 0;
+                struct sockaddr* peer_addr;
+
+                picoquic_before_sending_packet(cnx_next, fd);
+                picoquic_get_peer_addr(path, &peer_addr, &peer_addr_len);
+                (void)sendto(fd, send_buffer, (int)send_length, 0, peer_addr, peer_addr_len);
+            } else {
+                break;
+            }
+        }
+
+        current_time = picoquic_current_time();
+        delta_t = picoquic_get_next_wake_delay(qclient, current_time, delay_max);
+        next_start_time = picohttp_load_next_start_time(load);
+        if (next_start_time != UINT64_MAX && (int64_t)(next_start_time - current_time) < delta_t) {
+            delta_t = (next_start_time > current_time) ? (int64_t)(next_start_time - current_time) : 0;
+        }
+
+        from_length = to_length = sizeof(struct sockaddr_storage);
+        bytes_recv = picoquic_select(&fd, 1, &packet_from, &from_length,
+            &packet_to, &to_length, &if_index_to,
+            buffer, sizeof(buffer), delta_t, &current_time, qclient);
+
+        if (bytes_recv < 0) {
+            ret = -1;
+        } else if (bytes_recv > 0) {
+            (void)picoquic_incoming_packet(qclient, buffer, (size_t)bytes_recv,
+                (struct sockaddr*)&packet_from, (struct sockaddr*)&packet_to, if_index_to,
+                picoquic_current_time(), &new_context_created);
+        }
+    }
+
+    /* Clean up */
+    if (load != NULL) {
+        while ((cnx_next = picoquic_get_first_cnx(qclient)) != NULL) {
+            picohttp_load_connection_ended(load, cnx_next, picoquic_current_time());
+        }
+        picohttp_load_report(load, stdout);
+        picohttp_load_delete(load);
+    }
+
+    if (qclient != NULL) {
+        if (picoquic_save_tickets(qclient->p_first_ticket, picoquic_current_time(), ticket_store_filename) != 0) {
+            fprintf(stderr, "Could not store the saved session tickets.\n");
+        }
+        picoquic_free(qclient);
+    }
+
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+
+    return ret;
+}
+
 uint32_t parse_target_version(char const* v_arg)
 {
     /* Expect the version to be encoded in base 16 */
@@ -922,13 +1410,35 @@ void usage()
     fprintf(stderr, "  -v version            Version proposed by client, e.g. -v ff00000a\n");
     fprintf(stderr, "  -z                    Set TLS zero share behavior on client, to force HRR.\n");
     fprintf(stderr, "  -l file               Log file\n");
-    fprintf(stderr, "  -m mtu_max            Largest mtu value that can be tried for discovery\n");
-    fprintf(stderr, "  -q output.qlog        qlog output file\n");
+    fprintf(stderr, "  -m mtu_max            Largest mtu value that can be tried for discovery, up to 9216 for jumbo frames\n");
+    fprintf(stderr, "  -g algorithm          congestion control: newreno, cubic, bbr, ledbat or prague (default: cubic)\n");
+    fprintf(stderr, "  -T horizon            if server, leave the pacing to the fq qdisc, preparing packets up to horizon us early\n");
+    fprintf(stderr, "  -Y spin_us            if server, busy poll the sockets for up to spin_us before blocking\n");
+    fprintf(stderr, "  -J                    if server, receive and send through io_uring when the kernel supports it\n");
+    fprintf(stderr, "  -x ifname[:queue]     if server, receive and send the datagrams of the port through AF_XDP\n");
+    fprintf(stderr, "                        on that interface and queue, queue 0 by default\n");
+    fprintf(stderr, "  -q output.qlog        qlog output file, in the binary format if it ends with .bin\n");
     fprintf(stderr, "  -S filename           if set, write plugin statistics in the specified file (- for stdout)\n");
+    fprintf(stderr, "  -B filename           if server, write a binary trace of the packets instead of decoding them\n");
+    fprintf(stderr, "                        in the log file, see picoquic_binlog\n");
+    fprintf(stderr, "  -E filename           if server, write the metrics of the monitoring plugin in the Prometheus\n");
+    fprintf(stderr, "                        text format in the specified file, every second\n");
     fprintf(stderr, "  -o folder             Folder where client writes downloaded files,\n");
     fprintf(stderr, "                        defaults to current directory.\n");
     fprintf(stderr, "  -w folder             Folder containing web pages served by server\n");
     fprintf(stderr, "  -D                    no disk: do not save received files on disk.\n");
+    fprintf(stderr, "  -M                    if client, open a socket per local address for the paths\n");
+    fprintf(stderr, "  -u                    if client, connect a socket to the peer of each path, without -M\n");
+    fprintf(stderr, "  -H capacity           capacity of the QPACK dynamic table for HTTP3 (default: %d), 0 for the\n", H3ZERO_QPACK_DEFAULT_CAPACITY);
+    fprintf(stderr, "                        static table only\n");
+    fprintf(stderr, "  -K number             streams that may be blocked on the QPACK dynamic table (default: %d)\n", H3ZERO_QPACK_DEFAULT_BLOCKED_STREAMS);
+    fprintf(stderr, "  -N number             if client, run a load of the given number of connections instead of\n");
+    fprintf(stderr, "                        one, the scenario is then a request mix, see below\n");
+    fprintf(stderr, "  -U number             connections of the load open at the same time, at most (default: 100)\n");
+    fprintf(stderr, "  -A rate               new connections of the load per second, at most (default: no limit)\n");
+    fprintf(stderr, "  -W ms                 think time between two connections of a user of the load (default: 0)\n");
+    fprintf(stderr, "  -Z percent            share of the connections of the load that resume the session with\n");
+    fprintf(stderr, "                        0-RTT (default: 0)\n");
     fprintf(stderr, "  -h                    This help message\n");
 
     fprintf(stderr, "\nThe scenario argument specifies the set of files that should be retrieved,\n");
@@ -944,6 +1454,8 @@ void usage()
     fprintf(stderr, "                        binary(b) or text(t). Defaults to text.\n");
     fprintf(stderr, "  <path>:               The name of the document that should be retrieved\n");
     fprintf(stderr, "If no scenario is specified, the client executes the default scenario.\n");
+    fprintf(stderr, "\nThe request mix of a load lists scenarios separated by '|', each run by a share\n");
+    fprintf(stderr, "of the connections given by its optional weight, e.g. 9@index.html|big.bin\n");
     exit(1);
 }
 
@@ -1001,6 +1513,11 @@ int main(int argc, char** argv)
     uint64_t* reset_seed = NULL;
     uint64_t reset_seed_x[2];
     int mtu_max = 0;
+    uint64_t pacing_offload_horizon = 0;
+    uint64_t spin_budget = 0;
+    int use_uring = 0;
+    const char* xdp_interface = NULL;
+    picoquic_congestion_algorithm_t const* cc_algorithm = NULL;
     char *plugin_store_path = NULL;
     bool preload_plugins = false;
 
@@ -1011,16 +1528,24 @@ int main(int argc, char** argv)
 
     char *qlog_filename = NULL;
     char *stats_filename = NULL;
+    char *metrics_filename = NULL;
+    char *binlog_filename = NULL;
 
     int no_disk = 0;
+    int use_local_sockets = 0;
+    int use_connected_sockets = 0;
     char* www_dir = NULL;
     char* out_dir = NULL;
     char* client_scenario = NULL;
     char* alpn = NULL;
+    h3zero_settings_t qpack_settings = { H3ZERO_QPACK_DEFAULT_CAPACITY, H3ZERO_QPACK_DEFAULT_BLOCKED_STREAMS };
+    picohttp_load_params_t load_params = { 0 };
+
+    load_params.nb_users = 100;
 
     /* Get the parameters */
     int opt;
-    while ((opt = getopt(argc, argv, "c:k:P:C:Q:G:p:v:L14rhzRX:S:i:s:l:m:n:t:q:o:w:Da:")) != -1) {
+    while ((opt = getopt(argc, argv, "c:k:P:C:Q:G:p:v:L14rhuzRX:S:E:B:i:s:l:m:n:t:q:o:w:DMa:T:Y:Jx:g:H:K:N:U:A:W:Z:")) != -1) {
         switch (opt) {
         case 'c':
             server_cert_file = optarg;
@@ -1108,7 +1633,7 @@ int main(int argc, char** argv)
             break;
         case 'm':
             mtu_max = atoi(optarg);
-            if (mtu_max <= 0 || mtu_max > PICOQUIC_MAX_PACKET_SIZE) {
+            if (mtu_max <= 0 || mtu_max > PICOQUIC_MAX_JUMBO_PACKET_SIZE) {
                 fprintf(stderr, "Invalid max mtu: %s\n", optarg);
                 usage();
             }
@@ -1128,6 +1653,12 @@ int main(int argc, char** argv)
         case 'S':
             stats_filename = optarg;
             break;
+        case 'E':
+            metrics_filename = optarg;
+            break;
+        case 'B':
+            binlog_filename = optarg;
+            break;
         case 'R':
             ticket_store_filename = NULL;
             break;
@@ -1140,9 +1671,82 @@ int main(int argc, char** argv)
         case 'D':
             no_disk = 1;
             break;
+        case 'M':
+            use_local_sockets = 1;
+            break;
+        case 'u':
+            use_connected_sockets = 1;
+            break;
         case 'a':
             alpn = optarg;
             break;
+        case 'T':
+            pacing_offload_horizon = (uint64_t)atoi(optarg);
+            if (atoi(optarg) <= 0) {
+                fprintf(stderr, "Invalid pacing horizon: %s\n", optarg);
+                usage();
+            }
+            break;
+        case 'Y':
+            spin_budget = (uint64_t)atoi(optarg);
+            if (atoi(optarg) <= 0) {
+                fprintf(stderr, "Invalid spin budget: %s\n", optarg);
+                usage();
+            }
+            break;
+        case 'J':
+            use_uring = 1;
+            break;
+        case 'x':
+            xdp_interface = optarg;
+            break;
+        case 'g':
+            if ((cc_algorithm = picoquic_get_congestion_algorithm(optarg)) == NULL) {
+                fprintf(stderr, "Unknown congestion algorithm: %s\n", optarg);
+                usage();
+            }
+            break;
+        case 'H':
+            if (atoi(optarg) < 0) {
+                fprintf(stderr, "Invalid QPACK table capacity: %s\n", optarg);
+                usage();
+            }
+            qpack_settings.header_size = (unsigned int)atoi(optarg);
+            break;
+        case 'K':
+            if (atoi(optarg) < 0) {
+                fprintf(stderr, "Invalid number of QPACK blocked streams: %s\n", optarg);
+                usage();
+            }
+            qpack_settings.blocked_streams = (unsigned int)atoi(optarg);
+            break;
+        case 'N':
+            if (atoi(optarg) <= 0) {
+                fprintf(stderr, "Invalid number of connections: %s\n", optarg);
+                usage();
+            }
+            load_params.nb_connections = (size_t)atoi(optarg);
+            break;
+        case 'U':
+            if (atoi(optarg) <= 0) {
+                fprintf(stderr, "Invalid number of users: %s\n", optarg);
+                usage();
+            }
+            load_params.nb_users = (size_t)atoi(optarg);
+            break;
+        case 'A':
+            load_params.connection_rate = atof(optarg);
+            break;
+        case 'W':
+            load_params.think_time = (uint64_t)atoi(optarg) * 1000;
+            break;
+        case 'Z':
+            if (atoi(optarg) < 0 || atoi(optarg) > 100) {
+                fprintf(stderr, "Invalid resumption percentage: %s\n", optarg);
+                usage();
+            }
+            load_params.resume_percent = (unsigned int)atoi(optarg);
+            break;
         case 'h':
             usage();
             break;
@@ -1230,8 +1834,9 @@ int main(int argc, char** argv)
             /* TODO: find an alternative to using 64 bit mask. */
             (cnx_id_mask_is_set == 0) ? NULL : cnx_id_callback,
             (cnx_id_mask_is_set == 0) ? NULL : (void*)&cnx_id_cbdata,
-            (uint8_t*)reset_seed, mtu_max, local_plugin_fnames, local_plugins,
-            both_plugin_fnames, both_plugins, F_log, F_tls_secrets, qlog_filename, stats_filename, preload_plugins, www_dir);
+            (uint8_t*)reset_seed, mtu_max, pacing_offload_horizon, spin_budget, use_uring, xdp_interface, cc_algorithm, local_plugin_fnames, local_plugins,
+            both_plugin_fnames, both_plugins, F_log, F_tls_secrets, qlog_filename, stats_filename, metrics_filename, binlog_filename, preload_plugins, www_dir,
+            &qpack_settings);
         printf("Server exit with code = %d\n", ret);
         if (F_tls_secrets != NULL && F_tls_secrets != stdout) {
             fclose(F_tls_secrets);
@@ -1249,9 +1854,18 @@ int main(int argc, char** argv)
         if (local_plugins > 0) {
             fprintf(stderr, "WARNING: direct plugin insertion at client might interfere with remote plugin injection...\n");
         }
-        ret = quic_client(server_name, server_port, sni, root_trust_file, proposed_version, force_zero_share, mtu_max,
+        if (load_params.nb_connections > 0) {
+            load_params.request_mix = (client_scenario != NULL) ? client_scenario : test_scenario_default;
+            load_params.sni = sni;
+            load_params.alpn = alpn;
+            load_params.proposed_version = proposed_version;
+            load_params.qpack_settings = qpack_settings;
+            ret = quic_load_client(server_name, server_port, root_trust_file, mtu_max, cc_algorithm, F_log, &load_params);
+        } else {
+            ret = quic_client(server_name, server_port, sni, root_trust_file, proposed_version, force_zero_share, mtu_max, cc_algorithm,
                 F_log, F_tls_secrets, local_plugin_fnames, local_plugins, qlog_filename,
-                plugin_store_path, stats_filename, alpn, client_scenario, no_disk, out_dir);
+                plugin_store_path, stats_filename, alpn, client_scenario, no_disk, out_dir, use_local_sockets, use_connected_sockets, &qpack_settings);
+        }
 
         printf("Client exit with code = %d\n", ret);
 
@@ -60,6 +60,13 @@ static const char* default_server_key_file = "..\\certs\\key.pem";
 
 #else /* Linux */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -109,6 +116,7 @@ static const char* bad_request_message = "<html><head><title>Bad Request</title>
 #include "../picoquic/picosocks.h"
 #include "../picoquic/util.h"
 #include "../picoquic/plugin.h"
+#include "../picohttp/demoload.h"
 
 static char* strip_endofline(char* buf, size_t bufmax, char const* line)
 {
@@ -1153,6 +1161,598 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
     return ret;
 }
 
+/* Benchmark: pairs of a client and a server connected over the loopback, each pair run by its own
+ * thread, pinned to a core on Linux. The client of a pair downloads a number of streams of a given
+ * size, a number of them at a time, and the pair measures the completion time of the streams and
+ * the CPU time of its thread. While the pairs run, the main thread samples the utilisation of the
+ * cores. The results are summarized in JSON. */
+
+#define PICOQUIC_BENCH_MAX_PAIRS 64
+#define PICOQUIC_BENCH_ALPN "picoquic-bench"
+#define PICOQUIC_BENCH_MAX_CORES 256
+#define PICOQUIC_BENCH_SAMPLE_INTERVAL 1000000 /* Microseconds between two samples of the cores */
+
+typedef struct st_bench_params_t {
+    int nb_pairs;
+    uint64_t nb_streams; /* Per pair */
+    uint64_t nb_concurrent; /* Streams open at the same time, per pair */
+    uint64_t stream_size;
+    char const* cert_file;
+    char const* key_file;
+    char const* json_file;
+} bench_params_t;
+
+/* A response of the server, sent from the stream callback without copying */
+typedef struct st_bench_server_stream_t {
+    struct st_bench_server_stream_t* next_stream;
+    uint64_t stream_id;
+    size_t request_length;
+    uint8_t request[8]; /* Size of the response, in network order */
+    uint64_t remaining;
+} bench_server_stream_t;
+
+typedef struct st_bench_server_ctx_t {
+    bench_server_stream_t* first_stream;
+} bench_server_ctx_t;
+
+typedef struct st_bench_pair_t {
+    bench_params_t const* params;
+    int id;
+    pthread_t thread;
+    int is_done;
+    int ret;
+    picoquic_quic_t* qserver;
+    picoquic_quic_t* qclient;
+    picoquic_cnx_t* cnx_client;
+    SOCKET_TYPE fd_server;
+    SOCKET_TYPE fd_client;
+    struct sockaddr_in server_addr;
+    struct sockaddr_in client_addr;
+    uint64_t* stream_start_time; /* By stream number, stream ID / 4 */
+    uint64_t nb_started;
+    uint64_t nb_completed;
+    uint64_t nb_failed;
+    uint64_t bytes_received;
+    uint64_t start_time;
+    uint64_t handshake_time;
+    uint64_t end_time;
+    uint64_t cpu_time; /* Nanoseconds of the thread, client and server */
+    picohttp_histogram_t completion_time;
+} bench_pair_t;
+
+static int bench_server_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
+{
+    int ret = 0;
+    bench_server_ctx_t* ctx = (bench_server_ctx_t*)callback_ctx;
+    bench_server_stream_t* stream_ctx = (bench_server_stream_t*)v_stream_ctx;
+
+    if (fin_or_event == picoquic_callback_close || fin_or_event == picoquic_callback_application_close ||
+        fin_or_event == picoquic_callback_stateless_reset) {
+        if (ctx != NULL) {
+            while ((stream_ctx = ctx->first_stream) != NULL) {
+                ctx->first_stream = stream_ctx->next_stream;
+                free(stream_ctx);
+            }
+            free(ctx);
+            picoquic_set_callback(cnx, bench_server_callback, NULL);
+        }
+        return 0;
+    }
+
+    if (ctx == NULL) {
+        ctx = (bench_server_ctx_t*)calloc(1, sizeof(bench_server_ctx_t));
+        if (ctx == NULL) {
+            return picoquic_close(cnx, PICOQUIC_ERROR_MEMORY);
+        }
+        picoquic_set_callback(cnx, bench_server_callback, ctx);
+    }
+
+    if (stream_ctx == NULL) {
+        stream_ctx = ctx->first_stream;
+        while (stream_ctx != NULL && stream_ctx->stream_id != stream_id) {
+            stream_ctx = stream_ctx->next_stream;
+        }
+    }
+
+    switch (fin_or_event) {
+    case picoquic_callback_no_event:
+    case picoquic_callback_stream_fin:
+        if (stream_ctx == NULL) {
+            stream_ctx = (bench_server_stream_t*)calloc(1, sizeof(bench_server_stream_t));
+            if (stream_ctx == NULL) {
+                return picoquic_reset_stream(cnx, stream_id, PICOQUIC_ERROR_MEMORY);
+            }
+            stream_ctx->stream_id = stream_id;
+            stream_ctx->next_stream = ctx->first_stream;
+            ctx->first_stream = stream_ctx;
+        }
+        if (stream_ctx->request_length + length > sizeof(stream_ctx->request)) {
+            ret = picoquic_reset_stream(cnx, stream_id, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION);
+        } else {
+            memcpy(stream_ctx->request + stream_ctx->request_length, bytes, length);
+            stream_ctx->request_length += length;
+            if (fin_or_event == picoquic_callback_stream_fin) {
+                if (stream_ctx->request_length != sizeof(stream_ctx->request)) {
+                    ret = picoquic_reset_stream(cnx, stream_id, PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION);
+                } else {
+                    stream_ctx->remaining = PICOPARSE_64(stream_ctx->request);
+                    ret = picoquic_mark_active_stream(cnx, stream_id, 1, stream_ctx);
+                }
+            }
+        }
+        break;
+    case picoquic_callback_prepare_to_send:
+        if (stream_ctx == NULL) {
+            ret = picoquic_reset_stream(cnx, stream_id, PICOQUIC_TRANSPORT_INTERNAL_ERROR);
+        } else {
+            size_t available = (stream_ctx->remaining < length) ? (size_t)stream_ctx->remaining : length;
+            int is_fin = (available == stream_ctx->remaining);
+            uint8_t* buffer = picoquic_provide_stream_data_buffer(bytes, available, is_fin, !is_fin);
+
+            if (buffer == NULL) {
+                ret = -1;
+            } else {
+                /* The content does not matter, only the time it takes to send it */
+                memset(buffer, 0x5a, available);
+                stream_ctx->remaining -= available;
+            }
+        }
+        break;
+    case picoquic_callback_stream_reset:
+    case picoquic_callback_stop_sending:
+        ret = picoquic_reset_stream(cnx, stream_id, 0);
+        break;
+    default:
+        break;
+    }
+
+    return ret;
+}
+
+static int bench_client_open_stream(picoquic_cnx_t* cnx, bench_pair_t* pair)
+{
+    uint8_t request[8];
+    uint64_t stream_id = 4 * pair->nb_started;
+
+    picoformat_64(request, pair->params->stream_size);
+    pair->stream_start_time[pair->nb_started] = picoquic_current_time();
+    pair->nb_started++;
+
+    return picoquic_add_to_stream(cnx, stream_id, request, sizeof(request), 1);
+}
+
+static int bench_client_end_stream(picoquic_cnx_t* cnx, bench_pair_t* pair, uint64_t stream_id, int is_failed)
+{
+    int ret = 0;
+
+    if (stream_id / 4 >= pair->nb_started || pair->stream_start_time[stream_id / 4] == 0) {
+        /* Not a stream of the benchmark, or already ended */
+        return 0;
+    }
+
+    if (is_failed) {
+        pair->nb_failed++;
+    } else {
+        picohttp_histogram_add(&pair->completion_time, picoquic_current_time() - pair->stream_start_time[stream_id / 4]);
+    }
+    pair->stream_start_time[stream_id / 4] = 0;
+    pair->nb_completed++;
+
+    if (pair->nb_started < pair->params->nb_streams) {
+        ret = bench_client_open_stream(cnx, pair);
+    } else if (pair->nb_completed == pair->params->nb_streams) {
+        pair->end_time = picoquic_current_time();
+        ret = picoquic_close(cnx, 0);
+    }
+
+    return ret;
+}
+
+static int bench_client_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
+{
+    int ret = 0;
+    bench_pair_t* pair = (bench_pair_t*)callback_ctx;
+
+    switch (fin_or_event) {
+    case picoquic_callback_no_event:
+    case picoquic_callback_stream_fin:
+        pair->bytes_received += length;
+        if (fin_or_event == picoquic_callback_stream_fin) {
+            ret = bench_client_end_stream(cnx, pair, stream_id, 0);
+        }
+        break;
+    case picoquic_callback_stream_reset:
+    case picoquic_callback_stop_sending:
+        (void)picoquic_reset_stream(cnx, stream_id, 0);
+        ret = bench_client_end_stream(cnx, pair, stream_id, 1);
+        break;
+    case picoquic_callback_almost_ready:
+        pair->handshake_time = picoquic_current_time() - pair->start_time;
+        while (ret == 0 && pair->nb_started < pair->params->nb_concurrent && pair->nb_started < pair->params->nb_streams) {
+            ret = bench_client_open_stream(cnx, pair);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return ret;
+}
+
+static SOCKET_TYPE bench_open_socket(struct sockaddr_in* addr)
+{
+    SOCKET_TYPE fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    socklen_t addr_length = sizeof(struct sockaddr_in);
+
+    memset(addr, 0, sizeof(struct sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (fd != INVALID_SOCKET && (bind(fd, (struct sockaddr*)addr, sizeof(struct sockaddr_in)) != 0 ||
+        getsockname(fd, (struct sockaddr*)addr, &addr_length) != 0)) {
+        SOCKET_CLOSE(fd);
+        fd = INVALID_SOCKET;
+    }
+
+    return fd;
+}
+
+/* Sends what the connections of the context have to send, returns 1 once the client connection is disconnected */
+static int bench_send_packets(bench_pair_t* pair, picoquic_quic_t* quic, SOCKET_TYPE fd)
+{
+    int is_disconnected = 0;
+    uint8_t send_buffer[1536];
+    uint64_t loop_time = picoquic_current_time();
+    picoquic_cnx_t* cnx_next;
+
+    while ((cnx_next = picoquic_get_earliest_cnx_to_wake(quic, loop_time)) != NULL) {
+        size_t send_length = 0;
+        picoquic_path_t* path = NULL;
+        int ret = picoquic_prepare_packet(cnx_next, picoquic_current_time(), send_buffer, sizeof(send_buffer), &send_length, &path);
+
+        if (ret != 0) {
+            if (cnx_next == pair->cnx_client) {
+                is_disconnected = 1;
+                break;
+            }
+            picoquic_delete_cnx(cnx_next);
+        } else if (send_length > 0) {
+            int peer_addr_len = 0;
+            struct sockaddr* peer_addr;
+
+            picoquic_before_sending_packet(cnx_next, fd);
+            picoquic_get_peer_addr(path, &peer_addr, &peer_addr_len);
+            (void)sendto(fd, send_buffer, (int)send_length, 0, peer_addr, peer_addr_len);
+        } else {
+            break;
+        }
+    }
+
+    return is_disconnected;
+}
+
+static uint64_t bench_thread_cpu_time()
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void* bench_pair_run(void* arg)
+{
+    bench_pair_t* pair = (bench_pair_t*)arg;
+    uint64_t cpu_start;
+    int is_disconnected = 0;
+    uint8_t buffer[1536];
+    int new_context_created = 0;
+
+#ifdef __linux__
+    cpu_set_t cpus;
+    long nb_cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    CPU_ZERO(&cpus);
+    CPU_SET(pair->id % ((nb_cores > 0) ? nb_cores : 1), &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus) != 0) {
+        fprintf(stderr, "Cannot pin the thread of pair %d\n", pair->id);
+    }
+#endif
+
+    cpu_start = bench_thread_cpu_time();
+    pair->start_time = picoquic_current_time();
+    pair->cnx_client = picoquic_create_cnx(pair->qclient, picoquic_null_connection_id, picoquic_null_connection_id,
+        (struct sockaddr*)&pair->server_addr, pair->start_time, 0, NULL, PICOQUIC_BENCH_ALPN, 1);
+
+    if (pair->cnx_client == NULL) {
+        pair->ret = -1;
+    } else {
+        picoquic_set_callback(pair->cnx_client, bench_client_callback, pair);
+        pair->ret = picoquic_start_client_cnx(pair->cnx_client);
+    }
+
+    while (pair->ret == 0 && !is_disconnected) {
+        int64_t delta_t;
+        int64_t server_delta_t;
+        fd_set readfds;
+        struct timeval tv;
+        SOCKET_TYPE max_fd = (pair->fd_server > pair->fd_client) ? pair->fd_server : pair->fd_client;
+
+        (void)bench_send_packets(pair, pair->qserver, pair->fd_server);
+        is_disconnected = bench_send_packets(pair, pair->qclient, pair->fd_client);
+        if (is_disconnected) {
+            break;
+        }
+
+        delta_t = picoquic_get_next_wake_delay(pair->qclient, picoquic_current_time(), 10000000);
+        server_delta_t = picoquic_get_next_wake_delay(pair->qserver, picoquic_current_time(), 10000000);
+        if (server_delta_t < delta_t) {
+            delta_t = server_delta_t;
+        }
+        tv.tv_sec = (long)(delta_t / 1000000);
+        tv.tv_usec = (long)(delta_t % 1000000);
+
+        FD_ZERO(&readfds);
+        FD_SET(pair->fd_server, &readfds);
+        FD_SET(pair->fd_client, &readfds);
+
+        if (select((int)max_fd + 1, &readfds, NULL, NULL, &tv) < 0) {
+            pair->ret = -1;
+            break;
+        }
+
+        for (int i = 0; i < 2; i++) {
+            SOCKET_TYPE fd = (i == 0) ? pair->fd_server : pair->fd_client;
+            picoquic_quic_t* quic = (i == 0) ? pair->qserver : pair->qclient;
+            struct sockaddr* addr_to = (i == 0) ? (struct sockaddr*)&pair->server_addr : (struct sockaddr*)&pair->client_addr;
+
+            if (FD_ISSET(fd, &readfds)) {
+                struct sockaddr_storage addr_from;
+                socklen_t from_length = sizeof(addr_from);
+                int bytes_recv = (int)recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr*)&addr_from, &from_length);
+
+                if (bytes_recv > 0) {
+                    (void)picoquic_incoming_packet(quic, buffer, (size_t)bytes_recv, (struct sockaddr*)&addr_from,
+                        addr_to, 0, picoquic_current_time(), &new_context_created);
+                }
+            }
+        }
+    }
+
+    if (pair->end_time == 0) {
+        pair->end_time = picoquic_current_time();
+    }
+    pair->cpu_time = bench_thread_cpu_time() - cpu_start;
+    __atomic_store_n(&pair->is_done, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+/* Busy and total times of the cores, from /proc/stat, in clock ticks */
+static int bench_read_cores(uint64_t* busy, uint64_t* total, int nb_max)
+{
+    int nb_cores = 0;
+    FILE* F = fopen("/proc/stat", "r");
+    char line[512];
+
+    if (F != NULL) {
+        while (nb_cores < nb_max && fgets(line, sizeof(line), F) != NULL) {
+            unsigned long long v[8] = { 0 };
+            int core;
+
+            if (strncmp(line, "cpu", 3) != 0 || line[3] < '0' || line[3] > '9') {
+                continue;
+            }
+            if (sscanf(line + 3, "%d %llu %llu %llu %llu %llu %llu %llu %llu", &core,
+                    &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) >= 5) {
+                total[nb_cores] = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+                busy[nb_cores] = total[nb_cores] - v[3] - v[4];
+                nb_cores++;
+            }
+        }
+        fclose(F);
+    }
+
+    return nb_cores;
+}
+
+static void bench_write_histogram(FILE* F, char const* name, picohttp_histogram_t const* histogram)
+{
+    fprintf(F, "  \"%s\": { \"count\": %" PRIu64 ", \"mean\": %" PRIu64 ", \"p50\": %" PRIu64 ", \"p99\": %" PRIu64
+        ", \"p999\": %" PRIu64 ", \"max\": %" PRIu64 " },\n", name, histogram->count,
+        (histogram->count > 0) ? histogram->sum / histogram->count : 0,
+        picohttp_histogram_percentile(histogram, 0.5), picohttp_histogram_percentile(histogram, 0.99),
+        picohttp_histogram_percentile(histogram, 0.999), histogram->max);
+}
+
+int quic_bench(bench_params_t const* params)
+{
+    int ret = 0;
+    bench_pair_t* pairs = (bench_pair_t*)calloc(params->nb_pairs, sizeof(bench_pair_t));
+    picohttp_histogram_t* completion_time = (picohttp_histogram_t*)calloc(1, sizeof(picohttp_histogram_t));
+    picohttp_histogram_t* handshake_time = (picohttp_histogram_t*)calloc(1, sizeof(picohttp_histogram_t));
+    uint64_t busy[2][PICOQUIC_BENCH_MAX_CORES];
+    uint64_t total[2][PICOQUIC_BENCH_MAX_CORES];
+    double core_sum[PICOQUIC_BENCH_MAX_CORES] = { 0 };
+    double core_max[PICOQUIC_BENCH_MAX_CORES] = { 0 };
+    int nb_cores = 0;
+    int nb_samples = 0;
+    int nb_started = 0;
+    uint64_t start_time;
+    uint64_t end_time;
+    uint64_t bytes_received = 0;
+    uint64_t cpu_time = 0;
+    uint64_t nb_completed = 0;
+    uint64_t nb_failed = 0;
+
+    if (pairs == NULL || completion_time == NULL || handshake_time == NULL) {
+        ret = -1;
+    } else {
+        for (int i = 0; i < params->nb_pairs; i++) {
+            pairs[i].fd_server = INVALID_SOCKET;
+            pairs[i].fd_client = INVALID_SOCKET;
+        }
+    }
+
+    /* The contexts are created before the threads are started */
+    for (int i = 0; ret == 0 && i < params->nb_pairs; i++) {
+        bench_pair_t* pair = &pairs[i];
+        uint64_t current_time = picoquic_current_time();
+
+        pair->params = params;
+        pair->id = i;
+        pair->stream_start_time = (uint64_t*)malloc(params->nb_streams * sizeof(uint64_t));
+        pair->fd_server = bench_open_socket(&pair->server_addr);
+        pair->fd_client = bench_open_socket(&pair->client_addr);
+        pair->qserver = picoquic_create(8, params->cert_file, params->key_file, NULL, PICOQUIC_BENCH_ALPN,
+            bench_server_callback, NULL, NULL, NULL, NULL, current_time, NULL, NULL, NULL, 0, NULL);
+        pair->qclient = picoquic_create(8, NULL, NULL, NULL, PICOQUIC_BENCH_ALPN, NULL, NULL, NULL, NULL, NULL,
+            current_time, NULL, NULL, NULL, 0, NULL);
+
+        if (pair->stream_start_time == NULL || pair->fd_server == INVALID_SOCKET || pair->fd_client == INVALID_SOCKET ||
+            pair->qserver == NULL || pair->qclient == NULL) {
+            fprintf(stderr, "Cannot create the client and server of pair %d\n", i);
+            ret = -1;
+        } else {
+            picoquic_set_null_verifier(pair->qclient);
+        }
+    }
+
+    start_time = picoquic_current_time();
+    nb_cores = bench_read_cores(busy[0], total[0], PICOQUIC_BENCH_MAX_CORES);
+
+    for (int i = 0; ret == 0 && i < params->nb_pairs; i++) {
+        if (pthread_create(&pairs[i].thread, NULL, bench_pair_run, &pairs[i]) != 0) {
+            fprintf(stderr, "Cannot start pair %d\n", i);
+            ret = -1;
+        } else {
+            nb_started++;
+        }
+    }
+
+    /* Sample the cores until all the pairs are done */
+    if (nb_started > 0) {
+        int nb_done;
+
+        do {
+            uint64_t sample_start = picoquic_current_time();
+
+            nb_done = 0;
+            while (nb_done < nb_started && picoquic_current_time() - sample_start < PICOQUIC_BENCH_SAMPLE_INTERVAL) {
+                usleep(10000);
+                nb_done = 0;
+                for (int i = 0; i < nb_started; i++) {
+                    nb_done += __atomic_load_n(&pairs[i].is_done, __ATOMIC_ACQUIRE);
+                }
+            }
+
+            if (nb_cores > 0 && bench_read_cores(busy[1], total[1], nb_cores) == nb_cores) {
+                for (int c = 0; c < nb_cores; c++) {
+                    uint64_t delta_total = total[1][c] - total[0][c];
+                    double utilisation = (delta_total > 0) ? (double)(busy[1][c] - busy[0][c]) / (double)delta_total : 0;
+
+                    core_sum[c] += utilisation;
+                    if (utilisation > core_max[c]) {
+                        core_max[c] = utilisation;
+                    }
+                    busy[0][c] = busy[1][c];
+                    total[0][c] = total[1][c];
+                }
+                nb_samples++;
+            }
+        } while (nb_done < nb_started);
+    }
+
+    for (int i = 0; i < nb_started; i++) {
+        (void)pthread_join(pairs[i].thread, NULL);
+    }
+    end_time = picoquic_current_time();
+
+    for (int i = 0; i < nb_started; i++) {
+        bench_pair_t* pair = &pairs[i];
+
+        for (size_t b = 0; b < PICOHTTP_HISTOGRAM_NB_BUCKETS; b++) {
+            completion_time->buckets[b] += pair->completion_time.buckets[b];
+        }
+        completion_time->count += pair->completion_time.count;
+        completion_time->sum += pair->completion_time.sum;
+        if (pair->completion_time.max > completion_time->max) {
+            completion_time->max = pair->completion_time.max;
+        }
+        if (pair->handshake_time > 0) {
+            picohttp_histogram_add(handshake_time, pair->handshake_time);
+        }
+        bytes_received += pair->bytes_received;
+        cpu_time += pair->cpu_time;
+        nb_completed += pair->nb_completed - pair->nb_failed;
+        nb_failed += pair->nb_failed + (pair->params->nb_streams - pair->nb_completed);
+        if (pair->ret != 0) {
+            ret = pair->ret;
+        }
+    }
+
+    if (nb_started > 0) {
+        FILE* F = stdout;
+        double duration = (double)(end_time - start_time) / 1000000.0;
+
+        if (params->json_file != NULL && strcmp(params->json_file, "-") != 0) {
+            F = fopen(params->json_file, "w");
+            if (F == NULL) {
+                fprintf(stderr, "Cannot open %s, writing the summary to stdout\n", params->json_file);
+                F = stdout;
+            }
+        }
+
+        fprintf(F, "{\n");
+        fprintf(F, "  \"pairs\": %d,\n  \"streams_per_pair\": %" PRIu64 ",\n  \"concurrent_streams\": %" PRIu64 ",\n",
+            nb_started, params->nb_streams, params->nb_concurrent);
+        fprintf(F, "  \"stream_size\": %" PRIu64 ",\n  \"streams_completed\": %" PRIu64 ",\n  \"streams_failed\": %" PRIu64 ",\n",
+            params->stream_size, nb_completed, nb_failed);
+        fprintf(F, "  \"duration_s\": %.6f,\n  \"bytes_received\": %" PRIu64 ",\n  \"throughput_mbps\": %.3f,\n",
+            duration, bytes_received, (duration > 0) ? (double)bytes_received * 8.0 / duration / 1000000.0 : 0.0);
+        fprintf(F, "  \"cpu_ns_per_byte\": %.3f,\n", (bytes_received > 0) ? (double)cpu_time / (double)bytes_received : 0.0);
+        bench_write_histogram(F, "handshake_time_us", handshake_time);
+        bench_write_histogram(F, "stream_completion_time_us", completion_time);
+        fprintf(F, "  \"cores\": [");
+        for (int c = 0; c < nb_cores && nb_samples > 0; c++) {
+            fprintf(F, "%s\n    { \"core\": %d, \"mean_utilisation\": %.3f, \"max_utilisation\": %.3f }",
+                (c == 0) ? "" : ",", c, core_sum[c] / nb_samples, core_max[c]);
+        }
+        fprintf(F, "\n  ]\n}\n");
+
+        if (F != stdout) {
+            fclose(F);
+        }
+    }
+
+    for (int i = 0; pairs != NULL && i < params->nb_pairs; i++) {
+        bench_pair_t* pair = &pairs[i];
+
+        if (pair->qclient != NULL) {
+            picoquic_free(pair->qclient);
+        }
+        if (pair->qserver != NULL) {
+            picoquic_free(pair->qserver);
+        }
+        if (pair->fd_client != INVALID_SOCKET) {
+            SOCKET_CLOSE(pair->fd_client);
+        }
+        if (pair->fd_server != INVALID_SOCKET) {
+            SOCKET_CLOSE(pair->fd_server);
+        }
+        free(pair->stream_start_time);
+    }
+    free(pairs);
+    free(completion_time);
+    free(handshake_time);
+
+    return ret;
+}
+
 uint32_t parse_target_version(char const* v_arg)
 {
     /* Expect the version to be encoded in base 16 */
@@ -1207,6 +1807,12 @@ void usage()
     fprintf(stderr, "  -z                    Set TLS zero share behavior on client, to force HRR.\n");
     fprintf(stderr, "  -l file               Log file\n");
     fprintf(stderr, "  -m mtu_max            Largest mtu value that can be tried for discovery\n");
+    fprintf(stderr, "  -b pairs              Benchmark: run the given number of client and server pairs over the\n");
+    fprintf(stderr, "                        loopback, each on its own thread, and print a JSON summary\n");
+    fprintf(stderr, "  -N streams            Benchmark: streams downloaded by each client (default: 100)\n");
+    fprintf(stderr, "  -C streams            Benchmark: streams open at the same time by each client (default: 1)\n");
+    fprintf(stderr, "  -S size               Benchmark: size of the streams in bytes (default: 1000000)\n");
+    fprintf(stderr, "  -j file               Benchmark: write the JSON summary in the specified file (default: stdout)\n");
     fprintf(stderr, "  -h                    This help message\n");
     exit(1);
 }
@@ -1262,6 +1868,7 @@ int main(int argc, char** argv)
     uint64_t* reset_seed = NULL;
     uint64_t reset_seed_x[2];
     int mtu_max = 0;
+    bench_params_t bench_params = { 0, 100, 1, 1000000, NULL, NULL, NULL };
 
 #ifdef _WINDOWS
     WSADATA wsaData;
@@ -1272,7 +1879,7 @@ int main(int argc, char** argv)
 
     /* Get the parameters */
     int opt;
-    while ((opt = getopt(argc, argv, "c:k:p:v:1rhzi:s:l:m:n:t:P:")) != -1) {
+    while ((opt = getopt(argc, argv, "c:k:p:v:1rhzi:s:l:m:n:t:P:b:N:C:S:j:")) != -1) {
         switch (opt) {
         case 'c':
             server_cert_file = optarg;
@@ -1350,6 +1957,31 @@ int main(int argc, char** argv)
         case 'z':
             force_zero_share = 1;
             break;
+        case 'b':
+            bench_params.nb_pairs = atoi(optarg);
+            if (bench_params.nb_pairs <= 0 || bench_params.nb_pairs > PICOQUIC_BENCH_MAX_PAIRS) {
+                fprintf(stderr, "Invalid number of pairs: %s\n", optarg);
+                usage();
+            }
+            break;
+        case 'N':
+            if ((bench_params.nb_streams = strtoull(optarg, NULL, 10)) == 0) {
+                fprintf(stderr, "Invalid number of streams: %s\n", optarg);
+                usage();
+            }
+            break;
+        case 'C':
+            if ((bench_params.nb_concurrent = strtoull(optarg, NULL, 10)) == 0) {
+                fprintf(stderr, "Invalid number of concurrent streams: %s\n", optarg);
+                usage();
+            }
+            break;
+        case 'S':
+            bench_params.stream_size = strtoull(optarg, NULL, 10);
+            break;
+        case 'j':
+            bench_params.json_file = optarg;
+            break;
         case 'h':
             usage();
             break;
@@ -1379,7 +2011,14 @@ int main(int argc, char** argv)
     }
 #endif
 
-    if (is_client == 0) {
+    if (bench_params.nb_pairs > 0) {
+        bench_params.cert_file = server_cert_file;
+        bench_params.key_file = server_key_file;
+        ret = quic_bench(&bench_params);
+        if (ret != 0) {
+            fprintf(stderr, "Benchmark exit with code = %d\n", ret);
+        }
+    } else if (is_client == 0) {
         /* Run as server */
         printf("Starting PicoQUIC server on port %d, server name = %s, just_once = %d, hrr= %d, and %d plugins\n",
             server_port, server_name, just_once, do_hrr, plugins);
@@ -84,6 +84,7 @@ static const char* default_server_key_file = "..\\certs\\key.pem";
 #include <linux/if_tun.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
+#include <sys/eventfd.h>
 
 #ifndef SOCKET_TYPE
 #define SOCKET_TYPE int
@@ -117,10 +118,12 @@ static const char* ticket_store_filename = "demo_ticket_store.bin";
 #include "../picoquic/picosocks.h"
 #include "../picoquic/util.h"
 #include "../picoquic/plugin.h"
+#include "../picoquic/vnet_offload.h"
+#include "../plugins/datagram/datagram_ring.h"
 
 static protoop_id_t get_max_message_size = { .id = "get_max_message_size" };
-static protoop_id_t send_message = { .id = "send_message" };
-static protoop_id_t get_message_socket = { .id = "get_message_socket" };
+static protoop_id_t send_messages = { .id = "send_messages" };
+static protoop_id_t get_message_rings = { .id = "get_message_rings" };
 
 #define PQUIC_VPN_ALPN "vpn-29"
 #define SEC_TO_MILLIS (1000000)
@@ -160,36 +163,219 @@ static char* strip_endofline(char* buf, size_t bufmax, char const* line)
     return buf;
 }
 
-int tun_open(char *devname) {
+/* The tunnel device, with one queue per file descriptor. The queues are all drained by the thread of the
+ * connection: the QUIC connection and the datagram rings have a single producer. With the offloads, the
+ * frames of the device carry a virtio-net header, and the TCP super-packets are split in datagrams. */
+#define PQUIC_VPN_MAX_QUEUES 16
+#define PQUIC_VPN_TUN_BATCH 64 /* Frames read, or datagrams written, at once */
+#define PQUIC_VPN_TUN_SLOTS 128 /* Datagrams sent at once */
+
+typedef struct st_pquic_vpn_tun_t {
+    int nb_queues;
+    int queue_fds[PQUIC_VPN_MAX_QUEUES];
+    int use_offload;
+    int event_fd; /* Signaled by the datagram plugin for the received datagrams */
+    datagram_rings_t* rings;
+    uint64_t nb_sent;
+    uint64_t nb_received;
+    uint64_t nb_dropped;
+    datagram_message_t batch[PQUIC_VPN_TUN_SLOTS];
+    uint8_t batch_buffers[PQUIC_VPN_TUN_SLOTS][PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t frame[PICOQUIC_VNET_FRAME_MAX];
+} pquic_vpn_tun_t;
+
+/* Opens nb_queues queues of the device, with IFF_MULTI_QUEUE if there are several. The queues are
+ * non-blocking, so that the packets waiting on them can be read in batches. */
+int tun_open(pquic_vpn_tun_t* tun, char const* devname, int nb_queues, int use_offload)
+{
     struct ifreq ifr;
-    int fd;
+    int ret = 0;
 
-    if ((fd = open("/dev/net/tun", O_RDWR)) == -1) {
-        perror("open /dev/net/tun");
-        exit(1);
-    }
+    memset(tun, 0, sizeof(pquic_vpn_tun_t));
+    tun->event_fd = -1;
+    tun->use_offload = use_offload;
     memset(&ifr, 0, sizeof(ifr));
     ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
-    strncpy(ifr.ifr_name, devname, IFNAMSIZ);
+    if (nb_queues > 1) {
+        ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    }
+    if (use_offload) {
+        ifr.ifr_flags |= IFF_VNET_HDR;
+    }
+    strncpy(ifr.ifr_name, devname, IFNAMSIZ - 1);
+
+    while (ret == 0 && tun->nb_queues < nb_queues) {
+        int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+
+        if (fd == -1) {
+            perror("open /dev/net/tun");
+            ret = -1;
+        } else if (ioctl(fd, TUNSETIFF, (void *) &ifr) == -1) {
+            perror("ioctl TUNSETIFF");
+            close(fd);
+            ret = -1;
+        } else {
+            tun->queue_fds[tun->nb_queues++] = fd;
+        }
+    }
+
+    if (ret == 0 && use_offload) {
+        int hdr_size = PICOQUIC_VNET_HDR_SIZE;
+
+        if (ioctl(tun->queue_fds[0], TUNSETVNETHDRSZ, &hdr_size) == -1 ||
+            ioctl(tun->queue_fds[0], TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6) == -1) {
+            perror("ioctl TUNSETOFFLOAD");
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+void tun_close(pquic_vpn_tun_t* tun)
+{
+    for (int i = 0; i < tun->nb_queues; i++) {
+        close(tun->queue_fds[i]);
+    }
+    tun->nb_queues = 0;
+    if (tun->event_fd != -1) {
+        close(tun->event_fd);
+        tun->event_fd = -1;
+    }
+}
+
+int tun_is_queue(pquic_vpn_tun_t* tun, int fd)
+{
+    for (int i = 0; i < tun->nb_queues; i++) {
+        if (tun->queue_fds[i] == fd) {
+            return 1;
+        }
+    }
+    return 0;
+}
 
-    if (ioctl(fd, TUNSETIFF, (void *) &ifr) == -1) {
-        perror("ioctl TUNSETIFF");
-        close(fd);
-        return -1;
+/* Sets up the datagram rings of the connection, the received datagrams are then taken from them
+ * instead of the message socket. Returns -1 if the datagram plugin cannot provide them. */
+int tun_attach_rings(pquic_vpn_tun_t* tun, picoquic_cnx_t* cnx)
+{
+    if (tun->event_fd == -1) {
+        tun->event_fd = eventfd(0, EFD_NONBLOCK);
+        if (tun->event_fd == -1) {
+            perror("eventfd");
+            return -1;
+        }
     }
-    return fd;
+    tun->rings = (datagram_rings_t*) protoop_prepare_and_run_extern_noparam(cnx, &get_message_rings, NULL, tun->event_fd);
+
+    return (tun->rings == NULL) ? -1 : 0;
 }
 
-void handle_tun_read(picoquic_cnx_t *cnx, int tun, const uint8_t *buffer, int bytes_recv) {
-    printf("Received %d bytes on the tun interface\n", bytes_recv);
+static void tun_send_batch(picoquic_cnx_t *cnx, pquic_vpn_tun_t* tun, int* nb_messages)
+{
+    if (*nb_messages > 0) {
+        int nb_queued = (int) protoop_prepare_and_run_extern_noparam(cnx, &send_messages, NULL, tun->batch, *nb_messages);
+
+        tun->nb_sent += nb_queued;
+        tun->nb_dropped += *nb_messages - nb_queued;
+        *nb_messages = 0;
+    }
+}
+
+/* Adds the packet read from the tunnel to the batch or, with the offloads, the datagrams the frame is split in */
+static void tun_add_frame(picoquic_cnx_t *cnx, pquic_vpn_tun_t* tun, const uint8_t *frame, size_t length,
+    uint32_t max_message_size, int* nb_messages)
+{
+    if (tun->use_offload) {
+        size_t lengths[PQUIC_VPN_TUN_SLOTS];
+        int nb_segments = picoquic_vnet_segment(frame, length, max_message_size, tun->batch_buffers[*nb_messages],
+            PICOQUIC_MAX_PACKET_SIZE, lengths, PQUIC_VPN_TUN_SLOTS - *nb_messages);
+
+        if (nb_segments < 0 && *nb_messages > 0) {
+            /* Make room for the segments */
+            tun_send_batch(cnx, tun, nb_messages);
+            nb_segments = picoquic_vnet_segment(frame, length, max_message_size, tun->batch_buffers[0],
+                PICOQUIC_MAX_PACKET_SIZE, lengths, PQUIC_VPN_TUN_SLOTS);
+        }
+        if (nb_segments < 0) {
+            tun->nb_dropped++;
+        }
+        for (int i = 0; i < nb_segments; i++) {
+            tun->batch[*nb_messages].data = tun->batch_buffers[*nb_messages];
+            tun->batch[*nb_messages].length = (uint32_t) lengths[i];
+            (*nb_messages)++;
+        }
+    } else if (length > max_message_size) {
+        tun->nb_dropped++;
+    } else {
+        tun->batch[*nb_messages].data = (uint8_t *) frame;
+        tun->batch[*nb_messages].length = (uint32_t) length;
+        (*nb_messages)++;
+    }
+}
+
+/* Sends the packet read from the tunnel with those waiting on its queues, up to a batch, in one call to
+ * the datagram plugin. The datagrams are queued together, and several of them can share a QUIC packet. */
+void handle_tun_read(picoquic_cnx_t *cnx, pquic_vpn_tun_t* tun, const uint8_t *buffer, int bytes_recv)
+{
     uint32_t max_message_size = (uint32_t) protoop_prepare_and_run_extern_noparam(cnx, &get_max_message_size, NULL, NULL);
-    if (bytes_recv > max_message_size) {
-        fprintf(stdout, "%d-byte long message received is bigger than max payload size %d, dropping it\n", bytes_recv, max_message_size);
+    int nb_messages = 0;
+    int nb_frames = 1;
+    int queue = 0;
+
+    tun_add_frame(cnx, tun, buffer, (size_t) bytes_recv, max_message_size, &nb_messages);
+
+    while (queue < tun->nb_queues && nb_frames < PQUIC_VPN_TUN_BATCH && nb_messages < PQUIC_VPN_TUN_SLOTS) {
+        uint8_t* frame = (tun->use_offload) ? tun->frame : tun->batch_buffers[nb_messages];
+        ssize_t length = read(tun->queue_fds[queue], frame, (tun->use_offload) ? PICOQUIC_VNET_FRAME_MAX : PICOQUIC_MAX_PACKET_SIZE);
+
+        if (length <= 0) {
+            queue++;
+        } else {
+            nb_frames++;
+            tun_add_frame(cnx, tun, frame, (size_t) length, max_message_size, &nb_messages);
+        }
+    }
+
+    tun_send_batch(cnx, tun, &nb_messages);
+}
+
+/* Writes the datagrams waiting in the rx ring to the tunnel, and gives their slots back by batches. With the
+ * offloads, consecutive segments of a TCP flow are written as one super-packet. */
+void handle_tun_write(pquic_vpn_tun_t* tun)
+{
+    datagram_message_t messages[PQUIC_VPN_TUN_BATCH];
+    uint8_t const* packets[PQUIC_VPN_TUN_BATCH];
+    size_t lengths[PQUIC_VPN_TUN_BATCH];
+    int nb_messages;
+
+    if (tun->rings == NULL) {
         return;
     }
-    protoop_arg_t pret = protoop_prepare_and_run_extern_noparam(cnx, &send_message, NULL, buffer, bytes_recv);
-    if (pret != 0) {
-        fprintf(stdout, "Unable to send message\n");
+
+    while ((nb_messages = datagram_ring_rx_peek_batch(tun->rings, messages, PQUIC_VPN_TUN_BATCH)) > 0) {
+        for (int i = 0; i < nb_messages; i++) {
+            packets[i] = messages[i].data;
+            lengths[i] = messages[i].length;
+        }
+        for (int i = 0; i < nb_messages;) {
+            uint8_t const* frame = packets[i];
+            size_t frame_length = lengths[i];
+            int nb_merged = 1;
+
+            if (tun->use_offload) {
+                nb_merged = picoquic_vnet_coalesce(packets + i, lengths + i, nb_messages - i,
+                    tun->frame, PICOQUIC_VNET_FRAME_MAX, &frame_length);
+                frame = tun->frame;
+            }
+            if (nb_merged > 0 && write(tun->queue_fds[0], frame, frame_length) == (ssize_t) frame_length) {
+                tun->nb_received += nb_merged;
+            } else {
+                nb_merged = (nb_merged > 0) ? nb_merged : 1;
+                tun->nb_dropped += nb_merged;
+            }
+            i += nb_merged;
+        }
+        datagram_ring_rx_release_batch(tun->rings, nb_messages);
     }
 }
 
@@ -372,7 +558,8 @@ int quic_server(const char* server_name, int server_port,
                 const char* pem_cert, const char* pem_key,
                 int just_once, int do_hrr, cnx_id_cb_fn cnx_id_callback,
                 void* cnx_id_callback_ctx, uint8_t reset_seed[PICOQUIC_RESET_SECRET_SIZE],
-                int mtu_max, FILE *F_log, const char** plugin_fnames, int plugins, char *qlog_filename)
+                int mtu_max, FILE *F_log, const char** plugin_fnames, int plugins, char *qlog_filename, int nb_queues,
+                int use_offload)
 {
     /* Start: start the QUIC process with cert and key files */
     int ret = 0;
@@ -387,7 +574,7 @@ int quic_server(const char* server_name, int server_port,
     struct sockaddr_storage client_from;
     socklen_t from_length;
     socklen_t to_length;
-    uint8_t buffer[1536];
+    uint8_t buffer[PICOQUIC_VNET_FRAME_MAX];
     uint8_t send_buffer[1536];
     size_t send_length = 0;
     uint64_t current_time = 0;
@@ -418,15 +605,18 @@ int quic_server(const char* server_name, int server_port,
         }
     }
 
-    int tun_fd = tun_open("tun1");
-    if (tun_fd == -1) {
+    pquic_vpn_tun_t* tun = (pquic_vpn_tun_t*) malloc(sizeof(pquic_vpn_tun_t));
+    if (tun == NULL || tun_open(tun, "tun1", nb_queues, use_offload) != 0) {
         printf("Failed to open tun1\n");
         exit(-1);
     }
-    SOCKET_TYPE sockets[3];
+    SOCKET_TYPE sockets[2 + PQUIC_VPN_MAX_QUEUES + 1];
+    int nb_sockets = 2;
     sockets[0] = server_sockets.s_socket[0];
     sockets[1] = server_sockets.s_socket[1];
-    sockets[2] = tun_fd;
+    for (int i = 0; i < tun->nb_queues; i++) {
+        sockets[nb_sockets++] = tun->queue_fds[i];
+    }
 
     /* Wait for packets */
     while (ret == 0 && (just_once == 0 || cnx_server == NULL || picoquic_get_cnx_state(cnx_server) != picoquic_state_disconnected)) {
@@ -441,7 +631,7 @@ int quic_server(const char* server_name, int server_port,
             picoquic_log_congestion_state(stdout, cnx_server, current_time);
         }
 
-        bytes_recv = picoquic_select(sockets, 3,
+        bytes_recv = picoquic_select(sockets, nb_sockets,
                                      &addr_from, &from_length,
                                      &addr_to, &to_length, &if_index_to,
                                      buffer, sizeof(buffer),
@@ -463,7 +653,9 @@ int quic_server(const char* server_name, int server_port,
             ret = -1;
         } else {
             if (bytes_recv > 0) {
-                if (qserver->rcv_socket != tun_fd) {
+                if (qserver->rcv_socket == tun->event_fd) {
+                    /* The datagrams received are written below */
+                } else if (!tun_is_queue(tun, qserver->rcv_socket)) {
                     /* Submit the packet to the server */
                     ret = picoquic_incoming_packet(qserver, buffer,
                                                    (size_t) bytes_recv, (struct sockaddr *) &addr_from,
@@ -482,6 +674,15 @@ int quic_server(const char* server_name, int server_port,
                             plugin_insert_plugins_from_fnames(cnx_server, plugins, (char **) plugin_fnames);
                         }
 
+                        if (tun_attach_rings(tun, cnx_server) != 0) {
+                            printf("The datagram plugin cannot provide its rings\n");
+                            ret = -1;
+                            break;
+                        }
+                        if (sockets[nb_sockets - 1] != tun->event_fd) {
+                            sockets[nb_sockets++] = tun->event_fd;
+                        }
+
                         if (qlog_filename) {
                             int qlog_fd = open(qlog_filename, O_WRONLY | O_CREAT | O_TRUNC, 00755);
                             if (qlog_fd != -1) {
@@ -503,12 +704,14 @@ int quic_server(const char* server_name, int server_port,
                         picoquic_log_transport_extension(stdout, cnx_server, 1);
                     }
                 } else if (cnx_server != NULL && cnx_server->cnx_state >= picoquic_state_server_almost_ready) {
-                    handle_tun_read(cnx_server, tun_fd, buffer, bytes_recv);
+                    handle_tun_read(cnx_server, tun, buffer, bytes_recv);
                 }
             }
             if (ret == 0) {
                 uint64_t loop_time = current_time;
 
+                handle_tun_write(tun);
+
                 while ((sp = picoquic_dequeue_stateless_packet(qserver)) != NULL) {
                     (void) picoquic_send_through_server_sockets(&server_sockets,
                                                                 (struct sockaddr*)&sp->addr_to,
@@ -527,21 +730,6 @@ int quic_server(const char* server_name, int server_port,
 
 
                 while (ret == 0 && (cnx_next = picoquic_get_earliest_cnx_to_wake(qserver, loop_time)) != NULL) {
-                    int message_socket = (int) protoop_prepare_and_run_extern_noparam(cnx_next, &get_message_socket, 0, NULL);
-                    char buffer[65535];
-                    ssize_t mret = 1;
-                    while(mret > 0) {
-                        mret = recv(message_socket, buffer, sizeof(buffer), MSG_DONTWAIT);
-                        if (mret > 0) {
-                            printf("Received %" PRIu64 " bytes as message\n", mret);
-                            ssize_t tret = write(tun_fd, buffer, (size_t) mret);
-                            printf("Write %" PRIu64 " bytes to the tunnel\n", tret);
-                        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                            printf("Error when reading the message socket: %s\n", strerror(errno));
-                        }
-                    }
-
-
                     ret = picoquic_prepare_packet(cnx_next, current_time,
                                                   send_buffer, sizeof(send_buffer), &send_length, &path);
 
@@ -556,6 +744,7 @@ int quic_server(const char* server_name, int server_port,
 
                         if (cnx_next == cnx_server) {
                             cnx_server = NULL;
+                            tun->rings = NULL;
                         }
 
                         picoquic_delete_cnx(cnx_next);
@@ -607,7 +796,10 @@ int quic_server(const char* server_name, int server_port,
         }
     }
 
-    printf("Server exit, ret = %d\n", ret);
+    printf("Server exit, ret = %d, tunnel packets sent %" PRIu64 ", received %" PRIu64 ", dropped %" PRIu64 "\n",
+           ret, tun->nb_sent, tun->nb_received, tun->nb_dropped);
+    tun_close(tun);
+    free(tun);
 
     /* Clean up */
     if (qserver != NULL) {
@@ -732,7 +924,8 @@ static int client_callback(picoquic_cnx_t *cnx,
 
 int quic_client(const char* ip_address_text, int server_port, const char * sni,
                 const char * root_crt,
-                uint32_t proposed_version, int force_zero_share, int mtu_max, FILE* F_log, const char** plugin_fnames, int plugins, char *qlog_filename)
+                uint32_t proposed_version, int force_zero_share, int mtu_max, FILE* F_log, const char** plugin_fnames, int plugins, char *qlog_filename,
+                int nb_queues, int use_offload)
 {
     /* Start: start the QUIC process with cert and key files */
     int ret = 0;
@@ -748,7 +941,7 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
     socklen_t from_length;
     socklen_t to_length;
     int server_addr_length = 0;
-    uint8_t buffer[1536];
+    uint8_t buffer[PICOQUIC_VNET_FRAME_MAX];
     uint8_t send_buffer[1536];
     size_t send_length = 0;
     int bytes_sent;
@@ -762,6 +955,7 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
     int notified_ready = 0;
     int zero_rtt_available = 0;
     int new_context_created = 0;
+    pquic_vpn_tun_t* tun = NULL;
 
     memset(&callback_ctx, 0, sizeof(picoquic_first_client_callback_ctx_t));
 
@@ -842,6 +1036,16 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
                 plugin_insert_plugins_from_fnames(cnx_client, plugins, (char **) plugin_fnames);
             }
 
+            tun = (pquic_vpn_tun_t*) malloc(sizeof(pquic_vpn_tun_t));
+            if (tun == NULL || tun_open(tun, "tun0", nb_queues, use_offload) != 0) {
+                printf("Failed to open tun0\n");
+                exit(-1);
+            }
+            if (tun_attach_rings(tun, cnx_client) != 0) {
+                printf("The datagram plugin cannot provide its rings\n");
+                ret = -1;
+            }
+
             if (qlog_filename) {
                 int qlog_fd = open(qlog_filename, O_WRONLY | O_CREAT | O_TRUNC, 00755);
                 if (qlog_fd != -1) {
@@ -853,7 +1057,9 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
 
             picoquic_set_callback(cnx_client, client_callback, &callback_ctx);
 
-            ret = picoquic_start_client_cnx(cnx_client);
+            if (ret == 0) {
+                ret = picoquic_start_client_cnx(cnx_client);
+            }
 
             if (ret == 0) {
                 if (picoquic_is_0rtt_available(cnx_client) && (proposed_version & 0x0a0a0a0a) != 0x0a0a0a0a) {
@@ -889,14 +1095,15 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
         }
     }
 
-    int tun_fd = tun_open("tun0");
-    if (tun_fd == -1) {
-        printf("Failed to open tun0\n");
-        exit(-1);
+    SOCKET_TYPE sockets[1 + PQUIC_VPN_MAX_QUEUES + 1];
+    int nb_sockets = 0;
+    sockets[nb_sockets++] = fd;
+    if (tun != NULL) {
+        for (int i = 0; i < tun->nb_queues; i++) {
+            sockets[nb_sockets++] = tun->queue_fds[i];
+        }
+        sockets[nb_sockets++] = tun->event_fd;
     }
-    SOCKET_TYPE sockets[2];
-    sockets[0] = fd;
-    sockets[1] = tun_fd;
 
     /* Wait for packets */
     while (ret == 0 && picoquic_get_cnx_state(cnx_client) != picoquic_state_disconnected) {
@@ -904,7 +1111,7 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
 
         from_length = to_length = sizeof(struct sockaddr_storage);
 
-        bytes_recv = picoquic_select(sockets, 2, &packet_from, &from_length,
+        bytes_recv = picoquic_select(sockets, nb_sockets, &packet_from, &from_length,
                                      &packet_to, &to_length, &if_index_to,
                                      buffer, sizeof(buffer),
                                      delta_t,
@@ -916,7 +1123,7 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
                 fprintf(F_log, "Select returns %d, from length %u\n", bytes_recv, from_length);
             }
 
-            if (bytes_recv > 0 && qclient->rcv_socket != tun_fd && F_log != NULL)
+            if (bytes_recv > 0 && qclient->rcv_socket == fd && F_log != NULL)
             {
                 picoquic_log_packet_address(F_log,
                                             picoquic_val64_connection_id(picoquic_get_logging_cnxid(cnx_client)),
@@ -928,7 +1135,9 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
             ret = -1;
         } else {
             if (bytes_recv > 0) {
-                if (qclient->rcv_socket != tun_fd) {
+                if (qclient->rcv_socket == tun->event_fd) {
+                    /* The datagrams received are written below */
+                } else if (!tun_is_queue(tun, qclient->rcv_socket)) {
                     /* Submit the packet to the client */
                     ret = picoquic_incoming_packet(qclient, buffer,
                                                    (size_t) bytes_recv, (struct sockaddr *) &packet_from,
@@ -954,25 +1163,13 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
                         picoquic_log_error_packet(F_log, buffer, (size_t) bytes_recv, ret);
                     }
                 } else {
-                    handle_tun_read(cnx_client, tun_fd, buffer, bytes_recv);
+                    handle_tun_read(cnx_client, tun, buffer, bytes_recv);
                 }
 
                 delta_t = 0;
             }
 
-            int message_socket = (int) protoop_prepare_and_run_extern_noparam(cnx_client, &get_message_socket, 0, NULL);
-            char buffer[65535];
-            ssize_t mret = 1;
-            while(mret > 0) {
-                mret = recv(message_socket, buffer, sizeof(buffer), MSG_DONTWAIT);
-                if (mret > 0) {
-                    printf("Received %" PRIu64 " bytes as message\n", mret);
-                    ssize_t tret = write(tun_fd, buffer, (size_t) mret);
-                    printf("Write %" PRIu64 " bytes to the tunnel\n", tret);
-                } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    printf("Error when reading the message socket: %s\n", strerror(errno));
-                }
-            }
+            handle_tun_write(tun);
 
             /* In normal circumstances, the code waits until all packets in the receive
              * queue have been processed before sending new packets. However, if the server
@@ -1053,6 +1250,13 @@ int quic_client(const char* ip_address_text, int server_port, const char * sni,
         SOCKET_CLOSE(fd);
     }
 
+    if (tun != NULL) {
+        printf("Tunnel packets sent %" PRIu64 ", received %" PRIu64 ", dropped %" PRIu64 "\n",
+               tun->nb_sent, tun->nb_received, tun->nb_dropped);
+        tun_close(tun);
+        free(tun);
+    }
+
     return ret;
 }
 
@@ -1111,6 +1315,8 @@ void usage()
     fprintf(stderr, "  -l file               Log file\n");
     fprintf(stderr, "  -m mtu_max            Largest mtu value that can be tried for discovery\n");
     fprintf(stderr, "  -q output.qlog        qlog output file\n");
+    fprintf(stderr, "  -Q nb_queues          Number of queues of the tun device (default: 1, max: %d)\n", PQUIC_VPN_MAX_QUEUES);
+    fprintf(stderr, "  -O                    Use the TCP segmentation offloads of the tun device\n");
     fprintf(stderr, "  -h                    This help message\n");
     exit(1);
 }
@@ -1144,8 +1350,8 @@ static void cnx_id_callback(picoquic_connection_id_t cnx_id_local, picoquic_conn
 int main(int argc, char** argv)
 {
     get_max_message_size.hash = hash_value_str(get_max_message_size.id);
-    send_message.hash = hash_value_str(send_message.id);
-    get_message_socket.hash = hash_value_str(get_message_socket.id);
+    send_messages.hash = hash_value_str(send_messages.id);
+    get_message_rings.hash = hash_value_str(get_message_rings.id);
 
     const char* server_name = default_server_name;
     const char* server_cert_file = default_server_cert_file;
@@ -1170,6 +1376,8 @@ int main(int argc, char** argv)
     uint64_t* reset_seed = NULL;
     uint64_t reset_seed_x[2];
     int mtu_max = 0;
+    int nb_queues = 1;
+    int use_offload = 0;
 
 #ifdef _WINDOWS
     WSADATA wsaData;
@@ -1182,7 +1390,7 @@ int main(int argc, char** argv)
 
     /* Get the parameters */
     int opt;
-    while ((opt = getopt(argc, argv, "c:k:p:v:1rhzi:s:l:m:n:t:P:q:")) != -1) {
+    while ((opt = getopt(argc, argv, "c:k:p:v:1rhzi:s:l:m:n:t:P:q:Q:O")) != -1) {
         switch (opt) {
             case 'c':
                 server_cert_file = optarg;
@@ -1263,6 +1471,16 @@ int main(int argc, char** argv)
             case 'q':
                 qlog_filename = optarg;
                 break;
+            case 'Q':
+                nb_queues = atoi(optarg);
+                if (nb_queues <= 0 || nb_queues > PQUIC_VPN_MAX_QUEUES) {
+                    fprintf(stderr, "Invalid number of queues: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'O':
+                use_offload = 1;
+                break;
             case 'h':
                 usage();
                 break;
@@ -1323,7 +1541,7 @@ int main(int argc, char** argv)
                 /* TODO: find an alternative to using 64 bit mask. */
                           (cnx_id_mask_is_set == 0) ? NULL : cnx_id_callback,
                           (cnx_id_mask_is_set == 0) ? NULL : (void*)&cnx_id_cbdata,
-                          (uint8_t*)reset_seed, mtu_max, F_log, plugin_fnames, plugins, qlog_filename);
+                          (uint8_t*)reset_seed, mtu_max, F_log, plugin_fnames, plugins, qlog_filename, nb_queues, use_offload);
         printf("Server exit with code = %d\n", ret);
     } else {
         if (F_log != NULL) {
@@ -1335,7 +1553,7 @@ int main(int argc, char** argv)
         for(int i = 0; i < plugins; i++) {
             printf("\tplugin %s\n", plugin_fnames[i]);
         }
-        ret = quic_client(server_name, server_port, sni, root_trust_file, proposed_version, force_zero_share, mtu_max, F_log, plugin_fnames, plugins, qlog_filename);
+        ret = quic_client(server_name, server_port, sni, root_trust_file, proposed_version, force_zero_share, mtu_max, F_log, plugin_fnames, plugins, qlog_filename, nb_queues, use_offload);
 
         printf("Client exit with code = %d\n", ret);
 
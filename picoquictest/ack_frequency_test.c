@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+static picoquic_cnx_t* ack_frequency_test_cnx()
+{
+    struct sockaddr_in addr;
+    picoquic_cnx_t* cnx = calloc(1, sizeof(picoquic_cnx_t));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    if (cnx != NULL && picoquic_create_path(cnx, 0, (struct sockaddr*)&addr) < 0) {
+        free(cnx);
+        cnx = NULL;
+    }
+    if (cnx != NULL) {
+        register_protocol_operations(cnx);
+        cnx->local_parameters.min_ack_delay = PICOQUIC_ACK_DELAY_MIN;
+        cnx->local_parameters.max_ack_delay = 25;
+        cnx->remote_parameters.min_ack_delay = PICOQUIC_ACK_DELAY_MIN;
+        cnx->handshake_done = 1;
+    }
+
+    return cnx;
+}
+
+static void ack_frequency_test_free(picoquic_cnx_t* cnx)
+{
+    if (cnx != NULL) {
+        for (int i = 0; i < cnx->nb_paths; i++) {
+            for (picoquic_packet_context_enum pc = 0; pc < picoquic_nb_packet_context; pc++) {
+                picoquic_sack_list_free(&cnx->path[i]->pkt_ctx[pc].sack_list);
+            }
+            free(cnx->path[i]);
+        }
+        free(cnx->path);
+        picoquic_free_protoops(cnx->ops);
+        free(cnx);
+    }
+}
+
+/* Sends an ACK_FREQUENCY frame from the sender if one is due, and decodes it at the receiver */
+static int ack_frequency_test_one(picoquic_cnx_t* sender, picoquic_cnx_t* receiver, size_t* consumed)
+{
+    uint8_t bytes[64];
+    int ret = picoquic_prepare_ack_frequency_frame(sender, sender->path[0], bytes, sizeof(bytes), consumed);
+
+    if (ret == 0 && *consumed > 0) {
+        ret = picoquic_decode_frames_without_current_time(receiver, bytes, *consumed, 3, receiver->path[0]);
+    }
+
+    return ret;
+}
+
+int ack_frequency_test()
+{
+    int ret = 0;
+    picoquic_cnx_t* sender = ack_frequency_test_cnx();
+    picoquic_cnx_t* receiver = ack_frequency_test_cnx();
+    picoquic_packet_context_t* pkt_ctx;
+    uint8_t bytes[64];
+    size_t consumed = 0;
+
+    if (sender == NULL || receiver == NULL) {
+        ret = -1;
+    } else {
+        sender->path[0]->send_mtu = 1000;
+        sender->path[0]->cwin = 64000;
+        sender->path[0]->rtt_min = 40000;
+        pkt_ctx = &receiver->path[0]->pkt_ctx[picoquic_packet_context_application];
+    }
+
+    /* Four ACKs per congestion window, and a quarter of the RTT */
+    if (ret == 0 && (ack_frequency_test_one(sender, receiver, &consumed) != 0 || consumed == 0 ||
+        receiver->ack_gap_remote != 16 || receiver->ack_delay_remote != 10000 || pkt_ctx->ack_delay_local != 10000)) {
+        ret = -1;
+    }
+
+    /* The receiver waits for 16 packets, or the delay */
+    for (uint64_t pn = 1; ret == 0 && pn <= 16; pn++) {
+        if (picoquic_record_pn_received(receiver, receiver->path[0], picoquic_packet_context_application, pn, 0) != 0) {
+            ret = -1;
+        } else {
+            pkt_ctx->ack_needed = 1;
+            if (picoquic_is_ack_needed(receiver, 0, picoquic_packet_context_application, receiver->path[0]) != (pn == 16)) {
+                ret = -1;
+            }
+        }
+    }
+    if (ret == 0 && picoquic_is_ack_needed(receiver, 10000, picoquic_packet_context_application, receiver->path[0]) != 1) {
+        ret = -1;
+    }
+
+    /* Small changes of the congestion window do not trigger a new frame, doubling it does */
+    if (ret == 0) {
+        sender->path[0]->cwin = 96000;
+        if (ack_frequency_test_one(sender, receiver, &consumed) != 0 || consumed != 0) {
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        sender->path[0]->cwin = 128000;
+        if (ack_frequency_test_one(sender, receiver, &consumed) != 0 || consumed == 0 ||
+            receiver->ack_gap_remote != PICOQUIC_ACK_GAP_MAX || receiver->ack_frequency_sequence_remote != 2) {
+            ret = -1;
+        }
+    }
+
+    /* Values set by the application are sent as they are, and an obsolete frame is ignored */
+    if (ret == 0) {
+        uint8_t old_frame[64];
+        size_t old_length = 0;
+
+        picoquic_set_ack_frequency(sender, 4, 2000);
+        if (picoquic_prepare_ack_frequency_frame(sender, sender->path[0], bytes, sizeof(bytes), &consumed) != 0 || consumed == 0) {
+            ret = -1;
+        } else {
+            memcpy(old_frame, bytes, consumed);
+            old_length = consumed;
+            picoquic_set_ack_frequency(sender, 8, 0);
+            if (ack_frequency_test_one(sender, receiver, &consumed) != 0 || consumed == 0 ||
+                picoquic_decode_frames_without_current_time(receiver, old_frame, old_length, 3, receiver->path[0]) != 0 ||
+                receiver->ack_gap_remote != 8 || receiver->ack_delay_remote != 10000) {
+                ret = -1;
+            }
+        }
+    }
+
+    /* A delay below the announced minimum is a protocol violation */
+    if (ret == 0) {
+        sender->remote_parameters.min_ack_delay = 1;
+        picoquic_set_ack_frequency(sender, 8, 500);
+        if (ack_frequency_test_one(sender, receiver, &consumed) == 0 || receiver->local_error != PICOQUIC_TRANSPORT_PROTOCOL_VIOLATION) {
+            ret = -1;
+        }
+    }
+
+    ack_frequency_test_free(sender);
+    ack_frequency_test_free(receiver);
+
+    return ret;
+}
+
+int immediate_ack_test()
+{
+    int ret = 0;
+    picoquic_cnx_t* sender = ack_frequency_test_cnx();
+    picoquic_cnx_t* receiver = ack_frequency_test_cnx();
+    uint8_t bytes[16];
+    size_t consumed = 0;
+
+    if (sender == NULL || receiver == NULL) {
+        ret = -1;
+    } else {
+        picoquic_request_immediate_ack(sender);
+        if (picoquic_prepare_immediate_ack_frame(sender, bytes, sizeof(bytes), &consumed) != 0 || consumed != 2 ||
+            sender->immediate_ack_requested) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_packet_context_t* pkt_ctx = &receiver->path[0]->pkt_ctx[picoquic_packet_context_application];
+
+        /* A single packet is acknowledged at once, until the ACK is sent */
+        if (picoquic_record_pn_received(receiver, receiver->path[0], picoquic_packet_context_application, 1, 0) != 0 ||
+            picoquic_decode_frames(receiver, bytes, consumed, 3, 0, receiver->path[0]) != 0 ||
+            !pkt_ctx->ack_needed ||
+            picoquic_is_ack_needed(receiver, 0, picoquic_packet_context_application, receiver->path[0]) != 1 ||
+            picoquic_prepare_ack_frame(receiver, 0, picoquic_packet_context_application, bytes, sizeof(bytes), &consumed) != 0 ||
+            pkt_ctx->ack_immediate) {
+            ret = -1;
+        }
+    }
+
+    ack_frequency_test_free(sender);
+    ack_frequency_test_free(receiver);
+
+    return ret;
+}
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "alloc_profiler.h"
+
+#define ALLOC_PROFILER_TEST_NB_PACKETS 5
+#define ALLOC_PROFILER_TEST_NB_PLUGIN 7
+#define ALLOC_PROFILER_TEST_PERIOD 4096
+#define ALLOC_PROFILER_TEST_NB_SAMPLED 100000
+#define ALLOC_PROFILER_TEST_SAMPLED_SIZE 100
+
+static picoquic_alloc_profile_entry_t const* alloc_profiler_test_find(picoquic_alloc_profile_entry_t const* entries,
+    size_t nb_entries, picoquic_alloc_site_enum site, char const* plugin_name)
+{
+    for (size_t i = 0; i < nb_entries; i++) {
+        if (entries[i].site == site && (plugin_name == NULL || strcmp(entries[i].plugin_name, plugin_name) == 0)) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* Every allocation is counted with a period of 0, and the estimates of a sampled profile are close to the truth */
+int alloc_profiler_test()
+{
+    int ret = 0;
+    picoquic_alloc_profile_entry_t entries[16];
+    picoquic_alloc_profile_entry_t const* e;
+    size_t nb_entries;
+    size_t packet_size = 0;
+    queue_t* q = queue_init();
+    FILE* F = tmpfile();
+
+    if (q == NULL || F == NULL) {
+        ret = -1;
+    }
+
+    picoquic_alloc_profiler_start(0);
+    for (int i = 0; ret == 0 && i < ALLOC_PROFILER_TEST_NB_PACKETS; i++) {
+        picoquic_packet_t* packet = picoquic_create_packet(NULL);
+
+        if (packet == NULL) {
+            ret = -1;
+        } else {
+            packet_size = sizeof(picoquic_packet_t) + packet->bytes_max;
+            free(packet->bytes);
+            free(packet);
+        }
+    }
+    /* The array of the queue grows once */
+    for (uintptr_t i = 1; ret == 0 && i <= QUEUE_INITIAL_CAPACITY + 1; i++) {
+        ret = queue_enqueue(q, (void*)i);
+    }
+    for (int i = 0; ret == 0 && i < ALLOC_PROFILER_TEST_NB_PLUGIN; i++) {
+        picoquic_alloc_profile_record(picoquic_alloc_site_plugin, (i & 1) ? "test.plugin.odd" : "test.plugin.even", NULL, 10);
+    }
+    picoquic_alloc_profiler_stop();
+    picoquic_alloc_profile_record(picoquic_alloc_site_plugin, "test.plugin.odd", NULL, 10);
+
+    if (ret == 0) {
+        nb_entries = picoquic_alloc_profiler_snapshot(entries, sizeof(entries) / sizeof(entries[0]));
+        if (nb_entries != 4) {
+            DBG_PRINTF("Expected 4 sites, got %zu\n", nb_entries);
+            ret = -1;
+        } else if ((e = alloc_profiler_test_find(entries, nb_entries, picoquic_alloc_site_packet, NULL)) == NULL ||
+            e->count != ALLOC_PROFILER_TEST_NB_PACKETS || e->bytes != ALLOC_PROFILER_TEST_NB_PACKETS * packet_size || e->caller == 0) {
+            DBG_PRINTF("%s", "Wrong count of packets\n");
+            ret = -1;
+        } else if ((e = alloc_profiler_test_find(entries, nb_entries, picoquic_alloc_site_queue, NULL)) == NULL ||
+            e->count != 1 || e->bytes != 2 * QUEUE_INITIAL_CAPACITY * sizeof(void*)) {
+            DBG_PRINTF("%s", "Wrong count of queue growths\n");
+            ret = -1;
+        } else if ((e = alloc_profiler_test_find(entries, nb_entries, picoquic_alloc_site_plugin, "test.plugin.odd")) == NULL ||
+            e->count != ALLOC_PROFILER_TEST_NB_PLUGIN / 2 || e->caller != 0 ||
+            (e = alloc_profiler_test_find(entries, nb_entries, picoquic_alloc_site_plugin, "test.plugin.even")) == NULL ||
+            e->count != ALLOC_PROFILER_TEST_NB_PLUGIN - ALLOC_PROFILER_TEST_NB_PLUGIN / 2) {
+            DBG_PRINTF("%s", "Wrong count of plugin allocations\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        char line[256];
+        int nb_sections = 0;
+        int nb_records = 0;
+
+        ret = picoquic_alloc_profiler_dump(F);
+        rewind(F);
+        while (ret == 0 && fgets(line, sizeof(line), F) != NULL) {
+            if (strcmp(line, "--- symbol\n") == 0 || strcmp(line, "--- heap\n") == 0 ||
+                strncmp(line, "heap profile:", 13) == 0 || strcmp(line, "MAPPED_LIBRARIES:\n") == 0) {
+                nb_sections++;
+            } else if (strstr(line, "] @ 0x") != NULL) {
+                nb_records++;
+            }
+        }
+        if (nb_sections != 4 || nb_records != 4) {
+            DBG_PRINTF("Wrong dump, %d sections and %d records\n", nb_sections, nb_records);
+            ret = -1;
+        }
+    }
+
+    /* With a period of 4KB, about one allocation in 40 is sampled */
+    if (ret == 0) {
+        uint64_t expected = (uint64_t)ALLOC_PROFILER_TEST_NB_SAMPLED * ALLOC_PROFILER_TEST_SAMPLED_SIZE;
+
+        picoquic_alloc_profiler_start(ALLOC_PROFILER_TEST_PERIOD);
+        for (int i = 0; i < ALLOC_PROFILER_TEST_NB_SAMPLED; i++) {
+            picoquic_alloc_profile_record(picoquic_alloc_site_stream_data, NULL, (void*)alloc_profiler_test, ALLOC_PROFILER_TEST_SAMPLED_SIZE);
+        }
+        picoquic_alloc_profiler_stop();
+        nb_entries = picoquic_alloc_profiler_snapshot(entries, sizeof(entries) / sizeof(entries[0]));
+        if (nb_entries != 1 || entries[0].nb_samples == 0 || entries[0].nb_samples > ALLOC_PROFILER_TEST_NB_SAMPLED / 10 ||
+            entries[0].bytes < expected * 9 / 10 || entries[0].bytes > expected * 11 / 10) {
+            DBG_PRINTF("Estimated %" PRIu64 " bytes for %" PRIu64 ", with %" PRIu64 " samples\n",
+                (nb_entries > 0) ? entries[0].bytes : 0, expected, (nb_entries > 0) ? entries[0].nb_samples : 0);
+            ret = -1;
+        }
+    }
+
+    if (q != NULL) {
+        queue_free(q);
+    }
+    if (F != NULL) {
+        fclose(F);
+    }
+
+    return ret;
+}
@@ -0,0 +1,574 @@
+/*
+ * Congestion control benchmark. Each controller runs through a matrix of link
+ * conditions, the flows of a condition sharing the same bottleneck, and the
+ * results are written as JSON so that the effect of a change can be compared:
+ * goodput, queuing delay percentiles at the bottleneck, retransmission ratio,
+ * and Jain's fairness index of the bytes delivered to competing flows by the
+ * time the first one completes.
+ */
+
+#include "../picoquic/picoquic_internal.h"
+#include "picoquictest_internal.h"
+#ifdef _WINDOWS
+#include "..\picoquic\wincompat.h"
+#endif
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define CC_BENCH_SNI "test.example.com"
+#define CC_BENCH_ALPN "picoquic-test"
+#define CC_BENCH_MAX_FLOWS 4
+#define CC_BENCH_MAX_TIME 60000000 /* Simulated microseconds */
+#define CC_BENCH_MAX_BURST 64
+#define CC_BENCH_JSON_FILE "cc_bench.json"
+
+typedef struct st_cc_bench_controller_t {
+    char const* name; /* Name of the algorithm, unless a plugin replaces it */
+    char const* plugin_fname;
+} cc_bench_controller_t;
+
+typedef struct st_cc_bench_condition_t {
+    char const* name;
+    double data_rate_in_gbps;
+    uint64_t rtt; /* Microseconds */
+    uint64_t buffer_delay; /* Queue length at the bottleneck, microseconds */
+    uint64_t loss_mask; /* One packet lost per bit set, every 64 packets */
+    int nb_flows;
+    uint64_t flow_size;
+} cc_bench_condition_t;
+
+static const cc_bench_controller_t cc_bench_controllers[] = {
+    { "newreno", NULL },
+    { "cubic", NULL },
+    { "bbr", NULL },
+    { "ledbat", NULL },
+    { "westwood", "plugins/westwood/westwood_congestion_control.plugin" },
+    { "no_cc", "plugins/disable_congestion_control/disable_congestion_control.plugin" }
+};
+
+static const cc_bench_condition_t cc_bench_conditions[] = {
+    { "10M_40ms_bdp", 0.01, 40000, 40000, 0, 1, 4000000 },
+    { "10M_40ms_deep", 0.01, 40000, 200000, 0, 1, 4000000 },
+    { "100M_100ms_shallow", 0.1, 100000, 25000, 0, 1, 20000000 },
+    { "10M_40ms_loss", 0.01, 40000, 40000, 0x0000000100000001ull, 1, 4000000 },
+    { "10M_40ms_2flows", 0.01, 40000, 40000, 0, 2, 4000000 },
+    { "20M_20ms_4flows", 0.02, 20000, 20000, 0, 4, 4000000 }
+};
+
+typedef struct st_cc_bench_flow_t {
+    picoquic_quic_t* qclient;
+    picoquic_quic_t* qserver;
+    picoquic_cnx_t* cnx_client;
+    picoquic_cnx_t* cnx_server;
+    struct sockaddr_in client_addr;
+    struct sockaddr_in server_addr;
+    picoquictest_sim_link_t* c_to_s_link;
+    uint64_t* simulated_time;
+    uint64_t flow_size;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t bytes_at_first_completion;
+    uint64_t packets_sent;
+    uint64_t completion_time;
+    int is_complete;
+} cc_bench_flow_t;
+
+typedef struct st_cc_bench_ctx_t {
+    uint64_t simulated_time;
+    uint64_t loss_mask;
+    picoquictest_sim_link_t* s_to_c_link; /* The shared bottleneck */
+    cc_bench_flow_t flows[CC_BENCH_MAX_FLOWS];
+    int nb_flows;
+    int is_first_complete;
+    uint64_t* queue_delays;
+    size_t nb_queue_delays;
+    size_t queue_delays_max;
+} cc_bench_ctx_t;
+
+typedef struct st_cc_bench_result_t {
+    int is_complete;
+    double goodput;
+    double flow_goodput[CC_BENCH_MAX_FLOWS];
+    uint64_t queue_delay_p50;
+    uint64_t queue_delay_p99;
+    double retransmission_ratio;
+    double fairness;
+} cc_bench_result_t;
+
+/* The server responds to the request on stream 4 with flow_size bytes, provided as the transport polls them */
+static int cc_bench_server_callback(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* stream_ctx)
+{
+    int ret = 0;
+    cc_bench_flow_t* flow = (cc_bench_flow_t*)callback_ctx;
+
+    if (fin_or_event == picoquic_callback_stream_fin) {
+        ret = picoquic_mark_active_stream(cnx, stream_id, 1, NULL);
+    } else if (fin_or_event == picoquic_callback_prepare_to_send) {
+        size_t available = (size_t)(flow->flow_size - flow->bytes_sent);
+        int is_fin = 1;
+        uint8_t* buffer;
+
+        if (available > length) {
+            available = length;
+            is_fin = 0;
+        }
+        buffer = picoquic_provide_stream_data_buffer(bytes, available, is_fin, !is_fin);
+        if (buffer == NULL) {
+            ret = -1;
+        } else {
+            memset(buffer, 0x5A, available);
+            flow->bytes_sent += available;
+        }
+    }
+
+    return ret;
+}
+
+static int cc_bench_client_callback(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* stream_ctx)
+{
+    cc_bench_flow_t* flow = (cc_bench_flow_t*)callback_ctx;
+
+    if (fin_or_event == picoquic_callback_no_event || fin_or_event == picoquic_callback_stream_fin) {
+        flow->bytes_received += length;
+        if (fin_or_event == picoquic_callback_stream_fin) {
+            flow->is_complete = 1;
+            flow->completion_time = *flow->simulated_time;
+        }
+    }
+
+    return 0;
+}
+
+static void cc_bench_delete_ctx(cc_bench_ctx_t* bench)
+{
+    for (int i = 0; i < bench->nb_flows; i++) {
+        cc_bench_flow_t* flow = &bench->flows[i];
+
+        if (flow->qclient != NULL) {
+            picoquic_free(flow->qclient);
+        }
+        if (flow->qserver != NULL) {
+            picoquic_free(flow->qserver);
+        }
+        if (flow->c_to_s_link != NULL) {
+            picoquictest_sim_link_delete(flow->c_to_s_link);
+        }
+    }
+    if (bench->s_to_c_link != NULL) {
+        picoquictest_sim_link_delete(bench->s_to_c_link);
+    }
+    if (bench->queue_delays != NULL) {
+        free(bench->queue_delays);
+    }
+    free(bench);
+    picoquictest_sim_packet_pool_clear();
+}
+
+static int cc_bench_init_flow(cc_bench_ctx_t* bench, cc_bench_flow_t* flow, int flow_index,
+    cc_bench_controller_t const* controller, cc_bench_condition_t const* condition)
+{
+    int ret = 0;
+    picoquic_tp_t client_parameters;
+    picoquic_congestion_algorithm_t const* alg = picoquic_get_congestion_algorithm(controller->name);
+    const char* plugin_fnames[1];
+
+    plugin_fnames[0] = controller->plugin_fname;
+
+    flow->simulated_time = &bench->simulated_time;
+    flow->flow_size = condition->flow_size;
+
+    memset(&flow->client_addr, 0, sizeof(struct sockaddr_in));
+    flow->client_addr.sin_family = AF_INET;
+#ifdef _WINDOWS
+    flow->client_addr.sin_addr.S_un.S_addr = 0x0A000002;
+#else
+    flow->client_addr.sin_addr.s_addr = 0x0A000002;
+#endif
+    flow->client_addr.sin_port = (uint16_t)(1234 + flow_index);
+
+    memset(&flow->server_addr, 0, sizeof(struct sockaddr_in));
+    flow->server_addr.sin_family = AF_INET;
+#ifdef _WINDOWS
+    flow->server_addr.sin_addr.S_un.S_addr = 0x0A000001;
+#else
+    flow->server_addr.sin_addr.s_addr = 0x0A000001;
+#endif
+    flow->server_addr.sin_port = 4321;
+
+    flow->qclient = picoquic_create(8, NULL, NULL, PICOQUIC_TEST_CERT_STORE, NULL, cc_bench_client_callback,
+        flow, NULL, NULL, NULL, bench->simulated_time, &bench->simulated_time, NULL, NULL, 0, NULL);
+    flow->qserver = picoquic_create(8, PICOQUIC_TEST_SERVER_CERT, PICOQUIC_TEST_SERVER_KEY, PICOQUIC_TEST_CERT_STORE,
+        CC_BENCH_ALPN, cc_bench_server_callback, flow, NULL, NULL, NULL, bench->simulated_time,
+        &bench->simulated_time, NULL, NULL, 0, NULL);
+    /* The return path is not congested */
+    flow->c_to_s_link = picoquictest_sim_link_create(condition->data_rate_in_gbps, condition->rtt / 2, NULL, 0,
+        bench->simulated_time);
+
+    if (flow->qclient == NULL || flow->qserver == NULL || flow->c_to_s_link == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* The server connections take the controller when they are created */
+        if (alg != NULL) {
+            picoquic_set_default_congestion_algorithm(flow->qserver, alg);
+        }
+        if (controller->plugin_fname != NULL && picoquic_set_local_plugins(flow->qserver, plugin_fnames, 1) != 0) {
+            DBG_PRINTF("Cannot set the plugin %s\n", controller->plugin_fname);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        flow->cnx_client = picoquic_create_cnx(flow->qclient, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&flow->server_addr, bench->simulated_time, PICOQUIC_INTERNAL_TEST_VERSION_1,
+            CC_BENCH_SNI, CC_BENCH_ALPN, 1);
+        if (flow->cnx_client == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* The flow control must not limit the window */
+        picoquic_init_transport_parameters(&client_parameters, 1);
+        client_parameters.initial_max_stream_data_bidi_local = 2 * condition->flow_size;
+        client_parameters.initial_max_data = 2 * condition->flow_size;
+        picoquic_set_transport_parameters(flow->cnx_client, &client_parameters);
+        ret = picoquic_start_client_cnx(flow->cnx_client);
+    }
+
+    if (ret == 0) {
+        uint8_t request = 'G';
+
+        ret = picoquic_add_to_stream(flow->cnx_client, 4, &request, 1, 1);
+    }
+
+    return ret;
+}
+
+static cc_bench_ctx_t* cc_bench_create_ctx(cc_bench_controller_t const* controller, cc_bench_condition_t const* condition)
+{
+    int ret = 0;
+    cc_bench_ctx_t* bench = (cc_bench_ctx_t*)malloc(sizeof(cc_bench_ctx_t));
+
+    if (bench == NULL) {
+        return NULL;
+    }
+    memset(bench, 0, sizeof(cc_bench_ctx_t));
+    bench->loss_mask = condition->loss_mask;
+    bench->s_to_c_link = picoquictest_sim_link_create(condition->data_rate_in_gbps, condition->rtt / 2,
+        (condition->loss_mask == 0) ? NULL : &bench->loss_mask, condition->buffer_delay, 0);
+    if (bench->s_to_c_link == NULL) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < condition->nb_flows && i < CC_BENCH_MAX_FLOWS; i++) {
+        bench->nb_flows++;
+        ret = cc_bench_init_flow(bench, &bench->flows[i], i, controller, condition);
+    }
+
+    if (ret != 0) {
+        cc_bench_delete_ctx(bench);
+        bench = NULL;
+    }
+
+    return bench;
+}
+
+static int cc_bench_record_queue_delay(cc_bench_ctx_t* bench, uint64_t queue_delay)
+{
+    if (bench->nb_queue_delays >= bench->queue_delays_max) {
+        size_t new_max = (bench->queue_delays_max == 0) ? 4096 : 2 * bench->queue_delays_max;
+        uint64_t* new_delays = (uint64_t*)realloc(bench->queue_delays, new_max * sizeof(uint64_t));
+
+        if (new_delays == NULL) {
+            return -1;
+        }
+        bench->queue_delays = new_delays;
+        bench->queue_delays_max = new_max;
+    }
+    bench->queue_delays[bench->nb_queue_delays++] = queue_delay;
+
+    return 0;
+}
+
+/* Submits to the bottleneck the packets the server has ready, logging the queuing delay of those it accepts */
+static int cc_bench_submit_to_bottleneck(cc_bench_ctx_t* bench, cc_bench_flow_t* flow, picoquictest_sim_packet_t* packet)
+{
+    int ret = 0;
+    picoquictest_sim_link_t* link = bench->s_to_c_link;
+    uint64_t queue_delay = (link->queue_time > bench->simulated_time) ? link->queue_time - bench->simulated_time : 0;
+    uint64_t packets_sent = link->packets_sent;
+
+    packet->sent_time = bench->simulated_time;
+    picoquictest_sim_link_submit(link, packet, bench->simulated_time);
+    flow->packets_sent++;
+    if (link->packets_sent > packets_sent) {
+        ret = cc_bench_record_queue_delay(bench, queue_delay);
+    }
+
+    return ret;
+}
+
+static int cc_bench_prepare(cc_bench_ctx_t* bench, cc_bench_flow_t* flow, picoquic_cnx_t* cnx, int is_server, int* was_active)
+{
+    int ret = 0;
+
+    for (int i = 0; ret == 0 && i < CC_BENCH_MAX_BURST; i++) {
+        picoquic_path_t* path_x = NULL;
+        picoquictest_sim_packet_t* packet = picoquictest_sim_link_create_packet();
+
+        if (packet == NULL) {
+            ret = -1;
+            break;
+        }
+
+        ret = picoquic_prepare_packet(cnx, bench->simulated_time, packet->bytes, PICOQUIC_MAX_PACKET_SIZE,
+            &packet->length, &path_x);
+        if (ret != 0 || packet->length == 0) {
+            picoquictest_sim_link_free_packet(packet);
+            break;
+        }
+
+        *was_active = 1;
+        if (is_server) {
+            memcpy(&packet->addr_from, &flow->server_addr, sizeof(struct sockaddr_in));
+            memcpy(&packet->addr_to, &flow->client_addr, sizeof(struct sockaddr_in));
+            ret = cc_bench_submit_to_bottleneck(bench, flow, packet);
+        } else {
+            memcpy(&packet->addr_from, &flow->client_addr, sizeof(struct sockaddr_in));
+            memcpy(&packet->addr_to, &flow->server_addr, sizeof(struct sockaddr_in));
+            picoquictest_sim_link_submit(flow->c_to_s_link, packet, bench->simulated_time);
+        }
+    }
+
+    return ret;
+}
+
+static int cc_bench_deliver(cc_bench_ctx_t* bench, int* was_active)
+{
+    int ret = 0;
+    int new_context_created = 0;
+    picoquictest_sim_packet_t* packet;
+
+    while (ret == 0 && (packet = picoquictest_sim_link_dequeue(bench->s_to_c_link, bench->simulated_time)) != NULL) {
+        for (int i = 0; i < bench->nb_flows; i++) {
+            if (picoquic_compare_addr((struct sockaddr*)&bench->flows[i].client_addr,
+                (struct sockaddr*)&packet->addr_to) == 0) {
+                ret = picoquic_incoming_packet(bench->flows[i].qclient, packet->bytes, (uint32_t)packet->length,
+                    (struct sockaddr*)&packet->addr_from, (struct sockaddr*)&packet->addr_to, 0,
+                    bench->simulated_time, &new_context_created);
+                break;
+            }
+        }
+        *was_active = 1;
+        picoquictest_sim_link_free_packet(packet);
+    }
+
+    for (int i = 0; ret == 0 && i < bench->nb_flows; i++) {
+        cc_bench_flow_t* flow = &bench->flows[i];
+
+        while (ret == 0 && (packet = picoquictest_sim_link_dequeue(flow->c_to_s_link, bench->simulated_time)) != NULL) {
+            ret = picoquic_incoming_packet(flow->qserver, packet->bytes, (uint32_t)packet->length,
+                (struct sockaddr*)&packet->addr_from, (struct sockaddr*)&packet->addr_to, 0,
+                bench->simulated_time, &new_context_created);
+            if (flow->cnx_server == NULL) {
+                flow->cnx_server = picoquic_get_first_cnx(flow->qserver);
+            }
+            *was_active = 1;
+            picoquictest_sim_link_free_packet(packet);
+        }
+    }
+
+    return ret;
+}
+
+static uint64_t cc_bench_next_time(cc_bench_ctx_t* bench)
+{
+    uint64_t next_time = bench->simulated_time + CC_BENCH_MAX_TIME;
+
+    next_time = picoquictest_sim_link_next_arrival(bench->s_to_c_link, next_time);
+    for (int i = 0; i < bench->nb_flows; i++) {
+        cc_bench_flow_t* flow = &bench->flows[i];
+
+        next_time = picoquictest_sim_link_next_arrival(flow->c_to_s_link, next_time);
+        if (flow->cnx_client->cnx_state != picoquic_state_disconnected && flow->cnx_client->next_wake_time < next_time) {
+            next_time = flow->cnx_client->next_wake_time;
+        }
+        if (flow->cnx_server != NULL && flow->cnx_server->cnx_state != picoquic_state_disconnected &&
+            flow->cnx_server->next_wake_time < next_time) {
+            next_time = flow->cnx_server->next_wake_time;
+        }
+    }
+
+    return next_time;
+}
+
+static int cc_bench_loop(cc_bench_ctx_t* bench)
+{
+    int ret = 0;
+    int nb_complete = 0;
+
+    while (ret == 0 && nb_complete < bench->nb_flows && bench->simulated_time < CC_BENCH_MAX_TIME) {
+        int was_active = 0;
+        uint64_t next_time;
+
+        ret = cc_bench_deliver(bench, &was_active);
+
+        for (int i = 0; ret == 0 && i < bench->nb_flows; i++) {
+            cc_bench_flow_t* flow = &bench->flows[i];
+
+            ret = cc_bench_prepare(bench, flow, flow->cnx_client, 0, &was_active);
+            if (ret == 0 && flow->cnx_server != NULL) {
+                ret = cc_bench_prepare(bench, flow, flow->cnx_server, 1, &was_active);
+            }
+        }
+
+        nb_complete = 0;
+        for (int i = 0; i < bench->nb_flows; i++) {
+            nb_complete += bench->flows[i].is_complete;
+        }
+        if (nb_complete > 0 && !bench->is_first_complete) {
+            bench->is_first_complete = 1;
+            for (int i = 0; i < bench->nb_flows; i++) {
+                bench->flows[i].bytes_at_first_completion = bench->flows[i].bytes_received;
+            }
+        }
+
+        next_time = cc_bench_next_time(bench);
+        if (next_time <= bench->simulated_time) {
+            /* The connections woke up with nothing to send, move on */
+            next_time = bench->simulated_time + ((was_active) ? 1 : 1000);
+        }
+        bench->simulated_time = next_time;
+    }
+
+    return ret;
+}
+
+static int cc_bench_compare_delay(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static void cc_bench_compute_result(cc_bench_ctx_t* bench, cc_bench_result_t* result)
+{
+    uint64_t bytes_received = 0;
+    uint64_t last_completion = 0;
+    uint64_t nb_retransmissions = 0;
+    uint64_t packets_sent = 0;
+    double sum = 0;
+    double sum_squares = 0;
+
+    memset(result, 0, sizeof(cc_bench_result_t));
+    result->is_complete = 1;
+
+    for (int i = 0; i < bench->nb_flows; i++) {
+        cc_bench_flow_t* flow = &bench->flows[i];
+        uint64_t end_time = (flow->is_complete) ? flow->completion_time : bench->simulated_time;
+        double share = (double)flow->bytes_at_first_completion;
+
+        result->is_complete &= flow->is_complete;
+        bytes_received += flow->bytes_received;
+        if (end_time > last_completion) {
+            last_completion = end_time;
+        }
+        if (end_time > 0) {
+            result->flow_goodput[i] = ((double)flow->bytes_received * 8.0) / (double)end_time;
+        }
+        if (flow->cnx_server != NULL) {
+            nb_retransmissions += flow->cnx_server->nb_retransmission_total;
+        }
+        packets_sent += flow->packets_sent;
+        sum += share;
+        sum_squares += share * share;
+    }
+
+    /* Megabits per second, the flows all starting at time 0 */
+    if (last_completion > 0) {
+        result->goodput = ((double)bytes_received * 8.0) / (double)last_completion;
+    }
+    if (packets_sent > 0) {
+        result->retransmission_ratio = (double)nb_retransmissions / (double)packets_sent;
+    }
+    result->fairness = (sum_squares > 0) ? (sum * sum) / (bench->nb_flows * sum_squares) : 0;
+
+    if (bench->nb_queue_delays > 0) {
+        qsort(bench->queue_delays, bench->nb_queue_delays, sizeof(uint64_t), cc_bench_compare_delay);
+        result->queue_delay_p50 = bench->queue_delays[bench->nb_queue_delays / 2];
+        result->queue_delay_p99 = bench->queue_delays[(bench->nb_queue_delays * 99) / 100];
+    }
+}
+
+static void cc_bench_write_result(FILE* F, int is_first, cc_bench_controller_t const* controller,
+    cc_bench_condition_t const* condition, cc_bench_result_t const* result)
+{
+    fprintf(F, "%s\n  { \"controller\": \"%s\", \"condition\": \"%s\", \"bandwidth_mbps\": %.0f, \"rtt_ms\": %.1f, ",
+        (is_first) ? "" : ",", controller->name, condition->name, condition->data_rate_in_gbps * 1000.0,
+        (double)condition->rtt / 1000.0);
+    fprintf(F, "\"buffer_ms\": %.1f, \"loss_mask\": \"%016llx\", \"flows\": %d, \"flow_bytes\": %llu, \"completed\": %s,\n",
+        (double)condition->buffer_delay / 1000.0, (unsigned long long)condition->loss_mask, condition->nb_flows,
+        (unsigned long long)condition->flow_size, (result->is_complete) ? "true" : "false");
+    fprintf(F, "    \"goodput_mbps\": %.3f, \"flow_goodput_mbps\": [", result->goodput);
+    for (int i = 0; i < condition->nb_flows; i++) {
+        fprintf(F, "%s%.3f", (i == 0) ? "" : ", ", result->flow_goodput[i]);
+    }
+    fprintf(F, "], \"queue_delay_p50_ms\": %.3f, \"queue_delay_p99_ms\": %.3f, \"retransmission_ratio\": %.4f, \"fairness\": %.4f }",
+        (double)result->queue_delay_p50 / 1000.0, (double)result->queue_delay_p99 / 1000.0,
+        result->retransmission_ratio, result->fairness);
+}
+
+int cc_bench_test()
+{
+    int ret = 0;
+    int is_first = 1;
+    size_t nb_controllers = sizeof(cc_bench_controllers) / sizeof(cc_bench_controller_t);
+    size_t nb_conditions = sizeof(cc_bench_conditions) / sizeof(cc_bench_condition_t);
+    FILE* F = picoquic_file_open(CC_BENCH_JSON_FILE, "w");
+
+    if (F == NULL) {
+        DBG_PRINTF("Cannot open %s\n", CC_BENCH_JSON_FILE);
+        return -1;
+    }
+    fprintf(F, "[");
+
+    for (size_t i = 0; ret == 0 && i < nb_controllers; i++) {
+        cc_bench_controller_t const* controller = &cc_bench_controllers[i];
+
+        for (size_t j = 0; ret == 0 && j < nb_conditions; j++) {
+            cc_bench_result_t result;
+            cc_bench_ctx_t* bench = cc_bench_create_ctx(controller, &cc_bench_conditions[j]);
+
+            if (bench == NULL) {
+                DBG_PRINTF("Cannot create the %s bench for %s\n", cc_bench_conditions[j].name, controller->name);
+                ret = -1;
+                break;
+            }
+
+            ret = cc_bench_loop(bench);
+            if (ret == 0) {
+                cc_bench_compute_result(bench, &result);
+                cc_bench_write_result(F, is_first, controller, &cc_bench_conditions[j], &result);
+                is_first = 0;
+                /* All flows complete with the controllers of the library, the plugins are only reported */
+                if (!result.is_complete && controller->plugin_fname == NULL) {
+                    DBG_PRINTF("%s on %s: transfer not complete\n", controller->name, cc_bench_conditions[j].name);
+                    ret = -1;
+                }
+            }
+            cc_bench_delete_ctx(bench);
+        }
+    }
+
+    fprintf(F, "\n]\n");
+    (void)picoquic_file_close(F);
+
+    return ret;
+}
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+/* A spurious loss restores the window saved when the recovery started, a CE mark or a later packet does not */
+static int cc_undo_test_one(picoquic_congestion_algorithm_t* alg)
+{
+    int ret = 0;
+    uint64_t current_time = 1000000;
+    uint64_t cwin_before;
+    picoquic_cnx_t* cnx = (picoquic_cnx_t*)calloc(1, sizeof(picoquic_cnx_t));
+    picoquic_path_t* path_x = (picoquic_path_t*)calloc(1, sizeof(picoquic_path_t));
+
+    if (cnx == NULL || path_x == NULL) {
+        ret = -1;
+    } else {
+        path_x->send_mtu = PICOQUIC_INITIAL_MTU_IPV4;
+        path_x->smoothed_rtt = 100000;
+        path_x->pkt_ctx[picoquic_packet_context_application].send_sequence = 100;
+        alg->alg_init(cnx, path_x);
+        if (path_x->congestion_alg_state == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        alg->alg_notify(path_x, picoquic_congestion_notification_acknowledgement, 0, 50000, 0, current_time);
+        cwin_before = path_x->cwin;
+        alg->alg_notify(path_x, picoquic_congestion_notification_repeat, 0, 0, 50, current_time);
+        if (path_x->cwin >= cwin_before) {
+            ret = -1;
+        }
+    }
+
+    /* The retransmission of a packet sent after the recovery started does not undo it */
+    if (ret == 0) {
+        uint64_t cwin_recovery = path_x->cwin;
+
+        alg->alg_notify(path_x, picoquic_congestion_notification_spurious_repeat, 0, 0, 100, current_time);
+        if (path_x->cwin != cwin_recovery) {
+            ret = -1;
+        }
+    }
+
+    /* The loss of packet 50 was spurious, the window is back and slow start goes on */
+    if (ret == 0) {
+        alg->alg_notify(path_x, picoquic_congestion_notification_spurious_repeat, 0, 0, 50, current_time);
+        if (path_x->cwin != cwin_before) {
+            ret = -1;
+        } else {
+            alg->alg_notify(path_x, picoquic_congestion_notification_acknowledgement, 0, 10000, 0, current_time);
+            if (path_x->cwin != cwin_before + 10000) {
+                ret = -1;
+            }
+        }
+    }
+
+    /* The reduction for a CE mark is kept */
+    if (ret == 0) {
+        current_time += 2 * path_x->smoothed_rtt;
+        path_x->pkt_ctx[picoquic_packet_context_application].send_sequence = 200;
+        cwin_before = path_x->cwin;
+        alg->alg_notify(path_x, picoquic_congestion_notification_congestion_experienced, 0, 0, 0, current_time);
+        alg->alg_notify(path_x, picoquic_congestion_notification_spurious_repeat, 0, 0, 150, current_time);
+        if (path_x->cwin >= cwin_before) {
+            ret = -1;
+        }
+    }
+
+    if (path_x != NULL) {
+        alg->alg_delete(cnx, path_x);
+        free(path_x);
+    }
+    if (cnx != NULL) {
+        free(cnx);
+    }
+
+    return ret;
+}
+
+int cc_undo_test()
+{
+    int ret = cc_undo_test_one(picoquic_newreno_algorithm);
+
+    if (ret == 0) {
+        ret = cc_undo_test_one(picoquic_cubic_algorithm);
+    }
+
+    return ret;
+}
@@ -28,7 +28,12 @@
 #include "../picoquic/picoquic_internal.h"
 #include "../picoquic/tls_api.h"
 #include "../picoquic/util.h"
+#include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
+#ifndef _WINDOWS
+#include <sys/time.h>
+#endif
 #include "picoquictest_internal.h"
 
 static uint8_t const addr1[4] = { 10, 0, 0, 1 };
@@ -493,4 +498,101 @@ int cleartext_hp_enc_test()
     }
 
     return ret;
-}
\ No newline at end of file
+}
+/*
+ * Throughput of the AES-128-GCM of each supported AEAD provider, on packets of the usual size.
+ * All of them must produce the same packets, since they implement the same algorithm.
+ */
+#define AEAD_PROVIDER_BENCH_NB_PACKETS 20000
+#define AEAD_PROVIDER_BENCH_PACKET_SIZE 1440
+#define AEAD_PROVIDER_BENCH_HEADER_SIZE 17
+
+int aead_provider_bench_test()
+{
+    int ret = 0;
+    uint8_t secret[32];
+    uint8_t packet[AEAD_PROVIDER_BENCH_PACKET_SIZE + 16];
+    uint8_t decrypted[AEAD_PROVIDER_BENCH_PACKET_SIZE];
+    uint8_t reference[AEAD_PROVIDER_BENCH_PACKET_SIZE + 16];
+    size_t reference_length = 0;
+    uint8_t cleartext[AEAD_PROVIDER_BENCH_PACKET_SIZE];
+    char const* name;
+
+    for (size_t i = 0; i < sizeof(secret); i++) {
+        secret[i] = (uint8_t)(i + 1);
+    }
+    for (size_t i = 0; i < sizeof(cleartext); i++) {
+        cleartext[i] = (uint8_t)(31 * i);
+    }
+
+    for (size_t rank = 0; ret == 0 && (name = picoquic_get_aead_provider_name(rank)) != NULL; rank++) {
+        ptls_cipher_suite_t** suites = picoquic_get_aead_provider_suites(name);
+        ptls_cipher_suite_t* suite = NULL;
+        ptls_aead_context_t* aead_enc = NULL;
+        ptls_aead_context_t* aead_dec = NULL;
+
+        if (suites == NULL) {
+            fprintf(stderr, "AEAD provider %s: not supported by this CPU\n", name);
+            continue;
+        }
+        for (size_t i = 0; suites[i] != NULL && suite == NULL; i++) {
+            if (suites[i]->id == PTLS_CIPHER_SUITE_AES_128_GCM_SHA256) {
+                suite = suites[i];
+            }
+        }
+        if (suite == NULL) {
+            continue;
+        }
+
+        aead_enc = ptls_aead_new(suite->aead, suite->hash, 1, secret, PICOQUIC_LABEL_QUIC_BASE);
+        aead_dec = ptls_aead_new(suite->aead, suite->hash, 0, secret, PICOQUIC_LABEL_QUIC_BASE);
+        if (aead_enc == NULL || aead_dec == NULL) {
+            DBG_PRINTF("Cannot create the AEAD contexts of %s\n", name);
+            ret = -1;
+        } else {
+            struct timeval tv_start;
+            struct timeval tv_end;
+            uint64_t duration;
+            size_t length = 0;
+
+            gettimeofday(&tv_start, NULL);
+            for (uint64_t pn = 0; ret == 0 && pn < AEAD_PROVIDER_BENCH_NB_PACKETS; pn++) {
+                memcpy(packet, cleartext, AEAD_PROVIDER_BENCH_HEADER_SIZE);
+                length = AEAD_PROVIDER_BENCH_HEADER_SIZE + ptls_aead_encrypt(aead_enc, packet + AEAD_PROVIDER_BENCH_HEADER_SIZE,
+                    cleartext + AEAD_PROVIDER_BENCH_HEADER_SIZE, sizeof(cleartext) - AEAD_PROVIDER_BENCH_HEADER_SIZE,
+                    pn, packet, AEAD_PROVIDER_BENCH_HEADER_SIZE);
+                if (ptls_aead_decrypt(aead_dec, decrypted, packet + AEAD_PROVIDER_BENCH_HEADER_SIZE,
+                    length - AEAD_PROVIDER_BENCH_HEADER_SIZE, pn, packet, AEAD_PROVIDER_BENCH_HEADER_SIZE) !=
+                    sizeof(cleartext) - AEAD_PROVIDER_BENCH_HEADER_SIZE) {
+                    DBG_PRINTF("Provider %s cannot decrypt packet %d\n", name, (int)pn);
+                    ret = -1;
+                }
+            }
+            gettimeofday(&tv_end, NULL);
+            duration = (uint64_t)((tv_end.tv_sec - tv_start.tv_sec) * 1000000 + (tv_end.tv_usec - tv_start.tv_usec));
+
+            fprintf(stderr, "AEAD provider %s: %d packets of %d bytes sealed and opened in %" PRIu64 " us\n",
+                name, AEAD_PROVIDER_BENCH_NB_PACKETS, AEAD_PROVIDER_BENCH_PACKET_SIZE, duration);
+
+            /* The last packet is compared with the one of the first provider */
+            if (ret == 0) {
+                if (reference_length == 0) {
+                    memcpy(reference, packet, length);
+                    reference_length = length;
+                } else if (length != reference_length || memcmp(reference, packet, length) != 0) {
+                    DBG_PRINTF("Provider %s does not produce the same packets\n", name);
+                    ret = -1;
+                }
+            }
+        }
+
+        if (aead_enc != NULL) {
+            ptls_aead_free(aead_enc);
+        }
+        if (aead_dec != NULL) {
+            ptls_aead_free(aead_dec);
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,56 @@
+#include <stdlib.h>
+#include "picoquic_internal.h"
+
+#define CLOCK_TEST_NB_READS 100000
+
+int clock_test()
+{
+    int ret = 0;
+    uint64_t previous = picoquic_current_time();
+    uint64_t wall = picoquic_wall_time();
+    picoquic_quic_t* quic = (picoquic_quic_t*)calloc(1, sizeof(picoquic_quic_t));
+
+    /* The monotonic clock starts at the wall time */
+    if (previous + 1000000 < wall || wall + 1000000 < previous) {
+        DBG_PRINTF("Clock at %" PRIu64 ", wall time %" PRIu64 "\n", previous, wall);
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < CLOCK_TEST_NB_READS; i++) {
+        uint64_t now = picoquic_current_time();
+
+        if (now < previous) {
+            DBG_PRINTF("Clock going back from %" PRIu64 " to %" PRIu64 "\n", previous, now);
+            ret = -1;
+        }
+        previous = now;
+    }
+
+    if (ret == 0 && quic == NULL) {
+        ret = -1;
+    }
+
+    /* The loop time reads the clock until it is refreshed, and then stays */
+    if (ret == 0) {
+        uint64_t loop_time;
+
+        if (picoquic_get_loop_time(quic) < previous) {
+            DBG_PRINTF("%s", "The loop time before a refresh is not the current time\n");
+            ret = -1;
+        } else if ((loop_time = picoquic_refresh_time(quic)) < previous) {
+            DBG_PRINTF("%s", "The refreshed time is not the current time\n");
+            ret = -1;
+        } else {
+            while (picoquic_current_time() == loop_time) {
+            }
+            if (picoquic_get_loop_time(quic) != loop_time || picoquic_cached_time() != loop_time) {
+                DBG_PRINTF("%s", "The loop time is not cached\n");
+                ret = -1;
+            }
+        }
+    }
+
+    free(quic);
+
+    return ret;
+}
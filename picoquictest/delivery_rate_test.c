@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "cc_common.h"
+
+/* The max filter keeps the best sample of the window, then falls back to the next best ones */
+static int win_filter_max_test()
+{
+    int ret = 0;
+    picoquic_win_filter_t filter;
+    uint64_t window = 10;
+
+    memset(&filter, 0, sizeof(filter));
+
+    if (picoquic_win_filter_max(&filter, window, 1, 100) != 100 ||
+        picoquic_win_filter_max(&filter, window, 2, 50) != 100 ||
+        picoquic_win_filter_max(&filter, window, 6, 80) != 100 ||
+        picoquic_win_filter_max(&filter, window, 9, 60) != 100) {
+        ret = -1;
+    }
+
+    /* The 100 leaves the window, the 80 is the next best */
+    if (ret == 0 && picoquic_win_filter_max(&filter, window, 12, 40) != 80) {
+        ret = -1;
+    }
+
+    /* A higher sample takes over at once */
+    if (ret == 0 && picoquic_win_filter_max(&filter, window, 13, 200) != 200) {
+        ret = -1;
+    }
+
+    /* After a long silence, only the new sample is left */
+    if (ret == 0 && picoquic_win_filter_max(&filter, window, 100, 10) != 10) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int win_filter_min_test()
+{
+    int ret = 0;
+    picoquic_win_filter_t filter;
+    uint64_t window = 1000;
+
+    picoquic_win_filter_reset(&filter, 0, 5000);
+
+    if (picoquic_win_filter_min(&filter, window, 100, 3000) != 3000 ||
+        picoquic_win_filter_min(&filter, window, 400, 4000) != 3000 ||
+        picoquic_win_filter_min(&filter, window, 700, 3500) != 3000) {
+        ret = -1;
+    }
+
+    if (ret == 0 && picoquic_win_filter_min(&filter, window, 1200, 6000) != 3500) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int delivery_rate_sample_test()
+{
+    int ret = 0;
+    picoquic_path_t* path_x = (picoquic_path_t*)malloc(sizeof(picoquic_path_t));
+    picoquic_rate_sample_t rs;
+
+    if (path_x == NULL) {
+        return -1;
+    }
+    memset(path_x, 0, sizeof(picoquic_path_t));
+    memset(&rs, 0, sizeof(rs));
+
+    /* 100000 bytes in 100 ms, the ACK interval being the longest */
+    path_x->delivered = 110000;
+    if (picoquic_delivery_rate_sample(path_x, 1050000, 10000, 1000000, 1000000, 0, 1100000, &rs) != 1 ||
+        rs.delivered != 100000 || rs.interval != 100000 || rs.delivery_rate != 1000000 ||
+        rs.prior_delivered != 10000 || rs.is_app_limited) {
+        ret = -1;
+    }
+
+    /* The send interval is the longest, when the ACKs are compressed */
+    if (ret == 0 && (picoquic_delivery_rate_sample(path_x, 1200000, 10000, 1000000, 1000000, 1, 1100000, &rs) != 1 ||
+        rs.interval != 200000 || rs.delivery_rate != 500000 || !rs.is_app_limited)) {
+        ret = -1;
+    }
+
+    /* No sample over too short an interval */
+    if (ret == 0 && picoquic_delivery_rate_sample(path_x, 1000500, 10000, 1000000, 1000000, 0,
+        1000000 + PICOQUIC_BANDWIDTH_TIME_INTERVAL_MIN, &rs) != 0) {
+        ret = -1;
+    }
+
+    /* App limited until the data in transit is delivered */
+    if (ret == 0) {
+        path_x->bytes_in_transit = 20000;
+        picoquic_delivery_rate_set_app_limited(path_x);
+        if (path_x->delivered_limited_index != 130000) {
+            ret = -1;
+        }
+        path_x->delivered = 0;
+        path_x->bytes_in_transit = 0;
+        picoquic_delivery_rate_set_app_limited(path_x);
+        if (path_x->delivered_limited_index == 0) {
+            ret = -1;
+        }
+    }
+
+    free(path_x);
+
+    return ret;
+}
+
+int delivery_rate_test()
+{
+    int ret = win_filter_max_test();
+
+    if (ret == 0) {
+        ret = win_filter_min_test();
+    }
+    if (ret == 0) {
+        ret = delivery_rate_sample_test();
+    }
+
+    return ret;
+}
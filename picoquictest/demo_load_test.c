@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "../picohttp/demoload.h"
+
+/* Request mixes, with the weights and numbers of streams of their scenarios */
+typedef struct st_demo_load_mix_test_t {
+    char const* text;
+    int ret;
+    size_t nb_scenarios;
+    unsigned int weights[3];
+    size_t nb_streams[3];
+} demo_load_mix_test_t;
+
+static const demo_load_mix_test_t demo_load_mix_cases[] = {
+    { "index.html", 0, 1, { 1 }, { 1 } },
+    { "9@index.html;4:style.css|video.mp4", 0, 2, { 9, 1 }, { 2, 1 } },
+    { "0:index.html|12@4:-:a.txt;8:b.txt|2@c.txt", 0, 3, { 1, 12, 2 }, { 1, 2, 1 } },
+    { "0@index.html", -1, 0, { 0 }, { 0 } },
+    { "index.html|", -1, 0, { 0 }, { 0 } },
+    { "3@*x:index.html", -1, 0, { 0 }, { 0 } }
+};
+
+static const size_t nb_demo_load_mix_cases = sizeof(demo_load_mix_cases) / sizeof(demo_load_mix_test_t);
+
+int demo_load_test()
+{
+    int ret = 0;
+    picohttp_histogram_t* histogram = (picohttp_histogram_t*)calloc(1, sizeof(picohttp_histogram_t));
+
+    if (histogram == NULL) {
+        return -1;
+    }
+
+    /* Values 1 to 10000: the percentiles are exact below 32, then within 1/16 above */
+    for (uint64_t v = 1; v <= 10000; v++) {
+        picohttp_histogram_add(histogram, v);
+    }
+    if (histogram->count != 10000 || histogram->max != 10000 || histogram->sum != 50005000) {
+        DBG_PRINTF("Histogram count %" PRIu64 ", max %" PRIu64 ", sum %" PRIu64 "\n", histogram->count, histogram->max, histogram->sum);
+        ret = -1;
+    } else if (picohttp_histogram_percentile(histogram, 0.001) != 10 ||
+        picohttp_histogram_percentile(histogram, 0.0001) != 1 ||
+        picohttp_histogram_percentile(histogram, 1.0) != 10000) {
+        DBG_PRINTF("%s", "Wrong extreme percentiles\n");
+        ret = -1;
+    } else {
+        static const double fractions[] = { 0.5, 0.9, 0.99, 0.999 };
+
+        for (size_t i = 0; ret == 0 && i < sizeof(fractions) / sizeof(double); i++) {
+            uint64_t exact = (uint64_t)(fractions[i] * 10000);
+            uint64_t value = picohttp_histogram_percentile(histogram, fractions[i]);
+
+            if (value < exact || value > exact + exact / 16) {
+                DBG_PRINTF("Percentile %f is %" PRIu64 ", expected %" PRIu64 "\n", fractions[i], value, exact);
+                ret = -1;
+            }
+        }
+    }
+
+    /* The largest values have a bucket too */
+    if (ret == 0) {
+        memset(histogram, 0, sizeof(picohttp_histogram_t));
+        picohttp_histogram_add(histogram, UINT64_MAX);
+        if (picohttp_histogram_percentile(histogram, 0.5) != UINT64_MAX) {
+            DBG_PRINTF("%s", "Wrong percentile of the largest value\n");
+            ret = -1;
+        }
+    }
+
+    free(histogram);
+
+    for (size_t i = 0; ret == 0 && i < nb_demo_load_mix_cases; i++) {
+        demo_load_mix_test_t const* test = &demo_load_mix_cases[i];
+        size_t nb_scenarios = 0;
+        picohttp_load_scenario_t* scenarios = NULL;
+
+        if (picohttp_load_parse_mix(test->text, &nb_scenarios, &scenarios) != test->ret ||
+            nb_scenarios != test->nb_scenarios) {
+            DBG_PRINTF("Mix \"%s\" parsed as %zu scenarios\n", test->text, nb_scenarios);
+            ret = -1;
+        } else {
+            for (size_t j = 0; ret == 0 && j < nb_scenarios; j++) {
+                if (scenarios[j].weight != test->weights[j] || scenarios[j].nb_streams != test->nb_streams[j]) {
+                    DBG_PRINTF("Mix \"%s\", scenario %zu has weight %u and %zu streams\n", test->text, j,
+                        scenarios[j].weight, scenarios[j].nb_streams);
+                    ret = -1;
+                }
+            }
+        }
+
+        if (scenarios != NULL) {
+            picohttp_load_delete_mix(nb_scenarios, scenarios);
+        }
+    }
+
+    return ret;
+}
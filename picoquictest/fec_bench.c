@@ -0,0 +1,399 @@
+/*
+ * FEC scheme benchmark. The pluglets of each scheme are loaded from a small
+ * manifest and run directly, in JIT and interpreted modes, to encode blocks of
+ * source symbols and to decode them once some are lost. The native GF(256)
+ * region kernel is timed on the encoding work for comparison, and the results
+ * are written as JSON so that regressions can be tracked.
+ */
+
+#include "picoquic_internal.h"
+#include "plugin.h"
+#include "memory.h"
+#include "protoop.h"
+#include "gf256_region.h"
+
+#include "../plugins/fec/fec.h"
+
+#define FEC_BENCH_JSON_FILE "fec_bench.json"
+#define FEC_BENCH_SYMBOL_SIZE 1200
+#define FEC_BENCH_MAX_SOURCE 30
+#define FEC_BENCH_MAX_REPAIR 6
+#define FEC_BENCH_ITERATIONS 32
+/* The RLC decoders are kept per block number modulo 3, alternating between these two resets them */
+#define FEC_BENCH_NB_BLOCKS 2
+
+typedef struct st_fec_bench_scheme_t {
+    char const* name;
+    char const* plugin_fname;
+    uint8_t max_repair_symbols;
+} fec_bench_scheme_t;
+
+typedef struct st_fec_bench_window_t {
+    uint8_t source_symbols;
+    uint8_t repair_symbols;
+} fec_bench_window_t;
+
+typedef enum {
+    fec_bench_loss_first = 0, /* the first source symbols */
+    fec_bench_loss_spread, /* evenly spread over the block */
+    fec_bench_loss_last /* the last source symbols */
+} fec_bench_loss_t;
+
+static const fec_bench_scheme_t fec_bench_schemes[] = {
+    { "xor", "plugins/fec/fec_bench_xor.plugin", 1 },
+    { "rlc_gf256", "plugins/fec/fec_bench_rlc_gf256.plugin", FEC_BENCH_MAX_REPAIR },
+    { "rs_gf256", "plugins/fec/fec_bench_rs_gf256.plugin", FEC_BENCH_MAX_REPAIR }
+};
+
+static const fec_bench_window_t fec_bench_windows[] = {
+    { 5, 1 },
+    { 10, 2 },
+    { 20, 4 },
+    { 30, 6 }
+};
+
+static char const* fec_bench_loss_names[] = { "first", "spread", "last" };
+
+#define FEC_BENCH_PID(name) ((protoop_id_t) { .id = (char*)name, .hash = hash_value_str((char*)name) })
+
+typedef struct st_fec_bench_ctx_t {
+    picoquic_cnx_t cnx;
+    protoop_plugin_t* plugin;
+    pluglet_t* create;
+    pluglet_t* generate;
+    pluglet_t* recover;
+    void* fec_scheme;
+    protoop_arg_t inputv[PROTOOPARGS_MAX];
+    protoop_arg_t outputv[PROTOOPARGS_MAX];
+    /* In the plugin memory, as the pluglets access them */
+    source_symbol_t* source_symbols[FEC_BENCH_MAX_SOURCE];
+    fec_block_t* blocks[FEC_BENCH_NB_BLOCKS];
+} fec_bench_ctx_t;
+
+static uint64_t fec_bench_elapsed(struct timeval* start, struct timeval* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000 + (end->tv_usec - start->tv_usec);
+}
+
+static pluglet_t* fec_bench_get_pluglet(picoquic_cnx_t* cnx, char const* pid_str)
+{
+    protoop_id_t pid = FEC_BENCH_PID(pid_str);
+    protocol_operation_struct_t* post;
+
+    HASH_FIND_PID(cnx->ops, &pid.hash, post);
+    if (post == NULL || post->params == NULL || post->params->replace == NULL) {
+        DBG_PRINTF("No pluglet for %s\n", pid_str);
+        return NULL;
+    }
+    return post->params->replace->p == NULL ? NULL : post->params->replace;
+}
+
+static uint64_t fec_bench_run(fec_bench_ctx_t* bench, pluglet_t* pluglet, int nb_args, bool jit)
+{
+    char* error_msg = NULL;
+    uint64_t ret;
+
+    bench->cnx.protoop_inputv = bench->inputv;
+    bench->cnx.protoop_inputc = nb_args;
+    bench->cnx.protoop_outputv = bench->outputv;
+    bench->cnx.protoop_outputc_callee = 0;
+    ret = _exec_loaded_code(pluglet, (void*)&bench->cnx, (void*)bench->plugin->memory, bench->plugin->memory_size, &error_msg, jit);
+    if (error_msg != NULL) {
+        DBG_PRINTF("Pluglet error: %s\n", error_msg);
+    }
+    return ret;
+}
+
+static void fec_bench_free_repair_symbols(picoquic_cnx_t* cnx, fec_block_t* fb)
+{
+    for (int i = 0; i < MAX_SYMBOLS_PER_FEC_BLOCK; i++) {
+        if (fb->repair_symbols[i] != NULL) {
+            my_free(cnx, fb->repair_symbols[i]->data);
+            my_free(cnx, fb->repair_symbols[i]);
+            fb->repair_symbols[i] = NULL;
+        }
+    }
+}
+
+/* Sets the block up with all its source symbols, as the sender does before generating */
+static void fec_bench_fill_block(fec_bench_ctx_t* bench, fec_block_t* fb, fec_bench_window_t const* window)
+{
+    fb->total_source_symbols = window->source_symbols;
+    fb->total_repair_symbols = window->repair_symbols;
+    fb->current_source_symbols = window->source_symbols;
+    fb->current_repair_symbols = 0;
+    for (int i = 0; i < window->source_symbols; i++) {
+        fb->source_symbols[i] = bench->source_symbols[i];
+    }
+}
+
+static void fec_bench_delete_ctx(fec_bench_ctx_t* bench)
+{
+    /* The symbols and the scheme state go with the memory of the plugin */
+    picoquic_free_protoops_and_plugins(&bench->cnx);
+    free(bench);
+}
+
+static fec_bench_ctx_t* fec_bench_create_ctx(fec_bench_scheme_t const* scheme)
+{
+    fec_bench_ctx_t* bench = (fec_bench_ctx_t*)calloc(1, sizeof(fec_bench_ctx_t));
+    int ret = 0;
+
+    if (bench == NULL) {
+        return NULL;
+    }
+    register_protocol_operations(&bench->cnx);
+    if (plugin_insert_plugin(&bench->cnx, scheme->plugin_fname) != 0) {
+        DBG_PRINTF("Cannot insert %s\n", scheme->plugin_fname);
+        ret = -1;
+    } else {
+        bench->create = fec_bench_get_pluglet(&bench->cnx, "create_fec_schemes");
+        bench->generate = fec_bench_get_pluglet(&bench->cnx, "fec_generate_repair_symbols");
+        bench->recover = fec_bench_get_pluglet(&bench->cnx, "fec_recover");
+        if (bench->create == NULL || bench->generate == NULL || bench->recover == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* The symbols are allocated as the pluglets do, in the memory of the plugin */
+        bench->plugin = bench->create->p;
+        bench->cnx.current_plugin = bench->plugin;
+        for (int i = 0; ret == 0 && i < FEC_BENCH_MAX_SOURCE; i++) {
+            source_symbol_t* ss = (source_symbol_t*)my_malloc(&bench->cnx, sizeof(source_symbol_t));
+            uint8_t* data = (uint8_t*)my_malloc(&bench->cnx, FEC_BENCH_SYMBOL_SIZE);
+            if (ss == NULL || data == NULL) {
+                ret = -1;
+                break;
+            }
+            memset(ss, 0, sizeof(source_symbol_t));
+            ss->data = data;
+            ss->data_length = FEC_BENCH_SYMBOL_SIZE;
+            /* No null byte, the RLC scheme takes all-zero symbols as not recovered */
+            for (int j = 0; j < FEC_BENCH_SYMBOL_SIZE; j++) {
+                data[j] = (uint8_t)(1 + (i * 31 + j * 7) % 255);
+            }
+            bench->source_symbols[i] = ss;
+        }
+        for (int i = 0; ret == 0 && i < FEC_BENCH_NB_BLOCKS; i++) {
+            bench->blocks[i] = (fec_block_t*)my_malloc(&bench->cnx, sizeof(fec_block_t));
+            if (bench->blocks[i] == NULL) {
+                ret = -1;
+            } else {
+                memset(bench->blocks[i], 0, sizeof(fec_block_t));
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* The scheme uses the same state to encode and to decode */
+        ret = (int)fec_bench_run(bench, bench->create, 0, true);
+        bench->fec_scheme = (void*)bench->outputv[1];
+        if (ret != 0 || bench->fec_scheme == NULL) {
+            DBG_PRINTF("Cannot create the %s scheme\n", scheme->name);
+            ret = -1;
+        }
+    }
+
+    if (ret != 0) {
+        fec_bench_delete_ctx(bench);
+        bench = NULL;
+    }
+    return bench;
+}
+
+/* Generates the repair symbols of each block, which the decoding then uses */
+static int fec_bench_encode(fec_bench_ctx_t* bench, fec_bench_window_t const* window, bool jit, uint64_t* duration)
+{
+    int ret = 0;
+    struct timeval tv_start;
+    struct timeval tv_end;
+
+    gettimeofday(&tv_start, NULL);
+    for (int i = 0; ret == 0 && i < FEC_BENCH_ITERATIONS; i++) {
+        fec_block_t* fb = bench->blocks[i % FEC_BENCH_NB_BLOCKS];
+
+        fec_bench_free_repair_symbols(&bench->cnx, fb);
+        fb->fec_block_number = (i % FEC_BENCH_NB_BLOCKS) * MAX_FEC_BLOCKS;
+        fec_bench_fill_block(bench, fb, window);
+        bench->inputv[0] = (protoop_arg_t)fb;
+        bench->inputv[1] = (protoop_arg_t)bench->fec_scheme;
+        ret = (int)fec_bench_run(bench, bench->generate, 2, jit);
+    }
+    gettimeofday(&tv_end, NULL);
+    *duration = fec_bench_elapsed(&tv_start, &tv_end);
+
+    return ret;
+}
+
+static bool fec_bench_is_lost(fec_bench_window_t const* window, fec_bench_loss_t loss, int i)
+{
+    int nb_lost = window->repair_symbols;
+
+    switch (loss) {
+    case fec_bench_loss_first:
+        return i < nb_lost;
+    case fec_bench_loss_spread:
+        return (i * nb_lost) % window->source_symbols < nb_lost;
+    default:
+        return i >= window->source_symbols - nb_lost;
+    }
+}
+
+/* Decodes the blocks encoded last, after losing as many source symbols as there are repair symbols */
+static int fec_bench_decode(fec_bench_ctx_t* bench, fec_bench_window_t const* window, fec_bench_loss_t loss, bool jit, uint64_t* duration)
+{
+    int ret = 0;
+    struct timeval tv_start;
+    struct timeval tv_end;
+
+    *duration = 0;
+    for (int i = 0; ret == 0 && i < FEC_BENCH_ITERATIONS; i++) {
+        fec_block_t* fb = bench->blocks[i % FEC_BENCH_NB_BLOCKS];
+
+        fec_bench_fill_block(bench, fb, window);
+        fb->current_repair_symbols = fb->total_repair_symbols;
+        for (int j = 0; j < window->source_symbols; j++) {
+            if (fec_bench_is_lost(window, loss, j)) {
+                fb->source_symbols[j] = NULL;
+                fb->current_source_symbols--;
+            }
+        }
+        bench->inputv[0] = (protoop_arg_t)fb;
+        bench->inputv[1] = (protoop_arg_t)bench->fec_scheme;
+        gettimeofday(&tv_start, NULL);
+        ret = (int)fec_bench_run(bench, bench->recover, 2, jit);
+        gettimeofday(&tv_end, NULL);
+        *duration += fec_bench_elapsed(&tv_start, &tv_end);
+
+        /* Check and release the recovered symbols */
+        for (int j = 0; j < window->source_symbols; j++) {
+            if (fec_bench_is_lost(window, loss, j)) {
+                source_symbol_t* ss = fb->source_symbols[j];
+                if (ss == NULL || memcmp(ss->data, bench->source_symbols[j]->data, FEC_BENCH_SYMBOL_SIZE) != 0) {
+                    DBG_PRINTF("Source symbol %d of %d not recovered\n", j, window->source_symbols);
+                    ret = -1;
+                }
+                if (ss != NULL) {
+                    my_free(&bench->cnx, ss->data);
+                    my_free(&bench->cnx, ss);
+                    fb->source_symbols[j] = NULL;
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* The region operations of the RLC and RS encoders, one per source and repair symbol */
+static uint64_t fec_bench_native_encode(fec_bench_ctx_t* bench, fec_bench_window_t const* window)
+{
+    struct timeval tv_start;
+    struct timeval tv_end;
+    uint8_t repair[FEC_BENCH_SYMBOL_SIZE];
+
+    gettimeofday(&tv_start, NULL);
+    for (int i = 0; i < FEC_BENCH_ITERATIONS; i++) {
+        for (int r = 0; r < window->repair_symbols; r++) {
+            memset(repair, 0, sizeof(repair));
+            for (int j = 0; j < window->source_symbols; j++) {
+                gf256_region_mul_add(repair, bench->source_symbols[j]->data, (uint8_t)(2 + r * 31 + j), FEC_BENCH_SYMBOL_SIZE);
+            }
+        }
+    }
+    gettimeofday(&tv_end, NULL);
+
+    return fec_bench_elapsed(&tv_start, &tv_end);
+}
+
+static void fec_bench_write_result(FILE* F, int is_first, char const* scheme, char const* mode, char const* operation,
+    fec_bench_window_t const* window, char const* loss, uint64_t nb_symbols, uint64_t duration)
+{
+    /* Symbols encoded or recovered per second, and the same in MB/s */
+    double seconds = (duration == 0) ? 1e-6 : (double)duration / 1000000.0;
+
+    fprintf(F, "%s\n  { \"scheme\": \"%s\", \"mode\": \"%s\", \"operation\": \"%s\", \"source_symbols\": %d, \"repair_symbols\": %d, ",
+        (is_first) ? "" : ",", scheme, mode, operation, window->source_symbols, window->repair_symbols);
+    if (loss != NULL) {
+        fprintf(F, "\"loss\": \"%s\", ", loss);
+    }
+    fprintf(F, "\"symbol_size\": %d, \"iterations\": %d, \"duration_us\": %llu, \"symbols_per_second\": %.0f, \"mbps\": %.3f }",
+        FEC_BENCH_SYMBOL_SIZE, FEC_BENCH_ITERATIONS, (unsigned long long)duration, (double)nb_symbols / seconds,
+        ((double)nb_symbols * FEC_BENCH_SYMBOL_SIZE) / (seconds * 1000000.0));
+}
+
+int fec_bench_test()
+{
+    int ret = 0;
+    int is_first = 1;
+    size_t nb_schemes = sizeof(fec_bench_schemes) / sizeof(fec_bench_scheme_t);
+    size_t nb_windows = sizeof(fec_bench_windows) / sizeof(fec_bench_window_t);
+    FILE* F = picoquic_file_open(FEC_BENCH_JSON_FILE, "w");
+
+    if (F == NULL) {
+        DBG_PRINTF("Cannot open %s\n", FEC_BENCH_JSON_FILE);
+        return -1;
+    }
+    fprintf(F, "[");
+
+    /* Any scheme provides the source symbols */
+    fec_bench_ctx_t* native_bench = fec_bench_create_ctx(&fec_bench_schemes[0]);
+    if (native_bench == NULL) {
+        ret = -1;
+    } else {
+        for (size_t w = 0; w < nb_windows; w++) {
+            uint64_t duration = fec_bench_native_encode(native_bench, &fec_bench_windows[w]);
+            fec_bench_write_result(F, is_first, "gf256_region", "native", "encode", &fec_bench_windows[w], NULL,
+                (uint64_t)FEC_BENCH_ITERATIONS * fec_bench_windows[w].source_symbols, duration);
+            is_first = 0;
+        }
+        fec_bench_delete_ctx(native_bench);
+    }
+
+    for (size_t s = 0; ret == 0 && s < nb_schemes; s++) {
+        fec_bench_scheme_t const* scheme = &fec_bench_schemes[s];
+
+        for (int jit = 1; ret == 0 && jit >= 0; jit--) {
+            fec_bench_ctx_t* bench = fec_bench_create_ctx(scheme);
+            char const* mode = (jit) ? "jit" : "interpreter";
+
+            if (bench == NULL) {
+                ret = -1;
+                break;
+            }
+            for (size_t w = 0; ret == 0 && w < nb_windows; w++) {
+                fec_bench_window_t window = fec_bench_windows[w];
+                uint64_t duration = 0;
+
+                if (window.repair_symbols > scheme->max_repair_symbols) {
+                    window.repair_symbols = scheme->max_repair_symbols;
+                }
+                ret = fec_bench_encode(bench, &window, jit, &duration);
+                if (ret != 0) {
+                    DBG_PRINTF("%s cannot encode %d symbols\n", scheme->name, window.source_symbols);
+                    break;
+                }
+                fec_bench_write_result(F, is_first, scheme->name, mode, "encode", &window, NULL,
+                    (uint64_t)FEC_BENCH_ITERATIONS * window.source_symbols, duration);
+
+                for (int loss = fec_bench_loss_first; ret == 0 && loss <= fec_bench_loss_last; loss++) {
+                    ret = fec_bench_decode(bench, &window, (fec_bench_loss_t)loss, jit, &duration);
+                    if (ret != 0) {
+                        DBG_PRINTF("%s cannot decode %d symbols, %s losses\n", scheme->name, window.source_symbols,
+                            fec_bench_loss_names[loss]);
+                        break;
+                    }
+                    fec_bench_write_result(F, is_first, scheme->name, mode, "decode", &window, fec_bench_loss_names[loss],
+                        (uint64_t)FEC_BENCH_ITERATIONS * window.repair_symbols, duration);
+                }
+            }
+            fec_bench_delete_ctx(bench);
+        }
+    }
+
+    fprintf(F, "\n]\n");
+    (void)picoquic_file_close(F);
+
+    return ret;
+}
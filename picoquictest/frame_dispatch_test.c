@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+static protoop_arg_t frame_dispatch_test_default(picoquic_cnx_t *cnx)
+{
+    return 1;
+}
+
+static protoop_arg_t frame_dispatch_test_ack(picoquic_cnx_t *cnx)
+{
+    return 2 + cnx->protoop_inputv[0];
+}
+
+int frame_dispatch_test()
+{
+    int ret = 0;
+    picoquic_cnx_t *cnx = calloc(1, sizeof(picoquic_cnx_t));
+    protocol_operation_struct_t *post;
+
+    if (cnx == NULL) {
+        return -1;
+    }
+
+    if (register_param_protoop_default(cnx, &PROTOOP_PARAM_PARSE_FRAME, &frame_dispatch_test_default) != 0 ||
+        register_param_protoop(cnx, &PROTOOP_PARAM_PARSE_FRAME, picoquic_frame_type_ack, &frame_dispatch_test_ack) != 0) {
+        ret = -1;
+    }
+    picoquic_update_frame_dispatch(cnx);
+
+    /* The types without their own operation get the default one, those of other operations stay unresolved */
+    post = picoquic_find_protoop(cnx, &PROTOOP_PARAM_PARSE_FRAME);
+    if (ret == 0 && (post == NULL ||
+        cnx->frame_dispatch[picoquic_frame_op_parse][picoquic_frame_type_ack] != picoquic_find_protoop_param(post, picoquic_frame_type_ack) ||
+        cnx->frame_dispatch[picoquic_frame_op_parse][picoquic_frame_type_padding] != picoquic_find_protoop_param(post, NO_PARAM) ||
+        cnx->frame_dispatch[picoquic_frame_op_process][picoquic_frame_type_ack] != NULL)) {
+        ret = -1;
+    }
+
+    if (ret == 0 && (protoop_run_frame_op(cnx, picoquic_frame_op_parse, &PROTOOP_PARAM_PARSE_FRAME, picoquic_frame_type_ack, NULL,
+        1, (protoop_arg_t[1]) {PROTOOP_ARG(40)}) != 42 ||
+        protoop_run_frame_op(cnx, picoquic_frame_op_parse, &PROTOOP_PARAM_PARSE_FRAME, picoquic_frame_type_ping, NULL,
+        1, (protoop_arg_t[1]) {PROTOOP_ARG(40)}) != 1)) {
+        ret = -1;
+    }
+
+    /* A param struct created later is only used once the table is rebuilt */
+    if (ret == 0 && register_param_protoop(cnx, &PROTOOP_PARAM_PARSE_FRAME, picoquic_frame_type_ping, &frame_dispatch_test_ack) != 0) {
+        ret = -1;
+    }
+    picoquic_update_frame_dispatch(cnx);
+    if (ret == 0 && protoop_run_frame_op(cnx, picoquic_frame_op_parse, &PROTOOP_PARAM_PARSE_FRAME, picoquic_frame_type_ping, NULL,
+        1, (protoop_arg_t[1]) {PROTOOP_ARG(40)}) != 42) {
+        ret = -1;
+    }
+
+    picoquic_free_protoops(cnx->ops);
+    free(cnx);
+
+    return ret;
+}
@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "getset.h"
+#include "plugin.h"
+
+int getset_fields_test()
+{
+    int ret = 0;
+    picoquic_path_t *path = calloc(1, sizeof(picoquic_path_t));
+    picoquic_cnx_t *cnx = calloc(1, sizeof(picoquic_cnx_t));
+
+    if (path == NULL || cnx == NULL) {
+        ret = -1;
+    }
+
+    /* Bulk accesses behave like the corresponding sequence of single accesses */
+    if (ret == 0) {
+        access_key_t aks[3] = {AK_PATH_CWIN, AK_PATH_BYTES_IN_TRANSIT, AK_PATH_SMOOTHED_RTT};
+        protoop_arg_t vals[3] = {12000, 3000, 25000};
+        protoop_arg_t out[3] = {0, 0, 0};
+        set_path_fields(path, aks, NULL, 3, vals);
+        if (path->cwin != 12000 || path->bytes_in_transit != 3000 || path->smoothed_rtt != 25000) {
+            ret = -1;
+        }
+        get_path_fields(path, aks, NULL, 3, out);
+        for (int i = 0; ret == 0 && i < 3; i++) {
+            if (out[i] != vals[i] || out[i] != get_path(path, aks[i], 0)) {
+                ret = -1;
+            }
+        }
+    }
+
+    /* Parameters are passed key by key */
+    if (ret == 0) {
+        access_key_t aks[2] = {AK_PATH_PKT_CTX, AK_PATH_PKT_CTX};
+        uint16_t params[2] = {picoquic_packet_context_application, picoquic_packet_context_initial};
+        protoop_arg_t out[2];
+        get_path_fields(path, aks, params, 2, out);
+        if (out[0] != (protoop_arg_t) &path->pkt_ctx[picoquic_packet_context_application] ||
+            out[1] != (protoop_arg_t) &path->pkt_ctx[picoquic_packet_context_initial]) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        access_key_t aks[2] = {AK_CNX_START_TIME, AK_CNX_LATEST_PROGRESS_TIME};
+        protoop_arg_t vals[2] = {1000, 2000};
+        protoop_arg_t out[2] = {0, 0};
+        set_cnx_fields(cnx, aks, NULL, 2, vals);
+        get_cnx_fields(cnx, aks, NULL, 2, out);
+        if (cnx->start_time != 1000 || cnx->latest_progress_time != 2000 || out[0] != 1000 || out[1] != 2000) {
+            ret = -1;
+        }
+    }
+
+    /* Signed fields are sign-extended, read-only fields are left untouched */
+    if (ret == 0) {
+        path->peer_addr_len = -1;
+        path->delivered = 1234;
+        set_path(path, AK_PATH_DELIVERED, 0, 0);
+        if (get_path(path, AK_PATH_PEER_ADDR_LEN, 0) != (protoop_arg_t) -1 || get_path(path, AK_PATH_DELIVERED, 0) != 1234) {
+            ret = -1;
+        }
+    }
+
+    free(path);
+    free(cnx);
+
+    return ret;
+}
+
+int plugin_metadata_test()
+{
+    int ret = 0;
+    plugin_metadata_t metadata;
+    protoop_plugin_t inline_plugin, overflow_plugin;
+    uint64_t out = 1;
+
+    memset(&metadata, 0, sizeof(metadata));
+    memset(&inline_plugin, 0, sizeof(inline_plugin));
+    memset(&overflow_plugin, 0, sizeof(overflow_plugin));
+    strcpy(inline_plugin.name, "test.metadata.inline");
+    strcpy(overflow_plugin.name, "test.metadata.overflow");
+    inline_plugin.metadata_slot = 1;
+    overflow_plugin.metadata_slot = PLUGIN_METADATA_SLOTS;
+
+    /* Metadata never set read as zero, and each plugin has its own ones */
+    if (get_plugin_metadata(&inline_plugin, &metadata, 3, &out) != 0 || out != 0) {
+        ret = -1;
+    }
+    if (ret == 0 && (set_plugin_metadata(&inline_plugin, &metadata, 3, 42) != 0 ||
+        set_plugin_metadata(&overflow_plugin, &metadata, 3, 43) != 0)) {
+        ret = -1;
+    }
+    if (ret == 0 && (metadata.slots[1][3] != 42 || metadata.overflow == NULL)) {
+        ret = -1;
+    }
+    if (ret == 0 && (get_plugin_metadata(&overflow_plugin, &metadata, 3, &out) != 0 || out != 43)) {
+        ret = -1;
+    }
+    if (ret == 0 && (get_plugin_metadata(&inline_plugin, &metadata, 3, &out) != 0 || out != 42)) {
+        ret = -1;
+    }
+    if (ret == 0 && set_plugin_metadata(&inline_plugin, &metadata, STRUCT_METADATA_MAX, 1) == 0) {
+        ret = -1;
+    }
+
+    plugin_metadata_free(&metadata);
+    if (ret == 0 && (metadata.overflow != NULL || metadata.slots[1][3] != 0)) {
+        ret = -1;
+    }
+
+    return ret;
+}
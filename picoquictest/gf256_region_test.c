@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <string.h>
+#include "gf256_region.h"
+
+/* Regions longer than the vector width, with a tail and an unaligned start */
+#define GF256_REGION_TEST_LENGTH 1400
+#define GF256_REGION_TEST_OFFSET 3
+
+static uint8_t gf256_region_test_mul(uint8_t a, uint8_t b)
+{
+    uint8_t p = 0;
+    for (int i = 0; i < 8; i++) {
+        if (b & 1) {
+            p ^= a;
+        }
+        b >>= 1;
+        a = (a & 0x80) ? (uint8_t)((a << 1) ^ 0x1d) : (uint8_t)(a << 1);
+    }
+    return p;
+}
+
+int gf256_region_test()
+{
+    int ret = 0;
+    uint8_t src_buffer[GF256_REGION_TEST_LENGTH + GF256_REGION_TEST_OFFSET];
+    uint8_t dst_buffer[GF256_REGION_TEST_LENGTH + GF256_REGION_TEST_OFFSET];
+    uint8_t expected[GF256_REGION_TEST_LENGTH];
+    uint8_t* src = src_buffer + GF256_REGION_TEST_OFFSET;
+    uint8_t* dst = dst_buffer + GF256_REGION_TEST_OFFSET;
+
+    for (int i = 0; i < GF256_REGION_TEST_LENGTH; i++) {
+        src[i] = (uint8_t)(i * 7 + 1);
+    }
+
+    for (int coef = 0; ret == 0 && coef < 256; coef++) {
+        for (int i = 0; i < GF256_REGION_TEST_LENGTH; i++) {
+            dst[i] = (uint8_t)(i * 13 + coef);
+            expected[i] = dst[i] ^ gf256_region_test_mul((uint8_t)coef, src[i]);
+        }
+        gf256_region_mul_add(dst, src, (uint8_t)coef, GF256_REGION_TEST_LENGTH);
+        if (memcmp(dst, expected, GF256_REGION_TEST_LENGTH) != 0) {
+            ret = -1;
+            break;
+        }
+
+        for (int i = 0; i < GF256_REGION_TEST_LENGTH; i++) {
+            expected[i] = gf256_region_test_mul((uint8_t)coef, dst[i]);
+        }
+        gf256_region_mul(dst, (uint8_t)coef, GF256_REGION_TEST_LENGTH);
+        if (memcmp(dst, expected, GF256_REGION_TEST_LENGTH) != 0) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
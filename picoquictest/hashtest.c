@@ -20,8 +20,12 @@
 */
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
 #ifdef _WINDOWS
 #include <malloc.h>
+#else
+#include <sys/time.h>
 #endif
 #include "../picoquic/picohash.h"
 
@@ -135,3 +139,101 @@ int picohash_test()
 
     return ret;
 }
+
+#define PICOHASH_RESIZE_TEST_NB_KEYS 10000
+
+/* Grows the table from its minimal size, in the middle of deletions */
+int picohash_resize_test()
+{
+    int ret = 0;
+    picohash_table* t = picohash_create(1, hashtest_hash, hashtest_compare);
+
+    if (t == NULL) {
+        ret = -1;
+    }
+
+    for (uint64_t i = 0; ret == 0 && i < PICOHASH_RESIZE_TEST_NB_KEYS; i++) {
+        ret = picohash_insert(t, hashtest_item(i));
+
+        /* Delete one key in three, while the table keeps growing */
+        if (ret == 0 && i % 3 == 2) {
+            struct hashtestkey hk = { i - 1 };
+            picohash_item* pi = picohash_retrieve(t, &hk);
+
+            if (pi == NULL) {
+                ret = -1;
+            } else {
+                picohash_item_delete(t, pi, 1);
+            }
+        }
+    }
+
+    for (uint64_t i = 0; ret == 0 && i < PICOHASH_RESIZE_TEST_NB_KEYS + 10; i++) {
+        struct hashtestkey hk = { i };
+        picohash_item* pi = picohash_retrieve(t, &hk);
+        int expected = (i < PICOHASH_RESIZE_TEST_NB_KEYS && i % 3 != 1);
+
+        if ((pi != NULL) != expected || (pi != NULL && ((struct hashtestkey*)pi->key)->x != i)) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && t->count != PICOHASH_RESIZE_TEST_NB_KEYS - PICOHASH_RESIZE_TEST_NB_KEYS / 3) {
+        ret = -1;
+    }
+
+    if (t != NULL) {
+        picohash_delete(t, 1);
+    }
+
+    return ret;
+}
+
+#define PICOHASH_BENCH_NB_KEYS 100000
+#define PICOHASH_BENCH_NB_LOOKUPS 10000000
+
+/* Time taken by the lookups in a table of many connections, half of them missing */
+int picohash_bench_test()
+{
+    int ret = 0;
+    uint64_t nb_found = 0;
+    struct timeval tv_start;
+    struct timeval tv_end;
+    picohash_table* t = picohash_create(16, hashtest_hash, hashtest_compare);
+
+    if (t == NULL) {
+        ret = -1;
+    }
+
+    for (uint64_t i = 0; ret == 0 && i < PICOHASH_BENCH_NB_KEYS; i++) {
+        ret = picohash_insert(t, hashtest_item(2 * i));
+    }
+
+    if (ret == 0) {
+        gettimeofday(&tv_start, NULL);
+
+        for (uint64_t i = 0; i < PICOHASH_BENCH_NB_LOOKUPS; i++) {
+            struct hashtestkey hk = { (i * 7919) % (2 * PICOHASH_BENCH_NB_KEYS) };
+
+            if (picohash_retrieve(t, &hk) != NULL) {
+                nb_found++;
+            }
+        }
+
+        gettimeofday(&tv_end, NULL);
+
+        fprintf(stderr, "Hash: %d lookups in %d keys in %" PRIu64 " us\n",
+            PICOHASH_BENCH_NB_LOOKUPS, PICOHASH_BENCH_NB_KEYS,
+            (uint64_t)((tv_end.tv_sec - tv_start.tv_sec) * 1000000 + (tv_end.tv_usec - tv_start.tv_usec)));
+
+        if (nb_found != PICOHASH_BENCH_NB_LOOKUPS / 2) {
+            ret = -1;
+        }
+    }
+
+    if (t != NULL) {
+        picohash_delete(t, 1);
+    }
+
+    return ret;
+}
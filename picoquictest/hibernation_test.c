@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "stream_recv.h"
+
+#define HIBERNATION_TEST_DELAY 1000000
+#define HIBERNATION_TEST_NB_PN 40
+
+int hibernation_test()
+{
+    int ret = 0;
+    uint8_t bytes[100] = { 0 };
+    int new_data = 0;
+    picoquic_quic_t* quic = calloc(1, sizeof(picoquic_quic_t));
+    picoquic_cnx_t* cnx = calloc(1, sizeof(picoquic_cnx_t));
+    picoquic_path_t* path_x = calloc(1, sizeof(picoquic_path_t));
+    picoquic_path_t* paths[1] = { path_x };
+    picoquic_stream_head* stream = calloc(1, sizeof(picoquic_stream_head));
+    picoquic_sack_list_t* sacks;
+
+    if (quic == NULL || cnx == NULL || path_x == NULL || stream == NULL) {
+        free(quic);
+        free(cnx);
+        free(path_x);
+        free(stream);
+        return -1;
+    }
+
+    cnx->quic = quic;
+    cnx->path = paths;
+    cnx->nb_paths = 1;
+    cnx->first_stream = stream;
+    cnx->cnx_state = picoquic_state_server_ready;
+    sacks = &path_x->pkt_ctx[picoquic_packet_context_application].sack_list;
+
+    /* Enough packets to grow the ranges out of place, then merged back in a single one */
+    for (uint64_t pn = 0; ret == 0 && pn < HIBERNATION_TEST_NB_PN; pn += 2) {
+        ret = picoquic_record_pn_received(cnx, path_x, picoquic_packet_context_application, pn, 0);
+    }
+    for (uint64_t pn = 1; ret == 0 && pn < HIBERNATION_TEST_NB_PN; pn += 2) {
+        ret = picoquic_record_pn_received(cnx, path_x, picoquic_packet_context_application, pn, 0);
+    }
+    if (ret == 0 && (sacks->nb_ranges != 1 || picoquic_sack_list_footprint(sacks) == 0)) {
+        ret = -1;
+    }
+
+    /* Data received and consumed, the ring stays allocated */
+    if (ret == 0 && picoquic_stream_recv_insert(&stream->recv, 0, 0, bytes, sizeof(bytes), &new_data) != 0) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        picoquic_memory_charge(cnx, picoquic_memory_recv_data, picoquic_stream_recv_footprint(&stream->recv));
+        stream->consumed_offset = sizeof(bytes);
+        picoquic_stream_recv_release(&stream->recv, stream->consumed_offset);
+    }
+
+    /* Nothing happens before the delay, nor without one */
+    if (ret == 0) {
+        picoquic_check_hibernation(cnx, 2 * HIBERNATION_TEST_DELAY);
+        picoquic_set_hibernation_delay(quic, HIBERNATION_TEST_DELAY);
+        picoquic_check_hibernation(cnx, HIBERNATION_TEST_DELAY - 1);
+        if (picoquic_is_cnx_hibernating(cnx) || cnx->memory_total == 0) {
+            ret = -1;
+        }
+    }
+
+    /* Past it, only the state is left, and the connection still knows what it received */
+    if (ret == 0) {
+        picoquic_check_hibernation(cnx, HIBERNATION_TEST_DELAY);
+        if (!picoquic_is_cnx_hibernating(cnx) || cnx->nb_hibernations != 1 || cnx->memory_total != 0 ||
+            sacks->nb_ranges != 1 || picoquic_sack_list_footprint(sacks) != 0 || stream->recv.size != 0 ||
+            picoquic_is_pn_already_received(path_x, picoquic_packet_context_application, HIBERNATION_TEST_NB_PN - 1) == 0 ||
+            picoquic_is_pn_already_received(path_x, picoquic_packet_context_application, HIBERNATION_TEST_NB_PN) != 0) {
+            ret = -1;
+        }
+    }
+
+    /* Waking up, the structures grow again as needed */
+    if (ret == 0) {
+        picoquic_wake_cnx(cnx);
+        if (picoquic_is_cnx_hibernating(cnx) ||
+            picoquic_record_pn_received(cnx, path_x, picoquic_packet_context_application, HIBERNATION_TEST_NB_PN + 10, 0) != 0 ||
+            picoquic_stream_recv_insert(&stream->recv, stream->consumed_offset, stream->consumed_offset + 10,
+                bytes, sizeof(bytes), &new_data) != 0 || new_data == 0 ||
+            picoquic_stream_recv_first_offset(&stream->recv) != stream->consumed_offset + 10) {
+            ret = -1;
+        }
+    }
+
+    picoquic_sack_list_free(sacks);
+    picoquic_stream_recv_free(&stream->recv);
+    free(stream);
+    free(path_x);
+    free(cnx);
+    free(quic);
+
+    return ret;
+}
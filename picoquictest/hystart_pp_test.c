@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "cc_common.h"
+
+/* Feeds a round of RTT samples, the round starting with the acknowledgement of the previous one */
+static int hystart_pp_test_round(picoquic_hystart_pp_t* hs, picoquic_path_t* path_x, uint64_t rtt)
+{
+    int ret = 0;
+    picoquic_packet_context_t* pkt_ctx = &path_x->pkt_ctx[picoquic_packet_context_application];
+
+    pkt_ctx->highest_acknowledged = hs->window_end;
+    pkt_ctx->send_sequence += 16;
+
+    for (int i = 0; i < PICOQUIC_HYSTART_PP_N_RTT_SAMPLE && ret == 0; i++) {
+        ret = picoquic_hystart_pp_test(hs, path_x, rtt);
+    }
+
+    return ret;
+}
+
+int hystart_pp_unit_test()
+{
+    int ret = 0;
+    picoquic_hystart_pp_t hs;
+    picoquic_path_t* path_x = (picoquic_path_t*)malloc(sizeof(picoquic_path_t));
+
+    if (path_x == NULL) {
+        return -1;
+    }
+    memset(path_x, 0, sizeof(picoquic_path_t));
+    path_x->pkt_ctx[picoquic_packet_context_application].highest_acknowledged = UINT64_MAX;
+    picoquic_hystart_pp_reset(&hs, path_x);
+
+    /* A stable RTT does not end the slow start */
+    for (int i = 0; ret == 0 && i < 4; i++) {
+        if (hystart_pp_test_round(&hs, path_x, 100000) != 0 || hs.is_in_css) {
+            ret = -1;
+        }
+    }
+    if (ret == 0 && picoquic_hystart_pp_increase(&hs, 4000) != 4000) {
+        ret = -1;
+    }
+
+    /* An increase above the threshold starts the conservative slow start, growing four times slower */
+    if (ret == 0 && (hystart_pp_test_round(&hs, path_x, 100000 + PICOQUIC_HYSTART_PP_MAX_RTT_THRESH) != 0 ||
+        !hs.is_in_css || picoquic_hystart_pp_increase(&hs, 4000) != 1000 ||
+        picoquic_hystart_pp_increase(&hs, 6) != 1 || picoquic_hystart_pp_increase(&hs, 2) != 1)) {
+        ret = -1;
+    }
+
+    /* The RTT going back below the baseline was a spurious increase */
+    if (ret == 0 && (hystart_pp_test_round(&hs, path_x, 100000) != 0 || hs.is_in_css)) {
+        ret = -1;
+    }
+
+    /* Once back in the conservative slow start, it ends after its rounds */
+    if (ret == 0 && (hystart_pp_test_round(&hs, path_x, 120000) != 0 || !hs.is_in_css)) {
+        ret = -1;
+    }
+    for (int i = 1; ret == 0 && i < PICOQUIC_HYSTART_PP_CSS_ROUNDS; i++) {
+        if (hystart_pp_test_round(&hs, path_x, 120000) != 0) {
+            ret = -1;
+        }
+    }
+    if (ret == 0 && (hystart_pp_test_round(&hs, path_x, 120000) != 1 || hs.is_in_css)) {
+        ret = -1;
+    }
+
+    free(path_x);
+
+    return ret;
+}
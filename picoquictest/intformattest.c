@@ -262,3 +262,65 @@ int varint_test()
 
     return ret;
 }
+
+#define VARINT_BATCH_TEST_NB_VALUES 126
+#define VARINT_BATCH_TEST_ROUNDS 20000
+
+int varint_decode_n_test()
+{
+    int ret = 0;
+    uint8_t bytes[VARINT_BATCH_TEST_NB_VALUES * 8];
+    uint64_t expected[VARINT_BATCH_TEST_NB_VALUES];
+    uint64_t values[VARINT_BATCH_TEST_NB_VALUES];
+    size_t length = 0;
+
+    /* Mix of all the encoding lengths, as in an ACK frame with large and small gaps */
+    for (size_t i = 0; i < VARINT_BATCH_TEST_NB_VALUES; i++) {
+        picoquic_varintformat_test_t *test = &varint_test_cases[i % nb_varint_test_cases];
+        memcpy(bytes + length, test->encoding, test->length);
+        length += test->length;
+        expected[i] = test->decoded;
+    }
+
+    /* The whole buffer is needed, each truncation must fail */
+    for (size_t max_bytes = 0; ret == 0 && max_bytes <= length; max_bytes++) {
+        size_t consumed = picoquic_varint_decode_n(bytes, max_bytes, values, VARINT_BATCH_TEST_NB_VALUES);
+
+        if (consumed != (max_bytes < length ? 0 : length)) {
+            fprintf(stderr, "Varint batch: unexpected length %u for %u bytes\n", (unsigned)consumed, (unsigned)max_bytes);
+            ret = -1;
+        } else if (consumed != 0 && memcmp(values, expected, sizeof(expected)) != 0) {
+            fprintf(stderr, "Varint batch: unexpected values\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        uint64_t checksum[2] = { 0, 0 };
+        uint64_t start_time = picoquic_current_time();
+        uint64_t batch_time;
+
+        for (int r = 0; r < VARINT_BATCH_TEST_ROUNDS; r++) {
+            picoquic_varint_decode_n(bytes, length, values, VARINT_BATCH_TEST_NB_VALUES);
+            checksum[0] += values[r % VARINT_BATCH_TEST_NB_VALUES];
+        }
+        batch_time = picoquic_current_time() - start_time;
+        start_time = picoquic_current_time();
+        for (int r = 0; r < VARINT_BATCH_TEST_ROUNDS; r++) {
+            const uint8_t *x = bytes;
+            for (size_t i = 0; x != NULL && i < VARINT_BATCH_TEST_NB_VALUES; i++) {
+                x = picoquic_frames_varint_decode((uint8_t *)x, bytes + length, &values[i]);
+            }
+            checksum[1] += values[r % VARINT_BATCH_TEST_NB_VALUES];
+        }
+
+        if (checksum[0] != checksum[1]) {
+            ret = -1;
+        } else {
+            fprintf(stdout, "Varint batch: %" PRIu64 " us for %d varints, %" PRIu64 " us one at a time\n",
+                batch_time, VARINT_BATCH_TEST_ROUNDS * VARINT_BATCH_TEST_NB_VALUES, picoquic_current_time() - start_time);
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stddef.h>
+#ifndef _WINDOWS
+#include <sys/time.h>
+#endif
+#include "picoquic_internal.h"
+
+#define LAYOUT_CACHE_LINE 64
+#define LAYOUT_HOT_LINES_MAX 6 /* Lines holding the per packet fields of a connection, or of a path */
+#define LAYOUT_BENCH_NB_CNX 2048
+#define LAYOUT_BENCH_NB_ROUNDS 200
+
+typedef struct st_layout_field_t {
+    size_t offset;
+    size_t size;
+} layout_field_t;
+
+#define LAYOUT_FIELD(type, field) { offsetof(type, field), sizeof(((type *) NULL)->field) }
+
+/* Read or written for most packets sent or received, the bit fields next to cnx_state aside */
+static const layout_field_t layout_cnx_hot[] = {
+    LAYOUT_FIELD(picoquic_cnx_t, quic),
+    LAYOUT_FIELD(picoquic_cnx_t, cnx_state),
+    LAYOUT_FIELD(picoquic_cnx_t, version_index),
+    LAYOUT_FIELD(picoquic_cnx_t, path),
+    LAYOUT_FIELD(picoquic_cnx_t, nb_paths),
+    LAYOUT_FIELD(picoquic_cnx_t, protoop_inputc),
+    LAYOUT_FIELD(picoquic_cnx_t, protoop_inputv),
+    LAYOUT_FIELD(picoquic_cnx_t, protoop_outputv),
+    LAYOUT_FIELD(picoquic_cnx_t, current_protoop),
+    LAYOUT_FIELD(picoquic_cnx_t, current_plugin),
+    LAYOUT_FIELD(picoquic_cnx_t, next_wake_time),
+    LAYOUT_FIELD(picoquic_cnx_t, wake_heap_index),
+    LAYOUT_FIELD(picoquic_cnx_t, hp_batch),
+    LAYOUT_FIELD(picoquic_cnx_t, latest_progress_time),
+    LAYOUT_FIELD(picoquic_cnx_t, congestion_alg),
+    LAYOUT_FIELD(picoquic_cnx_t, data_sent),
+    LAYOUT_FIELD(picoquic_cnx_t, data_received),
+    LAYOUT_FIELD(picoquic_cnx_t, maxdata_local),
+    LAYOUT_FIELD(picoquic_cnx_t, maxdata_remote),
+    LAYOUT_FIELD(picoquic_cnx_t, ack_gap_remote),
+    LAYOUT_FIELD(picoquic_cnx_t, ack_delay_remote)
+};
+
+static const layout_field_t layout_path_hot[] = {
+    LAYOUT_FIELD(picoquic_path_t, cwin),
+    LAYOUT_FIELD(picoquic_path_t, bytes_in_transit),
+    LAYOUT_FIELD(picoquic_path_t, congestion_alg_state),
+    LAYOUT_FIELD(picoquic_path_t, send_mtu),
+    LAYOUT_FIELD(picoquic_path_t, max_ack_delay),
+    LAYOUT_FIELD(picoquic_path_t, smoothed_rtt),
+    LAYOUT_FIELD(picoquic_path_t, rtt_variant),
+    LAYOUT_FIELD(picoquic_path_t, retransmit_timer),
+    LAYOUT_FIELD(picoquic_path_t, rtt_min),
+    LAYOUT_FIELD(picoquic_path_t, pacing_evaluation_time),
+    LAYOUT_FIELD(picoquic_path_t, pacing_bucket_nanosec),
+    LAYOUT_FIELD(picoquic_path_t, pacing_packet_time_nanosec),
+    LAYOUT_FIELD(picoquic_path_t, pacing_departure_nanosec),
+    LAYOUT_FIELD(picoquic_path_t, delivered),
+    LAYOUT_FIELD(picoquic_path_t, bandwidth_estimate),
+    LAYOUT_FIELD(picoquic_path_t, nb_pkt_sent),
+    LAYOUT_FIELD(picoquic_path_t, local_cnxid),
+    LAYOUT_FIELD(picoquic_path_t, remote_cnxid)
+};
+
+/* Cache lines that the fields span, in a structure aligned on a line */
+static int layout_nb_lines(const layout_field_t* fields, size_t nb_fields)
+{
+    uint8_t touched[(sizeof(picoquic_cnx_t) + LAYOUT_CACHE_LINE - 1) / LAYOUT_CACHE_LINE];
+    int nb_lines = 0;
+
+    memset(touched, 0, sizeof(touched));
+    for (size_t i = 0; i < nb_fields; i++) {
+        for (size_t line = fields[i].offset / LAYOUT_CACHE_LINE;
+            line <= (fields[i].offset + fields[i].size - 1) / LAYOUT_CACHE_LINE; line++) {
+            if (!touched[line]) {
+                touched[line] = 1;
+                nb_lines++;
+            }
+        }
+    }
+
+    return nb_lines;
+}
+
+/* The per packet fields of the connection and of the path stay in their few leading cache lines */
+int cnx_layout_test()
+{
+    int ret = 0;
+    int nb_cnx_lines = layout_nb_lines(layout_cnx_hot, sizeof(layout_cnx_hot) / sizeof(layout_field_t));
+    int nb_path_lines = layout_nb_lines(layout_path_hot, sizeof(layout_path_hot) / sizeof(layout_field_t));
+
+    if (sizeof(picoquic_path_t) > sizeof(picoquic_cnx_t)) {
+        ret = -1;
+    } else if (nb_cnx_lines > LAYOUT_HOT_LINES_MAX) {
+        DBG_PRINTF("The hot fields of the connection span %d cache lines\n", nb_cnx_lines);
+        ret = -1;
+    } else if (nb_path_lines > LAYOUT_HOT_LINES_MAX) {
+        DBG_PRINTF("The hot fields of the path span %d cache lines\n", nb_path_lines);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static uint64_t layout_bench_random(uint64_t* seed)
+{
+    *seed = *seed * 6364136223846793005ull + 1442695040888963407ull;
+    return *seed >> 33;
+}
+
+/*
+ * Visits many connections in a random order, as a server loop does, touching the fields of a packet
+ * sent on each. With more connections than the caches hold, the time is that of the cache misses.
+ */
+int cnx_layout_bench_test()
+{
+    int ret = 0;
+    uint64_t seed = 0x5eed;
+    uint64_t sum = 0;
+    picoquic_cnx_t** cnx = calloc(LAYOUT_BENCH_NB_CNX, sizeof(picoquic_cnx_t*));
+    picoquic_path_t** paths = calloc(LAYOUT_BENCH_NB_CNX, sizeof(picoquic_path_t*));
+    uint32_t* order = calloc(LAYOUT_BENCH_NB_CNX, sizeof(uint32_t));
+    struct timeval tv_start;
+    struct timeval tv_end;
+
+    for (int i = 0; ret == 0 && i < LAYOUT_BENCH_NB_CNX; i++) {
+        if (cnx == NULL || paths == NULL || order == NULL ||
+            (cnx[i] = calloc(1, sizeof(picoquic_cnx_t))) == NULL ||
+            (paths[i] = calloc(1, sizeof(picoquic_path_t))) == NULL) {
+            ret = -1;
+        } else {
+            cnx[i]->path = &paths[i];
+            cnx[i]->nb_paths = 1;
+            cnx[i]->maxdata_remote = UINT64_MAX;
+            paths[i]->cwin = PICOQUIC_CWIN_INITIAL;
+            paths[i]->send_mtu = PICOQUIC_INITIAL_MTU_IPV4;
+            paths[i]->smoothed_rtt = PICOQUIC_INITIAL_RTT;
+            order[i] = (uint32_t)i;
+        }
+    }
+
+    if (ret == 0) {
+        for (int i = LAYOUT_BENCH_NB_CNX - 1; i > 0; i--) {
+            int j = (int)(layout_bench_random(&seed) % (uint64_t)(i + 1));
+            uint32_t x = order[i];
+            order[i] = order[j];
+            order[j] = x;
+        }
+
+        gettimeofday(&tv_start, NULL);
+
+        for (int round = 0; round < LAYOUT_BENCH_NB_ROUNDS; round++) {
+            for (int i = 0; i < LAYOUT_BENCH_NB_CNX; i++) {
+                picoquic_cnx_t* c = cnx[order[i]];
+                picoquic_path_t* path_x = c->path[0];
+
+                if (c->cnx_state == picoquic_state_client_init && c->data_sent < c->maxdata_remote &&
+                    path_x->bytes_in_transit < path_x->cwin) {
+                    path_x->bytes_in_transit += path_x->send_mtu;
+                    path_x->pacing_bucket_nanosec -= path_x->pacing_packet_time_nanosec;
+                    path_x->nb_pkt_sent++;
+                    c->data_sent += path_x->send_mtu;
+                    c->next_wake_time = path_x->pacing_evaluation_time + path_x->smoothed_rtt + path_x->retransmit_timer;
+                    c->latest_progress_time = c->next_wake_time;
+                } else {
+                    path_x->bytes_in_transit = 0;
+                }
+                sum += c->next_wake_time + path_x->remote_cnxid.id_len;
+            }
+        }
+
+        gettimeofday(&tv_end, NULL);
+
+        fprintf(stderr, "Layout: %d rounds of %d connections in %" PRIu64 " us (%" PRIu64 ")\n",
+            LAYOUT_BENCH_NB_ROUNDS, LAYOUT_BENCH_NB_CNX,
+            (uint64_t)((tv_end.tv_sec - tv_start.tv_sec) * 1000000 + (tv_end.tv_usec - tv_start.tv_usec)), sum);
+    }
+
+    for (int i = 0; i < LAYOUT_BENCH_NB_CNX; i++) {
+        if (cnx != NULL) {
+            free(cnx[i]);
+        }
+        if (paths != NULL) {
+            free(paths[i]);
+        }
+    }
+    free(cnx);
+    free(paths);
+    free(order);
+
+    return ret;
+}
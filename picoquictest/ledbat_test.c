@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+static void ledbat_unit_test_rtt(picoquic_path_t* path_x, uint64_t rtt, uint64_t current_time)
+{
+    for (int i = 0; i < 8; i++) {
+        picoquic_ledbat_algorithm->alg_notify(path_x, picoquic_congestion_notification_rtt_measurement, rtt, 0, 0, current_time);
+    }
+}
+
+/* The window grows while the queuing delay is under the target, and shrinks when it exceeds it */
+int ledbat_unit_test()
+{
+    int ret = 0;
+    uint64_t current_time = 1000000;
+    uint64_t cwin_before;
+    picoquic_path_t* path_x = (picoquic_path_t*)malloc(sizeof(picoquic_path_t));
+
+    if (path_x == NULL) {
+        return -1;
+    }
+    memset(path_x, 0, sizeof(picoquic_path_t));
+    path_x->send_mtu = PICOQUIC_INITIAL_MTU_IPV4;
+    path_x->rtt_min = 60000;
+    path_x->smoothed_rtt = 60000;
+    path_x->pkt_ctx[picoquic_packet_context_application].send_sequence = 1000;
+
+    picoquic_ledbat_algorithm->alg_init(NULL, path_x);
+    if (path_x->congestion_alg_state == NULL) {
+        ret = -1;
+    }
+
+    /* Slow start, the gain being halved by the base delay of 60 ms */
+    if (ret == 0) {
+        ledbat_unit_test_rtt(path_x, 60000, current_time);
+        cwin_before = path_x->cwin;
+        picoquic_ledbat_algorithm->alg_notify(path_x, picoquic_congestion_notification_acknowledgement, 0, 10000, 0, current_time);
+        if (path_x->cwin != cwin_before + 5000) {
+            ret = -1;
+        }
+    }
+
+    /* Above 3/4 of the target, the slow start ends */
+    if (ret == 0) {
+        ledbat_unit_test_rtt(path_x, 110000, current_time);
+        picoquic_ledbat_algorithm->alg_notify(path_x, picoquic_congestion_notification_acknowledgement, 0, 10000, 0, current_time);
+        cwin_before = path_x->cwin;
+        picoquic_ledbat_algorithm->alg_notify(path_x, picoquic_congestion_notification_acknowledgement, 0, cwin_before, 0, current_time);
+        /* Half a packet per RTT */
+        if (path_x->cwin != cwin_before + path_x->send_mtu / 2) {
+            ret = -1;
+        }
+    }
+
+    /* Above the target, the window shrinks by the excess */
+    if (ret == 0) {
+        ledbat_unit_test_rtt(path_x, 150000, current_time);
+        cwin_before = path_x->cwin;
+        picoquic_ledbat_algorithm->alg_notify(path_x, picoquic_congestion_notification_acknowledgement, 0, 12000, 0, current_time);
+        if (path_x->cwin != cwin_before - 6000) {
+            ret = -1;
+        }
+    }
+
+    /* A loss halves it */
+    if (ret == 0) {
+        cwin_before = path_x->cwin;
+        picoquic_ledbat_algorithm->alg_notify(path_x, picoquic_congestion_notification_repeat, 0, 0, 0, current_time + 100000);
+        if (path_x->cwin != cwin_before / 2) {
+            ret = -1;
+        }
+    }
+
+    picoquic_ledbat_algorithm->alg_delete(NULL, path_x);
+    free(path_x);
+
+    return ret;
+}
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "log_flusher.h"
+
+#define LOG_FLUSHER_TEST_NB_THREADS 4
+#define LOG_FLUSHER_TEST_NB_LINES 2000
+#define LOG_FLUSHER_TEST_LINE_SIZE 32
+
+typedef struct st_log_flusher_test_writer_t {
+    picoquic_log_flusher_t* flusher;
+    int fd;
+    int id;
+} log_flusher_test_writer_t;
+
+static void* log_flusher_test_write_lines(void* arg)
+{
+    log_flusher_test_writer_t* writer = (log_flusher_test_writer_t*)arg;
+    char line[LOG_FLUSHER_TEST_LINE_SIZE + 1];
+
+    for (int i = 0; i < LOG_FLUSHER_TEST_NB_LINES; i++) {
+        /* Fixed size lines, so that the file can be checked line by line */
+        snprintf(line, sizeof(line), "%d %029d\n", writer->id, i);
+        picoquic_log_flusher_write(writer->flusher, writer->fd, (const uint8_t*)line, LOG_FLUSHER_TEST_LINE_SIZE);
+    }
+    return NULL;
+}
+
+static int log_flusher_test_open(char* fname)
+{
+    strcpy(fname, "/tmp/log_flusher_test_XXXXXX");
+    return mkstemp(fname);
+}
+
+/* The lines of each writer are written in order, or counted as dropped */
+static int log_flusher_test_writers()
+{
+    int ret = 0;
+    char fname[64];
+    int fd = log_flusher_test_open(fname);
+    picoquic_log_flusher_t* flusher = picoquic_log_flusher_create(1024);
+    pthread_t threads[LOG_FLUSHER_TEST_NB_THREADS];
+    log_flusher_test_writer_t writers[LOG_FLUSHER_TEST_NB_THREADS];
+    int next_line[LOG_FLUSHER_TEST_NB_THREADS] = { 0 };
+    char line[LOG_FLUSHER_TEST_LINE_SIZE + 1];
+    FILE* F;
+
+    if (fd < 0 || flusher == NULL) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < LOG_FLUSHER_TEST_NB_THREADS; i++) {
+        writers[i].flusher = flusher;
+        writers[i].fd = fd;
+        writers[i].id = i;
+        if (pthread_create(&threads[i], NULL, log_flusher_test_write_lines, &writers[i]) != 0) {
+            ret = -1;
+        }
+    }
+    for (int i = 0; ret == 0 && i < LOG_FLUSHER_TEST_NB_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (ret == 0) {
+        picoquic_log_flusher_close(flusher, fd);
+        picoquic_log_flusher_wait_idle(flusher);
+        if (fcntl(fd, F_GETFD) != -1) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && (F = fopen(fname, "r")) != NULL) {
+        int nb_lines = 0;
+        while (ret == 0 && fgets(line, sizeof(line), F) != NULL) {
+            int id = -1;
+            int n = -1;
+            if (sscanf(line, "%d %d", &id, &n) != 2 || id < 0 || id >= LOG_FLUSHER_TEST_NB_THREADS || n < next_line[id]) {
+                ret = -1;
+            } else {
+                next_line[id] = n + 1;
+                nb_lines++;
+            }
+        }
+        fclose(F);
+        if (nb_lines + flusher->nb_dropped != LOG_FLUSHER_TEST_NB_THREADS * LOG_FLUSHER_TEST_NB_LINES) {
+            ret = -1;
+        }
+    } else {
+        ret = -1;
+    }
+    picoquic_log_flusher_delete(flusher);
+    unlink(fname);
+
+    return ret;
+}
+
+/* A writer never waits for a stalled disk, it drops and counts what does not fit */
+static int log_flusher_test_drops()
+{
+    int ret = 0;
+    int pipe_fds[2];
+    picoquic_log_flusher_t* flusher = NULL;
+    uint8_t chunk[PICOQUIC_LOG_CHUNK_SIZE];
+    int nb_dropped = 0;
+
+    memset(chunk, 'x', sizeof(chunk));
+    if (pipe(pipe_fds) != 0 || (flusher = picoquic_log_flusher_create(4)) == NULL) {
+        return -1;
+    }
+    /* Nobody reads the pipe, so the thread ends up blocked on it */
+    for (int i = 0; i < 1024; i++) {
+        if (picoquic_log_flusher_write(flusher, pipe_fds[1], chunk, sizeof(chunk)) != 0) {
+            nb_dropped++;
+        }
+    }
+    if (nb_dropped == 0 || flusher->nb_dropped != (uint64_t)nb_dropped) {
+        ret = -1;
+    }
+
+    /* Unblocks the thread */
+    fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+    picoquic_log_flusher_close(flusher, pipe_fds[1]);
+    while (__atomic_load_n(&flusher->dequeue_pos, __ATOMIC_ACQUIRE) != __atomic_load_n(&flusher->enqueue_pos, __ATOMIC_ACQUIRE)) {
+        if (read(pipe_fds[0], chunk, sizeof(chunk)) <= 0) {
+            usleep(100);
+        }
+    }
+    picoquic_log_flusher_delete(flusher);
+    close(pipe_fds[0]);
+
+    return ret;
+}
+
+/* The stream gathers the small writes of fprintf */
+static int log_flusher_test_stream()
+{
+    int ret = 0;
+    char fname[64];
+    int fd = log_flusher_test_open(fname);
+    picoquic_log_flusher_t* flusher = picoquic_log_flusher_create(16);
+    FILE* F = NULL;
+    char line[64];
+
+    if (fd < 0 || flusher == NULL || (F = picoquic_log_flusher_fopen(flusher, fd)) == NULL) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < 1000; i++) {
+        fprintf(F, "line %d\n", i);
+    }
+    if (F != NULL) {
+        fclose(F);
+    }
+    if (flusher != NULL) {
+        picoquic_log_flusher_wait_idle(flusher);
+        if (flusher->enqueue_pos >= 1000 || flusher->nb_dropped != 0) {
+            ret = -1;
+        }
+        picoquic_log_flusher_delete(flusher);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (ret == 0 && (F = fopen(fname, "r")) != NULL) {
+        int i = 0;
+        while (ret == 0 && fgets(line, sizeof(line), F) != NULL) {
+            int n = -1;
+            if (sscanf(line, "line %d", &n) != 1 || n != i) {
+                ret = -1;
+            }
+            i++;
+        }
+        fclose(F);
+        if (i != 1000) {
+            ret = -1;
+        }
+    } else {
+        ret = -1;
+    }
+    unlink(fname);
+
+    return ret;
+}
+
+int log_flusher_test()
+{
+    int ret = 0;
+
+    if (picoquic_log_flusher_create(0) != NULL || picoquic_log_flusher_create(3) != NULL) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        ret = log_flusher_test_writers();
+    }
+    if (ret == 0) {
+        ret = log_flusher_test_drops();
+    }
+    if (ret == 0) {
+        ret = log_flusher_test_stream();
+    }
+
+    return ret;
+}
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "plugin.h"
+
+static int logging_test_calls[3];
+
+static protoop_arg_t logging_test_log_event(picoquic_cnx_t *cnx)
+{
+    logging_test_calls[0]++;
+    return 0;
+}
+
+static protoop_arg_t logging_test_push(picoquic_cnx_t *cnx)
+{
+    logging_test_calls[1]++;
+    return 0;
+}
+
+static protoop_arg_t logging_test_pop(picoquic_cnx_t *cnx)
+{
+    logging_test_calls[2]++;
+    return 0;
+}
+
+static int logging_test_expect(int log_events, int pushes, int pops)
+{
+    return (logging_test_calls[0] == log_events && logging_test_calls[1] == pushes && logging_test_calls[2] == pops) ? 0 : -1;
+}
+
+int logging_active_test()
+{
+    int ret = 0;
+    picoquic_cnx_t *cnx = calloc(1, sizeof(picoquic_cnx_t));
+    protoop_plugin_t *p = calloc(1, sizeof(protoop_plugin_t));
+
+    memset(logging_test_calls, 0, sizeof(logging_test_calls));
+    if (cnx == NULL || p == NULL ||
+        register_noparam_protoop(cnx, &PROTOOP_NOPARAM_LOG_EVENT, logging_test_log_event) != 0 ||
+        register_noparam_protoop(cnx, &PROTOOP_NOPARAM_PUSH_LOG_CONTEXT, logging_test_push) != 0 ||
+        register_noparam_protoop(cnx, &PROTOOP_NOPARAM_POP_LOG_CONTEXT, logging_test_pop) != 0) {
+        free(cnx);
+        free(p);
+        return -1;
+    }
+    strcpy(p->name, "test.logging");
+
+    /* Without any pluglet, nothing is dispatched */
+    picoquic_update_logging_active(cnx);
+    PUSH_LOG_CTX(cnx, "\"test\": %d", 1);
+    LOG_EVENT(cnx, "test", "event", "", "{\"value\": %d}", 1);
+    if (cnx->logging_active || cnx->log_ctx_skipped != 1 || logging_test_expect(0, 0, 0) != 0) {
+        ret = -1;
+    }
+
+    /* Once observed, events are dispatched, but the context pushed before is not popped */
+    if (ret == 0 && (plugin_plug_elf(cnx, p, PROTOOP_NOPARAM_LOG_EVENT.id, NO_PARAM, pluglet_record, NULL) != 0 || !cnx->logging_active)) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        LOG_EVENT(cnx, "test", "event", "", "{\"value\": %d}", 2);
+        POP_LOG_CTX(cnx);
+        PUSH_LOG_CTX(cnx, "\"test\": %d", 2);
+        POP_LOG_CTX(cnx);
+        if (cnx->log_ctx_skipped != 0 || logging_test_expect(1, 1, 1) != 0) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && (plugin_unplug(cnx, PROTOOP_NOPARAM_LOG_EVENT.id, NO_PARAM, pluglet_record) != 0 || cnx->logging_active)) {
+        ret = -1;
+    }
+
+    picoquic_free_protoops(cnx->ops);
+    free(p->record_ring);
+    free(p);
+    free(cnx);
+
+    return ret;
+}
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "stream_recv.h"
+
+#define MAX_STREAM_DATA_TEST_NB_STREAMS 64
+#define MAX_STREAM_DATA_TEST_CREDIT 1000
+
+/* Built-in implementation of the prepare_required_max_stream_data_frames protocol operation, see frames.c */
+protoop_arg_t prepare_required_max_stream_data_frames(picoquic_cnx_t *cnx);
+void picoquic_stream_data_callback(picoquic_cnx_t* cnx, picoquic_stream_head* stream);
+
+static int max_stream_data_test_callback(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* stream_ctx)
+{
+    return 0;
+}
+
+/* Delivers length more bytes of the stream to the application */
+static int max_stream_data_test_receive(picoquic_cnx_t* cnx, picoquic_stream_head* stream, size_t length)
+{
+    uint8_t bytes[MAX_STREAM_DATA_TEST_CREDIT] = { 0 };
+    int new_data = 0;
+
+    if (picoquic_stream_recv_insert(&stream->recv, stream->consumed_offset, stream->consumed_offset,
+        bytes, length, &new_data) != 0) {
+        return -1;
+    }
+    picoquic_stream_data_callback(cnx, stream);
+
+    return 0;
+}
+
+/* Prepares the frames in bytes_max bytes, returning the number of frames */
+static int max_stream_data_test_prepare(picoquic_cnx_t* cnx, size_t bytes_max, uint64_t* stream_ids)
+{
+    uint8_t bytes[256];
+    protoop_arg_t inputv[2] = { (protoop_arg_t)bytes, (protoop_arg_t)bytes_max };
+    protoop_arg_t outputv[PROTOOPARGS_MAX];
+    size_t byte_index = 0;
+    int nb_frames = 0;
+
+    cnx->protoop_inputv = inputv;
+    cnx->protoop_inputc = 2;
+    cnx->protoop_outputv = outputv;
+    if (prepare_required_max_stream_data_frames(cnx) != 0) {
+        return -1;
+    }
+
+    while (byte_index < outputv[0]) {
+        uint64_t max_data = 0;
+        size_t l1 = 0;
+        size_t l2 = 0;
+
+        if (bytes[byte_index] != picoquic_frame_type_max_stream_data ||
+            (l1 = picoquic_varint_decode(bytes + byte_index + 1, outputv[0] - byte_index - 1, &stream_ids[nb_frames])) == 0 ||
+            (l2 = picoquic_varint_decode(bytes + byte_index + 1 + l1, outputv[0] - byte_index - 1 - l1, &max_data)) == 0) {
+            return -1;
+        }
+        byte_index += 1 + l1 + l2;
+        nb_frames++;
+    }
+
+    return nb_frames;
+}
+
+static int max_stream_data_test_autotune(picoquic_cnx_t* cnx, picoquic_stream_head* stream, picoquic_stream_head* stream2)
+{
+    int ret = 0;
+    uint64_t simulated_time = 1000000;
+    uint64_t stream_ids[MAX_STREAM_DATA_TEST_NB_STREAMS];
+    picoquic_quic_t* quic = calloc(1, sizeof(picoquic_quic_t));
+    /* Consumed bytes, window expected after the update, and time before the update */
+    static const uint64_t steps[][3] = {
+        { 600, MAX_STREAM_DATA_TEST_CREDIT, 0 },
+        { 600, 2 * MAX_STREAM_DATA_TEST_CREDIT, 100000 },
+        { 1010, 2 * MAX_STREAM_DATA_TEST_CREDIT, 1000000 },
+        { 1010, 3 * MAX_STREAM_DATA_TEST_CREDIT, 100000 },
+        { 1510, 3 * MAX_STREAM_DATA_TEST_CREDIT, 100000 }
+    };
+
+    if (quic == NULL) {
+        return -1;
+    }
+    quic->p_simulated_time = &simulated_time;
+    quic->max_stream_data_window_max = 4 * MAX_STREAM_DATA_TEST_CREDIT;
+    quic->flow_control_budget = 2 * MAX_STREAM_DATA_TEST_CREDIT;
+    cnx->quic = quic;
+
+    /* The second doubling is held by the budget */
+    for (size_t i = 0; ret == 0 && i < sizeof(steps) / sizeof(steps[0]); i++) {
+        simulated_time += steps[i][2];
+        for (uint64_t received = 0; ret == 0 && received < steps[i][0]; received += MAX_STREAM_DATA_TEST_CREDIT / 2) {
+            size_t length = (size_t)((steps[i][0] - received < MAX_STREAM_DATA_TEST_CREDIT / 2) ?
+                steps[i][0] - received : MAX_STREAM_DATA_TEST_CREDIT / 2);
+
+            ret = max_stream_data_test_receive(cnx, stream, length);
+        }
+        if (ret == 0 && (max_stream_data_test_prepare(cnx, 256, stream_ids) != 1 ||
+            stream->max_data_window != steps[i][1] ||
+            stream->maxdata_local != stream->consumed_offset + steps[i][1])) {
+            DBG_PRINTF("Window %d at step %d\n", (int)stream->max_data_window, (int)i);
+            ret = -1;
+        }
+    }
+
+    /* Once the budget is used, the other streams keep their window */
+    if (ret == 0 && (quic->flow_control_growth != 2 * MAX_STREAM_DATA_TEST_CREDIT ||
+        max_stream_data_test_receive(cnx, stream2, 600) != 0 || max_stream_data_test_prepare(cnx, 256, stream_ids) != 1 ||
+        max_stream_data_test_receive(cnx, stream2, 600) != 0 || max_stream_data_test_prepare(cnx, 256, stream_ids) != 1 ||
+        stream2->max_data_window != MAX_STREAM_DATA_TEST_CREDIT)) {
+        ret = -1;
+    }
+
+    cnx->quic = NULL;
+    free(quic);
+
+    return ret;
+}
+
+int max_stream_data_test()
+{
+    int ret = 0;
+    uint64_t stream_ids[MAX_STREAM_DATA_TEST_NB_STREAMS];
+    picoquic_cnx_t* cnx = calloc(1, sizeof(picoquic_cnx_t));
+    picoquic_stream_head* streams = calloc(MAX_STREAM_DATA_TEST_NB_STREAMS, sizeof(picoquic_stream_head));
+
+    if (cnx == NULL || streams == NULL) {
+        free(cnx);
+        free(streams);
+        return -1;
+    }
+
+    cnx->callback_fn = max_stream_data_test_callback;
+    for (int i = 0; i < MAX_STREAM_DATA_TEST_NB_STREAMS; i++) {
+        streams[i].stream_id = 4 * i;
+        streams[i].maxdata_local = MAX_STREAM_DATA_TEST_CREDIT;
+        streams[i].max_data_window = MAX_STREAM_DATA_TEST_CREDIT;
+        streams[i].next_stream = (i + 1 < MAX_STREAM_DATA_TEST_NB_STREAMS) ? &streams[i + 1] : NULL;
+    }
+    cnx->first_stream = &streams[0];
+
+    /* Below half of the credit, nothing is due */
+    if (max_stream_data_test_receive(cnx, &streams[3], MAX_STREAM_DATA_TEST_CREDIT / 2) != 0 ||
+        cnx->first_max_data_stream != NULL || max_stream_data_test_prepare(cnx, 256, stream_ids) != 0) {
+        ret = -1;
+    }
+
+    /* The streams crossing the threshold get their update in the order they crossed it, once */
+    if (ret == 0 && (max_stream_data_test_receive(cnx, &streams[40], 600) != 0 ||
+        max_stream_data_test_receive(cnx, &streams[3], 10) != 0 ||
+        max_stream_data_test_receive(cnx, &streams[10], 600) != 0 ||
+        max_stream_data_test_receive(cnx, &streams[40], 10) != 0)) {
+        ret = -1;
+    }
+    if (ret == 0 && (max_stream_data_test_prepare(cnx, 256, stream_ids) != 3 ||
+        stream_ids[0] != 160 || stream_ids[1] != 12 || stream_ids[2] != 40 ||
+        streams[40].maxdata_local != 610 + MAX_STREAM_DATA_TEST_CREDIT ||
+        cnx->first_max_data_stream != NULL || cnx->last_max_data_stream != NULL ||
+        max_stream_data_test_prepare(cnx, 256, stream_ids) != 0)) {
+        ret = -1;
+    }
+
+    /* Without room for all the frames, the others wait for the next packet */
+    if (ret == 0 && (max_stream_data_test_receive(cnx, &streams[50], 600) != 0 ||
+        max_stream_data_test_receive(cnx, &streams[51], 600) != 0 ||
+        max_stream_data_test_prepare(cnx, 6, stream_ids) != 1 || stream_ids[0] != 200 ||
+        cnx->first_max_data_stream != &streams[51] ||
+        max_stream_data_test_prepare(cnx, 256, stream_ids) != 1 || stream_ids[0] != 204)) {
+        ret = -1;
+    }
+
+    /* A stream that received its fin when its turn comes is skipped */
+    if (ret == 0 && max_stream_data_test_receive(cnx, &streams[60], 600) != 0) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        streams[60].fin_received = 1;
+        if (max_stream_data_test_prepare(cnx, 256, stream_ids) != 0 || streams[60].is_max_data_queued) {
+            ret = -1;
+        }
+    }
+
+    /* With a context, the window doubles when it is half consumed within 2 RTT of the previous update,
+     * up to the window max and the budget of the context */
+    if (ret == 0) {
+        ret = max_stream_data_test_autotune(cnx, &streams[20], &streams[21]);
+    }
+
+    for (int i = 0; i < MAX_STREAM_DATA_TEST_NB_STREAMS; i++) {
+        picoquic_stream_recv_free(&streams[i].recv);
+    }
+    free(streams);
+    free(cnx);
+
+    return ret;
+}
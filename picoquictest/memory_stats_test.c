@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+#define MEMORY_STATS_TEST_CREDIT 1000
+
+/* Built-in implementation of the prepare_required_max_stream_data_frames protocol operation, see frames.c */
+protoop_arg_t prepare_required_max_stream_data_frames(picoquic_cnx_t *cnx);
+
+/* Returns the length of the MAX_STREAM_DATA frames prepared */
+static size_t memory_stats_test_prepare(picoquic_cnx_t* cnx)
+{
+    uint8_t bytes[256];
+    protoop_arg_t inputv[2] = { (protoop_arg_t)bytes, (protoop_arg_t)sizeof(bytes) };
+    protoop_arg_t outputv[PROTOOPARGS_MAX] = { 0 };
+
+    cnx->protoop_inputv = inputv;
+    cnx->protoop_inputc = 2;
+    cnx->protoop_outputv = outputv;
+    (void)prepare_required_max_stream_data_frames(cnx);
+
+    return (size_t)outputv[0];
+}
+
+static picoquic_stream_data* memory_stats_test_queue(picoquic_cnx_t* cnx, size_t length)
+{
+    picoquic_stream_data* data = calloc(1, sizeof(picoquic_stream_data));
+
+    if (data != NULL && (data->bytes = malloc(length)) == NULL) {
+        free(data);
+        data = NULL;
+    }
+    if (data != NULL) {
+        data->length = length;
+        data->memory_category = picoquic_memory_send_data;
+        picoquic_memory_charge(cnx, picoquic_memory_send_data, picoquic_stream_data_footprint(data));
+    }
+
+    return data;
+}
+
+int memory_stats_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = calloc(1, sizeof(picoquic_quic_t));
+    picoquic_cnx_t* cnx = calloc(2, sizeof(picoquic_cnx_t));
+    picoquic_stream_head* stream = calloc(1, sizeof(picoquic_stream_head));
+    picoquic_sack_list_t sacks;
+    picoquic_stream_data* data = NULL;
+    picoquic_memory_stats_t stats;
+
+    if (quic == NULL || cnx == NULL || stream == NULL) {
+        free(quic);
+        free(cnx);
+        free(stream);
+        return -1;
+    }
+    picoquic_sack_list_init(&sacks);
+
+    /* The ranges of packet numbers are charged once they no longer fit inline */
+    for (uint64_t pn = 0; ret == 0 && pn < 200; pn += 2) {
+        ret = picoquic_update_sack_list(&cnx[0], &sacks, pn, pn);
+    }
+    if (ret == 0 && (picoquic_sack_list_footprint(&sacks) == 0 ||
+        cnx[0].memory_used[picoquic_memory_sacks] != picoquic_sack_list_footprint(&sacks) ||
+        cnx[0].memory_total != picoquic_sack_list_footprint(&sacks))) {
+        ret = -1;
+    }
+    picoquic_memory_release(&cnx[0], picoquic_memory_sacks, picoquic_sack_list_footprint(&sacks));
+    picoquic_sack_list_free(&sacks);
+
+    /* Queued data is charged with its copy, and fully released when freed */
+    if (ret == 0 && (data = memory_stats_test_queue(&cnx[0], 3000)) == NULL) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        picoquic_get_memory_stats(&cnx[0], &stats);
+        if (stats.bytes[picoquic_memory_send_data] != sizeof(picoquic_stream_data) + 3000 ||
+            stats.total != stats.bytes[picoquic_memory_send_data] || stats.peak < stats.total) {
+            ret = -1;
+        }
+        picoquic_free_stream_data(&cnx[0], data);
+        picoquic_get_memory_stats(&cnx[0], &stats);
+        if (ret == 0 && (stats.total != 0 || stats.bytes[picoquic_memory_send_data] != 0 ||
+            stats.peak < sizeof(picoquic_stream_data) + 3000)) {
+            ret = -1;
+        }
+    }
+
+    /* Past the cap, the MAX_STREAM_DATA update waits until the memory is freed */
+    stream->stream_id = 4;
+    stream->maxdata_local = MEMORY_STATS_TEST_CREDIT;
+    stream->consumed_offset = MEMORY_STATS_TEST_CREDIT;
+    stream->is_max_data_queued = 1;
+    cnx[1].first_stream = stream;
+    cnx[1].first_max_data_stream = stream;
+    cnx[1].last_max_data_stream = stream;
+    picoquic_set_memory_cap(&cnx[1], 2000);
+    if (ret == 0 && (data = memory_stats_test_queue(&cnx[1], 2000)) == NULL) {
+        ret = -1;
+    }
+    if (ret == 0 && (!picoquic_is_memory_capped(&cnx[1]) || memory_stats_test_prepare(&cnx[1]) != 0 ||
+        cnx[1].first_max_data_stream != stream || cnx[1].nb_memory_capped != 1)) {
+        ret = -1;
+    }
+
+    /* The context adds up its connections */
+    if (ret == 0) {
+        quic->cnx_list = &cnx[0];
+        cnx[0].next_in_table = &cnx[1];
+        picoquic_quic_get_memory_stats(quic, &stats);
+        if (stats.total != cnx[1].memory_total || stats.peak != cnx[0].memory_peak + cnx[1].memory_peak ||
+            stats.nb_capped != 1) {
+            ret = -1;
+        }
+    }
+
+    if (data != NULL) {
+        picoquic_free_stream_data(&cnx[1], data);
+        if (ret == 0 && (picoquic_is_memory_capped(&cnx[1]) || memory_stats_test_prepare(&cnx[1]) == 0 ||
+            cnx[1].first_max_data_stream != NULL || stream->maxdata_local != 3 * MEMORY_STATS_TEST_CREDIT)) {
+            ret = -1;
+        }
+    }
+
+    free(stream);
+    free(cnx);
+    free(quic);
+
+    return ret;
+}
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "memory.h"
+
+#define SLAB_TEST_NB_SMALL 100
+
+static protoop_plugin_t *slab_test_plugin(uint32_t memory_size)
+{
+    protoop_plugin_t *p = calloc(1, sizeof(protoop_plugin_t));
+    if (p == NULL) {
+        return NULL;
+    }
+    strcpy(p->name, "test.slab");
+    p->params.plugin_memory_manager_type = plugin_memory_manager_slab;
+    p->params.memory_size = memory_size;
+    if (plugin_memory_reserve(p) != 0) {
+        free(p);
+        return NULL;
+    }
+    if (init_memory_management(p) != 0) {
+        plugin_memory_release(p);
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+static void slab_test_plugin_free(protoop_plugin_t *p)
+{
+    destroy_memory_management(p);
+    plugin_memory_release(p);
+    free(p);
+}
+
+static void *slab_test_malloc(protoop_plugin_t *p, unsigned int size)
+{
+    return p->memory_manager.my_malloc(p, size);
+}
+
+static int slab_test_check_stats(protoop_plugin_t *p, int class_index, uint64_t in_use, uint64_t free_objects)
+{
+    slab_class_stats_t stats;
+    if (slab_memory_get_stats(p, class_index, &stats) != 0) {
+        return -1;
+    }
+    return (stats.in_use == in_use && stats.free == free_objects) ? 0 : -1;
+}
+
+int slab_memory_test()
+{
+    int ret = 0;
+    void *small[SLAB_TEST_NB_SMALL];
+    protoop_plugin_t *p = slab_test_plugin(1024 * 1024);
+
+    if (p == NULL) {
+        return -1;
+    }
+
+    /* Small objects all come from the 32 bytes class, header included */
+    for (int i = 0; ret == 0 && i < SLAB_TEST_NB_SMALL; i++) {
+        small[i] = slab_test_malloc(p, 16);
+        if (small[i] == NULL || !IS_IN_PLUGIN_MEMORY(p, small[i])) {
+            ret = -1;
+        } else {
+            memset(small[i], i, 16);
+        }
+    }
+    for (int i = 1; ret == 0 && i < SLAB_TEST_NB_SMALL; i++) {
+        if ((uint8_t *) small[i] - (uint8_t *) small[i - 1] != 32) {
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        ret = slab_test_check_stats(p, 1, SLAB_TEST_NB_SMALL, 0);
+    }
+
+    /* Released objects are reused first */
+    if (ret == 0) {
+        for (int i = 0; i < SLAB_TEST_NB_SMALL; i++) {
+            my_free_in_core(p, small[i]);
+        }
+        ret = slab_test_check_stats(p, 1, 0, SLAB_TEST_NB_SMALL);
+    }
+    if (ret == 0 && slab_test_malloc(p, 20) != small[SLAB_TEST_NB_SMALL - 1]) {
+        ret = -1;
+    }
+
+    /* Objects above the largest class take the large object path */
+    void *large = NULL;
+    if (ret == 0) {
+        large = slab_test_malloc(p, 10000);
+        if (large == NULL || !IS_IN_PLUGIN_MEMORY(p, large)) {
+            ret = -1;
+        } else {
+            ret = slab_test_check_stats(p, SLAB_LARGE_CLASS, 1, 0);
+        }
+    }
+    if (ret == 0) {
+        my_free_in_core(p, large);
+        if (slab_test_malloc(p, 9000) != large) {
+            ret = -1;
+        }
+    }
+
+    /* Growing an object moves it to another class while keeping its content */
+    if (ret == 0) {
+        uint8_t *grown = slab_test_malloc(p, 100);
+        if (grown == NULL) {
+            ret = -1;
+        } else {
+            memset(grown, 0x5a, 100);
+            grown = p->memory_manager.my_realloc(p, grown, 3000);
+            for (int i = 0; grown != NULL && i < 100; i++) {
+                if (grown[i] != 0x5a) {
+                    grown = NULL;
+                }
+            }
+            if (grown == NULL) {
+                ret = -1;
+            } else {
+                ret = slab_test_check_stats(p, 3, 0, 1);
+            }
+        }
+    }
+
+    /* Running out of plugin memory is reported, not fatal */
+    if (ret == 0 && slab_test_malloc(p, 2 * 1024 * 1024) != NULL) {
+        ret = -1;
+    }
+
+    slab_test_plugin_free(p);
+
+    return ret;
+}
+
+typedef struct template_test_node {
+    struct template_test_node *next;
+    uint8_t table[256];
+} template_test_node_t;
+
+/* A second instance maps the memory of the first one, with its pointers and its allocator state moved */
+int plugin_template_test()
+{
+    int ret = 0;
+    template_test_node_t *first = NULL;
+    template_test_node_t *node = NULL;
+    plugin_template_t *t = NULL;
+    protoop_plugin_t *p = slab_test_plugin(1024 * 1024);
+    protoop_plugin_t *instance = calloc(1, sizeof(protoop_plugin_t));
+
+    if (p == NULL || instance == NULL) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < 3; i++) {
+        node = slab_test_malloc(p, sizeof(template_test_node_t));
+        if (node == NULL) {
+            ret = -1;
+        } else {
+            for (int j = 0; j < 256; j++) {
+                node->table[j] = (uint8_t) (i + j);
+            }
+            node->next = first;
+            first = node;
+        }
+    }
+    if (ret == 0 && ((t = plugin_template_create(p)) == NULL || t->nb_relocations < 2)) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        strcpy(instance->name, p->name);
+        instance->params = p->params;
+        if (plugin_memory_reserve(instance) != 0) {
+            ret = -1;
+        } else if (plugin_template_apply(t, instance) != 0 || !instance->from_template) {
+            destroy_memory_management(instance);
+            plugin_memory_release(instance);
+            ret = -1;
+        }
+    }
+
+    /* The list is found at the same offsets, linked within the new memory */
+    node = ret == 0 ? (template_test_node_t *) (uintptr_t) plugin_template_relocate(t, instance, (uint64_t) (uintptr_t) first) : NULL;
+    for (int i = 2; ret == 0 && i >= 0; i--) {
+        if (node == NULL || !IS_IN_PLUGIN_MEMORY(instance, node) ||
+            (uint8_t *) node - (uint8_t *) instance->memory != (uint8_t *) first - (uint8_t *) p->memory ||
+            node->table[17] != (uint8_t) (i + 17)) {
+            ret = -1;
+        } else {
+            node = node->next;
+            first = first->next;
+        }
+    }
+    if (ret == 0 && node != NULL) {
+        ret = -1;
+    }
+
+    /* Both allocators continue from the same state, and the writes of the instance are its own */
+    if (ret == 0) {
+        uint8_t *from_template = slab_test_malloc(p, 100);
+        uint8_t *from_instance = slab_test_malloc(instance, 100);
+        if (from_template == NULL || from_instance == NULL ||
+            from_instance - (uint8_t *) instance->memory != from_template - (uint8_t *) p->memory ||
+            slab_test_check_stats(instance, 3, 1, 0) != 0) {
+            ret = -1;
+        } else {
+            memset(from_template, 1, 100);
+            memset(from_instance, 2, 100);
+            if (from_template[50] != 1) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (instance != NULL && instance->memory != NULL) {
+        slab_test_plugin_free(instance);
+    } else {
+        free(instance);
+    }
+    if (t != NULL) {
+        plugin_template_free(t);
+    }
+    if (p != NULL) {
+        slab_test_plugin_free(p);
+    }
+
+    return ret;
+}
@@ -1,13 +1,29 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WINDOWS
+#include <sys/time.h>
+#endif
 #include "picoquic_internal.h"
 #include "plugin.h"
 #include "memory.h"
+#include "memcpy.h"
 #include "getset.h"
 #include "util.h"
 #include "protoop.h"
+#include "../plugins/microbench/microbench.h"
+
+#define MICROBENCH_PLUGIN "plugins/microbench/microbench.plugin"
+#define MICROBENCH_NB_INSERTIONS 16
+
+/*
+ * Each loop has a native version, which is the baseline, and a pluglet doing the same
+ * in plugins/microbench, run both compiled and interpreted. Their results must match.
+ */
 
 uint64_t simple_for_loop(picoquic_cnx_t *mem) {
     uint64_t sum = 0;
-    for (uint64_t i = 0; i < 1000000000; i++) {
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
         sum = i + sum * 3 / 2;
     }
     return sum;
@@ -15,210 +31,318 @@ uint64_t simple_for_loop(picoquic_cnx_t *mem) {
 
 uint64_t get_set_cnx_fields_loop(picoquic_cnx_t *cnx) {
     uint64_t sum = 0;
-    for (uint64_t i = 0; i < 500000000; i++) {
-        sum += cnx->start_time;
-        sum += cnx->latest_progress_time;
-        cnx->start_time = 2 * sum + 3 * i;
-        cnx->latest_progress_time = 3 * sum / 4 + i;
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        sum += get_cnx(cnx, AK_CNX_START_TIME, 0);
+        sum += get_cnx(cnx, AK_CNX_LATEST_PROGRESS_TIME, 0);
+        set_cnx(cnx, AK_CNX_START_TIME, 0, 2 * sum + 3 * i);
+        set_cnx(cnx, AK_CNX_LATEST_PROGRESS_TIME, 0, 3 * sum / 4 + i);
     }
     return sum;
 }
 
-uint64_t get_set_api_cnx_fields_loop(picoquic_cnx_t *cnx) {
+static protoop_arg_t microbench_empty(picoquic_cnx_t *cnx) {
+    return 0;
+}
+
+static uint64_t run_protoop_loop(picoquic_cnx_t *cnx) {
     uint64_t sum = 0;
-    for (uint64_t i = 0; i < 500000000; i++) {
-        sum += get_cnx(cnx, AK_CNX_START_TIME, 0);
-        sum += get_cnx(cnx, AK_CNX_LATEST_PROGRESS_TIME, 0);
-        set_cnx(cnx, AK_CNX_START_TIME, 0, 2 * sum + 3 * i);
-        set_cnx(cnx, AK_CNX_LATEST_PROGRESS_TIME, 0, 3 * sum / 4 + i);
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        protoop_params_t pp = { .param = NO_PARAM, .caller_is_intern = true, .inputc = 0, .inputv = NULL, .outputv = NULL };
+        sum += plugin_run_protoop(cnx, &pp, PROTOOPID_MICROBENCH_EMPTY, NULL) + 1;
     }
     return sum;
 }
 
-#define SIMPLE_FOR_LOOP ((protoop_id_t) { .id = "simple_for_loop", .hash = hash_value_str("simple_for_loop") })
-#define GET_SET_CNX_FIELDS_LOOP ((protoop_id_t) { .id = "get_set_cnx_fields_loop", .hash = hash_value_str("get_set_cnx_fields_loop") })
+static uint64_t get_cnx_loop(picoquic_cnx_t *cnx) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        sum += get_cnx(cnx, AK_CNX_START_TIME, 0) + i;
+    }
+    return sum;
+}
 
-void register_microbench_protoops(picoquic_cnx_t *cnx)
-{
-    register_noparam_protoop(cnx, &SIMPLE_FOR_LOOP, &simple_for_loop);
-    register_noparam_protoop(cnx, &GET_SET_CNX_FIELDS_LOOP, &get_set_cnx_fields_loop);
+static uint64_t set_cnx_loop(picoquic_cnx_t *cnx) {
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        set_cnx(cnx, AK_CNX_START_TIME, 0, i);
+    }
+    return get_cnx(cnx, AK_CNX_START_TIME, 0);
 }
 
-int microbench_plugin_run_test() {
-    int ret = 0;
-    picoquic_cnx_t cnx = { 0 };
-    register_protocol_operations(&cnx);
-    register_microbench_protoops(&cnx);
-    
-    /* TODO compare with non-direct calls! */
+static uint64_t memcpy_loop(picoquic_cnx_t *cnx) {
+    uint8_t src[MICROBENCH_COPY_SIZE];
+    uint8_t dst[MICROBENCH_COPY_SIZE];
+    uint64_t sum = 0;
+    for (int i = 0; i < MICROBENCH_COPY_SIZE; i++) {
+        src[i] = (uint8_t) i;
+    }
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        src[i % MICROBENCH_COPY_SIZE] = (uint8_t) i;
+        my_memcpy(dst, src, MICROBENCH_COPY_SIZE);
+        sum += dst[(i * 7) % MICROBENCH_COPY_SIZE];
+    }
+    return sum;
+}
+
+static uint64_t memset_loop(picoquic_cnx_t *cnx) {
+    uint8_t dst[MICROBENCH_COPY_SIZE];
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        my_memset(dst, (int) (i & 0xff), MICROBENCH_COPY_SIZE);
+        sum += dst[(i * 7) % MICROBENCH_COPY_SIZE];
+    }
+    return sum;
+}
 
-    struct timeval tv_sl_start;
-    struct timeval tv_sl_end;
+static uint64_t malloc_free_loop(picoquic_cnx_t *cnx) {
+    unsigned int size = (unsigned int) get_cnx(cnx, AK_CNX_INPUT, 0);
+    uint64_t nb_allocated = 0;
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        void *p = my_malloc(cnx, size);
+        if (p != NULL) {
+            nb_allocated++;
+            my_free(cnx, p);
+        }
+    }
+    return nb_allocated;
+}
 
+static uint64_t metadata_loop(picoquic_cnx_t *cnx) {
     uint64_t sum = 0;
-    gettimeofday(&tv_sl_start, NULL);
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        sum += get_cnx_metadata(cnx, 0);
+        set_cnx_metadata(cnx, 0, i);
+    }
+    return sum;
+}
+
+static protoop_id_t MICROBENCH_EMPTY = { .id = PROTOOPID_MICROBENCH_EMPTY };
+static protoop_id_t MICROBENCH_EMPTY_OBSERVED = { .id = PROTOOPID_MICROBENCH_EMPTY_OBSERVED };
+static protoop_id_t MICROBENCH_EMPTY_REPLACE = { .id = PROTOOPID_MICROBENCH_EMPTY_REPLACE };
+static protoop_id_t SIMPLE_FOR_LOOP = { .id = "simple_for_loop" };
+static protoop_id_t GET_SET_CNX_FIELDS_LOOP = { .id = "get_set_cnx_fields_loop" };
+static protoop_id_t RUN_PROTOOP_LOOP = { .id = "run_protoop_loop" };
+static protoop_id_t GET_CNX_LOOP = { .id = "get_cnx_loop" };
+static protoop_id_t SET_CNX_LOOP = { .id = "set_cnx_loop" };
+static protoop_id_t MEMCPY_LOOP = { .id = "memcpy_loop" };
+static protoop_id_t MEMSET_LOOP = { .id = "memset_loop" };
+static protoop_id_t MALLOC_FREE_LOOP = { .id = "malloc_free_loop" };
+static protoop_id_t METADATA_LOOP = { .id = "metadata_loop" };
+
+typedef struct st_microbench_loop_t {
+    char const *name;
+    protoop_id_t *pid;
+    uint64_t (*native)(picoquic_cnx_t *cnx);
+    protoop_arg_t input; /* The size of the allocations */
+} microbench_loop_t;
+
+static const microbench_loop_t microbench_loops[] = {
+    { "simple_for_loop", &SIMPLE_FOR_LOOP, simple_for_loop, 0 },
+    { "get_set_cnx_fields", &GET_SET_CNX_FIELDS_LOOP, get_set_cnx_fields_loop, 0 },
+    { "run_protoop", &RUN_PROTOOP_LOOP, run_protoop_loop, 0 },
+    { "helper_get_cnx", &GET_CNX_LOOP, get_cnx_loop, 0 },
+    { "helper_set_cnx", &SET_CNX_LOOP, set_cnx_loop, 0 },
+    { "helper_my_memcpy_64", &MEMCPY_LOOP, memcpy_loop, 0 },
+    { "helper_my_memset_64", &MEMSET_LOOP, memset_loop, 0 },
+    { "my_malloc_free_16", &MALLOC_FREE_LOOP, malloc_free_loop, 16 },
+    { "my_malloc_free_64", &MALLOC_FREE_LOOP, malloc_free_loop, 64 },
+    { "my_malloc_free_256", &MALLOC_FREE_LOOP, malloc_free_loop, 256 },
+    { "my_malloc_free_1024", &MALLOC_FREE_LOOP, malloc_free_loop, 1024 },
+    { "my_malloc_free_4096", &MALLOC_FREE_LOOP, malloc_free_loop, 4096 },
+    { "metadata_get_set", &METADATA_LOOP, metadata_loop, 0 },
+};
+
+static const size_t nb_microbench_loops = sizeof(microbench_loops) / sizeof(microbench_loop_t);
+
+static const char *microbench_plugins[] = {
+    MICROBENCH_PLUGIN,
+    "plugins/datagram/datagram.plugin",
+    "plugins/monitoring/monitoring.plugin",
+};
+
+static const size_t nb_microbench_plugins = sizeof(microbench_plugins) / sizeof(const char *);
+
+static uint64_t microbench_elapsed(struct timeval *tv_start)
+{
+    struct timeval tv_end;
+
+    gettimeofday(&tv_end, NULL);
+    return (uint64_t)((tv_end.tv_sec - tv_start->tv_sec) * 1000000 + (tv_end.tv_usec - tv_start->tv_usec));
+}
+
+/* One line per result, in a fixed order, so that the outputs of two runs can be compared */
+static void microbench_report(const char *name, const char *variant, uint64_t elapsed_us, uint64_t nb_ops)
+{
+    fprintf(stderr, "MICROBENCH %-24s %-12s %12.2f ns/op\n", name, variant, (double)elapsed_us * 1000.0 / (double)nb_ops);
+}
+
+/* The state the loops read is reset before each run, so that all the variants return the same result */
+static void microbench_reset(picoquic_cnx_t *cnx)
+{
+    cnx->start_time = 0;
+    cnx->latest_progress_time = 0;
+    set_cnx_metadata(cnx, 0, 0);
+}
 
-    //for (uint64_t i = 0; i < 1000000; i++) {
-        sum += simple_for_loop(&cnx);
-        //protoop_prepare_and_run_noparam(&cnx, "simple_for_loop", NULL,
-        //    cnx);
-    //}
+static int microbench_run_loop(picoquic_cnx_t *cnx, const microbench_loop_t *loop)
+{
+    int ret = 0;
+    protocol_operation_struct_t *post;
+    pluglet_t *pluglet;
+    protoop_arg_t inputv[1] = { loop->input };
+    const char *variants[2] = { pluglet_uses_jit() ? "jit" : "threaded", "interpreter" };
+    char *error_msg = NULL;
+    struct timeval tv_start;
+    uint64_t native_result;
+
+    HASH_FIND_PID(cnx->ops, &loop->pid->hash, post);
+    if (!post || !post->params->replace) {
+        fprintf(stderr, "No pluglet for %s\n", loop->pid->id);
+        return -1;
+    }
+    pluglet = post->params->replace;
+    cnx->current_plugin = pluglet->p;
+    cnx->protoop_inputv = inputv;
+    cnx->protoop_inputc = 1;
+
+    microbench_reset(cnx);
+    gettimeofday(&tv_start, NULL);
+    native_result = loop->native(cnx);
+    microbench_report(loop->name, "baseline", microbench_elapsed(&tv_start), MICROBENCH_NB_LOOPS);
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        uint64_t result;
+
+        microbench_reset(cnx);
+        gettimeofday(&tv_start, NULL);
+        result = _exec_loaded_code(pluglet, (void *)cnx, (void *)cnx->current_plugin->memory,
+            cnx->current_plugin->memory_size, &error_msg, i == 0);
+        microbench_report(loop->name, variants[i], microbench_elapsed(&tv_start), MICROBENCH_NB_LOOPS);
+        if (result != native_result) {
+            fprintf(stderr, "%s %s returns %" PRIu64 " instead of %" PRIu64 "\n", loop->name, variants[i], result, native_result);
+            ret = -1;
+        }
+    }
 
-    gettimeofday(&tv_sl_end, NULL);
+    cnx->protoop_inputv = NULL;
+    cnx->protoop_inputc = 0;
+    cnx->current_plugin = NULL;
 
-    uint64_t sl_native = (tv_sl_end.tv_sec - tv_sl_start.tv_sec) * 1000000 + (tv_sl_end.tv_usec - tv_sl_start.tv_usec);
-    fprintf(stderr, "Native sl: %" PRIu64 " us, sum is %" PRIu64 "\n", sl_native, sum);
+    return ret;
+}
 
-    struct timeval tv_gs_start;
-    struct timeval tv_gs_end;
+/* Calls from the core of an empty protocol operation, the pluglets run as the build runs them */
+static void microbench_run_dispatch(picoquic_cnx_t *cnx, const char *name, const char *variant, protoop_id_t *pid)
+{
+    struct timeval tv_start;
 
-    sum = 0;
-    gettimeofday(&tv_gs_start, NULL);
+    gettimeofday(&tv_start, NULL);
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        protoop_prepare_and_run_noparam(cnx, pid, NULL, NULL);
+    }
+    microbench_report(name, variant, microbench_elapsed(&tv_start), MICROBENCH_NB_LOOPS);
+}
 
-    //for (uint64_t i = 0; i < 1000000; i++) {
-        sum += get_set_cnx_fields_loop(&cnx);
-        //protoop_prepare_and_run_noparam(&cnx, "simple_for_loop", NULL,
-        //    cnx);
-    //}
+/* Insertion of a plugin in a new connection */
+static int microbench_run_insertion(const char *plugin_fname, const char *variant)
+{
+    int ret = 0;
+    uint64_t elapsed = 0;
+    const char *name = strrchr(plugin_fname, '/');
+
+    for (int i = 0; ret == 0 && i < MICROBENCH_NB_INSERTIONS; i++) {
+        picoquic_cnx_t cnx = { 0 };
+        struct timeval tv_start;
+
+        register_protocol_operations(&cnx);
+        if ((cnx.reserved_frames = queue_init()) == NULL || (cnx.retry_frames = queue_init()) == NULL) {
+            ret = -1;
+        } else {
+            gettimeofday(&tv_start, NULL);
+            ret = plugin_insert_plugin(&cnx, plugin_fname);
+            elapsed += microbench_elapsed(&tv_start);
+            if (ret != 0) {
+                fprintf(stderr, "Failed to insert %s\n", plugin_fname);
+            }
+        }
+
+        picoquic_free_protoops_and_plugins(&cnx);
+        if (cnx.reserved_frames != NULL) {
+            queue_free(cnx.reserved_frames);
+        }
+        if (cnx.retry_frames != NULL) {
+            queue_free(cnx.retry_frames);
+        }
+    }
 
-    gettimeofday(&tv_gs_end, NULL);
+    if (ret == 0) {
+        char bench_name[64];
 
-    uint64_t gs_native = (tv_gs_end.tv_sec - tv_gs_start.tv_sec) * 1000000 + (tv_gs_end.tv_usec - tv_gs_start.tv_usec);
-    fprintf(stderr, "Native gs: %" PRIu64 " us, sum is %" PRIu64 "\n", gs_native, sum);
+        snprintf(bench_name, sizeof(bench_name), "insert_%s", (name != NULL) ? name + 1 : plugin_fname);
+        microbench_report(bench_name, variant, elapsed, MICROBENCH_NB_INSERTIONS);
+    }
 
-    struct timeval tv_gs_api_start;
-    struct timeval tv_gs_api_end;
+    return ret;
+}
 
-    sum = 0;
-    gettimeofday(&tv_gs_api_start, NULL);
+void register_microbench_protoops(picoquic_cnx_t *cnx)
+{
+    register_noparam_protoop(cnx, &MICROBENCH_EMPTY, &microbench_empty);
+    register_noparam_protoop(cnx, &MICROBENCH_EMPTY_OBSERVED, &microbench_empty);
+    register_noparam_protoop(cnx, &MICROBENCH_EMPTY_REPLACE, &microbench_empty);
+    for (size_t i = 0; i < nb_microbench_loops; i++) {
+        if (i == 0 || microbench_loops[i].pid != microbench_loops[i - 1].pid) {
+            register_noparam_protoop(cnx, microbench_loops[i].pid, microbench_loops[i].native);
+        }
+    }
+}
 
-    //for (uint64_t i = 0; i < 1000000; i++) {
-        sum += get_set_api_cnx_fields_loop(&cnx);
-        //protoop_prepare_and_run_noparam(&cnx, "simple_for_loop", NULL,
-        //    cnx);
-    //}
+/*
+ * Prints the nanoseconds per operation of the plugin runtime, natively for the baseline,
+ * and with the pluglets compiled, or threaded, and interpreted. The dispatch from the core and the
+ * insertions only exist in the mode of the build.
+ */
+int microbench_plugin_run_test() {
+    int ret = 0;
+    picoquic_cnx_t cnx = { 0 };
+    const char *build_variant = pluglet_uses_jit() ? "jit" : "threaded";
 
-    gettimeofday(&tv_gs_api_end, NULL);
+    register_protocol_operations(&cnx);
+    register_microbench_protoops(&cnx);
+    if ((cnx.reserved_frames = queue_init()) == NULL || (cnx.retry_frames = queue_init()) == NULL) {
+        ret = -1;
+    }
 
-    uint64_t gs_api_native = (tv_gs_api_end.tv_sec - tv_gs_api_start.tv_sec) * 1000000 + (tv_gs_api_end.tv_usec - tv_gs_api_start.tv_usec);
-    fprintf(stderr, "Native API gs: %" PRIu64 " us, sum is %" PRIu64 "\n", gs_api_native, sum);
+    /* The core only, before the plugin adds its pluglets */
+    if (ret == 0) {
+        microbench_run_dispatch(&cnx, "dispatch_empty", "baseline", &MICROBENCH_EMPTY);
+        microbench_run_dispatch(&cnx, "dispatch_pre_post", "baseline", &MICROBENCH_EMPTY_OBSERVED);
+        microbench_run_dispatch(&cnx, "dispatch_replace", "baseline", &MICROBENCH_EMPTY_REPLACE);
+    }
 
-    ret = plugin_insert_plugin(&cnx, "plugins/microbench/microbench.plugin");
-    if (ret) {
+    if (ret == 0 && (ret = plugin_insert_plugin(&cnx, MICROBENCH_PLUGIN)) != 0) {
         fprintf(stderr, "Failed to insert microbench plugin!\n");
-        return ret;
     }
 
-    /* Ok, this is ugly but if here we want to test only eBPF execution, we don't have the choice... */
-    protocol_operation_struct_t *post;
-    HASH_FIND_PID(cnx.ops, &SIMPLE_FOR_LOOP.hash, post);
-    if (!post) {
-        printf("FATAL ERROR: no protocol operation with id %s\n", "simple_for_loop");
-        return 1;
+    if (ret == 0) {
+        microbench_run_dispatch(&cnx, "dispatch_pre_post", build_variant, &MICROBENCH_EMPTY_OBSERVED);
+        microbench_run_dispatch(&cnx, "dispatch_replace", build_variant, &MICROBENCH_EMPTY_REPLACE);
+    }
+
+    for (size_t i = 0; ret == 0 && i < nb_microbench_loops; i++) {
+        ret = microbench_run_loop(&cnx, &microbench_loops[i]);
+    }
+
+    for (size_t i = 0; ret == 0 && i < nb_microbench_plugins; i++) {
+        ret = microbench_run_insertion(microbench_plugins[i], build_variant);
+    }
+
+    picoquic_free_protoops_and_plugins(&cnx);
+    if (cnx.reserved_frames != NULL) {
+        queue_free(cnx.reserved_frames);
+    }
+    if (cnx.retry_frames != NULL) {
+        queue_free(cnx.retry_frames);
     }
-    protocol_operation_param_struct_t *popst = post->params;
-    cnx.current_plugin = popst->replace->p;
-    char *error_msg = NULL;
 
-    struct timeval tv_sl_jit_start;
-    struct timeval tv_sl_jit_end;
-
-    sum = 0;
-    gettimeofday(&tv_sl_jit_start, NULL);
-
-    //for (uint64_t i = 0; i < 1000000; i++) {
-        sum += _exec_loaded_code(popst->replace, (void *)&cnx, (void *)cnx.current_plugin->memory, sizeof(cnx.current_plugin->memory), &error_msg, true);
-        //protoop_prepare_and_run_noparam(&cnx, "simple_for_loop", NULL,
-        //    cnx);
-    //}
-
-    gettimeofday(&tv_sl_jit_end, NULL);
-    uint64_t sl_jit = (tv_sl_jit_end.tv_sec - tv_sl_jit_start.tv_sec) * 1000000 + (tv_sl_jit_end.tv_usec - tv_sl_jit_start.tv_usec);
-    fprintf(stderr, "JIT sl: %" PRIu64 " us, sum is %" PRIu64 "\n", sl_jit, sum);
-
-    /* Second execution */
-    HASH_FIND_PID(cnx.ops, &GET_SET_CNX_FIELDS_LOOP.hash, post);
-    if (!post) {
-        printf("FATAL ERROR: no protocol operation with id %s\n", "get_set_cnx_fields_loop");
-        return 1;
-    }
-    popst = post->params;
-    cnx.current_plugin = popst->replace->p;
-
-    struct timeval tv_gs_jit_start;
-    struct timeval tv_gs_jit_end;
-
-    // Reset start_time and latest_progress_time
-    cnx.start_time = 0;
-    cnx.latest_progress_time = 0;
-
-    sum = 0;
-    gettimeofday(&tv_gs_jit_start, NULL);
-
-    //for (uint64_t i = 0; i < 1000000; i++) {
-        sum += _exec_loaded_code(popst->replace, (void *)&cnx, (void *)cnx.current_plugin->memory, sizeof(cnx.current_plugin->memory), &error_msg, true);
-        //protoop_prepare_and_run_noparam(&cnx, "simple_for_loop", NULL,
-        //    cnx);
-    //}
-
-    gettimeofday(&tv_gs_jit_end, NULL);
-    uint64_t gs_jit = (tv_gs_jit_end.tv_sec - tv_gs_jit_start.tv_sec) * 1000000 + (tv_gs_jit_end.tv_usec - tv_gs_jit_start.tv_usec);
-    fprintf(stderr, "JIT gs: %" PRIu64 " us, sum is %" PRIu64 "\n", gs_jit, sum);
-    
-    /* Interpreted */
-    HASH_FIND_PID(cnx.ops, &SIMPLE_FOR_LOOP.hash, post);
-    if (!post) {
-        printf("FATAL ERROR: no protocol operation with id %s\n", "simple_for_loop");
-        return 1;
-    }
-    popst = post->params;
-    cnx.current_plugin = popst->replace->p;
-
-    struct timeval tv_sl_int_start;
-    struct timeval tv_sl_int_end;
-
-    sum = 0;
-    gettimeofday(&tv_sl_int_start, NULL);
-
-    //for (uint64_t i = 0; i < 1000000; i++) {
-        sum += _exec_loaded_code(popst->replace, (void *)&cnx, (void *)cnx.current_plugin->memory, sizeof(cnx.current_plugin->memory), &error_msg, false);
-        //protoop_prepare_and_run_noparam(&cnx, "simple_for_loop", NULL,
-        //    cnx);
-    //}
-
-    gettimeofday(&tv_sl_int_end, NULL);
-    uint64_t sl_int = (tv_sl_int_end.tv_sec - tv_sl_int_start.tv_sec) * 1000000 + (tv_sl_int_end.tv_usec - tv_sl_int_start.tv_usec);
-    fprintf(stderr, "Interpreted sl: %" PRIu64 " us, sum is %" PRIu64 "\n", sl_int, sum);
-
-    /* Second execution */
-    HASH_FIND_PID(cnx.ops, &GET_SET_CNX_FIELDS_LOOP.hash, post);
-    if (!post) {
-        printf("FATAL ERROR: no protocol operation with id %s\n", "get_set_cnx_fields_loop");
-        return 1;
-    }
-    popst = post->params;
-    cnx.current_plugin = popst->replace->p;
-
-    struct timeval tv_gs_int_start;
-    struct timeval tv_gs_int_end;
-
-    // Reset start_time and latest_progress_time
-    cnx.start_time = 0;
-    cnx.latest_progress_time = 0;
-
-    sum = 0;
-    gettimeofday(&tv_gs_int_start, NULL);
-
-    //for (uint64_t i = 0; i < 1000000; i++) {
-        sum += _exec_loaded_code(popst->replace, (void *)&cnx, (void *)cnx.current_plugin->memory, sizeof(cnx.current_plugin->memory), &error_msg, false);
-        //protoop_prepare_and_run_noparam(&cnx, "simple_for_loop", NULL,
-        //    cnx);
-    //}
-
-    gettimeofday(&tv_gs_int_end, NULL);
-    uint64_t gs_int = (tv_gs_int_end.tv_sec - tv_gs_int_start.tv_sec) * 1000000 + (tv_gs_int_end.tv_usec - tv_gs_int_start.tv_usec);
-    fprintf(stderr, "Interpreted gs: %" PRIu64 " us, sum is %" PRIu64 "\n", gs_int, sum);
-
-    /* TODO register functions as default ops */
     return ret;
-}
\ No newline at end of file
+}
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "object_cache.h"
+
+#define OBJECT_CACHE_TEST_NB 100
+
+static int object_cache_test_is_zero(const uint8_t* bytes, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        if (bytes[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int object_cache_test()
+{
+    int ret = 0;
+    picoquic_object_cache_t cache;
+    picoquic_path_t* paths[OBJECT_CACHE_TEST_NB];
+    uint64_t nb_slabs;
+
+    picoquic_object_cache_init(&cache, sizeof(picoquic_path_t));
+    picoquic_object_cache_set_numa_node(&cache, 0);
+
+    /* New objects span several slabs, aligned and zeroed */
+    for (int i = 0; ret == 0 && i < OBJECT_CACHE_TEST_NB; i++) {
+        if ((paths[i] = (picoquic_path_t*)picoquic_object_cache_get(&cache)) == NULL ||
+            ((uintptr_t)paths[i] % PICOQUIC_OBJECT_CACHE_ALIGN) != 0 ||
+            !object_cache_test_is_zero((uint8_t*)paths[i], sizeof(picoquic_path_t))) {
+            ret = -1;
+        } else {
+            memset(paths[i], 0xa5, sizeof(picoquic_path_t));
+        }
+    }
+    nb_slabs = cache.nb_slabs;
+    if (ret == 0 && (nb_slabs < 2 || cache.nb_recycled != 0)) {
+        ret = -1;
+    }
+
+    /* The deleted objects come back cleared, without new slabs */
+    for (int i = 0; ret == 0 && i < OBJECT_CACHE_TEST_NB; i++) {
+        picoquic_object_cache_put(&cache, paths[i]);
+    }
+    for (int i = 0; ret == 0 && i < OBJECT_CACHE_TEST_NB; i++) {
+        if ((paths[i] = (picoquic_path_t*)picoquic_object_cache_get(&cache)) == NULL ||
+            !object_cache_test_is_zero((uint8_t*)paths[i], sizeof(picoquic_path_t))) {
+            ret = -1;
+        }
+    }
+    if (ret == 0 && (cache.nb_slabs != nb_slabs || cache.nb_recycled != OBJECT_CACHE_TEST_NB || cache.nb_free != 0)) {
+        ret = -1;
+    }
+
+    picoquic_object_cache_free(&cache);
+    if (ret == 0 && cache.slabs != NULL) {
+        ret = -1;
+    }
+
+    return ret;
+}
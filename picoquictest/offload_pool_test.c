@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "offload_pool.h"
+
+#define OFFLOAD_POOL_TEST_NB_THREADS 4
+#define OFFLOAD_POOL_TEST_NB_JOBS 64
+#define OFFLOAD_POOL_TEST_MAX_WAIT 5000 /* Milliseconds */
+
+typedef struct st_offload_pool_test_job_t {
+    picoquic_offload_job_t offload;
+    int* gate; /* The job waits until it is set, when not NULL */
+    int is_started;
+    uint64_t value;
+    uint64_t result;
+    int* nb_released;
+} offload_pool_test_job_t;
+
+static void offload_pool_test_run(picoquic_offload_job_t* offload)
+{
+    offload_pool_test_job_t* job = (offload_pool_test_job_t*)offload;
+
+    __atomic_store_n(&job->is_started, 1, __ATOMIC_RELEASE);
+    while (job->gate != NULL && !__atomic_load_n(job->gate, __ATOMIC_ACQUIRE)) {
+        usleep(100);
+    }
+    job->result = job->value * job->value;
+}
+
+static void offload_pool_test_release(picoquic_offload_job_t* offload)
+{
+    offload_pool_test_job_t* job = (offload_pool_test_job_t*)offload;
+
+    __atomic_fetch_add(job->nb_released, 1, __ATOMIC_RELAXED);
+}
+
+static void offload_pool_test_init(offload_pool_test_job_t* job, uint64_t value, int* gate, int* nb_released)
+{
+    memset(job, 0, sizeof(offload_pool_test_job_t));
+    job->offload.run = offload_pool_test_run;
+    job->offload.release = offload_pool_test_release;
+    job->value = value;
+    job->gate = gate;
+    job->nb_released = nb_released;
+}
+
+static int offload_pool_test_wait(int* flag)
+{
+    for (int i = 0; i < OFFLOAD_POOL_TEST_MAX_WAIT * 10; i++) {
+        if (__atomic_load_n(flag, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+        usleep(100);
+    }
+    return -1;
+}
+
+/* All the jobs submitted run once, the loop polling them */
+static int offload_pool_test_run_all()
+{
+    int ret = 0;
+    int nb_released = 0;
+    offload_pool_test_job_t jobs[OFFLOAD_POOL_TEST_NB_JOBS];
+    picoquic_offload_pool_t* pool = picoquic_offload_pool_create(OFFLOAD_POOL_TEST_NB_THREADS);
+
+    if (pool == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < OFFLOAD_POOL_TEST_NB_JOBS; i++) {
+        offload_pool_test_init(&jobs[i], (uint64_t)i + 1, NULL, &nb_released);
+        picoquic_offload_submit(pool, &jobs[i].offload);
+    }
+
+    for (int i = 0; ret == 0 && i < OFFLOAD_POOL_TEST_NB_JOBS; i++) {
+        int nb_polls = 0;
+
+        while (!picoquic_offload_job_is_done(&jobs[i].offload) && nb_polls++ < OFFLOAD_POOL_TEST_MAX_WAIT * 10) {
+            usleep(100);
+        }
+        if (!picoquic_offload_job_is_done(&jobs[i].offload) || jobs[i].result != jobs[i].value * jobs[i].value) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && (pool->nb_jobs_done != OFFLOAD_POOL_TEST_NB_JOBS || nb_released != 0)) {
+        ret = -1;
+    }
+
+    picoquic_offload_pool_delete(pool);
+
+    return ret;
+}
+
+/* A job abandoned while queued is released at once, one abandoned while running when it returns */
+static int offload_pool_test_abandon()
+{
+    int ret = 0;
+    int gate = 0;
+    int nb_released = 0;
+    offload_pool_test_job_t running;
+    offload_pool_test_job_t queued[3];
+    picoquic_offload_pool_t* pool = picoquic_offload_pool_create(1);
+
+    if (pool == NULL) {
+        return -1;
+    }
+
+    offload_pool_test_init(&running, 2, &gate, &nb_released);
+    picoquic_offload_submit(pool, &running.offload);
+    for (int i = 0; i < 3; i++) {
+        offload_pool_test_init(&queued[i], (uint64_t)i + 3, NULL, &nb_released);
+        picoquic_offload_submit(pool, &queued[i].offload);
+    }
+
+    ret = offload_pool_test_wait(&running.is_started);
+
+    if (ret == 0) {
+        picoquic_offload_job_abandon(pool, &queued[1].offload);
+        picoquic_offload_job_abandon(pool, &running.offload);
+        if (nb_released != 1 || queued[1].is_started) {
+            ret = -1;
+        }
+    }
+
+    __atomic_store_n(&gate, 1, __ATOMIC_RELEASE);
+    picoquic_offload_pool_wait_idle(pool);
+
+    if (ret == 0 && (nb_released != 2 || !picoquic_offload_job_is_done(&queued[0].offload) ||
+        !picoquic_offload_job_is_done(&queued[2].offload) || queued[1].is_started)) {
+        ret = -1;
+    }
+
+    /* Abandoning a job done releases it */
+    if (ret == 0) {
+        picoquic_offload_job_abandon(pool, &queued[2].offload);
+        if (nb_released != 3) {
+            ret = -1;
+        }
+    }
+
+    picoquic_offload_pool_delete(pool);
+
+    return ret;
+}
+
+/* Deleting the pool releases the jobs that did not run, the worker may or may not have taken them before it stopped */
+static int offload_pool_test_delete()
+{
+    int ret = 0;
+    int gate = 0;
+    int nb_released = 0;
+    offload_pool_test_job_t running;
+    offload_pool_test_job_t queued[2];
+    picoquic_offload_pool_t* pool = picoquic_offload_pool_create(1);
+
+    if (pool == NULL) {
+        return -1;
+    }
+
+    offload_pool_test_init(&running, 2, &gate, &nb_released);
+    picoquic_offload_submit(pool, &running.offload);
+    for (int i = 0; i < 2; i++) {
+        offload_pool_test_init(&queued[i], (uint64_t)i + 3, NULL, &nb_released);
+        picoquic_offload_submit(pool, &queued[i].offload);
+    }
+
+    ret = offload_pool_test_wait(&running.is_started);
+    __atomic_store_n(&gate, 1, __ATOMIC_RELEASE);
+    picoquic_offload_pool_delete(pool);
+
+    if (ret == 0 && !picoquic_offload_job_is_done(&running.offload)) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        if (picoquic_offload_job_is_done(&queued[i].offload)) {
+            nb_released++;
+        } else if (queued[i].is_started) {
+            ret = -1;
+        }
+    }
+    if (ret == 0 && nb_released != 2) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int offload_pool_test()
+{
+    int ret = 0;
+
+    if (picoquic_offload_pool_create(0) != NULL) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        ret = offload_pool_test_run_all();
+    }
+    if (ret == 0) {
+        ret = offload_pool_test_abandon();
+    }
+    if (ret == 0) {
+        ret = offload_pool_test_delete();
+    }
+
+    return ret;
+}
@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+#define PACING_TEST_PACKET_TIME 100000 /* ns */
+#define PACING_TEST_HORIZON 1000 /* us */
+
+int pacing_offload_test()
+{
+    int ret = 0;
+    uint64_t current_time = 1000000;
+    uint64_t next_time = UINT64_MAX;
+    int nb_sent = 0;
+    picoquic_path_t* path_x = calloc(1, sizeof(picoquic_path_t));
+
+    if (path_x == NULL) {
+        return -1;
+    }
+
+    path_x->send_mtu = 1000;
+    path_x->pacing_offload_horizon = PACING_TEST_HORIZON;
+    path_x->pacing_departure_nanosec = 0; /* Idle for a long time */
+    /* 10^10 bytes per second, one packet every 100 us, and a quantum of 4 packets */
+    picoquic_update_pacing_rate(path_x, 10000000.0, 4000);
+
+    /* The packets that the quantum allows ahead of now leave now, the next ones are spaced up to the horizon */
+    while (picoquic_is_sending_authorized_by_pacing(path_x, current_time, &next_time) && nb_sent < 100) {
+        picoquic_update_pacing_after_send(path_x, current_time);
+        nb_sent++;
+        if (nb_sent <= 5 && picoquic_get_departure_time(path_x) != current_time) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && (nb_sent != 5 + PACING_TEST_HORIZON * 1000 / PACING_TEST_PACKET_TIME ||
+        picoquic_get_departure_time(path_x) != current_time + PACING_TEST_HORIZON)) {
+        ret = -1;
+    }
+
+    /* The sender sleeps until the next packet is within the horizon */
+    if (ret == 0 && next_time != current_time + PACING_TEST_PACKET_TIME / 1000) {
+        ret = -1;
+    }
+    if (ret == 0 && (picoquic_is_sending_authorized_by_pacing(path_x, next_time - 1, &next_time) ||
+        !picoquic_is_sending_authorized_by_pacing(path_x, next_time, &next_time))) {
+        ret = -1;
+    }
+    current_time = next_time;
+
+    free(path_x);
+
+    return ret;
+}
+
+#define PACING_TRAIN_TEST_BURST 8
+#define PACING_TRAIN_TEST_DURATION 1000000 /* us */
+
+/* At 10 Gbps, a 1500 bytes packet takes 1.2 us: trains of 8 packets leave every 9.6 us on average */
+int pacing_train_test()
+{
+    int ret = 0;
+    uint64_t start_time = 1000000;
+    uint64_t current_time = start_time;
+    uint64_t next_time = UINT64_MAX;
+    uint64_t nb_sent = 0;
+    uint64_t nb_expected;
+    picoquic_path_t* path_x = calloc(1, sizeof(picoquic_path_t));
+
+    if (path_x == NULL) {
+        return -1;
+    }
+
+    path_x->send_mtu = 1500;
+    path_x->pacing_burst = PACING_TRAIN_TEST_BURST;
+    picoquic_update_pacing_rate(path_x, 1250000000.0, 1500);
+    path_x->pacing_evaluation_time = current_time;
+    path_x->pacing_bucket_nanosec = PACING_TRAIN_TEST_BURST * 1200;
+
+    if (path_x->pacing_packet_time_nanosec != 1200 ||
+        path_x->pacing_bucket_max < PACING_TRAIN_TEST_BURST * path_x->pacing_packet_time_nanosec) {
+        ret = -1;
+    }
+
+    /* One decision for the whole train */
+    for (int i = 0; ret == 0 && i < PACING_TRAIN_TEST_BURST; i++) {
+        if (!picoquic_is_sending_authorized_by_pacing(path_x, current_time, &next_time)) {
+            ret = -1;
+        } else {
+            picoquic_update_pacing_after_send(path_x, current_time);
+        }
+    }
+
+    /* The next train waits for the bucket to refill, to the microsecond */
+    if (ret == 0 && (picoquic_is_sending_authorized_by_pacing(path_x, current_time, &next_time) ||
+        next_time != current_time + (PACING_TRAIN_TEST_BURST * 1200 + 999) / 1000 ||
+        picoquic_is_sending_authorized_by_pacing(path_x, next_time - 1, &next_time) ||
+        !picoquic_is_sending_authorized_by_pacing(path_x, next_time, &next_time))) {
+        ret = -1;
+    }
+    current_time = next_time;
+
+    /* Over time, the rate is the one requested */
+    while (ret == 0 && current_time < start_time + PACING_TRAIN_TEST_DURATION) {
+        next_time = UINT64_MAX;
+        if (picoquic_is_sending_authorized_by_pacing(path_x, current_time, &next_time)) {
+            picoquic_update_pacing_after_send(path_x, current_time);
+            nb_sent++;
+        } else if (next_time <= current_time) {
+            ret = -1;
+        } else {
+            current_time = next_time;
+        }
+    }
+
+    nb_expected = PACING_TRAIN_TEST_DURATION * 1000ull / 1200;
+    if (ret == 0 && (nb_sent * 100 < nb_expected * 99 || nb_sent * 100 > nb_expected * 101)) {
+        DBG_PRINTF("Sent %" PRIu64 " packets instead of %" PRIu64 "\n", nb_sent, nb_expected);
+        ret = -1;
+    }
+
+    free(path_x);
+
+    return ret;
+}
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "packet_pool.h"
+
+#define PACKET_POOL_TEST_MAX 2
+
+static int packet_pool_heap_test()
+{
+    int ret = 0;
+    picoquic_packet_pool_t pool;
+    picoquic_packet_t* packets[PACKET_POOL_TEST_MAX + 1];
+
+    picoquic_packet_pool_init(&pool);
+    if (picoquic_packet_pool_configure(&pool, PACKET_POOL_TEST_MAX, 0) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < PACKET_POOL_TEST_MAX + 1; i++) {
+        packets[i] = picoquic_packet_pool_get(&pool, PICOQUIC_MAX_PACKET_SIZE);
+        if (packets[i] == NULL) {
+            return -1;
+        }
+        packets[i]->sequence_number = i + 1;
+    }
+    /* Only the bound is kept once given back */
+    for (int i = 0; i < PACKET_POOL_TEST_MAX + 1; i++) {
+        picoquic_packet_pool_put(&pool, packets[i]);
+    }
+    if (pool.nb_free_packets != PACKET_POOL_TEST_MAX || pool.stats.packet_misses != PACKET_POOL_TEST_MAX + 1 ||
+        pool.stats.packet_overflows != 1) {
+        ret = -1;
+    }
+
+    /* A recycled packet is as clean as a new one */
+    picoquic_packet_t* packet = picoquic_packet_pool_get(&pool, PICOQUIC_MAX_PACKET_SIZE);
+    if (ret == 0 && (packet == NULL || pool.stats.packet_hits != 1 || packet->sequence_number != 0 || packet->next_packet != NULL ||
+        packet->bytes == NULL || packet->bytes_max != PICOQUIC_MAX_PACKET_SIZE)) {
+        ret = -1;
+    }
+    if (packet != NULL) {
+        picoquic_packet_pool_put(&pool, packet);
+    }
+
+    /* Larger packets come from the jumbo class, which has its own freelist */
+    packet = picoquic_packet_pool_get(&pool, PICOQUIC_MAX_PACKET_SIZE + 1);
+    if (ret == 0 && (packet == NULL || packet->bytes_max != PICOQUIC_MAX_JUMBO_PACKET_SIZE)) {
+        ret = -1;
+    }
+    if (packet != NULL) {
+        memset(packet->bytes, 0, packet->bytes_max);
+        picoquic_packet_pool_put(&pool, packet);
+        if (ret == 0 && (pool.nb_free_jumbo_packets != 1 || pool.nb_free_packets != PACKET_POOL_TEST_MAX ||
+            picoquic_packet_pool_get(&pool, PICOQUIC_MAX_JUMBO_PACKET_SIZE) != packet)) {
+            ret = -1;
+        }
+        picoquic_packet_pool_put(&pool, packet);
+    }
+    if (ret == 0 && picoquic_packet_pool_get(&pool, PICOQUIC_MAX_JUMBO_PACKET_SIZE + 1) != NULL) {
+        ret = -1;
+    }
+
+    /* A packet without its payload is released when given back */
+    packet = picoquic_packet_pool_get(&pool, PICOQUIC_MAX_PACKET_SIZE);
+    if (packet != NULL) {
+        uint32_t nb_free_packets = pool.nb_free_packets;
+
+        picoquic_packet_pool_drop_payload(&pool, packet);
+        if (ret == 0 && (packet->bytes != NULL || packet->bytes_max != 0)) {
+            ret = -1;
+        }
+        picoquic_packet_pool_put(&pool, packet);
+        if (ret == 0 && pool.nb_free_packets != nb_free_packets) {
+            ret = -1;
+        }
+    } else {
+        ret = -1;
+    }
+
+    picoquic_packet_plugin_frame_t* frame = picoquic_packet_pool_get_frame(&pool);
+    if (frame != NULL) {
+        picoquic_packet_pool_put_frame(&pool, frame);
+        if (picoquic_packet_pool_get_frame(&pool) != frame || pool.stats.frame_misses != 1 || pool.stats.frame_hits != 1) {
+            ret = -1;
+        }
+        picoquic_packet_pool_put_frame(&pool, frame);
+    } else {
+        ret = -1;
+    }
+
+    /* Huge pages can only back an unused pool */
+    if (ret == 0 && picoquic_packet_pool_configure(&pool, PACKET_POOL_TEST_MAX, 1) == 0) {
+        ret = -1;
+    }
+
+    picoquic_packet_pool_free(&pool);
+    return ret;
+}
+
+static int packet_pool_slab_test()
+{
+    int ret = 0;
+    picoquic_packet_pool_t pool;
+
+    picoquic_packet_pool_init(&pool);
+    if (picoquic_packet_pool_configure(&pool, PACKET_POOL_TEST_MAX, 1) != 0) {
+        return -1;
+    }
+
+    /* The whole slab is available, and its packets always come back to the freelist */
+    uint32_t nb_slab_packets = pool.nb_free_packets;
+    if (nb_slab_packets < PACKET_POOL_TEST_MAX || nb_slab_packets != pool.nb_slab_packets) {
+        ret = -1;
+    }
+    /* The packets are contiguous, their payloads come after all of them */
+    uint8_t* payloads = pool.slab + (size_t)nb_slab_packets * sizeof(picoquic_packet_t);
+    picoquic_packet_t* packet = picoquic_packet_pool_get(&pool, PICOQUIC_MAX_PACKET_SIZE);
+    if (packet == NULL || (uint8_t*)packet < pool.slab || (uint8_t*)packet >= payloads ||
+        packet->bytes < payloads || packet->bytes + PICOQUIC_MAX_PACKET_SIZE > pool.slab + pool.slab_size) {
+        ret = -1;
+    }
+    if (packet != NULL) {
+        /* The payloads of the slab stay with their packets */
+        picoquic_packet_pool_drop_payload(&pool, packet);
+        if (packet->bytes < payloads || packet->bytes_max != PICOQUIC_MAX_PACKET_SIZE) {
+            ret = -1;
+        }
+        picoquic_packet_pool_put(&pool, packet);
+    }
+    if (ret == 0 && (pool.nb_free_packets != nb_slab_packets || pool.stats.packet_overflows != 0)) {
+        ret = -1;
+    }
+
+    picoquic_packet_pool_free(&pool);
+    return ret;
+}
+
+int packet_pool_test()
+{
+    int ret = packet_pool_heap_test();
+
+    if (ret == 0) {
+        ret = packet_pool_slab_test();
+    }
+
+    return ret;
+}
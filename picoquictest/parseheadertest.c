@@ -23,6 +23,7 @@
 #include <string.h>
 #include "../picoquic/tls_api.h"
 #include "../picoquic/picoquic_internal.h"
+#include "../picohttp/h3zero.h"
 #include "picoquictest_internal.h"
 
 /* test vectors and corresponding structure */
@@ -431,7 +432,7 @@ int test_packet_decrypt_one(
     /* Decrypt the packet */
     decoding_return = picoquic_parse_header_and_decrypt(q_server,
         send_buffer, (uint32_t)send_length, (uint32_t)packet_length,
-        addr_from,
+        addr_from, addr_from, 0,
         current_time, &received_ph, &server_cnx,
         &consumed, &new_context_created);
 
@@ -492,7 +493,7 @@ int test_packet_encrypt_one(
     picoquic_path_t * path_x = cnx_client->path[0];
     uint64_t current_time = 0;
     picoquic_packet_header expected_header;
-    picoquic_packet_t * packet = (picoquic_packet_t *) malloc(sizeof(picoquic_packet_t));
+    picoquic_packet_t * packet = picoquic_create_packet(NULL);
     picoquic_packet_context_enum pc = 0;
 
     if (packet == NULL) {
@@ -500,7 +501,6 @@ int test_packet_encrypt_one(
         ret = -1;
     }
     else {
-        memset(packet, 0, sizeof(picoquic_packet_t));
         memset(packet->bytes, 0xbb, length);
         header_length = picoquic_predict_packet_header_length(cnx_client, ptype, cnx_client->path[0]);
         packet->ptype = ptype;
@@ -676,4 +676,216 @@ int packet_enc_dec_test()
     }
 
     return ret;
-}
\ No newline at end of file
+}
+
+/* Huffman coding of the QPACK strings, with the examples of RFC 7541 */
+typedef struct st_h3zero_huffman_test_t {
+    char const* text;
+    uint8_t encoded[32];
+    size_t encoded_length;
+} h3zero_huffman_test_t;
+
+static const h3zero_huffman_test_t h3zero_huffman_cases[] = {
+    { "www.example.com", { 0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff }, 12 },
+    { "no-cache", { 0xa8, 0xeb, 0x10, 0x64, 0x9c, 0xbf }, 6 },
+    { "custom-key", { 0x25, 0xa8, 0x49, 0xe9, 0x5b, 0xa9, 0x7d, 0x7f }, 8 },
+    { "custom-value", { 0x25, 0xa8, 0x49, 0xe9, 0x5b, 0xb8, 0xe8, 0xb4, 0xbf }, 9 },
+    { "302", { 0x64, 0x02 }, 2 },
+    { "private", { 0xae, 0xc3, 0x77, 0x1a, 0x4b }, 5 },
+    { "Mon, 21 Oct 2013 20:13:21 GMT", { 0xd0, 0x7a, 0xbe, 0x94, 0x10, 0x54, 0xd4, 0x44, 0xa8, 0x20, 0x05, 0x95,
+        0x04, 0x0b, 0x81, 0x66, 0xe0, 0x82, 0xa6, 0x2d, 0x1b, 0xff }, 22 },
+    { "https://www.example.com", { 0x9d, 0x29, 0xad, 0x17, 0x18, 0x63, 0xc7, 0x8f, 0x0b, 0x97, 0xc8, 0xe9, 0xae,
+        0x82, 0xae, 0x43, 0xd3 }, 17 },
+    { "", { 0 }, 0 }
+};
+
+static const size_t nb_h3zero_huffman_cases = sizeof(h3zero_huffman_cases) / sizeof(h3zero_huffman_test_t);
+
+/* The padding must be a prefix of EOS shorter than a byte, and EOS cannot be coded */
+static const uint8_t h3zero_huffman_bad_padding[] = { 0x1f, 0xff }; /* "a" followed by 11 ones */
+static const uint8_t h3zero_huffman_zero_padding[] = { 0x18 }; /* "a" followed by 000 */
+static const uint8_t h3zero_huffman_eos[] = { 0xff, 0xff, 0xff, 0xfc };
+
+#define H3ZERO_HUFFMAN_BENCH_ROUNDS 100000
+
+int h3zero_huffman_test()
+{
+    int ret = 0;
+    uint8_t encoded[1024];
+    uint8_t decoded[1024];
+    uint8_t all_octets[256];
+    uint8_t* encoded_end;
+    size_t nb_decoded;
+
+    for (size_t i = 0; ret == 0 && i < nb_h3zero_huffman_cases; i++) {
+        h3zero_huffman_test_t const* test = &h3zero_huffman_cases[i];
+        size_t length = strlen(test->text);
+
+        encoded_end = h3zero_qpack_huffman_encode(encoded, encoded + sizeof(encoded), (uint8_t const*)test->text, length);
+        if (encoded_end == NULL || (size_t)(encoded_end - encoded) != test->encoded_length ||
+            h3zero_qpack_huffman_length((uint8_t const*)test->text, length) != test->encoded_length ||
+            memcmp(encoded, test->encoded, test->encoded_length) != 0) {
+            DBG_PRINTF("Huffman encoding of \"%s\" does not match\n", test->text);
+            ret = -1;
+        }
+        else if (hzero_qpack_huffman_decode((uint8_t*)test->encoded, (uint8_t*)test->encoded + test->encoded_length,
+            decoded, sizeof(decoded), &nb_decoded) != 0 || nb_decoded != length || memcmp(decoded, test->text, length) != 0) {
+            DBG_PRINTF("Huffman decoding of \"%s\" does not match\n", test->text);
+            ret = -1;
+        }
+        else if (length > 1 && hzero_qpack_huffman_decode((uint8_t*)test->encoded, (uint8_t*)test->encoded + test->encoded_length,
+            decoded, length - 1, &nb_decoded) == 0) {
+            /* The decoded string does not fit */
+            ret = -1;
+        }
+    }
+
+    /* Every octet, including the codes longer than a nibble boundary */
+    for (int i = 0; i < 256; i++) {
+        all_octets[i] = (uint8_t)i;
+    }
+    if (ret == 0) {
+        encoded_end = h3zero_qpack_huffman_encode(encoded, encoded + sizeof(encoded), all_octets, sizeof(all_octets));
+        if (encoded_end == NULL || hzero_qpack_huffman_decode(encoded, encoded_end, decoded, sizeof(decoded), &nb_decoded) != 0 ||
+            nb_decoded != sizeof(all_octets) || memcmp(decoded, all_octets, sizeof(all_octets)) != 0) {
+            DBG_PRINTF("%s", "Huffman round trip of all octets failed\n");
+            ret = -1;
+        }
+        else if (h3zero_qpack_huffman_encode(encoded, encoded + (encoded_end - encoded) - 1, all_octets, sizeof(all_octets)) != NULL) {
+            /* Not enough space */
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && (
+        hzero_qpack_huffman_decode((uint8_t*)h3zero_huffman_bad_padding, (uint8_t*)h3zero_huffman_bad_padding + sizeof(h3zero_huffman_bad_padding),
+            decoded, sizeof(decoded), &nb_decoded) == 0 ||
+        hzero_qpack_huffman_decode((uint8_t*)h3zero_huffman_zero_padding, (uint8_t*)h3zero_huffman_zero_padding + sizeof(h3zero_huffman_zero_padding),
+            decoded, sizeof(decoded), &nb_decoded) == 0 ||
+        hzero_qpack_huffman_decode((uint8_t*)h3zero_huffman_eos, (uint8_t*)h3zero_huffman_eos + sizeof(h3zero_huffman_eos),
+            decoded, sizeof(decoded), &nb_decoded) == 0)) {
+        DBG_PRINTF("%s", "Invalid Huffman string accepted\n");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* Throughput, on a header value typical of a request */
+        char const* value = "/assets/images/7a3f1c2e/banner-large.jpg?version=2019-10-31";
+        size_t length = strlen(value);
+        uint64_t checksum = 0;
+        uint64_t start_time = picoquic_current_time();
+        uint64_t encode_time;
+
+        for (int r = 0; r < H3ZERO_HUFFMAN_BENCH_ROUNDS; r++) {
+            encoded_end = h3zero_qpack_huffman_encode(encoded, encoded + sizeof(encoded), (uint8_t const*)value, length);
+            checksum += encoded_end[-1];
+        }
+        encode_time = picoquic_current_time() - start_time;
+        start_time = picoquic_current_time();
+        for (int r = 0; r < H3ZERO_HUFFMAN_BENCH_ROUNDS; r++) {
+            if (hzero_qpack_huffman_decode(encoded, encoded_end, decoded, sizeof(decoded), &nb_decoded) != 0) {
+                ret = -1;
+                break;
+            }
+            checksum += decoded[r % nb_decoded];
+        }
+
+        if (ret == 0) {
+            fprintf(stdout, "Huffman: %" PRIu64 " us to encode, %" PRIu64 " us to decode %d values of %d bytes (checksum %" PRIu64 ")\n",
+                encode_time, picoquic_current_time() - start_time, H3ZERO_HUFFMAN_BENCH_ROUNDS, (int)length, checksum);
+        }
+    }
+
+    return ret;
+}
+
+/* Priority field values of RFC 9218, applied over u=3, non incremental */
+typedef struct st_h3zero_priority_test_t {
+    char const* value;
+    int ret;
+    uint8_t urgency;
+    int is_incremental;
+} h3zero_priority_test_t;
+
+static const h3zero_priority_test_t h3zero_priority_cases[] = {
+    { "", 0, 3, 0 },
+    { "u=1", 0, 1, 0 },
+    { "i", 0, 3, 1 },
+    { "u=0, i", 0, 0, 1 },
+    { "i=?0,u=5", 0, 5, 0 },
+    { "u=2, u=6", 0, 6, 0 },
+    { "u=9, i=?1", 0, 3, 1 },
+    { "u=-1", 0, 3, 0 },
+    { "u=1.5, i=1", 0, 3, 0 },
+    { "u=4;foo=bar, x=\"a,b\", y=:AQ==:, z=tok/en", 0, 4, 0 },
+    { "  u=7  ,  i  ", 0, 7, 1 },
+    { "u=1,", -1, 3, 0 },
+    { "U=1", -1, 3, 0 },
+    { "u=1 i", -1, 3, 0 },
+    { "i=?2", -1, 3, 0 },
+    { "x=\"unterminated", -1, 3, 0 }
+};
+
+static const size_t nb_h3zero_priority_cases = sizeof(h3zero_priority_cases) / sizeof(h3zero_priority_test_t);
+
+/* Control stream with the SETTINGS, then PRIORITY_UPDATE "u=1, i" for stream 4, and "u=5" for stream 8 */
+static const uint8_t h3zero_priority_control_stream[] = {
+    0x00, 0x04, 0x00,
+    0x80, 0x0F, 0x07, 0x00, 0x07, 0x04, 'u', '=', '1', ',', ' ', 'i',
+    0x80, 0x0F, 0x07, 0x00, 0x04, 0x08, 'u', '=', '5'
+};
+
+/* A PRIORITY_UPDATE cannot refer to a server stream */
+static const uint8_t h3zero_priority_bad_update[] = {
+    0x00, 0x04, 0x00,
+    0x80, 0x0F, 0x07, 0x00, 0x04, 0x05, 'u', '=', '5'
+};
+
+int h3zero_priority_test()
+{
+    int ret = 0;
+    h3zero_qpack_t qpack;
+    h3zero_priority_update_t update;
+
+    for (size_t i = 0; ret == 0 && i < nb_h3zero_priority_cases; i++) {
+        h3zero_priority_test_t const* test = &h3zero_priority_cases[i];
+        uint8_t urgency = H3ZERO_PRIORITY_URGENCY_DEFAULT;
+        int is_incremental = 0;
+
+        if (h3zero_parse_priority((uint8_t const*)test->value, strlen(test->value), &urgency, &is_incremental) != test->ret ||
+            urgency != test->urgency || is_incremental != test->is_incremental) {
+            DBG_PRINTF("Priority \"%s\" parsed as u=%d, i=%d\n", test->value, urgency, is_incremental);
+            ret = -1;
+        }
+    }
+
+    /* The updates are received a byte at a time, and taken in order */
+    if (ret == 0 && h3zero_qpack_init(&qpack, NULL) == 0) {
+        for (size_t i = 0; ret == 0 && i < sizeof(h3zero_priority_control_stream); i++) {
+            if (h3zero_qpack_receive_uni_stream(&qpack, 2, &h3zero_priority_control_stream[i], 1) != 0) {
+                ret = -1;
+            }
+        }
+        if (ret == 0 && (!h3zero_qpack_next_priority_update(&qpack, &update) ||
+            update.stream_id != 4 || update.urgency != 1 || !update.is_incremental ||
+            !h3zero_qpack_next_priority_update(&qpack, &update) ||
+            update.stream_id != 8 || update.urgency != 5 || update.is_incremental ||
+            h3zero_qpack_next_priority_update(&qpack, &update))) {
+            DBG_PRINTF("%s", "Priority updates not received\n");
+            ret = -1;
+        }
+        h3zero_qpack_release(&qpack);
+    }
+    else {
+        ret = -1;
+    }
+
+    if (ret == 0 && h3zero_qpack_init(&qpack, NULL) == 0) {
+        if (h3zero_qpack_receive_uni_stream(&qpack, 2, h3zero_priority_bad_update, sizeof(h3zero_priority_bad_update)) != H3ZERO_ID_ERROR) {
+            ret = -1;
+        }
+        h3zero_qpack_release(&qpack);
+    }
+
+    return ret;
+}
@@ -30,10 +30,39 @@ extern "C" {
 
 extern uint64_t picoquic_stress_test_duration; /* In microseconds; defaults to 2 minutes */
 
+/* Control variables for the scale test */
+
+extern size_t picoquic_scale_nb_connections; /* In the largest round; defaults to 1024 */
+extern uint64_t picoquic_scale_churn_per_second; /* Defaults to 50 */
+
+/* Results of the benchmarks of picoquic_t -b, summed over the client and the server */
+
+typedef struct st_picoquic_bench_result_t {
+    uint64_t bytes; /* Stream data delivered, both directions */
+    uint64_t nb_connections;
+    uint64_t simulated_time; /* In microseconds */
+    uint64_t wall_time; /* In microseconds */
+    uint64_t cpu_time; /* In microseconds */
+    uint64_t nb_packets; /* Sent */
+    uint64_t nb_allocations; /* Memory charges of the connections and packet pool misses */
+} picoquic_bench_result_t;
+
+int bulk_bench(picoquic_bench_result_t* result);
+int small_streams_bench(picoquic_bench_result_t* result);
+int handshake_storm_bench(picoquic_bench_result_t* result);
+int lossy_link_bench(picoquic_bench_result_t* result);
+int multipath_bench(picoquic_bench_result_t* result);
+int fec_bench(picoquic_bench_result_t* result);
+
 /* List of test functions */
 int picohash_test();
+int picohash_resize_test();
+int picohash_bench_test();
 int cnxcreation_test();
 int parseheadertest();
+int h3zero_huffman_test();
+int h3zero_priority_test();
+int demo_load_test();
 int pn2pn64test();
 int intformattest();
 int fnv1atest();
@@ -59,39 +88,88 @@ int tls_api_q2_and_r2_stream_test();
 int tls_api_server_reset_test();
 int tls_api_bad_server_reset_test();
 int sim_link_test();
+int sim_net_test();
+int sim_link_bench_test();
 int tls_api_very_long_stream_test();
 int tls_api_very_long_max_test();
 int tls_api_very_long_with_err_test();
 int tls_api_very_long_congestion_test();
 int http0dot9_test();
 int tls_api_retry_test();
+int tls_api_retry_stateless_test();
 int ackrange_test();
+int sack_list_test();
 int ack_of_ack_test();
 int tls_api_two_connections_test();
 int cleartext_aead_test();
 int tls_api_multiple_versions_test();
 int varint_test();
+int varint_decode_n_test();
 int tls_api_client_losses_test();
 int tls_api_server_losses_test();
 int skip_frame_test();
 int ping_pong_test();
 int keep_alive_test();
+int keep_alive_adaptive_test();
+int log_policy_test();
+int binary_log_test();
 int logger_test();
 int socket_test();
+int socket_gso_test();
+int socket_batch_test();
+int socket_event_loop_test();
+int socket_connected_test();
+int socket_busy_poll_test();
+int socket_uring_test();
+int socket_rx_timestamp_test();
+int xdp_frames_test();
+int xdp_loopback_test();
+int threaded_server_test();
+int clock_test();
 int ticket_store_test();
+int ticket_store_append_test();
+int resumption_store_test();
+int server_metrics_test();
+int alloc_profiler_test();
+int offload_pool_test();
+int vnet_offload_test();
+int log_flusher_test();
 int session_resume_test();
 int zero_rtt_test();
 int zero_rtt_loss_test();
 int stop_sending_test();
 int unidir_test();
 int mtu_discovery_test();
+int pmtud_test();
+int plugin_drr_test();
+int plugin_swap_test();
+int queue_test();
+int queue_bench_test();
 int spurious_retransmit_test();
+int transport_stats_test();
 #if 0
 int wrong_keyshare_test();
 #endif
 int pn_ctr_test();
 int cleartext_hp_enc_test();
+int aead_provider_bench_test();
 int hp_enc_1rtt_test();
+int hp_mask_batch_test();
+int handshake_bench_test();
+int receive_bench_test();
+int ecn_test();
+int send_budget_test();
+int certificate_compression_test();
+int initial_reject_test();
+int hystart_pp_test();
+int ledbat_test();
+int tombstone_test();
+int quic_lb_test();
+int preferred_address_test();
+int overload_test();
+int header_template_test();
+int send_buffer_test();
+int cc_bench_test();
 int tls_zero_share_test();
 int cleartext_aead_vector_test();
 int transport_param_log_test();
@@ -114,7 +192,50 @@ int zero_rtt_spurious_test();
 int zero_rtt_retry_test();
 int parse_frame_test();
 int stress_test();
+int scale_test();
 int splay_test();
+int slab_memory_test();
+int plugin_template_test();
+int getset_fields_test();
+int delivery_rate_test();
+int hystart_pp_unit_test();
+int ledbat_unit_test();
+int prague_unit_test();
+int cc_undo_test();
+int plugin_metadata_test();
+int plugin_record_test();
+int plugin_private_test();
+int plugin_async_test();
+int logging_active_test();
+int packet_pool_test();
+int retransmit_index_test();
+int loss_threshold_test();
+int pto_test();
+int pacing_offload_test();
+int pacing_train_test();
+int stream_ready_test();
+int stream_scheduler_test();
+int stream_recv_test();
+int stream_buffer_test();
+int max_stream_data_test();
+int stream_batch_test();
+int wake_heap_test();
+int wake_heap_bench_test();
+int cnx_layout_test();
+int cnx_layout_bench_test();
+int stateless_ring_test();
+int memory_stats_test();
+int object_cache_test();
+int hibernation_test();
+int frame_dispatch_test();
+int ack_frequency_test();
+int immediate_ack_test();
+int pluglet_image_imports_test();
+int pluglet_bound_checks_test();
+int pluglet_threaded_test();
+int pluglet_threaded_getset_test();
+int gf256_region_test();
+int fec_bench_test();
 int TlsStreamFrameTest();
 int fuzz_test();
 int random_tester_test();
@@ -60,6 +60,10 @@ extern "C" {
  * pattern is a 64 bit bit mask.
  * Submit packet of length L at time t. The packet is queued to the link.
  * Get packet out of link at time T + L + Queue.
+ * The packets come from a pool of the thread, and go back to it with
+ * picoquictest_sim_link_free_packet(). The rate and loss of a link may
+ * follow a trace, and the links of a topology can be put in a network,
+ * which finds the next packet to arrive on any of them.
  */
 
 typedef struct st_picoquictest_sim_packet_t {
@@ -72,6 +76,13 @@ typedef struct st_picoquictest_sim_packet_t {
     uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE];
 } picoquictest_sim_packet_t;
 
+/* Step of a link trace: from start_time, relative to the start of the trace, until the next step */
+typedef struct st_picoquictest_sim_link_step_t {
+    uint64_t start_time;
+    double data_rate_in_gps;
+    uint32_t loss_per_million; /* Random losses, on top of the loss mask */
+} picoquictest_sim_link_step_t;
+
 typedef struct st_picoquictest_sim_link_t {
     uint64_t next_send_time;
     uint64_t queue_time;
@@ -83,6 +94,17 @@ typedef struct st_picoquictest_sim_link_t {
     uint64_t packets_sent;
     picoquictest_sim_packet_t* first_packet;
     picoquictest_sim_packet_t* last_packet;
+    /* Trace, see picoquictest_sim_link_set_trace() */
+    const picoquictest_sim_link_step_t* trace;
+    size_t nb_trace_steps;
+    size_t trace_index;
+    uint64_t trace_start;
+    uint64_t trace_period; /* 0 if the last step lasts forever */
+    uint32_t loss_per_million;
+    uint64_t random_context;
+    /* Network of the link, and position in its heap */
+    struct st_picoquictest_sim_net_t* net;
+    size_t net_index;
 } picoquictest_sim_link_t;
 
 picoquictest_sim_link_t* picoquictest_sim_link_create(double data_rate_in_gps,
@@ -92,6 +114,16 @@ void picoquictest_sim_link_delete(picoquictest_sim_link_t* link);
 
 picoquictest_sim_packet_t* picoquictest_sim_link_create_packet();
 
+void picoquictest_sim_link_free_packet(picoquictest_sim_packet_t* packet);
+
+/* Frees the packets kept by the pool of the thread */
+void picoquictest_sim_packet_pool_clear();
+
+/* The rate and loss of the link follow the steps, from current_time. If period is not 0, the trace
+ * starts again after that time. The steps are not copied. */
+void picoquictest_sim_link_set_trace(picoquictest_sim_link_t* link, const picoquictest_sim_link_step_t* trace,
+    size_t nb_steps, uint64_t period, uint64_t current_time);
+
 uint64_t picoquictest_sim_link_next_arrival(picoquictest_sim_link_t* link, uint64_t current_time);
 
 picoquictest_sim_packet_t* picoquictest_sim_link_dequeue(picoquictest_sim_link_t* link,
@@ -100,6 +132,26 @@ picoquictest_sim_packet_t* picoquictest_sim_link_dequeue(picoquictest_sim_link_t
 void picoquictest_sim_link_submit(picoquictest_sim_link_t* link, picoquictest_sim_packet_t* packet,
     uint64_t current_time);
 
+/* Links of a topology, in a heap ordered by the arrival time of their first packet */
+typedef struct st_picoquictest_sim_net_t {
+    picoquictest_sim_link_t** heap;
+    size_t nb_links;
+    size_t max_links;
+} picoquictest_sim_net_t;
+
+picoquictest_sim_net_t* picoquictest_sim_net_create();
+
+/* Also deletes the links */
+void picoquictest_sim_net_delete(picoquictest_sim_net_t* net);
+
+int picoquictest_sim_net_add_link(picoquictest_sim_net_t* net, picoquictest_sim_link_t* link);
+
+uint64_t picoquictest_sim_net_next_arrival(picoquictest_sim_net_t* net, uint64_t current_time);
+
+/* The next packet arrived on any link, and the link in *link */
+picoquictest_sim_packet_t* picoquictest_sim_net_dequeue(picoquictest_sim_net_t* net, uint64_t current_time,
+    picoquictest_sim_link_t** link);
+
 int test_one_hp_enc_pair(uint8_t * seqnum, size_t seqnum_len, void * pn_enc, void * pn_dec, uint8_t * sample);
 
 int picoquic_test_compare_files(char const* fname1, char const* fname2);
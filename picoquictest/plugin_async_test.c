@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "plugin_async.h"
+
+#define ASYNC_TEST_NB_EVENTS 100
+
+int plugin_async_test()
+{
+    int ret = 0;
+    protoop_id_t pid = { .id = "async_test", .hash = 1 };
+
+    picoquic_cnx_t *cnx = calloc(1, sizeof(picoquic_cnx_t));
+    plugin_async_observer_t *observer = calloc(1, sizeof(plugin_async_observer_t));
+    if (cnx == NULL || observer == NULL) {
+        free(cnx);
+        free(observer);
+        return -1;
+    }
+
+    /* A pluglet without VM returns immediately, which is enough to exercise the queue */
+    observer->pluglet = calloc(1, sizeof(pluglet_t));
+    observer->memory = calloc(1, PLUGIN_ASYNC_MEMORY);
+    observer->nb_fields = 1;
+    observer->fields[0] = AK_CNX_START_TIME;
+    if (observer->pluglet == NULL || observer->memory == NULL || plugin_async_attach(observer) != 0) {
+        free(observer->pluglet);
+        free(observer->memory);
+        free(observer);
+        free(cnx);
+        return -1;
+    }
+
+    for (int i = 0; i < ASYNC_TEST_NB_EVENTS; i++) {
+        protoop_arg_t inputv[1] = {i};
+        protoop_params_t pp = { .pid = &pid, .param = NO_PARAM, .caller_is_intern = true, .inputc = 1, .inputv = inputv, .outputv = NULL };
+        cnx->start_time = 1000 + i;
+        plugin_async_push(cnx, observer, &pp, 0, i + 1);
+    }
+
+    /* Once flushed, all the events were run, with the fields as they were when queued */
+    plugin_async_flush();
+    plugin_async_event_t *last = (plugin_async_event_t *) observer->memory;
+    if (observer->executed != ASYNC_TEST_NB_EVENTS || observer->dropped != 0 ||
+        last->record.pid_hash != pid.hash || last->record.inputv[0] != ASYNC_TEST_NB_EVENTS - 1 ||
+        last->record.status != ASYNC_TEST_NB_EVENTS || last->fields[0] != 1000 + ASYNC_TEST_NB_EVENTS - 1) {
+        ret = -1;
+    }
+
+    plugin_async_detach(observer);
+    free(observer->pluglet);
+    free(observer->memory);
+    free(observer);
+    free(cnx);
+
+    return ret;
+}
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+#define PLUGIN_DRR_TEST_NB_PLUGINS 3
+#define PLUGIN_DRR_TEST_FRAME_MSS 1400
+
+/* Queues a reservation of nb_bytes, as reserve_frames() does */
+static int plugin_drr_test_reserve(picoquic_cnx_t* cnx, protoop_plugin_t* p, size_t nb_bytes, int is_congestion_controlled)
+{
+    reserve_frames_block_t* block = calloc(1, sizeof(reserve_frames_block_t));
+    reserve_frame_slot_t* slot = calloc(1, sizeof(reserve_frame_slot_t));
+
+    if (block == NULL || slot == NULL ||
+        queue_enqueue((is_congestion_controlled) ? p->block_queue_cc : p->block_queue_non_cc, block) != 0) {
+        free(block);
+        free(slot);
+        return -1;
+    }
+    slot->nb_bytes = nb_bytes;
+    slot->is_congestion_controlled = is_congestion_controlled;
+    block->nb_frames = 1;
+    block->total_bytes = nb_bytes;
+    block->is_congestion_controlled = is_congestion_controlled;
+    block->frames = slot;
+    picoquic_drr_activate(cnx, p, is_congestion_controlled);
+    if (is_congestion_controlled) {
+        cnx->nb_reserved_cc_blocks++;
+    }
+
+    return 0;
+}
+
+/* Reserves the frames of one packet, and adds the bytes taken from each plugin to served */
+static size_t plugin_drr_test_packet(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_stream_head* stream,
+    protoop_plugin_t* plugins, uint64_t* served)
+{
+    reserve_frame_slot_t* slot;
+    size_t queued_bytes = picoquic_frame_fair_reserve(cnx, path_x, stream, PLUGIN_DRR_TEST_FRAME_MSS);
+
+    while ((slot = queue_dequeue(cnx->reserved_frames)) != NULL) {
+        served[slot->p - plugins] += slot->nb_bytes;
+        free(slot);
+    }
+
+    return queued_bytes;
+}
+
+/* The plugins with reservations share the packets in deficit round robin, and those held to the share of the
+ * core rate only send while the plugins have less than that share in flight, or when no stream has data */
+int plugin_drr_test()
+{
+    int ret = 0;
+    uint64_t served[PLUGIN_DRR_TEST_NB_PLUGINS] = { 0 };
+    picoquic_stream_head stream;
+    picoquic_path_t path_x;
+    picoquic_cnx_t* cnx = calloc(1, sizeof(picoquic_cnx_t));
+    protoop_plugin_t* plugins = calloc(PLUGIN_DRR_TEST_NB_PLUGINS, sizeof(protoop_plugin_t));
+
+    memset(&stream, 0, sizeof(stream));
+    memset(&path_x, 0, sizeof(path_x));
+    path_x.cwin = 100000;
+
+    if (cnx == NULL || plugins == NULL || (cnx->reserved_frames = queue_init()) == NULL) {
+        ret = -1;
+    } else {
+        cnx->core_rate = 500;
+        for (int i = 0; ret == 0 && i < PLUGIN_DRR_TEST_NB_PLUGINS; i++) {
+            if ((plugins[i].block_queue_cc = queue_init()) == NULL || (plugins[i].block_queue_non_cc = queue_init()) == NULL) {
+                ret = -1;
+            }
+        }
+        plugins[2].params.rate_unlimited = true;
+    }
+
+    /* Plugin 0 sends large frames, plugin 1 small ones, plugin 2 is rate unlimited */
+    for (int i = 0; ret == 0 && i < 6; i++) {
+        ret = plugin_drr_test_reserve(cnx, &plugins[0], 1000, 1);
+    }
+    for (int i = 0; ret == 0 && i < 30; i++) {
+        ret = plugin_drr_test_reserve(cnx, &plugins[1], 200, 1);
+    }
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        ret = plugin_drr_test_reserve(cnx, &plugins[2], 300, 1);
+    }
+    if (ret == 0) {
+        ret = plugin_drr_test_reserve(cnx, &plugins[0], 100, 0);
+    }
+
+    /* Past the share of the core rate, only the rate unlimited plugin and the frames without congestion control go */
+    if (ret == 0) {
+        cnx->plugin_bytes_in_flight = path_x.cwin / 2;
+        if (plugin_drr_test_packet(cnx, &path_x, &stream, plugins, served) != 700 ||
+            served[0] != 100 || served[1] != 0 || served[2] != 600 || cnx->nb_reserved_cc_blocks != 36 ||
+            cnx->drr[picoquic_drr_cc_unlimited].first != NULL) {
+            DBG_PRINTF("Served %d, %d and %d bytes over the core share\n", (int)served[0], (int)served[1], (int)served[2]);
+            ret = -1;
+        }
+        cnx->plugin_bytes_in_flight = 0;
+    }
+
+    /* The emptied queues leave their active lists, and the others share the packets by bytes */
+    for (int nb_packets = 0; ret == 0 && cnx->nb_reserved_cc_blocks > 0; nb_packets++) {
+        if (nb_packets > 20 || plugin_drr_test_packet(cnx, &path_x, &stream, plugins, served) == 0) {
+            DBG_PRINTF("%d blocks left after %d packets\n", (int)cnx->nb_reserved_cc_blocks, nb_packets);
+            ret = -1;
+        } else if (served[0] < 6000 && served[1] < 6000 &&
+            (served[0] > served[1] + PICOQUIC_DRR_QUANTUM + 1000 || served[1] > served[0] + PICOQUIC_DRR_QUANTUM + 1000)) {
+            DBG_PRINTF("Unfair share of %d and %d bytes\n", (int)served[0], (int)served[1]);
+            ret = -1;
+        }
+    }
+    if (ret == 0 && (served[0] != 6100 || served[1] != 6000 || cnx->drr[picoquic_drr_cc_unlimited].first != NULL ||
+        picoquic_frame_fair_reserve(cnx, &path_x, NULL, PLUGIN_DRR_TEST_FRAME_MSS) != 0)) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < picoquic_nb_drr_lists; i++) {
+        if (cnx->drr[i].first != NULL || cnx->drr[i].last != NULL || cnx->drr[i].nb_active != 0) {
+            ret = -1;
+        }
+    }
+
+    if (plugins != NULL) {
+        for (int i = 0; i < PLUGIN_DRR_TEST_NB_PLUGINS; i++) {
+            queue_t* queues[2] = { plugins[i].block_queue_cc, plugins[i].block_queue_non_cc };
+
+            for (int j = 0; j < 2 && queues[j] != NULL; j++) {
+                reserve_frames_block_t* block;
+
+                while ((block = queue_dequeue(queues[j])) != NULL) {
+                    free(block->frames);
+                    free(block);
+                }
+                queue_free(queues[j]);
+            }
+        }
+        free(plugins);
+    }
+    if (cnx != NULL) {
+        if (cnx->reserved_frames != NULL) {
+            queue_free(cnx->reserved_frames);
+        }
+        free(cnx);
+    }
+
+    return ret;
+}
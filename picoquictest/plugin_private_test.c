@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "plugin.h"
+
+static picoquic_cnx_t *private_test_cnx;
+static protoop_plugin_t *private_test_plugin;
+
+static uint64_t private_test_pluglet(void *arg)
+{
+    picoquic_cnx_t *cnx = (picoquic_cnx_t *) arg;
+    if (cnx != private_test_cnx || cnx->current_plugin != private_test_plugin || cnx->protoop_inputc != 2) {
+        return 0;
+    }
+    cnx->protoop_outputv[0] = cnx->protoop_inputv[1];
+    cnx->protoop_outputc_callee = 1;
+    return cnx->protoop_inputv[0] * 3;
+}
+
+static protoop_arg_t private_test_run(picoquic_cnx_t *cnx, protoop_id_t *pid, protoop_arg_t arg, protoop_arg_t *output)
+{
+    protoop_arg_t inputv[2] = {arg, 42};
+    protoop_arg_t outputv[PROTOOPARGS_MAX];
+    protoop_params_t pp = { .param = NO_PARAM, .caller_is_intern = true, .inputc = 2, .inputv = inputv, .outputv = outputv };
+    protoop_arg_t status = plugin_run_protoop(cnx, &pp, pid->id, pid);
+    *output = outputv[0];
+    return status;
+}
+
+int plugin_private_test()
+{
+    int ret = 0;
+    picoquic_cnx_t *cnx = calloc(1, sizeof(picoquic_cnx_t));
+    protoop_plugin_t *p = calloc(1, sizeof(protoop_plugin_t));
+    pluglet_t *pluglet = calloc(1, sizeof(pluglet_t));
+    protoop_id_t pid = { .id = "private_test" };
+    /* The copy of the id in the memory of the calling pluglet */
+    protoop_id_t caller_pid = { .id = "private_test" };
+    protocol_operation_param_struct_t *popst;
+    protoop_arg_t output = 0;
+
+    if (cnx == NULL || p == NULL || pluglet == NULL || register_noparam_protoop(cnx, &pid, NULL) != 0) {
+        free(cnx);
+        free(p);
+        free(pluglet);
+        return -1;
+    }
+    strcpy(p->name, "test.private");
+    private_test_cnx = cnx;
+    private_test_plugin = p;
+
+    /* As plugin_plug_elf() does for a private pluglet, without the ELF file */
+    pluglet->native_fn = private_test_pluglet;
+    pluglet->p = p;
+    popst = picoquic_find_protoop(cnx, &pid)->params;
+    popst->replace = pluglet;
+    popst->is_private = true;
+    picoquic_update_plain_core(popst);
+    picoquic_update_frame_dispatch(cnx);
+    if (!popst->plain_private || cnx->nb_private_ops != 1 || !plugin_pluglet_exists(cnx, &pid, NO_PARAM, pluglet_private)) {
+        ret = -1;
+    }
+
+    /* No other pluglet can observe it */
+    if (ret == 0 && (plugin_plug_elf(cnx, p, pid.id, NO_PARAM, pluglet_record, NULL) == 0 || popst->record != NULL)) {
+        ret = -1;
+    }
+
+    /* The first call resolves the operation in the id of the caller, the next ones use the index */
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        if (private_test_run(cnx, &caller_pid, 5 + i, &output) != (protoop_arg_t) 3 * (5 + i) || output != 42 ||
+            caller_pid.index != PROTOOP_BUILTIN_INDEX_MAX || cnx->current_plugin != NULL || popst->running) {
+            ret = -1;
+        }
+    }
+
+    /* A replace pluglet is run through the dispatch, even with a stale index */
+    if (ret == 0) {
+        popst->is_private = false;
+        picoquic_update_plain_core(popst);
+        picoquic_update_frame_dispatch(cnx);
+        if (cnx->nb_private_ops != 0 || private_test_run(cnx, &caller_pid, 7, &output) != 21 || output != 42 ||
+            cnx->current_plugin != NULL) {
+            ret = -1;
+        }
+        popst->is_private = true;
+    }
+
+    if (ret == 0 && (plugin_unplug(cnx, pid.id, NO_PARAM, pluglet_private) != 0 || cnx->nb_private_ops != 0)) {
+        ret = -1;
+    }
+
+    picoquic_free_protoops(cnx->ops);
+    free(pluglet);
+    free(p);
+    free(cnx);
+
+    return ret;
+}
@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "plugin.h"
+
+#define RECORD_TEST_EXTRA_CALLS 3
+
+static protoop_arg_t record_test_core(picoquic_cnx_t *cnx)
+{
+    cnx->protoop_outputv[0] = cnx->protoop_inputv[0] * 2;
+    cnx->protoop_outputc_callee = 1;
+    return cnx->protoop_inputv[0] + 1;
+}
+
+static protoop_arg_t record_test_run(picoquic_cnx_t *cnx, protoop_id_t *pid, protoop_arg_t arg)
+{
+    protoop_arg_t inputv[2] = {arg, 42};
+    protoop_arg_t outputv[PROTOOPARGS_MAX];
+    protoop_params_t pp = { .pid = pid, .param = NO_PARAM, .caller_is_intern = true, .inputc = 2, .inputv = inputv, .outputv = outputv };
+    return plugin_run_protoop_internal(cnx, &pp);
+}
+
+int plugin_record_test()
+{
+    int ret = 0;
+    picoquic_cnx_t *cnx = calloc(1, sizeof(picoquic_cnx_t));
+    protoop_plugin_t *p = calloc(1, sizeof(protoop_plugin_t));
+    protoop_id_t pid = { .id = "record_test" };
+    plugin_record_event_t events[4];
+
+    if (cnx == NULL || p == NULL || register_noparam_protoop(cnx, &pid, record_test_core) != 0) {
+        free(cnx);
+        free(p);
+        return -1;
+    }
+    strcpy(p->name, "test.record");
+
+    /* A record anchor needs no pluglet, but prevents the direct invocation of the core operation */
+    if (plugin_plug_elf(cnx, p, pid.id, NO_PARAM, pluglet_record, NULL) != 0 ||
+        !plugin_pluglet_exists(cnx, &pid, NO_PARAM, pluglet_record) ||
+        picoquic_find_protoop(cnx, &pid)->params->plain_core) {
+        ret = -1;
+    }
+
+    /* Each call is recorded, the oldest ones being overwritten when the ring is full */
+    for (int i = 0; ret == 0 && i < PLUGIN_RECORD_RING_SIZE + RECORD_TEST_EXTRA_CALLS; i++) {
+        if (record_test_run(cnx, &pid, i) != (protoop_arg_t) i + 1) {
+            ret = -1;
+        }
+    }
+
+    /* Draining is done by the plugin owning the ring, in FIFO order */
+    if (ret == 0 && plugin_record_drain(cnx, events, 4) != 0) {
+        ret = -1;
+    }
+    cnx->current_plugin = p;
+    if (ret == 0 && (plugin_record_drain(cnx, events, 4) != 4 || plugin_record_dropped(cnx) != RECORD_TEST_EXTRA_CALLS)) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < 4; i++) {
+        protoop_arg_t arg = RECORD_TEST_EXTRA_CALLS + i;
+        if (events[i].pid_hash != pid.hash || events[i].param != NO_PARAM ||
+            events[i].inputc != 2 || events[i].inputv[0] != arg || events[i].inputv[1] != 42 ||
+            events[i].outputc != 1 || events[i].outputv[0] != arg * 2 || events[i].status != arg + 1) {
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        int remaining = 0;
+        int n;
+        while ((n = plugin_record_drain(cnx, events, 4)) > 0) {
+            remaining += n;
+        }
+        if (remaining != PLUGIN_RECORD_RING_SIZE - 4) {
+            ret = -1;
+        }
+    }
+    cnx->current_plugin = NULL;
+
+    /* Once unplugged, the core operation is directly invoked again */
+    if (ret == 0 && (plugin_unplug(cnx, pid.id, NO_PARAM, pluglet_record) != 0 ||
+        !picoquic_find_protoop(cnx, &pid)->params->plain_core)) {
+        ret = -1;
+    }
+
+    picoquic_free_protoops(cnx->ops);
+    free(p->record_ring);
+    free(p);
+    free(cnx);
+
+    return ret;
+}
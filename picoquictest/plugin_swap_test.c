@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "plugin.h"
+#include "memory.h"
+
+#define PLUGIN_SWAP_TEST_FNAME "plugins/datagram/datagram.plugin"
+#define PLUGIN_SWAP_TEST_NAME "be.mpiraux.datagram"
+#define PLUGIN_SWAP_TEST_FRAME 0x2c /* Datagram frame without length */
+
+typedef struct st_plugin_swap_test_ctx_t {
+    protoop_plugin_t *old_p;
+    protoop_plugin_t *new_p;
+    int ret;
+} plugin_swap_test_ctx_t;
+
+static int plugin_swap_test_migrate(picoquic_cnx_t *cnx, protoop_plugin_t *old_p, protoop_plugin_t *new_p, void *migrate_ctx)
+{
+    plugin_swap_test_ctx_t *ctx = (plugin_swap_test_ctx_t *) migrate_ctx;
+    ctx->old_p = old_p;
+    ctx->new_p = new_p;
+    return ctx->ret;
+}
+
+/* Parses a datagram frame, which only the pluglets of the plugin know */
+static int plugin_swap_test_parse(picoquic_cnx_t *cnx)
+{
+    const uint8_t frame[] = { PLUGIN_SWAP_TEST_FRAME, 0xa, 0xb, 0xc, 0xd };
+    protoop_arg_t out[3] = { 0, 0, 0 };
+    uint8_t *bytes = (uint8_t *) malloc(sizeof(frame));
+    int ret = 0;
+
+    if (bytes == NULL) {
+        return -1;
+    }
+    memcpy(bytes, frame, sizeof(frame));
+    if ((uint8_t *) protoop_prepare_and_run_param(cnx, &PROTOOP_PARAM_PARSE_FRAME, PLUGIN_SWAP_TEST_FRAME, out, bytes, bytes + sizeof(frame)) != bytes + sizeof(frame)) {
+        ret = -1;
+    } else {
+        my_free_in_core(cnx->previous_plugin_in_replace, (void *) out[0]);
+    }
+    free(bytes);
+    return ret;
+}
+
+/* The pluglets of a plugin are swapped between packets, and a failed swap leaves the old version in place */
+int plugin_swap_test()
+{
+    int ret = 0;
+    picoquic_cnx_t cnx = { 0 };
+    plugin_swap_test_ctx_t ctx = { NULL, NULL, 0 };
+    protoop_plugin_t *p = NULL;
+
+    register_protocol_operations(&cnx);
+    if ((cnx.reserved_frames = queue_init()) == NULL || (cnx.retry_frames = queue_init()) == NULL ||
+        plugin_insert_plugin(&cnx, PLUGIN_SWAP_TEST_FNAME) != 0) {
+        DBG_PRINTF("%s", "Unable to load datagram plugin\n");
+        ret = -1;
+    } else {
+        HASH_FIND_STR(cnx.plugins, PLUGIN_SWAP_TEST_NAME, p);
+    }
+
+    /* Not while a pluglet runs, nor while the plugin has frames in flight */
+    if (ret == 0) {
+        cnx.current_plugin = p;
+        if (plugin_swap_plugin(&cnx, PLUGIN_SWAP_TEST_FNAME, NULL, NULL) != PLUGIN_SWAP_NOT_SAFE) {
+            ret = -1;
+        }
+        cnx.current_plugin = NULL;
+        p->bytes_in_flight = 100;
+        if (plugin_swap_plugin(&cnx, PLUGIN_SWAP_TEST_FNAME, NULL, NULL) != PLUGIN_SWAP_NOT_SAFE) {
+            ret = -1;
+        }
+        p->bytes_in_flight = 0;
+    }
+
+    /* The migration hook gets both versions, and the new one replaces the old one */
+    if (ret == 0) {
+        p->bytes_total = 1000;
+        if (plugin_swap_plugin(&cnx, PLUGIN_SWAP_TEST_FNAME, plugin_swap_test_migrate, &ctx) != 0) {
+            DBG_PRINTF("%s", "Swap failed\n");
+            ret = -1;
+        } else {
+            protoop_plugin_t *new_p = NULL;
+            HASH_FIND_STR(cnx.plugins, PLUGIN_SWAP_TEST_NAME, new_p);
+            if (ctx.old_p != p || new_p == NULL || ctx.new_p != new_p || HASH_COUNT(cnx.plugins) != 1 ||
+                new_p->memory == ctx.old_p->memory || new_p->bytes_total != 1000 || plugin_swap_test_parse(&cnx) != 0) {
+                DBG_PRINTF("%s", "Wrong plugin after the swap\n");
+                ret = -1;
+            }
+            p = new_p;
+        }
+    }
+
+    /* A migration failure undoes the swap */
+    if (ret == 0) {
+        protoop_plugin_t *kept_p = NULL;
+        ctx.ret = -1;
+        if (plugin_swap_plugin(&cnx, PLUGIN_SWAP_TEST_FNAME, plugin_swap_test_migrate, &ctx) != 1) {
+            ret = -1;
+        } else {
+            HASH_FIND_STR(cnx.plugins, PLUGIN_SWAP_TEST_NAME, kept_p);
+            if (kept_p != p || HASH_COUNT(cnx.plugins) != 1 || plugin_swap_test_parse(&cnx) != 0) {
+                DBG_PRINTF("%s", "Old plugin not restored\n");
+                ret = -1;
+            }
+        }
+    }
+
+    picoquic_free_protoops_and_plugins(&cnx);
+    if (cnx.reserved_frames != NULL) {
+        queue_free(cnx.reserved_frames);
+    }
+    if (cnx.retry_frames != NULL) {
+        queue_free(cnx.retry_frames);
+    }
+
+    return ret;
+}
@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+#define PMTUD_TEST_CHECKSUM 16
+#define PMTUD_TEST_MAX_PROBES 64
+
+/* Sends the probes that the search asks for over a path whose MTU is path_mtu, until it is done.
+ * Returns the number of probes, or -1 if the search does not end. */
+static int pmtud_test_search(picoquic_cnx_t* cnx, picoquic_path_t* path_x, picoquic_packet_t* p,
+    uint32_t path_mtu, uint64_t* current_time)
+{
+    int nb_probes = 0;
+
+    while (picoquic_is_mtu_probe_needed(cnx, path_x)) {
+        uint32_t probe_length = (uint32_t)picoquic_mtu_probe_length(cnx, path_x);
+
+        if (++nb_probes > PMTUD_TEST_MAX_PROBES) {
+            return -1;
+        }
+        p->is_mtu_probe = 1;
+        p->length = probe_length - PMTUD_TEST_CHECKSUM;
+        path_x->mtu_probe_sent = 1;
+        *current_time += 100000;
+        if (probe_length <= path_mtu) {
+            picoquic_mtu_packet_acked(cnx, path_x, p, *current_time);
+        } else {
+            (void)picoquic_mtu_packet_lost(cnx, path_x, p, *current_time);
+        }
+    }
+
+    return nb_probes;
+}
+
+static int pmtud_test_converged(picoquic_path_t* path_x, uint32_t path_mtu)
+{
+    return path_x->send_mtu <= path_mtu && path_x->send_mtu + PICOQUIC_MTU_SEARCH_PRECISION >= path_mtu;
+}
+
+/* The search finds the MTU of the path, falls back to the base on a black hole, and starts again after the raise timer */
+int pmtud_test()
+{
+    int ret = 0;
+    uint64_t current_time = 1000000;
+    picoquic_quic_t* quic = (picoquic_quic_t*)calloc(1, sizeof(picoquic_quic_t));
+    picoquic_cnx_t* cnx = (picoquic_cnx_t*)calloc(1, sizeof(picoquic_cnx_t));
+    picoquic_path_t* path_x = (picoquic_path_t*)calloc(1, sizeof(picoquic_path_t));
+    picoquic_packet_t* p = (picoquic_packet_t*)calloc(1, sizeof(picoquic_packet_t));
+
+    if (quic == NULL || cnx == NULL || path_x == NULL || p == NULL) {
+        ret = -1;
+    } else {
+        quic->max_packet_size = PICOQUIC_MAX_JUMBO_PACKET_SIZE;
+        cnx->quic = quic;
+        cnx->cnx_state = picoquic_state_client_ready;
+        cnx->remote_parameters.max_packet_size = 9000;
+        path_x->peer_addr.ss_family = AF_INET;
+        path_x->send_mtu = PICOQUIC_INITIAL_MTU_IPV4;
+        p->checksum_overhead = PMTUD_TEST_CHECKSUM;
+    }
+
+    /* A jumbo path: the first probe at the size of the peer gets through */
+    if (ret == 0 && (pmtud_test_search(cnx, path_x, p, 9000, &current_time) != 1 || path_x->send_mtu != 9000)) {
+        DBG_PRINTF("Jumbo search ends at %u\n", path_x->send_mtu);
+        ret = -1;
+    }
+
+    /* A black hole: the full size packets get lost, the MTU falls back and the search finds the smaller one */
+    if (ret == 0) {
+        int nb_probes;
+
+        p->is_mtu_probe = 0;
+        p->length = 9000 - PMTUD_TEST_CHECKSUM;
+        for (int i = 0; i < PICOQUIC_MTU_BLACK_HOLE_LOSSES - 1; i++) {
+            (void)picoquic_mtu_packet_lost(cnx, path_x, p, current_time);
+        }
+        if (path_x->send_mtu != 9000) {
+            DBG_PRINTF("%s", "Fell back before enough losses\n");
+            ret = -1;
+        } else {
+            /* An acknowledged packet of the base size does not show that the large ones get through */
+            p->length = PICOQUIC_INITIAL_MTU_IPV4 - PMTUD_TEST_CHECKSUM;
+            picoquic_mtu_packet_acked(cnx, path_x, p, current_time);
+            p->length = 9000 - PMTUD_TEST_CHECKSUM;
+            (void)picoquic_mtu_packet_lost(cnx, path_x, p, current_time);
+            if (path_x->send_mtu != PICOQUIC_INITIAL_MTU_IPV4 || path_x->send_mtu_max_tried != 9000) {
+                DBG_PRINTF("Black hole leaves the MTU at %u\n", path_x->send_mtu);
+                ret = -1;
+            }
+        }
+        if (ret == 0) {
+            nb_probes = pmtud_test_search(cnx, path_x, p, 1400, &current_time);
+            if (nb_probes < 0 || !pmtud_test_converged(path_x, 1400)) {
+                DBG_PRINTF("Search below the black hole ends at %u after %d probes\n", path_x->send_mtu, nb_probes);
+                ret = -1;
+            }
+        }
+    }
+
+    /* Done until the raise timer, then the search finds the larger MTU again */
+    if (ret == 0) {
+        if (path_x->mtu_raise_time == 0 || picoquic_is_mtu_probe_needed(cnx, path_x)) {
+            DBG_PRINTF("%s", "The search is not done\n");
+            ret = -1;
+        } else {
+            current_time = path_x->mtu_raise_time;
+            p->is_mtu_probe = 0;
+            p->length = 1000;
+            picoquic_mtu_packet_acked(cnx, path_x, p, current_time);
+            if (!picoquic_is_mtu_probe_needed(cnx, path_x) || pmtud_test_search(cnx, path_x, p, 4000, &current_time) < 0 ||
+                !pmtud_test_converged(path_x, 4000)) {
+                DBG_PRINTF("Search after the raise timer ends at %u\n", path_x->send_mtu);
+                ret = -1;
+            }
+        }
+    }
+
+    free(p);
+    free(path_x);
+    free(cnx);
+    free(quic);
+
+    return ret;
+}
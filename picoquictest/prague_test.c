@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+/* Ends the current round, the ACK_ECN frames having reported nb_ect marked packets, nb_ce of them CE */
+static void prague_unit_test_round(picoquic_path_t* path_x, uint64_t nb_ect, uint64_t nb_ce, uint64_t current_time)
+{
+    picoquic_packet_context_t* pkt_ctx = &path_x->pkt_ctx[picoquic_packet_context_application];
+
+    path_x->ecn_ect_acked += nb_ect;
+    path_x->ecn_ce_acked += nb_ce;
+    pkt_ctx->highest_acknowledged = pkt_ctx->send_sequence;
+    pkt_ctx->send_sequence += 1000;
+    picoquic_prague_algorithm->alg_notify(path_x, picoquic_congestion_notification_acknowledgement, 0, 0, 0, current_time);
+}
+
+/* The window shrinks in proportion of the CE fraction, at most once per RTT, and halves on losses */
+int prague_unit_test()
+{
+    int ret = 0;
+    uint64_t current_time = 1000000;
+    uint64_t cwin_before;
+    picoquic_path_t* path_x = (picoquic_path_t*)malloc(sizeof(picoquic_path_t));
+
+    if (path_x == NULL) {
+        return -1;
+    }
+    memset(path_x, 0, sizeof(picoquic_path_t));
+    path_x->send_mtu = PICOQUIC_INITIAL_MTU_IPV4;
+    path_x->rtt_min = 10000;
+    path_x->smoothed_rtt = 10000;
+    path_x->pkt_ctx[picoquic_packet_context_application].send_sequence = 1000;
+
+    picoquic_prague_algorithm->alg_init(NULL, path_x);
+    if (path_x->congestion_alg_state == NULL) {
+        ret = -1;
+    }
+
+    /* Slow start, until the first mark */
+    if (ret == 0) {
+        cwin_before = path_x->cwin;
+        picoquic_prague_algorithm->alg_notify(path_x, picoquic_congestion_notification_acknowledgement, 0, 100000, 0, current_time);
+        if (path_x->cwin != cwin_before + 100000) {
+            ret = -1;
+        }
+    }
+
+    /* Starting with alpha = 1, a round with 10% of CE marks gives alpha = 0.944, or 989593/2^20 */
+    if (ret == 0) {
+        prague_unit_test_round(path_x, 100, 10, current_time);
+        cwin_before = path_x->cwin;
+        picoquic_prague_algorithm->alg_notify(path_x, picoquic_congestion_notification_congestion_experienced, 0, 0, 0, current_time);
+        if (path_x->cwin != cwin_before - ((cwin_before * 989593) >> 21)) {
+            ret = -1;
+        }
+    }
+
+    /* Another mark in the same RTT does not change the window */
+    if (ret == 0) {
+        cwin_before = path_x->cwin;
+        current_time += path_x->smoothed_rtt / 2;
+        picoquic_prague_algorithm->alg_notify(path_x, picoquic_congestion_notification_congestion_experienced, 0, 0, 0, current_time);
+        if (path_x->cwin != cwin_before) {
+            ret = -1;
+        }
+    }
+
+    /* After rounds with few marks, the response is much smaller than the classic half */
+    for (int i = 0; ret == 0 && i < 64; i++) {
+        current_time += path_x->smoothed_rtt;
+        prague_unit_test_round(path_x, 100, 1, current_time);
+    }
+    if (ret == 0) {
+        current_time += path_x->smoothed_rtt;
+        cwin_before = path_x->cwin;
+        picoquic_prague_algorithm->alg_notify(path_x, picoquic_congestion_notification_congestion_experienced, 0, 0, 0, current_time);
+        if (path_x->cwin >= cwin_before || path_x->cwin < cwin_before - cwin_before / 32) {
+            ret = -1;
+        }
+    }
+
+    /* Additive increase of one packet per RTT in congestion avoidance */
+    if (ret == 0) {
+        cwin_before = path_x->cwin;
+        picoquic_prague_algorithm->alg_notify(path_x, picoquic_congestion_notification_acknowledgement, 0, cwin_before, 0, current_time);
+        if (path_x->cwin != cwin_before + path_x->send_mtu) {
+            ret = -1;
+        }
+    }
+
+    /* A loss halves the window */
+    if (ret == 0) {
+        current_time += 2 * path_x->smoothed_rtt;
+        cwin_before = path_x->cwin;
+        picoquic_prague_algorithm->alg_notify(path_x, picoquic_congestion_notification_repeat, 0, 0, 0, current_time);
+        if (path_x->cwin != cwin_before / 2) {
+            ret = -1;
+        }
+    }
+
+    picoquic_prague_algorithm->alg_delete(NULL, path_x);
+    if (path_x->congestion_alg_state != NULL) {
+        ret = -1;
+    }
+
+    free(path_x);
+
+    return ret;
+}
@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef _WINDOWS
+#include <sys/time.h>
+#endif
+#include "picoquic_internal.h"
+
+#define QUEUE_TEST_NB_ITEMS 100
+#define QUEUE_BENCH_NB_ROUNDS 2000000
+#define QUEUE_BENCH_DEPTH 16
+
+/* The elements come out in order while the array wraps around and grows */
+int queue_test()
+{
+    int ret = 0;
+    queue_t *q = queue_init();
+    queue_t *empty = queue_init();
+    size_t next_in = 1;
+    size_t next_out = 1;
+
+    if (q == NULL || empty == NULL) {
+        ret = -1;
+    }
+
+    /* Wrap around the initial array, then grow it while it wraps */
+    for (int round = 0; ret == 0 && round < 3; round++) {
+        size_t nb_in = (round == 0) ? QUEUE_INITIAL_CAPACITY - 2 : QUEUE_TEST_NB_ITEMS / (4 - round);
+        size_t nb_out = (round == 2) ? queue_size(q) + nb_in : nb_in / 2 + 1;
+
+        for (size_t i = 0; ret == 0 && i < nb_in; i++) {
+            ret = queue_enqueue(q, (void *)next_in++);
+        }
+        if (ret == 0 && (queue_size(q) != next_in - next_out || queue_get(q, 0) != (void *)next_out ||
+            queue_get(q, queue_size(q) - 1) != (void *)(next_in - 1) || queue_get(q, queue_size(q)) != NULL)) {
+            DBG_PRINTF("Wrong queue of %zu elements at round %d\n", queue_size(q), round);
+            ret = -1;
+        }
+        for (size_t i = 0; ret == 0 && i < nb_out; i++) {
+            if (queue_peek(q) != (void *)next_out || queue_dequeue(q) != (void *)next_out) {
+                DBG_PRINTF("Element %zu out of order\n", next_out);
+                ret = -1;
+            }
+            next_out++;
+        }
+    }
+
+    if (ret == 0 && (queue_size(q) != 0 || queue_peek(q) != NULL || queue_dequeue(q) != NULL)) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        const queue_t *queues[2] = { empty, q };
+
+        if (queue_enqueue(q, (void *)next_in) != 0 || queue_peek_any(queues, 2) != (void *)next_in ||
+            queue_peek_any(queues, 1) != NULL) {
+            ret = -1;
+        }
+    }
+
+    /* Removing elements keeps the order of the others */
+    for (size_t i = 1; ret == 0 && i < QUEUE_INITIAL_CAPACITY; i++) {
+        ret = queue_enqueue(q, (void *)(next_in + i));
+    }
+    if (ret == 0 && (queue_remove(q, 2) != (void *)(next_in + 2) || queue_remove(q, queue_size(q) - 1) != (void *)(next_in + QUEUE_INITIAL_CAPACITY - 1) ||
+        queue_remove(q, queue_size(q)) != NULL || queue_size(q) != QUEUE_INITIAL_CAPACITY - 2)) {
+        ret = -1;
+    }
+    for (size_t i = 0; ret == 0 && i < QUEUE_INITIAL_CAPACITY - 1; i++) {
+        if (i != 2 && queue_dequeue(q) != (void *)(next_in + i)) {
+            DBG_PRINTF("Element %zu out of order after the removals\n", i);
+            ret = -1;
+        }
+    }
+
+    if (q != NULL) {
+        queue_free(q);
+    }
+    if (empty != NULL) {
+        queue_free(empty);
+    }
+
+    return ret;
+}
+
+/* The linked list queue that queue_t replaced, for comparison */
+typedef struct st_queue_bench_node_t {
+    void *data;
+    struct st_queue_bench_node_t *next;
+} queue_bench_node_t;
+
+typedef struct st_queue_bench_list_t {
+    queue_bench_node_t *head;
+    queue_bench_node_t *tail;
+    size_t size;
+} queue_bench_list_t;
+
+static int queue_bench_list_enqueue(queue_bench_list_t *q, void *d)
+{
+    queue_bench_node_t *n = (queue_bench_node_t *) malloc(sizeof(queue_bench_node_t));
+    if (!n) {
+        return 1;
+    }
+    n->data = d;
+    n->next = NULL;
+    if (!q->head) {
+        q->head = n;
+    } else {
+        q->tail->next = n;
+    }
+    q->tail = n;
+    q->size++;
+    return 0;
+}
+
+static void *queue_bench_list_dequeue(queue_bench_list_t *q)
+{
+    queue_bench_node_t *to_remove = q->head;
+    void *to_return;
+
+    if (!to_remove) {
+        return NULL;
+    }
+    to_return = to_remove->data;
+    q->head = to_remove->next;
+    if (!q->head) {
+        q->tail = NULL;
+    }
+    q->size--;
+    free(to_remove);
+    return to_return;
+}
+
+static uint64_t queue_bench_elapsed(struct timeval *tv_start)
+{
+    struct timeval tv_end;
+
+    gettimeofday(&tv_end, NULL);
+    return (uint64_t)((tv_end.tv_sec - tv_start->tv_sec) * 1000000 + (tv_end.tv_usec - tv_start->tv_usec));
+}
+
+/* As the frame queues of a connection do for each packet, a few elements are queued then removed */
+int queue_bench_test()
+{
+    int ret = 0;
+    uintptr_t sum_list = 0;
+    uintptr_t sum_ring = 0;
+    queue_bench_list_t list = { NULL, NULL, 0 };
+    queue_t *q = queue_init();
+    struct timeval tv_start;
+    uint64_t list_time;
+    uint64_t ring_time;
+
+    if (q == NULL) {
+        return -1;
+    }
+
+    gettimeofday(&tv_start, NULL);
+    for (uintptr_t i = 0; ret == 0 && i < QUEUE_BENCH_NB_ROUNDS; i++) {
+        for (uintptr_t j = 1; ret == 0 && j <= QUEUE_BENCH_DEPTH; j++) {
+            ret = queue_bench_list_enqueue(&list, (void *)(i + j));
+        }
+        while (list.size > 0) {
+            sum_list += (uintptr_t)queue_bench_list_dequeue(&list);
+        }
+    }
+    list_time = queue_bench_elapsed(&tv_start);
+
+    gettimeofday(&tv_start, NULL);
+    for (uintptr_t i = 0; ret == 0 && i < QUEUE_BENCH_NB_ROUNDS; i++) {
+        for (uintptr_t j = 1; ret == 0 && j <= QUEUE_BENCH_DEPTH; j++) {
+            ret = queue_enqueue(q, (void *)(i + j));
+        }
+        while (queue_size(q) > 0) {
+            sum_ring += (uintptr_t)queue_dequeue(q);
+        }
+    }
+    ring_time = queue_bench_elapsed(&tv_start);
+
+    fprintf(stderr, "Queue: %d rounds of %d elements, linked list %" PRIu64 " us, circular array %" PRIu64 " us\n",
+        QUEUE_BENCH_NB_ROUNDS, QUEUE_BENCH_DEPTH, list_time, ring_time);
+
+    if (ret == 0 && sum_list != sum_ring) {
+        ret = -1;
+    }
+    while (list.size > 0) {
+        (void)queue_bench_list_dequeue(&list);
+    }
+    queue_free(q);
+
+    return ret;
+}
@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "tls_api.h"
+
+#define QUIC_LB_TEST_NB_CNX_IDS 64
+
+static int quic_lb_test_one(picoquic_lb_config_t* config)
+{
+    int ret = 0;
+    picoquic_lb_ctx_t* lb_ctx = picoquic_lb_ctx_create(config);
+    picoquic_connection_id_t cnx_id[2];
+    uint8_t server_id[PICOQUIC_LB_SERVER_ID_MAX];
+    uint8_t cnx_id_length = (uint8_t)(1 + config->server_id_length + config->nonce_length);
+
+    if (lb_ctx == NULL || picoquic_lb_cnx_id_length(lb_ctx) != cnx_id_length) {
+        DBG_PRINTF("Cannot create the QUIC-LB mode %d\n", (int)config->mode);
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < QUIC_LB_TEST_NB_CNX_IDS; i++) {
+        picoquic_connection_id_t* c = &cnx_id[i & 1];
+
+        memset(c, 0, sizeof(picoquic_connection_id_t));
+        picoquic_public_random(c->id, cnx_id_length);
+        picoquic_lb_encode_cnx_id(lb_ctx, c);
+        memset(server_id, 0, sizeof(server_id));
+        if (c->id_len != cnx_id_length || (c->id[0] >> 5) != config->config_rotation ||
+            (config->self_encode_length && (c->id[0] & 0x1F) != cnx_id_length - 1) ||
+            picoquic_lb_decode_server_id(lb_ctx, c->id, c->id_len, server_id) != 0 ||
+            memcmp(server_id, config->server_id, config->server_id_length) != 0) {
+            DBG_PRINTF("Wrong CID %d in QUIC-LB mode %d\n", i, (int)config->mode);
+            ret = -1;
+        } else if (i > 0 && picoquic_compare_connection_id(&cnx_id[0], &cnx_id[1]) == 0) {
+            ret = -1;
+        } else if (config->mode != picoquic_lb_plaintext && i > 0 &&
+            memcmp(cnx_id[0].id + cnx_id_length - config->server_id_length, cnx_id[1].id + cnx_id_length - config->server_id_length,
+                config->server_id_length) == 0) {
+            /* The encrypted server ID changes with the nonce */
+            ret = -1;
+        }
+    }
+
+    /* A CID of another configuration, or too short, is not routed */
+    if (ret == 0) {
+        cnx_id[0].id[0] ^= 0x20;
+        if (picoquic_lb_decode_server_id(lb_ctx, cnx_id[0].id, cnx_id_length, server_id) == 0 ||
+            picoquic_lb_decode_server_id(lb_ctx, cnx_id[1].id, cnx_id_length - 1, server_id) == 0) {
+            ret = -1;
+        }
+    }
+
+    picoquic_lb_ctx_free(lb_ctx);
+
+    return ret;
+}
+
+int quic_lb_test()
+{
+    int ret = 0;
+    picoquic_lb_config_t config;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_connection_id_t cnx_id;
+    uint8_t server_id[PICOQUIC_LB_SERVER_ID_MAX];
+    uint8_t key[PICOQUIC_LB_KEY_SIZE] = { 0x8f, 0x95, 0xf0, 0x92, 0x45, 0x76, 0x5f, 0x80, 0x25, 0x69, 0x34, 0xe5, 0x0c, 0x66, 0x20, 0x7f };
+    uint8_t sid[PICOQUIC_LB_SERVER_ID_MAX] = { 0xed, 0x79, 0x3a, 0x51, 0xd4, 0x9b, 0x8f, 0x5f, 0xab, 0x65, 0xba, 0x04, 0xc3, 0x33, 0x0a };
+    static const struct {
+        picoquic_lb_mode_enum mode;
+        uint8_t server_id_length;
+        uint8_t nonce_length;
+        int self_encode_length;
+        int is_valid;
+    } cases[] = {
+        { picoquic_lb_plaintext, 1, 8, 1, 1 },
+        { picoquic_lb_plaintext, 15, 4, 0, 1 },
+        { picoquic_lb_plaintext, 3, 3, 0, 0 },
+        { picoquic_lb_stream_cipher, 3, 8, 1, 1 },
+        { picoquic_lb_stream_cipher, 3, 16, 0, 1 },
+        { picoquic_lb_stream_cipher, 4, 7, 0, 0 },
+        { picoquic_lb_stream_cipher, 4, 16, 0, 0 },
+        { picoquic_lb_block_cipher, 4, 12, 1, 1 },
+        { picoquic_lb_block_cipher, 15, 1, 0, 1 },
+        { picoquic_lb_block_cipher, 4, 11, 0, 0 },
+        { picoquic_lb_plaintext, 0, 8, 0, 0 }
+    };
+
+    for (size_t i = 0; ret == 0 && i < sizeof(cases) / sizeof(cases[0]); i++) {
+        memset(&config, 0, sizeof(config));
+        config.config_rotation = (uint8_t)(i % (PICOQUIC_LB_CONFIG_ROTATION_MAX + 1));
+        config.mode = cases[i].mode;
+        config.server_id_length = cases[i].server_id_length;
+        config.nonce_length = cases[i].nonce_length;
+        config.self_encode_length = cases[i].self_encode_length;
+        memcpy(config.server_id, sid, sizeof(sid));
+        memcpy(config.key, key, sizeof(key));
+        if (cases[i].is_valid) {
+            ret = quic_lb_test_one(&config);
+        } else {
+            picoquic_lb_ctx_t* lb_ctx = picoquic_lb_ctx_create(&config);
+            if (lb_ctx != NULL) {
+                DBG_PRINTF("Invalid QUIC-LB case %d accepted\n", (int)i);
+                picoquic_lb_ctx_free(lb_ctx);
+                ret = -1;
+            }
+        }
+    }
+
+    /* The unroutable config rotation cannot be configured */
+    if (ret == 0) {
+        config.config_rotation = PICOQUIC_LB_CONFIG_ROTATION_MAX + 1;
+        config.mode = picoquic_lb_plaintext;
+        config.server_id_length = 2;
+        config.nonce_length = 6;
+        if (picoquic_lb_ctx_create(&config) != NULL) {
+            ret = -1;
+        }
+        config.config_rotation = 1;
+    }
+
+    /* The CIDs of the context, those of the plugins included, follow the configuration */
+    if (ret == 0) {
+        quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0, NULL);
+        cnx = calloc(1, sizeof(picoquic_cnx_t));
+        if (quic == NULL || cnx == NULL) {
+            ret = -1;
+        } else {
+            cnx->quic = quic;
+        }
+    }
+    if (ret == 0) {
+        config.mode = picoquic_lb_stream_cipher;
+        config.nonce_length = 10;
+        if (picoquic_set_lb_config(quic, &config) != 0 || quic->local_ctx_length != 13) {
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        picoquic_create_random_cnx_id(quic, &cnx_id, quic->local_ctx_length);
+        if (cnx_id.id_len != 13 || picoquic_lb_decode_server_id(quic->lb_ctx, cnx_id.id, cnx_id.id_len, server_id) != 0 ||
+            memcmp(server_id, sid, 2) != 0) {
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        picoquic_create_random_cnx_id_for_cnx(cnx, &cnx_id, 8);
+        if (cnx_id.id_len != 13 || picoquic_lb_decode_server_id(quic->lb_ctx, cnx_id.id, cnx_id.id_len, server_id) != 0 ||
+            memcmp(server_id, sid, 2) != 0) {
+            ret = -1;
+        }
+    }
+
+    /* A rejected configuration leaves the previous one, NULL goes back to random CIDs */
+    if (ret == 0) {
+        config.nonce_length = 2;
+        if (picoquic_set_lb_config(quic, &config) == 0 || quic->lb_ctx == NULL ||
+            picoquic_set_lb_config(quic, NULL) != 0 || quic->lb_ctx != NULL || quic->local_ctx_length != 13) {
+            ret = -1;
+        }
+    }
+
+    free(cnx);
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
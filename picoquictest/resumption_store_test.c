@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "resumption_store.h"
+
+#define RESUMPTION_STORE_TEST_SLOTS 64
+#define RESUMPTION_STORE_TEST_NB_KEYS 6
+#define RESUMPTION_STORE_TEST_NAME "/pquic_resumption_store_test"
+
+static int resumption_store_test_keys(picoquic_resumption_store_t* store)
+{
+    int ret = 0;
+    uint8_t secret[PICOQUIC_RESUMPTION_KEY_SIZE];
+    uint8_t read_back[PICOQUIC_RESUMPTION_KEY_SIZE];
+    uint32_t key_ids[RESUMPTION_STORE_TEST_NB_KEYS];
+
+    if (picoquic_resumption_store_get_key(store, 0, read_back) != 0) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < RESUMPTION_STORE_TEST_NB_KEYS; i++) {
+        memset(secret, i + 1, sizeof(secret));
+        key_ids[i] = picoquic_resumption_store_rotate_key(store, secret, sizeof(secret));
+        if (key_ids[i] == 0 || picoquic_resumption_store_current_key_id(store) != key_ids[i]) {
+            ret = -1;
+        }
+    }
+
+    /* Only the last keys are still there, the older ones being overwritten */
+    for (int i = 0; ret == 0 && i < RESUMPTION_STORE_TEST_NB_KEYS; i++) {
+        uint32_t key_id = picoquic_resumption_store_get_key(store, key_ids[i], read_back);
+
+        if (i < RESUMPTION_STORE_TEST_NB_KEYS - PICOQUIC_RESUMPTION_KEY_SLOTS) {
+            if (key_id != 0) {
+                ret = -1;
+            }
+        } else {
+            memset(secret, i + 1, sizeof(secret));
+            if (key_id != key_ids[i] || memcmp(secret, read_back, sizeof(secret)) != 0) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0 && picoquic_resumption_store_get_key(store, 0, read_back) != key_ids[RESUMPTION_STORE_TEST_NB_KEYS - 1]) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int resumption_store_test_strikes(picoquic_resumption_store_t* store)
+{
+    int ret = 0;
+    uint64_t current_time = 1000000;
+    uint64_t window = 10;
+
+    picoquic_resumption_store_set_strike_window(store, (uint32_t)window);
+
+    /* Accepted once within the window, a hash of 0 as well */
+    if (picoquic_resumption_store_strike(store, 0x123456789ABCDEF0ull, current_time) != 0 ||
+        picoquic_resumption_store_strike(store, 0x123456789ABCDEF0ull, current_time + 1000) != 1 ||
+        picoquic_resumption_store_strike(store, 0, current_time) != 0 ||
+        picoquic_resumption_store_strike(store, 0, current_time) != 1) {
+        ret = -1;
+    }
+
+    /* Past the window, the ticket is forgotten */
+    if (ret == 0) {
+        current_time += window * 1000000;
+        if (picoquic_resumption_store_strike(store, 0x123456789ABCDEF0ull, current_time) != 0) {
+            ret = -1;
+        }
+    }
+
+    /* Tickets of the same probes fill them up, then the next ones are refused */
+    if (ret == 0) {
+        current_time += window * 1000000;
+        for (uint64_t i = 0; ret == 0 && i < PICOQUIC_RESUMPTION_STRIKE_PROBES; i++) {
+            if (picoquic_resumption_store_strike(store, (i + 1) << 40, current_time) != 0) {
+                ret = -1;
+            }
+        }
+        if (ret == 0 && picoquic_resumption_store_strike(store, (uint64_t)(PICOQUIC_RESUMPTION_STRIKE_PROBES + 1) << 40, current_time) != 1) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && store->shared->nb_replays != 3) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* A child process forked after the creation sees the keys and the strikes of the parent */
+static int resumption_store_test_fork(picoquic_resumption_store_t* store)
+{
+    int ret = 0;
+    uint64_t current_time = 100000000;
+    uint8_t secret[PICOQUIC_RESUMPTION_KEY_SIZE];
+    int status = 0;
+    pid_t pid;
+
+    memset(secret, 0xA5, sizeof(secret));
+    (void)picoquic_resumption_store_rotate_key(store, secret, sizeof(secret));
+
+    pid = fork();
+    if (pid < 0) {
+        ret = -1;
+    } else if (pid == 0) {
+        uint8_t read_back[PICOQUIC_RESUMPTION_KEY_SIZE];
+        int child_ret = 0;
+
+        if (picoquic_resumption_store_get_key(store, 0, read_back) == 0 || memcmp(read_back, secret, sizeof(secret)) != 0 ||
+            picoquic_resumption_store_strike(store, 0xFEDCBA9876543210ull, current_time) != 0) {
+            child_ret = 1;
+        }
+        _exit(child_ret);
+    } else if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        ret = -1;
+    } else if (picoquic_resumption_store_strike(store, 0xFEDCBA9876543210ull, current_time) != 1) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int resumption_store_test()
+{
+    int ret = 0;
+    picoquic_resumption_store_t* store = picoquic_resumption_store_create(NULL, RESUMPTION_STORE_TEST_SLOTS);
+
+    if (store == NULL) {
+        return -1;
+    }
+
+    if (store->shared->nb_strike_slots != RESUMPTION_STORE_TEST_SLOTS) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        ret = resumption_store_test_keys(store);
+    }
+    if (ret == 0) {
+        ret = resumption_store_test_strikes(store);
+    }
+    if (ret == 0) {
+        ret = resumption_store_test_fork(store);
+    }
+    picoquic_resumption_store_release(store);
+
+    /* A named store is the same for all those who open it */
+    if (ret == 0) {
+        picoquic_resumption_store_t* first;
+        picoquic_resumption_store_t* second;
+        uint8_t secret[PICOQUIC_RESUMPTION_KEY_SIZE];
+        uint8_t read_back[PICOQUIC_RESUMPTION_KEY_SIZE];
+        uint32_t key_id;
+
+        (void)picoquic_resumption_store_unlink(RESUMPTION_STORE_TEST_NAME);
+        first = picoquic_resumption_store_create(RESUMPTION_STORE_TEST_NAME, RESUMPTION_STORE_TEST_SLOTS);
+        second = picoquic_resumption_store_create(RESUMPTION_STORE_TEST_NAME, 2 * RESUMPTION_STORE_TEST_SLOTS);
+
+        if (first == NULL || second == NULL) {
+            ret = -1;
+        } else {
+            memset(secret, 0x5A, sizeof(secret));
+            key_id = picoquic_resumption_store_rotate_key(first, secret, sizeof(secret));
+            if (second->shared->nb_strike_slots != RESUMPTION_STORE_TEST_SLOTS ||
+                picoquic_resumption_store_get_key(second, key_id, read_back) != key_id ||
+                memcmp(read_back, secret, sizeof(secret)) != 0 ||
+                picoquic_resumption_store_strike(first, 0x0102030405060708ull, 1000000) != 0 ||
+                picoquic_resumption_store_strike(second, 0x0102030405060708ull, 1000000) != 1) {
+                ret = -1;
+            }
+        }
+        picoquic_resumption_store_release(first);
+        picoquic_resumption_store_release(second);
+        if (picoquic_resumption_store_unlink(RESUMPTION_STORE_TEST_NAME) != 0) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+/* Enough packets for the index to grow at least once */
+#define RETRANSMIT_INDEX_TEST_NB 200
+
+static void retransmit_index_test_queue(picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* packet)
+{
+    packet->previous_packet = NULL;
+    packet->next_packet = pkt_ctx->retransmit_newest;
+    if (pkt_ctx->retransmit_newest == NULL) {
+        pkt_ctx->retransmit_oldest = packet;
+    } else {
+        pkt_ctx->retransmit_newest->previous_packet = packet;
+    }
+    pkt_ctx->retransmit_newest = packet;
+    picoquic_retransmit_index_add(pkt_ctx, packet);
+}
+
+static void retransmit_index_test_dequeue(picoquic_packet_context_t* pkt_ctx, picoquic_packet_t* packet)
+{
+    if (packet->previous_packet == NULL) {
+        pkt_ctx->retransmit_newest = packet->next_packet;
+    } else {
+        packet->previous_packet->next_packet = packet->next_packet;
+    }
+    if (packet->next_packet == NULL) {
+        pkt_ctx->retransmit_oldest = packet->previous_packet;
+    } else {
+        packet->next_packet->previous_packet = packet->previous_packet;
+    }
+    picoquic_retransmit_index_remove(pkt_ctx, packet);
+}
+
+int retransmit_index_test()
+{
+    int ret = 0;
+    picoquic_packet_context_t pkt_ctx;
+    picoquic_packet_t* packets = calloc(RETRANSMIT_INDEX_TEST_NB, sizeof(picoquic_packet_t));
+
+    if (packets == NULL) {
+        return -1;
+    }
+    memset(&pkt_ctx, 0, sizeof(pkt_ctx));
+
+    /* Odd packet numbers only, as if the even ones were sent in another context */
+    for (int i = 0; i < RETRANSMIT_INDEX_TEST_NB; i++) {
+        packets[i].sequence_number = 2 * i + 1;
+        retransmit_index_test_queue(&pkt_ctx, &packets[i]);
+    }
+    if (pkt_ctx.retransmit_index == NULL || pkt_ctx.retransmit_index_mask < 2 * RETRANSMIT_INDEX_TEST_NB) {
+        ret = -1;
+    }
+
+    /* The floor is the packet itself when queued, else the next older one */
+    for (int i = 0; ret == 0 && i < RETRANSMIT_INDEX_TEST_NB; i++) {
+        if (picoquic_retransmit_index_floor(&pkt_ctx, pkt_ctx.retransmit_newest, 2 * i + 1) != &packets[i] ||
+            picoquic_retransmit_index_floor(&pkt_ctx, pkt_ctx.retransmit_newest, 2 * i + 2) != &packets[i]) {
+            ret = -1;
+        }
+    }
+    if (ret == 0 && picoquic_retransmit_index_floor(&pkt_ctx, pkt_ctx.retransmit_newest, 0) != NULL) {
+        ret = -1;
+    }
+
+    /* Dequeued packets are not found anymore */
+    retransmit_index_test_dequeue(&pkt_ctx, &packets[10]);
+    retransmit_index_test_dequeue(&pkt_ctx, &packets[0]);
+    if (ret == 0 && (picoquic_retransmit_index_floor(&pkt_ctx, pkt_ctx.retransmit_newest, 21) != &packets[9] ||
+        picoquic_retransmit_index_floor(&pkt_ctx, pkt_ctx.retransmit_newest, 2) != NULL)) {
+        ret = -1;
+    }
+
+    /* An out of order queue is still searched, by walking it */
+    packets[0].sequence_number = 5;
+    retransmit_index_test_queue(&pkt_ctx, &packets[0]);
+    if (ret == 0 && (pkt_ctx.retransmit_index != NULL || !pkt_ctx.retransmit_index_broken ||
+        picoquic_retransmit_index_floor(&pkt_ctx, pkt_ctx.retransmit_newest->next_packet, 21) != &packets[9])) {
+        ret = -1;
+    }
+
+    /* Once emptied, the queue is indexed again */
+    while (pkt_ctx.retransmit_newest != NULL) {
+        retransmit_index_test_dequeue(&pkt_ctx, pkt_ctx.retransmit_newest);
+    }
+    retransmit_index_test_queue(&pkt_ctx, &packets[1]);
+    if (ret == 0 && (pkt_ctx.retransmit_index_broken || pkt_ctx.retransmit_index == NULL ||
+        picoquic_retransmit_index_floor(&pkt_ctx, pkt_ctx.retransmit_newest, 3) != &packets[1])) {
+        ret = -1;
+    }
+
+    picoquic_retransmit_index_free(&pkt_ctx);
+    free(packets);
+
+    return ret;
+}
+
+/* The loss time threshold is 9/8 of the largest RTT, widened after spurious losses */
+int loss_threshold_test()
+{
+    int ret = 0;
+    picoquic_path_t* path_x = (picoquic_path_t*)malloc(sizeof(picoquic_path_t));
+
+    if (path_x == NULL) {
+        return -1;
+    }
+    memset(path_x, 0, sizeof(picoquic_path_t));
+    path_x->smoothed_rtt = 80000;
+    path_x->rtt_sample = 40000;
+
+    if (picoquic_loss_time_threshold(path_x) != 90000) {
+        ret = -1;
+    }
+
+    /* A latest RTT above the smoothed one is used instead */
+    if (ret == 0) {
+        path_x->rtt_sample = 160000;
+        if (picoquic_loss_time_threshold(path_x) != 180000) {
+            ret = -1;
+        }
+    }
+
+    /* Each spurious loss adds 1/8 of RTT */
+    if (ret == 0) {
+        path_x->reorder_window_mult = 2;
+        if (picoquic_loss_time_threshold(path_x) != 220000) {
+            ret = -1;
+        }
+    }
+
+    /* Never below the timer granularity */
+    if (ret == 0) {
+        path_x->smoothed_rtt = 100;
+        path_x->rtt_sample = 100;
+        if (picoquic_loss_time_threshold(path_x) != PICOQUIC_ACK_DELAY_MIN) {
+            ret = -1;
+        }
+    }
+
+    free(path_x);
+
+    return ret;
+}
+
+/* The probe timeout leaves out the ack delay before the application space, doubles with each probe, and runs from the last ack-eliciting packet */
+int pto_test()
+{
+    int ret = 0;
+    picoquic_packet_t packet;
+    picoquic_path_t* path_x = (picoquic_path_t*)malloc(sizeof(picoquic_path_t));
+
+    if (path_x == NULL) {
+        return -1;
+    }
+    memset(path_x, 0, sizeof(picoquic_path_t));
+    memset(&packet, 0, sizeof(packet));
+    path_x->retransmit_timer = 125000;
+    path_x->max_ack_delay = 25000;
+
+    if (picoquic_pto_duration(path_x, picoquic_packet_context_application) != 125000 ||
+        picoquic_pto_duration(path_x, picoquic_packet_context_handshake) != 100000) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        path_x->pkt_ctx[picoquic_packet_context_application].nb_retransmit = 2;
+        if (picoquic_pto_duration(path_x, picoquic_packet_context_application) != 500000) {
+            ret = -1;
+        }
+        path_x->pkt_ctx[picoquic_packet_context_application].nb_retransmit = 0;
+    }
+
+    /* Never below the minimum timer */
+    if (ret == 0) {
+        path_x->retransmit_timer = 30000;
+        if (picoquic_pto_duration(path_x, picoquic_packet_context_initial) != PICOQUIC_MIN_RETRANSMIT_TIMER) {
+            ret = -1;
+        }
+        path_x->retransmit_timer = 125000;
+    }
+
+    if (ret == 0) {
+        packet.send_time = 1000000;
+        if (picoquic_pto_time(path_x, picoquic_packet_context_application, &packet) != 1125000) {
+            ret = -1;
+        }
+        path_x->pkt_ctx[picoquic_packet_context_application].latest_ack_eliciting_time = 1050000;
+        if (picoquic_pto_time(path_x, picoquic_packet_context_application, &packet) != 1175000) {
+            ret = -1;
+        }
+    }
+
+    free(path_x);
+
+    return ret;
+}
@@ -78,7 +78,6 @@ int sacktest()
     memset(&cnx, 0, sizeof(cnx));
 
     memset(&path_x, 0, sizeof(path_x));
-    path_x.pkt_ctx[pc].first_sack_item.start_of_sack_range = (uint64_t)((int64_t)-1);
 
     /* Do a basic test with packet zero */
 
@@ -94,15 +93,15 @@ int sacktest()
         ret = -1;
     }
 
-    if (path_x.pkt_ctx[pc].first_sack_item.start_of_sack_range != 0 ||
-        path_x.pkt_ctx[pc].first_sack_item.end_of_sack_range != 0 ||
-        path_x.pkt_ctx[pc].first_sack_item.next_sack != NULL) {
+    if (picoquic_sack_list_first(&path_x.pkt_ctx[pc].sack_list)->start_of_sack_range != 0 ||
+        picoquic_sack_list_first(&path_x.pkt_ctx[pc].sack_list)->end_of_sack_range != 0 ||
+        path_x.pkt_ctx[pc].sack_list.nb_ranges != 1) {
         ret = -1;
     }
     else {
         /* reset for the next test */
+        picoquic_sack_list_free(&path_x.pkt_ctx[pc].sack_list);
         memset(&path_x, 0, sizeof(path_x));
-        path_x.pkt_ctx[pc].first_sack_item.start_of_sack_range = (uint64_t)((int64_t)-1);
     }
 
     for (size_t i = 0; ret == 0 && i < nb_test_pn64; i++) {
@@ -135,20 +134,16 @@ int sacktest()
     }
 
     if (ret == 0) {
-        if (path_x.pkt_ctx[pc].first_sack_item.end_of_sack_range != 21 || 
-            path_x.pkt_ctx[pc].first_sack_item.start_of_sack_range != 0 || 
+        if (picoquic_sack_list_first(&path_x.pkt_ctx[pc].sack_list)->end_of_sack_range != 21 || 
+            picoquic_sack_list_first(&path_x.pkt_ctx[pc].sack_list)->start_of_sack_range != 0 || 
             path_x.pkt_ctx[pc].time_stamp_largest_received != highest_seen_time ||
-            path_x.pkt_ctx[pc].first_sack_item.next_sack != NULL) {
+            path_x.pkt_ctx[pc].sack_list.nb_ranges != 1) {
             ret = -1;
         }
     }
 
     /* Reset the sack lists*/
-    while (path_x.pkt_ctx[pc].first_sack_item.next_sack != NULL) {
-        picoquic_sack_item_t * next = path_x.pkt_ctx[pc].first_sack_item.next_sack;
-        path_x.pkt_ctx[pc].first_sack_item.next_sack = next->next_sack;
-        free(next);
-    }
+    picoquic_sack_list_free(&path_x.pkt_ctx[pc].sack_list);
 
     return ret;
 }
@@ -288,7 +283,6 @@ int sendacktest()
     memset(&cnx, 0, sizeof(cnx));
     picoquic_create_path(&cnx, current_time, (struct sockaddr *) &addr);
     picoquic_path_t *path_x = cnx.path[0];
-    path_x->pkt_ctx[pc].first_sack_item.start_of_sack_range = (uint64_t)((int64_t)-1);
     register_protocol_operations(&cnx);
 
     for (size_t i = 0; ret == 0 && i < nb_test_pn64; i++) {
@@ -341,11 +335,10 @@ int ackrange_test()
 {
     int ret = 0;
     picoquic_cnx_t cnx;
-    picoquic_sack_item_t sack0;
+    picoquic_sack_list_t sack0;
 
     memset(&cnx, 0, sizeof(picoquic_cnx_t));
-    memset(&sack0, 0, sizeof(picoquic_sack_item_t));
-    sack0.start_of_sack_range = (uint64_t)((int64_t)-1);
+    picoquic_sack_list_init(&sack0);
 
     for (size_t i = 0; i < nb_ack_range; i++) {
         ret = picoquic_check_sack_list(&sack0,
@@ -370,17 +363,87 @@ int ackrange_test()
         }
     }
 
-    if (ret == 0 && sack0.start_of_sack_range != 0) {
+    if (ret == 0 && picoquic_sack_list_first(&sack0)->start_of_sack_range != 0) {
         ret = -1;
     }
 
-    if (ret == 0 && sack0.end_of_sack_range != 7500) {
+    if (ret == 0 && picoquic_sack_list_first(&sack0)->end_of_sack_range != 7500) {
         ret = -1;
     }
 
-    if (ret == 0 && sack0.next_sack != NULL) {
+    if (ret == 0 && sack0.nb_ranges != 1) {
         ret = -1;
     }
 
+    picoquic_sack_list_free(&sack0);
+
+    return ret;
+}
+
+#define SACK_LIST_TEST_RANGES 257
+
+/*
+ * Receive every other number in a scrambled order, so that the list grows
+ * past its inline items with insertions at both ends and in the middle,
+ * then fill the holes until a single range remains.
+ */
+int sack_list_test()
+{
+    int ret = 0;
+    picoquic_cnx_t cnx;
+    picoquic_sack_list_t sacks;
+
+    memset(&cnx, 0, sizeof(picoquic_cnx_t));
+    picoquic_sack_list_init(&sacks);
+
+    for (uint64_t i = 0; ret == 0 && i < SACK_LIST_TEST_RANGES; i++) {
+        uint64_t pn = 2 * ((i * 101) % SACK_LIST_TEST_RANGES);
+
+        if (picoquic_update_sack_list(&cnx, &sacks, pn, pn) != 0 ||
+            picoquic_update_sack_list(&cnx, &sacks, pn, pn) != 1 ||
+            sacks.nb_ranges != i + 1) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_sack_item_t* item = picoquic_sack_list_first(&sacks);
+        uint64_t expected = 2 * (SACK_LIST_TEST_RANGES - 1);
+
+        for (uint32_t i = 0; ret == 0 && i < sacks.nb_ranges; i++, item++, expected -= 2) {
+            if (item->start_of_sack_range != expected || item->end_of_sack_range != expected) {
+                ret = -1;
+            }
+        }
+
+        if (ret == 0 && item->start_of_sack_range != (uint64_t)((int64_t)-1)) {
+            ret = -1;
+        }
+    }
+
+    for (uint64_t i = 0; ret == 0 && i + 1 < SACK_LIST_TEST_RANGES; i++) {
+        uint64_t pn = 2 * ((i * 101) % (SACK_LIST_TEST_RANGES - 1)) + 1;
+
+        if (picoquic_update_sack_list(&cnx, &sacks, pn, pn) != 0 ||
+            sacks.nb_ranges != SACK_LIST_TEST_RANGES - 1 - i) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && (sacks.nb_ranges != 1 || picoquic_sack_list_first(&sacks)->start_of_sack_range != 0 ||
+        picoquic_sack_list_first(&sacks)->end_of_sack_range != 2 * (SACK_LIST_TEST_RANGES - 1))) {
+        ret = -1;
+    }
+
+    /* Acknowledging the start of the highest range trims it */
+    if (ret == 0) {
+        picoquic_sack_list_ack_of_ack(&sacks, 0, 200);
+        if (sacks.nb_ranges != 1 || picoquic_sack_list_first(&sacks)->start_of_sack_range != 201) {
+            ret = -1;
+        }
+    }
+
+    picoquic_sack_list_free(&sacks);
+
     return ret;
 }
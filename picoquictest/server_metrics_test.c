@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "server_metrics.h"
+
+#define SERVER_METRICS_TEST_NB_CHILDREN 4
+#define SERVER_METRICS_TEST_NB_SAMPLES 1000
+#define SERVER_METRICS_TEST_NAME "/pquic_server_metrics_test"
+#define SERVER_METRICS_TEST_TEXT_SIZE 32768
+
+static void server_metrics_test_sample(picoquic_server_metrics_sample_t* sample, uint64_t rtt)
+{
+    memset(sample, 0, sizeof(picoquic_server_metrics_sample_t));
+    sample->duration = 1000000;
+    sample->smoothed_rtt = rtt;
+    sample->cwnd = 15000;
+    sample->bytes_sent = 110000;
+    sample->bytes_lost = 10000;
+    sample->packets_sent = 100;
+    sample->packets_lost = 1;
+    sample->streams_opened = 2;
+}
+
+/* The histograms put each value in the smallest bucket above it */
+static int server_metrics_test_buckets(picoquic_server_metrics_t* metrics)
+{
+    int ret = 0;
+    picoquic_server_metrics_sample_t sample;
+    picoquic_server_metrics_shared_t snapshot;
+    uint64_t rtts[] = { 0, 1, 2, 3, 1024, 1025, UINT64_MAX };
+    int buckets[] = { 0, 0, 1, 2, 10, 11, PICOQUIC_SERVER_METRICS_BUCKETS - 1 };
+
+    for (size_t i = 0; i < sizeof(rtts) / sizeof(rtts[0]); i++) {
+        server_metrics_test_sample(&sample, rtts[i]);
+        picoquic_server_metrics_merge(metrics, &sample);
+    }
+    /* A failed handshake is counted, but not in the histograms */
+    server_metrics_test_sample(&sample, 100);
+    sample.handshake_failed = 1;
+    picoquic_server_metrics_merge(metrics, &sample);
+
+    picoquic_server_metrics_snapshot(metrics, &snapshot);
+    for (size_t i = 0; i < sizeof(rtts) / sizeof(rtts[0]); i++) {
+        int nb_expected = 0;
+        for (size_t j = 0; j < sizeof(rtts) / sizeof(rtts[0]); j++) {
+            nb_expected += buckets[j] == buckets[i];
+        }
+        if (snapshot.histograms[picoquic_server_metrics_rtt].buckets[buckets[i]] != (uint64_t)nb_expected) {
+            ret = -1;
+        }
+    }
+    if (snapshot.counters[picoquic_server_metrics_connections] != 8 ||
+        snapshot.counters[picoquic_server_metrics_handshake_failures] != 1 ||
+        snapshot.histograms[picoquic_server_metrics_rtt].count != 7 ||
+        snapshot.histograms[picoquic_server_metrics_loss_rate].buckets[14] != 7 || /* 10000 per million */
+        snapshot.histograms[picoquic_server_metrics_goodput].buckets[17] != 7) { /* 100000 bytes per second */
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* The merges of the processes forked after the creation all go in the same metrics */
+static int server_metrics_test_fork(picoquic_server_metrics_t* metrics)
+{
+    int ret = 0;
+    pid_t pids[SERVER_METRICS_TEST_NB_CHILDREN];
+    picoquic_server_metrics_shared_t snapshot;
+
+    for (int i = 0; i < SERVER_METRICS_TEST_NB_CHILDREN; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            ret = -1;
+        } else if (pids[i] == 0) {
+            picoquic_server_metrics_sample_t sample;
+
+            for (int j = 0; j < SERVER_METRICS_TEST_NB_SAMPLES; j++) {
+                server_metrics_test_sample(&sample, 50000);
+                picoquic_server_metrics_merge(metrics, &sample);
+            }
+            _exit(0);
+        }
+    }
+    for (int i = 0; i < SERVER_METRICS_TEST_NB_CHILDREN; i++) {
+        int status = 0;
+        if (pids[i] > 0 && (waitpid(pids[i], &status, 0) != pids[i] || !WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+            ret = -1;
+        }
+    }
+
+    picoquic_server_metrics_snapshot(metrics, &snapshot);
+    if (ret == 0 && (snapshot.counters[picoquic_server_metrics_connections] != SERVER_METRICS_TEST_NB_CHILDREN * SERVER_METRICS_TEST_NB_SAMPLES ||
+        snapshot.counters[picoquic_server_metrics_streams_opened] != 2 * SERVER_METRICS_TEST_NB_CHILDREN * SERVER_METRICS_TEST_NB_SAMPLES ||
+        snapshot.histograms[picoquic_server_metrics_rtt].buckets[16] != SERVER_METRICS_TEST_NB_CHILDREN * SERVER_METRICS_TEST_NB_SAMPLES ||
+        snapshot.histograms[picoquic_server_metrics_rtt].sum != 50000ull * SERVER_METRICS_TEST_NB_CHILDREN * SERVER_METRICS_TEST_NB_SAMPLES)) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int server_metrics_test_format(picoquic_server_metrics_t* metrics)
+{
+    int ret = 0;
+    picoquic_server_metrics_shared_t snapshot;
+    picoquic_server_metrics_sample_t sample;
+    char* text = malloc(SERVER_METRICS_TEST_TEXT_SIZE);
+
+    if (text == NULL) {
+        return -1;
+    }
+
+    server_metrics_test_sample(&sample, 3);
+    picoquic_server_metrics_merge(metrics, &sample);
+    picoquic_server_metrics_snapshot(metrics, &snapshot);
+
+    if (picoquic_server_metrics_format(&snapshot, "test_", text, SERVER_METRICS_TEST_TEXT_SIZE) <= 0 ||
+        strstr(text, "# TYPE test_connections_total counter\ntest_connections_total 1\n") == NULL ||
+        strstr(text, "test_rtt_microseconds_bucket{le=\"2\"} 0\ntest_rtt_microseconds_bucket{le=\"4\"} 1\n") == NULL ||
+        strstr(text, "test_rtt_microseconds_bucket{le=\"+Inf\"} 1\ntest_rtt_microseconds_sum 3\ntest_rtt_microseconds_count 1\n") == NULL) {
+        ret = -1;
+    }
+    /* Never truncated */
+    if (ret == 0 && picoquic_server_metrics_format(&snapshot, "test_", text, 256) != -1) {
+        ret = -1;
+    }
+    free(text);
+
+    return ret;
+}
+
+/* Two mappings of the same name share the metrics */
+static int server_metrics_test_named()
+{
+    int ret = 0;
+    picoquic_server_metrics_t* first;
+    picoquic_server_metrics_t* second;
+    picoquic_server_metrics_sample_t sample;
+
+    (void)picoquic_server_metrics_unlink(SERVER_METRICS_TEST_NAME);
+    first = picoquic_server_metrics_create(SERVER_METRICS_TEST_NAME);
+    second = picoquic_server_metrics_create(SERVER_METRICS_TEST_NAME);
+    if (first == NULL || second == NULL) {
+        ret = -1;
+    } else {
+        server_metrics_test_sample(&sample, 10);
+        picoquic_server_metrics_merge(first, &sample);
+        if (second->shared->counters[picoquic_server_metrics_connections] != 1) {
+            ret = -1;
+        }
+    }
+    picoquic_server_metrics_release(first);
+    picoquic_server_metrics_release(second);
+    (void)picoquic_server_metrics_unlink(SERVER_METRICS_TEST_NAME);
+
+    return ret;
+}
+
+int server_metrics_test()
+{
+    int ret = 0;
+    picoquic_server_metrics_t* metrics = picoquic_server_metrics_create(NULL);
+
+    if (metrics == NULL) {
+        return -1;
+    }
+    ret = server_metrics_test_buckets(metrics);
+    picoquic_server_metrics_release(metrics);
+
+    if (ret == 0) {
+        if ((metrics = picoquic_server_metrics_create(NULL)) == NULL) {
+            ret = -1;
+        } else {
+            ret = server_metrics_test_fork(metrics);
+            picoquic_server_metrics_release(metrics);
+        }
+    }
+
+    if (ret == 0) {
+        if ((metrics = picoquic_server_metrics_create(NULL)) == NULL) {
+            ret = -1;
+        } else {
+            ret = server_metrics_test_format(metrics);
+            picoquic_server_metrics_release(metrics);
+        }
+    }
+
+    if (ret == 0) {
+        ret = server_metrics_test_named();
+    }
+
+    return ret;
+}
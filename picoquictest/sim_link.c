@@ -31,25 +31,42 @@
 
 #include "../picoquic/picoquic_internal.h"
 #include "picoquictest_internal.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef _WINDOWS
+#define PICOQUICTEST_THREAD_LOCAL __declspec(thread)
+#else
+#define PICOQUICTEST_THREAD_LOCAL __thread
+#endif
+
+/* Packets kept for reuse, so that a long simulation does not allocate a packet per transmission */
+#define PICOQUICTEST_SIM_PACKET_POOL_MAX 16384
+
+static PICOQUICTEST_THREAD_LOCAL picoquictest_sim_packet_t* picoquictest_sim_packet_pool;
+static PICOQUICTEST_THREAD_LOCAL size_t picoquictest_sim_packet_pool_size;
+
+static uint64_t picoquictest_sim_link_picosec_per_byte(double data_rate_in_gps)
+{
+    double pico_d = (data_rate_in_gps <= 0) ? 0 : (8000.0 / data_rate_in_gps);
+    pico_d *= (1.024 * 1.024); /* account for binary units */
+    return (uint64_t)pico_d;
+}
 
 picoquictest_sim_link_t* picoquictest_sim_link_create(double data_rate_in_gps,
     uint64_t microsec_latency, uint64_t* loss_mask, uint64_t queue_delay_max, uint64_t current_time)
 {
     picoquictest_sim_link_t* link = (picoquictest_sim_link_t*)malloc(sizeof(picoquictest_sim_link_t));
     if (link != 0) {
-        double pico_d = (data_rate_in_gps <= 0) ? 0 : (8000.0 / data_rate_in_gps);
-        pico_d *= (1.024 * 1.024); /* account for binary units */
+        memset(link, 0, sizeof(picoquictest_sim_link_t));
         link->next_send_time = current_time;
         link->queue_time = current_time;
         link->queue_delay_max = queue_delay_max;
-        link->picosec_per_byte = pico_d; 
+        link->picosec_per_byte = picoquictest_sim_link_picosec_per_byte(data_rate_in_gps);
         link->microsec_latency = microsec_latency;
-        link->packets_dropped = 0;
-        link->packets_sent = 0;
-        link->first_packet = NULL;
-        link->last_packet = NULL;
         link->loss_mask = loss_mask;
+        link->random_context = 0xdeadbeefcafeull;
     }
 
     return link;
@@ -61,7 +78,7 @@ void picoquictest_sim_link_delete(picoquictest_sim_link_t* link)
 
     while ((packet = link->first_packet) != NULL) {
         link->first_packet = packet->next_packet;
-        free(packet);
+        picoquictest_sim_link_free_packet(packet);
     }
 
     free(link);
@@ -69,7 +86,15 @@ void picoquictest_sim_link_delete(picoquictest_sim_link_t* link)
 
 picoquictest_sim_packet_t* picoquictest_sim_link_create_packet()
 {
-    picoquictest_sim_packet_t* packet = (picoquictest_sim_packet_t*)malloc(sizeof(picoquictest_sim_packet_t));
+    picoquictest_sim_packet_t* packet = picoquictest_sim_packet_pool;
+
+    if (packet != NULL) {
+        picoquictest_sim_packet_pool = packet->next_packet;
+        picoquictest_sim_packet_pool_size--;
+    } else {
+        packet = (picoquictest_sim_packet_t*)malloc(sizeof(picoquictest_sim_packet_t));
+    }
+
     if (packet != NULL) {
         packet->next_packet = NULL;
         packet->sent_time = 0;
@@ -80,6 +105,64 @@ picoquictest_sim_packet_t* picoquictest_sim_link_create_packet()
     return packet;
 }
 
+void picoquictest_sim_link_free_packet(picoquictest_sim_packet_t* packet)
+{
+    if (picoquictest_sim_packet_pool_size < PICOQUICTEST_SIM_PACKET_POOL_MAX) {
+        packet->next_packet = picoquictest_sim_packet_pool;
+        picoquictest_sim_packet_pool = packet;
+        picoquictest_sim_packet_pool_size++;
+    } else {
+        free(packet);
+    }
+}
+
+void picoquictest_sim_packet_pool_clear()
+{
+    picoquictest_sim_packet_t* packet;
+
+    while ((packet = picoquictest_sim_packet_pool) != NULL) {
+        picoquictest_sim_packet_pool = packet->next_packet;
+        free(packet);
+    }
+    picoquictest_sim_packet_pool_size = 0;
+}
+
+void picoquictest_sim_link_set_trace(picoquictest_sim_link_t* link, const picoquictest_sim_link_step_t* trace,
+    size_t nb_steps, uint64_t period, uint64_t current_time)
+{
+    link->trace = (nb_steps > 0) ? trace : NULL;
+    link->nb_trace_steps = nb_steps;
+    link->trace_index = 0;
+    link->trace_start = current_time;
+    link->trace_period = period;
+    if (link->trace != NULL) {
+        link->picosec_per_byte = picoquictest_sim_link_picosec_per_byte(trace[0].data_rate_in_gps);
+        link->loss_per_million = trace[0].loss_per_million;
+    } else {
+        link->loss_per_million = 0;
+    }
+}
+
+/* Moves to the step of the trace in which the current time falls, the time only goes forward within a period */
+static void picoquictest_sim_link_follow_trace(picoquictest_sim_link_t* link, uint64_t current_time)
+{
+    uint64_t trace_time = (current_time > link->trace_start) ? current_time - link->trace_start : 0;
+    size_t index = link->trace_index;
+
+    if (link->trace_period > 0) {
+        trace_time %= link->trace_period;
+    }
+    if (trace_time < link->trace[index].start_time) {
+        index = 0;
+    }
+    while (index + 1 < link->nb_trace_steps && link->trace[index + 1].start_time <= trace_time) {
+        index++;
+    }
+    link->trace_index = index;
+    link->picosec_per_byte = picoquictest_sim_link_picosec_per_byte(link->trace[index].data_rate_in_gps);
+    link->loss_per_million = link->trace[index].loss_per_million;
+}
+
 uint64_t picoquictest_sim_link_next_arrival(picoquictest_sim_link_t* link, uint64_t current_time)
 {
     picoquictest_sim_packet_t* packet = link->first_packet;
@@ -91,6 +174,8 @@ uint64_t picoquictest_sim_link_next_arrival(picoquictest_sim_link_t* link, uint6
     return current_time;
 }
 
+static void picoquictest_sim_net_update(picoquictest_sim_net_t* net, size_t index);
+
 picoquictest_sim_packet_t* picoquictest_sim_link_dequeue(picoquictest_sim_link_t* link,
     uint64_t current_time)
 {
@@ -101,6 +186,9 @@ picoquictest_sim_packet_t* picoquictest_sim_link_dequeue(picoquictest_sim_link_t
         if (link->first_packet == NULL) {
             link->last_packet = NULL;
         }
+        if (link->net != NULL) {
+            picoquictest_sim_net_update(link->net, link->net_index);
+        }
     } else {
         packet = NULL;
     }
@@ -128,7 +216,12 @@ void picoquictest_sim_link_submit(picoquictest_sim_link_t* link, picoquictest_si
     uint64_t current_time)
 {
     uint64_t queue_delay = (current_time > link->queue_time) ? 0 : link->queue_time - current_time;
-    uint64_t transmit_time = ((link->picosec_per_byte * packet->length) >> 20);
+    uint64_t transmit_time;
+
+    if (link->trace != NULL) {
+        picoquictest_sim_link_follow_trace(link, current_time);
+    }
+    transmit_time = ((link->picosec_per_byte * packet->length) >> 20);
     if (transmit_time <= 0)
         transmit_time = 1;
 
@@ -136,9 +229,10 @@ void picoquictest_sim_link_submit(picoquictest_sim_link_t* link, picoquictest_si
 
         link->queue_time = current_time + queue_delay + transmit_time;
 
-        if (picoquictest_sim_link_testloss(link->loss_mask) != 0) {
+        if (picoquictest_sim_link_testloss(link->loss_mask) != 0 || (link->loss_per_million > 0 &&
+            picoquic_test_uniform_random(&link->random_context, 1000000) < link->loss_per_million)) {
             link->packets_dropped++;
-            free(packet);
+            picoquictest_sim_link_free_packet(packet);
         } else {
             link->packets_sent++;
             if (link->last_packet == NULL) {
@@ -149,14 +243,117 @@ void picoquictest_sim_link_submit(picoquictest_sim_link_t* link, picoquictest_si
             link->last_packet = packet;
             packet->next_packet = NULL;
             packet->arrival_time = link->queue_time + link->microsec_latency;
+            if (link->net != NULL && link->first_packet == packet) {
+                picoquictest_sim_net_update(link->net, link->net_index);
+            }
         }
     } else {
         /* simulate congestion loss on queue full */
         link->packets_dropped++;
-        free(packet);
+        picoquictest_sim_link_free_packet(packet);
     }
 }
 
+/*
+ * The network keeps its links in a binary heap, ordered by the arrival time of their first packet,
+ * so that the next arrival in a topology of many links is found without visiting all of them. The
+ * links update their position when their first packet changes.
+ */
+#define PICOQUICTEST_SIM_NET_MIN_SIZE 8
+
+static uint64_t picoquictest_sim_net_key(picoquictest_sim_link_t* link)
+{
+    return (link->first_packet == NULL) ? UINT64_MAX : link->first_packet->arrival_time;
+}
+
+static void picoquictest_sim_net_set(picoquictest_sim_net_t* net, size_t index, picoquictest_sim_link_t* link)
+{
+    net->heap[index] = link;
+    link->net_index = index;
+}
+
+static void picoquictest_sim_net_update(picoquictest_sim_net_t* net, size_t index)
+{
+    picoquictest_sim_link_t* link = net->heap[index];
+    uint64_t key = picoquictest_sim_net_key(link);
+
+    while (index > 0 && key < picoquictest_sim_net_key(net->heap[(index - 1) / 2])) {
+        picoquictest_sim_net_set(net, index, net->heap[(index - 1) / 2]);
+        index = (index - 1) / 2;
+    }
+    for (;;) {
+        size_t child = 2 * index + 1;
+
+        if (child + 1 < net->nb_links && picoquictest_sim_net_key(net->heap[child + 1]) < picoquictest_sim_net_key(net->heap[child])) {
+            child++;
+        }
+        if (child >= net->nb_links || picoquictest_sim_net_key(net->heap[child]) >= key) {
+            break;
+        }
+        picoquictest_sim_net_set(net, index, net->heap[child]);
+        index = child;
+    }
+    picoquictest_sim_net_set(net, index, link);
+}
+
+picoquictest_sim_net_t* picoquictest_sim_net_create()
+{
+    picoquictest_sim_net_t* net = (picoquictest_sim_net_t*)malloc(sizeof(picoquictest_sim_net_t));
+
+    if (net != NULL) {
+        memset(net, 0, sizeof(picoquictest_sim_net_t));
+    }
+
+    return net;
+}
+
+void picoquictest_sim_net_delete(picoquictest_sim_net_t* net)
+{
+    for (size_t i = 0; i < net->nb_links; i++) {
+        picoquictest_sim_link_delete(net->heap[i]);
+    }
+    free(net->heap);
+    free(net);
+}
+
+int picoquictest_sim_net_add_link(picoquictest_sim_net_t* net, picoquictest_sim_link_t* link)
+{
+    if (net->nb_links >= net->max_links) {
+        size_t new_max = (net->max_links == 0) ? PICOQUICTEST_SIM_NET_MIN_SIZE : 2 * net->max_links;
+        picoquictest_sim_link_t** new_heap = (picoquictest_sim_link_t**)realloc(net->heap, new_max * sizeof(picoquictest_sim_link_t*));
+
+        if (new_heap == NULL) {
+            return -1;
+        }
+        net->heap = new_heap;
+        net->max_links = new_max;
+    }
+    link->net = net;
+    picoquictest_sim_net_set(net, net->nb_links++, link);
+    picoquictest_sim_net_update(net, link->net_index);
+
+    return 0;
+}
+
+uint64_t picoquictest_sim_net_next_arrival(picoquictest_sim_net_t* net, uint64_t current_time)
+{
+    return (net->nb_links > 0) ? picoquictest_sim_link_next_arrival(net->heap[0], current_time) : current_time;
+}
+
+picoquictest_sim_packet_t* picoquictest_sim_net_dequeue(picoquictest_sim_net_t* net, uint64_t current_time,
+    picoquictest_sim_link_t** link)
+{
+    picoquictest_sim_packet_t* packet = NULL;
+
+    /* The link may move down the heap when its packet leaves */
+    *link = (net->nb_links > 0) ? net->heap[0] : NULL;
+    if (*link != NULL && (packet = picoquictest_sim_link_dequeue(*link, current_time)) == NULL) {
+        *link = NULL;
+    }
+
+    return packet;
+}
+
 int sim_link_one_test(uint64_t* loss_mask, uint64_t queue_delay_max, uint64_t nb_losses)
 {
     int ret = 0;
@@ -182,7 +379,7 @@ int sim_link_one_test(uint64_t* loss_mask, uint64_t queue_delay_max, uint64_t nb
 
         if (packet != NULL) {
             dequeued++;
-            free(packet);
+            picoquictest_sim_link_free_packet(packet);
         } else if (queued < nb_packets) {
             packet = picoquictest_sim_link_create_packet();
 
@@ -232,3 +429,200 @@ int sim_link_test()
 
     return ret;
 }
+
+#define SIM_NET_TEST_NB_LINKS 3
+#define SIM_NET_TEST_NB_PACKETS 10
+
+/* Packets come back from the pool, and a network delivers the packets of its links in order of arrival */
+static int sim_net_one_test(picoquictest_sim_net_t* net)
+{
+    int ret = 0;
+    uint64_t latency[SIM_NET_TEST_NB_LINKS] = { 30000, 10000, 20000 };
+    uint64_t nb_received[SIM_NET_TEST_NB_LINKS] = { 0 };
+    picoquictest_sim_link_t* links[SIM_NET_TEST_NB_LINKS];
+    picoquictest_sim_link_t* link = NULL;
+    picoquictest_sim_packet_t* packet;
+    uint64_t last_arrival = 0;
+    uint64_t current_time = 0;
+
+    for (int i = 0; ret == 0 && i < SIM_NET_TEST_NB_LINKS; i++) {
+        if ((links[i] = picoquictest_sim_link_create(1.0, latency[i], NULL, 0, 0)) == NULL) {
+            ret = -1;
+        } else if (picoquictest_sim_net_add_link(net, links[i]) != 0) {
+            picoquictest_sim_link_delete(links[i]);
+            ret = -1;
+        }
+    }
+
+    for (uint64_t t = 0; ret == 0 && t < SIM_NET_TEST_NB_PACKETS * 5000; t += 5000) {
+        for (int i = 0; ret == 0 && i < SIM_NET_TEST_NB_LINKS; i++) {
+            if ((packet = picoquictest_sim_link_create_packet()) == NULL) {
+                ret = -1;
+            } else {
+                packet->length = 1000;
+                picoquictest_sim_link_submit(links[i], packet, t);
+            }
+        }
+    }
+
+    while (ret == 0 && (current_time = picoquictest_sim_net_next_arrival(net, UINT64_MAX)) != UINT64_MAX) {
+        if ((packet = picoquictest_sim_net_dequeue(net, current_time, &link)) == NULL || link == NULL ||
+            packet->arrival_time < last_arrival) {
+            ret = -1;
+        } else {
+            last_arrival = packet->arrival_time;
+            for (int i = 0; i < SIM_NET_TEST_NB_LINKS; i++) {
+                if (link == links[i]) {
+                    nb_received[i]++;
+                }
+            }
+            picoquictest_sim_link_free_packet(packet);
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < SIM_NET_TEST_NB_LINKS; i++) {
+        if (nb_received[i] != SIM_NET_TEST_NB_PACKETS) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/* The rate and random losses of a link follow its trace, which starts again after its period */
+static int sim_link_trace_test()
+{
+    int ret = 0;
+    const picoquictest_sim_link_step_t trace[3] = { { 0, 1.0, 0 }, { 1000, 0.1, 0 }, { 2000, 1.0, 500000 } };
+    const uint64_t expected_transmit[4] = { 7, 79, 7, 7 };
+    const uint64_t submit_time[4] = { 0, 1500, 3500, 99500 };
+    picoquictest_sim_link_t* link = picoquictest_sim_link_create(0.01, 10000, NULL, 0, 0);
+    picoquictest_sim_packet_t* packet;
+
+    if (link == NULL) {
+        return -1;
+    }
+    picoquictest_sim_link_set_trace(link, trace, 3, 3000, 0);
+
+    /* 1000 bytes take 7 us at 1 Gbps, 79 us at 100 Mbps, and 3.5 ms and 99.5 ms fall in the first step of a period */
+    for (int i = 0; ret == 0 && i < 4; i++) {
+        if ((packet = picoquictest_sim_link_create_packet()) == NULL) {
+            ret = -1;
+        } else {
+            packet->length = 1000;
+            picoquictest_sim_link_submit(link, packet, submit_time[i]);
+            if (link->queue_time != submit_time[i] + expected_transmit[i] || link->packets_dropped != 0) {
+                DBG_PRINTF("Packet %d submitted at %d leaves at %d\n", i, (int)submit_time[i], (int)link->queue_time);
+                ret = -1;
+            }
+        }
+    }
+
+    /* Half of the packets are lost in the third step */
+    for (uint64_t t = 2000; ret == 0 && t < 2500; t++) {
+        if ((packet = picoquictest_sim_link_create_packet()) == NULL) {
+            ret = -1;
+        } else {
+            packet->length = 100;
+            picoquictest_sim_link_submit(link, packet, t);
+        }
+    }
+    if (ret == 0 && (link->packets_dropped < 200 || link->packets_dropped > 300)) {
+        DBG_PRINTF("%d packets dropped out of 500\n", (int)link->packets_dropped);
+        ret = -1;
+    }
+
+    picoquictest_sim_link_delete(link);
+
+    return ret;
+}
+
+int sim_net_test()
+{
+    int ret = 0;
+    picoquictest_sim_packet_t* packet = picoquictest_sim_link_create_packet();
+    picoquictest_sim_net_t* net = picoquictest_sim_net_create();
+
+    if (packet == NULL || net == NULL) {
+        ret = -1;
+    } else {
+        picoquictest_sim_packet_t* reused;
+
+        picoquictest_sim_link_free_packet(packet);
+        reused = picoquictest_sim_link_create_packet();
+        if (reused != packet) {
+            ret = -1;
+        }
+        if (reused != NULL) {
+            picoquictest_sim_link_free_packet(reused);
+        }
+    }
+
+    if (ret == 0) {
+        ret = sim_net_one_test(net);
+    }
+
+    if (ret == 0) {
+        ret = sim_link_trace_test();
+    }
+
+    if (net != NULL) {
+        picoquictest_sim_net_delete(net);
+    }
+    picoquictest_sim_packet_pool_clear();
+
+    return ret;
+}
+
+/* A 10 Gbps link with 100 ms of latency, kept full for 500 ms, is simulated faster than real time */
+int sim_link_bench_test()
+{
+    int ret = 0;
+    const uint64_t duration = 500000;
+    uint64_t current_time = 0;
+    uint64_t nb_received = 0;
+    uint64_t wall_time_start = picoquic_current_time();
+    uint64_t wall_time;
+    picoquictest_sim_net_t* net = picoquictest_sim_net_create();
+    picoquictest_sim_link_t* link = picoquictest_sim_link_create(10.0, 100000, NULL, 0, 0);
+
+    if (net == NULL || link == NULL || picoquictest_sim_net_add_link(net, link) != 0) {
+        if (link != NULL) {
+            picoquictest_sim_link_delete(link);
+        }
+        ret = -1;
+    }
+
+    while (ret == 0 && current_time < duration) {
+        picoquictest_sim_packet_t* packet;
+        picoquictest_sim_link_t* arrival_link;
+
+        /* Deliver what arrived, then send when the link is free */
+        while ((packet = picoquictest_sim_net_dequeue(net, current_time, &arrival_link)) != NULL) {
+            nb_received++;
+            picoquictest_sim_link_free_packet(packet);
+        }
+        if (link->queue_time <= current_time) {
+            if ((packet = picoquictest_sim_link_create_packet()) == NULL) {
+                ret = -1;
+            } else {
+                packet->length = PICOQUIC_MAX_PACKET_SIZE;
+                picoquictest_sim_link_submit(link, packet, current_time);
+            }
+        }
+        current_time = picoquictest_sim_net_next_arrival(net, link->queue_time);
+    }
+    wall_time = picoquic_current_time() - wall_time_start;
+
+    fprintf(stderr, "Simulated %d packets over %d us in %d us\n", (int)link->packets_sent, (int)duration, (int)wall_time);
+    if (ret == 0 && (wall_time >= duration || nb_received == 0 || link->packets_sent < 100000)) {
+        ret = -1;
+    }
+
+    if (net != NULL) {
+        picoquictest_sim_net_delete(net);
+    }
+    picoquictest_sim_packet_pool_clear();
+
+    return ret;
+}
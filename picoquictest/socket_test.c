@@ -168,3 +168,639 @@ int socket_test()
 
     return ret;
 }
+
+int socket_gso_test()
+{
+    int ret = 0;
+    int test_port = 12346;
+    const int segment_size = 1000;
+    const int nb_segments = 3;
+    const int length = (nb_segments - 1) * segment_size + segment_size / 2;
+    uint64_t current_time = picoquic_current_time();
+    uint8_t message[3 * 1000];
+    uint8_t buffer[1536];
+    struct sockaddr_storage client_addr;
+    socklen_t client_addr_length = sizeof(client_addr);
+    struct sockaddr_storage addr_back;
+    socklen_t back_length;
+    picoquic_server_sockets_t server_sockets;
+    SOCKET_TYPE fd = INVALID_SOCKET;
+#ifdef _WINDOWS
+    WSADATA wsaData;
+
+    if (WSA_START(MAKEWORD(2, 2), &wsaData)) {
+        DBG_PRINTF("Cannot init WSA\n");
+        ret = -1;
+    }
+#endif
+
+    for (int i = 0; i < length; i++) {
+        message[i] = (uint8_t)(i / segment_size + i);
+    }
+
+    if (ret == 0 && picoquic_open_server_sockets(&server_sockets, test_port) != 0) {
+        ret = -1;
+    }
+
+    /* The client socket is bound to the loopback address, on which segmentation is always possible */
+    if (ret == 0) {
+        struct sockaddr_in* s4 = (struct sockaddr_in*)&client_addr;
+        memset(&client_addr, 0, sizeof(client_addr));
+        s4->sin_family = AF_INET;
+        s4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd == INVALID_SOCKET ||
+            bind(fd, (struct sockaddr*)&client_addr, sizeof(struct sockaddr_in)) != 0 ||
+            getsockname(fd, (struct sockaddr*)&client_addr, &client_addr_length) != 0) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && picoquic_send_segments_through_server_sockets(&server_sockets,
+        (struct sockaddr*)&client_addr, client_addr_length, NULL, 0, 0,
+        (const char*)message, length, segment_size, 0) != length) {
+        ret = -1;
+    }
+
+    /* Whether segmented by the kernel or sent one by one, the client receives separate datagrams */
+    for (int i = 0; ret == 0 && i < nb_segments; i++) {
+        int expected = (i < nb_segments - 1) ? segment_size : length - i * segment_size;
+        back_length = (socklen_t)sizeof(addr_back);
+        int bytes_recv = picoquic_select(&fd, 1, &addr_back, &back_length, NULL, NULL, NULL,
+            buffer, sizeof(buffer), 1000000, &current_time, NULL);
+
+        if (bytes_recv != expected || memcmp(buffer, message + i * segment_size, expected) != 0) {
+            ret = -1;
+        }
+    }
+
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+    picoquic_close_server_sockets(&server_sockets);
+
+    return ret;
+}
+
+int socket_batch_test()
+{
+    int ret = 0;
+    int test_port = 12347;
+    const int nb_datagrams = 5;
+    uint64_t current_time = picoquic_current_time();
+    uint8_t message[256];
+    uint8_t buffer[PICOQUIC_MAX_RECV_BATCH * 1536];
+    picoquic_recv_datagram_t datagrams[PICOQUIC_MAX_RECV_BATCH];
+    struct sockaddr_storage server_addr;
+    int server_addr_length = 0;
+    int is_name = 0;
+    picoquic_server_sockets_t server_sockets;
+    SOCKET_TYPE fd = INVALID_SOCKET;
+    int nb_received = 0;
+#ifdef _WINDOWS
+    WSADATA wsaData;
+
+    if (WSA_START(MAKEWORD(2, 2), &wsaData)) {
+        DBG_PRINTF("Cannot init WSA\n");
+        ret = -1;
+    }
+#endif
+
+    if (ret == 0 && (picoquic_open_server_sockets(&server_sockets, test_port) != 0 ||
+        picoquic_get_server_address("127.0.0.1", test_port, &server_addr, &server_addr_length, &is_name) != 0)) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd == INVALID_SOCKET) {
+            ret = -1;
+        }
+    }
+
+    /* Datagrams of different lengths, all queued before the server looks at its sockets */
+    for (int i = 0; ret == 0 && i < nb_datagrams; i++) {
+        memset(message, i, sizeof(message));
+        if (sendto(fd, (const char*)message, 100 + i, 0, (struct sockaddr*)&server_addr, server_addr_length) != 100 + i) {
+            ret = -1;
+        }
+    }
+
+    /* Without recvmmsg, the datagrams come one per call */
+    while (ret == 0 && nb_received < nb_datagrams) {
+        int nb = picoquic_select_batch(server_sockets.s_socket, PICOQUIC_NB_SERVER_SOCKETS,
+            datagrams + nb_received, PICOQUIC_MAX_RECV_BATCH - nb_received, buffer, 1536, 1000000, &current_time);
+
+        if (nb <= 0) {
+            ret = -1;
+        }
+        for (int i = nb_received; ret == 0 && i < nb_received + nb; i++) {
+            if (datagrams[i].length != 100 + i || datagrams[i].bytes[0] != i || datagrams[i].bytes[99 + i] != i ||
+                datagrams[i].segment_size != 0 || datagrams[i].from_length == 0 ||
+                datagrams[i].dest_length == 0 || datagrams[i].addr_dest.ss_family != AF_INET) {
+                ret = -1;
+            }
+        }
+        nb_received += nb;
+    }
+
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+    picoquic_close_server_sockets(&server_sockets);
+
+    return ret;
+}
+
+int socket_event_loop_test()
+{
+    int ret = 0;
+    int test_port = 12348;
+    uint64_t current_time = picoquic_current_time();
+    uint8_t message[128];
+    uint8_t buffer[4 * 1536];
+    picoquic_recv_datagram_t datagrams[4];
+    struct sockaddr_storage server_addr;
+    int server_addr_length = 0;
+    int is_name = 0;
+    picoquic_server_sockets_t server_sockets;
+    picoquic_event_loop_t* loop = NULL;
+    SOCKET_TYPE fd = INVALID_SOCKET;
+#ifdef _WINDOWS
+    WSADATA wsaData;
+
+    if (WSA_START(MAKEWORD(2, 2), &wsaData)) {
+        DBG_PRINTF("Cannot init WSA\n");
+        ret = -1;
+    }
+#endif
+
+    if (ret == 0 && (picoquic_open_server_sockets(&server_sockets, test_port) != 0 ||
+        picoquic_get_server_address("127.0.0.1", test_port, &server_addr, &server_addr_length, &is_name) != 0)) {
+        ret = -1;
+    }
+
+    if (ret == 0 && (loop = picoquic_event_loop_create()) == NULL) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < PICOQUIC_NB_SERVER_SOCKETS; i++) {
+        ret = picoquic_event_loop_add(loop, server_sockets.s_socket[i]);
+    }
+
+    /* Nothing to receive yet */
+    if (ret == 0 && picoquic_event_loop_recv_batch(loop, datagrams, 4, buffer, 1536, 1000, &current_time) != 0) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        memset(message, 0x5A, sizeof(message));
+        if (fd == INVALID_SOCKET ||
+            sendto(fd, (const char*)message, sizeof(message), 0, (struct sockaddr*)&server_addr, server_addr_length) != sizeof(message)) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && (picoquic_event_loop_recv_batch(loop, datagrams, 4, buffer, 1536, 1000000, &current_time) != 1 ||
+        datagrams[0].length != sizeof(message) || memcmp(datagrams[0].bytes, message, sizeof(message)) != 0 ||
+        datagrams[0].socket != server_sockets.s_socket[PICOQUIC_NB_SERVER_SOCKETS - 1])) {
+        ret = -1;
+    }
+
+    /* Once removed, a socket does not wake up the loop anymore */
+    if (ret == 0) {
+        SOCKET_TYPE ready[PICOQUIC_NB_SERVER_SOCKETS];
+        picoquic_event_loop_remove(loop, server_sockets.s_socket[PICOQUIC_NB_SERVER_SOCKETS - 1]);
+        if (sendto(fd, (const char*)message, sizeof(message), 0, (struct sockaddr*)&server_addr, server_addr_length) != sizeof(message) ||
+            picoquic_event_loop_wait(loop, 10000, ready, PICOQUIC_NB_SERVER_SOCKETS) != 0) {
+            ret = -1;
+        }
+    }
+
+    if (loop != NULL) {
+        picoquic_event_loop_free(loop);
+    }
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+    picoquic_close_server_sockets(&server_sockets);
+
+    return ret;
+}
+
+/* The spin returns a datagram as soon as it arrives, and otherwise blocks once the budget is spent */
+int socket_busy_poll_test()
+{
+    int ret = 0;
+    int test_port = 12351;
+    uint64_t current_time = 0;
+    uint64_t start_time;
+    uint8_t message[128];
+    uint8_t buffer[4 * 1536];
+    picoquic_recv_datagram_t datagrams[4];
+    struct sockaddr_storage server_addr;
+    int server_addr_length = 0;
+    int is_name = 0;
+    picoquic_server_sockets_t server_sockets;
+    picoquic_event_loop_t* loop = NULL;
+    picoquic_quic_t* quic = (picoquic_quic_t*)calloc(1, sizeof(picoquic_quic_t));
+    SOCKET_TYPE fd = INVALID_SOCKET;
+#ifdef _WINDOWS
+    WSADATA wsaData;
+
+    if (WSA_START(MAKEWORD(2, 2), &wsaData)) {
+        DBG_PRINTF("Cannot init WSA\n");
+        ret = -1;
+    }
+#endif
+
+    if (ret == 0 && (picoquic_open_server_sockets(&server_sockets, test_port) != 0 ||
+        picoquic_get_server_address("127.0.0.1", test_port, &server_addr, &server_addr_length, &is_name) != 0)) {
+        ret = -1;
+    }
+    if (quic == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0 && (loop = picoquic_event_loop_create()) == NULL) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < PICOQUIC_NB_SERVER_SOCKETS; i++) {
+        ret = picoquic_event_loop_add(loop, server_sockets.s_socket[i]);
+    }
+    if (ret == 0) {
+        /* Without the privilege to busy poll in the kernel, the loop still spins */
+        (void)picoquic_event_loop_set_busy_poll(loop, 2000, 50);
+        picoquic_event_loop_set_quic(loop, quic);
+    }
+
+    /* A timer shorter than the budget ends the spin, a longer one leads to a wait */
+    for (int64_t delta_t = 1000; ret == 0 && delta_t <= 5000; delta_t += 4000) {
+        start_time = picoquic_current_time();
+        if (picoquic_event_loop_recv_batch(loop, datagrams, 4, buffer, 1536, delta_t, &current_time) != 0 ||
+            current_time < start_time + (uint64_t)delta_t || quic->loop_time != current_time ||
+            picoquic_cached_time() != current_time) {
+            DBG_PRINTF("Wrong spin for a delay of %d us\n", (int)delta_t);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        memset(message, 0x5A, sizeof(message));
+        if (fd == INVALID_SOCKET ||
+            sendto(fd, (const char*)message, sizeof(message), 0, (struct sockaddr*)&server_addr, server_addr_length) != sizeof(message)) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        start_time = picoquic_current_time();
+        if (picoquic_event_loop_recv_batch(loop, datagrams, 4, buffer, 1536, 1000000, &current_time) != 1 ||
+            datagrams[0].length != sizeof(message) || memcmp(datagrams[0].bytes, message, sizeof(message)) != 0 ||
+            current_time - start_time >= 1000000) {
+            DBG_PRINTF("%s", "Datagram not received while spinning\n");
+            ret = -1;
+        }
+    }
+
+    if (loop != NULL) {
+        picoquic_event_loop_free(loop);
+    }
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+    picoquic_close_server_sockets(&server_sockets);
+    free(quic);
+
+    return ret;
+}
+
+/* Receives the datagrams sent through the ring on a plain socket */
+static int socket_uring_receive(SOCKET_TYPE fd, int nb_expected, int expected_length)
+{
+    int ret = 0;
+    uint8_t buffer[1536];
+    struct sockaddr_storage addr_from;
+    socklen_t from_length;
+    struct sockaddr_storage addr_dest;
+    socklen_t dest_length;
+    unsigned long dest_if;
+    uint64_t current_time;
+
+    for (int i = 0; ret == 0 && i < nb_expected; i++) {
+        int bytes_recv = picoquic_select(&fd, 1, &addr_from, &from_length, &addr_dest, &dest_length, &dest_if,
+            buffer, sizeof(buffer), 1000000, &current_time, NULL);
+        if (bytes_recv != expected_length) {
+            DBG_PRINTF("Received %d bytes instead of %d\n", bytes_recv, expected_length);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+int socket_uring_test()
+{
+    int ret = 0;
+    int test_port = 12352;
+    uint64_t current_time = 0;
+    uint8_t message[128];
+    picoquic_recv_datagram_t datagrams[4];
+    struct sockaddr_storage server_addr;
+    int server_addr_length = 0;
+    int is_name = 0;
+    int nb_received = 0;
+    picoquic_server_sockets_t server_sockets;
+    picoquic_uring_t* uring = NULL;
+    SOCKET_TYPE fd = INVALID_SOCKET;
+    struct sockaddr_storage client_addr;
+    socklen_t client_addr_length = sizeof(client_addr);
+
+    if (picoquic_open_server_sockets(&server_sockets, test_port) != 0 ||
+        picoquic_get_server_address("127.0.0.1", test_port, &server_addr, &server_addr_length, &is_name) != 0) {
+        return -1;
+    }
+
+    if ((uring = picoquic_uring_create(server_sockets.s_socket, PICOQUIC_NB_SERVER_SOCKETS, 1536, 4 * 1536)) == NULL) {
+        DBG_PRINTF("%s", "No io_uring or Registered I/O on this system, test skipped\n");
+        picoquic_close_server_sockets(&server_sockets);
+        return 0;
+    }
+
+    if (picoquic_uring_recv_batch(uring, datagrams, 4, 1000, &current_time) != 0) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        memset(message, 0x5A, sizeof(message));
+        for (int i = 0; ret == 0 && i < 3; i++) {
+            message[0] = (uint8_t)i;
+            if (fd == INVALID_SOCKET ||
+                sendto(fd, (const char*)message, sizeof(message), 0, (struct sockaddr*)&server_addr, server_addr_length) != sizeof(message)) {
+                ret = -1;
+            }
+        }
+    }
+
+    /* The datagrams point into the buffers of the ring, in the order they arrived */
+    while (ret == 0 && nb_received < 3) {
+        int nb = picoquic_uring_recv_batch(uring, datagrams, 2, 1000000, &current_time);
+
+        if (nb <= 0) {
+            ret = -1;
+        }
+        for (int i = 0; ret == 0 && i < nb; i++) {
+            if (datagrams[i].length != sizeof(message) || datagrams[i].bytes[0] != nb_received ||
+                memcmp(datagrams[i].bytes + 1, message + 1, sizeof(message) - 1) != 0 ||
+                datagrams[i].socket != server_sockets.s_socket[PICOQUIC_NB_SERVER_SOCKETS - 1] ||
+                datagrams[i].addr_from.ss_family != AF_INET || datagrams[i].dest_length == 0) {
+                DBG_PRINTF("Wrong datagram %d\n", nb_received);
+                ret = -1;
+            }
+            nb_received++;
+        }
+    }
+
+    /* One send, then one split in segments by the kernel, answering from the address the datagrams came to */
+    if (ret == 0 && getsockname(fd, (struct sockaddr*)&client_addr, &client_addr_length) != 0) {
+        ret = -1;
+    }
+    for (int nb_segments = 1; ret == 0 && nb_segments <= 3; nb_segments += 2) {
+        uint8_t* send_buffer = picoquic_uring_get_send_buffer(uring);
+
+        ((struct sockaddr_in*)&client_addr)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (send_buffer == NULL) {
+            ret = -1;
+        } else {
+            memset(send_buffer, 0xA5, nb_segments * 100);
+            if (picoquic_uring_queue_send(uring, datagrams[0].socket,
+                (struct sockaddr*)&client_addr, sizeof(struct sockaddr_in),
+                (struct sockaddr*)&datagrams[0].addr_dest, datagrams[0].dest_length, datagrams[0].dest_if,
+                nb_segments * 100, 100, 0) != 0 ||
+                picoquic_uring_submit(uring) != 0 ||
+                socket_uring_receive(fd, nb_segments, 100) != 0) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0 && (picoquic_uring_recv_batch(uring, datagrams, 4, 0, &current_time) != 0 ||
+        picoquic_uring_send_errors(uring) != 0)) {
+        DBG_PRINTF("%s", "The sends failed\n");
+        ret = -1;
+    }
+
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+    picoquic_close_server_sockets(&server_sockets);
+    picoquic_uring_free(uring);
+
+    return ret;
+}
+
+/* The kernel stamps the datagram on arrival, so a late read does not add to the delay seen by the RTT */
+int socket_rx_timestamp_test()
+{
+    int ret = 0;
+    int test_port = 12350;
+    uint64_t current_time = 0;
+    uint64_t sent_time = 0;
+    uint8_t message[128];
+    uint8_t buffer[4 * 1536];
+    picoquic_recv_datagram_t datagrams[4];
+    struct sockaddr_storage server_addr;
+    int server_addr_length = 0;
+    int is_name = 0;
+    picoquic_server_sockets_t server_sockets;
+    SOCKET_TYPE fd = INVALID_SOCKET;
+#ifdef _WINDOWS
+    WSADATA wsaData;
+
+    if (WSA_START(MAKEWORD(2, 2), &wsaData)) {
+        DBG_PRINTF("Cannot init WSA\n");
+        ret = -1;
+    }
+#endif
+
+    if (ret == 0 && (picoquic_open_server_sockets(&server_sockets, test_port) != 0 ||
+        picoquic_get_server_address("127.0.0.1", test_port, &server_addr, &server_addr_length, &is_name) != 0)) {
+        ret = -1;
+    }
+    if (ret == 0 && picoquic_enable_server_sockets_rx_timestamps(&server_sockets) != 0) {
+        /* Without kernel timestamps, the RTT is measured at the time of the read */
+        picoquic_close_server_sockets(&server_sockets);
+        return 0;
+    }
+
+    if (ret == 0) {
+        fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        memset(message, 0x3C, sizeof(message));
+        sent_time = picoquic_current_time();
+        if (fd == INVALID_SOCKET ||
+            sendto(fd, (const char*)message, sizeof(message), 0, (struct sockaddr*)&server_addr, server_addr_length) != sizeof(message)) {
+            ret = -1;
+        }
+    }
+
+    /* The datagram waits in the socket while the loop is busy */
+    while (ret == 0 && picoquic_current_time() < sent_time + 10000);
+
+    if (ret == 0) {
+        if (picoquic_select_batch(server_sockets.s_socket, PICOQUIC_NB_SERVER_SOCKETS,
+            datagrams, 4, buffer, 1536, 1000000, &current_time) != 1 || datagrams[0].length != sizeof(message)) {
+            ret = -1;
+        } else if (datagrams[0].rcv_time == 0 || datagrams[0].rcv_time > current_time ||
+            current_time - datagrams[0].rcv_time < 5000) {
+            DBG_PRINTF("Wrong receive time, %" PRIu64 " us before the read\n", current_time - datagrams[0].rcv_time);
+            ret = -1;
+        }
+    }
+
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+    picoquic_close_server_sockets(&server_sockets);
+
+    return ret;
+}
+
+static int socket_connected_receive(picoquic_server_sockets_t* server_sockets, int nb_expected, uint64_t* current_time)
+{
+    uint8_t buffer[4 * 1536];
+    picoquic_recv_datagram_t datagrams[4];
+    int nb_received = 0;
+
+    while (nb_received < nb_expected) {
+        int nb = picoquic_select_batch(server_sockets->s_socket, PICOQUIC_NB_SERVER_SOCKETS,
+            datagrams, 4, buffer, 1536, 1000000, current_time);
+
+        if (nb <= 0) {
+            break;
+        }
+        nb_received += nb;
+    }
+
+    return (nb_received == nb_expected) ? 0 : -1;
+}
+
+/* The first path takes over the initial socket, follows its peer, and the other paths get their own socket */
+int socket_connected_test()
+{
+    int ret = 0;
+    int test_port = 12349;
+    uint64_t current_time = picoquic_current_time();
+    uint8_t message[3][64];
+    uint8_t* packets[3] = { message[0], message[1], message[2] };
+    size_t lengths[3] = { 40, 50, 60 };
+    struct sockaddr_storage server_addr;
+    int server_addr_length = 0;
+    int is_name = 0;
+    picoquic_server_sockets_t server_sockets[2];
+    picoquic_connected_sockets_t connected_sockets;
+    picoquic_cnx_t* cnx = (picoquic_cnx_t*)calloc(1, sizeof(picoquic_cnx_t));
+    picoquic_path_t* paths = (picoquic_path_t*)calloc(2, sizeof(picoquic_path_t));
+    picoquic_path_t* path_table[2];
+    SOCKET_TYPE fd = INVALID_SOCKET;
+    SOCKET_TYPE fd_other = INVALID_SOCKET;
+    SOCKET_TYPE listed[PICOQUIC_MAX_CONNECTED_SOCKETS];
+    int nb_server_sockets = 0;
+#ifdef _WINDOWS
+    WSADATA wsaData;
+
+    if (WSA_START(MAKEWORD(2, 2), &wsaData)) {
+        DBG_PRINTF("Cannot init WSA\n");
+        ret = -1;
+    }
+#endif
+
+    memset(message, 0xC5, sizeof(message));
+    picoquic_init_connected_sockets(&connected_sockets, INVALID_SOCKET);
+
+    if (cnx == NULL || paths == NULL) {
+        ret = -1;
+    }
+    while (ret == 0 && nb_server_sockets < 2) {
+        if (picoquic_open_server_sockets(&server_sockets[nb_server_sockets], test_port + nb_server_sockets) != 0) {
+            ret = -1;
+        } else {
+            nb_server_sockets++;
+        }
+    }
+    if (ret == 0 && (picoquic_get_server_address("127.0.0.1", test_port, &server_addr, &server_addr_length, &is_name) != 0 ||
+        (fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        path_table[0] = &paths[0];
+        path_table[1] = &paths[1];
+        cnx->path = path_table;
+        cnx->nb_paths = 1;
+        memcpy(&paths[0].peer_addr, &server_addr, server_addr_length);
+        memcpy(&paths[1].peer_addr, &server_addr, server_addr_length);
+        ((struct sockaddr_in*)&paths[1].local_addr)->sin_family = AF_INET;
+        ((struct sockaddr_in*)&paths[1].local_addr)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        paths[1].local_addr_len = sizeof(struct sockaddr_in);
+        picoquic_init_connected_sockets(&connected_sockets, fd);
+
+        if (picoquic_get_connected_socket(&connected_sockets, cnx, &paths[0]) != fd ||
+            picoquic_send_connected(fd, packets, lengths, 3) != 3 ||
+            socket_connected_receive(&server_sockets[0], 3, &current_time) != 0 ||
+            picoquic_list_connected_sockets(&connected_sockets, listed, PICOQUIC_MAX_CONNECTED_SOCKETS) != 0) {
+            DBG_PRINTF("%s", "Cannot send through the initial socket\n");
+            ret = -1;
+        }
+    }
+
+    /* The peer moves to another port */
+    if (ret == 0) {
+        ((struct sockaddr_in*)&paths[0].peer_addr)->sin_port = htons((unsigned short)(test_port + 1));
+        if (picoquic_get_connected_socket(&connected_sockets, cnx, &paths[0]) != fd ||
+            picoquic_send_connected(fd, packets, lengths, 1) != 1 ||
+            socket_connected_receive(&server_sockets[1], 1, &current_time) != 0) {
+            DBG_PRINTF("%s", "Cannot follow the peer\n");
+            ret = -1;
+        }
+    }
+
+    /* A second path gets its own socket, closed once the path is gone */
+    if (ret == 0) {
+        cnx->nb_paths = 2;
+        fd_other = picoquic_get_connected_socket(&connected_sockets, cnx, &paths[1]);
+        if (fd_other == INVALID_SOCKET || fd_other == fd ||
+            picoquic_send_connected(fd_other, packets, lengths, 2) != 2 ||
+            socket_connected_receive(&server_sockets[0], 2, &current_time) != 0 ||
+            picoquic_list_connected_sockets(&connected_sockets, listed, PICOQUIC_MAX_CONNECTED_SOCKETS) != 1 ||
+            listed[0] != fd_other) {
+            DBG_PRINTF("%s", "Cannot send on a second path\n");
+            ret = -1;
+        }
+        cnx->nb_paths = 1;
+        if (ret == 0 && (picoquic_get_connected_socket(&connected_sockets, cnx, &paths[0]) != fd ||
+            connected_sockets.nb_sockets != 1 ||
+            picoquic_list_connected_sockets(&connected_sockets, listed, PICOQUIC_MAX_CONNECTED_SOCKETS) != 0)) {
+            DBG_PRINTF("%s", "The socket of the second path is still open\n");
+            ret = -1;
+        }
+    }
+
+    /* The initial socket outlives the connected sockets */
+    picoquic_close_connected_sockets(&connected_sockets);
+    if (ret == 0 && sendto(fd, (const char*)message[0], 10, 0, (struct sockaddr*)&server_addr, server_addr_length) != 10) {
+        ret = -1;
+    }
+
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+    for (int i = 0; i < nb_server_sockets; i++) {
+        picoquic_close_server_sockets(&server_sockets[i]);
+    }
+    free(cnx);
+    free(paths);
+
+    return ret;
+}
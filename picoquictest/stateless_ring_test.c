@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+/* Fills the ring, checks the overflow is counted, then that the packets come out in order and their slots are reused */
+int stateless_ring_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = calloc(1, sizeof(picoquic_quic_t));
+
+    if (quic == NULL || (quic->stateless_ring = (picoquic_stateless_packet_t*)malloc(
+        PICOQUIC_STATELESS_RING_SIZE * sizeof(picoquic_stateless_packet_t))) == NULL) {
+        ret = -1;
+    } else {
+        for (uint64_t i = 0; i < PICOQUIC_STATELESS_RING_SIZE; i++) {
+            quic->stateless_ring[i].ring_sequence = i;
+        }
+    }
+
+    for (int round = 0; ret == 0 && round < 3; round++) {
+        picoquic_stateless_packet_t* sp;
+        int nb_queued = 0;
+
+        while ((sp = picoquic_create_stateless_packet(quic)) != NULL) {
+            if (round == 0 && nb_queued == 0 && picoquic_dequeue_stateless_packet(quic) != NULL) {
+                /* Reserved but not queued yet */
+                ret = -1;
+            }
+            sp->length = nb_queued;
+            picoquic_queue_stateless_packet(quic, sp);
+            nb_queued++;
+        }
+
+        if (ret == 0 && (nb_queued != PICOQUIC_STATELESS_RING_SIZE ||
+            picoquic_create_stateless_packet(quic) != NULL ||
+            picoquic_get_stateless_packets_dropped(quic) != (uint64_t)(2 * (round + 1)))) {
+            ret = -1;
+        }
+
+        for (int i = 0; ret == 0 && i < PICOQUIC_STATELESS_RING_SIZE; i++) {
+            if ((sp = picoquic_dequeue_stateless_packet(quic)) == NULL || sp->length != (size_t)i) {
+                ret = -1;
+            } else {
+                picoquic_delete_stateless_packet(sp);
+            }
+        }
+
+        if (ret == 0 && picoquic_dequeue_stateless_packet(quic) != NULL) {
+            ret = -1;
+        }
+    }
+
+    if (quic != NULL) {
+        free(quic->stateless_ring);
+        free(quic);
+    }
+
+    return ret;
+}
@@ -178,24 +178,22 @@ static int StreamZeroFrameOneTest(struct test_case_st* test)
 
     if (ret == 0) {
         /* Check the content of all the data in the context */
-        picoquic_stream_data* data = cnx->first_stream->stream_data;
+        picoquic_stream_head* stream = cnx->first_stream;
+        const uint8_t* bytes = NULL;
+        size_t length;
         size_t data_rank = 0;
 
-        while (data != NULL) {
-            if (data->bytes == NULL) {
-                FAIL(test, "%s", "No data bytes");
-                ret = -1;
-            }
-
-            for (size_t i = 0; ret == 0 && i < data->length; i++) {
+        while (ret == 0 && (length = picoquic_stream_recv_peek(&stream->recv, stream->consumed_offset, &bytes)) > 0) {
+            for (size_t i = 0; ret == 0 && i < length; i++) {
                 data_rank++;
-                if (data->bytes[i] != data_rank) {
-                    FAIL(test, "byte %" PRIst " is %u instead of %" PRIst, i, data->bytes[i], data_rank);
+                if (bytes[i] != data_rank) {
+                    FAIL(test, "byte %" PRIst " is %u instead of %" PRIst, i, bytes[i], data_rank);
                     ret = -1;
                 }
             }
 
-            data = data->next_stream_data;
+            stream->consumed_offset += length;
+            picoquic_stream_recv_release(&stream->recv, stream->consumed_offset);
         }
 
         if (ret == 0 && data_rank != test->expected_length) {
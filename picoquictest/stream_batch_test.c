@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "stream_recv.h"
+
+#define STREAM_BATCH_TEST_NB_STREAMS 3
+#define STREAM_BATCH_TEST_CREDIT 4096
+
+/* Built-in implementation of the process_frame protocol operation of the STREAM frames, see frames.c */
+protoop_arg_t process_stream_frame(picoquic_cnx_t *cnx);
+
+/* The bytes of a span are those of the stream offsets, until they are consumed */
+static int stream_batch_test_check_bytes(picoquic_stream_span_t* span)
+{
+    for (size_t i = 0; i < span->length; i++) {
+        if (span->bytes[i] != (uint8_t)(span->offset + i)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+typedef struct st_stream_batch_test_ctx_t {
+    int nb_callbacks;
+    size_t nb_spans;
+    picoquic_stream_span_t spans[2 * STREAM_BATCH_TEST_NB_STREAMS];
+    /* Bytes the callback consumes on stream 0, the other streams are consumed entirely */
+    size_t consume_stream0;
+} stream_batch_test_ctx_t;
+
+static int stream_batch_test_callback(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* stream_ctx)
+{
+    stream_batch_test_ctx_t* ctx = (stream_batch_test_ctx_t*)callback_ctx;
+    picoquic_stream_span_t* spans = (picoquic_stream_span_t*)bytes;
+    picoquic_stream_consumed_t consumed[2 * STREAM_BATCH_TEST_NB_STREAMS];
+    size_t nb_consumed = 0;
+
+    if (fin_or_event != picoquic_callback_stream_batch || length > 2 * STREAM_BATCH_TEST_NB_STREAMS) {
+        return -1;
+    }
+    ctx->nb_callbacks++;
+    ctx->nb_spans = length;
+    memcpy(ctx->spans, spans, length * sizeof(picoquic_stream_span_t));
+
+    for (size_t i = 0; i < length; i++) {
+        if (stream_batch_test_check_bytes(&spans[i]) != 0) {
+            return -1;
+        }
+        consumed[nb_consumed].stream_id = spans[i].stream_id;
+        consumed[nb_consumed].length = (spans[i].stream_id == 0) ? ctx->consume_stream0 : spans[i].length;
+        nb_consumed++;
+    }
+
+    return picoquic_consume_stream_data(cnx, consumed, nb_consumed);
+}
+
+static int stream_batch_test_frame(picoquic_cnx_t* cnx, uint64_t stream_id, uint64_t offset, size_t length, int fin)
+{
+    uint8_t bytes[STREAM_BATCH_TEST_CREDIT];
+    stream_frame_t frame = { stream_id, length, offset, fin, 0, bytes };
+    protoop_arg_t inputv[4] = { (protoop_arg_t)&frame, 1000, 0, 0 };
+
+    for (size_t i = 0; i < length; i++) {
+        bytes[i] = (uint8_t)(offset + i);
+    }
+    cnx->protoop_inputv = inputv;
+    cnx->protoop_inputc = 4;
+
+    return (int)process_stream_frame(cnx);
+}
+
+static int stream_batch_test_check_span(picoquic_stream_span_t* span, uint64_t stream_id, uint64_t offset, size_t length, int is_fin)
+{
+    return (span->stream_id != stream_id || span->offset != offset || span->length != length || span->is_fin != is_fin) ? -1 : 0;
+}
+
+/* The frames of a batch only mark their streams readable, the application gets one callback per connection */
+int stream_batch_test()
+{
+    int ret = 0;
+    stream_batch_test_ctx_t ctx;
+    picoquic_stream_span_t spans[2];
+    picoquic_stream_consumed_t consumed = { 8, 1 };
+    picoquic_quic_t* quic = calloc(1, sizeof(picoquic_quic_t));
+    picoquic_cnx_t* cnx = calloc(1, sizeof(picoquic_cnx_t));
+    picoquic_stream_head* streams = calloc(STREAM_BATCH_TEST_NB_STREAMS, sizeof(picoquic_stream_head));
+
+    if (quic == NULL || cnx == NULL || streams == NULL) {
+        free(quic);
+        free(cnx);
+        free(streams);
+        return -1;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.consume_stream0 = 20;
+    picoquic_set_stream_batch_callbacks(quic, 1);
+    cnx->quic = quic;
+    cnx->callback_fn = stream_batch_test_callback;
+    cnx->callback_ctx = &ctx;
+    cnx->maxdata_local = STREAM_BATCH_TEST_NB_STREAMS * STREAM_BATCH_TEST_CREDIT;
+    for (int i = 0; i < STREAM_BATCH_TEST_NB_STREAMS; i++) {
+        streams[i].stream_id = 4 * i;
+        streams[i].maxdata_local = STREAM_BATCH_TEST_CREDIT;
+        streams[i].max_data_window = STREAM_BATCH_TEST_CREDIT;
+        streams[i].next_stream = (i + 1 < STREAM_BATCH_TEST_NB_STREAMS) ? &streams[i + 1] : NULL;
+        HASH_ADD(hh, cnx->streams_by_id, stream_id, sizeof(uint64_t), &streams[i]);
+    }
+    cnx->first_stream = &streams[0];
+
+    /* Nothing is handed out while the frames are processed */
+    if (stream_batch_test_frame(cnx, 4, 0, 100, 0) != 0 || stream_batch_test_frame(cnx, 0, 0, 50, 0) != 0 ||
+        stream_batch_test_frame(cnx, 4, 100, 100, 1) != 0 || ctx.nb_callbacks != 0 ||
+        quic->first_readable_cnx != cnx || cnx->nb_readable_streams != 2) {
+        ret = -1;
+    }
+
+    /* The streams are listed in the order they became readable, once */
+    if (ret == 0) {
+        picoquic_notify_stream_batches(quic);
+        if (ctx.nb_callbacks != 1 || ctx.nb_spans != 2 ||
+            stream_batch_test_check_span(&ctx.spans[0], 4, 0, 200, 1) != 0 ||
+            stream_batch_test_check_span(&ctx.spans[1], 0, 0, 50, 0) != 0 ||
+            quic->first_readable_cnx != NULL || cnx->first_readable_stream != NULL) {
+            ret = -1;
+        }
+    }
+
+    /* The consumed fin ends the stream, what is left of the other one stays available */
+    if (ret == 0 && (!streams[1].fin_signalled || streams[1].consumed_offset != 200 || streams[0].consumed_offset != 20 ||
+        picoquic_get_stream_spans(cnx, 0, spans, 2) != 1 || stream_batch_test_check_span(&spans[0], 0, 20, 30, 0) != 0 ||
+        stream_batch_test_check_bytes(&spans[0]) != 0 ||
+        picoquic_get_stream_spans(cnx, 4, spans, 2) != 0)) {
+        ret = -1;
+    }
+
+    /* Without new data, there is no callback. Data after a gap only marks the stream */
+    if (ret == 0) {
+        picoquic_notify_stream_batches(quic);
+        if (ctx.nb_callbacks != 1 || stream_batch_test_frame(cnx, 8, 10, 10, 0) != 0) {
+            ret = -1;
+        } else {
+            picoquic_notify_stream_batches(quic);
+            if (ctx.nb_callbacks != 1 || picoquic_consume_stream_data(cnx, &consumed, 1) == 0) {
+                ret = -1;
+            }
+        }
+    }
+
+    /* Once the gap is filled, the span goes past it. A fin alone comes as an empty span */
+    if (ret == 0 && (stream_batch_test_frame(cnx, 8, 0, 10, 0) != 0 || stream_batch_test_frame(cnx, 0, 50, 0, 1) != 0)) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        ctx.consume_stream0 = 30;
+        picoquic_notify_stream_batches(quic);
+        if (ctx.nb_callbacks != 2 || ctx.nb_spans != 2 ||
+            stream_batch_test_check_span(&ctx.spans[0], 8, 0, 20, 0) != 0 ||
+            stream_batch_test_check_span(&ctx.spans[1], 0, 20, 30, 1) != 0 ||
+            !streams[0].fin_signalled || streams[2].consumed_offset != 20) {
+            ret = -1;
+        }
+    }
+    if (ret == 0 && (stream_batch_test_frame(cnx, 8, 20, 0, 1) != 0 || picoquic_get_stream_spans(cnx, 8, spans, 2) != 1 ||
+        stream_batch_test_check_span(&spans[0], 8, 20, 0, 1) != 0)) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        consumed.length = 0;
+        if (picoquic_consume_stream_data(cnx, &consumed, 1) != 0 || !streams[2].fin_signalled) {
+            ret = -1;
+        }
+    }
+
+    picoquic_remove_readable_cnx(cnx);
+    HASH_CLEAR(hh, cnx->streams_by_id);
+    for (int i = 0; i < STREAM_BATCH_TEST_NB_STREAMS; i++) {
+        picoquic_stream_recv_free(&streams[i].recv);
+    }
+    free(quic->stream_batch_spans);
+    free(streams);
+    free(cnx);
+    free(quic);
+
+    return ret;
+}
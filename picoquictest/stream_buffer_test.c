@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+typedef struct st_stream_buffer_test_ctx_t {
+    int nb_released;
+    const uint8_t* bytes;
+    size_t length;
+} stream_buffer_test_ctx_t;
+
+static void stream_buffer_test_release(void* release_ctx, const uint8_t* bytes, size_t length)
+{
+    stream_buffer_test_ctx_t* ctx = (stream_buffer_test_ctx_t*)release_ctx;
+
+    ctx->nb_released++;
+    ctx->bytes = bytes;
+    ctx->length = length;
+}
+
+int stream_buffer_test()
+{
+    int ret = 0;
+    uint8_t buffer[256];
+    stream_buffer_test_ctx_t ctx = { 0 };
+    picoquic_cnx_t* cnx = calloc(1, sizeof(picoquic_cnx_t));
+    picoquic_stream_head* stream = calloc(1, sizeof(picoquic_stream_head));
+    picoquic_stream_data* data = calloc(1, sizeof(picoquic_stream_data));
+
+    if (cnx == NULL || stream == NULL || data == NULL) {
+        free(cnx);
+        free(stream);
+        free(data);
+        return -1;
+    }
+
+    memset(buffer, 0x5a, sizeof(buffer));
+    picoquic_init_ready_streams(cnx);
+    stream->stream_id = 4;
+    HASH_ADD(hh, cnx->streams_by_id, stream_id, sizeof(uint64_t), stream);
+    cnx->first_stream = stream;
+
+    /* A FIN without data does not keep the buffer */
+    if (picoquic_add_buffer_to_stream(cnx, 4, buffer, 0, 1, stream_buffer_test_release, &ctx) != 0 ||
+        ctx.nb_released != 1 || ctx.bytes != buffer || !stream->fin_requested) {
+        ret = -1;
+    }
+
+    /* When the call fails, the buffer remains the application's */
+    stream->reset_sent = 1;
+    if (ret == 0 && (picoquic_add_buffer_to_stream(cnx, 4, buffer, sizeof(buffer), 0, stream_buffer_test_release, &ctx) == 0 ||
+        ctx.nb_released != 1)) {
+        ret = -1;
+    }
+
+    /* A queued buffer is given back, not freed, when the stream is cleared */
+    data->bytes = buffer;
+    data->length = sizeof(buffer);
+    data->release_fn = stream_buffer_test_release;
+    data->release_ctx = &ctx;
+    stream->send_queue = data;
+    picoquic_clear_stream(cnx, stream);
+    if (ret == 0 && (ctx.nb_released != 2 || ctx.bytes != buffer || ctx.length != sizeof(buffer) || stream->send_queue != NULL)) {
+        ret = -1;
+    }
+
+    /* Small copied writes fill the last chunk, and a large one completes it before taking a chunk of its own */
+    if (ret == 0) {
+        picoquic_stream_data* queue = NULL;
+        uint8_t large[2 * PICOQUIC_STREAM_SEND_CHUNK_SIZE];
+
+        memset(large, 0xa5, sizeof(large));
+        for (int i = 0; ret == 0 && i < 20; i++) {
+            ret = picoquic_append_stream_data(cnx, &queue, buffer, sizeof(buffer), NULL, NULL);
+        }
+        if (ret == 0 && (queue == NULL || queue->next_stream_data != NULL || queue->length != 20 * sizeof(buffer) ||
+            queue->capacity != PICOQUIC_STREAM_SEND_CHUNK_SIZE || queue->bytes[queue->length - 1] != 0x5a ||
+            cnx->memory_used[picoquic_memory_send_data] != sizeof(picoquic_stream_data) + PICOQUIC_STREAM_SEND_CHUNK_SIZE)) {
+            DBG_PRINTF("%s", "Small writes are not in a single chunk\n");
+            ret = -1;
+        }
+        if (ret == 0 && (picoquic_append_stream_data(cnx, &queue, large, sizeof(large), NULL, NULL) != 0 ||
+            queue->length != PICOQUIC_STREAM_SEND_CHUNK_SIZE || queue->bytes[queue->length - 1] != 0xa5 ||
+            queue->next_stream_data == NULL || queue->next_stream_data->next_stream_data != NULL ||
+            queue->next_stream_data->length != sizeof(large) - (PICOQUIC_STREAM_SEND_CHUNK_SIZE - 20 * sizeof(buffer)))) {
+            DBG_PRINTF("%s", "Large write not split at the end of the chunk\n");
+            ret = -1;
+        }
+        while (queue != NULL) {
+            picoquic_stream_data* next = queue->next_stream_data;
+            picoquic_free_stream_data(cnx, queue);
+            queue = next;
+        }
+        if (ret == 0 && cnx->memory_used[picoquic_memory_send_data] != 0) {
+            ret = -1;
+        }
+    }
+
+    HASH_CLEAR(hh, cnx->streams_by_id);
+    free(stream);
+    free(cnx);
+
+    return ret;
+}
@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+
+#define STREAM_READY_TEST_NB_STREAMS 64
+
+/* Built-in implementation of the find_ready_stream protocol operation, see frames.c */
+protoop_arg_t find_ready_stream(picoquic_cnx_t *cnx);
+
+int stream_ready_test()
+{
+    int ret = 0;
+    picoquic_cnx_t* cnx = calloc(1, sizeof(picoquic_cnx_t));
+    picoquic_stream_head* streams = calloc(STREAM_READY_TEST_NB_STREAMS, sizeof(picoquic_stream_head));
+    picoquic_stream_data data = { .length = 100 };
+
+    if (cnx == NULL || streams == NULL) {
+        free(cnx);
+        free(streams);
+        return -1;
+    }
+
+    /* Server side, all the streams opened by the client */
+    cnx->maxdata_remote = 1000000;
+    for (int i = 0; i < STREAM_READY_TEST_NB_STREAMS; i++) {
+        streams[i].stream_id = 4 * i;
+        streams[i].maxdata_remote = 1000;
+        streams[i].next_stream = (i + 1 < STREAM_READY_TEST_NB_STREAMS) ? &streams[i + 1] : NULL;
+    }
+    cnx->first_stream = &streams[0];
+    picoquic_init_ready_streams(cnx);
+
+    /* Idle streams are not found, even if they were marked */
+    picoquic_mark_stream_ready(cnx, &streams[3]);
+    if ((picoquic_stream_head*)find_ready_stream(cnx) != NULL || cnx->ready_stream_tree.size != 0) {
+        ret = -1;
+    }
+
+    /* Streams with data are visited in round robin, whatever the order they were marked in */
+    streams[40].send_queue = &data;
+    streams[10].send_queue = &data;
+    streams[20].reset_requested = 1;
+    picoquic_mark_stream_ready(cnx, &streams[40]);
+    picoquic_mark_stream_ready(cnx, &streams[10]);
+    picoquic_mark_stream_ready(cnx, &streams[20]);
+    picoquic_mark_stream_ready(cnx, &streams[10]);
+
+    for (int i = 0; ret == 0 && i < 6; i++) {
+        static const int expected[3] = { 10, 20, 40 };
+        picoquic_stream_head* stream = (picoquic_stream_head*)find_ready_stream(cnx);
+
+        if (stream != &streams[expected[i % 3]]) {
+            ret = -1;
+        } else {
+            cnx->last_visited_stream_id = stream->stream_id;
+        }
+    }
+
+    /* A stream blocked by its flow control leaves the list, until its credit grows */
+    if (ret == 0) {
+        streams[20].reset_sent = 1;
+        streams[10].sent_offset = streams[10].maxdata_remote;
+        cnx->last_visited_stream_id = 0;
+        if ((picoquic_stream_head*)find_ready_stream(cnx) != &streams[40] || streams[10].is_ready_queued ||
+            streams[20].is_ready_queued) {
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        streams[10].maxdata_remote += 1000;
+        picoquic_mark_stream_ready(cnx, &streams[10]);
+        if ((picoquic_stream_head*)find_ready_stream(cnx) != &streams[10]) {
+            ret = -1;
+        }
+    }
+
+    /* Without connection credit, only the control frames can be sent */
+    if (ret == 0) {
+        cnx->data_sent = cnx->maxdata_remote;
+        streams[50].stop_sending_requested = 1;
+        picoquic_mark_stream_ready(cnx, &streams[50]);
+        if ((picoquic_stream_head*)find_ready_stream(cnx) != &streams[50] || !streams[40].is_ready_queued) {
+            ret = -1;
+        }
+    }
+
+    /* The streams of lower urgency go first, round robin if incremental, else by stream ID */
+    if (ret == 0) {
+        picoquic_stream_data other_data = { .length = 100 };
+
+        cnx->data_sent = 0;
+        streams[50].stop_sending_sent = 1;
+        streams[61].send_queue = &other_data;
+        streams[60].send_queue = &other_data;
+        picoquic_mark_stream_ready(cnx, &streams[61]);
+        picoquic_mark_stream_ready(cnx, &streams[60]);
+        picoquic_update_stream_priority(cnx, &streams[61], 5, 1);
+        picoquic_update_stream_priority(cnx, &streams[60], 5, 1);
+        picoquic_update_stream_priority(cnx, &streams[10], 3, 0);
+        picoquic_update_stream_priority(cnx, &streams[40], 3, 0);
+        if (cnx->ready_stream_tree.size != 5 || (picoquic_stream_head*)find_ready_stream(cnx) != &streams[10]) {
+            ret = -1;
+        }
+        cnx->last_visited_stream_id = streams[10].stream_id;
+        if (ret == 0 && (picoquic_stream_head*)find_ready_stream(cnx) != &streams[40]) {
+            ret = -1;
+        }
+        streams[10].send_queue = NULL;
+        streams[40].send_queue = NULL;
+        cnx->last_visited_stream_id = streams[60].stream_id;
+        if (ret == 0 && ((picoquic_stream_head*)find_ready_stream(cnx) != &streams[60] ||
+            (picoquic_stream_head*)find_ready_stream(cnx) != &streams[60] || cnx->ready_stream_tree.size != 2)) {
+            ret = -1;
+        }
+        /* A queued stream changing priority is found under its new one */
+        picoquic_update_stream_priority(cnx, &streams[61], 0, 0);
+        if (ret == 0 && ((picoquic_stream_head*)find_ready_stream(cnx) != &streams[61] || !streams[60].is_ready_queued)) {
+            ret = -1;
+        }
+    }
+
+    free(streams);
+    free(cnx);
+
+    return ret;
+}
+
+/* Counts the streams found in a number of rounds, each charged the bytes it would send */
+static void stream_scheduler_run(picoquic_cnx_t* cnx, picoquic_stream_head* streams, int nb_rounds, int* nb_found)
+{
+    for (int i = 0; i < nb_rounds; i++) {
+        picoquic_stream_head* stream = (picoquic_stream_head*)find_ready_stream(cnx);
+
+        if (stream != NULL) {
+            nb_found[stream - streams]++;
+            cnx->last_visited_stream_id = stream->stream_id;
+            picoquic_charge_stream_weight(cnx, stream, 1000);
+        }
+    }
+}
+
+/* The native schedulers, selected per connection */
+int stream_scheduler_test()
+{
+    int ret = 0;
+    picoquic_cnx_t* cnx = calloc(1, sizeof(picoquic_cnx_t));
+    picoquic_stream_head* streams = calloc(4, sizeof(picoquic_stream_head));
+    picoquic_stream_data data = { .length = 100 };
+    int nb_found[4];
+
+    if (cnx == NULL || streams == NULL) {
+        free(cnx);
+        free(streams);
+        return -1;
+    }
+
+    cnx->maxdata_remote = UINT64_MAX;
+    for (int i = 0; i < 4; i++) {
+        streams[i].stream_id = 4 * i;
+        streams[i].maxdata_remote = UINT64_MAX;
+        streams[i].send_queue = &data;
+        streams[i].weight = PICOQUIC_STREAM_WEIGHT_DEFAULT;
+        streams[i].next_stream = (i + 1 < 4) ? &streams[i + 1] : NULL;
+    }
+    cnx->first_stream = &streams[0];
+    picoquic_init_ready_streams(cnx);
+    for (int i = 0; i < 4; i++) {
+        picoquic_mark_stream_ready(cnx, &streams[i]);
+    }
+    /* Stream 0 goes first and alone, then 4 and 8 in turn, then 12 */
+    picoquic_update_stream_priority(cnx, &streams[0], 1, 0);
+    picoquic_update_stream_priority(cnx, &streams[1], 2, 0);
+    picoquic_update_stream_priority(cnx, &streams[2], 2, 0);
+    picoquic_update_stream_priority(cnx, &streams[3], 4, 0);
+
+    /* Round robin ignores the priorities */
+    memset(nb_found, 0, sizeof(nb_found));
+    if (picoquic_set_stream_scheduler(cnx, picoquic_stream_scheduler_round_robin) != 0 ||
+        cnx->ready_stream_tree.size != 4) {
+        ret = -1;
+    } else {
+        stream_scheduler_run(cnx, streams, 8, nb_found);
+        for (int i = 0; i < 4; i++) {
+            if (nb_found[i] != 2) {
+                ret = -1;
+            }
+        }
+    }
+
+    /* Strict priority sends the streams of an urgency one after the other, even the incremental ones */
+    if (ret == 0) {
+        memset(nb_found, 0, sizeof(nb_found));
+        if (picoquic_set_stream_scheduler(cnx, picoquic_stream_scheduler_strict_priority) != 0) {
+            ret = -1;
+        } else {
+            stream_scheduler_run(cnx, streams, 4, nb_found);
+            streams[0].send_queue = NULL;
+            stream_scheduler_run(cnx, streams, 4, nb_found);
+            if (nb_found[0] != 4 || nb_found[1] != 4 || nb_found[2] != 0 || nb_found[3] != 0) {
+                ret = -1;
+            }
+            streams[0].send_queue = &data;
+            picoquic_mark_stream_ready(cnx, &streams[0]);
+        }
+    }
+
+    /* The weighted scheduler shares the bytes in proportion to the weights */
+    if (ret == 0) {
+        memset(nb_found, 0, sizeof(nb_found));
+        streams[0].weight = 8;
+        streams[1].weight = 16;
+        streams[2].weight = 16;
+        streams[3].weight = 32;
+        if (picoquic_set_stream_scheduler(cnx, picoquic_stream_scheduler_weighted) != 0) {
+            ret = -1;
+        } else {
+            stream_scheduler_run(cnx, streams, 720, nb_found);
+            if (nb_found[0] != 80 || nb_found[1] != 160 || nb_found[2] != 160 || nb_found[3] != 320) {
+                DBG_PRINTF("Weighted shares %d, %d, %d, %d\n", nb_found[0], nb_found[1], nb_found[2], nb_found[3]);
+                ret = -1;
+            }
+        }
+    }
+
+    /* A stream back from idle gets its share from then on, not the one it missed */
+    if (ret == 0) {
+        memset(nb_found, 0, sizeof(nb_found));
+        streams[3].send_queue = NULL;
+        stream_scheduler_run(cnx, streams, 400, nb_found);
+        streams[3].send_queue = &data;
+        picoquic_mark_stream_ready(cnx, &streams[3]);
+        memset(nb_found, 0, sizeof(nb_found));
+        stream_scheduler_run(cnx, streams, 72, nb_found);
+        if (nb_found[3] < 30 || nb_found[3] > 34) {
+            DBG_PRINTF("Stream back from idle sent %d times\n", nb_found[3]);
+            ret = -1;
+        }
+    }
+
+    /* The priority scheduler is the default, and can be restored */
+    if (ret == 0 && (picoquic_set_stream_scheduler(cnx, picoquic_stream_scheduler_priority) != 0 ||
+        (picoquic_stream_head*)find_ready_stream(cnx) != &streams[0] ||
+        picoquic_set_stream_scheduler(cnx, (picoquic_stream_scheduler_enum)17) == 0)) {
+        ret = -1;
+    }
+
+    free(streams);
+    free(cnx);
+
+    return ret;
+}
@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <string.h>
+#include "stream_recv.h"
+
+#define STREAM_RECV_TEST_LENGTH (3 * PICOQUIC_STREAM_RECV_MIN_SIZE)
+#define STREAM_RECV_TEST_CHUNK 1000
+
+static uint8_t stream_recv_test_byte(uint64_t offset)
+{
+    return (uint8_t)(offset * 7 + (offset >> 8));
+}
+
+static int stream_recv_test_insert(picoquic_stream_recv_t* recv, uint64_t consumed_offset, uint64_t offset, size_t length, int* new_data)
+{
+    uint8_t bytes[PICOQUIC_STREAM_RECV_MIN_SIZE];
+
+    for (size_t i = 0; i < length; i++) {
+        bytes[i] = stream_recv_test_byte(offset + i);
+    }
+    *new_data = 0;
+
+    return picoquic_stream_recv_insert(recv, consumed_offset, offset, bytes, length, new_data);
+}
+
+/* Reads the in order data of the ring, checking it against the expected bytes */
+static int stream_recv_test_read(picoquic_stream_recv_t* recv, uint64_t* consumed_offset)
+{
+    const uint8_t* bytes = NULL;
+    size_t length;
+
+    while ((length = picoquic_stream_recv_peek(recv, *consumed_offset, &bytes)) > 0) {
+        for (size_t i = 0; i < length; i++) {
+            if (bytes[i] != stream_recv_test_byte(*consumed_offset + i)) {
+                return -1;
+            }
+        }
+        *consumed_offset += length;
+        picoquic_stream_recv_release(recv, *consumed_offset);
+    }
+
+    return 0;
+}
+
+int stream_recv_test()
+{
+    int ret = 0;
+    int new_data = 0;
+    uint64_t consumed_offset = 0;
+    const uint8_t* bytes = NULL;
+    picoquic_stream_recv_t recv;
+
+    memset(&recv, 0, sizeof(recv));
+
+    /* Odd chunks first, leaving holes */
+    for (uint64_t offset = STREAM_RECV_TEST_CHUNK; ret == 0 && offset < STREAM_RECV_TEST_LENGTH; offset += 2 * STREAM_RECV_TEST_CHUNK) {
+        size_t length = (offset + STREAM_RECV_TEST_CHUNK < STREAM_RECV_TEST_LENGTH) ? STREAM_RECV_TEST_CHUNK : (size_t)(STREAM_RECV_TEST_LENGTH - offset);
+        if (stream_recv_test_insert(&recv, consumed_offset, offset, length, &new_data) != 0 || !new_data) {
+            ret = -1;
+        }
+    }
+    if (ret == 0 && (picoquic_stream_recv_peek(&recv, consumed_offset, &bytes) != 0 ||
+        picoquic_stream_recv_first_offset(&recv) != STREAM_RECV_TEST_CHUNK ||
+        recv.nb_ranges != (STREAM_RECV_TEST_LENGTH + STREAM_RECV_TEST_CHUNK) / (2 * STREAM_RECV_TEST_CHUNK))) {
+        ret = -1;
+    }
+
+    /* A duplicate brings nothing */
+    if (ret == 0 && (stream_recv_test_insert(&recv, consumed_offset, STREAM_RECV_TEST_CHUNK + 10, 100, &new_data) != 0 || new_data)) {
+        ret = -1;
+    }
+
+    /* The even chunks, overlapping their neighbours, fill the holes one by one */
+    for (uint64_t offset = 0; ret == 0 && offset < STREAM_RECV_TEST_LENGTH; offset += 2 * STREAM_RECV_TEST_CHUNK) {
+        uint64_t start = (offset > 10) ? offset - 10 : 0;
+        uint64_t end = (offset + STREAM_RECV_TEST_CHUNK + 10 < STREAM_RECV_TEST_LENGTH) ? offset + STREAM_RECV_TEST_CHUNK + 10 : STREAM_RECV_TEST_LENGTH;
+
+        if (stream_recv_test_insert(&recv, consumed_offset, start, (size_t)(end - start), &new_data) != 0 || !new_data ||
+            stream_recv_test_read(&recv, &consumed_offset) != 0 || consumed_offset < end) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && (consumed_offset != STREAM_RECV_TEST_LENGTH || picoquic_stream_recv_first_offset(&recv) != UINT64_MAX)) {
+        ret = -1;
+    }
+
+    /* Once consumed, the ring wraps around without growing */
+    if (ret == 0) {
+        size_t size = recv.size;
+
+        for (int i = 0; ret == 0 && i < 10; i++) {
+            uint64_t offset = consumed_offset;
+
+            if (stream_recv_test_insert(&recv, consumed_offset, offset + 1000, 2000, &new_data) != 0 ||
+                stream_recv_test_insert(&recv, consumed_offset, offset, 1000, &new_data) != 0 || !new_data ||
+                stream_recv_test_read(&recv, &consumed_offset) != 0 || consumed_offset != offset + 3000) {
+                ret = -1;
+            }
+        }
+        if (ret == 0 && recv.size != size) {
+            ret = -1;
+        }
+    }
+
+    picoquic_stream_recv_free(&recv);
+
+    return ret;
+}
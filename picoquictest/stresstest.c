@@ -497,7 +497,7 @@ static int stress_submit_sp_packets(picoquic_stress_ctx_t * ctx, picoquic_quic_t
                     picoquictest_sim_link_submit(target_link, packet, ctx->simulated_time);
                 }
                 else {
-                    free(packet);
+                    picoquictest_sim_link_free_packet(packet);
                     stress_debug_break();
                     ret = -1;
                     break;
@@ -525,7 +525,7 @@ static int stress_handle_packet_arrival(picoquic_stress_ctx_t * ctx, picoquic_qu
         if (ret != 0){
             stress_debug_break();
         }
-        free(packet);
+        picoquictest_sim_link_free_packet(packet);
     }
 
     return ret;
@@ -596,7 +596,7 @@ static int stress_handle_packet_prepare(picoquic_stress_ctx_t * ctx, picoquic_qu
             }
         }
         else {
-            free(packet);
+            picoquictest_sim_link_free_packet(packet);
             packet = NULL;
 
             if (ret == PICOQUIC_ERROR_DISCONNECTED) {
@@ -638,7 +638,7 @@ static int stress_handle_packet_prepare(picoquic_stress_ctx_t * ctx, picoquic_qu
             ret = -1;
         }
         if (packet != NULL) {
-            free(packet);
+            picoquictest_sim_link_free_packet(packet);
         }
     }
 
@@ -972,6 +972,7 @@ static int stress_or_fuzz_test(picoquic_fuzz_fn fuzz_fn, void * fuzz_ctx)
         picoquic_free(stress_ctx.qserver);
         stress_ctx.qserver = NULL;
     }
+    picoquictest_sim_packet_pool_clear();
 
     /* Report */
     run_time_seconds = ((double)stress_ctx.simulated_time) / 1000000.0;
@@ -996,6 +997,509 @@ int stress_test()
     return stress_or_fuzz_test(NULL, NULL);
 }
 
+/*
+ * Scale test: a large number of connections from one client context to the
+ * server, over one pair of simulated links. Each connection sends a short query
+ * once per second and the server answers it; connections are closed and replaced
+ * at the churn rate. For growing numbers of connections, the test measures the
+ * server time per packet, the cost of the wake list and connection ID lookups,
+ * and the memory accounted per connection. It fails if one of the costs grows
+ * much faster than the number of connections does, which is the mark of a
+ * structure that is linear in the number of connections.
+ */
+
+#define PICOQUIC_SCALE_NB_ROUNDS 3 /* Scales of 1/16, 1/4 and all the connections */
+#define PICOQUIC_SCALE_QUERY_INTERVAL 1000000 /* Per connection */
+#define PICOQUIC_SCALE_QUERY_SIZE 64
+#define PICOQUIC_SCALE_RESPONSE_SIZE 1000
+#define PICOQUIC_SCALE_SETUP_MAX 30000000
+#define PICOQUIC_SCALE_DURATION 4000000
+#define PICOQUIC_SCALE_NB_LOOKUPS 200000
+#define PICOQUIC_SCALE_MAX_GROWTH 8.0
+#define PICOQUIC_SCALE_MIN_COST_NS 100.0 /* Below this, the variations are noise */
+
+size_t picoquic_scale_nb_connections = 1024; /* Default to 1024 connections in the largest round */
+uint64_t picoquic_scale_churn_per_second = 50; /* Connections replaced per second */
+
+struct st_picoquic_scale_ctx_t;
+
+typedef struct st_picoquic_scale_cnx_t {
+    struct st_picoquic_scale_ctx_t* ctx;
+    picoquic_cnx_t* cnx;
+    struct sockaddr_in addr;
+    uint64_t next_stream_id;
+    int is_ready;
+} picoquic_scale_cnx_t;
+
+typedef struct st_picoquic_scale_ctx_t {
+    uint64_t simulated_time;
+    picoquic_quic_t* qserver;
+    picoquic_quic_t* qclient;
+    struct sockaddr_in server_addr;
+    picoquictest_sim_link_t* c_to_s_link;
+    picoquictest_sim_link_t* s_to_c_link;
+    picoquic_scale_cnx_t* cnx;
+    size_t nb_cnx;
+    size_t nb_ready;
+    size_t next_query;
+    size_t next_churn;
+    uint64_t next_query_time;
+    uint64_t next_churn_time;
+    int is_measuring;
+    uint64_t server_time;
+    uint64_t server_packets;
+    uint64_t nb_responses;
+    uint64_t nb_replaced;
+} picoquic_scale_ctx_t;
+
+typedef struct st_picoquic_scale_result_t {
+    size_t nb_cnx;
+    double server_ns_per_packet;
+    double wake_ns_per_op;
+    double cid_ns_per_op;
+    uint64_t memory_per_cnx;
+} picoquic_scale_result_t;
+
+static const uint8_t scale_response[PICOQUIC_SCALE_RESPONSE_SIZE] = { 0 };
+
+static int scale_server_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* stream_ctx)
+{
+    int ret = 0;
+
+    if (fin_or_event == picoquic_callback_stream_fin && (stream_id & 3) == 0) {
+        if ((ret = picoquic_add_to_stream(cnx, stream_id, scale_response, sizeof(scale_response), 1)) != 0) {
+            stress_debug_break();
+        }
+    }
+
+    return ret;
+}
+
+static int scale_client_callback(picoquic_cnx_t* cnx,
+    uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* stream_ctx)
+{
+    picoquic_scale_cnx_t* s_cnx = (picoquic_scale_cnx_t*)callback_ctx;
+
+    if (s_cnx != NULL && s_cnx->cnx == cnx) {
+        if ((fin_or_event == picoquic_callback_almost_ready || fin_or_event == picoquic_callback_ready) &&
+            !s_cnx->is_ready) {
+            s_cnx->is_ready = 1;
+            s_cnx->ctx->nb_ready++;
+        } else if (fin_or_event == picoquic_callback_stream_fin) {
+            s_cnx->ctx->nb_responses++;
+        }
+    }
+
+    return 0;
+}
+
+static int scale_start_cnx(picoquic_scale_ctx_t* ctx, picoquic_scale_cnx_t* s_cnx)
+{
+    int ret = 0;
+
+    s_cnx->is_ready = 0;
+    s_cnx->next_stream_id = 4;
+    s_cnx->cnx = picoquic_create_cnx(ctx->qclient,
+        picoquic_null_connection_id, picoquic_null_connection_id,
+        (struct sockaddr*)&ctx->server_addr, ctx->simulated_time,
+        0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+
+    if (s_cnx->cnx == NULL) {
+        stress_debug_break();
+        ret = -1;
+    } else {
+        picoquic_set_callback(s_cnx->cnx, scale_client_callback, s_cnx);
+        if ((ret = picoquic_start_client_cnx(s_cnx->cnx)) != 0) {
+            stress_debug_break();
+        }
+    }
+
+    return ret;
+}
+
+static int scale_submit_sp_packets(picoquic_scale_ctx_t* ctx, picoquic_quic_t* q, picoquictest_sim_link_t* link)
+{
+    int ret = 0;
+    picoquic_stateless_packet_t* sp = NULL;
+
+    while ((sp = picoquic_dequeue_stateless_packet(q)) != NULL) {
+        if (ret == 0 && sp->length > 0) {
+            picoquictest_sim_packet_t* packet = picoquictest_sim_link_create_packet();
+
+            if (packet == NULL) {
+                stress_debug_break();
+                ret = -1;
+            } else {
+                memcpy(&packet->addr_from, &sp->addr_local,
+                    (sp->addr_local.ss_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+                memcpy(&packet->addr_to, &sp->addr_to,
+                    (sp->addr_to.ss_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+                memcpy(packet->bytes, sp->bytes, sp->length);
+                packet->length = sp->length;
+                picoquictest_sim_link_submit(link, packet, ctx->simulated_time);
+            }
+        }
+        picoquic_delete_stateless_packet(sp);
+    }
+
+    return ret;
+}
+
+static int scale_handle_arrival(picoquic_scale_ctx_t* ctx, picoquic_quic_t* q, picoquictest_sim_link_t* link)
+{
+    int ret = 0;
+    int new_context_created = 0;
+    picoquictest_sim_packet_t* packet = picoquictest_sim_link_dequeue(link, ctx->simulated_time);
+
+    if (packet != NULL) {
+        uint64_t wall_start = (q == ctx->qserver) ? picoquic_current_time() : 0;
+
+        ret = picoquic_incoming_packet(q, packet->bytes, (uint32_t)packet->length,
+            (struct sockaddr*)&packet->addr_from, (struct sockaddr*)&packet->addr_to, 0,
+            ctx->simulated_time, &new_context_created);
+        if (q == ctx->qserver && ctx->is_measuring) {
+            ctx->server_time += picoquic_current_time() - wall_start;
+            ctx->server_packets++;
+        }
+        if (ret != 0) {
+            stress_debug_break();
+        }
+        picoquictest_sim_link_free_packet(packet);
+    }
+
+    return ret;
+}
+
+static int scale_handle_prepare(picoquic_scale_ctx_t* ctx, picoquic_quic_t* q)
+{
+    int ret = 0;
+    picoquic_cnx_t* cnx = picoquic_get_earliest_cnx_to_wake(q, 0);
+    picoquictest_sim_packet_t* packet = picoquictest_sim_link_create_packet();
+    picoquic_path_t* path = NULL;
+    uint64_t wall_start = picoquic_current_time();
+
+    if (packet == NULL || cnx == NULL) {
+        stress_debug_break();
+        ret = -1;
+    } else {
+        ret = picoquic_prepare_packet(cnx, ctx->simulated_time,
+            packet->bytes, PICOQUIC_MAX_PACKET_SIZE, &packet->length, &path);
+        if (q == ctx->qserver && ctx->is_measuring && ret == 0 && packet->length > 0) {
+            ctx->server_time += picoquic_current_time() - wall_start;
+            ctx->server_packets++;
+        }
+    }
+
+    if (ret == 0 && packet->length > 0) {
+        if (q == ctx->qserver) {
+            memcpy(&packet->addr_from, &ctx->server_addr, sizeof(struct sockaddr_in));
+            memcpy(&packet->addr_to, &cnx->path[0]->peer_addr, sizeof(struct sockaddr_in));
+            picoquictest_sim_link_submit(ctx->s_to_c_link, packet, ctx->simulated_time);
+        } else {
+            picoquic_scale_cnx_t* s_cnx = (picoquic_scale_cnx_t*)picoquic_get_callback_context(cnx);
+
+            memcpy(&packet->addr_from, &s_cnx->addr, sizeof(struct sockaddr_in));
+            memcpy(&packet->addr_to, &ctx->server_addr, sizeof(struct sockaddr_in));
+            picoquictest_sim_link_submit(ctx->c_to_s_link, packet, ctx->simulated_time);
+        }
+    } else {
+        if (packet != NULL) {
+            picoquictest_sim_link_free_packet(packet);
+        }
+        if (ret == PICOQUIC_ERROR_DISCONNECTED) {
+            /* A closed client connection is replaced by a new one on the same address */
+            picoquic_scale_cnx_t* s_cnx = (q == ctx->qclient) ?
+                (picoquic_scale_cnx_t*)picoquic_get_callback_context(cnx) : NULL;
+
+            picoquic_set_callback(cnx, NULL, NULL);
+            picoquic_delete_cnx(cnx);
+            ret = 0;
+            if (s_cnx != NULL) {
+                ctx->nb_replaced++;
+                ret = scale_start_cnx(ctx, s_cnx);
+            }
+        } else if (ret != 0) {
+            stress_debug_break();
+        }
+    }
+
+    return ret;
+}
+
+/* A query on the next connection, round robin */
+static int scale_send_query(picoquic_scale_ctx_t* ctx)
+{
+    int ret = 0;
+    uint8_t query[PICOQUIC_SCALE_QUERY_SIZE];
+    picoquic_scale_cnx_t* s_cnx = &ctx->cnx[ctx->next_query];
+
+    ctx->next_query = (ctx->next_query + 1) % ctx->nb_cnx;
+    ctx->next_query_time += (ctx->nb_cnx < PICOQUIC_SCALE_QUERY_INTERVAL) ? PICOQUIC_SCALE_QUERY_INTERVAL / ctx->nb_cnx : 1;
+
+    if (s_cnx->is_ready) {
+        memset(query, 0, sizeof(query));
+        picoformat_64(query, s_cnx->next_stream_id);
+        if ((ret = picoquic_add_to_stream(s_cnx->cnx, s_cnx->next_stream_id, query, sizeof(query), 1)) != 0) {
+            stress_debug_break();
+        }
+        s_cnx->next_stream_id += 4;
+    }
+
+    return ret;
+}
+
+/* The next ready connection is closed, and replaced once disconnected */
+static int scale_churn(picoquic_scale_ctx_t* ctx)
+{
+    int ret = 0;
+    picoquic_scale_cnx_t* s_cnx = &ctx->cnx[ctx->next_churn];
+
+    ctx->next_churn = (ctx->next_churn + 1) % ctx->nb_cnx;
+    ctx->next_churn_time += (picoquic_scale_churn_per_second < 1000000) ? 1000000 / picoquic_scale_churn_per_second : 1;
+
+    if (s_cnx->is_ready) {
+        s_cnx->is_ready = 0;
+        ctx->nb_ready--;
+        if ((ret = picoquic_close(s_cnx->cnx, 0)) != 0) {
+            stress_debug_break();
+        }
+    }
+
+    return ret;
+}
+
+/* Runs the earliest of the pending events, or moves the time to the end */
+static int scale_step(picoquic_scale_ctx_t* ctx, uint64_t end_time, int is_steady)
+{
+    int ret = 0;
+    picoquic_cnx_t* s_cnx = picoquic_get_earliest_cnx_to_wake(ctx->qserver, 0);
+    picoquic_cnx_t* c_cnx = picoquic_get_earliest_cnx_to_wake(ctx->qclient, 0);
+    uint64_t next_time = end_time;
+
+    if ((ret = scale_submit_sp_packets(ctx, ctx->qserver, ctx->s_to_c_link)) != 0 ||
+        (ret = scale_submit_sp_packets(ctx, ctx->qclient, ctx->c_to_s_link)) != 0) {
+        return ret;
+    }
+
+    next_time = picoquictest_sim_link_next_arrival(ctx->c_to_s_link, next_time);
+    next_time = picoquictest_sim_link_next_arrival(ctx->s_to_c_link, next_time);
+    if (s_cnx != NULL && s_cnx->next_wake_time < next_time) {
+        next_time = s_cnx->next_wake_time;
+    }
+    if (c_cnx != NULL && c_cnx->next_wake_time < next_time) {
+        next_time = c_cnx->next_wake_time;
+    }
+    if (is_steady && ctx->next_query_time < next_time) {
+        next_time = ctx->next_query_time;
+    }
+    if (is_steady && picoquic_scale_churn_per_second > 0 && ctx->next_churn_time < next_time) {
+        next_time = ctx->next_churn_time;
+    }
+    if (next_time > ctx->simulated_time) {
+        ctx->simulated_time = next_time;
+    }
+
+    if (picoquictest_sim_link_next_arrival(ctx->c_to_s_link, UINT64_MAX) <= ctx->simulated_time) {
+        ret = scale_handle_arrival(ctx, ctx->qserver, ctx->c_to_s_link);
+    } else if (picoquictest_sim_link_next_arrival(ctx->s_to_c_link, UINT64_MAX) <= ctx->simulated_time) {
+        ret = scale_handle_arrival(ctx, ctx->qclient, ctx->s_to_c_link);
+    } else if (s_cnx != NULL && s_cnx->next_wake_time <= ctx->simulated_time) {
+        ret = scale_handle_prepare(ctx, ctx->qserver);
+    } else if (c_cnx != NULL && c_cnx->next_wake_time <= ctx->simulated_time) {
+        ret = scale_handle_prepare(ctx, ctx->qclient);
+    } else if (is_steady && ctx->next_query_time <= ctx->simulated_time) {
+        ret = scale_send_query(ctx);
+    } else if (is_steady && picoquic_scale_churn_per_second > 0 && ctx->next_churn_time <= ctx->simulated_time) {
+        ret = scale_churn(ctx);
+    }
+
+    return ret;
+}
+
+/* Costs of the wake list and of the connection ID table, on random server connections */
+static int scale_measure_lookups(picoquic_scale_ctx_t* ctx, picoquic_scale_result_t* result)
+{
+    int ret = 0;
+    size_t nb_server_cnx = 0;
+    picoquic_cnx_t** server_cnx = NULL;
+    uint64_t random_ctx = 0x5ca1ab1e5ca1ab1eull;
+    uint64_t wall_start;
+
+    for (picoquic_cnx_t* cnx = ctx->qserver->cnx_list; cnx != NULL; cnx = cnx->next_in_table) {
+        nb_server_cnx++;
+    }
+    if (nb_server_cnx == 0 ||
+        (server_cnx = (picoquic_cnx_t**)malloc(nb_server_cnx * sizeof(picoquic_cnx_t*))) == NULL) {
+        return -1;
+    }
+    nb_server_cnx = 0;
+    for (picoquic_cnx_t* cnx = ctx->qserver->cnx_list; cnx != NULL; cnx = cnx->next_in_table) {
+        server_cnx[nb_server_cnx++] = cnx;
+    }
+
+    wall_start = picoquic_current_time();
+    for (int i = 0; ret == 0 && i < PICOQUIC_SCALE_NB_LOOKUPS; i++) {
+        picoquic_cnx_t* cnx = server_cnx[picoquic_test_uniform_random(&random_ctx, nb_server_cnx)];
+
+        if (picoquic_cnx_by_id(ctx->qserver, cnx->path[0]->local_cnxid) != cnx) {
+            DBG_PRINTF("%s", "Server connection not found by its connection ID\n");
+            ret = -1;
+        }
+    }
+    result->cid_ns_per_op = ((double)(picoquic_current_time() - wall_start)) * 1000.0 / PICOQUIC_SCALE_NB_LOOKUPS;
+
+    wall_start = picoquic_current_time();
+    for (int i = 0; ret == 0 && i < PICOQUIC_SCALE_NB_LOOKUPS; i++) {
+        picoquic_cnx_t* cnx = server_cnx[picoquic_test_uniform_random(&random_ctx, nb_server_cnx)];
+
+        picoquic_reinsert_by_wake_time(ctx->qserver, cnx, cnx->next_wake_time);
+    }
+    result->wake_ns_per_op = ((double)(picoquic_current_time() - wall_start)) * 1000.0 / PICOQUIC_SCALE_NB_LOOKUPS;
+
+    free(server_cnx);
+
+    return ret;
+}
+
+static int scale_round(size_t nb_cnx, picoquic_scale_result_t* result)
+{
+    int ret = 0;
+    picoquic_scale_ctx_t ctx;
+    picoquic_memory_stats_t memory_stats;
+    uint64_t end_time;
+
+    memset(&ctx, 0, sizeof(ctx));
+    memset(result, 0, sizeof(picoquic_scale_result_t));
+    result->nb_cnx = nb_cnx;
+    ctx.nb_cnx = nb_cnx;
+    stress_set_ip_address_from_index(&ctx.server_addr, -1);
+
+    ctx.qserver = picoquic_create((uint32_t)nb_cnx,
+        PICOQUIC_TEST_SERVER_CERT, PICOQUIC_TEST_SERVER_KEY, PICOQUIC_TEST_CERT_STORE,
+        PICOQUIC_TEST_ALPN, scale_server_callback, NULL, NULL, NULL, NULL,
+        ctx.simulated_time, &ctx.simulated_time, NULL,
+        stress_ticket_encrypt_key, sizeof(stress_ticket_encrypt_key), NULL);
+    ctx.qclient = picoquic_create((uint32_t)nb_cnx, NULL, NULL, PICOQUIC_TEST_CERT_STORE, NULL, NULL,
+        NULL, NULL, NULL, NULL, ctx.simulated_time, &ctx.simulated_time, NULL, NULL, 0, NULL);
+    ctx.c_to_s_link = picoquictest_sim_link_create(1, 10000, 0, 0, 0);
+    ctx.s_to_c_link = picoquictest_sim_link_create(1, 10000, 0, 0, 0);
+    ctx.cnx = (picoquic_scale_cnx_t*)calloc(nb_cnx, sizeof(picoquic_scale_cnx_t));
+
+    if (ctx.qserver == NULL || ctx.qclient == NULL || ctx.c_to_s_link == NULL ||
+        ctx.s_to_c_link == NULL || ctx.cnx == NULL) {
+        DBG_PRINTF("Cannot create the scale test contexts for %zu connections\n", nb_cnx);
+        ret = -1;
+    }
+
+    /* Each connection has its own client address */
+    for (size_t i = 0; ret == 0 && i < nb_cnx; i++) {
+        ctx.cnx[i].ctx = &ctx;
+        stress_set_ip_address_from_index(&ctx.cnx[i].addr, (int)i + 1);
+        ret = scale_start_cnx(&ctx, &ctx.cnx[i]);
+    }
+
+    while (ret == 0 && ctx.nb_ready < nb_cnx) {
+        if (ctx.simulated_time >= PICOQUIC_SCALE_SETUP_MAX) {
+            DBG_PRINTF("Only %zu of %zu connections ready\n", ctx.nb_ready, nb_cnx);
+            ret = -1;
+        } else {
+            ret = scale_step(&ctx, PICOQUIC_SCALE_SETUP_MAX, 0);
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_quic_get_memory_stats(ctx.qserver, &memory_stats);
+        result->memory_per_cnx = memory_stats.total / nb_cnx + sizeof(picoquic_cnx_t) + sizeof(picoquic_path_t);
+    }
+
+    /* Steady state, with queries and churn */
+    ctx.is_measuring = 1;
+    ctx.next_query_time = ctx.simulated_time;
+    ctx.next_churn_time = ctx.simulated_time;
+    end_time = ctx.simulated_time + PICOQUIC_SCALE_DURATION;
+    while (ret == 0 && ctx.simulated_time < end_time) {
+        ret = scale_step(&ctx, end_time, 1);
+    }
+    ctx.is_measuring = 0;
+
+    if (ret == 0) {
+        if (ctx.server_packets == 0 || ctx.nb_responses == 0) {
+            DBG_PRINTF("No traffic with %zu connections\n", nb_cnx);
+            ret = -1;
+        } else {
+            result->server_ns_per_packet = ((double)ctx.server_time) * 1000.0 / ctx.server_packets;
+            ret = scale_measure_lookups(&ctx, result);
+        }
+    }
+
+    if (ret == 0) {
+        DBG_PRINTF("Scale %zu: %" PRIu64 " responses, %" PRIu64 " replaced, %.0f ns/packet, wake %.0f ns, CID %.0f ns, %" PRIu64 " bytes/cnx\n",
+            nb_cnx, ctx.nb_responses, ctx.nb_replaced, result->server_ns_per_packet,
+            result->wake_ns_per_op, result->cid_ns_per_op, result->memory_per_cnx);
+    }
+
+    if (ctx.qclient != NULL) {
+        picoquic_free(ctx.qclient);
+    }
+    if (ctx.qserver != NULL) {
+        picoquic_free(ctx.qserver);
+    }
+    if (ctx.c_to_s_link != NULL) {
+        picoquictest_sim_link_delete(ctx.c_to_s_link);
+    }
+    if (ctx.s_to_c_link != NULL) {
+        picoquictest_sim_link_delete(ctx.s_to_c_link);
+    }
+    free(ctx.cnx);
+
+    return ret;
+}
+
+static int scale_check_growth(char const* name, double first, double last)
+{
+    if (first < PICOQUIC_SCALE_MIN_COST_NS) {
+        first = PICOQUIC_SCALE_MIN_COST_NS;
+    }
+    if (last > first * PICOQUIC_SCALE_MAX_GROWTH) {
+        DBG_PRINTF("%s grows from %.0f ns to %.0f ns\n", name, first, last);
+        return -1;
+    }
+    return 0;
+}
+
+int scale_test()
+{
+    int ret = 0;
+    picoquic_scale_result_t results[PICOQUIC_SCALE_NB_ROUNDS];
+
+    for (int i = 0; ret == 0 && i < PICOQUIC_SCALE_NB_ROUNDS; i++) {
+        size_t nb_cnx = picoquic_scale_nb_connections >> (2 * (PICOQUIC_SCALE_NB_ROUNDS - 1 - i));
+
+        ret = scale_round((nb_cnx > 0) ? nb_cnx : 1, &results[i]);
+    }
+    picoquictest_sim_packet_pool_clear();
+
+    if (ret == 0) {
+        picoquic_scale_result_t* first = &results[0];
+        picoquic_scale_result_t* last = &results[PICOQUIC_SCALE_NB_ROUNDS - 1];
+
+        if (scale_check_growth("Server time per packet", first->server_ns_per_packet, last->server_ns_per_packet) != 0 ||
+            scale_check_growth("Wake list update", first->wake_ns_per_op, last->wake_ns_per_op) != 0 ||
+            scale_check_growth("Connection ID lookup", first->cid_ns_per_op, last->cid_ns_per_op) != 0) {
+            ret = -1;
+        } else if (last->memory_per_cnx > 2 * first->memory_per_cnx) {
+            DBG_PRINTF("Memory per connection grows from %" PRIu64 " to %" PRIu64 " bytes\n",
+                first->memory_per_cnx, last->memory_per_cnx);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
 /*
  * Basic fuzz test just tries to flip some bits in random packets
  */
@@ -0,0 +1,92 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* sched_getaffinity */
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "threaded_server.h"
+
+#define THREADED_SERVER_TEST_WORKERS 3
+
+static picoquic_quic_t* threaded_server_test_create_quic(void* ctx, int worker_id)
+{
+    int* nb_created = (int*)ctx;
+
+    (*nb_created)++;
+
+    return picoquic_create(8, NULL, NULL, NULL, "test", NULL, NULL,
+        NULL, NULL, NULL, picoquic_current_time(), NULL, NULL, NULL, 0, NULL);
+}
+
+int threaded_server_test()
+{
+    int ret = 0;
+    int nb_created = 0;
+    uint8_t packet[32];
+    picoquic_connection_id_t cid = { { 0xAA, 1, 2, 3, 4, 5, 6, 7 }, 8 };
+    picoquic_connection_id_t returned;
+    picoquic_threaded_server_t* server = picoquic_threaded_server_create(THREADED_SERVER_TEST_WORKERS, 12349,
+        threaded_server_test_create_quic, &nb_created);
+
+    if (server == NULL || nb_created != THREADED_SERVER_TEST_WORKERS) {
+        return -1;
+    }
+
+    /* The connection IDs chosen by a worker designate it */
+    picoquic_worker_cnx_id_callback(cid, picoquic_null_connection_id, &server->workers[2], &returned);
+    if (returned.id_len != 8 || returned.id[0] != 2 || memcmp(returned.id + 1, cid.id + 1, 7) != 0) {
+        ret = -1;
+    }
+
+    /* Short header, then long header packets */
+    memset(packet, 0, sizeof(packet));
+    packet[0] = 0x40;
+    memcpy(packet + 1, returned.id, returned.id_len);
+    if (ret == 0 && picoquic_threaded_server_route(server, packet, sizeof(packet)) != 2) {
+        ret = -1;
+    }
+    packet[1] = THREADED_SERVER_TEST_WORKERS;
+    if (ret == 0 && picoquic_threaded_server_route(server, packet, sizeof(packet)) != -1) {
+        ret = -1;
+    }
+    packet[0] = 0xC0;
+    packet[5] = 8;
+    packet[6] = 1;
+    if (ret == 0 && picoquic_threaded_server_route(server, packet, sizeof(packet)) != 1) {
+        ret = -1;
+    }
+    packet[5] = 0;
+    if (ret == 0 && picoquic_threaded_server_route(server, packet, sizeof(packet)) != -1) {
+        ret = -1;
+    }
+
+    /* The first worker runs on a cpu the test may use, and takes the NUMA node of that cpu */
+    if (ret == 0) {
+        cpu_set_t cpus;
+        int cpu = 0;
+
+        if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+            while (cpu < CPU_SETSIZE - 1 && !CPU_ISSET(cpu, &cpus)) {
+                cpu++;
+            }
+        }
+        if (picoquic_threaded_server_set_worker_cpu(server, THREADED_SERVER_TEST_WORKERS, cpu) == 0 ||
+            picoquic_threaded_server_set_worker_cpu(server, 0, cpu) != 0) {
+            ret = -1;
+        }
+        if (ret == 0 && picoquic_threaded_server_start(server) != 0) {
+            ret = -1;
+        }
+        if (ret == 0 && picoquic_threaded_server_set_worker_cpu(server, 1, cpu) == 0) {
+            ret = -1;
+        }
+        picoquic_threaded_server_stop(server);
+        if (ret == 0 && (picoquic_get_numa_node(server->workers[0].quic) != picoquic_cpu_numa_node(cpu) ||
+            picoquic_get_numa_node(server->workers[1].quic) != -1)) {
+            ret = -1;
+        }
+    }
+    picoquic_threaded_server_free(server);
+
+    return ret;
+}
@@ -28,6 +28,7 @@ static char const* test_sni[] = { "example.com", "example.net", "test.example.co
 static char const* test_alpn[] = { "hq05", "hq07", "hq09" };
 static const size_t nb_test_sni = sizeof(test_sni) / sizeof(char const*);
 static const size_t nb_test_alpn = sizeof(test_alpn) / sizeof(char const*);
+static char const* test_plugins[] = { NULL, "be.mpiraux.monitoring", "be.mpiraux.monitoring,be.michelfra.fec" };
 
 static int create_test_ticket(uint64_t current_time, uint32_t ttl, uint8_t* buf, uint16_t len)
 {
@@ -61,11 +62,12 @@ static int ticket_store_compare(picoquic_stored_ticket_t* s1, picoquic_stored_ti
         if (c2 == 0) {
             ret = -1;
         } else {
-            if (c1->time_valid_until != c2->time_valid_until || c1->sni_length != c2->sni_length || c1->alpn_length != c2->alpn_length || c1->ticket_length != c2->ticket_length || memcmp(c1->sni, c2->sni, c1->sni_length) != 0 || memcmp(c1->alpn, c2->alpn, c1->alpn_length) != 0 || memcmp(c1->ticket, c2->ticket, c1->ticket_length) != 0) {
+            if (c1->time_valid_until != c2->time_valid_until || c1->sni_length != c2->sni_length || c1->alpn_length != c2->alpn_length || c1->ticket_length != c2->ticket_length || memcmp(c1->sni, c2->sni, c1->sni_length) != 0 || memcmp(c1->alpn, c2->alpn, c1->alpn_length) != 0 || memcmp(c1->ticket, c2->ticket, c1->ticket_length) != 0 ||
+                c1->plugins_length != c2->plugins_length || strcmp(c1->plugins, c2->plugins) != 0) {
                 ret = -1;
             } else {
-                c1 = c1->next_ticket;
-                c2 = c2->next_ticket;
+                c1 = (picoquic_stored_ticket_t*)c1->hh.next;
+                c2 = (picoquic_stored_ticket_t*)c2->hh.next;
             }
         }
     }
@@ -120,7 +122,7 @@ int ticket_store_test()
             ret = picoquic_store_ticket(&p_first_ticket, current_time,
                 test_sni[i], (uint16_t)strlen(test_sni[i]),
                 test_alpn[j], (uint16_t)strlen(test_alpn[j]),
-                ticket, ticket_length);
+                ticket, ticket_length, test_plugins[j]);
             if (ret != 0) {
                 break;
             }
@@ -133,6 +135,7 @@ int ticket_store_test()
             uint16_t ticket_length = 0;
             uint16_t expected_length = (uint16_t)(64 + j * nb_test_sni + i);
             uint8_t* ticket = NULL;
+            char const* plugins;
             ret = picoquic_get_ticket(p_first_ticket, current_time,
                 test_sni[i], (uint16_t)strlen(test_sni[i]),
                 test_alpn[j], (uint16_t)strlen(test_alpn[j]),
@@ -144,6 +147,13 @@ int ticket_store_test()
                 ret = -1;
                 break;
             }
+            plugins = picoquic_get_ticket_plugins(p_first_ticket, current_time,
+                test_sni[i], (uint16_t)strlen(test_sni[i]),
+                test_alpn[j], (uint16_t)strlen(test_alpn[j]));
+            if ((plugins == NULL) != (test_plugins[j] == NULL) || (plugins != NULL && strcmp(plugins, test_plugins[j]) != 0)) {
+                ret = -1;
+                break;
+            }
         }
     }
     /* Store them on a file */
@@ -175,3 +185,106 @@ int ticket_store_test()
 
     return ret;
 }
+
+/*
+ * Many origins, saved once then appended to, and the expired tickets evicted as new ones come
+ */
+#define TICKET_STORE_APPEND_NB_SNI 2000
+
+static int ticket_store_append_one(picoquic_stored_ticket_t** pp_first_ticket, uint64_t current_time,
+    uint64_t ticket_time, uint32_t ttl, size_t rank, uint16_t ticket_length)
+{
+    char sni[32];
+    uint8_t ticket[128];
+    int ret = create_test_ticket(ticket_time / 1000, ttl, ticket, ticket_length);
+
+    if (ret == 0) {
+        (void)snprintf(sni, sizeof(sni), "origin%zu.example.com", rank);
+        ret = picoquic_store_ticket(pp_first_ticket, current_time, sni, (uint16_t)strlen(sni),
+            test_alpn[0], (uint16_t)strlen(test_alpn[0]), ticket, ticket_length, NULL);
+    }
+
+    return ret;
+}
+
+static long ticket_store_file_size(char const* file_name)
+{
+    long length = -1;
+    FILE* F = fopen(file_name, "rb");
+
+    if (F != NULL) {
+        if (fseek(F, 0, SEEK_END) == 0) {
+            length = ftell(F);
+        }
+        fclose(F);
+    }
+
+    return length;
+}
+
+int ticket_store_append_test()
+{
+    int ret = 0;
+    picoquic_stored_ticket_t* p_first_ticket = NULL;
+    picoquic_stored_ticket_t* p_first_ticket_bis = NULL;
+    uint64_t ticket_time = 40000000000ull;
+    uint64_t current_time = 50000000000ull;
+    uint32_t ttl = 100000;
+    uint8_t* ticket = NULL;
+    uint16_t ticket_length = 0;
+    char const* sni_0 = "origin0.example.com";
+    long file_size = 0;
+
+    for (size_t i = 0; ret == 0 && i < TICKET_STORE_APPEND_NB_SNI; i++) {
+        ret = ticket_store_append_one(&p_first_ticket, current_time, ticket_time, ttl, i, 64);
+    }
+    if (ret == 0) {
+        ret = picoquic_save_tickets(p_first_ticket, current_time, test_file_name);
+        file_size = ticket_store_file_size(test_file_name);
+    }
+
+    /* A newer ticket replaces the one of the same origin, and only the changes are appended */
+    if (ret == 0 && (ticket_store_append_one(&p_first_ticket, current_time, ticket_time + 1000, ttl, 0, 80) != 0 ||
+        ticket_store_append_one(&p_first_ticket, current_time, ticket_time, ttl, TICKET_STORE_APPEND_NB_SNI, 64) != 0 ||
+        HASH_COUNT(p_first_ticket) != TICKET_STORE_APPEND_NB_SNI + 1 ||
+        picoquic_append_tickets(p_first_ticket, current_time, test_file_name) != 0)) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        /* Two records: length, time, then SNI, ALPN and ticket with their lengths */
+        long expected = file_size + 2 * (4 + 8 + 3 * 2 + (long)strlen(test_alpn[0])) +
+            (long)strlen(sni_0) + 80 + (long)strlen("origin2000.example.com") + 64;
+
+        if (ticket_store_file_size(test_file_name) != expected) {
+            ret = -1;
+        }
+    }
+
+    /* On load, the appended record wins */
+    if (ret == 0 && (picoquic_load_tickets(&p_first_ticket_bis, current_time, test_file_name) != 0 ||
+        HASH_COUNT(p_first_ticket_bis) != TICKET_STORE_APPEND_NB_SNI + 1 ||
+        picoquic_get_ticket(p_first_ticket_bis, current_time, sni_0, (uint16_t)strlen(sni_0),
+            test_alpn[0], (uint16_t)strlen(test_alpn[0]), &ticket, &ticket_length) != 0 || ticket_length != 80 ||
+        picoquic_append_tickets(p_first_ticket_bis, current_time, test_file_name) != 0)) {
+        ret = -1;
+    }
+
+    /* Once expired, the oldest tickets are evicted as new ones are stored */
+    if (ret == 0) {
+        uint64_t later_time = ticket_time + ((uint64_t)ttl + 1) * 1000000;
+
+        for (size_t i = 0; ret == 0 && i < TICKET_STORE_APPEND_NB_SNI / 2; i++) {
+            ret = ticket_store_append_one(&p_first_ticket_bis, later_time, later_time, ttl, TICKET_STORE_APPEND_NB_SNI + 1 + i, 64);
+        }
+        if (ret == 0 && (HASH_COUNT(p_first_ticket_bis) != TICKET_STORE_APPEND_NB_SNI / 2 + 1 ||
+            picoquic_get_ticket(p_first_ticket_bis, later_time, sni_0, (uint16_t)strlen(sni_0),
+                test_alpn[0], (uint16_t)strlen(test_alpn[0]), &ticket, &ticket_length) == 0)) {
+            ret = -1;
+        }
+    }
+
+    picoquic_free_tickets(&p_first_ticket);
+    picoquic_free_tickets(&p_first_ticket_bis);
+
+    return ret;
+}
@@ -22,6 +22,7 @@
 #include <picotls.h>
 #include "../picoquic/picoquic_internal.h"
 #include "../picoquic/tls_api.h"
+#include "../picoquic/getset.h"
 #include "picoquictest_internal.h"
 #ifdef _WINDOWS
 #include "..\picoquic\wincompat.h"
@@ -29,8 +30,14 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+#include <time.h>
+#ifndef _WINDOWS
+#include <sys/time.h>
+#endif
 #include <openssl/pem.h>
 #include "picoquictest_internal.h"
+#include "picoquictest.h"
 
 #define PICOQUIC_TEST_SNI "test.example.com"
 #define PICOQUIC_TEST_ALPN "picoquic-test"
@@ -605,6 +612,7 @@ static void tls_api_delete_ctx(picoquic_test_tls_api_ctx_t* test_ctx)
     }
 
     free(test_ctx);
+    picoquictest_sim_packet_pool_clear();
 }
 
 static int tls_api_init_ctx(picoquic_test_tls_api_ctx_t** pctx, uint32_t proposed_version,
@@ -778,7 +786,7 @@ static int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
             uint64_t next_time = *simulated_time += 5000;
             uint64_t client_arrival, server_arrival;
 
-            free(packet);
+            picoquictest_sim_link_free_packet(packet);
 
             if (test_ctx->cnx_client != NULL && test_ctx->cnx_client->cnx_state != picoquic_state_disconnected) {
                 if (test_ctx->cnx_server != NULL && test_ctx->cnx_server->cnx_state != picoquic_state_disconnected && test_ctx->cnx_server->next_wake_time < test_ctx->cnx_client->next_wake_time) {
@@ -818,7 +826,7 @@ static int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
                     ret = -1;
                 }
 
-                free(packet);
+                picoquictest_sim_link_free_packet(packet);
             } else if (server_arrival < next_time && (packet = picoquictest_sim_link_dequeue(test_ctx->c_to_s_link, server_arrival)) != NULL) {
 
                 next_time = server_arrival;
@@ -852,7 +860,7 @@ static int tls_api_one_sim_round(picoquic_test_tls_api_ctx_t* test_ctx,
                 }
 
                 *was_active |= 1;
-                free(packet);
+                picoquictest_sim_link_free_packet(packet);
             } else {
                 *simulated_time = next_time;
             }
@@ -1497,6 +1505,54 @@ int tls_api_retry_test()
     return ret;
 }
 
+/*
+ * verify that the server does not create a connection context before the
+ * client has presented a valid retry token
+ */
+
+int tls_api_retry_stateless_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    int nb_trials = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        picoquic_set_cookie_mode(test_ctx->qserver, 1);
+
+        /* Until the client has received the retry, the server holds no state */
+        while (ret == 0 && test_ctx->cnx_client->retry_token == NULL) {
+            int was_active = 0;
+
+            if (++nb_trials > 64 || test_ctx->qserver->cnx_list != NULL) {
+                ret = -1;
+            } else {
+                ret = tls_api_one_sim_round(test_ctx, &simulated_time, &was_active);
+            }
+        }
+    }
+
+    if (ret == 0 && test_ctx->cnx_client->retry_token_length != PICOQUIC_RETRY_TOKEN_SIZE) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
 /*
 * verify that a connection is correctly established
 * if the client does not initially provide a key share
@@ -1715,6 +1771,238 @@ int keep_alive_test()
     return ret;
 }
 
+/* The adaptive interval grows while no rebinding is seen, then backs off to the longest one that held */
+int keep_alive_adaptive_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0, NULL);
+    picoquic_cnx_t* cnx = calloc(1, sizeof(picoquic_cnx_t));
+
+    if (quic == NULL || cnx == NULL) {
+        ret = -1;
+    } else {
+        cnx->quic = quic;
+        picoquic_enable_adaptive_keep_alive(cnx, 10000000, 40000000);
+        if (cnx->keep_alive_interval != 10000000) {
+            ret = -1;
+        }
+    }
+
+    /* Each interval is confirmed by the next PING: 10s, held, then 15s, held, then 22.5s */
+    for (int i = 0; ret == 0 && i < 4; i++) {
+        picoquic_keep_alive_sent(cnx);
+    }
+    if (ret == 0 && (cnx->keep_alive_safe != 15000000 || cnx->keep_alive_probe != 15000000 ||
+        cnx->keep_alive_interval != 22500000)) {
+        DBG_PRINTF("Keep alive interval %" PRIu64 " after 4 PINGs\n", cnx->keep_alive_interval);
+        ret = -1;
+    }
+
+    /* The NAT forgets the binding after 15s of silence, back to 10s, without growing again */
+    if (ret == 0) {
+        picoquic_keep_alive_rebinding(cnx);
+        picoquic_keep_alive_sent(cnx);
+        picoquic_keep_alive_sent(cnx);
+        if (cnx->keep_alive_max != 10000000 || cnx->keep_alive_interval != 10000000) {
+            DBG_PRINTF("Keep alive interval %" PRIu64 " after the rebinding\n", cnx->keep_alive_interval);
+            ret = -1;
+        }
+    }
+
+    /* The deadlines fall on the bucket, so that the idle connections wake together */
+    if (ret == 0) {
+        cnx->latest_progress_time = 1234567;
+        if (picoquic_keep_alive_time(cnx) != 12000000) {
+            ret = -1;
+        }
+        picoquic_set_keep_alive_bucket(quic, 0);
+        if (picoquic_keep_alive_time(cnx) != 11234567) {
+            ret = -1;
+        }
+    }
+
+    free(cnx);
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+
+    return ret;
+}
+
+/*
+ * Log policy test: the log plugin is only inserted in the server connections the policy selects
+ */
+
+static void log_policy_test_capture(picoquic_cnx_t* cnx, void* capture_ctx)
+{
+    (*(int*)capture_ctx)++;
+}
+
+static int log_policy_test_impl(char const* sni, uint32_t sample_one_in, uint64_t rtt_threshold, int expect_captured)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_log_policy_t policy;
+    int nb_captured = 0;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        return PICOQUIC_ERROR_MEMORY;
+    }
+
+    memset(&policy, 0, sizeof(policy));
+    policy.plugin_fname = "plugins/qlog/qlog.plugin";
+    policy.capture_fn = log_policy_test_capture;
+    policy.capture_ctx = &nb_captured;
+    policy.sni = sni;
+    policy.sample_one_in = sample_one_in;
+    policy.rtt_threshold = rtt_threshold;
+    if (ret == 0) {
+        ret = picoquic_set_log_policy(test_ctx->qserver, &policy);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    /* The thresholds are checked when preparing packets */
+    if (ret == 0) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+    }
+
+    if (ret == 0) {
+        int is_captured = test_ctx->cnx_server->log_policy_state == picoquic_log_policy_captured;
+        if (is_captured != expect_captured || nb_captured != expect_captured ||
+            test_ctx->cnx_client->logging_active || test_ctx->cnx_server->logging_active != expect_captured) {
+            DBG_PRINTF("Log policy for %s, 1/%u, rtt %" PRIu64 ": state %d, %d captures\n", sni, sample_one_in, rtt_threshold,
+                test_ctx->cnx_server->log_policy_state, nb_captured);
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Binary log test: the packets of a connection are recorded as binary records and decoded offline
+ */
+
+static int binary_log_test_count(FILE* F, char const* pattern)
+{
+    char line[512];
+    int nb_lines = 0;
+
+    rewind(F);
+    while (fgets(line, sizeof(line), F) != NULL) {
+        if (strstr(line, pattern) != NULL) {
+            nb_lines++;
+        }
+    }
+    return nb_lines;
+}
+
+int binary_log_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    FILE* F_trace = tmpfile();
+    FILE* F_log = tmpfile();
+    int nb_packets = 0;
+    int ret = (F_trace == NULL || F_log == NULL) ? -1 :
+        tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+
+    if (ret == 0) {
+        picoquic_set_binary_log(test_ctx->qclient, F_trace);
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+    }
+
+    if (ret == 0) {
+        rewind(F_trace);
+        nb_packets = picoquic_log_binary_trace(F_trace, F_log, 1);
+        /* The trace holds the packets sent and received by the client, each one decoded with its frames */
+        if (nb_packets <= 0 || binary_log_test_count(F_log, "T= ") != nb_packets ||
+            binary_log_test_count(F_log, "Prepared") == 0 || binary_log_test_count(F_log, "Decrypted") == 0 ||
+            binary_log_test_count(F_log, "Crypto HS frame") == 0) {
+            DBG_PRINTF("Binary log of %d packets not decoded as expected\n", nb_packets);
+            ret = -1;
+        }
+    }
+
+    /* A truncated trace is detected */
+    if (ret == 0) {
+        long trace_length;
+        FILE* F_truncated = tmpfile();
+        uint8_t* trace = NULL;
+
+        fseek(F_trace, 0, SEEK_END);
+        trace_length = ftell(F_trace);
+        if (F_truncated == NULL || trace_length <= 1 || (trace = (uint8_t*)malloc(trace_length)) == NULL) {
+            ret = -1;
+        } else {
+            rewind(F_trace);
+            if (fread(trace, trace_length, 1, F_trace) != 1 || fwrite(trace, trace_length - 1, 1, F_truncated) != 1) {
+                ret = -1;
+            } else {
+                rewind(F_truncated);
+                if (picoquic_log_binary_trace(F_truncated, F_log, 0) != -1) {
+                    ret = -1;
+                }
+            }
+        }
+        if (trace != NULL) {
+            free(trace);
+        }
+        if (F_truncated != NULL) {
+            fclose(F_truncated);
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+    if (F_trace != NULL) {
+        fclose(F_trace);
+    }
+    if (F_log != NULL) {
+        fclose(F_log);
+    }
+
+    return ret;
+}
+
+int log_policy_test()
+{
+    int ret = log_policy_test_impl(PICOQUIC_TEST_SNI, 1, 0, 1);
+
+    if (ret == 0) {
+        ret = log_policy_test_impl("other.example.com", 1, 0, 0);
+    }
+    if (ret == 0) {
+        ret = log_policy_test_impl(NULL, 0, 0, 0);
+    }
+    if (ret == 0) {
+        ret = log_policy_test_impl(PICOQUIC_TEST_SNI, 0, 1, 1);
+    }
+
+    return ret;
+}
+
 /*
  * Session resume test.
  */
@@ -2199,6 +2487,102 @@ int spurious_retransmit_test()
     return ret;
 }
 
+/*
+ * Transport counters test: the counters of the client and of the server agree after a transfer with
+ * losses, a caller of an older version only gets the fields it knows, and the RTT percentiles are
+ * those of the samples.
+ */
+int transport_stats_test()
+{
+    uint64_t loss_mask = 0;
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_cnx_stats_t client_stats;
+    picoquic_cnx_stats_t server_stats;
+    picoquic_path_stats_t path_stats;
+    picoquic_path_t* path_x = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        loss_mask = 0x6;
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q2_and_r2, sizeof(test_scenario_q2_and_r2));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        if (picoquic_get_cnx_stats(test_ctx->cnx_client, &client_stats, sizeof(client_stats)) != 0 ||
+            picoquic_get_cnx_stats(test_ctx->cnx_server, &server_stats, sizeof(server_stats)) != 0 ||
+            picoquic_get_path_stats(test_ctx->cnx_client, 0, &path_stats, sizeof(path_stats)) != 0) {
+            ret = -1;
+        } else if (client_stats.version != PICOQUIC_STATS_VERSION || client_stats.nb_paths != 1 ||
+            client_stats.packets_sent == 0 || client_stats.bytes_sent < server_stats.bytes_received ||
+            server_stats.bytes_sent < client_stats.bytes_received ||
+            client_stats.packets_sent < server_stats.packets_received ||
+            client_stats.ack_frames_received == 0 || server_stats.ack_frames_sent == 0 ||
+            client_stats.packets_lost + server_stats.packets_lost == 0 ||
+            client_stats.rtt_samples == 0 || client_stats.rtt_p50 == 0 ||
+            client_stats.rtt_p50 > client_stats.rtt_p90 || client_stats.rtt_p90 > client_stats.rtt_p99) {
+            DBG_PRINTF("Wrong counters, %d packets sent, %d received by the peer, %d lost\n",
+                (int)client_stats.packets_sent, (int)server_stats.packets_received, (int)client_stats.packets_lost);
+            ret = -1;
+        } else if (path_stats.packets_sent != client_stats.packets_sent || path_stats.rtt_p99 != client_stats.rtt_p99 ||
+            path_stats.cwin != test_ctx->cnx_client->path[0]->cwin) {
+            ret = -1;
+        }
+    }
+
+    /* Fields past the size of the caller are left alone, and there is no second path */
+    if (ret == 0) {
+        memset(&path_stats, 0xff, sizeof(path_stats));
+        if (picoquic_get_path_stats(test_ctx->cnx_client, 0, &path_stats, offsetof(picoquic_path_stats_t, bytes_sent)) != 0 ||
+            path_stats.version != PICOQUIC_STATS_VERSION || path_stats.packets_sent != client_stats.packets_sent ||
+            path_stats.bytes_sent != UINT64_MAX ||
+            picoquic_get_path_stats(test_ctx->cnx_client, 1, &path_stats, sizeof(path_stats)) != -1) {
+            ret = -1;
+        }
+    }
+
+    /* 1000 samples from 1 to 1000 microseconds, the percentiles are within the 12% of a bucket */
+    if (ret == 0 && (path_x = (picoquic_path_t*)calloc(1, sizeof(picoquic_path_t))) == NULL) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        picoquic_cnx_t cnx = { 0 };
+
+        cnx.quic = test_ctx->qclient;
+        cnx.path = &path_x;
+        cnx.nb_paths = 1;
+        for (uint64_t rtt = 1; rtt <= 1000; rtt++) {
+            picoquic_path_record_rtt(path_x, rtt);
+        }
+        /* 10 us of pacing, then 20 us blocked by the window, up to now */
+        picoquic_path_set_send_limit(path_x, picoquic_send_limit_pacing, simulated_time - 30);
+        picoquic_path_set_send_limit(path_x, picoquic_send_limit_cwnd, simulated_time - 20);
+        if (picoquic_get_path_stats(&cnx, 0, &path_stats, sizeof(path_stats)) != 0 || path_stats.rtt_samples != 1000 ||
+            path_stats.rtt_p50 < 440 || path_stats.rtt_p50 > 560 || path_stats.rtt_p90 < 790 || path_stats.rtt_p90 > 1010 ||
+            path_stats.rtt_p99 < 870 || path_stats.rtt_p99 > 1110 ||
+            path_stats.pacing_limited_time != 10 || path_stats.cwnd_limited_time != 20) {
+            DBG_PRINTF("RTT percentiles %d, %d, %d\n", (int)path_stats.rtt_p50, (int)path_stats.rtt_p90, (int)path_stats.rtt_p99);
+            ret = -1;
+        }
+        free(path_x);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
 #if 0
 
 /*
@@ -2583,28 +2967,130 @@ int hp_enc_1rtt_test()
     return ret;
 }
 
-int bad_certificate_test()
+/*
+ * The header protection masks computed in batch are those of the packets taken one by one,
+ * and the packets of a burst are protected such that the peer can read them.
+ */
+#define HP_MASK_BATCH_TEST_NB 20
+#define HP_MASK_BATCH_TEST_SEGMENTS 8
+
+int hp_mask_batch_test()
 {
-    uint64_t simulated_time = 0;
     uint64_t loss_mask = 0;
+    uint64_t simulated_time = 0;
     picoquic_test_tls_api_ctx_t* test_ctx = NULL;
     int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
 
-    /* Delete the server context, and recreate it with the bad certificate */
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
 
-    if (ret == 0)
-    {
-        if (test_ctx->qserver != NULL) {
-            picoquic_free(test_ctx->qserver);
-        }
+    if (ret == 0) {
+        ret = wait_application_pn_enc_ready(test_ctx, &simulated_time);
+    }
 
-        test_ctx->qserver = picoquic_create(8,
-            PICOQUIC_TEST_SERVER_BAD_CERT, PICOQUIC_TEST_SERVER_KEY, PICOQUIC_TEST_CERT_STORE,
-            PICOQUIC_TEST_ALPN, test_api_callback, (void*)&test_ctx->server_callback, NULL, NULL, NULL,
-            simulated_time, &simulated_time, NULL,
-            test_ticket_encrypt_key, sizeof(test_ticket_encrypt_key), NULL);
+    if (ret == 0) {
+        picoquic_crypto_context_t* ctx = &test_ctx->cnx_client->crypto_context[3];
+        uint8_t sample_bytes[16 * HP_MASK_BATCH_TEST_NB];
+        const uint8_t* samples[HP_MASK_BATCH_TEST_NB];
+        uint8_t masks[5 * HP_MASK_BATCH_TEST_NB];
+        uint8_t masks_one_by_one[5 * HP_MASK_BATCH_TEST_NB];
+
+        for (size_t i = 0; i < sizeof(sample_bytes); i++) {
+            sample_bytes[i] = (uint8_t)(7 * i + 1);
+        }
+        for (int i = 0; i < HP_MASK_BATCH_TEST_NB; i++) {
+            samples[i] = sample_bytes + 16 * i;
+        }
 
-        if (test_ctx->qserver == NULL) {
+        if (ctx->hp_ecb == NULL) {
+            DBG_PRINTF("%s", "No block cipher context for the AES header protection\n");
+            ret = -1;
+        } else {
+            picoquic_hp_mask_batch(ctx->hp_enc, ctx->hp_ecb, samples, masks, HP_MASK_BATCH_TEST_NB);
+            picoquic_hp_mask_batch(ctx->hp_enc, NULL, samples, masks_one_by_one, HP_MASK_BATCH_TEST_NB);
+            if (memcmp(masks, masks_one_by_one, sizeof(masks)) != 0) {
+                DBG_PRINTF("%s", "Masks computed in batch differ\n");
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_cnx_t* cnx = test_ctx->cnx_client;
+        uint64_t first_pn = cnx->path[0]->pkt_ctx[picoquic_packet_context_application].send_sequence;
+        uint64_t last_pn;
+        uint8_t data[HP_MASK_BATCH_TEST_SEGMENTS * PICOQUIC_MAX_PACKET_SIZE];
+        uint8_t* send_buffer = (uint8_t*)malloc(sizeof(data));
+        size_t segment_lengths[HP_MASK_BATCH_TEST_SEGMENTS];
+        size_t nb_segments = 0;
+        picoquic_path_t* path_x = NULL;
+
+        memset(data, 0x5A, sizeof(data));
+        if (send_buffer == NULL) {
+            ret = -1;
+        } else {
+            ret = picoquic_add_to_stream(cnx, 4, data, sizeof(data), 0);
+        }
+        if (ret == 0) {
+            ret = picoquic_prepare_packets(cnx, simulated_time, send_buffer, sizeof(data),
+                segment_lengths, HP_MASK_BATCH_TEST_SEGMENTS, &nb_segments, &path_x);
+        }
+        if (ret == 0 && (nb_segments < 2 || cnx->hp_batch != NULL)) {
+            DBG_PRINTF("Expected a burst, got %d segments\n", (int)nb_segments);
+            ret = -1;
+        }
+
+        last_pn = cnx->path[0]->pkt_ctx[picoquic_packet_context_application].send_sequence;
+
+        for (size_t i = 0, offset = 0; ret == 0 && i < nb_segments; offset += segment_lengths[i++]) {
+            int new_context_created = 0;
+
+            ret = picoquic_incoming_packet(test_ctx->qserver, send_buffer + offset, (uint32_t)segment_lengths[i],
+                (struct sockaddr*)&test_ctx->client_addr, (struct sockaddr*)&test_ctx->server_addr, 0,
+                simulated_time, &new_context_created);
+        }
+
+        for (uint64_t pn = first_pn; ret == 0 && pn < last_pn; pn++) {
+            if (picoquic_is_pn_already_received(test_ctx->cnx_server->path[0], picoquic_packet_context_application, pn) == 0) {
+                DBG_PRINTF("Packet %d of the burst was not decrypted\n", (int)pn);
+                ret = -1;
+            }
+        }
+
+        free(send_buffer);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int bad_certificate_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    /* Delete the server context, and recreate it with the bad certificate */
+
+    if (ret == 0)
+    {
+        if (test_ctx->qserver != NULL) {
+            picoquic_free(test_ctx->qserver);
+        }
+
+        test_ctx->qserver = picoquic_create(8,
+            PICOQUIC_TEST_SERVER_BAD_CERT, PICOQUIC_TEST_SERVER_KEY, PICOQUIC_TEST_CERT_STORE,
+            PICOQUIC_TEST_ALPN, test_api_callback, (void*)&test_ctx->server_callback, NULL, NULL, NULL,
+            simulated_time, &simulated_time, NULL,
+            test_ticket_encrypt_key, sizeof(test_ticket_encrypt_key), NULL);
+
+        if (test_ctx->qserver == NULL) {
             ret = -1;
         }
     }
@@ -3336,3 +3822,1490 @@ int cubic_test()
 
     return ret;
 }
+
+/*
+ * Cost of the connection establishment: many clients connect at the same time to the same server,
+ * their packets going straight from one context to the other. Reports the handshakes per second,
+ * the CPU time per handshake spent in each stage, and the memory held by each server connection.
+ */
+#define HANDSHAKE_BENCH_NB_CNX 64
+#define HANDSHAKE_BENCH_MAX_ROUNDS 32
+
+static int handshake_bench_exchange(picoquic_quic_t* quic_from, struct sockaddr* addr_from,
+    picoquic_quic_t* quic_to, struct sockaddr* addr_to, uint64_t current_time)
+{
+    int ret = 0;
+    uint8_t send_buffer[PICOQUIC_MAX_PACKET_SIZE];
+    picoquic_cnx_t* cnx = picoquic_get_first_cnx(quic_from);
+
+    while (ret == 0 && cnx != NULL) {
+        size_t length = 0;
+        picoquic_path_t* path_x = NULL;
+
+        do {
+            ret = picoquic_prepare_packet(cnx, current_time, send_buffer, sizeof(send_buffer), &length, &path_x);
+            if (ret == 0 && length > 0) {
+                int new_context_created = 0;
+
+                ret = picoquic_incoming_packet(quic_to, send_buffer, (uint32_t)length, addr_from, addr_to, 0,
+                    current_time, &new_context_created);
+            }
+        } while (ret == 0 && length > 0);
+        cnx = picoquic_get_next_cnx(cnx);
+    }
+
+    return ret;
+}
+
+static int handshake_bench_nb_ready(picoquic_quic_t* quic)
+{
+    int nb_ready = 0;
+
+    for (picoquic_cnx_t* cnx = picoquic_get_first_cnx(quic); cnx != NULL; cnx = picoquic_get_next_cnx(cnx)) {
+        if (picoquic_get_cnx_state(cnx) == picoquic_state_client_ready ||
+            picoquic_get_cnx_state(cnx) == picoquic_state_server_ready) {
+            nb_ready++;
+        }
+    }
+
+    return nb_ready;
+}
+
+int handshake_bench_test()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_profile_t client_profile;
+    picoquic_profile_t server_profile;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 1, 0);
+
+    memset(&client_profile, 0, sizeof(client_profile));
+    memset(&server_profile, 0, sizeof(server_profile));
+
+    if (ret == 0) {
+        picoquic_set_profile(test_ctx->qclient, &client_profile);
+        picoquic_set_profile(test_ctx->qserver, &server_profile);
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+    }
+
+    for (int i = 1; ret == 0 && i < HANDSHAKE_BENCH_NB_CNX; i++) {
+        picoquic_cnx_t* cnx = picoquic_create_cnx(test_ctx->qclient,
+            picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->server_addr, simulated_time, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+
+        ret = (cnx == NULL) ? -1 : picoquic_start_client_cnx(cnx);
+    }
+
+    if (ret == 0) {
+        struct timeval tv_start;
+        struct timeval tv_end;
+        clock_t cpu_start = clock();
+        uint64_t duration;
+        uint64_t cpu_time;
+        int nb_rounds = 0;
+        picoquic_memory_stats_t stats;
+        char const* stage_names[picoquic_nb_profile_categories] = { "tls", "incoming", "prepare", "plugins" };
+
+        gettimeofday(&tv_start, NULL);
+        while (ret == 0 && nb_rounds < HANDSHAKE_BENCH_MAX_ROUNDS &&
+            (handshake_bench_nb_ready(test_ctx->qclient) < HANDSHAKE_BENCH_NB_CNX ||
+                handshake_bench_nb_ready(test_ctx->qserver) < HANDSHAKE_BENCH_NB_CNX)) {
+            ret = handshake_bench_exchange(test_ctx->qclient, (struct sockaddr*)&test_ctx->client_addr,
+                test_ctx->qserver, (struct sockaddr*)&test_ctx->server_addr, simulated_time);
+            if (ret == 0) {
+                ret = handshake_bench_exchange(test_ctx->qserver, (struct sockaddr*)&test_ctx->server_addr,
+                    test_ctx->qclient, (struct sockaddr*)&test_ctx->client_addr, simulated_time);
+            }
+            simulated_time += 1000;
+            nb_rounds++;
+        }
+        gettimeofday(&tv_end, NULL);
+        cpu_time = (uint64_t)(clock() - cpu_start) * 1000000 / CLOCKS_PER_SEC;
+        duration = (uint64_t)((tv_end.tv_sec - tv_start.tv_sec) * 1000000 + (tv_end.tv_usec - tv_start.tv_usec));
+
+        if (ret == 0 && (handshake_bench_nb_ready(test_ctx->qclient) < HANDSHAKE_BENCH_NB_CNX ||
+            handshake_bench_nb_ready(test_ctx->qserver) < HANDSHAKE_BENCH_NB_CNX)) {
+            DBG_PRINTF("Only %d clients and %d servers ready after %d rounds\n", handshake_bench_nb_ready(test_ctx->qclient),
+                handshake_bench_nb_ready(test_ctx->qserver), nb_rounds);
+            ret = -1;
+        }
+
+        if (ret == 0) {
+            picoquic_quic_get_memory_stats(test_ctx->qserver, &stats);
+            fprintf(stderr, "Handshakes: %d in %" PRIu64 " us, %" PRIu64 " per second, %" PRIu64 " us of CPU each\n",
+                HANDSHAKE_BENCH_NB_CNX, duration, (duration == 0) ? 0 : HANDSHAKE_BENCH_NB_CNX * 1000000ull / duration,
+                cpu_time / HANDSHAKE_BENCH_NB_CNX);
+            for (int i = 0; i < picoquic_nb_profile_categories; i++) {
+                fprintf(stderr, "    %-8s client %" PRIu64 " us, server %" PRIu64 " us per handshake, %" PRIu64 " + %" PRIu64 " calls\n",
+                    stage_names[i], client_profile.cpu_time[i] / 1000 / HANDSHAKE_BENCH_NB_CNX,
+                    server_profile.cpu_time[i] / 1000 / HANDSHAKE_BENCH_NB_CNX,
+                    client_profile.nb_calls[i], server_profile.nb_calls[i]);
+            }
+            fprintf(stderr, "    Server memory peak per connection: %" PRIu64 " bytes\n", stats.peak / HANDSHAKE_BENCH_NB_CNX);
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Cost of receiving a packet on an established connection: the server sends a long stream to the client,
+ * and the CPU time that the client spends in picoquic_incoming_packet() is divided by the number of packets.
+ */
+int receive_bench_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_profile_t client_profile;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    memset(&client_profile, 0, sizeof(client_profile));
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    /* Only the packets received once the connection is established are counted */
+    if (ret == 0) {
+        picoquic_set_profile(test_ctx->qclient, &client_profile);
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        uint64_t nb_packets = client_profile.nb_calls[picoquic_profile_incoming];
+
+        if (!test_ctx->test_finished || nb_packets == 0) {
+            DBG_PRINTF("Transfer not complete after %" PRIu64 " packets\n", nb_packets);
+            ret = -1;
+        } else {
+            fprintf(stderr, "Receive: %" PRIu64 " packets, %" PRIu64 " ns of CPU each\n",
+                nb_packets, client_profile.cpu_time[picoquic_profile_incoming] / nb_packets);
+        }
+    }
+
+    if (test_ctx != NULL) {
+        picoquic_set_profile(test_ctx->qclient, NULL);
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Performance scenarios, run by picoquic_t -b, which prints their results as JSON.
+ * Each one fills a picoquic_bench_result_t, the counters covering both the client
+ * and the server.
+ */
+#define PICOQUIC_BENCH_SMALL_STREAMS_ROUNDS 16
+#define PICOQUIC_BENCH_LOSS_MASK 0x0000800000008000ull /* 2 packets in 64 */
+
+static char const* bench_multipath_plugins[] = { "plugins/multipath/multipath.plugin" };
+static char const* bench_fec_plugins[] = { "plugins/fec/fec_rlc_gf256_window.plugin" };
+
+typedef struct st_tls_api_bench_clock_t {
+    struct timeval tv_start;
+    clock_t cpu_start;
+} tls_api_bench_clock_t;
+
+static void tls_api_bench_clock_start(tls_api_bench_clock_t* bench_clock)
+{
+    gettimeofday(&bench_clock->tv_start, NULL);
+    bench_clock->cpu_start = clock();
+}
+
+static void tls_api_bench_clock_stop(tls_api_bench_clock_t* bench_clock, picoquic_bench_result_t* result)
+{
+    struct timeval tv_end;
+
+    gettimeofday(&tv_end, NULL);
+    result->cpu_time = (uint64_t)(clock() - bench_clock->cpu_start) * 1000000 / CLOCKS_PER_SEC;
+    result->wall_time = (uint64_t)((tv_end.tv_sec - bench_clock->tv_start.tv_sec) * 1000000 +
+        (tv_end.tv_usec - bench_clock->tv_start.tv_usec));
+}
+
+/* Packets sent and allocations of the connections of a context, and of its packet pool */
+static void tls_api_bench_count(picoquic_quic_t* quic, picoquic_bench_result_t* result)
+{
+    picoquic_memory_stats_t memory_stats;
+    picoquic_packet_pool_stats_t pool_stats;
+
+    for (picoquic_cnx_t* cnx = picoquic_get_first_cnx(quic); cnx != NULL; cnx = picoquic_get_next_cnx(cnx)) {
+        picoquic_cnx_stats_t stats;
+
+        if (picoquic_get_cnx_stats(cnx, &stats, sizeof(stats)) == 0) {
+            result->nb_packets += stats.packets_sent;
+        }
+    }
+    picoquic_quic_get_memory_stats(quic, &memory_stats);
+    picoquic_get_packet_pool_stats(quic, &pool_stats);
+    result->nb_allocations += memory_stats.nb_charges + pool_stats.packet_misses + pool_stats.frame_misses;
+}
+
+/* The plugins are inserted when the connections are created, so the client one is created again */
+static int tls_api_bench_set_plugins(picoquic_test_tls_api_ctx_t* test_ctx, char const** plugin_fnames, int nb_plugins,
+    uint64_t simulated_time)
+{
+    int ret = picoquic_set_local_plugins(test_ctx->qclient, plugin_fnames, nb_plugins);
+
+    if (ret == 0) {
+        ret = picoquic_set_local_plugins(test_ctx->qserver, plugin_fnames, nb_plugins);
+    }
+
+    if (ret == 0) {
+        picoquic_delete_cnx(test_ctx->cnx_client);
+        test_ctx->cnx_client = picoquic_create_cnx(test_ctx->qclient,
+            picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->server_addr, simulated_time, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+        if (test_ctx->cnx_client == NULL) {
+            DBG_PRINTF("Cannot create the client connection with %s\n", plugin_fnames[0]);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/* Runs the scenario nb_rounds times on the same connection, with new streams at each round */
+static int tls_api_bench_scenario(picoquic_bench_result_t* result, test_api_stream_desc_t const* scenario,
+    size_t sizeof_scenario, int nb_rounds, uint64_t data_loss_mask, char const** plugin_fnames, int nb_plugins)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    size_t nb_streams = sizeof_scenario / sizeof(test_api_stream_desc_t);
+    test_api_stream_desc_t round_scenario[PICOQUIC_TEST_MAX_TEST_STREAMS];
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    tls_api_bench_clock_t bench_clock;
+    int ret = 0;
+
+    tls_api_bench_clock_start(&bench_clock);
+    ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 1, 0);
+
+    if (ret == 0 && nb_plugins > 0) {
+        ret = tls_api_bench_set_plugins(test_ctx, plugin_fnames, nb_plugins, simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    for (int round = 0; ret == 0 && round < nb_rounds; round++) {
+        uint64_t stream_offset = 4 * nb_streams * (uint64_t)round;
+
+        for (size_t i = 0; i < test_ctx->nb_test_streams; i++) {
+            test_api_delete_test_stream(&test_ctx->test_stream[i]);
+        }
+        for (size_t i = 0; i < nb_streams; i++) {
+            round_scenario[i] = scenario[i];
+            round_scenario[i].stream_id += stream_offset;
+            if (round_scenario[i].previous_stream_id != 0) {
+                round_scenario[i].previous_stream_id += stream_offset;
+            }
+        }
+
+        loss_mask = data_loss_mask;
+        ret = test_api_init_send_recv_scenario(test_ctx, round_scenario, sizeof_scenario);
+        if (ret == 0) {
+            ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+        }
+
+        for (size_t i = 0; ret == 0 && i < test_ctx->nb_test_streams; i++) {
+            if (test_ctx->test_stream[i].q_recv_nb != test_ctx->test_stream[i].q_len ||
+                test_ctx->test_stream[i].r_recv_nb != test_ctx->test_stream[i].r_len) {
+                DBG_PRINTF("Stream %" PRIu64 " incomplete at round %d\n", test_ctx->test_stream[i].stream_id, round);
+                ret = -1;
+            } else {
+                result->bytes += test_ctx->test_stream[i].q_len + test_ctx->test_stream[i].r_len;
+            }
+        }
+    }
+
+    if (ret == 0 && (test_ctx->server_callback.error_detected || test_ctx->client_callback.error_detected)) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        result->nb_connections = 1;
+        result->simulated_time = simulated_time;
+        tls_api_bench_count(test_ctx->qclient, result);
+        tls_api_bench_count(test_ctx->qserver, result);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+    tls_api_bench_clock_stop(&bench_clock, result);
+
+    return ret;
+}
+
+int bulk_bench(picoquic_bench_result_t* result)
+{
+    return tls_api_bench_scenario(result, test_scenario_sustained, sizeof(test_scenario_sustained), 1, 0, NULL, 0);
+}
+
+int small_streams_bench(picoquic_bench_result_t* result)
+{
+    return tls_api_bench_scenario(result, test_scenario_many_streams, sizeof(test_scenario_many_streams),
+        PICOQUIC_BENCH_SMALL_STREAMS_ROUNDS, 0, NULL, 0);
+}
+
+int lossy_link_bench(picoquic_bench_result_t* result)
+{
+    return tls_api_bench_scenario(result, test_scenario_very_long, sizeof(test_scenario_very_long), 1,
+        PICOQUIC_BENCH_LOSS_MASK, NULL, 0);
+}
+
+/* The simulation has a single pair of links, so this measures the cost of the plugin on one path */
+int multipath_bench(picoquic_bench_result_t* result)
+{
+    return tls_api_bench_scenario(result, test_scenario_very_long, sizeof(test_scenario_very_long), 1, 0,
+        bench_multipath_plugins, (int)(sizeof(bench_multipath_plugins) / sizeof(char const*)));
+}
+
+int fec_bench(picoquic_bench_result_t* result)
+{
+    return tls_api_bench_scenario(result, test_scenario_very_long, sizeof(test_scenario_very_long), 1,
+        PICOQUIC_BENCH_LOSS_MASK, bench_fec_plugins, (int)(sizeof(bench_fec_plugins) / sizeof(char const*)));
+}
+
+/* The handshakes of handshake_bench_test(), without data */
+int handshake_storm_bench(picoquic_bench_result_t* result)
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    tls_api_bench_clock_t bench_clock;
+    int nb_rounds = 0;
+    int ret;
+
+    tls_api_bench_clock_start(&bench_clock);
+    ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    for (int i = 1; ret == 0 && i < HANDSHAKE_BENCH_NB_CNX; i++) {
+        picoquic_cnx_t* cnx = picoquic_create_cnx(test_ctx->qclient,
+            picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&test_ctx->server_addr, simulated_time, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+
+        ret = (cnx == NULL) ? -1 : picoquic_start_client_cnx(cnx);
+    }
+
+    while (ret == 0 && nb_rounds < HANDSHAKE_BENCH_MAX_ROUNDS &&
+        (handshake_bench_nb_ready(test_ctx->qclient) < HANDSHAKE_BENCH_NB_CNX ||
+            handshake_bench_nb_ready(test_ctx->qserver) < HANDSHAKE_BENCH_NB_CNX)) {
+        ret = handshake_bench_exchange(test_ctx->qclient, (struct sockaddr*)&test_ctx->client_addr,
+            test_ctx->qserver, (struct sockaddr*)&test_ctx->server_addr, simulated_time);
+        if (ret == 0) {
+            ret = handshake_bench_exchange(test_ctx->qserver, (struct sockaddr*)&test_ctx->server_addr,
+                test_ctx->qclient, (struct sockaddr*)&test_ctx->client_addr, simulated_time);
+        }
+        simulated_time += 1000;
+        nb_rounds++;
+    }
+
+    if (ret == 0 && handshake_bench_nb_ready(test_ctx->qserver) < HANDSHAKE_BENCH_NB_CNX) {
+        DBG_PRINTF("Only %d handshakes complete\n", handshake_bench_nb_ready(test_ctx->qserver));
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        result->nb_connections = HANDSHAKE_BENCH_NB_CNX;
+        result->simulated_time = simulated_time;
+        tls_api_bench_count(test_ctx->qclient, result);
+        tls_api_bench_count(test_ctx->qserver, result);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+    tls_api_bench_clock_stop(&bench_clock, result);
+
+    return ret;
+}
+
+/*
+ * The client marks its packets and the server reports the marks of the packets it receives, with the given TOS.
+ * The client path is validated when the counts come back, and fails when the server sends plain ACK frames.
+ */
+static int ecn_test_one(int server_tos, picoquic_ecn_state_enum expected_state)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        picoquic_set_ecn(test_ctx->qclient, PICOQUIC_ECN_ECT0);
+        test_ctx->qserver->rcv_tos = server_tos;
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_sustained, sizeof(test_scenario_sustained));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        picoquic_path_t* path_x = test_ctx->cnx_client->path[0];
+        uint64_t nb_marked = 0;
+
+        for (int pc = 0; pc < picoquic_nb_packet_context; pc++) {
+            nb_marked += test_ctx->cnx_server->path[0]->pkt_ctx[pc].ecn_received[(server_tos == PICOQUIC_ECN_CE) ? 2 : 0];
+        }
+
+        if (!test_ctx->test_finished || path_x->ecn_state != expected_state) {
+            DBG_PRINTF("ECN state %d instead of %d\n", (int)path_x->ecn_state, (int)expected_state);
+            ret = -1;
+        } else if (server_tos == 0 && (nb_marked != 0 || path_x->ecn_ect_acked != 0)) {
+            ret = -1;
+        } else if (server_tos != 0 && (nb_marked == 0 || path_x->ecn_ect_acked == 0 || path_x->ecn_ect_acked > nb_marked ||
+            path_x->ecn_ce_acked != ((server_tos == PICOQUIC_ECN_CE) ? path_x->ecn_ect_acked : 0))) {
+            DBG_PRINTF("%" PRIu64 " marked packets, %" PRIu64 " reported, %" PRIu64 " CE\n",
+                nb_marked, path_x->ecn_ect_acked, path_x->ecn_ce_acked);
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int ecn_test()
+{
+    int ret = ecn_test_one(PICOQUIC_ECN_ECT0, picoquic_ecn_capable);
+
+    if (ret == 0) {
+        ret = ecn_test_one(PICOQUIC_ECN_CE, picoquic_ecn_capable);
+    }
+
+    if (ret == 0) {
+        ret = ecn_test_one(0, picoquic_ecn_failed);
+    }
+
+    return ret;
+}
+
+/*
+ * Connections ready at the same time take turns of one datagram when the send budget is one packet,
+ * until none is ready.
+ */
+#define SEND_BUDGET_TEST_NB_CNX 3
+
+int send_budget_test()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_cnx_t* cnx[SEND_BUDGET_TEST_NB_CNX];
+    int nb_turns[SEND_BUDGET_TEST_NB_CNX] = { 0 };
+    uint8_t send_buffer[4 * PICOQUIC_MAX_PACKET_SIZE];
+    size_t segment_lengths[4];
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        cnx[0] = test_ctx->cnx_client;
+        for (int i = 1; ret == 0 && i < SEND_BUDGET_TEST_NB_CNX; i++) {
+            cnx[i] = picoquic_create_cnx(test_ctx->qclient, picoquic_null_connection_id, picoquic_null_connection_id,
+                (struct sockaddr*)&test_ctx->server_addr, simulated_time, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, 1);
+            ret = (cnx[i] == NULL) ? -1 : picoquic_start_client_cnx(cnx[i]);
+        }
+        picoquic_set_send_budget(test_ctx->qclient, 1, 0);
+        /* A time of 0 would not bound the wake times */
+        simulated_time += 1000;
+    }
+
+    for (int turn = 0; ret == 0; turn++) {
+        picoquic_cnx_t* cnx_next = NULL;
+        picoquic_path_t* path = NULL;
+        size_t nb_segments = 0;
+        int i = 0;
+
+        ret = picoquic_prepare_next_packets(test_ctx->qclient, simulated_time, send_buffer, sizeof(send_buffer),
+            segment_lengths, 4, &nb_segments, &cnx_next, &path);
+        if (ret != 0 || cnx_next == NULL) {
+            break;
+        }
+        while (i < SEND_BUDGET_TEST_NB_CNX && cnx[i] != cnx_next) {
+            i++;
+        }
+        if (i >= SEND_BUDGET_TEST_NB_CNX || nb_segments > 1 || turn > 10 * SEND_BUDGET_TEST_NB_CNX) {
+            DBG_PRINTF("Turn %d gives %d datagrams\n", turn, (int)nb_segments);
+            ret = -1;
+        } else if (turn < SEND_BUDGET_TEST_NB_CNX && nb_turns[i] != 0) {
+            DBG_PRINTF("Connection %d served twice in the first round\n", i);
+            ret = -1;
+        } else {
+            nb_turns[i]++;
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < SEND_BUDGET_TEST_NB_CNX; i++) {
+        if (nb_turns[i] == 0) {
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Key updates started by each side in turn while data flows. The next phase keys are ready before
+ * the update, the peer follows, and the previous decryption key is released after the retention delay.
+ */
+int key_rotation_test()
+{
+    uint64_t loss_mask = 0;
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = wait_application_pn_enc_ready(test_ctx, &simulated_time);
+    }
+
+    if (ret == 0) {
+        picoquic_crypto_context_t* c_ctx = &test_ctx->cnx_client->crypto_context[3];
+        picoquic_crypto_context_t* s_ctx = &test_ctx->cnx_server->crypto_context[3];
+
+        if (c_ctx->aead_encrypt_next == NULL || c_ctx->aead_decrypt_next == NULL ||
+            s_ctx->aead_encrypt_next == NULL || s_ctx->aead_decrypt_next == NULL) {
+            DBG_PRINTF("%s", "Next phase keys not ready\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_very_long, sizeof(test_scenario_very_long));
+    }
+
+    /* The client starts, and cannot start again before the server followed */
+    if (ret == 0) {
+        void* next_encrypt = test_ctx->cnx_client->crypto_context[3].aead_encrypt_next;
+
+        if (picoquic_start_key_rotation(test_ctx->cnx_client, simulated_time) != 0 ||
+            test_ctx->cnx_client->crypto_context[3].aead_encrypt != next_encrypt ||
+            test_ctx->cnx_client->crypto_context[3].aead_encrypt_next == NULL ||
+            picoquic_start_key_rotation(test_ctx->cnx_client, simulated_time) != PICOQUIC_ERROR_KEY_ROTATION_NOT_READY) {
+            DBG_PRINTF("%s", "Client key rotation failed\n");
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < 1024 && test_ctx->cnx_server->key_phase_dec == 0; i++) {
+        int was_active = 0;
+
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, &was_active);
+    }
+
+    /* Then the server, once the client is back in step */
+    if (ret == 0) {
+        if (test_ctx->cnx_server->key_phase_dec != 1 || test_ctx->cnx_server->key_phase_enc != 1 ||
+            test_ctx->cnx_server->crypto_context[3].aead_decrypt_old == NULL) {
+            DBG_PRINTF("%s", "Server did not follow the key update\n");
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < 1024 && test_ctx->cnx_client->key_phase_dec == 0; i++) {
+        int was_active = 0;
+
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, &was_active);
+    }
+
+    if (ret == 0 && picoquic_start_key_rotation(test_ctx->cnx_server, simulated_time) != 0) {
+        DBG_PRINTF("%s", "Server key rotation failed\n");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0) {
+        if (test_ctx->server_callback.error_detected || test_ctx->client_callback.error_detected ||
+            test_ctx->test_stream[0].q_recv_nb != test_ctx->test_stream[0].q_len ||
+            test_ctx->test_stream[0].r_recv_nb != test_ctx->test_stream[0].r_len) {
+            DBG_PRINTF("%s", "Data not received across the key updates\n");
+            ret = -1;
+        } else if (test_ctx->cnx_client->key_phase_enc != 0 || test_ctx->cnx_client->key_phase_dec != 0 ||
+            test_ctx->cnx_server->key_phase_enc != 0 || test_ctx->cnx_server->key_phase_dec != 0 ||
+            test_ctx->cnx_client->crypto_context[3].nb_key_phases_received != 2 ||
+            test_ctx->cnx_server->crypto_context[3].nb_key_phases_received != 2) {
+            DBG_PRINTF("Key phases client %d/%d, server %d/%d\n",
+                test_ctx->cnx_client->key_phase_enc, test_ctx->cnx_client->key_phase_dec,
+                test_ctx->cnx_server->key_phase_enc, test_ctx->cnx_server->key_phase_dec);
+            ret = -1;
+        }
+    }
+
+    /* Past the retention delay, the previous keys are gone */
+    if (ret == 0) {
+        uint64_t expiry = test_ctx->cnx_server->crypto_context[3].old_decrypt_expiry;
+
+        picoquic_check_key_retention(test_ctx->cnx_server, expiry - 1);
+        if (test_ctx->cnx_server->crypto_context[3].aead_decrypt_old == NULL) {
+            ret = -1;
+        } else {
+            picoquic_check_key_retention(test_ctx->cnx_server, expiry);
+            if (test_ctx->cnx_server->crypto_context[3].aead_decrypt_old != NULL) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * The server chain is compressed once in the master context when picotls has brotli, and the
+ * clients complete the handshake whether it is compressed or not.
+ */
+int certificate_compression_test()
+{
+    uint64_t loss_mask = 0;
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+#ifdef PICOQUIC_WITH_BROTLI
+    int expect_compressed = 1;
+#else
+    int expect_compressed = 0;
+#endif
+
+    if (ret == 0 && (picoquic_is_certificate_compressed(test_ctx->qserver) != expect_compressed ||
+        picoquic_is_certificate_compressed(test_ctx->qclient) != 0)) {
+        DBG_PRINTF("Certificate compression is %d, expected %d\n",
+            picoquic_is_certificate_compressed(test_ctx->qserver), expect_compressed);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_attempt_to_close(test_ctx, &simulated_time);
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Initial packets that cannot be decrypted are dropped before any connection is created, the keys
+ * of their destination CID being kept for the next ones, and the valid Initial still gets through.
+ */
+int initial_reject_test()
+{
+    uint64_t simulated_time = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    uint8_t bytes[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t junk[PICOQUIC_MAX_PACKET_SIZE];
+    size_t length = 0;
+    picoquic_path_t* path = NULL;
+    int new_context_created = 0;
+    int ret = tls_api_init_ctx(&test_ctx, 0, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        ret = picoquic_prepare_packet(test_ctx->cnx_client, simulated_time, bytes, sizeof(bytes), &length, &path);
+        if (ret == 0 && length < PICOQUIC_ENFORCED_INITIAL_MTU) {
+            ret = -1;
+        }
+    }
+
+    /* The same Initial damaged twice: rejected without a connection */
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        memcpy(junk, bytes, length);
+        junk[length / 2 + i] ^= 0xFF;
+        (void)picoquic_incoming_packet(test_ctx->qserver, junk, (uint32_t)length,
+            (struct sockaddr*)&test_ctx->client_addr, (struct sockaddr*)&test_ctx->server_addr, 0,
+            simulated_time, &new_context_created);
+        if (new_context_created || picoquic_get_first_cnx(test_ctx->qserver) != NULL ||
+            picoquic_get_initial_reject_count(test_ctx->qserver, picoquic_initial_reject_aead) != (uint64_t)i + 1) {
+            DBG_PRINTF("Damaged Initial %d not rejected\n", i);
+            ret = -1;
+        }
+    }
+
+    /* The original is accepted */
+    if (ret == 0) {
+        (void)picoquic_incoming_packet(test_ctx->qserver, bytes, (uint32_t)length,
+            (struct sockaddr*)&test_ctx->client_addr, (struct sockaddr*)&test_ctx->server_addr, 0,
+            simulated_time, &new_context_created);
+        if (!new_context_created || picoquic_get_first_cnx(test_ctx->qserver) == NULL ||
+            picoquic_get_initial_reject_count(test_ctx->qserver, picoquic_initial_reject_aead) != 2 ||
+            picoquic_get_initial_reject_count(test_ctx->qserver, picoquic_initial_reject_too_short) != 0) {
+            DBG_PRINTF("%s", "Valid Initial not accepted\n");
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Slow start on a 1 Gbps link with 100 ms of RTT and a 25 ms buffer, the server
+ * sending 16 MB with Cubic. The overshoot of the slow start shows up as packets
+ * dropped at the bottleneck, compared with and without HyStart++.
+ */
+#define HYSTART_PP_TEST_RESPONSE_SIZE 16000000
+#define HYSTART_PP_TEST_QUEUE_DELAY 25000
+#define HYSTART_PP_TEST_MAX_TIME 10000000
+
+static test_api_stream_desc_t test_scenario_hystart_pp[] = {
+    { 4, 0, 257, HYSTART_PP_TEST_RESPONSE_SIZE }
+};
+
+static int hystart_pp_one_test(int is_hystart_pp, uint64_t* packets_dropped, uint64_t* packets_sent, uint64_t* completion_time)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint64_t start_time;
+    picoquic_tp_t client_parameters;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN,
+        &simulated_time, NULL, 0, 1, 0);
+
+    if (ret == 0) {
+        picoquictest_sim_link_delete(test_ctx->c_to_s_link);
+        picoquictest_sim_link_delete(test_ctx->s_to_c_link);
+        test_ctx->c_to_s_link = picoquictest_sim_link_create(1.0, 50000, NULL, 0, simulated_time);
+        test_ctx->s_to_c_link = picoquictest_sim_link_create(1.0, 50000, NULL, 0, simulated_time);
+        if (test_ctx->c_to_s_link == NULL || test_ctx->s_to_c_link == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* The flow control must not limit the window */
+        picoquic_init_transport_parameters(&client_parameters, 1);
+        client_parameters.initial_max_stream_data_bidi_local = 4 * HYSTART_PP_TEST_RESPONSE_SIZE;
+        client_parameters.initial_max_data = 4 * HYSTART_PP_TEST_RESPONSE_SIZE;
+        picoquic_set_transport_parameters(test_ctx->cnx_client, &client_parameters);
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, HYSTART_PP_TEST_QUEUE_DELAY, &simulated_time);
+    }
+
+    if (ret == 0) {
+        picoquic_set_hystart_pp(test_ctx->cnx_server, is_hystart_pp);
+        start_time = simulated_time;
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_hystart_pp, sizeof(test_scenario_hystart_pp));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 1000000);
+    }
+
+    if (ret == 0 && (!test_ctx->test_finished ||
+        test_ctx->test_stream[0].r_recv_nb != test_ctx->test_stream[0].r_len)) {
+        DBG_PRINTF("HyStart++ %d: transfer not complete\n", is_hystart_pp);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        *packets_dropped = test_ctx->s_to_c_link->packets_dropped;
+        *packets_sent = test_ctx->s_to_c_link->packets_sent;
+        *completion_time = simulated_time - start_time;
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int hystart_pp_test()
+{
+    uint64_t dropped[2] = { 0, 0 };
+    uint64_t sent[2] = { 0, 0 };
+    uint64_t completion_time[2] = { 0, 0 };
+    int ret = 0;
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        ret = hystart_pp_one_test(i, &dropped[i], &sent[i], &completion_time[i]);
+    }
+
+    if (ret == 0) {
+        DBG_PRINTF("Slow start: %" PRIu64 "/%" PRIu64 " packets dropped in %" PRIu64 " us, with HyStart++ %" PRIu64 "/%" PRIu64 " in %" PRIu64 " us\n",
+            dropped[0], sent[0], completion_time[0], dropped[1], sent[1], completion_time[1]);
+        /* Leaving the slow start before the buffer overflows keeps the losses marginal */
+        if (dropped[1] * 20 > sent[1] || completion_time[1] > HYSTART_PP_TEST_MAX_TIME) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Delay based congestion control against Cubic, the server sending 2 MB on a 10 Mbps link
+ * with 40 ms of RTT and a 200 ms buffer. Cubic fills the buffer until it loses packets,
+ * LEDBAT has to keep the queuing delay close to its 60 ms target, at a similar throughput.
+ */
+#define LEDBAT_TEST_RESPONSE_SIZE 2000000
+#define LEDBAT_TEST_QUEUE_DELAY 200000
+#define LEDBAT_TEST_MAX_QUEUING_DELAY 120000
+
+static test_api_stream_desc_t test_scenario_ledbat[] = {
+    { 4, 0, 257, LEDBAT_TEST_RESPONSE_SIZE }
+};
+
+static int ledbat_one_test(picoquic_congestion_algorithm_t const* alg, uint64_t* queuing_delay_max,
+    uint64_t* queuing_delay_average, uint64_t* packets_dropped, uint64_t* completion_time)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint64_t start_time = 0;
+    uint64_t delay_sum = 0;
+    uint64_t nb_samples = 0;
+    int nb_trials = 0;
+    int nb_inactive = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1, PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN,
+        &simulated_time, NULL, 0, 1, 0);
+
+    *queuing_delay_max = 0;
+
+    if (ret == 0) {
+        picoquictest_sim_link_delete(test_ctx->c_to_s_link);
+        picoquictest_sim_link_delete(test_ctx->s_to_c_link);
+        test_ctx->c_to_s_link = picoquictest_sim_link_create(0.01, 20000, NULL, 0, simulated_time);
+        test_ctx->s_to_c_link = picoquictest_sim_link_create(0.01, 20000, NULL, 0, simulated_time);
+        if (test_ctx->c_to_s_link == NULL || test_ctx->s_to_c_link == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* The server connection is created with the default algorithm */
+        picoquic_set_default_congestion_algorithm(test_ctx->qserver, alg);
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, LEDBAT_TEST_QUEUE_DELAY, &simulated_time);
+    }
+
+    if (ret == 0) {
+        start_time = simulated_time;
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_ledbat, sizeof(test_scenario_ledbat));
+    }
+
+    /* The data sending loop, sampling the queuing delay seen by the server */
+    while (ret == 0 && nb_trials < 1000000 && nb_inactive < 256 &&
+        test_ctx->cnx_client->cnx_state == picoquic_state_client_ready &&
+        test_ctx->cnx_server->cnx_state == picoquic_state_server_ready) {
+        int was_active = 0;
+        picoquic_path_t* path_x = test_ctx->cnx_server->path[0];
+
+        nb_trials++;
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, &was_active);
+        nb_inactive = (was_active) ? 0 : nb_inactive + 1;
+
+        if (path_x->rtt_min > 0 && path_x->smoothed_rtt > path_x->rtt_min) {
+            uint64_t queuing_delay = path_x->smoothed_rtt - path_x->rtt_min;
+
+            if (queuing_delay > *queuing_delay_max) {
+                *queuing_delay_max = queuing_delay;
+            }
+            delay_sum += queuing_delay;
+            nb_samples++;
+        }
+
+        if (test_ctx->test_finished && picoquic_is_cnx_backlog_empty(test_ctx->cnx_client) &&
+            picoquic_is_cnx_backlog_empty(test_ctx->cnx_server)) {
+            break;
+        }
+    }
+
+    if (ret == 0 && (!test_ctx->test_finished ||
+        test_ctx->test_stream[0].r_recv_nb != test_ctx->test_stream[0].r_len)) {
+        DBG_PRINTF("Congestion algorithm %x: transfer not complete\n", alg->congestion_algorithm_id);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        *queuing_delay_average = (nb_samples > 0) ? delay_sum / nb_samples : 0;
+        *packets_dropped = test_ctx->s_to_c_link->packets_dropped;
+        *completion_time = simulated_time - start_time;
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int ledbat_test()
+{
+    picoquic_congestion_algorithm_t const* alg[2];
+    uint64_t delay_max[2] = { 0, 0 };
+    uint64_t delay_average[2] = { 0, 0 };
+    uint64_t dropped[2] = { 0, 0 };
+    uint64_t completion_time[2] = { 0, 0 };
+    int ret = 0;
+
+    alg[0] = picoquic_cubic_algorithm;
+    alg[1] = picoquic_ledbat_algorithm;
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        ret = ledbat_one_test(alg[i], &delay_max[i], &delay_average[i], &dropped[i], &completion_time[i]);
+    }
+
+    if (ret == 0) {
+        for (int i = 0; i < 2; i++) {
+            DBG_PRINTF("%s: queuing delay %" PRIu64 " us average, %" PRIu64 " us max, %" PRIu64 " packets dropped, done in %" PRIu64 " us\n",
+                (i == 0) ? "Cubic" : "LEDBAT", delay_average[i], delay_max[i], dropped[i], completion_time[i]);
+        }
+        /* The queue stays short without costing much throughput */
+        if (delay_average[1] > LEDBAT_TEST_MAX_QUEUING_DELAY || delay_average[1] >= delay_average[0] ||
+            dropped[1] > dropped[0] || completion_time[1] > 2 * completion_time[0]) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * The server closes, and leaves a tombstone in place of the connection. The late packets of the client
+ * get the close datagram again, at most once per interval, its late Initial does not open a new
+ * connection, and the tombstone is gone after 3 RTO.
+ */
+static int tombstone_test_packet(picoquic_test_tls_api_ctx_t* test_ctx, uint8_t* bytes, size_t length,
+    uint64_t simulated_time, const uint8_t* close_datagram, size_t close_length)
+{
+    int ret = 0;
+    int new_context_created = 0;
+    picoquic_stateless_packet_t* sp;
+
+    (void)picoquic_incoming_packet(test_ctx->qserver, bytes, (uint32_t)length,
+        (struct sockaddr*)&test_ctx->client_addr, (struct sockaddr*)&test_ctx->server_addr, 0,
+        simulated_time, &new_context_created);
+    sp = picoquic_dequeue_stateless_packet(test_ctx->qserver);
+
+    if (new_context_created || picoquic_get_first_cnx(test_ctx->qserver) != NULL) {
+        DBG_PRINTF("%s", "Closed connection opened again\n");
+        ret = -1;
+    } else if (close_datagram == NULL && sp != NULL) {
+        DBG_PRINTF("%s", "Unexpected answer\n");
+        ret = -1;
+    } else if (close_datagram != NULL && (sp == NULL || sp->length != close_length ||
+        memcmp(sp->bytes, close_datagram, close_length) != 0)) {
+        DBG_PRINTF("%s", "Close datagram not repeated\n");
+        ret = -1;
+    }
+
+    if (sp != NULL) {
+        picoquic_delete_stateless_packet(sp);
+    }
+
+    return ret;
+}
+
+int tombstone_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint64_t interval = 0;
+    uint64_t expiry = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    uint8_t initial[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t close_datagram[PICOQUIC_MAX_PACKET_SIZE];
+    uint8_t late[128];
+    size_t initial_length = 0;
+    size_t close_length = 0;
+    picoquic_path_t* path = NULL;
+    picoquic_stateless_packet_t* sp;
+    int new_context_created = 0;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 1, 0);
+
+    /* The first Initial of the client is kept to be replayed */
+    if (ret == 0) {
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+    }
+    if (ret == 0) {
+        ret = picoquic_prepare_packet(test_ctx->cnx_client, simulated_time, initial, sizeof(initial), &initial_length, &path);
+        if (ret == 0 && initial_length < PICOQUIC_ENFORCED_INITIAL_MTU) {
+            ret = -1;
+        } else if (ret == 0) {
+            (void)picoquic_incoming_packet(test_ctx->qserver, initial, (uint32_t)initial_length,
+                (struct sockaddr*)&test_ctx->client_addr, (struct sockaddr*)&test_ctx->server_addr, 0,
+                simulated_time, &new_context_created);
+            if (!new_context_created) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        picoquic_path_t* path_x = test_ctx->cnx_server->path[0];
+
+        picoquic_set_tombstones(test_ctx->qserver, 4);
+        interval = (2 * path_x->rtt_min < path_x->retransmit_timer) ? path_x->retransmit_timer / 2 : path_x->rtt_min;
+        expiry = simulated_time + 3 * path_x->retransmit_timer;
+
+        /* A short header packet to the server CID, the content does not matter */
+        memset(late, 0x5A, sizeof(late));
+        late[0] = 0x41;
+        memcpy(late + 1, path_x->local_cnxid.id, path_x->local_cnxid.id_len);
+
+        ret = picoquic_close(test_ctx->cnx_server, 0);
+    }
+
+    if (ret == 0) {
+        ret = picoquic_prepare_packet(test_ctx->cnx_server, simulated_time, close_datagram, sizeof(close_datagram),
+            &close_length, &path);
+        if (ret == 0 && (close_length == 0 ||
+            picoquic_get_cnx_state(test_ctx->cnx_server) != picoquic_state_disconnected ||
+            picoquic_get_nb_tombstones(test_ctx->qserver, simulated_time) != 1)) {
+            DBG_PRINTF("%s", "No tombstone after the close\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_delete_cnx(test_ctx->cnx_server);
+        test_ctx->cnx_server = NULL;
+        while ((sp = picoquic_dequeue_stateless_packet(test_ctx->qserver)) != NULL) {
+            picoquic_delete_stateless_packet(sp);
+        }
+        /* Dropped until the interval has passed, then answered once */
+        ret = tombstone_test_packet(test_ctx, late, sizeof(late), simulated_time, NULL, 0);
+        if (ret == 0) {
+            simulated_time += interval;
+            ret = tombstone_test_packet(test_ctx, late, sizeof(late), simulated_time, close_datagram, close_length);
+        }
+        if (ret == 0) {
+            ret = tombstone_test_packet(test_ctx, late, sizeof(late), simulated_time, NULL, 0);
+        }
+    }
+
+    if (ret == 0) {
+        ret = tombstone_test_packet(test_ctx, initial, initial_length, simulated_time, NULL, 0);
+        if (ret == 0 && picoquic_get_initial_reject_count(test_ctx->qserver, picoquic_initial_reject_closed) != 1) {
+            DBG_PRINTF("%s", "Late Initial not rejected\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && (picoquic_get_nb_tombstones(test_ctx->qserver, expiry - 1) != 1 ||
+        picoquic_get_nb_tombstones(test_ctx->qserver, expiry) != 0)) {
+        DBG_PRINTF("%s", "Tombstone not expired\n");
+        ret = -1;
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * The client moves to the preferred port of the server once the handshake is done, with the CID of
+ * the preferred address, and the server answers from that port.
+ */
+int preferred_address_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint16_t preferred_port = 0;
+    struct sockaddr_in preferred_addr;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 1, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+
+    if (ret == 0) {
+        preferred_port = (uint16_t)(test_ctx->server_addr.sin_port + 1);
+        memset(&preferred_addr, 0, sizeof(preferred_addr));
+        preferred_addr.sin_family = AF_INET;
+        preferred_addr.sin_port = preferred_port;
+        picoquic_set_preferred_address(test_ctx->qserver, (struct sockaddr*)&preferred_addr, NULL);
+        ret = picoquic_start_client_cnx(test_ctx->cnx_client);
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    /* Until the client receives the HANDSHAKE_DONE */
+    for (int i = 0; ret == 0 && i < 64 &&
+        ((struct sockaddr_in*)&test_ctx->cnx_client->path[0]->peer_addr)->sin_port != preferred_port; i++) {
+        int was_active = 0;
+
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, &was_active);
+    }
+
+    if (ret == 0) {
+        if (!test_ctx->cnx_client->preferred_address_used ||
+            ((struct sockaddr_in*)&test_ctx->cnx_client->path[0]->peer_addr)->sin_port != preferred_port) {
+            DBG_PRINTF("%s", "The client did not move to the preferred address\n");
+            ret = -1;
+        } else {
+            test_ctx->server_addr.sin_port = preferred_port;
+        }
+    }
+
+    if (ret == 0) {
+        ret = test_api_init_send_recv_scenario(test_ctx, test_scenario_q_and_r, sizeof(test_scenario_q_and_r));
+    }
+
+    if (ret == 0) {
+        ret = tls_api_data_sending_loop(test_ctx, &loss_mask, &simulated_time, 0);
+    }
+
+    if (ret == 0 && (test_ctx->cnx_client->path[0]->challenge_verified != 1 ||
+        picoquic_compare_connection_id(&test_ctx->cnx_client->path[0]->remote_cnxid, &test_ctx->cnx_server->preferred_cnxid) != 0 ||
+        ((struct sockaddr_in*)&test_ctx->cnx_server->path[0]->local_addr)->sin_port != preferred_port)) {
+        DBG_PRINTF("%s", "The preferred address was not validated\n");
+        ret = -1;
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * The overload levels follow the smoothed load, new connections are sent a Retry at the first level
+ * and refused with a stateless CONNECTION_CLOSE(SERVER_BUSY) at the last one.
+ */
+static int overload_test_one(picoquic_overload_level_enum level)
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+
+    /* Without connection there is no lag, the backlog alone drives the level */
+    if (ret == 0) {
+        picoquic_set_overload_thresholds(test_ctx->qserver, 0, (level == picoquic_overload_retry) ? 4 : 1);
+        for (int i = 0; i < 64 && picoquic_get_overload_level(test_ctx->qserver) < level; i++) {
+            (void)picoquic_update_overload(test_ctx->qserver, simulated_time, 8);
+        }
+        if (picoquic_get_overload_level(test_ctx->qserver) != level) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && level == picoquic_overload_retry) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+        if (ret == 0 && picoquic_get_initial_reject_count(test_ctx->qserver, picoquic_initial_reject_token) == 0) {
+            DBG_PRINTF("%s", "No retry under overload\n");
+            ret = -1;
+        }
+    } else if (ret == 0) {
+        for (int i = 0; ret == 0 && i < 64 && test_ctx->cnx_client->cnx_state != picoquic_state_disconnected; i++) {
+            int was_active = 0;
+
+            ret = tls_api_one_sim_round(test_ctx, &simulated_time, &was_active);
+        }
+        if (ret == 0 && (test_ctx->cnx_client->cnx_state != picoquic_state_disconnected ||
+            test_ctx->cnx_client->remote_error != PICOQUIC_TRANSPORT_SERVER_BUSY || test_ctx->cnx_server != NULL ||
+            test_ctx->qserver->cnx_list != NULL ||
+            picoquic_get_initial_reject_count(test_ctx->qserver, picoquic_initial_reject_busy) == 0)) {
+            DBG_PRINTF("%s", "New connection not refused under overload\n");
+            ret = -1;
+        }
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+int overload_test()
+{
+    int ret = 0;
+    picoquic_quic_t* quic = picoquic_create(8, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0, NULL);
+
+    if (quic == NULL) {
+        return -1;
+    }
+
+    /* The level goes up and down one way, with the smoothed backlog */
+    picoquic_set_overload_thresholds(quic, 0, 4);
+    for (int i = 0; ret == 0 && i < 64; i++) {
+        picoquic_overload_level_enum previous = picoquic_get_overload_level(quic);
+        if (picoquic_update_overload(quic, 0, 32) < previous) {
+            ret = -1;
+        }
+    }
+    if (ret == 0 && picoquic_get_overload_level(quic) != picoquic_overload_reject) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < 64; i++) {
+        picoquic_overload_level_enum previous = picoquic_get_overload_level(quic);
+        if (picoquic_update_overload(quic, 0, 0) > previous) {
+            ret = -1;
+        }
+    }
+    if (ret == 0 && picoquic_get_overload_level(quic) != picoquic_overload_none) {
+        ret = -1;
+    }
+
+    /* Without threshold, the controller is off */
+    if (ret == 0) {
+        picoquic_set_overload_thresholds(quic, 0, 0);
+        if (picoquic_update_overload(quic, 0, 1000) != picoquic_overload_none) {
+            ret = -1;
+        }
+    }
+    picoquic_free(quic);
+
+    if (ret == 0) {
+        ret = overload_test_one(picoquic_overload_retry);
+    }
+    if (ret == 0) {
+        ret = overload_test_one(picoquic_overload_reject);
+    }
+
+    return ret;
+}
+
+/*
+ * The headers copied from the templates are the ones the header operations create, and the
+ * templates follow the change of the server CID.
+ */
+static int header_template_compare(picoquic_cnx_t* cnx, picoquic_packet_type_enum ptype)
+{
+    int ret = 0;
+    uint8_t header[2][PICOQUIC_MAX_PACKET_SIZE];
+    uint32_t length[2];
+    uint32_t predicted[2];
+    uint32_t pn_offset[2];
+    uint32_t pn_length[2];
+
+    for (int i = 0; i < 2; i++) {
+        /* The second time, as if a pluglet was attached to the header operations */
+        cnx->plain_header_ops = (i == 0);
+        predicted[i] = picoquic_predict_packet_header_length(cnx, ptype, cnx->path[0]);
+        length[i] = picoquic_create_packet_header(cnx, ptype, cnx->path[0], 0x12345678, header[i], &pn_offset[i], &pn_length[i]);
+    }
+    cnx->plain_header_ops = 1;
+
+    if (length[0] != length[1] || predicted[0] != predicted[1] || predicted[0] != length[0] ||
+        pn_offset[0] != pn_offset[1] || pn_length[0] != pn_length[1] || memcmp(header[0], header[1], length[0]) != 0) {
+        DBG_PRINTF("Header template differs for packet type %d\n", ptype);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int header_template_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    picoquic_packet_type_enum ptypes[] = { picoquic_packet_initial, picoquic_packet_handshake,
+        picoquic_packet_1rtt_protected_phi0, picoquic_packet_1rtt_protected_phi1 };
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0 && (!test_ctx->cnx_client->plain_header_ops || !test_ctx->cnx_client->plain_checksum_op)) {
+        DBG_PRINTF("%s", "Header operations not run directly\n");
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < (int)(sizeof(ptypes) / sizeof(ptypes[0])); i++) {
+        ret = header_template_compare(test_ctx->cnx_client, ptypes[i]);
+        if (ret == 0) {
+            ret = header_template_compare(test_ctx->cnx_server, ptypes[i]);
+        }
+    }
+
+    if (ret == 0) {
+        /* A new CID for the server, as a pluglet could set it */
+        picoquic_connection_id_t* remote_cnxid = (picoquic_connection_id_t*)get_path(test_ctx->cnx_client->path[0], AK_PATH_REMOTE_CID, 0);
+
+        remote_cnxid->id[0] ^= 0xFF;
+        ret = header_template_compare(test_ctx->cnx_client, picoquic_packet_1rtt_protected_phi0);
+        remote_cnxid->id[0] ^= 0xFF;
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * Past the high watermarks, the writes are refused until the sent data brings the
+ * buffers back to the low watermarks, which the application learns from a callback.
+ */
+typedef struct st_send_buffer_test_ctx_t {
+    int nb_events;
+    uint64_t stream_id[2];
+    size_t stream_buffered[2];
+    uint64_t cnx_buffered[2];
+} send_buffer_test_ctx_t;
+
+static int send_buffer_test_callback(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t* bytes, size_t length,
+    picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* stream_ctx)
+{
+    send_buffer_test_ctx_t* ctx = (send_buffer_test_ctx_t*)callback_ctx;
+
+    if (fin_or_event == picoquic_callback_send_buffer_low) {
+        if (ctx->nb_events >= 2) {
+            return -1;
+        }
+        ctx->stream_id[ctx->nb_events] = stream_id;
+        ctx->stream_buffered[ctx->nb_events] = length;
+        ctx->cnx_buffered[ctx->nb_events] = cnx->send_buffered;
+        ctx->nb_events++;
+    }
+    return 0;
+}
+
+int send_buffer_test()
+{
+    uint64_t simulated_time = 0;
+    uint64_t loss_mask = 0;
+    uint8_t data[3000];
+    send_buffer_test_ctx_t cb_ctx;
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_test_tls_api_ctx_t* test_ctx = NULL;
+    int ret = tls_api_init_ctx(&test_ctx, PICOQUIC_INTERNAL_TEST_VERSION_1,
+        PICOQUIC_TEST_SNI, PICOQUIC_TEST_ALPN, &simulated_time, NULL, 0, 0, 0);
+
+    if (ret == 0 && test_ctx == NULL) {
+        ret = PICOQUIC_ERROR_MEMORY;
+    }
+
+    if (ret == 0) {
+        ret = tls_api_connection_loop(test_ctx, &loss_mask, 0, &simulated_time);
+    }
+
+    if (ret == 0) {
+        cnx = test_ctx->cnx_client;
+        memset(&cb_ctx, 0, sizeof(cb_ctx));
+        memset(data, 0x5a, sizeof(data));
+        picoquic_set_callback(cnx, send_buffer_test_callback, &cb_ctx);
+        picoquic_set_send_buffer_watermarks(cnx, 4096, 1024, 6000, 2000);
+
+        /* The stream mark stops stream 4, then the connection mark stops stream 8 */
+        if (picoquic_add_to_stream(cnx, 4, data, 3000, 0) != 0 ||
+            picoquic_add_to_stream(cnx, 4, data, 2000, 0) != 0 ||
+            picoquic_add_to_stream(cnx, 4, data, 100, 1) != PICOQUIC_ERROR_WOULD_BLOCK ||
+            picoquic_add_to_stream(cnx, 8, data, 1500, 0) != 0 ||
+            picoquic_add_to_stream(cnx, 8, data, 10, 0) != PICOQUIC_ERROR_WOULD_BLOCK ||
+            picoquic_add_to_stream(cnx, 8, NULL, 0, 1) != 0) {
+            DBG_PRINTF("%s", "The writes do not follow the high watermarks\n");
+            ret = -1;
+        } else if (cnx->send_buffered != 6500 || cnx->nb_send_blocked != 2 ||
+            picoquic_find_stream(cnx, 4, 0)->fin_requested) {
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < 64 && cb_ctx.nb_events < 2; i++) {
+        int was_active = 0;
+
+        ret = tls_api_one_sim_round(test_ctx, &simulated_time, &was_active);
+    }
+
+    if (ret == 0 && (cb_ctx.nb_events != 2 || cb_ctx.stream_id[0] + cb_ctx.stream_id[1] != 12 || cnx->nb_send_blocked != 0)) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        if (cb_ctx.stream_buffered[i] > 1024 || cb_ctx.cnx_buffered[i] > 2000) {
+            DBG_PRINTF("%s", "The streams were not notified below the low watermarks\n");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && picoquic_add_to_stream(cnx, 4, data, 100, 1) != 0) {
+        ret = -1;
+    }
+
+    if (test_ctx != NULL) {
+        tls_api_delete_ctx(test_ctx);
+        test_ctx = NULL;
+    }
+
+    return ret;
+}
@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include "ubpf.h"
+#include "picoquic_internal.h"
+#include "getset.h"
+
+#define UBPF_TEST_MAX_INSNS 16
+
+/* Minimal relocatable ELF with a text section and a symbol table holding one undefined symbol */
+typedef struct {
+    Elf64_Ehdr ehdr;
+    Elf64_Shdr shdrs[4];
+    Elf64_Sym syms[2];
+    char strtab[32];
+    uint64_t text[UBPF_TEST_MAX_INSNS];
+} ubpf_test_elf_t;
+
+static void ubpf_test_elf_init(ubpf_test_elf_t *elf, const char *helper, const uint64_t *insns, int nb_insns)
+{
+    memset(elf, 0, sizeof(ubpf_test_elf_t));
+    memcpy(elf->ehdr.e_ident, ELFMAG, SELFMAG);
+    elf->ehdr.e_shoff = offsetof(ubpf_test_elf_t, shdrs);
+    elf->ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    elf->ehdr.e_shnum = 4;
+    elf->shdrs[1].sh_type = SHT_SYMTAB;
+    elf->shdrs[1].sh_link = 2;
+    elf->shdrs[1].sh_offset = offsetof(ubpf_test_elf_t, syms);
+    elf->shdrs[1].sh_size = sizeof(elf->syms);
+    elf->shdrs[2].sh_type = SHT_STRTAB;
+    elf->shdrs[2].sh_offset = offsetof(ubpf_test_elf_t, strtab);
+    elf->shdrs[2].sh_size = sizeof(elf->strtab);
+    elf->shdrs[3].sh_type = SHT_PROGBITS;
+    elf->shdrs[3].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    elf->shdrs[3].sh_offset = offsetof(ubpf_test_elf_t, text);
+    elf->shdrs[3].sh_size = nb_insns * sizeof(uint64_t);
+    strcpy(elf->strtab + 1, helper);
+    elf->syms[1].st_name = 1;
+    elf->syms[1].st_shndx = SHN_UNDEF;
+    memcpy(elf->text, insns, nb_insns * sizeof(uint64_t));
+}
+
+/* Encodes an eBPF instruction, as laid out on a little endian host */
+#define UBPF_TEST_INSN(op, dst, src, off, imm) \
+    ((uint64_t) (uint8_t) (op) | ((uint64_t) (((src) << 4) | (dst)) << 8) | \
+     ((uint64_t) (uint16_t) (off) << 16) | ((uint64_t) (uint32_t) (imm) << 32))
+
+int pluglet_image_imports_test()
+{
+    ubpf_test_elf_t elf;
+    uint64_t exit_insn = UBPF_TEST_INSN(0x95, 0, 0, 0, 0);
+    pluglet_image_t image = { .code = &elf, .code_len = sizeof(elf) };
+
+    ubpf_test_elf_init(&elf, "set_cnx", &exit_insn, 1);
+    if (!pluglet_image_imports(&image, "set_")) {
+        return -1;
+    }
+    ubpf_test_elf_init(&elf, "get_cnx", &exit_insn, 1);
+    if (pluglet_image_imports(&image, "set_")) {
+        return -1;
+    }
+    return 0;
+}
+
+int pluglet_bound_checks_test()
+{
+    ubpf_test_elf_t elf;
+    uint32_t accesses = 0, elidable = 0;
+    const uint64_t insns[] = {
+        UBPF_TEST_INSN(0x7b, 10, 1, -8, 0),     /* *(u64 *)(r10 - 8) = r1: in the stack */
+        UBPF_TEST_INSN(0xbf, 2, 10, 0, 0),      /* r2 = r10 */
+        UBPF_TEST_INSN(0x07, 2, 0, 0, -16),     /* r2 += -16 */
+        UBPF_TEST_INSN(0x63, 2, 1, 4, 0),       /* *(u32 *)(r2 + 4) = r1: in the stack */
+        UBPF_TEST_INSN(0x79, 3, 10, 8, 0),      /* r3 = *(u64 *)(r10 + 8): above the stack */
+        UBPF_TEST_INSN(0x71, 4, 1, 0, 0),       /* r4 = *(u8 *)(r1 + 0): unknown pointer */
+        UBPF_TEST_INSN(0x85, 0, 0, 0, 1),       /* call 1, clobbering r2 */
+        UBPF_TEST_INSN(0x7b, 2, 1, 0, 0),       /* *(u64 *)(r2 + 0) = r1: no more known */
+        UBPF_TEST_INSN(0xbf, 6, 10, 0, 0),      /* r6 = r10 */
+        UBPF_TEST_INSN(0x05, 0, 0, 0, 0),       /* goto +0, the next instruction is a jump target */
+        UBPF_TEST_INSN(0x72, 6, 0, -1, 0),      /* *(u8 *)(r6 - 1) = 0: unknown after the jump */
+        UBPF_TEST_INSN(0x72, 10, 0, -1, 0),     /* *(u8 *)(r10 - 1) = 0: the frame pointer is always known */
+        UBPF_TEST_INSN(0x95, 0, 0, 0, 0),       /* exit */
+    };
+
+    ubpf_test_elf_init(&elf, "get_cnx", insns, sizeof(insns) / sizeof(insns[0]));
+    pluglet_count_elidable_checks(&elf, sizeof(elf), &accesses, &elidable);
+
+    return (accesses == 7 && elidable == 3) ? 0 : -1;
+}
+
+static uint64_t ubpf_test_helper_mul(uint64_t r1, uint64_t r2, uint64_t r3, uint64_t r4, uint64_t r5)
+{
+    return r1 * r2;
+}
+
+/* Decodes the instructions and runs them, returns UINT64_MAX - 1 if they cannot be decoded */
+static uint64_t ubpf_test_threaded_run(const uint64_t *insns, int nb_insns, const bool *is_elidable, void *arg, void *mem,
+    size_t mem_len, bool *has_error)
+{
+    pluglet_helper_t helpers[PLUGLET_MAX_HELPERS];
+    char *errmsg = NULL;
+    char *error_msg = NULL;
+    uint64_t ret = UINT64_MAX - 1;
+
+    memset(helpers, 0, sizeof(helpers));
+    helpers[1].name = "mul";
+    helpers[1].fn = (void *) ubpf_test_helper_mul;
+    helpers[3].name = "get_cnx";
+    helpers[3].fn = (void *) get_cnx;
+    helpers[4].name = "set_cnx";
+    helpers[4].fn = (void *) set_cnx;
+    helpers[5].name = "get_path";
+    helpers[5].fn = (void *) get_path;
+    helpers[6].name = "set_path";
+    helpers[6].fn = (void *) set_path;
+    pluglet_threaded_t *threaded = pluglet_threaded_create((const pluglet_insn_t *) insns, nb_insns, is_elidable, helpers, &errmsg);
+    if (threaded != NULL) {
+        ret = pluglet_threaded_exec(threaded, arg, mem, mem_len, &error_msg);
+        *has_error = (error_msg != NULL);
+        pluglet_threaded_free(threaded);
+    }
+    free(errmsg);
+    return ret;
+}
+
+/* The threaded interpreter runs as the uBPF one, and rejects the same invalid code */
+int pluglet_threaded_test()
+{
+    const uint64_t insns[] = {
+        UBPF_TEST_INSN(0xb7, 6, 0, 0, 0),       /* r6 = 0 */
+        UBPF_TEST_INSN(0xb7, 7, 0, 0, 0),       /* r7 = 0 */
+        UBPF_TEST_INSN(0x0f, 6, 7, 0, 0),       /* r6 += r7 */
+        UBPF_TEST_INSN(0x07, 7, 0, 0, 1),       /* r7 += 1, fused with the jump */
+        UBPF_TEST_INSN(0x55, 7, 0, -3, 10),     /* if r7 != 10 goto -3 */
+        UBPF_TEST_INSN(0x7b, 10, 6, -8, 0),     /* *(u64 *)(r10 - 8) = r6 */
+        UBPF_TEST_INSN(0xbf, 2, 10, 0, 0),      /* r2 = r10, fused with the add */
+        UBPF_TEST_INSN(0x07, 2, 0, 0, -8),      /* r2 += -8 */
+        UBPF_TEST_INSN(0x79, 1, 2, 0, 0),       /* r1 = *(u64 *)(r2 + 0) */
+        UBPF_TEST_INSN(0xb7, 2, 0, 0, 3),       /* r2 = 3 */
+        UBPF_TEST_INSN(0x85, 0, 0, 0, 1),       /* call 1 */
+        UBPF_TEST_INSN(0x18, 3, 0, 0, 0),       /* r3 = 0x100000000 */
+        UBPF_TEST_INSN(0x00, 0, 0, 0, 1),
+        UBPF_TEST_INSN(0x0f, 0, 3, 0, 0),       /* r0 += r3 */
+        UBPF_TEST_INSN(0xdc, 0, 0, 0, 16),      /* r0 = be16 r0 */
+        UBPF_TEST_INSN(0x95, 0, 0, 0, 0),       /* exit */
+    };
+    const uint64_t load_arg[] = {
+        UBPF_TEST_INSN(0x79, 0, 1, 8, 0),       /* r0 = *(u64 *)(r1 + 8) */
+        UBPF_TEST_INSN(0x95, 0, 0, 0, 0),
+    };
+    const uint64_t divide[] = {
+        UBPF_TEST_INSN(0xb7, 1, 0, 0, 0),       /* r1 = 0 */
+        UBPF_TEST_INSN(0x3f, 0, 1, 0, 0),       /* r0 /= r1 */
+        UBPF_TEST_INSN(0x95, 0, 0, 0, 0),
+    };
+    const uint64_t no_exit[] = { UBPF_TEST_INSN(0xb7, 0, 0, 0, 1) };
+    const uint64_t jump_out[] = { UBPF_TEST_INSN(0x05, 0, 0, 1, 0), UBPF_TEST_INSN(0x95, 0, 0, 0, 0) };
+    const uint64_t unknown_helper[] = { UBPF_TEST_INSN(0x85, 0, 0, 0, 2), UBPF_TEST_INSN(0x95, 0, 0, 0, 0) };
+    const uint64_t into_lddw[] = {
+        UBPF_TEST_INSN(0x05, 0, 0, 1, 0),
+        UBPF_TEST_INSN(0x18, 0, 0, 0, 0),
+        UBPF_TEST_INSN(0x00, 0, 0, 0, 0),
+        UBPF_TEST_INSN(0x95, 0, 0, 0, 0),
+    };
+    /* The stack accesses that pluglet_count_elidable_checks() would find */
+    bool is_elidable[sizeof(insns) / sizeof(insns[0])] = { [5] = true, [8] = true };
+    uint64_t mem[4] = { 0, 0x1234, 0, 0 };
+    uint64_t outside[2] = { 0, 0x5678 };
+    bool has_error = false;
+
+    if (ubpf_test_threaded_run(insns, sizeof(insns) / sizeof(insns[0]), is_elidable, NULL, NULL, 0, &has_error) != 0x8700 || has_error) {
+        return -1;
+    }
+    /* The accesses out of the memory of the plugin and of the stack are caught */
+    if (ubpf_test_threaded_run(load_arg, 2, NULL, mem, mem, sizeof(mem), &has_error) != 0x1234 || has_error ||
+        ubpf_test_threaded_run(load_arg, 2, NULL, outside, mem, sizeof(mem), &has_error) != UINT64_MAX || !has_error ||
+        ubpf_test_threaded_run(load_arg, 2, NULL, &mem[3], mem, sizeof(mem), &has_error) != UINT64_MAX || !has_error) {
+        return -1;
+    }
+    if (ubpf_test_threaded_run(divide, 3, NULL, NULL, NULL, 0, &has_error) != UINT64_MAX || !has_error ||
+        ubpf_test_threaded_run(no_exit, 1, NULL, NULL, NULL, 0, &has_error) != UINT64_MAX || !has_error) {
+        return -1;
+    }
+    if (ubpf_test_threaded_run(jump_out, 2, NULL, NULL, NULL, 0, &has_error) != UINT64_MAX - 1 ||
+        ubpf_test_threaded_run(unknown_helper, 2, NULL, NULL, NULL, 0, &has_error) != UINT64_MAX - 1 ||
+        ubpf_test_threaded_run(into_lddw, 4, NULL, NULL, NULL, 0, &has_error) != UINT64_MAX - 1) {
+        return -1;
+    }
+    return 0;
+}
+
+/* The calls to the getters and setters of the plain fields with a constant key run as loads and stores */
+int pluglet_threaded_getset_test()
+{
+    const uint64_t cnx_insns[] = {
+        UBPF_TEST_INSN(0xbf, 6, 1, 0, 0),       /* r6 = r1 */
+        UBPF_TEST_INSN(0xb7, 2, 0, 0, AK_CNX_START_TIME),
+        UBPF_TEST_INSN(0xb7, 4, 0, 0, 42),      /* r4 = 42 */
+        UBPF_TEST_INSN(0x85, 0, 0, 0, 4),       /* set_cnx(r1, AK_CNX_START_TIME, r3, 42) */
+        UBPF_TEST_INSN(0xbf, 1, 6, 0, 0),       /* r1 = r6 */
+        UBPF_TEST_INSN(0xb4, 2, 0, 0, AK_CNX_START_TIME),
+        UBPF_TEST_INSN(0x85, 0, 0, 0, 3),       /* get_cnx(r1, AK_CNX_START_TIME, r3) */
+        UBPF_TEST_INSN(0x07, 0, 0, 0, 1),       /* r0 += 1 */
+        UBPF_TEST_INSN(0x95, 0, 0, 0, 0),
+    };
+    const uint64_t path_insns[] = {
+        UBPF_TEST_INSN(0xbf, 6, 1, 0, 0),       /* r6 = r1 */
+        UBPF_TEST_INSN(0xb7, 2, 0, 0, AK_PATH_PEER_ADDR_LEN),
+        UBPF_TEST_INSN(0xb7, 4, 0, 0, -2),      /* r4 = -2 */
+        UBPF_TEST_INSN(0x85, 0, 0, 0, 6),       /* set_path(r1, AK_PATH_PEER_ADDR_LEN, r3, -2) */
+        UBPF_TEST_INSN(0xbf, 1, 6, 0, 0),       /* r1 = r6 */
+        UBPF_TEST_INSN(0xb7, 2, 0, 0, AK_PATH_PEER_ADDR_LEN),
+        UBPF_TEST_INSN(0x05, 0, 0, 0, 0),       /* goto +0, the key is no more known at the call */
+        UBPF_TEST_INSN(0x85, 0, 0, 0, 5),       /* get_path(r1, AK_PATH_PEER_ADDR_LEN, r3) */
+        UBPF_TEST_INSN(0xbf, 7, 0, 0, 0),       /* r7 = r0 */
+        UBPF_TEST_INSN(0xbf, 1, 6, 0, 0),       /* r1 = r6 */
+        UBPF_TEST_INSN(0xb7, 2, 0, 0, AK_PATH_PEER_ADDR_LEN),
+        UBPF_TEST_INSN(0x85, 0, 0, 0, 5),       /* get_path(r1, AK_PATH_PEER_ADDR_LEN, r3) */
+        UBPF_TEST_INSN(0x0f, 0, 7, 0, 0),       /* r0 += r7 */
+        UBPF_TEST_INSN(0x95, 0, 0, 0, 0),
+    };
+    picoquic_cnx_t *cnx = (picoquic_cnx_t *) calloc(1, sizeof(picoquic_cnx_t));
+    picoquic_path_t *path_x = (picoquic_path_t *) calloc(1, sizeof(picoquic_path_t));
+    bool has_error = false;
+    int ret = 0;
+
+    if (cnx == NULL || path_x == NULL) {
+        ret = -1;
+    } else if (ubpf_test_threaded_run(cnx_insns, sizeof(cnx_insns) / sizeof(cnx_insns[0]), NULL, cnx, NULL, 0, &has_error) != 43 ||
+        has_error || cnx->start_time != 42) {
+        ret = -1;
+    } else if (ubpf_test_threaded_run(path_insns, sizeof(path_insns) / sizeof(path_insns[0]), NULL, path_x, NULL, 0, &has_error) !=
+        (uint64_t) -4 || has_error || path_x->peer_addr_len != -2) {
+        ret = -1;
+    }
+    free(cnx);
+    free(path_x);
+
+    return ret;
+}
@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "vnet_offload.h"
+
+#define VNET_TEST_PAYLOAD 5000
+#define VNET_TEST_GSO_SIZE 1448
+#define VNET_TEST_SEGMENT_MAX 1200
+#define VNET_TEST_MAX_SEGMENTS 16
+
+static uint16_t vnet_test_fold(uint64_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)sum;
+}
+
+static uint64_t vnet_test_sum(uint8_t const* bytes, size_t length)
+{
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        sum += (i & 1) ? bytes[i] : ((uint64_t)bytes[i]) << 8;
+    }
+    return sum;
+}
+
+/* Checks the lengths and checksums of an IP packet carrying a TCP segment */
+static int vnet_test_check_packet(uint8_t const* ip, size_t length, size_t ip_hlen)
+{
+    uint64_t pseudo;
+
+    if (ip_hlen == 20) {
+        if (PICOPARSE_16(ip + 2) != length || vnet_test_fold(vnet_test_sum(ip, 20)) != 0xFFFF) {
+            return -1;
+        }
+        pseudo = vnet_test_sum(ip + 12, 8);
+    } else {
+        if (PICOPARSE_16(ip + 4) != length - 40) {
+            return -1;
+        }
+        pseudo = vnet_test_sum(ip + 8, 32);
+    }
+    pseudo += 6 + length - ip_hlen;
+
+    return (vnet_test_fold(pseudo + vnet_test_sum(ip + ip_hlen, length - ip_hlen)) == 0xFFFF) ? 0 : -1;
+}
+
+/* Builds a frame as the kernel does with TSO: one super-packet, its TCP checksum only covering the pseudo header */
+static size_t vnet_test_super_packet(uint8_t* frame, int is_ipv6, uint8_t tcp_flags)
+{
+    picoquic_vnet_hdr_t hdr;
+    uint8_t* ip = frame + PICOQUIC_VNET_HDR_SIZE;
+    size_t ip_hlen = (is_ipv6) ? 40 : 20;
+    size_t headers = ip_hlen + 32;
+    size_t length = headers + VNET_TEST_PAYLOAD;
+    uint8_t* tcp = ip + ip_hlen;
+    uint64_t pseudo;
+
+    memset(ip, 0, headers);
+    if (is_ipv6) {
+        ip[0] = 0x60;
+        picoformat_16(ip + 4, (uint16_t)(length - 40));
+        ip[6] = 6;
+        ip[7] = 64;
+        for (int i = 0; i < 32; i++) {
+            ip[8 + i] = (uint8_t)(0x20 + i);
+        }
+        pseudo = vnet_test_sum(ip + 8, 32);
+    } else {
+        ip[0] = 0x45;
+        picoformat_16(ip + 2, (uint16_t)length);
+        picoformat_16(ip + 4, 0x1234);
+        ip[6] = 0x40;
+        ip[8] = 64;
+        ip[9] = 6;
+        picoformat_32(ip + 12, 0x0A000001);
+        picoformat_32(ip + 16, 0x0A000002);
+        picoformat_16(ip + 10, (uint16_t)~vnet_test_fold(vnet_test_sum(ip, 20)));
+        pseudo = vnet_test_sum(ip + 12, 8);
+    }
+    picoformat_16(tcp, 443);
+    picoformat_16(tcp + 2, 51000);
+    picoformat_32(tcp + 4, 0xFFFFF000); /* The sequence numbers wrap */
+    picoformat_32(tcp + 8, 0x12345678);
+    tcp[12] = 0x80;
+    tcp[13] = tcp_flags;
+    picoformat_16(tcp + 14, 512);
+    /* NOP, NOP and timestamps */
+    tcp[20] = 1;
+    tcp[21] = 1;
+    tcp[22] = 8;
+    tcp[23] = 10;
+    picoformat_32(tcp + 24, 1000);
+    picoformat_32(tcp + 28, 2000);
+    for (size_t i = 0; i < VNET_TEST_PAYLOAD; i++) {
+        ip[headers + i] = (uint8_t)(i * 7 + (i >> 8));
+    }
+    picoformat_16(tcp + 16, vnet_test_fold(pseudo + 6 + length - ip_hlen));
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.flags = PICOQUIC_VNET_HDR_F_NEEDS_CSUM;
+    hdr.gso_type = (is_ipv6) ? PICOQUIC_VNET_HDR_GSO_TCPV6 : PICOQUIC_VNET_HDR_GSO_TCPV4;
+    hdr.hdr_len = (uint16_t)headers;
+    hdr.gso_size = VNET_TEST_GSO_SIZE;
+    hdr.csum_start = (uint16_t)ip_hlen;
+    hdr.csum_offset = 16;
+    picoquic_vnet_hdr_encode(&hdr, frame);
+
+    return PICOQUIC_VNET_HDR_SIZE + length;
+}
+
+static int vnet_test_one(uint8_t* frame, uint8_t* frame2, uint8_t* segments, int is_ipv6)
+{
+    size_t ip_hlen = (is_ipv6) ? 40 : 20;
+    size_t headers = ip_hlen + 32;
+    size_t frame_length = vnet_test_super_packet(frame, is_ipv6, 0x18);
+    size_t lengths[VNET_TEST_MAX_SEGMENTS];
+    size_t lengths2[VNET_TEST_MAX_SEGMENTS];
+    uint8_t const* packets[VNET_TEST_MAX_SEGMENTS];
+    size_t frame2_length = 0;
+    size_t mss = VNET_TEST_SEGMENT_MAX - headers;
+    int nb_expected = (int)((VNET_TEST_PAYLOAD + mss - 1) / mss);
+    int nb_segments = picoquic_vnet_segment(frame, frame_length, VNET_TEST_SEGMENT_MAX,
+        segments, PICOQUIC_MAX_PACKET_SIZE, lengths, VNET_TEST_MAX_SEGMENTS);
+    picoquic_vnet_hdr_t hdr;
+
+    /* The segments are made smaller than the gso size, to fit the segment max */
+    if (nb_segments != nb_expected) {
+        DBG_PRINTF("Super-packet split in %d segments instead of %d\n", nb_segments, nb_expected);
+        return -1;
+    }
+    for (int i = 0; i < nb_segments; i++) {
+        uint8_t const* segment = segments + i * PICOQUIC_MAX_PACKET_SIZE;
+        uint8_t const* tcp = segment + ip_hlen;
+
+        packets[i] = segment;
+        if (lengths[i] > VNET_TEST_SEGMENT_MAX || vnet_test_check_packet(segment, lengths[i], ip_hlen) != 0 ||
+            PICOPARSE_32(tcp + 4) != 0xFFFFF000 + (uint32_t)(i * mss) ||
+            tcp[13] != ((i + 1 == nb_segments) ? 0x18 : 0x10) ||
+            memcmp(segment + headers, frame + PICOQUIC_VNET_HDR_SIZE + headers + i * mss, lengths[i] - headers) != 0 ||
+            (!is_ipv6 && PICOPARSE_16(segment + 4) != 0x1234 + i)) {
+            DBG_PRINTF("Segment %d of %zu bytes is wrong\n", i, lengths[i]);
+            return -1;
+        }
+    }
+
+    /* The segments merge back into one super-packet, which splits again in the same segments */
+    if (picoquic_vnet_coalesce(packets, lengths, nb_segments, frame2, PICOQUIC_VNET_FRAME_MAX, &frame2_length) != nb_segments ||
+        frame2_length != frame_length) {
+        DBG_PRINTF("Coalesced %zu bytes instead of %zu\n", frame2_length, frame_length);
+        return -1;
+    }
+    picoquic_vnet_hdr_decode(frame2, &hdr);
+    if (hdr.flags != PICOQUIC_VNET_HDR_F_NEEDS_CSUM || hdr.gso_size != mss || hdr.hdr_len != headers ||
+        hdr.csum_start != ip_hlen || hdr.csum_offset != 16 ||
+        memcmp(frame2 + PICOQUIC_VNET_HDR_SIZE + headers, frame + PICOQUIC_VNET_HDR_SIZE + headers, VNET_TEST_PAYLOAD) != 0) {
+        DBG_PRINTF("%s", "Wrong coalesced super-packet\n");
+        return -1;
+    }
+    if (picoquic_vnet_segment(frame2, frame2_length, VNET_TEST_SEGMENT_MAX, segments + VNET_TEST_MAX_SEGMENTS * PICOQUIC_MAX_PACKET_SIZE,
+        PICOQUIC_MAX_PACKET_SIZE, lengths2, VNET_TEST_MAX_SEGMENTS) != nb_segments) {
+        DBG_PRINTF("%s", "The coalesced super-packet does not split again\n");
+        return -1;
+    }
+    for (int i = 0; i < nb_segments; i++) {
+        if (lengths2[i] != lengths[i] ||
+            memcmp(segments + (VNET_TEST_MAX_SEGMENTS + i) * PICOQUIC_MAX_PACKET_SIZE, packets[i], lengths[i]) != 0) {
+            DBG_PRINTF("Segment %d differs after coalescing\n", i);
+            return -1;
+        }
+    }
+
+    /* A segment of another flow ends the super-packet, and a single packet only gets a header */
+    segments[PICOQUIC_MAX_PACKET_SIZE * 2 + ip_hlen + 1] ^= 1;
+    if (picoquic_vnet_coalesce(packets, lengths, nb_segments, frame2, PICOQUIC_VNET_FRAME_MAX, &frame2_length) != 2 ||
+        picoquic_vnet_coalesce(packets + 2, lengths + 2, 1, frame2, PICOQUIC_VNET_FRAME_MAX, &frame2_length) != 1 ||
+        frame2_length != PICOQUIC_VNET_HDR_SIZE + lengths[2] || frame2[0] != 0 || frame2[1] != 0 ||
+        memcmp(frame2 + PICOQUIC_VNET_HDR_SIZE, packets[2], lengths[2]) != 0) {
+        DBG_PRINTF("%s", "Wrong coalescing of another flow\n");
+        return -1;
+    }
+
+    /* Too few slots */
+    if (picoquic_vnet_segment(frame, frame_length, VNET_TEST_SEGMENT_MAX, segments, PICOQUIC_MAX_PACKET_SIZE,
+        lengths, nb_expected - 1) != -1) {
+        DBG_PRINTF("%s", "Segmented in too few slots\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int vnet_offload_test()
+{
+    int ret = 0;
+    uint8_t* frame = (uint8_t*)malloc(PICOQUIC_VNET_FRAME_MAX);
+    uint8_t* frame2 = (uint8_t*)malloc(PICOQUIC_VNET_FRAME_MAX);
+    uint8_t* segments = (uint8_t*)malloc(2 * VNET_TEST_MAX_SEGMENTS * PICOQUIC_MAX_PACKET_SIZE);
+
+    if (frame == NULL || frame2 == NULL || segments == NULL) {
+        ret = -1;
+    }
+
+    for (int is_ipv6 = 0; ret == 0 && is_ipv6 <= 1; is_ipv6++) {
+        ret = vnet_test_one(frame, frame2, segments, is_ipv6);
+    }
+
+    if (ret == 0) {
+        /* A packet without segmentation has its checksum completed */
+        size_t frame_length = vnet_test_super_packet(frame, 0, 0x10);
+        size_t length;
+        picoquic_vnet_hdr_t hdr;
+
+        picoquic_vnet_hdr_decode(frame, &hdr);
+        hdr.gso_type = PICOQUIC_VNET_HDR_GSO_NONE;
+        picoquic_vnet_hdr_encode(&hdr, frame);
+        if (picoquic_vnet_segment(frame, frame_length, PICOQUIC_VNET_FRAME_MAX, frame2, PICOQUIC_VNET_FRAME_MAX, &length, 1) != 1 ||
+            length != frame_length - PICOQUIC_VNET_HDR_SIZE || vnet_test_check_packet(frame2, length, 20) != 0) {
+            DBG_PRINTF("%s", "Wrong checksum of a packet without segmentation\n");
+            ret = -1;
+        }
+    }
+
+    free(frame);
+    free(frame2);
+    free(segments);
+
+    return ret;
+}
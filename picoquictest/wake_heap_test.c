@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#ifndef _WINDOWS
+#include <sys/time.h>
+#endif
+#include "picoquic_internal.h"
+
+#define WAKE_HEAP_TEST_NB_CNX 1000
+#define WAKE_HEAP_BENCH_NB_CNX 50000
+#define WAKE_HEAP_BENCH_NB_UPDATES 2000000
+
+static uint64_t wake_heap_test_random(uint64_t* seed)
+{
+    *seed = *seed * 6364136223846793005ull + 1442695040888963407ull;
+    return *seed >> 33;
+}
+
+static picoquic_cnx_t* wake_heap_test_create(picoquic_quic_t* quic, size_t nb_cnx, uint64_t* seed)
+{
+    picoquic_cnx_t* cnx = calloc(nb_cnx, sizeof(picoquic_cnx_t));
+
+    for (size_t i = 0; cnx != NULL && i < nb_cnx; i++) {
+        cnx[i].quic = quic;
+        cnx[i].next_wake_time = wake_heap_test_random(seed) % 1000000;
+        if (picoquic_insert_cnx_by_wake_time(quic, &cnx[i]) != 0) {
+            free(cnx);
+            cnx = NULL;
+        }
+    }
+
+    return cnx;
+}
+
+/* Empties the heap, checking that the connections come out by wake time, then by insertion */
+static int wake_heap_test_drain(picoquic_quic_t* quic, size_t nb_expected)
+{
+    picoquic_cnx_t* previous = NULL;
+    picoquic_cnx_t* cnx;
+    size_t nb_cnx = 0;
+
+    while ((cnx = picoquic_get_earliest_cnx_to_wake(quic, 0)) != NULL) {
+        if (previous != NULL && (previous->next_wake_time > cnx->next_wake_time ||
+            (previous->next_wake_time == cnx->next_wake_time && previous->wake_sequence > cnx->wake_sequence))) {
+            return -1;
+        }
+        picoquic_remove_cnx_from_wake_list(cnx);
+        previous = cnx;
+        nb_cnx++;
+    }
+
+    return (nb_cnx == nb_expected) ? 0 : -1;
+}
+
+int wake_heap_test()
+{
+    int ret = 0;
+    uint64_t seed = 0xdeadbeef;
+    picoquic_quic_t* quic = calloc(1, sizeof(picoquic_quic_t));
+    picoquic_cnx_t* cnx = (quic == NULL) ? NULL : wake_heap_test_create(quic, WAKE_HEAP_TEST_NB_CNX, &seed);
+
+    if (cnx == NULL) {
+        ret = -1;
+    }
+
+    /* Move the connections around, then remove a tenth of them */
+    for (int i = 0; ret == 0 && i < 10 * WAKE_HEAP_TEST_NB_CNX; i++) {
+        picoquic_cnx_t* cnx_x = &cnx[wake_heap_test_random(&seed) % WAKE_HEAP_TEST_NB_CNX];
+        picoquic_reinsert_by_wake_time(quic, cnx_x, wake_heap_test_random(&seed) % 1000);
+    }
+    for (int i = 0; ret == 0 && i < WAKE_HEAP_TEST_NB_CNX; i += 10) {
+        picoquic_remove_cnx_from_wake_list(&cnx[i]);
+        /* Removing twice has no effect */
+        picoquic_remove_cnx_from_wake_list(&cnx[i]);
+    }
+    if (ret == 0 && (quic->cnx_wake_heap_size != WAKE_HEAP_TEST_NB_CNX - WAKE_HEAP_TEST_NB_CNX / 10 ||
+        picoquic_get_next_wake_delay(quic, 0, 1000000) != (int64_t)picoquic_get_earliest_cnx_to_wake(quic, 0)->next_wake_time ||
+        wake_heap_test_drain(quic, WAKE_HEAP_TEST_NB_CNX - WAKE_HEAP_TEST_NB_CNX / 10) != 0)) {
+        ret = -1;
+    }
+
+    /* Connections waking at the same time take turns */
+    if (ret == 0) {
+        for (int i = 0; ret == 0 && i < 3; i++) {
+            cnx[i].next_wake_time = 100;
+            ret = picoquic_insert_cnx_by_wake_time(quic, &cnx[i]);
+        }
+        picoquic_reinsert_by_wake_time(quic, &cnx[0], 100);
+        if (ret == 0 && (picoquic_get_earliest_cnx_to_wake(quic, 99) != NULL ||
+            picoquic_get_earliest_cnx_to_wake(quic, 100) != &cnx[1] ||
+            picoquic_get_next_wake_delay(quic, 200, 1000) != 0 ||
+            picoquic_get_next_wake_delay(quic, 0, 50) != 50)) {
+            ret = -1;
+        }
+        picoquic_remove_cnx_from_wake_list(&cnx[1]);
+        if (ret == 0 && (picoquic_get_earliest_cnx_to_wake(quic, 0) != &cnx[2] || wake_heap_test_drain(quic, 2) != 0 ||
+            picoquic_get_next_wake_delay(quic, 0, 50) != 50)) {
+            ret = -1;
+        }
+    }
+
+    free(cnx);
+    if (quic != NULL) {
+        free(quic->cnx_wake_heap);
+        free(quic);
+    }
+
+    return ret;
+}
+
+/* Time taken by the wake time updates of a server with many connections */
+int wake_heap_bench_test()
+{
+    int ret = 0;
+    uint64_t seed = 0x12345678;
+    uint64_t current_time = 0;
+    picoquic_quic_t* quic = calloc(1, sizeof(picoquic_quic_t));
+    picoquic_cnx_t* cnx = (quic == NULL) ? NULL : wake_heap_test_create(quic, WAKE_HEAP_BENCH_NB_CNX, &seed);
+    struct timeval tv_start;
+    struct timeval tv_end;
+
+    if (cnx == NULL) {
+        ret = -1;
+    } else {
+        gettimeofday(&tv_start, NULL);
+
+        /* As in a server loop, the earliest connection is served and sets its next wake time */
+        for (int i = 0; i < WAKE_HEAP_BENCH_NB_UPDATES; i++) {
+            picoquic_cnx_t* cnx_next = picoquic_get_earliest_cnx_to_wake(quic, 0);
+
+            if (cnx_next->next_wake_time > current_time) {
+                current_time = cnx_next->next_wake_time;
+            }
+            picoquic_reinsert_by_wake_time(quic, cnx_next, current_time + wake_heap_test_random(&seed) % 100000);
+        }
+
+        gettimeofday(&tv_end, NULL);
+
+        fprintf(stderr, "Wake heap: %d updates with %d connections in %" PRIu64 " us\n",
+            WAKE_HEAP_BENCH_NB_UPDATES, WAKE_HEAP_BENCH_NB_CNX,
+            (uint64_t)((tv_end.tv_sec - tv_start.tv_sec) * 1000000 + (tv_end.tv_usec - tv_start.tv_usec)));
+
+        ret = wake_heap_test_drain(quic, WAKE_HEAP_BENCH_NB_CNX);
+    }
+
+    free(cnx);
+    if (quic != NULL) {
+        free(quic->cnx_wake_heap);
+        free(quic);
+    }
+
+    return ret;
+}
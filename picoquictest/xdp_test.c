@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_internal.h"
+#include "picoxdp.h"
+
+static int xdp_frame_test_one(struct sockaddr* addr_from, struct sockaddr* addr_dest, size_t from_length)
+{
+    int ret = 0;
+    uint8_t frame[PICOQUIC_XDP_FRAME_SIZE];
+    uint8_t* payload = frame + PICOQUIC_XDP_HEADROOM;
+    const uint8_t mac_src[6] = { 2, 0, 0, 0, 0, 1 };
+    const uint8_t mac_dst[6] = { 2, 0, 0, 0, 0, 2 };
+    uint8_t mac[6];
+    picoquic_recv_datagram_t d;
+    int port = ntohs((addr_dest->sa_family == AF_INET) ?
+        ((struct sockaddr_in*)addr_dest)->sin_port : ((struct sockaddr_in6*)addr_dest)->sin6_port);
+    int header_length;
+
+    for (size_t i = 0; i < 1001; i++) {
+        payload[i] = (uint8_t)(i * 7);
+    }
+
+    /* Odd lengths test the padding of the checksum */
+    header_length = picoquic_xdp_encap(payload, 1001, mac_src, mac_dst, addr_from, addr_dest);
+    if (header_length != ((addr_dest->sa_family == AF_INET) ? 42 : 62)) {
+        DBG_PRINTF("Wrong header length %d\n", header_length);
+        ret = -1;
+    } else if (picoquic_xdp_decap(payload - header_length, header_length + 1001, port, &d, mac) != 0 ||
+        d.length != 1001 || d.bytes != payload || memcmp(mac, mac_src, 6) != 0 || memcmp(payload - header_length, mac_dst, 6) != 0 ||
+        d.from_length != from_length || d.dest_length != from_length ||
+        picoquic_compare_addr((struct sockaddr*)&d.addr_from, addr_from) != 0 ||
+        picoquic_compare_addr((struct sockaddr*)&d.addr_dest, addr_dest) != 0) {
+        DBG_PRINTF("%s", "Wrong decapsulation\n");
+        ret = -1;
+    } else if (picoquic_xdp_decap(payload - header_length, header_length + 1001, port + 1, &d, mac) == 0) {
+        DBG_PRINTF("%s", "Accepted the wrong port\n");
+        ret = -1;
+    } else if (picoquic_xdp_decap(payload - header_length, header_length + 1000, port, &d, mac) == 0) {
+        DBG_PRINTF("%s", "Accepted a truncated frame\n");
+        ret = -1;
+    } else {
+        payload[500] ^= 1;
+        if (picoquic_xdp_decap(payload - header_length, header_length + 1001, port, &d, mac) == 0) {
+            DBG_PRINTF("%s", "Accepted a wrong checksum\n");
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/* The headers written for a datagram are read back, and damaged frames are rejected */
+int xdp_frames_test()
+{
+    int ret = 0;
+    struct sockaddr_in from4;
+    struct sockaddr_in dest4;
+    struct sockaddr_in6 from6;
+    struct sockaddr_in6 dest6;
+
+    memset(&from4, 0, sizeof(from4));
+    from4.sin_family = AF_INET;
+    from4.sin_addr.s_addr = htonl(0xC0A80001);
+    from4.sin_port = htons(4443);
+    dest4 = from4;
+    dest4.sin_addr.s_addr = htonl(0x0A000102);
+    dest4.sin_port = htons(54321);
+
+    memset(&from6, 0, sizeof(from6));
+    from6.sin6_family = AF_INET6;
+    from6.sin6_addr.s6_addr[0] = 0x20;
+    from6.sin6_addr.s6_addr[1] = 0x01;
+    from6.sin6_addr.s6_addr[15] = 1;
+    from6.sin6_port = htons(4443);
+    dest6 = from6;
+    dest6.sin6_addr.s6_addr[15] = 2;
+    dest6.sin6_port = htons(54321);
+
+    if (xdp_frame_test_one((struct sockaddr*)&from4, (struct sockaddr*)&dest4, sizeof(from4)) != 0 ||
+        xdp_frame_test_one((struct sockaddr*)&from6, (struct sockaddr*)&dest6, sizeof(from6)) != 0) {
+        ret = -1;
+    } else if (picoquic_xdp_encap((uint8_t*)&dest6 + PICOQUIC_XDP_HEADROOM, 0, NULL, NULL,
+        (struct sockaddr*)&from4, (struct sockaddr*)&dest6) >= 0) {
+        DBG_PRINTF("%s", "Mixed the address families\n");
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Generic XDP on the loopback: the datagrams to the port go to the socket, the others to the kernel */
+int xdp_loopback_test()
+{
+    int ret = 0;
+    int test_port = 12353;
+    uint64_t current_time = 0;
+    uint8_t message[128];
+    picoquic_recv_datagram_t datagrams[4];
+    struct sockaddr_in server_addr;
+    int nb_received = 0;
+    int one = 1;
+    picoquic_xdp_t* xdp;
+    SOCKET_TYPE fd = INVALID_SOCKET;
+
+    if ((xdp = picoquic_xdp_create("lo", 0, test_port, PICOQUIC_XDP_FLAG_SKB_MODE)) == NULL) {
+        DBG_PRINTF("%s", "No AF_XDP on the loopback, test skipped\n");
+        return 0;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server_addr.sin_port = htons((uint16_t)test_port);
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    memset(message, 0x5A, sizeof(message));
+    /* The loopback leaves the checksums to offload, the frames would only hold the one of the pseudo header */
+    if (fd == INVALID_SOCKET || setsockopt(fd, SOL_SOCKET, SO_NO_CHECK, &one, sizeof(one)) != 0) {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < 3; i++) {
+        message[0] = (uint8_t)i;
+        if (sendto(fd, (const char*)message, sizeof(message), 0, (struct sockaddr*)&server_addr, sizeof(server_addr)) != sizeof(message)) {
+            ret = -1;
+        }
+    }
+
+    /* No socket is bound to the port, the datagrams can only arrive through the XDP program */
+    while (ret == 0 && nb_received < 3) {
+        int nb = picoquic_xdp_recv_batch(xdp, datagrams, 2, 1000000, &current_time);
+
+        if (nb <= 0) {
+            ret = -1;
+        }
+        for (int i = 0; ret == 0 && i < nb; i++) {
+            if (datagrams[i].length != sizeof(message) || datagrams[i].bytes[0] != nb_received ||
+                memcmp(datagrams[i].bytes + 1, message + 1, sizeof(message) - 1) != 0 ||
+                datagrams[i].socket != INVALID_SOCKET || datagrams[i].addr_from.ss_family != AF_INET) {
+                DBG_PRINTF("Wrong datagram %d\n", nb_received);
+                ret = -1;
+            }
+            nb_received++;
+        }
+    }
+
+    /* The loopback drops the frames from 127.0.0.1 injected by the socket as martians, but it runs the program
+     * on them first: the datagram sent to the port comes back to the socket, its checksums checked on receive */
+    if (ret == 0) {
+        uint8_t* send_buffer = picoquic_xdp_get_send_buffer(xdp);
+
+        if (send_buffer == NULL) {
+            ret = -1;
+        } else {
+            memset(send_buffer, 0xA5, 333);
+            if (picoquic_xdp_queue_send(xdp, (struct sockaddr*)&server_addr, (struct sockaddr*)&datagrams[0].addr_dest, 333) != 0 ||
+                picoquic_xdp_submit(xdp) != 0 ||
+                picoquic_xdp_recv_batch(xdp, datagrams, 4, 1000000, &current_time) != 1 ||
+                datagrams[0].length != 333 || datagrams[0].bytes[0] != 0xA5 ||
+                ((struct sockaddr_in*)&datagrams[0].addr_from)->sin_port != server_addr.sin_port) {
+                DBG_PRINTF("%s", "The datagram sent did not come back\n");
+                ret = -1;
+            }
+        }
+    }
+
+    picoquic_xdp_free(xdp);
+    if (fd != INVALID_SOCKET) {
+        SOCKET_CLOSE(fd);
+    }
+
+    return ret;
+}
@@ -3,7 +3,7 @@
 #include "../helpers.h"
 #include "memory.h"
 
-static int process_ack_of_ack_frame(picoquic_cnx_t* cnx, picoquic_sack_item_t* first_sack,
+static int process_ack_of_ack_frame(picoquic_cnx_t* cnx, picoquic_sack_list_t* sacks,
     uint8_t* bytes, size_t bytes_max, size_t* consumed, int is_ecn)
 {
     int ret;
@@ -11,16 +11,6 @@ static int process_ack_of_ack_frame(picoquic_cnx_t* cnx, picoquic_sack_item_t* f
     uint64_t ack_delay;
     uint64_t num_block;
 
-    /* Find the oldest ACK range, in order to calibrate the
-     * extension of the largest number to 64 bits */
-
-    picoquic_sack_item_t* target_sack = first_sack;
-    picoquic_sack_item_t* next_sack = (picoquic_sack_item_t*) get_sack_item(target_sack, AK_SACKITEM_NEXT_SACK);
-    while (next_sack != NULL) {
-        target_sack = next_sack;
-        next_sack = (picoquic_sack_item_t*) get_sack_item(target_sack, AK_SACKITEM_NEXT_SACK);
-    }
-
     ret = helper_parse_ack_header(bytes, bytes_max,
         &num_block,
         &largest, &ack_delay, consumed, 0);
@@ -57,7 +47,7 @@ static int process_ack_of_ack_frame(picoquic_cnx_t* cnx, picoquic_sack_item_t* f
             }
 
             if (range > 0) {
-                helper_process_ack_of_ack_range(cnx, first_sack, largest + 1 - range, largest);
+                helper_process_ack_of_ack_range(cnx, sacks, largest + 1 - range, largest);
             }
 
             if (num_block-- == 0)
@@ -133,8 +123,8 @@ protoop_arg_t process_possible_ack_of_ack_frame(picoquic_cnx_t* cnx)
             picoquic_path_t *send_path = (picoquic_path_t *) get_pkt(p, AK_PKT_SEND_PATH);
             picoquic_packet_context_enum pc = (picoquic_packet_context_enum) get_pkt(p, AK_PKT_CONTEXT);
             picoquic_packet_context_t *pkt_ctx = (picoquic_packet_context_t *) get_path(send_path, AK_PATH_PKT_CTX, pc);
-            picoquic_sack_item_t *first_sack = (picoquic_sack_item_t *) get_pkt_ctx(pkt_ctx, AK_PKTCTX_FIRST_SACK_ITEM);
-            ret = process_ack_of_ack_frame(cnx, first_sack,
+            picoquic_sack_list_t *sacks = (picoquic_sack_list_t *) get_pkt_ctx(pkt_ctx, AK_PKTCTX_SACK_LIST);
+            ret = process_ack_of_ack_frame(cnx, sacks,
                 &bytes[byte_index], length - byte_index, &frame_length, is_ecn);
             byte_index += frame_length;
         } else if (PICOQUIC_IN_RANGE(type_byte, picoquic_frame_type_stream_range_min, picoquic_frame_type_stream_range_max)) {
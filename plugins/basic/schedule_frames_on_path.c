@@ -94,7 +94,8 @@ protoop_arg_t schedule_frames_on_path(picoquic_cnx_t *cnx)
         if (helper_is_ack_needed(cnx, current_time, pc, path_x) == 0
             && challenge_response_to_send == 0
             && (challenge_verified == 1 || current_time < challenge_time + retransmit_timer)) {
-            if (ret == 0 && send_buffer_max > path_send_mtu && helper_is_mtu_probe_needed(cnx, path_x)) {
+            if (ret == 0 && send_buffer_max > path_send_mtu && helper_is_mtu_probe_needed(cnx, path_x) &&
+                helper_mtu_probe_length(cnx, path_x) <= send_buffer_max) {
                 length = helper_prepare_mtu_probe(cnx, path_x, header_length, checksum_overhead, bytes);
                 set_pkt(packet, AK_PKT_IS_MTU_PROBE, 1);
                 set_pkt(packet, AK_PKT_LENGTH, length);
@@ -222,6 +223,9 @@ protoop_arg_t schedule_frames_on_path(picoquic_cnx_t *cnx)
 
                             for (int i = 0; ret == 0 && i < pids_to_request_size; i++) {
                                 pid_to_request = (plugin_req_pid_t *) get_cnx(cnx, AK_CNX_PIDS_TO_REQUEST, i);
+                                if (get_preq(pid_to_request, AK_PIDREQ_REQUESTED)) {
+                                    continue;
+                                }
                                 pid_id = (uint64_t) get_preq(pid_to_request, AK_PIDREQ_PID_ID);
                                 plugin_name = (char *) get_preq(pid_to_request, AK_PIDREQ_PLUGIN_NAME);
                                 ret = helper_write_plugin_validate_frame(cnx, &bytes[length], &bytes[send_buffer_min_max - checksum_overhead],
@@ -2,6 +2,8 @@
 #include "memcpy.h"
 #include "getset.h"
 #include "../helpers.h"
+#define DATAGRAM_RING_IN_PLUGIN
+#include "datagram_ring.h"
 
 #define FT_DATAGRAM 0x2c
 #define FT_DATAGRAM_LEN 0x01
@@ -30,19 +32,36 @@ typedef struct st_datagram_frame_t {
     uint8_t * datagram_data_ptr;  /* Start of the data, not contained in the structure */
 } datagram_frame_t;
 
+#define DATAGRAM_REORDER_SLOTS 128  // datagrams with an ID further than this from the expected one force the delivery of the others
+
 typedef struct st_received_datagram_t {
     datagram_frame_t *datagram;
     uint64_t delivery_deadline;
-    struct st_received_datagram_t *next;
+    uint32_t heap_index;
 } received_datagram_t;
 
+/* The reorder buffer, indexed by datagram_id % DATAGRAM_REORDER_SLOTS. It holds the IDs in
+ * [expected_datagram_id, expected_datagram_id + DATAGRAM_REORDER_SLOTS), so a slot holds at most one datagram. */
+typedef struct st_datagram_reorder_ring_t {
+    received_datagram_t *slots[DATAGRAM_REORDER_SLOTS];
+} datagram_reorder_ring_t;
+
+/* Min-heap of the buffered datagrams on their delivery deadline */
+typedef struct st_datagram_deadline_heap_t {
+    uint32_t size;
+    received_datagram_t *entries[DATAGRAM_REORDER_SLOTS];
+} datagram_deadline_heap_t;
+
 typedef struct st_datagram_memory_t {
     int socket_fds[2];  // TODO: When to free this socket ?
     uint64_t next_datagram_id;
     uint64_t expected_datagram_id;
-    received_datagram_t *datagram_buffer;
+    datagram_reorder_ring_t *reorder_ring;  // both allocated with the first datagram to buffer
+    datagram_deadline_heap_t *deadlines;
     uint32_t send_buffer;
     uint32_t recv_buffer;
+    datagram_rings_t *rings;  // NULL until the application asks for them, the socket pair is then unused
+    datagram_drops_t drops;  // shared with the application by get_message_drops
 } datagram_memory_t;
 
 static inline size_t varint_len(uint64_t val) {
@@ -106,9 +125,28 @@ static __attribute__((always_inline)) uint64_t get_max_rtt_difference(picoquic_c
     return highest_rtt - get_path(path_x, AK_PATH_SMOOTHED_RTT, 0);
 }
 
+/* The indexes of the rings are shared with the application, the volatile accesses keep their order in the pluglet */
+#define RING_INDEX(i) (*(volatile uint32_t *) &(i))
+
+static __attribute__((always_inline)) ssize_t put_datagram_in_rx_ring(datagram_rings_t *rings, datagram_frame_t *frame) {
+    datagram_ring_t *rx = &rings->rx;
+    uint32_t head = RING_INDEX(rx->head);
+    if (head - RING_INDEX(rx->tail) >= DATAGRAM_RING_SLOTS || frame->length > DATAGRAM_RING_SLOT_SIZE) {
+        return -1;
+    }
+    my_memcpy(rx->slots[head % DATAGRAM_RING_SLOTS], frame->datagram_data_ptr, frame->length);
+    rx->lengths[head % DATAGRAM_RING_SLOTS] = (uint32_t) frame->length;
+    RING_INDEX(rx->head) = head + 1;
+    if (rings->rx_event_fd != -1) {
+        uint64_t one = 1;
+        write(rings->rx_event_fd, &one, sizeof(one));
+    }
+    return (ssize_t) frame->length;
+}
+
 static __attribute__((always_inline)) protoop_arg_t send_datagram_to_application(datagram_memory_t *m, picoquic_cnx_t *cnx, datagram_frame_t *frame) {
-    ssize_t ret = write(m->socket_fds[PLUGIN_SOCKET], frame->datagram_data_ptr, frame->length);
-    PROTOOP_PRINTF(cnx, "Wrote %d bytes to the message socket\n", ret);
+    ssize_t ret = m->rings ? put_datagram_in_rx_ring(m->rings, frame) : write(m->socket_fds[PLUGIN_SOCKET], frame->datagram_data_ptr, frame->length);
+    PROTOOP_PRINTF(cnx, "Wrote %d bytes to the application\n", ret);
     //picoquic_reinsert_cnx_by_wake_time(cnx, picoquic_current_time());
     reserve_frame_slot_t *slot = my_malloc(cnx, sizeof(reserve_frame_slot_t));
     my_memset(slot, 0, sizeof(reserve_frame_slot_t));
@@ -116,108 +154,294 @@ static __attribute__((always_inline)) protoop_arg_t send_datagram_to_application
     slot->nb_bytes = 1;
     slot->frame_ctx = NULL;
     reserve_frames(cnx, 1, slot);
-    if (frame->datagram_id != 0) {
+    if (frame->datagram_id >= m->expected_datagram_id) {
         m->expected_datagram_id = frame->datagram_id + 1;
     }
     return (protoop_arg_t) (ret > 0 ? 0 : ret);
 }
 
+static __attribute__((always_inline)) bool datagram_buffer_is_empty(datagram_memory_t *m) {
+    return m->deadlines == NULL || m->deadlines->size == 0;
+}
+
+static __attribute__((always_inline)) int allocate_datagram_buffer(datagram_memory_t *m, picoquic_cnx_t *cnx) {
+    if (m->reorder_ring == NULL) {
+        m->reorder_ring = (datagram_reorder_ring_t *) my_malloc(cnx, sizeof(datagram_reorder_ring_t));
+        if (m->reorder_ring == NULL) {
+            return PICOQUIC_ERROR_MEMORY;
+        }
+        my_memset(m->reorder_ring, 0, sizeof(datagram_reorder_ring_t));
+    }
+    if (m->deadlines == NULL) {
+        m->deadlines = (datagram_deadline_heap_t *) my_malloc(cnx, sizeof(datagram_deadline_heap_t));
+        if (m->deadlines == NULL) {
+            return PICOQUIC_ERROR_MEMORY;
+        }
+        my_memset(m->deadlines, 0, sizeof(datagram_deadline_heap_t));
+    }
+    return 0;
+}
+
+static __attribute__((always_inline)) void deadline_heap_set(datagram_deadline_heap_t *h, uint32_t i, received_datagram_t *r) {
+    h->entries[i] = r;
+    r->heap_index = i;
+}
+
+static __attribute__((always_inline)) void deadline_heap_sift_up(datagram_deadline_heap_t *h, uint32_t i) {
+    received_datagram_t *r = h->entries[i];
+    while (i > 0 && h->entries[(i - 1) / 2]->delivery_deadline > r->delivery_deadline) {
+        deadline_heap_set(h, i, h->entries[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    deadline_heap_set(h, i, r);
+}
+
+static __attribute__((always_inline)) void deadline_heap_sift_down(datagram_deadline_heap_t *h, uint32_t i) {
+    received_datagram_t *r = h->entries[i];
+    while (2 * i + 1 < h->size) {
+        uint32_t child = 2 * i + 1;
+        if (child + 1 < h->size && h->entries[child + 1]->delivery_deadline < h->entries[child]->delivery_deadline) {
+            child++;
+        }
+        if (h->entries[child]->delivery_deadline >= r->delivery_deadline) {
+            break;
+        }
+        deadline_heap_set(h, i, h->entries[child]);
+        i = child;
+    }
+    deadline_heap_set(h, i, r);
+}
+
+static __attribute__((always_inline)) void deadline_heap_remove(datagram_deadline_heap_t *h, received_datagram_t *r) {
+    uint32_t i = r->heap_index;
+    h->size--;
+    if (i < h->size) {
+        received_datagram_t *moved = h->entries[h->size];
+        deadline_heap_set(h, i, moved);
+        deadline_heap_sift_up(h, i);
+        deadline_heap_sift_down(h, moved->heap_index);
+    }
+}
+
 static __attribute__((always_inline)) void dump_buffer(datagram_memory_t *m, picoquic_cnx_t *cnx) {
-    received_datagram_t *r = m->datagram_buffer;
     uint64_t now = picoquic_current_time();
-    while (r != NULL) {
-        PROTOOP_PRINTF(cnx, "{%d, d=%" PRIu64 ", n=%p} ", r->datagram->datagram_id, r->delivery_deadline < now ? 0 : r->delivery_deadline - now, (protoop_arg_t) r->next);
-        r = r->next;
+    for (uint32_t i = 0; m->deadlines != NULL && i < m->deadlines->size; i++) {
+        PROTOOP_PRINTF(cnx, "{%d, d=%" PRIu64 "} ", m->deadlines->entries[i]->datagram->datagram_id,
+            m->deadlines->entries[i]->delivery_deadline < now ? 0 : m->deadlines->entries[i]->delivery_deadline - now);
     }
     PROTOOP_PRINTF(cnx, "\n");
 }
 
+/* The caller ensures that the ID of the datagram is in the window of the ring, and that its slot is free */
 static __attribute__((always_inline)) void insert_into_datagram_buffer(datagram_memory_t *m, received_datagram_t *r) {
-    if (m->datagram_buffer == NULL) {
-        m->datagram_buffer = r;
-        r->next = NULL;
+    m->reorder_ring->slots[r->datagram->datagram_id % DATAGRAM_REORDER_SLOTS] = r;
+    datagram_deadline_heap_t *h = m->deadlines;
+    h->entries[h->size] = r;
+    h->size++;
+    deadline_heap_sift_up(h, h->size - 1);
+    m->recv_buffer += r->datagram->length;
+}
+
+static __attribute__((always_inline)) received_datagram_t *get_buffered_datagram(datagram_memory_t *m, uint64_t datagram_id) {
+    received_datagram_t *r = m->reorder_ring->slots[datagram_id % DATAGRAM_REORDER_SLOTS];
+    return (r != NULL && r->datagram->datagram_id == datagram_id) ? r : NULL;
+}
+
+static __attribute__((always_inline)) void deliver_buffered_datagram(datagram_memory_t *m, picoquic_cnx_t *cnx, received_datagram_t *r) {
+    m->reorder_ring->slots[r->datagram->datagram_id % DATAGRAM_REORDER_SLOTS] = NULL;
+    deadline_heap_remove(m->deadlines, r);
+    send_datagram_to_application(m, cnx, r->datagram);
+    if (r->datagram->length <= m->recv_buffer) {
+        m->recv_buffer -= r->datagram->length;
     } else {
-        received_datagram_t **prev = &m->datagram_buffer;
-        received_datagram_t *node = m->datagram_buffer;
-        while(node != NULL && node->datagram->datagram_id < r->datagram->datagram_id) {
-            prev = &(*prev)->next;
-            node = node->next;
+        m->recv_buffer = 0;
+    }
+    my_free(cnx, r->datagram->datagram_data_ptr);
+    my_free(cnx, r->datagram);
+    my_free(cnx, r);
+}
+
+/* Delivers the buffered datagrams with IDs up to last_id, in order */
+static __attribute__((always_inline)) void deliver_datagram_buffer_until(datagram_memory_t *m, picoquic_cnx_t *cnx, uint64_t last_id) {
+    for (uint64_t id = m->expected_datagram_id; id <= last_id && !datagram_buffer_is_empty(m); id++) {
+        received_datagram_t *r = get_buffered_datagram(m, id);
+        if (r != NULL) {
+            deliver_buffered_datagram(m, cnx, r);
         }
-        *prev = r;
-        r->next = node;
     }
-    m->recv_buffer += r->datagram->length;
 }
 
 static __attribute__((always_inline)) void process_datagram_buffer(datagram_memory_t *m, picoquic_cnx_t *cnx) {
-    received_datagram_t *r = m->datagram_buffer;
     uint64_t now = picoquic_current_time();
+    received_datagram_t *r;
 
-    while (r != NULL) {
-        if (r->delivery_deadline < now || m->expected_datagram_id >= r->datagram->datagram_id) {
-            send_datagram_to_application(m, cnx, r->datagram);
-            if (r->datagram->length <= m->recv_buffer) {
-                m->recv_buffer -= r->datagram->length;
-            } else {
-                m->recv_buffer = 0;
-            }
-            my_free(cnx, r->datagram->datagram_data_ptr);
-            my_free(cnx, r->datagram);
-            m->datagram_buffer = r->next;
-            received_datagram_t *t = r;
-            r = r->next;
-            my_free(cnx, t);
+    while (!datagram_buffer_is_empty(m)) {
+        if ((r = get_buffered_datagram(m, m->expected_datagram_id)) != NULL) {
+            deliver_buffered_datagram(m, cnx, r);
+        } else if (m->deadlines->entries[0]->delivery_deadline < now) {
+            /* Give up on the missing datagrams before the expired one */
+            deliver_datagram_buffer_until(m, cnx, m->deadlines->entries[0]->datagram->datagram_id);
         } else {
             break;
         }
     }
-    if (m->datagram_buffer != NULL && get_cnx(cnx, AK_CNX_NEXT_WAKE_TIME, 0) > m->datagram_buffer->delivery_deadline) {
-        picoquic_reinsert_cnx_by_wake_time(cnx, m->datagram_buffer->delivery_deadline);
+    if (!datagram_buffer_is_empty(m) && get_cnx(cnx, AK_CNX_NEXT_WAKE_TIME, 0) > m->deadlines->entries[0]->delivery_deadline) {
+        picoquic_reinsert_cnx_by_wake_time(cnx, m->deadlines->entries[0]->delivery_deadline);
     }
 }
 
+/* Delivers the buffered datagram with the lowest ID, to reclaim its memory */
 static __attribute__((always_inline)) void send_head_datagram_buffer(datagram_memory_t *m, picoquic_cnx_t *cnx) {
-    if (m->datagram_buffer != NULL) {
-        received_datagram_t *head = m->datagram_buffer;
-        send_datagram_to_application(m, cnx, head->datagram);
-        if (head->datagram->length <= m->recv_buffer) {
-            m->recv_buffer -= head->datagram->length;
-        } else {
-            m->recv_buffer = 0;
+    for (uint64_t id = m->expected_datagram_id; !datagram_buffer_is_empty(m) && id < m->expected_datagram_id + DATAGRAM_REORDER_SLOTS; id++) {
+        received_datagram_t *r = get_buffered_datagram(m, id);
+        if (r != NULL) {
+            deliver_buffered_datagram(m, cnx, r);
+            break;
         }
-        my_free(cnx, head->datagram->datagram_data_ptr);
-        my_free(cnx, head->datagram);
-        m->datagram_buffer = head->next;
-        my_free(cnx, head);
     }
 }
 
-static __attribute__((always_inline)) void free_head_datagram_reserved(datagram_memory_t *m, picoquic_cnx_t *cnx) {
+/* Frees a reserved DATAGRAM frame that will not be sent, and its payload */
+static __attribute__((always_inline)) void free_datagram_reserved(datagram_memory_t *m, picoquic_cnx_t *cnx, reserve_frame_slot_t *slot) {
+    datagram_frame_t *frame = slot->frame_ctx;
+    my_free(cnx, frame->datagram_data_ptr);
+    if (frame->length <= m->send_buffer) {
+        m->send_buffer -= frame->length;
+    } else {
+        m->send_buffer = 0;
+    }
+    my_free(cnx, frame);
+    my_free(cnx, slot);
+}
+
+/* Drops the queued datagram with the highest drop priority, the oldest among equals */
+static __attribute__((always_inline)) void free_droppable_datagram_reserved(datagram_memory_t *m, picoquic_cnx_t *cnx) {
     uint8_t nb_frames;
-    reserve_frame_slot_t *slots = cancel_head_reservation(cnx, &nb_frames, (int) DCC);
+    reserve_frame_slot_t *slots = cancel_droppable_reservation(cnx, &nb_frames, (int) DCC);
     if (slots == NULL) {
         m->send_buffer = 0;
         return;
     }
     for (int i = 0; i < nb_frames; i++) {
-        reserve_frame_slot_t *slot = (slots+i);
-        datagram_frame_t *frame = slot->frame_ctx;
-        my_free(cnx, frame->datagram_data_ptr);
-        if (frame->length <= m->send_buffer) {
-            m->send_buffer -= frame->length;
-        } else {
-            m->send_buffer = 0;
-        }
-        my_free(cnx, frame);
-        my_free(cnx, slot);
+        free_datagram_reserved(m, cnx, slots + i);
+        m->drops.nb_evicted++;
     }
 }
 
 static __attribute__((always_inline)) void *my_malloc_on_sending_buffer(datagram_memory_t *m, picoquic_cnx_t *cnx, unsigned int size) {
     void *p = my_malloc(cnx, size);
     while (p == NULL && m->send_buffer > 0) {
-        free_head_datagram_reserved(m, cnx);
+        free_droppable_datagram_reserved(m, cnx);
         p = my_malloc(cnx, size);
     }
     return p;
-}
\ No newline at end of file
+}
+
+/* Queues a DATAGRAM frame carrying payload, of which it takes the ownership. Returns 0 if the frame was reserved.
+ * The frame is dropped if it is not sent before expire_time, unless it is 0. When the send buffer is full, the
+ * frames with the highest drop_priority are dropped first, possibly this one. */
+static __attribute__((always_inline)) int reserve_datagram_frame(datagram_memory_t *m, picoquic_cnx_t *cnx, uint8_t *payload, uint64_t len,
+    uint64_t expire_time, uint8_t drop_priority) {
+    uint64_t datagram_id = 0;
+    reserve_frame_slot_t *slot = (reserve_frame_slot_t *) my_malloc_on_sending_buffer(m, cnx, sizeof(reserve_frame_slot_t));
+    if (slot == NULL) {
+        //PROTOOP_PRINTF(cnx, "Unable to allocate frame slot!\n");
+        my_free(cnx, payload);
+        return 1;
+    }
+    my_memset(slot, 0, sizeof(reserve_frame_slot_t));
+#ifdef DATAGRAM_WITH_ID
+    datagram_id = ++m->next_datagram_id;
+    slot->frame_type = FT_DATAGRAM | FT_DATAGRAM_ID | FT_DATAGRAM_LEN;
+    slot->nb_bytes = 1 + varint_len(datagram_id) + varint_len(len) + len;  // Unfortunately we are always forced to account for the length field
+#else
+    slot->frame_type = FT_DATAGRAM | FT_DATAGRAM_LEN;
+    slot->nb_bytes = 1 + varint_len(len) + len;  // Unfortunately we are always forced to account for the length field
+#endif
+    slot->is_congestion_controlled = DCC;
+    slot->expire_time = expire_time;
+    slot->drop_priority = drop_priority;
+
+    datagram_frame_t* frame = my_malloc_on_sending_buffer(m, cnx, sizeof(datagram_frame_t));
+    if (frame == NULL) {
+        //PROTOOP_PRINTF(cnx, "Unable to allocate frame structure!\n");
+        my_free(cnx, payload);
+        my_free(cnx, slot);
+        return 1;
+    }
+    frame->datagram_data_ptr = payload;
+    frame->length = len;
+    frame->datagram_id = datagram_id;
+    slot->frame_ctx = frame;
+
+    size_t reserved_size = reserve_frames(cnx, 1, slot);
+    if (reserved_size < slot->nb_bytes) {
+        //PROTOOP_PRINTF(cnx, "Unable to reserve frame slot\n");
+        my_free(cnx, frame->datagram_data_ptr);
+        my_free(cnx, frame);
+        my_free(cnx, slot);
+        return 1;
+    }
+    m->send_buffer += len;
+    while (m->send_buffer > SEND_BUFFER) {
+        free_droppable_datagram_reserved(m, cnx);
+    }
+    PROTOOP_PRINTF(cnx, "Send buffer size %d\n", m->send_buffer);
+    return 0;
+}
+
+static __attribute__((always_inline)) datagram_rings_t *get_datagram_rings(datagram_memory_t *m, picoquic_cnx_t *cnx) {
+    if (m->rings == NULL) {
+        datagram_rings_t *rings = (datagram_rings_t *) my_malloc(cnx, sizeof(datagram_rings_t));
+        if (!rings) {
+            return NULL;
+        }
+        my_memset(rings, 0, sizeof(datagram_rings_t));
+        rings->rx_event_fd = -1;
+        for (int i = 0; i < DATAGRAM_RING_SLOTS; i++) {
+            rings->tx.slots[i] = my_malloc(cnx, DATAGRAM_RING_SLOT_SIZE);
+            rings->rx.slots[i] = my_malloc(cnx, DATAGRAM_RING_SLOT_SIZE);
+            if (!rings->tx.slots[i] || !rings->rx.slots[i]) {
+                for (int j = 0; j <= i; j++) {
+                    if (rings->tx.slots[j])
+                        my_free(cnx, rings->tx.slots[j]);
+                    if (rings->rx.slots[j])
+                        my_free(cnx, rings->rx.slots[j]);
+                }
+                my_free(cnx, rings);
+                return NULL;
+            }
+        }
+        m->rings = rings;
+    }
+    return m->rings;
+}
+
+/* Reserves a DATAGRAM frame for each datagram of the tx ring. The slot of a datagram becomes its frame payload,
+ * and a new one takes its place in the ring, so that the payload is only copied again when the frame is written. */
+static __attribute__((always_inline)) void consume_datagram_tx_ring(datagram_memory_t *m, picoquic_cnx_t *cnx) {
+    if (m->rings == NULL) {
+        return;
+    }
+    datagram_ring_t *tx = &m->rings->tx;
+    uint32_t max_datagram_size = get_max_datagram_size(cnx);
+    uint32_t tail = RING_INDEX(tx->tail);
+    while (tail != RING_INDEX(tx->head)) {
+        uint32_t len = tx->lengths[tail % DATAGRAM_RING_SLOTS];
+        if (len > 0 && len <= max_datagram_size && len <= DATAGRAM_RING_SLOT_SIZE) {
+            uint8_t *fresh_slot = my_malloc_on_sending_buffer(m, cnx, DATAGRAM_RING_SLOT_SIZE);
+            if (fresh_slot == NULL) {
+                /* Retry when some memory has been released */
+                break;
+            }
+            uint8_t *payload = tx->slots[tail % DATAGRAM_RING_SLOTS];
+            tx->slots[tail % DATAGRAM_RING_SLOTS] = fresh_slot;
+            reserve_datagram_frame(m, cnx, payload, len, tx->expire_times[tail % DATAGRAM_RING_SLOTS],
+                tx->drop_priorities[tail % DATAGRAM_RING_SLOTS]);
+        } else {
+            PROTOOP_PRINTF(cnx, "Unable to send %d-byte long message, max known payload transmission unit is %d bytes\n", len, max_datagram_size);
+        }
+        tail++;
+        RING_INDEX(tx->tail) = tail;
+    }
+}
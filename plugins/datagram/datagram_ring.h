@@ -0,0 +1,123 @@
+#ifndef DATAGRAM_RING_H
+#define DATAGRAM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Shared-memory interface between the application and the datagram plugin, returned by the
+ * get_message_rings extern protocol operation. It lives in the memory of the plugin, and holds
+ * two single-producer single-consumer rings of DATAGRAM_RING_SLOTS inline payload slots:
+ * tx from the application to the plugin, and rx from the plugin to the application.
+ *
+ * A producer fills slots[head % DATAGRAM_RING_SLOTS], sets its length and then increments head.
+ * A consumer reads the slot at tail while tail != head, and then increments tail. Each index is only
+ * written by one side. The plugin may replace the slot pointers of tx while it consumes them, so the
+ * application must read the pointer again for each datagram.
+ *
+ * A datagram may carry an expire time, in the time of the connection, after which the plugin drops it
+ * instead of sending it. When its send buffer is full, the plugin drops the queued datagrams with the
+ * highest drop priority first, the oldest among equals. The drops are counted in the datagram_drops_t
+ * returned by the get_message_drops extern protocol operation.
+ */
+#define DATAGRAM_RING_SLOTS 64
+#define DATAGRAM_RING_SLOT_SIZE 1536 /* PICOQUIC_MAX_PACKET_SIZE, and a slot fits in one block of plugin memory */
+
+typedef struct st_datagram_ring_t {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t lengths[DATAGRAM_RING_SLOTS];
+    uint8_t *slots[DATAGRAM_RING_SLOTS];
+    uint64_t expire_times[DATAGRAM_RING_SLOTS]; /* tx only, 0 if the datagram does not expire */
+    uint8_t drop_priorities[DATAGRAM_RING_SLOTS]; /* tx only */
+} datagram_ring_t;
+
+/* A message given to the send_messages extern protocol operation, or returned by datagram_ring_rx_peek_batch */
+typedef struct st_datagram_message_t {
+    uint8_t *data;
+    uint32_t length;
+    uint8_t drop_priority;
+    uint64_t expire_time; /* 0 if the message does not expire */
+} datagram_message_t;
+
+typedef struct st_datagram_drops_t {
+    uint64_t nb_expired; /* Dropped past their expire time */
+    uint64_t nb_evicted; /* Dropped to make room in the send buffer */
+} datagram_drops_t;
+
+typedef struct st_datagram_rings_t {
+    datagram_ring_t tx;
+    datagram_ring_t rx;
+    int rx_event_fd; /* eventfd of the application, incremented for each datagram put in rx, -1 if none */
+} datagram_rings_t;
+
+#ifndef DATAGRAM_RING_IN_PLUGIN
+/* Application side. The plugin runs in the thread of the connection, the application may not. */
+
+/* Returns the slot to fill with the next datagram to send, or NULL if tx is full */
+static inline uint8_t *datagram_ring_tx_reserve(datagram_rings_t *rings)
+{
+    uint32_t head = rings->tx.head;
+    if (head - __atomic_load_n(&rings->tx.tail, __ATOMIC_ACQUIRE) >= DATAGRAM_RING_SLOTS) {
+        return NULL;
+    }
+    return rings->tx.slots[head % DATAGRAM_RING_SLOTS];
+}
+
+/* Hands the reserved slot to the plugin, which must then be woken up to send it before expire_time */
+static inline void datagram_ring_tx_commit_deadline(datagram_rings_t *rings, uint32_t length, uint64_t expire_time,
+    uint8_t drop_priority)
+{
+    uint32_t head = rings->tx.head;
+    rings->tx.lengths[head % DATAGRAM_RING_SLOTS] = length;
+    rings->tx.expire_times[head % DATAGRAM_RING_SLOTS] = expire_time;
+    rings->tx.drop_priorities[head % DATAGRAM_RING_SLOTS] = drop_priority;
+    __atomic_store_n(&rings->tx.head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Hands the reserved slot to the plugin, which must then be woken up to send it */
+static inline void datagram_ring_tx_commit(datagram_rings_t *rings, uint32_t length)
+{
+    datagram_ring_tx_commit_deadline(rings, length, 0, 0);
+}
+
+/* Returns the next received datagram and sets its length, or NULL if rx is empty */
+static inline uint8_t *datagram_ring_rx_peek(datagram_rings_t *rings, uint32_t *length)
+{
+    uint32_t tail = rings->rx.tail;
+    if (tail == __atomic_load_n(&rings->rx.head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    *length = rings->rx.lengths[tail % DATAGRAM_RING_SLOTS];
+    return rings->rx.slots[tail % DATAGRAM_RING_SLOTS];
+}
+
+/* Gives the slot of the datagram returned by datagram_ring_rx_peek back to the plugin */
+static inline void datagram_ring_rx_release(datagram_rings_t *rings)
+{
+    __atomic_store_n(&rings->rx.tail, rings->rx.tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Fills messages with up to max_messages received datagrams, and returns their number. Their slots remain
+ * valid until they are given back with datagram_ring_rx_release_batch. */
+static inline int datagram_ring_rx_peek_batch(datagram_rings_t *rings, datagram_message_t *messages, int max_messages)
+{
+    uint32_t tail = rings->rx.tail;
+    uint32_t available = __atomic_load_n(&rings->rx.head, __ATOMIC_ACQUIRE) - tail;
+    int nb_messages = (available < (uint32_t) max_messages) ? (int) available : max_messages;
+    for (int i = 0; i < nb_messages; i++) {
+        messages[i].data = rings->rx.slots[(tail + i) % DATAGRAM_RING_SLOTS];
+        messages[i].length = rings->rx.lengths[(tail + i) % DATAGRAM_RING_SLOTS];
+        messages[i].drop_priority = 0;
+        messages[i].expire_time = 0;
+    }
+    return nb_messages;
+}
+
+static inline void datagram_ring_rx_release_batch(datagram_rings_t *rings, int nb_messages)
+{
+    __atomic_store_n(&rings->rx.tail, rings->rx.tail + (uint32_t) nb_messages, __ATOMIC_RELEASE);
+}
+#endif
+
+#endif
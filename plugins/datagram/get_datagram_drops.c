@@ -0,0 +1,10 @@
+#include "../helpers.h"
+#include "bpf.h"
+
+/**
+ * Output: datagram_drops_t* shared with the application, counting the datagrams dropped before being sent
+ */
+protoop_arg_t get_datagram_drops(picoquic_cnx_t* cnx)
+{
+    return (protoop_arg_t) &get_datagram_memory(cnx)->drops;
+}
\ No newline at end of file
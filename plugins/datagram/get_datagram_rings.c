@@ -0,0 +1,19 @@
+#include "../helpers.h"
+#include "bpf.h"
+
+/**
+ * int rx_event_fd = (int) get_cnx(cnx, AK_CNX_INPUT, 0);
+ *
+ * Output: datagram_rings_t* shared with the application, or NULL if they cannot be allocated
+ */
+protoop_arg_t get_datagram_rings_op(picoquic_cnx_t* cnx)
+{
+    int rx_event_fd = (int) get_cnx(cnx, AK_CNX_INPUT, 0);
+    datagram_rings_t *rings = get_datagram_rings(get_datagram_memory(cnx), cnx);
+    if (rings == NULL) {
+        PROTOOP_PRINTF(cnx, "Failed to allocate the datagram rings!\n");
+        return 0;
+    }
+    rings->rx_event_fd = rx_event_fd;
+    return (protoop_arg_t) rings;
+}
\ No newline at end of file
@@ -5,8 +5,14 @@
 protoop_arg_t notify_datagram_frame(picoquic_cnx_t *cnx)
 {
     reserve_frame_slot_t *rfs = (reserve_frame_slot_t *) get_cnx(cnx, AK_CNX_INPUT, 0);
-    /* Commented out, can be used if needed */
-    /* int received = (int) get_cnx(cnx, AK_CNX_INPUT, 1); */
+    int received = (int) get_cnx(cnx, AK_CNX_INPUT, 1);
+    if (received == PICOQUIC_FRAME_EXPIRED && rfs->frame_ctx != NULL) {
+        /* It was not written, so the frame and its payload are still there */
+        datagram_memory_t *m = get_datagram_memory(cnx);
+        m->drops.nb_expired++;
+        free_datagram_reserved(m, cnx, rfs);
+        return 0;
+    }
     my_free(cnx, rfs);
     return 0;
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 
 protoop_arg_t op_process_datagram_buffer(picoquic_cnx_t* cnx)
 {
-    process_datagram_buffer(get_datagram_memory(cnx), cnx);
+    datagram_memory_t *m = get_datagram_memory(cnx);
+    consume_datagram_tx_ring(m, cnx);
+    process_datagram_buffer(m, cnx);
     return 0;
 }
\ No newline at end of file
@@ -8,8 +8,11 @@ protoop_arg_t process_datagram_frame(picoquic_cnx_t* cnx)
     picoquic_path_t *path_x = (picoquic_path_t*) get_cnx(cnx, AK_CNX_INPUT, 3);
     datagram_memory_t *m = get_datagram_memory(cnx);
 
-    if (m->socket_fds[PLUGIN_SOCKET] != -1) {
-        if (frame->datagram_id == 0) { // Send the datagram as a message on the socket
+    if (m->socket_fds[PLUGIN_SOCKET] != -1 || m->rings != NULL) {
+        if (frame->datagram_id == 0 || frame->datagram_id < m->expected_datagram_id) { // Send the datagram as a message to the application
+            return send_datagram_to_application(m, cnx, frame);
+        } else if (allocate_datagram_buffer(m, cnx) != 0) {
+            PROTOOP_PRINTF(cnx, "Unable to allocate the reorder buffer\n");
             return send_datagram_to_application(m, cnx, frame);
         } else {  // Tries to place the datagram in the buffer
             received_datagram_t *r = NULL;
@@ -32,7 +35,7 @@ protoop_arg_t process_datagram_frame(picoquic_cnx_t* cnx)
                     my_free(cnx, r);
                     send_head_datagram_buffer(m, cnx);
                 }
-            } while ((r == NULL || r->datagram == NULL || r->datagram->datagram_data_ptr == NULL) && m->datagram_buffer != NULL);
+            } while ((r == NULL || r->datagram == NULL || r->datagram->datagram_data_ptr == NULL) && !datagram_buffer_is_empty(m));
 
             if (r == NULL || r->datagram == NULL || r->datagram->datagram_data_ptr == NULL) {
                 PROTOOP_PRINTF(cnx, "Unable to reclaim enough memory to reserve buffer slot\n");
@@ -40,9 +43,25 @@ protoop_arg_t process_datagram_frame(picoquic_cnx_t* cnx)
                 return 0;
             }
 
-            while (m->recv_buffer + frame->length > RECV_BUFFER) {
+            while (m->recv_buffer + frame->length > RECV_BUFFER && !datagram_buffer_is_empty(m)) {
                 send_head_datagram_buffer(m, cnx);
             }
+            // Slide the window of the reorder buffer up to the datagram
+            while (frame->datagram_id >= m->expected_datagram_id + DATAGRAM_REORDER_SLOTS) {
+                if (datagram_buffer_is_empty(m)) {
+                    m->expected_datagram_id = frame->datagram_id - DATAGRAM_REORDER_SLOTS + 1;
+                } else {
+                    send_head_datagram_buffer(m, cnx);
+                }
+            }
+
+            if (frame->datagram_id < m->expected_datagram_id || get_buffered_datagram(m, frame->datagram_id) != NULL) {
+                // Overtaken by the reclaimed datagrams, or a duplicate
+                my_free(cnx, r->datagram->datagram_data_ptr);
+                my_free(cnx, r->datagram);
+                my_free(cnx, r);
+                return send_datagram_to_application(m, cnx, frame);
+            }
 
             r->datagram->datagram_id = frame->datagram_id;
             r->datagram->length = frame->length;
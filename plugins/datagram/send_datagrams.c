@@ -0,0 +1,34 @@
+#include "../helpers.h"
+#include "bpf.h"
+
+/**
+ * datagram_message_t *messages = (datagram_message_t *) get_cnx(cnx, AK_CNX_INPUT, 0);
+ * int nb_messages = (int) get_cnx(cnx, AK_CNX_INPUT, 1);
+ *
+ * Output: the number of messages queued, they are queued in order and the first one that cannot be sent stops the batch
+ */
+protoop_arg_t send_datagram_frames(picoquic_cnx_t* cnx)
+{
+    datagram_message_t *messages = (datagram_message_t *) get_cnx(cnx, AK_CNX_INPUT, 0);
+    int nb_messages = (int) get_cnx(cnx, AK_CNX_INPUT, 1);
+    datagram_memory_t *m = get_datagram_memory(cnx);
+    uint32_t max_path_mtu = get_max_datagram_size(cnx);
+    int i;
+
+    for (i = 0; i < nb_messages; i++) {
+        uint32_t len = messages[i].length;
+        if (len > max_path_mtu) {
+            PROTOOP_PRINTF(cnx, "Unable to send %d-byte long message, max known payload transmission unit is %d bytes\n", len, max_path_mtu);
+            break;
+        }
+        uint8_t *datagram_data = my_malloc_on_sending_buffer(m, cnx, len);
+        if (datagram_data == NULL) {
+            break;
+        }
+        my_memcpy(datagram_data, messages[i].data, len);
+        if (reserve_datagram_frame(m, cnx, datagram_data, len, messages[i].expire_time, messages[i].drop_priority) != 0) {
+            break;
+        }
+    }
+    return (protoop_arg_t) i;
+}
\ No newline at end of file
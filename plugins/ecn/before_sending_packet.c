@@ -2,6 +2,10 @@
 #include "plugin.h"
 #include "bpf.h"
 
+#ifndef ECN_IP_TOS
+#define ECN_IP_TOS 0x02 /* ECT(0), ECT(1) being 0x01 */
+#endif
+
 /**
  * See "before_sending_packet"
  * cnx->protoop_inputv[0] = SOCKET_TYPE socket
@@ -21,8 +25,7 @@ protoop_arg_t before_sending_packet(picoquic_cnx_t *cnx)
     }
 
     int read_ecn = 1;
-    int ecn_ip_tos = 0x02; // For ECT(0)
-    // int ecn_ip_tos = 0x01; // For ECT(1)
+    int ecn_ip_tos = ECN_IP_TOS;
 
     setsockopt(socket, IPPROTO_IP, IP_RECVTOS, &read_ecn, sizeof(read_ecn));
     setsockopt(socket, IPPROTO_IP, IP_TOS, &ecn_ip_tos, sizeof(ecn_ip_tos));
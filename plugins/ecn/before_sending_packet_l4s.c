@@ -0,0 +1,3 @@
+/* Same as before_sending_packet, but marks the packets ECT(1) to get the L4S treatment at the bottleneck */
+#define ECN_IP_TOS 0x01
+#include "before_sending_packet.c"
@@ -14,6 +14,11 @@ protoop_arg_t process_ecn_block(picoquic_cnx_t *cnx) {
     }
 
     if (cnts && cnts->ecn_ect0_remote_pkts <= block->ect0 && cnts->ecn_ect1_remote_pkts <= block->ect1 && cnts->ecn_ect_ce_remote_pkts <= block->ectce) {
+        /* Keep the path counts up to date before the notification, so that the controller can compute the CE fraction */
+        uint64_t ce_acked = block->ectce - cnts->ecn_ect_ce_remote_pkts;
+        uint64_t ect_acked = (block->ect0 - cnts->ecn_ect0_remote_pkts) + (block->ect1 - cnts->ecn_ect1_remote_pkts) + ce_acked;
+        set_path(path, AK_PATH_ECN_ECT_ACKED, 0, get_path(path, AK_PATH_ECN_ECT_ACKED, 0) + ect_acked);
+        set_path(path, AK_PATH_ECN_CE_ACKED, 0, get_path(path, AK_PATH_ECN_CE_ACKED, 0) + ce_acked);
         cnts->ecn_ect0_remote_pkts = block->ect0;
         cnts->ecn_ect1_remote_pkts = block->ect1;
         if (block->ectce > cnts->ecn_ect_ce_remote_pkts) {
@@ -0,0 +1,128 @@
+#include "picoquic.h"
+#include "../fec_protoops.h"
+
+#define DEFAULT_N 30
+#define DEFAULT_K 25
+
+/*
+ * Gilbert model of the losses of each path: the packets are lost in the bad state and received in
+ * the good one. p is the probability to go from good to bad, r from bad to good, estimated from the
+ * transitions between consecutive acknowledgements and losses. The probabilities are fixed point
+ * values, GE_ONE being 1, as the eBPF code cannot use floating point.
+ */
+#define GE_ONE ((uint64_t) 1 << 16)
+#define GE_MAX_PATHS 8
+#define GE_HALVING_THRESHOLD 4096   // the counts are halved once they reach it, to follow the changes of the loss process
+#define GE_UPDATE_INTERVAL 32       // notifications received between two choices of the parameters
+
+// block sizes tried, and the highest probability that a block cannot be recovered
+#define ADAPTIVE_MIN_N 5
+#define ADAPTIVE_MAX_N 30
+#define ADAPTIVE_N_STEP 5
+#define ADAPTIVE_TARGET_RESIDUAL_LOSS (GE_ONE / 100)
+
+typedef struct {
+    picoquic_path_t *path;
+    bool has_last;
+    bool last_lost;
+    uint64_t transitions[2][2];     // [previous packet lost][packet lost]
+} ge_path_estimator_t;
+
+typedef struct {
+    ge_path_estimator_t paths[GE_MAX_PATHS];
+    uint32_t notifications_since_update;
+    uint8_t n;
+    uint8_t k;
+    // distribution of the number of losses in a block, per state of its last packet
+    uint64_t good[ADAPTIVE_MAX_N + 1];
+    uint64_t bad[ADAPTIVE_MAX_N + 1];
+} adaptive_redundancy_controller_t;
+
+static __attribute__((always_inline)) void ge_record(adaptive_redundancy_controller_t *arc, picoquic_path_t *path, bool lost) {
+    ge_path_estimator_t *pe = NULL;
+    for (int i = 0 ; i < GE_MAX_PATHS && !pe ; i++) {
+        if (arc->paths[i].path == path || arc->paths[i].path == NULL) {
+            pe = &arc->paths[i];
+        }
+    }
+    if (!pe) {
+        // more paths than estimators: share the last one
+        pe = &arc->paths[GE_MAX_PATHS - 1];
+    }
+    pe->path = path;
+    if (pe->has_last) {
+        pe->transitions[pe->last_lost][lost]++;
+        if (pe->transitions[pe->last_lost][0] + pe->transitions[pe->last_lost][1] >= GE_HALVING_THRESHOLD) {
+            for (int i = 0 ; i < 2 ; i++) {
+                pe->transitions[i][0] /= 2;
+                pe->transitions[i][1] /= 2;
+            }
+        }
+    }
+    pe->has_last = true;
+    pe->last_lost = lost;
+    arc->notifications_since_update++;
+}
+
+// computes in good[j] + bad[j] the probability that a block of n packets has j losses
+static __attribute__((always_inline)) void ge_loss_distribution(adaptive_redundancy_controller_t *arc, uint64_t p, uint64_t r, int n) {
+    uint64_t pi_bad = (p * GE_ONE) / (p + r);
+    int i, j;
+    my_memset(arc->good, 0, sizeof(arc->good));
+    my_memset(arc->bad, 0, sizeof(arc->bad));
+    arc->good[0] = GE_ONE - pi_bad;
+    arc->bad[1] = pi_bad;
+    for (i = 1 ; i < n ; i++) {
+        // j losses among the i first packets, updated in place from the highest count
+        for (j = i + 1 ; j >= 0 ; j--) {
+            uint64_t good = arc->good[j];
+            uint64_t bad = arc->bad[j];
+            uint64_t prev_good = (j > 0) ? arc->good[j-1] : 0;
+            uint64_t prev_bad = (j > 0) ? arc->bad[j-1] : 0;
+            arc->good[j] = (good * (GE_ONE - p) + bad * r) / GE_ONE;
+            arc->bad[j] = (prev_good * p + prev_bad * (GE_ONE - r)) / GE_ONE;
+        }
+    }
+}
+
+// chooses the block size and the number of repair symbols sending the least redundancy for the target residual loss
+static __attribute__((always_inline)) void adaptive_update_parameters(adaptive_redundancy_controller_t *arc) {
+    uint64_t transitions[2][2] = {{0, 0}, {0, 0}};
+    for (int i = 0 ; i < GE_MAX_PATHS ; i++) {
+        transitions[0][0] += arc->paths[i].transitions[0][0];
+        transitions[0][1] += arc->paths[i].transitions[0][1];
+        transitions[1][0] += arc->paths[i].transitions[1][0];
+        transitions[1][1] += arc->paths[i].transitions[1][1];
+    }
+    arc->notifications_since_update = 0;
+    if (transitions[0][1] == 0) {
+        // no loss: no redundancy
+        arc->n = 0;
+        arc->k = 0;
+        return;
+    }
+    uint64_t p = (transitions[0][1] * GE_ONE) / (transitions[0][0] + transitions[0][1]);
+    // a single observed loss in a row would give r = 1, keep the bad state possible
+    uint64_t r = (transitions[1][0] + transitions[1][1] == 0) ? GE_ONE : (transitions[1][0] * GE_ONE) / (transitions[1][0] + transitions[1][1]);
+    r = MAX(r, 1);
+    uint8_t best_n = ADAPTIVE_MAX_N;
+    uint8_t best_m = ADAPTIVE_MAX_N - 1;
+    for (int n = ADAPTIVE_MIN_N ; n <= ADAPTIVE_MAX_N ; n += ADAPTIVE_N_STEP) {
+        ge_loss_distribution(arc, p, r, n);
+        // probability of more than m losses, i.e. that the block cannot be recovered with m repair symbols
+        uint64_t failure = GE_ONE - arc->good[0] - arc->bad[0];
+        for (int m = 1 ; m < n ; m++) {
+            failure -= MIN(failure, arc->good[m] + arc->bad[m]);
+            if (failure <= ADAPTIVE_TARGET_RESIDUAL_LOSS) {
+                // m/n < best_m/best_n
+                if (m * best_n < best_m * n) {
+                    best_n = n;
+                    best_m = m;
+                }
+                break;
+            }
+        }
+    }
+    arc->n = best_n;
+    arc->k = best_n - best_m;
+}
@@ -0,0 +1,14 @@
+#include "adaptive_redundancy_controller.h"
+
+// sets as output the pointer towards the controller's state
+protoop_arg_t create_adaptive_redundancy_controller(picoquic_cnx_t *cnx)
+{
+    adaptive_redundancy_controller_t *arc = my_malloc(cnx, sizeof(adaptive_redundancy_controller_t));
+    if (!arc) {
+        set_cnx(cnx, AK_CNX_OUTPUT, 0, (protoop_arg_t) NULL);
+        return PICOQUIC_ERROR_MEMORY;
+    }
+    my_memset(arc, 0, sizeof(adaptive_redundancy_controller_t));
+    set_cnx(cnx, AK_CNX_OUTPUT, 0, (protoop_arg_t) arc);
+    return 0;
+}
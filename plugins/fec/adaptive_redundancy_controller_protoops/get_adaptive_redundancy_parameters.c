@@ -0,0 +1,20 @@
+#include "adaptive_redundancy_controller.h"
+
+// sets as output:
+// Input  0: the redundancy controller state
+// Input  1: whether the window is flushed
+// Output 0: the size of a block
+// Output 1: the number of source symbols in a block
+protoop_arg_t get_adaptive_redundancy_parameters(picoquic_cnx_t *cnx)
+{
+    adaptive_redundancy_controller_t *arc = (adaptive_redundancy_controller_t *) get_cnx(cnx, AK_CNX_INPUT, 0);
+    bool flush = (bool) get_cnx(cnx, AK_CNX_INPUT, 1);
+    if (arc->notifications_since_update >= GE_UPDATE_INTERVAL) {
+        adaptive_update_parameters(arc);
+    }
+    // if we flush the window, ensure that there is redundancy to send
+    set_cnx(cnx, AK_CNX_OUTPUT, 0, (flush && arc->n == 0) ? DEFAULT_N : arc->n);
+    set_cnx(cnx, AK_CNX_OUTPUT, 1, (flush && arc->n == 0) ? DEFAULT_K : arc->k);
+    PROTOOP_PRINTF(cnx, "RETURN ADAPTIVE PARAMETERS N = %u, K = %u\n", arc->n, arc->k);
+    return 0;
+}
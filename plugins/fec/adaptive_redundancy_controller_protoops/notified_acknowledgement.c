@@ -0,0 +1,18 @@
+#include "adaptive_redundancy_controller.h"
+
+protoop_arg_t congestion_alg_notify(picoquic_cnx_t *cnx)
+{
+    picoquic_path_t *path = (picoquic_path_t *) get_cnx(cnx, AK_CNX_INPUT, 0);
+    picoquic_congestion_notification_t notification = get_cnx(cnx, AK_CNX_INPUT, 1);
+
+    if (notification == picoquic_congestion_notification_acknowledgement) {
+        bpf_state *state = get_bpf_state(cnx);
+        if (!state) return PICOQUIC_ERROR_MEMORY;
+        /* The notification covers all the packets acknowledged by a frame */
+        uint64_t nb_packets = (uint64_t) get_cnx(cnx, AK_CNX_INPUT, 4);
+        for (uint64_t i = 0; i == 0 || i < nb_packets; i++) {
+            ge_record((adaptive_redundancy_controller_t *) state->controller, path, false);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,10 @@
+#include "adaptive_redundancy_controller.h"
+
+protoop_arg_t packet_was_lost(picoquic_cnx_t *cnx)
+{
+    picoquic_path_t *path = (picoquic_path_t *) get_cnx(cnx, AK_CNX_INPUT, 1);
+    bpf_state *state = get_bpf_state(cnx);
+    if (!state) return PICOQUIC_ERROR_MEMORY;
+    ge_record((adaptive_redundancy_controller_t *) state->controller, path, true);
+    return 0;
+}
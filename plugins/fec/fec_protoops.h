@@ -5,6 +5,7 @@
 #include "../helpers.h"
 #include "fec.h"
 #define MAX_RECOVERED_PACKETS_IN_BUFFER 50
+#define MAX_PAYLOAD_SPANS_IN_SYMBOL 16 // runs of protected frames in a packet payload, separated by ACK, PADDING or CRYPTO frames
 #define MIN(a, b) ((a < b) ? a : b)
 
 typedef void * fec_framework_t;
@@ -192,19 +193,20 @@ static __attribute__((always_inline)) int protect_packet(picoquic_cnx_t *cnx, so
         return PICOQUIC_ERROR_MEMORY;
     PROTOOP_PRINTF(cnx, "PROTECT PACKET OF SIZE %u\n", (unsigned long) length);
     // protect_source_symbol lets the underlying sender-side FEC Framework protect the source symbol
-    // the SFPID of the SS is set by protect_source_symbol
+    // the SFPID of the SS is set by protect_source_symbol and returned as output, the framework may already have freed the SS
     protoop_arg_t params[2];
+    protoop_arg_t outs[1];
     params[0] = (protoop_arg_t) state->framework_sender;
     params[1] = (protoop_arg_t) ss;
 
-    int ret = (int) run_noparam(cnx, "fec_protect_source_symbol", 2, params, NULL);
-    // write the source fpid
-    source_fpid->raw = ss->source_fec_payload_id.raw;
+    int ret = (int) run_noparam(cnx, "fec_protect_source_symbol", 2, params, outs);
     if (ret) {
         PROTOOP_PRINTF(cnx, "ERROR WHEN PROTECTING\n");
         free_source_symbol(cnx, ss);
         return ret;
     }
+    // write the source fpid
+    source_fpid->raw = (uint32_t) outs[0];
     return 0;
 }
 
@@ -212,7 +214,7 @@ static __attribute__((always_inline)) bool should_send_recovered_frames(picoquic
     return (bool) run_noparam(cnx, "should_send_recovered_frames", 1, (protoop_arg_t *) &rp, NULL);
 }
 
-#define MAX_RECOVERED_IN_ONE_ROW 5
+#define MAX_RECOVERED_IN_ONE_ROW 5 // packets announced in one RECOVERED frame
 #define MIN_DECODED_SYMBOL_TO_PARSE 20
 
 static __attribute__((always_inline)) int recover_block(picoquic_cnx_t *cnx, bpf_state *state, fec_block_t *block){
@@ -224,9 +226,14 @@ static __attribute__((always_inline)) int recover_block(picoquic_cnx_t *cnx, bpf
     protoop_arg_t args[5], outs[1];
     args[0] = (protoop_arg_t) fb;
     args[1] = (protoop_arg_t) state->scheme_receiver;
-    uint8_t *to_recover = (uint8_t *) my_malloc(cnx, MAX_RECOVERED_IN_ONE_ROW);
+    // the scheme may recover any of the missing symbols, they are all decoded
+    uint8_t *to_recover = (uint8_t *) my_scratch_alloc(cnx, MAX_SYMBOLS_PER_FEC_BLOCK);
+    if (!to_recover) {
+        my_free(cnx, fb);
+        return PICOQUIC_ERROR_MEMORY;
+    }
     int n_to_recover = 0;
-    for (uint8_t i = 0; i < fb->total_source_symbols && n_to_recover < MAX_RECOVERED_IN_ONE_ROW; i++) {
+    for (uint8_t i = 0; i < fb->total_source_symbols; i++) {
         if (fb->source_symbols[i] == NULL) {
             to_recover[n_to_recover++] = i;
         }
@@ -236,7 +243,7 @@ static __attribute__((always_inline)) int recover_block(picoquic_cnx_t *cnx, bpf
     if (n_to_recover > 0) {
         recovered_packets_t *rp = my_malloc(cnx, sizeof(recovered_packets_t));
         if(rp) {    // if rp is null, this is not a big deal, just don't send the recovered frame
-            rp->packets = my_malloc(cnx, n_to_recover*sizeof(uint64_t));
+            rp->packets = my_malloc(cnx, MIN(n_to_recover, MAX_RECOVERED_IN_ONE_ROW)*sizeof(uint64_t));
             rp->number_of_packets = 0;
             if (!rp->packets) {
                 my_free(cnx, rp);
@@ -276,7 +283,7 @@ static __attribute__((always_inline)) int recover_block(picoquic_cnx_t *cnx, bpf
 
                     if (!ret) {
                         PROTOOP_PRINTF(cnx, "DECODED ! \n");
-                        if (rp) {
+                        if (rp && rp->number_of_packets < MAX_RECOVERED_IN_ONE_ROW) {
                             rp->packets[rp->number_of_packets++] = pn;
                         }
                     } else {
@@ -309,7 +316,6 @@ static __attribute__((always_inline)) int recover_block(picoquic_cnx_t *cnx, bpf
             }
         }
     }
-    my_free(cnx, to_recover);
     my_free(cnx, fb);
 
 
@@ -12,6 +12,7 @@ static __attribute__((always_inline)) int create_fec_schemes(picoquic_cnx_t *cnx
     rlc_gf256_fec_scheme_t *fs = my_malloc(cnx, sizeof(rlc_gf256_fec_scheme_t));
     if (!fs)
         return PICOQUIC_ERROR_MEMORY;
+    my_memset(fs, 0, sizeof(rlc_gf256_fec_scheme_t));
     uint8_t **table_mul = my_malloc(cnx, 256*sizeof(uint8_t *));
     if (!table_mul)
         return PICOQUIC_ERROR_MEMORY;
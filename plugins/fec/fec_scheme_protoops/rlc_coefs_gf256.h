@@ -0,0 +1,38 @@
+#ifndef RLC_COEFS_GF256_H
+#define RLC_COEFS_GF256_H
+
+// to include after tinymt32.c and fec.h
+#include "rlc_fec_scheme_gf256.h"
+
+/*
+ * Returns the first n coefficients of the repair symbol whose FPID is seed, from the cache of the scheme.
+ * The encoder and the decoder share the scheme, so that the PRNG only runs the first time a repair FPID is
+ * seen by either of them, or when a longer vector is asked. Returns NULL if the cache cannot be allocated.
+ */
+static __attribute__((always_inline)) uint8_t *rlc_get_coefs(picoquic_cnx_t *cnx, rlc_gf256_fec_scheme_t *fs, uint32_t seed, int n) {
+    if (!fs->cached_coefs) {
+        fs->cached_coefs = my_malloc(cnx, RLC_GF256_COEFS_CACHE_SIZE * MAX_SYMBOLS_PER_FEC_BLOCK);
+        if (!fs->cached_coefs)
+            return NULL;
+        my_memset(fs->cached_lengths, 0, sizeof(fs->cached_lengths));
+    }
+    int slot = seed % RLC_GF256_COEFS_CACHE_SIZE;
+    uint8_t *coefs = fs->cached_coefs + slot * MAX_SYMBOLS_PER_FEC_BLOCK;
+    if (fs->cached_lengths[slot] < n || fs->cached_seeds[slot] != seed) {
+        tinymt32_t prng;
+        prng.mat1 = 0x8f7011ee;
+        prng.mat2 = 0xfc78ff1f;
+        prng.tmat = 0x3793fdff;
+        tinymt32_init(&prng, seed);
+        for (int i = 0 ; i < n ; i++) {
+            coefs[i] = (uint8_t) tinymt32_generate_uint32(&prng);
+            if (coefs[i] == 0)
+                coefs[i] = 1;
+        }
+        fs->cached_seeds[slot] = seed;
+        fs->cached_lengths[slot] = n;
+    }
+    return coefs;
+}
+
+#endif // RLC_COEFS_GF256_H
@@ -4,17 +4,7 @@
 #include "../../helpers.h"
 #include "../prng/tinymt32.c"
 #include "rlc_fec_scheme_gf256.h"
-
-
-static inline void get_coefs(picoquic_cnx_t *cnx, tinymt32_t *prng, uint32_t seed, int n, uint8_t coefs[n]) {
-    tinymt32_init(prng, seed);
-    int i;
-    for (i = 0 ; i < n ; i++) {
-        coefs[i] = (uint8_t) tinymt32_generate_uint32(prng);
-        if (coefs[i] == 0)
-            coefs[i] = 1;
-    }
-}
+#include "rlc_coefs_gf256.h"
 
 /**
  * fec_block_t* fec_block = (fec_block_t *) cnx->protoop_inputv[0];
@@ -23,10 +13,6 @@ static inline void get_coefs(picoquic_cnx_t *cnx, tinymt32_t *prng, uint32_t see
  */
 protoop_arg_t fec_generate_repair_symbols(picoquic_cnx_t *cnx)
 {
-    tinymt32_t prng;
-    prng.mat1 = 0x8f7011ee;
-    prng.mat2 = 0xfc78ff1f;
-    prng.tmat = 0x3793fdff;
     fec_block_t* fec_block = (fec_block_t *) get_cnx(cnx, AK_CNX_INPUT, 0);
     rlc_gf256_fec_scheme_t *fs = (rlc_gf256_fec_scheme_t *) get_cnx(cnx, AK_CNX_INPUT, 1);
     uint8_t **mul = fs->table_mul;
@@ -46,7 +32,7 @@ protoop_arg_t fec_generate_repair_symbols(picoquic_cnx_t *cnx)
 
 
     uint8_t i, j;
-    uint8_t *coefs = my_malloc(cnx, fec_block->total_source_symbols*sizeof(uint8_t));
+    int ret = 0;
     uint8_t **knowns = my_malloc(cnx, fec_block->total_source_symbols*sizeof(uint8_t));
     for (i = 0 ; i < fec_block->total_source_symbols ; i++) {
         knowns[i] = my_malloc(cnx, max_length);
@@ -58,7 +44,12 @@ protoop_arg_t fec_generate_repair_symbols(picoquic_cnx_t *cnx)
         rfpid.raw = 0;
         rfpid.fec_block_number = fec_block->fec_block_number;
         rfpid.symbol_number = i;
-        get_coefs(cnx, &prng, rfpid.source_fpid.raw, fec_block->total_source_symbols, coefs);
+        // in window mode, the FPIDs and thus the coefficients are the same for every window
+        uint8_t *coefs = rlc_get_coefs(cnx, fs, rfpid.source_fpid.raw, fec_block->total_source_symbols);
+        if (!coefs) {
+            ret = PICOQUIC_ERROR_MEMORY;
+            break;
+        }
         repair_symbol_t *rs = malloc_repair_symbol(cnx, rfpid, max_length);
         for (j = 0 ; j < fec_block->total_source_symbols ; j++) {
 //            PROTOOP_PRINTF(cnx, "ADD coef = %d, data = %p, rs[8] = 0x%x, symbol2 = %p, tab = %p\n", coefs[j], (protoop_arg_t) rs->data, rs->data[8], (protoop_arg_t) knowns[j], (protoop_arg_t) mul);
@@ -71,7 +62,6 @@ protoop_arg_t fec_generate_repair_symbols(picoquic_cnx_t *cnx)
     for (i = 0 ; i < fec_block->total_source_symbols ; i++) {
         my_free(cnx, knowns[i]);
     }
-    my_free(cnx, coefs);
     my_free(cnx, knowns);
-    return 0;
+    return ret;
 }
@@ -4,127 +4,150 @@
 #include "../prng/tinymt32.c"
 #include "../gf256/swif_symbol.c"
 #include "rlc_fec_scheme_gf256.h"
+#include "rlc_coefs_gf256.h"
 #define MIN(a, b) ((a < b) ? a : b)
 
+#define RLC_NO_PIVOT 0xff
 
-
-static __attribute__((always_inline)) void swap(uint8_t **a, int i, int j) {
-    uint8_t *tmp = a[i];
-    a[i] = a[j];
-    a[j] = tmp;
-}
-
-// returns 1 if a has its first non-zero term before b
-// returns -1 if a has its first non-zero term after b
-// returns 0 otherwise
-static __attribute__((always_inline)) int cmp_eq(uint8_t *a, uint8_t *b, int idx, int n_unknowns) {
-    if (a[idx] < b[idx]) return -1;
-    else if (a[idx] > b[idx]) return 1;
-    else if (a[idx] != 0) return 0;
-    return 0;
-}
-
-// pre: there is no column full of zeroes
-static __attribute__((always_inline)) void sort_system(picoquic_cnx_t *cnx, uint8_t **a, uint8_t **constant_terms, int n_eq, int n_unknowns) {
-    // simple selection sort, because there should not be that much equations
-    for (int i = 0 ; i < n_eq ; i++) {
-        int max = i;
-        for (int j = i+1 ; j < n_eq ; j++) {
-            if (cmp_eq(a[max], a[j], i, n_unknowns) < 0) {
-                max = j;
-            }
-        }
-        swap(a, i, max);
-        swap(constant_terms, i, max);
+/*******
+The system of a FEC block is solved incrementally, by on-the-fly Gauss-Jordan elimination.
+Its rows are kept in reduced row echelon form: the coefficient of the pivot of each row is 1, and
+the pivot columns are 0 in all the other rows. Each new source symbol is substituted in the rows,
+each new repair symbol is reduced by the rows and then removes its pivot from them: this costs
+O(rank) symbol operations per arrival, instead of eliminating the whole system at each recovery.
+A row without any other non-zero coefficient than its pivot holds a recovered source symbol.
+********/
+typedef struct rlc_gf256_decoder {
+    uint32_t fec_block_number;
+    uint8_t total_source_symbols;
+    uint8_t n_rows;
+    uint16_t symbol_size;
+    bool folded_source[MAX_SYMBOLS_PER_FEC_BLOCK];
+    bool folded_repair[MAX_SYMBOLS_PER_FEC_BLOCK];
+    bool delivered[MAX_SYMBOLS_PER_FEC_BLOCK];
+    uint8_t pivot_row[MAX_SYMBOLS_PER_FEC_BLOCK];    // row whose pivot is this column, RLC_NO_PIVOT if none
+    uint8_t row_pivot[MAX_SYMBOLS_PER_FEC_BLOCK];
+    uint8_t *coefs[MAX_SYMBOLS_PER_FEC_BLOCK];
+    uint8_t *constant_terms[MAX_SYMBOLS_PER_FEC_BLOCK];
+} rlc_gf256_decoder_t;
+
+static __attribute__((always_inline)) void decoder_reset(picoquic_cnx_t *cnx, rlc_gf256_decoder_t *dec, fec_block_t *fec_block, uint16_t symbol_size) {
+    for (int i = 0 ; i < dec->n_rows ; i++) {
+        my_free(cnx, dec->coefs[i]);
+        my_free(cnx, dec->constant_terms[i]);
     }
+    my_memset(dec, 0, sizeof(rlc_gf256_decoder_t));
+    my_memset(dec->pivot_row, RLC_NO_PIVOT, sizeof(dec->pivot_row));
+    dec->fec_block_number = fec_block->fec_block_number;
+    dec->total_source_symbols = fec_block->total_source_symbols;
+    dec->symbol_size = symbol_size;
 }
 
-
-
-/*******
-Function that performs Gauss-Elimination and returns the Upper triangular matrix:
-There are two options to do this in C.
-1. Pass a matrix (a) as the parameter, and calculate and store the upperTriangular(Gauss-Eliminated Matrix) in it.
-2. Use malloc and make the function of pointer type and return the pointer.
-This program uses the first option.
-********/
-static __attribute__((always_inline)) void gaussElimination(picoquic_cnx_t *cnx, int n_eq, int n_unknowns, uint8_t **a, uint8_t *constant_terms[n_eq], uint8_t *x[n_eq], bool undetermined[n_unknowns], uint32_t symbol_size, uint8_t **mul, uint8_t *inv){
-    sort_system(cnx, a, constant_terms, n_eq, n_unknowns);
-    int i,j,k;
-    for(i=0;i<n_eq-1;i++){
-        for(k=i+1;k<n_eq;k++){
-            if(k > i){
-                uint8_t mulnum = a[k][i];
-                uint8_t muldenom = a[i][i];
-                // term=a[k][i]/a[i][i]
-                uint8_t term = gf256_mul(mulnum, inv[muldenom], mul);
-                for(j=0;j<n_unknowns;j++){
-                    // a[k][j] -= a[k][i]/a[i][i]*a[i][j]
-//                    // i < m-1 AND m <= n, -> i < n-1
-                      a[k][j] = gf256_sub(a[k][j], gf256_mul(term, a[i][j], mul));
-                }
-                // a[k][j] -= a[k][i]/a[i][i]*a[i][j] for the big, constant term
-                symbol_sub_scaled(constant_terms[k], term, constant_terms[i], symbol_size, mul);
-            }
+// takes the ownership of coefs and constant_term
+static __attribute__((always_inline)) void decoder_insert_row(picoquic_cnx_t *cnx, rlc_gf256_fec_scheme_t *fs, rlc_gf256_decoder_t *dec, uint8_t *coefs, uint8_t *constant_term) {
+    uint8_t **mul = fs->table_mul;
+    int n = dec->total_source_symbols;
+    int pivot = -1;
+    int k, r;
+    // removing a pivot from the new row keeps the other pivot columns at 0
+    for (k = 0 ; k < n ; k++) {
+        if (coefs[k] != 0 && dec->pivot_row[k] != RLC_NO_PIVOT) {
+            uint8_t term = coefs[k];
+            symbol_sub_scaled(coefs, term, dec->coefs[dec->pivot_row[k]], n, mul);
+            symbol_sub_scaled(constant_term, term, dec->constant_terms[dec->pivot_row[k]], dec->symbol_size, mul);
         }
     }
-    int candidate = n_unknowns - 1;
-    //Begin Back-substitution
-    for(i=n_eq-1;i>=0;i--){
-        while(a[i][candidate] == 0 && candidate >= 0) {
-            undetermined[candidate--] = true;
+    for (k = 0 ; k < n && pivot == -1 ; k++) {
+        if (coefs[k] != 0) {
+            pivot = k;
         }
-        my_memcpy(x[candidate], constant_terms[i], symbol_size);
-        for (int j = 0 ; j < candidate ; j++) {
-            if (a[i][j] != 0) {
-                // if this variable depends on another one with a smaller index, it is undefined, as we don't know the value of the one with a smaller index
-                undetermined[candidate] = true;
-                break;
-            }
-        }
-        for(j=candidate+1;j<n_unknowns;j++){
-//             x[i]=x[i]-a[i][j]*x[j];
-            if (a[i][j] != 0) {
-                if (undetermined[j]) {
-                    // if the unknown depends on an undetermined unknown, this unknown is undetermined
-                    undetermined[candidate] = true;
-                } else {
-                    symbol_sub_scaled(x[candidate], a[i][j], x[j], symbol_size, mul);
-                    a[i][j] = 0;
-                }
-            }
+    }
+    if (pivot == -1) {
+        // linearly dependent from the other rows
+        my_free(cnx, coefs);
+        my_free(cnx, constant_term);
+        return;
+    }
+    uint8_t inv_pivot = fs->table_inv[coefs[pivot]];
+    symbol_mul(coefs, inv_pivot, n, mul);
+    symbol_mul(constant_term, inv_pivot, dec->symbol_size, mul);
+    for (r = 0 ; r < dec->n_rows ; r++) {
+        uint8_t term = dec->coefs[r][pivot];
+        if (term != 0) {
+            symbol_sub_scaled(dec->coefs[r], term, coefs, n, mul);
+            symbol_sub_scaled(dec->constant_terms[r], term, constant_term, dec->symbol_size, mul);
         }
-        // i < n_eq <= n_unknowns, so a[i][i] is small
-        if (symbol_is_zero(x[candidate], symbol_size) || a[i][candidate] == 0) {
-            // this solution is undetermined
-            undetermined[candidate] = true;
-            PROTOOP_PRINTF(cnx, "UNDETERMINED SOL\n");
-            // TODO
-        } else if (!undetermined[candidate]) {
-            // x[i] = x[i]/a[i][i]
-            symbol_mul(x[candidate], inv[a[i][candidate]], symbol_size, mul);
-            a[i][candidate] = gf256_mul(a[i][candidate], inv[a[i][candidate]], mul);
+    }
+    dec->coefs[dec->n_rows] = coefs;
+    dec->constant_terms[dec->n_rows] = constant_term;
+    dec->row_pivot[dec->n_rows] = pivot;
+    dec->pivot_row[pivot] = dec->n_rows;
+    dec->n_rows++;
+}
+
+static __attribute__((always_inline)) void decoder_fold_source_symbol(picoquic_cnx_t *cnx, rlc_gf256_fec_scheme_t *fs, rlc_gf256_decoder_t *dec, int j, source_symbol_t *ss) {
+    uint8_t **mul = fs->table_mul;
+    dec->folded_source[j] = true;
+    for (int r = 0 ; r < dec->n_rows ; r++) {
+        uint8_t term = dec->coefs[r][j];
+        if (term != 0) {
+            // the source symbols are padded with zeroes, so there is no harm in not adding them
+            symbol_sub_scaled(dec->constant_terms[r], term, ss->data, MIN(ss->data_length, dec->symbol_size), mul);
+            dec->coefs[r][j] = 0;
         }
-        candidate--;
     }
-    // it marks all the variables with an index <= candidate as undetermined
-    // we use a my_memset although it is harder to understand because with a for loop, the compiler will translate it into a call to memset
-    if (candidate >= 0) {
-        my_memset(undetermined, true, (candidate+1)*sizeof(bool));
+    if (dec->pivot_row[j] != RLC_NO_PIVOT) {
+        // the row lost its pivot: take it out of the system and reduce it again
+        uint8_t r = dec->pivot_row[j];
+        uint8_t last = dec->n_rows - 1;
+        uint8_t *coefs = dec->coefs[r];
+        uint8_t *constant_term = dec->constant_terms[r];
+        dec->pivot_row[j] = RLC_NO_PIVOT;
+        if (r != last) {
+            dec->coefs[r] = dec->coefs[last];
+            dec->constant_terms[r] = dec->constant_terms[last];
+            dec->row_pivot[r] = dec->row_pivot[last];
+            dec->pivot_row[dec->row_pivot[r]] = r;
+        }
+        dec->n_rows--;
+        decoder_insert_row(cnx, fs, dec, coefs, constant_term);
     }
 }
 
-static __attribute__((always_inline)) void get_coefs(picoquic_cnx_t *cnx, tinymt32_t *prng, uint32_t seed, int n, uint8_t *coefs) {
-    tinymt32_init(prng, seed);
-    int i;
-    for (i = 0 ; i < n ; i++) {
-        coefs[i] = (uint8_t) tinymt32_generate_uint32(prng);
-        if (coefs[i] == 0)
-            coefs[i] = 1;
+static __attribute__((always_inline)) int decoder_fold_repair_symbol(picoquic_cnx_t *cnx, rlc_gf256_fec_scheme_t *fs, rlc_gf256_decoder_t *dec, fec_block_t *fec_block, repair_symbol_t *rs) {
+    uint8_t **mul = fs->table_mul;
+    int n = dec->total_source_symbols;
+    uint8_t *cached_coefs = rlc_get_coefs(cnx, fs, rs->repair_fec_payload_id.source_fpid.raw, n);
+    uint8_t *coefs = my_malloc(cnx, n);
+    uint8_t *constant_term = my_malloc(cnx, dec->symbol_size);
+    if (!cached_coefs || !coefs || !constant_term) {
+        if (coefs)
+            my_free(cnx, coefs);
+        if (constant_term)
+            my_free(cnx, constant_term);
+        return PICOQUIC_ERROR_MEMORY;
     }
+    my_memset(constant_term, 0, dec->symbol_size);
+    my_memcpy(constant_term, rs->data, rs->data_length);
+    my_memcpy(coefs, cached_coefs, n);
+    for (int j = 0 ; j < n ; j++) {
+        source_symbol_t *ss = fec_block->source_symbols[j];
+        if (ss && dec->folded_source[j]) {
+            symbol_sub_scaled(constant_term, coefs[j], ss->data, MIN(ss->data_length, dec->symbol_size), mul);
+            coefs[j] = 0;
+        }
+    }
+    decoder_insert_row(cnx, fs, dec, coefs, constant_term);
+    return 0;
 }
 
-// TODO: handle when malloc returns NULL
+static __attribute__((always_inline)) bool decoder_row_is_solved(rlc_gf256_decoder_t *dec, int r) {
+    for (int k = 0 ; k < dec->total_source_symbols ; k++) {
+        if (k != dec->row_pivot[r] && dec->coefs[r][k] != 0)
+            return false;
+    }
+    return true;
+}
 
 /**
  * fec_block_t* fec_block = (fec_block_t *) cnx->protoop_inputv[0];
@@ -135,117 +158,75 @@ protoop_arg_t fec_recover(picoquic_cnx_t *cnx)
 {
     fec_block_t *fec_block = (fec_block_t *) get_cnx(cnx, AK_CNX_INPUT, 0);
     rlc_gf256_fec_scheme_t *fs = (rlc_gf256_fec_scheme_t *) get_cnx(cnx, AK_CNX_INPUT, 1);
-    uint8_t **mul = fs->table_mul;
     PROTOOP_PRINTF(cnx, "TRYING TO RECOVER SYMBOLS WITH RLC256 FOR BLOCK %u !\n", fec_block->fec_block_number);
     if (fec_block->total_repair_symbols == 0 || fec_block->current_source_symbols == fec_block->total_source_symbols ||
         fec_block->current_source_symbols + fec_block->current_repair_symbols < fec_block->total_source_symbols) {
         PROTOOP_PRINTF(cnx, "NO RECOVERY TO DO\n");
         return 0;
     }
-    tinymt32_t *prng = my_malloc(cnx, sizeof(tinymt32_t));
-    prng->mat1 = 0x8f7011ee;
-    prng->mat2 = 0xfc78ff1f;
-    prng->tmat = 0x3793fdff;
-
-    PROTOOP_PRINTF(cnx, "RECOVERING\n");
-    int n_unknowns = fec_block->total_source_symbols - fec_block->current_source_symbols;
-    int n_eq = MIN(n_unknowns, fec_block->current_repair_symbols);
-    int i = 0;
-    int j;
-    uint8_t *coefs = my_malloc(cnx, fec_block->total_source_symbols*sizeof(uint8_t));//[fec_block->total_source_symbols];
-    uint8_t **unknowns = my_malloc(cnx, (n_unknowns)*sizeof(uint8_t *));;//[n_unknowns];
-    uint8_t **system_coefs = my_malloc(cnx, n_eq*sizeof(uint8_t *));//[n_eq][n_unknowns + 1];
-    uint8_t **constant_terms = my_malloc(cnx, n_eq*sizeof(uint8_t *));
-    bool *undetermined = my_malloc(cnx, n_unknowns*sizeof(bool));
-    my_memset(undetermined, 0, n_unknowns*sizeof(bool));
-
 
-    if (!coefs || !unknowns || !system_coefs) {
-        PROTOOP_PRINTF(cnx, "NOT ENOUGH MEM\n");
+    int i, j;
+    uint16_t max_length = 0;
+    repair_symbol_t *rs;
+    for_each_repair_symbol(fec_block, rs) {
+        if (rs && rs->data_length > max_length) {
+            max_length = rs->data_length;
+        }
     }
 
-    for (j = 0 ; j < n_eq ; j++) {
-        system_coefs[j] = my_malloc(cnx, (n_unknowns) * sizeof(uint8_t));
-        if (!system_coefs[j]) {
+    int slot = fec_block->fec_block_number % RLC_GF256_MAX_DECODERS;
+    rlc_gf256_decoder_t *dec = fs->decoders[slot];
+    if (!dec) {
+        dec = my_malloc(cnx, sizeof(rlc_gf256_decoder_t));
+        if (!dec) {
             PROTOOP_PRINTF(cnx, "NOT ENOUGH MEM\n");
+            return PICOQUIC_ERROR_MEMORY;
         }
+        my_memset(dec, 0, sizeof(rlc_gf256_decoder_t));
+        fs->decoders[slot] = dec;
     }
-
-    int idx = 0;
-    int first_notnull_rs = -1;
-
-    repair_symbol_t *rs;
-    for_each_repair_symbol(fec_block, rs) {
-        if (rs && first_notnull_rs == -1) {
-            first_notnull_rs = idx;
-            break;
-        }
-        idx++;
+    if (dec->fec_block_number != fec_block->fec_block_number || dec->total_source_symbols != fec_block->total_source_symbols ||
+        dec->symbol_size < max_length) {
+        // another block, or longer symbols: start the system again
+        decoder_reset(cnx, dec, fec_block, max_length);
     }
 
-    uint16_t max_length = fec_block->repair_symbols[first_notnull_rs]->data_length;
-
-    for (j = 0 ; j < n_unknowns ; j++) {
-        unknowns[j] = my_malloc(cnx, max_length);
-        my_memset(unknowns[j], 0, max_length);
+    PROTOOP_PRINTF(cnx, "RECOVERING\n");
+    for (j = 0 ; j < fec_block->total_source_symbols ; j++) {
+        if (fec_block->source_symbols[j] && !dec->folded_source[j]) {
+            decoder_fold_source_symbol(cnx, fs, dec, j, fec_block->source_symbols[j]);
+        }
     }
 
-    // building the system, equation by equation
-    i = 0;
-    for_each_repair_symbol(fec_block, rs) {
-        if (rs && i < n_eq) {
-            constant_terms[i] = my_malloc(cnx, max_length);
-            my_memset(constant_terms[i], 0, max_length);
-            my_memcpy(constant_terms[i], rs->data, rs->data_length);
-            get_coefs(cnx, prng, (rs->repair_fec_payload_id.source_fpid.raw), fec_block->total_source_symbols, coefs);
-            int current_unknown = 0;
-            for (j = 0 ; j < fec_block->total_source_symbols ; j++) {
-                if (fec_block->source_symbols[j]) {
-                    // we add data_length to avoid overflowing on the source symbol. As we assume the source symbols are padded to 0, there is no harm in not adding the zeroes
-                    symbol_sub_scaled(constant_terms[i], coefs[j], fec_block->source_symbols[j]->data, fec_block->source_symbols[j]->data_length, mul);
-                } else if (current_unknown < n_unknowns) {
-                    system_coefs[i][current_unknown++] = coefs[j];
-                }
+    for (i = 0 ; i < fec_block->total_repair_symbols ; i++) {
+        rs = fec_block->repair_symbols[i];
+        if (rs && !dec->folded_repair[i]) {
+            if (decoder_fold_repair_symbol(cnx, fs, dec, fec_block, rs) != 0) {
+                PROTOOP_PRINTF(cnx, "NOT ENOUGH MEM\n");
+                break;
             }
-            i++;
+            dec->folded_repair[i] = true;
         }
     }
 
-    PROTOOP_PRINTF(cnx, "BEFORE GAUSSIAN\n");
-    // the system is built: let's recover it
-    gaussElimination(cnx, n_eq, n_unknowns, system_coefs, constant_terms, unknowns, undetermined, max_length, mul, fs->table_inv);
-    PROTOOP_PRINTF(cnx, "AFTER GAUSSIAN\n");
-    int current_unknown = 0;
-    for (j = 0 ; j < fec_block->total_source_symbols ; j++) {
-        if (!fec_block->source_symbols[j] && !undetermined[current_unknown] && !symbol_is_zero(unknowns[current_unknown], max_length)) {
+    // deliver the source symbols recovered since the last call
+    for (i = 0 ; i < dec->n_rows ; i++) {
+        j = dec->row_pivot[i];
+        if (fec_block->source_symbols[j] || dec->delivered[j] || !decoder_row_is_solved(dec, i) ||
+            symbol_is_zero(dec->constant_terms[i], dec->symbol_size)) {
             // TODO: handle the case where source symbols could be 0
-            source_symbol_t *ss = malloc_source_symbol(cnx, (source_fpid_t) (((fec_block->fec_block_number) << 8) + ((uint8_t)j)), max_length);
-            if (!ss) {
-                my_free(cnx, unknowns[current_unknown++]);
-                continue;
-            }
-            my_memcpy(ss->data, unknowns[current_unknown], max_length);
-            ss->data_length = max_length;
-            fec_block->source_symbols[j] = ss;
-            fec_block->current_source_symbols++;
-            my_free(cnx, unknowns[current_unknown++]);
-        } else if (!fec_block->source_symbols[j] && (undetermined[current_unknown] || symbol_is_zero(unknowns[current_unknown], max_length))) {
-            // this unknown could not be recovered
-            my_free(cnx, unknowns[current_unknown++]);
+            continue;
+        }
+        source_symbol_t *ss = malloc_source_symbol(cnx, (source_fpid_t) (((fec_block->fec_block_number) << 8) + ((uint8_t)j)), dec->symbol_size);
+        if (!ss) {
+            continue;
         }
+        my_memcpy(ss->data, dec->constant_terms[i], dec->symbol_size);
+        ss->data_length = dec->symbol_size;
+        fec_block->source_symbols[j] = ss;
+        fec_block->current_source_symbols++;
+        dec->delivered[j] = true;
     }
 
-    // free the system
-    for (i = 0 ; i < n_eq ; i++) {
-        my_free(cnx, system_coefs[i]);
-        my_free(cnx, constant_terms[i]);
-    }
-    my_free(cnx, prng);
-    my_free(cnx, system_coefs);
-    my_free(cnx, constant_terms);
-    my_free(cnx, unknowns);
-    my_free(cnx, coefs);
-    my_free(cnx, undetermined);
-
     return 0;
 }
@@ -1,6 +1,22 @@
+#ifndef RLC_FEC_SCHEME_GF256_H
+#define RLC_FEC_SCHEME_GF256_H
+
 #include <stdint.h>
 
+#define RLC_GF256_MAX_DECODERS 3    // as many as the FEC blocks handled concurrently by the frameworks
+#define RLC_GF256_COEFS_CACHE_SIZE 16   // coefficient vectors kept, indexed by the FPID of their repair symbol
+
+struct rlc_gf256_decoder;
+
 typedef struct {
     uint8_t **table_mul;
     uint8_t *table_inv;
+    // systems being solved, kept between the recoveries of the same FEC block
+    struct rlc_gf256_decoder *decoders[RLC_GF256_MAX_DECODERS];
+    // coefficients of the last repair symbols, see rlc_get_coefs
+    uint8_t *cached_coefs;  // RLC_GF256_COEFS_CACHE_SIZE vectors of MAX_SYMBOLS_PER_FEC_BLOCK coefficients
+    uint32_t cached_seeds[RLC_GF256_COEFS_CACHE_SIZE];
+    uint8_t cached_lengths[RLC_GF256_COEFS_CACHE_SIZE];
 } rlc_gf256_fec_scheme_t;
+
+#endif // RLC_FEC_SCHEME_GF256_H
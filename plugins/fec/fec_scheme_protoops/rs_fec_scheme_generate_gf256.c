@@ -0,0 +1,49 @@
+#include <picoquic.h>
+#include "../fec.h"
+#include "../gf256/swif_symbol.c"
+#include "../../helpers.h"
+#include "rs_fec_scheme_gf256.h"
+
+/**
+ * fec_block_t* fec_block = (fec_block_t *) cnx->protoop_inputv[0];
+ *
+ * Output: return code (int)
+ */
+protoop_arg_t fec_generate_repair_symbols(picoquic_cnx_t *cnx)
+{
+    fec_block_t* fec_block = (fec_block_t *) get_cnx(cnx, AK_CNX_INPUT, 0);
+    rs_gf256_fec_scheme_t *fs = (rs_gf256_fec_scheme_t *) get_cnx(cnx, AK_CNX_INPUT, 1);
+    PROTOOP_PRINTF(cnx, "GENERATING SYMBOLS WITH RS GF256\n");
+    if (fec_block->total_repair_symbols == 0
+        || fec_block->total_source_symbols < 1
+        || fec_block->current_source_symbols != fec_block->total_source_symbols) {
+        PROTOOP_PRINTF(cnx, "IMPOSSIBLE TO GENERATE\n");
+        return 1;
+    }
+
+    uint16_t max_length = 0;
+
+    for_each_source_symbol(fec_block, source_symbol_t *source_symbol) {
+        max_length = MAX(source_symbol->data_length, max_length);
+    }
+
+    uint8_t i, j;
+    uint8_t k = fec_block->total_source_symbols;
+    for (i = 0 ; i < fec_block->total_repair_symbols ; i++) {
+        repair_fpid_t rfpid;
+        rfpid.raw = 0;
+        rfpid.fec_block_number = fec_block->fec_block_number;
+        rfpid.symbol_number = i;
+        repair_symbol_t *rs = malloc_repair_symbol(cnx, rfpid, max_length);
+        if (!rs) {
+            return PICOQUIC_ERROR_MEMORY;
+        }
+        for (j = 0 ; j < k ; j++) {
+            // the source symbols are padded with zeroes, so there is no harm in not adding them
+            symbol_add_scaled(rs->data, rs_gf256_coef(fs, k, i, j), fec_block->source_symbols[j]->data,
+                              fec_block->source_symbols[j]->data_length, fs->table_mul);
+        }
+        fec_block->repair_symbols[i] = rs;
+    }
+    return 0;
+}
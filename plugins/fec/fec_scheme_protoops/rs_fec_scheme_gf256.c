@@ -0,0 +1,121 @@
+#include <picoquic.h>
+#include "../../helpers.h"
+#include "../fec.h"
+#include "../gf256/swif_symbol.c"
+#include "rs_fec_scheme_gf256.h"
+#define MIN(a, b) ((a < b) ? a : b)
+
+static __attribute__((always_inline)) void swap(uint8_t **a, int i, int j) {
+    uint8_t *tmp = a[i];
+    a[i] = a[j];
+    a[j] = tmp;
+}
+
+/**
+ * fec_block_t* fec_block = (fec_block_t *) cnx->protoop_inputv[0];
+ *
+ * Output: return code (int)
+ */
+protoop_arg_t fec_recover(picoquic_cnx_t *cnx)
+{
+    fec_block_t *fec_block = (fec_block_t *) get_cnx(cnx, AK_CNX_INPUT, 0);
+    rs_gf256_fec_scheme_t *fs = (rs_gf256_fec_scheme_t *) get_cnx(cnx, AK_CNX_INPUT, 1);
+    uint8_t **mul = fs->table_mul;
+    PROTOOP_PRINTF(cnx, "TRYING TO RECOVER SYMBOLS WITH RS GF256 FOR BLOCK %u !\n", fec_block->fec_block_number);
+    if (fec_block->total_repair_symbols == 0 || fec_block->current_source_symbols == fec_block->total_source_symbols ||
+        fec_block->current_source_symbols + fec_block->current_repair_symbols < fec_block->total_source_symbols) {
+        PROTOOP_PRINTF(cnx, "NO RECOVERY TO DO\n");
+        return 0;
+    }
+
+    // the code is MDS: any n_unknowns repair symbols give an invertible system
+    int k = fec_block->total_source_symbols;
+    int n_unknowns = k - fec_block->current_source_symbols;
+    int i, j, r, c;
+    uint16_t max_length = 0;
+    repair_symbol_t *rs;
+    for_each_repair_symbol(fec_block, rs) {
+        if (rs && rs->data_length > max_length) {
+            max_length = rs->data_length;
+        }
+    }
+
+    uint8_t *unknowns = my_malloc(cnx, n_unknowns);
+    uint8_t **system_coefs = my_malloc(cnx, n_unknowns*sizeof(uint8_t *));
+    uint8_t **constant_terms = my_malloc(cnx, n_unknowns*sizeof(uint8_t *));
+    if (!unknowns || !system_coefs || !constant_terms) {
+        PROTOOP_PRINTF(cnx, "NOT ENOUGH MEM\n");
+        return PICOQUIC_ERROR_MEMORY;
+    }
+    c = 0;
+    for (j = 0 ; j < k ; j++) {
+        if (!fec_block->source_symbols[j]) {
+            unknowns[c++] = j;
+        }
+    }
+
+    // building the system with the first n_unknowns repair symbols
+    r = 0;
+    for (i = 0 ; i < fec_block->total_repair_symbols && r < n_unknowns ; i++) {
+        rs = fec_block->repair_symbols[i];
+        if (!rs) {
+            continue;
+        }
+        system_coefs[r] = my_malloc(cnx, n_unknowns);
+        constant_terms[r] = my_malloc(cnx, max_length);
+        my_memset(constant_terms[r], 0, max_length);
+        my_memcpy(constant_terms[r], rs->data, rs->data_length);
+        c = 0;
+        for (j = 0 ; j < k ; j++) {
+            source_symbol_t *ss = fec_block->source_symbols[j];
+            if (ss) {
+                symbol_sub_scaled(constant_terms[r], rs_gf256_coef(fs, k, i, j), ss->data, MIN(ss->data_length, max_length), mul);
+            } else {
+                system_coefs[r][c++] = rs_gf256_coef(fs, k, i, j);
+            }
+        }
+        r++;
+    }
+
+    // Gauss-Jordan elimination, the pivot always exists
+    for (c = 0 ; c < n_unknowns ; c++) {
+        for (r = c ; r < n_unknowns && system_coefs[r][c] == 0 ; r++);
+        if (r == n_unknowns) {
+            PROTOOP_PRINTF(cnx, "SINGULAR SYSTEM\n");
+            break;
+        }
+        swap(system_coefs, c, r);
+        swap(constant_terms, c, r);
+        uint8_t inv_pivot = fs->table_inv[system_coefs[c][c]];
+        symbol_mul(system_coefs[c], inv_pivot, n_unknowns, mul);
+        symbol_mul(constant_terms[c], inv_pivot, max_length, mul);
+        for (r = 0 ; r < n_unknowns ; r++) {
+            uint8_t term = system_coefs[r][c];
+            if (r != c && term != 0) {
+                symbol_sub_scaled(system_coefs[r], term, system_coefs[c], n_unknowns, mul);
+                symbol_sub_scaled(constant_terms[r], term, constant_terms[c], max_length, mul);
+            }
+        }
+    }
+
+    for (r = 0 ; r < n_unknowns && c == n_unknowns ; r++) {
+        j = unknowns[r];
+        source_symbol_t *ss = malloc_source_symbol(cnx, (source_fpid_t) (((fec_block->fec_block_number) << 8) + ((uint8_t)j)), max_length);
+        if (!ss) {
+            continue;
+        }
+        my_memcpy(ss->data, constant_terms[r], max_length);
+        fec_block->source_symbols[j] = ss;
+        fec_block->current_source_symbols++;
+    }
+
+    // free the system
+    for (r = 0 ; r < n_unknowns ; r++) {
+        my_free(cnx, system_coefs[r]);
+        my_free(cnx, constant_terms[r]);
+    }
+    my_free(cnx, system_coefs);
+    my_free(cnx, constant_terms);
+    my_free(cnx, unknowns);
+    return 0;
+}
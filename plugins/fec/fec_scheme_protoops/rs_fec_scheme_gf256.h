@@ -0,0 +1,19 @@
+#ifndef RS_FEC_SCHEME_GF256_H
+#define RS_FEC_SCHEME_GF256_H
+
+#include <stdint.h>
+
+/*
+ * Systematic Reed-Solomon code built on a Cauchy matrix: the repair symbol i of a block of k source
+ * symbols is the sum of the source symbols j multiplied by 1/(x_i + y_j), with x_i = k + i and y_j = j.
+ * Every square submatrix of a Cauchy matrix is invertible, so any k symbols of a block recover it.
+ */
+typedef struct {
+    uint8_t **table_mul;
+    uint8_t *table_inv;
+} rs_gf256_fec_scheme_t;
+
+// k + i and j are distinct as long as a block holds less than 256 symbols
+#define rs_gf256_coef(fs, k, i, j) ((fs)->table_inv[(uint8_t) (((k) + (i)) ^ (j))])
+
+#endif // RS_FEC_SCHEME_GF256_H
@@ -4,35 +4,12 @@
 #include <string.h>
 #include "memory.h"
 #include "../fec_protoops.h"
+#include "xor_fec_scheme.h"
 
 #ifndef MIN
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
-static inline void xor(uint8_t *a, uint8_t *b, uint8_t *container, int size_a, int size_b) {
-    int size = MIN(size_a, size_b);
-    int n_64 = size/8;
-    int i;
-    uint64_t *a64 = (uint64_t  *) a;
-    uint64_t *b64 = (uint64_t  *) b;
-    uint64_t *container64 = (uint64_t  *) container;
-    // should be faster by doing XOR on 8-bytes words directly
-    for (i = 0 ; i < n_64 ; i++) {
-        container64[i] = a64[i] ^ b64[i];
-    }
-    for (i = n_64*8 ; i < size ; i++) {
-        container[i] = a[i] ^ b[i];
-    }
-    if (size_a < size_b) {
-        for (; i < size_b ; i++)
-            container[i] = b[i];
-    } else {
-        for (; i < size_b ; i++)
-            container[i] = a[i];
-    }
-}
-
-
 /**
  * fec_block_t* fec_block = (fec_block_t *) cnx->protoop_inputv[0];
  *
@@ -64,8 +41,7 @@ protoop_arg_t fec_recover(picoquic_cnx_t *cnx)
     source_symbol_t *source_symbol = NULL;
     for_each_source_symbol_nobreak(fec_block, source_symbol) {
         if (source_symbol) {
-            xor(ss->data, source_symbol->data, ss->data,
-                ss->data_length, source_symbol->data_length);
+            symbol_xor_region(ss->data, source_symbol->data, MIN(ss->data_length, source_symbol->data_length));
         }
     }
 
@@ -0,0 +1,12 @@
+#ifndef XOR_FEC_SCHEME_H
+#define XOR_FEC_SCHEME_H
+
+#include "gf256_region.h"
+
+// dst ^= src, run natively by the GF(256) helper as a multiplication by 1. The symbols are a byte, a packet
+// number and the payload, so neither their start nor their length is aligned: the helper uses unaligned loads
+static __attribute__((always_inline)) void symbol_xor_region(uint8_t *dst, uint8_t *src, uint16_t len) {
+    gf256_region_mul_add(dst, src, 1, len);
+}
+
+#endif // XOR_FEC_SCHEME_H
@@ -4,35 +4,13 @@
 #include <string.h>
 #include "memory.h"
 #include "../fec_protoops.h"
+#include "xor_fec_scheme.h"
 
 #ifndef MIN
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
 
-static inline void xor(uint8_t *a, uint8_t *b, uint8_t *container, int size_a, int size_b) {
-    int size = MIN(size_a, size_b);
-    int n_64 = size/8;
-    int i;
-    uint64_t *a64 = (uint64_t  *) a;
-    uint64_t *b64 = (uint64_t  *) b;
-    uint64_t *container64 = (uint64_t  *) container;
-    // should be faster by doing XOR on 8-bytes words directly
-    for (i = 0 ; i < n_64 ; i++) {
-        container64[i] = a64[i] ^ b64[i];
-    }
-    for (i = n_64*8 ; i < size ; i++) {
-        container[i] = a[i] ^ b[i];
-    }
-    if (size_a < size_b) {
-        for (; i < size_b ; i++)
-            container[i] = b[i];
-    } else {
-        for (; i < size_b ; i++)
-            container[i] = a[i];
-    }
-}
-
 /**
  * fec_block_t* fec_block = (fec_block_t *) cnx->protoop_inputv[0];
  *
@@ -66,8 +44,7 @@ protoop_arg_t fec_generate_repair_symbols(picoquic_cnx_t *cnx)
     int i = 0;
     for_each_source_symbol_nobreak(fec_block, source_symbol) {
         if (source_symbol) {
-            xor(rs->data, source_symbol->data, rs->data,
-                rs->data_length, source_symbol->data_length);
+            symbol_xor_region(rs->data, source_symbol->data, MIN(rs->data_length, source_symbol->data_length));
             i++;
         }
     }
@@ -5,6 +5,8 @@
 
 #define MIN(a, b) ((a < b) ? a : b)
 
+#include "window_symbol_ring.h"
+
 
 #define MAX_AMBIGUOUS_ID_GAP ((uint32_t) 0x200*2)       // the max ambiguous ID gap depends on the max number of source symbols that can be protected by a Repair Symbol
 
@@ -12,7 +14,8 @@
 typedef struct {
     uint32_t highest_removed;
     fec_scheme_t fs;
-    source_symbol_t *fec_window[RECEIVE_BUFFER_MAX_LENGTH];
+    symbol_ring_t ring;
+    source_symbol_t *fec_window[RECEIVE_BUFFER_MAX_LENGTH];    // the symbols of the ring that are in the window
 } window_fec_framework_receiver_t;
 
 static __attribute__((always_inline)) fec_block_t *get_fec_block(bpf_state *state, uint32_t fbn){
@@ -28,6 +31,10 @@ static __attribute__((always_inline)) window_fec_framework_receiver_t *create_fr
     if (wff) {
         my_memset(wff, 0, sizeof(window_fec_framework_receiver_t));
         wff->fs = fs;
+        if (symbol_ring_init(cnx, &wff->ring)) {
+            my_free(cnx, wff);
+            return NULL;
+        }
     }
     return wff;
 }
@@ -109,22 +116,25 @@ static __attribute__((always_inline)) void try_to_recover_from_symbol(picoquic_c
     }
 }
 
-// returns true if the symbol has been successfully processed
+// returns true if the symbol has been successfully processed: it is copied in the window and freed
 // returns false otherwise: the symbol can be destroyed
 //FIXME: we pass the state in the parameters because the call to get_bpf_state leads to an error when loading the code
 static __attribute__((always_inline)) bool window_receive_source_symbol(picoquic_cnx_t *cnx, bpf_state *state, window_fec_framework_receiver_t *wff, source_symbol_t *ss, bool recover){
+    if (!symbol_ring_fits(ss))
+        return false;
     int idx = ss->source_fec_payload_id.raw % RECEIVE_BUFFER_MAX_LENGTH;
     if (wff->fec_window[idx]) {
         // the same symbol is already present: nothing to do
         if (wff->fec_window[idx]->source_fec_payload_id.raw == ss->source_fec_payload_id.raw)
             return false;
         wff->highest_removed = MAX(wff->fec_window[idx]->source_fec_payload_id.raw, wff->highest_removed);
-        // another symbol is present: remove it
-        free_source_symbol(cnx, wff->fec_window[idx]);
+        // another symbol is present: its slot is overwritten
         wff->fec_window[idx] = NULL;
     }
 
-    wff->fec_window[idx] = ss;
+    wff->fec_window[idx] = symbol_ring_store(&wff->ring, ss);
+    free_source_symbol(cnx, ss);
+    ss = wff->fec_window[idx];
     PROTOOP_PRINTF(cnx, "RECEIVED SYMBOL %u\n", ss->source_fec_payload_id.raw);
     // let's find all the blocks protecting this symbol to see if we can recover the remaining
     // we don't recover symbols if we already are in recovery mode
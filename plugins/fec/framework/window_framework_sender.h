@@ -8,6 +8,8 @@
 
 #define MIN(a, b) ((a < b) ? a : b)
 
+#include "window_symbol_ring.h"
+
 typedef uint32_t fec_block_number;
 
 typedef struct {
@@ -19,7 +21,8 @@ typedef struct {
 typedef struct {
     fec_scheme_t fec_scheme;
     fec_redundancy_controller_t controller;
-    source_symbol_t *fec_window[RECEIVE_BUFFER_MAX_LENGTH];
+    symbol_ring_t ring;
+    source_symbol_t *fec_window[RECEIVE_BUFFER_MAX_LENGTH];    // the symbols of the ring that are in the window
     queue_item repair_symbols_queue[MAX_QUEUED_REPAIR_SYMBOLS];
     uint32_t max_id;
     uint32_t min_id;
@@ -39,6 +42,10 @@ static __attribute__((always_inline)) window_fec_framework_t *create_framework_s
     if (!wff)
         return NULL;
     my_memset(wff, 0, sizeof(window_fec_framework_t));
+    if (symbol_ring_init(cnx, &wff->ring)) {
+        my_free(cnx, wff);
+        return NULL;
+    }
     wff->highest_sent_id = INITIAL_SYMBOL_ID-1;
     wff->controller = controller;
     wff->fec_scheme = fs;
@@ -187,7 +194,7 @@ static __attribute__((always_inline)) void remove_source_symbol_from_window(pico
         int idx = (int) (ss->source_fec_payload_id.raw % RECEIVE_BUFFER_MAX_LENGTH);
         if (wff->fec_window[idx] && wff->fec_window[idx]->source_fec_payload_id.raw == ss->source_fec_payload_id.raw) {
             if (wff->fec_window[idx]->source_fec_payload_id.raw == wff->min_id) wff->min_id++;
-            free_source_symbol(cnx, wff->fec_window[idx]);
+            // its slot is reused by the next symbol with the same index
             wff->fec_window[idx] = NULL;
             // one less symbol
             wff->window_length--;
@@ -266,11 +273,15 @@ static __attribute__((always_inline)) source_fpid_t get_source_fpid(window_fec_f
     return s;
 }
 
+// copies the symbol in the window and frees it, its ID is then max_id
 static __attribute__((always_inline)) int protect_source_symbol(picoquic_cnx_t *cnx, window_fec_framework_t *wff, source_symbol_t *ss){
+    if (!symbol_ring_fits(ss))
+        return PICOQUIC_ERROR_MEMORY;
     ss->source_fec_payload_id.raw = ++wff->max_id;
     int idx = (int) (ss->source_fec_payload_id.raw % RECEIVE_BUFFER_MAX_LENGTH);
     remove_source_symbol_from_window(cnx, wff, wff->fec_window[idx]);
-    wff->fec_window[idx] = ss;
+    wff->fec_window[idx] = symbol_ring_store(&wff->ring, ss);
+    free_source_symbol(cnx, ss);
     if (wff->window_length == 0) {
         wff->min_id = wff->max_id = ss->source_fec_payload_id.raw;
     }
@@ -0,0 +1,63 @@
+#ifndef WINDOW_SYMBOL_RING_H
+#define WINDOW_SYMBOL_RING_H
+
+#include "../fec.h"
+#include "../../helpers.h"
+
+// the largest source symbol: a packet payload preceded by its first byte and its packet number
+#define SYMBOL_RING_SLOT_DATA_SIZE (PICOQUIC_MAX_PACKET_SIZE + 1 + sizeof(uint64_t))
+#define SYMBOL_RING_LENGTH RECEIVE_BUFFER_MAX_LENGTH
+
+/*
+ * Source symbols of a FEC window, stored in slots allocated once with the framework. The symbol whose ID
+ * is i lives in the slot i % SYMBOL_RING_LENGTH with its data inline, so that storing a symbol is a copy
+ * and the window releases it by storing the symbol that takes its slot: no symbol is allocated or freed
+ * while the window moves. A slot fits in one block of the plugin memory.
+ */
+typedef struct {
+    source_symbol_t symbol;     // symbol.data points to data
+    uint8_t data[SYMBOL_RING_SLOT_DATA_SIZE];
+} symbol_ring_slot_t;
+
+typedef struct {
+    symbol_ring_slot_t *slots[SYMBOL_RING_LENGTH];
+} symbol_ring_t;
+
+static __attribute__((always_inline)) void symbol_ring_free(picoquic_cnx_t *cnx, symbol_ring_t *ring) {
+    for (int i = 0 ; i < SYMBOL_RING_LENGTH ; i++) {
+        if (ring->slots[i]) {
+            my_free(cnx, ring->slots[i]);
+            ring->slots[i] = NULL;
+        }
+    }
+}
+
+static __attribute__((always_inline)) int symbol_ring_init(picoquic_cnx_t *cnx, symbol_ring_t *ring) {
+    for (int i = 0 ; i < SYMBOL_RING_LENGTH ; i++) {
+        symbol_ring_slot_t *slot = (symbol_ring_slot_t *) my_malloc(cnx, sizeof(symbol_ring_slot_t));
+        if (!slot) {
+            symbol_ring_free(cnx, ring);
+            return PICOQUIC_ERROR_MEMORY;
+        }
+        my_memset(&slot->symbol, 0, sizeof(source_symbol_t));
+        slot->symbol.data = slot->data;
+        ring->slots[i] = slot;
+    }
+    return 0;
+}
+
+static __attribute__((always_inline)) bool symbol_ring_fits(source_symbol_t *ss) {
+    return ss->data_length <= SYMBOL_RING_SLOT_DATA_SIZE;
+}
+
+// copies the symbol in the slot of its ID, overwriting the previous one, and returns the stored symbol
+// assumes that symbol_ring_fits(ss)
+static __attribute__((always_inline)) source_symbol_t *symbol_ring_store(symbol_ring_t *ring, source_symbol_t *ss) {
+    symbol_ring_slot_t *slot = ring->slots[ss->source_fec_payload_id.raw % SYMBOL_RING_LENGTH];
+    slot->symbol.source_fec_payload_id = ss->source_fec_payload_id;
+    slot->symbol.data_length = ss->data_length;
+    my_memcpy(slot->data, ss->data, ss->data_length);
+    return &slot->symbol;
+}
+
+#endif // WINDOW_SYMBOL_RING_H
@@ -6,5 +6,9 @@ protoop_arg_t fec_protect_source_symbol(picoquic_cnx_t *cnx)
 {
     block_fec_framework_t *bff = (block_fec_framework_t *) get_cnx(cnx, AK_CNX_INPUT, 0);
     source_symbol_t *ss = (source_symbol_t *) get_cnx(cnx, AK_CNX_INPUT, 1);
-    return (protoop_arg_t) protect_source_symbol(cnx, bff, ss);
+    // the symbol is freed with its block if it completes it
+    source_fpid_t sfpid = get_source_fpid(bff);
+    int ret = protect_source_symbol(cnx, bff, ss);
+    set_cnx(cnx, AK_CNX_OUTPUT, 0, sfpid.raw);
+    return (protoop_arg_t) ret;
 }
\ No newline at end of file
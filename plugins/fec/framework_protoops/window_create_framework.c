@@ -18,6 +18,7 @@ protoop_arg_t create_framework(picoquic_cnx_t *cnx)
     }
     window_fec_framework_receiver_t *wffr = create_framework_receiver(cnx, receiver_scheme);
     if (!wffr) {
+        symbol_ring_free(cnx, &wffs->ring);
         my_free(cnx, wffs);
         set_cnx(cnx, AK_CNX_OUTPUT, 0, (protoop_arg_t) NULL);
         set_cnx(cnx, AK_CNX_OUTPUT, 1, (protoop_arg_t) NULL);
@@ -8,6 +8,7 @@
 #define gf256_add(a, b) (a^b)
 #define gf256_sub gf256_add
 #include <stdbool.h>
+#include "gf256_region.h"
 
 static __attribute__((always_inline)) uint8_t gf256_mul(uint8_t a, uint8_t b, uint8_t **mul)
 { return mul[a][b]; }
@@ -32,6 +33,7 @@ static __attribute__((always_inline)) uint8_t gf256_mul_formula(uint8_t a, uint8
 /**
  * @brief Take a symbol and add another symbol multiplied by a 
  *        coefficient, e.g. performs the equivalent of: p1 += coef * p2
+ *        The whole region is processed by the native helper.
  * @param[in,out] p1     First symbol (to which coef*p2 will be added)
  * @param[in]     coef  Coefficient by which the second packet is multiplied
  * @param[in]     p2     Second symbol
@@ -39,11 +41,7 @@ static __attribute__((always_inline)) uint8_t gf256_mul_formula(uint8_t a, uint8
 static __attribute__((always_inline)) void symbol_add_scaled
 (void *symbol1, uint8_t coef, void *symbol2, uint32_t symbol_size, uint8_t **mul)
 {
-    uint8_t *data1 = (uint8_t *) symbol1;
-    uint8_t *data2 = (uint8_t *) symbol2; 
-    for (uint32_t i=0; i<symbol_size; i++) {
-        data1[i] ^= gf256_mul(coef, data2[i], mul);
-    }
+    gf256_region_mul_add((uint8_t *) symbol1, (uint8_t *) symbol2, coef, symbol_size);
 }
 
 static __attribute__((always_inline)) bool symbol_is_zero(void *symbol, uint32_t symbol_size) {
@@ -63,9 +61,7 @@ static __attribute__((always_inline)) bool symbol_is_zero(void *symbol, uint32_t
 static __attribute__((always_inline)) void symbol_mul
 (uint8_t *symbol1, uint8_t coef, uint32_t symbol_size, uint8_t **mul)
 {
-    for (uint32_t i=0; i<symbol_size; i++) {
-        symbol1[i] = gf256_mul(coef, symbol1[i], mul);
-    }
+    gf256_region_mul(symbol1, coef, symbol_size);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -16,22 +16,23 @@ protoop_arg_t packet_payload_to_source_symbol(picoquic_cnx_t *cnx)
     }
     encode_u64(sequence_number, buffer + 1);
     buffer[0] = FEC_MAGIC_NUMBER;
+    picoquic_payload_span_t spans[MAX_PAYLOAD_SPANS_IN_SYMBOL];
+    protoop_arg_t args[4], outs[2];
+    args[0] = (protoop_arg_t) bytes_protected;
+    args[1] = (protoop_arg_t) payload_length;
+    args[2] = (protoop_arg_t) spans;
+    args[3] = MAX_PAYLOAD_SPANS_IN_SYMBOL;
+    // the core classifies the frames natively, the symbol is then gathered with one copy per run of protected frames
+    if (run_noparam(cnx, PROTOOPID_NOPARAM_PROTECTABLE_PAYLOAD_SPANS, 4, args, outs) != 0) {
+        PROTOOP_PRINTF(cnx, "COULD NOT LIST THE FRAMES TO PROTECT\n");
+        return 1 + sizeof(uint64_t);
+    }
+    int nb_spans = (int) outs[0];
     uint32_t offset_in_symbol = 0;
-    uint32_t offset_in_packet_payload = 0;
-    size_t consumed = 0;
-    int pure_ack = 0;
-    uint8_t first_byte = 0;
-
-    while(offset_in_packet_payload < payload_length) {
-        my_memcpy(&first_byte, bytes_protected + offset_in_packet_payload, 1);
-        bool to_ignore = first_byte == picoquic_frame_type_ack || first_byte == picoquic_frame_type_padding || first_byte == picoquic_frame_type_crypto_hs;
-        helper_skip_frame(cnx, bytes_protected + offset_in_packet_payload, payload_length - offset_in_packet_payload, &consumed, &pure_ack);
-        if (!to_ignore) {
-            my_memcpy(buffer + 1 + sizeof(uint64_t) + offset_in_symbol, bytes_protected + offset_in_packet_payload, consumed);
-            offset_in_symbol += consumed;
-        }
-        offset_in_packet_payload += consumed;
+    for (int i = 0 ; i < nb_spans ; i++) {
+        my_memcpy(buffer + 1 + sizeof(uint64_t) + offset_in_symbol, bytes_protected + spans[i].offset, spans[i].length);
+        offset_in_symbol += spans[i].length;
     }
-    PROTOOP_PRINTF(cnx, "SKIPPED %d BYTES IN SOURCE SYMBOL, SYMBOL SIZE = %d\n", offset_in_packet_payload - offset_in_symbol, 1 + sizeof(uint64_t) + offset_in_symbol);
+    PROTOOP_PRINTF(cnx, "SKIPPED %d BYTES IN SOURCE SYMBOL, SYMBOL SIZE = %d\n", payload_length - offset_in_symbol, 1 + sizeof(uint64_t) + offset_in_symbol);
     return 1 + sizeof(uint64_t) + offset_in_symbol;
 }
\ No newline at end of file
@@ -10,7 +10,9 @@ protoop_arg_t congestion_alg_notify(picoquic_cnx_t *cnx)
         bpf_state *state = get_bpf_state(cnx);
         if (!state) return PICOQUIC_ERROR_MEMORY;
         uniform_redundancy_controller_t *urc = state->controller;
-        urc->total_acknowledged_packets++;
+        /* The notification covers all the packets acknowledged by a frame */
+        uint64_t nb_packets = (uint64_t) get_cnx(cnx, AK_CNX_INPUT, 4);
+        urc->total_acknowledged_packets += (nb_packets > 0) ? nb_packets : 1;
     }
     return 0;
 }
\ No newline at end of file
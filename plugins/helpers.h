@@ -75,6 +75,8 @@
 #endif
 
 void *my_malloc_ex(picoquic_cnx_t *cnx, unsigned int size);
+/* Temporary memory, released when the pluglet returns, so it must not be freed nor kept in the plugin state */
+void *my_scratch_alloc(picoquic_cnx_t *cnx, unsigned int size);
 
 #ifdef PLUGIN_MEMORY_DBG
 #define my_malloc(cnx,size) my_malloc_dbg(cnx,size,__FILE__,__LINE__)
@@ -244,6 +246,20 @@ static int helper_skip_frame(picoquic_cnx_t *cnx, uint8_t* bytes, size_t bytes_m
     return ret;
 }
 
+/* Copies the bytes [offset, offset + length[ of the packet to buffer, or buffer to them if is_write is set,
+ * so that a pluglet parses or builds them in its memory rather than byte per byte through my_memcpy */
+static int helper_packet_window(picoquic_cnx_t *cnx, picoquic_packet_t *packet, size_t offset, size_t length,
+    uint8_t *buffer, int is_write)
+{
+    protoop_arg_t args[5];
+    args[0] = (protoop_arg_t) packet;
+    args[1] = (protoop_arg_t) offset;
+    args[2] = (protoop_arg_t) length;
+    args[3] = (protoop_arg_t) buffer;
+    args[4] = (protoop_arg_t) is_write;
+    return (int) run_noparam(cnx, PROTOOPID_NOPARAM_PACKET_WINDOW, 5, args, NULL);
+}
+
 static int helper_check_stream_frame_already_acked(picoquic_cnx_t* cnx, uint8_t* bytes,
     size_t bytes_max, int* no_need_to_repeat)
 {
@@ -299,18 +315,20 @@ static __attribute__((always_inline)) int helper_mtu_probe_length(picoquic_cnx_t
     if (path_mtu_max_tried == 0) {
         size_t max_packet_size = get_cnx(cnx, AK_CNX_REMOTE_PARAMETER, TRANSPORT_PARAMETER_MAX_PACKET_SIZE);
         size_t quic_mtu_max = get_cnx(cnx, AK_CNX_QUIC_MTU_MAX, 0);
+        size_t quic_max_packet_size = get_cnx(cnx, AK_CNX_QUIC_MAX_PACKET_SIZE, 0);
         if (max_packet_size > 0) {
             probe_length = max_packet_size;
             if (quic_mtu_max > 0 && (int)probe_length > quic_mtu_max) {
                 probe_length = quic_mtu_max;
-            } else if (probe_length > PICOQUIC_MAX_PACKET_SIZE) {
-                probe_length = PICOQUIC_MAX_PACKET_SIZE;
+            }
+            if (probe_length > quic_max_packet_size) {
+                probe_length = quic_max_packet_size;
             }
             if (probe_length < path_mtu) {
                 probe_length = path_mtu;
             }
         } else if (quic_mtu_max > 0) {
-            probe_length = quic_mtu_max;
+            probe_length = (quic_mtu_max < quic_max_packet_size) ? quic_mtu_max : quic_max_packet_size;
         } else {
             probe_length = PICOQUIC_PRACTICAL_MAX_MTU;
         }
@@ -839,11 +857,11 @@ static int helper_packet_was_lost(picoquic_cnx_t *cnx, picoquic_packet_t *packet
     return run_noparam(cnx, PROTOOPID_NOPARAM_PACKET_WAS_LOST, 2, args, NULL);
 }
 
-static __attribute__((always_inline)) void helper_process_ack_of_ack_range(picoquic_cnx_t *cnx, picoquic_sack_item_t *first_sack,
+static __attribute__((always_inline)) void helper_process_ack_of_ack_range(picoquic_cnx_t *cnx, picoquic_sack_list_t *sacks,
     uint64_t start_range, uint64_t end_range)
 {
     protoop_arg_t args[3];
-    args[0] = (protoop_arg_t) first_sack;
+    args[0] = (protoop_arg_t) sacks;
     args[1] = (protoop_arg_t) start_range;
     args[2] = (protoop_arg_t) end_range;
     run_noparam(cnx, PROTOOPID_NOPARAM_PROCESS_ACK_OF_ACK_RANGE, 3, args, NULL);
@@ -0,0 +1,5 @@
+#include "../helpers.h"
+
+protoop_arg_t empty(picoquic_cnx_t *cnx) {
+    return 0;
+}
@@ -0,0 +1,10 @@
+#include "../helpers.h"
+#include "microbench.h"
+
+uint64_t get_cnx_loop(picoquic_cnx_t *cnx) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        sum += get_cnx(cnx, AK_CNX_START_TIME, 0) + i;
+    }
+    return sum;
+}
@@ -0,0 +1,16 @@
+#include "../helpers.h"
+#include "microbench.h"
+
+/* The size of the allocations is the first input */
+uint64_t malloc_free_loop(picoquic_cnx_t *cnx) {
+    unsigned int size = (unsigned int) get_cnx(cnx, AK_CNX_INPUT, 0);
+    uint64_t nb_allocated = 0;
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        void *p = my_malloc(cnx, size);
+        if (p != NULL) {
+            nb_allocated++;
+            my_free(cnx, p);
+        }
+    }
+    return nb_allocated;
+}
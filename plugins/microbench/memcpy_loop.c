@@ -0,0 +1,17 @@
+#include "../helpers.h"
+#include "microbench.h"
+
+uint64_t memcpy_loop(picoquic_cnx_t *cnx) {
+    uint8_t src[MICROBENCH_COPY_SIZE];
+    uint8_t dst[MICROBENCH_COPY_SIZE];
+    uint64_t sum = 0;
+    for (int i = 0; i < MICROBENCH_COPY_SIZE; i++) {
+        src[i] = (uint8_t) i;
+    }
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        src[i % MICROBENCH_COPY_SIZE] = (uint8_t) i;
+        my_memcpy(dst, src, MICROBENCH_COPY_SIZE);
+        sum += dst[(i * 7) % MICROBENCH_COPY_SIZE];
+    }
+    return sum;
+}
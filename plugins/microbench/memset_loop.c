@@ -0,0 +1,12 @@
+#include "../helpers.h"
+#include "microbench.h"
+
+uint64_t memset_loop(picoquic_cnx_t *cnx) {
+    uint8_t dst[MICROBENCH_COPY_SIZE];
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        my_memset(dst, (int) (i & 0xff), MICROBENCH_COPY_SIZE);
+        sum += dst[(i * 7) % MICROBENCH_COPY_SIZE];
+    }
+    return sum;
+}
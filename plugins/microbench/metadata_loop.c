@@ -0,0 +1,11 @@
+#include "../helpers.h"
+#include "microbench.h"
+
+uint64_t metadata_loop(picoquic_cnx_t *cnx) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        sum += get_cnx_metadata(cnx, 0);
+        set_cnx_metadata(cnx, 0, i);
+    }
+    return sum;
+}
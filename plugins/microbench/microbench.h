@@ -0,0 +1,12 @@
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+/* Shared with picoquictest/microbench.c, which runs the same loops in the core as the baseline */
+#define MICROBENCH_NB_LOOPS 1000000
+#define MICROBENCH_COPY_SIZE 64
+
+#define PROTOOPID_MICROBENCH_EMPTY "microbench_empty"
+#define PROTOOPID_MICROBENCH_EMPTY_OBSERVED "microbench_empty_observed"
+#define PROTOOPID_MICROBENCH_EMPTY_REPLACE "microbench_empty_replace"
+
+#endif /* MICROBENCH_H */
@@ -0,0 +1,10 @@
+#include "../helpers.h"
+#include "microbench.h"
+
+uint64_t run_protoop_loop(picoquic_cnx_t *cnx) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        sum += run_noparam(cnx, PROTOOPID_MICROBENCH_EMPTY, 0, NULL, NULL) + 1;
+    }
+    return sum;
+}
@@ -0,0 +1,9 @@
+#include "../helpers.h"
+#include "microbench.h"
+
+uint64_t set_cnx_loop(picoquic_cnx_t *cnx) {
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
+        set_cnx(cnx, AK_CNX_START_TIME, 0, i);
+    }
+    return get_cnx(cnx, AK_CNX_START_TIME, 0);
+}
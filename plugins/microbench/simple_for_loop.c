@@ -1,9 +1,10 @@
 #include "../helpers.h"
+#include "microbench.h"
 
 uint64_t simple_for_loop(void *mem) {
     uint64_t sum = 0;
-    for (uint64_t i = 0; i < 1000000000; i++) {
+    for (uint64_t i = 0; i < MICROBENCH_NB_LOOPS; i++) {
         sum = i + sum * 3 / 2;
     }
     return sum;
-}
\ No newline at end of file
+}
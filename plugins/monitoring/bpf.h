@@ -9,6 +9,7 @@
 #include "memcpy.h"
 #include "util.h"
 #include "getset.h"
+#include "server_metrics.h"
 
 #define MONITORING_OPAQUE_ID 0x02
 #define BILLION ((unsigned int) 1000000)
@@ -99,6 +100,7 @@ typedef struct {  // We might want to add CIDs to this
     monitoring_path_metrics handshake_metrics;
     int n_established_paths;
     monitoring_path_metrics *established_metrics;
+    int merged_in_server_metrics;
 } monitoring_conn_metrics;
 
 static __attribute__((always_inline)) monitoring_conn_metrics *initialize_metrics_data(picoquic_cnx_t *cnx)  // TODO: We need to free it as well
@@ -235,6 +237,40 @@ static __attribute__((always_inline)) void complete_path(monitoring_path_metrics
     clock_gettime(CLOCK_MONOTONIC, &path_metrics->t_end);
 }
 
+/**
+ * Processes the update_rtt calls recorded since the last invocation, see PROTOOP_NOPARAM_UPDATE_RTT.
+ * The ring only contains update_rtt events, as it is the only record anchor of the plugin.
+ * The path might have been deleted meanwhile, so it is looked up again in the connection.
+ */
+static __attribute__((always_inline)) void process_recorded_rtt_updates(picoquic_cnx_t *cnx, monitoring_conn_metrics *metrics)
+{
+    plugin_record_event_t event;
+    while (plugin_record_drain(cnx, &event, 1) == 1) {
+        picoquic_packet_context_enum pc = (picoquic_packet_context_enum) event.inputv[3];
+        picoquic_path_t *path_x = (picoquic_path_t *) event.inputv[4];
+        int nb_paths = (int) get_cnx(cnx, AK_CNX_NB_PATHS, 0);
+        int i;
+        for (i = 0; i < nb_paths && (picoquic_path_t *) get_cnx(cnx, AK_CNX_PATH, i) != path_x; i++);
+        if (i == nb_paths) {
+            continue;
+        }
+        monitoring_path_metrics *path_metrics;
+        picoquic_state_enum cnx_state = (picoquic_state_enum) get_cnx(cnx, AK_CNX_STATE, 0);
+        picoquic_packet_context_t *pkt_ctx = (picoquic_packet_context_t *) get_path(path_x, AK_PATH_PKT_CTX, pc);
+
+        if (cnx_state < picoquic_state_client_ready) {
+            path_metrics = &metrics->handshake_metrics;
+        } else {
+            path_metrics = find_metrics_for_path(cnx, metrics, path_x);
+        }
+
+        path_metrics->metrics.smoothed_rtt = (uint64_t) get_path(path_x, AK_PATH_SMOOTHED_RTT, 0);
+        path_metrics->metrics.rtt_variance = (uint64_t) get_path(path_x, AK_PATH_RTT_VARIANT, 0);
+        path_metrics->metrics.ack_delay = (uint64_t) get_pkt_ctx(pkt_ctx, AK_PKTCTX_ACK_DELAY_LOCAL);
+        path_metrics->metrics.max_ack_delay = (uint64_t) get_path(path_x, AK_PATH_MAX_ACK_DELAY, 0);
+    }
+}
+
 static __attribute__((always_inline)) void dump_metrics(picoquic_cnx_t *cnx, monitoring_conn_metrics *metrics) {
     struct sockaddr_in si;
     memset(&si, 0, sizeof(struct sockaddr_in));
@@ -311,4 +347,51 @@ static __attribute__((always_inline)) void send_path_metrics_to_exporter(picoqui
         PROTOOP_PRINTF(cnx, "Unable to send path metrics\n");
     }
     my_free(cnx, buf);
+}
+
+static __attribute__((always_inline)) void add_path_to_sample(picoquic_server_metrics_sample_t *sample, monitoring_metrics *m) {
+    sample->bytes_sent += m->data_sent;
+    sample->bytes_received += m->data_recv;
+    sample->bytes_lost += m->data_lost;
+    sample->packets_sent += m->pkt_sent;
+    sample->packets_received += m->pkt_recv;
+    sample->packets_lost += m->pkt_lost;
+    sample->rto_fired += m->rto_fired;
+    sample->tlp_fired += m->tlp_fired;
+    sample->frt_fired += m->frt_fired;
+}
+
+/**
+ * Merges the totals of the connection in the server metrics of the context, once, see PROTOOP_NOPARAM_MERGE_SERVER_METRICS.
+ * Unlike the exporter, this does not leave the process.
+ */
+static __attribute__((always_inline)) void merge_in_server_metrics(picoquic_cnx_t *cnx, monitoring_conn_metrics *metrics, int handshake_failed) {
+    picoquic_server_metrics_sample_t sample;
+    struct timespec now;
+    picoquic_path_t *path_0 = (picoquic_path_t *) get_cnx(cnx, AK_CNX_PATH, 0);
+
+    if (metrics->merged_in_server_metrics) {
+        return;
+    }
+    metrics->merged_in_server_metrics = 1;
+
+    my_memset(&sample, 0, sizeof(picoquic_server_metrics_sample_t));
+    add_path_to_sample(&sample, &metrics->handshake_metrics.metrics);
+    monitoring_path_metrics *path_metrics = metrics->established_metrics;
+    int limit = metrics->n_established_paths; // T2 oddity
+    for (int i = 0; i < limit && path_metrics != NULL; i++) {
+        add_path_to_sample(&sample, &path_metrics->metrics);
+        path_metrics = path_metrics->next;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sample.duration = (uint64_t) ((now.tv_sec - metrics->handshake_metrics.t_start.tv_sec) * 1000000 +
+        (now.tv_nsec - metrics->handshake_metrics.t_start.tv_nsec) / 1000);
+    sample.smoothed_rtt = (uint64_t) get_path(path_0, AK_PATH_SMOOTHED_RTT, 0);
+    sample.cwnd = (uint64_t) get_path(path_0, AK_PATH_CWIN, 0);
+    sample.streams_opened = metrics->quic_metrics.streams_opened;
+    sample.handshake_failed = handshake_failed;
+
+    protoop_arg_t args[1];
+    args[0] = (protoop_arg_t) &sample;
+    run_noparam(cnx, PROTOOPID_NOPARAM_MERGE_SERVER_METRICS, 1, args, NULL);
 }
\ No newline at end of file
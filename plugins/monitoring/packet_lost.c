@@ -11,7 +11,7 @@ protoop_arg_t packet_lost(picoquic_cnx_t *cnx)
     picoquic_path_t *path = (picoquic_path_t *) get_cnx(cnx, AK_CNX_INPUT, 1);
 
     monitoring_path_metrics *path_metrics = find_metrics_for_path(cnx, metrics, path);
-    path_metrics->metrics.data_lost = (get_pkt(packet, AK_PKT_LENGTH) + get_pkt(packet, AK_PKT_CHECKSUM_OVERHEAD));
+    path_metrics->metrics.data_lost += (get_pkt(packet, AK_PKT_LENGTH) + get_pkt(packet, AK_PKT_CHECKSUM_OVERHEAD));
     path_metrics->metrics.pkt_lost++;
     return 0;
 }
\ No newline at end of file
@@ -19,6 +19,8 @@ protoop_arg_t packet_sent(picoquic_cnx_t *cnx)
     picoquic_packet_t *packet = (picoquic_packet_t *) get_cnx(cnx, AK_CNX_INPUT, 2);
     size_t length = (size_t) get_cnx(cnx, AK_CNX_INPUT, 3);
 
+    process_recorded_rtt_updates(cnx, metrics);
+
     uint64_t plen = get_pkt(packet, AK_PKT_LENGTH);
     if (plen == 0 || plen <= get_pkt(packet, AK_PKT_OFFSET)) {
         return 0; // This packet is empty
@@ -37,14 +37,41 @@
 
 #define MAX_DUPLICATE_DATA_LENGTH 1250
 
-#define RTT_PROBE_TYPE 0x42
+/* Number of sending uniflows carrying the frames of redundant streams */
+#ifndef REDUNDANT_UNIFLOWS
+#define REDUNDANT_UNIFLOWS 2
+#endif
+
+#define RTT_PROBE_TYPE 0x49
 #define RTT_PROBE_INTERVAL 100000
 
+/* Path health. A sending uniflow becomes suspect when none of its packets in flight was acknowledged for
+ * MP_SUSPECT_RTT_COEF smoothed RTTs. Its packets in flight then move to the healthy uniflows, and it only
+ * carries RTT probes until one of its packets gets acknowledged. After MP_FAILED_PROBES probes lost in a row,
+ * it is failed and only probed every MP_FAILED_PROBE_INTERVAL. Lower values fail over faster, at the cost of
+ * more spurious failovers. */
+#ifndef MP_SUSPECT_RTT_COEF
+#define MP_SUSPECT_RTT_COEF 4
+#endif
+#ifndef MP_FAILED_PROBES
+#define MP_FAILED_PROBES 3
+#endif
+#ifndef MP_FAILED_PROBE_INTERVAL
+#define MP_FAILED_PROBE_INTERVAL 1000000
+#endif
+
 typedef enum mp_sending_uniflow_state_e {
     uniflow_unused = 0,
     uniflow_active = 1,
 } mp_sending_uniflow_state;
 
+typedef enum mp_uniflow_health_e {
+    uniflow_healthy = 0,
+    uniflow_suspect = 1, /* Not acknowledged for too long, waits for its RTT probe */
+    uniflow_probing = 2, /* Its RTT probe is in flight */
+    uniflow_failed = 3,
+} mp_uniflow_health;
+
 typedef struct {
     uint64_t uniflow_id;
 } mp_new_connection_id_ctx_t;
@@ -79,8 +106,9 @@ typedef struct {
     // bool doing_ack;
     bool has_sent_uniflows_frame;
 
-    uint64_t failure_count;
-    uint64_t cooldown_time;
+    mp_uniflow_health health;
+    uint8_t rtt_probe_losses; /* In a row */
+    uint64_t last_ack_time;
 } uniflow_data_t;
 
 typedef struct {
@@ -133,7 +161,12 @@ typedef struct {
 typedef struct {
     uint8_t requires_duplication;
     uint16_t data_length;
-    uint8_t data[1250];
+    uint8_t data[MAX_DUPLICATE_DATA_LENGTH];
+    /* Stream frames of redundant streams, still to be sent on other uniflows */
+    uint8_t redundant_copies_left;
+    uint8_t redundant_sent_uniflows; /* Bitmask of the sending uniflow indexes that already carried them */
+    uint16_t redundant_length;
+    uint8_t redundant_data[MAX_DUPLICATE_DATA_LENGTH];
 } bpf_duplicate_data;
 
 typedef struct add_address_frame {
@@ -628,4 +661,141 @@ static __attribute__((always_inline)) picoquic_packet_t* mp_update_rtt(picoquic_
         *is_new_ack = outs[0];
     }
     return p;
-}
\ No newline at end of file
+}
+static __attribute__((always_inline)) void mp_uniflow_set_health(picoquic_cnx_t *cnx, uniflow_data_t *ud, mp_uniflow_health health)
+{
+    LOG_EVENT(cnx, "multipath", "uniflow_health", "", "{\"uniflow_id\": %" PRIu64 ", \"path\": \"%p\", \"old\": %d, \"new\": %d}",
+              ud->uniflow_id, (protoop_arg_t) ud->path, ud->health, health);
+    ud->health = health;
+    if (health == uniflow_healthy) {
+        ud->rtt_probe_losses = 0;
+    }
+}
+
+static bool mp_has_healthy_uniflow(bpf_data *bpfd, uniflow_data_t *except)
+{
+    for (int i = 0; i < bpfd->nb_sending_proposed; i++) {
+        uniflow_data_t *ud = bpfd->sending_uniflows[i];
+        if (ud != except && ud->state == uniflow_active && ud->health == uniflow_healthy &&
+            get_path(ud->path, AK_PATH_CHALLENGE_VERIFIED, 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Unhealthy uniflows only carry RTT probes, unless none is healthy */
+static bool mp_uniflow_usable(bpf_data *bpfd, uniflow_data_t *ud)
+{
+    return ud == NULL || ud->health == uniflow_healthy || !mp_has_healthy_uniflow(bpfd, NULL);
+}
+
+static bool mp_path_usable(bpf_data *bpfd, picoquic_path_t *path_x)
+{
+    return mp_uniflow_usable(bpfd, mp_get_sending_uniflow_data(bpfd, path_x));
+}
+
+/* Time at which the uniflow becomes suspect if nothing it carried gets acknowledged, UINT64_MAX if nothing is awaited */
+static uint64_t mp_uniflow_suspect_time(uniflow_data_t *ud)
+{
+    picoquic_packet_context_t *pkt_ctx = (picoquic_packet_context_t *) get_path(ud->path, AK_PATH_PKT_CTX, picoquic_packet_context_application);
+    picoquic_packet_t *p = (picoquic_packet_t *) get_pkt_ctx(pkt_ctx, AK_PKTCTX_RETRANSMIT_OLDEST);
+    while (p != NULL && get_pkt(p, AK_PKT_IS_PURE_ACK)) {
+        p = (picoquic_packet_t *) get_pkt(p, AK_PKT_NEXT_PACKET);
+    }
+    if (p == NULL) {
+        return UINT64_MAX;
+    }
+    uint64_t start_time = (uint64_t) get_pkt(p, AK_PKT_SEND_TIME);
+    if (ud->last_ack_time > start_time) {
+        start_time = ud->last_ack_time;
+    }
+    uint64_t delay = MP_SUSPECT_RTT_COEF * (uint64_t) get_path(ud->path, AK_PATH_SMOOTHED_RTT, 0) +
+        (uint64_t) get_path(ud->path, AK_PATH_MAX_ACK_DELAY, 0);
+    if (delay < PICOQUIC_MIN_RETRANSMIT_TIMER) {
+        delay = PICOQUIC_MIN_RETRANSMIT_TIMER;
+    }
+    return start_time + delay;
+}
+
+/* Time at which the RTT probe of an unhealthy uniflow is due, or is lost if in flight */
+static uint64_t mp_uniflow_probe_time(uniflow_data_t *ud)
+{
+    switch (ud->health) {
+    case uniflow_suspect:
+        return ud->last_rtt_probe;
+    case uniflow_probing:
+        return ud->last_rtt_probe + (uint64_t) get_path(ud->path, AK_PATH_RETRANSMIT_TIMER, 0);
+    case uniflow_failed:
+        return ud->last_rtt_probe + MP_FAILED_PROBE_INTERVAL;
+    default:
+        return UINT64_MAX;
+    }
+}
+
+/* Makes the packets in flight on the uniflow due for retransmission at once, so that they move to the other
+ * uniflows. A null send time also keeps them out of the RTT estimates and of the spurious retransmission checks. */
+static void mp_uniflow_expire_packets(uniflow_data_t *ud)
+{
+    picoquic_packet_context_t *pkt_ctx = (picoquic_packet_context_t *) get_path(ud->path, AK_PATH_PKT_CTX, picoquic_packet_context_application);
+    picoquic_packet_t *p = (picoquic_packet_t *) get_pkt_ctx(pkt_ctx, AK_PKTCTX_RETRANSMIT_OLDEST);
+    set_pkt_ctx(pkt_ctx, AK_PKTCTX_LATEST_ACK_ELICITING_TIME, 0);
+    while (p != NULL) {
+        set_pkt(p, AK_PKT_SEND_TIME, 0);
+        p = (picoquic_packet_t *) get_pkt(p, AK_PKT_NEXT_PACKET);
+    }
+}
+
+static void reserve_rtt_probe(picoquic_cnx_t *cnx, uniflow_data_t *ud, int uniflow_index)
+{
+    reserve_frame_slot_t *rfs = (reserve_frame_slot_t *) my_malloc(cnx, sizeof(reserve_frame_slot_t));
+    if (!rfs) {
+        return;
+    }
+    my_memset(rfs, 0, sizeof(reserve_frame_slot_t));
+    rfs->frame_type = RTT_PROBE_TYPE;
+    rfs->frame_ctx = (void *) (uint64_t) uniflow_index;
+    rfs->nb_bytes = 1;
+    if (reserve_frames(cnx, 1, rfs) < rfs->nb_bytes) {
+        my_free(cnx, rfs);
+        return;
+    }
+    ud->rtt_probe_ready = true;
+    ud->rtt_probe_tries = 0;
+}
+
+/* Moves the sending uniflows through the health states, returns whether a packet should be sent now */
+static bool mp_update_uniflows_health(picoquic_cnx_t *cnx, bpf_data *bpfd, uint64_t current_time)
+{
+    bool send_now = false;
+    for (int i = 0; i < bpfd->nb_sending_proposed; i++) {
+        uniflow_data_t *ud = bpfd->sending_uniflows[i];
+        if (ud->state != uniflow_active || !get_path(ud->path, AK_PATH_CHALLENGE_VERIFIED, 0)) {
+            continue;
+        }
+        if (ud->health == uniflow_healthy) {
+            if (mp_uniflow_suspect_time(ud) > current_time) {
+                continue;
+            }
+            mp_uniflow_set_health(cnx, ud, uniflow_suspect);
+            ud->last_rtt_probe = current_time;
+            if (mp_has_healthy_uniflow(bpfd, ud)) {
+                mp_uniflow_expire_packets(ud);
+                send_now = true;
+            }
+        }
+        if (ud->rtt_probe_ready || mp_uniflow_probe_time(ud) > current_time) {
+            continue;
+        }
+        if (ud->health == uniflow_probing) {
+            /* The RTT probe was not acknowledged in time */
+            ud->rtt_probe_losses++;
+            if (ud->rtt_probe_losses >= MP_FAILED_PROBES) {
+                mp_uniflow_set_health(cnx, ud, uniflow_failed);
+                continue;
+            }
+        }
+        reserve_rtt_probe(cnx, ud, i);
+    }
+    return send_now;
+}
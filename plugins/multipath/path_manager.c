@@ -1,8 +1,5 @@
 #include "bpf.h"
 
-#define UNUSABLE_RTT_COEF 8
-#define COOLDOWN_RTT_COEF 8
-
 protoop_arg_t path_manager(picoquic_cnx_t* cnx) {
     /* Now, even the server MUST itself setup its sending paths */
     bpf_data *bpfd = get_bpf_data(cnx);
@@ -12,6 +12,103 @@
     } \
 }
 
+/* Keeps the stream frames of a redundant stream, so that they are also sent on other uniflows. A new set of
+ * frames is only started once the previous one was sent on all its uniflows, or was acknowledged. */
+static __attribute__((always_inline)) void copy_for_redundancy(bpf_data *bpfd, bpf_duplicate_data *bpfdd, int sending_index,
+    uint8_t *frame, size_t frame_length, int *redundant_started)
+{
+    if (sending_index < 0 || (bpfdd->redundant_copies_left > 0 && !*redundant_started)) {
+        return;
+    }
+    if (!*redundant_started) {
+        uint8_t nb_uniflows = (bpfd->nb_sending_active < REDUNDANT_UNIFLOWS) ? bpfd->nb_sending_active : REDUNDANT_UNIFLOWS;
+        if (nb_uniflows <= 1) {
+            return;
+        }
+        bpfdd->redundant_copies_left = nb_uniflows - 1;
+        bpfdd->redundant_sent_uniflows = 1 << sending_index;
+        bpfdd->redundant_length = 0;
+        *redundant_started = 1;
+    }
+    if (bpfdd->redundant_length + frame_length <= MAX_DUPLICATE_DATA_LENGTH) {
+        my_memcpy(&bpfdd->redundant_data[bpfdd->redundant_length], frame, frame_length);
+        bpfdd->redundant_length += frame_length;
+    }
+}
+
+/* Writes the kept redundant frames that were not acknowledged yet. Returns the number of bytes written, 0 if they do
+ * not fit. Once all of them were acknowledged, the remaining copies are cancelled. */
+static size_t write_redundant_frames(picoquic_cnx_t *cnx, bpf_duplicate_data *bpfdd, uint8_t *bytes, size_t bytes_max)
+{
+    size_t byte_index = 0;
+    size_t needed = 0;
+    size_t written = 0;
+    size_t frame_length = 0;
+    int pure_ack = 0;
+    int already_acked = 0;
+
+    /* First pass to find what remains to be sent */
+    while (byte_index < bpfdd->redundant_length) {
+        if (helper_skip_frame(cnx, &bpfdd->redundant_data[byte_index], bpfdd->redundant_length - byte_index, &frame_length, &pure_ack) != 0) {
+            break;
+        }
+        if (helper_check_stream_frame_already_acked(cnx, &bpfdd->redundant_data[byte_index], frame_length, &already_acked) == 0 && !already_acked) {
+            needed += frame_length;
+        }
+        byte_index += frame_length;
+    }
+
+    if (needed == 0) {
+        bpfdd->redundant_copies_left = 0;
+        bpfdd->redundant_length = 0;
+        return 0;
+    }
+    if (needed > bytes_max) {
+        return 0;
+    }
+
+    byte_index = 0;
+    while (byte_index < bpfdd->redundant_length) {
+        if (helper_skip_frame(cnx, &bpfdd->redundant_data[byte_index], bpfdd->redundant_length - byte_index, &frame_length, &pure_ack) != 0) {
+            break;
+        }
+        if (helper_check_stream_frame_already_acked(cnx, &bpfdd->redundant_data[byte_index], frame_length, &already_acked) == 0 && !already_acked) {
+            my_memcpy(&bytes[written], &bpfdd->redundant_data[byte_index], frame_length);
+            written += frame_length;
+        }
+        byte_index += frame_length;
+    }
+    return written;
+}
+
+/* Flow control credit needed beyond the usual doubling, to absorb the data of the fast uniflows that arrives while
+ * the slowest one catches up. It is the receive rate times the RTT difference between the active uniflows. */
+static uint64_t mp_reordering_budget(bpf_data *bpfd)
+{
+    uint64_t receive_rate = 0;
+    uint64_t rtt_min = UINT64_MAX;
+    uint64_t rtt_max = 0;
+
+    for (int i = 0; i < bpfd->nb_receiving_proposed; i++) {
+        uniflow_data_t *ud = bpfd->receiving_uniflows[i];
+        if (ud && ud->path) {
+            receive_rate += (uint64_t) get_path(ud->path, AK_PATH_RECEIVE_RATE_ESTIMATE, 0);
+        }
+    }
+    for (int i = 0; i < bpfd->nb_sending_proposed; i++) {
+        uniflow_data_t *ud = bpfd->sending_uniflows[i];
+        if (ud && ud->state == uniflow_active && get_path(ud->path, AK_PATH_CHALLENGE_VERIFIED, 0)) {
+            uint64_t srtt = (uint64_t) get_path(ud->path, AK_PATH_SMOOTHED_RTT, 0);
+            rtt_min = (srtt < rtt_min) ? srtt : rtt_min;
+            rtt_max = (srtt > rtt_max) ? srtt : rtt_max;
+        }
+    }
+    if (rtt_max <= rtt_min) {
+        return 0;
+    }
+    return (receive_rate * (rtt_max - rtt_min)) / 1000000;
+}
+
 protoop_arg_t schedule_frames(picoquic_cnx_t *cnx) {
     picoquic_packet_t* packet = (picoquic_packet_t*) get_cnx(cnx, AK_CNX_INPUT, 0);
     size_t send_buffer_max = (size_t) get_cnx(cnx, AK_CNX_INPUT, 1);
@@ -31,15 +128,18 @@ protoop_arg_t schedule_frames(picoquic_cnx_t *cnx) {
     /* FIXME cope with different ath MTUs */
     picoquic_path_t *sending_path;
     if (bpfd->next_sending_uniflow == NULL) { /* Has set_next_wake_time already recommended a path ? */
-        sending_path = schedule_path(cnx, retransmit_p, from_path, reason, bpfdd->requires_duplication);
+        sending_path = schedule_path(cnx, retransmit_p, from_path, reason, bpfdd->requires_duplication || bpfdd->redundant_copies_left > 0);
     } else {
         sending_path = bpfd->next_sending_uniflow->path;
+        bpfd->last_uniflow_index_sent = (uint8_t) mp_get_uniflow_index_from_path(bpfd, true, sending_path);
     }
     PUSH_LOG_CTX(cnx, "\"sending path\": \"%p\"", (protoop_arg_t) sending_path);
     uint32_t sending_path_mtu = (uint32_t) get_path(sending_path, AK_PATH_SEND_MTU, 0);
 
     uint32_t send_buffer_min_max = (send_buffer_max > sending_path_mtu) ? sending_path_mtu : (uint32_t)send_buffer_max;
-    int retransmit_possible = 1;
+    /* An unhealthy uniflow only carries its RTT probe and the frames that can go on any uniflow */
+    int sending_usable = mp_path_usable(bpfd, sending_path);
+    int retransmit_possible = sending_usable;
     picoquic_packet_context_enum pc = picoquic_packet_context_application;
     size_t data_bytes = 0;
     uint32_t header_length = 0;
@@ -97,6 +197,8 @@ protoop_arg_t schedule_frames(picoquic_cnx_t *cnx) {
         int mtu_needed = helper_is_mtu_probe_needed(cnx, sending_path);
         int handshake_done_to_send = !get_cnx(cnx, AK_CNX_CLIENT_MODE, 0) && get_cnx(cnx, AK_CNX_HANDSHAKE_DONE, 0) && !get_cnx(cnx, AK_CNX_HANDSHAKE_DONE_SENT, 0);
         uniflow_data_t *sending_uniflow = mp_get_sending_uniflow_data(bpfd, sending_path);
+        int sending_index = mp_get_uniflow_index_from_path(bpfd, true, sending_path);
+        int redundant_started = 0;
 
         /* We first need to check if there is ANY receive path that requires acknowledgement, and also no path response to send */
         int any_receiving_require_ack = 0;
@@ -118,7 +220,7 @@ protoop_arg_t schedule_frames(picoquic_cnx_t *cnx) {
             && (!sending_uniflow || sending_uniflow->has_sent_uniflows_frame == 1)
             && (challenge_verified == 1 || current_time < challenge_time + retransmit_timer)
             && mtu_needed) {
-            if (ret == 0 && send_buffer_max > sending_path_mtu) {
+            if (ret == 0 && send_buffer_max > sending_path_mtu && helper_mtu_probe_length(cnx, sending_path) <= send_buffer_max) {
                 length = helper_prepare_mtu_probe(cnx, sending_path, header_length, checksum_overhead, bytes);
                 set_pkt(packet, AK_PKT_IS_MTU_PROBE, 1);
                 set_pkt(packet, AK_PKT_LENGTH, length);
@@ -168,6 +270,19 @@ protoop_arg_t schedule_frames(picoquic_cnx_t *cnx) {
                     bpfdd->requires_duplication = 0;
                 }
 
+                /* Then repeat the frames of redundant streams, if this uniflow did not carry them yet */
+                if (!path_validation_in_progress && sending_usable && bpfdd->redundant_copies_left > 0 && sending_index >= 0 &&
+                    (bpfdd->redundant_sent_uniflows & (1 << sending_index)) == 0) {
+                    data_bytes = write_redundant_frames(cnx, bpfdd, &bytes[length], send_buffer_min_max - checksum_overhead - length);
+                    if (data_bytes > 0) {
+                        length += (uint32_t) data_bytes;
+                        set_pkt(packet, AK_PKT_IS_PURE_ACK, 0);
+                        set_pkt(packet, AK_PKT_IS_CONGESTION_CONTROLLED, 1);
+                        bpfdd->redundant_sent_uniflows |= 1 << sending_index;
+                        bpfdd->redundant_copies_left--;
+                    }
+                }
+
                 /* FIXME I know Multipath somewhat bypass the reservation rules, but it is required here and easier like this... */
                 if (bpfd->nb_sending_proposed > 0 && bpfd->nb_receiving_proposed > 0 && (get_cnx(cnx, AK_CNX_HANDSHAKE_DONE, 0) && (get_cnx(cnx, AK_CNX_CLIENT_MODE, 0) || get_cnx(cnx, AK_CNX_HANDSHAKE_DONE_ACKED, 0))) &&
                     sending_uniflow && !sending_uniflow->has_sent_uniflows_frame && get_path(sending_uniflow->path, AK_PATH_CHALLENGE_VERIFIED, 0)) {
@@ -192,8 +307,13 @@ protoop_arg_t schedule_frames(picoquic_cnx_t *cnx) {
                 size_t queued_bytes = 0;
                 size_t consumed = 0;
                 queue_t *reserved_frames = (queue_t *) get_cnx(cnx, AK_CNX_RESERVED_FRAMES, 0);
+                if (!sending_usable) {
+                    stream = NULL;
+                }
                 if (queue_peek(reserved_frames) == NULL) {
-                    stream = helper_schedule_next_stream(cnx, send_buffer_min_max - checksum_overhead - length, sending_path);
+                    if (sending_usable) {
+                        stream = helper_schedule_next_stream(cnx, send_buffer_min_max - checksum_overhead - length, sending_path);
+                    }
                     picoquic_frame_fair_reserve(cnx, sending_path, stream, send_buffer_min_max - checksum_overhead - length);
                 }
 
@@ -237,7 +357,7 @@ protoop_arg_t schedule_frames(picoquic_cnx_t *cnx) {
                         }
                     }
 
-                    if (cwin > bytes_in_transit) {
+                    if (cwin > bytes_in_transit && sending_usable) {
                         /* if present, send tls data */
                         if (tls_ready) {
                             ret = helper_prepare_crypto_hs_frame(cnx, 3, &bytes[length],
@@ -270,8 +390,9 @@ protoop_arg_t schedule_frames(picoquic_cnx_t *cnx) {
                         /* If necessary, encode the max data frame */
                         uint64_t data_received = get_cnx(cnx, AK_CNX_DATA_RECEIVED, 0);
                         uint64_t maxdata_local = get_cnx(cnx, AK_CNX_MAXDATA_LOCAL, 0);
-                        if (ret == 0 && 2 * data_received > maxdata_local) {
-                            ret = helper_prepare_max_data_frame(cnx, 2 * data_received, &bytes[length],
+                        uint64_t reordering_budget = mp_reordering_budget(bpfd);
+                        if (ret == 0 && 2 * data_received + reordering_budget > maxdata_local) {
+                            ret = helper_prepare_max_data_frame(cnx, 2 * data_received + reordering_budget, &bytes[length],
                                                                 send_buffer_min_max - checksum_overhead - length, &data_bytes);
 
                             if (ret == 0) {
@@ -308,6 +429,9 @@ protoop_arg_t schedule_frames(picoquic_cnx_t *cnx) {
 
                             for (int i = 0; ret == 0 && i < pids_to_request_size; i++) {
                                 pid_to_request = (plugin_req_pid_t *) get_cnx(cnx, AK_CNX_PIDS_TO_REQUEST, i);
+                                if (get_preq(pid_to_request, AK_PIDREQ_REQUESTED)) {
+                                    continue;
+                                }
                                 pid_id = (uint64_t) get_preq(pid_to_request, AK_PIDREQ_PID_ID);
                                 plugin_name = (char *) get_preq(pid_to_request, AK_PIDREQ_PLUGIN_NAME);
                                 ret = helper_write_plugin_validate_frame(cnx, &bytes[length], &bytes[send_buffer_min_max - checksum_overhead],
@@ -378,6 +502,9 @@ protoop_arg_t schedule_frames(picoquic_cnx_t *cnx) {
 
                                     if (path_validation_in_progress && !helper_is_stream_frame_unlimited(bytes + length - data_bytes)) {
                                         copy_for_duplication(cnx, bpfdd, packet, bytes, length, data_bytes, false, true);
+                                    } else if (!path_validation_in_progress && get_stream_head(stream, AK_STREAMHEAD_FLAGS_REDUNDANT) &&
+                                               !helper_is_stream_frame_unlimited(bytes + length - data_bytes)) {
+                                        copy_for_redundancy(bpfd, bpfdd, sending_index, bytes + length - data_bytes, data_bytes, &redundant_started);
                                     }
                                 }
 
@@ -0,0 +1,134 @@
+#include "../bpf.h"
+
+/* Earliest Completion First, after Lim et al., "ECF: An MPTCP Path Scheduler to Manage Heterogeneous Paths".
+ * Data goes on the fastest path while its window has room. When it is full, a slower path with room is only
+ * used if it delivers sooner than the fastest path would once its window opens again. Otherwise the data is
+ * held for the fastest path, instead of arriving late at the receiver and blocking the stream behind it. */
+
+static uint64_t find_smooth_rtt(bpf_data *bpfd, bpf_tuple_data *bpftd, int sending_index) {
+    /* Instead of finding the smallest RTT, just weight them by the number of packets */
+    uint64_t srtt = 0;
+    uint64_t nb_updates = 0;
+    for (int i = 0; i < bpfd->nb_receiving_proposed; i++) {
+        srtt += bpftd->tuple_stats[i][sending_index].smoothed_rtt * bpftd->tuple_stats[i][sending_index].nb_updates;
+        nb_updates += bpftd->tuple_stats[i][sending_index].nb_updates;
+    }
+    if (nb_updates == 0) return 1; /* Give a chance to be used */
+    return srtt / nb_updates;
+}
+
+protoop_arg_t schedule_path_ecf(picoquic_cnx_t *cnx) {
+    access_key_t input_aks[4] = {AK_CNX_INPUT, AK_CNX_INPUT, AK_CNX_INPUT, AK_CNX_INPUT};
+    uint16_t input_params[4] = {0, 1, 2, 3};
+    protoop_arg_t inputs[4];
+    get_cnx_fields(cnx, input_aks, input_params, 4, inputs);
+    picoquic_packet_t *retransmit_p  = (picoquic_packet_t *) inputs[0];
+    picoquic_path_t *from_path = (picoquic_path_t *) inputs[1];
+    char *reason = (char *) inputs[2];
+    int change_path = (int) inputs[3];
+    char *path_reason = "";
+
+    if (retransmit_p && from_path && reason) {
+        if (strncmp(PROTOOPID_NOPARAM_RETRANSMISSION_TIMEOUT, reason, 23) != 0 && mp_path_usable(get_bpf_data(cnx), from_path)) {
+            /* Fast retransmit or TLP, stay on the same path, unless it is unhealthy! */
+            return (protoop_arg_t) from_path;
+        }
+    }
+
+    picoquic_path_t *sending_path = (picoquic_path_t *) get_cnx(cnx, AK_CNX_PATH, 0); /* We should NEVER return NULL */
+    bpf_data *bpfd = get_bpf_data(cnx);
+    bpf_tuple_data *bpftd = get_bpf_tuple_data(cnx);
+    uniflow_data_t *ud = NULL;
+    access_key_t path_aks[3] = {AK_PATH_CHALLENGE_VERIFIED, AK_PATH_CWIN, AK_PATH_BYTES_IN_TRANSIT};
+    protoop_arg_t path_fields[3];
+
+    /* The fastest path, whether its window has room or not, and the fastest one with room */
+    picoquic_path_t *fast_path = NULL;
+    uint8_t fast_index = 255;
+    uint64_t fast_rtt = 0;
+    uint64_t fast_cwin = 0;
+    int fast_has_room = 0;
+    picoquic_path_t *slow_path = NULL;
+    uint8_t slow_index = 255;
+    uint64_t slow_rtt = 0;
+    uint64_t slow_room = 0;
+
+    for (uint8_t i = 0; i < bpfd->nb_sending_proposed; i++) {
+        ud = bpfd->sending_uniflows[i];
+        if (ud->state != uniflow_active || !mp_uniflow_usable(bpfd, ud)) {
+            continue;
+        }
+        picoquic_path_t *path_c = ud->path;
+        get_path_fields(path_c, path_aks, NULL, 3, path_fields);
+        int challenge_verified_c = (int) path_fields[0];
+        uint64_t cwin_c = (uint64_t) path_fields[1];
+        uint64_t bytes_in_transit_c = (uint64_t) path_fields[2];
+
+        /* If we want another path, ask for it now */
+        if (change_path && i != bpfd->last_uniflow_index_sent) {
+            bpfd->last_uniflow_index_sent = i;
+            return (protoop_arg_t) path_c;
+        }
+
+        /* Retransmit the packet from the given path, if it has room */
+        if (path_c == from_path && cwin_c > bytes_in_transit_c) {
+            bpfd->last_uniflow_index_sent = i;
+            return (protoop_arg_t) path_c;
+        }
+
+        /* Don't consider invalid paths */
+        if (!challenge_verified_c) {
+            continue;
+        }
+
+        uint64_t smoothed_rtt_c = find_smooth_rtt(bpfd, bpftd, i);
+        if (fast_path == NULL || smoothed_rtt_c < fast_rtt) {
+            fast_path = path_c;
+            fast_index = i;
+            fast_rtt = smoothed_rtt_c;
+            fast_cwin = cwin_c;
+            fast_has_room = cwin_c > bytes_in_transit_c;
+        }
+        if (cwin_c > bytes_in_transit_c && (slow_path == NULL || smoothed_rtt_c < slow_rtt)) {
+            slow_path = path_c;
+            slow_index = i;
+            slow_rtt = smoothed_rtt_c;
+            slow_room = cwin_c - bytes_in_transit_c;
+        }
+    }
+
+    uint8_t selected_uniflow_index = 255;
+    if (fast_path != NULL && fast_has_room) {
+        sending_path = fast_path;
+        selected_uniflow_index = fast_index;
+        path_reason = "ECF_FAST";
+    } else if (slow_path != NULL) {
+        /* The room of the slower path would take one RTT for the fastest path to free its window, and
+         * room / cwin more to send. Use the slower path if that is longer than its own RTT. */
+        uint64_t fast_completion = fast_rtt + ((fast_cwin > 0) ? fast_rtt * slow_room / fast_cwin : fast_rtt);
+        if (fast_path == NULL || fast_completion >= slow_rtt) {
+            sending_path = slow_path;
+            selected_uniflow_index = slow_index;
+            path_reason = "ECF_SLOW";
+        } else {
+            /* Hold the data; the window of the fastest path being full, nothing is sent until it opens */
+            sending_path = fast_path;
+            selected_uniflow_index = fast_index;
+            path_reason = "ECF_WAIT";
+        }
+    } else if (fast_path != NULL) {
+        sending_path = fast_path;
+        selected_uniflow_index = fast_index;
+        path_reason = "ECF_BLOCKED";
+    }
+
+    bpfd->last_uniflow_index_sent = selected_uniflow_index;
+    LOG {
+        size_t path_reason_len = strlen(path_reason) + 1;
+        char *p_path_reason = my_malloc(cnx, path_reason_len);
+        my_memcpy(p_path_reason, path_reason, path_reason_len);
+        LOG_EVENT(cnx, "multipath", "schedule_path", p_path_reason, "{\"sending path\": \"%p\"}", (protoop_arg_t) sending_path);
+        my_free(cnx, p_path_reason);
+    }
+    return (protoop_arg_t) sending_path;
+}
@@ -0,0 +1,126 @@
+#include "../bpf.h"
+
+/* Lowest RTT scheduler that also places the copies of the redundant stream frames kept by schedule_frames.
+ * Each copy goes on the fastest of the REDUNDANT_UNIFLOWS lowest-RTT uniflows that did not carry them yet. */
+
+static uint64_t find_smooth_rtt(bpf_data *bpfd, bpf_tuple_data *bpftd, int sending_index) {
+    /* Instead of finding the smallest RTT, just weight them by the number of packets */
+    uint64_t srtt = 0;
+    uint64_t nb_updates = 0;
+    for (int i = 0; i < bpfd->nb_receiving_proposed; i++) {
+        srtt += bpftd->tuple_stats[i][sending_index].smoothed_rtt * bpftd->tuple_stats[i][sending_index].nb_updates;
+        nb_updates += bpftd->tuple_stats[i][sending_index].nb_updates;
+    }
+    if (nb_updates == 0) return 1; /* Give a chance to be used */
+    return srtt / nb_updates;
+}
+
+protoop_arg_t schedule_path_redundant(picoquic_cnx_t *cnx) {
+    access_key_t input_aks[4] = {AK_CNX_INPUT, AK_CNX_INPUT, AK_CNX_INPUT, AK_CNX_INPUT};
+    uint16_t input_params[4] = {0, 1, 2, 3};
+    protoop_arg_t inputs[4];
+    get_cnx_fields(cnx, input_aks, input_params, 4, inputs);
+    picoquic_packet_t *retransmit_p  = (picoquic_packet_t *) inputs[0];
+    picoquic_path_t *from_path = (picoquic_path_t *) inputs[1];
+    char *reason = (char *) inputs[2];
+    int change_path = (int) inputs[3];
+    char *path_reason = "";
+
+    if (retransmit_p && from_path && reason) {
+        if (strncmp(PROTOOPID_NOPARAM_RETRANSMISSION_TIMEOUT, reason, 23) != 0 && mp_path_usable(get_bpf_data(cnx), from_path)) {
+            /* Fast retransmit or TLP, stay on the same path, unless it is unhealthy! */
+            return (protoop_arg_t) from_path;
+        }
+    }
+
+    picoquic_path_t *sending_path = (picoquic_path_t *) get_cnx(cnx, AK_CNX_PATH, 0); /* We should NEVER return NULL */
+    bpf_data *bpfd = get_bpf_data(cnx);
+    bpf_tuple_data *bpftd = get_bpf_tuple_data(cnx);
+    bpf_duplicate_data *bpfdd = get_bpf_duplicate_data(cnx);
+    uniflow_data_t *ud = NULL;
+    access_key_t path_aks[3] = {AK_PATH_CHALLENGE_VERIFIED, AK_PATH_CWIN, AK_PATH_BYTES_IN_TRANSIT};
+    protoop_arg_t path_fields[3];
+
+    /* RTT and room of the validated active uniflows, 0 RTT for the others */
+    uint64_t rtts[MAX_SENDING_UNIFLOWS];
+    int has_room[MAX_SENDING_UNIFLOWS];
+    uint8_t selected_uniflow_index = 255;
+    uint64_t selected_rtt = 0;
+
+    for (uint8_t i = 0; i < MAX_SENDING_UNIFLOWS; i++) {
+        rtts[i] = 0;
+        has_room[i] = 0;
+        if (i >= bpfd->nb_sending_proposed) {
+            continue;
+        }
+        ud = bpfd->sending_uniflows[i];
+        if (ud->state != uniflow_active || !mp_uniflow_usable(bpfd, ud)) {
+            continue;
+        }
+        get_path_fields(ud->path, path_aks, NULL, 3, path_fields);
+        has_room[i] = (uint64_t) path_fields[1] > (uint64_t) path_fields[2];
+
+        /* Path validation duplicates, as in the lowest RTT scheduler */
+        if (change_path && bpfdd->redundant_copies_left == 0 && i != bpfd->last_uniflow_index_sent) {
+            bpfd->last_uniflow_index_sent = i;
+            return (protoop_arg_t) ud->path;
+        }
+
+        /* Retransmit the packet from the given path, if it has room */
+        if (ud->path == from_path && has_room[i]) {
+            bpfd->last_uniflow_index_sent = i;
+            return (protoop_arg_t) ud->path;
+        }
+
+        if ((int) path_fields[0]) {
+            rtts[i] = find_smooth_rtt(bpfd, bpftd, i);
+        }
+    }
+
+    if (change_path && bpfdd->redundant_copies_left > 0) {
+        for (uint8_t i = 0; i < bpfd->nb_sending_proposed && i < MAX_SENDING_UNIFLOWS; i++) {
+            if (rtts[i] == 0 || !has_room[i] || (bpfdd->redundant_sent_uniflows & (1 << i))) {
+                continue;
+            }
+            /* Only the REDUNDANT_UNIFLOWS fastest uniflows carry the copies */
+            uint8_t rank = 0;
+            for (uint8_t j = 0; j < bpfd->nb_sending_proposed && j < MAX_SENDING_UNIFLOWS; j++) {
+                if (rtts[j] != 0 && (rtts[j] < rtts[i] || (rtts[j] == rtts[i] && j < i))) {
+                    rank++;
+                }
+            }
+            if (rank < REDUNDANT_UNIFLOWS && (selected_uniflow_index == 255 || rtts[i] < selected_rtt)) {
+                selected_uniflow_index = i;
+                selected_rtt = rtts[i];
+                path_reason = "REDUNDANT_COPY";
+            }
+        }
+    }
+
+    if (selected_uniflow_index == 255) {
+        for (uint8_t i = 0; i < bpfd->nb_sending_proposed && i < MAX_SENDING_UNIFLOWS; i++) {
+            if (rtts[i] == 0 || !has_room[i]) {
+                continue;
+            }
+            if (selected_uniflow_index == 255 || rtts[i] < selected_rtt) {
+                selected_uniflow_index = i;
+                selected_rtt = rtts[i];
+                path_reason = "BEST_RTT";
+            }
+        }
+    }
+
+    if (selected_uniflow_index != 255) {
+        sending_path = bpfd->sending_uniflows[selected_uniflow_index]->path;
+    }
+
+    bpfd->last_uniflow_index_sent = selected_uniflow_index;
+    LOG {
+        size_t path_reason_len = strlen(path_reason) + 1;
+        char *p_path_reason = my_malloc(cnx, path_reason_len);
+        my_memcpy(p_path_reason, path_reason, path_reason_len);
+        LOG_EVENT(cnx, "multipath", "schedule_path", p_path_reason, "{\"sending path\": \"%p\"}", (protoop_arg_t) sending_path);
+        my_free(cnx, p_path_reason);
+    }
+    return (protoop_arg_t) sending_path;
+}
@@ -6,8 +6,8 @@ protoop_arg_t schedule_path_rr(picoquic_cnx_t *cnx) {
     char *reason = (char *) get_cnx(cnx, AK_CNX_INPUT, 2);
 
     if (retransmit_p && from_path && reason) {
-        if (strncmp(PROTOOPID_NOPARAM_RETRANSMISSION_TIMEOUT, reason, 23) != 0) {
-            /* Fast retransmit or TLP, stay on the same path! */
+        if (strncmp(PROTOOPID_NOPARAM_RETRANSMISSION_TIMEOUT, reason, 23) != 0 && mp_path_usable(get_bpf_data(cnx), from_path)) {
+            /* Fast retransmit or TLP, stay on the same path, unless it is unhealthy! */
             return (protoop_arg_t) from_path;
         }
     }
@@ -27,7 +27,7 @@ protoop_arg_t schedule_path_rr(picoquic_cnx_t *cnx) {
         ud = bpfd->sending_uniflows[i];
 
         /* A (very) simple round-robin */
-        if (ud->state == uniflow_active) {
+        if (ud->state == uniflow_active && mp_uniflow_usable(bpfd, ud)) {
             path_c = ud->path;
             int challenge_verified_c = (int) get_path(path_c, AK_PATH_CHALLENGE_VERIFIED, 0);
 
@@ -13,15 +13,19 @@ static uint64_t find_smooth_rtt(bpf_data *bpfd, bpf_tuple_data *bpftd, int sendi
 }
 
 protoop_arg_t schedule_path_rtt(picoquic_cnx_t *cnx) {
-    picoquic_packet_t *retransmit_p  = (picoquic_packet_t *) get_cnx(cnx, AK_CNX_INPUT, 0);
-    picoquic_path_t *from_path = (picoquic_path_t *) get_cnx(cnx, AK_CNX_INPUT, 1);
-    char *reason = (char *) get_cnx(cnx, AK_CNX_INPUT, 2);
-    int change_path = (int) get_cnx(cnx, AK_CNX_INPUT, 3);
+    access_key_t input_aks[4] = {AK_CNX_INPUT, AK_CNX_INPUT, AK_CNX_INPUT, AK_CNX_INPUT};
+    uint16_t input_params[4] = {0, 1, 2, 3};
+    protoop_arg_t inputs[4];
+    get_cnx_fields(cnx, input_aks, input_params, 4, inputs);
+    picoquic_packet_t *retransmit_p  = (picoquic_packet_t *) inputs[0];
+    picoquic_path_t *from_path = (picoquic_path_t *) inputs[1];
+    char *reason = (char *) inputs[2];
+    int change_path = (int) inputs[3];
     char *path_reason = "";
 
     if (retransmit_p && from_path && reason) {
-        if (strncmp(PROTOOPID_NOPARAM_RETRANSMISSION_TIMEOUT, reason, 23) != 0) {
-            /* Fast retransmit or TLP, stay on the same path! */
+        if (strncmp(PROTOOPID_NOPARAM_RETRANSMISSION_TIMEOUT, reason, 23) != 0 && mp_path_usable(get_bpf_data(cnx), from_path)) {
+            /* Fast retransmit or TLP, stay on the same path, unless it is unhealthy! */
             return (protoop_arg_t) from_path;
         }
     }
@@ -34,13 +38,16 @@ protoop_arg_t schedule_path_rtt(picoquic_cnx_t *cnx) {
     uint8_t selected_uniflow_index = 255;
     uint64_t smoothed_rtt_x = 0;
     int valid = 0;
+    access_key_t path_aks[3] = {AK_PATH_CHALLENGE_VERIFIED, AK_PATH_CWIN, AK_PATH_BYTES_IN_TRANSIT};
+    protoop_arg_t path_fields[3];
 
     for (uint8_t i = 0; i < bpfd->nb_sending_proposed; i++) {
         ud = bpfd->sending_uniflows[i];
         /* Lowest RTT-based scheduler */
-        if (ud->state == uniflow_active) {
+        if (ud->state == uniflow_active && mp_uniflow_usable(bpfd, ud)) {
             path_c = ud->path;
-            int challenge_verified_c = (int) get_path(path_c, AK_PATH_CHALLENGE_VERIFIED, 0);
+            get_path_fields(path_c, path_aks, NULL, 3, path_fields);
+            int challenge_verified_c = (int) path_fields[0];
 
             /* If we want another path, ask for it now */
             if (change_path && i != bpfd->last_uniflow_index_sent) {
@@ -53,8 +60,8 @@ protoop_arg_t schedule_path_rtt(picoquic_cnx_t *cnx) {
             }
 
             /* Very important: don't go further if the cwin is exceeded! */
-            uint64_t cwin_c = (uint64_t) get_path(path_c, AK_PATH_CWIN, 0);
-            uint64_t bytes_in_transit_c = (uint64_t) get_path(path_c, AK_PATH_BYTES_IN_TRANSIT, 0);
+            uint64_t cwin_c = (uint64_t) path_fields[1];
+            uint64_t bytes_in_transit_c = (uint64_t) path_fields[2];
             if (cwin_c <= bytes_in_transit_c) {
                 continue;
             }
@@ -58,64 +58,18 @@ protoop_arg_t process_mp_ack_frame(picoquic_cnx_t *cnx)
             rs_is_path_limited = get_pkt(top_packet, AK_PKT_DELIVERED_APP_LIMITED);
         }
 
-        uint64_t range = frame->ack.first_ack_block;
-        uint64_t block_to_block;
-
-        range ++;
-
-        if (frame->ack.largest_acknowledged + 1 < range) {
-            protoop_arg_t args[2];
-            args[0] = frame->ack.largest_acknowledged;
-            args[1] = range;
-            helper_protoop_printf(cnx, "ack range error: largest=%" PRIx64 ", range=%" PRIx64, args, 2);
-            helper_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, MP_ACK_TYPE);
-            return 1;
-        }
-
-        if (helper_process_ack_range(cnx, pc, frame->ack.largest_acknowledged, range, &top_packet, current_time) != 0) {
+        /* The ranges are processed by the core, in a single call */
+        picoquic_path_ack_t path_ack;
+        my_memset(&path_ack, 0, sizeof(picoquic_path_ack_t));
+        path_ack.path_x = sending_path;
+        path_ack.pc = pc;
+        path_ack.current_time = current_time;
+        path_ack.frame_type = MP_ACK_TYPE;
+
+        if (picoquic_process_path_ack_ranges(cnx, &path_ack, &frame->ack, &top_packet) != 0) {
             return 1;
         }
 
-        if (range > 0) {
-            helper_check_spurious_retransmission(cnx, frame->ack.largest_acknowledged + 1 - range, frame->ack.largest_acknowledged, current_time, pc, sending_path);
-        }
-
-        uint64_t largest = frame->ack.largest_acknowledged;
-
-        for (int i = 0; i < frame->ack.ack_block_count; i++) {
-            /* Skip the gap */
-            block_to_block = frame->ack.ack_blocks[i].gap;
-
-            block_to_block += 1; /* add 1, since zero is ruled out by varint, see spec. */
-            block_to_block += range;
-
-            if (largest < block_to_block) {
-                PROTOOP_PRINTF(cnx, "ack gap error: largest=%" PRIx64 ", range=%" PRIx64 ", gap=%" PRIu64, largest, range, block_to_block - range);
-                helper_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, MP_ACK_TYPE);
-                return 1;
-            }
-
-            largest -= block_to_block;
-            range = frame->ack.ack_blocks[i].additional_ack_block;
-            range ++;
-            if (largest + 1 < range) {
-                protoop_arg_t args[2];
-                args[0] = largest;
-                args[1] = range;
-                helper_protoop_printf(cnx, "ack range error: largest=%" PRIx64 ", range=%" PRIx64, args, 2);
-                helper_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, MP_ACK_TYPE);
-                return 1;
-            }
-
-            if (helper_process_ack_range(cnx, pc, largest, range, &top_packet, current_time) != 0) {
-                return 1;
-            }
-
-            if (range > 0) {
-                helper_check_spurious_retransmission(cnx, largest + 1 - range, largest, current_time, pc, sending_path);
-            }
-        }
-
         if (frame->ack.is_ack_ecn && frame->ack.ecn_block && helper_process_ecn_block(cnx, frame->ack.ecn_block, pkt_ctx, sending_path)) {
             PROTOOP_PRINTF(cnx, "ecn block error\n");
             helper_connection_error(cnx, PICOQUIC_TRANSPORT_FRAME_FORMAT_ERROR, MP_ACK_TYPE);
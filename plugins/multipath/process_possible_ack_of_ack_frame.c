@@ -35,19 +35,8 @@ static int process_ack_of_ack_frame(picoquic_cnx_t* cnx, picoquic_packet_context
     /* Here, we receive an ACK for an ACK of our receive path! */
 
     if (ret == 0) {
-        /* Find the oldest ACK range, in order to calibrate the
-         * extension of the largest number to 64 bits */
         picoquic_packet_context_t *pkt_ctx = (picoquic_packet_context_t *) get_path(path_x, AK_PATH_PKT_CTX, pc);
-        picoquic_sack_item_t* first_sack = (picoquic_sack_item_t*) get_pkt_ctx(pkt_ctx, AK_PKTCTX_FIRST_SACK_ITEM);
-        picoquic_sack_item_t* target_sack = first_sack;
-        picoquic_sack_item_t* next_sack = NULL;
-        if (first_sack != NULL) {
-            next_sack = (picoquic_sack_item_t *) get_sack_item(target_sack, AK_SACKITEM_NEXT_SACK);
-        }
-        while (first_sack != NULL && next_sack != NULL) {
-            target_sack = next_sack;
-            next_sack = (picoquic_sack_item_t *) get_sack_item(target_sack, AK_SACKITEM_NEXT_SACK);
-        }
+        picoquic_sack_list_t* sacks = (picoquic_sack_list_t*) get_pkt_ctx(pkt_ctx, AK_PKTCTX_SACK_LIST);
         size_t byte_index = *consumed;
 
         /* Process each successive range */
@@ -79,7 +68,7 @@ static int process_ack_of_ack_frame(picoquic_cnx_t* cnx, picoquic_packet_context
             }
 
             if (range > 0) {
-                helper_process_ack_of_ack_range(cnx, first_sack, largest + 1 - range, largest);
+                helper_process_ack_of_ack_range(cnx, sacks, largest + 1 - range, largest);
             }
 
             if (num_block-- == 0)
@@ -216,6 +216,12 @@ protoop_arg_t set_nxt_wake_time(picoquic_cnx_t *cnx)
 
     manage_paths(cnx);
 
+    if (mp_update_uniflows_health(cnx, bpfd, current_time)) {
+        blocked = 0;
+        bpfd->next_sending_uniflow = NULL;
+        reason = "Uniflow suspect";
+    }
+
     if (cnx_state == picoquic_state_disconnecting || cnx_state == picoquic_state_handshake_failure || cnx_state == picoquic_state_closing_received) {
         blocked = 0;
         bpfd->next_sending_uniflow = bpfd->sending_uniflows[0];
@@ -226,6 +232,16 @@ protoop_arg_t set_nxt_wake_time(picoquic_cnx_t *cnx)
     int nb_rcv_uniflows = get_nb_uniflows(bpfd, false);
     picoquic_path_t *path_x = NULL;
 
+    /* Send the RTT probes first, the other packets would delay them */
+    for (int i = 0; blocked != 0 && i < nb_snd_uniflows; i++) {
+        path_x = get_sending_path(cnx, bpfd, i, &ud);
+        if (ud->state == uniflow_active && ud->rtt_probe_ready) {
+            blocked = 0;
+            bpfd->next_sending_uniflow = ud;
+            reason = "RTT probe to send";
+        }
+    }
+
     /* If any receive path requires path response, do it now! */
     for (int i = 0; blocked != 0 && i < nb_rcv_uniflows; i++) {
         path_x = get_receiving_path(cnx, bpfd, i, &ud);
@@ -276,7 +292,7 @@ protoop_arg_t set_nxt_wake_time(picoquic_cnx_t *cnx)
                 }
             }
 
-            if (blocked != 0) {
+            if (blocked != 0 && mp_uniflow_usable(bpfd, ud)) {
                 uint64_t cwin_x = (uint64_t) get_path(path_x, AK_PATH_CWIN, 0);
                 uint64_t bytes_in_transit_x = (uint64_t) get_path(path_x, AK_PATH_BYTES_IN_TRANSIT, 0);
                 int is_validated = get_path(path_x, AK_PATH_CHALLENGE_VERIFIED, 0);
@@ -418,6 +434,20 @@ protoop_arg_t set_nxt_wake_time(picoquic_cnx_t *cnx)
             }
         }
 
+        /* Consider the health of the sending uniflows */
+        for (int i = 0; i < nb_snd_uniflows; i++) {
+            path_x = get_sending_path(cnx, bpfd, i, &ud);
+            if (ud->state != uniflow_active || ud->rtt_probe_ready || get_path(path_x, AK_PATH_CHALLENGE_VERIFIED, 0) == 0) {
+                continue;
+            }
+            uint64_t health_time = (ud->health == uniflow_healthy) ? mp_uniflow_suspect_time(ud) : mp_uniflow_probe_time(ud);
+            if (health_time < next_time) {
+                next_time = health_time;
+                bpfd->next_sending_uniflow = NULL;
+                reason = "Uniflow health check";
+            }
+        }
+
         /* Consider keep alive */
         uint64_t keep_alive_interval = (uint64_t) get_cnx(cnx, AK_CNX_KEEP_ALIVE_INTERVAL, 0);
         if (keep_alive_interval != 0 && next_time > (latest_progress_time + keep_alive_interval)) {
@@ -5,12 +5,16 @@
  */
 protoop_arg_t update_rtt(picoquic_cnx_t *cnx)
 {
-    uint64_t largest = (uint64_t) get_cnx(cnx, AK_CNX_INPUT, 0);
-    uint64_t current_time = (uint64_t) get_cnx(cnx, AK_CNX_INPUT, 1);
-    uint64_t ack_delay = (uint64_t) get_cnx(cnx, AK_CNX_INPUT, 2);
-    picoquic_packet_context_enum pc = (picoquic_packet_context_enum) get_cnx(cnx, AK_CNX_INPUT, 3);
-    picoquic_path_t *sending_path = (picoquic_path_t *) get_cnx(cnx, AK_CNX_INPUT, 4);
-    picoquic_path_t *receiving_path = (picoquic_path_t *) get_cnx(cnx, AK_CNX_INPUT, 5);
+    access_key_t input_aks[6] = {AK_CNX_INPUT, AK_CNX_INPUT, AK_CNX_INPUT, AK_CNX_INPUT, AK_CNX_INPUT, AK_CNX_INPUT};
+    uint16_t input_params[6] = {0, 1, 2, 3, 4, 5};
+    protoop_arg_t inputs[6];
+    get_cnx_fields(cnx, input_aks, input_params, 6, inputs);
+    uint64_t largest = (uint64_t) inputs[0];
+    uint64_t current_time = (uint64_t) inputs[1];
+    uint64_t ack_delay = (uint64_t) inputs[2];
+    picoquic_packet_context_enum pc = (picoquic_packet_context_enum) inputs[3];
+    picoquic_path_t *sending_path = (picoquic_path_t *) inputs[4];
+    picoquic_path_t *receiving_path = (picoquic_path_t *) inputs[5];
     int receiving_uniflow_index = -1;
     int is_new_ack = 0;
 
@@ -31,6 +35,15 @@ protoop_arg_t update_rtt(picoquic_cnx_t *cnx)
         set_pkt_ctx(pkt_ctx, AK_PKTCTX_HIGHEST_ACKNOWLEDGED, largest);
         is_new_ack = 1;
 
+        /* The uniflow delivers, whatever its health was */
+        uniflow_data_t *sending_ud = mp_get_sending_uniflow_data(bpfd, sending_path);
+        if (sending_ud != NULL) {
+            sending_ud->last_ack_time = current_time;
+            if (sending_ud->health != uniflow_healthy) {
+                mp_uniflow_set_health(cnx, sending_ud, uniflow_healthy);
+            }
+        }
+
         if (ack_delay < PICOQUIC_ACK_DELAY_MAX) {
             /* if the ACK is reasonably recent, use it to update the RTT */
             /* find the stored copy of the largest acknowledged packet */
@@ -61,10 +74,14 @@ protoop_arg_t update_rtt(picoquic_cnx_t *cnx)
                 }
                 set_cnx(cnx, AK_CNX_LATEST_PROGRESS_TIME, 0, current_time);
 
-                if (rtt_estimate > 0) {
+                /* Packets expired by a suspect uniflow have no send time left */
+                if (rtt_estimate > 0 && send_time != 0) {
                     picoquic_path_t * old_sending_path = (picoquic_path_t *) get_pkt(packet, AK_PKT_SEND_PATH);
                     int old_sending_uniflow_index = mp_get_uniflow_index_from_path(bpfd, true, old_sending_path);
-                    uint64_t old_max_ack_delay = (uint64_t) get_path(old_sending_path, AK_PATH_MAX_ACK_DELAY, 0);
+                    access_key_t rtt_aks[4] = {AK_PATH_MAX_ACK_DELAY, AK_PATH_SMOOTHED_RTT, AK_PATH_RTT_VARIANT, AK_PATH_RTT_MIN};
+                    protoop_arg_t rtt_fields[4];
+                    get_path_fields(old_sending_path, rtt_aks, NULL, 4, rtt_fields);
+                    uint64_t old_max_ack_delay = (uint64_t) rtt_fields[0];
 
                     if (ack_delay > old_max_ack_delay) {
                         set_path(old_sending_path, AK_PATH_MAX_ACK_DELAY, 0, ack_delay);
@@ -114,8 +131,8 @@ protoop_arg_t update_rtt(picoquic_cnx_t *cnx)
                     }
 
                     /* And still keep the old code */
-                    uint64_t old_smoothed_rtt = (uint64_t) get_path(old_sending_path, AK_PATH_SMOOTHED_RTT, 0);
-                    uint64_t old_rtt_variant = (uint64_t) get_path(old_sending_path, AK_PATH_RTT_VARIANT, 0);
+                    uint64_t old_smoothed_rtt = (uint64_t) rtt_fields[1];
+                    uint64_t old_rtt_variant = (uint64_t) rtt_fields[2];
                     if (old_smoothed_rtt == PICOQUIC_INITIAL_RTT && old_rtt_variant == 0) {
                         set_path(old_sending_path, AK_PATH_SMOOTHED_RTT, 0, rtt_estimate);
                         set_path(old_sending_path, AK_PATH_RTT_VARIANT, 0, rtt_estimate / 2);
@@ -139,7 +156,7 @@ protoop_arg_t update_rtt(picoquic_cnx_t *cnx)
                         }
                         set_path(old_sending_path, AK_PATH_RTT_VARIANT, 0, old_rtt_variant + (delta_rtt_average) / 4);
 
-                        uint64_t old_rtt_min = get_path(old_sending_path, AK_PATH_RTT_MIN, 0);
+                        uint64_t old_rtt_min = (uint64_t) rtt_fields[3];
                         if (rtt_estimate < (int64_t)old_rtt_min) {
                             set_path(old_sending_path, AK_PATH_RTT_MIN, 0, rtt_estimate);
 
@@ -14,6 +14,17 @@
 #define QLOG_N_END_CHARS 4
 #define QLOG_END_CHARS "]}]}"
 
+/* Binary mode, see qlog_convert.py. The file is a sequence of qlog_record_t, each one followed by length bytes.
+ * It starts with a trace record, strings are interned and announced by a string record before their first use. */
+#define QLOG_RECORD_TRACE 0x01  /* time is the reference time, flags is 1 for the client */
+#define QLOG_RECORD_STRING 0x02 /* strings[0] is the id of the string that follows */
+#define QLOG_RECORD_EVENT 0x03  /* strings holds the ids of the fields, the data of the event follows */
+#define QLOG_RECORD_END 0x04    /* the ODCID follows */
+#define QLOG_BINARY_MAGIC 0x51424c47
+#define QLOG_BUFFER_SIZE 2048   /* fits in one block of plugin memory */
+#define QLOG_STRING_SLOTS 128   /* the ids are the slots plus one, 0 is the NULL string */
+#define QLOG_MAX_STRINGS 96     /* the table is emptied past this load, the ids are then announced again */
+
 typedef struct st_qlog_ctx_t {
     char *ctx;
     struct st_qlog_ctx_t *next;
@@ -40,6 +51,21 @@ typedef struct st_qlog_header_t {
     char *event_fields[QLOG_N_EVENT_FIELDS];
 } qlog_hdr_t;
 
+typedef struct st_qlog_record_t {
+    uint64_t time;
+    uint16_t strings[QLOG_N_EVENT_FIELDS - 2];
+    uint16_t length;
+    uint8_t type;
+    uint8_t flags;
+    uint32_t magic;
+} qlog_record_t;
+
+typedef struct st_qlog_strings_t {
+    uint16_t count;
+    uint32_t hashes[QLOG_STRING_SLOTS];
+    char *strings[QLOG_STRING_SLOTS];
+} qlog_strings_t;
+
 typedef struct st_qlog_t {
     int fd;
     qlog_hdr_t hdr;
@@ -50,6 +76,11 @@ typedef struct st_qlog_t {
     qlog_frames_t *frames_tail;
     bool wrote_hdr;
     bool wrote_event;
+    bool binary;
+    uint16_t ctx_string;  /* id of the current context in binary mode, 0 if it must be interned again */
+    uint16_t buffer_len;
+    uint8_t *buffer;
+    qlog_strings_t *strings;
     picoquic_packet_header pkt_hdr;
 } qlog_t;
 
@@ -73,6 +104,7 @@ static __attribute__((always_inline)) void push_ctx(picoquic_cnx_t *cnx, qlog_t
         e->next = q->top;
         e->ctx = ctx;
         q->top = e;
+        q->ctx_string = 0;
     }
 }
 
@@ -83,6 +115,7 @@ static __attribute__((always_inline)) char * pop_ctx(picoquic_cnx_t *cnx, qlog_t
         q->top = e->next;
         ctx = e->ctx;
         my_free(cnx, e);
+        q->ctx_string = 0;
     }
     return ctx;
 }
@@ -117,6 +150,119 @@ static __attribute__((always_inline)) void free_event(picoquic_cnx_t *cnx, qlog_
     my_free(cnx, e);
 }
 
+/* Through the log flusher of the context when there is one, so that the disk does not stall the connection */
+static __attribute__((always_inline)) void write_log(picoquic_cnx_t *cnx, int fd, const void *bytes, size_t len, int close_fd) {
+    protoop_arg_t args[4];
+    args[0] = (protoop_arg_t) fd;
+    args[1] = (protoop_arg_t) bytes;
+    args[2] = (protoop_arg_t) len;
+    args[3] = (protoop_arg_t) close_fd;
+    run_noparam(cnx, PROTOOPID_NOPARAM_WRITE_LOG, 4, args, NULL);
+}
+
+static __attribute__((always_inline)) void flush_buffer(picoquic_cnx_t *cnx, qlog_t *q) {
+    if (q->buffer_len) {
+        write_log(cnx, q->fd, q->buffer, q->buffer_len, 0);
+    }
+    q->buffer_len = 0;
+}
+
+static __attribute__((always_inline)) void buffer_append(picoquic_cnx_t *cnx, qlog_t *q, const void *bytes, size_t len) {
+    if (q->buffer_len + len > QLOG_BUFFER_SIZE) {
+        flush_buffer(cnx, q);
+    }
+    if (len > QLOG_BUFFER_SIZE) {
+        write_log(cnx, q->fd, bytes, len, 0);
+    } else {
+        my_memcpy(q->buffer + q->buffer_len, bytes, len);
+        q->buffer_len += len;
+    }
+}
+
+static __attribute__((always_inline)) void buffer_append_record(picoquic_cnx_t *cnx, qlog_t *q, uint8_t type, uint64_t time, uint16_t *strings, const void *bytes, uint16_t len) {
+    qlog_record_t r;
+    my_memset(&r, 0, sizeof(qlog_record_t));
+    r.type = type;
+    r.time = time;
+    r.length = len;
+    if (strings) {
+        my_memcpy(r.strings, strings, sizeof(r.strings));
+    }
+    buffer_append(cnx, q, &r, sizeof(qlog_record_t));
+    if (len) {
+        buffer_append(cnx, q, bytes, len);
+    }
+}
+
+static __attribute__((always_inline)) void free_strings(picoquic_cnx_t *cnx, qlog_t *q) {
+    for (int i = 0; i < QLOG_STRING_SLOTS; i++) {
+        if (q->strings->strings[i]) {
+            my_free(cnx, q->strings->strings[i]);
+        }
+    }
+    my_memset(q->strings, 0, sizeof(qlog_strings_t));
+    q->ctx_string = 0;
+}
+
+/* Returns the id of the string, which is announced with a string record when it is new, or 0 if it cannot be interned.
+ * The table must have a free slot. */
+static __attribute__((always_inline)) uint16_t intern_string(picoquic_cnx_t *cnx, qlog_t *q, char *str) {
+    if (!str) {
+        return 0;
+    }
+    uint32_t hash = 2166136261u;
+    size_t len = 0;
+    while (str[len]) {
+        hash = (hash ^ (uint8_t) str[len]) * 16777619u;
+        len++;
+    }
+    uint32_t slot = hash % QLOG_STRING_SLOTS;
+    while (q->strings->strings[slot]) {
+        if (q->strings->hashes[slot] == hash && strcmp(q->strings->strings[slot], str) == 0) {
+            return slot + 1;
+        }
+        slot = (slot + 1) % QLOG_STRING_SLOTS;
+    }
+    char *copy = my_malloc(cnx, len + 1);
+    if (!copy) {
+        return 0;
+    }
+    my_memcpy(copy, str, len + 1);
+    q->strings->strings[slot] = copy;
+    q->strings->hashes[slot] = hash;
+    q->strings->count++;
+    uint16_t id = slot + 1;
+    buffer_append_record(cnx, q, QLOG_RECORD_STRING, 0, &id, str, len);
+    return id;
+}
+
+static __attribute__((always_inline)) void append_binary_event(picoquic_cnx_t *cnx, qlog_t *q, uint64_t absolute_time, char **fields) {
+    uint16_t strings[QLOG_N_EVENT_FIELDS - 2];
+    if (q->strings->count + QLOG_N_EVENT_FIELDS - 2 > QLOG_MAX_STRINGS) {
+        /* Not in the middle of an event, whose ids would be reused */
+        free_strings(cnx, q);
+    }
+    for (int i = 0; i < QLOG_N_EVENT_FIELDS - 3; i++) {
+        strings[i] = intern_string(cnx, q, fields[i]);
+    }
+    if (fields[QLOG_N_EVENT_FIELDS - 3]) {
+        strings[QLOG_N_EVENT_FIELDS - 3] = intern_string(cnx, q, fields[QLOG_N_EVENT_FIELDS - 3]);
+    } else {
+        /* The context only changes when it is pushed or popped, it is not formatted for each event */
+        if (!q->ctx_string) {
+            char *ctx = format_ctx(cnx, q);
+            q->ctx_string = intern_string(cnx, q, ctx);
+            if (ctx) {
+                my_free(cnx, ctx);
+            }
+        }
+        strings[QLOG_N_EVENT_FIELDS - 3] = q->ctx_string;
+    }
+    char *data = fields[QLOG_N_EVENT_FIELDS - 2];
+    buffer_append_record(cnx, q, QLOG_RECORD_EVENT, absolute_time - q->hdr.reference_time, strings, data, data ? strlen(data) : 0);
+    q->wrote_event = true;
+}
+
 static __attribute__((always_inline)) void append_event(qlog_t *q, uint64_t absolute_time, char **fields) {
     if (q->wrote_hdr || q->wrote_event) {
         lseek(q->fd, -QLOG_N_END_CHARS, SEEK_END);
@@ -145,6 +291,32 @@ static void write_header(picoquic_cnx_t *cnx, qlog_t *q) {
     }
 }
 
+static void write_binary_header(picoquic_cnx_t *cnx, qlog_t *q) {
+    qlog_record_t r;
+    my_memset(&r, 0, sizeof(qlog_record_t));
+    r.type = QLOG_RECORD_TRACE;
+    r.time = q->hdr.reference_time;
+    r.flags = strcmp(q->hdr.vantage_point, QLOG_VANTAGE_POINT_CLIENT) == 0;
+    r.magic = QLOG_BINARY_MAGIC;
+    buffer_append(cnx, q, &r, sizeof(qlog_record_t));
+    q->wrote_hdr = true;
+
+    while (q->head) {
+        qlog_event_t *e = q->head;
+        append_binary_event(cnx, q, e->reference_time, e->fields);
+        q->head = e->next;
+        free_event(cnx, e);
+    }
+}
+
+static void write_binary_trailer(picoquic_cnx_t *cnx, qlog_t *q) {
+    buffer_append_record(cnx, q, QLOG_RECORD_END, 0, NULL, q->hdr.odcid.id, q->hdr.odcid.id_len);
+    /* Closed once the trace is written */
+    write_log(cnx, q->fd, q->buffer, q->buffer_len, 1);
+    q->buffer_len = 0;
+    free_strings(cnx, q);
+}
+
 static void write_trailer(picoquic_cnx_t *cnx, qlog_t *q) {
     lseek(q->fd, -(QLOG_N_END_CHARS + q->wrote_event), SEEK_END);
     char *id_str = my_malloc(cnx, (sizeof(char) * (q->hdr.odcid.id_len * 2)) + sizeof(char));
@@ -24,8 +24,12 @@ protoop_arg_t state_changed(picoquic_cnx_t *cnx)
         }
 
         if (state == picoquic_state_disconnected) {
-            write_trailer(cnx, qlog);
-            close(qlog->fd);
+            if (qlog->binary) {
+                write_binary_trailer(cnx, qlog);
+            } else {
+                write_trailer(cnx, qlog);
+                close(qlog->fd);
+            }
         }
     }
     return 0;
@@ -36,6 +36,8 @@ protoop_arg_t log_event(picoquic_cnx_t *cnx) {
             qlog->tail->next = e;
         }
         qlog->tail = e;
+    } else if (qlog->binary) {
+        append_binary_event(cnx, qlog, now, fields);
     } else {
         bool generate_context = !fields[3];
         if (generate_context) {
@@ -0,0 +1,35 @@
+#include "bpf.h"
+
+/**
+ * Writes the trace in the binary format, to be converted to JSON by qlog_convert.py
+ *
+ * Input: None
+ *
+ * Output: None
+ */
+protoop_arg_t set_binary_output_file(picoquic_cnx_t *cnx)
+{
+    qlog_t *qlog = get_qlog_t(cnx);
+    if (qlog->fd == -1) {
+        qlog->buffer = my_malloc(cnx, QLOG_BUFFER_SIZE);
+        qlog->strings = my_malloc(cnx, sizeof(qlog_strings_t));
+        if (!qlog->buffer || !qlog->strings) {
+            if (qlog->buffer) {
+                my_free(cnx, qlog->buffer);
+                qlog->buffer = NULL;
+            }
+            if (qlog->strings) {
+                my_free(cnx, qlog->strings);
+                qlog->strings = NULL;
+            }
+            return 0;
+        }
+        my_memset(qlog->strings, 0, sizeof(qlog_strings_t));
+        qlog->binary = true;
+        qlog->fd = (int) get_cnx(cnx, AK_CNX_INPUT, 0);
+        qlog->hdr.reference_time = qlog->head ? qlog->head->reference_time : picoquic_current_time();
+        qlog->hdr.vantage_point = get_cnx(cnx, AK_CNX_CLIENT_MODE, 0) ? QLOG_VANTAGE_POINT_CLIENT : QLOG_VANTAGE_POINT_SERVER;
+        write_binary_header(cnx, qlog);
+    }
+    return 0;
+}
\ No newline at end of file
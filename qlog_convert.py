@@ -0,0 +1,77 @@
+import json
+import struct
+import sys
+
+# Converts a trace written by the set_qlog_binary_file operation of the qlog plugin to the qlog JSON it writes
+# with set_qlog_file. The format of the records is described in plugins/qlog/bpf.h.
+
+if len(sys.argv) < 3:
+    print('Usage: %s binary_trace_file output.qlog' % sys.argv[0])
+    exit(-1)
+
+RECORD = struct.Struct('<Q4HHBBI')
+RECORD_TRACE, RECORD_STRING, RECORD_EVENT, RECORD_END = 0x01, 0x02, 0x03, 0x04
+BINARY_MAGIC = 0x51424c47
+EVENT_FIELDS = ["relative_time", "category", "event_type", "trigger", "context", "data"]
+
+
+def raw_json(s):
+    # The context and the data are JSON objects, as in the text trace
+    try:
+        return json.loads(s)
+    except ValueError:
+        return s
+
+
+with open(sys.argv[1], 'rb') as f:
+    trace = f.read()
+
+strings = {0: None}
+events = []
+vantage_point = None
+reference_time = 0
+odcid = ''
+offset = 0
+while offset + RECORD.size <= len(trace):
+    time, category, event_type, trigger, context, length, record_type, flags, magic = RECORD.unpack_from(trace, offset)
+    offset += RECORD.size
+    payload = trace[offset:offset + length]
+    offset += length
+
+    if record_type == RECORD_TRACE:
+        if magic != BINARY_MAGIC:
+            print('%s is not a binary qlog trace' % sys.argv[1])
+            exit(-1)
+        vantage_point = 'client' if flags else 'server'
+        reference_time = time
+    elif record_type == RECORD_STRING:
+        strings[category] = payload.decode()  # The ids of the table are reused once it has been emptied
+    elif record_type == RECORD_EVENT:
+        ctx = strings[context]
+        events.append([time, strings[category], strings[event_type], strings[trigger],
+                       raw_json(ctx) if ctx is not None else {}, raw_json(payload.decode())])
+    elif record_type == RECORD_END:
+        odcid = payload.hex()
+
+if vantage_point is None:
+    print('%s is not a binary qlog trace' % sys.argv[1])
+    exit(-1)
+
+qlog = {
+    'qlog_version': 'draft-01',
+    'title': '',
+    'description': '',
+    'summary': {},
+    'traces': [{
+        'vantage_point': {'type': vantage_point, 'name': ''},
+        'title': '',
+        'description': '',
+        'events': events,
+        'configuration': {'time_offset': 0, 'time_units': 'us'},
+        'common_fields': {'group_id': odcid, 'ODCID': odcid, 'reference_time': reference_time},
+        'event_fields': EVENT_FIELDS,
+    }],
+}
+
+with open(sys.argv[2], 'w') as f:
+    json.dump(qlog, f)